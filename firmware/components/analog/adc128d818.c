@@ -118,3 +118,38 @@ bool adc_read_word(uint8_t reg_addr, uint16_t* reg_data)
 	*reg_data = ((buf[0] << 8) | buf[1]) >> 4; /* I dunno why, but TI put the 12-bits in the top */
 	return true;
 }
+
+
+/**
+ * Read n consecutive 16-bit ADC registers starting at reg_addr in one I2C transaction
+ * (the ADC doesn't auto-increment its address pointer so each register is addressed
+ * with a repeated start) - data is returned in the low 12-bits
+ */
+bool adc_read_words(uint8_t reg_addr, int n, uint16_t* reg_data)
+{
+	uint8_t regs[ADC_MAX_BATCH_REGS];
+	uint8_t buf[ADC_MAX_BATCH_REGS*2];
+	int i;
+	
+	if (n > ADC_MAX_BATCH_REGS) {
+		ESP_LOGE(TAG, "can't read %d registers at once", n);
+		return false;
+	}
+	
+	for (i=0; i<n; i++) {
+		regs[i] = reg_addr + i;
+	}
+	
+	i2c_lock();
+	if (i2c_master_read_slave_regs(ADC_I2C_ADDR, regs, n, buf, 2) != ESP_OK) {
+		i2c_unlock();
+		ESP_LOGE(TAG, "failed to read from word registers %02x-%02x", reg_addr, reg_addr + n - 1);
+		return false;
+	}
+	i2c_unlock();
+	
+	for (i=0; i<n; i++) {
+		reg_data[i] = ((buf[2*i] << 8) | buf[2*i + 1]) >> 4;
+	}
+	return true;
+}
@@ -51,6 +51,12 @@
 #define ADC_CH_STAT1_REG      (ADC_CH_BASE_REG + 4)
 #define ADC_CH_T_REG          (ADC_CH_BASE_REG + 5)
 
+// Limit alerts: the power button channel above PWR_BTN_THRESHOLD and the battery channel
+// at or below BATT_CRIT_THRESHOLD.  INT mask bits are set to disable a channel's alert.
+#define ADC_CH_BTN            0
+#define ADC_CH_BATT           2
+#define ADC_INT_MASK          ((uint8_t) ~((1 << ADC_CH_BTN) | (1 << ADC_CH_BATT)))
+
 // cur_adc_vals indexes
 #define ADC_CUR_BTN_I         0
 #define ADC_CUR_STAT2_I       1
@@ -62,6 +68,19 @@
 // External voltage reference value
 #define ADC_EXT_VREF_V        2.048
 
+// Conversions work in 0.1 mV units at the ADC input pin
+#define ADC_EXT_VREF_MV10     20480
+#define ADC_V_2_MV10(v)       ((int32_t) ((v) * 10000.0 + 0.5))
+
+// Battery divider multiplier in 1/1000 units
+#define BATT_ADC_MULT_1000    ((int32_t) (BATT_ADC_MULT * 1000.0 + 0.5))
+
+// LMT86 conversion table: temperature (C * 100) at every ADC_TEMP_LUT_STEP ADC counts,
+// interpolated between entries
+#define ADC_TEMP_LUT_SHIFT    4
+#define ADC_TEMP_LUT_STEP     (1 << ADC_TEMP_LUT_SHIFT)
+#define ADC_TEMP_LUT_LEN      ((4096 >> ADC_TEMP_LUT_SHIFT) + 1)
+
 // Uncomment to use the LM36 temperature sensor instead of the LMT86
 #define ADC_USE_LM36
 
@@ -69,6 +88,19 @@
 //#define ADC_DEBUG
 
 
+//
+// ADC Utilities typedefs
+//
+
+// Moving average of the last n samples kept as a running sum
+typedef struct {
+	uint16_t* buf;
+	int n;
+	int index;
+	uint32_t sum;
+} adc_filter_t;
+
+
 //
 // ADC Utilities Variables
 //
@@ -86,16 +118,22 @@ static bool power_button_pressed;
 static SemaphoreHandle_t power_button_mutex;
 
 
-// Averaging arrays
+// Averaging filters
 static uint16_t batt_average_array[NUM_BATT_SAMPLES];
-static int batt_average_index;
+static adc_filter_t batt_filter = {batt_average_array, NUM_BATT_SAMPLES, 0, 0};
 
 static uint16_t temp_average_array[NUM_TEMP_SAMPLES];
-static int temp_average_index;
+static adc_filter_t temp_filter = {temp_average_array, NUM_TEMP_SAMPLES, 0, 0};
 
 static uint16_t stat1_average_array[NUM_STAT_SAMPLES];
+static adc_filter_t stat1_filter = {stat1_average_array, NUM_STAT_SAMPLES, 0, 0};
+
 static uint16_t stat2_average_array[NUM_STAT_SAMPLES];
-static int stat_average_index;
+static adc_filter_t stat2_filter = {stat2_average_array, NUM_STAT_SAMPLES, 0, 0};
+
+#ifndef ADC_USE_LM36
+static int16_t temp_lut[ADC_TEMP_LUT_LEN];
+#endif
 
 // Power button state
 static bool power_button_cur;         // Current button reading
@@ -105,20 +143,28 @@ static bool power_button_prev;        // Previous button reading
 static uint16_t cur_adc_vals[ADC_NUM_VALID_CH];
 
 #ifdef ADC_DEBUG
-float temp_v;
+int32_t temp_mv10;
 #endif
 
 //
 // ADC Utilities Forward Declarations for internal functions
 //
 void adc_read_channels();
-bool adc_val_greater_than_threshold(uint16_t adc_val, float threshold);
-uint16_t compute_average(uint16_t* buf, int n);
+bool adc_val_greater_than_threshold(uint16_t adc_val, int32_t threshold_mv10);
+void filter_init(adc_filter_t* f, uint16_t v);
+void filter_push(adc_filter_t* f, uint16_t v);
+uint16_t filter_average(adc_filter_t* f);
 void update_battery_info();
 void update_temp_info();
 void update_button_info();
-float adc_2_volts(uint16_t adc_val);
-float adc_2_temp(uint16_t adc_val);
+int32_t adc_2_mv10(uint16_t adc_val);
+int32_t adc_2_temp_c100(uint16_t adc_val);
+#ifndef ADC_USE_LM36
+void init_temp_lut();
+#endif
+#ifdef ADC_INT_IO
+uint8_t volts_2_adc_limit(float v);
+#endif
 
 
 
@@ -170,7 +216,16 @@ bool adc_init()
 	adc_write_byte(ADC_CONV_REG, ADC_CONV_EN);
 	adc_write_byte(ADC_CH_DIS_REG, ADC_CH_DIS_MASK);
 	adc_write_byte(ADC_ACFG_REG, ADC_ACFG_EXT_REF_MASK | ADC_ACFG_MODE1_MASK);
+#ifdef ADC_INT_IO
+	adc_write_byte(ADC_LIM_HIGH_REG(ADC_CH_BTN), volts_2_adc_limit(PWR_BTN_THRESHOLD));
+	adc_write_byte(ADC_LIM_LOW_REG(ADC_CH_BTN), 0x00);
+	adc_write_byte(ADC_LIM_HIGH_REG(ADC_CH_BATT), 0xFF);
+	adc_write_byte(ADC_LIM_LOW_REG(ADC_CH_BATT), volts_2_adc_limit(BATT_CRIT_THRESHOLD / BATT_ADC_MULT));
+	adc_write_byte(ADC_INT_MASK_REG, ADC_INT_MASK);
+	adc_write_byte(ADC_CFG_REG, ADC_CFG_START_MASK | ADC_CFG_INT_EN_MASK);  /* Enable ADC and INT */
+#else
 	adc_write_byte(ADC_CFG_REG, ADC_CFG_START_MASK);  /* Enable ADC after configuration */
+#endif
 	
 	// Wait to allow it to make an initial set of measurements
 	vTaskDelay(pdMS_TO_TICKS(100));
@@ -178,20 +233,14 @@ bool adc_init()
 	// Read active ADC channels
 	adc_read_channels();
 	
-	// Initialize our averaging arrays
-	for (u8=0; u8<NUM_BATT_SAMPLES; u8++) {
-		batt_average_array[u8] = cur_adc_vals[ADC_CUR_BATT_I];
-	}
-	batt_average_index = 0;
-	for (u8=0; u8<NUM_TEMP_SAMPLES; u8++) {
-		temp_average_array[u8] = cur_adc_vals[ADC_CUR_T_I];
-	}
-	temp_average_index = 0;
-	for (u8=0; u8<NUM_STAT_SAMPLES; u8++) {
-		stat1_average_array[u8] = cur_adc_vals[ADC_CUR_STAT1_I];
-		stat2_average_array[u8] = cur_adc_vals[ADC_CUR_STAT2_I];
-	}
-	stat_average_index = 0;
+	// Initialize our averaging filters
+	filter_init(&batt_filter, cur_adc_vals[ADC_CUR_BATT_I]);
+	filter_init(&temp_filter, cur_adc_vals[ADC_CUR_T_I]);
+	filter_init(&stat1_filter, cur_adc_vals[ADC_CUR_STAT1_I]);
+	filter_init(&stat2_filter, cur_adc_vals[ADC_CUR_STAT2_I]);
+#ifndef ADC_USE_LM36
+	init_temp_lut();
+#endif
 	
 	// Assume power button is depressed from startup here
 	power_button_prev = true;
@@ -212,19 +261,22 @@ bool adc_init()
  */
 void adc_update()
 {
-	// Get current data from the ADC
-	adc_read_channels();
+#ifdef ADC_INT_IO
+	uint8_t u8;
 	
-	// Push the latest value into our averaging arrays
-	batt_average_array[batt_average_index++] = cur_adc_vals[ADC_CUR_BATT_I];
-	if (batt_average_index >= NUM_BATT_SAMPLES) batt_average_index = 0;
+	// Reading the status releases INT.  It is raised again after the next conversion of a
+	// channel still outside its limit.
+	(void) adc_read_byte(ADC_INT_STATUS_REG, &u8);
+#endif
 	
-	temp_average_array[temp_average_index++] = cur_adc_vals[ADC_CUR_T_I];
-	if (temp_average_index >= NUM_TEMP_SAMPLES) temp_average_index = 0;
+	// Get current data from the ADC
+	adc_read_channels();
 	
-	stat1_average_array[stat_average_index] = cur_adc_vals[ADC_CUR_STAT1_I];
-	stat2_average_array[stat_average_index++] = cur_adc_vals[ADC_CUR_STAT2_I];
-	if (stat_average_index >= NUM_STAT_SAMPLES) stat_average_index = 0;
+	// Push the latest value into our averaging filters
+	filter_push(&batt_filter, cur_adc_vals[ADC_CUR_BATT_I]);
+	filter_push(&temp_filter, cur_adc_vals[ADC_CUR_T_I]);
+	filter_push(&stat1_filter, cur_adc_vals[ADC_CUR_STAT1_I]);
+	filter_push(&stat2_filter, cur_adc_vals[ADC_CUR_STAT2_I]);
 	
 	// Update system values
 	update_battery_info();
@@ -234,9 +286,9 @@ void adc_update()
 #ifdef ADC_DEBUG
 	static int count = 0;
 	if ((++count % 15) == 0) {
-		printf("bv = %1.2f bs = %d cs = %d t = %2.2f (%1.3f) btn = %d\n", 
+		printf("bv = %1.2f bs = %d cs = %d t = %2.2f (%1.4f) btn = %d\n", 
 			   batt_status.batt_voltage, batt_status.batt_state, batt_status.charge_state,
-			   temp_value, temp_v, power_button_pressed);
+			   temp_value, temp_mv10 / 10000.0, power_button_pressed);
 	}
 #endif
 }
@@ -289,49 +341,62 @@ bool adc_button_pressed()
 //
 
 /**
- * Read active ADC channels into a local array
+ * Read active ADC channels into a local array in one I2C transaction.  The previous
+ * values are kept if the read fails.
  */
 void adc_read_channels()
 {
+	uint16_t vals[ADC_NUM_VALID_CH];
 	int i;
 	
-	for (i=0; i<ADC_NUM_VALID_CH; i++) {
-		adc_read_word(ADC_CH_BASE_REG + i, &cur_adc_vals[i]);
+	if (adc_read_words(ADC_CH_BASE_REG, ADC_NUM_VALID_CH, vals)) {
+		for (i=0; i<ADC_NUM_VALID_CH; i++) {
+			cur_adc_vals[i] = vals[i];
+		}
 	}
 }
 
 
 /**
- * Convert an ADC value to voltage and compare against a voltage threshold
+ * Convert an ADC value to voltage and compare against a voltage threshold (from
+ * ADC_V_2_MV10)
  */
-bool adc_val_greater_than_threshold(uint16_t adc_val, float threshold)
+bool adc_val_greater_than_threshold(uint16_t adc_val, int32_t threshold_mv10)
 {
-	float v;
-	
-	v = adc_2_volts(adc_val);
-	return (v >= threshold);
+	return (adc_2_mv10(adc_val) >= threshold_mv10);
 }
 
 
 /**
- * Compute a rounded average
+ * Fill a filter with an initial value
  */
-uint16_t compute_average(uint16_t* buf, int n)
+void filter_init(adc_filter_t* f, uint16_t v)
 {
 	int i;
-	uint16_t avg;
-	uint32_t sum = 0;
-	
-	// Sum values
-	for (i=0; i<n; i++) sum += *(buf + i);
-	
-	// Compute the integer portion of the average
-	avg = sum / n;
 	
-	// Round up if necessary
-	if ((sum % n) >= (n / 2)) avg = avg + 1;
-	
-	return avg;
+	for (i=0; i<f->n; i++) f->buf[i] = v;
+	f->index = 0;
+	f->sum = (uint32_t) v * f->n;
+}
+
+
+/**
+ * Replace the oldest sample in a filter
+ */
+void filter_push(adc_filter_t* f, uint16_t v)
+{
+	f->sum = f->sum - f->buf[f->index] + v;
+	f->buf[f->index] = v;
+	if (++f->index >= f->n) f->index = 0;
+}
+
+
+/**
+ * Return the rounded average of a filter's samples (n is even)
+ */
+uint16_t filter_average(adc_filter_t* f)
+{
+	return (uint16_t) ((f->sum + (f->n / 2)) / f->n);
 }
 
 
@@ -341,28 +406,28 @@ uint16_t compute_average(uint16_t* buf, int n)
 void update_battery_info()
 {
 	bool s1, s2;
-	float bv;
+	int32_t bv_mv10;
 	uint16_t avg_adc_val;
 	enum BATT_STATE_t bs;
 	enum CHARGE_STATE_t cs;
 	
 	// Compute the battery voltage
-	avg_adc_val = compute_average(batt_average_array, NUM_BATT_SAMPLES);
-	bv = adc_2_volts(avg_adc_val) * BATT_ADC_MULT;
+	avg_adc_val = filter_average(&batt_filter);
+	bv_mv10 = (adc_2_mv10(avg_adc_val) * BATT_ADC_MULT_1000) / 1000;
 	
 	// Set the battery state
-	if (bv <= BATT_CRIT_THRESHOLD) bs = BATT_CRIT;
-	else if (bv <= BATT_0_THRESHOLD) bs = BATT_0;
-	else if (bv <= BATT_25_THRESHOLD) bs = BATT_25;
-	else if (bv <= BATT_50_THRESHOLD) bs = BATT_50;
-	else if (bv <= BATT_75_THRESHOLD) bs = BATT_75;
+	if (bv_mv10 <= ADC_V_2_MV10(BATT_CRIT_THRESHOLD)) bs = BATT_CRIT;
+	else if (bv_mv10 <= ADC_V_2_MV10(BATT_0_THRESHOLD)) bs = BATT_0;
+	else if (bv_mv10 <= ADC_V_2_MV10(BATT_25_THRESHOLD)) bs = BATT_25;
+	else if (bv_mv10 <= ADC_V_2_MV10(BATT_50_THRESHOLD)) bs = BATT_50;
+	else if (bv_mv10 <= ADC_V_2_MV10(BATT_75_THRESHOLD)) bs = BATT_75;
 	else bs = BATT_100;
 	
 	// Compute the charger status flags
-	avg_adc_val = compute_average(stat1_average_array, NUM_STAT_SAMPLES);
-	s1 = adc_val_greater_than_threshold(avg_adc_val, STAT1_THRESHOLD);
-	avg_adc_val = compute_average(stat2_average_array, NUM_STAT_SAMPLES);
-	s2 = adc_val_greater_than_threshold(avg_adc_val, STAT2_THRESHOLD);
+	avg_adc_val = filter_average(&stat1_filter);
+	s1 = adc_val_greater_than_threshold(avg_adc_val, ADC_V_2_MV10(STAT1_THRESHOLD));
+	avg_adc_val = filter_average(&stat2_filter);
+	s2 = adc_val_greater_than_threshold(avg_adc_val, ADC_V_2_MV10(STAT2_THRESHOLD));
 	
 	// Convert the flags to charge state
 	//   From the MCP73871 spec, Table 5-1 (simplified without PG)
@@ -384,7 +449,7 @@ void update_battery_info()
 	
 	// Finally, atomically update our value
 	xSemaphoreTake(batt_status_mutex, portMAX_DELAY);
-	batt_status.batt_voltage = bv;
+	batt_status.batt_voltage = bv_mv10 / 10000.0f;
 	batt_status.batt_state = bs;
 	batt_status.charge_state = cs;
 	xSemaphoreGive(batt_status_mutex);
@@ -397,11 +462,11 @@ void update_temp_info()
 	uint16_t avg_adc_val;
 	
 	// Compute the temperature
-	avg_adc_val = compute_average(temp_average_array, NUM_TEMP_SAMPLES);
+	avg_adc_val = filter_average(&temp_filter);
 #ifdef ADC_DEBUG
-	temp_v = adc_2_volts(avg_adc_val);
+	temp_mv10 = adc_2_mv10(avg_adc_val);
 #endif
-	t = adc_2_temp(avg_adc_val);
+	t = adc_2_temp_c100(avg_adc_val) / 100.0f;
 	
 	// Atomically update our value
 	xSemaphoreTake(temp_value_mutex, portMAX_DELAY);
@@ -416,7 +481,7 @@ void update_temp_info()
 void update_button_info()
 {
 	// Compute current pressed state
-	power_button_cur = adc_val_greater_than_threshold(cur_adc_vals[ADC_CUR_BTN_I], PWR_BTN_THRESHOLD);
+	power_button_cur = adc_val_greater_than_threshold(cur_adc_vals[ADC_CUR_BTN_I], ADC_V_2_MV10(PWR_BTN_THRESHOLD));
 	
 	// Atomically update the value
 	xSemaphoreTake(power_button_mutex, portMAX_DELAY);
@@ -429,48 +494,73 @@ void update_button_info()
 
 
 /**
- * Convert a 12-bit ADC value to the voltage at the ADC input pin
+ * Convert a 12-bit ADC value to the voltage at the ADC input pin in 0.1 mV units
  */
-float adc_2_volts(uint16_t adc_val)
+int32_t adc_2_mv10(uint16_t adc_val)
 {
-	return ((ADC_EXT_VREF_V * adc_val) / 4095.0);
+	return ((ADC_EXT_VREF_MV10 * (int32_t) adc_val) + 2047) / 4095;
+}
+
+
+#ifdef ADC_INT_IO
+/**
+ * Convert a voltage at the ADC input pin to an 8-bit limit register value (limits are
+ * compared with the top 8 bits of the 12-bit conversion)
+ */
+uint8_t volts_2_adc_limit(float v)
+{
+	int i;
+	
+	i = (int) ((v * 4095.0) / ADC_EXT_VREF_V) >> 4;
+	if (i > 0xFF) i = 0xFF;
+	if (i < 0) i = 0;
+	
+	return (uint8_t) i;
 }
+#endif
 
 
 
 #ifdef ADC_USE_LM36
 /**
- * Convert a 12-bit ADC value to degrees C according to the conversion specification
+ * Convert a 12-bit ADC value to degrees C * 100 according to the conversion specification
  * for the LM36 temperature sensor
  */
-float adc_2_temp(uint16_t adc_val)
+int32_t adc_2_temp_c100(uint16_t adc_val)
 {
-	float t;
-	float mv;
-	
-	mv = (double) adc_2_volts(adc_val) * 1000.0;
-	
-	// LM36 offset at 0C = 500mV; scale factor = 10mV/C
-	t = (mv - 500.0) / 10.0;
-	
-	return t;
+	// LM36 offset at 0C = 500mV; scale factor = 10mV/C (C * 100 = 0.1 mV units - 5000)
+	return adc_2_mv10(adc_val) - 5000;
 }
 #else
 /**
- * Convert a 12-bit ADC value to degrees C according to the conversion specification 
- * for the LMT86 thermistor
+ * Convert a 12-bit ADC value to degrees C * 100 from the LMT86 table
  */
-float adc_2_temp(uint16_t adc_val)
+int32_t adc_2_temp_c100(uint16_t adc_val)
 {
+	int i = adc_val >> ADC_TEMP_LUT_SHIFT;
+	int32_t f = adc_val & (ADC_TEMP_LUT_STEP - 1);
+	
+	return temp_lut[i] + (((temp_lut[i+1] - temp_lut[i]) * f) / ADC_TEMP_LUT_STEP);
+}
+
+
+/**
+ * Build the LMT86 table from the parabolic curve fit in the LMT86 datasheet, equation 2
+ * (page 10)
+ */
+void init_temp_lut()
+{
+	int i;
 	double t;
 	double mv;
 	
-	// Implementation of parabolic curve fit from LMT86 datasheet, equation 2 (page 10)
-	mv = (double) adc_2_volts(adc_val) * 1000.0;
-	
-	t = sqrt(pow(-10.888, 2) + (4 * 0.00347 * (1777.3 - mv)));
-	t = ((10.888 - t) / (2 * -0.00347)) + 30.0;
-	
-	return (float) t;	
+	for (i=0; i<ADC_TEMP_LUT_LEN; i++) {
+		mv = (ADC_EXT_VREF_V * 1000.0 * (i * ADC_TEMP_LUT_STEP)) / 4095.0;
+		
+		t = sqrt(pow(-10.888, 2) + (4 * 0.00347 * (1777.3 - mv)));
+		t = ((10.888 - t) / (2 * -0.00347)) + 30.0;
+		
+		temp_lut[i] = (int16_t) (t * 100.0);
+	}
 }
 #endif
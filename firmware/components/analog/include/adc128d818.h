@@ -42,6 +42,10 @@
 #define ADC_CFG_INT_CLR_MASK  0x08
 #define ADC_CFG_INIT_MASK     0x80
 
+#define ADC_INT_STATUS_REG    0x01
+
+#define ADC_INT_MASK_REG      0x03
+
 #define ADC_CONV_REG          0x07
 #define ADC_CONV_EN           0x01
 #define ADC_CONV_LP           0x00
@@ -68,6 +72,8 @@
 #define ADC_CH_BASE_REG       0x20
 
 #define ADC_LIM_BASE_REG      0x2A
+#define ADC_LIM_HIGH_REG(ch)  (ADC_LIM_BASE_REG + 2*(ch))
+#define ADC_LIM_LOW_REG(ch)   (ADC_LIM_BASE_REG + 2*(ch) + 1)
 
 #define ADC_MANUF_ID_REG      0x3E
 #define ADC_MANUF_ID          0x01
@@ -75,6 +81,9 @@
 #define ADC_REV_ID_REG        0x3F
 #define ADC_REV_ID            0x09
 
+// Maximum registers read by adc_read_words (one per input channel)
+#define ADC_MAX_BATCH_REGS    8
+
 // Internal voltage reference value
 #define ADC_INT_VREF_V        2.56
 
@@ -86,6 +95,7 @@
 bool adc_write_byte(uint8_t reg_addr, uint8_t reg_data);
 bool adc_read_byte(uint8_t reg_addr, uint8_t* reg_data);
 bool adc_read_word(uint8_t reg_addr, uint16_t* reg_data);
+bool adc_read_words(uint8_t reg_addr, int n, uint16_t* reg_data);
 
 
 #endif /* ADC128D818_H */
\ No newline at end of file
@@ -27,6 +27,7 @@
 #ifndef OV2640_H
 #define OV2640_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include "ov2640regs.h"
 
@@ -46,6 +47,11 @@
 #define ACK_VAL 0x0
 #define NACK_VAL 0x1 
 
+// Maximum register writes sent in one I2C transaction by ov2640_wrSensorRegs8_8.  The
+// bus is released between batches so the Lepton's CCI isn't held off for a whole table.
+// Batches are bulk transfers (each register write is about 3 bytes on the bus).
+#define OV2640_I2C_BATCH_REGS (I2C_MAX_BULK_BYTES / 3)
+
 /* SPI constants */
 #define CAM_SPI_HOST VSPI_HOST
 #define CAM_DMA_CH 1
@@ -54,7 +60,21 @@
 #define CAM_PIN_NUM_MISO 34
 #define CAM_PIN_NUM_SCLK 25
 #define CAM_PIN_NUM_CS   27
-#define CAM_MAX_SPI_PKT  1024
+#define CAM_MAX_SPI_PKT  4096
+
+// Number of CAM_MAX_SPI_PKT DMA buffers used to read the FIFO.  ov2640_transferJpeg
+// processes one while the next is being read.
+#define CAM_NUM_SPI_BUFS 2
+
+// Yield VSPI to the LCD and touchscreen between FIFO bursts so they aren't held off for
+// a whole image.  Undefine to hold the bus for the entire image if other devices' traffic
+// between bursts corrupts images.
+#define CAM_YIELD_BETWEEN_BURSTS
+
+// The ArduCAM doesn't respond on SPI until its CPLD has booted.  ov2640_init retries
+// the SPI test every CAM_BOOT_POLL_MSEC for up to CAM_BOOT_TIMEOUT_MSEC.
+#define CAM_BOOT_POLL_MSEC    10
+#define CAM_BOOT_TIMEOUT_MSEC 1000
 
 
 /*################# PUBLIC CONSTANTS, VARIABLES & DATA TYPES ##################*/
@@ -69,6 +89,12 @@
 #define OV2640_1280x1024	7
 #define OV2640_1600x1200	8
 
+// JPEG quantization scale (DSP register 0x44).  Lower values give higher quality and
+// larger images.
+#define OV2640_QS_MIN       4
+#define OV2640_QS_MAX       63
+#define OV2640_QS_DEFAULT   0x32
+
 #define CAP_DONE_MASK 0x08
 #define ARDUCHIP_TRIG 0x41
 
@@ -91,16 +117,21 @@ void ov2640_clearFifoFlag(void);
 void ov2640_flushFifo(void);
 uint8_t ov2640_getBit(uint8_t addr, uint8_t bit);
 int ov2640_init(void);
+void ov2640_lowPower(bool en);
 uint8_t ov2640_rdSensorReg8_8(uint8_t regID, uint8_t* regDat);
 uint32_t ov2640_readFifoLength(void);
 uint8_t ov2640_readFifo(void);
 uint8_t ov2640_readReg(uint8_t addr);
 void ov2640_setBit(uint8_t addr, uint8_t bit);
 void ov2640_setFormat(uint8_t fmt);
+void ov2640_setJPEGQuality(uint8_t qs);
 void ov2640_setJPEGSize(uint8_t size);
 void ov2640_set_Light_Mode(uint8_t Light_Mode);
 void ov2640_setMode(uint8_t mode);
+int ov2640_setSpiFreq(int freq_hz);
+int ov2640_setWindow(uint8_t size, uint16_t x, uint16_t y, uint16_t w, uint16_t h);
 void ov2640_startCapture(void);
+int ov2640_testSpi(void);
 void ov2640_transferJpeg(uint8_t * camData, uint32_t* length);
 void ov2640_transferRaw(uint8_t * camData, uint32_t length);
 void ov2640_writeReg(uint8_t addr, uint8_t data);
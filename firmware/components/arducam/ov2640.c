@@ -41,6 +41,7 @@
 #include "ov2640regs.h"
 #include "ov2640.h"
 #include "system_config.h"
+#include "sys_utilities.h"
 
 
 
@@ -71,6 +72,38 @@
 #define SENSOR_VAL_TERM_16BIT               0xFFFF
 #define MAX_FIFO_SIZE		                0x60000
 
+/* DSP (bank 0) windowing registers */
+
+#define DSP_HSIZE  0x51
+#define DSP_VSIZE  0x52
+#define DSP_XOFFL  0x53
+#define DSP_YOFFL  0x54
+#define DSP_VHYX   0x55
+#define DSP_TEST   0x57
+#define DSP_ZMOW   0x5A
+#define DSP_ZMOH   0x5B
+#define DSP_ZMHH   0x5C
+#define DSP_RESET  0xE0
+#define DSP_RESET_DVP 0x04
+#define DSP_BPADDR 0x7C
+#define DSP_BPDATA 0x7D
+
+/* Sensor (bank 1) registers */
+
+#define SEN_GAIN   0x00
+#define SEN_AEC    0x10
+#define SEN_COM7   0x12
+#define SEN_COM7_SRST 0x80
+#define SEN_ADVFL  0x2D
+#define SEN_ADVFH  0x2E
+#define SEN_REG45  0x45
+
+/* Register bank select (both banks) */
+
+#define OV2640_BANK_SEL 0xFF
+#define OV2640_BANK_DSP 0
+#define OV2640_BANK_SEN 1
+
 /* ArduChip registers definition */
 
 #define RWBIT 0x80
@@ -107,10 +140,26 @@ static const char* TAG = "ov2640";
 // SPI Interface
 static spi_device_handle_t spi;
 
-// Pointer to an allocated array to store data read from the camera (DMA capable)
-static uint8_t* camBuf;
+// Pointers to allocated arrays to store data read from the camera (DMA capable)
+static uint8_t* camBuf[CAM_NUM_SPI_BUFS];
+
+// FIFO burst read transactions, one per buffer
+static spi_transaction_t camTrans[CAM_NUM_SPI_BUFS];
+
+// Shadow of the values last written to the sensor's DSP and sensor register banks so
+// ov2640_wrSensorRegs8_8 only writes registers a table changes
+static uint8_t sensorShadow[2][256];
+static bool sensorShadowValid[2][256];
+static int sensorBank = -1;      // Selected register bank, -1 when unknown
 
 // Forward declarations for private functions
+static int ov2640_addSpiDevice(int freq_hz);
+static void ov2640_queueBurstRead(int buf_index, uint32_t length);
+static int ov2640_findMarker(const uint8_t* buf, uint32_t length, uint8_t marker, bool* prev_ff);
+static int ov2640_wrSensorBatch(const uint8_t* reg_vals, int num_regs);
+static bool ov2640_shadowMatch(uint8_t regID, uint8_t regDat);
+static void ov2640_shadowWrite(uint8_t regID, uint8_t regDat);
+static void ov2640_shadowInvalidate(int bank);
 static void ov2640_i2c_delay();
 
 
@@ -131,9 +180,11 @@ uint8_t ov2640_wrSensorReg8_8(uint8_t regID, uint8_t regDat) {
 	if (i2c_master_write_slave(OV2640_I2C_ADDR, write_buf, sizeof(write_buf)) != ESP_OK) {
 		i2c_unlock();
     	ESP_LOGE(TAG, "ov2640_wrSensorReg8_8 failed: register 0x%02x, value 0x%02x", regID, regDat);
+    	ov2640_shadowInvalidate(-1);
     	return 0;
 	};
 	i2c_unlock();
+	ov2640_shadowWrite(regID, regDat);
 
   return 1;
 }
@@ -172,20 +223,37 @@ uint8_t ov2640_rdSensorReg8_8(uint8_t regID, uint8_t* regDat) {
 }
 
 /* I2C Array Write 8bit address, 8bit data */
+/*   Registers already holding the table's value are skipped and the rest are written */
+/*   in batches of up to OV2640_I2C_BATCH_REGS.  The terminating entry is a sensor */
+/*   bank select and is written too.  Returns 1 for success, 0 if a batch failed. */
 int ov2640_wrSensorRegs8_8(const struct sensor_reg* reglist) {
+	uint8_t batch[OV2640_I2C_BATCH_REGS*2];
 	uint8_t reg_addr = 0;
 	uint8_t reg_val = 0;
 	const struct sensor_reg *next = reglist;
+	int n = 0;
+	int rtn = 1;
 	
 	while ((reg_addr != 0xff) | (reg_val != 0xff))
 	{
 		reg_addr = next->reg;
 		reg_val = next->val;
-		ov2640_wrSensorReg8_8(reg_addr, reg_val);
+		if (!ov2640_shadowMatch(reg_addr, reg_val)) {
+			batch[n*2] = reg_addr;
+			batch[n*2 + 1] = reg_val;
+			ov2640_shadowWrite(reg_addr, reg_val);
+			if (++n == OV2640_I2C_BATCH_REGS) {
+				rtn &= ov2640_wrSensorBatch(batch, n);
+				n = 0;
+			}
+		}
 		next++;
 	}
+	if (n != 0) {
+		rtn &= ov2640_wrSensorBatch(batch, n);
+	}
 
-	return 1;
+	return rtn;
 }
 
 /* Single byte SPI write operation */
@@ -234,7 +302,7 @@ void ov2640_burstBusRead(uint16_t length) {
 	t.cmd = BURST_FIFO_READ;          // SPI IF will send upper 8-bits during command phase
 	t.rxlength = length * 8;          // length byte read during data phase
 	t.tx_buffer = NULL;
-	t.rx_buffer = camBuf;             // Receive into our DMA-capable buffer
+	t.rx_buffer = camBuf[0];          // Receive into our DMA-capable buffer
 	
 	// Run the SPI transaction using the interrupt function so other tasks can run during the transfer
 	ret = spi_device_transmit(spi, &t);
@@ -256,42 +324,39 @@ void ov2640_writeReg(uint8_t addr, uint8_t data) {
 /* Init the camera */
 /*   returns 1 for success, 0 for failure */
 int ov2640_init(void) {
+	int i;
 	uint8_t vid, pid;
 	uint8_t rtnVal;
-	esp_err_t espRtnVal;
 
 	// SPI Device
-	spi_device_interface_config_t devcfg = {
-    	.command_bits = 8,
-    	.address_bits = 0,
-    	.clock_speed_hz = CAM_SPI_FREQ_HZ,
-    	.input_delay_ns = 25,
-    	.mode = 0,
-    	.spics_io_num = CAM_CSN_IO,
-    	.queue_size = 1,
-    	.flags = SPI_DEVICE_HALFDUPLEX,
-    	.cs_ena_pretrans = 2
-	};
-    if ((espRtnVal=spi_bus_add_device(VSPI_HOST, &devcfg, &spi)) != ESP_OK) {
-    	ESP_LOGE(TAG, "Failed to add camera spi device");
-    	return 0;
-    }
+	if (ov2640_addSpiDevice(CAM_SPI_FREQ_HZ) == 0) {
+		return 0;
+	}
 
-    // Allocate our DMA-capable SPI buffer
-    camBuf = (uint8_t*) heap_caps_malloc(CAM_MAX_SPI_PKT, MALLOC_CAP_DMA);
-    if (camBuf == NULL) {
-    	ESP_LOGE(TAG, "Failed to allocate camera DMA buffer");
-        return 0;
+    // Allocate our DMA-capable SPI buffers
+    for (i=0; i<CAM_NUM_SPI_BUFS; i++) {
+    	camBuf[i] = (uint8_t*) heap_caps_malloc(CAM_MAX_SPI_PKT, MALLOC_CAP_DMA);
+    	if (camBuf[i] == NULL) {
+    		ESP_LOGE(TAG, "Failed to allocate camera DMA buffer");
+        	return 0;
+    	}
     }
 
-	//Test SPI connection first
-	ov2640_writeReg(ARDUCHIP_TEST1, 0x55);
-	rtnVal = ov2640_readReg(ARDUCHIP_TEST1);
+	//Test SPI connection first, waiting for the ArduCAM to boot
+	for (i=0; i<(CAM_BOOT_TIMEOUT_MSEC / CAM_BOOT_POLL_MSEC); i++) {
+		ov2640_writeReg(ARDUCHIP_TEST1, 0x55);
+		rtnVal = ov2640_readReg(ARDUCHIP_TEST1);
+		if (rtnVal == 0x55) break;
+		vTaskDelay(pdMS_TO_TICKS(CAM_BOOT_POLL_MSEC));
+	}
 	if (rtnVal != 0x55) {
 		ESP_LOGE(TAG, "SPI Test read failed with 0x%02x", rtnVal);
     	return 0;
 	}
 	
+	//Bring the sensor out of low power mode (it stays powered while the ESP32 sleeps)
+	ov2640_lowPower(false);
+	
 	//Reset CPLD per https://www.arducam.com/docs/spi-cameras-for-arduino/faq/
 	ov2640_writeReg(0x07, 0x80);
 	vTaskDelay(pdMS_TO_TICKS(100));
@@ -343,11 +408,23 @@ void ov2640_setFormat(uint8_t fmt) {
 		ov2640_wrSensorReg8_8(0xff, 0x01);
 		ov2640_wrSensorReg8_8(0x15, 0x00);
 		ov2640_wrSensorRegs8_8(OV2640_320x240_JPEG);
-		ov2640_wrSensorReg8_8(0xff, 0x00); //???
-		ov2640_wrSensorReg8_8(0x44, 0x32); //???
+		ov2640_setJPEGQuality(OV2640_QS_DEFAULT);
 	}
 }
 
+/* Set the JPEG quantization scale (lower is higher quality) */
+void ov2640_setJPEGQuality(uint8_t qs) {
+	if (qs < OV2640_QS_MIN) qs = OV2640_QS_MIN;
+	if (qs > OV2640_QS_MAX) qs = OV2640_QS_MAX;
+	const struct sensor_reg qs_regs[] = {
+		{ OV2640_BANK_SEL, OV2640_BANK_DSP },
+		{ 0x44, qs },
+		{ 0xff, 0xff }
+	};
+	
+	ov2640_wrSensorRegs8_8(qs_regs);
+}
+
 /* Set the JPEG pixel size of the image */
 void ov2640_setJPEGSize(uint8_t size) {
 	switch (size)
@@ -385,6 +462,79 @@ void ov2640_setJPEGSize(uint8_t size) {
 	}
 }
 
+/* Output only the region (x, y, w, h) of an image of the given JPEG size.  Coordinates
+ * are in pixels of the full size image.  The width is rounded down to a multiple of 16,
+ * the height to a multiple of 8 and the offsets to even values.  A zero width or height
+ * selects the full image.  Only 160x120, 320x240 and 640x480 are supported.  Returns the
+ * output width or 0 for an illegal size or region. */
+int ov2640_setWindow(uint8_t size, uint16_t x, uint16_t y, uint16_t w, uint16_t h) {
+	uint16_t img_w, img_h;   // Full output image
+	uint16_t sen_w;          // Full sensor window for the mode the size table selects
+	uint16_t win_x, win_y, win_w, win_h;
+	uint16_t zw, zh;
+	
+	switch (size) {
+	case OV2640_160x120:
+		img_w = 160;
+		img_h = 120;
+		sen_w = 800;
+		break;
+	case OV2640_320x240:
+		img_w = 320;
+		img_h = 240;
+		sen_w = 800;
+		break;
+	case OV2640_640x480:
+		img_w = 640;
+		img_h = 480;
+		sen_w = 1600;
+		break;
+	default:
+		return 0;
+	}
+	
+	if ((w == 0) || (h == 0)) {
+		x = 0;
+		y = 0;
+		w = img_w;
+		h = img_h;
+	} else {
+		x &= ~0x1;
+		y &= ~0x1;
+		w &= ~0xF;
+		h &= ~0x7;
+		if ((w == 0) || (h == 0) || ((x + w) > img_w) || ((y + h) > img_h)) {
+			return 0;
+		}
+	}
+	
+	// Scale the region to the sensor window (the sensor is 2.5 or 5 times the image
+	// with the same 4:3 aspect ratio).  The DSP keeps the full image divider and zoom
+	// ratio so the region has the same pixel scale as the full image.
+	win_x = (uint32_t) x * sen_w / img_w;
+	win_y = (uint32_t) y * sen_w / img_w;
+	win_w = ((uint32_t) w * sen_w / img_w) / 4;
+	win_h = ((uint32_t) h * sen_w / img_w) / 4;
+	zw = w / 4;
+	zh = h / 4;
+	
+	ov2640_wrSensorReg8_8(0xff, 0x00);
+	ov2640_wrSensorReg8_8(DSP_RESET, DSP_RESET_DVP);
+	ov2640_wrSensorReg8_8(DSP_HSIZE, win_w & 0xFF);
+	ov2640_wrSensorReg8_8(DSP_VSIZE, win_h & 0xFF);
+	ov2640_wrSensorReg8_8(DSP_XOFFL, win_x & 0xFF);
+	ov2640_wrSensorReg8_8(DSP_YOFFL, win_y & 0xFF);
+	ov2640_wrSensorReg8_8(DSP_VHYX, ((win_h >> 1) & 0x80) | ((win_y >> 4) & 0x70) |
+	                                ((win_w >> 5) & 0x08) | ((win_x >> 8) & 0x07));
+	ov2640_wrSensorReg8_8(DSP_TEST, (win_w >> 2) & 0x80);
+	ov2640_wrSensorReg8_8(DSP_ZMOW, zw & 0xFF);
+	ov2640_wrSensorReg8_8(DSP_ZMOH, zh & 0xFF);
+	ov2640_wrSensorReg8_8(DSP_ZMHH, ((zh >> 6) & 0x04) | ((zw >> 8) & 0x03));
+	ov2640_wrSensorReg8_8(DSP_RESET, 0x00);
+	
+	return w;
+}
+
 /* Set Light Mode */
 void ov2640_set_Light_Mode(uint8_t Light_Mode) {
 	switch(Light_Mode)
@@ -438,6 +588,15 @@ uint32_t ov2640_readFifoLength(void) {
 	return length;
 }
 
+/* Enter or leave the sensor's low power (power down) mode */
+void ov2640_lowPower(bool en) {
+	if (en) {
+		ov2640_setBit(ARDUCHIP_GPIO, GPIO_PWDN_MASK);
+	} else {
+		ov2640_clearBit(ARDUCHIP_GPIO, GPIO_PWDN_MASK);
+	}
+}
+
 /* Set corresponding bit */
 void ov2640_setBit(uint8_t addr, uint8_t bit) {
 	uint8_t temp;
@@ -498,6 +657,32 @@ void ov2640_clearFifoFlag(void) {
 	ov2640_writeReg(ARDUCHIP_FIFO, FIFO_CLEAR_MASK);
 }
 
+/* Change the SPI clock - the bus must be locked */
+/*   returns 1 for success, 0 for failure */
+int ov2640_setSpiFreq(int freq_hz) {
+	if (spi_bus_remove_device(spi) != ESP_OK) {
+		ESP_LOGE(TAG, "Failed to remove camera spi device");
+		return 0;
+	}
+	return ov2640_addSpiDevice(freq_hz);
+}
+
+/* Check SPI transfers with the ArduChip test register */
+/*   returns 1 if all patterns read back correctly, 0 otherwise */
+int ov2640_testSpi(void) {
+	static const uint8_t patterns[] = {0x55, 0xAA, 0x00, 0xFF, 0x5A, 0xA5, 0x0F, 0xF0};
+	int i;
+
+	for (i=0; i<sizeof(patterns); i++) {
+		ov2640_writeReg(ARDUCHIP_TEST1, patterns[i]);
+		if (ov2640_readReg(ARDUCHIP_TEST1) != patterns[i]) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
 /* Read FIFO single */
 uint8_t ov2640_readFifo(void) {
 	uint8_t data;
@@ -516,15 +701,26 @@ void ov2640_capture(void) {
 }
 
 /* Transfer data from the Arducam frame buffer */
+/*   The FIFO is read in CAM_MAX_SPI_PKT bursts, alternating between the DMA buffers so  */
+/*   the next burst is being read while the last is scanned and copied.  The SOI and EOI */
+/*   markers are found with memchr and the jpeg data between them is copied in blocks.  */
+/*   The caller locks VSPI and the bus is yielded to higher priority users between     */
+/*   bursts.                                                                            */
 void ov2640_transferJpeg(uint8_t* camData, uint32_t* length) {
 	uint32_t read_length;           // Data length in SPI buffer
-	uint32_t total_read_length = 0; // Length of data read so far
+	uint32_t queued_length = 0;     // Length of data requested so far
 	uint32_t image_length;          // Length of image reported by camera
 	uint32_t jpeg_length = 0;       // Length of jpeg image found in camera data
-	uint8_t temp = 0, temp_last;    // Used to determine start and stop of jpeg data
+	uint32_t pos;                   // Start of jpeg data in the SPI buffer
+	uint32_t n;
+	bool prev_ff = false;           // Set when the last buffer ended with 0xFF
 	bool saw_header = false;        // Set when we find the start of a jpeg image
 	bool found_image = false;       // Set when a valid jpeg image is found
-	int i;
+	int cur_buf = 0;
+	int pending = 0;                // Bursts queued but not yet processed
+	int marker;
+	spi_transaction_t* rtrans;
+	esp_err_t ret;
 
 	// Get the image length
 	image_length = ov2640_readFifoLength();
@@ -542,43 +738,65 @@ void ov2640_transferJpeg(uint8_t* camData, uint32_t* length) {
 		return;
 	}
 	
+	// Start the first burst
+	read_length = (image_length > CAM_MAX_SPI_PKT) ? CAM_MAX_SPI_PKT : image_length;
+	ov2640_queueBurstRead(cur_buf, read_length);
+	queued_length = read_length;
+	pending = 1;
+	
 	// Process image data
-	while ((total_read_length < image_length) && !found_image) {
-		// Read data from the camera
-		if (total_read_length < (image_length - CAM_MAX_SPI_PKT)) {
-			read_length = CAM_MAX_SPI_PKT;
-		} else {
-			read_length = image_length - total_read_length;
+	while (pending != 0) {
+		ret = spi_device_get_trans_result(spi, &rtrans, portMAX_DELAY);
+		ESP_ERROR_CHECK(ret);
+		pending--;
+		
+		// Start reading the next burst into the other buffer
+		if ((queued_length < image_length) && !found_image) {
+			if ((image_length - queued_length) > CAM_MAX_SPI_PKT) {
+				read_length = CAM_MAX_SPI_PKT;
+			} else {
+				read_length = image_length - queued_length;
+			}
+			ov2640_queueBurstRead((cur_buf + 1) % CAM_NUM_SPI_BUFS, read_length);
+			queued_length += read_length;
+			pending++;
 		}
-		ov2640_burstBusRead(read_length);
-
+		
+		// Bursts still in flight after the image was found are drained and discarded
+		if (found_image) continue;
+		
 		// Process read data
-		for (i=0; i<read_length; i++) {
-			temp_last = temp;
-			temp = camBuf[i];
-
-			if (saw_header) {
-				// Processing jpeg data
-				camData[jpeg_length] = temp;
-				jpeg_length++;
-				
-				if ((temp == 0xD9) && (temp_last == 0xFF)) {
-					// End of jpeg image
-					found_image = true;
-					break;
-				}
-			} else if ((temp == 0xD8) && (temp_last == 0xFF)) {
+		n = rtrans->rxlength / 8;
+		pos = 0;
+		if (!saw_header) {
+			marker = ov2640_findMarker(camBuf[cur_buf], n, 0xD8, &prev_ff);
+			if (marker >= 0) {
 				// Start of jpeg image
 				saw_header = true;
-							
-				camData[0] = temp_last;
-				camData[1] = temp;
-				jpeg_length = 2;
-
+				camData[0] = 0xFF;
+				jpeg_length = 1;
+				pos = marker;
 			}
 		}
-		total_read_length += read_length;
-
+		if (saw_header) {
+			marker = ov2640_findMarker(&camBuf[cur_buf][pos], n - pos, 0xD9, &prev_ff);
+			if (marker >= 0) {
+				// End of jpeg image
+				found_image = true;
+				n = pos + marker + 1;
+			}
+			memcpy(&camData[jpeg_length], &camBuf[cur_buf][pos], n - pos);
+			jpeg_length += n - pos;
+		}
+		
+		cur_buf = (cur_buf + 1) % CAM_NUM_SPI_BUFS;
+		
+#ifdef CAM_YIELD_BETWEEN_BURSTS
+		// Let a waiting LCD or touchscreen update use the bus between bursts
+		if (!found_image) {
+			(void) system_yield_vspi();
+		}
+#endif
 	}
 	
 	if (found_image) {
@@ -604,7 +822,7 @@ void ov2640_transferRaw(uint8_t * camData, uint32_t length) {
 			read_length = length - total_read_length;
 		}
 		ov2640_burstBusRead(read_length);
-		memcpy(&camData[total_read_length], camBuf, read_length);
+		memcpy(&camData[total_read_length], camBuf[0], read_length);
 		total_read_length += read_length;
 	}
 }
@@ -613,6 +831,177 @@ void ov2640_transferRaw(uint8_t * camData, uint32_t length) {
 /*######################## PRIVATE FUNCTION BODIES #############################*/
 
 
+/**
+ * Add the camera to the SPI bus with the specified clock
+ *
+ */
+static int ov2640_addSpiDevice(int freq_hz)
+{
+	spi_device_interface_config_t devcfg = {
+    	.command_bits = 8,
+    	.address_bits = 0,
+    	.clock_speed_hz = freq_hz,
+    	.input_delay_ns = 25,
+    	.mode = 0,
+    	.spics_io_num = CAM_CSN_IO,
+    	.queue_size = CAM_NUM_SPI_BUFS,
+    	.flags = SPI_DEVICE_HALFDUPLEX,
+    	.cs_ena_pretrans = 2
+	};
+	
+	if (spi_bus_add_device(VSPI_HOST, &devcfg, &spi) != ESP_OK) {
+		ESP_LOGE(TAG, "Failed to add camera spi device");
+		return 0;
+	}
+	
+	return 1;
+}
+
+
+/**
+ * Queue a burst read of length bytes from the FIFO into camBuf[buf_index]
+ *
+ */
+static void ov2640_queueBurstRead(int buf_index, uint32_t length)
+{
+	spi_transaction_t* t = &camTrans[buf_index];
+	esp_err_t ret;
+	
+	memset(t, 0, sizeof(spi_transaction_t));
+	t->cmd = BURST_FIFO_READ;         // SPI IF will send upper 8-bits during command phase
+	t->rxlength = length * 8;         // length byte read during data phase
+	t->tx_buffer = NULL;
+	t->rx_buffer = camBuf[buf_index];
+	
+	ret = spi_device_queue_trans(spi, t, portMAX_DELAY);
+	ESP_ERROR_CHECK(ret);
+}
+
+
+/**
+ * Find a jpeg marker (0xFF followed by marker) in buf.  Returns the index of the marker
+ * byte or -1 if it isn't found.  prev_ff carries a 0xFF at the end of one buffer over to
+ * the next so markers split across bursts are found (a marker at index 0).
+ *
+ */
+static int ov2640_findMarker(const uint8_t* buf, uint32_t length, uint8_t marker, bool* prev_ff)
+{
+	const uint8_t* p;
+	uint32_t i = 0;
+	
+	if (length == 0) return -1;
+	
+	if (*prev_ff && (buf[0] == marker)) {
+		*prev_ff = false;
+		return 0;
+	}
+	
+	while (i < length) {
+		p = memchr(&buf[i], 0xFF, length - i);
+		if (p == NULL) break;
+		i = (p - buf) + 1;
+		if (i == length) {
+			*prev_ff = true;
+			return -1;
+		}
+		if (buf[i] == marker) {
+			*prev_ff = false;
+			return i;
+		}
+	}
+	
+	*prev_ff = false;
+	return -1;
+}
+
+
+/**
+ * Write num_regs register address and value pairs in one I2C transaction.  Returns 1
+ * for success, 0 for failure in which case the shadow is no longer trusted.
+ */
+static int ov2640_wrSensorBatch(const uint8_t* reg_vals, int num_regs)
+{
+	// Tbuf is only needed before the first write since the pairs are separated by
+	// repeated starts, not stops
+	ov2640_i2c_delay();
+	
+	i2c_lock_prio(I2C_PRIO_BULK);
+	if (i2c_master_write_slave_regs(OV2640_I2C_ADDR, reg_vals, num_regs) != ESP_OK) {
+		i2c_unlock();
+		ESP_LOGE(TAG, "ov2640_wrSensorBatch failed: %d registers from 0x%02x", num_regs, reg_vals[0]);
+		ov2640_shadowInvalidate(-1);
+		return 0;
+	}
+	i2c_unlock();
+	
+	return 1;
+}
+
+
+/**
+ * Return true if a write of regDat to regID in the selected bank can be skipped
+ * because the register already holds it.  Registers the sensor changes itself (AEC/AGC
+ * results), registers that trigger an action and the indirect SDE address/data pair
+ * are always written.
+ */
+static bool ov2640_shadowMatch(uint8_t regID, uint8_t regDat)
+{
+	if (regID == OV2640_BANK_SEL) {
+		return (sensorBank == (regDat & 0x01));
+	}
+	
+	if (sensorBank == OV2640_BANK_DSP) {
+		if ((regID == DSP_RESET) || (regID == DSP_BPADDR) || (regID == DSP_BPDATA)) {
+			return false;
+		}
+	} else if (sensorBank == OV2640_BANK_SEN) {
+		if ((regID == SEN_GAIN) || (regID == SEN_AEC) || (regID == SEN_COM7) ||
+		    (regID == SEN_ADVFL) || (regID == SEN_ADVFH) || (regID == SEN_REG45))
+		{
+			return false;
+		}
+	} else {
+		return false;
+	}
+	
+	return (sensorShadowValid[sensorBank][regID] && (sensorShadow[sensorBank][regID] == regDat));
+}
+
+
+/**
+ * Track a write of regDat to regID in the selected bank.  A COM7 write resets the
+ * sensor bank (resolution change) or every register (soft reset) to defaults.
+ */
+static void ov2640_shadowWrite(uint8_t regID, uint8_t regDat)
+{
+	if (regID == OV2640_BANK_SEL) {
+		sensorBank = regDat & 0x01;
+	} else if (sensorBank >= 0) {
+		if ((sensorBank == OV2640_BANK_SEN) && (regID == SEN_COM7)) {
+			ov2640_shadowInvalidate((regDat & SEN_COM7_SRST) ? -1 : OV2640_BANK_SEN);
+		} else {
+			sensorShadow[sensorBank][regID] = regDat;
+			sensorShadowValid[sensorBank][regID] = true;
+		}
+	}
+}
+
+
+/**
+ * Forget the shadow values of one bank or, for bank -1, of both banks and the
+ * selected bank
+ */
+static void ov2640_shadowInvalidate(int bank)
+{
+	if (bank < 0) {
+		memset(sensorShadowValid, 0, sizeof(sensorShadowValid));
+		sensorBank = -1;
+	} else {
+		memset(sensorShadowValid[bank], 0, sizeof(sensorShadowValid[bank]));
+	}
+}
+
+
 /**
  * Delay for at least 1.3 uSec (on a 240 MHz CPU)
  *
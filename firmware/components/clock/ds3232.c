@@ -29,6 +29,7 @@
 #include "ds3232.h"
 #include "esp_log.h"
 #include "i2c.h"
+#include <string.h>
 
 
 //
@@ -65,6 +66,7 @@ static const uint8_t monthDays[]={31,28,31,30,31,30,31,31,30,31,30,31}; // API s
 //
 // RTC Module forward declarations for internal functions
 //
+static int read_rtc_regs(uint8_t addr, uint8_t* values, uint8_t nBytes, int prio);
 static uint8_t dec2bcd(uint8_t n);
 static uint8_t bcd2dec(uint8_t n);
 
@@ -110,8 +112,9 @@ int read_rtc_time(tmElements_t* tm)
 {
 	uint8_t buf[tmNbrFields];
 	
-	// Attempt to read the time registers from the RTC chip
-	if (read_rtc_bytes(RTC_SECONDS, buf, tmNbrFields)) {
+	// Attempt to read the time registers from the RTC chip ahead of any other waiting
+	// I2C traffic
+	if (read_rtc_regs(RTC_SECONDS, buf, tmNbrFields, I2C_PRIO_CRITICAL)) {
 		rtc_breakTime(0, tm);  // Set time to 0 (1970...)
 		return 1;
 	}
@@ -212,16 +215,60 @@ int write_rtc_byte(uint8_t addr, uint8_t value)
 }
 
 
+/**
+ * Write len bytes of the RTC's SRAM starting at addr.  The write is split into
+ * transfers of at most I2C_MAX_BULK_BYTES made at bulk priority so it never holds off
+ * time reads for long.  Returns zero if successful.
+ */
+int write_rtc_sram(uint8_t addr, const uint8_t* data, int len)
+{
+	esp_err_t ret = ESP_OK;
+	uint8_t buf[I2C_MAX_BULK_BYTES];
+	int n;
+	
+	while ((len > 0) && (ret == ESP_OK)) {
+		n = (len < (I2C_MAX_BULK_BYTES - 1)) ? len : (I2C_MAX_BULK_BYTES - 1);
+		buf[0] = addr;
+		memcpy(&buf[1], data, n);
+		
+		i2c_lock_prio(I2C_PRIO_BULK);
+		ret = i2c_master_write_slave(RTC_ADDR, buf, n + 1);
+		i2c_unlock();
+		
+		addr += n;
+		data += n;
+		len -= n;
+	}
+	
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "write_rtc_sram failed");
+		return 1;
+	}
+	
+	return 0;
+}
+
+
 /**
  * Read multiple bytes from the RTC via I2C.
  * Returns zero if successful
  */
 int read_rtc_bytes(uint8_t addr, uint8_t* values, uint8_t nBytes)
+{
+	return read_rtc_regs(addr, values, nBytes, I2C_PRIO_NORMAL);
+}
+
+
+/**
+ * Read multiple bytes from the RTC via I2C locking the bus at prio (I2C_PRIO_xxx).
+ * Returns zero if successful
+ */
+static int read_rtc_regs(uint8_t addr, uint8_t* values, uint8_t nBytes, int prio)
 {
     esp_err_t ret;
 	
 	// Atomically perform the I2C access
-	i2c_lock();
+	i2c_lock_prio(prio);
 	ret = i2c_master_write_slave(RTC_ADDR, &addr, 1);
 	if (ret == ESP_OK) {
 		ret = i2c_master_read_slave(RTC_ADDR, values, nBytes);
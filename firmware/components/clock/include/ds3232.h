@@ -165,6 +165,7 @@ int read_rtc_time(tmElements_t* tm);
 int write_rtc_time(tmElements_t tm);
 int write_rtc_bytes(uint8_t *values, uint8_t nBytes);
 int write_rtc_byte(uint8_t addr, uint8_t value);
+int write_rtc_sram(uint8_t addr, const uint8_t* data, int len);
 int read_rtc_bytes(uint8_t addr, uint8_t *values, uint8_t nBytes);
 int read_rtc_byte(uint8_t addr, uint8_t *value);
 void set_rtc_alarm_secs(enum ALARM_TYPES_t alarmType, uint8_t seconds, uint8_t minutes, uint8_t hours, uint8_t daydate);
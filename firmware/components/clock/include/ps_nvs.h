@@ -0,0 +1,102 @@
+/*
+ * Extended Persistent Storage Module
+ *
+ * Settings that don't have to survive a crash mid-update, and don't fit in the RTC
+ * SRAM, are kept in the ESP32 NVS flash partition.  Each setting has a typed key.  All
+ * settings are loaded into RAM on first access and written through when they change.
+ * Larger data sets are stored as named blobs that are read and written whole.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PS_NVS_H
+#define PS_NVS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+
+
+//
+// PS NVS Constants
+//
+
+// NVS namespace for our settings
+#define PS_NVS_NAMESPACE "firecam"
+
+// Setting types
+#define PS_NVS_TYPE_U8  0
+#define PS_NVS_TYPE_U16 1
+#define PS_NVS_TYPE_U32 2
+#define PS_NVS_TYPE_I32 3
+
+// Blob names (kept apart from the setting key names)
+#define PS_NVS_BLOB_LEP_CORR "lep_corr"
+#define PS_NVS_BLOB_REC_SCHED "rec_sched"
+
+
+
+//
+// PS NVS typedefs
+//
+
+// Setting keys
+typedef enum {
+	PS_NVS_CAM_SPI_MHZ,         // ArduCAM SPI clock found by calibration (0 = uncalibrated)
+	PS_NVS_RTC_CAL_SECS,        // System time the RTC was last set from SNTP (0 = never)
+	PS_NVS_RTC_CAL_ERR_USEC,    // RTC error when it was last set from SNTP
+	PS_NVS_WIFI_PROFILE,        // WIFI_PROFILE_xxx
+	PS_NVS_WIFI_AP_CHAN,        // Channel of the AP last connected to in client mode (0 = none)
+	PS_NVS_WIFI_AP_BSSID_HI,    // BSSID bytes 0-1 of that AP
+	PS_NVS_WIFI_AP_BSSID_LO,    // BSSID bytes 2-5 of that AP
+	PS_NVS_SYNC_MODE,           // SYNC_MODE_xxx
+	PS_NVS_UPLOAD_ADDR,         // Upload server IPV4 address (most-significant byte first)
+	PS_NVS_UPLOAD_PORT,         // Upload server port (0 = uploads disabled)
+	PS_NVS_ISO_MODE,            // SYS_ISO_xxx
+	PS_NVS_ISO_COLOR,           // SYS_ISO_COLOR_xxx
+	PS_NVS_ISO_LOW,             // Isotherm thresholds (K * 100)
+	PS_NVS_ISO_HIGH,
+	PS_NVS_METER_MODE,          // SYS_METER_xxx
+	PS_NVS_LEP_CROP,            // Radiometric crop x, y, w, h (most-significant byte first)
+	PS_NVS_ROI1_CORR,           // Statistics region emissivity (high 16 bits) and reflected
+	PS_NVS_ROI2_CORR,           //   temperature (low 16 bits), one per region
+	PS_NVS_HEALTH_REBOOTS,      // System restarts by the health monitor
+	PS_NVS_TLOG_RATE,           // Session telemetry log samples per second (0 = off)
+	PS_NVS_FUSION_DIST,         // Fusion calibration (high 16 bits) and subject (low 16 bits)
+	                            //   distances in cm
+	PS_NVS_NUM_KEYS
+} ps_nvs_key_t;
+
+
+
+//
+// PS NVS API
+//
+bool ps_nvs_init();
+uint32_t ps_nvs_get_uint(ps_nvs_key_t key);
+int32_t ps_nvs_get_int(ps_nvs_key_t key);
+bool ps_nvs_set_uint(ps_nvs_key_t key, uint32_t val);
+bool ps_nvs_set_int(ps_nvs_key_t key, int32_t val);
+bool ps_nvs_get_blob(const char* name, void* bufP, uint32_t len);
+bool ps_nvs_set_blob(const char* name, const void* bufP, uint32_t len);
+bool ps_nvs_erase_blob(const char* name);
+bool ps_nvs_locked_by(TaskHandle_t task);
+
+#endif /* PS_NVS_H */
@@ -49,6 +49,30 @@
 #define PS_PW_MAX_LEN       32
 #define PS_PALETTE_NAME_LEN 16
 #define PS_REC_INTERVAL_LEN 2
+#define PS_JRNL_DIR_LEN     25
+#define PS_CAM_ROI_LEN      4
+#define PS_FUSION_LEN       5
+#define PS_STATS_ROI_LEN    (SYS_LEP_STATS_MAX_ROI * 4)
+#define PS_ALARM_LEN        6
+
+// Time cached configuration updates must be stable before they are written
+#define PS_FLUSH_DELAY_MSEC 500
+
+
+
+//
+// PS Utilities typedefs
+//
+
+// Recording journal.  file_task keeps it up to date while recording so a session
+// interrupted by a crash or power failure can be resumed after a reboot.
+typedef struct {
+	char session_dir[PS_JRNL_DIR_LEN + 1];
+	uint16_t image_seq_num;      // Next image file sequence number
+	uint8_t container_num;       // Next session container number
+	uint32_t lep_seq_num;        // Next high-rate record sequence number
+	uint32_t lep_offset;         // Length of the high-rate file as of its last sync
+} ps_rec_journal_t;
 
 
 
@@ -62,5 +86,13 @@ bool ps_get_rec_enable();
 void ps_set_rec_enable(bool en);
 void ps_get_gui_state(gui_state_t* state);
 void ps_set_gui_state(const gui_state_t* state);
+uint32_t ps_get_gui_version();
+bool ps_get_rec_journal(ps_rec_journal_t* jrnl);
+void ps_set_rec_journal(const ps_rec_journal_t* jrnl, bool pos_only);
+void ps_clear_rec_journal();
+int ps_get_cam_spi_freq();
+void ps_set_cam_spi_freq(int freq_hz);
+bool ps_flush();
+void ps_flush_check();
 
 #endif /* PS_UTILITIES_H */
\ No newline at end of file
@@ -0,0 +1,80 @@
+/*
+ * Recording schedule
+ *
+ * Holds a table of weekly recording windows kept in NVS.  While a window is active its
+ * recording interval, camera enables and duty-cycled sleep replace the configured
+ * ones.  The first active window in the table wins and the configured settings are
+ * used outside all windows.  Windows are set in local camera time (the time set with
+ * set_time) and a window whose end is at or before its start crosses midnight (into
+ * the next day, which doesn't need to be one of its days).
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef SCHEDULE_UTILITIES_H
+#define SCHEDULE_UTILITIES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+
+//
+// Schedule Constants
+//
+
+// Windows in the table
+#define SCHED_MAX_WINDOWS    8
+
+// Stored table layout version
+#define SCHED_VERSION        1
+
+// Minutes in a day (window start and end times are less than this)
+#define SCHED_DAY_MIN        1440
+
+// Window flags
+#define SCHED_FLAG_ARDUCAM   0x01      /* Record ArduCAM images */
+#define SCHED_FLAG_LEPTON    0x02      /* Record Lepton images */
+#define SCHED_FLAG_SLEEP     0x04      /* Duty-cycled sleep between images */
+
+
+
+//
+// Schedule typedefs
+//
+typedef struct {
+	uint8_t days;                // Days it starts on (bit 0 = Sunday), 0 if unused
+	uint8_t flags;               // SCHED_FLAG_xxx
+	uint16_t start_min;          // Start, minutes after midnight
+	uint16_t end_min;            // End, minutes after midnight
+	uint16_t record_interval;    // Seconds between images (REC_INT_x_VAL)
+} sched_window_t;
+
+
+
+//
+// Schedule API
+//
+void sched_init();
+bool sched_set_window(int n, const sched_window_t* wP);
+void sched_get_window(int n, sched_window_t* wP);
+uint32_t sched_get_version();
+int sched_active_window(time_t t, sched_window_t* wP);
+time_t sched_next_change(time_t t);
+
+#endif /* SCHEDULE_UTILITIES_H */
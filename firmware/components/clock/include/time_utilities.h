@@ -26,16 +26,68 @@
 #define TIME_UTILITIES_H
 
 #include <stdint.h>
+#include <sys/time.h>
 #include "ds3232.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+
+//
+// Time Utilities Constants
+//
+
+// Maximum time to wait for the RTC seconds to change when aligning the system time
+#define TIME_RTC_EDGE_MSEC   1100
+
+// RTC polling interval while waiting for the seconds to change
+#define TIME_RTC_POLL_USEC   1000
+
+// Errors larger than this are stepped instead of slewed when disciplining the system time
+#define TIME_MAX_SLEW_USEC   100000
+
+// The second tick is notified this long after the system time's second changes
+#define TIME_TICK_LATE_USEC  100
+
+// The RTC is not used to discipline the system time for this long after a SNTP sync
+#define TIME_SNTP_VALID_SEC  7200
+
+// The RTC is not used to discipline the system time for this long after a correction
+// from a sync_task master
+#define TIME_SYNC_VALID_SEC  60
+
+// RTC check against SNTP
+//   The RTC is polled every TIME_CAL_POLL_MSEC to find its second edge
+//   The RTC is set when it is off by more than TIME_RTC_MAX_ERR_MSEC
+//   The RTC is set within TIME_CAL_SET_WINDOW_MSEC of the start of a second
+//   Drift is measured over at least TIME_CAL_MIN_SEC
+//   The DS3232 aging offset is about 0.1 ppm per LSB
+#define TIME_CAL_POLL_MSEC        10
+#define TIME_RTC_MAX_ERR_MSEC     100
+#define TIME_CAL_SET_WINDOW_MSEC  20
+#define TIME_CAL_MIN_SEC          86400
+#define TIME_AGING_PPB_PER_LSB    100
+
+// RTC check states
+#define TIME_CAL_IDLE  0
+#define TIME_CAL_EDGE  1
+#define TIME_CAL_SET   2
 
 
 //
 // Time Utilities API
 //
 void time_init();
+void time_sntp_sync(struct timeval* tv);
+void time_discipline();
+void time_sync_adjust(int64_t err_usec);
+int time_discipline_msec();
+bool time_start_tick(TaskHandle_t task, uint32_t mask);
 void time_set(tmElements_t te);
 void time_get(tmElements_t* te);
+void time_get_from_usec(int64_t esp_usec, tmElements_t* te, uint16_t* msec);
 bool time_changed(tmElements_t* te, time_t* prev_time);
+int time_msec_to_next_second();
+bool time_set_wake_alarm(time_t wake_secs);
 void time_get_disp_string(tmElements_t te, char* buf);
 void time_get_short_string(tmElements_t te, char* buf);
 
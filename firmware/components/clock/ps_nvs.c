@@ -0,0 +1,346 @@
+/*
+ * Extended Persistent Storage Module
+ *
+ * Settings that don't have to survive a crash mid-update, and don't fit in the RTC
+ * SRAM, are kept in the ESP32 NVS flash partition.  Each setting has a typed key.  All
+ * settings are loaded into RAM on first access and written through when they change.
+ * Larger data sets are stored as named blobs that are read and written whole.
+ * Missing settings (for example after a firmware update adds one) take their default
+ * value.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "ps_nvs.h"
+#include "sys_utilities.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+
+
+//
+// PS NVS typedefs
+//
+typedef struct {
+	const char* name;           // NVS key (15 characters max)
+	uint8_t type;               // PS_NVS_TYPE_xxx
+	uint32_t def_val;           // Default value
+} ps_nvs_setting_t;
+
+
+
+//
+// PS NVS variables
+//
+static const char* TAG = "ps_nvs";
+
+// Setting definitions (indexed by ps_nvs_key_t)
+static const ps_nvs_setting_t ps_nvs_settings[PS_NVS_NUM_KEYS] = {
+	{"cam_spi_mhz", PS_NVS_TYPE_U8, 0},
+	{"rtc_cal_secs", PS_NVS_TYPE_U32, 0},
+	{"rtc_cal_err", PS_NVS_TYPE_I32, 0},
+	{"wifi_profile", PS_NVS_TYPE_U8, 0},
+	{"wifi_ap_chan", PS_NVS_TYPE_U8, 0},
+	{"wifi_bssid_hi", PS_NVS_TYPE_U16, 0},
+	{"wifi_bssid_lo", PS_NVS_TYPE_U32, 0},
+	{"sync_mode", PS_NVS_TYPE_U8, 0},
+	{"upload_addr", PS_NVS_TYPE_U32, 0},
+	{"upload_port", PS_NVS_TYPE_U16, 0},
+	{"iso_mode", PS_NVS_TYPE_U8, SYS_ISO_OFF},
+	{"iso_color", PS_NVS_TYPE_U8, SYS_ISO_COLOR_GREEN},
+	{"iso_low", PS_NVS_TYPE_U32, 30315},       // 30 °C
+	{"iso_high", PS_NVS_TYPE_U32, 37315},      // 100 °C
+	{"meter_mode", PS_NVS_TYPE_U8, SYS_METER_OFF},
+	{"lep_crop", PS_NVS_TYPE_U32, 0},          // Full frame
+	{"roi1_corr", PS_NVS_TYPE_U32, (100 << 16) | SYS_LEP_REFL_DEF_K100},   // Uncorrected
+	{"roi2_corr", PS_NVS_TYPE_U32, (100 << 16) | SYS_LEP_REFL_DEF_K100},
+	{"health_reboots", PS_NVS_TYPE_U32, 0},
+	{"tlog_rate", PS_NVS_TYPE_U8, 0},
+	{"fusion_dist", PS_NVS_TYPE_U32, 0}        // Not distance corrected
+};
+
+// Cached values
+static bool ps_nvs_loaded = false;
+static uint32_t ps_nvs_values[PS_NVS_NUM_KEYS];
+static nvs_handle ps_nvs_handle;
+static SemaphoreHandle_t ps_nvs_mutex;
+
+
+
+//
+// PS NVS Forward Declarations for internal functions
+//
+static void ps_nvs_load();
+static bool ps_nvs_set(ps_nvs_key_t key, uint32_t val);
+
+
+
+//
+// PS NVS API
+//
+
+/**
+ * Initialize the NVS flash partition (also used by the WiFi driver).  Settings are
+ * loaded on first access.
+ */
+bool ps_nvs_init()
+{
+	esp_err_t ret;
+	
+	ps_nvs_mutex = xSemaphoreCreateMutex();
+	
+	ret = nvs_flash_init();
+	if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+		ret = nvs_flash_erase();
+		if (ret != ESP_OK) {
+			ESP_LOGE(TAG, "nvs_flash_erase failed (%d)", ret);
+			return false;
+		}
+		ret = nvs_flash_init();
+	}
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "nvs_flash_init failed (%d)", ret);
+		return false;
+	}
+	
+	ret = nvs_open(PS_NVS_NAMESPACE, NVS_READWRITE, &ps_nvs_handle);
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "nvs_open failed (%d)", ret);
+		return false;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Get an unsigned setting
+ */
+uint32_t ps_nvs_get_uint(ps_nvs_key_t key)
+{
+	uint32_t val;
+	
+	if (key >= PS_NVS_NUM_KEYS) return 0;
+	
+	xSemaphoreTake(ps_nvs_mutex, portMAX_DELAY);
+	if (!ps_nvs_loaded) ps_nvs_load();
+	val = ps_nvs_values[key];
+	xSemaphoreGive(ps_nvs_mutex);
+	
+	return val;
+}
+
+
+/**
+ * Get a signed setting
+ */
+int32_t ps_nvs_get_int(ps_nvs_key_t key)
+{
+	return (int32_t) ps_nvs_get_uint(key);
+}
+
+
+/**
+ * Store an unsigned setting.  Returns false if it could not be written to flash.
+ */
+bool ps_nvs_set_uint(ps_nvs_key_t key, uint32_t val)
+{
+	return ps_nvs_set(key, val);
+}
+
+
+/**
+ * Store a signed setting.  Returns false if it could not be written to flash.
+ */
+bool ps_nvs_set_int(ps_nvs_key_t key, int32_t val)
+{
+	return ps_nvs_set(key, (uint32_t) val);
+}
+
+
+/**
+ * Read a blob of exactly len bytes into bufP.  Returns false if it doesn't exist or is
+ * a different length (for example written by a firmware version with another layout).
+ */
+bool ps_nvs_get_blob(const char* name, void* bufP, uint32_t len)
+{
+	esp_err_t ret;
+	size_t blob_len = len;
+	
+	xSemaphoreTake(ps_nvs_mutex, portMAX_DELAY);
+	ret = nvs_get_blob(ps_nvs_handle, name, bufP, &blob_len);
+	xSemaphoreGive(ps_nvs_mutex);
+	
+	if ((ret != ESP_OK) && (ret != ESP_ERR_NVS_NOT_FOUND)) {
+		ESP_LOGE(TAG, "Failed to read %s (%d)", name, ret);
+	}
+	
+	return ((ret == ESP_OK) && (blob_len == len));
+}
+
+
+/**
+ * Write a blob.  Returns false if it could not be written to flash.
+ */
+bool ps_nvs_set_blob(const char* name, const void* bufP, uint32_t len)
+{
+	esp_err_t ret;
+	
+	xSemaphoreTake(ps_nvs_mutex, portMAX_DELAY);
+	ret = nvs_set_blob(ps_nvs_handle, name, bufP, len);
+	if (ret == ESP_OK) {
+		ret = nvs_commit(ps_nvs_handle);
+	}
+	xSemaphoreGive(ps_nvs_mutex);
+	
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "Failed to write %s (%d)", name, ret);
+	}
+	
+	return (ret == ESP_OK);
+}
+
+
+/**
+ * Remove a blob.  Returns false if it existed and could not be removed.
+ */
+bool ps_nvs_erase_blob(const char* name)
+{
+	esp_err_t ret;
+	
+	xSemaphoreTake(ps_nvs_mutex, portMAX_DELAY);
+	ret = nvs_erase_key(ps_nvs_handle, name);
+	if (ret == ESP_OK) {
+		ret = nvs_commit(ps_nvs_handle);
+	} else if (ret == ESP_ERR_NVS_NOT_FOUND) {
+		ret = ESP_OK;
+	}
+	xSemaphoreGive(ps_nvs_mutex);
+	
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "Failed to erase %s (%d)", name, ret);
+	}
+	
+	return (ret == ESP_OK);
+}
+
+
+/**
+ * Return true if task is accessing the settings
+ */
+bool ps_nvs_locked_by(TaskHandle_t task)
+{
+	return (xSemaphoreGetMutexHolder(ps_nvs_mutex) == task);
+}
+
+
+
+//
+// PS NVS internal functions
+//
+
+/**
+ * Load all settings into our cache.  Called with the mutex held.
+ */
+static void ps_nvs_load()
+{
+	const ps_nvs_setting_t* sP;
+	esp_err_t ret;
+	int i;
+	uint8_t u8;
+	uint16_t u16;
+	uint32_t u32;
+	int32_t i32;
+	
+	for (i=0; i<PS_NVS_NUM_KEYS; i++) {
+		sP = &ps_nvs_settings[i];
+		switch (sP->type) {
+			case PS_NVS_TYPE_U8:
+				ret = nvs_get_u8(ps_nvs_handle, sP->name, &u8);
+				u32 = u8;
+				break;
+			case PS_NVS_TYPE_U16:
+				ret = nvs_get_u16(ps_nvs_handle, sP->name, &u16);
+				u32 = u16;
+				break;
+			case PS_NVS_TYPE_U32:
+				ret = nvs_get_u32(ps_nvs_handle, sP->name, &u32);
+				break;
+			default:
+				ret = nvs_get_i32(ps_nvs_handle, sP->name, &i32);
+				u32 = (uint32_t) i32;
+		}
+		
+		if (ret == ESP_OK) {
+			ps_nvs_values[i] = u32;
+		} else {
+			if (ret != ESP_ERR_NVS_NOT_FOUND) {
+				ESP_LOGE(TAG, "Failed to read %s (%d)", sP->name, ret);
+			}
+			ps_nvs_values[i] = sP->def_val;
+		}
+	}
+	
+	ps_nvs_loaded = true;
+}
+
+
+/**
+ * Update a setting in our cache and write it to flash if it changed
+ */
+static bool ps_nvs_set(ps_nvs_key_t key, uint32_t val)
+{
+	const ps_nvs_setting_t* sP;
+	esp_err_t ret = ESP_OK;
+	
+	if (key >= PS_NVS_NUM_KEYS) return false;
+	sP = &ps_nvs_settings[key];
+	
+	xSemaphoreTake(ps_nvs_mutex, portMAX_DELAY);
+	if (!ps_nvs_loaded) ps_nvs_load();
+	
+	if (ps_nvs_values[key] != val) {
+		ps_nvs_values[key] = val;
+		switch (sP->type) {
+			case PS_NVS_TYPE_U8:
+				ret = nvs_set_u8(ps_nvs_handle, sP->name, (uint8_t) val);
+				break;
+			case PS_NVS_TYPE_U16:
+				ret = nvs_set_u16(ps_nvs_handle, sP->name, (uint16_t) val);
+				break;
+			case PS_NVS_TYPE_U32:
+				ret = nvs_set_u32(ps_nvs_handle, sP->name, val);
+				break;
+			default:
+				ret = nvs_set_i32(ps_nvs_handle, sP->name, (int32_t) val);
+		}
+		if (ret == ESP_OK) {
+			ret = nvs_commit(ps_nvs_handle);
+		}
+		if (ret != ESP_OK) {
+			ESP_LOGE(TAG, "Failed to write %s (%d)", sP->name, ret);
+		}
+	}
+	xSemaphoreGive(ps_nvs_mutex);
+	
+	return (ret == ESP_OK);
+}
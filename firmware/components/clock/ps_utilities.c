@@ -8,6 +8,14 @@
  * This is done to eliminate the need for mutex protection, that could cause a 
  * dead-lock with another process also accessing a device via I2C.
  *
+ * Settings that aren't crash-critical and don't fit here are kept in NVS by ps_nvs.
+ *
+ * Configuration updates (WiFi and GUI state) are cached and
+ * written to the RTC SRAM together by ps_flush once they have been unchanged for
+ * PS_FLUSH_DELAY_MSEC, so a burst of updates only writes each region once.  The
+ * recording flag and journal are written immediately, along with anything cached,
+ * since they have to survive a crash.
+ *
  * Copyright 2020 Dan Julio
  *
  * This file is part of firecam.
@@ -27,11 +35,16 @@
  *
  */
 #include "ps_utilities.h"
+#include "ps_nvs.h"
 #include "system_config.h"
 #include "ds3232.h"
 #include "esp_system.h"
+#include "esp_attr.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
 #include "palettes.h"
+#include "vospi.h"
 #include <stdbool.h>
 #include <string.h>
 
@@ -71,25 +84,70 @@
 #define PS_PALETTE_NAME_ADDR   (PS_GAIN_MODE_ADDR + 1)
 #define PS_REC_INTERVAL_ADDR   (PS_PALETTE_NAME_ADDR + PS_PALETTE_NAME_LEN + 1)
 
-#define PS_LAST_VALID_ADDR     (PS_REC_INTERVAL_ADDR + PS_REC_INTERVAL_LEN)
+// Version 2 compatible additions (unused locations were initialized to 0 which is the
+// default value)
+#define PS_REC_FORMAT_ADDR     (PS_REC_INTERVAL_ADDR + PS_REC_INTERVAL_LEN)
+#define PS_REC_CONTAINER_ADDR  (PS_REC_FORMAT_ADDR + 1)
+#define PS_JRNL_VALID_ADDR     (PS_REC_CONTAINER_ADDR + 1)
+#define PS_JRNL_DIR_ADDR       (PS_JRNL_VALID_ADDR + 1)
+#define PS_JRNL_IMG_SEQ_ADDR   (PS_JRNL_DIR_ADDR + PS_JRNL_DIR_LEN + 1)
+#define PS_JRNL_CONT_NUM_ADDR  (PS_JRNL_IMG_SEQ_ADDR + 2)
+#define PS_JRNL_LEP_SEQ_ADDR   (PS_JRNL_CONT_NUM_ADDR + 1)
+#define PS_JRNL_LEP_OFF_ADDR   (PS_JRNL_LEP_SEQ_ADDR + 4)
+#define PS_REC_RING_ADDR       (PS_JRNL_LEP_OFF_ADDR + 4)
+#define PS_CAM_SPI_MHZ_ADDR    (PS_REC_RING_ADDR + 1)      /* Unused, moved to NVS */
+#define PS_CAM_RES_ADDR        (PS_CAM_SPI_MHZ_ADDR + 1)
+#define PS_CAM_QUALITY_ADDR    (PS_CAM_RES_ADDR + 1)
+#define PS_CAM_ROI_ADDR        (PS_CAM_QUALITY_ADDR + 1)
+#define PS_LEP_AGC_ADDR        (PS_CAM_ROI_ADDR + PS_CAM_ROI_LEN)
+#define PS_FUSION_ADDR         (PS_LEP_AGC_ADDR + 1)
+
+#define PS_STATS_ROI_ADDR      (PS_FUSION_ADDR + PS_FUSION_LEN)
+#define PS_ALARM_ADDR          (PS_STATS_ROI_ADDR + PS_STATS_ROI_LEN)
+#define PS_LAST_VALID_ADDR     (PS_ALARM_ADDR + PS_ALARM_LEN)
 #define PS_CHECKSUM_ADDR       (SRAM_SIZE - 1)
 
+#if PS_LAST_VALID_ADDR > PS_CHECKSUM_ADDR
+#error "Persistent storage layout doesn't fit in the RTC SRAM"
+#endif
+
+#if SYS_LEP_STATS_MAX_ROI > 2
+#error "Add PS_NVS_ROIn_CORR keys for the additional statistics regions"
+#endif
+
 // Update region lengths
 #define PS_REC_EN_UPD_LEN      1
 #define PS_WIFI_UPD_LEN        (PS_REC_ARD_EN_ADDR - PS_WIFI_EN_ADDR)
-#define PS_GUI_UPD_LEN         (PS_LAST_VALID_ADDR - PS_REC_ARD_EN_ADDR)
+#define PS_GUI_UPD_LEN         (PS_JRNL_VALID_ADDR - PS_REC_ARD_EN_ADDR)
+#define PS_JRNL_UPD_LEN        (PS_REC_RING_ADDR - PS_JRNL_VALID_ADDR)
+#define PS_JRNL_POS_UPD_LEN    (PS_REC_RING_ADDR - PS_JRNL_IMG_SEQ_ADDR)
+#define PS_CAM_IMG_UPD_LEN     (PS_LAST_VALID_ADDR - PS_CAM_RES_ADDR)
+
+// Recording flags stored in the container location (originally 0 or 1 for container mode)
+#define PS_REC_FLAG_CONTAINER  0x01
+#define PS_REC_FLAG_MOTION     0x02
+#define PS_REC_FLAG_SLEEP      0x04
+#define PS_REC_FLAG_META_LOG   0x08
+
+// Default alarm threshold (about 100 °C in K * 100)
+#define PS_ALARM_THRESH_DEF    37310
 
 // Stored Wifi Flags bitmask
-#define PS_WIFI_FLAG_MASK      (WIFI_INFO_FLAG_STARTUP_ENABLE | WIFI_INFO_FLAG_CL_STATIC_IP | WIFI_INFO_FLAG_CLIENT_MODE)
+#define PS_WIFI_FLAG_MASK      (WIFI_INFO_FLAG_STARTUP_ENABLE | WIFI_INFO_FLAG_CL_STATIC_IP | WIFI_INFO_FLAG_AP_STA_MODE | WIFI_INFO_FLAG_CLIENT_MODE)
 
 
 enum ps_update_types_t {
 	FULL,                      // Update all bytes in the external SRAM
 	WIFI,                      // Update wifi-related and checksum
 	REC,                       // Update record enable and checksum
-	GUI                        // Update GUI state related and checksum
+	GUI,                       // Update GUI state related and checksum
+	JRNL,                      // Update the recording journal and checksum
+	JRNL_POS                   // Update the recording journal positions and checksum
 };
 
+// Cached update types
+#define PS_CACHED_MASK         ((1 << WIFI) | (1 << GUI))
+
 
 
 //
@@ -97,8 +155,16 @@ enum ps_update_types_t {
 //
 static const char* TAG = "ps_utilities";
 
-// Our local copy for reading
-static uint8_t ps_shadow_buffer[SRAM_SIZE];
+// Our local copy for reading (rarely accessed so kept in PSRAM)
+static EXT_RAM_ATTR uint8_t ps_shadow_buffer[SRAM_SIZE];
+
+// Cached updates not yet written to the RTC SRAM (bitmask of 1 << ps_update_types_t)
+static uint32_t ps_dirty_mask = 0;
+static int64_t ps_dirty_usec;               // Time of the latest cached update
+static portMUX_TYPE ps_dirty_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Incremented each time the GUI state is stored so users can tell when it changes
+static volatile uint32_t ps_gui_version = 0;
 
 
 
@@ -106,9 +172,14 @@ static uint8_t ps_shadow_buffer[SRAM_SIZE];
 // PS Utilities Forward Declarations for internal functions
 //
 static bool ps_read_array();
+static bool ps_update(enum ps_update_types_t t);
 static bool ps_write_array(enum ps_update_types_t t);
 static void ps_init_array(bool upgrade);
+static void ps_init_alarm();
+static bool ps_fusion_dist_valid(uint16_t d);
 static void ps_store_string(char* s, uint8_t start, uint8_t max_len);
+static void ps_store_uint32(uint32_t v, uint8_t start);
+static uint32_t ps_load_uint32(uint8_t start);
 static bool ps_valid_magic_word();
 static uint8_t ps_compute_checksum();
 static int ps_write_bytes_to_rtc(uint8_t start_addr, uint8_t* data, uint8_t data_len);
@@ -167,6 +238,10 @@ void ps_get_wifi_info(wifi_info_t* info)
 		info->ap_ip_addr[i] = ps_shadow_buffer[PS_WIFI_AP_IP_ADDR + i];
 		info->sta_ip_addr[i] = ps_shadow_buffer[PS_WIFI_STA_IP_ADDR + i];
 	}
+	
+	// The profile was added later and is kept in NVS
+	info->profile = (uint8_t) ps_nvs_get_uint(PS_NVS_WIFI_PROFILE);
+	if (info->profile >= WIFI_NUM_PROFILES) info->profile = WIFI_PROFILE_DEFAULT;
 }
 
 
@@ -188,9 +263,15 @@ void ps_set_wifi_info(const wifi_info_t* info)
 		ps_shadow_buffer[PS_WIFI_STA_IP_ADDR + i] = info->sta_ip_addr[i];
 	}
 	ps_shadow_buffer[PS_CHECKSUM_ADDR] = ps_compute_checksum();
-	if (!ps_write_array(WIFI)) {
+	if (!ps_update(WIFI)) {
 		ESP_LOGE(TAG, "Failed to write WiFi data to RTC SRAM");
 	}
+	
+	if (info->profile != (uint8_t) ps_nvs_get_uint(PS_NVS_WIFI_PROFILE)) {
+		if (!ps_nvs_set_uint(PS_NVS_WIFI_PROFILE, (uint32_t) info->profile)) {
+			ESP_LOGE(TAG, "Failed to write WiFi profile to NVS");
+		}
+	}
 }
 
 
@@ -214,21 +295,50 @@ void ps_set_rec_enable(bool en)
 {
 	ps_shadow_buffer[PS_REC_EN_ADDR] = en ? 1 : 0;
 	ps_shadow_buffer[PS_CHECKSUM_ADDR] = ps_compute_checksum();
-	if (!ps_write_array(REC)) {
+	if (!ps_update(REC)) {
 		ESP_LOGE(TAG, "Failed to write record enable to RTC SRAM");
 	}
 }
 
 
+/**
+ * Get the ArduCAM SPI clock found by cam_task's calibration.  Returns 0 if the clock
+ * hasn't been calibrated.
+ */
+int ps_get_cam_spi_freq()
+{
+	return ps_nvs_get_uint(PS_NVS_CAM_SPI_MHZ) * 1000000;
+}
+
+
+/**
+ * Store the ArduCAM SPI clock (rounded down to MHz) into persistent storage (NVS)
+ */
+void ps_set_cam_spi_freq(int freq_hz)
+{
+	if (!ps_nvs_set_uint(PS_NVS_CAM_SPI_MHZ, (uint32_t) (freq_hz / 1000000))) {
+		ESP_LOGE(TAG, "Failed to write ArduCAM SPI clock to NVS");
+	}
+}
+
+
 /**
  * Get GUI Camera state
  */
 void ps_get_gui_state(gui_state_t* state)
 {
 	bool repair_mem = false;
+	int i;
+	uint32_t u;
 	
 	state->rec_arducam_enable = ps_shadow_buffer[PS_REC_ARD_EN_ADDR] != 0 ? true : false;
 	state->rec_lepton_enable = ps_shadow_buffer[PS_REC_LEP_EN_ADDR] != 0 ? true : false;
+#ifndef INCLUDE_SYS_ARDUCAM
+	// Profiles without the ArduCAM only record the Lepton (the stored settings are kept
+	// for a firmware with it)
+	state->rec_arducam_enable = false;
+	state->rec_lepton_enable = true;
+#endif
 	
 	state->gain_mode = ps_shadow_buffer[PS_GAIN_MODE_ADDR];
 	
@@ -245,6 +355,188 @@ void ps_get_gui_state(gui_state_t* state)
 		ESP_LOGE(TAG, "reset record_interval to legal value");
 	}
 	
+	state->record_format = ps_shadow_buffer[PS_REC_FORMAT_ADDR];
+	if (state->record_format > REC_FORMAT_AVI) {
+		state->record_format = REC_FORMAT_JSON;
+		ps_shadow_buffer[PS_REC_FORMAT_ADDR] = state->record_format;
+		repair_mem = true;
+		ESP_LOGE(TAG, "reset record_format to legal value");
+	}
+	
+	state->record_container = (ps_shadow_buffer[PS_REC_CONTAINER_ADDR] & PS_REC_FLAG_CONTAINER) != 0;
+	state->record_motion = (ps_shadow_buffer[PS_REC_CONTAINER_ADDR] & PS_REC_FLAG_MOTION) != 0;
+	state->record_sleep = (ps_shadow_buffer[PS_REC_CONTAINER_ADDR] & PS_REC_FLAG_SLEEP) != 0;
+	state->record_meta_log = (ps_shadow_buffer[PS_REC_CONTAINER_ADDR] & PS_REC_FLAG_META_LOG) != 0;
+	state->record_ring = ps_shadow_buffer[PS_REC_RING_ADDR] != 0 ? true : false;
+	
+	state->cam_resolution = ps_shadow_buffer[PS_CAM_RES_ADDR];
+	if (state->cam_resolution > SYS_CAM_RES_160x120) {
+		state->cam_resolution = SYS_CAM_RES_640x480;
+		ps_shadow_buffer[PS_CAM_RES_ADDR] = state->cam_resolution;
+		repair_mem = true;
+		ESP_LOGE(TAG, "reset cam_resolution to legal value");
+	}
+	
+	// A quality of 0 is an unused location from an earlier firmware version
+	state->cam_quality = ps_shadow_buffer[PS_CAM_QUALITY_ADDR];
+	if ((state->cam_quality < OV2640_QS_MIN) || (state->cam_quality > OV2640_QS_MAX)) {
+		if (state->cam_quality != 0) {
+			ESP_LOGE(TAG, "reset cam_quality to legal value");
+		}
+		state->cam_quality = OV2640_QS_DEFAULT;
+		ps_shadow_buffer[PS_CAM_QUALITY_ADDR] = state->cam_quality;
+		repair_mem = true;
+	}
+	
+	// Region of interest is stored in SYS_CAM_ROI_UNIT steps
+	state->cam_roi_x = ps_shadow_buffer[PS_CAM_ROI_ADDR] * SYS_CAM_ROI_UNIT;
+	state->cam_roi_y = ps_shadow_buffer[PS_CAM_ROI_ADDR + 1] * SYS_CAM_ROI_UNIT;
+	state->cam_roi_w = ps_shadow_buffer[PS_CAM_ROI_ADDR + 2] * SYS_CAM_ROI_UNIT;
+	state->cam_roi_h = ps_shadow_buffer[PS_CAM_ROI_ADDR + 3] * SYS_CAM_ROI_UNIT;
+	if (((state->cam_roi_x + state->cam_roi_w) > SYS_CAM_ROI_REF_WIDTH) ||
+	    ((state->cam_roi_y + state->cam_roi_h) > SYS_CAM_ROI_REF_HEIGHT))
+	{
+		state->cam_roi_x = 0;
+		state->cam_roi_y = 0;
+		state->cam_roi_w = 0;
+		state->cam_roi_h = 0;
+		memset(&ps_shadow_buffer[PS_CAM_ROI_ADDR], 0, PS_CAM_ROI_LEN);
+		repair_mem = true;
+		ESP_LOGE(TAG, "reset cam_roi to full image");
+	}
+	
+	state->lep_agc_mode = ps_shadow_buffer[PS_LEP_AGC_ADDR];
+	if (state->lep_agc_mode >= SYS_LEP_AGC_NUM) {
+		state->lep_agc_mode = SYS_LEP_AGC_LINEAR;
+		ps_shadow_buffer[PS_LEP_AGC_ADDR] = state->lep_agc_mode;
+		repair_mem = true;
+		ESP_LOGE(TAG, "reset lep_agc_mode to legal value");
+	}
+	
+	// Fusion settings are stored as mode, alpha, x offset, y offset and scale.  An alpha
+	// or scale of 0 is an unused location from an earlier firmware version.
+	state->fusion_mode = ps_shadow_buffer[PS_FUSION_ADDR];
+	state->fusion_alpha = ps_shadow_buffer[PS_FUSION_ADDR + 1];
+	state->fusion_offset_x = (int8_t) ps_shadow_buffer[PS_FUSION_ADDR + 2];
+	state->fusion_offset_y = (int8_t) ps_shadow_buffer[PS_FUSION_ADDR + 3];
+	state->fusion_scale = ps_shadow_buffer[PS_FUSION_ADDR + 4];
+	if ((state->fusion_mode >= SYS_FUSION_NUM) ||
+	    (state->fusion_alpha < SYS_FUSION_ALPHA_MIN) || (state->fusion_alpha > SYS_FUSION_ALPHA_MAX) ||
+	    (state->fusion_offset_x < -SYS_FUSION_OFFSET_MAX) || (state->fusion_offset_x > SYS_FUSION_OFFSET_MAX) ||
+	    (state->fusion_offset_y < -SYS_FUSION_OFFSET_MAX) || (state->fusion_offset_y > SYS_FUSION_OFFSET_MAX) ||
+	    (state->fusion_scale < SYS_FUSION_SCALE_MIN) || (state->fusion_scale > SYS_FUSION_SCALE_MAX))
+	{
+		if ((state->fusion_alpha != 0) || (state->fusion_scale != 0)) {
+			ESP_LOGE(TAG, "reset fusion to defaults");
+		}
+		state->fusion_mode = SYS_FUSION_OFF;
+		state->fusion_alpha = SYS_FUSION_ALPHA_DEF;
+		state->fusion_offset_x = 0;
+		state->fusion_offset_y = 0;
+		state->fusion_scale = SYS_FUSION_SCALE_DEF;
+		ps_shadow_buffer[PS_FUSION_ADDR] = state->fusion_mode;
+		ps_shadow_buffer[PS_FUSION_ADDR + 1] = state->fusion_alpha;
+		ps_shadow_buffer[PS_FUSION_ADDR + 2] = 0;
+		ps_shadow_buffer[PS_FUSION_ADDR + 3] = 0;
+		ps_shadow_buffer[PS_FUSION_ADDR + 4] = state->fusion_scale;
+		repair_mem = true;
+	}
+	
+	// Statistics regions are stored as x, y, w, h in Lepton pixels
+	for (i=0; i<SYS_LEP_STATS_MAX_ROI; i++) {
+		state->stats_roi[i].x = ps_shadow_buffer[PS_STATS_ROI_ADDR + i*4];
+		state->stats_roi[i].y = ps_shadow_buffer[PS_STATS_ROI_ADDR + i*4 + 1];
+		state->stats_roi[i].w = ps_shadow_buffer[PS_STATS_ROI_ADDR + i*4 + 2];
+		state->stats_roi[i].h = ps_shadow_buffer[PS_STATS_ROI_ADDR + i*4 + 3];
+		if (((state->stats_roi[i].x + state->stats_roi[i].w) > LEP_WIDTH) ||
+		    ((state->stats_roi[i].y + state->stats_roi[i].h) > LEP_HEIGHT))
+		{
+			memset(&state->stats_roi[i], 0, sizeof(sys_lep_roi_t));
+			memset(&ps_shadow_buffer[PS_STATS_ROI_ADDR + i*4], 0, 4);
+			repair_mem = true;
+			ESP_LOGE(TAG, "reset stats_roi %d to disabled", i);
+		}
+	}
+	
+	// Alarm settings are stored as mode, region (high nibble) and statistic (low nibble),
+	// threshold (2 bytes), rate and hold in the SYS_ALARM units.  A hold of 0 is an unused
+	// location from an earlier firmware version.
+	state->alarm_mode = ps_shadow_buffer[PS_ALARM_ADDR];
+	state->alarm_roi = ps_shadow_buffer[PS_ALARM_ADDR + 1] >> 4;
+	state->alarm_stat = ps_shadow_buffer[PS_ALARM_ADDR + 1] & 0x0F;
+	state->alarm_threshold = ((ps_shadow_buffer[PS_ALARM_ADDR + 2] << 8) | ps_shadow_buffer[PS_ALARM_ADDR + 3]) * SYS_ALARM_THRESH_UNIT;
+	state->alarm_rate = ps_shadow_buffer[PS_ALARM_ADDR + 4] * SYS_ALARM_RATE_UNIT;
+	state->alarm_hold = ps_shadow_buffer[PS_ALARM_ADDR + 5];
+	if ((state->alarm_mode >= SYS_ALARM_NUM) ||
+	    (state->alarm_roi > SYS_LEP_STATS_MAX_ROI) ||
+	    (state->alarm_stat >= SYS_ALARM_STAT_NUM) ||
+	    (state->alarm_hold < SYS_ALARM_HOLD_MIN))
+	{
+		if (state->alarm_hold != 0) {
+			ESP_LOGE(TAG, "reset alarm to defaults");
+		}
+		ps_init_alarm();
+		state->alarm_mode = SYS_ALARM_OFF;
+		state->alarm_roi = 0;
+		state->alarm_stat = SYS_ALARM_STAT_MAX;
+		state->alarm_threshold = PS_ALARM_THRESH_DEF;
+		state->alarm_rate = 0;
+		state->alarm_hold = SYS_ALARM_HOLD_DEF;
+		repair_mem = true;
+	}
+	
+	// The isotherm and meter display settings don't fit in the RTC SRAM and are kept in NVS
+	state->iso_mode = (uint8_t) ps_nvs_get_uint(PS_NVS_ISO_MODE);
+	state->iso_color = (uint8_t) ps_nvs_get_uint(PS_NVS_ISO_COLOR);
+	state->iso_low = ps_nvs_get_uint(PS_NVS_ISO_LOW);
+	state->iso_high = ps_nvs_get_uint(PS_NVS_ISO_HIGH);
+	if (state->iso_mode >= SYS_ISO_NUM) state->iso_mode = SYS_ISO_OFF;
+	if (state->iso_color >= SYS_ISO_COLOR_NUM) state->iso_color = SYS_ISO_COLOR_GREEN;
+	if (state->iso_low > state->iso_high) state->iso_low = state->iso_high;
+	state->meter_mode = (uint8_t) ps_nvs_get_uint(PS_NVS_METER_MODE);
+	if (state->meter_mode >= SYS_METER_NUM) state->meter_mode = SYS_METER_OFF;
+	
+	// As are the statistics region corrections
+	for (i=0; i<SYS_LEP_STATS_MAX_ROI; i++) {
+		u = ps_nvs_get_uint(PS_NVS_ROI1_CORR + i);
+		state->stats_emissivity[i] = u >> 16;
+		state->stats_refl[i] = u & 0xFFFF;
+		if ((state->stats_emissivity[i] < SYS_LEP_EMISSIVITY_MIN) ||
+		    (state->stats_emissivity[i] > SYS_LEP_EMISSIVITY_MAX))
+		{
+			state->stats_emissivity[i] = SYS_LEP_EMISSIVITY_MAX;
+			state->stats_refl[i] = SYS_LEP_REFL_DEF_K100;
+			ESP_LOGE(TAG, "reset stats_roi %d correction", i);
+		}
+	}
+	
+	// And the radiometric crop
+	u = ps_nvs_get_uint(PS_NVS_LEP_CROP);
+	state->lep_crop.x = u >> 24;
+	state->lep_crop.y = (u >> 16) & 0xFF;
+	state->lep_crop.w = (u >> 8) & 0xFF;
+	state->lep_crop.h = u & 0xFF;
+	if (((state->lep_crop.x + state->lep_crop.w) > LEP_WIDTH) ||
+	    ((state->lep_crop.y + state->lep_crop.h) > LEP_HEIGHT))
+	{
+		memset(&state->lep_crop, 0, sizeof(sys_lep_roi_t));
+		ESP_LOGE(TAG, "reset lep_crop to full frame");
+	}
+	
+	// And the session telemetry log rate
+	state->tlog_rate = (uint8_t) ps_nvs_get_uint(PS_NVS_TLOG_RATE);
+	if (state->tlog_rate > SYS_TLOG_MAX_RATE) state->tlog_rate = 0;
+	
+	// And the fusion parallax distances
+	u = ps_nvs_get_uint(PS_NVS_FUSION_DIST);
+	state->fusion_cal_dist = u >> 16;
+	state->fusion_dist = u & 0xFFFF;
+	if (!ps_fusion_dist_valid(state->fusion_cal_dist) || !ps_fusion_dist_valid(state->fusion_dist)) {
+		state->fusion_cal_dist = 0;
+		state->fusion_dist = 0;
+		ESP_LOGE(TAG, "reset fusion distances");
+	}
+	
 	state->palette_index = get_palette_by_name((const char*) &ps_shadow_buffer[PS_PALETTE_NAME_ADDR]);
 	if (state->palette_index < 0) {
 		state->palette_index = 0;
@@ -255,7 +547,7 @@ void ps_get_gui_state(gui_state_t* state)
 	
 	if (repair_mem) {
 		ps_shadow_buffer[PS_CHECKSUM_ADDR] = ps_compute_checksum();
-		if (!ps_write_array(GUI)) {
+		if (!ps_update(GUI)) {
 			ESP_LOGE(TAG, "Failed to write GUI state to RTC SRAM");
 		}
 	}
@@ -267,20 +559,200 @@ void ps_get_gui_state(gui_state_t* state)
  */
 void ps_set_gui_state(const gui_state_t* state)
 {
+	int i;
+	uint32_t u;
+	
 	ps_shadow_buffer[PS_REC_ARD_EN_ADDR] = state->rec_arducam_enable ? 1 : 0;
 	ps_shadow_buffer[PS_REC_LEP_EN_ADDR] = state->rec_lepton_enable ? 1 : 0;
 	ps_shadow_buffer[PS_GAIN_MODE_ADDR] = state->gain_mode;
 	ps_shadow_buffer[PS_REC_INTERVAL_ADDR] = state->record_interval >> 8;
 	ps_shadow_buffer[PS_REC_INTERVAL_ADDR + 1] = state->record_interval & 0xFF;
 	ps_store_string(get_palette_name(state->palette_index), PS_PALETTE_NAME_ADDR, PS_PALETTE_NAME_LEN);
+	ps_shadow_buffer[PS_REC_FORMAT_ADDR] = state->record_format;
+	ps_shadow_buffer[PS_REC_CONTAINER_ADDR] = (state->record_container ? PS_REC_FLAG_CONTAINER : 0) |
+	                                          (state->record_motion ? PS_REC_FLAG_MOTION : 0) |
+	                                          (state->record_sleep ? PS_REC_FLAG_SLEEP : 0) |
+	                                          (state->record_meta_log ? PS_REC_FLAG_META_LOG : 0);
+	ps_shadow_buffer[PS_REC_RING_ADDR] = state->record_ring ? 1 : 0;
+	ps_shadow_buffer[PS_CAM_RES_ADDR] = state->cam_resolution;
+	ps_shadow_buffer[PS_CAM_QUALITY_ADDR] = state->cam_quality;
+	ps_shadow_buffer[PS_CAM_ROI_ADDR] = state->cam_roi_x / SYS_CAM_ROI_UNIT;
+	ps_shadow_buffer[PS_CAM_ROI_ADDR + 1] = state->cam_roi_y / SYS_CAM_ROI_UNIT;
+	ps_shadow_buffer[PS_CAM_ROI_ADDR + 2] = state->cam_roi_w / SYS_CAM_ROI_UNIT;
+	ps_shadow_buffer[PS_CAM_ROI_ADDR + 3] = state->cam_roi_h / SYS_CAM_ROI_UNIT;
+	ps_shadow_buffer[PS_LEP_AGC_ADDR] = state->lep_agc_mode;
+	ps_shadow_buffer[PS_FUSION_ADDR] = state->fusion_mode;
+	ps_shadow_buffer[PS_FUSION_ADDR + 1] = state->fusion_alpha;
+	ps_shadow_buffer[PS_FUSION_ADDR + 2] = (uint8_t) state->fusion_offset_x;
+	ps_shadow_buffer[PS_FUSION_ADDR + 3] = (uint8_t) state->fusion_offset_y;
+	ps_shadow_buffer[PS_FUSION_ADDR + 4] = state->fusion_scale;
+	for (i=0; i<SYS_LEP_STATS_MAX_ROI; i++) {
+		ps_shadow_buffer[PS_STATS_ROI_ADDR + i*4] = state->stats_roi[i].x;
+		ps_shadow_buffer[PS_STATS_ROI_ADDR + i*4 + 1] = state->stats_roi[i].y;
+		ps_shadow_buffer[PS_STATS_ROI_ADDR + i*4 + 2] = state->stats_roi[i].w;
+		ps_shadow_buffer[PS_STATS_ROI_ADDR + i*4 + 3] = state->stats_roi[i].h;
+	}
+	ps_shadow_buffer[PS_ALARM_ADDR] = state->alarm_mode;
+	ps_shadow_buffer[PS_ALARM_ADDR + 1] = (state->alarm_roi << 4) | state->alarm_stat;
+	ps_shadow_buffer[PS_ALARM_ADDR + 2] = (state->alarm_threshold / SYS_ALARM_THRESH_UNIT) >> 8;
+	ps_shadow_buffer[PS_ALARM_ADDR + 3] = (state->alarm_threshold / SYS_ALARM_THRESH_UNIT) & 0xFF;
+	ps_shadow_buffer[PS_ALARM_ADDR + 4] = state->alarm_rate / SYS_ALARM_RATE_UNIT;
+	ps_shadow_buffer[PS_ALARM_ADDR + 5] = state->alarm_hold;
 	ps_shadow_buffer[PS_CHECKSUM_ADDR] = ps_compute_checksum();
-	if (!ps_write_array(GUI)) {
+	if (!ps_update(GUI)) {
 		ESP_LOGE(TAG, "Failed to write GUI state to RTC SRAM");
 	}
+	
+	// NVS settings are only written when they change
+	if (!ps_nvs_set_uint(PS_NVS_ISO_MODE, (uint32_t) state->iso_mode) ||
+	    !ps_nvs_set_uint(PS_NVS_ISO_COLOR, (uint32_t) state->iso_color) ||
+	    !ps_nvs_set_uint(PS_NVS_ISO_LOW, state->iso_low) ||
+	    !ps_nvs_set_uint(PS_NVS_ISO_HIGH, state->iso_high))
+	{
+		ESP_LOGE(TAG, "Failed to write isotherm settings to NVS");
+	}
+	if (!ps_nvs_set_uint(PS_NVS_METER_MODE, (uint32_t) state->meter_mode)) {
+		ESP_LOGE(TAG, "Failed to write meter mode to NVS");
+	}
+	for (i=0; i<SYS_LEP_STATS_MAX_ROI; i++) {
+		u = ((uint32_t) state->stats_emissivity[i] << 16) | state->stats_refl[i];
+		if (!ps_nvs_set_uint(PS_NVS_ROI1_CORR + i, u)) {
+			ESP_LOGE(TAG, "Failed to write stats_roi %d correction to NVS", i);
+		}
+	}
+	u = ((uint32_t) state->lep_crop.x << 24) | ((uint32_t) state->lep_crop.y << 16) |
+	    ((uint32_t) state->lep_crop.w << 8) | state->lep_crop.h;
+	if (!ps_nvs_set_uint(PS_NVS_LEP_CROP, u)) {
+		ESP_LOGE(TAG, "Failed to write radiometric crop to NVS");
+	}
+	if (!ps_nvs_set_uint(PS_NVS_TLOG_RATE, (uint32_t) state->tlog_rate)) {
+		ESP_LOGE(TAG, "Failed to write telemetry log rate to NVS");
+	}
+	u = ((uint32_t) state->fusion_cal_dist << 16) | state->fusion_dist;
+	if (!ps_nvs_set_uint(PS_NVS_FUSION_DIST, u)) {
+		ESP_LOGE(TAG, "Failed to write fusion distances to NVS");
+	}
+	ps_gui_version++;
+}
+
+
+/**
+ * Return a count that changes each time the GUI state is stored
+ */
+uint32_t ps_get_gui_version()
+{
+	return ps_gui_version;
+}
+
+
+
+/**
+ * Get the recording journal.  Returns false if there isn't a valid journal (the last
+ * recording session ended normally).
+ */
+bool ps_get_rec_journal(ps_rec_journal_t* jrnl)
+{
+	if (ps_shadow_buffer[PS_JRNL_VALID_ADDR] == 0) {
+		return false;
+	}
+	
+	strncpy(jrnl->session_dir, (const char*) &ps_shadow_buffer[PS_JRNL_DIR_ADDR], PS_JRNL_DIR_LEN);
+	jrnl->session_dir[PS_JRNL_DIR_LEN] = 0;
+	jrnl->image_seq_num = (ps_shadow_buffer[PS_JRNL_IMG_SEQ_ADDR] << 8) |
+	                      ps_shadow_buffer[PS_JRNL_IMG_SEQ_ADDR + 1];
+	jrnl->container_num = ps_shadow_buffer[PS_JRNL_CONT_NUM_ADDR];
+	jrnl->lep_seq_num = ps_load_uint32(PS_JRNL_LEP_SEQ_ADDR);
+	jrnl->lep_offset = ps_load_uint32(PS_JRNL_LEP_OFF_ADDR);
+	
+	return (strlen(jrnl->session_dir) != 0);
+}
+
+
+/**
+ * Store the recording journal into persistent storage.  Only the positions are
+ * written to the RTC SRAM if pos_only is set (the session directory hasn't changed).
+ */
+void ps_set_rec_journal(const ps_rec_journal_t* jrnl, bool pos_only)
+{
+	ps_shadow_buffer[PS_JRNL_VALID_ADDR] = 1;
+	ps_store_string((char*) jrnl->session_dir, PS_JRNL_DIR_ADDR, PS_JRNL_DIR_LEN);
+	ps_shadow_buffer[PS_JRNL_IMG_SEQ_ADDR] = jrnl->image_seq_num >> 8;
+	ps_shadow_buffer[PS_JRNL_IMG_SEQ_ADDR + 1] = jrnl->image_seq_num & 0xFF;
+	ps_shadow_buffer[PS_JRNL_CONT_NUM_ADDR] = jrnl->container_num;
+	ps_store_uint32(jrnl->lep_seq_num, PS_JRNL_LEP_SEQ_ADDR);
+	ps_store_uint32(jrnl->lep_offset, PS_JRNL_LEP_OFF_ADDR);
+	ps_shadow_buffer[PS_CHECKSUM_ADDR] = ps_compute_checksum();
+	if (!ps_update(pos_only ? JRNL_POS : JRNL)) {
+		ESP_LOGE(TAG, "Failed to write recording journal to RTC SRAM");
+	}
+}
+
+
+/**
+ * Invalidate the recording journal
+ */
+void ps_clear_rec_journal()
+{
+	if (ps_shadow_buffer[PS_JRNL_VALID_ADDR] != 0) {
+		ps_shadow_buffer[PS_JRNL_VALID_ADDR] = 0;
+		ps_shadow_buffer[PS_CHECKSUM_ADDR] = ps_compute_checksum();
+		if (!ps_update(JRNL)) {
+			ESP_LOGE(TAG, "Failed to clear recording journal in RTC SRAM");
+		}
+	}
 }
 
 
 
+/**
+ * Write any cached updates to the RTC SRAM.  Returns false if a write failed (the
+ * update stays cached to be retried).
+ */
+bool ps_flush()
+{
+	bool ret = true;
+	int t;
+	uint32_t mask;
+	
+	portENTER_CRITICAL(&ps_dirty_mux);
+	mask = ps_dirty_mask;
+	ps_dirty_mask = 0;
+	portEXIT_CRITICAL(&ps_dirty_mux);
+	
+	for (t=WIFI; t<=JRNL_POS; t++) {
+		if ((mask & (1 << t)) != 0) {
+			if (!ps_write_array((enum ps_update_types_t) t)) {
+				ESP_LOGE(TAG, "Failed to write cached update %d to RTC SRAM", t);
+				portENTER_CRITICAL(&ps_dirty_mux);
+				ps_dirty_mask |= (1 << t);
+				portEXIT_CRITICAL(&ps_dirty_mux);
+				ret = false;
+			}
+		}
+	}
+	
+	return ret;
+}
+
+
+/**
+ * Write cached updates to the RTC SRAM once they have settled.  Called periodically.
+ */
+void ps_flush_check()
+{
+	bool due;
+	
+	portENTER_CRITICAL(&ps_dirty_mux);
+	due = (ps_dirty_mask != 0) &&
+	      ((esp_timer_get_time() - ps_dirty_usec) >= (PS_FLUSH_DELAY_MSEC * 1000));
+	portEXIT_CRITICAL(&ps_dirty_mux);
+	
+	if (due) {
+		(void) ps_flush();
+	}
+}
+
+
 //
 // PS Utilities internal functions
 //
@@ -294,6 +766,25 @@ static bool ps_read_array()
 }
 
 
+/**
+ * Cache an update or, for the recording flag and journal, write it immediately along
+ * with any cached updates (the checksum covers them all)
+ */
+static bool ps_update(enum ps_update_types_t t)
+{
+	if ((PS_CACHED_MASK & (1 << t)) != 0) {
+		portENTER_CRITICAL(&ps_dirty_mux);
+		ps_dirty_mask |= (1 << t);
+		ps_dirty_usec = esp_timer_get_time();
+		portEXIT_CRITICAL(&ps_dirty_mux);
+		return true;
+	}
+	
+	(void) ps_flush();
+	return ps_write_array(t);
+}
+
+
 /**
  * Write parts (to reduce locked I2C time) or the full local buffer to RTC SRAM
  */
@@ -330,9 +821,40 @@ static bool ps_write_array(enum ps_update_types_t t)
 		break;
 	
 	case GUI:
-		if (ps_write_bytes_to_rtc(SRAM_START_ADDR + PS_REC_ARD_EN_ADDR,
-		                          &ps_shadow_buffer[PS_REC_ARD_EN_ADDR],
-		                          PS_GUI_UPD_LEN) == 0)
+		// record_ring follows the journal and the camera image and display settings follow
+		// the SPI clock
+		if ((ps_write_bytes_to_rtc(SRAM_START_ADDR + PS_REC_ARD_EN_ADDR,
+		                           &ps_shadow_buffer[PS_REC_ARD_EN_ADDR],
+		                           PS_GUI_UPD_LEN) == 0) &&
+		    (write_rtc_byte(SRAM_START_ADDR + PS_REC_RING_ADDR,
+		                    ps_shadow_buffer[PS_REC_RING_ADDR]) == 0) &&
+		    (ps_write_bytes_to_rtc(SRAM_START_ADDR + PS_CAM_RES_ADDR,
+		                           &ps_shadow_buffer[PS_CAM_RES_ADDR],
+		                           PS_CAM_IMG_UPD_LEN) == 0))
+		{
+			ret = (write_rtc_byte(SRAM_START_ADDR + PS_CHECKSUM_ADDR,
+			                       ps_shadow_buffer[PS_CHECKSUM_ADDR]) == 0);
+		} else {
+			ret = false;
+		}
+		break;
+	
+	case JRNL:
+		if (ps_write_bytes_to_rtc(SRAM_START_ADDR + PS_JRNL_VALID_ADDR,
+		                          &ps_shadow_buffer[PS_JRNL_VALID_ADDR],
+		                          PS_JRNL_UPD_LEN) == 0)
+		{
+			ret = (write_rtc_byte(SRAM_START_ADDR + PS_CHECKSUM_ADDR,
+			                       ps_shadow_buffer[PS_CHECKSUM_ADDR]) == 0);
+		} else {
+			ret = false;
+		}
+		break;
+	
+	case JRNL_POS:
+		if (ps_write_bytes_to_rtc(SRAM_START_ADDR + PS_JRNL_IMG_SEQ_ADDR,
+		                          &ps_shadow_buffer[PS_JRNL_IMG_SEQ_ADDR],
+		                          PS_JRNL_POS_UPD_LEN) == 0)
 		{
 			ret = (write_rtc_byte(SRAM_START_ADDR + PS_CHECKSUM_ADDR,
 			                       ps_shadow_buffer[PS_CHECKSUM_ADDR]) == 0);
@@ -403,12 +925,51 @@ static void ps_init_array(bool upgrade)
 	ps_store_string("Fusion", PS_PALETTE_NAME_ADDR, PS_PALETTE_NAME_LEN);
 	ps_shadow_buffer[PS_REC_INTERVAL_ADDR] = 0;
 	ps_shadow_buffer[PS_REC_INTERVAL_ADDR + 1] = 1;
+	ps_shadow_buffer[PS_REC_FORMAT_ADDR] = REC_FORMAT_JSON;
+	ps_shadow_buffer[PS_REC_CONTAINER_ADDR] = 0;
+	ps_shadow_buffer[PS_JRNL_VALID_ADDR] = 0;
+	ps_shadow_buffer[PS_REC_RING_ADDR] = 0;
+	ps_shadow_buffer[PS_CAM_SPI_MHZ_ADDR] = 0;
+	ps_shadow_buffer[PS_CAM_RES_ADDR] = SYS_CAM_RES_640x480;
+	ps_shadow_buffer[PS_CAM_QUALITY_ADDR] = OV2640_QS_DEFAULT;
+	memset(&ps_shadow_buffer[PS_CAM_ROI_ADDR], 0, PS_CAM_ROI_LEN);
+	ps_shadow_buffer[PS_LEP_AGC_ADDR] = SYS_LEP_AGC_LINEAR;
+	ps_shadow_buffer[PS_FUSION_ADDR] = SYS_FUSION_OFF;
+	ps_shadow_buffer[PS_FUSION_ADDR + 1] = SYS_FUSION_ALPHA_DEF;
+	ps_shadow_buffer[PS_FUSION_ADDR + 2] = 0;
+	ps_shadow_buffer[PS_FUSION_ADDR + 3] = 0;
+	ps_shadow_buffer[PS_FUSION_ADDR + 4] = SYS_FUSION_SCALE_DEF;
+	memset(&ps_shadow_buffer[PS_STATS_ROI_ADDR], 0, PS_STATS_ROI_LEN);
+	ps_init_alarm();
 	
 	// Finally compute and load checksum
 	ps_shadow_buffer[PS_CHECKSUM_ADDR] = ps_compute_checksum();
 }
 
 
+/**
+ * Initialize the alarm settings in our local buffer with default values
+ */
+static void ps_init_alarm()
+{
+	ps_shadow_buffer[PS_ALARM_ADDR] = SYS_ALARM_OFF;
+	ps_shadow_buffer[PS_ALARM_ADDR + 1] = SYS_ALARM_STAT_MAX;
+	ps_shadow_buffer[PS_ALARM_ADDR + 2] = (PS_ALARM_THRESH_DEF / SYS_ALARM_THRESH_UNIT) >> 8;
+	ps_shadow_buffer[PS_ALARM_ADDR + 3] = (PS_ALARM_THRESH_DEF / SYS_ALARM_THRESH_UNIT) & 0xFF;
+	ps_shadow_buffer[PS_ALARM_ADDR + 4] = 0;
+	ps_shadow_buffer[PS_ALARM_ADDR + 5] = SYS_ALARM_HOLD_DEF;
+}
+
+
+/**
+ * Return true for a fusion parallax distance of 0 (none) or in the supported range
+ */
+static bool ps_fusion_dist_valid(uint16_t d)
+{
+	return ((d == 0) || ((d >= SYS_FUSION_DIST_MIN) && (d <= SYS_FUSION_DIST_MAX)));
+}
+
+
 /**
  * Store a string at the specified location in our local buffer making sure it does
  * not exceed the available space and is terminated with a null character.
@@ -434,6 +995,31 @@ static void ps_store_string(char* s, uint8_t start, uint8_t max_len)
 }
 
 
+/**
+ * Store a 32-bit value, most significant byte first, at the specified location in our
+ * local buffer
+ */
+static void ps_store_uint32(uint32_t v, uint8_t start)
+{
+	ps_shadow_buffer[start]     = v >> 24;
+	ps_shadow_buffer[start + 1] = (v >> 16) & 0xFF;
+	ps_shadow_buffer[start + 2] = (v >> 8) & 0xFF;
+	ps_shadow_buffer[start + 3] = v & 0xFF;
+}
+
+
+/**
+ * Load a 32-bit value stored by ps_store_uint32
+ */
+static uint32_t ps_load_uint32(uint8_t start)
+{
+	return ((uint32_t) ps_shadow_buffer[start] << 24) |
+	       ((uint32_t) ps_shadow_buffer[start + 1] << 16) |
+	       ((uint32_t) ps_shadow_buffer[start + 2] << 8) |
+	       (uint32_t) ps_shadow_buffer[start + 3];
+}
+
+
 /**
  * Return true if our local array starts with the magic word
  */
@@ -466,15 +1052,7 @@ static uint8_t ps_compute_checksum()
  */
 static int ps_write_bytes_to_rtc(uint8_t start_addr, uint8_t* data, uint8_t data_len)
 {
-	int i;
-	uint8_t rtc_bytes[SRAM_SIZE+1];
-	
-	rtc_bytes[0] = start_addr;
-	for (i=1; i<=data_len; i++) {
-		rtc_bytes[i] = *(data + i - 1);
-	}
-	
-	return write_rtc_bytes(rtc_bytes, data_len+1);
+	return write_rtc_sram(start_addr, data, data_len);
 }
 
 
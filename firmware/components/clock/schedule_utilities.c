@@ -0,0 +1,232 @@
+/*
+ * Recording schedule
+ *
+ * Holds the table of weekly recording windows kept in NVS and finds the window active
+ * at a time and the next time the active window changes.  Set by cmd_task and
+ * evaluated by app_task.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "schedule_utilities.h"
+#include "ps_nvs.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <string.h>
+
+
+
+//
+// Schedule typedefs
+//
+
+// Table stored in NVS
+typedef struct {
+	uint16_t version;            // SCHED_VERSION
+	uint16_t reserved;
+	sched_window_t windows[SCHED_MAX_WINDOWS];
+} sched_table_t;
+
+
+
+//
+// Schedule private variables
+//
+static const char* TAG = "schedule_utilities";
+
+static sched_table_t sched_table;
+static uint32_t sched_version = 0;     // Incremented each time the table changes
+static portMUX_TYPE sched_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+
+//
+// Schedule Forward Declarations for internal functions
+//
+static bool sched_window_valid(const sched_window_t* wP);
+static bool sched_window_active(const sched_window_t* wP, int wday, int min);
+
+
+
+//
+// Schedule API
+//
+
+/**
+ * Load the stored table.  The schedule is empty if there isn't a valid one.
+ */
+void sched_init()
+{
+	int i;
+	
+	if (ps_nvs_get_blob(PS_NVS_BLOB_REC_SCHED, &sched_table, sizeof(sched_table_t)) &&
+	    (sched_table.version == SCHED_VERSION))
+	{
+		for (i=0; i<SCHED_MAX_WINDOWS; i++) {
+			if (!sched_window_valid(&sched_table.windows[i])) {
+				sched_table.windows[i].days = 0;
+			}
+		}
+	} else {
+		memset(&sched_table, 0, sizeof(sched_table_t));
+		sched_table.version = SCHED_VERSION;
+	}
+}
+
+
+/**
+ * Set window n (days 0 clears it) and store the table.  Returns false for an illegal
+ * window.  A table that can't be stored is still used until the camera restarts.
+ */
+bool sched_set_window(int n, const sched_window_t* wP)
+{
+	sched_table_t t;
+	
+	if ((n < 0) || (n >= SCHED_MAX_WINDOWS) || !sched_window_valid(wP)) {
+		return false;
+	}
+	
+	portENTER_CRITICAL(&sched_mux);
+	sched_table.windows[n] = *wP;
+	t = sched_table;
+	sched_version++;
+	portEXIT_CRITICAL(&sched_mux);
+	
+	if (!ps_nvs_set_blob(PS_NVS_BLOB_REC_SCHED, &t, sizeof(sched_table_t))) {
+		ESP_LOGE(TAG, "Could not store the schedule");
+	}
+	
+	return true;
+}
+
+
+/**
+ * Return a copy of window n
+ */
+void sched_get_window(int n, sched_window_t* wP)
+{
+	portENTER_CRITICAL(&sched_mux);
+	*wP = sched_table.windows[n];
+	portEXIT_CRITICAL(&sched_mux);
+}
+
+
+/**
+ * Return a count that changes each time the table is changed
+ */
+uint32_t sched_get_version()
+{
+	return sched_version;
+}
+
+
+/**
+ * Return the index of the window active at t, loading a copy into wP if it isn't
+ * NULL, or -1 if none is
+ */
+int sched_active_window(time_t t, sched_window_t* wP)
+{
+	int i;
+	int min;
+	int wday;
+	
+	// Day of the week (0 = Sunday, 1970-01-01 was a Thursday) and minute of the day
+	wday = (int) (((t / 86400) + 4) % 7);
+	min = (int) ((t % 86400) / 60);
+	
+	portENTER_CRITICAL(&sched_mux);
+	for (i=0; i<SCHED_MAX_WINDOWS; i++) {
+		if (sched_window_active(&sched_table.windows[i], wday, min)) {
+			if (wP != NULL) *wP = sched_table.windows[i];
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&sched_mux);
+	
+	return (i < SCHED_MAX_WINDOWS) ? i : -1;
+}
+
+
+/**
+ * Return the next time after t, within a week, the active window changes or 0 if it
+ * doesn't.  Changes only happen at the start or end of a window.
+ */
+time_t sched_next_change(time_t t)
+{
+	sched_window_t w;
+	time_t day, bt;
+	time_t next = 0;
+	int cur;
+	int d, i, j;
+	
+	cur = sched_active_window(t, NULL);
+	day = t - (t % 86400);
+	
+	for (i=0; i<SCHED_MAX_WINDOWS; i++) {
+		sched_get_window(i, &w);
+		if (w.days == 0) continue;
+		
+		for (d=0; d<=7; d++) {
+			for (j=0; j<2; j++) {
+				bt = day + (d * 86400) + ((j == 0) ? w.start_min : w.end_min) * 60;
+				if ((bt > t) && ((next == 0) || (bt < next)) &&
+				    (sched_active_window(bt, NULL) != cur))
+				{
+					next = bt;
+				}
+			}
+		}
+	}
+	
+	return next;
+}
+
+
+
+//
+// Schedule internal functions
+//
+
+/**
+ * Return true if a window's values are in range (the recording interval is checked by
+ * the caller)
+ */
+static bool sched_window_valid(const sched_window_t* wP)
+{
+	return ((wP->days < 0x80) && (wP->start_min < SCHED_DAY_MIN) && (wP->end_min < SCHED_DAY_MIN));
+}
+
+
+/**
+ * Return true if a window is active at minute min of day wday (0 = Sunday)
+ */
+static bool sched_window_active(const sched_window_t* wP, int wday, int min)
+{
+	int prev_wday = (wday == 0) ? 6 : (wday - 1);
+	
+	if (wP->days == 0) return false;
+	
+	if (wP->start_min < wP->end_min) {
+		return (((wP->days & (1 << wday)) != 0) && (min >= wP->start_min) && (min < wP->end_min));
+	}
+	
+	// Crosses midnight
+	return ((((wP->days & (1 << wday)) != 0) && (min >= wP->start_min)) ||
+	        (((wP->days & (1 << prev_wday)) != 0) && (min < wP->end_min)));
+}
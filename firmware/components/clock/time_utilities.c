@@ -4,6 +4,24 @@
  * Contains functions to interface the RTC to the system timekeeping
  * capabilities and provide application access to the system time.
  *
+ * The system time is aligned to the RTC's second boundary when it is initialized so
+ * sub-second timestamps are meaningful.  On boards that wire the RTC's 1 Hz square
+ * wave to RTC_SQW_IO its falling edges are also used to slew the system time to track
+ * the RTC.
+ *
+ * A sync_task slave corrects the system time to its master's with time_sync_adjust.
+ *
+ * On boards that wire RTC_SQW_IO the RTC's alarm 1 can also wake the ESP32 from a deep
+ * sleep.  The output is switched from the square wave to the alarm interrupt just before
+ * sleeping and back when the system restarts.
+ * The RTC square wave isn't used while those corrections are arriving.
+ *
+ * When SNTP sets the system time (WiFi client mode) the RTC is checked against it.
+ * The RTC is set when it is too far off and its drift, measured across syncs at least
+ * TIME_CAL_MIN_SEC apart, is corrected with the DS3232 aging offset.  The RTC's second
+ * edge is found by polling it every TIME_CAL_POLL_MSEC from time_discipline so the
+ * check never blocks the caller.
+ *
  * Copyright 2020 Dan Julio
  *
  * This file is part of firecam.
@@ -23,8 +41,16 @@
  *
  */
 #include "time_utilities.h"
+#include "ps_nvs.h"
+#include "system_config.h"
+#include "driver/gpio.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "rom/ets_sys.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "trace_utilities.h"
 #include <stdlib.h>
 #include <time.h>
 #include <sys/time.h>
@@ -66,6 +92,48 @@ static const char* mon_strings[] = {
 //
 static const char* TAG = "time_utilities";
 
+// SNTP sync state (set from the lwip task) and network sync state (set from sync_task)
+static bool time_sntp_pending = false;
+static int64_t time_sntp_usec = 0;          // esp_timer time of the last sync (0 = never)
+static int64_t time_sync_usec = 0;          // esp_timer time of the last correction (0 = never)
+static portMUX_TYPE time_sntp_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Second tick
+static esp_timer_handle_t time_tick_timer;
+static TaskHandle_t time_tick_task;
+static uint32_t time_tick_mask;
+
+// RTC check state
+static int time_cal_state = TIME_CAL_IDLE;
+static time_t time_cal_rtc_secs;            // RTC time when the edge search started
+static int64_t time_cal_start_usec;         // esp_timer time the edge search started
+static int64_t time_cal_poll_usec;          // esp_timer time of the last RTC poll
+
+#ifdef RTC_SQW_IO
+// esp_timer time of the most recent RTC second edge (0 once it has been used)
+static volatile int64_t time_pps_usec = 0;
+static portMUX_TYPE time_pps_mux = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
+
+
+//
+// Time Utilities Forward Declarations for internal functions
+//
+static time_t time_wait_rtc_edge();
+static void time_secs_to_te(time_t secs, tmElements_t* te);
+static void time_cal_edge();
+static void time_cal_eval(time_t secs, int64_t err_usec);
+static void time_cal_set();
+static void time_cal_aging(int32_t drift_ppb);
+static void time_arm_tick();
+static void time_tick_cb(void* arg);
+static void time_correct(int64_t err_usec);
+#ifdef RTC_SQW_IO
+static void time_pps_discipline();
+static void IRAM_ATTR time_pps_isr(void* arg);
+#endif
+
 
  
 //
@@ -82,12 +150,22 @@ void time_init()
 	struct timeval tv;
 	time_t secs;
 	
-	// Set the system time from the RTC
-	secs = get_rtc_time_secs();
+	// Set the system time from the RTC at the start of a second
+	secs = time_wait_rtc_edge();
 	tv.tv_sec = secs;
 	tv.tv_usec = 0;
 	settimeofday((const struct timeval *) &tv, NULL);
 	
+#ifdef RTC_SQW_IO
+	// Clear any wake alarm from a deep sleep and start tracking the RTC's 1 Hz square wave
+	set_rtc_alarm_interrupt(ALARM_1, false);
+	(void) is_rtc_alarm(ALARM_1);
+	set_rtc_squareWave(SQWAVE_1_HZ);
+	gpio_set_direction(RTC_SQW_IO, GPIO_MODE_INPUT);
+	gpio_set_intr_type(RTC_SQW_IO, GPIO_INTR_NEGEDGE);
+	gpio_isr_handler_add(RTC_SQW_IO, time_pps_isr, NULL);
+#endif
+	
 	// Diagnostic display of time
 	time_get(&te);
 	time_get_disp_string(te, buf);
@@ -95,6 +173,142 @@ void time_init()
 }
 
 
+/**
+ * Note that SNTP has set the system time.  Called from the lwip task (the
+ * SNTP time sync notification callback) so it only records the sync for time_discipline.
+ */
+void time_sntp_sync(struct timeval* tv)
+{
+	portENTER_CRITICAL(&time_sntp_mux);
+	time_sntp_pending = true;
+	time_sntp_usec = esp_timer_get_time();
+	portEXIT_CRITICAL(&time_sntp_mux);
+}
+
+
+/**
+ * Check the RTC against the system time after a SNTP sync and, on boards that wire the
+ * RTC square wave without a recent SNTP sync, slew the system time toward the RTC's
+ * second edge.  Call periodically, at least as often as time_discipline_msec requests.
+ */
+void time_discipline()
+{
+	bool sntp;
+	
+	portENTER_CRITICAL(&time_sntp_mux);
+	sntp = time_sntp_pending;
+	time_sntp_pending = false;
+	portEXIT_CRITICAL(&time_sntp_mux);
+	
+	if (sntp && (time_cal_state == TIME_CAL_IDLE)) {
+		// Start looking for the RTC's second edge
+		time_cal_rtc_secs = get_rtc_time_secs();
+		time_cal_start_usec = esp_timer_get_time();
+		time_cal_poll_usec = time_cal_start_usec;
+		time_cal_state = TIME_CAL_EDGE;
+	}
+	
+	switch (time_cal_state) {
+		case TIME_CAL_EDGE:
+			time_cal_edge();
+			break;
+		
+		case TIME_CAL_SET:
+			time_cal_set();
+			break;
+	}
+	
+#ifdef RTC_SQW_IO
+	time_pps_discipline();
+#endif
+}
+
+
+/**
+ * Correct the system time by err_usec (positive when the system time is ahead of the
+ * reference).  Called by sync_task with each good measurement against its master.
+ */
+void time_sync_adjust(int64_t err_usec)
+{
+	portENTER_CRITICAL(&time_sntp_mux);
+	time_sync_usec = esp_timer_get_time();
+	portEXIT_CRITICAL(&time_sntp_mux);
+	
+	time_correct(err_usec);
+}
+
+
+/**
+ * Return the mSec until time_discipline needs to run again or -1 if it is idle
+ */
+int time_discipline_msec()
+{
+	int msec;
+	
+	switch (time_cal_state) {
+		case TIME_CAL_EDGE:
+			msec = TIME_CAL_POLL_MSEC - (int) ((esp_timer_get_time() - time_cal_poll_usec) / 1000);
+			if (msec < 0) msec = 0;
+			return msec;
+		
+		case TIME_CAL_SET:
+			return time_msec_to_next_second();
+		
+		default:
+			return -1;
+	}
+}
+
+
+/**
+ * Notify task with mask at the start of each second of the system time.  The
+ * notification comes from an esp_timer so it follows the system time as it is
+ * disciplined instead of waiting for the next FreeRTOS tick.
+ */
+bool time_start_tick(TaskHandle_t task, uint32_t mask)
+{
+	const esp_timer_create_args_t args = {
+		.callback = &time_tick_cb,
+		.arg = NULL,
+		.name = "time_tick"
+	};
+	
+	time_tick_task = task;
+	time_tick_mask = mask;
+	if (esp_timer_create(&args, &time_tick_timer) != ESP_OK) {
+		return false;
+	}
+	time_arm_tick();
+	
+	return true;
+}
+
+
+/**
+ * Set the RTC's alarm 1 to assert RTC_SQW_IO at wake_secs (less than a month away) to
+ * wake the system from the deep sleep that follows.  The square wave stops until the
+ * system restarts.  Returns false on boards without RTC_SQW_IO.
+ */
+bool time_set_wake_alarm(time_t wake_secs)
+{
+#ifdef RTC_SQW_IO
+	tmElements_t te;
+	
+	time_secs_to_te(wake_secs, &te);
+	set_rtc_alarm_secs(ALM1_MATCH_DATE, te.Second, te.Minute, te.Hour, te.Day);
+	(void) is_rtc_alarm(ALARM_1);
+	gpio_isr_handler_remove(RTC_SQW_IO);
+	set_rtc_squareWave(SQWAVE_NONE);
+	set_rtc_alarm_interrupt(ALARM_1, true);
+	
+	return true;
+#else
+	(void) wake_secs;
+	return false;
+#endif
+}
+
+
 /**
  * Set the system time and update the RTC
  */
@@ -108,6 +322,9 @@ void time_set(tmElements_t te)
 		ESP_LOGE(TAG, "Update RTC failed");
 	}
 	
+	// The RTC's drift can't be measured across a manual change
+	(void) ps_nvs_set_uint(PS_NVS_RTC_CAL_SECS, 0);
+	
 	// Set the system time
 	secs = rtc_makeTime(te);
 	tv.tv_sec = secs;
@@ -138,6 +355,23 @@ void time_get(tmElements_t* te)
 }
 
 
+/**
+ * Get the system time, with mSec, at an earlier esp_timer time (e.g. a frame's capture
+ * timestamp)
+ */
+void time_get_from_usec(int64_t esp_usec, tmElements_t* te, uint16_t* msec)
+{
+	struct timeval tv;
+	int64_t t;
+	
+	gettimeofday(&tv, NULL);
+	t = ((int64_t) tv.tv_sec * 1000000) + tv.tv_usec - (esp_timer_get_time() - esp_usec);
+	
+	time_secs_to_te((time_t) (t / 1000000), te);
+	*msec = (uint16_t) ((t % 1000000) / 1000);
+}
+
+
 /**
  * Return true if the system time (in seconds) has changed from the last time
  * this function returned true. Each calling task must maintain its own prev_time
@@ -173,6 +407,18 @@ bool time_changed(tmElements_t* te, time_t* prev_time)
 }
 
 
+/**
+ * Return the number of mSec until the system time (in seconds) will change
+ */
+int time_msec_to_next_second()
+{
+	struct timeval tv;
+	
+	gettimeofday(&tv, NULL);
+	return 1000 - (tv.tv_usec / 1000);
+}
+
+
 /**
  * Load buf with a time & date string for display.
  *
@@ -215,3 +461,261 @@ void time_get_short_string(tmElements_t te, char* buf)
 	sprintf(buf, "%2d_%02d_%02d_%02d_%02d_%02d",
 		te.Year, te.Month, te.Day, te.Hour, te.Minute, te.Second);
 }
+
+
+
+//
+// Time Utilities internal functions
+//
+
+/**
+ * Wait for the RTC seconds to change and return the new time.  The RTC is polled
+ * every TIME_RTC_POLL_USEC so the edge is found to about a mSec.  Returns the current
+ * time if the RTC doesn't tick within TIME_RTC_EDGE_MSEC.
+ */
+static time_t time_wait_rtc_edge()
+{
+	time_t start;
+	time_t secs;
+	int64_t start_usec;
+	
+	start = get_rtc_time_secs();
+	start_usec = esp_timer_get_time();
+	while ((esp_timer_get_time() - start_usec) < (TIME_RTC_EDGE_MSEC * 1000)) {
+		secs = get_rtc_time_secs();
+		if (secs != start) {
+			return secs;
+		}
+		ets_delay_us(TIME_RTC_POLL_USEC);
+	}
+	
+	ESP_LOGE(TAG, "RTC not running");
+	return start;
+}
+
+
+/**
+ * Convert secs into our simplified tmElements format
+ */
+static void time_secs_to_te(time_t secs, tmElements_t* te)
+{
+	struct tm timeinfo;
+	
+	localtime_r(&secs, &timeinfo);  // Get the unix formatted timeinfo
+	mktime(&timeinfo);              // Fill in the DOW and DOY fields
+	te->Second = (uint8_t) timeinfo.tm_sec;
+	te->Minute = (uint8_t) timeinfo.tm_min;
+	te->Hour = (uint8_t) timeinfo.tm_hour;
+	te->Wday = (uint8_t) timeinfo.tm_wday + 1; // Sunday is 1 in our tmElements structure
+	te->Day = (uint8_t) timeinfo.tm_mday;
+	te->Month = (uint8_t) timeinfo.tm_mon + 1; // January is 1 in our tmElements structure
+	te->Year = (uint8_t) timeinfo.tm_year - 70; // tmElements starts at 1970
+}
+
+/**
+ * Poll the RTC looking for its second edge and evaluate it against the system time when
+ * it is found.  The edge occurred between the last two polls.
+ */
+static void time_cal_edge()
+{
+	struct timeval tv;
+	time_t secs;
+	int64_t prev_usec;
+	int64_t sys_usec;
+	
+	if ((esp_timer_get_time() - time_cal_poll_usec) < (TIME_CAL_POLL_MSEC * 1000)) return;
+	
+	secs = get_rtc_time_secs();
+	prev_usec = time_cal_poll_usec;
+	time_cal_poll_usec = esp_timer_get_time();
+	if (secs == time_cal_rtc_secs) {
+		if ((time_cal_poll_usec - time_cal_start_usec) >= (TIME_RTC_EDGE_MSEC * 1000)) {
+			ESP_LOGE(TAG, "RTC not running");
+			time_cal_state = TIME_CAL_SET;
+		}
+		return;
+	}
+	
+	// System time at the middle of the poll interval
+	gettimeofday(&tv, NULL);
+	sys_usec = ((int64_t) tv.tv_sec * 1000000) + tv.tv_usec;
+	sys_usec -= (esp_timer_get_time() - prev_usec) / 2;
+	
+	time_cal_eval(tv.tv_sec, ((int64_t) secs * 1000000) - sys_usec);
+}
+
+
+/**
+ * Evaluate the RTC error (positive when the RTC is ahead) at secs.  The drift since the
+ * RTC was last set corrects the aging offset when it has been long enough to measure.
+ * The RTC is set if it is too far off, has no reference or has just had its aging
+ * offset changed.
+ */
+static void time_cal_eval(time_t secs, int64_t err_usec)
+{
+	uint32_t ref_secs;
+	int32_t ref_err_usec;
+	bool set_rtc;
+	
+	ESP_LOGI(TAG, "RTC error %d mSec", (int) (err_usec / 1000));
+	
+	ref_secs = ps_nvs_get_uint(PS_NVS_RTC_CAL_SECS);
+	ref_err_usec = ps_nvs_get_int(PS_NVS_RTC_CAL_ERR_USEC);
+	
+	set_rtc = (ref_secs == 0) || ((uint32_t) secs < ref_secs) ||
+	          (err_usec > (TIME_RTC_MAX_ERR_MSEC * 1000)) || (err_usec < -(TIME_RTC_MAX_ERR_MSEC * 1000));
+	
+	if (!set_rtc && (((uint32_t) secs - ref_secs) >= TIME_CAL_MIN_SEC)) {
+		// uSec per second of drift is ppm
+		time_cal_aging((int32_t) (((err_usec - ref_err_usec) * 1000) / ((uint32_t) secs - ref_secs)));
+		set_rtc = true;
+	}
+	
+	time_cal_state = set_rtc ? TIME_CAL_SET : TIME_CAL_IDLE;
+}
+
+
+/**
+ * Set the RTC from the system time at the start of a second so its second edge lines up
+ * with the system time's and make that the reference for the next drift measurement
+ */
+static void time_cal_set()
+{
+	struct timeval tv;
+	
+	// Wait for the start of a second
+	gettimeofday(&tv, NULL);
+	if (tv.tv_usec >= (TIME_CAL_SET_WINDOW_MSEC * 1000)) return;
+	
+	// Writing the seconds restarts the RTC's second so it is behind by the write time
+	if (set_rtc_time_secs(tv.tv_sec) != 0) {
+		ESP_LOGE(TAG, "Update RTC failed");
+	} else {
+		(void) ps_nvs_set_uint(PS_NVS_RTC_CAL_SECS, (uint32_t) tv.tv_sec);
+		(void) ps_nvs_set_int(PS_NVS_RTC_CAL_ERR_USEC, -tv.tv_usec);
+		ESP_LOGI(TAG, "RTC set");
+	}
+	
+	time_cal_state = TIME_CAL_IDLE;
+}
+
+
+/**
+ * Correct the RTC aging offset for the measured drift (positive when the RTC runs fast).
+ * Positive aging offsets slow the oscillator.
+ */
+static void time_cal_aging(int32_t drift_ppb)
+{
+	uint8_t b;
+	int aging;
+	int delta;
+	
+	if (read_rtc_byte(RTC_AGING, &b) != 0) return;
+	aging = (int8_t) b;
+	
+	if (drift_ppb >= 0) {
+		delta = (drift_ppb + (TIME_AGING_PPB_PER_LSB / 2)) / TIME_AGING_PPB_PER_LSB;
+	} else {
+		delta = (drift_ppb - (TIME_AGING_PPB_PER_LSB / 2)) / TIME_AGING_PPB_PER_LSB;
+	}
+	delta += aging;
+	if (delta > 127) delta = 127;
+	if (delta < -127) delta = -127;
+	
+	ESP_LOGI(TAG, "RTC drift %d ppb, aging offset %d -> %d", drift_ppb, aging, delta);
+	if (delta != aging) {
+		(void) write_rtc_byte(RTC_AGING, (uint8_t) ((int8_t) delta));
+	}
+}
+
+
+/**
+ * Start the second tick timer for just after the next second.  It is re-armed each
+ * second so steps and slews of the system time are followed.
+ */
+static void time_arm_tick()
+{
+	struct timeval tv;
+	
+	gettimeofday(&tv, NULL);
+	(void) esp_timer_start_once(time_tick_timer, (1000000 - tv.tv_usec) + TIME_TICK_LATE_USEC);
+}
+
+
+static void time_tick_cb(void* arg)
+{
+	xTaskNotify(time_tick_task, time_tick_mask, eSetBits);
+	time_arm_tick();
+}
+
+
+/**
+ * Step the system time by err_usec (positive when it is ahead) if it is too far off to
+ * slew, otherwise slew it.  Only one slew is outstanding so a new correction replaces
+ * any remaining from the previous one.
+ */
+static void time_correct(int64_t err_usec)
+{
+	struct timeval tv;
+	int64_t t;
+	
+	if ((err_usec > TIME_MAX_SLEW_USEC) || (err_usec < -TIME_MAX_SLEW_USEC)) {
+		gettimeofday(&tv, NULL);
+		t = ((int64_t) tv.tv_sec * 1000000) + tv.tv_usec - err_usec;
+		tv.tv_sec = (time_t) (t / 1000000);
+		tv.tv_usec = (suseconds_t) (t % 1000000);
+		settimeofday((const struct timeval *) &tv, NULL);
+	} else if (err_usec != 0) {
+		tv.tv_sec = 0;
+		tv.tv_usec = (suseconds_t) -err_usec;
+		adjtime((const struct timeval *) &tv, NULL);
+	}
+}
+
+
+#ifdef RTC_SQW_IO
+/**
+ * Slew the system time toward the most recent RTC second edge
+ */
+static void time_pps_discipline()
+{
+	struct timeval tv;
+	int64_t edge_usec;
+	int64_t now_usec;
+	int64_t sntp_usec;
+	int64_t sync_usec;
+	int32_t err_usec;
+	
+	portENTER_CRITICAL(&time_pps_mux);
+	edge_usec = time_pps_usec;
+	time_pps_usec = 0;
+	portEXIT_CRITICAL(&time_pps_mux);
+	if (edge_usec == 0) return;
+	
+	// SNTP or a sync_task master, when available, are better references than the RTC
+	portENTER_CRITICAL(&time_sntp_mux);
+	sntp_usec = time_sntp_usec;
+	sync_usec = time_sync_usec;
+	portEXIT_CRITICAL(&time_sntp_mux);
+	now_usec = esp_timer_get_time();
+	if ((sntp_usec != 0) && ((now_usec - sntp_usec) < ((int64_t) TIME_SNTP_VALID_SEC * 1000000))) return;
+	if ((sync_usec != 0) && ((now_usec - sync_usec) < ((int64_t) TIME_SYNC_VALID_SEC * 1000000))) return;
+	
+	// The system time at the edge should be on a second boundary
+	gettimeofday(&tv, NULL);
+	now_usec = esp_timer_get_time();
+	err_usec = (int32_t) (((int64_t) tv.tv_usec - (now_usec - edge_usec)) % 1000000);
+	if (err_usec < 0) err_usec += 1000000;
+	if (err_usec >= 500000) err_usec -= 1000000;
+	
+	time_correct(err_usec);
+}
+
+
+static void IRAM_ATTR time_pps_isr(void* arg)
+{
+	portENTER_CRITICAL_ISR(&time_pps_mux);
+	time_pps_usec = esp_timer_get_time();
+	portEXIT_CRITICAL_ISR(&time_pps_mux);
+}
+#endif
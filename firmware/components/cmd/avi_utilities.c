@@ -0,0 +1,230 @@
+/*
+ * MJPEG AVI file format
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "avi_utilities.h"
+#include <string.h>
+
+
+
+//
+// AVI private constants
+//
+
+// Header chunk data lengths
+#define AVIH_LEN  56
+#define STRH_LEN  56
+#define STRF_LEN  40
+
+// Offset of the JUNK chunk and the length of its data
+#define JUNK_OFFSET  (12 + 12 + 8 + AVIH_LEN + 12 + 8 + STRH_LEN + 8 + STRF_LEN)
+#define JUNK_LEN     (AVI_HEADER_LEN - JUNK_OFFSET - 8 - 12)
+
+
+
+//
+// AVI Forward Declarations for internal functions
+//
+static uint8_t* avi_put_fourcc(uint8_t* p, const char* fourcc);
+static uint8_t* avi_put_u32(uint8_t* p, uint32_t v);
+static uint8_t* avi_put_u16(uint8_t* p, uint16_t v);
+
+
+
+//
+// AVI API
+//
+
+/**
+ * Load buf (AVI_HEADER_LEN bytes) with the file header for a file described by infoP
+ */
+void avi_build_header(uint8_t* buf, const avi_info_t* infoP)
+{
+	uint8_t* p = buf;
+	uint32_t riff_len;
+	uint32_t max_bytes_per_sec;
+	
+	riff_len = AVI_HEADER_LEN - 8 + infoP->movi_len;
+	if (infoP->index_len != 0) {
+		riff_len += AVI_CHUNK_HDR_LEN + infoP->index_len;
+	}
+	max_bytes_per_sec = (infoP->usec_per_frame == 0) ? 0 :
+	                    (uint32_t) ((uint64_t) infoP->max_frame_len * 1000000 / infoP->usec_per_frame);
+	
+	p = avi_put_fourcc(p, "RIFF");
+	p = avi_put_u32(p, riff_len);
+	p = avi_put_fourcc(p, "AVI ");
+	
+	p = avi_put_fourcc(p, "LIST");
+	p = avi_put_u32(p, JUNK_OFFSET - 20);
+	p = avi_put_fourcc(p, "hdrl");
+	
+	p = avi_put_fourcc(p, "avih");
+	p = avi_put_u32(p, AVIH_LEN);
+	p = avi_put_u32(p, infoP->usec_per_frame);
+	p = avi_put_u32(p, max_bytes_per_sec);
+	p = avi_put_u32(p, 0);                                 // Padding granularity
+	p = avi_put_u32(p, (infoP->index_len != 0) ? AVI_AVIF_HASINDEX : 0);
+	p = avi_put_u32(p, infoP->frames);
+	p = avi_put_u32(p, 0);                                 // Initial frames
+	p = avi_put_u32(p, 1);                                 // Streams
+	p = avi_put_u32(p, infoP->max_frame_len + AVI_CHUNK_HDR_LEN);
+	p = avi_put_u32(p, infoP->width);
+	p = avi_put_u32(p, infoP->height);
+	memset(p, 0, 16);                                      // Reserved
+	p += 16;
+	
+	p = avi_put_fourcc(p, "LIST");
+	p = avi_put_u32(p, 4 + 8 + STRH_LEN + 8 + STRF_LEN);
+	p = avi_put_fourcc(p, "strl");
+	
+	p = avi_put_fourcc(p, "strh");
+	p = avi_put_u32(p, STRH_LEN);
+	p = avi_put_fourcc(p, "vids");
+	p = avi_put_fourcc(p, "MJPG");
+	p = avi_put_u32(p, 0);                                 // Flags
+	p = avi_put_u16(p, 0);                                 // Priority
+	p = avi_put_u16(p, 0);                                 // Language
+	p = avi_put_u32(p, 0);                                 // Initial frames
+	p = avi_put_u32(p, infoP->usec_per_frame);             // Scale / Rate = seconds per frame
+	p = avi_put_u32(p, 1000000);
+	p = avi_put_u32(p, 0);                                 // Start
+	p = avi_put_u32(p, infoP->frames);
+	p = avi_put_u32(p, infoP->max_frame_len);
+	p = avi_put_u32(p, 0xFFFFFFFF);                        // Default quality
+	p = avi_put_u32(p, 0);                                 // Sample size (varies)
+	p = avi_put_u16(p, 0);                                 // Frame rectangle
+	p = avi_put_u16(p, 0);
+	p = avi_put_u16(p, infoP->width);
+	p = avi_put_u16(p, infoP->height);
+	
+	p = avi_put_fourcc(p, "strf");
+	p = avi_put_u32(p, STRF_LEN);
+	p = avi_put_u32(p, STRF_LEN);
+	p = avi_put_u32(p, infoP->width);
+	p = avi_put_u32(p, infoP->height);
+	p = avi_put_u16(p, 1);                                 // Planes
+	p = avi_put_u16(p, 24);                                // Bits per pixel when decoded
+	p = avi_put_fourcc(p, "MJPG");
+	p = avi_put_u32(p, (uint32_t) infoP->width * infoP->height * 3);
+	memset(p, 0, 16);                                      // Resolution and colors
+	p += 16;
+	
+	p = avi_put_fourcc(p, "JUNK");
+	p = avi_put_u32(p, JUNK_LEN);
+	memset(p, 0, JUNK_LEN);
+	p += JUNK_LEN;
+	
+	p = avi_put_fourcc(p, "LIST");
+	p = avi_put_u32(p, 4 + infoP->movi_len);
+	(void) avi_put_fourcc(p, "movi");
+}
+
+
+/**
+ * Load buf (AVI_CHUNK_HDR_LEN bytes) with a chunk header
+ */
+void avi_build_chunk_header(uint8_t* buf, const char* fourcc, uint32_t len)
+{
+	buf = avi_put_fourcc(buf, fourcc);
+	(void) avi_put_u32(buf, len);
+}
+
+
+/**
+ * Load an idx1 entry for the len byte frame whose chunk is movi_pos bytes into the
+ * frame chunks
+ */
+void avi_build_index_entry(avi_index_entry_t* entryP, uint32_t movi_pos, uint32_t len)
+{
+	(void) avi_put_fourcc((uint8_t*) &entryP->ckid, "00dc");
+	entryP->flags = AVI_AVIIF_KEYFRAME;
+	entryP->offset = 4 + movi_pos;
+	entryP->length = len;
+}
+
+
+/**
+ * Get the dimensions of a jpeg image from its start of frame marker.  Returns false if
+ * one couldn't be found before the image data.
+ */
+bool avi_get_jpeg_size(const uint8_t* jpgP, uint32_t len, uint16_t* width, uint16_t* height)
+{
+	uint32_t i = 2;
+	uint8_t m;
+	
+	if ((len < 4) || (jpgP[0] != 0xFF) || (jpgP[1] != 0xD8)) {
+		return false;
+	}
+	
+	while ((i + 9) <= len) {
+		if (jpgP[i] != 0xFF) return false;
+		m = jpgP[i+1];
+		if (m == 0xFF) {
+			// Fill byte
+			i++;
+		} else if ((m == 0x01) || ((m >= 0xD0) && (m <= 0xD7))) {
+			// Markers without a length
+			i += 2;
+		} else if ((m >= 0xC0) && (m <= 0xCF) && (m != 0xC4) && (m != 0xC8) && (m != 0xCC)) {
+			*height = (jpgP[i+5] << 8) | jpgP[i+6];
+			*width = (jpgP[i+7] << 8) | jpgP[i+8];
+			return true;
+		} else if (m == 0xDA) {
+			return false;
+		} else {
+			i += 2 + ((jpgP[i+2] << 8) | jpgP[i+3]);
+		}
+	}
+	
+	return false;
+}
+
+
+
+//
+// AVI internal functions
+//
+static uint8_t* avi_put_fourcc(uint8_t* p, const char* fourcc)
+{
+	memcpy(p, fourcc, 4);
+	
+	return p + 4;
+}
+
+
+static uint8_t* avi_put_u32(uint8_t* p, uint32_t v)
+{
+	*p++ = v & 0xFF;
+	*p++ = (v >> 8) & 0xFF;
+	*p++ = (v >> 16) & 0xFF;
+	*p++ = v >> 24;
+	
+	return p;
+}
+
+
+static uint8_t* avi_put_u16(uint8_t* p, uint16_t v)
+{
+	*p++ = v & 0xFF;
+	*p++ = v >> 8;
+	
+	return p;
+}
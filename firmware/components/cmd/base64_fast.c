@@ -0,0 +1,221 @@
+/*
+ * Table-driven base64 encoder for large image payloads.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "base64_fast.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef BASE64_FAST_BENCHMARK
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "mbedtls/base64.h"
+#endif
+
+
+
+//
+// Base64 Fast variables
+//
+#ifdef BASE64_FAST_BENCHMARK
+static const char* TAG = "base64_fast";
+#endif
+
+static const char b64_symbols[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Two output characters for each 12-bit input value, first character in the low byte
+static DRAM_ATTR uint16_t b64_pair_table[4096];
+
+
+
+//
+// Base64 Fast Forward Declarations for internal functions
+//
+static inline uint32_t IRAM_ATTR load_be32(const uint8_t* p);
+static inline uint32_t IRAM_ATTR encode_group(uint32_t g);
+
+
+
+//
+// Base64 Fast API
+//
+
+/**
+ * Build the character pair table.  Must be called before base64_fast_encode.
+ */
+void base64_fast_init()
+{
+	int i;
+	
+	for (i=0; i<4096; i++) {
+		b64_pair_table[i] = b64_symbols[i >> 6] | (b64_symbols[i & 0x3F] << 8);
+	}
+}
+
+
+/**
+ * Encode len bytes from src into dst (which must have room for BASE64_ENC_LEN(len)
+ * characters).  Returns the number of characters written.
+ */
+uint32_t IRAM_ATTR base64_fast_encode(const uint8_t* src, uint32_t len, char* dst)
+{
+	bool aligned_dst = (((uintptr_t) dst & 0x3) == 0);
+	char* out = dst;
+	uint32_t w0, w1, w2;
+	uint32_t o[4];
+	uint32_t g;
+	
+	// Main loop: 12 input bytes -> 16 output characters
+	while (len >= 12) {
+		w0 = load_be32(src);
+		w1 = load_be32(src + 4);
+		w2 = load_be32(src + 8);
+		
+		o[0] = encode_group(w0 >> 8);
+		o[1] = encode_group(((w0 & 0xFF) << 16) | (w1 >> 16));
+		o[2] = encode_group(((w1 & 0xFFFF) << 8) | (w2 >> 24));
+		o[3] = encode_group(w2 & 0xFFFFFF);
+		
+		if (aligned_dst) {
+			((uint32_t*) out)[0] = o[0];
+			((uint32_t*) out)[1] = o[1];
+			((uint32_t*) out)[2] = o[2];
+			((uint32_t*) out)[3] = o[3];
+		} else {
+			memcpy(out, o, 16);
+		}
+		
+		src += 12;
+		out += 16;
+		len -= 12;
+	}
+	
+	// Remaining complete 3-byte groups
+	while (len >= 3) {
+		g = (src[0] << 16) | (src[1] << 8) | src[2];
+		o[0] = encode_group(g);
+		memcpy(out, o, 4);
+		src += 3;
+		out += 4;
+		len -= 3;
+	}
+	
+	// Final partial group with padding
+	if (len != 0) {
+		g = src[0] << 16;
+		if (len == 2) {
+			g |= src[1] << 8;
+		}
+		out[0] = b64_symbols[(g >> 18) & 0x3F];
+		out[1] = b64_symbols[(g >> 12) & 0x3F];
+		out[2] = (len == 2) ? b64_symbols[(g >> 6) & 0x3F] : '=';
+		out[3] = '=';
+		out += 4;
+	}
+	
+	return (uint32_t) (out - dst);
+}
+
+
+#ifdef BASE64_FAST_BENCHMARK
+/**
+ * Time this encoder against mbedtls_base64_encode on an image-sized buffer and check
+ * that they produce the same output
+ */
+void base64_fast_benchmark()
+{
+	const uint32_t src_len = 65536;
+	const int iterations = 10;
+	char* dstP;
+	char* refP;
+	int i;
+	int64_t t0;
+	int64_t t_fast;
+	int64_t t_mbed;
+	size_t ref_len;
+	uint32_t fast_len = 0;
+	uint8_t* srcP;
+	
+	srcP = heap_caps_malloc(src_len, MALLOC_CAP_SPIRAM);
+	dstP = heap_caps_malloc(BASE64_ENC_LEN(src_len) + 1, MALLOC_CAP_SPIRAM);
+	refP = heap_caps_malloc(BASE64_ENC_LEN(src_len) + 1, MALLOC_CAP_SPIRAM);
+	if ((srcP == NULL) || (dstP == NULL) || (refP == NULL)) {
+		ESP_LOGE(TAG, "Could not allocate benchmark buffers");
+		goto done;
+	}
+	
+	// Pseudo-random data
+	for (i=0; i<src_len; i++) {
+		srcP[i] = (uint8_t) ((i * 2654435761U) >> 24);
+	}
+	
+	t0 = esp_timer_get_time();
+	for (i=0; i<iterations; i++) {
+		fast_len = base64_fast_encode(srcP, src_len, dstP);
+	}
+	t_fast = (esp_timer_get_time() - t0) / iterations;
+	
+	t0 = esp_timer_get_time();
+	for (i=0; i<iterations; i++) {
+		(void) mbedtls_base64_encode((unsigned char*) refP, BASE64_ENC_LEN(src_len) + 1, &ref_len, srcP, src_len);
+	}
+	t_mbed = (esp_timer_get_time() - t0) / iterations;
+	
+	ESP_LOGI(TAG, "Encode %d bytes: fast %d uSec, mbedtls %d uSec", src_len, (int) t_fast, (int) t_mbed);
+	if ((fast_len != ref_len) || (memcmp(dstP, refP, fast_len) != 0)) {
+		ESP_LOGE(TAG, "Encoder output mismatch");
+	}
+
+done:
+	free(srcP);
+	free(dstP);
+	free(refP);
+}
+#endif
+
+
+
+//
+// Base64 Fast internal functions
+//
+
+/**
+ * Load a big-endian 32-bit word, using a single 32-bit load when possible
+ */
+static inline uint32_t IRAM_ATTR load_be32(const uint8_t* p)
+{
+	if (((uintptr_t) p & 0x3) == 0) {
+		return __builtin_bswap32(*((const uint32_t*) p));
+	} else {
+		return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	}
+}
+
+
+/**
+ * Convert 24 bits of input to 4 output characters packed for a little-endian store
+ */
+static inline uint32_t IRAM_ATTR encode_group(uint32_t g)
+{
+	return b64_pair_table[g >> 12] | (b64_pair_table[g & 0xFFF] << 16);
+}
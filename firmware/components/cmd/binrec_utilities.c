@@ -0,0 +1,333 @@
+/*
+ * Binary image record format
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "binrec_utilities.h"
+#include "lepton_utilities.h"
+#include "metadata_utilities.h"
+#include "radcodec.h"
+#include "vospi.h"
+#include <string.h>
+
+
+
+//
+// Binary Record Forward Declarations for internal functions
+//
+static uint8_t* binrec_add_string(uint8_t* p, uint8_t type, const char* s);
+static uint8_t* binrec_add_float(uint8_t* p, uint8_t type, float f);
+static uint8_t* binrec_add_stats(uint8_t* p, int index, lep_roi_stats_t* statP);
+static uint8_t* binrec_add_frame_stats(uint8_t* p, app_frame_stats_t* statsP);
+static uint8_t* binrec_add_sequence(uint8_t* p, uint8_t type, uint32_t num, int64_t usec, uint32_t age_msec);
+static bool binrec_get_crop(uint8_t* bufP, sys_lep_roi_t* cropP);
+
+
+
+//
+// Binary Record API
+//
+
+/**
+ * Load buf (at least BINREC_MAX_HEADER_LEN bytes) with the record header and metadata
+ * for the images in camP and lepP (either may be NULL) limited to the IMG_CONTENT_*
+ * items set in contents.  lep_z_len is the length of the radcodec compressed
+ * radiometric data or 0 if it is sent raw.  With IMG_CONTENT_PREVIEW the radiometric
+ * payload is instead a lep_z_len byte prevcodec preview.  Returns the header length.  The caller
+ * writes the payloads whose lengths are non-zero in the header after it.  cropP is the
+ * region the caller encodes the radiometric data from (NULL for the whole frame).  A
+ * cropped region is always in the metadata since the data can't be decoded without it.
+ */
+uint32_t binrec_build_header(uint8_t* buf, int seq_num, cam_buffer_t* camP, lep_buffer_t* lepP, uint8_t contents, uint32_t lep_z_len,
+                             const sys_lep_roi_t* cropP)
+{
+	binrec_header_t hdr;
+	image_metadata_t md;
+	uint8_t* p;
+	int i;
+	bool cropped;
+	
+	metadata_get(seq_num, camP, lepP, &md);
+	
+	// Metadata follows the fixed header
+	p = buf + sizeof(binrec_header_t);
+	if ((contents & IMG_CONTENT_META) != 0) {
+		p = binrec_add_string(p, BINREC_MD_CAMERA, md.camera);
+		p = binrec_add_string(p, BINREC_MD_VERSION, md.version);
+		p = binrec_add_string(p, BINREC_MD_TIME, md.time);
+		p = binrec_add_string(p, BINREC_MD_DATE, md.date);
+		p = binrec_add_float(p, BINREC_MD_BATTERY, md.battery);
+		p = binrec_add_string(p, BINREC_MD_CHARGE, md.charge);
+		p = binrec_add_frame_stats(p, &md.frames);
+		if (md.has_cam) {
+			p = binrec_add_string(p, BINREC_MD_CAM_TIME, md.cam_time);
+			p = binrec_add_sequence(p, BINREC_MD_CAM_SEQ, md.cam_capture_num, md.cam_usec, md.cam_age_msec);
+		}
+		if (md.has_lep) {
+			if (md.lep_time[0] != 0) {
+				p = binrec_add_string(p, BINREC_MD_LEP_TIME, md.lep_time);
+			}
+			p = binrec_add_sequence(p, BINREC_MD_LEP_SEQ, md.has_lep_count ? md.lep_frame_count : BINREC_NO_FRAME_COUNT,
+			                        md.lep_usec, md.lep_age_msec);
+			p = binrec_add_float(p, BINREC_MD_FPA_TEMP, md.fpa_temp);
+			p = binrec_add_float(p, BINREC_MD_AUX_TEMP, md.aux_temp);
+			p = binrec_add_float(p, BINREC_MD_LENS_TEMP, md.lens_temp);
+			p = binrec_add_string(p, BINREC_MD_GAIN_MODE, md.gain_mode);
+			p = binrec_add_string(p, BINREC_MD_RESOLUTION, md.resolution);
+			if (md.has_stats) {
+				for (i=0; i<LEP_STATS_NUM; i++) {
+					if (md.stats.stats[i].valid) {
+						p = binrec_add_stats(p, i, &md.stats.stats[i]);
+					}
+				}
+			}
+		}
+	}
+	cropped = (lepP != NULL) && ((contents & IMG_CONTENT_LEP) != 0) && ((contents & IMG_CONTENT_PREVIEW) == 0) &&
+	          (cropP != NULL) && !lepton_crop_is_full(cropP);
+	if (cropped) {
+		*p++ = BINREC_MD_CROP;
+		*p++ = 4;
+		*p++ = cropP->x;
+		*p++ = cropP->y;
+		*p++ = cropP->w;
+		*p++ = cropP->h;
+	}
+	
+	hdr.magic = BINREC_MAGIC;
+	hdr.version = BINREC_VERSION;
+	hdr.header_len = (uint16_t) (p - buf);
+	hdr.seq_num = seq_num;
+	hdr.jpeg_len = ((camP != NULL) && ((contents & IMG_CONTENT_CAM) != 0)) ? camP->cam_buffer_len : 0;
+	hdr.lep_len = ((lepP != NULL) && ((contents & IMG_CONTENT_LEP) != 0)) ? LEP_NUM_PIXELS*2 : 0;
+	if (cropped) hdr.lep_len = LEP_CROP_PIXEL_LEN(cropP);
+	hdr.telem_len = ((lepP != NULL) && ((contents & IMG_CONTENT_TELEM) != 0)) ? LEP_TEL_WORDS*2 : 0;
+	hdr.lep_codec = BINREC_LEP_CODEC_RAW;
+	hdr.tag = 0;
+	if ((lepP != NULL) && ((contents & IMG_CONTENT_PREVIEW) != 0)) {
+		hdr.lep_len = lep_z_len;
+		hdr.lep_codec = BINREC_LEP_CODEC_PREVIEW;
+	} else if ((hdr.lep_len != 0) && (lep_z_len != 0)) {
+		hdr.lep_len = lep_z_len;
+		hdr.lep_codec = BINREC_LEP_CODEC_RADZ;
+	}
+	memcpy(buf, &hdr, sizeof(binrec_header_t));
+	
+	return hdr.header_len;
+}
+
+
+/**
+ * Append the age of the images to the metadata of the header built in buf by
+ * binrec_build_header.  Returns the new header length.
+ */
+uint32_t binrec_add_age(uint8_t* buf, uint32_t age_msec)
+{
+	binrec_header_t* hdrP = (binrec_header_t*) buf;
+	uint8_t* p = buf + hdrP->header_len;
+	
+	*p++ = BINREC_MD_AGE;
+	*p++ = sizeof(uint32_t);
+	memcpy(p, &age_msec, sizeof(uint32_t));
+	hdrP->header_len += 2 + sizeof(uint32_t);
+	
+	return hdrP->header_len;
+}
+
+
+/**
+ * Load lepP and point jpegPP at the jpeg image in the len byte binary image record in
+ * bufP.  has_lepP is set if the record has a radiometric image and jpeg_lenP is 0
+ * without a jpeg image.  Returns false if the record is invalid or has neither.
+ * Cropped radiometric data is expanded to a full frame.
+ */
+bool binrec_parse_record(uint8_t* bufP, uint32_t len, lep_buffer_t* lepP, bool* has_lepP, uint8_t** jpegPP, uint32_t* jpeg_lenP)
+{
+	binrec_header_t* hdrP = (binrec_header_t*) bufP;
+	sys_lep_roi_t crop;
+	bool cropped;
+	uint8_t* p;
+	
+	if ((len < sizeof(binrec_header_t)) || (hdrP->magic != BINREC_MAGIC) ||
+	    ((hdrP->header_len + hdrP->jpeg_len + hdrP->lep_len + hdrP->telem_len) > len) ||
+	    (hdrP->jpeg_len > CAM_MAX_JPG_LEN))
+	{
+		return false;
+	}
+	p = bufP + hdrP->header_len;
+	
+	*jpegPP = p;
+	*jpeg_lenP = hdrP->jpeg_len;
+	p += hdrP->jpeg_len;
+	
+	*has_lepP = (hdrP->lep_len != 0);
+	if (*has_lepP) {
+		cropped = binrec_get_crop(bufP, &crop);
+		if (hdrP->lep_codec == BINREC_LEP_CODEC_RAW) {
+			if (hdrP->lep_len != LEP_CROP_PIXEL_LEN(&crop)) return false;
+			memcpy(lepP->lep_bufferP, p, hdrP->lep_len);
+		} else if (hdrP->lep_codec == BINREC_LEP_CODEC_RADZ) {
+			if (!radcodec_decode(p, hdrP->lep_len, crop.w, crop.h, lepP->lep_bufferP)) {
+				return false;
+			}
+		} else {
+			return false;
+		}
+		if (cropped) {
+			lepton_crop_expand(lepP->lep_bufferP, &crop);
+		}
+		p += hdrP->lep_len;
+		
+		lepP->telem_valid = (hdrP->telem_len == LEP_TEL_WORDS*2);
+		if (lepP->telem_valid) {
+			memcpy(lepP->lep_telemP, p, LEP_TEL_WORDS*2);
+		}
+	}
+	
+	return (*has_lepP || (*jpeg_lenP != 0));
+}
+
+
+
+//
+// Binary Record internal functions
+//
+static uint8_t* binrec_add_string(uint8_t* p, uint8_t type, const char* s)
+{
+	int len = strlen(s);
+	
+	// Strings are short (at most PS_SSID_MAX_LEN) so this limit is never hit
+	if (len > 64) len = 64;
+	*p++ = type;
+	*p++ = (uint8_t) len;
+	memcpy(p, s, len);
+	
+	return p + len;
+}
+
+
+static uint8_t* binrec_add_float(uint8_t* p, uint8_t type, float f)
+{
+	*p++ = type;
+	*p++ = sizeof(float);
+	memcpy(p, &f, sizeof(float));
+	
+	return p + sizeof(float);
+}
+
+
+static uint8_t* binrec_add_sequence(uint8_t* p, uint8_t type, uint32_t num, int64_t usec, uint32_t age_msec)
+{
+	*p++ = type;
+	*p++ = 2*sizeof(uint32_t) + sizeof(int64_t);
+	memcpy(p, &num, sizeof(uint32_t));
+	p += sizeof(uint32_t);
+	memcpy(p, &usec, sizeof(int64_t));
+	p += sizeof(int64_t);
+	memcpy(p, &age_msec, sizeof(uint32_t));
+	
+	return p + sizeof(uint32_t);
+}
+
+
+static uint8_t* binrec_add_stats(uint8_t* p, int index, lep_roi_stats_t* statP)
+{
+	uint32_t v[7];
+	
+	v[0] = statP->min;
+	v[1] = statP->max;
+	v[2] = statP->mean;
+	v[3] = statP->stddev;
+	v[4] = statP->p_low;
+	v[5] = statP->p_mid;
+	v[6] = statP->p_high;
+	
+	*p++ = BINREC_MD_STATS;
+	*p++ = 5 + sizeof(v);
+	*p++ = (uint8_t) index;
+	*p++ = statP->roi.x;
+	*p++ = statP->roi.y;
+	*p++ = statP->roi.w;
+	*p++ = statP->roi.h;
+	memcpy(p, v, sizeof(v));
+	
+	return p + sizeof(v);
+}
+
+
+static uint8_t* binrec_add_frame_stats(uint8_t* p, app_frame_stats_t* statsP)
+{
+	uint32_t v[10];
+	uint16_t t[3];
+	
+	v[0] = statsP->requested;
+	v[1] = statsP->cam_received;
+	v[2] = statsP->lep_received;
+	v[3] = statsP->cam_late;
+	v[4] = statsP->lep_late;
+	v[5] = statsP->gui_skipped;
+	v[6] = statsP->file_skipped;
+	v[7] = statsP->dropped;
+	v[8] = statsP->cmd_sent;
+	v[9] = statsP->decimated;
+	t[0] = statsP->cam_msec;
+	t[1] = statsP->lep_msec;
+	t[2] = statsP->pair_msec;
+	
+	*p++ = BINREC_MD_FRAME_STATS;
+	*p++ = sizeof(v) + sizeof(t);
+	memcpy(p, v, sizeof(v));
+	p += sizeof(v);
+	memcpy(p, t, sizeof(t));
+	
+	return p + sizeof(t);
+}
+
+
+/**
+ * Load cropP with the radiometric crop in the metadata of the record in bufP (the whole
+ * frame if it has none).  Returns true if the data is cropped.
+ */
+static bool binrec_get_crop(uint8_t* bufP, sys_lep_roi_t* cropP)
+{
+	binrec_header_t* hdrP = (binrec_header_t*) bufP;
+	uint8_t* p = bufP + sizeof(binrec_header_t);
+	uint8_t* endP = bufP + hdrP->header_len;
+	
+	cropP->x = 0;
+	cropP->y = 0;
+	cropP->w = LEP_WIDTH;
+	cropP->h = LEP_HEIGHT;
+	
+	while ((p + 2) <= endP) {
+		if ((p + 2 + p[1]) > endP) break;
+		if ((p[0] == BINREC_MD_CROP) && (p[1] == 4)) {
+			if ((p[4] != 0) && (p[5] != 0) && ((p[2] + p[4]) <= LEP_WIDTH) && ((p[3] + p[5]) <= LEP_HEIGHT)) {
+				cropP->x = p[2];
+				cropP->y = p[3];
+				cropP->w = p[4];
+				cropP->h = p[5];
+			}
+			break;
+		}
+		p += 2 + p[1];
+	}
+	
+	return !lepton_crop_is_full(cropP);
+}
@@ -0,0 +1,95 @@
+/*
+ * MJPEG AVI file format
+ *
+ * Builds the RIFF structures for recording the ArduCAM jpeg images as an MJPEG AVI
+ * (AVI 1.0) video file that any player can open:
+ *   RIFF 'AVI '
+ *     LIST 'hdrl'
+ *       'avih' main header
+ *       LIST 'strl'
+ *         'strh' video stream header
+ *         'strf' BITMAPINFOHEADER
+ *     'JUNK' padding to AVI_HEADER_LEN
+ *     LIST 'movi'
+ *       '00dc' chunk for each jpeg image (padded to an even length)
+ *     'idx1' index of the '00dc' chunks (written when the file is closed)
+ * The header is a fixed length so it can be rewritten in place with the current counts
+ * as the file grows and the frames start on a sector boundary.  All multi-byte values
+ * are little-endian.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef AVI_UTILITIES_H
+#define AVI_UTILITIES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+//
+// AVI Constants
+//
+
+// Length of the header through the 'movi' list type (offset of the first frame chunk)
+#define AVI_HEADER_LEN          512
+
+// Frame chunk header length ('00dc' fourcc and length)
+#define AVI_CHUNK_HDR_LEN       8
+
+// idx1 chunk offsets are relative to the 'movi' list type
+#define AVI_MOVI_OFFSET         (AVI_HEADER_LEN - 4)
+
+// Flags
+#define AVI_AVIF_HASINDEX       0x00000010
+#define AVI_AVIIF_KEYFRAME      0x00000010
+
+
+//
+// AVI typedefs
+//
+
+// Values for the header
+typedef struct {
+	uint16_t width;
+	uint16_t height;
+	uint32_t usec_per_frame;
+	uint32_t frames;
+	uint32_t movi_len;          // Length of the frame chunks
+	uint32_t max_frame_len;     // Largest frame chunk
+	uint32_t index_len;         // Length of the idx1 entries or 0 if it hasn't been written
+} avi_info_t;
+
+// idx1 entry
+typedef struct {
+	uint32_t ckid;              // '00dc'
+	uint32_t flags;             // AVI_AVIIF_KEYFRAME
+	uint32_t offset;            // Chunk offset from AVI_MOVI_OFFSET
+	uint32_t length;            // Chunk data length (without the header or padding)
+} __attribute__((packed)) avi_index_entry_t;
+
+
+//
+// AVI API
+//
+void avi_build_header(uint8_t* buf, const avi_info_t* infoP);
+void avi_build_chunk_header(uint8_t* buf, const char* fourcc, uint32_t len);
+void avi_build_index_entry(avi_index_entry_t* entryP, uint32_t movi_pos, uint32_t len);
+bool avi_get_jpeg_size(const uint8_t* jpgP, uint32_t len, uint16_t* width, uint16_t* height);
+
+#endif /* AVI_UTILITIES_H */
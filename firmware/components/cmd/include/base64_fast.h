@@ -0,0 +1,53 @@
+/*
+ * Table-driven base64 encoder for large image payloads.
+ *
+ * Encodes 12 source bytes per iteration using 32-bit loads and a 4096-entry table of
+ * pre-computed output character pairs (one entry per 12 bits of input).  The encode
+ * loop runs from IRAM.  The table lives in internal DRAM since IRAM only supports
+ * 32-bit accesses.  Output is standard base64 without line breaks or a terminating null.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef BASE64_FAST_H
+#define BASE64_FAST_H
+
+#include <stdint.h>
+
+
+//
+// Base64 Fast Constants
+//
+
+// Uncomment to log a comparison of this encoder with mbedtls during json_init
+//#define BASE64_FAST_BENCHMARK
+
+// Encoded length of len bytes of data
+#define BASE64_ENC_LEN(len) ((((len) + 2) / 3) * 4)
+
+
+//
+// Base64 Fast API
+//
+void base64_fast_init();
+uint32_t base64_fast_encode(const uint8_t* src, uint32_t len, char* dst);
+#ifdef BASE64_FAST_BENCHMARK
+void base64_fast_benchmark();
+#endif
+
+#endif /* BASE64_FAST_H */
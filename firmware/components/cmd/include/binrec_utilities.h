@@ -0,0 +1,103 @@
+/*
+ * Binary image record format
+ *
+ * An alternative to json image files for recordings.  Each file contains one record:
+ *   1. A fixed binrec_header_t
+ *   2. Metadata as a sequence of type-length-value items (one byte type, one byte
+ *      length, value).  Strings are not null terminated.  Floats are 4-byte IEEE-754.
+ *   3. The raw ArduCAM jpeg image (jpeg_len bytes)
+ *   4. The raw Lepton radiometric frame (lep_len bytes, 16-bit pixels)
+ *   5. The raw Lepton telemetry (telem_len bytes, 16-bit words)
+ * All multi-byte values are little-endian.  header_len is the offset of the first
+ * payload so readers can skip metadata they don't understand.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef BINREC_UTILITIES_H
+#define BINREC_UTILITIES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sys_utilities.h"
+
+
+//
+// Binary Record Constants
+//
+#define BINREC_MAGIC            0x52494346   /* "FCIR" */
+#define BINREC_VERSION          2
+
+// Radiometric payload encodings
+#define BINREC_LEP_CODEC_RAW    0      /* Little-endian 16-bit pixels */
+#define BINREC_LEP_CODEC_RADZ   1      /* radcodec compressed pixels */
+#define BINREC_LEP_CODEC_PREVIEW 2     /* prevcodec 80x60 8-bit preview (remote clients only) */
+
+// Maximum length of the header and metadata
+#define BINREC_MAX_HEADER_LEN   448
+
+// Metadata types (names match the json metadata object)
+#define BINREC_MD_CAMERA        0x01   /* String */
+#define BINREC_MD_VERSION       0x02   /* String */
+#define BINREC_MD_TIME          0x03   /* String "H:MM:SS" */
+#define BINREC_MD_DATE          0x04   /* String "M/D/YY" */
+#define BINREC_MD_BATTERY       0x05   /* Float volts */
+#define BINREC_MD_CHARGE        0x06   /* String */
+#define BINREC_MD_FPA_TEMP      0x07   /* Float °C */
+#define BINREC_MD_AUX_TEMP      0x08   /* Float °C */
+#define BINREC_MD_LENS_TEMP     0x09   /* Float °C */
+#define BINREC_MD_GAIN_MODE     0x0A   /* String */
+#define BINREC_MD_RESOLUTION    0x0B   /* String */
+#define BINREC_MD_STATS         0x0C   /* Statistics entry, index, x, y, w, h then 7 uint32 */
+#define BINREC_MD_CAM_TIME      0x0D   /* String "H:MM:SS.mmm" */
+#define BINREC_MD_LEP_TIME      0x0E   /* String "H:MM:SS.mmm" */
+#define BINREC_MD_FRAME_STATS   0x0F   /* Frame stats, 10 uint32 counts then 3 uint16 arrival times and pair skew */
+#define BINREC_MD_AGE           0x10   /* uint32 mSec since capture (get_image responses only) */
+#define BINREC_MD_CROP          0x11   /* Radiometric crop x, y, w, h (uint8 each, cropped data only) */
+#define BINREC_MD_CAM_SEQ       0x12   /* uint32 capture number, int64 uSec timestamp, uint32 mSec age */
+#define BINREC_MD_LEP_SEQ       0x13   /* uint32 frame counter (BINREC_NO_FRAME_COUNT without telemetry), int64 uSec timestamp, uint32 mSec age */
+
+// Lepton frame counter of a frame without telemetry
+#define BINREC_NO_FRAME_COUNT   0xFFFFFFFF
+
+
+//
+// Binary Record typedefs
+//
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t header_len;        // Length of this header plus metadata
+	uint32_t seq_num;
+	uint32_t jpeg_len;
+	uint32_t lep_len;
+	uint32_t telem_len;
+	uint16_t lep_codec;         // BINREC_LEP_CODEC_* (version 2)
+	uint16_t tag;               // get_image command tag (0 in files)
+} __attribute__((packed)) binrec_header_t;
+
+
+//
+// Binary Record API
+//
+uint32_t binrec_build_header(uint8_t* buf, int seq_num, cam_buffer_t* camP, lep_buffer_t* lepP, uint8_t contents, uint32_t lep_z_len,
+                             const sys_lep_roi_t* cropP);
+uint32_t binrec_add_age(uint8_t* buf, uint32_t age_msec);
+bool binrec_parse_record(uint8_t* bufP, uint32_t len, lep_buffer_t* lepP, bool* has_lepP, uint8_t** jpegPP, uint32_t* jpeg_lenP);
+
+#endif /* BINREC_UTILITIES_H */
@@ -5,9 +5,9 @@
  * json objects used by firecam.  Uses the cjson library.  Image data is formatted
  * using Base64 encoding.
  *
- * This module uses two pre-allocated buffers for the json text objects.  One for image
- * data (that can be stored as a file or sent to the host) and one for smaller responses
- * to the host.
+ * Image json text is streamed into a caller-supplied buffer (that can be stored as a
+ * file or sent to the host).  This module uses a pre-allocated buffer for smaller
+ * responses to the host.
  *
  * Be sure to read the requirements about freeing allocated buffers or objects in
  * the function description.  Or BOOM.
@@ -33,28 +33,97 @@
 #ifndef JSON_UTILITIES_H
 #define JSON_UTILITIES_H
 
+#include "base64_fast.h"
 #include "ds3232.h"
+#include "ota_task.h"
+#include "schedule_utilities.h"
+#include "summary_utilities.h"
 #include "sys_utilities.h"
+#include "vospi.h"
 #include "wifi_utilities.h"
+#include "xfer_task.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include "cJSON.h"
 
 
 
+//
+// JSON Utilities Constants
+//
+
+// cJSON arena allocation alignment (cJSON items hold doubles)
+#define JSON_ARENA_ALIGN 8
+
+// Combined image (ArduCAM + Lepton + Metadata) json object text size: the Base64
+// encoded largest jpeg image, radiometric data and telemetry plus the metadata and
+// object overhead (child names, formatting characters, NLs) rounded to 4 bytes
+#define JSON_MAX_IMAGE_TEXT_LEN ((BASE64_ENC_LEN(CAM_MAX_JPG_LEN) + \
+                                  BASE64_ENC_LEN(LEP_NUM_PIXELS*2) + \
+                                  BASE64_ENC_LEN(LEP_TEL_WORDS*2) + \
+                                  JSON_MAX_METADATA_LEN + JSON_IMAGE_OVERHEAD_LEN + 3) & ~3)
+
+// Streamed responses
+#define JSON_STREAM_NONE      0
+#define JSON_STREAM_PERF      1
+#define JSON_STREAM_SESSIONS  2
+
+
+
+//
+// JSON Utilities typedefs
+//
+
+// A response written a chunk at a time by json_stream_fill.  Each chunk holds whole
+// parts (the response header, one pipeline stage or session, the trailer).
+typedef struct {
+	int type;                    // JSON_STREAM_xxx, JSON_STREAM_NONE when finished
+	int part;                    // Next part to write
+	uint16_t tag;                // Added as the first item if non-zero
+	int count;                   // Sessions in the list
+	int total;                   // Sessions on the card
+} json_stream_t;
+
+
+
 //
 // JSON Utilities API
 //
 bool json_init();
 cJSON* json_get_cmd_object(char* json_string);
-char* json_get_image_file_string(int seq_num, bool has_cam, bool has_lep, uint32_t* len);
+bool json_get_image_file_string(int seq_num, cam_buffer_t* camP, lep_buffer_t* lepP, uint8_t contents, json_image_string_t* dst);
+uint32_t json_get_image_meta_line(int seq_num, cam_buffer_t* camP, lep_buffer_t* lepP, char* buf, uint32_t max_len);
+uint32_t json_get_summary_string(const session_summary_t* sumP, char* buf, uint32_t max_len);
 char* json_get_config(uint32_t* len);
 char* json_get_status(uint32_t* len);
+char* json_get_beacon(uint32_t* len);
+#ifdef INCLUDE_SYS_BENCH
+char* json_get_benchmark(uint32_t* len);
+#endif
+char* json_get_alarm(uint32_t* len);
+char* json_get_schedule(uint32_t* len);
 char* json_get_wifi(uint32_t* len);
-bool json_parse_cmd(cJSON* cmd_obj, int* cmd, cJSON** cmd_args);
+void json_stream_start(json_stream_t* s, int type, uint16_t tag);
+uint32_t json_stream_fill(json_stream_t* s, char* buf, uint32_t max_len);
+char* json_get_ota(const ota_status_t* statusP, uint32_t* len);
+bool json_scan_cmd(const char* json_string, int* cmd, uint16_t* tag, bool* has_args);
+bool json_parse_cmd(cJSON* cmd_obj, int* cmd, uint16_t* tag, cJSON** cmd_args);
 bool json_parse_set_config(cJSON* cmd_args, gui_state_t* new_st);
+bool json_parse_set_fusion_cal(cJSON* cmd_args, gui_state_t* new_st);
+void json_parse_calibrate_lepton(cJSON* cmd_args, bool* clear);
+void json_parse_get_image(cJSON* cmd_args, bool* fresh);
+bool json_parse_set_image_format(cJSON* cmd_args, int* format);
+void json_parse_stream_on(cJSON* cmd_args, int* period, int* contents);
+bool json_parse_udp_stream_on(cJSON* cmd_args, uint8_t* ip_addr, uint16_t* port);
+bool json_parse_set_sync(cJSON* cmd_args, int* mode);
+bool json_parse_set_upload(cJSON* cmd_args, uint8_t* ip_addr, uint16_t* port);
+bool json_parse_set_schedule(cJSON* cmd_args, int* n, sched_window_t* w);
+bool json_parse_ota_update(cJSON* cmd_args, uint32_t* length, uint8_t* sha256, bool* restart);
+void json_parse_run_benchmark(cJSON* cmd_args, uint16_t* tcp_port);
+bool json_parse_get_file(cJSON* cmd_args, bool whole_session, xfer_request_t* reqP);
 bool json_parse_set_time(cJSON* cmd_args, tmElements_t* te);
 bool json_parse_set_wifi(cJSON* cmd_args, wifi_info_t* new_wifi_info);
+bool json_parse_image_string(char* textP, uint32_t len, lep_buffer_t* lepP, bool* has_lepP, uint8_t** jpegPP, uint32_t* jpeg_lenP);
 void json_free_cmd(cJSON* cmd);
 
 #endif /* JSON_UTILITIES_H */
\ No newline at end of file
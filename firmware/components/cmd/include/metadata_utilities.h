@@ -0,0 +1,79 @@
+/*
+ * Image metadata collection
+ *
+ * Gathers the system and Lepton information stored with each image so the json and
+ * binary image formats report the same values.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef METADATA_UTILITIES_H
+#define METADATA_UTILITIES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "adc_utilities.h"
+#include "app_task.h"
+#include "lepton_stats.h"
+#include "ps_utilities.h"
+#include "sys_utilities.h"
+
+
+//
+// Metadata Utilities typedefs
+//
+typedef struct {
+	char camera[PS_SSID_MAX_LEN+1];
+	const char* version;
+	int seq_num;
+	char time[12];              // "H:MM:SS" of the capture
+	char date[12];              // "M/D/YY" of the capture
+	float battery;
+	const char* charge;
+	bool has_cam;               // ArduCAM capture time (only valid if set)
+	char cam_time[16];          // "H:MM:SS.mmm"
+	uint32_t cam_capture_num;   // cam_task's count of images read
+	int64_t cam_usec;           // esp_timer time the capture completed
+	uint32_t cam_age_msec;      // Time since then when the metadata was collected
+	bool has_lep;               // Following are only valid if set
+	char lep_time[16];          // "H:MM:SS.mmm"
+	bool has_lep_count;         // Lepton frame counter from the telemetry (only valid if set)
+	uint32_t lep_frame_count;
+	int64_t lep_usec;           // esp_timer time of the frame's vsync (0 if unknown)
+	uint32_t lep_age_msec;
+	float fpa_temp;
+	float aux_temp;
+	float lens_temp;
+	const char* gain_mode;
+	const char* resolution;
+	bool has_stats;             // Radiometric statistics (only valid if set)
+	lep_stats_t stats;
+	app_frame_stats_t frames;   // Image pipeline accounting when the metadata was collected
+} image_metadata_t;
+
+
+//
+// Metadata Utilities API
+//
+void metadata_init();
+void metadata_set_camera(const char* name);
+void metadata_set_batt(batt_status_t* bs);
+void metadata_set_lens_temp(float t);
+void metadata_get(int seq_num, cam_buffer_t* camP, lep_buffer_t* lepP, image_metadata_t* md);
+
+#endif /* METADATA_UTILITIES_H */
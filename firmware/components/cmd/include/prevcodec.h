@@ -0,0 +1,64 @@
+/*
+ * Low-bandwidth Lepton preview codec
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PREVCODEC_H
+#define PREVCODEC_H
+
+#include <stdint.h>
+#include "sys_utilities.h"
+#include "vospi.h"
+
+
+//
+// Preview codec constants
+//
+
+// A preview is the Lepton frame averaged down to 80x60 pixels and linearly mapped to
+// 8 bits between the frame's minimum (0) and maximum (255) radiometric values.  It
+// starts with an 8-byte little-endian header:
+//   width, height, encoding, 0        - 1 byte each
+//   minimum, maximum                   - 2 bytes each (radiometric values of 0 and 255)
+// followed by the pixels, a row at a time, either raw (PREVCODEC_ENC_RAW) or packed
+// (PREVCODEC_ENC_PACKED).  Packed pixels are predicted as in radcodec and the zig-zag
+// encoded residuals (modulo 256) are Rice coded in a bit stream (most significant bit
+// first).  Each row starts with its 2-bit Rice parameter k.  Each residual r is then
+// written as q = r >> k 0 bits, a 1 bit and the low k bits of r.  If q would be
+// PREVCODEC_RICE_LIMIT or more, PREVCODEC_RICE_LIMIT 0 bits and r's 8 bits are written
+// instead.  The last byte is padded with 0 bits.  A packed preview that would be
+// longer than a raw one is sent raw.
+#define PREVCODEC_WIDTH         (LEP_WIDTH / 2)
+#define PREVCODEC_HEIGHT        (LEP_HEIGHT / 2)
+#define PREVCODEC_HEADER_LEN    8
+#define PREVCODEC_MAX_LEN       (PREVCODEC_HEADER_LEN + PREVCODEC_WIDTH * PREVCODEC_HEIGHT)
+
+#define PREVCODEC_ENC_RAW       0
+#define PREVCODEC_ENC_PACKED    1
+
+#define PREVCODEC_RICE_MAX_K    3
+#define PREVCODEC_RICE_LIMIT    12
+
+
+//
+// Preview codec API
+//
+uint32_t prevcodec_encode(const lep_buffer_t* lepP, uint8_t* dst);
+
+#endif /* PREVCODEC_H */
@@ -0,0 +1,50 @@
+/*
+ * Lossless radiometric frame codec
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef RADCODEC_H
+#define RADCODEC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+//
+// Radiometric codec constants
+//
+
+// Each pixel is predicted from its left, upper and upper-left neighbors (the LOCO-I
+// median edge detector).  The zig-zag encoded prediction residuals are written as:
+//   0xxxxxxx                  - residual 0 - 127
+//   10xxxxxx xxxxxxxx         - residual 128 - 16383 (high byte first)
+//   110nnnnn                  - nnnnn+1 (1 - 32) zero residuals
+//   11100000 <lo> <hi>        - any residual
+#define RADCODEC_MAX_RUN        32
+#define RADCODEC_ESCAPE         0xE0
+
+
+//
+// Radiometric codec API
+//
+uint32_t radcodec_encode(const uint16_t* src, int width, int height, uint8_t* dst, uint32_t dst_len);
+uint32_t radcodec_encode_region(const uint16_t* src, int stride, int width, int height, uint8_t* dst, uint32_t dst_len);
+bool radcodec_decode(const uint8_t* src, uint32_t src_len, int width, int height, uint16_t* dst);
+
+#endif /* RADCODEC_H */
@@ -0,0 +1,137 @@
+/*
+ * Recording session summary
+ *
+ * Running aggregates of the images recorded in a session (temperatures over time,
+ * per-region maxima, partial and missing images and alarm events) so a session can be
+ * triaged from one small file instead of its image files.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef SUMMARY_UTILITIES_H
+#define SUMMARY_UTILITIES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "file_utilities.h"
+#include "lepton_stats.h"
+#include "sys_utilities.h"
+
+
+//
+// Summary Utilities constants
+//
+
+// Temperature timeline.  Images are summarized in buckets of SUMMARY_BUCKET_SEC seconds
+// from the start of the session.  When a session outlasts SUMMARY_MAX_BUCKETS buckets
+// adjacent pairs are merged and the bucket length doubles.
+#define SUMMARY_MAX_BUCKETS  48
+#define SUMMARY_BUCKET_SEC   60
+
+// Alarm events kept with their details (later events are only counted)
+#define SUMMARY_MAX_ALARMS   16
+
+// Summary json text size: the session values, a full timeline and alarm list
+#define SUMMARY_MAX_TEXT_LEN 8192
+
+
+
+//
+// Summary Utilities typedefs
+//
+
+// Values taken from an image when it is queued for recording
+typedef struct {
+	uint32_t epoch_sec;
+	bool has_cam;
+	bool has_lep;
+	bool has_stats;             // Mean and region values are only valid if set
+	uint32_t min;               // Frame values in K * 100
+	uint32_t max;
+	uint32_t mean;
+	bool roi_valid[LEP_STATS_NUM];
+	uint32_t roi_max[LEP_STATS_NUM];
+} summary_sample_t;
+
+typedef struct {
+	uint32_t images;            // Images in the bucket (temperatures only valid if lep_images != 0)
+	uint32_t lep_images;
+	uint32_t min;
+	uint32_t max;
+	uint64_t mean_sum;
+	uint32_t mean_count;
+} summary_bucket_t;
+
+typedef struct {
+	bool valid;
+	uint32_t max;               // K * 100
+	uint32_t epoch_sec;         // Image with the maximum
+	uint16_t seq_num;
+} summary_roi_max_t;
+
+typedef struct {
+	uint32_t epoch_sec;         // Event start
+	uint8_t cause;              // LEP_ALARM_CAUSE_xxx
+	uint8_t roi;
+	uint8_t stat;               // SYS_ALARM_STAT_xxx
+	uint32_t value;
+	int32_t rate;
+} summary_alarm_t;
+
+typedef struct {
+	char session[SESSION_DIR_NAME_LEN];
+	bool resumed;               // Only covers the images since the session was resumed
+	bool complete;              // Set when the session has ended
+	uint32_t start_sec;
+	uint32_t update_sec;
+	bool rec_cam;               // Images expected in the session
+	bool rec_lep;
+	uint32_t images;            // Images written (including spooled)
+	uint32_t cam_images;
+	uint32_t lep_images;
+	uint32_t partial;           // Images missing an expected ArduCAM image or Lepton frame
+	uint32_t spooled;
+	uint32_t failed;            // Images that couldn't be written
+	uint32_t dropped;           // Images not queued because file_task was behind
+	uint32_t cam_late;          // Pipeline periods without an image since the session started
+	uint32_t lep_late;
+	uint32_t min;               // Session frame values in K * 100 (only valid if lep_images != 0)
+	uint32_t max;
+	uint64_t mean_sum;
+	uint32_t mean_count;
+	summary_roi_max_t roi[LEP_STATS_NUM];
+	uint32_t bucket_sec;
+	summary_bucket_t buckets[SUMMARY_MAX_BUCKETS];
+	uint32_t alarm_count;       // Alarm events during the session
+	int num_alarms;             // Events with details
+	summary_alarm_t alarms[SUMMARY_MAX_ALARMS];
+} session_summary_t;
+
+
+
+//
+// Summary Utilities API
+//
+void summary_get_sample(cam_buffer_t* camP, lep_buffer_t* lepP, summary_sample_t* sampleP);
+void summary_start(const char* session, bool resume, bool rec_cam, bool rec_lep);
+void summary_add_image(const summary_sample_t* sampleP, uint16_t seq_num, bool written, bool spooled);
+void summary_update(uint32_t dropped, bool complete);
+bool summary_get_changed();
+const session_summary_t* summary_get();
+
+#endif /* SUMMARY_UTILITIES_H */
@@ -34,15 +34,40 @@
 #include "json_utilities.h"
 #include "ps_utilities.h"
 #include "system_config.h"
+#include "lepton_alarm.h"
+#include "lepton_correct.h"
+#include "lepton_stats.h"
 #include "lepton_utilities.h"
 #include "time_utilities.h"
 #include "app_task.h"
+#include "bench_task.h"
+#include "cam_task.h"
 #include "cmd_task.h"
+#include "file_task.h"
+#include "file_utilities.h"
+#include "gui_mem_utilities.h"
+#include "health_task.h"
+#include "fork_utilities.h"
 #include "vospi.h"
-#include "crypto/base64.h"
+#include "xfer_task.h"
+#include "base64_fast.h"
+#include "metadata_utilities.h"
+#include "perf_utilities.h"
+#include "prevcodec.h"
+#include "schedule_utilities.h"
+#include "ota_task.h"
+#include "sync_task.h"
+#include "upload_task.h"
+#include "esp_attr.h"
 #include "esp_system.h"
 #include "esp_ota_ops.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "mbedtls/base64.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 
@@ -65,37 +90,152 @@ const cmd_name_t command_list[CMD_NUM] = {
 	{CMD_SET_WIFI_S, CMD_SET_WIFI},
 	{CMD_RECORD_ON_S, CMD_RECORD_ON},
 	{CMD_RECORD_OFF_S, CMD_RECORD_OFF},
-	{CMD_POWEROFF_S, CMD_POWEROFF}
+	{CMD_POWEROFF_S, CMD_POWEROFF},
+	{CMD_SET_IMG_FMT_S, CMD_SET_IMG_FMT},
+	{CMD_STREAM_ON_S, CMD_STREAM_ON},
+	{CMD_STREAM_OFF_S, CMD_STREAM_OFF},
+	{CMD_UDP_ON_S, CMD_UDP_ON},
+	{CMD_UDP_OFF_S, CMD_UDP_OFF},
+	{CMD_GET_PERF_S, CMD_GET_PERF},
+	{CMD_DUMP_TRACE_S, CMD_DUMP_TRACE},
+	{CMD_RUN_BENCH_S, CMD_RUN_BENCH},
+	{CMD_LIST_SESSIONS_S, CMD_LIST_SESSIONS},
+	{CMD_GET_FILE_S, CMD_GET_FILE},
+	{CMD_GET_SESSION_S, CMD_GET_SESSION},
+	{CMD_PREP_CARD_S, CMD_PREP_CARD},
+	{CMD_SET_SYNC_S, CMD_SET_SYNC},
+	{CMD_OTA_UPDATE_S, CMD_OTA_UPDATE},
+	{CMD_SET_UPLOAD_S, CMD_SET_UPLOAD},
+	{CMD_SET_FUSION_CAL_S, CMD_SET_FUSION_CAL},
+	{CMD_CAL_LEPTON_S, CMD_CAL_LEPTON},
+	{CMD_GET_SCHED_S, CMD_GET_SCHED},
+	{CMD_SET_SCHED_S, CMD_SET_SCHED}
 };
 
 
 
+//
+// Image pipeline accounting names (Frame Stats object)
+//
+#define JSON_FRAME_STATS_NUM 13
+
+static const char* json_frame_stats_names[JSON_FRAME_STATS_NUM] = {
+	"Requested",
+	"ArduCAM Received",
+	"Lepton Received",
+	"ArduCAM Late",
+	"Lepton Late",
+	"GUI Skipped",
+	"File Skipped",
+	"Dropped",
+	"Cmd Sent",
+	"Decimated",
+	"ArduCAM Arrival",
+	"Lepton Arrival",
+	"Pair Skew"
+};
+
+
+
+//
+// Streaming json writer used for image files
+//
+typedef struct {
+	char* bufP;
+	uint32_t length;
+	uint32_t max_length;
+	int depth;
+	bool first;       // Next item is the first in its object
+	bool overflow;    // Output didn't fit in the buffer
+	bool compact;     // No whitespace (like cJSON's unformatted output)
+} json_writer_t;
+
+// Base64 data encoded in 12-byte blocks split across both cores
+#define JSON_B64_BLOCK_LEN     12
+#define JSON_B64_SPLIT_MIN_LEN 8192
+
+typedef struct {
+	const uint8_t* src;
+	uint32_t len;
+	char* dst;
+} json_b64_job_t;
+
+
+
 //
 // JSON Utilities variables
 //
 static const char* TAG = "json_utilities";
 
-static char* json_image_text;       // Loaded for combined image data
 static char* json_response_text;    // Loaded for response data
 
-static unsigned char* base64_jpeg_data;
-static unsigned char* base64_lep_data;
-static unsigned char* base64_lep_telem_data;
+// Rendered get_config and get_status responses.  The config response is re-rendered
+// when the GUI state changes and the status response when it is older than
+// JSON_STATUS_HOLD_MSEC so repeated polls are only a copy.
+static char* json_config_text;
+static uint32_t json_config_len;    // 0 when not rendered
+static uint32_t json_config_version;
+static char* json_status_text;
+static uint32_t json_status_len;    // 0 when not rendered
+static int64_t json_status_usec;
+
+// Copy of the performance counters for get_perf (too large for cmd_task's stack)
+static perf_stats_t json_perf_stats;
+static perf_task_t json_perf_tasks[PERF_MAX_TASKS];
+
+// Lepton preview for a json image.  Only app_task's cmd_task images contain previews.
+static EXT_RAM_ATTR uint8_t json_preview_buffer[PREVCODEC_MAX_LEN];
+
+// Cropped Lepton radiometric data for a json image
+static EXT_RAM_ATTR uint16_t json_crop_buffer[LEP_NUM_PIXELS];
+
+// cJSON allocation arena.  cJSON objects live only while a command is processed so
+// allocations are a pointer bump and the arena is reset when the last one is freed.
+// Only cmd_task uses cJSON.
+static uint8_t* json_arena;
+static uint32_t json_arena_used;
+static int json_arena_live;         // Arena allocations not yet freed
 
 
 
 //
 // JSON Utilities Forward Declarations for internal functions
 //
-bool json_add_cam_image_object(cJSON* parent);
-void json_free_cam_base64_image();
-bool json_add_lep_image_object(cJSON* parent);
-void json_free_lep_base64_image();
-bool json_add_lep_telem_object(cJSON* parent);
-void json_free_lep_base64_telem();
-bool json_add_metadata_object(cJSON* parent, int seq_num, bool inc_lep);
-int json_generate_response_string(cJSON* root);
+void json_writer_init(json_writer_t* w, char* buf, uint32_t max_len);
+void json_writer_write(json_writer_t* w, const char* text, uint32_t len);
+void json_writer_puts(json_writer_t* w, const char* text);
+void json_writer_begin_object(json_writer_t* w);
+void json_writer_end_object(json_writer_t* w);
+void json_writer_key(json_writer_t* w, const char* key);
+void json_writer_string(json_writer_t* w, const char* str);
+void json_writer_number(json_writer_t* w, double d);
+void json_writer_bool(json_writer_t* w, bool b);
+void json_writer_begin_array(json_writer_t* w);
+void json_writer_end_array(json_writer_t* w);
+void json_writer_element(json_writer_t* w);
+void json_writer_base64(json_writer_t* w, const uint8_t* data, uint32_t len);
+void json_b64_blocks(void* argP, int start, int end);
+void json_write_metadata_object(json_writer_t* w, int seq_num, cam_buffer_t* camP, lep_buffer_t* lepP);
+void json_write_stats_object(json_writer_t* w, lep_stats_t* statsP);
+void json_add_stats_object(cJSON* parent, lep_stats_t* statsP);
+int json_frame_stats_values(app_frame_stats_t* statsP, double* v);
+void json_write_frame_stats_object(json_writer_t* w, app_frame_stats_t* statsP);
+void json_add_frame_stats_object(cJSON* parent, app_frame_stats_t* statsP);
+const char* json_stats_name(int index, char* buf);
+static const char* json_charge_name(enum CHARGE_STATE_t charge_state);
+static void* json_arena_malloc(size_t sz);
+static void json_arena_free(void* ptr);
+static const char* json_skip_space(const char* cP);
+static bool json_find_image_value(char* textP, const char* key, char** valP, uint32_t* val_lenP);
+static bool json_decode_image_value(char* textP, const char* key, uint8_t** dataPP, uint32_t* lenP);
+int json_generate_response_string(cJSON* root, char* buf);
 bool json_ip_string_to_array(uint8_t* ip_array, char* ip_string);
+uint16_t json_get_roi_arg(cJSON* cmd_args, const char* name, uint16_t cur_val, int* item_count);
+int json_get_range_arg(cJSON* cmd_args, const char* name, int cur_val, int min_val, int max_val, int* item_count);
+uint16_t json_get_fusion_dist_arg(cJSON* cmd_args, const char* name, uint16_t cur_val, int* item_count);
+static void json_stream_header(json_stream_t* s, json_writer_t* w, const char* name);
+static bool json_stream_perf_part(json_stream_t* s, json_writer_t* w);
+static bool json_stream_sessions_part(json_stream_t* s, json_writer_t* w);
 
 
 
@@ -108,18 +248,40 @@ bool json_ip_string_to_array(uint8_t* ip_array, char* ip_string);
  */
 bool json_init()
 {
-	// Get memory for the json text output strings
-	json_image_text = heap_caps_malloc(JSON_MAX_IMAGE_TEXT_LEN, MALLOC_CAP_SPIRAM);
-	if (json_image_text == NULL) {
-		ESP_LOGE(TAG, "Could not allocate json_image_text buffer");
-		return false;
-	}
+	cJSON_Hooks hooks;
+	
+	// Setup the image data encoder
+	base64_fast_init();
+#ifdef BASE64_FAST_BENCHMARK
+	base64_fast_benchmark();
+#endif
 	
+	// Get memory for the json text output strings
 	json_response_text = heap_caps_malloc(JSON_MAX_RSP_TEXT_LEN, MALLOC_CAP_SPIRAM);
 	if (json_response_text == NULL) {
 		ESP_LOGE(TAG, "Could not allocate json_response_text buffer");
 		return false;
 	}
+	json_config_text = heap_caps_malloc(JSON_MAX_RSP_TEXT_LEN, MALLOC_CAP_SPIRAM);
+	json_status_text = heap_caps_malloc(JSON_MAX_RSP_TEXT_LEN, MALLOC_CAP_SPIRAM);
+	if ((json_config_text == NULL) || (json_status_text == NULL)) {
+		ESP_LOGE(TAG, "Could not allocate cached response buffers");
+		return false;
+	}
+	json_config_len = 0;
+	json_status_len = 0;
+	
+	// Get memory for the cJSON arena and have cJSON use it
+	json_arena = heap_caps_malloc(JSON_ARENA_LEN, MALLOC_CAP_SPIRAM);
+	if (json_arena == NULL) {
+		ESP_LOGE(TAG, "Could not allocate json_arena buffer");
+		return false;
+	}
+	json_arena_used = 0;
+	json_arena_live = 0;
+	hooks.malloc_fn = json_arena_malloc;
+	hooks.free_fn = json_arena_free;
+	cJSON_InitHooks(&hooks);
 	
 	return true;
 }
@@ -136,85 +298,266 @@ cJSON* json_get_cmd_object(char* json_string)
 
 
 /**
- * Return a formatted json string in our pre-allocated json text image buffer containing
- * up to three json objects.  *len is non-zero for a successful operation.
- *   - Base64 encoded jpeg image from the ArduCAM if has_cam is true
- *   - Base64 encoded raw image from the Lepton if has_lep is true
+ * Write a formatted json string into the dst image buffer containing up to four json
+ * objects selected by the IMG_CONTENT_* flags in contents.  dst->length is non-zero
+ * and true is returned for a successful operation.
  *   - Image meta-data
+ *   - Base64 encoded jpeg image from the ArduCAM if camP is not NULL
+ *   - Base64 encoded raw image and telemetry from the Lepton if lepP is not NULL
+ *   - Base64 encoded preview of the Lepton image for remote clients that want it
  *
- * This function handles its own memory management.
+ * The string is streamed directly into dst in one pass, base64 encoding the image data
+ * in place, so no heap memory is used.  The layout matches cJSON's formatted output.
+ * Radiometric data is limited to the configured crop, which is then included as "crop".
  */
-char* json_get_image_file_string(int seq_num, bool has_cam, bool has_lep, uint32_t* len)
+bool json_get_image_file_string(int seq_num, cam_buffer_t* camP, lep_buffer_t* lepP, uint8_t contents, json_image_string_t* dst)
 {
-	bool success;
-	cJSON* root;
+	json_writer_t w;
+	int64_t start_usec;
+	sys_lep_roi_t crop;
+	char crop_text[16];
 	
-	*len = 0;
-	root = cJSON_CreateObject();
-	if (root == NULL) return NULL;
+	start_usec = esp_timer_get_time();
+	json_writer_init(&w, dst->bufferP, JSON_MAX_IMAGE_TEXT_LEN);
 	
-	// Construct the json object
-	success = json_add_metadata_object(root, seq_num, has_lep);
-	if (success) {
-		if (has_cam) {
-			success = json_add_cam_image_object(root);
-		}
-		if (success) {
-			if (has_lep) {
-				success = json_add_lep_image_object(root);
-				if (!success && has_cam) {
-					// We have to free the cam_image that was already allocated
-					json_free_cam_base64_image();
-				} else {
-					success = json_add_lep_telem_object(root);
-					if (!success) {
-						// Free images that were already allocated
-						if (has_cam) {
-							json_free_cam_base64_image();
-						}
-						json_free_lep_base64_image();
-					}
-				}
+	json_writer_begin_object(&w);
+	if ((contents & IMG_CONTENT_META) != 0) {
+		json_write_metadata_object(&w, seq_num, camP, lepP);
+	}
+	if ((camP != NULL) && ((contents & IMG_CONTENT_CAM) != 0)) {
+		json_writer_key(&w, "jpeg");
+		json_writer_base64(&w, camP->cam_bufferP, camP->cam_buffer_len);
+	}
+	if (lepP != NULL) {
+		if ((contents & IMG_CONTENT_LEP) != 0) {
+			if (lepton_get_crop(&crop)) {
+				sprintf(crop_text, "%u,%u,%u,%u", crop.x, crop.y, crop.w, crop.h);
+				json_writer_key(&w, "crop");
+				json_writer_string(&w, crop_text);
+				lepton_crop_copy(lepP->lep_bufferP, &crop, json_crop_buffer);
+				json_writer_key(&w, "radiometric");
+				json_writer_base64(&w, (uint8_t*) json_crop_buffer, LEP_CROP_PIXEL_LEN(&crop));
+			} else {
+				json_writer_key(&w, "radiometric");
+				json_writer_base64(&w, (uint8_t*) lepP->lep_bufferP, LEP_NUM_PIXELS*2);
 			}
 		}
+		if ((contents & IMG_CONTENT_TELEM) != 0) {
+			json_writer_key(&w, "telemetry");
+			json_writer_base64(&w, (uint8_t*) lepP->lep_telemP, LEP_TEL_WORDS*2);
+		}
+		if ((contents & IMG_CONTENT_PREVIEW) != 0) {
+			json_writer_key(&w, "preview");
+			json_writer_base64(&w, json_preview_buffer, prevcodec_encode(lepP, json_preview_buffer));
+		}
 	}
+	json_writer_end_object(&w);
 	
-	// Pretty-print the object to our buffer
-	if (success) {
-		if (cJSON_PrintPreallocated(root, json_image_text, JSON_MAX_IMAGE_TEXT_LEN, true) == 0) {
-			*len = 0;
-		} else {
-			*len = strlen(json_image_text);
+	if (w.overflow) {
+		ESP_LOGE(TAG, "failed to create json image text - too large for buffer");
+		dst->length = 0;
+	} else {
+		// json_writer always leaves room for the terminating null
+		w.bufP[w.length] = 0;
+		dst->length = w.length;
+		perf_record(PERF_JSON_BUILD, esp_timer_get_time() - start_usec);
+	}
+	
+	return (dst->length != 0);
+}
+
+
+/**
+ * Write an image's metadata into buf (max_len bytes) as one line of compact json text
+ * ending in a newline for the session metadata log.  Returns the length of the line or
+ * 0 if it didn't fit.  It holds the same metadata object as an image file.  Uses no
+ * heap memory.
+ */
+uint32_t json_get_image_meta_line(int seq_num, cam_buffer_t* camP, lep_buffer_t* lepP, char* buf, uint32_t max_len)
+{
+	json_writer_t w;
+	
+	json_writer_init(&w, buf, max_len);
+	w.compact = true;
+	
+	json_writer_begin_object(&w);
+	json_write_metadata_object(&w, seq_num, camP, lepP);
+	json_writer_end_object(&w);
+	json_writer_puts(&w, "\n");
+	
+	if (w.overflow) {
+		ESP_LOGE(TAG, "failed to create json metadata line - too large for buffer");
+		return 0;
+	}
+	
+	w.bufP[w.length] = 0;
+	return w.length;
+}
+
+
+/**
+ * Write the recording session summary into buf (max_len bytes) as a formatted json
+ * string.  Returns the length of the string or 0 if it didn't fit.  Temperatures are
+ * in K * 100 and times are seconds since the epoch.  Uses no heap memory so file_task
+ * can call it.
+ */
+uint32_t json_get_summary_string(const session_summary_t* sumP, char* buf, uint32_t max_len)
+{
+	char name[16];
+	int i;
+	json_writer_t w;
+	const summary_bucket_t* bP;
+	const summary_roi_max_t* roiP;
+	const summary_alarm_t* aP;
+	
+	json_writer_init(&w, buf, max_len);
+	
+	json_writer_begin_object(&w);
+	json_writer_key(&w, "Session");
+	json_writer_string(&w, sumP->session);
+	json_writer_key(&w, "Resumed");
+	json_writer_bool(&w, sumP->resumed);
+	json_writer_key(&w, "Complete");
+	json_writer_bool(&w, sumP->complete);
+	json_writer_key(&w, "Start");
+	json_writer_number(&w, (double) sumP->start_sec);
+	json_writer_key(&w, "Updated");
+	json_writer_number(&w, (double) sumP->update_sec);
+	
+	json_writer_key(&w, "Images");
+	json_writer_number(&w, (double) sumP->images);
+	json_writer_key(&w, "ArduCAM Images");
+	json_writer_number(&w, (double) sumP->cam_images);
+	json_writer_key(&w, "Lepton Images");
+	json_writer_number(&w, (double) sumP->lep_images);
+	json_writer_key(&w, "Partial Images");
+	json_writer_number(&w, (double) sumP->partial);
+	json_writer_key(&w, "Spooled");
+	json_writer_number(&w, (double) sumP->spooled);
+	json_writer_key(&w, "Failed");
+	json_writer_number(&w, (double) sumP->failed);
+	json_writer_key(&w, "Dropped");
+	json_writer_number(&w, (double) sumP->dropped);
+	json_writer_key(&w, "ArduCAM Late");
+	json_writer_number(&w, (double) sumP->cam_late);
+	json_writer_key(&w, "Lepton Late");
+	json_writer_number(&w, (double) sumP->lep_late);
+	
+	if (sumP->lep_images != 0) {
+		json_writer_key(&w, "Min");
+		json_writer_number(&w, (double) sumP->min);
+		json_writer_key(&w, "Max");
+		json_writer_number(&w, (double) sumP->max);
+		if (sumP->mean_count != 0) {
+			json_writer_key(&w, "Mean");
+			json_writer_number(&w, (double) (sumP->mean_sum / sumP->mean_count));
 		}
+	}
+	
+	json_writer_key(&w, "Maxima");
+	json_writer_begin_object(&w);
+	for (i=0; i<LEP_STATS_NUM; i++) {
+		roiP = &sumP->roi[i];
+		if (!roiP->valid) continue;
 		
-		// Free the base-64 converted image strings
-		if (has_cam) {
-			json_free_cam_base64_image();
-		}
-		if (has_lep) {
-			json_free_lep_base64_image();
-			json_free_lep_base64_telem();
+		json_writer_key(&w, json_stats_name(i, name));
+		json_writer_begin_object(&w);
+		json_writer_key(&w, "Max");
+		json_writer_number(&w, (double) roiP->max);
+		json_writer_key(&w, "Time");
+		json_writer_number(&w, (double) roiP->epoch_sec);
+		json_writer_key(&w, "Seq Num");
+		json_writer_number(&w, (double) roiP->seq_num);
+		json_writer_end_object(&w);
+	}
+	json_writer_end_object(&w);
+	
+	json_writer_key(&w, "Bucket Length");
+	json_writer_number(&w, (double) sumP->bucket_sec);
+	json_writer_key(&w, "Timeline");
+	json_writer_begin_array(&w);
+	for (i=0; i<SUMMARY_MAX_BUCKETS; i++) {
+		bP = &sumP->buckets[i];
+		if (bP->images == 0) continue;
+		
+		json_writer_element(&w);
+		json_writer_begin_object(&w);
+		json_writer_key(&w, "Time");
+		json_writer_number(&w, (double) (sumP->start_sec + i * sumP->bucket_sec));
+		json_writer_key(&w, "Images");
+		json_writer_number(&w, (double) bP->images);
+		if (bP->lep_images != 0) {
+			json_writer_key(&w, "Min");
+			json_writer_number(&w, (double) bP->min);
+			json_writer_key(&w, "Max");
+			json_writer_number(&w, (double) bP->max);
+			if (bP->mean_count != 0) {
+				json_writer_key(&w, "Mean");
+				json_writer_number(&w, (double) (bP->mean_sum / bP->mean_count));
+			}
 		}
-	} else {
-		ESP_LOGE(TAG, "failed to create json image text");
+		json_writer_end_object(&w);
+	}
+	json_writer_end_array(&w);
+	
+	json_writer_key(&w, "Alarm Count");
+	json_writer_number(&w, (double) sumP->alarm_count);
+	json_writer_key(&w, "Alarms");
+	json_writer_begin_array(&w);
+	for (i=0; i<sumP->num_alarms; i++) {
+		aP = &sumP->alarms[i];
+		json_writer_element(&w);
+		json_writer_begin_object(&w);
+		json_writer_key(&w, "Time");
+		json_writer_number(&w, (double) aP->epoch_sec);
+		json_writer_key(&w, "Cause");
+		json_writer_string(&w, (aP->cause == LEP_ALARM_CAUSE_THRESH) ? "Threshold" : "Rate");
+		json_writer_key(&w, "Source");
+		json_writer_string(&w, json_stats_name(aP->roi, name));
+		json_writer_key(&w, "Stat");
+		json_writer_string(&w, lepton_alarm_stat_name(aP->stat));
+		json_writer_key(&w, "Value");
+		json_writer_number(&w, (double) aP->value);
+		json_writer_key(&w, "Rate");
+		json_writer_number(&w, (double) aP->rate);
+		json_writer_end_object(&w);
 	}
+	json_writer_end_array(&w);
+	json_writer_end_object(&w);
+	json_writer_puts(&w, "\n");
 	
-	cJSON_Delete(root);
+	if (w.overflow) {
+		ESP_LOGE(TAG, "failed to create summary json text - too large for buffer");
+		return 0;
+	}
 	
-	return json_image_text;
+	// json_writer always leaves room for the terminating null
+	w.bufP[w.length] = 0;
+	return w.length;
 }
 
 
 /**
  * Return a formatted json string containing the camera's operating parameters in
  * response to the get_config commmand.  Include the delimitors since this string
- * will be sent via the socket interface
+ * will be sent via the socket interface.  The previous string is returned if the
+ * GUI state hasn't been changed since it was rendered.
  */
 char* json_get_config(uint32_t* len)
 {
+	char name[24];
+	int i;
 	cJSON* root;
 	cJSON* config;
 	gui_state_t* gui_stP;
+	uint32_t version;
+	
+	// Read the version before the state so a change while we render is seen next time
+	version = ps_get_gui_version();
+	if ((json_config_len != 0) && (version == json_config_version)) {
+		*len = json_config_len;
+		return json_config_text;
+	}
 	
 	// Get state
 	gui_stP = system_get_gui_st();
@@ -229,20 +572,73 @@ char* json_get_config(uint32_t* len)
 	cJSON_AddNumberToObject(config, "lepton_enable", (const double) gui_stP->rec_lepton_enable);
 	cJSON_AddNumberToObject(config, "gain_mode", (const double) gui_stP->gain_mode);
 	cJSON_AddNumberToObject(config, "record_interval", (const double) gui_stP->record_interval);
+	cJSON_AddNumberToObject(config, "record_format", (const double) gui_stP->record_format);
+	cJSON_AddNumberToObject(config, "record_container", (const double) gui_stP->record_container);
+	cJSON_AddNumberToObject(config, "record_ring", (const double) gui_stP->record_ring);
+	cJSON_AddNumberToObject(config, "record_motion", (const double) gui_stP->record_motion);
+	cJSON_AddNumberToObject(config, "record_sleep", (const double) gui_stP->record_sleep);
+	cJSON_AddNumberToObject(config, "record_meta_log", (const double) gui_stP->record_meta_log);
+	cJSON_AddNumberToObject(config, "arducam_resolution", (const double) gui_stP->cam_resolution);
+	cJSON_AddNumberToObject(config, "arducam_quality", (const double) gui_stP->cam_quality);
+	cJSON_AddNumberToObject(config, "arducam_roi_x", (const double) gui_stP->cam_roi_x);
+	cJSON_AddNumberToObject(config, "arducam_roi_y", (const double) gui_stP->cam_roi_y);
+	cJSON_AddNumberToObject(config, "arducam_roi_w", (const double) gui_stP->cam_roi_w);
+	cJSON_AddNumberToObject(config, "arducam_roi_h", (const double) gui_stP->cam_roi_h);
+	cJSON_AddNumberToObject(config, "lepton_display_agc", (const double) gui_stP->lep_agc_mode);
+	cJSON_AddNumberToObject(config, "fusion_mode", (const double) gui_stP->fusion_mode);
+	cJSON_AddNumberToObject(config, "fusion_alpha", (const double) gui_stP->fusion_alpha);
+	cJSON_AddNumberToObject(config, "fusion_offset_x", (const double) gui_stP->fusion_offset_x);
+	cJSON_AddNumberToObject(config, "fusion_offset_y", (const double) gui_stP->fusion_offset_y);
+	cJSON_AddNumberToObject(config, "fusion_scale", (const double) gui_stP->fusion_scale);
+	cJSON_AddNumberToObject(config, "fusion_cal_distance", (const double) gui_stP->fusion_cal_dist);
+	cJSON_AddNumberToObject(config, "fusion_distance", (const double) gui_stP->fusion_dist);
+	for (i=0; i<SYS_LEP_STATS_MAX_ROI; i++) {
+		sprintf(name, "stats_roi_%d_x", i+1);
+		cJSON_AddNumberToObject(config, name, (const double) gui_stP->stats_roi[i].x);
+		sprintf(name, "stats_roi_%d_y", i+1);
+		cJSON_AddNumberToObject(config, name, (const double) gui_stP->stats_roi[i].y);
+		sprintf(name, "stats_roi_%d_w", i+1);
+		cJSON_AddNumberToObject(config, name, (const double) gui_stP->stats_roi[i].w);
+		sprintf(name, "stats_roi_%d_h", i+1);
+		cJSON_AddNumberToObject(config, name, (const double) gui_stP->stats_roi[i].h);
+		sprintf(name, "stats_roi_%d_emissivity", i+1);
+		cJSON_AddNumberToObject(config, name, (const double) gui_stP->stats_emissivity[i]);
+		sprintf(name, "stats_roi_%d_reflected", i+1);
+		cJSON_AddNumberToObject(config, name, (const double) gui_stP->stats_refl[i]);
+	}
+	cJSON_AddNumberToObject(config, "alarm_mode", (const double) gui_stP->alarm_mode);
+	cJSON_AddNumberToObject(config, "alarm_roi", (const double) gui_stP->alarm_roi);
+	cJSON_AddNumberToObject(config, "alarm_stat", (const double) gui_stP->alarm_stat);
+	cJSON_AddNumberToObject(config, "alarm_threshold", (const double) gui_stP->alarm_threshold);
+	cJSON_AddNumberToObject(config, "alarm_rate", (const double) gui_stP->alarm_rate);
+	cJSON_AddNumberToObject(config, "alarm_hold", (const double) gui_stP->alarm_hold);
+	cJSON_AddNumberToObject(config, "isotherm_mode", (const double) gui_stP->iso_mode);
+	cJSON_AddNumberToObject(config, "isotherm_color", (const double) gui_stP->iso_color);
+	cJSON_AddNumberToObject(config, "isotherm_low", (const double) gui_stP->iso_low);
+	cJSON_AddNumberToObject(config, "isotherm_high", (const double) gui_stP->iso_high);
+	cJSON_AddNumberToObject(config, "meter_mode", (const double) gui_stP->meter_mode);
+	cJSON_AddNumberToObject(config, "lepton_crop_x", (const double) gui_stP->lep_crop.x);
+	cJSON_AddNumberToObject(config, "lepton_crop_y", (const double) gui_stP->lep_crop.y);
+	cJSON_AddNumberToObject(config, "lepton_crop_w", (const double) gui_stP->lep_crop.w);
+	cJSON_AddNumberToObject(config, "lepton_crop_h", (const double) gui_stP->lep_crop.h);
+	cJSON_AddNumberToObject(config, "telemetry_log_rate", (const double) gui_stP->tlog_rate);
 	
 	// Tightly print the object into our buffer with delimitors
-	*len = json_generate_response_string(root);
+	*len = json_generate_response_string(root, json_config_text);
+	json_config_len = *len;
+	json_config_version = version;
 	
 	cJSON_Delete(root);
 	
-	return json_response_text;
+	return json_config_text;
 }
 
 
 /**
  * Return a formatted json string containing the system status in response to the
  * get_status command.  Include the delimitors since this string will be sent via
- * the socket interface.
+ * the socket interface.  The previous string is returned if it was rendered less
+ * than JSON_STATUS_HOLD_MSEC ago.
  */
 char* json_get_status(uint32_t* len)
 {
@@ -253,6 +649,32 @@ char* json_get_status(uint32_t* len)
 	const esp_app_desc_t* app_desc;
 	tmElements_t te;
 	batt_status_t batt;
+	file_rec_stats_t rec_stats;
+	file_card_speed_t card_speed;
+	cam_capture_stats_t cap_stats;
+	lep_stats_t lep_stats;
+	app_frame_stats_t frame_stats;
+	sync_status_t sync_status;
+	upload_status_t upload_status;
+	health_stats_t health_stats;
+	lep_corr_status_t corr_status;
+	cJSON* corr;
+	cJSON* speed;
+	cJSON* sync;
+	cJSON* upload;
+	cJSON* health;
+	cJSON* health_entry;
+	cJSON* tasks;
+	cJSON* task;
+	int sd_width, sd_freq_khz;
+	int i, n;
+	int64_t cur_usec;
+	
+	cur_usec = esp_timer_get_time();
+	if ((json_status_len != 0) && ((cur_usec - json_status_usec) < (JSON_STATUS_HOLD_MSEC * 1000))) {
+		*len = json_status_len;
+		return json_status_text;
+	}
 	
 	// Get system information
 	app_desc = esp_ota_get_app_description();	
@@ -279,21 +701,415 @@ char* json_get_status(uint32_t* len)
 	
 	cJSON_AddNumberToObject(status, "Battery", (const double) batt.batt_voltage);
 	
-	switch (batt.charge_state) {
-		case CHARGE_OFF:
-			strcpy(buf, "OFF");
-			break;
-		case CHARGE_ON:
-			strcpy(buf, "ON");
-			break;
-		case CHARGE_FAULT:
-			strcpy(buf, "FAULT");
+	cJSON_AddStringToObject(status, "Charge", json_charge_name(batt.charge_state));
+	
+	cam_task_get_capture_stats(&cap_stats);
+	cJSON_AddNumberToObject(status, "Capture Time", (const double) cap_stats.avg_msec);
+	cJSON_AddNumberToObject(status, "Capture Max Time", (const double) cap_stats.max_msec);
+	cJSON_AddNumberToObject(status, "Capture Polls", (const double) cap_stats.avg_polls);
+	cJSON_AddNumberToObject(status, "Capture Timeouts", (const double) cap_stats.timeouts);
+	cJSON_AddNumberToObject(status, "Capture Quality", (const double) cap_stats.quality);
+	
+	file_task_get_rec_stats(&rec_stats);
+	cJSON_AddNumberToObject(status, "Queued Images", (const double) rec_stats.queued);
+	cJSON_AddNumberToObject(status, "Dropped Images", (const double) rec_stats.dropped);
+	cJSON_AddNumberToObject(status, "Write Errors", (const double) rec_stats.write_errors);
+	cJSON_AddNumberToObject(status, "Spooled Images", (const double) rec_stats.spooled);
+	cJSON_AddNumberToObject(status, "Spool Pending", (const double) rec_stats.spool_pending);
+	cJSON_AddNumberToObject(status, "SD Write Rate", (const double) file_task_get_write_rate());
+	
+	if (file_get_card_mode(&sd_width, &sd_freq_khz)) {
+		sprintf(buf, "%d-bit %d MHz", sd_width, sd_freq_khz / 1000);
+	} else {
+		strcpy(buf, "NONE");
+	}
+	cJSON_AddStringToObject(status, "SD Mode", buf);
+	
+	file_task_get_card_speed(&card_speed);
+	if (card_speed.valid) {
+		cJSON_AddItemToObject(status, "SD Speed Test", speed=cJSON_CreateObject());
+		cJSON_AddNumberToObject(speed, "Sequential", (const double) card_speed.seq_rate);
+		cJSON_AddNumberToObject(speed, "Random Avg", (const double) card_speed.rand_avg_usec);
+		cJSON_AddNumberToObject(speed, "Random Max", (const double) card_speed.rand_max_usec);
+		cJSON_AddNumberToObject(speed, "Sustainable", (const double) card_speed.sustainable);
+		cJSON_AddNumberToObject(speed, "Profile Changed", (const double) card_speed.profile_changed);
+	}
+	
+	if (lepton_stats_get_latest(&lep_stats)) {
+		json_add_stats_object(status, &lep_stats);
+	}
+	
+	lepton_correct_get_status(&corr_status);
+	cJSON_AddItemToObject(status, "Lepton Correction", corr=cJSON_CreateObject());
+	cJSON_AddNumberToObject(corr, "State", (const double) corr_status.state);
+	cJSON_AddNumberToObject(corr, "Bad Pixels", (const double) corr_status.bad_pixels);
+	cJSON_AddNumberToObject(corr, "Columns", (const double) corr_status.columns);
+	cJSON_AddNumberToObject(corr, "Failed", (const double) corr_status.cal_failed);
+	
+	app_task_get_frame_stats(&frame_stats);
+	json_add_frame_stats_object(status, &frame_stats);
+	
+	sync_task_get_status(&sync_status);
+	if (sync_status.mode != SYNC_MODE_OFF) {
+		cJSON_AddItemToObject(status, "Sync", sync=cJSON_CreateObject());
+		cJSON_AddNumberToObject(sync, "Mode", (const double) sync_status.mode);
+		cJSON_AddNumberToObject(sync, "Beacons", (const double) sync_status.beacons);
+		if (sync_status.mode == SYNC_MODE_SLAVE) {
+			cJSON_AddNumberToObject(sync, "Locked", (const double) sync_status.locked);
+			cJSON_AddNumberToObject(sync, "Offset", (const double) sync_status.offset_usec);
+			cJSON_AddNumberToObject(sync, "Delay", (const double) sync_status.delay_usec);
+			cJSON_AddNumberToObject(sync, "Rejected", (const double) sync_status.rejected);
+		}
+	}
+	
+	upload_task_get_status(&upload_status);
+	if (upload_status.enabled) {
+		cJSON_AddItemToObject(status, "Upload", upload=cJSON_CreateObject());
+		cJSON_AddNumberToObject(upload, "Active", (const double) upload_status.active);
+		cJSON_AddStringToObject(upload, "Session", upload_status.session);
+		cJSON_AddNumberToObject(upload, "Sessions", (const double) upload_status.sessions);
+		cJSON_AddNumberToObject(upload, "kB", (const double) upload_status.kbytes);
+		cJSON_AddNumberToObject(upload, "Failures", (const double) upload_status.failures);
+	}
+	
+	health_task_get_stats(&health_stats);
+	cJSON_AddItemToObject(status, "Health", health=cJSON_CreateObject());
+	cJSON_AddNumberToObject(health, "Reboots", (const double) health_stats.reboots);
+	for (i=0; i<HEALTH_NUM_TASKS; i++) {
+		cJSON_AddItemToObject(health, health_task_name(i), health_entry=cJSON_CreateObject());
+		cJSON_AddNumberToObject(health_entry, "State", (const double) health_stats.tasks[i].state);
+		cJSON_AddNumberToObject(health_entry, "Stalls", (const double) health_stats.tasks[i].stalls);
+		cJSON_AddNumberToObject(health_entry, "Recovers", (const double) health_stats.tasks[i].recovers);
+		cJSON_AddNumberToObject(health_entry, "Restarts", (const double) health_stats.tasks[i].restarts);
+	}
+	
+	n = perf_get_tasks(json_perf_tasks);
+	if (n != 0) {
+		cJSON_AddItemToObject(status, "Tasks", tasks=cJSON_CreateArray());
+		for (i=0; i<n; i++) {
+			cJSON_AddItemToArray(tasks, task=cJSON_CreateObject());
+			cJSON_AddStringToObject(task, "Name", json_perf_tasks[i].name);
+			cJSON_AddNumberToObject(task, "Core", (const double) json_perf_tasks[i].core);
+			cJSON_AddNumberToObject(task, "Priority", (const double) json_perf_tasks[i].priority);
+			cJSON_AddNumberToObject(task, "CPU", (const double) json_perf_tasks[i].cpu);
+			cJSON_AddNumberToObject(task, "Stack Free", (const double) json_perf_tasks[i].stack_free);
+		}
+	}
+	
+	// Tightly print the object into our buffer with delimitors
+	*len = json_generate_response_string(root, json_status_text);
+	json_status_len = *len;
+	json_status_usec = cur_usec;
+	
+	cJSON_Delete(root);
+	
+	return json_status_text;
+}
+
+
+#ifdef INCLUDE_SYS_BENCH
+/**
+ * Return a formatted json string holding a compact camera status for the UDP status
+ * beacon.  Include the delimitors so monitors can use the same parser as for the
+ * command interface responses.
+ */
+char* json_get_beacon(uint32_t* len)
+{
+	char buf[20];
+	cJSON* root;
+	cJSON* beacon;
+	const esp_app_desc_t* app_desc;
+	const wifi_info_t* wifi_infoP;
+	batt_status_t batt;
+	file_rec_stats_t rec_stats;
+	lep_stats_t lep_stats;
+	app_frame_stats_t frame_stats;
+	int idle, idle_cores;
+	int sd_width, sd_freq_khz;
+	int i, n;
+	
+	app_desc = esp_ota_get_app_description();
+	wifi_infoP = wifi_get_info();
+	adc_get_batt(&batt);
+	
+	root=cJSON_CreateObject();
+	if (root == NULL) return NULL;
+	
+	cJSON_AddItemToObject(root, "beacon", beacon=cJSON_CreateObject());
+	
+	cJSON_AddStringToObject(beacon, "Camera", wifi_infoP->ap_ssid);
+	cJSON_AddStringToObject(beacon, "Version", app_desc->version);
+	sprintf(buf, "%d.%d.%d.%d", wifi_infoP->cur_ip_addr[3], wifi_infoP->cur_ip_addr[2],
+	        wifi_infoP->cur_ip_addr[1], wifi_infoP->cur_ip_addr[0]);
+	cJSON_AddStringToObject(beacon, "IP", buf);
+	cJSON_AddNumberToObject(beacon, "Uptime", (const double) (esp_timer_get_time() / 1000000));
+	cJSON_AddNumberToObject(beacon, "Recording", (const double) app_task_get_recording());
+	cJSON_AddNumberToObject(beacon, "Battery", (const double) batt.batt_voltage);
+	cJSON_AddStringToObject(beacon, "Charge", json_charge_name(batt.charge_state));
+	
+	// Storage
+	if (file_get_card_mode(&sd_width, &sd_freq_khz)) {
+		cJSON_AddNumberToObject(beacon, "SD Free", (const double) file_task_get_free_mb());
+	}
+	file_task_get_rec_stats(&rec_stats);
+	cJSON_AddNumberToObject(beacon, "Queued Images", (const double) rec_stats.queued);
+	cJSON_AddNumberToObject(beacon, "Dropped Images", (const double) rec_stats.dropped);
+	cJSON_AddNumberToObject(beacon, "Write Errors", (const double) rec_stats.write_errors);
+	
+	// Pipeline and CPU load (average of both cores, from the idle tasks)
+	app_task_get_frame_stats(&frame_stats);
+	cJSON_AddNumberToObject(beacon, "ArduCAM Late", (const double) frame_stats.cam_late);
+	cJSON_AddNumberToObject(beacon, "Lepton Late", (const double) frame_stats.lep_late);
+	cJSON_AddNumberToObject(beacon, "Dropped", (const double) frame_stats.dropped);
+	n = perf_get_tasks(json_perf_tasks);
+	idle = 0;
+	idle_cores = 0;
+	for (i=0; i<n; i++) {
+		if (strncmp(json_perf_tasks[i].name, "IDLE", 4) == 0) {
+			idle += json_perf_tasks[i].cpu;
+			idle_cores++;
+		}
+	}
+	if (idle_cores != 0) {
+		cJSON_AddNumberToObject(beacon, "CPU", (const double) (100 - (idle / idle_cores)));
+	}
+	
+	// Scene temperatures (K * 100) from the most recent Lepton frame
+	if (lepton_stats_get_latest(&lep_stats) && lep_stats.stats[LEP_STATS_FRAME].valid) {
+		cJSON_AddNumberToObject(beacon, "Min", (const double) lep_stats.stats[LEP_STATS_FRAME].min);
+		cJSON_AddNumberToObject(beacon, "Max", (const double) lep_stats.stats[LEP_STATS_FRAME].max);
+		cJSON_AddNumberToObject(beacon, "Mean", (const double) lep_stats.stats[LEP_STATS_FRAME].mean);
+	}
+	
+	// Tightly print the object into our buffer with delimitors
+	*len = json_generate_response_string(root, json_response_text);
+	
+	cJSON_Delete(root);
+	
+	return json_response_text;
+}
+
+
+/**
+ * Return a formatted json string containing the results of the last benchmark run
+ * in response to the run_benchmark command.  Include the delimitors since this string
+ * will be sent via the socket interface.
+ */
+char* json_get_benchmark(uint32_t* len)
+{
+	bench_result_t results[BENCH_NUM_ITEMS];
+	cJSON* root;
+	cJSON* bench;
+	cJSON* item;
+	double rate;
+	int i;
+	
+	bench_task_get_results(results);
+	
+	root=cJSON_CreateObject();
+	if (root == NULL) return NULL;
+	
+	cJSON_AddItemToObject(root, "benchmark", bench=cJSON_CreateObject());
+	
+	// Times are the average for one run in uSec.  Items that couldn't be run are left out.
+	for (i=0; i<BENCH_NUM_ITEMS; i++) {
+		if (!results[i].valid) continue;
+		
+		cJSON_AddItemToObject(bench, bench_task_item_name(i), item=cJSON_CreateObject());
+		cJSON_AddNumberToObject(item, "Bytes", (const double) results[i].bytes);
+		cJSON_AddNumberToObject(item, "uSec", (const double) results[i].usec);
+		if ((results[i].bytes != 0) && (results[i].usec != 0)) {
+			// bytes/uSec = MB/sec, rounded to 0.01
+			rate = round(100.0 * (double) results[i].bytes / (double) results[i].usec) / 100.0;
+			cJSON_AddNumberToObject(item, "MB/s", rate);
+		}
+	}
+	
+	// Tightly print the object into our buffer with delimitors
+	*len = json_generate_response_string(root, json_response_text);
+	
+	cJSON_Delete(root);
+	
+	return json_response_text;
+}
+#endif
+
+
+/**
+ * Return a formatted json string describing the current (or most recent) alarm event.
+ * This is sent to all clients when an event starts or ends.  Include the delimitors
+ * since this string will be sent via the socket interface.
+ */
+char* json_get_alarm(uint32_t* len)
+{
+	char buf[80];
+	cJSON* root;
+	cJSON* alarm;
+	gui_state_t* gui_stP;
+	lep_alarm_event_t event;
+	tmElements_t te;
+	
+	gui_stP = system_get_gui_st();
+	lepton_alarm_get_event(&event);
+	time_get(&te);
+	
+	root=cJSON_CreateObject();
+	if (root == NULL) return NULL;
+	
+	cJSON_AddItemToObject(root, "alarm", alarm=cJSON_CreateObject());
+	
+	cJSON_AddStringToObject(alarm, "State", event.active ? "TRIGGER" : "CLEAR");
+	cJSON_AddStringToObject(alarm, "Cause", (event.cause == LEP_ALARM_CAUSE_THRESH) ? "Threshold" : "Rate");
+	cJSON_AddStringToObject(alarm, "Source", json_stats_name(event.roi, buf));
+	cJSON_AddStringToObject(alarm, "Stat", lepton_alarm_stat_name(event.stat));
+	cJSON_AddNumberToObject(alarm, "Value", (const double) event.value);
+	cJSON_AddNumberToObject(alarm, "Rate", (const double) event.rate);
+	cJSON_AddNumberToObject(alarm, "Threshold", (const double) gui_stP->alarm_threshold);
+	cJSON_AddNumberToObject(alarm, "Rate Limit", (const double) gui_stP->alarm_rate);
+	cJSON_AddNumberToObject(alarm, "Count", (const double) event.count);
+	
+	sprintf(buf, "%d:%02d:%02d", te.Hour, te.Minute, te.Second);
+	cJSON_AddStringToObject(alarm, "Time", buf);
+	sprintf(buf, "%d/%d/%02d", te.Month, te.Day, te.Year-30); // Year starts at 1970
+	cJSON_AddStringToObject(alarm, "Date", buf);
+	
+	// Tightly print the object into our buffer with delimitors
+	*len = json_generate_response_string(root, json_response_text);
+	
+	cJSON_Delete(root);
+	
+	return json_response_text;
+}
+
+
+/**
+ * Return a formatted json string containing the recording schedule windows and the
+ * active window in response to the get_schedule command.  Include the delimitors since
+ * this string will be sent via the socket interface.
+ */
+char* json_get_schedule(uint32_t* len)
+{
+	cJSON* root;
+	cJSON* sched;
+	cJSON* list;
+	cJSON* item;
+	sched_window_t w;
+	time_t now;
+	int i;
+	
+	root=cJSON_CreateObject();
+	if (root == NULL) return NULL;
+	
+	time(&now);
+	cJSON_AddItemToObject(root, "schedule", sched=cJSON_CreateObject());
+	cJSON_AddNumberToObject(sched, "Active", (const double) sched_active_window(now, NULL));
+	cJSON_AddItemToObject(sched, "Windows", list=cJSON_CreateArray());
+	
+	for (i=0; i<SCHED_MAX_WINDOWS; i++) {
+		sched_get_window(i, &w);
+		cJSON_AddItemToArray(list, item=cJSON_CreateObject());
+		cJSON_AddNumberToObject(item, "days", (const double) w.days);
+		cJSON_AddNumberToObject(item, "start", (const double) w.start_min);
+		cJSON_AddNumberToObject(item, "end", (const double) w.end_min);
+		cJSON_AddNumberToObject(item, "record_interval", (const double) w.record_interval);
+		cJSON_AddNumberToObject(item, "arducam_enable", (const double) ((w.flags & SCHED_FLAG_ARDUCAM) ? 1 : 0));
+		cJSON_AddNumberToObject(item, "lepton_enable", (const double) ((w.flags & SCHED_FLAG_LEPTON) ? 1 : 0));
+		cJSON_AddNumberToObject(item, "record_sleep", (const double) ((w.flags & SCHED_FLAG_SLEEP) ? 1 : 0));
+	}
+	
+	// Tightly print the object into our buffer with delimitors
+	*len = json_generate_response_string(root, json_response_text);
+	
+	cJSON_Delete(root);
+	
+	return json_response_text;
+}
+
+
+/**
+ * Start a streamed response: the performance counters for the get_perf command or the
+ * last list of sessions on the Micro-SD Card (oldest first) for the list_sessions
+ * command.  The counters are copied now so a response is consistent unless another
+ * client's get_perf starts while it is being sent.  Sessions are read as they are
+ * written and the list ends early if it changes.
+ */
+void json_stream_start(json_stream_t* s, int type, uint16_t tag)
+{
+	s->type = type;
+	s->part = 0;
+	s->tag = tag;
+	
+	if (type == JSON_STREAM_PERF) {
+		perf_get(&json_perf_stats);
+	} else {
+		s->count = xfer_task_get_session_count(&s->total);
+	}
+}
+
+
+/**
+ * Write as many whole parts of a streamed response as fit in buf, including the
+ * delimitors since it will be sent via the socket interface.  Returns the length
+ * written, 0 when the response is finished.
+ */
+uint32_t json_stream_fill(json_stream_t* s, char* buf, uint32_t max_len)
+{
+	json_writer_t w;
+	uint32_t start;
+	bool more;
+	
+	json_writer_init(&w, buf, max_len);
+	w.compact = true;
+	
+	while (s->type != JSON_STREAM_NONE) {
+		start = w.length;
+		if (s->type == JSON_STREAM_PERF) {
+			more = json_stream_perf_part(s, &w);
+		} else {
+			more = json_stream_sessions_part(s, &w);
+		}
+		
+		if (w.overflow) {
+			// Send the part in the next chunk
+			w.length = start;
+			if (start == 0) {
+				ESP_LOGE(TAG, "Streamed response part too large - ending response");
+				s->type = JSON_STREAM_NONE;
+			}
 			break;
+		}
+		s->part++;
+		if (!more) {
+			s->type = JSON_STREAM_NONE;
+		}
+	}
+	
+	return w.length;
+}
+
+
+/**
+ * Return a formatted json string containing the result of an ota_update command.
+ * Include the delimitors since this string will be sent via the socket interface.
+ */
+char* json_get_ota(const ota_status_t* statusP, uint32_t* len)
+{
+	cJSON* root;
+	cJSON* ota;
+	
+	root=cJSON_CreateObject();
+	if (root == NULL) return NULL;
+	
+	cJSON_AddItemToObject(root, "ota", ota=cJSON_CreateObject());
+	cJSON_AddStringToObject(ota, "Result", (statusP->result != NULL) ? statusP->result : "Busy");
+	cJSON_AddNumberToObject(ota, "Length", (const double) statusP->length);
+	cJSON_AddNumberToObject(ota, "Written", (const double) statusP->written);
+	if (statusP->partition != NULL) {
+		cJSON_AddStringToObject(ota, "Partition", statusP->partition);
 	}
-	cJSON_AddStringToObject(status, "Charge", buf);
 	
 	// Tightly print the object into our buffer with delimitors
-	*len = json_generate_response_string(root);
+	*len = json_generate_response_string(root, json_response_text);
 	
 	cJSON_Delete(root);
 	
@@ -325,6 +1141,7 @@ char* json_get_wifi(uint32_t* len)
 	cJSON_AddStringToObject(wifi, "ap_ssid", wifi_infoP->ap_ssid);
 	cJSON_AddStringToObject(wifi, "sta_ssid", wifi_infoP->sta_ssid);
 	cJSON_AddNumberToObject(wifi, "flags", (const double) wifi_infoP->flags);
+	cJSON_AddNumberToObject(wifi, "profile", (const double) wifi_infoP->profile);
 	
 	sprintf(ip_string, "%d.%d.%d.%d", wifi_infoP->ap_ip_addr[3],
 			                          wifi_infoP->ap_ip_addr[2],
@@ -345,7 +1162,7 @@ char* json_get_wifi(uint32_t* len)
 	cJSON_AddStringToObject(wifi, "cur_ip_addr", ip_string);
 	
 	// Tightly print the object into our buffer with delimitors
-	*len = json_generate_response_string(root);
+	*len = json_generate_response_string(root, json_response_text);
 	
 	cJSON_Delete(root);
 	
@@ -354,12 +1171,95 @@ char* json_get_wifi(uint32_t* len)
 
 
 /**
- * Parse a top level command object, returning the command number and a pointer to 
- * a json object containing "args".  The pointer is set to NULL if there are no args.
+ * Scan a command string for its command and tag without building a json object.
+ * has_args is set if the string contains anything but "cmd" and "tag" (or they aren't
+ * in their simple form) and must be parsed with json_get_cmd_object and json_parse_cmd
+ * to get the command and its arguments.  Returns false if the string isn't a command
+ * object.
+ */
+bool json_scan_cmd(const char* json_string, int* cmd, uint16_t* tag, bool* has_args)
+{
+	const char* cP;
+	const char* nameP;
+	int name_len;
+	bool found = false;
+	uint32_t val;
+	int i;
+	
+	*tag = 0;
+	*has_args = false;
+	
+	cP = json_skip_space(json_string);
+	if (*cP++ != '{') return false;
+	
+	cP = json_skip_space(cP);
+	while (*cP != '}') {
+		if (strncmp(cP, "\"cmd\"", 5) == 0) {
+			cP = json_skip_space(cP + 5);
+			if (*cP++ != ':') return false;
+			cP = json_skip_space(cP);
+			if (*cP++ != '"') return false;
+			
+			nameP = cP;
+			while ((*cP != 0) && (*cP != '"') && (*cP != '\\')) cP++;
+			if (*cP != '"') {
+				*has_args = true;
+				return true;
+			}
+			name_len = cP++ - nameP;
+			
+			*cmd = CMD_UNKNOWN;
+			for (i=0; i<CMD_NUM; i++) {
+				if ((strncmp(nameP, command_list[i].cmd_name, name_len) == 0) &&
+				    (command_list[i].cmd_name[name_len] == 0))
+				{
+					*cmd = command_list[i].cmd_index;
+					break;
+				}
+			}
+			found = true;
+		} else if (strncmp(cP, "\"tag\"", 5) == 0) {
+			cP = json_skip_space(cP + 5);
+			if (*cP++ != ':') return false;
+			cP = json_skip_space(cP);
+			
+			// Only plain integers in range are handled here
+			val = 0;
+			nameP = cP;
+			while ((*cP >= '0') && (*cP <= '9') && (val <= CMD_MAX_TAG)) {
+				val = val * 10 + (*cP++ - '0');
+			}
+			if ((cP == nameP) || (val > CMD_MAX_TAG) || (*cP == '.') || (*cP == 'e') || (*cP == 'E')) {
+				*has_args = true;
+				return true;
+			}
+			*tag = (uint16_t) val;
+		} else {
+			*has_args = true;
+			return true;
+		}
+		
+		cP = json_skip_space(cP);
+		if (*cP == ',') {
+			cP = json_skip_space(cP + 1);
+		} else if (*cP != '}') {
+			return false;
+		}
+	}
+	
+	return found;
+}
+
+
+/**
+ * Parse a top level command object, returning the command number, its tag (0 if
+ * it doesn't have one in the range 1 - CMD_MAX_TAG) and a pointer to a json object
+ * containing "args".  The pointer is set to NULL if there are no args.
  */
-bool json_parse_cmd(cJSON* cmd_obj, int* cmd, cJSON** cmd_args)
+bool json_parse_cmd(cJSON* cmd_obj, int* cmd, uint16_t* tag, cJSON** cmd_args)
 {
 	 cJSON *cmd_type = cJSON_GetObjectItem(cmd_obj, "cmd");
+	 cJSON *cmd_tag;
 	 char* cmd_name;
 	 int i;
 	 
@@ -376,6 +1276,14 @@ bool json_parse_cmd(cJSON* cmd_obj, int* cmd, cJSON** cmd_args)
 	 			}
 	 		}
 	 		
+	 		*tag = 0;
+	 		cmd_tag = cJSON_GetObjectItem(cmd_obj, "tag");
+	 		if (cmd_tag != NULL) {
+	 			if ((cmd_tag->valueint >= 0) && (cmd_tag->valueint <= CMD_MAX_TAG)) {
+	 				*tag = (uint16_t) cmd_tag->valueint;
+	 			}
+	 		}
+	 		
 	 		*cmd_args = cJSON_GetObjectItem(cmd_obj, "args");
 	 		
 	 		return true;
@@ -392,8 +1300,12 @@ bool json_parse_cmd(cJSON* cmd_obj, int* cmd, cJSON** cmd_args)
  */
 bool json_parse_set_config(cJSON* cmd_args, gui_state_t* new_st)
 {
+	char name[24];
+	int i;
 	int item_count = 0;
 	gui_state_t* gui_stP;
+	sys_lep_roi_t* roiP;
+	sys_lep_roi_t* cur_roiP;
 	
 	// Get existing settings
 	gui_stP = system_get_gui_st();
@@ -439,6 +1351,189 @@ bool json_parse_set_config(cJSON* cmd_args, gui_state_t* new_st)
 			new_st->record_interval_index = gui_stP->record_interval_index;
 		}
 		
+		if (cJSON_HasObjectItem(cmd_args, "record_format")) {
+			new_st->record_format = cJSON_GetObjectItem(cmd_args, "record_format")->valueint;
+			if (new_st->record_format > REC_FORMAT_AVI) {
+				ESP_LOGW(TAG, "Unsupported set_config record_format %d", new_st->record_format);
+				new_st->record_format = REC_FORMAT_JSON;
+			}
+			item_count++;
+		} else {
+			new_st->record_format = gui_stP->record_format;
+		}
+		
+		if (cJSON_HasObjectItem(cmd_args, "record_container")) {
+			new_st->record_container = cJSON_GetObjectItem(cmd_args, "record_container")->valueint > 0 ? true : false;
+			item_count++;
+		} else {
+			new_st->record_container = gui_stP->record_container;
+		}
+		
+		if (cJSON_HasObjectItem(cmd_args, "record_ring")) {
+			new_st->record_ring = cJSON_GetObjectItem(cmd_args, "record_ring")->valueint > 0 ? true : false;
+			item_count++;
+		} else {
+			new_st->record_ring = gui_stP->record_ring;
+		}
+		
+		if (cJSON_HasObjectItem(cmd_args, "record_motion")) {
+			new_st->record_motion = cJSON_GetObjectItem(cmd_args, "record_motion")->valueint > 0 ? true : false;
+			item_count++;
+		} else {
+			new_st->record_motion = gui_stP->record_motion;
+		}
+		
+		if (cJSON_HasObjectItem(cmd_args, "record_sleep")) {
+			new_st->record_sleep = cJSON_GetObjectItem(cmd_args, "record_sleep")->valueint > 0 ? true : false;
+			item_count++;
+		} else {
+			new_st->record_sleep = gui_stP->record_sleep;
+		}
+		
+		if (cJSON_HasObjectItem(cmd_args, "record_meta_log")) {
+			new_st->record_meta_log = cJSON_GetObjectItem(cmd_args, "record_meta_log")->valueint > 0 ? true : false;
+			item_count++;
+		} else {
+			new_st->record_meta_log = gui_stP->record_meta_log;
+		}
+		
+		new_st->cam_resolution = gui_stP->cam_resolution;
+		if (cJSON_HasObjectItem(cmd_args, "arducam_resolution")) {
+			i = cJSON_GetObjectItem(cmd_args, "arducam_resolution")->valueint;
+			if ((i >= SYS_CAM_RES_640x480) && (i <= SYS_CAM_RES_160x120)) {
+				new_st->cam_resolution = i;
+			} else {
+				ESP_LOGW(TAG, "Unsupported set_config arducam_resolution %d", i);
+			}
+			item_count++;
+		}
+		
+		new_st->cam_quality = gui_stP->cam_quality;
+		if (cJSON_HasObjectItem(cmd_args, "arducam_quality")) {
+			i = cJSON_GetObjectItem(cmd_args, "arducam_quality")->valueint;
+			if ((i >= OV2640_QS_MIN) && (i <= OV2640_QS_MAX)) {
+				new_st->cam_quality = i;
+			} else {
+				ESP_LOGW(TAG, "Unsupported set_config arducam_quality %d", i);
+			}
+			item_count++;
+		}
+		
+		// The region of interest must fit in a 640x480 image
+		new_st->cam_roi_x = json_get_roi_arg(cmd_args, "arducam_roi_x", gui_stP->cam_roi_x, &item_count);
+		new_st->cam_roi_y = json_get_roi_arg(cmd_args, "arducam_roi_y", gui_stP->cam_roi_y, &item_count);
+		new_st->cam_roi_w = json_get_roi_arg(cmd_args, "arducam_roi_w", gui_stP->cam_roi_w, &item_count);
+		new_st->cam_roi_h = json_get_roi_arg(cmd_args, "arducam_roi_h", gui_stP->cam_roi_h, &item_count);
+		if (((new_st->cam_roi_x + new_st->cam_roi_w) > SYS_CAM_ROI_REF_WIDTH) ||
+		    ((new_st->cam_roi_y + new_st->cam_roi_h) > SYS_CAM_ROI_REF_HEIGHT))
+		{
+			ESP_LOGW(TAG, "Unsupported set_config arducam_roi %d %d %d %d", new_st->cam_roi_x,
+			         new_st->cam_roi_y, new_st->cam_roi_w, new_st->cam_roi_h);
+			new_st->cam_roi_x = gui_stP->cam_roi_x;
+			new_st->cam_roi_y = gui_stP->cam_roi_y;
+			new_st->cam_roi_w = gui_stP->cam_roi_w;
+			new_st->cam_roi_h = gui_stP->cam_roi_h;
+		}
+		
+		new_st->lep_agc_mode = gui_stP->lep_agc_mode;
+		if (cJSON_HasObjectItem(cmd_args, "lepton_display_agc")) {
+			i = cJSON_GetObjectItem(cmd_args, "lepton_display_agc")->valueint;
+			if ((i >= SYS_LEP_AGC_LINEAR) && (i < SYS_LEP_AGC_NUM)) {
+				new_st->lep_agc_mode = i;
+			} else {
+				ESP_LOGW(TAG, "Unsupported set_config lepton_display_agc %d", i);
+			}
+			item_count++;
+		}
+		
+		new_st->fusion_mode = json_get_range_arg(cmd_args, "fusion_mode", gui_stP->fusion_mode,
+		                                         SYS_FUSION_OFF, SYS_FUSION_NUM - 1, &item_count);
+		new_st->fusion_alpha = json_get_range_arg(cmd_args, "fusion_alpha", gui_stP->fusion_alpha,
+		                                          SYS_FUSION_ALPHA_MIN, SYS_FUSION_ALPHA_MAX, &item_count);
+		new_st->fusion_offset_x = json_get_range_arg(cmd_args, "fusion_offset_x", gui_stP->fusion_offset_x,
+		                                             -SYS_FUSION_OFFSET_MAX, SYS_FUSION_OFFSET_MAX, &item_count);
+		new_st->fusion_offset_y = json_get_range_arg(cmd_args, "fusion_offset_y", gui_stP->fusion_offset_y,
+		                                             -SYS_FUSION_OFFSET_MAX, SYS_FUSION_OFFSET_MAX, &item_count);
+		new_st->fusion_scale = json_get_range_arg(cmd_args, "fusion_scale", gui_stP->fusion_scale,
+		                                          SYS_FUSION_SCALE_MIN, SYS_FUSION_SCALE_MAX, &item_count);
+		new_st->fusion_cal_dist = gui_stP->fusion_cal_dist;
+		new_st->fusion_dist = json_get_fusion_dist_arg(cmd_args, "fusion_distance", gui_stP->fusion_dist,
+		                                               &item_count);
+		
+		// Statistics regions must fit in the Lepton frame
+		for (i=0; i<SYS_LEP_STATS_MAX_ROI; i++) {
+			roiP = &new_st->stats_roi[i];
+			cur_roiP = &gui_stP->stats_roi[i];
+			sprintf(name, "stats_roi_%d_x", i+1);
+			roiP->x = json_get_range_arg(cmd_args, name, cur_roiP->x, 0, LEP_WIDTH, &item_count);
+			sprintf(name, "stats_roi_%d_y", i+1);
+			roiP->y = json_get_range_arg(cmd_args, name, cur_roiP->y, 0, LEP_HEIGHT, &item_count);
+			sprintf(name, "stats_roi_%d_w", i+1);
+			roiP->w = json_get_range_arg(cmd_args, name, cur_roiP->w, 0, LEP_WIDTH, &item_count);
+			sprintf(name, "stats_roi_%d_h", i+1);
+			roiP->h = json_get_range_arg(cmd_args, name, cur_roiP->h, 0, LEP_HEIGHT, &item_count);
+			if (((roiP->x + roiP->w) > LEP_WIDTH) || ((roiP->y + roiP->h) > LEP_HEIGHT)) {
+				ESP_LOGW(TAG, "Unsupported set_config stats_roi_%d %d %d %d %d", i+1,
+				         roiP->x, roiP->y, roiP->w, roiP->h);
+				*roiP = *cur_roiP;
+			}
+			sprintf(name, "stats_roi_%d_emissivity", i+1);
+			new_st->stats_emissivity[i] = json_get_range_arg(cmd_args, name, gui_stP->stats_emissivity[i],
+			                                                 SYS_LEP_EMISSIVITY_MIN, SYS_LEP_EMISSIVITY_MAX, &item_count);
+			sprintf(name, "stats_roi_%d_reflected", i+1);
+			new_st->stats_refl[i] = json_get_range_arg(cmd_args, name, gui_stP->stats_refl[i],
+			                                           0, 65535, &item_count);
+		}
+		
+		// Alarm threshold and rate are stored in unit steps
+		new_st->alarm_mode = json_get_range_arg(cmd_args, "alarm_mode", gui_stP->alarm_mode,
+		                                        SYS_ALARM_OFF, SYS_ALARM_NUM - 1, &item_count);
+		new_st->alarm_roi = json_get_range_arg(cmd_args, "alarm_roi", gui_stP->alarm_roi,
+		                                       0, SYS_LEP_STATS_MAX_ROI, &item_count);
+		new_st->alarm_stat = json_get_range_arg(cmd_args, "alarm_stat", gui_stP->alarm_stat,
+		                                        SYS_ALARM_STAT_MIN, SYS_ALARM_STAT_NUM - 1, &item_count);
+		i = json_get_range_arg(cmd_args, "alarm_threshold", gui_stP->alarm_threshold,
+		                       0, SYS_ALARM_THRESH_MAX, &item_count);
+		new_st->alarm_threshold = (i / SYS_ALARM_THRESH_UNIT) * SYS_ALARM_THRESH_UNIT;
+		i = json_get_range_arg(cmd_args, "alarm_rate", gui_stP->alarm_rate,
+		                       0, SYS_ALARM_RATE_MAX, &item_count);
+		new_st->alarm_rate = (i / SYS_ALARM_RATE_UNIT) * SYS_ALARM_RATE_UNIT;
+		new_st->alarm_hold = json_get_range_arg(cmd_args, "alarm_hold", gui_stP->alarm_hold,
+		                                        SYS_ALARM_HOLD_MIN, 255, &item_count);
+		
+		new_st->iso_mode = json_get_range_arg(cmd_args, "isotherm_mode", gui_stP->iso_mode,
+		                                      SYS_ISO_OFF, SYS_ISO_NUM - 1, &item_count);
+		new_st->iso_color = json_get_range_arg(cmd_args, "isotherm_color", gui_stP->iso_color,
+		                                       SYS_ISO_COLOR_WHITE, SYS_ISO_COLOR_NUM - 1, &item_count);
+		new_st->iso_low = json_get_range_arg(cmd_args, "isotherm_low", gui_stP->iso_low,
+		                                     0, SYS_ISO_THRESH_MAX, &item_count);
+		new_st->iso_high = json_get_range_arg(cmd_args, "isotherm_high", gui_stP->iso_high,
+		                                      0, SYS_ISO_THRESH_MAX, &item_count);
+		if (new_st->iso_low > new_st->iso_high) {
+			ESP_LOGW(TAG, "Unsupported set_config isotherm_low %u above isotherm_high %u",
+			         new_st->iso_low, new_st->iso_high);
+			new_st->iso_low = gui_stP->iso_low;
+			new_st->iso_high = gui_stP->iso_high;
+		}
+		new_st->meter_mode = json_get_range_arg(cmd_args, "meter_mode", gui_stP->meter_mode,
+		                                        SYS_METER_OFF, SYS_METER_NUM - 1, &item_count);
+		
+		// The radiometric crop must fit in the Lepton frame
+		roiP = &new_st->lep_crop;
+		cur_roiP = &gui_stP->lep_crop;
+		roiP->x = json_get_range_arg(cmd_args, "lepton_crop_x", cur_roiP->x, 0, LEP_WIDTH, &item_count);
+		roiP->y = json_get_range_arg(cmd_args, "lepton_crop_y", cur_roiP->y, 0, LEP_HEIGHT, &item_count);
+		roiP->w = json_get_range_arg(cmd_args, "lepton_crop_w", cur_roiP->w, 0, LEP_WIDTH, &item_count);
+		roiP->h = json_get_range_arg(cmd_args, "lepton_crop_h", cur_roiP->h, 0, LEP_HEIGHT, &item_count);
+		if (((roiP->x + roiP->w) > LEP_WIDTH) || ((roiP->y + roiP->h) > LEP_HEIGHT)) {
+			ESP_LOGW(TAG, "Unsupported set_config lepton_crop %d %d %d %d",
+			         roiP->x, roiP->y, roiP->w, roiP->h);
+			*roiP = *cur_roiP;
+		}
+		
+		new_st->tlog_rate = json_get_range_arg(cmd_args, "telemetry_log_rate", gui_stP->tlog_rate,
+		                                       0, SYS_TLOG_MAX_RATE, &item_count);
+		
 		// Copy existing palette index over
 		new_st->palette_index = gui_stP->palette_index;
 		
@@ -449,6 +1544,364 @@ bool json_parse_set_config(cJSON* cmd_args, gui_state_t* new_st)
 }
 
 
+/**
+ * Fill in a gui_st struct with the image fusion calibration from a set_fusion_cal
+ * command, preserving the other elements
+ */
+bool json_parse_set_fusion_cal(cJSON* cmd_args, gui_state_t* new_st)
+{
+	int item_count = 0;
+	gui_state_t* gui_stP;
+	
+	gui_stP = system_get_gui_st();
+	*new_st = *gui_stP;
+	
+	if (cmd_args != NULL) {
+		new_st->fusion_scale = json_get_range_arg(cmd_args, "scale", gui_stP->fusion_scale,
+		                                          SYS_FUSION_SCALE_MIN, SYS_FUSION_SCALE_MAX, &item_count);
+		new_st->fusion_offset_x = json_get_range_arg(cmd_args, "offset_x", gui_stP->fusion_offset_x,
+		                                             -SYS_FUSION_OFFSET_MAX, SYS_FUSION_OFFSET_MAX, &item_count);
+		new_st->fusion_offset_y = json_get_range_arg(cmd_args, "offset_y", gui_stP->fusion_offset_y,
+		                                             -SYS_FUSION_OFFSET_MAX, SYS_FUSION_OFFSET_MAX, &item_count);
+		new_st->fusion_cal_dist = json_get_fusion_dist_arg(cmd_args, "distance", gui_stP->fusion_cal_dist,
+		                                                   &item_count);
+		
+		return (item_count > 0);
+	}
+	
+	return false;
+}
+
+
+/**
+ * Get the clear flag from a calibrate_lepton command.  It defaults to false.
+ */
+void json_parse_calibrate_lepton(cJSON* cmd_args, bool* clear)
+{
+	*clear = false;
+	
+	if (cmd_args != NULL) {
+		if (cJSON_HasObjectItem(cmd_args, "clear")) {
+			*clear = cJSON_GetObjectItem(cmd_args, "clear")->valueint > 0 ? true : false;
+		}
+	}
+}
+
+
+/**
+ * Get the fresh flag from a get_image command.  A fresh request is answered with the
+ * next images instead of the latest images.  It defaults to false.
+ */
+void json_parse_get_image(cJSON* cmd_args, bool* fresh)
+{
+	*fresh = false;
+	
+	if (cmd_args != NULL) {
+		if (cJSON_HasObjectItem(cmd_args, "fresh")) {
+			*fresh = cJSON_GetObjectItem(cmd_args, "fresh")->valueint > 0 ? true : false;
+		}
+	}
+}
+
+
+/**
+ * Get the requested get_image response format from a set_image_format command
+ */
+bool json_parse_set_image_format(cJSON* cmd_args, int* format)
+{
+	if (cmd_args != NULL) {
+		if (cJSON_HasObjectItem(cmd_args, "format")) {
+			*format = cJSON_GetObjectItem(cmd_args, "format")->valueint;
+			if ((*format < CMD_IMG_FMT_JSON) || (*format > CMD_IMG_FMT_BINARY_Z)) {
+				ESP_LOGW(TAG, "Unsupported set_image_format format %d", *format);
+				return false;
+			}
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+
+/**
+ * Get the stream period (seconds) and IMG_CONTENT_* contents from a stream_on command.
+ * Missing arguments default to every second with all contents.
+ */
+void json_parse_stream_on(cJSON* cmd_args, int* period, int* contents)
+{
+	*period = 1;
+	*contents = IMG_CONTENT_ALL;
+	
+	if (cmd_args != NULL) {
+		if (cJSON_HasObjectItem(cmd_args, "period")) {
+			*period = cJSON_GetObjectItem(cmd_args, "period")->valueint;
+			if (*period < 1) {
+				ESP_LOGW(TAG, "Unsupported stream_on period %d", *period);
+				*period = 1;
+			}
+		}
+		
+		if (cJSON_HasObjectItem(cmd_args, "contents")) {
+			*contents = cJSON_GetObjectItem(cmd_args, "contents")->valueint & (IMG_CONTENT_ALL | IMG_CONTENT_PREVIEW);
+			if (*contents == 0) {
+				ESP_LOGW(TAG, "Empty stream_on contents");
+				*contents = IMG_CONTENT_ALL;
+			}
+		}
+	}
+}
+
+
+/**
+ * Get the destination address (unicast or multicast) and port from a udp_stream_on
+ * command
+ */
+bool json_parse_udp_stream_on(cJSON* cmd_args, uint8_t* ip_addr, uint16_t* port)
+{
+	char* s;
+	
+	if (cmd_args != NULL) {
+		if (cJSON_HasObjectItem(cmd_args, "ip_addr") && cJSON_HasObjectItem(cmd_args, "port")) {
+			s = cJSON_GetObjectItem(cmd_args, "ip_addr")->valuestring;
+			if ((s == NULL) || !json_ip_string_to_array(ip_addr, s)) {
+				ESP_LOGE(TAG, "Illegal udp_stream_on ip_addr");
+				return false;
+			}
+			*port = (uint16_t) cJSON_GetObjectItem(cmd_args, "port")->valueint;
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+
+/**
+ * Get the server address and port from a set_upload command
+ */
+bool json_parse_set_upload(cJSON* cmd_args, uint8_t* ip_addr, uint16_t* port)
+{
+	char* s;
+	
+	if ((cmd_args != NULL) && cJSON_HasObjectItem(cmd_args, "ip_addr") && cJSON_HasObjectItem(cmd_args, "port")) {
+		s = cJSON_GetObjectItem(cmd_args, "ip_addr")->valuestring;
+		if ((s == NULL) || !json_ip_string_to_array(ip_addr, s)) {
+			ESP_LOGE(TAG, "Illegal set_upload ip_addr");
+			return false;
+		}
+		*port = (uint16_t) cJSON_GetObjectItem(cmd_args, "port")->valueint;
+		return true;
+	}
+	
+	return false;
+}
+
+
+/**
+ * Get the window number and its new values from a set_schedule command.  Values not
+ * included are kept from the window's current values.  Returns false for an illegal
+ * window.
+ */
+bool json_parse_set_schedule(cJSON* cmd_args, int* n, sched_window_t* w)
+{
+	int i;
+	
+	if ((cmd_args == NULL) || !cJSON_HasObjectItem(cmd_args, "window")) return false;
+	
+	*n = cJSON_GetObjectItem(cmd_args, "window")->valueint;
+	if ((*n < 0) || (*n >= SCHED_MAX_WINDOWS)) {
+		ESP_LOGW(TAG, "Unsupported set_schedule window %d", *n);
+		return false;
+	}
+	sched_get_window(*n, w);
+	
+	if (cJSON_HasObjectItem(cmd_args, "days")) {
+		i = cJSON_GetObjectItem(cmd_args, "days")->valueint;
+		if ((i < 0) || (i > 0x7F)) {
+			ESP_LOGW(TAG, "Unsupported set_schedule days %d", i);
+			return false;
+		}
+		w->days = (uint8_t) i;
+	}
+	if (cJSON_HasObjectItem(cmd_args, "start")) {
+		i = cJSON_GetObjectItem(cmd_args, "start")->valueint;
+		if ((i < 0) || (i >= SCHED_DAY_MIN)) {
+			ESP_LOGW(TAG, "Unsupported set_schedule start %d", i);
+			return false;
+		}
+		w->start_min = (uint16_t) i;
+	}
+	if (cJSON_HasObjectItem(cmd_args, "end")) {
+		i = cJSON_GetObjectItem(cmd_args, "end")->valueint;
+		if ((i < 0) || (i >= SCHED_DAY_MIN)) {
+			ESP_LOGW(TAG, "Unsupported set_schedule end %d", i);
+			return false;
+		}
+		w->end_min = (uint16_t) i;
+	}
+	if (cJSON_HasObjectItem(cmd_args, "record_interval")) {
+		i = cJSON_GetObjectItem(cmd_args, "record_interval")->valueint;
+		if (system_get_rec_interval_index(i) < 0) {
+			ESP_LOGW(TAG, "Unsupported set_schedule record_interval %d", i);
+			return false;
+		}
+		w->record_interval = (uint16_t) i;
+	}
+	if (cJSON_HasObjectItem(cmd_args, "arducam_enable")) {
+		if (cJSON_GetObjectItem(cmd_args, "arducam_enable")->valueint > 0) {
+			w->flags |= SCHED_FLAG_ARDUCAM;
+		} else {
+			w->flags &= ~SCHED_FLAG_ARDUCAM;
+		}
+	}
+	if (cJSON_HasObjectItem(cmd_args, "lepton_enable")) {
+		if (cJSON_GetObjectItem(cmd_args, "lepton_enable")->valueint > 0) {
+			w->flags |= SCHED_FLAG_LEPTON;
+		} else {
+			w->flags &= ~SCHED_FLAG_LEPTON;
+		}
+	}
+	if (cJSON_HasObjectItem(cmd_args, "record_sleep")) {
+		if (cJSON_GetObjectItem(cmd_args, "record_sleep")->valueint > 0) {
+			w->flags |= SCHED_FLAG_SLEEP;
+		} else {
+			w->flags &= ~SCHED_FLAG_SLEEP;
+		}
+	}
+	
+	return true;
+}
+
+
+/**
+ * Get the SYNC_MODE_xxx from a set_sync command
+ */
+bool json_parse_set_sync(cJSON* cmd_args, int* mode)
+{
+	if ((cmd_args != NULL) && cJSON_HasObjectItem(cmd_args, "mode")) {
+		*mode = cJSON_GetObjectItem(cmd_args, "mode")->valueint;
+		if ((*mode < SYNC_MODE_OFF) || (*mode > SYNC_MODE_SLAVE)) {
+			ESP_LOGW(TAG, "Unsupported set_sync mode %d", *mode);
+			return false;
+		}
+		return true;
+	}
+	
+	return false;
+}
+
+
+/**
+ * Get the image length, its SHA-256 (64 hex characters) and the optional restart flag
+ * from an ota_update command.  restart is set false if not included.  length is set
+ * to 0 if not included.
+ */
+bool json_parse_ota_update(cJSON* cmd_args, uint32_t* length, uint8_t* sha256, bool* restart)
+{
+	char* s;
+	int i;
+	unsigned int b;
+	
+	*length = 0;
+	*restart = false;
+	
+	if ((cmd_args == NULL) || !cJSON_HasObjectItem(cmd_args, "length")) {
+		return false;
+	}
+	
+	// The length is returned even if the rest is bad so the image can be skipped
+	*length = (uint32_t) cJSON_GetObjectItem(cmd_args, "length")->valuedouble;
+	
+	s = cJSON_HasObjectItem(cmd_args, "sha256") ? cJSON_GetStringValue(cJSON_GetObjectItem(cmd_args, "sha256")) : NULL;
+	if ((s == NULL) || (strlen(s) != 64)) {
+		ESP_LOGW(TAG, "Illegal ota_update sha256");
+		return false;
+	}
+	for (i=0; i<32; i++) {
+		if (!isxdigit((int) s[2*i]) || !isxdigit((int) s[2*i+1]) ||
+		    (sscanf(&s[2*i], "%2x", &b) != 1))
+		{
+			ESP_LOGW(TAG, "Illegal ota_update sha256");
+			return false;
+		}
+		sha256[i] = (uint8_t) b;
+	}
+	
+	if (cJSON_HasObjectItem(cmd_args, "restart")) {
+		*restart = cJSON_GetObjectItem(cmd_args, "restart")->valueint > 0 ? true : false;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Get the optional port for the TCP send benchmark from a run_benchmark command.  It
+ * is set to 0, skipping the TCP benchmark, if not included.
+ */
+void json_parse_run_benchmark(cJSON* cmd_args, uint16_t* tcp_port)
+{
+	*tcp_port = 0;
+	
+	if ((cmd_args != NULL) && cJSON_HasObjectItem(cmd_args, "tcp_port")) {
+		*tcp_port = (uint16_t) cJSON_GetObjectItem(cmd_args, "tcp_port")->valueint;
+	}
+}
+
+
+/**
+ * Get the session, file, optional offset and client port from a get_file command or a
+ * get_session command (file and offset are optional, used to resume).  The names are
+ * checked so only files in session directories may be read.
+ */
+bool json_parse_get_file(cJSON* cmd_args, bool whole_session, xfer_request_t* reqP)
+{
+	char* s;
+	
+	memset(reqP, 0, sizeof(xfer_request_t));
+	reqP->whole_session = whole_session;
+	
+	if ((cmd_args == NULL) || !cJSON_HasObjectItem(cmd_args, "session") ||
+	    !cJSON_HasObjectItem(cmd_args, "tcp_port"))
+	{
+		return false;
+	}
+	
+	s = cJSON_GetObjectItem(cmd_args, "session")->valuestring;
+	if ((s == NULL) || (strlen(s) >= SESSION_DIR_NAME_LEN) ||
+	    (strncmp(s, SESSION_DIR_PREFIX, strlen(SESSION_DIR_PREFIX)) != 0) ||
+	    (strchr(s, '/') != NULL) || (strstr(s, "..") != NULL))
+	{
+		ESP_LOGE(TAG, "Illegal session");
+		return false;
+	}
+	strcpy(reqP->session, s);
+	
+	if (cJSON_HasObjectItem(cmd_args, "file")) {
+		s = cJSON_GetObjectItem(cmd_args, "file")->valuestring;
+		if ((s == NULL) || (strlen(s) >= XFER_MAX_PATH_LEN) || (strstr(s, "..") != NULL) ||
+		    (s[0] == '/'))
+		{
+			ESP_LOGE(TAG, "Illegal file");
+			return false;
+		}
+		strcpy(reqP->file, s);
+	}
+	if (!whole_session && (reqP->file[0] == 0)) {
+		return false;
+	}
+	
+	if (cJSON_HasObjectItem(cmd_args, "offset")) {
+		reqP->offset = (uint32_t) cJSON_GetObjectItem(cmd_args, "offset")->valuedouble;
+	}
+	
+	reqP->tcp_port = (uint16_t) cJSON_GetObjectItem(cmd_args, "tcp_port")->valueint;
+	
+	return true;
+}
+
+
 /**
  * Fill in a tmElements object with arguments from a set_time command
  */
@@ -573,6 +2026,19 @@ bool json_parse_set_wifi(cJSON* cmd_args, wifi_info_t* new_wifi_info)
 			new_wifi_info->flags = wifi_infoP->flags;
 		}
 		
+		if (cJSON_HasObjectItem(cmd_args, "profile")) {
+			i = cJSON_GetObjectItem(cmd_args, "profile")->valueint;
+			if ((i >= 0) && (i < WIFI_NUM_PROFILES)) {
+				new_wifi_info->profile = (uint8_t) i;
+				item_count++;
+			} else {
+				ESP_LOGE(TAG, "Illegal set_wifi profile: %d", i);
+				return false;
+			}
+		} else {
+			new_wifi_info->profile = wifi_infoP->profile;
+		}
+		
 		if (cJSON_HasObjectItem(cmd_args, "ap_ip_addr")) {
 			s = cJSON_GetObjectItem(cmd_args, "ap_ip_addr")->valuestring;
 			if (json_ip_string_to_array(new_wifi_info->ap_ip_addr, s)) {
@@ -607,6 +2073,65 @@ bool json_parse_set_wifi(cJSON* cmd_args, wifi_info_t* new_wifi_info)
 }
 
 
+/**
+ * Load lepP and point jpegPP at the jpeg image from the len byte json image file in
+ * textP (which must have room for a terminating null).  The Base-64 values are decoded
+ * in place (the decoder's output never overtakes its input) so the jpeg image is left
+ * in textP.  has_lepP is set if the file has a radiometric image and jpeg_lenP is 0
+ * without a jpeg image.  Returns false if the file has neither.  Cropped radiometric
+ * data is expanded to a full frame.
+ */
+bool json_parse_image_string(char* textP, uint32_t len, lep_buffer_t* lepP, bool* has_lepP, uint8_t** jpegPP, uint32_t* jpeg_lenP)
+{
+	uint8_t* dataP;
+	uint32_t data_len;
+	char* valP;
+	uint32_t val_len;
+	unsigned int x, y, w, h;
+	sys_lep_roi_t crop;
+	bool cropped = false;
+	
+	textP[len] = 0;
+	
+	// Find the crop before the Base-64 values are decoded over the text
+	crop.x = 0;
+	crop.y = 0;
+	crop.w = LEP_WIDTH;
+	crop.h = LEP_HEIGHT;
+	if (json_find_image_value(textP, "crop", &valP, &val_len) &&
+	    (sscanf(valP, "%u,%u,%u,%u", &x, &y, &w, &h) == 4) &&
+	    (w != 0) && (h != 0) && ((x + w) <= LEP_WIDTH) && ((y + h) <= LEP_HEIGHT))
+	{
+		crop.x = x;
+		crop.y = y;
+		crop.w = w;
+		crop.h = h;
+		cropped = !lepton_crop_is_full(&crop);
+	}
+	
+	if (!json_decode_image_value(textP, "jpeg", jpegPP, jpeg_lenP) || (*jpeg_lenP > CAM_MAX_JPG_LEN)) {
+		*jpeg_lenP = 0;
+	}
+	
+	*has_lepP = json_decode_image_value(textP, "radiometric", &dataP, &data_len) &&
+	            (data_len == LEP_CROP_PIXEL_LEN(&crop));
+	if (*has_lepP) {
+		memcpy(lepP->lep_bufferP, dataP, data_len);
+		if (cropped) {
+			lepton_crop_expand(lepP->lep_bufferP, &crop);
+		}
+		
+		lepP->telem_valid = json_decode_image_value(textP, "telemetry", &dataP, &data_len) &&
+		                    (data_len == LEP_TEL_WORDS*2);
+		if (lepP->telem_valid) {
+			memcpy(lepP->lep_telemP, dataP, LEP_TEL_WORDS*2);
+		}
+	}
+	
+	return (*has_lepP || (*jpeg_lenP != 0));
+}
+
+
 /**
  * Free the json command object
  */
@@ -622,224 +2147,572 @@ void json_free_cmd(cJSON* cmd)
 //
 
 /**
- * Add a child object containing base64 encoded jpeg image from the shared buffer
- *
- * Note: The encoded image string is held in an array that must be freed with
- * json_free_cam_base64_image() after the json object is converted to a string.
+ * Find the string value of a top level key in a json image file.  The values looked
+ * for are Base-64 so need no unescaping.
  */
-bool json_add_cam_image_object(cJSON* parent)
+static bool json_find_image_value(char* textP, const char* key, char** valP, uint32_t* val_lenP)
 {
-	size_t base64_obj_len;
+	char name[16];
+	char* startP;
+	char* endP;
 	
-	// Base-64 encode the camera data
-	base64_jpeg_data = base64_encode((const unsigned char *) sys_cam_buffer.cam_bufferP,
-	                                 sys_cam_buffer.cam_buffer_len, &base64_obj_len);
+	sprintf(name, "\"%s\":", key);
+	startP = strstr(textP, name);
+	if (startP == NULL) return false;
 	
-	// Add the encoded data as a reference since we're managing the buffer
-	if (base64_obj_len != 0) {
-		cJSON_AddItemToObject(parent, "jpeg", cJSON_CreateStringReference((char*) base64_jpeg_data));
-	} else {
-		ESP_LOGE(TAG, "failed to create jpeg image base64 text");
+	startP += strlen(name);
+	while ((*startP == ' ') || (*startP == '\t')) startP++;
+	if (*startP++ != '"') return false;
+	
+	endP = strchr(startP, '"');
+	if (endP == NULL) return false;
+	
+	*valP = startP;
+	*val_lenP = (uint32_t) (endP - startP);
+	return true;
+}
+
+
+/**
+ * Decode the Base-64 value of a top level key in a json image file in place
+ */
+static bool json_decode_image_value(char* textP, const char* key, uint8_t** dataPP, uint32_t* lenP)
+{
+	char* valP;
+	uint32_t val_len;
+	size_t dec_len;
+	
+	if (!json_find_image_value(textP, key, &valP, &val_len)) return false;
+	if (mbedtls_base64_decode((uint8_t*) valP, val_len, &dec_len, (uint8_t*) valP, val_len) != 0) {
 		return false;
 	}
 	
+	*dataPP = (uint8_t*) valP;
+	*lenP = (uint32_t) dec_len;
 	return true;
 }
 
 
 /**
- * Free the base64-encoded ArduCAM image.  Call this routine after printing the 
- * image json object.
+ * Initialize a streaming json writer to fill buf (max_len bytes including the
+ * terminating null)
  */
-void json_free_cam_base64_image()
+void json_writer_init(json_writer_t* w, char* buf, uint32_t max_len)
 {
-	free(base64_jpeg_data);
+	w->bufP = buf;
+	w->length = 0;
+	w->max_length = max_len - 1;   // Leave room for the null
+	w->depth = 0;
+	w->first = true;
+	w->overflow = false;
+	w->compact = false;
 }
 
 
 /**
- * Add a child object containing base64 encoded lepton image from the shared buffer
- *
- * Note: The encoded image string is held in an array that must be freed with
- * json_free_lep_base64_image() after the json object is converted to a string.
+ * Append len bytes of text to the output
+ */
+void json_writer_write(json_writer_t* w, const char* text, uint32_t len)
+{
+	if (w->overflow) return;
+	
+	if ((w->length + len) > w->max_length) {
+		w->overflow = true;
+		return;
+	}
+	memcpy(&w->bufP[w->length], text, len);
+	w->length += len;
+}
+
+
+/**
+ * Append a null-terminated string to the output
+ */
+void json_writer_puts(json_writer_t* w, const char* text)
+{
+	json_writer_write(w, text, strlen(text));
+}
+
+
+/**
+ * Start an object
  */
-bool json_add_lep_image_object(cJSON* parent)
+void json_writer_begin_object(json_writer_t* w)
 {
-	size_t base64_obj_len;
+	json_writer_puts(w, "{");
+	w->depth++;
+	w->first = true;
+}
+
+
+/**
+ * Finish an object
+ */
+void json_writer_end_object(json_writer_t* w)
+{
+	int i;
 	
-	// Base-64 encode the camera data
-	base64_lep_data = base64_encode((const unsigned char *) sys_lep_buffer.lep_bufferP,
-	                                 LEP_NUM_PIXELS*2, &base64_obj_len);
+	w->depth--;
+	if (!w->compact) {
+		json_writer_puts(w, "\n");
+		for (i=0; i<w->depth; i++) {
+			json_writer_puts(w, "\t");
+		}
+	}
+	json_writer_puts(w, "}");
+	w->first = false;
+}
+
+
+/**
+ * Start a new item in the current object (the value must be written next)
+ */
+void json_writer_key(json_writer_t* w, const char* key)
+{
+	int i;
 	
-	// Add the encoded data as a reference since we're managing the buffer
-	if (base64_obj_len != 0) {
-		cJSON_AddItemToObject(parent, "radiometric", cJSON_CreateStringReference((char*) base64_lep_data));
-	} else {
-		ESP_LOGE(TAG, "failed to create lepton image base64 text");
-		return false;
+	if (w->compact) {
+		if (!w->first) json_writer_puts(w, ",");
+		json_writer_string(w, key);
+		json_writer_puts(w, ":");
+		w->first = false;
+		return;
 	}
 	
-	return true;
+	json_writer_puts(w, w->first ? "\n" : ",\n");
+	for (i=0; i<w->depth; i++) {
+		json_writer_puts(w, "\t");
+	}
+	json_writer_string(w, key);
+	json_writer_puts(w, ":\t");
+	w->first = false;
 }
 
 
 /**
- * Free the base64-encoded Lepton image.  Call this routine after printing the 
- * image json object.
+ * Write a quoted string value, escaping characters as necessary
  */
-void json_free_lep_base64_image()
+void json_writer_string(json_writer_t* w, const char* str)
 {
-	free(base64_lep_data);
+	char esc[8];
+	
+	json_writer_puts(w, "\"");
+	while (*str != 0) {
+		if ((*str == '\"') || (*str == '\\')) {
+			esc[0] = '\\';
+			esc[1] = *str;
+			json_writer_write(w, esc, 2);
+		} else if ((unsigned char) *str < 0x20) {
+			sprintf(esc, "\\u%04x", (unsigned char) *str);
+			json_writer_write(w, esc, 6);
+		} else {
+			json_writer_write(w, str, 1);
+		}
+		str++;
+	}
+	json_writer_puts(w, "\"");
 }
 
 
 /**
- * Add a child object containing base64 encoded lepton telemetry array from the shared buffer
- *
- * Note: The encoded telemetry string is held in an array that must be freed with
- * json_free_lep_base64_telem() after the json object is converted to a string.
+ * Write a number value using the same formatting as cJSON
  */
-bool json_add_lep_telem_object(cJSON* parent)
+void json_writer_number(json_writer_t* w, double d)
 {
-	size_t base64_obj_len;
-	
-	// Base-64 encode the telemetry array
-	base64_lep_telem_data = base64_encode((const unsigned char *) sys_lep_buffer.lep_telemP,
-	                                 LEP_TEL_WORDS*2, &base64_obj_len);
+	char buf[32];
+	double test;
 	
-	// Add the encoded data as a reference since we're managing the buffer
-	if (base64_obj_len != 0) {
-		cJSON_AddItemToObject(parent, "telemetry", cJSON_CreateStringReference((char*) base64_lep_telem_data));
+	if (isnan(d) || isinf(d)) {
+		strcpy(buf, "null");
 	} else {
-		ESP_LOGE(TAG, "failed to create lepton telemetry base64 text");
-		return false;
+		// Use 15 digits of precision unless that doesn't reproduce the value
+		sprintf(buf, "%1.15g", d);
+		if ((sscanf(buf, "%lg", &test) != 1) || (test != d)) {
+			sprintf(buf, "%1.17g", d);
+		}
 	}
+	json_writer_puts(w, buf);
+}
+
+
+/**
+ * Write a boolean value
+ */
+void json_writer_bool(json_writer_t* w, bool b)
+{
+	json_writer_puts(w, b ? "true" : "false");
+}
+
+
+/**
+ * Start an array (each element is started with json_writer_element)
+ */
+void json_writer_begin_array(json_writer_t* w)
+{
+	json_writer_puts(w, "[");
+	w->depth++;
+	w->first = true;
+}
+
+
+/**
+ * Finish an array
+ */
+void json_writer_end_array(json_writer_t* w)
+{
+	int i;
 	
-	return true;
+	if (!w->first && !w->compact) {
+		json_writer_puts(w, "\n");
+		w->depth--;
+		for (i=0; i<w->depth; i++) {
+			json_writer_puts(w, "\t");
+		}
+	} else {
+		w->depth--;
+	}
+	json_writer_puts(w, "]");
+	w->first = false;
 }
 
 
 /**
- * Free the base64-encoded Lepton telemetry string.  Call this routine after printing the 
- * telemetry json object.
+ * Start a new element in the current array (the value must be written next)
  */
-void json_free_lep_base64_telem()
+void json_writer_element(json_writer_t* w)
 {
-	free(base64_lep_telem_data);
+	int i;
+	
+	if (w->compact) {
+		if (!w->first) json_writer_puts(w, ",");
+	} else {
+		json_writer_puts(w, w->first ? "\n" : ",\n");
+		for (i=0; i<w->depth; i++) {
+			json_writer_puts(w, "\t");
+		}
+	}
+	w->first = false;
 }
 
 
 /**
- * Add a child object containing image metadata to the parent.  Data related to the
- * Lepton is not included if inc_lep is not set.
+ * Write a quoted string value containing len bytes of data base64 encoded directly
+ * into the output buffer
  */
-bool json_add_metadata_object(cJSON* parent, int seq_num, bool inc_lep)
+void json_writer_base64(json_writer_t* w, const uint8_t* data, uint32_t len)
 {
-	char buf[80];
-	float t;
-	cJSON* meta;
-	wifi_info_t* wifi_info;
-	const esp_app_desc_t* app_desc;
-	tmElements_t te;
-	batt_status_t batt;
+	json_b64_job_t job;
 	
-	// Get system information
-	app_desc = esp_ota_get_app_description();
-	time_get(&te);
-	adc_get_batt(&batt);
+	json_writer_puts(w, "\"");
 	
-	// Create and add to the metadata object
-	cJSON_AddItemToObject(parent, "metadata", meta=cJSON_CreateObject());
+	if (w->overflow || ((w->length + BASE64_ENC_LEN(len)) > w->max_length)) {
+		w->overflow = true;
+		return;
+	}
 	
-	wifi_info = wifi_get_info();
-	cJSON_AddStringToObject(meta, "Camera", wifi_info->ap_ssid);
+	if (len < JSON_B64_SPLIT_MIN_LEN) {
+		w->length += base64_fast_encode(data, len, &w->bufP[w->length]);
+	} else {
+		job.src = data;
+		job.len = len;
+		job.dst = &w->bufP[w->length];
+		fork_run(json_b64_blocks, &job, len / JSON_B64_BLOCK_LEN);
+		w->length += BASE64_ENC_LEN(len);
+	}
 	
-	cJSON_AddStringToObject(meta, "Version", app_desc->version);
+	json_writer_puts(w, "\"");
+}
+
+
+/**
+ * Encode 12-byte blocks [start, end) of a base64 job (4 output characters for each 3
+ * input bytes so each block's output position is fixed).  The part after the last
+ * complete block goes with the last block.
+ */
+void json_b64_blocks(void* argP, int start, int end)
+{
+	json_b64_job_t* jobP = (json_b64_job_t*) argP;
+	uint32_t offset = start * JSON_B64_BLOCK_LEN;
+	uint32_t len;
 	
-	cJSON_AddNumberToObject(meta, "Sequence Number", (const double) seq_num);
+	if (end == (jobP->len / JSON_B64_BLOCK_LEN)) {
+		len = jobP->len - offset;
+	} else {
+		len = (end - start) * JSON_B64_BLOCK_LEN;
+	}
+	(void) base64_fast_encode(jobP->src + offset, len, jobP->dst + (offset / 3) * 4);
+}
+
+
+/**
+ * Write the image metadata object.  Data related to the ArduCAM or Lepton is not included
+ * if camP or lepP is NULL.
+ */
+void json_write_metadata_object(json_writer_t* w, int seq_num, cam_buffer_t* camP, lep_buffer_t* lepP)
+{
+	image_metadata_t md;
+	
+	metadata_get(seq_num, camP, lepP, &md);
+	
+	json_writer_key(w, "metadata");
+	json_writer_begin_object(w);
+	
+	json_writer_key(w, "Camera");
+	json_writer_string(w, md.camera);
+	json_writer_key(w, "Version");
+	json_writer_string(w, md.version);
+	json_writer_key(w, "Sequence Number");
+	json_writer_number(w, (double) md.seq_num);
+	json_writer_key(w, "Time");
+	json_writer_string(w, md.time);
+	json_writer_key(w, "Date");
+	json_writer_string(w, md.date);
+	json_writer_key(w, "Battery");
+	json_writer_number(w, (double) md.battery);
+	json_writer_key(w, "Charge");
+	json_writer_string(w, md.charge);
+	json_write_frame_stats_object(w, &md.frames);
+	
+	if (md.has_cam) {
+		json_writer_key(w, "ArduCAM Time");
+		json_writer_string(w, md.cam_time);
+		json_writer_key(w, "ArduCAM Capture");
+		json_writer_number(w, (double) md.cam_capture_num);
+		json_writer_key(w, "ArduCAM Timestamp");
+		json_writer_number(w, (double) md.cam_usec);
+		json_writer_key(w, "ArduCAM Age");
+		json_writer_number(w, (double) md.cam_age_msec);
+	}
 	
-	sprintf(buf, "%d:%02d:%02d", te.Hour, te.Minute, te.Second);
-	cJSON_AddStringToObject(meta, "Time", buf);
-	sprintf(buf, "%d/%d/%02d", te.Month, te.Day, te.Year-30);  // Year starts at 1970
-	cJSON_AddStringToObject(meta, "Date", buf);
-	
-	cJSON_AddNumberToObject(meta, "Battery", (const double) batt.batt_voltage);
-	switch (batt.charge_state) {
-		case CHARGE_OFF:
-			strcpy(buf, "OFF");
-			break;
-		case CHARGE_ON:
-			strcpy(buf, "ON");
-			break;
-		case CHARGE_FAULT:
-			strcpy(buf, "FAULT");
-			break;
+	if (md.has_lep) {
+		if (md.lep_time[0] != 0) {
+			json_writer_key(w, "Lepton Time");
+			json_writer_string(w, md.lep_time);
+			json_writer_key(w, "Lepton Timestamp");
+			json_writer_number(w, (double) md.lep_usec);
+			json_writer_key(w, "Lepton Age");
+			json_writer_number(w, (double) md.lep_age_msec);
+		}
+		if (md.has_lep_count) {
+			json_writer_key(w, "Lepton Frame Count");
+			json_writer_number(w, (double) md.lep_frame_count);
+		}
+		json_writer_key(w, "FPA Temp");
+		json_writer_number(w, (double) md.fpa_temp);
+		json_writer_key(w, "AUX Temp");
+		json_writer_number(w, (double) md.aux_temp);
+		json_writer_key(w, "Lens Temp");
+		json_writer_number(w, (double) md.lens_temp);
+		json_writer_key(w, "Lepton Gain Mode");
+		json_writer_string(w, md.gain_mode);
+		json_writer_key(w, "Lepton Resolution");
+		json_writer_string(w, md.resolution);
+		if (md.has_stats) {
+			json_write_stats_object(w, &md.stats);
+		}
 	}
-	cJSON_AddStringToObject(meta, "Charge", buf);
 	
-	if (inc_lep) {
-		t = lepton_kelvin_to_C(sys_lep_buffer.lep_telemP[LEP_TEL_FPA_T_K100], 0.01);
-		cJSON_AddNumberToObject(meta, "FPA Temp", (const double) t);
-		
-		t = lepton_kelvin_to_C(sys_lep_buffer.lep_telemP[LEP_TEL_HSE_T_K100], 0.01);
-		cJSON_AddNumberToObject(meta, "AUX Temp", (const double) t);
-		
-		cJSON_AddNumberToObject(meta, "Lens Temp", (const double) adc_get_temp());
+	json_writer_end_object(w);
+}
+
+
+/**
+ * Write the radiometric statistics object containing the frame and enabled regions
+ */
+void json_write_stats_object(json_writer_t* w, lep_stats_t* statsP)
+{
+	char name[16];
+	int i;
+	lep_roi_stats_t* statP;
+	
+	json_writer_key(w, "Lepton Stats");
+	json_writer_begin_object(w);
+	
+	for (i=0; i<LEP_STATS_NUM; i++) {
+		statP = &statsP->stats[i];
+		if (!statP->valid) continue;
 		
-		if (sys_lep_buffer.lep_telemP[LEP_TEL_GAIN_MODE] == 2) {
-			// Lepton is in Auto Gain mode, so get the effective value
-			switch (sys_lep_buffer.lep_telemP[LEP_TEL_EFF_GAIN_MODE]) {
-				case 0:
-					strcpy(buf, "HIGH");
-					break;
-				case 1:
-					strcpy(buf, "LOW");
-					break;
-				default:
-					strcpy(buf, "UNKNOWN");
-			}
-		} else {
-			// Lepton is in one of the manual Gain modes so just use it
-			switch (sys_lep_buffer.lep_telemP[LEP_TEL_GAIN_MODE]) {
-				case 0:
-					strcpy(buf, "HIGH");
-					break;
-				case 1:
-					strcpy(buf, "LOW");
-					break;
-				default:
-					strcpy(buf, "UNKNOWN");
-			}
+		json_writer_key(w, json_stats_name(i, name));
+		json_writer_begin_object(w);
+		if (i != LEP_STATS_FRAME) {
+			json_writer_key(w, "X");
+			json_writer_number(w, (double) statP->roi.x);
+			json_writer_key(w, "Y");
+			json_writer_number(w, (double) statP->roi.y);
+			json_writer_key(w, "W");
+			json_writer_number(w, (double) statP->roi.w);
+			json_writer_key(w, "H");
+			json_writer_number(w, (double) statP->roi.h);
 		}
-		cJSON_AddStringToObject(meta, "Lepton Gain Mode", buf);
+		json_writer_key(w, "Min");
+		json_writer_number(w, (double) statP->min);
+		json_writer_key(w, "Max");
+		json_writer_number(w, (double) statP->max);
+		json_writer_key(w, "Mean");
+		json_writer_number(w, (double) statP->mean);
+		json_writer_key(w, "StdDev");
+		json_writer_number(w, (double) statP->stddev);
+		sprintf(name, "P%d", LEP_STATS_PCT_LOW);
+		json_writer_key(w, name);
+		json_writer_number(w, (double) statP->p_low);
+		sprintf(name, "P%d", LEP_STATS_PCT_MID);
+		json_writer_key(w, name);
+		json_writer_number(w, (double) statP->p_mid);
+		sprintf(name, "P%d", LEP_STATS_PCT_HIGH);
+		json_writer_key(w, name);
+		json_writer_number(w, (double) statP->p_high);
+		json_writer_end_object(w);
+	}
+	
+	json_writer_end_object(w);
+}
+
+
+/**
+ * Add the radiometric statistics object containing the frame and enabled regions to
+ * parent
+ */
+void json_add_stats_object(cJSON* parent, lep_stats_t* statsP)
+{
+	char name[16];
+	int i;
+	cJSON* stats;
+	cJSON* roi;
+	lep_roi_stats_t* statP;
+	
+	cJSON_AddItemToObject(parent, "Lepton Stats", stats=cJSON_CreateObject());
+	
+	for (i=0; i<LEP_STATS_NUM; i++) {
+		statP = &statsP->stats[i];
+		if (!statP->valid) continue;
 		
-		if (sys_lep_buffer.lep_telemP[LEP_TEL_TLIN_RES] == 0) {
-			strcpy(buf, "0.1");
-		} else {
-			strcpy(buf, "0.01");
+		cJSON_AddItemToObject(stats, json_stats_name(i, name), roi=cJSON_CreateObject());
+		if (i != LEP_STATS_FRAME) {
+			cJSON_AddNumberToObject(roi, "X", (const double) statP->roi.x);
+			cJSON_AddNumberToObject(roi, "Y", (const double) statP->roi.y);
+			cJSON_AddNumberToObject(roi, "W", (const double) statP->roi.w);
+			cJSON_AddNumberToObject(roi, "H", (const double) statP->roi.h);
 		}
-		cJSON_AddStringToObject(meta, "Lepton Resolution", buf);
+		cJSON_AddNumberToObject(roi, "Min", (const double) statP->min);
+		cJSON_AddNumberToObject(roi, "Max", (const double) statP->max);
+		cJSON_AddNumberToObject(roi, "Mean", (const double) statP->mean);
+		cJSON_AddNumberToObject(roi, "StdDev", (const double) statP->stddev);
+		sprintf(name, "P%d", LEP_STATS_PCT_LOW);
+		cJSON_AddNumberToObject(roi, name, (const double) statP->p_low);
+		sprintf(name, "P%d", LEP_STATS_PCT_MID);
+		cJSON_AddNumberToObject(roi, name, (const double) statP->p_mid);
+		sprintf(name, "P%d", LEP_STATS_PCT_HIGH);
+		cJSON_AddNumberToObject(roi, name, (const double) statP->p_high);
 	}
+}
+
+
+/**
+ * Load v with the image pipeline accounting values in the order of json_frame_stats_names
+ * and return the number of values.  Arrival times of images that weren't received are -1.
+ */
+int json_frame_stats_values(app_frame_stats_t* statsP, double* v)
+{
+	v[0] = (double) statsP->requested;
+	v[1] = (double) statsP->cam_received;
+	v[2] = (double) statsP->lep_received;
+	v[3] = (double) statsP->cam_late;
+	v[4] = (double) statsP->lep_late;
+	v[5] = (double) statsP->gui_skipped;
+	v[6] = (double) statsP->file_skipped;
+	v[7] = (double) statsP->dropped;
+	v[8] = (double) statsP->cmd_sent;
+	v[9] = (double) statsP->decimated;
+	v[10] = (statsP->cam_msec == APP_FRAME_LATE) ? -1 : (double) statsP->cam_msec;
+	v[11] = (statsP->lep_msec == APP_FRAME_LATE) ? -1 : (double) statsP->lep_msec;
+	v[12] = (statsP->pair_msec == APP_FRAME_LATE) ? -1 : (double) statsP->pair_msec;
+	
+	return JSON_FRAME_STATS_NUM;
+}
+
+
+/**
+ * Write the image pipeline accounting object
+ */
+void json_write_frame_stats_object(json_writer_t* w, app_frame_stats_t* statsP)
+{
+	double v[JSON_FRAME_STATS_NUM];
+	int i, n;
 	
-	return true;
+	n = json_frame_stats_values(statsP, v);
+	
+	json_writer_key(w, "Frame Stats");
+	json_writer_begin_object(w);
+	for (i=0; i<n; i++) {
+		json_writer_key(w, json_frame_stats_names[i]);
+		json_writer_number(w, v[i]);
+	}
+	json_writer_end_object(w);
+}
+
+
+/**
+ * Add the image pipeline accounting object to parent
+ */
+void json_add_frame_stats_object(cJSON* parent, app_frame_stats_t* statsP)
+{
+	double v[JSON_FRAME_STATS_NUM];
+	cJSON* frames;
+	int i, n;
+	
+	n = json_frame_stats_values(statsP, v);
+	
+	cJSON_AddItemToObject(parent, "Frame Stats", frames=cJSON_CreateObject());
+	for (i=0; i<n; i++) {
+		cJSON_AddNumberToObject(frames, json_frame_stats_names[i], v[i]);
+	}
+}
+
+
+/**
+ * Load buf with the name of statistics entry index ("Frame" or "ROI n")
+ */
+const char* json_stats_name(int index, char* buf)
+{
+	if (index == LEP_STATS_FRAME) {
+		strcpy(buf, "Frame");
+	} else {
+		sprintf(buf, "ROI %d", index);
+	}
+	
+	return buf;
+}
+
+
+static const char* json_charge_name(enum CHARGE_STATE_t charge_state)
+{
+	switch (charge_state) {
+		case CHARGE_ON:
+			return "ON";
+		case CHARGE_FAULT:
+			return "FAULT";
+		default:
+			return "OFF";
+	}
 }
 
 
 /**
- * Tightly print a response into a string with delimitors for transmission over the network.
+ * Tightly print a response into buf with delimitors for transmission over the network.
  * Returns length of the string.
  */
-int json_generate_response_string(cJSON* root)
+int json_generate_response_string(cJSON* root, char* buf)
 {
 	int len;
 	
-	json_response_text[0] = CMD_JSON_STRING_START;
-	if (cJSON_PrintPreallocated(root, &json_response_text[1], JSON_MAX_RSP_TEXT_LEN, false) == 0) {
+	// Leave room for the delimitors and null terminator
+	buf[0] = CMD_JSON_STRING_START;
+	if (cJSON_PrintPreallocated(root, &buf[1], JSON_MAX_RSP_TEXT_LEN - 2, false) == 0) {
 		len = 0;
 	} else {
-		len = strlen(json_response_text);
-		json_response_text[len] = CMD_JSON_STRING_STOP;
-		json_response_text[len+1] = 0;
+		len = strlen(buf);
+		buf[len] = CMD_JSON_STRING_STOP;
+		buf[len+1] = 0;
 		len += 1;
 	}
 	
@@ -847,6 +2720,215 @@ int json_generate_response_string(cJSON* root)
 }
 
 
+/**
+ * Start a streamed response: the delimitor, the tag if there is one and the name of
+ * its object
+ */
+static void json_stream_header(json_stream_t* s, json_writer_t* w, const char* name)
+{
+	char start = CMD_JSON_STRING_START;
+	
+	json_writer_write(w, &start, 1);
+	json_writer_begin_object(w);
+	if (s->tag != 0) {
+		json_writer_key(w, "tag");
+		json_writer_number(w, (double) s->tag);
+	}
+	json_writer_key(w, name);
+	json_writer_begin_object(w);
+}
+
+
+/**
+ * Write the next part of a get_perf response: the pipeline counters, one stage or the
+ * GUI memory and trailer.  Returns false for the last part.
+ */
+static bool json_stream_perf_part(json_stream_t* s, json_writer_t* w)
+{
+	char stop = CMD_JSON_STRING_STOP;
+	gui_mem_stats_t mem_stats;
+	perf_stage_t* sP;
+	uint32_t vsyncs;
+	uint32_t frames;
+	int i;
+	
+	if (s->part == 0) {
+		json_stream_header(s, w, "perf");
+		
+		json_writer_key(w, "Uptime");
+		json_writer_number(w, (double) (esp_timer_get_time() / 1000000));
+		
+		// Lepton frame success rate is the percentage of the expected frames received
+		vsyncs = json_perf_stats.counter[PERF_CNT_LEP_VSYNC];
+		frames = json_perf_stats.counter[PERF_CNT_LEP_FRAME];
+		json_writer_key(w, "Lepton Vsyncs");
+		json_writer_number(w, (double) vsyncs);
+		json_writer_key(w, "Lepton Frames");
+		json_writer_number(w, (double) frames);
+		if (vsyncs >= PERF_LEP_VSYNC_PER_FRAME) {
+			i = (int) (((uint64_t) frames * PERF_LEP_VSYNC_PER_FRAME * 100) / vsyncs);
+			if (i > 100) i = 100;
+		} else {
+			i = 0;
+		}
+		json_writer_key(w, "Lepton Frame Success");
+		json_writer_number(w, (double) i);
+		json_writer_key(w, "Lepton Duplicate Frames");
+		json_writer_number(w, (double) json_perf_stats.counter[PERF_CNT_LEP_DUP_FRAME]);
+		json_writer_key(w, "Lepton Skipped Frames");
+		json_writer_number(w, (double) json_perf_stats.counter[PERF_CNT_LEP_SKIP_FRAME]);
+		json_writer_key(w, "Lepton Gain Change Frames");
+		json_writer_number(w, (double) json_perf_stats.counter[PERF_CNT_LEP_GAIN_FRAME]);
+		return true;
+	}
+	
+	w->first = false;
+	if (s->part <= PERF_NUM_STAGES) {
+		// Stage times are in uSec
+		sP = &json_perf_stats.stage[s->part - 1];
+		json_writer_key(w, perf_stage_name(s->part - 1));
+		json_writer_begin_object(w);
+		json_writer_key(w, "Count");
+		json_writer_number(w, (double) sP->count);
+		json_writer_key(w, "Avg");
+		json_writer_number(w, (double) ((sP->count == 0) ? 0 : (sP->total_usec / sP->count)));
+		json_writer_key(w, "Min");
+		json_writer_number(w, (double) sP->min_usec);
+		json_writer_key(w, "Max");
+		json_writer_number(w, (double) sP->max_usec);
+		json_writer_key(w, "Last");
+		json_writer_number(w, (double) sP->last_usec);
+		json_writer_key(w, "Histogram");
+		json_writer_begin_array(w);
+		for (i=0; i<PERF_HIST_BINS; i++) {
+			json_writer_element(w);
+			json_writer_number(w, (double) sP->hist[i]);
+		}
+		json_writer_end_array(w);
+		json_writer_end_object(w);
+		return true;
+	}
+	
+	// Little VGL heap use and the PSRAM fragmentation (free bytes vs the largest block)
+	gui_mem_get_stats(&mem_stats);
+	json_writer_key(w, "GUI Memory");
+	json_writer_begin_object(w);
+	json_writer_key(w, "Used");
+	json_writer_number(w, (double) mem_stats.used_bytes);
+	json_writer_key(w, "Peak");
+	json_writer_number(w, (double) mem_stats.peak_bytes);
+	json_writer_key(w, "Allocations");
+	json_writer_number(w, (double) mem_stats.allocations);
+	json_writer_key(w, "Internal Allocations");
+	json_writer_number(w, (double) mem_stats.internal_allocs);
+	json_writer_key(w, "Failures");
+	json_writer_number(w, (double) mem_stats.failures);
+	json_writer_key(w, "PSRAM Free");
+	json_writer_number(w, (double) mem_stats.psram_free);
+	json_writer_key(w, "PSRAM Largest Block");
+	json_writer_number(w, (double) mem_stats.psram_largest);
+	json_writer_end_object(w);
+	
+	json_writer_end_object(w);
+	json_writer_end_object(w);
+	json_writer_write(w, &stop, 1);
+	return false;
+}
+
+
+/**
+ * Write the next part of a list_sessions response: the session count, one session or
+ * the trailer.  Returns false for the last part.
+ */
+static bool json_stream_sessions_part(json_stream_t* s, json_writer_t* w)
+{
+	char stop = CMD_JSON_STRING_STOP;
+	xfer_session_t session;
+	
+	if (s->part == 0) {
+		json_stream_header(s, w, "sessions");
+		json_writer_key(w, "Total");
+		json_writer_number(w, (double) s->total);
+		json_writer_key(w, "List");
+		json_writer_begin_array(w);
+		return true;
+	}
+	
+	w->first = (s->part == 1);
+	if ((s->part <= s->count) && xfer_task_get_session(s->part - 1, &session)) {
+		json_writer_element(w);
+		json_writer_begin_object(w);
+		json_writer_key(w, "Name");
+		json_writer_string(w, session.name);
+		json_writer_key(w, "Images");
+		json_writer_number(w, (double) session.images);
+		json_writer_key(w, "Start");
+		json_writer_number(w, (double) session.start_sec);
+		json_writer_key(w, "End");
+		json_writer_number(w, (double) session.end_sec);
+		json_writer_end_object(w);
+		return true;
+	}
+	
+	json_writer_end_array(w);
+	json_writer_end_object(w);
+	json_writer_end_object(w);
+	json_writer_write(w, &stop, 1);
+	return false;
+}
+
+
+/**
+ * Return a pointer to the first non-whitespace character at or after cP
+ */
+static const char* json_skip_space(const char* cP)
+{
+	while ((*cP == ' ') || (*cP == '\t') || (*cP == '\r') || (*cP == '\n')) cP++;
+	
+	return cP;
+}
+
+
+/**
+ * cJSON allocator.  Allocations are rounded up to JSON_ARENA_ALIGN bytes.  They come
+ * from the heap if the arena is full.
+ */
+static void* json_arena_malloc(size_t sz)
+{
+	uint32_t len;
+	void* p;
+	
+	len = (sz + JSON_ARENA_ALIGN - 1) & ~(JSON_ARENA_ALIGN - 1);
+	if ((json_arena_used + len) > JSON_ARENA_LEN) {
+		return malloc(sz);
+	}
+	
+	p = json_arena + json_arena_used;
+	json_arena_used += len;
+	json_arena_live++;
+	
+	return p;
+}
+
+
+/**
+ * cJSON deallocator.  The arena is reset when its last allocation is freed.
+ */
+static void json_arena_free(void* ptr)
+{
+	if (ptr == NULL) return;
+	
+	if (((uint8_t*) ptr >= json_arena) && ((uint8_t*) ptr < (json_arena + JSON_ARENA_LEN))) {
+		if (--json_arena_live <= 0) {
+			json_arena_live = 0;
+			json_arena_used = 0;
+		}
+	} else {
+		free(ptr);
+	}
+}
+
+
 /**
  * Convert a string in the form of "XXX.XXX.XXX.XXX" into a 4-byte array for wifi_info_t
  */
@@ -876,3 +2958,58 @@ bool json_ip_string_to_array(uint8_t* ip_array, char* ip_string)
 	
 	return true;
 }
+
+
+/**
+ * Return a region of interest coordinate from cmd_args rounded down to a multiple of
+ * SYS_CAM_ROI_UNIT or cur_val if it isn't present
+ */
+uint16_t json_get_roi_arg(cJSON* cmd_args, const char* name, uint16_t cur_val, int* item_count)
+{
+	int i;
+	
+	if (!cJSON_HasObjectItem(cmd_args, name)) return cur_val;
+	
+	(*item_count)++;
+	i = cJSON_GetObjectItem(cmd_args, name)->valueint;
+	if (i < 0) i = 0;
+	if (i > SYS_CAM_ROI_REF_WIDTH) i = SYS_CAM_ROI_REF_WIDTH;
+	return (uint16_t) (i - (i % SYS_CAM_ROI_UNIT));
+}
+
+
+/**
+ * Return an integer argument from cmd_args or cur_val if it isn't present or is outside
+ * the range min_val - max_val
+ */
+int json_get_range_arg(cJSON* cmd_args, const char* name, int cur_val, int min_val, int max_val, int* item_count)
+{
+	int i;
+	
+	if (!cJSON_HasObjectItem(cmd_args, name)) return cur_val;
+	
+	(*item_count)++;
+	i = cJSON_GetObjectItem(cmd_args, name)->valueint;
+	if ((i < min_val) || (i > max_val)) {
+		ESP_LOGW(TAG, "Unsupported set_config %s %d", name, i);
+		return cur_val;
+	}
+	return i;
+}
+
+
+/**
+ * Return a fusion parallax distance argument from cmd_args: 0 or SYS_FUSION_DIST_MIN -
+ * SYS_FUSION_DIST_MAX cm.  Returns cur_val if it isn't present or is illegal.
+ */
+uint16_t json_get_fusion_dist_arg(cJSON* cmd_args, const char* name, uint16_t cur_val, int* item_count)
+{
+	int d;
+	
+	d = json_get_range_arg(cmd_args, name, cur_val, 0, SYS_FUSION_DIST_MAX, item_count);
+	if ((d != 0) && (d < SYS_FUSION_DIST_MIN)) {
+		ESP_LOGW(TAG, "Unsupported %s %d", name, d);
+		return cur_val;
+	}
+	return (uint16_t) d;
+}
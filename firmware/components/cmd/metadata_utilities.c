@@ -0,0 +1,246 @@
+/*
+ * Image metadata collection
+ *
+ * The system values in each image's metadata are kept in a snapshot updated by their
+ * producers (adc_task, wifi configuration changes) when they change so building an
+ * image's metadata is a copy instead of a set of driver and mutex calls.  The capture
+ * times come from each image.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "metadata_utilities.h"
+#include "adc_utilities.h"
+#include "lepton_utilities.h"
+#include "time_utilities.h"
+#include "vospi.h"
+#include "wifi_utilities.h"
+#include "esp_ota_ops.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include <stdio.h>
+#include <string.h>
+
+
+
+//
+// Metadata Utilities typedefs
+//
+
+// Current system values for image metadata
+typedef struct {
+	char camera[PS_SSID_MAX_LEN+1];
+	const char* version;
+	float battery;
+	const char* charge;
+	float lens_temp;
+} metadata_sys_t;
+
+
+
+//
+// Metadata Utilities variables
+//
+static metadata_sys_t metadata_sys = {"", "", 0, "OFF", 0};
+static portMUX_TYPE metadata_sys_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+
+//
+// Metadata Utilities Forward Declarations for internal functions
+//
+static void metadata_capture_time(int64_t timestamp_usec, tmElements_t* te, char* buf);
+static const char* metadata_gain_name(uint16_t mode);
+static const char* metadata_charge_name(enum CHARGE_STATE_t charge_state);
+
+
+
+//
+// Metadata Utilities API
+//
+
+/**
+ * Load the snapshot with the current system values.  Called after the ADC and WiFi have
+ * been initialized.
+ */
+void metadata_init()
+{
+	batt_status_t batt;
+	
+	metadata_sys.version = esp_ota_get_app_description()->version;
+	metadata_set_camera(wifi_get_info()->ap_ssid);
+	adc_get_batt(&batt);
+	metadata_set_batt(&batt);
+	metadata_set_lens_temp(adc_get_temp());
+}
+
+
+/**
+ * Update the camera name (AP SSID) when the WiFi configuration changes
+ */
+void metadata_set_camera(const char* name)
+{
+	char buf[PS_SSID_MAX_LEN+1];
+	
+	strncpy(buf, name, PS_SSID_MAX_LEN);
+	buf[PS_SSID_MAX_LEN] = 0;
+	
+	portENTER_CRITICAL(&metadata_sys_mux);
+	strcpy(metadata_sys.camera, buf);
+	portEXIT_CRITICAL(&metadata_sys_mux);
+}
+
+
+/**
+ * Update the battery values when they change
+ */
+void metadata_set_batt(batt_status_t* bs)
+{
+	const char* charge = metadata_charge_name(bs->charge_state);
+	
+	portENTER_CRITICAL(&metadata_sys_mux);
+	metadata_sys.battery = bs->batt_voltage;
+	metadata_sys.charge = charge;
+	portEXIT_CRITICAL(&metadata_sys_mux);
+}
+
+
+/**
+ * Update the lens temperature when it changes
+ */
+void metadata_set_lens_temp(float t)
+{
+	portENTER_CRITICAL(&metadata_sys_mux);
+	metadata_sys.lens_temp = t;
+	portEXIT_CRITICAL(&metadata_sys_mux);
+}
+
+
+/**
+ * Fill md with the current system information and, if camP or lepP are not NULL,
+ * information about the ArduCAM image or Lepton frame.  The time and date are
+ * those of the Lepton frame, the ArduCAM image or now, in that order.
+ */
+void metadata_get(int seq_num, cam_buffer_t* camP, lep_buffer_t* lepP, image_metadata_t* md)
+{
+	tmElements_t te;
+	tmElements_t cap_te;
+	bool has_time = false;
+	float lens_temp;
+	int64_t now_usec = esp_timer_get_time();
+	
+	// Get system information
+	portENTER_CRITICAL(&metadata_sys_mux);
+	strcpy(md->camera, metadata_sys.camera);
+	md->version = metadata_sys.version;
+	md->battery = metadata_sys.battery;
+	md->charge = metadata_sys.charge;
+	lens_temp = metadata_sys.lens_temp;
+	portEXIT_CRITICAL(&metadata_sys_mux);
+	app_task_get_frame_stats(&md->frames);
+	md->seq_num = seq_num;
+	
+	// Capture times
+	md->has_cam = (camP != NULL) && (camP->cam_buffer_len != 0) && (camP->timestamp_usec != 0);
+	if (md->has_cam) {
+		metadata_capture_time(camP->timestamp_usec, &cap_te, md->cam_time);
+		te = cap_te;
+		has_time = true;
+		md->cam_capture_num = camP->capture_num;
+		md->cam_usec = camP->timestamp_usec;
+		md->cam_age_msec = (uint32_t) ((now_usec - camP->timestamp_usec) / 1000);
+	}
+	if ((lepP != NULL) && (lepP->timestamp_usec != 0)) {
+		metadata_capture_time(lepP->timestamp_usec, &cap_te, md->lep_time);
+		te = cap_te;
+		has_time = true;
+		md->lep_usec = lepP->timestamp_usec;
+		md->lep_age_msec = (uint32_t) ((now_usec - lepP->timestamp_usec) / 1000);
+	} else {
+		md->lep_time[0] = 0;
+		md->lep_usec = 0;
+		md->lep_age_msec = 0;
+	}
+	if (!has_time) time_get(&te);
+	
+	sprintf(md->time, "%d:%02d:%02d", te.Hour, te.Minute, te.Second);
+	sprintf(md->date, "%d/%d/%02d", te.Month, te.Day, te.Year-30);  // Year starts at 1970
+	
+	md->has_lep = (lepP != NULL);
+	md->has_lep_count = md->has_lep && lepP->telem_valid;
+	md->has_stats = false;
+	if (md->has_lep) {
+		md->lep_frame_count = lepP->telem.frame_count;
+		md->fpa_temp = lepton_k100_to_c100(lepP->telem.fpa_temp_k100) / 100.0f;
+		md->aux_temp = lepton_k100_to_c100(lepP->telem.aux_temp_k100) / 100.0f;
+		md->lens_temp = lens_temp;
+		
+		// The gain mode in use (the one chosen in Auto Gain mode)
+		md->gain_mode = metadata_gain_name(lepP->telem.gain_mode);
+		
+		md->resolution = (lepton_get_tlin_scale(lepP) == LEP_TLIN_SCALE_LOW) ? "0.1" : "0.01";
+		
+		// app_task computes statistics for the frames it gets from lep_task (but not the
+		// frames lep_task records directly)
+		md->has_stats = lepton_stats_get_frame(lepP, &md->stats);
+	}
+}
+
+
+
+//
+// Metadata Utilities internal functions
+//
+
+/**
+ * Get the time of the capture at timestamp_usec into te and a "H:MM:SS.mmm" string
+ * into buf
+ */
+static void metadata_capture_time(int64_t timestamp_usec, tmElements_t* te, char* buf)
+{
+	uint16_t msec;
+	
+	time_get_from_usec(timestamp_usec, te, &msec);
+	sprintf(buf, "%d:%02d:%02d.%03d", te->Hour, te->Minute, te->Second, msec);
+}
+
+
+static const char* metadata_charge_name(enum CHARGE_STATE_t charge_state)
+{
+	switch (charge_state) {
+		case CHARGE_ON:
+			return "ON";
+		case CHARGE_FAULT:
+			return "FAULT";
+		default:
+			return "OFF";
+	}
+}
+
+
+static const char* metadata_gain_name(uint16_t mode)
+{
+	switch (mode) {
+		case 0:
+			return "HIGH";
+		case 1:
+			return "LOW";
+		default:
+			return "UNKNOWN";
+	}
+}
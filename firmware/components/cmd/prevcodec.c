@@ -0,0 +1,229 @@
+/*
+ * Low-bandwidth Lepton preview codec
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "prevcodec.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+
+//
+// Preview codec private constants
+//
+
+// Worst-case bytes written for one row
+#define PREVCODEC_MAX_ROW_LEN ((2 + PREVCODEC_WIDTH * (PREVCODEC_RICE_LIMIT + 8) + 7) / 8)
+
+
+
+//
+// Preview codec typedefs
+//
+
+// Bit writer
+typedef struct {
+	uint8_t* p;
+	uint32_t acc;                // Bits not yet written, right aligned
+	int n;                       // Number of them
+} prevcodec_bits_t;
+
+
+
+//
+// Preview codec Forward Declarations for internal functions
+//
+static void prevcodec_downsample_row(const lep_buffer_t* lepP, int h, uint32_t scale, uint8_t* dst);
+static uint32_t prevcodec_pack(const lep_buffer_t* lepP, uint32_t scale, uint8_t* dst, uint32_t dst_len);
+static void prevcodec_put_bits(prevcodec_bits_t* bitsP, uint32_t v, int n);
+
+
+
+//
+// Preview codec API
+//
+
+/**
+ * Load dst (at least PREVCODEC_MAX_LEN bytes) with the preview of the Lepton frame in
+ * lepP.  Returns the preview length.  The preview is built a row at a time so no
+ * buffers are shared between the tasks that call this.
+ */
+uint32_t prevcodec_encode(const lep_buffer_t* lepP, uint8_t* dst)
+{
+	int h;
+	uint32_t diff;
+	uint32_t len;
+	uint32_t scale;
+	
+	dst[0] = PREVCODEC_WIDTH;
+	dst[1] = PREVCODEC_HEIGHT;
+	dst[3] = 0;
+	dst[4] = lepP->lep_min_val & 0xFF;
+	dst[5] = lepP->lep_min_val >> 8;
+	dst[6] = lepP->lep_max_val & 0xFF;
+	dst[7] = lepP->lep_max_val >> 8;
+	
+	// 16.16 fixed-point reciprocal of 4 * diff (the block sums are 4 pixels).  A uniform
+	// frame maps to 0.
+	diff = (lepP->lep_max_val > lepP->lep_min_val) ? lepP->lep_max_val - lepP->lep_min_val : 0;
+	scale = (diff == 0) ? 0 : (255 << 16) / (4 * diff);
+	
+	len = prevcodec_pack(lepP, scale, &dst[PREVCODEC_HEADER_LEN], PREVCODEC_WIDTH * PREVCODEC_HEIGHT);
+	if (len == 0) {
+		dst[2] = PREVCODEC_ENC_RAW;
+		for (h=0; h<PREVCODEC_HEIGHT; h++) {
+			prevcodec_downsample_row(lepP, h, scale, &dst[PREVCODEC_HEADER_LEN + h * PREVCODEC_WIDTH]);
+		}
+		len = PREVCODEC_WIDTH * PREVCODEC_HEIGHT;
+	} else {
+		dst[2] = PREVCODEC_ENC_PACKED;
+	}
+	
+	return PREVCODEC_HEADER_LEN + len;
+}
+
+
+
+//
+// Preview codec internal functions
+//
+
+/**
+ * Average each 2x2 block of Lepton pixels in preview row h and scale it to 8 bits
+ * above the frame's minimum value
+ */
+static void prevcodec_downsample_row(const lep_buffer_t* lepP, int h, uint32_t scale, uint8_t* dst)
+{
+	const uint16_t* rowP;
+	int w;
+	uint32_t min4;
+	uint32_t t;
+	
+	min4 = 4 * (uint32_t) lepP->lep_min_val;
+	rowP = lepP->lep_bufferP + 2 * h * LEP_WIDTH;
+	for (w=0; w<PREVCODEC_WIDTH; w++) {
+		t = (uint32_t) rowP[2*w] + rowP[2*w + 1] + rowP[LEP_WIDTH + 2*w] + rowP[LEP_WIDTH + 2*w + 1];
+		t = (t > min4) ? (((t - min4) * scale) >> 16) : 0;
+		*dst++ = (t > 255) ? 255 : t;
+	}
+}
+
+
+/**
+ * Pack the preview of lepP into dst.  Returns the packed length or 0 if it won't fit in
+ * dst_len bytes.
+ */
+static uint32_t prevcodec_pack(const lep_buffer_t* lepP, uint32_t scale, uint8_t* dst, uint32_t dst_len)
+{
+	uint8_t rows[2][PREVCODEC_WIDTH];
+	uint8_t zz[PREVCODEC_WIDTH];
+	uint32_t cost[PREVCODEC_RICE_MAX_K + 1];
+	const uint8_t* rowP;
+	const uint8_t* prevP;
+	int h, w;
+	int a, b, c;
+	int k, best_k;
+	int pred;
+	int q;
+	prevcodec_bits_t bits;
+	uint8_t r;
+	uint8_t* endP;
+	
+	bits.p = dst;
+	bits.acc = 0;
+	bits.n = 0;
+	endP = dst + dst_len - PREVCODEC_MAX_ROW_LEN;
+	prevP = NULL;
+	for (h=0; h<PREVCODEC_HEIGHT; h++) {
+		if (bits.p > endP) return 0;
+		
+		prevcodec_downsample_row(lepP, h, scale, rows[h & 1]);
+		rowP = rows[h & 1];
+		
+		// Zig-zag the prediction residuals (modulo 2^8) so small magnitudes are small
+		// values and find the Rice parameter that codes them in the fewest bits
+		memset(cost, 0, sizeof(cost));
+		for (w=0; w<PREVCODEC_WIDTH; w++) {
+			if (prevP == NULL) {
+				pred = (w == 0) ? 0 : rowP[w-1];
+			} else if (w == 0) {
+				pred = prevP[0];
+			} else {
+				a = rowP[w-1];
+				b = prevP[w];
+				c = prevP[w-1];
+				if (c >= ((a > b) ? a : b)) {
+					pred = (a < b) ? a : b;
+				} else if (c <= ((a < b) ? a : b)) {
+					pred = (a > b) ? a : b;
+				} else {
+					pred = a + b - c;
+				}
+			}
+			r = (uint8_t) (rowP[w] - pred);
+			zz[w] = (uint8_t) ((r << 1) ^ ((int8_t) r >> 7));
+			
+			for (k=0; k<=PREVCODEC_RICE_MAX_K; k++) {
+				q = zz[w] >> k;
+				cost[k] += (q < PREVCODEC_RICE_LIMIT) ? q + 1 + k : PREVCODEC_RICE_LIMIT + 8;
+			}
+		}
+		best_k = 0;
+		for (k=1; k<=PREVCODEC_RICE_MAX_K; k++) {
+			if (cost[k] < cost[best_k]) best_k = k;
+		}
+		
+		prevcodec_put_bits(&bits, best_k, 2);
+		for (w=0; w<PREVCODEC_WIDTH; w++) {
+			q = zz[w] >> best_k;
+			if (q < PREVCODEC_RICE_LIMIT) {
+				prevcodec_put_bits(&bits, 1, q + 1);
+				prevcodec_put_bits(&bits, zz[w] & ((1 << best_k) - 1), best_k);
+			} else {
+				prevcodec_put_bits(&bits, 0, PREVCODEC_RICE_LIMIT);
+				prevcodec_put_bits(&bits, zz[w], 8);
+			}
+		}
+		prevP = rowP;
+	}
+	
+	// Pad the last byte with 0 bits
+	if (bits.n != 0) {
+		prevcodec_put_bits(&bits, 0, 8 - bits.n);
+	}
+	
+	return (uint32_t) (bits.p - dst);
+}
+
+
+/**
+ * Write the low n bits of v (n <= 24), most significant first
+ */
+static void prevcodec_put_bits(prevcodec_bits_t* bitsP, uint32_t v, int n)
+{
+	if (n == 0) return;
+	
+	bitsP->acc = (bitsP->acc << n) | (v & ((1 << n) - 1));
+	bitsP->n += n;
+	while (bitsP->n >= 8) {
+		bitsP->n -= 8;
+		*bitsP->p++ = (uint8_t) (bitsP->acc >> bitsP->n);
+	}
+}
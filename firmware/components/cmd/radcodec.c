@@ -0,0 +1,207 @@
+/*
+ * Lossless radiometric frame codec
+ *
+ * Compresses the 16-bit radiometric Lepton frames for binary image records.  Neighboring
+ * pixels are highly correlated so most prediction residuals fit in one byte and flat
+ * areas collapse to zero runs.  Encoding takes a single pass over the frame.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "radcodec.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+
+// Worst-case bytes written for one pixel (an escaped residual after a pending zero run)
+#define RADCODEC_MAX_PIXEL_LEN 4
+
+
+
+//
+// Radiometric codec API
+//
+
+/**
+ * Compress the width x height frame in src into dst.  Returns the compressed length or
+ * 0 if it won't fit in dst_len bytes.  Callers pass a dst_len smaller than the raw frame
+ * so a frame that doesn't compress is sent raw instead.
+ */
+uint32_t radcodec_encode(const uint16_t* src, int width, int height, uint8_t* dst, uint32_t dst_len)
+{
+	return radcodec_encode_region(src, width, width, height, dst, dst_len);
+}
+
+
+/**
+ * Compress a width x height region starting at src in a frame stride pixels wide into
+ * dst.  The result decodes as a width x height frame.
+ */
+uint32_t radcodec_encode_region(const uint16_t* src, int stride, int width, int height, uint8_t* dst, uint32_t dst_len)
+{
+	const uint16_t* rowP;
+	const uint16_t* prevP;
+	int h, w;
+	int run;
+	int32_t a, b, c;
+	int32_t pred;
+	uint16_t r;
+	uint16_t zz;
+	uint8_t* p;
+	uint8_t* endP;
+
+	if (dst_len < RADCODEC_MAX_PIXEL_LEN) return 0;
+
+	p = dst;
+	endP = dst + dst_len - RADCODEC_MAX_PIXEL_LEN;
+	run = 0;
+	prevP = NULL;
+	rowP = src;
+	for (h=0; h<height; h++) {
+		for (w=0; w<width; w++) {
+			// Predict from the already coded neighbors
+			if (prevP == NULL) {
+				pred = (w == 0) ? 0 : rowP[w-1];
+			} else if (w == 0) {
+				pred = prevP[0];
+			} else {
+				a = rowP[w-1];
+				b = prevP[w];
+				c = prevP[w-1];
+				if (c >= ((a > b) ? a : b)) {
+					pred = (a < b) ? a : b;
+				} else if (c <= ((a < b) ? a : b)) {
+					pred = (a > b) ? a : b;
+				} else {
+					pred = a + b - c;
+				}
+			}
+
+			// Zig-zag the residual (modulo 2^16) so small magnitudes are small values
+			r = (uint16_t) (rowP[w] - pred);
+			zz = (uint16_t) ((r << 1) ^ ((int16_t) r >> 15));
+
+			if (zz == 0) {
+				if (++run == RADCODEC_MAX_RUN) {
+					*p++ = 0xC0 | (run - 1);
+					run = 0;
+				}
+			} else {
+				if (run != 0) {
+					*p++ = 0xC0 | (run - 1);
+					run = 0;
+				}
+				if (zz < 0x80) {
+					*p++ = (uint8_t) zz;
+				} else if (zz < 0x4000) {
+					*p++ = 0x80 | (zz >> 8);
+					*p++ = zz & 0xFF;
+				} else {
+					*p++ = RADCODEC_ESCAPE;
+					*p++ = zz & 0xFF;
+					*p++ = zz >> 8;
+				}
+			}
+
+			if (p > endP) return 0;
+		}
+		prevP = rowP;
+		rowP += stride;
+	}
+
+	if (run != 0) {
+		*p++ = 0xC0 | (run - 1);
+	}
+
+	return (uint32_t) (p - dst);
+}
+
+
+/**
+ * Decompress src_len bytes from radcodec_encode into the width x height frame dst.
+ * Returns false if the data is corrupt or doesn't hold exactly one frame.
+ */
+bool radcodec_decode(const uint8_t* src, uint32_t src_len, int width, int height, uint16_t* dst)
+{
+	const uint8_t* p;
+	const uint8_t* endP;
+	uint16_t* rowP;
+	uint16_t* prevP;
+	int h, w;
+	int run;
+	int32_t a, b, c;
+	int32_t pred;
+	uint16_t r;
+	uint16_t zz;
+
+	p = src;
+	endP = src + src_len;
+	run = 0;
+	prevP = NULL;
+	rowP = dst;
+	for (h=0; h<height; h++) {
+		for (w=0; w<width; w++) {
+			if (run > 0) {
+				zz = 0;
+				run--;
+			} else {
+				if (p >= endP) return false;
+				if (*p < 0x80) {
+					zz = *p++;
+				} else if (*p < 0xC0) {
+					if ((p + 2) > endP) return false;
+					zz = (uint16_t) (((p[0] & 0x3F) << 8) | p[1]);
+					p += 2;
+				} else if (*p < RADCODEC_ESCAPE) {
+					// This pixel starts the run
+					run = *p++ & 0x1F;
+					zz = 0;
+				} else {
+					if ((*p != RADCODEC_ESCAPE) || ((p + 3) > endP)) return false;
+					zz = (uint16_t) (p[1] | (p[2] << 8));
+					p += 3;
+				}
+			}
+
+			// Same prediction as the encoder from the already decoded neighbors
+			if (prevP == NULL) {
+				pred = (w == 0) ? 0 : rowP[w-1];
+			} else if (w == 0) {
+				pred = prevP[0];
+			} else {
+				a = rowP[w-1];
+				b = prevP[w];
+				c = prevP[w-1];
+				if (c >= ((a > b) ? a : b)) {
+					pred = (a < b) ? a : b;
+				} else if (c <= ((a < b) ? a : b)) {
+					pred = (a > b) ? a : b;
+				} else {
+					pred = a + b - c;
+				}
+			}
+
+			r = (uint16_t) ((zz >> 1) ^ (uint16_t) -(int16_t) (zz & 1));
+			rowP[w] = (uint16_t) (pred + r);
+		}
+		prevP = rowP;
+		rowP += width;
+	}
+
+	return (run == 0) && (p == endP);
+}
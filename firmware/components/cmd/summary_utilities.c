@@ -0,0 +1,342 @@
+/*
+ * Recording session summary
+ *
+ * Running aggregates of the images recorded in a session (temperatures over time,
+ * per-region maxima, partial and missing images and alarm events) so a session can be
+ * triaged from one small file instead of its image files.
+ *
+ * Samples are taken by app_task as it queues each image (while the frame's statistics
+ * are still the latest) and added by file_task once the image has been written.  Only
+ * file_task updates and reads the summary.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "summary_utilities.h"
+#include "app_task.h"
+#include "lepton_alarm.h"
+#include "lepton_utilities.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <string.h>
+#include <time.h>
+
+
+
+//
+// Summary Utilities variables
+//
+static const char* TAG = "summary_utilities";
+
+static session_summary_t summary;
+static bool summary_changed;
+
+// Startup counts as of the start of the session
+static uint32_t summary_cam_late_base;
+static uint32_t summary_lep_late_base;
+static uint32_t summary_alarm_base;
+static uint32_t summary_dropped_base;    // Images dropped before a continued session was suspended
+
+
+
+//
+// Summary Utilities Forward Declarations for internal functions
+//
+static void summary_add_bucket(const summary_sample_t* sampleP);
+static void summary_merge_buckets();
+static void summary_add_temps(uint32_t* minP, uint32_t* maxP, uint64_t* sumP, uint32_t* countP,
+                              uint32_t n, const summary_sample_t* sampleP);
+static void summary_check_alarm();
+
+
+
+//
+// Summary Utilities API
+//
+
+/**
+ * Load sampleP with the values the summary needs from an image being queued for
+ * recording.  Called by app_task before the frame's statistics are replaced.  Without
+ * statistics only the frame's minimum and maximum are available.
+ */
+void summary_get_sample(cam_buffer_t* camP, lep_buffer_t* lepP, summary_sample_t* sampleP)
+{
+	lep_stats_t stats;
+	int i, scale;
+	
+	memset(sampleP, 0, sizeof(summary_sample_t));
+	sampleP->epoch_sec = (uint32_t) time(NULL);
+	sampleP->has_cam = (camP != NULL);
+	sampleP->has_lep = (lepP != NULL);
+	if (lepP == NULL) return;
+	
+	if (lepton_stats_get_frame(lepP, &stats)) {
+		sampleP->has_stats = true;
+		sampleP->min = stats.stats[LEP_STATS_FRAME].min;
+		sampleP->max = stats.stats[LEP_STATS_FRAME].max;
+		sampleP->mean = stats.stats[LEP_STATS_FRAME].mean;
+		for (i=0; i<LEP_STATS_NUM; i++) {
+			sampleP->roi_valid[i] = stats.stats[i].valid;
+			sampleP->roi_max[i] = stats.stats[i].max;
+		}
+	} else {
+		scale = lepton_get_tlin_scale(lepP);
+		sampleP->min = (uint32_t) lepP->lep_min_val * scale;
+		sampleP->max = (uint32_t) lepP->lep_max_val * scale;
+	}
+}
+
+
+/**
+ * Start the summary for a recording session.  A session resumed without a restart
+ * (recording suspended and restarted) continues its summary.  Otherwise a resumed
+ * session's summary starts again, and is marked so, since the images recorded before
+ * it was interrupted aren't read back.
+ */
+void summary_start(const char* session, bool resume, bool rec_cam, bool rec_lep)
+{
+	app_frame_stats_t frame_stats;
+	lep_alarm_event_t event;
+	
+	summary_changed = true;
+	if (resume && (strncmp(summary.session, session, SESSION_DIR_NAME_LEN) == 0)) {
+		summary.complete = false;
+		summary_dropped_base = summary.dropped;
+		ESP_LOGI(TAG, "Continue summary for %s", session);
+		return;
+	}
+	
+	memset(&summary, 0, sizeof(session_summary_t));
+	strncpy(summary.session, session, SESSION_DIR_NAME_LEN - 1);
+	summary.resumed = resume;
+	summary.start_sec = (uint32_t) time(NULL);
+	summary.update_sec = summary.start_sec;
+	summary.rec_cam = rec_cam;
+	summary.rec_lep = rec_lep;
+	summary.bucket_sec = SUMMARY_BUCKET_SEC;
+	summary_dropped_base = 0;
+	
+	app_task_get_frame_stats(&frame_stats);
+	summary_cam_late_base = frame_stats.cam_late;
+	summary_lep_late_base = frame_stats.lep_late;
+	lepton_alarm_get_event(&event);
+	summary_alarm_base = event.count;
+}
+
+
+/**
+ * Add a queued image once file_task is done with it.  Only images that were written
+ * (to the card or the spool) are summarized.
+ */
+void summary_add_image(const summary_sample_t* sampleP, uint16_t seq_num, bool written, bool spooled)
+{
+	int i;
+	uint32_t max;
+	summary_roi_max_t* roiP;
+	
+	summary_changed = true;
+	if (!written) {
+		summary.failed++;
+		return;
+	}
+	
+	summary.images++;
+	if (spooled) summary.spooled++;
+	if (sampleP->has_cam) summary.cam_images++;
+	if (sampleP->has_lep) summary.lep_images++;
+	if ((summary.rec_cam && !sampleP->has_cam) || (summary.rec_lep && !sampleP->has_lep)) {
+		summary.partial++;
+	}
+	
+	if (sampleP->has_lep) {
+		summary_add_temps(&summary.min, &summary.max, &summary.mean_sum, &summary.mean_count,
+		                  summary.lep_images, sampleP);
+	
+		// The frame maximum is always known, region maxima only with statistics
+		for (i=0; i<LEP_STATS_NUM; i++) {
+			if ((i != LEP_STATS_FRAME) && !(sampleP->has_stats && sampleP->roi_valid[i])) continue;
+			
+			max = (i == LEP_STATS_FRAME) ? sampleP->max : sampleP->roi_max[i];
+			roiP = &summary.roi[i];
+			if (!roiP->valid || (max > roiP->max)) {
+				roiP->valid = true;
+				roiP->max = max;
+				roiP->epoch_sec = sampleP->epoch_sec;
+				roiP->seq_num = seq_num;
+			}
+		}
+	}
+	
+	summary_add_bucket(sampleP);
+}
+
+
+/**
+ * Update the values that aren't tied to a written image: the images dropped (file_task's
+ * count, which starts again when a session is resumed), the pipeline periods without
+ * an image and new alarm events.  complete is set when the session ends.
+ */
+void summary_update(uint32_t dropped, bool complete)
+{
+	app_frame_stats_t frame_stats;
+	
+	app_task_get_frame_stats(&frame_stats);
+	dropped += summary_dropped_base;
+	if ((dropped != summary.dropped) ||
+	    ((frame_stats.cam_late - summary_cam_late_base) != summary.cam_late) ||
+	    ((frame_stats.lep_late - summary_lep_late_base) != summary.lep_late) ||
+	    (complete != summary.complete))
+	{
+		summary_changed = true;
+	}
+	summary.dropped = dropped;
+	summary.cam_late = frame_stats.cam_late - summary_cam_late_base;
+	summary.lep_late = frame_stats.lep_late - summary_lep_late_base;
+	summary.complete = complete;
+	summary_check_alarm();
+	
+	if (summary_changed) {
+		summary.update_sec = (uint32_t) time(NULL);
+	}
+}
+
+
+/**
+ * Return true once if the summary has changed since the last call
+ */
+bool summary_get_changed()
+{
+	bool changed = summary_changed;
+	
+	summary_changed = false;
+	return changed;
+}
+
+
+/**
+ * Return the summary for file_task to write
+ */
+const session_summary_t* summary_get()
+{
+	return &summary;
+}
+
+
+
+//
+// Summary Utilities internal functions
+//
+
+/**
+ * Add an image to its timeline bucket, merging buckets until the image fits.  Images
+ * timestamped before the start of the session (the clock was set back) go in the
+ * first bucket.
+ */
+static void summary_add_bucket(const summary_sample_t* sampleP)
+{
+	uint32_t n;
+	summary_bucket_t* bP;
+	
+	n = (sampleP->epoch_sec > summary.start_sec) ? (sampleP->epoch_sec - summary.start_sec) : 0;
+	while ((n / summary.bucket_sec) >= SUMMARY_MAX_BUCKETS) {
+		summary_merge_buckets();
+	}
+	
+	bP = &summary.buckets[n / summary.bucket_sec];
+	bP->images++;
+	if (sampleP->has_lep) {
+		bP->lep_images++;
+		summary_add_temps(&bP->min, &bP->max, &bP->mean_sum, &bP->mean_count, bP->lep_images, sampleP);
+	}
+}
+
+
+/**
+ * Merge adjacent timeline buckets, doubling the bucket length
+ */
+static void summary_merge_buckets()
+{
+	int i;
+	summary_bucket_t* dP;
+	summary_bucket_t* sP;
+	
+	for (i=0; i<SUMMARY_MAX_BUCKETS; i++) {
+		dP = &summary.buckets[i];
+		if (i < (SUMMARY_MAX_BUCKETS / 2)) {
+			sP = &summary.buckets[2*i];
+			*dP = *sP;
+			sP = &summary.buckets[2*i + 1];
+			if (sP->lep_images != 0) {
+				if ((dP->lep_images == 0) || (sP->min < dP->min)) dP->min = sP->min;
+				if ((dP->lep_images == 0) || (sP->max > dP->max)) dP->max = sP->max;
+			}
+			dP->images += sP->images;
+			dP->lep_images += sP->lep_images;
+			dP->mean_sum += sP->mean_sum;
+			dP->mean_count += sP->mean_count;
+		} else {
+			memset(dP, 0, sizeof(summary_bucket_t));
+		}
+	}
+	
+	summary.bucket_sec *= 2;
+	ESP_LOGI(TAG, "Summary bucket length now %u sec", summary.bucket_sec);
+}
+
+
+/**
+ * Include a Lepton image's temperatures in a set of values that now holds n images
+ */
+static void summary_add_temps(uint32_t* minP, uint32_t* maxP, uint64_t* sumP, uint32_t* countP,
+                              uint32_t n, const summary_sample_t* sampleP)
+{
+	if ((n == 1) || (sampleP->min < *minP)) *minP = sampleP->min;
+	if ((n == 1) || (sampleP->max > *maxP)) *maxP = sampleP->max;
+	if (sampleP->has_stats) {
+		*sumP += sampleP->mean;
+		*countP += 1;
+	}
+}
+
+
+/**
+ * Record a new alarm event.  Events are seen as changes in the event count so only the
+ * details of the latest of events starting between checks are kept.
+ */
+static void summary_check_alarm()
+{
+	lep_alarm_event_t event;
+	summary_alarm_t* aP;
+	uint32_t count;
+	
+	lepton_alarm_get_event(&event);
+	count = event.count - summary_alarm_base;
+	if (count == summary.alarm_count) return;
+	
+	summary.alarm_count = count;
+	summary_changed = true;
+	if (summary.num_alarms < SUMMARY_MAX_ALARMS) {
+		aP = &summary.alarms[summary.num_alarms++];
+		aP->epoch_sec = (uint32_t) (time(NULL) - (esp_timer_get_time() - event.start_usec) / 1000000);
+		aP->cause = event.cause;
+		aP->roi = event.roi;
+		aP->stat = event.stat;
+		aP->value = event.value;
+		aP->rate = event.rate;
+	}
+}
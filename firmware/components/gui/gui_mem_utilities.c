@@ -0,0 +1,116 @@
+/*
+ * Little VGL memory allocator
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "gui_mem_utilities.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdbool.h>
+
+
+//
+// GUI Memory Utilities private constants
+//
+
+// Each block starts with its length so the statistics can be kept when it is freed
+#define GUI_MEM_HDR_LEN sizeof(uint32_t)
+
+
+
+//
+// GUI Memory Utilities variables
+//
+static gui_mem_stats_t gui_mem_stats;
+static portMUX_TYPE gui_mem_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+
+//
+// GUI Memory Utilities API
+//
+
+/**
+ * Little VGL malloc replacement.  Allocates from the PSRAM, falling back to the
+ * internal RAM so the GUI keeps working if the PSRAM is exhausted.
+ */
+void* gui_mem_alloc(size_t size)
+{
+	uint32_t* p;
+	bool internal = false;
+	
+	p = heap_caps_malloc(size + GUI_MEM_HDR_LEN, MALLOC_CAP_SPIRAM);
+	if (p == NULL) {
+		p = heap_caps_malloc(size + GUI_MEM_HDR_LEN, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+		internal = true;
+	}
+	
+	portENTER_CRITICAL(&gui_mem_mux);
+	if (p == NULL) {
+		gui_mem_stats.failures++;
+	} else {
+		gui_mem_stats.used_bytes += size;
+		if (gui_mem_stats.used_bytes > gui_mem_stats.peak_bytes) {
+			gui_mem_stats.peak_bytes = gui_mem_stats.used_bytes;
+		}
+		gui_mem_stats.allocations++;
+		if (internal) gui_mem_stats.internal_allocs++;
+	}
+	portEXIT_CRITICAL(&gui_mem_mux);
+	
+	if (p == NULL) return NULL;
+	
+	*p = size;
+	return p + 1;
+}
+
+
+/**
+ * Little VGL free replacement
+ */
+void gui_mem_free(void* p)
+{
+	uint32_t* blockP;
+	
+	if (p == NULL) return;
+	
+	blockP = ((uint32_t*) p) - 1;
+	
+	portENTER_CRITICAL(&gui_mem_mux);
+	gui_mem_stats.used_bytes -= *blockP;
+	gui_mem_stats.allocations--;
+	portEXIT_CRITICAL(&gui_mem_mux);
+	
+	heap_caps_free(blockP);
+}
+
+
+/**
+ * Get the Little VGL memory use and the state of the PSRAM heap it comes from
+ */
+void gui_mem_get_stats(gui_mem_stats_t* statsP)
+{
+	portENTER_CRITICAL(&gui_mem_mux);
+	*statsP = gui_mem_stats;
+	portEXIT_CRITICAL(&gui_mem_mux);
+	
+	statsP->psram_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+	statsP->psram_largest = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+}
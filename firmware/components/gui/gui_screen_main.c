@@ -27,17 +27,24 @@
 #include "gui_screen_main.h"
 #include "app_task.h"
 #include "gui_task.h"
+#include "gui_utilities.h"
+#include "ili9341.h"
 #include "adc_utilities.h"
 #include "file_utilities.h"
+#include "fork_utilities.h"
 #include "ps_utilities.h"
 #include "sys_utilities.h"
 #include "time_utilities.h"
 #include "wifi_utilities.h"
 #include "lv_conf.h"
 #include "vospi.h"
+#include "jpgenc.h"
+#include "lepton_stats.h"
+#include "lepton_utilities.h"
 #include "palettes.h"
 #include "render_jpg.h"
 #include <math.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -50,6 +57,55 @@
 // Uncomment to debug image display timing
 //#define GUI_DEBUG_IMG
 
+// WiFi flags that change the displayed WiFi status
+#define GUI_WIFI_DISP_FLAGS (WIFI_INFO_FLAG_ENABLED | WIFI_INFO_FLAG_CONNECTED | WIFI_INFO_FLAG_CLIENT_MODE)
+
+// Maximum span of lepton values converted through a per-frame pixel lookup table.  Frames
+// with a wider span are scaled with a fixed-point reciprocal instead, except with an
+// isotherm when the table covers the span in steps of the smallest power of 2 that fits.
+#define GUI_LEP_LUT_LEN 1024
+
+// Display AGC histogram bins (one per display intensity level)
+#define GUI_LEP_AGC_BINS 256
+
+// Clip AGC: fraction of pixels (per thousand) saturated at each end
+#define GUI_LEP_AGC_CLIP_PERMIL 10
+
+// Plateau AGC: maximum pixel count of a histogram bin, 4x the count of a flat histogram.
+// It stops large uniform areas (sky, walls) from taking most of the intensity range.
+#define GUI_LEP_AGC_PLATEAU (4 * LEP_NUM_PIXELS / GUI_LEP_AGC_BINS)
+
+// Fusion edge overlay.  Edges are ArduCAM pixels where the sum of the horizontal and
+// vertical green gradients (0 - 126) exceeds the threshold.  Stronger edges are drawn
+// more opaque (blend alpha is 0 - 32).
+#define GUI_FUSION_EDGE_THRESH 12
+#define GUI_FUSION_EDGE_GAIN   2
+
+// Touch meter regions in Lepton pixels
+#define GUI_METER_SPOT_SIZE    3
+#define GUI_METER_BOX_W        24
+#define GUI_METER_BOX_H        18
+
+// Touch meter marker arm length (spot) in Lepton pixels
+#define GUI_METER_ARM_LEN      3
+
+// Lepton palette mapping methods
+#define GUI_LEP_MAP_AGC        0
+#define GUI_LEP_MAP_LUT        1
+#define GUI_LEP_MAP_SCALE      2
+
+// Full-screen display block - the rows rendered into the draw buffer at a time
+typedef struct {
+	uint16_t* bufP;
+	int y;
+} lep_full_block_t;
+
+// Swapped RGB565 pixel components
+#define GUI_SWAP565_GREEN(c)   ((__builtin_bswap16(c) >> 5) & 0x3F)
+#define GUI_SWAP565_WHITE      0xFFFF
+#define GUI_SWAP565_BLACK      0x0000
+#define GUI_SWAP565(c)         ((uint16_t) ((((c) & 0xFF) << 8) | ((c) >> 8)))
+
 
 //
 // Main GUI Screen variables
@@ -64,6 +120,7 @@ static lv_obj_t* lbl_batt_status;
 static lv_obj_t* lbl_ssid;
 static lv_obj_t* lbl_time_date;
 static lv_obj_t* lbl_lens_temp;
+static lv_obj_t* lbl_meter;
 static lv_img_dsc_t arducam_img_dsc;
 static lv_obj_t* img_arducam;
 static lv_img_dsc_t lepton_img_dsc;
@@ -80,6 +137,48 @@ static lv_obj_t* btn_poweroff_label;
 // Screen state
 static bool main_screen_active;
 
+// Lepton value (offset from the frame minimum) to byte-swapped RGB565 pixel lookup table
+static uint16_t lep_pixel_lut[GUI_LEP_LUT_LEN];
+
+// Display AGC per-frame histogram and histogram bin to byte-swapped RGB565 pixel map
+static uint16_t lep_agc_hist[GUI_LEP_AGC_BINS];
+static uint16_t lep_agc_map[GUI_LEP_AGC_BINS];
+
+// Current frame palette mapping, shared by both halves of the rows split across the cores
+static int lep_map_method;
+static const uint16_t* lep_map_srcP;
+static uint16_t* lep_map_dstP;
+static uint16_t lep_map_min;
+static uint32_t lep_map_diff;
+static uint32_t lep_map_scale;
+static int lep_map_lut_shift;           // Lookup table step (as a power of 2)
+static uint32_t lep_map_lut_limit;      // Last lookup table entry
+
+// Byte-swapped RGB565 isotherm colors (indexed by SYS_ISO_COLOR_xxx)
+static const uint16_t lep_iso_colors[SYS_ISO_COLOR_NUM] = {
+	GUI_SWAP565(0xFFFF),                // White
+	GUI_SWAP565(0x0000),                // Black
+	GUI_SWAP565(0xF800),                // Red
+	GUI_SWAP565(0x07E0),                // Green
+	GUI_SWAP565(0x001F),                // Blue
+	GUI_SWAP565(0xF81F)                 // Magenta
+};
+
+// Touch meter center in Lepton pixels and the last touch on the Lepton image
+static int meter_x = LEP_IMG_WIDTH / 2;
+static int meter_y = LEP_IMG_HEIGHT / 2;
+static lv_point_t meter_press_point;
+
+// ArduCAM display pixel column and row under each Lepton display pixel (-1 for none).
+// The mapping is separable so these small tables are the whole remap.  They are only
+// rebuilt when the scale or parallax corrected offsets they were built for change.
+static int16_t fusion_col[LEP_IMG_WIDTH];
+static int16_t fusion_row[LEP_IMG_HEIGHT];
+static bool fusion_map_valid = false;
+static int fusion_map_scale;
+static int fusion_map_dx;
+static int fusion_map_dy;
+
 // Displayed object state to reduce redraws
 static char prev_ssid[PS_SSID_MAX_LEN];
 static uint8_t prev_flags;
@@ -87,6 +186,9 @@ static batt_status_t prev_bs;
 static bool prev_sdcard_present;
 static int prev_temp;
 static uint16_t prev_record_count;
+static uint8_t prev_meter_mode;
+static uint32_t prev_meter_max;
+static uint32_t prev_meter_mean;
 
 
 
@@ -100,6 +202,24 @@ static void main_screen_update_sdcard();
 static void main_screen_update_batt();
 static void main_screen_update_time();
 static void main_screen_update_temp();
+static void main_screen_update_meter(lep_buffer_t* lepP);
+static void main_screen_get_meter_roi(sys_lep_roi_t* roiP);
+static void main_screen_draw_meter(const sys_lep_roi_t* roiP);
+static void main_screen_meter_hline(int x1, int x2, int y);
+static void main_screen_meter_vline(int x, int y1, int y2);
+static void main_screen_render_lep(lep_buffer_t* lepP);
+static bool main_screen_lep_map_setup(lep_buffer_t* lepP);
+static void main_screen_lep_agc_map(uint8_t mode);
+static void main_screen_lep_iso_lut(lep_buffer_t* lepP);
+static void SYS_HOT_IRAM_ATTR main_screen_lep_map_rows(void* argP, int start, int end);
+static void SYS_HOT_IRAM_ATTR main_screen_lep_full_rows(void* argP, int start, int end);
+static inline uint16_t main_screen_lep_full_pixel(uint32_t t, const uint16_t* tableP, uint32_t limit, uint32_t scale);
+static void main_screen_draw_image(lv_obj_t* img, const uint16_t* bufP);
+static void main_screen_fuse_images();
+static void main_screen_fusion_map();
+static int main_screen_fusion_offset(int offset);
+static inline uint16_t main_screen_blend(uint16_t fg, uint16_t bg, uint32_t a);
+static void img_lepton_callback(lv_obj_t * img, lv_event_t event);
 static void btn_record_callback(lv_obj_t * btn, lv_event_t event);
 static void btn_settings_callback(lv_obj_t * btn, lv_event_t event);
 static void btn_poweroff_callback(lv_obj_t * btn, lv_event_t event);
@@ -153,6 +273,14 @@ lv_obj_t* gui_screen_main_create()
 	lv_obj_set_width(lbl_lens_temp, 50);
 	lv_label_set_align(lbl_lens_temp, LV_LABEL_ALIGN_RIGHT);
 	
+	// Touch meter reading (above the Lepton image, which is written directly to the LCD)
+	lbl_meter = lv_label_create(main_screen, NULL);
+	lv_label_set_long_mode(lbl_meter, LV_LABEL_LONG_CROP);
+	lv_obj_set_pos(lbl_meter, 165, 22);
+	lv_obj_set_width(lbl_meter, 110);
+	lv_label_set_align(lbl_meter, LV_LABEL_ALIGN_RIGHT);
+	lv_label_set_static_text(lbl_meter, "");
+	
 	// Arducam image data structure
 	arducam_img_dsc.header.always_zero = 0;
 	arducam_img_dsc.header.cf = LV_IMG_CF_TRUE_COLOR;
@@ -178,6 +306,8 @@ lv_obj_t* gui_screen_main_create()
 	img_lepton = lv_img_create(main_screen, NULL);
 	lv_img_set_src(img_lepton, &lepton_img_dsc);
 	lv_obj_set_pos(img_lepton, 160, 40);
+	lv_obj_set_click(img_lepton, true);
+	lv_obj_set_event_cb(img_lepton, img_lepton_callback);
 	
 	// Button Area
 	btn_record = lv_btn_create(main_screen, NULL);
@@ -263,53 +393,80 @@ void gui_screen_main_status_update_task(lv_task_t * task)
 
 
 /**
- * Update the ArduCAM display.  Convert the jpeg image to our image size and
- * force LittleVGL to update the image area
+ * Convert the jpeg image in the shared buffer to our image size in bufP.  Called by
+ * render_task, outside the LittleVGL context, so it must not touch any LVGL objects.
+ *   returns true for success, false for failure
  */
-void gui_screen_main_update_cam_image()
+bool gui_screen_main_render_cam_image(uint16_t* bufP)
 {
-	// Attempt to convert the jpeg image from the shared buffer into a bitmap in our
-	// display buffer
-	if (render_jpeg_image((uint8_t*) gui_cam_bufferP, sys_cam_buffer.cam_bufferP,
-	    sys_cam_buffer.cam_buffer_len, CAM_JPEG_WIDTH, CAM_IMG_WIDTH) == 1) {
-	    
-		// Invalidate the object to force it to redraw from the buffer
-		lv_obj_invalidate(img_arducam);
-		
+	int rendered;
+	
+	if (sys_cam_gui_bufferP == NULL) return false;
+	
+#ifdef RENDER_JPG_BENCHMARK
+	static bool benchmark_done = false;
+	if (!benchmark_done) {
+		render_jpeg_benchmark(sys_cam_gui_bufferP->cam_bufferP, sys_cam_gui_bufferP->cam_buffer_len,
+		                      CAM_IMG_WIDTH, CAM_IMG_HEIGHT);
+		benchmark_done = true;
+	}
+#endif
+	
+#ifdef GUI_CAM_FAST_PREVIEW
+	// Leave more CPU to the recording tasks with a quick DC-only decode while recording
+	if (app_task_get_recording()) {
+		rendered = render_jpeg_preview((uint8_t*) bufP, sys_cam_gui_bufferP->cam_bufferP,
+		                               sys_cam_gui_bufferP->cam_buffer_len, CAM_IMG_WIDTH, CAM_IMG_HEIGHT);
+	} else
+#endif
+	{
+		rendered = render_jpeg_image((uint8_t*) bufP, sys_cam_gui_bufferP->cam_bufferP,
+		                             sys_cam_gui_bufferP->cam_buffer_len, CAM_IMG_WIDTH, CAM_IMG_HEIGHT);
+	}
+	
 #ifdef GUI_DEBUG_IMG
+	if (rendered == 1) {
 		ESP_LOGI(TAG, "render cam");
-#endif
 	}
+#endif
+	
+	return (rendered == 1);
 }
 
 
 /**
- * Update the lepton display.  Perform a simple linearization of the raw lepton data and
- * scale it to 8-bit and write pseudo-color pixels to the gui lepton display buffer
- * and force LittleVGL to update the image area.
+ * Update the ArduCAM display.  Swap the buffer render_task just decoded an image into
+ * with the displayed buffer and draw it.
  */
-void gui_screen_main_update_lep_image()
+void gui_screen_main_update_cam_image()
 {
-	uint32_t t32;
-	uint32_t diff;
-	uint16_t* ptr = sys_lep_buffer.lep_bufferP;
-	uint16_t* ptr2 = gui_lep_bufferP;
-	uint8_t t8;
+	uint16_t* t;
 	
-	// Copy the source buffer to the destination buffer
-	//  - Scale each source value to an 8-bit intensity value
-	//  - Convert the intensity value to a byte-swapped RGB565 pixel to store
-	ptr = sys_lep_buffer.lep_bufferP;
-	diff = sys_lep_buffer.lep_max_val - sys_lep_buffer.lep_min_val;
+	t = gui_cam_bufferP;
+	gui_cam_bufferP = gui_cam_render_bufferP;
+	gui_cam_render_bufferP = t;
+	arducam_img_dsc.data = (uint8_t*) gui_cam_bufferP;
 	
-	while (ptr < (sys_lep_buffer.lep_bufferP + LEP_NUM_PIXELS)) {
-		t32 = ((uint32_t)(*ptr++ - sys_lep_buffer.lep_min_val) * 255) / diff;
-		t8 = (t32 > 255) ? 255 : (uint8_t) t32;
-		*ptr2++ = PALLETTE_LOOKUP(t8);
-	}
+	// Drop any cached reference to the old buffer so later redraws use the new buffer
+	lv_img_cache_invalidate_src(&arducam_img_dsc);
+	main_screen_draw_image(img_arducam, gui_cam_bufferP);
+}
+
 
-	// Finally invalidate the object to force it to redraw from the buffer
-	lv_obj_invalidate(img_lepton);
+/**
+ * Update the lepton display from lepP (normally sys_lep_gui_bufferP).  Scale the raw
+ * lepton data to 8-bit using the display AGC mode and write pseudo-color pixels to the
+ * gui lepton display buffer and draw it.
+ */
+void gui_screen_main_update_lep_image(lep_buffer_t* lepP)
+{
+	if (lepP == NULL) return;
+	
+	main_screen_render_lep(lepP);
+	main_screen_update_meter(lepP);
+	
+	// Finally display the updated buffer
+	main_screen_draw_image(img_lepton, gui_lep_bufferP);
 		
 #ifdef GUI_DEBUG_IMG
 		ESP_LOGI(TAG, "render lep");
@@ -317,6 +474,93 @@ void gui_screen_main_update_lep_image()
 }
 
 
+/**
+ * Encode the palette mapped Lepton image for lepP as a jpeg in dst for http_task.
+ * rendered is set if gui_screen_main_update_lep_image has just drawn lepP so
+ * gui_lep_bufferP already holds it.  Returns the jpeg length or 0 if it didn't fit in
+ * dst_len bytes.
+ */
+uint32_t gui_screen_main_encode_lep_jpg(lep_buffer_t* lepP, bool rendered, uint8_t* dst, uint32_t dst_len)
+{
+	if (lepP == NULL) return 0;
+	
+	if (!rendered) {
+		main_screen_render_lep(lepP);
+	}
+	
+	return jpgenc_encode_rgb565(gui_lep_bufferP, LEP_IMG_WIDTH, LEP_IMG_HEIGHT, true, dst, dst_len);
+}
+
+
+/**
+ * Draw the lepton image from lepP upscaled 2x with bilinear interpolation to fill the
+ * LCD for the thermal screen.  The raw values are interpolated and then palette mapped
+ * so no colors that aren't in the palette appear.  Blocks of rows are rendered into
+ * LittleVGL's free display buffer with the rows split between both cores and written
+ * directly to the LCD so no full-size image buffer is needed.  The ArduCAM image isn't
+ * fused with the full-screen image.
+ */
+void gui_screen_main_update_lep_full(lep_buffer_t* lepP)
+{
+	lep_full_block_t block;
+	lv_area_t area;
+	uint32_t len;
+	int rows;
+	
+	if ((lepP == NULL) || gui_message_box_displayed()) return;
+	
+	(void) main_screen_lep_map_setup(lepP);
+	
+	block.bufP = gui_get_draw_buffer(&len);
+	rows = len / LEP_FULL_IMG_WIDTH;
+	if (rows > LEP_FULL_IMG_HEIGHT) rows = LEP_FULL_IMG_HEIGHT;
+	
+	area.x1 = 0;
+	area.x2 = LEP_FULL_IMG_WIDTH - 1;
+	for (block.y=0; block.y<LEP_FULL_IMG_HEIGHT; block.y+=rows) {
+		if ((block.y + rows) > LEP_FULL_IMG_HEIGHT) {
+			rows = LEP_FULL_IMG_HEIGHT - block.y;
+		}
+		fork_run(main_screen_lep_full_rows, &block, rows);
+		
+		area.y1 = block.y;
+		area.y2 = block.y + rows - 1;
+		ili9341_write_area(&area, block.bufP);
+	}
+	
+#ifdef GUI_DEBUG_IMG
+	ESP_LOGI(TAG, "render lep full");
+#endif
+}
+
+
+/**
+ * Palette map lepP into bufP (LEP_IMG_PIXELS byte-swapped RGB565 pixels) using the
+ * display palette, AGC mode and isotherm for the playback screen.  The ArduCAM image
+ * isn't fused and the meter isn't drawn.
+ */
+void gui_screen_main_render_lep_buffer(lep_buffer_t* lepP, uint16_t* bufP)
+{
+	uint16_t* ptr2 = bufP;
+	uint16_t t16;
+	
+	// Copy the source buffer to the destination buffer
+	//  - Scale each source value to an 8-bit intensity value
+	//  - Convert the intensity value to a byte-swapped RGB565 pixel to store
+	if (!main_screen_lep_map_setup(lepP)) {
+		// Uniform scene
+		t16 = lep_pixel_lut[0];
+		while (ptr2 < (bufP + LEP_NUM_PIXELS)) {
+			*ptr2++ = t16;
+		}
+	} else {
+		// Convert the pixels with the rows split between both cores
+		lep_map_dstP = bufP;
+		fork_run(main_screen_lep_map_rows, NULL, LEP_HEIGHT);
+	}
+}
+
+
 /**
  * Update the recording LED state
  */
@@ -377,12 +621,13 @@ static void main_screen_initialize_dynamic_values()
 	
 	// Force updates
 	prev_ssid[0] = 0;
-	prev_flags = 0;
+	prev_flags = 0xFF;
 	prev_sdcard_present = !file_get_card_present();
 	prev_bs.batt_state = BATT_CRIT;         /* Pick values hopefully we won't have */
 	prev_bs.charge_state = CHARGE_FAULT;
 	prev_temp = 99999;
 	prev_record_count = 1;
+	prev_meter_mode = 0xFF;
 	
 	main_screen_update_wifi();
 	main_screen_update_sdcard();
@@ -422,7 +667,7 @@ static void main_screen_update_wifi()
 		ssid_different = (strcmp(prev_ssid, wifi_info->ap_ssid) != 0);
 	}
 	
-	if (ssid_different || (prev_flags != wifi_info->flags)) {
+	if (ssid_different || (prev_flags != (wifi_info->flags & GUI_WIFI_DISP_FLAGS))) {
 	    
 		// Update the label with the SSID and optional WiFi Icon to indicate active/connected
 		memset(wifi_label, 0, sizeof(wifi_label));
@@ -455,7 +700,7 @@ static void main_screen_update_wifi()
 		} else {
 			strcpy(prev_ssid, wifi_info->ap_ssid);
 		}
-		prev_flags = wifi_info->flags;
+		prev_flags = wifi_info->flags & GUI_WIFI_DISP_FLAGS;
 	}
 }
 
@@ -543,11 +788,17 @@ static void main_screen_update_batt()
 static void main_screen_update_time()
 {
 	static char time_buf[26];  // Statically allocated for lv_label_set_static_text
+	char new_buf[26];
 	tmElements_t tm;
 	
+	// Only redraw the label when the displayed time changes (this task isn't synchronized
+	// to the RTC so it may run twice in one second)
 	time_get(&tm);
-	time_get_disp_string(tm, time_buf);
-	lv_label_set_static_text(lbl_time_date, time_buf);
+	time_get_disp_string(tm, new_buf);
+	if (strcmp(new_buf, time_buf) != 0) {
+		strcpy(time_buf, new_buf);
+		lv_label_set_static_text(lbl_time_date, time_buf);
+	}
 }
 
 
@@ -568,11 +819,641 @@ static void main_screen_update_temp()
 }
 
 
+/**
+ * Update the touch meter for lepP: set the region measured from the next frame, draw
+ * its marker over the Lepton display buffer and display the reading for lepP.  The
+ * reading comes from the statistics app_task computed for the frame so the meter adds
+ * no pass over the image.  The previous reading stays displayed if they aren't
+ * available yet or are for the meter's previous position.
+ */
+static void main_screen_update_meter(lep_buffer_t* lepP)
+{
+	static char meter_buf[24];  // Statically allocated for lv_label_set_static_text
+	sys_lep_roi_t roi;
+	lep_stats_t stats;
+	lep_roi_stats_t* statP;
+	bool mode_changed;
+	
+	main_screen_get_meter_roi(&roi);
+	lepton_stats_set_meter(&roi);
+	
+	mode_changed = (gui_st.meter_mode != prev_meter_mode);
+	prev_meter_mode = gui_st.meter_mode;
+	if (gui_st.meter_mode == SYS_METER_OFF) {
+		if (mode_changed) {
+			lv_label_set_static_text(lbl_meter, "");
+		}
+		return;
+	}
+	
+	main_screen_draw_meter(&roi);
+	
+	if (!lepton_stats_get_frame(lepP, &stats)) return;
+	statP = &stats.stats[LEP_STATS_METER];
+	if (!statP->valid || (memcmp(&statP->roi, &roi, sizeof(sys_lep_roi_t)) != 0)) return;
+	
+	if (mode_changed || (statP->max != prev_meter_max) || (statP->mean != prev_meter_mean)) {
+		if (gui_st.meter_mode == SYS_METER_SPOT) {
+			sprintf(meter_buf, "%1.1f C", ((int32_t) statP->mean - 27315) / 100.0);
+		} else {
+			sprintf(meter_buf, "%1.1f/%1.1f C", ((int32_t) statP->max - 27315) / 100.0,
+			        ((int32_t) statP->mean - 27315) / 100.0);
+		}
+		lv_label_set_static_text(lbl_meter, meter_buf);
+		prev_meter_max = statP->max;
+		prev_meter_mean = statP->mean;
+	}
+}
+
+
+/**
+ * Load roiP with the meter region around the meter position, kept inside the image.
+ * The region is empty when the meter is off.
+ */
+static void main_screen_get_meter_roi(sys_lep_roi_t* roiP)
+{
+	int x, y, w, h;
+	
+	if (gui_st.meter_mode == SYS_METER_SPOT) {
+		w = GUI_METER_SPOT_SIZE;
+		h = GUI_METER_SPOT_SIZE;
+	} else if (gui_st.meter_mode == SYS_METER_BOX) {
+		w = GUI_METER_BOX_W;
+		h = GUI_METER_BOX_H;
+	} else {
+		memset(roiP, 0, sizeof(sys_lep_roi_t));
+		return;
+	}
+	
+	x = meter_x - w/2;
+	y = meter_y - h/2;
+	if (x < 0) x = 0;
+	if (x > (LEP_IMG_WIDTH - w)) x = LEP_IMG_WIDTH - w;
+	if (y < 0) y = 0;
+	if (y > (LEP_IMG_HEIGHT - h)) y = LEP_IMG_HEIGHT - h;
+	
+	roiP->x = x;
+	roiP->y = y;
+	roiP->w = w;
+	roiP->h = h;
+}
+
+
+/**
+ * Outline the meter region in the Lepton display buffer, leaving the pixels measured
+ * visible.  The spot also gets crosshair arms so it can be found in a busy image.
+ */
+static void main_screen_draw_meter(const sys_lep_roi_t* roiP)
+{
+	int x1 = roiP->x - 1;
+	int x2 = roiP->x + roiP->w;
+	int y1 = roiP->y - 1;
+	int y2 = roiP->y + roiP->h;
+	int cx = roiP->x + roiP->w/2;
+	int cy = roiP->y + roiP->h/2;
+	
+	main_screen_meter_hline(x1, x2, y1);
+	main_screen_meter_hline(x1, x2, y2);
+	main_screen_meter_vline(x1, y1, y2);
+	main_screen_meter_vline(x2, y1, y2);
+	
+	if (gui_st.meter_mode == SYS_METER_SPOT) {
+		main_screen_meter_hline(x1 - GUI_METER_ARM_LEN, x1, cy);
+		main_screen_meter_hline(x2, x2 + GUI_METER_ARM_LEN, cy);
+		main_screen_meter_vline(cx, y1 - GUI_METER_ARM_LEN, y1);
+		main_screen_meter_vline(cx, y2, y2 + GUI_METER_ARM_LEN);
+	}
+}
+
+
+/**
+ * Draw meter marker lines [x1, x2] or [y1, y2], clipped to the Lepton display buffer
+ */
+static void main_screen_meter_hline(int x1, int x2, int y)
+{
+	uint16_t* ptr;
+	
+	if ((y < 0) || (y >= LEP_IMG_HEIGHT)) return;
+	if (x1 < 0) x1 = 0;
+	if (x2 >= LEP_IMG_WIDTH) x2 = LEP_IMG_WIDTH - 1;
+	
+	ptr = gui_lep_bufferP + y * LEP_IMG_WIDTH + x1;
+	while (x1++ <= x2) {
+		*ptr++ = GUI_SWAP565_WHITE;
+	}
+}
+
+
+static void main_screen_meter_vline(int x, int y1, int y2)
+{
+	uint16_t* ptr;
+	
+	if ((x < 0) || (x >= LEP_IMG_WIDTH)) return;
+	if (y1 < 0) y1 = 0;
+	if (y2 >= LEP_IMG_HEIGHT) y2 = LEP_IMG_HEIGHT - 1;
+	
+	ptr = gui_lep_bufferP + y1 * LEP_IMG_WIDTH + x;
+	while (y1++ <= y2) {
+		*ptr = GUI_SWAP565_WHITE;
+		ptr += LEP_IMG_WIDTH;
+	}
+}
+
+
+/**
+ * Palette map lepP into gui_lep_bufferP, fused with the ArduCAM image if enabled
+ */
+static void main_screen_render_lep(lep_buffer_t* lepP)
+{
+	gui_screen_main_render_lep_buffer(lepP, gui_lep_bufferP);
+
+	// Combine the ArduCAM image with the palette mapped Lepton image if enabled
+	if (gui_st.fusion_mode != SYS_FUSION_OFF) {
+		main_screen_fuse_images();
+	}
+}
+
+
+/**
+ * Set up the palette mapping of lepP's values using the display AGC mode.  Returns false
+ * for a uniform scene, which is mapped (through the lookup table) to the first palette
+ * entry.
+ */
+static bool main_screen_lep_map_setup(lep_buffer_t* lepP)
+{
+	uint32_t t32;
+	uint32_t diff;
+	uint32_t scale;
+	uint16_t min;
+	uint16_t* ptr;
+	uint16_t* endP;
+	
+	ptr = lepP->lep_bufferP;
+	endP = ptr + LEP_NUM_PIXELS;
+	min = lepP->lep_min_val;
+	diff = lepP->lep_max_val - min;
+	
+	lep_map_srcP = ptr;
+	lep_map_min = min;
+	lep_map_diff = diff;
+	lep_map_lut_shift = 0;
+	lep_map_lut_limit = diff;
+	
+	if (diff == 0) {
+		lep_pixel_lut[0] = PALLETTE_LOOKUP(0);
+		lep_map_method = GUI_LEP_MAP_LUT;
+		if (gui_st.iso_mode != SYS_ISO_OFF) {
+			main_screen_lep_iso_lut(lepP);
+		}
+		return false;
+	}
+	
+	// 16.16 fixed-point reciprocal replaces the per-pixel divide
+	scale = (255 << 16) / diff;
+	lep_map_scale = scale;
+	
+	if (gui_st.lep_agc_mode != SYS_LEP_AGC_LINEAR) {
+		// Histogram the frame in display intensity bins, map the bins to pixels based
+		// on the histogram and then convert each pixel through the map
+		memset(lep_agc_hist, 0, sizeof(lep_agc_hist));
+		while (ptr < endP) {
+			t32 = ((uint32_t)(*ptr++ - min) * scale) >> 16;
+			lep_agc_hist[(t32 > 255) ? 255 : t32]++;
+		}
+		
+		main_screen_lep_agc_map(gui_st.lep_agc_mode);
+		lep_map_method = GUI_LEP_MAP_AGC;
+	} else if (diff < GUI_LEP_LUT_LEN) {
+		// Scale each possible value once so each pixel is a single lookup
+		for (t32=0; t32<=diff; t32++) {
+			lep_pixel_lut[t32] = PALLETTE_LOOKUP((t32 * 255) / diff);
+		}
+		lep_map_method = GUI_LEP_MAP_LUT;
+	} else {
+		lep_map_method = GUI_LEP_MAP_SCALE;
+	}
+	
+	// Fold the isotherm into a lookup table so it costs nothing extra per pixel
+	if (gui_st.iso_mode != SYS_ISO_OFF) {
+		main_screen_lep_iso_lut(lepP);
+	}
+	
+	return true;
+}
+
+
+/**
+ * Compute the display AGC histogram bin to pixel map from the current frame's histogram
+ */
+static void main_screen_lep_agc_map(uint8_t mode)
+{
+	int i;
+	int lo, hi;
+	uint32_t clip;
+	uint32_t cum;
+	uint32_t h;
+	uint32_t total;
+	uint32_t t32;
+	
+	if (mode == SYS_LEP_AGC_CLIP) {
+		// Find the bins where the coldest and hottest pixels are clipped and scale linearly
+		// between them
+		clip = (LEP_NUM_PIXELS * GUI_LEP_AGC_CLIP_PERMIL) / 1000;
+		cum = 0;
+		for (lo=0; lo<(GUI_LEP_AGC_BINS-1); lo++) {
+			cum += lep_agc_hist[lo];
+			if (cum > clip) break;
+		}
+		cum = 0;
+		for (hi=(GUI_LEP_AGC_BINS-1); hi>0; hi--) {
+			cum += lep_agc_hist[hi];
+			if (cum > clip) break;
+		}
+		for (i=0; i<GUI_LEP_AGC_BINS; i++) {
+			if (i <= lo) {
+				t32 = 0;
+			} else if (i >= hi) {
+				t32 = 255;
+			} else {
+				t32 = ((i - lo) * 255) / (hi - lo);
+			}
+			lep_agc_map[i] = PALLETTE_LOOKUP(t32);
+		}
+	} else {
+		// Equalize: each bin's intensity is the fraction of pixels colder than the middle of
+		// the bin.  Plateau equalization limits each bin's count first.
+		total = 0;
+		for (i=0; i<GUI_LEP_AGC_BINS; i++) {
+			h = lep_agc_hist[i];
+			if ((mode == SYS_LEP_AGC_PLATEAU) && (h > GUI_LEP_AGC_PLATEAU)) h = GUI_LEP_AGC_PLATEAU;
+			total += h;
+		}
+		cum = 0;
+		for (i=0; i<GUI_LEP_AGC_BINS; i++) {
+			h = lep_agc_hist[i];
+			if ((mode == SYS_LEP_AGC_PLATEAU) && (h > GUI_LEP_AGC_PLATEAU)) h = GUI_LEP_AGC_PLATEAU;
+			t32 = ((2 * cum + h) * 255) / (2 * total);
+			lep_agc_map[i] = PALLETTE_LOOKUP(t32);
+			cum += h;
+		}
+	}
+}
+
+
+/**
+ * Convert the palette mapping set up for the current frame to a lookup table with the
+ * entries for values in the isotherm set to the isotherm color.  A frame whose span
+ * doesn't fit in the table is mapped in steps of the smallest power of 2 that does, each
+ * step taking the color of its lowest value, so the isotherm edge is accurate to within
+ * a step (2 lepton values for spans up to 20 K at 0.01 K resolution).
+ */
+static void main_screen_lep_iso_lut(lep_buffer_t* lepP)
+{
+	uint32_t lo, hi;
+	uint32_t t32, v, i;
+	uint32_t tlin;
+	uint16_t color;
+	int shift;
+	
+	// Isotherm in lepton values (values on a threshold are in the isotherm)
+	tlin = (uint32_t) lepton_get_tlin_scale(lepP);
+	switch (gui_st.iso_mode) {
+		case SYS_ISO_ABOVE:
+			lo = (gui_st.iso_high + tlin - 1) / tlin;
+			hi = 0xFFFFFFFF;
+			break;
+		case SYS_ISO_BELOW:
+			lo = 0;
+			hi = gui_st.iso_low / tlin;
+			break;
+		default:
+			lo = (gui_st.iso_low + tlin - 1) / tlin;
+			hi = gui_st.iso_high / tlin;
+	}
+	color = lep_iso_colors[gui_st.iso_color];
+	
+	shift = 0;
+	while ((lep_map_diff >> shift) >= GUI_LEP_LUT_LEN) shift++;
+	
+	// The linear lookup table (never stepped) already holds the palette entries
+	for (t32=0; t32<=(lep_map_diff >> shift); t32++) {
+		v = t32 << shift;
+		if (((lep_map_min + v) >= lo) && ((lep_map_min + v) <= hi)) {
+			lep_pixel_lut[t32] = color;
+		} else if (lep_map_method != GUI_LEP_MAP_LUT) {
+			i = (v * lep_map_scale) >> 16;
+			if (i > 255) i = 255;
+			if (lep_map_method == GUI_LEP_MAP_AGC) {
+				lep_pixel_lut[t32] = lep_agc_map[i];
+			} else {
+				lep_pixel_lut[t32] = PALLETTE_LOOKUP(i);
+			}
+		}
+	}
+	
+	lep_map_lut_shift = shift;
+	lep_map_lut_limit = lep_map_diff >> shift;
+	lep_map_method = GUI_LEP_MAP_LUT;
+}
+
+
+/**
+ * Convert lepton rows [start, end) of the current frame to palette pixels in the gui
+ * lepton display buffer using the method set up for the frame
+ */
+static void SYS_HOT_IRAM_ATTR main_screen_lep_map_rows(void* argP, int start, int end)
+{
+	const uint16_t* ptr = lep_map_srcP + start * LEP_WIDTH;
+	const uint16_t* endP = lep_map_srcP + end * LEP_WIDTH;
+	uint16_t* ptr2 = lep_map_dstP + start * LEP_WIDTH;
+	uint16_t min = lep_map_min;
+	uint32_t limit = lep_map_lut_limit;
+	uint32_t scale = lep_map_scale;
+	int shift = lep_map_lut_shift;
+	uint32_t t32;
+	uint8_t t8;
+	
+	if (lep_map_method == GUI_LEP_MAP_AGC) {
+		while (ptr < endP) {
+			t32 = ((uint32_t)(*ptr++ - min) * scale) >> 16;
+			*ptr2++ = lep_agc_map[(t32 > 255) ? 255 : t32];
+		}
+	} else if (lep_map_method == GUI_LEP_MAP_LUT) {
+		while (ptr < endP) {
+			t32 = (uint32_t)(*ptr++ - min) >> shift;
+			*ptr2++ = lep_pixel_lut[(t32 > limit) ? limit : t32];
+		}
+	} else {
+		while (ptr < endP) {
+			t32 = ((uint32_t)(*ptr++ - min) * scale) >> 16;
+			t8 = (t32 > 255) ? 255 : (uint8_t) t32;
+			*ptr2++ = PALLETTE_LOOKUP(t8);
+		}
+	}
+}
+
+
+/**
+ * Render full-screen rows [start, end) of the block in argP (a lep_full_block_t).  Each
+ * output pixel sits a quarter of a source pixel from its nearest source pixel so the
+ * bilinear weights are always 3/4 and 1/4 in each direction: the two source rows are
+ * combined (x4) and then adjacent columns (x16), all in integer arithmetic on the
+ * values' offsets from the frame minimum.
+ */
+static void SYS_HOT_IRAM_ATTR main_screen_lep_full_rows(void* argP, int start, int end)
+{
+	lep_full_block_t* blockP = (lep_full_block_t*) argP;
+	const uint16_t* r0P;
+	const uint16_t* r1P;
+	const uint16_t* tableP;
+	uint16_t* dstP;
+	uint32_t base;
+	uint32_t limit;
+	uint32_t scale;
+	uint32_t prev, cur, next;
+	int sy, ny;
+	int x, y;
+	
+	// Palette mapping set up for the frame.  A stepped lookup table is indexed through
+	// the scale (a power of 2 scale is an exact shift).
+	if (lep_map_method == GUI_LEP_MAP_LUT) {
+		tableP = lep_pixel_lut;
+		limit = lep_map_lut_limit;
+		scale = (lep_map_lut_shift != 0) ? (0x10000 >> lep_map_lut_shift) : 0;
+	} else {
+		tableP = (lep_map_method == GUI_LEP_MAP_AGC) ? lep_agc_map : palette16;
+		limit = 255;
+		scale = lep_map_scale;
+	}
+	base = 4 * (uint32_t) lep_map_min;
+	
+	for (y=blockP->y+start; y<(blockP->y+end); y++) {
+		// Nearest source row and the neighbor on this output row's side of it
+		sy = y >> 1;
+		if (y & 1) {
+			ny = (sy < (LEP_IMG_HEIGHT-1)) ? sy + 1 : sy;
+		} else {
+			ny = (sy > 0) ? sy - 1 : sy;
+		}
+		r0P = lep_map_srcP + sy * LEP_IMG_WIDTH;
+		r1P = lep_map_srcP + ny * LEP_IMG_WIDTH;
+		dstP = blockP->bufP + (y - blockP->y) * LEP_FULL_IMG_WIDTH;
+		
+		// Slide a window of vertically interpolated columns across the row
+		cur = 3 * r0P[0] + r1P[0] - base;
+		prev = cur;
+		for (x=0; x<LEP_IMG_WIDTH; x++) {
+			next = (x < (LEP_IMG_WIDTH-1)) ? (3 * r0P[x+1] + r1P[x+1] - base) : cur;
+			*dstP++ = main_screen_lep_full_pixel((3 * cur + prev + 8) >> 4, tableP, limit, scale);
+			*dstP++ = main_screen_lep_full_pixel((3 * cur + next + 8) >> 4, tableP, limit, scale);
+			prev = cur;
+			cur = next;
+		}
+	}
+}
+
+
+/**
+ * Map an interpolated value's offset from the frame minimum to a pixel: through the
+ * lookup table directly or scaled to an intensity for the AGC map or palette
+ */
+static inline uint16_t main_screen_lep_full_pixel(uint32_t t, const uint16_t* tableP, uint32_t limit, uint32_t scale)
+{
+	if (scale != 0) t = (t * scale) >> 16;
+	return tableP[(t > limit) ? limit : t];
+}
+
+
+/**
+ * Display an updated image buffer.  The images don't overlap any other objects so
+ * they are written directly to the LCD, skipping LittleVGL's redraw of the area, unless
+ * a message box is covering the screen.  The image object still describes the buffer
+ * for when LittleVGL redraws the whole screen.
+ */
+static void main_screen_draw_image(lv_obj_t* img, const uint16_t* bufP)
+{
+#ifdef GUI_DIRECT_IMG_WRITE
+	lv_area_t area;
+	
+	if (main_screen_active && !gui_message_box_displayed()) {
+		lv_obj_get_coords(img, &area);
+		ili9341_write_area(&area, bufP);
+		return;
+	}
+#endif
+	
+	lv_obj_invalidate(img);
+}
+
+
+/**
+ * Combine the displayed ArduCAM image with the palette mapped Lepton image in the
+ * Lepton display buffer, either by alpha blending or by drawing the ArduCAM image's
+ * edges over the Lepton image.  Lepton pixels outside the ArduCAM image are unchanged.
+ */
+static void main_screen_fuse_images()
+{
+	int x, y;
+	int cx, cy;
+	int xl, xr;
+	int e;
+	uint32_t a;
+	uint16_t* lepP;
+	const uint16_t* camP;
+	const uint16_t* camUpP;
+	const uint16_t* camDnP;
+	
+	main_screen_fusion_map();
+	
+	lepP = gui_lep_bufferP;
+	if (gui_st.fusion_mode == SYS_FUSION_BLEND) {
+		// Lepton weight in 1/32 steps
+		a = (gui_st.fusion_alpha * 32 + 50) / 100;
+		for (y=0; y<LEP_IMG_HEIGHT; y++) {
+			if (fusion_row[y] >= 0) {
+				camP = gui_cam_bufferP + fusion_row[y] * CAM_IMG_WIDTH;
+				for (x=0; x<LEP_IMG_WIDTH; x++) {
+					cx = fusion_col[x];
+					if (cx >= 0) {
+						lepP[x] = main_screen_blend(lepP[x], camP[cx], a);
+					}
+				}
+			}
+			lepP += LEP_IMG_WIDTH;
+		}
+	} else {
+		for (y=0; y<LEP_IMG_HEIGHT; y++) {
+			cy = fusion_row[y];
+			if (cy >= 0) {
+				camP = gui_cam_bufferP + cy * CAM_IMG_WIDTH;
+				camUpP = (cy > 0) ? camP - CAM_IMG_WIDTH : camP;
+				camDnP = (cy < CAM_IMG_HEIGHT-1) ? camP + CAM_IMG_WIDTH : camP;
+				for (x=0; x<LEP_IMG_WIDTH; x++) {
+					cx = fusion_col[x];
+					if (cx < 0) continue;
+					
+					xl = (cx > 0) ? cx - 1 : cx;
+					xr = (cx < CAM_IMG_WIDTH-1) ? cx + 1 : cx;
+					e = abs(GUI_SWAP565_GREEN(camP[xr]) - GUI_SWAP565_GREEN(camP[xl])) +
+					    abs(GUI_SWAP565_GREEN(camDnP[cx]) - GUI_SWAP565_GREEN(camUpP[cx]));
+					if (e > GUI_FUSION_EDGE_THRESH) {
+						// Draw the edge in a color that contrasts with the Lepton pixel
+						a = (e - GUI_FUSION_EDGE_THRESH) * GUI_FUSION_EDGE_GAIN;
+						if (a > 32) a = 32;
+						lepP[x] = main_screen_blend((GUI_SWAP565_GREEN(lepP[x]) > 31) ? GUI_SWAP565_BLACK : GUI_SWAP565_WHITE,
+						                            lepP[x], a);
+					}
+				}
+			}
+			lepP += LEP_IMG_WIDTH;
+		}
+	}
+}
+
+
+/**
+ * Compute the ArduCAM display pixel under each Lepton display pixel from the parallax
+ * offset and scale if they have changed since the tables were built
+ */
+static void main_screen_fusion_map()
+{
+	int i;
+	int t;
+	int dx, dy;
+	
+	dx = main_screen_fusion_offset(gui_st.fusion_offset_x);
+	dy = main_screen_fusion_offset(gui_st.fusion_offset_y);
+	if (fusion_map_valid && (fusion_map_scale == gui_st.fusion_scale) &&
+	    (fusion_map_dx == dx) && (fusion_map_dy == dy))
+	{
+		return;
+	}
+	fusion_map_scale = gui_st.fusion_scale;
+	fusion_map_dx = dx;
+	fusion_map_dy = dy;
+	fusion_map_valid = true;
+	
+	for (i=0; i<LEP_IMG_WIDTH; i++) {
+		t = (CAM_IMG_WIDTH / 2) + dx +
+		    ((i - (LEP_IMG_WIDTH / 2)) * (CAM_IMG_WIDTH * gui_st.fusion_scale)) / (LEP_IMG_WIDTH * 100);
+		fusion_col[i] = ((t >= 0) && (t < CAM_IMG_WIDTH)) ? t : -1;
+	}
+	
+	for (i=0; i<LEP_IMG_HEIGHT; i++) {
+		t = (CAM_IMG_HEIGHT / 2) + dy +
+		    ((i - (LEP_IMG_HEIGHT / 2)) * (CAM_IMG_HEIGHT * gui_st.fusion_scale)) / (LEP_IMG_HEIGHT * 100);
+		fusion_row[i] = ((t >= 0) && (t < CAM_IMG_HEIGHT)) ? t : -1;
+	}
+}
+
+
+/**
+ * Return a calibrated offset scaled from the calibration distance to the subject
+ * distance, rounded to the nearest ArduCAM display pixel.  The offset is treated as
+ * all parallax (the cameras pointing the same way) so it varies inversely with distance.
+ * It is used unchanged unless both distances are set.
+ */
+static int main_screen_fusion_offset(int offset)
+{
+	int32_t n;
+	int32_t d = gui_st.fusion_dist;
+	
+	if ((gui_st.fusion_cal_dist == 0) || (d == 0)) return offset;
+	
+	n = offset * (int32_t) gui_st.fusion_cal_dist;
+	return (n + ((n < 0) ? -(d / 2) : (d / 2))) / d;
+}
+
+
+/**
+ * Blend two swapped RGB565 pixels: fg * a/32 + bg * (32-a)/32.  The pixels are spread
+ * out to 00000GGGGGG00000RRRRR000000BBBBB so all three channels are blended with one
+ * multiply.
+ */
+static inline uint16_t main_screen_blend(uint16_t fg, uint16_t bg, uint32_t a)
+{
+	uint32_t f, b;
+	
+	fg = __builtin_bswap16(fg);
+	bg = __builtin_bswap16(bg);
+	f = (fg | ((uint32_t) fg << 16)) & 0x07E0F81F;
+	b = (bg | ((uint32_t) bg << 16)) & 0x07E0F81F;
+	b = ((((f - b) * a) >> 5) + b) & 0x07E0F81F;
+	return __builtin_bswap16((uint16_t) (b | (b >> 16)));
+}
+
+
+static void img_lepton_callback(lv_obj_t * img, lv_event_t event)
+{
+	lv_area_t area;
+	
+	if (event == LV_EVENT_PRESSED) {
+		lv_indev_get_point(lv_indev_get_act(), &meter_press_point);
+	} else if (event == LV_EVENT_SHORT_CLICKED) {
+		if (gui_st.meter_mode != SYS_METER_OFF) {
+			// Move the meter to the touched pixel
+			lv_obj_get_coords(img, &area);
+			meter_x = meter_press_point.x - area.x1;
+			meter_y = meter_press_point.y - area.y1;
+		} else {
+			// Cycle through the fusion modes
+			if (++gui_st.fusion_mode >= SYS_FUSION_NUM) {
+				gui_st.fusion_mode = SYS_FUSION_OFF;
+			}
+			ps_set_gui_state(&gui_st);
+		}
+	} else if (event == LV_EVENT_LONG_PRESSED) {
+		gui_set_screen(GUI_SCREEN_THERMAL);
+	}
+}
+
+
 static void btn_record_callback(lv_obj_t * btn, lv_event_t event)
 {
-	if (event == LV_EVENT_CLICKED) {
-		// Let the app_task know the button was pressed since it handles the system mode
-		xTaskNotify(task_handle_app, APP_NOTIFY_RECORD_BTN_MASK, eSetBits);
+	if (event == LV_EVENT_PRESSED) {
+		// Let the app_task know the button was pressed since it handles the system mode.
+		// This is sent on the press, instead of the release, so it acts right away.
+		gui_task_send_action(APP_NOTIFY_RECORD_BTN_MASK);
 	}
 }
 
@@ -587,8 +1468,8 @@ static void btn_settings_callback(lv_obj_t * btn, lv_event_t event)
 
 static void btn_poweroff_callback(lv_obj_t * btn, lv_event_t event)
 {
-	if (event == LV_EVENT_CLICKED) {
+	if (event == LV_EVENT_PRESSED) {
 		// Notify app_task to power down
-		xTaskNotify(task_handle_app, APP_NOTIFY_SHUTDOWN_MASK, eSetBits);
+		gui_task_send_action(APP_NOTIFY_SHUTDOWN_MASK);
 	}
 }
@@ -0,0 +1,484 @@
+/*
+ * Playback GUI screen related functions, callbacks and event handlers
+ *
+ * Plays a recorded session from the Micro-SD Card side by side like the main screen.
+ * play_task reads the images ahead of the display.  Each frame's Lepton image is
+ * palette mapped here and its jpeg image decoded by render_task (the jpeg decoder is
+ * only used from render_task) before both are drawn.  A slider scrubs through the
+ * session's index.  Sessions recorded with a separate AVI file only show their Lepton
+ * images.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "gui_screen_playback.h"
+#include "gui_screen_main.h"
+#include "gui_task.h"
+#include "gui_utilities.h"
+#include "play_task.h"
+#include "render_task.h"
+#include "ds3232.h"
+#include "ili9341.h"
+#include "render_jpg.h"
+#include "sys_utilities.h"
+#include "time_utilities.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lv_conf.h"
+#include <stdio.h>
+#include <string.h>
+
+
+
+//
+// Playback GUI Screen variables
+//
+static const char* TAG = "gui_playback";
+
+// LVGL objects
+static lv_obj_t* playback_screen;
+static lv_obj_t* lbl_session;
+static lv_obj_t* lbl_position;
+static lv_obj_t* lbl_frame_time;
+static lv_obj_t* btn_playback_exit;
+static lv_obj_t* btn_playback_exit_label;
+static lv_img_dsc_t play_cam_img_dsc;
+static lv_obj_t* img_play_cam;
+static lv_img_dsc_t play_lep_img_dsc;
+static lv_obj_t* img_play_lep;
+static lv_obj_t* sld_position;
+static lv_obj_t* btn_prev_session;
+static lv_obj_t* btn_prev_session_label;
+static lv_obj_t* btn_play;
+static lv_obj_t* btn_play_label;
+static lv_obj_t* btn_next_session;
+static lv_obj_t* btn_next_session_label;
+
+// Image buffers (external RAM, allocated once and kept when the screen is deleted)
+static uint16_t* play_cam_bufferP = NULL;
+static uint16_t* play_lep_bufferP = NULL;
+
+// Screen state
+static bool playback_screen_active = false;
+static bool playback_playing;
+static bool playback_show_next;             // Show the next frame even while paused
+static bool playback_at_end;                // The session's last frame is displayed
+static int64_t playback_prev_frame_usec;
+
+// Frame being displayed (held from play_task while render_task decodes its jpeg)
+static play_frame_t* playback_frameP = NULL;
+
+// Displayed object state to reduce redraws
+static int prev_state;
+static char prev_session[SESSION_DIR_NAME_LEN];
+
+// Statically allocated for lv_label_set_static_text
+static char session_buf[SESSION_DIR_NAME_LEN + 16];
+static char position_buf[24];
+static char frame_time_buf[26];
+
+
+
+//
+// Playback GUI Screen internal function forward declarations
+//
+static void playback_screen_update_info();
+static void playback_screen_set_playing(bool en);
+static void playback_screen_clear_images();
+static void playback_screen_draw_image(lv_obj_t* img, const uint16_t* bufP);
+static void btn_exit_callback(lv_obj_t * btn, lv_event_t event);
+static void btn_prev_session_callback(lv_obj_t * btn, lv_event_t event);
+static void btn_play_callback(lv_obj_t * btn, lv_event_t event);
+static void btn_next_session_callback(lv_obj_t * btn, lv_event_t event);
+static void sld_position_callback(lv_obj_t * sld, lv_event_t event);
+
+
+
+//
+// Playback GUI Screen API
+//
+
+/**
+ * Create the playback screen, its graphical objects and link necessary callbacks
+ */
+lv_obj_t* gui_screen_playback_create()
+{
+	if (play_cam_bufferP == NULL) {
+		play_cam_bufferP = heap_caps_malloc(CAM_IMG_PIXELS*2, MALLOC_CAP_SPIRAM);
+		play_lep_bufferP = heap_caps_malloc(LEP_IMG_PIXELS*2, MALLOC_CAP_SPIRAM);
+		if ((play_cam_bufferP == NULL) || (play_lep_bufferP == NULL)) {
+			ESP_LOGE(TAG, "Could not allocate image buffers");
+		}
+	}
+	
+	playback_screen = lv_obj_create(NULL, NULL);
+	lv_obj_set_size(playback_screen, LV_HOR_RES_MAX, LV_VER_RES_MAX);
+	lv_obj_set_style(playback_screen, &lv_style_plain_color);
+	
+	// Create the graphical elements for this screen
+	//
+	// Session and position
+	lbl_session = lv_label_create(playback_screen, NULL);
+	lv_label_set_long_mode(lbl_session, LV_LABEL_LONG_CROP);
+	lv_obj_set_pos(lbl_session, 10, 5);
+	lv_obj_set_width(lbl_session, 255);
+	lv_label_set_align(lbl_session, LV_LABEL_ALIGN_CENTER);
+	lv_label_set_static_text(lbl_session, "");
+	
+	lbl_position = lv_label_create(playback_screen, NULL);
+	lv_label_set_long_mode(lbl_position, LV_LABEL_LONG_CROP);
+	lv_obj_set_pos(lbl_position, 10, 22);
+	lv_obj_set_width(lbl_position, 255);
+	lv_label_set_align(lbl_position, LV_LABEL_ALIGN_CENTER);
+	lv_label_set_static_text(lbl_position, "");
+	
+	// Exit button
+	btn_playback_exit = lv_btn_create(playback_screen, NULL);
+	lv_obj_set_pos(btn_playback_exit, 275, 5);
+	lv_obj_set_size(btn_playback_exit, 40, 35);
+	lv_obj_set_event_cb(btn_playback_exit, btn_exit_callback);
+	btn_playback_exit_label = lv_label_create(btn_playback_exit, NULL);
+	lv_label_set_static_text(btn_playback_exit_label, LV_SYMBOL_CLOSE);
+	
+	// Arducam image data structure and area
+	play_cam_img_dsc.header.always_zero = 0;
+	play_cam_img_dsc.header.cf = LV_IMG_CF_TRUE_COLOR;
+	play_cam_img_dsc.header.w = CAM_IMG_WIDTH;
+	play_cam_img_dsc.header.h = CAM_IMG_HEIGHT;
+	play_cam_img_dsc.data_size = CAM_IMG_WIDTH * CAM_IMG_HEIGHT * 2;
+	play_cam_img_dsc.data = (uint8_t*) play_cam_bufferP;
+	
+	img_play_cam = lv_img_create(playback_screen, NULL);
+	lv_img_set_src(img_play_cam, &play_cam_img_dsc);
+	lv_obj_set_pos(img_play_cam, 0, 45);
+	
+	// Lepton image data structure and area
+	play_lep_img_dsc.header.always_zero = 0;
+	play_lep_img_dsc.header.cf = LV_IMG_CF_TRUE_COLOR;
+	play_lep_img_dsc.header.w = LEP_IMG_WIDTH;
+	play_lep_img_dsc.header.h = LEP_IMG_HEIGHT;
+	play_lep_img_dsc.data_size = LEP_IMG_WIDTH * LEP_IMG_HEIGHT * 2;
+	play_lep_img_dsc.data = (uint8_t*) play_lep_bufferP;
+	
+	img_play_lep = lv_img_create(playback_screen, NULL);
+	lv_img_set_src(img_play_lep, &play_lep_img_dsc);
+	lv_obj_set_pos(img_play_lep, 160, 45);
+	
+	// Frame capture time
+	lbl_frame_time = lv_label_create(playback_screen, NULL);
+	lv_label_set_long_mode(lbl_frame_time, LV_LABEL_LONG_CROP);
+	lv_obj_set_pos(lbl_frame_time, 10, 170);
+	lv_obj_set_width(lbl_frame_time, 300);
+	lv_label_set_align(lbl_frame_time, LV_LABEL_ALIGN_CENTER);
+	lv_label_set_static_text(lbl_frame_time, "");
+	
+	// Scrub slider
+	sld_position = lv_slider_create(playback_screen, NULL);
+	lv_obj_set_pos(sld_position, 20, 192);
+	lv_obj_set_size(sld_position, 280, 12);
+	lv_slider_set_range(sld_position, 0, GUI_PLAY_SLIDER_STEPS);
+	lv_obj_set_event_cb(sld_position, sld_position_callback);
+	
+	// Session and play controls
+	btn_prev_session = lv_btn_create(playback_screen, NULL);
+	lv_obj_set_pos(btn_prev_session, 20, 210);
+	lv_obj_set_size(btn_prev_session, 70, 28);
+	lv_obj_set_event_cb(btn_prev_session, btn_prev_session_callback);
+	btn_prev_session_label = lv_label_create(btn_prev_session, NULL);
+	lv_label_set_static_text(btn_prev_session_label, LV_SYMBOL_PREV);
+	
+	btn_play = lv_btn_create(playback_screen, NULL);
+	lv_obj_set_pos(btn_play, 125, 210);
+	lv_obj_set_size(btn_play, 70, 28);
+	lv_obj_set_event_cb(btn_play, btn_play_callback);
+	btn_play_label = lv_label_create(btn_play, NULL);
+	lv_label_set_static_text(btn_play_label, LV_SYMBOL_PAUSE);
+	
+	btn_next_session = lv_btn_create(playback_screen, NULL);
+	lv_obj_set_pos(btn_next_session, 230, 210);
+	lv_obj_set_size(btn_next_session, 70, 28);
+	lv_obj_set_event_cb(btn_next_session, btn_next_session_callback);
+	btn_next_session_label = lv_label_create(btn_next_session, NULL);
+	lv_label_set_static_text(btn_next_session_label, LV_SYMBOL_NEXT);
+	
+	return playback_screen;
+}
+
+
+/**
+ * Start playing the newest session when the screen is displayed and stop reading it
+ * when the screen is left
+ */
+void gui_screen_playback_set_active(bool en)
+{
+	if (en && !playback_screen_active) {
+		prev_state = -1;
+		prev_session[0] = 0;
+		playback_at_end = false;
+		playback_screen_clear_images();
+		playback_screen_set_playing(true);
+		play_task_open(PLAY_OPEN_NEWEST);
+	} else if (!en && playback_screen_active) {
+		play_task_close();
+	}
+	
+	playback_screen_active = en;
+}
+
+
+/**
+ * Called by gui_task each event evaluation while the screen is displayed.  Starts
+ * displaying the next frame every PLAY_FRAME_MSEC while playing.
+ */
+void gui_screen_playback_update()
+{
+	int64_t now;
+	
+	if (!playback_screen_active) return;
+	
+	playback_screen_update_info();
+	
+	// Wait for the current frame to finish
+	if (playback_frameP != NULL) return;
+	if (!playback_playing && !playback_show_next) return;
+	if ((play_cam_bufferP == NULL) || (play_lep_bufferP == NULL)) return;
+	
+	now = esp_timer_get_time();
+	if (playback_playing && ((now - playback_prev_frame_usec) < (PLAY_FRAME_MSEC * 1000))) return;
+	
+	playback_frameP = play_task_get_frame();
+	if (playback_frameP == NULL) return;
+	playback_prev_frame_usec = now;
+	playback_show_next = false;
+	
+	if (playback_frameP->has_lep) {
+		gui_screen_main_render_lep_buffer(&playback_frameP->lep, play_lep_bufferP);
+	} else {
+		memset(play_lep_bufferP, 0, LEP_IMG_PIXELS*2);
+	}
+	
+	if (playback_frameP->jpeg_len != 0) {
+		// render_task decodes the jpeg image and lets gui_task know when it's done
+		xTaskNotify(task_handle_render, RENDER_NOTIFY_PLAY_FRAME_MASK, eSetBits);
+	} else {
+		gui_screen_playback_frame_done(false);
+	}
+}
+
+
+/**
+ * Decode the current frame's jpeg image into the ArduCAM image buffer.  Called by
+ * render_task.
+ */
+bool gui_screen_playback_render_cam_image()
+{
+	if (playback_frameP == NULL) return false;
+	
+	return (render_jpeg_image((uint8_t*) play_cam_bufferP, playback_frameP->jpegP,
+	                          playback_frameP->jpeg_len, CAM_IMG_WIDTH, CAM_IMG_HEIGHT) == 1);
+}
+
+
+/**
+ * Draw the current frame and release it.  cam_rendered is set if its jpeg image was
+ * decoded.  The frame is released even if the screen has been left.
+ */
+void gui_screen_playback_frame_done(bool cam_rendered)
+{
+	play_info_t info;
+	tmElements_t te;
+	uint32_t pos;
+	
+	if (playback_frameP == NULL) return;
+	
+	if (playback_screen_active) {
+		if (!cam_rendered) {
+			memset(play_cam_bufferP, 0, CAM_IMG_PIXELS*2);
+		}
+		playback_screen_draw_image(img_play_cam, play_cam_bufferP);
+		playback_screen_draw_image(img_play_lep, play_lep_bufferP);
+	
+		play_task_get_info(&info);
+		pos = playback_frameP->pos;
+		sprintf(position_buf, "%u / %u", pos + 1, info.count);
+		lv_label_set_static_text(lbl_position, position_buf);
+	
+		rtc_breakTime((time_t) playback_frameP->epoch_sec, &te);
+		time_get_disp_string(te, frame_time_buf);
+		lv_label_set_static_text(lbl_frame_time, frame_time_buf);
+	
+		if (!lv_slider_is_dragged(sld_position) && (info.count > 1)) {
+			lv_slider_set_value(sld_position, (pos * GUI_PLAY_SLIDER_STEPS) / (info.count - 1), LV_ANIM_OFF);
+		}
+	
+		// Stop at the end of the session
+		playback_at_end = ((pos + 1) >= info.count);
+		if (playback_at_end) {
+			playback_screen_set_playing(false);
+		}
+	}
+	
+	play_task_release_frame(playback_frameP);
+	playback_frameP = NULL;
+}
+
+
+
+//
+// Playback GUI Screen internal functions
+//
+
+/**
+ * Update the session label when play_task opens a session
+ */
+static void playback_screen_update_info()
+{
+	play_info_t info;
+	
+	play_task_get_info(&info);
+	if ((info.state == prev_state) && (strcmp(info.session, prev_session) == 0)) return;
+	
+	prev_state = info.state;
+	strcpy(prev_session, info.session);
+	
+	if (info.state == PLAY_STATE_OPEN) {
+		strcpy(session_buf, info.session);
+		sprintf(position_buf, "%u images", info.count);
+		playback_show_next = true;
+	} else if (info.state == PLAY_STATE_EMPTY) {
+		strcpy(session_buf, (info.session[0] != 0) ? info.session : "No recorded sessions");
+		position_buf[0] = 0;
+		playback_screen_set_playing(false);
+		playback_screen_clear_images();
+	} else {
+		session_buf[0] = 0;
+		position_buf[0] = 0;
+	}
+	frame_time_buf[0] = 0;
+	
+	lv_label_set_static_text(lbl_session, session_buf);
+	lv_label_set_static_text(lbl_position, position_buf);
+	lv_label_set_static_text(lbl_frame_time, frame_time_buf);
+	lv_slider_set_value(sld_position, 0, LV_ANIM_OFF);
+}
+
+
+static void playback_screen_set_playing(bool en)
+{
+	playback_playing = en;
+	lv_label_set_static_text(btn_play_label, en ? LV_SYMBOL_PAUSE : LV_SYMBOL_PLAY);
+}
+
+
+static void playback_screen_clear_images()
+{
+	if ((play_cam_bufferP == NULL) || (play_lep_bufferP == NULL)) return;
+	
+	memset(play_cam_bufferP, 0, CAM_IMG_PIXELS*2);
+	memset(play_lep_bufferP, 0, LEP_IMG_PIXELS*2);
+	lv_obj_invalidate(img_play_cam);
+	lv_obj_invalidate(img_play_lep);
+}
+
+
+/**
+ * Draw an image written directly to the LCD like the main screen's images unless a
+ * message box is covering the screen
+ */
+static void playback_screen_draw_image(lv_obj_t* img, const uint16_t* bufP)
+{
+#ifdef GUI_DIRECT_IMG_WRITE
+	lv_area_t area;
+	
+	if (!gui_message_box_displayed()) {
+		lv_obj_get_coords(img, &area);
+		ili9341_write_area(&area, bufP);
+		return;
+	}
+#endif
+	
+	lv_obj_invalidate(img);
+}
+
+
+static void btn_exit_callback(lv_obj_t * btn, lv_event_t event)
+{
+	if (event == LV_EVENT_CLICKED) {
+		gui_set_screen(GUI_SCREEN_MAIN);
+	}
+}
+
+
+static void btn_prev_session_callback(lv_obj_t * btn, lv_event_t event)
+{
+	if (event == LV_EVENT_CLICKED) {
+		playback_screen_set_playing(true);
+		play_task_open(PLAY_OPEN_OLDER);
+	}
+}
+
+
+static void btn_play_callback(lv_obj_t * btn, lv_event_t event)
+{
+	play_info_t info;
+	
+	if (event == LV_EVENT_CLICKED) {
+		play_task_get_info(&info);
+		if (info.state != PLAY_STATE_OPEN) return;
+	
+		if (!playback_playing && playback_at_end) {
+			// Start again from the beginning
+			play_task_seek(0);
+			playback_at_end = false;
+		}
+		playback_screen_set_playing(!playback_playing);
+	}
+}
+
+
+static void btn_next_session_callback(lv_obj_t * btn, lv_event_t event)
+{
+	if (event == LV_EVENT_CLICKED) {
+		playback_screen_set_playing(true);
+		play_task_open(PLAY_OPEN_NEWER);
+	}
+}
+
+
+/**
+ * Continue from the image under the slider when it is released
+ */
+static void sld_position_callback(lv_obj_t * sld, lv_event_t event)
+{
+	play_info_t info;
+	uint32_t pos;
+	
+	if (event == LV_EVENT_RELEASED) {
+		play_task_get_info(&info);
+		if (info.state != PLAY_STATE_OPEN) return;
+	
+		pos = ((uint32_t) lv_slider_get_value(sld) * (info.count - 1)) / GUI_PLAY_SLIDER_STEPS;
+		play_task_seek(pos);
+		playback_show_next = true;
+		playback_at_end = false;
+	}
+}
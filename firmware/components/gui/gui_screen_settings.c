@@ -22,6 +22,7 @@
 #include "gui_screen_settings.h"
 #include "app_task.h"
 #include "gui_task.h"
+#include "lep_task.h"
 #include "cci.h"
 #include "esp_system.h"
 #include "freertos/FreeRTOS.h"
@@ -32,12 +33,21 @@
 #include "ps_utilities.h"
 #include "sys_utilities.h"
 #include "wifi_utilities.h"
+#include <stdlib.h>
 
 
 
 // Gain Drop-down list
 static const char* dd_gain_mode_list = SYS_GAIN_DD_STRING;
 
+// Lepton display AGC button labels (indexed by SYS_LEP_AGC_xxx)
+static const char* btn_lep_agc_names[SYS_LEP_AGC_NUM] = {
+	"AGC: Linear",
+	"AGC: Clip",
+	"AGC: Equalize",
+	"AGC: Plateau"
+};
+
 
 
 //
@@ -61,6 +71,10 @@ static lv_obj_t* btn_set_wifi;
 static lv_obj_t* btn_set_wifi_label;
 static lv_obj_t* btn_set_time;
 static lv_obj_t* btn_set_time_label;
+static lv_obj_t* btn_lep_agc;
+static lv_obj_t* btn_lep_agc_label;
+static lv_obj_t* btn_playback;
+static lv_obj_t* btn_playback_label;
 static lv_obj_t* dd_rec_interval;
 static lv_obj_t* dd_rec_interval_label;
 static lv_obj_t* dd_gain_mode;
@@ -78,10 +92,9 @@ static uint8_t prev_disp_ip_addr[4];
 // Statically allocated for lv_label_set_static_text = "XXX:XXX:XXX:XXX" + null
 static char ip_string[16];
 
-// String created for recording intervals drop-down
+// Strings created for the recording intervals and palette drop-downs (freed once the
+// drop-down has its own copy so a re-created screen doesn't leak them)
 static char* dd_rec_interval_list;
-
-// String created for palette drop-down
 static char* dd_palette_list;
 
 // Local copy of gui_state used for local updating and check upon save
@@ -101,6 +114,8 @@ static void lepton_en_cb_callback(lv_obj_t * cb, lv_event_t event);
 static void btn_set_network_callback(lv_obj_t * btn, lv_event_t event);
 static void btn_set_time_callback(lv_obj_t * btn, lv_event_t event);
 static void btn_set_wifi_callback(lv_obj_t * btn, lv_event_t event);
+static void btn_lep_agc_callback(lv_obj_t * btn, lv_event_t event);
+static void btn_playback_callback(lv_obj_t * btn, lv_event_t event);
 static void dd_rec_interval_callback(lv_obj_t * dd, lv_event_t event);
 static void dd_gain_mode_callback(lv_obj_t * dd, lv_event_t event);
 static void dd_palette_callback(lv_obj_t * dd, lv_event_t event);
@@ -188,6 +203,21 @@ lv_obj_t* gui_screen_settings_create()
 	btn_set_time_label = lv_label_create(btn_set_time, NULL);
 	lv_label_set_static_text(btn_set_time_label, "Clock");
 	
+	// Lepton display AGC mode (cycles through the modes when pressed)
+	btn_lep_agc = lv_btn_create(settings_screen, NULL);
+	lv_obj_set_pos(btn_lep_agc, 175, 205);
+	lv_obj_set_size(btn_lep_agc, 130, 30);
+	lv_obj_set_event_cb(btn_lep_agc, btn_lep_agc_callback);
+	btn_lep_agc_label = lv_label_create(btn_lep_agc, NULL);
+	
+	// Recorded session playback
+	btn_playback = lv_btn_create(settings_screen, NULL);
+	lv_obj_set_pos(btn_playback, 120, 205);
+	lv_obj_set_size(btn_playback, 50, 30);
+	lv_obj_set_event_cb(btn_playback, btn_playback_callback);
+	btn_playback_label = lv_label_create(btn_playback, NULL);
+	lv_label_set_static_text(btn_playback_label, LV_SYMBOL_PLAY);
+	
 	// Camera IP address
 	lbl_ip_addr = lv_label_create(settings_screen, NULL);
 	lv_obj_set_pos(lbl_ip_addr, 15, 210);
@@ -272,6 +302,8 @@ void gui_screen_settings_active(bool en)
 		if (local_gui_st.rec_lepton_enable != lv_cb_is_checked(cb_en_lepton)) {
 			lv_cb_set_checked(cb_en_lepton, local_gui_st.rec_lepton_enable);
 		}
+		
+		lv_label_set_static_text(btn_lep_agc_label, btn_lep_agc_names[local_gui_st.lep_agc_mode]);
 	}
 }
 
@@ -306,6 +338,8 @@ static void initialize_screen_values()
 	add_dd_palette_entries();
 	lv_ddlist_set_selected(dd_palette, gui_st.palette_index);
 	
+	lv_label_set_static_text(btn_lep_agc_label, btn_lep_agc_names[gui_st.lep_agc_mode]);
+	
 	ip_string[0] = 0;
 	prev_wifi_ip_valid = false;
 	for (int i=0; i<4; i++) prev_disp_ip_addr[i] = 0;
@@ -326,7 +360,7 @@ static void settings_screen_update_ip_addr()
 	if ((wifi_info->flags & WIFI_INFO_FLAG_CLIENT_MODE) != 0) {
 		// Client (sta) mode - display IP if connected
 		wifi_ip_valid = ((wifi_info->flags & WIFI_INFO_FLAG_CONNECTED) != 0);
-		
+	
 	} else {
 		// AP mode - display IP if enabled
 		wifi_ip_valid = ((wifi_info->flags & WIFI_INFO_FLAG_ENABLED) != 0);
@@ -364,6 +398,7 @@ static void settings_screen_update_ip_addr()
 static void btn_save_callback(lv_obj_t * btn, lv_event_t event)
 {
 	bool notify_after_update = false;
+	bool update_lepton = false;
 	
 	if (event == LV_EVENT_CLICKED) {
 		// Make sure at least one camera is enabled for recording before we allow exit
@@ -372,7 +407,7 @@ static void btn_save_callback(lv_obj_t * btn, lv_event_t event)
 		} else {
 			// Look for changed items that require updating other modules
 			if (local_gui_st.gain_mode != gui_st.gain_mode) {
-				lepton_gain_mode(local_gui_st.gain_mode);
+				update_lepton = true;
 			}
 			if ((local_gui_st.record_interval != gui_st.record_interval) ||
 			    (local_gui_st.rec_arducam_enable != gui_st.rec_arducam_enable) ||
@@ -380,7 +415,7 @@ static void btn_save_callback(lv_obj_t * btn, lv_event_t event)
 			{
 				notify_after_update = true;
 			}
-		
+			
 			// Save the settings in persistent storage
 			gui_st = local_gui_st;
 			ps_set_gui_state(&gui_st);
@@ -389,7 +424,11 @@ static void btn_save_callback(lv_obj_t * btn, lv_event_t event)
 			if (notify_after_update) {
 				xTaskNotify(task_handle_app, APP_NOTIFY_RECORD_PARM_UPD_MASK, eSetBits);
 			}
-		
+			if (update_lepton) {
+				// lep_task applies the new gain mode from persistent storage between frames
+				xTaskNotify(task_handle_lep, LEP_NOTIFY_GAIN_MASK, eSetBits);
+			}
+			
 			gui_set_screen(GUI_SCREEN_MAIN);
 		}
 	}
@@ -437,6 +476,14 @@ static void btn_set_time_callback(lv_obj_t * btn, lv_event_t event)
 }
 
 
+static void btn_playback_callback(lv_obj_t * btn, lv_event_t event)
+{
+	if (event == LV_EVENT_CLICKED) {
+		gui_set_screen(GUI_SCREEN_PLAYBACK);
+	}
+}
+
+
 static void btn_set_wifi_callback(lv_obj_t * btn, lv_event_t event)
 {
 	if (event == LV_EVENT_CLICKED) {
@@ -445,6 +492,17 @@ static void btn_set_wifi_callback(lv_obj_t * btn, lv_event_t event)
 }
 
 
+static void btn_lep_agc_callback(lv_obj_t * btn, lv_event_t event)
+{
+	if (event == LV_EVENT_CLICKED) {
+		if (++local_gui_st.lep_agc_mode >= SYS_LEP_AGC_NUM) {
+			local_gui_st.lep_agc_mode = SYS_LEP_AGC_LINEAR;
+		}
+		lv_label_set_static_text(btn_lep_agc_label, btn_lep_agc_names[local_gui_st.lep_agc_mode]);
+	}
+}
+
+
 static void dd_rec_interval_callback(lv_obj_t * dd, lv_event_t event)
 {
 	int new_sel;
@@ -508,6 +566,8 @@ static void add_dd_rec_interval_entries()
 	
 	// Finally, add the list of items to the drop-down menu
 	lv_ddlist_set_options(dd_rec_interval, dd_rec_interval_list);
+	free(dd_rec_interval_list);
+	dd_rec_interval_list = NULL;
 }
 
 
@@ -521,7 +581,7 @@ static void add_dd_palette_entries()
 	
 	// Determine how much space we need for the string
 	n = 0;
-	for (i=0; i<REC_INT_NUM; i++) {
+	for (i=0; i<PALETTE_COUNT; i++) {
 		cp = get_palette_name(i);
 		n += strlen(cp) + 1;   // +1 includes "\n" or final NULL character
 	}
@@ -546,5 +606,7 @@ static void add_dd_palette_entries()
 	
 	// Finally, add the list of items to the drop-down menu
 	lv_ddlist_set_options(dd_palette, dd_palette_list);
+	free(dd_palette_list);
+	dd_palette_list = NULL;
 }
 
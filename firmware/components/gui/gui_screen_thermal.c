@@ -0,0 +1,88 @@
+/*
+ * Full-screen Lepton GUI screen related functions, callbacks and event handlers
+ *
+ * The screen is an empty black background.  The main screen module draws the upscaled
+ * Lepton image directly to the LCD over it (gui_screen_main_update_lep_full).  Touching
+ * the screen returns to the main screen.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "gui_screen_thermal.h"
+#include "gui_task.h"
+#include "esp_system.h"
+#include "lv_conf.h"
+
+//
+// Thermal GUI Screen variables
+//
+
+// LVGL objects
+static lv_obj_t* thermal_screen;
+
+static lv_style_t thermal_screen_style;
+
+// Screen state
+static bool thermal_screen_active;
+
+
+//
+// Thermal GUI Screen internal function forward declarations
+//
+static void thermal_screen_callback(lv_obj_t * obj, lv_event_t event);
+
+
+//
+// Thermal GUI Screen API
+//
+lv_obj_t* gui_screen_thermal_create()
+{
+	// Screen - black so nothing shows around the image while it is first drawn
+	lv_style_copy(&thermal_screen_style, &lv_style_plain_color);
+	thermal_screen_style.body.main_color = LV_COLOR_BLACK;
+	thermal_screen_style.body.grad_color = LV_COLOR_BLACK;
+	
+	thermal_screen = lv_obj_create(NULL, NULL);
+	lv_obj_set_size(thermal_screen, LV_HOR_RES_MAX, LV_VER_RES_MAX);
+	lv_obj_set_style(thermal_screen, &thermal_screen_style);
+	lv_obj_set_click(thermal_screen, true);
+	lv_obj_set_event_cb(thermal_screen, thermal_screen_callback);
+	
+	thermal_screen_active = false;
+	
+	return thermal_screen;
+}
+
+
+void gui_screen_thermal_set_active(bool en)
+{
+	// Nothing to do for this screen
+	thermal_screen_active = en;
+}
+
+
+
+//
+// Thermal GUI Screen internal functions
+//
+static void thermal_screen_callback(lv_obj_t * obj, lv_event_t event)
+{
+	if (event == LV_EVENT_CLICKED) {
+		gui_set_screen(GUI_SCREEN_MAIN);
+	}
+}
@@ -83,6 +83,15 @@ void gui_message_box(lv_obj_t* parent, const char* msg)
 }
 
 
+/**
+ * Returns true while a message box is displayed over the screen
+ */
+bool gui_message_box_displayed()
+{
+	return (msg_box != NULL);
+}
+
+
 /**
  * Set the string for gui_preset_message_box - this function is designed to be called
  * by another task who then sends a GUI_NOTIFY_MESSAGEBOX_MASK to gui_task to initiate
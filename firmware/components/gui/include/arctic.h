@@ -24,263 +24,263 @@
 
 #include "palettes.h"
 
-palette_map_t arctic_palette_map = {
-	{15,16,146},
-	{15,16,146},
-	{15,15,153},
-	{15,15,153},
-	{15,15,159},
-	{15,15,159},
-	{16,15,167},
-	{16,15,167},
-	{15,15,175},
-	{15,15,175},
-	{16,15,182},
-	{16,15,182},
-	{16,16,190},
-	{16,16,190},
-	{14,15,197},
-	{14,15,197},
-	{15,15,205},
-	{15,15,205},
-	{15,15,211},
-	{15,15,211},
-	{16,15,219},
-	{16,15,219},
-	{16,15,227},
-	{16,15,227},
-	{16,18,239},
-	{16,18,239},
-	{16,25,240},
-	{16,25,240},
-	{15,34,239},
-	{15,34,239},
-	{15,44,238},
-	{15,44,238},
-	{14,54,239},
-	{14,54,239},
-	{14,63,239},
-	{14,63,239},
-	{14,74,238},
-	{14,74,238},
-	{17,82,238},
-	{17,82,238},
-	{19,92,237},
-	{19,92,237},
-	{22,102,239},
-	{22,102,239},
-	{24,111,238},
-	{24,111,238},
-	{27,120,237},
-	{27,120,237},
-	{28,131,237},
-	{28,131,237},
-	{32,140,237},
-	{32,140,237},
-	{34,150,237},
-	{34,150,237},
-	{36,160,236},
-	{36,160,236},
-	{39,168,237},
-	{39,168,237},
-	{42,179,237},
-	{42,179,237},
-	{44,188,236},
-	{44,188,236},
-	{46,197,236},
-	{46,197,236},
-	{49,208,236},
-	{49,208,236},
-	{52,217,235},
-	{52,217,235},
-	{54,227,232},
-	{54,227,232},
-	{57,227,230},
-	{57,227,230},
-	{58,226,227},
-	{58,226,227},
-	{62,224,225},
-	{62,224,225},
-	{64,222,222},
-	{64,222,222},
-	{66,220,220},
-	{66,220,220},
-	{67,215,215},
-	{67,215,215},
-	{69,209,210},
-	{69,209,210},
-	{73,205,204},
-	{73,205,204},
-	{76,198,199},
-	{76,198,199},
-	{79,193,192},
-	{79,193,192},
-	{81,187,187},
-	{81,187,187},
-	{83,181,180},
-	{83,181,180},
-	{87,175,175},
-	{87,175,175},
-	{88,170,170},
-	{88,170,170},
-	{88,164,165},
-	{88,164,165},
-	{90,158,159},
-	{90,158,159},
-	{90,152,153},
-	{90,152,153},
-	{90,146,145},
-	{90,146,145},
-	{92,140,140},
-	{92,140,140},
-	{92,134,134},
-	{92,134,134},
-	{95,129,129},
-	{95,129,129},
-	{95,123,123},
-	{95,123,123},
-	{96,117,116},
-	{96,117,116},
-	{97,111,110},
-	{97,111,110},
-	{99,105,105},
-	{99,105,105},
-	{102,102,102},
-	{102,102,102},
-	{107,101,97},
-	{107,101,97},
-	{112,101,95},
-	{112,101,95},
-	{117,101,90},
-	{117,101,90},
-	{123,102,87},
-	{123,102,87},
-	{129,101,84},
-	{129,101,84},
-	{134,101,80},
-	{134,101,80},
-	{138,102,76},
-	{138,102,76},
-	{143,101,73},
-	{143,101,73},
-	{148,101,69},
-	{148,101,69},
-	{153,101,66},
-	{153,101,66},
-	{159,102,63},
-	{159,102,63},
-	{165,102,59},
-	{165,102,59},
-	{170,101,56},
-	{170,101,56},
-	{175,101,52},
-	{175,101,52},
-	{180,101,48},
-	{180,101,48},
-	{185,100,45},
-	{185,100,45},
-	{191,100,41},
-	{191,100,41},
-	{197,101,37},
-	{197,101,37},
-	{201,101,35},
-	{201,101,35},
-	{206,101,31},
-	{206,101,31},
-	{211,101,26},
-	{211,101,26},
-	{216,101,24},
-	{216,101,24},
-	{221,101,19},
-	{221,101,19},
-	{228,101,18},
-	{228,101,18},
-	{233,101,14},
-	{233,101,14},
-	{237,101,13},
-	{237,101,13},
-	{236,105,13},
-	{236,105,13},
-	{236,112,12},
-	{236,112,12},
-	{236,120,13},
-	{236,120,13},
-	{237,123,13},
-	{237,123,13},
-	{237,130,12},
-	{237,130,12},
-	{237,137,13},
-	{237,137,13},
-	{237,142,12},
-	{237,142,12},
-	{237,149,12},
-	{237,149,12},
-	{236,156,13},
-	{236,156,13},
-	{236,160,11},
-	{236,160,11},
-	{235,167,12},
-	{235,167,12},
-	{235,173,12},
-	{235,173,12},
-	{235,179,12},
-	{235,179,12},
-	{235,185,12},
-	{235,185,12},
-	{236,191,13},
-	{236,191,13},
-	{236,196,11},
-	{236,196,11},
-	{235,202,12},
-	{235,202,12},
-	{236,204,27},
-	{236,204,27},
-	{235,207,34},
-	{235,207,34},
-	{236,208,50},
-	{236,208,50},
-	{235,211,65},
-	{235,211,65},
-	{235,212,71},
-	{235,212,71},
-	{235,214,87},
-	{235,214,87},
-	{235,216,100},
-	{235,216,100},
-	{235,216,108},
-	{235,216,108},
-	{236,220,123},
-	{236,220,123},
-	{235,221,138},
-	{235,221,138},
-	{235,221,146},
-	{235,221,146},
-	{235,225,160},
-	{235,225,160},
-	{235,225,175},
-	{235,225,175},
-	{236,227,182},
-	{236,227,182},
-	{235,229,191},
-	{235,229,191},
-	{235,230,194},
-	{235,230,194},
-	{235,235,235},
-	{234,234,234},
-	{233,233,233},
-	{232,232,232},
-	{231,231,231},
-	{230,230,230},
-	{229,229,229},
-	{228,228,228},
-	{227,227,227},
-	{226,226,226},
-	{225,225,225},
-	{224,224,224},
-	{223,223,223},
-	{222,222,222},
-	{221,221,221},
-	{220,220,220},
+palette16_map_t arctic_palette16_map = {
+	RGB_TO_16BIT_SWAP(15, 16, 146),
+	RGB_TO_16BIT_SWAP(15, 16, 146),
+	RGB_TO_16BIT_SWAP(15, 15, 153),
+	RGB_TO_16BIT_SWAP(15, 15, 153),
+	RGB_TO_16BIT_SWAP(15, 15, 159),
+	RGB_TO_16BIT_SWAP(15, 15, 159),
+	RGB_TO_16BIT_SWAP(16, 15, 167),
+	RGB_TO_16BIT_SWAP(16, 15, 167),
+	RGB_TO_16BIT_SWAP(15, 15, 175),
+	RGB_TO_16BIT_SWAP(15, 15, 175),
+	RGB_TO_16BIT_SWAP(16, 15, 182),
+	RGB_TO_16BIT_SWAP(16, 15, 182),
+	RGB_TO_16BIT_SWAP(16, 16, 190),
+	RGB_TO_16BIT_SWAP(16, 16, 190),
+	RGB_TO_16BIT_SWAP(14, 15, 197),
+	RGB_TO_16BIT_SWAP(14, 15, 197),
+	RGB_TO_16BIT_SWAP(15, 15, 205),
+	RGB_TO_16BIT_SWAP(15, 15, 205),
+	RGB_TO_16BIT_SWAP(15, 15, 211),
+	RGB_TO_16BIT_SWAP(15, 15, 211),
+	RGB_TO_16BIT_SWAP(16, 15, 219),
+	RGB_TO_16BIT_SWAP(16, 15, 219),
+	RGB_TO_16BIT_SWAP(16, 15, 227),
+	RGB_TO_16BIT_SWAP(16, 15, 227),
+	RGB_TO_16BIT_SWAP(16, 18, 239),
+	RGB_TO_16BIT_SWAP(16, 18, 239),
+	RGB_TO_16BIT_SWAP(16, 25, 240),
+	RGB_TO_16BIT_SWAP(16, 25, 240),
+	RGB_TO_16BIT_SWAP(15, 34, 239),
+	RGB_TO_16BIT_SWAP(15, 34, 239),
+	RGB_TO_16BIT_SWAP(15, 44, 238),
+	RGB_TO_16BIT_SWAP(15, 44, 238),
+	RGB_TO_16BIT_SWAP(14, 54, 239),
+	RGB_TO_16BIT_SWAP(14, 54, 239),
+	RGB_TO_16BIT_SWAP(14, 63, 239),
+	RGB_TO_16BIT_SWAP(14, 63, 239),
+	RGB_TO_16BIT_SWAP(14, 74, 238),
+	RGB_TO_16BIT_SWAP(14, 74, 238),
+	RGB_TO_16BIT_SWAP(17, 82, 238),
+	RGB_TO_16BIT_SWAP(17, 82, 238),
+	RGB_TO_16BIT_SWAP(19, 92, 237),
+	RGB_TO_16BIT_SWAP(19, 92, 237),
+	RGB_TO_16BIT_SWAP(22, 102, 239),
+	RGB_TO_16BIT_SWAP(22, 102, 239),
+	RGB_TO_16BIT_SWAP(24, 111, 238),
+	RGB_TO_16BIT_SWAP(24, 111, 238),
+	RGB_TO_16BIT_SWAP(27, 120, 237),
+	RGB_TO_16BIT_SWAP(27, 120, 237),
+	RGB_TO_16BIT_SWAP(28, 131, 237),
+	RGB_TO_16BIT_SWAP(28, 131, 237),
+	RGB_TO_16BIT_SWAP(32, 140, 237),
+	RGB_TO_16BIT_SWAP(32, 140, 237),
+	RGB_TO_16BIT_SWAP(34, 150, 237),
+	RGB_TO_16BIT_SWAP(34, 150, 237),
+	RGB_TO_16BIT_SWAP(36, 160, 236),
+	RGB_TO_16BIT_SWAP(36, 160, 236),
+	RGB_TO_16BIT_SWAP(39, 168, 237),
+	RGB_TO_16BIT_SWAP(39, 168, 237),
+	RGB_TO_16BIT_SWAP(42, 179, 237),
+	RGB_TO_16BIT_SWAP(42, 179, 237),
+	RGB_TO_16BIT_SWAP(44, 188, 236),
+	RGB_TO_16BIT_SWAP(44, 188, 236),
+	RGB_TO_16BIT_SWAP(46, 197, 236),
+	RGB_TO_16BIT_SWAP(46, 197, 236),
+	RGB_TO_16BIT_SWAP(49, 208, 236),
+	RGB_TO_16BIT_SWAP(49, 208, 236),
+	RGB_TO_16BIT_SWAP(52, 217, 235),
+	RGB_TO_16BIT_SWAP(52, 217, 235),
+	RGB_TO_16BIT_SWAP(54, 227, 232),
+	RGB_TO_16BIT_SWAP(54, 227, 232),
+	RGB_TO_16BIT_SWAP(57, 227, 230),
+	RGB_TO_16BIT_SWAP(57, 227, 230),
+	RGB_TO_16BIT_SWAP(58, 226, 227),
+	RGB_TO_16BIT_SWAP(58, 226, 227),
+	RGB_TO_16BIT_SWAP(62, 224, 225),
+	RGB_TO_16BIT_SWAP(62, 224, 225),
+	RGB_TO_16BIT_SWAP(64, 222, 222),
+	RGB_TO_16BIT_SWAP(64, 222, 222),
+	RGB_TO_16BIT_SWAP(66, 220, 220),
+	RGB_TO_16BIT_SWAP(66, 220, 220),
+	RGB_TO_16BIT_SWAP(67, 215, 215),
+	RGB_TO_16BIT_SWAP(67, 215, 215),
+	RGB_TO_16BIT_SWAP(69, 209, 210),
+	RGB_TO_16BIT_SWAP(69, 209, 210),
+	RGB_TO_16BIT_SWAP(73, 205, 204),
+	RGB_TO_16BIT_SWAP(73, 205, 204),
+	RGB_TO_16BIT_SWAP(76, 198, 199),
+	RGB_TO_16BIT_SWAP(76, 198, 199),
+	RGB_TO_16BIT_SWAP(79, 193, 192),
+	RGB_TO_16BIT_SWAP(79, 193, 192),
+	RGB_TO_16BIT_SWAP(81, 187, 187),
+	RGB_TO_16BIT_SWAP(81, 187, 187),
+	RGB_TO_16BIT_SWAP(83, 181, 180),
+	RGB_TO_16BIT_SWAP(83, 181, 180),
+	RGB_TO_16BIT_SWAP(87, 175, 175),
+	RGB_TO_16BIT_SWAP(87, 175, 175),
+	RGB_TO_16BIT_SWAP(88, 170, 170),
+	RGB_TO_16BIT_SWAP(88, 170, 170),
+	RGB_TO_16BIT_SWAP(88, 164, 165),
+	RGB_TO_16BIT_SWAP(88, 164, 165),
+	RGB_TO_16BIT_SWAP(90, 158, 159),
+	RGB_TO_16BIT_SWAP(90, 158, 159),
+	RGB_TO_16BIT_SWAP(90, 152, 153),
+	RGB_TO_16BIT_SWAP(90, 152, 153),
+	RGB_TO_16BIT_SWAP(90, 146, 145),
+	RGB_TO_16BIT_SWAP(90, 146, 145),
+	RGB_TO_16BIT_SWAP(92, 140, 140),
+	RGB_TO_16BIT_SWAP(92, 140, 140),
+	RGB_TO_16BIT_SWAP(92, 134, 134),
+	RGB_TO_16BIT_SWAP(92, 134, 134),
+	RGB_TO_16BIT_SWAP(95, 129, 129),
+	RGB_TO_16BIT_SWAP(95, 129, 129),
+	RGB_TO_16BIT_SWAP(95, 123, 123),
+	RGB_TO_16BIT_SWAP(95, 123, 123),
+	RGB_TO_16BIT_SWAP(96, 117, 116),
+	RGB_TO_16BIT_SWAP(96, 117, 116),
+	RGB_TO_16BIT_SWAP(97, 111, 110),
+	RGB_TO_16BIT_SWAP(97, 111, 110),
+	RGB_TO_16BIT_SWAP(99, 105, 105),
+	RGB_TO_16BIT_SWAP(99, 105, 105),
+	RGB_TO_16BIT_SWAP(102, 102, 102),
+	RGB_TO_16BIT_SWAP(102, 102, 102),
+	RGB_TO_16BIT_SWAP(107, 101, 97),
+	RGB_TO_16BIT_SWAP(107, 101, 97),
+	RGB_TO_16BIT_SWAP(112, 101, 95),
+	RGB_TO_16BIT_SWAP(112, 101, 95),
+	RGB_TO_16BIT_SWAP(117, 101, 90),
+	RGB_TO_16BIT_SWAP(117, 101, 90),
+	RGB_TO_16BIT_SWAP(123, 102, 87),
+	RGB_TO_16BIT_SWAP(123, 102, 87),
+	RGB_TO_16BIT_SWAP(129, 101, 84),
+	RGB_TO_16BIT_SWAP(129, 101, 84),
+	RGB_TO_16BIT_SWAP(134, 101, 80),
+	RGB_TO_16BIT_SWAP(134, 101, 80),
+	RGB_TO_16BIT_SWAP(138, 102, 76),
+	RGB_TO_16BIT_SWAP(138, 102, 76),
+	RGB_TO_16BIT_SWAP(143, 101, 73),
+	RGB_TO_16BIT_SWAP(143, 101, 73),
+	RGB_TO_16BIT_SWAP(148, 101, 69),
+	RGB_TO_16BIT_SWAP(148, 101, 69),
+	RGB_TO_16BIT_SWAP(153, 101, 66),
+	RGB_TO_16BIT_SWAP(153, 101, 66),
+	RGB_TO_16BIT_SWAP(159, 102, 63),
+	RGB_TO_16BIT_SWAP(159, 102, 63),
+	RGB_TO_16BIT_SWAP(165, 102, 59),
+	RGB_TO_16BIT_SWAP(165, 102, 59),
+	RGB_TO_16BIT_SWAP(170, 101, 56),
+	RGB_TO_16BIT_SWAP(170, 101, 56),
+	RGB_TO_16BIT_SWAP(175, 101, 52),
+	RGB_TO_16BIT_SWAP(175, 101, 52),
+	RGB_TO_16BIT_SWAP(180, 101, 48),
+	RGB_TO_16BIT_SWAP(180, 101, 48),
+	RGB_TO_16BIT_SWAP(185, 100, 45),
+	RGB_TO_16BIT_SWAP(185, 100, 45),
+	RGB_TO_16BIT_SWAP(191, 100, 41),
+	RGB_TO_16BIT_SWAP(191, 100, 41),
+	RGB_TO_16BIT_SWAP(197, 101, 37),
+	RGB_TO_16BIT_SWAP(197, 101, 37),
+	RGB_TO_16BIT_SWAP(201, 101, 35),
+	RGB_TO_16BIT_SWAP(201, 101, 35),
+	RGB_TO_16BIT_SWAP(206, 101, 31),
+	RGB_TO_16BIT_SWAP(206, 101, 31),
+	RGB_TO_16BIT_SWAP(211, 101, 26),
+	RGB_TO_16BIT_SWAP(211, 101, 26),
+	RGB_TO_16BIT_SWAP(216, 101, 24),
+	RGB_TO_16BIT_SWAP(216, 101, 24),
+	RGB_TO_16BIT_SWAP(221, 101, 19),
+	RGB_TO_16BIT_SWAP(221, 101, 19),
+	RGB_TO_16BIT_SWAP(228, 101, 18),
+	RGB_TO_16BIT_SWAP(228, 101, 18),
+	RGB_TO_16BIT_SWAP(233, 101, 14),
+	RGB_TO_16BIT_SWAP(233, 101, 14),
+	RGB_TO_16BIT_SWAP(237, 101, 13),
+	RGB_TO_16BIT_SWAP(237, 101, 13),
+	RGB_TO_16BIT_SWAP(236, 105, 13),
+	RGB_TO_16BIT_SWAP(236, 105, 13),
+	RGB_TO_16BIT_SWAP(236, 112, 12),
+	RGB_TO_16BIT_SWAP(236, 112, 12),
+	RGB_TO_16BIT_SWAP(236, 120, 13),
+	RGB_TO_16BIT_SWAP(236, 120, 13),
+	RGB_TO_16BIT_SWAP(237, 123, 13),
+	RGB_TO_16BIT_SWAP(237, 123, 13),
+	RGB_TO_16BIT_SWAP(237, 130, 12),
+	RGB_TO_16BIT_SWAP(237, 130, 12),
+	RGB_TO_16BIT_SWAP(237, 137, 13),
+	RGB_TO_16BIT_SWAP(237, 137, 13),
+	RGB_TO_16BIT_SWAP(237, 142, 12),
+	RGB_TO_16BIT_SWAP(237, 142, 12),
+	RGB_TO_16BIT_SWAP(237, 149, 12),
+	RGB_TO_16BIT_SWAP(237, 149, 12),
+	RGB_TO_16BIT_SWAP(236, 156, 13),
+	RGB_TO_16BIT_SWAP(236, 156, 13),
+	RGB_TO_16BIT_SWAP(236, 160, 11),
+	RGB_TO_16BIT_SWAP(236, 160, 11),
+	RGB_TO_16BIT_SWAP(235, 167, 12),
+	RGB_TO_16BIT_SWAP(235, 167, 12),
+	RGB_TO_16BIT_SWAP(235, 173, 12),
+	RGB_TO_16BIT_SWAP(235, 173, 12),
+	RGB_TO_16BIT_SWAP(235, 179, 12),
+	RGB_TO_16BIT_SWAP(235, 179, 12),
+	RGB_TO_16BIT_SWAP(235, 185, 12),
+	RGB_TO_16BIT_SWAP(235, 185, 12),
+	RGB_TO_16BIT_SWAP(236, 191, 13),
+	RGB_TO_16BIT_SWAP(236, 191, 13),
+	RGB_TO_16BIT_SWAP(236, 196, 11),
+	RGB_TO_16BIT_SWAP(236, 196, 11),
+	RGB_TO_16BIT_SWAP(235, 202, 12),
+	RGB_TO_16BIT_SWAP(235, 202, 12),
+	RGB_TO_16BIT_SWAP(236, 204, 27),
+	RGB_TO_16BIT_SWAP(236, 204, 27),
+	RGB_TO_16BIT_SWAP(235, 207, 34),
+	RGB_TO_16BIT_SWAP(235, 207, 34),
+	RGB_TO_16BIT_SWAP(236, 208, 50),
+	RGB_TO_16BIT_SWAP(236, 208, 50),
+	RGB_TO_16BIT_SWAP(235, 211, 65),
+	RGB_TO_16BIT_SWAP(235, 211, 65),
+	RGB_TO_16BIT_SWAP(235, 212, 71),
+	RGB_TO_16BIT_SWAP(235, 212, 71),
+	RGB_TO_16BIT_SWAP(235, 214, 87),
+	RGB_TO_16BIT_SWAP(235, 214, 87),
+	RGB_TO_16BIT_SWAP(235, 216, 100),
+	RGB_TO_16BIT_SWAP(235, 216, 100),
+	RGB_TO_16BIT_SWAP(235, 216, 108),
+	RGB_TO_16BIT_SWAP(235, 216, 108),
+	RGB_TO_16BIT_SWAP(236, 220, 123),
+	RGB_TO_16BIT_SWAP(236, 220, 123),
+	RGB_TO_16BIT_SWAP(235, 221, 138),
+	RGB_TO_16BIT_SWAP(235, 221, 138),
+	RGB_TO_16BIT_SWAP(235, 221, 146),
+	RGB_TO_16BIT_SWAP(235, 221, 146),
+	RGB_TO_16BIT_SWAP(235, 225, 160),
+	RGB_TO_16BIT_SWAP(235, 225, 160),
+	RGB_TO_16BIT_SWAP(235, 225, 175),
+	RGB_TO_16BIT_SWAP(235, 225, 175),
+	RGB_TO_16BIT_SWAP(236, 227, 182),
+	RGB_TO_16BIT_SWAP(236, 227, 182),
+	RGB_TO_16BIT_SWAP(235, 229, 191),
+	RGB_TO_16BIT_SWAP(235, 229, 191),
+	RGB_TO_16BIT_SWAP(235, 230, 194),
+	RGB_TO_16BIT_SWAP(235, 230, 194),
+	RGB_TO_16BIT_SWAP(235, 235, 235),
+	RGB_TO_16BIT_SWAP(234, 234, 234),
+	RGB_TO_16BIT_SWAP(233, 233, 233),
+	RGB_TO_16BIT_SWAP(232, 232, 232),
+	RGB_TO_16BIT_SWAP(231, 231, 231),
+	RGB_TO_16BIT_SWAP(230, 230, 230),
+	RGB_TO_16BIT_SWAP(229, 229, 229),
+	RGB_TO_16BIT_SWAP(228, 228, 228),
+	RGB_TO_16BIT_SWAP(227, 227, 227),
+	RGB_TO_16BIT_SWAP(226, 226, 226),
+	RGB_TO_16BIT_SWAP(225, 225, 225),
+	RGB_TO_16BIT_SWAP(224, 224, 224),
+	RGB_TO_16BIT_SWAP(223, 223, 223),
+	RGB_TO_16BIT_SWAP(222, 222, 222),
+	RGB_TO_16BIT_SWAP(221, 221, 221),
+	RGB_TO_16BIT_SWAP(220, 220, 220),
 };
 
 #endif
\ No newline at end of file
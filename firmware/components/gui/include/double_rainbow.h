@@ -24,263 +24,263 @@
 
 #include "palettes.h"
 
-palette_map_t double_rainbow_palette_map = {
-	{18,15,18},
-	{25,17,26},
-	{34,18,32},
-	{43,19,39},
-	{52,21,48},
-	{60,23,55},
-	{69,25,62},
-	{77,26,70},
-	{86,28,75},
-	{95,30,84},
-	{103,31,91},
-	{112,34,98},
-	{120,35,106},
-	{129,36,111},
-	{138,39,120},
-	{146,40,128},
-	{155,42,136},
-	{150,44,140},
-	{145,47,146},
-	{139,51,151},
-	{134,54,157},
-	{130,57,161},
-	{124,60,168},
-	{119,63,172},
-	{115,66,179},
-	{109,70,183},
-	{104,73,189},
-	{99,76,194},
-	{93,80,200},
-	{89,83,205},
-	{84,86,211},
-	{78,90,216},
-	{73,92,222},
-	{69,96,227},
-	{63,99,233},
-	{59,103,238},
-	{57,104,230},
-	{54,107,221},
-	{50,109,213},
-	{50,113,206},
-	{46,115,196},
-	{45,117,189},
-	{42,120,180},
-	{39,123,171},
-	{38,125,164},
-	{35,127,154},
-	{32,130,147},
-	{30,133,138},
-	{28,135,129},
-	{25,138,122},
-	{24,140,113},
-	{21,144,104},
-	{20,146,97},
-	{16,148,87},
-	{14,152,81},
-	{27,153,75},
-	{41,157,70},
-	{54,160,64},
-	{69,164,60},
-	{84,166,54},
-	{98,170,49},
-	{110,173,44},
-	{123,176,38},
-	{138,180,34},
-	{151,182,28},
-	{166,186,23},
-	{179,189,18},
-	{194,193,13},
-	{194,189,13},
-	{194,186,13},
-	{193,183,14},
-	{194,180,15},
-	{194,177,15},
-	{194,174,14},
-	{193,171,14},
-	{194,169,15},
-	{193,165,15},
-	{194,161,16},
-	{194,160,15},
-	{194,156,17},
-	{194,154,18},
-	{195,150,17},
-	{194,147,17},
-	{195,145,18},
-	{195,142,18},
-	{195,138,19},
-	{194,135,19},
-	{195,133,20},
-	{195,129,20},
-	{195,126,19},
-	{195,124,22},
-	{193,118,21},
-	{191,114,24},
-	{189,109,24},
-	{188,104,27},
-	{186,100,27},
-	{185,95,29},
-	{183,91,30},
-	{181,86,32},
-	{180,82,33},
-	{178,77,35},
-	{177,73,36},
-	{176,67,38},
-	{173,63,39},
-	{172,59,41},
-	{172,54,41},
-	{169,50,44},
-	{169,45,45},
-	{170,53,60},
-	{171,61,74},
-	{174,68,90},
-	{174,76,103},
-	{177,83,119},
-	{179,92,133},
-	{181,99,149},
-	{182,107,162},
-	{185,114,178},
-	{186,123,192},
-	{187,131,208},
-	{190,139,222},
-	{193,146,238},
-	{194,149,236},
-	{195,153,238},
-	{197,158,237},
-	{199,160,237},
-	{200,165,237},
-	{203,168,236},
-	{193,169,235},
-	{185,168,232},
-	{176,168,229},
-	{166,168,228},
-	{157,168,225},
-	{149,168,222},
-	{140,170,220},
-	{131,169,218},
-	{121,170,215},
-	{113,170,212},
-	{103,170,211},
-	{94,170,208},
-	{86,171,206},
-	{76,171,203},
-	{68,171,202},
-	{59,171,199},
-	{51,170,196},
-	{41,171,195},
-	{33,172,193},
-	{23,172,190},
-	{14,172,187},
-	{18,173,181},
-	{24,174,174},
-	{30,175,166},
-	{33,176,160},
-	{39,177,152},
-	{45,178,145},
-	{49,179,139},
-	{54,180,131},
-	{60,181,126},
-	{64,182,118},
-	{69,183,110},
-	{74,183,104},
-	{79,185,97},
-	{84,186,91},
-	{88,187,83},
-	{93,187,76},
-	{99,189,71},
-	{103,190,63},
-	{107,191,57},
-	{113,192,50},
-	{118,193,42},
-	{122,194,36},
-	{127,195,28},
-	{133,195,20},
-	{139,196,15},
-	{143,199,14},
-	{148,200,15},
-	{151,202,13},
-	{155,204,13},
-	{161,206,15},
-	{164,208,13},
-	{169,209,13},
-	{173,211,14},
-	{178,213,13},
-	{182,214,13},
-	{187,216,14},
-	{192,217,13},
-	{196,219,13},
-	{201,221,13},
-	{205,223,13},
-	{210,224,13},
-	{213,226,11},
-	{217,228,13},
-	{222,229,13},
-	{226,231,11},
-	{231,233,13},
-	{236,234,13},
-	{236,229,13},
-	{236,224,16},
-	{237,219,17},
-	{236,214,20},
-	{236,209,22},
-	{236,203,22},
-	{236,198,25},
-	{237,193,28},
-	{236,188,30},
-	{236,183,31},
-	{236,177,33},
-	{236,172,34},
-	{236,167,36},
-	{236,162,39},
-	{238,156,42},
-	{237,151,42},
-	{237,146,45},
-	{237,140,47},
-	{238,136,48},
-	{238,131,51},
-	{237,125,53},
-	{235,118,52},
-	{235,113,52},
-	{234,105,52},
-	{233,99,52},
-	{232,93,52},
-	{231,86,53},
-	{229,80,52},
-	{230,73,52},
-	{228,67,53},
-	{227,61,53},
-	{226,54,52},
-	{225,48,52},
-	{227,56,61},
-	{227,64,69},
-	{227,73,77},
-	{227,80,86},
-	{227,88,93},
-	{229,96,101},
-	{228,105,109},
-	{230,113,118},
-	{230,121,126},
-	{231,130,136},
-	{231,138,142},
-	{230,146,150},
-	{231,154,158},
-	{233,162,166},
-	{233,170,175},
-	{232,175,178},
-	{232,179,183},
-	{233,184,189},
-	{233,189,194},
-	{233,195,198},
-	{233,199,202},
-	{235,204,206},
-	{235,208,213},
-	{234,213,216},
-	{235,218,222},
-	{235,222,227},
-	{234,227,230},
-	{235,232,235},
+palette16_map_t double_rainbow_palette16_map = {
+	RGB_TO_16BIT_SWAP(18, 15, 18),
+	RGB_TO_16BIT_SWAP(25, 17, 26),
+	RGB_TO_16BIT_SWAP(34, 18, 32),
+	RGB_TO_16BIT_SWAP(43, 19, 39),
+	RGB_TO_16BIT_SWAP(52, 21, 48),
+	RGB_TO_16BIT_SWAP(60, 23, 55),
+	RGB_TO_16BIT_SWAP(69, 25, 62),
+	RGB_TO_16BIT_SWAP(77, 26, 70),
+	RGB_TO_16BIT_SWAP(86, 28, 75),
+	RGB_TO_16BIT_SWAP(95, 30, 84),
+	RGB_TO_16BIT_SWAP(103, 31, 91),
+	RGB_TO_16BIT_SWAP(112, 34, 98),
+	RGB_TO_16BIT_SWAP(120, 35, 106),
+	RGB_TO_16BIT_SWAP(129, 36, 111),
+	RGB_TO_16BIT_SWAP(138, 39, 120),
+	RGB_TO_16BIT_SWAP(146, 40, 128),
+	RGB_TO_16BIT_SWAP(155, 42, 136),
+	RGB_TO_16BIT_SWAP(150, 44, 140),
+	RGB_TO_16BIT_SWAP(145, 47, 146),
+	RGB_TO_16BIT_SWAP(139, 51, 151),
+	RGB_TO_16BIT_SWAP(134, 54, 157),
+	RGB_TO_16BIT_SWAP(130, 57, 161),
+	RGB_TO_16BIT_SWAP(124, 60, 168),
+	RGB_TO_16BIT_SWAP(119, 63, 172),
+	RGB_TO_16BIT_SWAP(115, 66, 179),
+	RGB_TO_16BIT_SWAP(109, 70, 183),
+	RGB_TO_16BIT_SWAP(104, 73, 189),
+	RGB_TO_16BIT_SWAP(99, 76, 194),
+	RGB_TO_16BIT_SWAP(93, 80, 200),
+	RGB_TO_16BIT_SWAP(89, 83, 205),
+	RGB_TO_16BIT_SWAP(84, 86, 211),
+	RGB_TO_16BIT_SWAP(78, 90, 216),
+	RGB_TO_16BIT_SWAP(73, 92, 222),
+	RGB_TO_16BIT_SWAP(69, 96, 227),
+	RGB_TO_16BIT_SWAP(63, 99, 233),
+	RGB_TO_16BIT_SWAP(59, 103, 238),
+	RGB_TO_16BIT_SWAP(57, 104, 230),
+	RGB_TO_16BIT_SWAP(54, 107, 221),
+	RGB_TO_16BIT_SWAP(50, 109, 213),
+	RGB_TO_16BIT_SWAP(50, 113, 206),
+	RGB_TO_16BIT_SWAP(46, 115, 196),
+	RGB_TO_16BIT_SWAP(45, 117, 189),
+	RGB_TO_16BIT_SWAP(42, 120, 180),
+	RGB_TO_16BIT_SWAP(39, 123, 171),
+	RGB_TO_16BIT_SWAP(38, 125, 164),
+	RGB_TO_16BIT_SWAP(35, 127, 154),
+	RGB_TO_16BIT_SWAP(32, 130, 147),
+	RGB_TO_16BIT_SWAP(30, 133, 138),
+	RGB_TO_16BIT_SWAP(28, 135, 129),
+	RGB_TO_16BIT_SWAP(25, 138, 122),
+	RGB_TO_16BIT_SWAP(24, 140, 113),
+	RGB_TO_16BIT_SWAP(21, 144, 104),
+	RGB_TO_16BIT_SWAP(20, 146, 97),
+	RGB_TO_16BIT_SWAP(16, 148, 87),
+	RGB_TO_16BIT_SWAP(14, 152, 81),
+	RGB_TO_16BIT_SWAP(27, 153, 75),
+	RGB_TO_16BIT_SWAP(41, 157, 70),
+	RGB_TO_16BIT_SWAP(54, 160, 64),
+	RGB_TO_16BIT_SWAP(69, 164, 60),
+	RGB_TO_16BIT_SWAP(84, 166, 54),
+	RGB_TO_16BIT_SWAP(98, 170, 49),
+	RGB_TO_16BIT_SWAP(110, 173, 44),
+	RGB_TO_16BIT_SWAP(123, 176, 38),
+	RGB_TO_16BIT_SWAP(138, 180, 34),
+	RGB_TO_16BIT_SWAP(151, 182, 28),
+	RGB_TO_16BIT_SWAP(166, 186, 23),
+	RGB_TO_16BIT_SWAP(179, 189, 18),
+	RGB_TO_16BIT_SWAP(194, 193, 13),
+	RGB_TO_16BIT_SWAP(194, 189, 13),
+	RGB_TO_16BIT_SWAP(194, 186, 13),
+	RGB_TO_16BIT_SWAP(193, 183, 14),
+	RGB_TO_16BIT_SWAP(194, 180, 15),
+	RGB_TO_16BIT_SWAP(194, 177, 15),
+	RGB_TO_16BIT_SWAP(194, 174, 14),
+	RGB_TO_16BIT_SWAP(193, 171, 14),
+	RGB_TO_16BIT_SWAP(194, 169, 15),
+	RGB_TO_16BIT_SWAP(193, 165, 15),
+	RGB_TO_16BIT_SWAP(194, 161, 16),
+	RGB_TO_16BIT_SWAP(194, 160, 15),
+	RGB_TO_16BIT_SWAP(194, 156, 17),
+	RGB_TO_16BIT_SWAP(194, 154, 18),
+	RGB_TO_16BIT_SWAP(195, 150, 17),
+	RGB_TO_16BIT_SWAP(194, 147, 17),
+	RGB_TO_16BIT_SWAP(195, 145, 18),
+	RGB_TO_16BIT_SWAP(195, 142, 18),
+	RGB_TO_16BIT_SWAP(195, 138, 19),
+	RGB_TO_16BIT_SWAP(194, 135, 19),
+	RGB_TO_16BIT_SWAP(195, 133, 20),
+	RGB_TO_16BIT_SWAP(195, 129, 20),
+	RGB_TO_16BIT_SWAP(195, 126, 19),
+	RGB_TO_16BIT_SWAP(195, 124, 22),
+	RGB_TO_16BIT_SWAP(193, 118, 21),
+	RGB_TO_16BIT_SWAP(191, 114, 24),
+	RGB_TO_16BIT_SWAP(189, 109, 24),
+	RGB_TO_16BIT_SWAP(188, 104, 27),
+	RGB_TO_16BIT_SWAP(186, 100, 27),
+	RGB_TO_16BIT_SWAP(185, 95, 29),
+	RGB_TO_16BIT_SWAP(183, 91, 30),
+	RGB_TO_16BIT_SWAP(181, 86, 32),
+	RGB_TO_16BIT_SWAP(180, 82, 33),
+	RGB_TO_16BIT_SWAP(178, 77, 35),
+	RGB_TO_16BIT_SWAP(177, 73, 36),
+	RGB_TO_16BIT_SWAP(176, 67, 38),
+	RGB_TO_16BIT_SWAP(173, 63, 39),
+	RGB_TO_16BIT_SWAP(172, 59, 41),
+	RGB_TO_16BIT_SWAP(172, 54, 41),
+	RGB_TO_16BIT_SWAP(169, 50, 44),
+	RGB_TO_16BIT_SWAP(169, 45, 45),
+	RGB_TO_16BIT_SWAP(170, 53, 60),
+	RGB_TO_16BIT_SWAP(171, 61, 74),
+	RGB_TO_16BIT_SWAP(174, 68, 90),
+	RGB_TO_16BIT_SWAP(174, 76, 103),
+	RGB_TO_16BIT_SWAP(177, 83, 119),
+	RGB_TO_16BIT_SWAP(179, 92, 133),
+	RGB_TO_16BIT_SWAP(181, 99, 149),
+	RGB_TO_16BIT_SWAP(182, 107, 162),
+	RGB_TO_16BIT_SWAP(185, 114, 178),
+	RGB_TO_16BIT_SWAP(186, 123, 192),
+	RGB_TO_16BIT_SWAP(187, 131, 208),
+	RGB_TO_16BIT_SWAP(190, 139, 222),
+	RGB_TO_16BIT_SWAP(193, 146, 238),
+	RGB_TO_16BIT_SWAP(194, 149, 236),
+	RGB_TO_16BIT_SWAP(195, 153, 238),
+	RGB_TO_16BIT_SWAP(197, 158, 237),
+	RGB_TO_16BIT_SWAP(199, 160, 237),
+	RGB_TO_16BIT_SWAP(200, 165, 237),
+	RGB_TO_16BIT_SWAP(203, 168, 236),
+	RGB_TO_16BIT_SWAP(193, 169, 235),
+	RGB_TO_16BIT_SWAP(185, 168, 232),
+	RGB_TO_16BIT_SWAP(176, 168, 229),
+	RGB_TO_16BIT_SWAP(166, 168, 228),
+	RGB_TO_16BIT_SWAP(157, 168, 225),
+	RGB_TO_16BIT_SWAP(149, 168, 222),
+	RGB_TO_16BIT_SWAP(140, 170, 220),
+	RGB_TO_16BIT_SWAP(131, 169, 218),
+	RGB_TO_16BIT_SWAP(121, 170, 215),
+	RGB_TO_16BIT_SWAP(113, 170, 212),
+	RGB_TO_16BIT_SWAP(103, 170, 211),
+	RGB_TO_16BIT_SWAP(94, 170, 208),
+	RGB_TO_16BIT_SWAP(86, 171, 206),
+	RGB_TO_16BIT_SWAP(76, 171, 203),
+	RGB_TO_16BIT_SWAP(68, 171, 202),
+	RGB_TO_16BIT_SWAP(59, 171, 199),
+	RGB_TO_16BIT_SWAP(51, 170, 196),
+	RGB_TO_16BIT_SWAP(41, 171, 195),
+	RGB_TO_16BIT_SWAP(33, 172, 193),
+	RGB_TO_16BIT_SWAP(23, 172, 190),
+	RGB_TO_16BIT_SWAP(14, 172, 187),
+	RGB_TO_16BIT_SWAP(18, 173, 181),
+	RGB_TO_16BIT_SWAP(24, 174, 174),
+	RGB_TO_16BIT_SWAP(30, 175, 166),
+	RGB_TO_16BIT_SWAP(33, 176, 160),
+	RGB_TO_16BIT_SWAP(39, 177, 152),
+	RGB_TO_16BIT_SWAP(45, 178, 145),
+	RGB_TO_16BIT_SWAP(49, 179, 139),
+	RGB_TO_16BIT_SWAP(54, 180, 131),
+	RGB_TO_16BIT_SWAP(60, 181, 126),
+	RGB_TO_16BIT_SWAP(64, 182, 118),
+	RGB_TO_16BIT_SWAP(69, 183, 110),
+	RGB_TO_16BIT_SWAP(74, 183, 104),
+	RGB_TO_16BIT_SWAP(79, 185, 97),
+	RGB_TO_16BIT_SWAP(84, 186, 91),
+	RGB_TO_16BIT_SWAP(88, 187, 83),
+	RGB_TO_16BIT_SWAP(93, 187, 76),
+	RGB_TO_16BIT_SWAP(99, 189, 71),
+	RGB_TO_16BIT_SWAP(103, 190, 63),
+	RGB_TO_16BIT_SWAP(107, 191, 57),
+	RGB_TO_16BIT_SWAP(113, 192, 50),
+	RGB_TO_16BIT_SWAP(118, 193, 42),
+	RGB_TO_16BIT_SWAP(122, 194, 36),
+	RGB_TO_16BIT_SWAP(127, 195, 28),
+	RGB_TO_16BIT_SWAP(133, 195, 20),
+	RGB_TO_16BIT_SWAP(139, 196, 15),
+	RGB_TO_16BIT_SWAP(143, 199, 14),
+	RGB_TO_16BIT_SWAP(148, 200, 15),
+	RGB_TO_16BIT_SWAP(151, 202, 13),
+	RGB_TO_16BIT_SWAP(155, 204, 13),
+	RGB_TO_16BIT_SWAP(161, 206, 15),
+	RGB_TO_16BIT_SWAP(164, 208, 13),
+	RGB_TO_16BIT_SWAP(169, 209, 13),
+	RGB_TO_16BIT_SWAP(173, 211, 14),
+	RGB_TO_16BIT_SWAP(178, 213, 13),
+	RGB_TO_16BIT_SWAP(182, 214, 13),
+	RGB_TO_16BIT_SWAP(187, 216, 14),
+	RGB_TO_16BIT_SWAP(192, 217, 13),
+	RGB_TO_16BIT_SWAP(196, 219, 13),
+	RGB_TO_16BIT_SWAP(201, 221, 13),
+	RGB_TO_16BIT_SWAP(205, 223, 13),
+	RGB_TO_16BIT_SWAP(210, 224, 13),
+	RGB_TO_16BIT_SWAP(213, 226, 11),
+	RGB_TO_16BIT_SWAP(217, 228, 13),
+	RGB_TO_16BIT_SWAP(222, 229, 13),
+	RGB_TO_16BIT_SWAP(226, 231, 11),
+	RGB_TO_16BIT_SWAP(231, 233, 13),
+	RGB_TO_16BIT_SWAP(236, 234, 13),
+	RGB_TO_16BIT_SWAP(236, 229, 13),
+	RGB_TO_16BIT_SWAP(236, 224, 16),
+	RGB_TO_16BIT_SWAP(237, 219, 17),
+	RGB_TO_16BIT_SWAP(236, 214, 20),
+	RGB_TO_16BIT_SWAP(236, 209, 22),
+	RGB_TO_16BIT_SWAP(236, 203, 22),
+	RGB_TO_16BIT_SWAP(236, 198, 25),
+	RGB_TO_16BIT_SWAP(237, 193, 28),
+	RGB_TO_16BIT_SWAP(236, 188, 30),
+	RGB_TO_16BIT_SWAP(236, 183, 31),
+	RGB_TO_16BIT_SWAP(236, 177, 33),
+	RGB_TO_16BIT_SWAP(236, 172, 34),
+	RGB_TO_16BIT_SWAP(236, 167, 36),
+	RGB_TO_16BIT_SWAP(236, 162, 39),
+	RGB_TO_16BIT_SWAP(238, 156, 42),
+	RGB_TO_16BIT_SWAP(237, 151, 42),
+	RGB_TO_16BIT_SWAP(237, 146, 45),
+	RGB_TO_16BIT_SWAP(237, 140, 47),
+	RGB_TO_16BIT_SWAP(238, 136, 48),
+	RGB_TO_16BIT_SWAP(238, 131, 51),
+	RGB_TO_16BIT_SWAP(237, 125, 53),
+	RGB_TO_16BIT_SWAP(235, 118, 52),
+	RGB_TO_16BIT_SWAP(235, 113, 52),
+	RGB_TO_16BIT_SWAP(234, 105, 52),
+	RGB_TO_16BIT_SWAP(233, 99, 52),
+	RGB_TO_16BIT_SWAP(232, 93, 52),
+	RGB_TO_16BIT_SWAP(231, 86, 53),
+	RGB_TO_16BIT_SWAP(229, 80, 52),
+	RGB_TO_16BIT_SWAP(230, 73, 52),
+	RGB_TO_16BIT_SWAP(228, 67, 53),
+	RGB_TO_16BIT_SWAP(227, 61, 53),
+	RGB_TO_16BIT_SWAP(226, 54, 52),
+	RGB_TO_16BIT_SWAP(225, 48, 52),
+	RGB_TO_16BIT_SWAP(227, 56, 61),
+	RGB_TO_16BIT_SWAP(227, 64, 69),
+	RGB_TO_16BIT_SWAP(227, 73, 77),
+	RGB_TO_16BIT_SWAP(227, 80, 86),
+	RGB_TO_16BIT_SWAP(227, 88, 93),
+	RGB_TO_16BIT_SWAP(229, 96, 101),
+	RGB_TO_16BIT_SWAP(228, 105, 109),
+	RGB_TO_16BIT_SWAP(230, 113, 118),
+	RGB_TO_16BIT_SWAP(230, 121, 126),
+	RGB_TO_16BIT_SWAP(231, 130, 136),
+	RGB_TO_16BIT_SWAP(231, 138, 142),
+	RGB_TO_16BIT_SWAP(230, 146, 150),
+	RGB_TO_16BIT_SWAP(231, 154, 158),
+	RGB_TO_16BIT_SWAP(233, 162, 166),
+	RGB_TO_16BIT_SWAP(233, 170, 175),
+	RGB_TO_16BIT_SWAP(232, 175, 178),
+	RGB_TO_16BIT_SWAP(232, 179, 183),
+	RGB_TO_16BIT_SWAP(233, 184, 189),
+	RGB_TO_16BIT_SWAP(233, 189, 194),
+	RGB_TO_16BIT_SWAP(233, 195, 198),
+	RGB_TO_16BIT_SWAP(233, 199, 202),
+	RGB_TO_16BIT_SWAP(235, 204, 206),
+	RGB_TO_16BIT_SWAP(235, 208, 213),
+	RGB_TO_16BIT_SWAP(234, 213, 216),
+	RGB_TO_16BIT_SWAP(235, 218, 222),
+	RGB_TO_16BIT_SWAP(235, 222, 227),
+	RGB_TO_16BIT_SWAP(234, 227, 230),
+	RGB_TO_16BIT_SWAP(235, 232, 235),
 };
 
 #endif
\ No newline at end of file
@@ -24,263 +24,263 @@
 
 #include "palettes.h"
 
-palette_map_t fusion_palette_map = {
-	{0,2,36},
-	{1,2,37},
-	{3,3,38},
-	{3,3,39},
-	{5,3,41},
-	{6,3,42},
-	{8,4,44},
-	{8,4,46},
-	{10,4,47},
-	{12,5,49},
-	{14,5,51},
-	{15,5,53},
-	{17,6,56},
-	{18,6,58},
-	{20,7,61},
-	{22,6,62},
-	{24,7,66},
-	{26,7,68},
-	{28,8,70},
-	{30,8,73},
-	{32,9,75},
-	{35,9,78},
-	{36,9,81},
-	{39,10,84},
-	{41,10,86},
-	{43,11,89},
-	{46,11,91},
-	{47,11,95},
-	{50,13,97},
-	{52,13,101},
-	{55,13,103},
-	{57,13,106},
-	{59,14,109},
-	{61,14,111},
-	{64,16,114},
-	{66,16,116},
-	{68,16,119},
-	{71,16,121},
-	{74,18,123},
-	{76,18,127},
-	{79,18,129},
-	{81,19,131},
-	{83,20,134},
-	{86,21,135},
-	{88,21,137},
-	{90,22,139},
-	{93,22,141},
-	{95,23,143},
-	{97,24,145},
-	{100,24,147},
-	{102,25,147},
-	{104,26,149},
-	{107,26,151},
-	{109,27,151},
-	{111,28,152},
-	{114,29,153},
-	{116,29,154},
-	{117,30,155},
-	{120,31,155},
-	{122,32,155},
-	{124,33,155},
-	{126,34,155},
-	{128,34,155},
-	{130,36,155},
-	{133,36,154},
-	{134,37,153},
-	{137,38,152},
-	{139,39,151},
-	{141,40,150},
-	{144,41,148},
-	{145,42,147},
-	{147,42,145},
-	{150,43,142},
-	{152,44,141},
-	{154,45,139},
-	{156,46,136},
-	{158,47,134},
-	{161,48,131},
-	{163,49,129},
-	{166,51,126},
-	{168,51,124},
-	{170,52,121},
-	{172,53,118},
-	{175,54,115},
-	{177,55,111},
-	{179,56,108},
-	{182,58,105},
-	{184,59,102},
-	{186,60,99},
-	{188,61,95},
-	{191,62,92},
-	{192,63,89},
-	{195,64,86},
-	{197,66,82},
-	{200,67,79},
-	{202,68,75},
-	{203,69,72},
-	{206,70,69},
-	{207,71,66},
-	{210,72,62},
-	{211,74,59},
-	{214,75,56},
-	{216,76,52},
-	{218,77,49},
-	{219,79,47},
-	{222,80,44},
-	{223,82,41},
-	{225,82,37},
-	{227,85,34},
-	{229,86,32},
-	{231,87,29},
-	{232,89,27},
-	{234,90,25},
-	{236,92,22},
-	{236,93,20},
-	{239,94,18},
-	{240,95,16},
-	{241,98,14},
-	{243,99,12},
-	{244,100,10},
-	{245,102,9},
-	{246,103,8},
-	{247,105,6},
-	{248,107,6},
-	{249,107,6},
-	{250,110,6},
-	{251,111,6},
-	{251,112,6},
-	{252,114,6},
-	{253,115,6},
-	{253,117,6},
-	{253,119,6},
-	{253,120,6},
-	{253,122,6},
-	{253,124,6},
-	{253,125,6},
-	{253,127,6},
-	{253,129,6},
-	{253,130,6},
-	{253,133,6},
-	{253,134,6},
-	{253,136,6},
-	{253,138,6},
-	{253,140,6},
-	{253,141,6},
-	{253,144,6},
-	{253,146,6},
-	{253,147,6},
-	{253,149,6},
-	{253,151,6},
-	{253,154,6},
-	{253,156,6},
-	{253,158,6},
-	{253,160,6},
-	{253,162,6},
-	{253,164,6},
-	{253,166,6},
-	{253,168,6},
-	{253,170,6},
-	{253,171,6},
-	{253,174,6},
-	{253,175,6},
-	{253,178,6},
-	{253,180,6},
-	{253,181,6},
-	{253,184,7},
-	{253,186,7},
-	{253,187,8},
-	{253,189,10},
-	{253,191,10},
-	{253,193,11},
-	{253,195,12},
-	{253,196,13},
-	{253,199,14},
-	{253,200,15},
-	{253,202,16},
-	{253,204,18},
-	{253,205,19},
-	{253,207,20},
-	{253,209,22},
-	{253,210,22},
-	{253,211,24},
-	{253,214,25},
-	{253,215,26},
-	{253,216,28},
-	{253,218,29},
-	{253,219,31},
-	{253,221,31},
-	{253,223,33},
-	{253,223,35},
-	{253,225,36},
-	{253,225,38},
-	{253,227,39},
-	{253,229,42},
-	{253,230,43},
-	{253,230,44},
-	{253,232,47},
-	{253,233,49},
-	{253,233,52},
-	{253,235,54},
-	{253,236,57},
-	{254,236,60},
-	{253,237,62},
-	{253,239,65},
-	{253,239,68},
-	{254,240,72},
-	{253,241,75},
-	{254,242,78},
-	{254,242,82},
-	{253,243,86},
-	{253,244,89},
-	{253,244,93},
-	{253,245,96},
-	{254,245,100},
-	{253,246,104},
-	{254,247,108},
-	{254,247,112},
-	{254,248,115},
-	{254,248,119},
-	{254,248,124},
-	{254,248,128},
-	{254,249,132},
-	{254,249,136},
-	{253,250,141},
-	{253,250,144},
-	{254,250,149},
-	{254,250,153},
-	{254,251,157},
-	{254,251,161},
-	{254,251,165},
-	{254,251,169},
-	{253,252,173},
-	{254,252,177},
-	{254,252,181},
-	{254,252,185},
-	{254,252,189},
-	{254,252,192},
-	{254,252,196},
-	{254,253,200},
-	{254,252,204},
-	{254,253,207},
-	{254,253,211},
-	{254,253,215},
-	{254,253,218},
-	{254,253,221},
-	{254,253,224},
-	{254,254,227},
-	{254,254,230},
-	{254,254,233},
-	{254,254,236},
-	{254,254,238},
-	{254,254,240},
-	{254,255,243},
-	{254,255,245},
-	{254,254,248},
-	{255,255,255}
+palette16_map_t fusion_palette16_map = {
+	RGB_TO_16BIT_SWAP(0, 2, 36),
+	RGB_TO_16BIT_SWAP(1, 2, 37),
+	RGB_TO_16BIT_SWAP(3, 3, 38),
+	RGB_TO_16BIT_SWAP(3, 3, 39),
+	RGB_TO_16BIT_SWAP(5, 3, 41),
+	RGB_TO_16BIT_SWAP(6, 3, 42),
+	RGB_TO_16BIT_SWAP(8, 4, 44),
+	RGB_TO_16BIT_SWAP(8, 4, 46),
+	RGB_TO_16BIT_SWAP(10, 4, 47),
+	RGB_TO_16BIT_SWAP(12, 5, 49),
+	RGB_TO_16BIT_SWAP(14, 5, 51),
+	RGB_TO_16BIT_SWAP(15, 5, 53),
+	RGB_TO_16BIT_SWAP(17, 6, 56),
+	RGB_TO_16BIT_SWAP(18, 6, 58),
+	RGB_TO_16BIT_SWAP(20, 7, 61),
+	RGB_TO_16BIT_SWAP(22, 6, 62),
+	RGB_TO_16BIT_SWAP(24, 7, 66),
+	RGB_TO_16BIT_SWAP(26, 7, 68),
+	RGB_TO_16BIT_SWAP(28, 8, 70),
+	RGB_TO_16BIT_SWAP(30, 8, 73),
+	RGB_TO_16BIT_SWAP(32, 9, 75),
+	RGB_TO_16BIT_SWAP(35, 9, 78),
+	RGB_TO_16BIT_SWAP(36, 9, 81),
+	RGB_TO_16BIT_SWAP(39, 10, 84),
+	RGB_TO_16BIT_SWAP(41, 10, 86),
+	RGB_TO_16BIT_SWAP(43, 11, 89),
+	RGB_TO_16BIT_SWAP(46, 11, 91),
+	RGB_TO_16BIT_SWAP(47, 11, 95),
+	RGB_TO_16BIT_SWAP(50, 13, 97),
+	RGB_TO_16BIT_SWAP(52, 13, 101),
+	RGB_TO_16BIT_SWAP(55, 13, 103),
+	RGB_TO_16BIT_SWAP(57, 13, 106),
+	RGB_TO_16BIT_SWAP(59, 14, 109),
+	RGB_TO_16BIT_SWAP(61, 14, 111),
+	RGB_TO_16BIT_SWAP(64, 16, 114),
+	RGB_TO_16BIT_SWAP(66, 16, 116),
+	RGB_TO_16BIT_SWAP(68, 16, 119),
+	RGB_TO_16BIT_SWAP(71, 16, 121),
+	RGB_TO_16BIT_SWAP(74, 18, 123),
+	RGB_TO_16BIT_SWAP(76, 18, 127),
+	RGB_TO_16BIT_SWAP(79, 18, 129),
+	RGB_TO_16BIT_SWAP(81, 19, 131),
+	RGB_TO_16BIT_SWAP(83, 20, 134),
+	RGB_TO_16BIT_SWAP(86, 21, 135),
+	RGB_TO_16BIT_SWAP(88, 21, 137),
+	RGB_TO_16BIT_SWAP(90, 22, 139),
+	RGB_TO_16BIT_SWAP(93, 22, 141),
+	RGB_TO_16BIT_SWAP(95, 23, 143),
+	RGB_TO_16BIT_SWAP(97, 24, 145),
+	RGB_TO_16BIT_SWAP(100, 24, 147),
+	RGB_TO_16BIT_SWAP(102, 25, 147),
+	RGB_TO_16BIT_SWAP(104, 26, 149),
+	RGB_TO_16BIT_SWAP(107, 26, 151),
+	RGB_TO_16BIT_SWAP(109, 27, 151),
+	RGB_TO_16BIT_SWAP(111, 28, 152),
+	RGB_TO_16BIT_SWAP(114, 29, 153),
+	RGB_TO_16BIT_SWAP(116, 29, 154),
+	RGB_TO_16BIT_SWAP(117, 30, 155),
+	RGB_TO_16BIT_SWAP(120, 31, 155),
+	RGB_TO_16BIT_SWAP(122, 32, 155),
+	RGB_TO_16BIT_SWAP(124, 33, 155),
+	RGB_TO_16BIT_SWAP(126, 34, 155),
+	RGB_TO_16BIT_SWAP(128, 34, 155),
+	RGB_TO_16BIT_SWAP(130, 36, 155),
+	RGB_TO_16BIT_SWAP(133, 36, 154),
+	RGB_TO_16BIT_SWAP(134, 37, 153),
+	RGB_TO_16BIT_SWAP(137, 38, 152),
+	RGB_TO_16BIT_SWAP(139, 39, 151),
+	RGB_TO_16BIT_SWAP(141, 40, 150),
+	RGB_TO_16BIT_SWAP(144, 41, 148),
+	RGB_TO_16BIT_SWAP(145, 42, 147),
+	RGB_TO_16BIT_SWAP(147, 42, 145),
+	RGB_TO_16BIT_SWAP(150, 43, 142),
+	RGB_TO_16BIT_SWAP(152, 44, 141),
+	RGB_TO_16BIT_SWAP(154, 45, 139),
+	RGB_TO_16BIT_SWAP(156, 46, 136),
+	RGB_TO_16BIT_SWAP(158, 47, 134),
+	RGB_TO_16BIT_SWAP(161, 48, 131),
+	RGB_TO_16BIT_SWAP(163, 49, 129),
+	RGB_TO_16BIT_SWAP(166, 51, 126),
+	RGB_TO_16BIT_SWAP(168, 51, 124),
+	RGB_TO_16BIT_SWAP(170, 52, 121),
+	RGB_TO_16BIT_SWAP(172, 53, 118),
+	RGB_TO_16BIT_SWAP(175, 54, 115),
+	RGB_TO_16BIT_SWAP(177, 55, 111),
+	RGB_TO_16BIT_SWAP(179, 56, 108),
+	RGB_TO_16BIT_SWAP(182, 58, 105),
+	RGB_TO_16BIT_SWAP(184, 59, 102),
+	RGB_TO_16BIT_SWAP(186, 60, 99),
+	RGB_TO_16BIT_SWAP(188, 61, 95),
+	RGB_TO_16BIT_SWAP(191, 62, 92),
+	RGB_TO_16BIT_SWAP(192, 63, 89),
+	RGB_TO_16BIT_SWAP(195, 64, 86),
+	RGB_TO_16BIT_SWAP(197, 66, 82),
+	RGB_TO_16BIT_SWAP(200, 67, 79),
+	RGB_TO_16BIT_SWAP(202, 68, 75),
+	RGB_TO_16BIT_SWAP(203, 69, 72),
+	RGB_TO_16BIT_SWAP(206, 70, 69),
+	RGB_TO_16BIT_SWAP(207, 71, 66),
+	RGB_TO_16BIT_SWAP(210, 72, 62),
+	RGB_TO_16BIT_SWAP(211, 74, 59),
+	RGB_TO_16BIT_SWAP(214, 75, 56),
+	RGB_TO_16BIT_SWAP(216, 76, 52),
+	RGB_TO_16BIT_SWAP(218, 77, 49),
+	RGB_TO_16BIT_SWAP(219, 79, 47),
+	RGB_TO_16BIT_SWAP(222, 80, 44),
+	RGB_TO_16BIT_SWAP(223, 82, 41),
+	RGB_TO_16BIT_SWAP(225, 82, 37),
+	RGB_TO_16BIT_SWAP(227, 85, 34),
+	RGB_TO_16BIT_SWAP(229, 86, 32),
+	RGB_TO_16BIT_SWAP(231, 87, 29),
+	RGB_TO_16BIT_SWAP(232, 89, 27),
+	RGB_TO_16BIT_SWAP(234, 90, 25),
+	RGB_TO_16BIT_SWAP(236, 92, 22),
+	RGB_TO_16BIT_SWAP(236, 93, 20),
+	RGB_TO_16BIT_SWAP(239, 94, 18),
+	RGB_TO_16BIT_SWAP(240, 95, 16),
+	RGB_TO_16BIT_SWAP(241, 98, 14),
+	RGB_TO_16BIT_SWAP(243, 99, 12),
+	RGB_TO_16BIT_SWAP(244, 100, 10),
+	RGB_TO_16BIT_SWAP(245, 102, 9),
+	RGB_TO_16BIT_SWAP(246, 103, 8),
+	RGB_TO_16BIT_SWAP(247, 105, 6),
+	RGB_TO_16BIT_SWAP(248, 107, 6),
+	RGB_TO_16BIT_SWAP(249, 107, 6),
+	RGB_TO_16BIT_SWAP(250, 110, 6),
+	RGB_TO_16BIT_SWAP(251, 111, 6),
+	RGB_TO_16BIT_SWAP(251, 112, 6),
+	RGB_TO_16BIT_SWAP(252, 114, 6),
+	RGB_TO_16BIT_SWAP(253, 115, 6),
+	RGB_TO_16BIT_SWAP(253, 117, 6),
+	RGB_TO_16BIT_SWAP(253, 119, 6),
+	RGB_TO_16BIT_SWAP(253, 120, 6),
+	RGB_TO_16BIT_SWAP(253, 122, 6),
+	RGB_TO_16BIT_SWAP(253, 124, 6),
+	RGB_TO_16BIT_SWAP(253, 125, 6),
+	RGB_TO_16BIT_SWAP(253, 127, 6),
+	RGB_TO_16BIT_SWAP(253, 129, 6),
+	RGB_TO_16BIT_SWAP(253, 130, 6),
+	RGB_TO_16BIT_SWAP(253, 133, 6),
+	RGB_TO_16BIT_SWAP(253, 134, 6),
+	RGB_TO_16BIT_SWAP(253, 136, 6),
+	RGB_TO_16BIT_SWAP(253, 138, 6),
+	RGB_TO_16BIT_SWAP(253, 140, 6),
+	RGB_TO_16BIT_SWAP(253, 141, 6),
+	RGB_TO_16BIT_SWAP(253, 144, 6),
+	RGB_TO_16BIT_SWAP(253, 146, 6),
+	RGB_TO_16BIT_SWAP(253, 147, 6),
+	RGB_TO_16BIT_SWAP(253, 149, 6),
+	RGB_TO_16BIT_SWAP(253, 151, 6),
+	RGB_TO_16BIT_SWAP(253, 154, 6),
+	RGB_TO_16BIT_SWAP(253, 156, 6),
+	RGB_TO_16BIT_SWAP(253, 158, 6),
+	RGB_TO_16BIT_SWAP(253, 160, 6),
+	RGB_TO_16BIT_SWAP(253, 162, 6),
+	RGB_TO_16BIT_SWAP(253, 164, 6),
+	RGB_TO_16BIT_SWAP(253, 166, 6),
+	RGB_TO_16BIT_SWAP(253, 168, 6),
+	RGB_TO_16BIT_SWAP(253, 170, 6),
+	RGB_TO_16BIT_SWAP(253, 171, 6),
+	RGB_TO_16BIT_SWAP(253, 174, 6),
+	RGB_TO_16BIT_SWAP(253, 175, 6),
+	RGB_TO_16BIT_SWAP(253, 178, 6),
+	RGB_TO_16BIT_SWAP(253, 180, 6),
+	RGB_TO_16BIT_SWAP(253, 181, 6),
+	RGB_TO_16BIT_SWAP(253, 184, 7),
+	RGB_TO_16BIT_SWAP(253, 186, 7),
+	RGB_TO_16BIT_SWAP(253, 187, 8),
+	RGB_TO_16BIT_SWAP(253, 189, 10),
+	RGB_TO_16BIT_SWAP(253, 191, 10),
+	RGB_TO_16BIT_SWAP(253, 193, 11),
+	RGB_TO_16BIT_SWAP(253, 195, 12),
+	RGB_TO_16BIT_SWAP(253, 196, 13),
+	RGB_TO_16BIT_SWAP(253, 199, 14),
+	RGB_TO_16BIT_SWAP(253, 200, 15),
+	RGB_TO_16BIT_SWAP(253, 202, 16),
+	RGB_TO_16BIT_SWAP(253, 204, 18),
+	RGB_TO_16BIT_SWAP(253, 205, 19),
+	RGB_TO_16BIT_SWAP(253, 207, 20),
+	RGB_TO_16BIT_SWAP(253, 209, 22),
+	RGB_TO_16BIT_SWAP(253, 210, 22),
+	RGB_TO_16BIT_SWAP(253, 211, 24),
+	RGB_TO_16BIT_SWAP(253, 214, 25),
+	RGB_TO_16BIT_SWAP(253, 215, 26),
+	RGB_TO_16BIT_SWAP(253, 216, 28),
+	RGB_TO_16BIT_SWAP(253, 218, 29),
+	RGB_TO_16BIT_SWAP(253, 219, 31),
+	RGB_TO_16BIT_SWAP(253, 221, 31),
+	RGB_TO_16BIT_SWAP(253, 223, 33),
+	RGB_TO_16BIT_SWAP(253, 223, 35),
+	RGB_TO_16BIT_SWAP(253, 225, 36),
+	RGB_TO_16BIT_SWAP(253, 225, 38),
+	RGB_TO_16BIT_SWAP(253, 227, 39),
+	RGB_TO_16BIT_SWAP(253, 229, 42),
+	RGB_TO_16BIT_SWAP(253, 230, 43),
+	RGB_TO_16BIT_SWAP(253, 230, 44),
+	RGB_TO_16BIT_SWAP(253, 232, 47),
+	RGB_TO_16BIT_SWAP(253, 233, 49),
+	RGB_TO_16BIT_SWAP(253, 233, 52),
+	RGB_TO_16BIT_SWAP(253, 235, 54),
+	RGB_TO_16BIT_SWAP(253, 236, 57),
+	RGB_TO_16BIT_SWAP(254, 236, 60),
+	RGB_TO_16BIT_SWAP(253, 237, 62),
+	RGB_TO_16BIT_SWAP(253, 239, 65),
+	RGB_TO_16BIT_SWAP(253, 239, 68),
+	RGB_TO_16BIT_SWAP(254, 240, 72),
+	RGB_TO_16BIT_SWAP(253, 241, 75),
+	RGB_TO_16BIT_SWAP(254, 242, 78),
+	RGB_TO_16BIT_SWAP(254, 242, 82),
+	RGB_TO_16BIT_SWAP(253, 243, 86),
+	RGB_TO_16BIT_SWAP(253, 244, 89),
+	RGB_TO_16BIT_SWAP(253, 244, 93),
+	RGB_TO_16BIT_SWAP(253, 245, 96),
+	RGB_TO_16BIT_SWAP(254, 245, 100),
+	RGB_TO_16BIT_SWAP(253, 246, 104),
+	RGB_TO_16BIT_SWAP(254, 247, 108),
+	RGB_TO_16BIT_SWAP(254, 247, 112),
+	RGB_TO_16BIT_SWAP(254, 248, 115),
+	RGB_TO_16BIT_SWAP(254, 248, 119),
+	RGB_TO_16BIT_SWAP(254, 248, 124),
+	RGB_TO_16BIT_SWAP(254, 248, 128),
+	RGB_TO_16BIT_SWAP(254, 249, 132),
+	RGB_TO_16BIT_SWAP(254, 249, 136),
+	RGB_TO_16BIT_SWAP(253, 250, 141),
+	RGB_TO_16BIT_SWAP(253, 250, 144),
+	RGB_TO_16BIT_SWAP(254, 250, 149),
+	RGB_TO_16BIT_SWAP(254, 250, 153),
+	RGB_TO_16BIT_SWAP(254, 251, 157),
+	RGB_TO_16BIT_SWAP(254, 251, 161),
+	RGB_TO_16BIT_SWAP(254, 251, 165),
+	RGB_TO_16BIT_SWAP(254, 251, 169),
+	RGB_TO_16BIT_SWAP(253, 252, 173),
+	RGB_TO_16BIT_SWAP(254, 252, 177),
+	RGB_TO_16BIT_SWAP(254, 252, 181),
+	RGB_TO_16BIT_SWAP(254, 252, 185),
+	RGB_TO_16BIT_SWAP(254, 252, 189),
+	RGB_TO_16BIT_SWAP(254, 252, 192),
+	RGB_TO_16BIT_SWAP(254, 252, 196),
+	RGB_TO_16BIT_SWAP(254, 253, 200),
+	RGB_TO_16BIT_SWAP(254, 252, 204),
+	RGB_TO_16BIT_SWAP(254, 253, 207),
+	RGB_TO_16BIT_SWAP(254, 253, 211),
+	RGB_TO_16BIT_SWAP(254, 253, 215),
+	RGB_TO_16BIT_SWAP(254, 253, 218),
+	RGB_TO_16BIT_SWAP(254, 253, 221),
+	RGB_TO_16BIT_SWAP(254, 253, 224),
+	RGB_TO_16BIT_SWAP(254, 254, 227),
+	RGB_TO_16BIT_SWAP(254, 254, 230),
+	RGB_TO_16BIT_SWAP(254, 254, 233),
+	RGB_TO_16BIT_SWAP(254, 254, 236),
+	RGB_TO_16BIT_SWAP(254, 254, 238),
+	RGB_TO_16BIT_SWAP(254, 254, 240),
+	RGB_TO_16BIT_SWAP(254, 255, 243),
+	RGB_TO_16BIT_SWAP(254, 255, 245),
+	RGB_TO_16BIT_SWAP(254, 254, 248),
+	RGB_TO_16BIT_SWAP(255, 255, 255)
 };
 
 #endif
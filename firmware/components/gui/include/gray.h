@@ -24,263 +24,263 @@
 
 #include "palettes.h"
 
-palette_map_t gray_palette_map = {
-	{0,0,0},
-	{1,1,1},
-	{2,2,2},
-	{3,3,3},
-	{4,4,4},
-	{5,5,5},
-	{6,6,6},
-	{7,7,7},
-	{8,8,8},
-	{9,9,9},
-	{10,10,10},
-	{11,11,11},
-	{12,12,12},
-	{13,13,13},
-	{14,14,14},
-	{15,15,15},
-	{16,16,16},
-	{17,17,17},
-	{18,18,18},
-	{19,19,19},
-	{20,20,20},
-	{21,21,21},
-	{22,22,22},
-	{23,23,23},
-	{24,24,24},
-	{25,25,25},
-	{26,26,26},
-	{27,27,27},
-	{28,28,28},
-	{29,29,29},
-	{30,30,30},
-	{31,31,31},
-	{32,32,32},
-	{33,33,33},
-	{34,34,34},
-	{35,35,35},
-	{36,36,36},
-	{37,37,37},
-	{38,38,38},
-	{39,39,39},
-	{40,40,40},
-	{41,41,41},
-	{42,42,42},
-	{43,43,43},
-	{44,44,44},
-	{45,45,45},
-	{46,46,46},
-	{47,47,47},
-	{48,48,48},
-	{49,49,49},
-	{50,50,50},
-	{51,51,51},
-	{52,52,52},
-	{53,53,53},
-	{54,54,54},
-	{55,55,55},
-	{56,56,56},
-	{57,57,57},
-	{58,58,58},
-	{59,59,59},
-	{60,60,60},
-	{61,61,61},
-	{62,62,62},
-	{63,63,63},
-	{64,64,64},
-	{65,65,65},
-	{66,66,66},
-	{67,67,67},
-	{68,68,68},
-	{69,69,69},
-	{70,70,70},
-	{71,71,71},
-	{72,72,72},
-	{73,73,73},
-	{74,74,74},
-	{75,75,75},
-	{76,76,76},
-	{77,77,77},
-	{78,78,78},
-	{79,79,79},
-	{80,80,80},
-	{81,81,81},
-	{82,82,82},
-	{83,83,83},
-	{84,84,84},
-	{85,85,85},
-	{86,86,86},
-	{87,87,87},
-	{88,88,88},
-	{89,89,89},
-	{90,90,90},
-	{91,91,91},
-	{92,92,92},
-	{93,93,93},
-	{94,94,94},
-	{95,95,95},
-	{96,96,96},
-	{97,97,97},
-	{98,98,98},
-	{99,99,99},
-	{100,100,100},
-	{101,101,101},
-	{102,102,102},
-	{103,103,103},
-	{104,104,104},
-	{105,105,105},
-	{106,106,106},
-	{107,107,107},
-	{108,108,108},
-	{109,109,109},
-	{110,110,110},
-	{111,111,111},
-	{112,112,112},
-	{113,113,113},
-	{114,114,114},
-	{115,115,115},
-	{116,116,116},
-	{117,117,117},
-	{118,118,118},
-	{119,119,119},
-	{120,120,120},
-	{121,121,121},
-	{122,122,122},
-	{123,123,123},
-	{124,124,124},
-	{125,125,125},
-	{126,126,126},
-	{127,127,127},
-	{128,128,128},
-	{129,129,129},
-	{130,130,130},
-	{131,131,131},
-	{132,132,132},
-	{133,133,133},
-	{134,134,134},
-	{135,135,135},
-	{136,136,136},
-	{137,137,137},
-	{138,138,138},
-	{139,139,139},
-	{140,140,140},
-	{141,141,141},
-	{142,142,142},
-	{143,143,143},
-	{144,144,144},
-	{145,145,145},
-	{146,146,146},
-	{147,147,147},
-	{148,148,148},
-	{149,149,149},
-	{150,150,150},
-	{151,151,151},
-	{152,152,152},
-	{153,153,153},
-	{154,154,154},
-	{155,155,155},
-	{156,156,156},
-	{157,157,157},
-	{158,158,158},
-	{159,159,159},
-	{160,160,160},
-	{161,161,161},
-	{162,162,162},
-	{163,163,163},
-	{164,164,164},
-	{165,165,165},
-	{166,166,166},
-	{167,167,167},
-	{168,168,168},
-	{169,169,169},
-	{170,170,170},
-	{171,171,171},
-	{172,172,172},
-	{173,173,173},
-	{174,174,174},
-	{175,175,175},
-	{176,176,176},
-	{177,177,177},
-	{178,178,178},
-	{179,179,179},
-	{180,180,180},
-	{181,181,181},
-	{182,182,182},
-	{183,183,183},
-	{184,184,184},
-	{185,185,185},
-	{186,186,186},
-	{187,187,187},
-	{188,188,188},
-	{189,189,189},
-	{190,190,190},
-	{191,191,191},
-	{192,192,192},
-	{193,193,193},
-	{194,194,194},
-	{195,195,195},
-	{196,196,196},
-	{197,197,197},
-	{198,198,198},
-	{199,199,199},
-	{200,200,200},
-	{201,201,201},
-	{202,202,202},
-	{203,203,203},
-	{204,204,204},
-	{205,205,205},
-	{206,206,206},
-	{207,207,207},
-	{208,208,208},
-	{209,209,209},
-	{210,210,210},
-	{211,211,211},
-	{212,212,212},
-	{213,213,213},
-	{214,214,214},
-	{215,215,215},
-	{216,216,216},
-	{217,217,217},
-	{218,218,218},
-	{219,219,219},
-	{220,220,220},
-	{221,221,221},
-	{222,222,222},
-	{223,223,223},
-	{224,224,224},
-	{225,225,225},
-	{226,226,226},
-	{227,227,227},
-	{228,228,228},
-	{229,229,229},
-	{230,230,230},
-	{231,231,231},
-	{232,232,232},
-	{233,233,233},
-	{234,234,234},
-	{235,235,235},
-	{236,236,236},
-	{237,237,237},
-	{238,238,238},
-	{239,239,239},
-	{240,240,240},
-	{241,241,241},
-	{242,242,242},
-	{243,243,243},
-	{244,244,244},
-	{245,245,245},
-	{246,246,246},
-	{247,247,247},
-	{248,248,248},
-	{249,249,249},
-	{250,250,250},
-	{251,251,251},
-	{252,252,252},
-	{253,253,253},
-	{254,254,254},
-	{255,255,255}
+palette16_map_t gray_palette16_map = {
+	RGB_TO_16BIT_SWAP(0, 0, 0),
+	RGB_TO_16BIT_SWAP(1, 1, 1),
+	RGB_TO_16BIT_SWAP(2, 2, 2),
+	RGB_TO_16BIT_SWAP(3, 3, 3),
+	RGB_TO_16BIT_SWAP(4, 4, 4),
+	RGB_TO_16BIT_SWAP(5, 5, 5),
+	RGB_TO_16BIT_SWAP(6, 6, 6),
+	RGB_TO_16BIT_SWAP(7, 7, 7),
+	RGB_TO_16BIT_SWAP(8, 8, 8),
+	RGB_TO_16BIT_SWAP(9, 9, 9),
+	RGB_TO_16BIT_SWAP(10, 10, 10),
+	RGB_TO_16BIT_SWAP(11, 11, 11),
+	RGB_TO_16BIT_SWAP(12, 12, 12),
+	RGB_TO_16BIT_SWAP(13, 13, 13),
+	RGB_TO_16BIT_SWAP(14, 14, 14),
+	RGB_TO_16BIT_SWAP(15, 15, 15),
+	RGB_TO_16BIT_SWAP(16, 16, 16),
+	RGB_TO_16BIT_SWAP(17, 17, 17),
+	RGB_TO_16BIT_SWAP(18, 18, 18),
+	RGB_TO_16BIT_SWAP(19, 19, 19),
+	RGB_TO_16BIT_SWAP(20, 20, 20),
+	RGB_TO_16BIT_SWAP(21, 21, 21),
+	RGB_TO_16BIT_SWAP(22, 22, 22),
+	RGB_TO_16BIT_SWAP(23, 23, 23),
+	RGB_TO_16BIT_SWAP(24, 24, 24),
+	RGB_TO_16BIT_SWAP(25, 25, 25),
+	RGB_TO_16BIT_SWAP(26, 26, 26),
+	RGB_TO_16BIT_SWAP(27, 27, 27),
+	RGB_TO_16BIT_SWAP(28, 28, 28),
+	RGB_TO_16BIT_SWAP(29, 29, 29),
+	RGB_TO_16BIT_SWAP(30, 30, 30),
+	RGB_TO_16BIT_SWAP(31, 31, 31),
+	RGB_TO_16BIT_SWAP(32, 32, 32),
+	RGB_TO_16BIT_SWAP(33, 33, 33),
+	RGB_TO_16BIT_SWAP(34, 34, 34),
+	RGB_TO_16BIT_SWAP(35, 35, 35),
+	RGB_TO_16BIT_SWAP(36, 36, 36),
+	RGB_TO_16BIT_SWAP(37, 37, 37),
+	RGB_TO_16BIT_SWAP(38, 38, 38),
+	RGB_TO_16BIT_SWAP(39, 39, 39),
+	RGB_TO_16BIT_SWAP(40, 40, 40),
+	RGB_TO_16BIT_SWAP(41, 41, 41),
+	RGB_TO_16BIT_SWAP(42, 42, 42),
+	RGB_TO_16BIT_SWAP(43, 43, 43),
+	RGB_TO_16BIT_SWAP(44, 44, 44),
+	RGB_TO_16BIT_SWAP(45, 45, 45),
+	RGB_TO_16BIT_SWAP(46, 46, 46),
+	RGB_TO_16BIT_SWAP(47, 47, 47),
+	RGB_TO_16BIT_SWAP(48, 48, 48),
+	RGB_TO_16BIT_SWAP(49, 49, 49),
+	RGB_TO_16BIT_SWAP(50, 50, 50),
+	RGB_TO_16BIT_SWAP(51, 51, 51),
+	RGB_TO_16BIT_SWAP(52, 52, 52),
+	RGB_TO_16BIT_SWAP(53, 53, 53),
+	RGB_TO_16BIT_SWAP(54, 54, 54),
+	RGB_TO_16BIT_SWAP(55, 55, 55),
+	RGB_TO_16BIT_SWAP(56, 56, 56),
+	RGB_TO_16BIT_SWAP(57, 57, 57),
+	RGB_TO_16BIT_SWAP(58, 58, 58),
+	RGB_TO_16BIT_SWAP(59, 59, 59),
+	RGB_TO_16BIT_SWAP(60, 60, 60),
+	RGB_TO_16BIT_SWAP(61, 61, 61),
+	RGB_TO_16BIT_SWAP(62, 62, 62),
+	RGB_TO_16BIT_SWAP(63, 63, 63),
+	RGB_TO_16BIT_SWAP(64, 64, 64),
+	RGB_TO_16BIT_SWAP(65, 65, 65),
+	RGB_TO_16BIT_SWAP(66, 66, 66),
+	RGB_TO_16BIT_SWAP(67, 67, 67),
+	RGB_TO_16BIT_SWAP(68, 68, 68),
+	RGB_TO_16BIT_SWAP(69, 69, 69),
+	RGB_TO_16BIT_SWAP(70, 70, 70),
+	RGB_TO_16BIT_SWAP(71, 71, 71),
+	RGB_TO_16BIT_SWAP(72, 72, 72),
+	RGB_TO_16BIT_SWAP(73, 73, 73),
+	RGB_TO_16BIT_SWAP(74, 74, 74),
+	RGB_TO_16BIT_SWAP(75, 75, 75),
+	RGB_TO_16BIT_SWAP(76, 76, 76),
+	RGB_TO_16BIT_SWAP(77, 77, 77),
+	RGB_TO_16BIT_SWAP(78, 78, 78),
+	RGB_TO_16BIT_SWAP(79, 79, 79),
+	RGB_TO_16BIT_SWAP(80, 80, 80),
+	RGB_TO_16BIT_SWAP(81, 81, 81),
+	RGB_TO_16BIT_SWAP(82, 82, 82),
+	RGB_TO_16BIT_SWAP(83, 83, 83),
+	RGB_TO_16BIT_SWAP(84, 84, 84),
+	RGB_TO_16BIT_SWAP(85, 85, 85),
+	RGB_TO_16BIT_SWAP(86, 86, 86),
+	RGB_TO_16BIT_SWAP(87, 87, 87),
+	RGB_TO_16BIT_SWAP(88, 88, 88),
+	RGB_TO_16BIT_SWAP(89, 89, 89),
+	RGB_TO_16BIT_SWAP(90, 90, 90),
+	RGB_TO_16BIT_SWAP(91, 91, 91),
+	RGB_TO_16BIT_SWAP(92, 92, 92),
+	RGB_TO_16BIT_SWAP(93, 93, 93),
+	RGB_TO_16BIT_SWAP(94, 94, 94),
+	RGB_TO_16BIT_SWAP(95, 95, 95),
+	RGB_TO_16BIT_SWAP(96, 96, 96),
+	RGB_TO_16BIT_SWAP(97, 97, 97),
+	RGB_TO_16BIT_SWAP(98, 98, 98),
+	RGB_TO_16BIT_SWAP(99, 99, 99),
+	RGB_TO_16BIT_SWAP(100, 100, 100),
+	RGB_TO_16BIT_SWAP(101, 101, 101),
+	RGB_TO_16BIT_SWAP(102, 102, 102),
+	RGB_TO_16BIT_SWAP(103, 103, 103),
+	RGB_TO_16BIT_SWAP(104, 104, 104),
+	RGB_TO_16BIT_SWAP(105, 105, 105),
+	RGB_TO_16BIT_SWAP(106, 106, 106),
+	RGB_TO_16BIT_SWAP(107, 107, 107),
+	RGB_TO_16BIT_SWAP(108, 108, 108),
+	RGB_TO_16BIT_SWAP(109, 109, 109),
+	RGB_TO_16BIT_SWAP(110, 110, 110),
+	RGB_TO_16BIT_SWAP(111, 111, 111),
+	RGB_TO_16BIT_SWAP(112, 112, 112),
+	RGB_TO_16BIT_SWAP(113, 113, 113),
+	RGB_TO_16BIT_SWAP(114, 114, 114),
+	RGB_TO_16BIT_SWAP(115, 115, 115),
+	RGB_TO_16BIT_SWAP(116, 116, 116),
+	RGB_TO_16BIT_SWAP(117, 117, 117),
+	RGB_TO_16BIT_SWAP(118, 118, 118),
+	RGB_TO_16BIT_SWAP(119, 119, 119),
+	RGB_TO_16BIT_SWAP(120, 120, 120),
+	RGB_TO_16BIT_SWAP(121, 121, 121),
+	RGB_TO_16BIT_SWAP(122, 122, 122),
+	RGB_TO_16BIT_SWAP(123, 123, 123),
+	RGB_TO_16BIT_SWAP(124, 124, 124),
+	RGB_TO_16BIT_SWAP(125, 125, 125),
+	RGB_TO_16BIT_SWAP(126, 126, 126),
+	RGB_TO_16BIT_SWAP(127, 127, 127),
+	RGB_TO_16BIT_SWAP(128, 128, 128),
+	RGB_TO_16BIT_SWAP(129, 129, 129),
+	RGB_TO_16BIT_SWAP(130, 130, 130),
+	RGB_TO_16BIT_SWAP(131, 131, 131),
+	RGB_TO_16BIT_SWAP(132, 132, 132),
+	RGB_TO_16BIT_SWAP(133, 133, 133),
+	RGB_TO_16BIT_SWAP(134, 134, 134),
+	RGB_TO_16BIT_SWAP(135, 135, 135),
+	RGB_TO_16BIT_SWAP(136, 136, 136),
+	RGB_TO_16BIT_SWAP(137, 137, 137),
+	RGB_TO_16BIT_SWAP(138, 138, 138),
+	RGB_TO_16BIT_SWAP(139, 139, 139),
+	RGB_TO_16BIT_SWAP(140, 140, 140),
+	RGB_TO_16BIT_SWAP(141, 141, 141),
+	RGB_TO_16BIT_SWAP(142, 142, 142),
+	RGB_TO_16BIT_SWAP(143, 143, 143),
+	RGB_TO_16BIT_SWAP(144, 144, 144),
+	RGB_TO_16BIT_SWAP(145, 145, 145),
+	RGB_TO_16BIT_SWAP(146, 146, 146),
+	RGB_TO_16BIT_SWAP(147, 147, 147),
+	RGB_TO_16BIT_SWAP(148, 148, 148),
+	RGB_TO_16BIT_SWAP(149, 149, 149),
+	RGB_TO_16BIT_SWAP(150, 150, 150),
+	RGB_TO_16BIT_SWAP(151, 151, 151),
+	RGB_TO_16BIT_SWAP(152, 152, 152),
+	RGB_TO_16BIT_SWAP(153, 153, 153),
+	RGB_TO_16BIT_SWAP(154, 154, 154),
+	RGB_TO_16BIT_SWAP(155, 155, 155),
+	RGB_TO_16BIT_SWAP(156, 156, 156),
+	RGB_TO_16BIT_SWAP(157, 157, 157),
+	RGB_TO_16BIT_SWAP(158, 158, 158),
+	RGB_TO_16BIT_SWAP(159, 159, 159),
+	RGB_TO_16BIT_SWAP(160, 160, 160),
+	RGB_TO_16BIT_SWAP(161, 161, 161),
+	RGB_TO_16BIT_SWAP(162, 162, 162),
+	RGB_TO_16BIT_SWAP(163, 163, 163),
+	RGB_TO_16BIT_SWAP(164, 164, 164),
+	RGB_TO_16BIT_SWAP(165, 165, 165),
+	RGB_TO_16BIT_SWAP(166, 166, 166),
+	RGB_TO_16BIT_SWAP(167, 167, 167),
+	RGB_TO_16BIT_SWAP(168, 168, 168),
+	RGB_TO_16BIT_SWAP(169, 169, 169),
+	RGB_TO_16BIT_SWAP(170, 170, 170),
+	RGB_TO_16BIT_SWAP(171, 171, 171),
+	RGB_TO_16BIT_SWAP(172, 172, 172),
+	RGB_TO_16BIT_SWAP(173, 173, 173),
+	RGB_TO_16BIT_SWAP(174, 174, 174),
+	RGB_TO_16BIT_SWAP(175, 175, 175),
+	RGB_TO_16BIT_SWAP(176, 176, 176),
+	RGB_TO_16BIT_SWAP(177, 177, 177),
+	RGB_TO_16BIT_SWAP(178, 178, 178),
+	RGB_TO_16BIT_SWAP(179, 179, 179),
+	RGB_TO_16BIT_SWAP(180, 180, 180),
+	RGB_TO_16BIT_SWAP(181, 181, 181),
+	RGB_TO_16BIT_SWAP(182, 182, 182),
+	RGB_TO_16BIT_SWAP(183, 183, 183),
+	RGB_TO_16BIT_SWAP(184, 184, 184),
+	RGB_TO_16BIT_SWAP(185, 185, 185),
+	RGB_TO_16BIT_SWAP(186, 186, 186),
+	RGB_TO_16BIT_SWAP(187, 187, 187),
+	RGB_TO_16BIT_SWAP(188, 188, 188),
+	RGB_TO_16BIT_SWAP(189, 189, 189),
+	RGB_TO_16BIT_SWAP(190, 190, 190),
+	RGB_TO_16BIT_SWAP(191, 191, 191),
+	RGB_TO_16BIT_SWAP(192, 192, 192),
+	RGB_TO_16BIT_SWAP(193, 193, 193),
+	RGB_TO_16BIT_SWAP(194, 194, 194),
+	RGB_TO_16BIT_SWAP(195, 195, 195),
+	RGB_TO_16BIT_SWAP(196, 196, 196),
+	RGB_TO_16BIT_SWAP(197, 197, 197),
+	RGB_TO_16BIT_SWAP(198, 198, 198),
+	RGB_TO_16BIT_SWAP(199, 199, 199),
+	RGB_TO_16BIT_SWAP(200, 200, 200),
+	RGB_TO_16BIT_SWAP(201, 201, 201),
+	RGB_TO_16BIT_SWAP(202, 202, 202),
+	RGB_TO_16BIT_SWAP(203, 203, 203),
+	RGB_TO_16BIT_SWAP(204, 204, 204),
+	RGB_TO_16BIT_SWAP(205, 205, 205),
+	RGB_TO_16BIT_SWAP(206, 206, 206),
+	RGB_TO_16BIT_SWAP(207, 207, 207),
+	RGB_TO_16BIT_SWAP(208, 208, 208),
+	RGB_TO_16BIT_SWAP(209, 209, 209),
+	RGB_TO_16BIT_SWAP(210, 210, 210),
+	RGB_TO_16BIT_SWAP(211, 211, 211),
+	RGB_TO_16BIT_SWAP(212, 212, 212),
+	RGB_TO_16BIT_SWAP(213, 213, 213),
+	RGB_TO_16BIT_SWAP(214, 214, 214),
+	RGB_TO_16BIT_SWAP(215, 215, 215),
+	RGB_TO_16BIT_SWAP(216, 216, 216),
+	RGB_TO_16BIT_SWAP(217, 217, 217),
+	RGB_TO_16BIT_SWAP(218, 218, 218),
+	RGB_TO_16BIT_SWAP(219, 219, 219),
+	RGB_TO_16BIT_SWAP(220, 220, 220),
+	RGB_TO_16BIT_SWAP(221, 221, 221),
+	RGB_TO_16BIT_SWAP(222, 222, 222),
+	RGB_TO_16BIT_SWAP(223, 223, 223),
+	RGB_TO_16BIT_SWAP(224, 224, 224),
+	RGB_TO_16BIT_SWAP(225, 225, 225),
+	RGB_TO_16BIT_SWAP(226, 226, 226),
+	RGB_TO_16BIT_SWAP(227, 227, 227),
+	RGB_TO_16BIT_SWAP(228, 228, 228),
+	RGB_TO_16BIT_SWAP(229, 229, 229),
+	RGB_TO_16BIT_SWAP(230, 230, 230),
+	RGB_TO_16BIT_SWAP(231, 231, 231),
+	RGB_TO_16BIT_SWAP(232, 232, 232),
+	RGB_TO_16BIT_SWAP(233, 233, 233),
+	RGB_TO_16BIT_SWAP(234, 234, 234),
+	RGB_TO_16BIT_SWAP(235, 235, 235),
+	RGB_TO_16BIT_SWAP(236, 236, 236),
+	RGB_TO_16BIT_SWAP(237, 237, 237),
+	RGB_TO_16BIT_SWAP(238, 238, 238),
+	RGB_TO_16BIT_SWAP(239, 239, 239),
+	RGB_TO_16BIT_SWAP(240, 240, 240),
+	RGB_TO_16BIT_SWAP(241, 241, 241),
+	RGB_TO_16BIT_SWAP(242, 242, 242),
+	RGB_TO_16BIT_SWAP(243, 243, 243),
+	RGB_TO_16BIT_SWAP(244, 244, 244),
+	RGB_TO_16BIT_SWAP(245, 245, 245),
+	RGB_TO_16BIT_SWAP(246, 246, 246),
+	RGB_TO_16BIT_SWAP(247, 247, 247),
+	RGB_TO_16BIT_SWAP(248, 248, 248),
+	RGB_TO_16BIT_SWAP(249, 249, 249),
+	RGB_TO_16BIT_SWAP(250, 250, 250),
+	RGB_TO_16BIT_SWAP(251, 251, 251),
+	RGB_TO_16BIT_SWAP(252, 252, 252),
+	RGB_TO_16BIT_SWAP(253, 253, 253),
+	RGB_TO_16BIT_SWAP(254, 254, 254),
+	RGB_TO_16BIT_SWAP(255, 255, 255)
 };
 
 #endif
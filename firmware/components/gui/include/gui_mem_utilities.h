@@ -0,0 +1,57 @@
+/*
+ * Little VGL memory allocator
+ *
+ * Little VGL is built with LV_MEM_CUSTOM set (see lv_conf.h) so its objects, styles and
+ * other dynamic data are allocated here, from the PSRAM, instead of from a fixed pool in
+ * the internal RAM.  The display buffers are allocated separately by gui_task in
+ * internal DMA-capable memory.  This header is included by Little VGL itself so it only
+ * depends on the standard headers.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef GUI_MEM_UTILITIES_H
+#define GUI_MEM_UTILITIES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+//
+// GUI Memory Utilities typedefs
+//
+typedef struct {
+	uint32_t used_bytes;         // Bytes allocated to Little VGL now
+	uint32_t peak_bytes;         // Most bytes allocated at once since startup
+	uint32_t allocations;        // Blocks allocated now
+	uint32_t internal_allocs;    // Blocks that had to come from the internal RAM since startup
+	uint32_t failures;           // Allocations that failed since startup
+	uint32_t psram_free;         // PSRAM heap free bytes and its largest free block
+	uint32_t psram_largest;      //   (their difference shows the fragmentation)
+} gui_mem_stats_t;
+
+
+
+//
+// GUI Memory Utilities API
+//
+void* gui_mem_alloc(size_t size);
+void gui_mem_free(void* p);
+void gui_mem_get_stats(gui_mem_stats_t* statsP);
+
+#endif /* GUI_MEM_UTILITIES_H */
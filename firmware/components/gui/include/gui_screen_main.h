@@ -25,6 +25,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "lvgl/lvgl.h"
+#include "sys_utilities.h"
 
 //
 // Main Screen Constants
@@ -35,11 +36,23 @@
 #define CAM_IMG_HEIGHT 120
 #define CAM_IMG_PIXELS (CAM_IMG_WIDTH * CAM_IMG_HEIGHT)
 
+// Comment out to fully decode the ArduCAM image while recording instead of drawing a
+// faster, blockier, DC-only preview
+#define GUI_CAM_FAST_PREVIEW
+
+// Comment out to have LittleVGL redraw the camera images instead of writing them
+// directly to their areas of the LCD
+#define GUI_DIRECT_IMG_WRITE
+
 // Lepton display area
 #define LEP_IMG_WIDTH  160
 #define LEP_IMG_HEIGHT 120
 #define LEP_IMG_PIXELS (LEP_IMG_WIDTH * LEP_IMG_HEIGHT)
 
+// Full-screen Lepton display (2x upscaled)
+#define LEP_FULL_IMG_WIDTH  (2 * LEP_IMG_WIDTH)
+#define LEP_FULL_IMG_HEIGHT (2 * LEP_IMG_HEIGHT)
+
 
 
 
@@ -49,8 +62,12 @@
 lv_obj_t* gui_screen_main_create();
 void gui_screen_main_set_active(bool en);
 void gui_screen_main_status_update_task(lv_task_t * task);
+bool gui_screen_main_render_cam_image(uint16_t* bufP);
 void gui_screen_main_update_cam_image();
-void gui_screen_main_update_lep_image();
+void gui_screen_main_update_lep_image(lep_buffer_t* lepP);
+void gui_screen_main_update_lep_full(lep_buffer_t* lepP);
+uint32_t gui_screen_main_encode_lep_jpg(lep_buffer_t* lepP, bool rendered, uint8_t* dst, uint32_t dst_len);
+void gui_screen_main_render_lep_buffer(lep_buffer_t* lepP, uint16_t* bufP);
 void gui_screen_main_update_rec_led(bool en);
 void gui_screen_main_update_rec_count(uint16_t c);
 
@@ -22,6 +22,7 @@
 #ifndef GUI_UTILITY_H
 #define GUI_UTILITY_H
 
+#include <stdbool.h>
 #include "lvgl/lvgl.h"
 
 //
@@ -36,6 +37,7 @@
 // GUI Utilities API
 //
 void gui_message_box(lv_obj_t* parent, const char* msg);
+bool gui_message_box_displayed();
 void gui_preset_message_box_string(const char* msg);
 void gui_preset_message_box(lv_obj_t* parent);
 
@@ -24,263 +24,263 @@
 
 #include "palettes.h"
 
-palette_map_t ironblack_palette_map = {
-	{255,255,255},
-	{253,253,253},
-	{251,251,251},
-	{249,249,249},
-	{247,247,247},
-	{245,245,245},
-	{243,243,243},
-	{241,241,241},
-	{239,239,239},
-	{237,237,237},
-	{235,235,235},
-	{233,233,233},
-	{231,231,231},
-	{229,229,229},
-	{227,227,227},
-	{225,225,225},
-	{223,223,223},
-	{221,221,221},
-	{219,219,219},
-	{217,217,217},
-	{215,215,215},
-	{213,213,213},
-	{211,211,211},
-	{209,209,209},
-	{207,207,207},
-	{205,205,205},
-	{203,203,203},
-	{201,201,201},
-	{199,199,199},
-	{197,197,197},
-	{195,195,195},
-	{193,193,193},
-	{191,191,191},
-	{189,189,189},
-	{187,187,187},
-	{185,185,185},
-	{183,183,183},
-	{181,181,181},
-	{179,179,179},
-	{177,177,177},
-	{175,175,175},
-	{173,173,173},
-	{171,171,171},
-	{169,169,169},
-	{167,167,167},
-	{165,165,165},
-	{163,163,163},
-	{161,161,161},
-	{159,159,159},
-	{157,157,157},
-	{155,155,155},
-	{153,153,153},
-	{151,151,151},
-	{149,149,149},
-	{147,147,147},
-	{145,145,145},
-	{143,143,143},
-	{141,141,141},
-	{139,139,139},
-	{137,137,137},
-	{135,135,135},
-	{133,133,133},
-	{131,131,131},
-	{129,129,129},
-	{126,126,126},
-	{124,124,124},
-	{122,122,122},
-	{120,120,120},
-	{118,118,118},
-	{116,116,116},
-	{114,114,114},
-	{112,112,112},
-	{110,110,110},
-	{108,108,108},
-	{106,106,106},
-	{104,104,104},
-	{102,102,102},
-	{100,100,100},
-	{98,98,98},
-	{96,96,96},
-	{94,94,94},
-	{92,92,92},
-	{90,90,90},
-	{88,88,88},
-	{86,86,86},
-	{84,84,84},
-	{82,82,82},
-	{80,80,80},
-	{78,78,78},
-	{76,76,76},
-	{74,74,74},
-	{72,72,72},
-	{70,70,70},
-	{68,68,68},
-	{66,66,66},
-	{64,64,64},
-	{62,62,62},
-	{60,60,60},
-	{58,58,58},
-	{56,56,56},
-	{54,54,54},
-	{52,52,52},
-	{50,50,50},
-	{48,48,48},
-	{46,46,46},
-	{44,44,44},
-	{42,42,42},
-	{40,40,40},
-	{38,38,38},
-	{36,36,36},
-	{34,34,34},
-	{32,32,32},
-	{30,30,30},
-	{28,28,28},
-	{26,26,26},
-	{24,24,24},
-	{22,22,22},
-	{20,20,20},
-	{18,18,18},
-	{16,16,16},
-	{14,14,14},
-	{12,12,12},
-	{10,10,10},
-	{8,8,8},
-	{6,6,6},
-	{4,4,4},
-	{2,2,2},
-	{0,0,0},
-	{0,0,9},
-	{2,0,16},
-	{4,0,24},
-	{6,0,31},
-	{8,0,38},
-	{10,0,45},
-	{12,0,53},
-	{14,0,60},
-	{17,0,67},
-	{19,0,74},
-	{21,0,82},
-	{23,0,89},
-	{25,0,96},
-	{27,0,103},
-	{29,0,111},
-	{31,0,118},
-	{36,0,120},
-	{41,0,121},
-	{46,0,122},
-	{51,0,123},
-	{56,0,124},
-	{61,0,125},
-	{66,0,126},
-	{71,0,127},
-	{76,1,128},
-	{81,1,129},
-	{86,1,130},
-	{91,1,131},
-	{96,1,132},
-	{101,1,133},
-	{106,1,134},
-	{111,1,135},
-	{116,1,136},
-	{121,1,136},
-	{125,2,137},
-	{130,2,137},
-	{135,3,137},
-	{139,3,138},
-	{144,3,138},
-	{149,4,138},
-	{153,4,139},
-	{158,5,139},
-	{163,5,139},
-	{167,5,140},
-	{172,6,140},
-	{177,6,140},
-	{181,7,141},
-	{186,7,141},
-	{189,10,137},
-	{191,13,132},
-	{194,16,127},
-	{196,19,121},
-	{198,22,116},
-	{200,25,111},
-	{203,28,106},
-	{205,31,101},
-	{207,34,95},
-	{209,37,90},
-	{212,40,85},
-	{214,43,80},
-	{216,46,75},
-	{218,49,69},
-	{221,52,64},
-	{223,55,59},
-	{224,57,49},
-	{225,60,47},
-	{226,64,44},
-	{227,67,42},
-	{228,71,39},
-	{229,74,37},
-	{230,78,34},
-	{231,81,32},
-	{231,85,29},
-	{232,88,27},
-	{233,92,24},
-	{234,95,22},
-	{235,99,19},
-	{236,102,17},
-	{237,106,14},
-	{238,109,12},
-	{239,112,12},
-	{240,116,12},
-	{240,119,12},
-	{241,123,12},
-	{241,127,12},
-	{242,130,12},
-	{242,134,12},
-	{243,138,12},
-	{243,141,13},
-	{244,145,13},
-	{244,149,13},
-	{245,152,13},
-	{245,156,13},
-	{246,160,13},
-	{246,163,13},
-	{247,167,13},
-	{247,171,13},
-	{248,175,14},
-	{248,178,15},
-	{249,182,16},
-	{249,185,18},
-	{250,189,19},
-	{250,192,20},
-	{251,196,21},
-	{251,199,22},
-	{252,203,23},
-	{252,206,24},
-	{253,210,25},
-	{253,213,27},
-	{254,217,28},
-	{254,220,29},
-	{255,224,30},
-	{255,227,39},
-	{255,229,53},
-	{255,231,67},
-	{255,233,81},
-	{255,234,95},
-	{255,236,109},
-	{255,238,123},
-	{255,240,137},
-	{255,242,151},
-	{255,244,165},
-	{255,246,179},
-	{255,248,193},
-	{255,249,207},
-	{255,251,221},
-	{255,253,235},
-	{255,255,24}
+palette16_map_t ironblack_palette16_map = {
+	RGB_TO_16BIT_SWAP(255, 255, 255),
+	RGB_TO_16BIT_SWAP(253, 253, 253),
+	RGB_TO_16BIT_SWAP(251, 251, 251),
+	RGB_TO_16BIT_SWAP(249, 249, 249),
+	RGB_TO_16BIT_SWAP(247, 247, 247),
+	RGB_TO_16BIT_SWAP(245, 245, 245),
+	RGB_TO_16BIT_SWAP(243, 243, 243),
+	RGB_TO_16BIT_SWAP(241, 241, 241),
+	RGB_TO_16BIT_SWAP(239, 239, 239),
+	RGB_TO_16BIT_SWAP(237, 237, 237),
+	RGB_TO_16BIT_SWAP(235, 235, 235),
+	RGB_TO_16BIT_SWAP(233, 233, 233),
+	RGB_TO_16BIT_SWAP(231, 231, 231),
+	RGB_TO_16BIT_SWAP(229, 229, 229),
+	RGB_TO_16BIT_SWAP(227, 227, 227),
+	RGB_TO_16BIT_SWAP(225, 225, 225),
+	RGB_TO_16BIT_SWAP(223, 223, 223),
+	RGB_TO_16BIT_SWAP(221, 221, 221),
+	RGB_TO_16BIT_SWAP(219, 219, 219),
+	RGB_TO_16BIT_SWAP(217, 217, 217),
+	RGB_TO_16BIT_SWAP(215, 215, 215),
+	RGB_TO_16BIT_SWAP(213, 213, 213),
+	RGB_TO_16BIT_SWAP(211, 211, 211),
+	RGB_TO_16BIT_SWAP(209, 209, 209),
+	RGB_TO_16BIT_SWAP(207, 207, 207),
+	RGB_TO_16BIT_SWAP(205, 205, 205),
+	RGB_TO_16BIT_SWAP(203, 203, 203),
+	RGB_TO_16BIT_SWAP(201, 201, 201),
+	RGB_TO_16BIT_SWAP(199, 199, 199),
+	RGB_TO_16BIT_SWAP(197, 197, 197),
+	RGB_TO_16BIT_SWAP(195, 195, 195),
+	RGB_TO_16BIT_SWAP(193, 193, 193),
+	RGB_TO_16BIT_SWAP(191, 191, 191),
+	RGB_TO_16BIT_SWAP(189, 189, 189),
+	RGB_TO_16BIT_SWAP(187, 187, 187),
+	RGB_TO_16BIT_SWAP(185, 185, 185),
+	RGB_TO_16BIT_SWAP(183, 183, 183),
+	RGB_TO_16BIT_SWAP(181, 181, 181),
+	RGB_TO_16BIT_SWAP(179, 179, 179),
+	RGB_TO_16BIT_SWAP(177, 177, 177),
+	RGB_TO_16BIT_SWAP(175, 175, 175),
+	RGB_TO_16BIT_SWAP(173, 173, 173),
+	RGB_TO_16BIT_SWAP(171, 171, 171),
+	RGB_TO_16BIT_SWAP(169, 169, 169),
+	RGB_TO_16BIT_SWAP(167, 167, 167),
+	RGB_TO_16BIT_SWAP(165, 165, 165),
+	RGB_TO_16BIT_SWAP(163, 163, 163),
+	RGB_TO_16BIT_SWAP(161, 161, 161),
+	RGB_TO_16BIT_SWAP(159, 159, 159),
+	RGB_TO_16BIT_SWAP(157, 157, 157),
+	RGB_TO_16BIT_SWAP(155, 155, 155),
+	RGB_TO_16BIT_SWAP(153, 153, 153),
+	RGB_TO_16BIT_SWAP(151, 151, 151),
+	RGB_TO_16BIT_SWAP(149, 149, 149),
+	RGB_TO_16BIT_SWAP(147, 147, 147),
+	RGB_TO_16BIT_SWAP(145, 145, 145),
+	RGB_TO_16BIT_SWAP(143, 143, 143),
+	RGB_TO_16BIT_SWAP(141, 141, 141),
+	RGB_TO_16BIT_SWAP(139, 139, 139),
+	RGB_TO_16BIT_SWAP(137, 137, 137),
+	RGB_TO_16BIT_SWAP(135, 135, 135),
+	RGB_TO_16BIT_SWAP(133, 133, 133),
+	RGB_TO_16BIT_SWAP(131, 131, 131),
+	RGB_TO_16BIT_SWAP(129, 129, 129),
+	RGB_TO_16BIT_SWAP(126, 126, 126),
+	RGB_TO_16BIT_SWAP(124, 124, 124),
+	RGB_TO_16BIT_SWAP(122, 122, 122),
+	RGB_TO_16BIT_SWAP(120, 120, 120),
+	RGB_TO_16BIT_SWAP(118, 118, 118),
+	RGB_TO_16BIT_SWAP(116, 116, 116),
+	RGB_TO_16BIT_SWAP(114, 114, 114),
+	RGB_TO_16BIT_SWAP(112, 112, 112),
+	RGB_TO_16BIT_SWAP(110, 110, 110),
+	RGB_TO_16BIT_SWAP(108, 108, 108),
+	RGB_TO_16BIT_SWAP(106, 106, 106),
+	RGB_TO_16BIT_SWAP(104, 104, 104),
+	RGB_TO_16BIT_SWAP(102, 102, 102),
+	RGB_TO_16BIT_SWAP(100, 100, 100),
+	RGB_TO_16BIT_SWAP(98, 98, 98),
+	RGB_TO_16BIT_SWAP(96, 96, 96),
+	RGB_TO_16BIT_SWAP(94, 94, 94),
+	RGB_TO_16BIT_SWAP(92, 92, 92),
+	RGB_TO_16BIT_SWAP(90, 90, 90),
+	RGB_TO_16BIT_SWAP(88, 88, 88),
+	RGB_TO_16BIT_SWAP(86, 86, 86),
+	RGB_TO_16BIT_SWAP(84, 84, 84),
+	RGB_TO_16BIT_SWAP(82, 82, 82),
+	RGB_TO_16BIT_SWAP(80, 80, 80),
+	RGB_TO_16BIT_SWAP(78, 78, 78),
+	RGB_TO_16BIT_SWAP(76, 76, 76),
+	RGB_TO_16BIT_SWAP(74, 74, 74),
+	RGB_TO_16BIT_SWAP(72, 72, 72),
+	RGB_TO_16BIT_SWAP(70, 70, 70),
+	RGB_TO_16BIT_SWAP(68, 68, 68),
+	RGB_TO_16BIT_SWAP(66, 66, 66),
+	RGB_TO_16BIT_SWAP(64, 64, 64),
+	RGB_TO_16BIT_SWAP(62, 62, 62),
+	RGB_TO_16BIT_SWAP(60, 60, 60),
+	RGB_TO_16BIT_SWAP(58, 58, 58),
+	RGB_TO_16BIT_SWAP(56, 56, 56),
+	RGB_TO_16BIT_SWAP(54, 54, 54),
+	RGB_TO_16BIT_SWAP(52, 52, 52),
+	RGB_TO_16BIT_SWAP(50, 50, 50),
+	RGB_TO_16BIT_SWAP(48, 48, 48),
+	RGB_TO_16BIT_SWAP(46, 46, 46),
+	RGB_TO_16BIT_SWAP(44, 44, 44),
+	RGB_TO_16BIT_SWAP(42, 42, 42),
+	RGB_TO_16BIT_SWAP(40, 40, 40),
+	RGB_TO_16BIT_SWAP(38, 38, 38),
+	RGB_TO_16BIT_SWAP(36, 36, 36),
+	RGB_TO_16BIT_SWAP(34, 34, 34),
+	RGB_TO_16BIT_SWAP(32, 32, 32),
+	RGB_TO_16BIT_SWAP(30, 30, 30),
+	RGB_TO_16BIT_SWAP(28, 28, 28),
+	RGB_TO_16BIT_SWAP(26, 26, 26),
+	RGB_TO_16BIT_SWAP(24, 24, 24),
+	RGB_TO_16BIT_SWAP(22, 22, 22),
+	RGB_TO_16BIT_SWAP(20, 20, 20),
+	RGB_TO_16BIT_SWAP(18, 18, 18),
+	RGB_TO_16BIT_SWAP(16, 16, 16),
+	RGB_TO_16BIT_SWAP(14, 14, 14),
+	RGB_TO_16BIT_SWAP(12, 12, 12),
+	RGB_TO_16BIT_SWAP(10, 10, 10),
+	RGB_TO_16BIT_SWAP(8, 8, 8),
+	RGB_TO_16BIT_SWAP(6, 6, 6),
+	RGB_TO_16BIT_SWAP(4, 4, 4),
+	RGB_TO_16BIT_SWAP(2, 2, 2),
+	RGB_TO_16BIT_SWAP(0, 0, 0),
+	RGB_TO_16BIT_SWAP(0, 0, 9),
+	RGB_TO_16BIT_SWAP(2, 0, 16),
+	RGB_TO_16BIT_SWAP(4, 0, 24),
+	RGB_TO_16BIT_SWAP(6, 0, 31),
+	RGB_TO_16BIT_SWAP(8, 0, 38),
+	RGB_TO_16BIT_SWAP(10, 0, 45),
+	RGB_TO_16BIT_SWAP(12, 0, 53),
+	RGB_TO_16BIT_SWAP(14, 0, 60),
+	RGB_TO_16BIT_SWAP(17, 0, 67),
+	RGB_TO_16BIT_SWAP(19, 0, 74),
+	RGB_TO_16BIT_SWAP(21, 0, 82),
+	RGB_TO_16BIT_SWAP(23, 0, 89),
+	RGB_TO_16BIT_SWAP(25, 0, 96),
+	RGB_TO_16BIT_SWAP(27, 0, 103),
+	RGB_TO_16BIT_SWAP(29, 0, 111),
+	RGB_TO_16BIT_SWAP(31, 0, 118),
+	RGB_TO_16BIT_SWAP(36, 0, 120),
+	RGB_TO_16BIT_SWAP(41, 0, 121),
+	RGB_TO_16BIT_SWAP(46, 0, 122),
+	RGB_TO_16BIT_SWAP(51, 0, 123),
+	RGB_TO_16BIT_SWAP(56, 0, 124),
+	RGB_TO_16BIT_SWAP(61, 0, 125),
+	RGB_TO_16BIT_SWAP(66, 0, 126),
+	RGB_TO_16BIT_SWAP(71, 0, 127),
+	RGB_TO_16BIT_SWAP(76, 1, 128),
+	RGB_TO_16BIT_SWAP(81, 1, 129),
+	RGB_TO_16BIT_SWAP(86, 1, 130),
+	RGB_TO_16BIT_SWAP(91, 1, 131),
+	RGB_TO_16BIT_SWAP(96, 1, 132),
+	RGB_TO_16BIT_SWAP(101, 1, 133),
+	RGB_TO_16BIT_SWAP(106, 1, 134),
+	RGB_TO_16BIT_SWAP(111, 1, 135),
+	RGB_TO_16BIT_SWAP(116, 1, 136),
+	RGB_TO_16BIT_SWAP(121, 1, 136),
+	RGB_TO_16BIT_SWAP(125, 2, 137),
+	RGB_TO_16BIT_SWAP(130, 2, 137),
+	RGB_TO_16BIT_SWAP(135, 3, 137),
+	RGB_TO_16BIT_SWAP(139, 3, 138),
+	RGB_TO_16BIT_SWAP(144, 3, 138),
+	RGB_TO_16BIT_SWAP(149, 4, 138),
+	RGB_TO_16BIT_SWAP(153, 4, 139),
+	RGB_TO_16BIT_SWAP(158, 5, 139),
+	RGB_TO_16BIT_SWAP(163, 5, 139),
+	RGB_TO_16BIT_SWAP(167, 5, 140),
+	RGB_TO_16BIT_SWAP(172, 6, 140),
+	RGB_TO_16BIT_SWAP(177, 6, 140),
+	RGB_TO_16BIT_SWAP(181, 7, 141),
+	RGB_TO_16BIT_SWAP(186, 7, 141),
+	RGB_TO_16BIT_SWAP(189, 10, 137),
+	RGB_TO_16BIT_SWAP(191, 13, 132),
+	RGB_TO_16BIT_SWAP(194, 16, 127),
+	RGB_TO_16BIT_SWAP(196, 19, 121),
+	RGB_TO_16BIT_SWAP(198, 22, 116),
+	RGB_TO_16BIT_SWAP(200, 25, 111),
+	RGB_TO_16BIT_SWAP(203, 28, 106),
+	RGB_TO_16BIT_SWAP(205, 31, 101),
+	RGB_TO_16BIT_SWAP(207, 34, 95),
+	RGB_TO_16BIT_SWAP(209, 37, 90),
+	RGB_TO_16BIT_SWAP(212, 40, 85),
+	RGB_TO_16BIT_SWAP(214, 43, 80),
+	RGB_TO_16BIT_SWAP(216, 46, 75),
+	RGB_TO_16BIT_SWAP(218, 49, 69),
+	RGB_TO_16BIT_SWAP(221, 52, 64),
+	RGB_TO_16BIT_SWAP(223, 55, 59),
+	RGB_TO_16BIT_SWAP(224, 57, 49),
+	RGB_TO_16BIT_SWAP(225, 60, 47),
+	RGB_TO_16BIT_SWAP(226, 64, 44),
+	RGB_TO_16BIT_SWAP(227, 67, 42),
+	RGB_TO_16BIT_SWAP(228, 71, 39),
+	RGB_TO_16BIT_SWAP(229, 74, 37),
+	RGB_TO_16BIT_SWAP(230, 78, 34),
+	RGB_TO_16BIT_SWAP(231, 81, 32),
+	RGB_TO_16BIT_SWAP(231, 85, 29),
+	RGB_TO_16BIT_SWAP(232, 88, 27),
+	RGB_TO_16BIT_SWAP(233, 92, 24),
+	RGB_TO_16BIT_SWAP(234, 95, 22),
+	RGB_TO_16BIT_SWAP(235, 99, 19),
+	RGB_TO_16BIT_SWAP(236, 102, 17),
+	RGB_TO_16BIT_SWAP(237, 106, 14),
+	RGB_TO_16BIT_SWAP(238, 109, 12),
+	RGB_TO_16BIT_SWAP(239, 112, 12),
+	RGB_TO_16BIT_SWAP(240, 116, 12),
+	RGB_TO_16BIT_SWAP(240, 119, 12),
+	RGB_TO_16BIT_SWAP(241, 123, 12),
+	RGB_TO_16BIT_SWAP(241, 127, 12),
+	RGB_TO_16BIT_SWAP(242, 130, 12),
+	RGB_TO_16BIT_SWAP(242, 134, 12),
+	RGB_TO_16BIT_SWAP(243, 138, 12),
+	RGB_TO_16BIT_SWAP(243, 141, 13),
+	RGB_TO_16BIT_SWAP(244, 145, 13),
+	RGB_TO_16BIT_SWAP(244, 149, 13),
+	RGB_TO_16BIT_SWAP(245, 152, 13),
+	RGB_TO_16BIT_SWAP(245, 156, 13),
+	RGB_TO_16BIT_SWAP(246, 160, 13),
+	RGB_TO_16BIT_SWAP(246, 163, 13),
+	RGB_TO_16BIT_SWAP(247, 167, 13),
+	RGB_TO_16BIT_SWAP(247, 171, 13),
+	RGB_TO_16BIT_SWAP(248, 175, 14),
+	RGB_TO_16BIT_SWAP(248, 178, 15),
+	RGB_TO_16BIT_SWAP(249, 182, 16),
+	RGB_TO_16BIT_SWAP(249, 185, 18),
+	RGB_TO_16BIT_SWAP(250, 189, 19),
+	RGB_TO_16BIT_SWAP(250, 192, 20),
+	RGB_TO_16BIT_SWAP(251, 196, 21),
+	RGB_TO_16BIT_SWAP(251, 199, 22),
+	RGB_TO_16BIT_SWAP(252, 203, 23),
+	RGB_TO_16BIT_SWAP(252, 206, 24),
+	RGB_TO_16BIT_SWAP(253, 210, 25),
+	RGB_TO_16BIT_SWAP(253, 213, 27),
+	RGB_TO_16BIT_SWAP(254, 217, 28),
+	RGB_TO_16BIT_SWAP(254, 220, 29),
+	RGB_TO_16BIT_SWAP(255, 224, 30),
+	RGB_TO_16BIT_SWAP(255, 227, 39),
+	RGB_TO_16BIT_SWAP(255, 229, 53),
+	RGB_TO_16BIT_SWAP(255, 231, 67),
+	RGB_TO_16BIT_SWAP(255, 233, 81),
+	RGB_TO_16BIT_SWAP(255, 234, 95),
+	RGB_TO_16BIT_SWAP(255, 236, 109),
+	RGB_TO_16BIT_SWAP(255, 238, 123),
+	RGB_TO_16BIT_SWAP(255, 240, 137),
+	RGB_TO_16BIT_SWAP(255, 242, 151),
+	RGB_TO_16BIT_SWAP(255, 244, 165),
+	RGB_TO_16BIT_SWAP(255, 246, 179),
+	RGB_TO_16BIT_SWAP(255, 248, 193),
+	RGB_TO_16BIT_SWAP(255, 249, 207),
+	RGB_TO_16BIT_SWAP(255, 251, 221),
+	RGB_TO_16BIT_SWAP(255, 253, 235),
+	RGB_TO_16BIT_SWAP(255, 255, 24)
 };
 
 #endif /* IRONBLACK */
\ No newline at end of file
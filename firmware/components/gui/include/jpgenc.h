@@ -0,0 +1,51 @@
+/*
+ * Baseline JPEG encoder
+ *
+ * Encodes the small palette-rendered Lepton images as baseline (sequential huffman)
+ * JFIF images with 4:2:0 chroma subsampling, the standard JPEG Annex K quantization
+ * tables scaled to JPGENC_QUALITY and the standard huffman tables.  The forward DCT is
+ * the fixed-point IJG "islow" algorithm.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef JPGENC_H
+#define JPGENC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+//
+// JPEG Encoder Constants
+//
+
+// Image quality (1 - 100, IJG scaling of the Annex K tables)
+#define JPGENC_QUALITY 85
+
+// Worst-case encoded length of one 16x16 pixel MCU (six blocks of 64 coefficients,
+// each with a 16-bit huffman code and 11 bits of value, doubled for 0xFF stuffing)
+#define JPGENC_MAX_MCU_LEN (6 * 64 * 27 * 2 / 8)
+
+
+//
+// JPEG Encoder API
+//
+uint32_t jpgenc_encode_rgb565(const uint16_t* src, int width, int height, bool swapped, uint8_t* dst, uint32_t dst_len);
+
+#endif /* JPGENC_H */
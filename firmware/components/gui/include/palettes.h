@@ -38,11 +38,12 @@
 #define PALETTE_ARCTIC    5
 #define PALETTE_COUNT     6
 
-typedef const uint8_t palette_map_t[256][3];
+// Palettes are byte-swapped RGB565 lv_img pixels generated by the compiler
+typedef const uint16_t palette16_map_t[256];
 
 typedef struct {
   char name[32];
-  palette_map_t* map_ptr;
+  const uint16_t* map_ptr;
 } palette_t;
 
 
@@ -61,7 +62,7 @@ typedef struct {
 //
 // Palette extern variables
 //
-extern uint16_t palette16[256];                 // Current palette for fast lookup
+extern const uint16_t* palette16;               // Current palette for fast lookup
 extern int cur_palette;
 
 
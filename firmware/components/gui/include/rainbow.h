@@ -24,263 +24,263 @@
 
 #include "palettes.h"
 
-palette_map_t rainbow_palette_map = {
-	{1,3,74},
-	{0,3,74},
-	{0,3,75},
-	{0,3,75},
-	{0,3,76},
-	{0,3,76},
-	{0,3,77},
-	{0,3,79},
-	{0,3,82},
-	{0,5,85},
-	{0,7,88},
-	{0,10,91},
-	{0,14,94},
-	{0,19,98},
-	{0,22,100},
-	{0,25,103},
-	{0,28,106},
-	{0,32,109},
-	{0,35,112},
-	{0,38,116},
-	{0,40,119},
-	{0,42,123},
-	{0,45,128},
-	{0,49,133},
-	{0,50,134},
-	{0,51,136},
-	{0,52,137},
-	{0,53,139},
-	{0,54,142},
-	{0,55,144},
-	{0,56,145},
-	{0,58,149},
-	{0,61,154},
-	{0,63,156},
-	{0,65,159},
-	{0,66,161},
-	{0,68,164},
-	{0,69,167},
-	{0,71,170},
-	{0,73,174},
-	{0,75,179},
-	{0,76,181},
-	{0,78,184},
-	{0,79,187},
-	{0,80,188},
-	{0,81,190},
-	{0,84,194},
-	{0,87,198},
-	{0,88,200},
-	{0,90,203},
-	{0,92,205},
-	{0,94,207},
-	{0,94,208},
-	{0,95,209},
-	{0,96,210},
-	{0,97,211},
-	{0,99,214},
-	{0,102,217},
-	{0,103,218},
-	{0,104,219},
-	{0,105,220},
-	{0,107,221},
-	{0,109,223},
-	{0,111,223},
-	{0,113,223},
-	{0,115,222},
-	{0,117,221},
-	{0,118,220},
-	{1,120,219},
-	{1,122,217},
-	{2,124,216},
-	{2,126,214},
-	{3,129,212},
-	{3,131,207},
-	{4,132,205},
-	{4,133,202},
-	{4,134,197},
-	{5,136,192},
-	{6,138,185},
-	{7,141,178},
-	{8,142,172},
-	{10,144,166},
-	{10,144,162},
-	{11,145,158},
-	{12,146,153},
-	{13,147,149},
-	{15,149,140},
-	{17,151,132},
-	{22,153,120},
-	{25,154,115},
-	{28,156,109},
-	{34,158,101},
-	{40,160,94},
-	{45,162,86},
-	{51,164,79},
-	{59,167,69},
-	{67,171,60},
-	{72,173,54},
-	{78,175,48},
-	{83,177,43},
-	{89,179,39},
-	{93,181,35},
-	{98,183,31},
-	{105,185,26},
-	{109,187,23},
-	{113,188,21},
-	{118,189,19},
-	{123,191,17},
-	{128,193,14},
-	{134,195,12},
-	{138,196,10},
-	{142,197,8},
-	{146,198,6},
-	{151,200,5},
-	{155,201,4},
-	{160,203,3},
-	{164,204,2},
-	{169,205,2},
-	{173,206,1},
-	{175,207,1},
-	{178,207,1},
-	{184,208,0},
-	{190,210,0},
-	{193,211,0},
-	{196,212,0},
-	{199,212,0},
-	{202,213,1},
-	{207,214,2},
-	{212,215,3},
-	{215,214,3},
-	{218,214,3},
-	{220,213,3},
-	{222,213,4},
-	{224,212,4},
-	{225,212,5},
-	{226,212,5},
-	{229,211,5},
-	{232,211,6},
-	{232,211,6},
-	{233,211,6},
-	{234,210,6},
-	{235,210,7},
-	{236,209,7},
-	{237,208,8},
-	{239,206,8},
-	{241,204,9},
-	{242,203,9},
-	{244,202,10},
-	{244,201,10},
-	{245,200,10},
-	{245,199,11},
-	{246,198,11},
-	{247,197,12},
-	{248,194,13},
-	{249,191,14},
-	{250,189,14},
-	{251,187,15},
-	{251,185,16},
-	{252,183,17},
-	{252,178,18},
-	{253,174,19},
-	{253,171,19},
-	{254,168,20},
-	{254,165,21},
-	{254,164,21},
-	{255,163,22},
-	{255,161,22},
-	{255,159,23},
-	{255,157,23},
-	{255,155,24},
-	{255,149,25},
-	{255,143,27},
-	{255,139,28},
-	{255,135,30},
-	{255,131,31},
-	{255,127,32},
-	{255,118,34},
-	{255,110,36},
-	{255,104,37},
-	{255,101,38},
-	{255,99,39},
-	{255,93,40},
-	{255,88,42},
-	{254,82,43},
-	{254,77,45},
-	{254,69,47},
-	{254,62,49},
-	{253,57,50},
-	{253,53,52},
-	{252,49,53},
-	{252,45,55},
-	{251,39,57},
-	{251,33,59},
-	{251,32,60},
-	{251,31,60},
-	{251,30,61},
-	{251,29,61},
-	{251,28,62},
-	{250,27,63},
-	{250,27,65},
-	{249,26,66},
-	{249,26,68},
-	{248,25,70},
-	{248,24,73},
-	{247,24,75},
-	{247,25,77},
-	{247,25,79},
-	{247,26,81},
-	{247,32,83},
-	{247,35,85},
-	{247,38,86},
-	{247,42,88},
-	{247,46,90},
-	{247,50,92},
-	{248,55,94},
-	{248,59,96},
-	{248,64,98},
-	{248,72,101},
-	{249,81,104},
-	{249,87,106},
-	{250,93,108},
-	{250,95,109},
-	{250,98,110},
-	{250,100,111},
-	{251,101,112},
-	{251,102,113},
-	{251,109,117},
-	{252,116,121},
-	{252,121,123},
-	{253,126,126},
-	{253,130,128},
-	{254,135,131},
-	{254,139,133},
-	{254,144,136},
-	{254,151,140},
-	{255,158,144},
-	{255,163,146},
-	{255,168,149},
-	{255,173,152},
-	{255,176,153},
-	{255,178,155},
-	{255,184,160},
-	{255,191,165},
-	{255,195,168},
-	{255,199,172},
-	{255,203,175},
-	{255,207,179},
-	{255,211,182},
-	{255,216,185},
-	{255,218,190},
-	{255,220,196},
-	{255,222,200},
-	{255,225,202},
-	{255,227,204},
-	{255,230,206},
-	{255,233,208}
+palette16_map_t rainbow_palette16_map = {
+	RGB_TO_16BIT_SWAP(1, 3, 74),
+	RGB_TO_16BIT_SWAP(0, 3, 74),
+	RGB_TO_16BIT_SWAP(0, 3, 75),
+	RGB_TO_16BIT_SWAP(0, 3, 75),
+	RGB_TO_16BIT_SWAP(0, 3, 76),
+	RGB_TO_16BIT_SWAP(0, 3, 76),
+	RGB_TO_16BIT_SWAP(0, 3, 77),
+	RGB_TO_16BIT_SWAP(0, 3, 79),
+	RGB_TO_16BIT_SWAP(0, 3, 82),
+	RGB_TO_16BIT_SWAP(0, 5, 85),
+	RGB_TO_16BIT_SWAP(0, 7, 88),
+	RGB_TO_16BIT_SWAP(0, 10, 91),
+	RGB_TO_16BIT_SWAP(0, 14, 94),
+	RGB_TO_16BIT_SWAP(0, 19, 98),
+	RGB_TO_16BIT_SWAP(0, 22, 100),
+	RGB_TO_16BIT_SWAP(0, 25, 103),
+	RGB_TO_16BIT_SWAP(0, 28, 106),
+	RGB_TO_16BIT_SWAP(0, 32, 109),
+	RGB_TO_16BIT_SWAP(0, 35, 112),
+	RGB_TO_16BIT_SWAP(0, 38, 116),
+	RGB_TO_16BIT_SWAP(0, 40, 119),
+	RGB_TO_16BIT_SWAP(0, 42, 123),
+	RGB_TO_16BIT_SWAP(0, 45, 128),
+	RGB_TO_16BIT_SWAP(0, 49, 133),
+	RGB_TO_16BIT_SWAP(0, 50, 134),
+	RGB_TO_16BIT_SWAP(0, 51, 136),
+	RGB_TO_16BIT_SWAP(0, 52, 137),
+	RGB_TO_16BIT_SWAP(0, 53, 139),
+	RGB_TO_16BIT_SWAP(0, 54, 142),
+	RGB_TO_16BIT_SWAP(0, 55, 144),
+	RGB_TO_16BIT_SWAP(0, 56, 145),
+	RGB_TO_16BIT_SWAP(0, 58, 149),
+	RGB_TO_16BIT_SWAP(0, 61, 154),
+	RGB_TO_16BIT_SWAP(0, 63, 156),
+	RGB_TO_16BIT_SWAP(0, 65, 159),
+	RGB_TO_16BIT_SWAP(0, 66, 161),
+	RGB_TO_16BIT_SWAP(0, 68, 164),
+	RGB_TO_16BIT_SWAP(0, 69, 167),
+	RGB_TO_16BIT_SWAP(0, 71, 170),
+	RGB_TO_16BIT_SWAP(0, 73, 174),
+	RGB_TO_16BIT_SWAP(0, 75, 179),
+	RGB_TO_16BIT_SWAP(0, 76, 181),
+	RGB_TO_16BIT_SWAP(0, 78, 184),
+	RGB_TO_16BIT_SWAP(0, 79, 187),
+	RGB_TO_16BIT_SWAP(0, 80, 188),
+	RGB_TO_16BIT_SWAP(0, 81, 190),
+	RGB_TO_16BIT_SWAP(0, 84, 194),
+	RGB_TO_16BIT_SWAP(0, 87, 198),
+	RGB_TO_16BIT_SWAP(0, 88, 200),
+	RGB_TO_16BIT_SWAP(0, 90, 203),
+	RGB_TO_16BIT_SWAP(0, 92, 205),
+	RGB_TO_16BIT_SWAP(0, 94, 207),
+	RGB_TO_16BIT_SWAP(0, 94, 208),
+	RGB_TO_16BIT_SWAP(0, 95, 209),
+	RGB_TO_16BIT_SWAP(0, 96, 210),
+	RGB_TO_16BIT_SWAP(0, 97, 211),
+	RGB_TO_16BIT_SWAP(0, 99, 214),
+	RGB_TO_16BIT_SWAP(0, 102, 217),
+	RGB_TO_16BIT_SWAP(0, 103, 218),
+	RGB_TO_16BIT_SWAP(0, 104, 219),
+	RGB_TO_16BIT_SWAP(0, 105, 220),
+	RGB_TO_16BIT_SWAP(0, 107, 221),
+	RGB_TO_16BIT_SWAP(0, 109, 223),
+	RGB_TO_16BIT_SWAP(0, 111, 223),
+	RGB_TO_16BIT_SWAP(0, 113, 223),
+	RGB_TO_16BIT_SWAP(0, 115, 222),
+	RGB_TO_16BIT_SWAP(0, 117, 221),
+	RGB_TO_16BIT_SWAP(0, 118, 220),
+	RGB_TO_16BIT_SWAP(1, 120, 219),
+	RGB_TO_16BIT_SWAP(1, 122, 217),
+	RGB_TO_16BIT_SWAP(2, 124, 216),
+	RGB_TO_16BIT_SWAP(2, 126, 214),
+	RGB_TO_16BIT_SWAP(3, 129, 212),
+	RGB_TO_16BIT_SWAP(3, 131, 207),
+	RGB_TO_16BIT_SWAP(4, 132, 205),
+	RGB_TO_16BIT_SWAP(4, 133, 202),
+	RGB_TO_16BIT_SWAP(4, 134, 197),
+	RGB_TO_16BIT_SWAP(5, 136, 192),
+	RGB_TO_16BIT_SWAP(6, 138, 185),
+	RGB_TO_16BIT_SWAP(7, 141, 178),
+	RGB_TO_16BIT_SWAP(8, 142, 172),
+	RGB_TO_16BIT_SWAP(10, 144, 166),
+	RGB_TO_16BIT_SWAP(10, 144, 162),
+	RGB_TO_16BIT_SWAP(11, 145, 158),
+	RGB_TO_16BIT_SWAP(12, 146, 153),
+	RGB_TO_16BIT_SWAP(13, 147, 149),
+	RGB_TO_16BIT_SWAP(15, 149, 140),
+	RGB_TO_16BIT_SWAP(17, 151, 132),
+	RGB_TO_16BIT_SWAP(22, 153, 120),
+	RGB_TO_16BIT_SWAP(25, 154, 115),
+	RGB_TO_16BIT_SWAP(28, 156, 109),
+	RGB_TO_16BIT_SWAP(34, 158, 101),
+	RGB_TO_16BIT_SWAP(40, 160, 94),
+	RGB_TO_16BIT_SWAP(45, 162, 86),
+	RGB_TO_16BIT_SWAP(51, 164, 79),
+	RGB_TO_16BIT_SWAP(59, 167, 69),
+	RGB_TO_16BIT_SWAP(67, 171, 60),
+	RGB_TO_16BIT_SWAP(72, 173, 54),
+	RGB_TO_16BIT_SWAP(78, 175, 48),
+	RGB_TO_16BIT_SWAP(83, 177, 43),
+	RGB_TO_16BIT_SWAP(89, 179, 39),
+	RGB_TO_16BIT_SWAP(93, 181, 35),
+	RGB_TO_16BIT_SWAP(98, 183, 31),
+	RGB_TO_16BIT_SWAP(105, 185, 26),
+	RGB_TO_16BIT_SWAP(109, 187, 23),
+	RGB_TO_16BIT_SWAP(113, 188, 21),
+	RGB_TO_16BIT_SWAP(118, 189, 19),
+	RGB_TO_16BIT_SWAP(123, 191, 17),
+	RGB_TO_16BIT_SWAP(128, 193, 14),
+	RGB_TO_16BIT_SWAP(134, 195, 12),
+	RGB_TO_16BIT_SWAP(138, 196, 10),
+	RGB_TO_16BIT_SWAP(142, 197, 8),
+	RGB_TO_16BIT_SWAP(146, 198, 6),
+	RGB_TO_16BIT_SWAP(151, 200, 5),
+	RGB_TO_16BIT_SWAP(155, 201, 4),
+	RGB_TO_16BIT_SWAP(160, 203, 3),
+	RGB_TO_16BIT_SWAP(164, 204, 2),
+	RGB_TO_16BIT_SWAP(169, 205, 2),
+	RGB_TO_16BIT_SWAP(173, 206, 1),
+	RGB_TO_16BIT_SWAP(175, 207, 1),
+	RGB_TO_16BIT_SWAP(178, 207, 1),
+	RGB_TO_16BIT_SWAP(184, 208, 0),
+	RGB_TO_16BIT_SWAP(190, 210, 0),
+	RGB_TO_16BIT_SWAP(193, 211, 0),
+	RGB_TO_16BIT_SWAP(196, 212, 0),
+	RGB_TO_16BIT_SWAP(199, 212, 0),
+	RGB_TO_16BIT_SWAP(202, 213, 1),
+	RGB_TO_16BIT_SWAP(207, 214, 2),
+	RGB_TO_16BIT_SWAP(212, 215, 3),
+	RGB_TO_16BIT_SWAP(215, 214, 3),
+	RGB_TO_16BIT_SWAP(218, 214, 3),
+	RGB_TO_16BIT_SWAP(220, 213, 3),
+	RGB_TO_16BIT_SWAP(222, 213, 4),
+	RGB_TO_16BIT_SWAP(224, 212, 4),
+	RGB_TO_16BIT_SWAP(225, 212, 5),
+	RGB_TO_16BIT_SWAP(226, 212, 5),
+	RGB_TO_16BIT_SWAP(229, 211, 5),
+	RGB_TO_16BIT_SWAP(232, 211, 6),
+	RGB_TO_16BIT_SWAP(232, 211, 6),
+	RGB_TO_16BIT_SWAP(233, 211, 6),
+	RGB_TO_16BIT_SWAP(234, 210, 6),
+	RGB_TO_16BIT_SWAP(235, 210, 7),
+	RGB_TO_16BIT_SWAP(236, 209, 7),
+	RGB_TO_16BIT_SWAP(237, 208, 8),
+	RGB_TO_16BIT_SWAP(239, 206, 8),
+	RGB_TO_16BIT_SWAP(241, 204, 9),
+	RGB_TO_16BIT_SWAP(242, 203, 9),
+	RGB_TO_16BIT_SWAP(244, 202, 10),
+	RGB_TO_16BIT_SWAP(244, 201, 10),
+	RGB_TO_16BIT_SWAP(245, 200, 10),
+	RGB_TO_16BIT_SWAP(245, 199, 11),
+	RGB_TO_16BIT_SWAP(246, 198, 11),
+	RGB_TO_16BIT_SWAP(247, 197, 12),
+	RGB_TO_16BIT_SWAP(248, 194, 13),
+	RGB_TO_16BIT_SWAP(249, 191, 14),
+	RGB_TO_16BIT_SWAP(250, 189, 14),
+	RGB_TO_16BIT_SWAP(251, 187, 15),
+	RGB_TO_16BIT_SWAP(251, 185, 16),
+	RGB_TO_16BIT_SWAP(252, 183, 17),
+	RGB_TO_16BIT_SWAP(252, 178, 18),
+	RGB_TO_16BIT_SWAP(253, 174, 19),
+	RGB_TO_16BIT_SWAP(253, 171, 19),
+	RGB_TO_16BIT_SWAP(254, 168, 20),
+	RGB_TO_16BIT_SWAP(254, 165, 21),
+	RGB_TO_16BIT_SWAP(254, 164, 21),
+	RGB_TO_16BIT_SWAP(255, 163, 22),
+	RGB_TO_16BIT_SWAP(255, 161, 22),
+	RGB_TO_16BIT_SWAP(255, 159, 23),
+	RGB_TO_16BIT_SWAP(255, 157, 23),
+	RGB_TO_16BIT_SWAP(255, 155, 24),
+	RGB_TO_16BIT_SWAP(255, 149, 25),
+	RGB_TO_16BIT_SWAP(255, 143, 27),
+	RGB_TO_16BIT_SWAP(255, 139, 28),
+	RGB_TO_16BIT_SWAP(255, 135, 30),
+	RGB_TO_16BIT_SWAP(255, 131, 31),
+	RGB_TO_16BIT_SWAP(255, 127, 32),
+	RGB_TO_16BIT_SWAP(255, 118, 34),
+	RGB_TO_16BIT_SWAP(255, 110, 36),
+	RGB_TO_16BIT_SWAP(255, 104, 37),
+	RGB_TO_16BIT_SWAP(255, 101, 38),
+	RGB_TO_16BIT_SWAP(255, 99, 39),
+	RGB_TO_16BIT_SWAP(255, 93, 40),
+	RGB_TO_16BIT_SWAP(255, 88, 42),
+	RGB_TO_16BIT_SWAP(254, 82, 43),
+	RGB_TO_16BIT_SWAP(254, 77, 45),
+	RGB_TO_16BIT_SWAP(254, 69, 47),
+	RGB_TO_16BIT_SWAP(254, 62, 49),
+	RGB_TO_16BIT_SWAP(253, 57, 50),
+	RGB_TO_16BIT_SWAP(253, 53, 52),
+	RGB_TO_16BIT_SWAP(252, 49, 53),
+	RGB_TO_16BIT_SWAP(252, 45, 55),
+	RGB_TO_16BIT_SWAP(251, 39, 57),
+	RGB_TO_16BIT_SWAP(251, 33, 59),
+	RGB_TO_16BIT_SWAP(251, 32, 60),
+	RGB_TO_16BIT_SWAP(251, 31, 60),
+	RGB_TO_16BIT_SWAP(251, 30, 61),
+	RGB_TO_16BIT_SWAP(251, 29, 61),
+	RGB_TO_16BIT_SWAP(251, 28, 62),
+	RGB_TO_16BIT_SWAP(250, 27, 63),
+	RGB_TO_16BIT_SWAP(250, 27, 65),
+	RGB_TO_16BIT_SWAP(249, 26, 66),
+	RGB_TO_16BIT_SWAP(249, 26, 68),
+	RGB_TO_16BIT_SWAP(248, 25, 70),
+	RGB_TO_16BIT_SWAP(248, 24, 73),
+	RGB_TO_16BIT_SWAP(247, 24, 75),
+	RGB_TO_16BIT_SWAP(247, 25, 77),
+	RGB_TO_16BIT_SWAP(247, 25, 79),
+	RGB_TO_16BIT_SWAP(247, 26, 81),
+	RGB_TO_16BIT_SWAP(247, 32, 83),
+	RGB_TO_16BIT_SWAP(247, 35, 85),
+	RGB_TO_16BIT_SWAP(247, 38, 86),
+	RGB_TO_16BIT_SWAP(247, 42, 88),
+	RGB_TO_16BIT_SWAP(247, 46, 90),
+	RGB_TO_16BIT_SWAP(247, 50, 92),
+	RGB_TO_16BIT_SWAP(248, 55, 94),
+	RGB_TO_16BIT_SWAP(248, 59, 96),
+	RGB_TO_16BIT_SWAP(248, 64, 98),
+	RGB_TO_16BIT_SWAP(248, 72, 101),
+	RGB_TO_16BIT_SWAP(249, 81, 104),
+	RGB_TO_16BIT_SWAP(249, 87, 106),
+	RGB_TO_16BIT_SWAP(250, 93, 108),
+	RGB_TO_16BIT_SWAP(250, 95, 109),
+	RGB_TO_16BIT_SWAP(250, 98, 110),
+	RGB_TO_16BIT_SWAP(250, 100, 111),
+	RGB_TO_16BIT_SWAP(251, 101, 112),
+	RGB_TO_16BIT_SWAP(251, 102, 113),
+	RGB_TO_16BIT_SWAP(251, 109, 117),
+	RGB_TO_16BIT_SWAP(252, 116, 121),
+	RGB_TO_16BIT_SWAP(252, 121, 123),
+	RGB_TO_16BIT_SWAP(253, 126, 126),
+	RGB_TO_16BIT_SWAP(253, 130, 128),
+	RGB_TO_16BIT_SWAP(254, 135, 131),
+	RGB_TO_16BIT_SWAP(254, 139, 133),
+	RGB_TO_16BIT_SWAP(254, 144, 136),
+	RGB_TO_16BIT_SWAP(254, 151, 140),
+	RGB_TO_16BIT_SWAP(255, 158, 144),
+	RGB_TO_16BIT_SWAP(255, 163, 146),
+	RGB_TO_16BIT_SWAP(255, 168, 149),
+	RGB_TO_16BIT_SWAP(255, 173, 152),
+	RGB_TO_16BIT_SWAP(255, 176, 153),
+	RGB_TO_16BIT_SWAP(255, 178, 155),
+	RGB_TO_16BIT_SWAP(255, 184, 160),
+	RGB_TO_16BIT_SWAP(255, 191, 165),
+	RGB_TO_16BIT_SWAP(255, 195, 168),
+	RGB_TO_16BIT_SWAP(255, 199, 172),
+	RGB_TO_16BIT_SWAP(255, 203, 175),
+	RGB_TO_16BIT_SWAP(255, 207, 179),
+	RGB_TO_16BIT_SWAP(255, 211, 182),
+	RGB_TO_16BIT_SWAP(255, 216, 185),
+	RGB_TO_16BIT_SWAP(255, 218, 190),
+	RGB_TO_16BIT_SWAP(255, 220, 196),
+	RGB_TO_16BIT_SWAP(255, 222, 200),
+	RGB_TO_16BIT_SWAP(255, 225, 202),
+	RGB_TO_16BIT_SWAP(255, 227, 204),
+	RGB_TO_16BIT_SWAP(255, 230, 206),
+	RGB_TO_16BIT_SWAP(255, 233, 208)
 };
 
 #endif /* PALETTE_RAINBOW_H */
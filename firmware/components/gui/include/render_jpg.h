@@ -27,14 +27,24 @@
 // JPG Render Constants
 //
 
-// Using tjpgd (http://elm-chan.org/fsw/tjpgd/00index.html)
-#define TJPGD_WORK_BUF_LEN 3100
+// Using tjpgd (http://elm-chan.org/fsw/tjpgd/00index.html).  The work area includes
+// 2048 bytes for the JD_FASTDECODE huffman lookup tables.
+#define TJPGD_WORK_BUF_LEN 5200
+
+// Uncomment to log the time to decode the first camera image with the original tjpgd
+// output path and the fast path
+//#define RENDER_JPG_BENCHMARK
 
 
 //
 // JPG Render API
 //
 int render_init();
-int render_jpeg_image(uint8_t* fb, uint8_t* jpeg, uint32_t jpeg_length, uint16_t src_width, uint16_t dst_width);
+int render_jpeg_image(uint8_t* fb, uint8_t* jpeg, uint32_t jpeg_length, uint16_t dst_width, uint16_t dst_height);
+int render_jpeg_preview(uint8_t* fb, uint8_t* jpeg, uint32_t jpeg_length, uint16_t dst_width, uint16_t dst_height);
+int render_jpeg_get_size(uint8_t* jpeg, uint32_t jpeg_length, uint16_t* width, uint16_t* height);
+#ifdef RENDER_JPG_BENCHMARK
+void render_jpeg_benchmark(uint8_t* jpeg, uint32_t jpeg_length, uint16_t dst_width, uint16_t dst_height);
+#endif
 
 #endif /* RENDER_JPG_H */
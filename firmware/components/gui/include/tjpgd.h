@@ -10,6 +10,7 @@
 #define JD_FORMAT		1	/* Output pixel format 0:RGB888 (3 unsigned char/pix), 1:RGB565 (1 unsigned short/pix) */
 #define	JD_USE_SCALE	1	/* Use descaling feature for output */
 #define JD_TBLCLIP		1	/* Use table for saturation (might be a bit faster but increases 1K bytes of code size) */
+#define JD_FASTDECODE	1	/* Build huffman lookup tables and the jd_decomp_fb() fast path (uses 2K bytes more of the memory pool) */
 
 /*---------------------------------------------------------------------------*/
 
@@ -48,6 +49,9 @@ struct JDEC {
 	unsigned char* inbuf;			/* Bit stream input buffer */
 	unsigned char dmsk;				/* Current bit in the current read byte */
 	unsigned char scale;				/* Output scaling ratio */
+#if JD_FASTDECODE
+	unsigned char zoom;				/* Output pixel replication (jd_decomp_fb 1/8 scaling only) */
+#endif
 	unsigned char msx, msy;			/* MCU size in unit of block (width, height) */
 	unsigned char qtid[3];			/* Quantization table ID of each component */
 	short dcv[3];			/* Previous DC element of each component */
@@ -56,6 +60,9 @@ struct JDEC {
 	unsigned char* huffbits[2][2];	/* Huffman bit distribution tables [id][dcac] */
 	unsigned short* huffcode[2][2];	/* Huffman code word tables [id][dcac] */
 	unsigned char* huffdata[2][2];	/* Huffman decoded data tables [id][dcac] */
+#if JD_FASTDECODE
+	unsigned short* hufflut[2][2];	/* Huffman lookup tables for short codes [id][dcac] */
+#endif
 	long* qttbl[4];			/* Dequaitizer tables [id] */
 	void* workbuf;			/* Working buffer for IDCT and RGB output */
 	unsigned char* mcubuf;			/* Working buffer for the MCU */
@@ -70,6 +77,9 @@ struct JDEC {
 /* TJpgDec API functions */
 JRESULT jd_prepare (JDEC*, unsigned int(*)(JDEC*,unsigned char*,unsigned int), void*, unsigned int, void*);
 JRESULT jd_decomp (JDEC*, unsigned int(*)(JDEC*,void*,JRECT*), unsigned char);
+#if JD_FASTDECODE
+JRESULT jd_decomp_fb (JDEC*, unsigned short*, unsigned int, unsigned int, unsigned int, unsigned char, unsigned char);
+#endif
 
 
 #ifdef __cplusplus
@@ -0,0 +1,634 @@
+/*
+ * Baseline JPEG encoder
+ *
+ * Encodes the small palette-rendered Lepton images as baseline (sequential huffman)
+ * JFIF images with 4:2:0 chroma subsampling, the standard JPEG Annex K quantization
+ * tables scaled to JPGENC_QUALITY and the standard huffman tables.  The forward DCT is
+ * the fixed-point IJG "islow" algorithm.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "jpgenc.h"
+#include <string.h>
+
+
+//
+// JPEG Encoder private constants
+//
+
+// Fixed-point DCT constants (13 fractional bits) and the extra precision kept between
+// the row and column passes
+#define DCT_CONST_BITS  13
+#define DCT_PASS1_BITS  2
+
+#define FIX_0_298631336 2446
+#define FIX_0_390180644 3196
+#define FIX_0_541196100 4433
+#define FIX_0_765366865 6270
+#define FIX_0_899976223 7373
+#define FIX_1_175875602 9633
+#define FIX_1_501321110 12299
+#define FIX_1_847759065 15137
+#define FIX_1_961570560 16069
+#define FIX_2_053119869 16819
+#define FIX_2_562915447 20995
+#define FIX_3_072711026 25172
+
+#define DESCALE(x, n)   (((x) + (1 << ((n) - 1))) >> (n))
+
+// Component table indexes
+#define JPGENC_LUM      0
+#define JPGENC_CHROMA   1
+
+
+
+//
+// JPEG Encoder typedefs
+//
+
+// Bit writer
+typedef struct {
+	uint8_t* p;
+	uint8_t* endP;
+	uint32_t acc;                // Bits not yet written, right aligned
+	int n;                       // Number of them
+} jpgenc_bits_t;
+
+// Huffman code and length for each symbol
+typedef struct {
+	uint16_t code[256];
+	uint8_t size[256];
+} jpgenc_huff_t;
+
+
+
+//
+// JPEG Encoder variables
+//
+
+// Zig-zag position to natural (row-major) coefficient index
+static const uint8_t jpgenc_zigzag[64] = {
+	 0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+	12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// Annex K quantization tables (natural order)
+static const uint8_t jpgenc_std_quant[2][64] = {
+	{
+		16, 11, 10, 16,  24,  40,  51,  61,
+		12, 12, 14, 19,  26,  58,  60,  55,
+		14, 13, 16, 24,  40,  57,  69,  56,
+		14, 17, 22, 29,  51,  87,  80,  62,
+		18, 22, 37, 56,  68, 109, 103,  77,
+		24, 35, 55, 64,  81, 104, 113,  92,
+		49, 64, 78, 87, 103, 121, 120, 101,
+		72, 92, 95, 98, 112, 100, 103,  99
+	},
+	{
+		17, 18, 24, 47, 99, 99, 99, 99,
+		18, 21, 26, 66, 99, 99, 99, 99,
+		24, 26, 56, 99, 99, 99, 99, 99,
+		47, 66, 99, 99, 99, 99, 99, 99,
+		99, 99, 99, 99, 99, 99, 99, 99,
+		99, 99, 99, 99, 99, 99, 99, 99,
+		99, 99, 99, 99, 99, 99, 99, 99,
+		99, 99, 99, 99, 99, 99, 99, 99
+	}
+};
+
+// Annex K huffman tables: the number of codes of each length (1 - 16) then the symbols
+static const uint8_t jpgenc_dc_bits[2][16] = {
+	{0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0},
+	{0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0}
+};
+
+static const uint8_t jpgenc_dc_vals[12] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11
+};
+
+static const uint8_t jpgenc_ac_bits[2][16] = {
+	{0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D},
+	{0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77}
+};
+
+static const uint8_t jpgenc_ac_vals[2][162] = {
+	{
+		0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+		0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+		0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+		0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+		0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+		0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+		0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+		0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+		0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+		0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+		0xF9, 0xFA
+	},
+	{
+		0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+		0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33, 0x52, 0xF0,
+		0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34, 0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19, 0x1A, 0x26,
+		0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+		0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+		0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+		0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5,
+		0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3,
+		0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA,
+		0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+		0xF9, 0xFA
+	}
+};
+
+// Tables built on first use
+static bool jpgenc_tables_valid = false;
+static uint8_t jpgenc_quant[2][64];          // Scaled quantization tables (zig-zag order)
+static int32_t jpgenc_recip[2][64];          // 16.16 reciprocals of 8 * quant (natural order)
+static jpgenc_huff_t jpgenc_dc_huff[2];
+static jpgenc_huff_t jpgenc_ac_huff[2];
+
+// Current MCU (kept off the calling task's stack)
+static int32_t jpgenc_blocks[6][64];
+
+
+
+//
+// JPEG Encoder Forward Declarations for internal functions
+//
+static void jpgenc_init_tables();
+static void jpgenc_build_huff(jpgenc_huff_t* hP, const uint8_t* bits, const uint8_t* vals);
+static uint8_t* jpgenc_put_headers(uint8_t* p, int width, int height);
+static uint8_t* jpgenc_put_dht(uint8_t* p, int class_id, const uint8_t* bits, const uint8_t* vals);
+static void jpgenc_load_mcu(const uint16_t* src, int width, int height, bool swapped, int mx, int my, int32_t blocks[6][64]);
+static void jpgenc_fdct(int32_t* d);
+static void jpgenc_encode_block(jpgenc_bits_t* bitsP, int32_t* d, int comp, int32_t* dc_predP);
+static void jpgenc_put_bits(jpgenc_bits_t* bitsP, uint32_t v, int n);
+static void jpgenc_flush_bits(jpgenc_bits_t* bitsP);
+
+
+
+//
+// JPEG Encoder API
+//
+
+/**
+ * Encode the width x height RGB565 image in src (byte-swapped pixels, as LittleVGL
+ * stores them, if swapped is set) into dst.  Returns the JFIF image length or 0 if it
+ * won't fit in dst_len bytes.  The tables are built on the first call and the encoder
+ * keeps its working state in static memory so only one task should use it.
+ */
+uint32_t jpgenc_encode_rgb565(const uint16_t* src, int width, int height, bool swapped, uint8_t* dst, uint32_t dst_len)
+{
+	int32_t dc_pred[3] = {0, 0, 0};
+	int i;
+	int mx, my;
+	jpgenc_bits_t bits;
+	
+	if (!jpgenc_tables_valid) {
+		jpgenc_init_tables();
+	}
+	
+	// The headers are about 600 bytes
+	if (dst_len < (1024 + JPGENC_MAX_MCU_LEN)) return 0;
+	
+	bits.p = jpgenc_put_headers(dst, width, height);
+	bits.endP = dst + dst_len - JPGENC_MAX_MCU_LEN - 2;
+	bits.acc = 0;
+	bits.n = 0;
+	
+	// 16x16 pixel MCUs of four luminance blocks and one each of Cb and Cr
+	for (my=0; my<height; my+=16) {
+		for (mx=0; mx<width; mx+=16) {
+			if (bits.p > bits.endP) return 0;
+	
+			jpgenc_load_mcu(src, width, height, swapped, mx, my, jpgenc_blocks);
+			for (i=0; i<6; i++) {
+				jpgenc_fdct(jpgenc_blocks[i]);
+				if (i < 4) {
+					jpgenc_encode_block(&bits, jpgenc_blocks[i], JPGENC_LUM, &dc_pred[0]);
+				} else {
+					jpgenc_encode_block(&bits, jpgenc_blocks[i], JPGENC_CHROMA, &dc_pred[i-3]);
+				}
+			}
+		}
+	}
+	jpgenc_flush_bits(&bits);
+	
+	// EOI
+	*bits.p++ = 0xFF;
+	*bits.p++ = 0xD9;
+	
+	return (uint32_t) (bits.p - dst);
+}
+
+
+
+//
+// JPEG Encoder internal functions
+//
+
+/**
+ * Scale the quantization tables and build the huffman code tables
+ */
+static void jpgenc_init_tables()
+{
+	int c, i;
+	int32_t q;
+	int scale;
+	
+	scale = (JPGENC_QUALITY < 50) ? (5000 / JPGENC_QUALITY) : (200 - 2 * JPGENC_QUALITY);
+	for (c=0; c<2; c++) {
+		for (i=0; i<64; i++) {
+			q = ((int32_t) jpgenc_std_quant[c][jpgenc_zigzag[i]] * scale + 50) / 100;
+			if (q < 1) q = 1;
+			if (q > 255) q = 255;
+			jpgenc_quant[c][i] = (uint8_t) q;
+	
+			// The DCT output is scaled up by 8
+			jpgenc_recip[c][jpgenc_zigzag[i]] = (1 << 16) / (q * 8);
+		}
+	
+		jpgenc_build_huff(&jpgenc_dc_huff[c], jpgenc_dc_bits[c], jpgenc_dc_vals);
+		jpgenc_build_huff(&jpgenc_ac_huff[c], jpgenc_ac_bits[c], jpgenc_ac_vals[c]);
+	}
+	
+	jpgenc_tables_valid = true;
+}
+
+
+/**
+ * Assign the canonical huffman codes described by bits and vals to their symbols
+ */
+static void jpgenc_build_huff(jpgenc_huff_t* hP, const uint8_t* bits, const uint8_t* vals)
+{
+	int i, j;
+	int k = 0;
+	uint16_t code = 0;
+	
+	memset(hP->size, 0, sizeof(hP->size));
+	for (i=0; i<16; i++) {
+		for (j=0; j<bits[i]; j++) {
+			hP->code[vals[k]] = code++;
+			hP->size[vals[k]] = i + 1;
+			k++;
+		}
+		code <<= 1;
+	}
+}
+
+
+/**
+ * Write the SOI, APP0 (JFIF), DQT, SOF0, DHT and SOS markers.  Returns the position of
+ * the entropy coded data.
+ */
+static uint8_t* jpgenc_put_headers(uint8_t* p, int width, int height)
+{
+	static const uint8_t app0[] = {
+		0xFF, 0xD8,                                          // SOI
+		0xFF, 0xE0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00,    // APP0 JFIF 1.1
+		0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00
+	};
+	int c;
+	
+	memcpy(p, app0, sizeof(app0));
+	p += sizeof(app0);
+	
+	// DQT with both 8-bit tables
+	*p++ = 0xFF;
+	*p++ = 0xDB;
+	*p++ = 0x00;
+	*p++ = 2 + 2 * 65;
+	for (c=0; c<2; c++) {
+		*p++ = c;
+		memcpy(p, jpgenc_quant[c], 64);
+		p += 64;
+	}
+	
+	// SOF0: 8-bit samples, Y sampled 2x2 with table 0, Cb and Cr 1x1 with table 1
+	*p++ = 0xFF;
+	*p++ = 0xC0;
+	*p++ = 0x00;
+	*p++ = 17;
+	*p++ = 8;
+	*p++ = height >> 8;
+	*p++ = height & 0xFF;
+	*p++ = width >> 8;
+	*p++ = width & 0xFF;
+	*p++ = 3;
+	for (c=1; c<=3; c++) {
+		*p++ = c;
+		*p++ = (c == 1) ? 0x22 : 0x11;
+		*p++ = (c == 1) ? 0 : 1;
+	}
+	
+	for (c=0; c<2; c++) {
+		p = jpgenc_put_dht(p, 0x00 | c, jpgenc_dc_bits[c], jpgenc_dc_vals);
+		p = jpgenc_put_dht(p, 0x10 | c, jpgenc_ac_bits[c], jpgenc_ac_vals[c]);
+	}
+	
+	// SOS: the three components, Y with tables 0, Cb and Cr with tables 1
+	*p++ = 0xFF;
+	*p++ = 0xDA;
+	*p++ = 0x00;
+	*p++ = 12;
+	*p++ = 3;
+	for (c=1; c<=3; c++) {
+		*p++ = c;
+		*p++ = (c == 1) ? 0x00 : 0x11;
+	}
+	*p++ = 0;                                                // Spectral selection 0 - 63
+	*p++ = 63;
+	*p++ = 0;
+	
+	return p;
+}
+
+
+static uint8_t* jpgenc_put_dht(uint8_t* p, int class_id, const uint8_t* bits, const uint8_t* vals)
+{
+	int i;
+	int n = 0;
+	
+	for (i=0; i<16; i++) {
+		n += bits[i];
+	}
+	
+	*p++ = 0xFF;
+	*p++ = 0xC4;
+	*p++ = (2 + 1 + 16 + n) >> 8;
+	*p++ = (2 + 1 + 16 + n) & 0xFF;
+	*p++ = class_id;
+	memcpy(p, bits, 16);
+	p += 16;
+	memcpy(p, vals, n);
+	
+	return p + n;
+}
+
+
+/**
+ * Convert the 16x16 pixels at mx, my to level shifted YCbCr blocks (four luminance
+ * blocks then the averaged Cb and Cr blocks).  Pixels past the edge of the image repeat
+ * the last row and column.
+ */
+static void jpgenc_load_mcu(const uint16_t* src, int width, int height, bool swapped, int mx, int my, int32_t blocks[6][64])
+{
+	int x, y;
+	int sx, sy;
+	int ci;
+	int32_t r, g, b;
+	uint16_t t;
+	
+	memset(blocks[4], 0, 2 * 64 * sizeof(int32_t));
+	
+	for (y=0; y<16; y++) {
+		sy = my + y;
+		if (sy >= height) sy = height - 1;
+		for (x=0; x<16; x++) {
+			sx = mx + x;
+			if (sx >= width) sx = width - 1;
+	
+			t = src[sy * width + sx];
+			if (swapped) {
+				t = (t >> 8) | (t << 8);
+			}
+			r = ((t >> 8) & 0xF8) | (t >> 13);
+			g = ((t >> 3) & 0xFC) | ((t >> 9) & 0x03);
+			b = ((t << 3) & 0xF8) | ((t >> 2) & 0x07);
+	
+			// Luminance block 0 - 3 is the top-left, top-right, bottom-left, bottom-right
+			blocks[((y >> 3) << 1) | (x >> 3)][((y & 7) << 3) | (x & 7)] =
+				((77 * r + 150 * g + 29 * b) >> 8) - 128;
+	
+			// Chroma are summed over each 2x2 pixel group (already level shifted)
+			ci = ((y >> 1) << 3) | (x >> 1);
+			blocks[4][ci] += (-43 * r - 85 * g + 128 * b) >> 8;
+			blocks[5][ci] += (128 * r - 107 * g - 21 * b) >> 8;
+		}
+	}
+	
+	for (ci=0; ci<64; ci++) {
+		blocks[4][ci] = DESCALE(blocks[4][ci], 2);
+		blocks[5][ci] = DESCALE(blocks[5][ci], 2);
+	}
+}
+
+
+/**
+ * In-place forward DCT of an 8x8 block.  The output is scaled up by 8.
+ */
+static void jpgenc_fdct(int32_t* d)
+{
+	int32_t tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+	int32_t tmp10, tmp11, tmp12, tmp13;
+	int32_t z1, z2, z3, z4, z5;
+	int32_t* p;
+	int i;
+	
+	// Rows, keeping DCT_PASS1_BITS of extra precision
+	p = d;
+	for (i=0; i<8; i++) {
+		tmp0 = p[0] + p[7];
+		tmp7 = p[0] - p[7];
+		tmp1 = p[1] + p[6];
+		tmp6 = p[1] - p[6];
+		tmp2 = p[2] + p[5];
+		tmp5 = p[2] - p[5];
+		tmp3 = p[3] + p[4];
+		tmp4 = p[3] - p[4];
+	
+		tmp10 = tmp0 + tmp3;
+		tmp13 = tmp0 - tmp3;
+		tmp11 = tmp1 + tmp2;
+		tmp12 = tmp1 - tmp2;
+	
+		p[0] = (tmp10 + tmp11) << DCT_PASS1_BITS;
+		p[4] = (tmp10 - tmp11) << DCT_PASS1_BITS;
+	
+		z1 = (tmp12 + tmp13) * FIX_0_541196100;
+		p[2] = DESCALE(z1 + tmp13 * FIX_0_765366865, DCT_CONST_BITS - DCT_PASS1_BITS);
+		p[6] = DESCALE(z1 - tmp12 * FIX_1_847759065, DCT_CONST_BITS - DCT_PASS1_BITS);
+	
+		z1 = tmp4 + tmp7;
+		z2 = tmp5 + tmp6;
+		z3 = tmp4 + tmp6;
+		z4 = tmp5 + tmp7;
+		z5 = (z3 + z4) * FIX_1_175875602;
+	
+		tmp4 *= FIX_0_298631336;
+		tmp5 *= FIX_2_053119869;
+		tmp6 *= FIX_3_072711026;
+		tmp7 *= FIX_1_501321110;
+		z1 *= -FIX_0_899976223;
+		z2 *= -FIX_2_562915447;
+		z3 = z3 * -FIX_1_961570560 + z5;
+		z4 = z4 * -FIX_0_390180644 + z5;
+	
+		p[7] = DESCALE(tmp4 + z1 + z3, DCT_CONST_BITS - DCT_PASS1_BITS);
+		p[5] = DESCALE(tmp5 + z2 + z4, DCT_CONST_BITS - DCT_PASS1_BITS);
+		p[3] = DESCALE(tmp6 + z2 + z3, DCT_CONST_BITS - DCT_PASS1_BITS);
+		p[1] = DESCALE(tmp7 + z1 + z4, DCT_CONST_BITS - DCT_PASS1_BITS);
+	
+		p += 8;
+	}
+	
+	// Columns, removing the extra precision
+	p = d;
+	for (i=0; i<8; i++) {
+		tmp0 = p[8*0] + p[8*7];
+		tmp7 = p[8*0] - p[8*7];
+		tmp1 = p[8*1] + p[8*6];
+		tmp6 = p[8*1] - p[8*6];
+		tmp2 = p[8*2] + p[8*5];
+		tmp5 = p[8*2] - p[8*5];
+		tmp3 = p[8*3] + p[8*4];
+		tmp4 = p[8*3] - p[8*4];
+	
+		tmp10 = tmp0 + tmp3;
+		tmp13 = tmp0 - tmp3;
+		tmp11 = tmp1 + tmp2;
+		tmp12 = tmp1 - tmp2;
+	
+		p[8*0] = DESCALE(tmp10 + tmp11, DCT_PASS1_BITS);
+		p[8*4] = DESCALE(tmp10 - tmp11, DCT_PASS1_BITS);
+	
+		z1 = (tmp12 + tmp13) * FIX_0_541196100;
+		p[8*2] = DESCALE(z1 + tmp13 * FIX_0_765366865, DCT_CONST_BITS + DCT_PASS1_BITS);
+		p[8*6] = DESCALE(z1 - tmp12 * FIX_1_847759065, DCT_CONST_BITS + DCT_PASS1_BITS);
+	
+		z1 = tmp4 + tmp7;
+		z2 = tmp5 + tmp6;
+		z3 = tmp4 + tmp6;
+		z4 = tmp5 + tmp7;
+		z5 = (z3 + z4) * FIX_1_175875602;
+	
+		tmp4 *= FIX_0_298631336;
+		tmp5 *= FIX_2_053119869;
+		tmp6 *= FIX_3_072711026;
+		tmp7 *= FIX_1_501321110;
+		z1 *= -FIX_0_899976223;
+		z2 *= -FIX_2_562915447;
+		z3 = z3 * -FIX_1_961570560 + z5;
+		z4 = z4 * -FIX_0_390180644 + z5;
+	
+		p[8*7] = DESCALE(tmp4 + z1 + z3, DCT_CONST_BITS + DCT_PASS1_BITS);
+		p[8*5] = DESCALE(tmp5 + z2 + z4, DCT_CONST_BITS + DCT_PASS1_BITS);
+		p[8*3] = DESCALE(tmp6 + z2 + z3, DCT_CONST_BITS + DCT_PASS1_BITS);
+		p[8*1] = DESCALE(tmp7 + z1 + z4, DCT_CONST_BITS + DCT_PASS1_BITS);
+	
+		p++;
+	}
+}
+
+
+/**
+ * Quantize a transformed block and huffman code it in zig-zag order
+ */
+static void jpgenc_encode_block(jpgenc_bits_t* bitsP, int32_t* d, int comp, int32_t* dc_predP)
+{
+	const jpgenc_huff_t* dcP = &jpgenc_dc_huff[comp];
+	const jpgenc_huff_t* acP = &jpgenc_ac_huff[comp];
+	const int32_t* recipP = jpgenc_recip[comp];
+	int i;
+	int n;
+	int run = 0;
+	int32_t v;
+	int32_t a;
+	
+	for (i=0; i<64; i++) {
+		// Round to the nearest quantization step
+		v = d[jpgenc_zigzag[i]];
+		a = (v < 0) ? -v : v;
+		a = (a * recipP[jpgenc_zigzag[i]] + (1 << 15)) >> 16;
+		v = (v < 0) ? -a : a;
+	
+		if (i == 0) {
+			// DC difference from the component's previous block
+			a = v - *dc_predP;
+			*dc_predP = v;
+			v = a;
+		} else if (v == 0) {
+			run++;
+			continue;
+		} else {
+			while (run > 15) {
+				jpgenc_put_bits(bitsP, acP->code[0xF0], acP->size[0xF0]);
+				run -= 16;
+			}
+		}
+	
+		// Magnitude category and the value bits (one's complement for negative values)
+		a = (v < 0) ? -v : v;
+		n = 0;
+		while (a != 0) {
+			n++;
+			a >>= 1;
+		}
+		if (v < 0) v--;
+	
+		if (i == 0) {
+			jpgenc_put_bits(bitsP, dcP->code[n], dcP->size[n]);
+		} else {
+			jpgenc_put_bits(bitsP, acP->code[(run << 4) | n], acP->size[(run << 4) | n]);
+			run = 0;
+		}
+		jpgenc_put_bits(bitsP, (uint32_t) v, n);
+	}
+	
+	if (run != 0) {
+		// EOB
+		jpgenc_put_bits(bitsP, acP->code[0x00], acP->size[0x00]);
+	}
+}
+
+
+/**
+ * Write the low n bits of v (n <= 16), most significant first, stuffing a 0 after each
+ * 0xFF byte
+ */
+static void jpgenc_put_bits(jpgenc_bits_t* bitsP, uint32_t v, int n)
+{
+	uint8_t c;
+	
+	if (n == 0) return;
+	
+	bitsP->acc = (bitsP->acc << n) | (v & ((1 << n) - 1));
+	bitsP->n += n;
+	while (bitsP->n >= 8) {
+		bitsP->n -= 8;
+		c = (uint8_t) (bitsP->acc >> bitsP->n);
+		*bitsP->p++ = c;
+		if (c == 0xFF) {
+			*bitsP->p++ = 0;
+		}
+	}
+}
+
+
+/**
+ * Pad the last byte with 1 bits
+ */
+static void jpgenc_flush_bits(jpgenc_bits_t* bitsP)
+{
+	if (bitsP->n != 0) {
+		jpgenc_put_bits(bitsP, 0x7F, 8 - bitsP->n);
+	}
+}
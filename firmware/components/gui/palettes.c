@@ -39,27 +39,27 @@ static const char* TAG = "palettes";
 static palette_t palettes[PALETTE_COUNT] = {
 	{
 		.name = "Grayscale",
-		.map_ptr = &gray_palette_map
+		.map_ptr = gray_palette16_map
 	},
 	{
 		.name = "Fusion",
-		.map_ptr = &fusion_palette_map
+		.map_ptr = fusion_palette16_map
 	},
 	{
 		.name = "Rainbow",
-		.map_ptr = &rainbow_palette_map
+		.map_ptr = rainbow_palette16_map
 	},
 	{
 		.name = "Rainbow2",
-		.map_ptr = &double_rainbow_palette_map
+		.map_ptr = double_rainbow_palette16_map
 	},
 	{
 		.name = "Ironblack",
-		.map_ptr = &ironblack_palette_map
+		.map_ptr = ironblack_palette16_map
 	},
 	{
 		.name = "Arctic",
-		.map_ptr = &arctic_palette_map
+		.map_ptr = arctic_palette16_map
 	},
 };
 
@@ -68,27 +68,23 @@ static palette_t palettes[PALETTE_COUNT] = {
 //
 // Palette variables
 //
-uint16_t palette16[256];                 // Current palette for fast lookup
+const uint16_t* palette16 = gray_palette16_map;  // Current palette for fast lookup
 int cur_palette;
 
+// Internal RAM copy of the current palette (the maps are in flash)
+static uint16_t palette16_ram[256];
+
 
 //
 // Palette API
 //
 void set_palette(int n)
 {
-	int i;
-	
 	if ((n >= 0) && (n < PALETTE_COUNT)) {
-		ESP_LOGI(TAG, "Loading %s color map", palettes[n].name);
+		ESP_LOGI(TAG, "Selecting %s color map", palettes[n].name);
 		
-		for (i=0; i<256; i++) {
-			palette16[i] = RGB_TO_16BIT_SWAP(
-				(*(palettes[n].map_ptr))[i][0],
-				(*(palettes[n].map_ptr))[i][1],
-				(*(palettes[n].map_ptr))[i][2]
-			);
-		}
+		memcpy(palette16_ram, palettes[n].map_ptr, sizeof(palette16_ram));
+		palette16 = palette16_ram;
 		cur_palette = n;
 	}
 }
@@ -19,9 +19,13 @@
  * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
  *
  */
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "render_jpg.h"
 #include "tjpgd.h"
 
@@ -32,9 +36,11 @@ static const char* TAG = "render_jpg";
 // tjpgd Decompressor structure
 typedef struct {
 	uint8_t* jpic;	   // Pointer to jpeg image
-	uint16_t jsize;	   // Jpeg image length (bytes)
-	uint16_t joffset;  // Current offset reading from jpeg image
+	uint32_t jsize;	   // Jpeg image length (bytes)
+	uint32_t joffset;  // Current offset reading from jpeg image
 	uint16_t fwidth;   // Frame buffer width
+	uint16_t xoffset;  // Image position in the frame buffer
+	uint16_t yoffset;
 	uint8_t* fbuf;	   // Pointer to frame buffer
 } IODEV;
 
@@ -47,8 +53,11 @@ static void* tjpgd_work;
 //
 // Internal Function Forward Declarations
 //
+static int render_prepare(JDEC* jd, IODEV* dev, uint8_t* fb, uint8_t* jpeg, uint32_t jpeg_length, uint16_t dst_width, uint16_t dst_height, bool preview, uint8_t* scale, uint8_t* zoom);
 static unsigned int tjpgd_input(JDEC* jd, unsigned char* buff, unsigned int nbyte);
+#if !JD_FASTDECODE || defined(RENDER_JPG_BENCHMARK)
 static unsigned int tjpgd_output(JDEC* jd, void* bitmap, JRECT* rect);
+#endif
 
 
 
@@ -75,48 +84,235 @@ int render_init()
 
 
 /**
- * Decompress a jpeg image to our frame buffer
+ * Decompress a jpeg image to our frame buffer.  The image is scaled down by the smallest
+ * factor that fits it in the frame buffer and centered.  Images smaller than the frame
+ * buffer (for example a camera region of interest) are drawn on a black background.
  *   returns 1 for success, 0 for failure
  */
-int render_jpeg_image(uint8_t* fb, uint8_t* jpeg, uint32_t jpeg_length, uint16_t src_width, uint16_t dst_width)
+int render_jpeg_image(uint8_t* fb, uint8_t* jpeg, uint32_t jpeg_length, uint16_t dst_width, uint16_t dst_height)
 {
 	JDEC jdec;		  /* Decompression object */
 	JRESULT res;	  /* Result code of TJpgDec API */
 	IODEV devid;	  /* User defined device identifier */
 	uint8_t scale;    /* Scale Factor: 0=1:1, 1=2:1, 2=4:1, 3=8:1 */
+	uint8_t zoom;     /* Pixel replication: 1 for full decodes, 2 for DC-only previews */
+	
+	if (render_prepare(&jdec, &devid, fb, jpeg, jpeg_length, dst_width, dst_height, false, &scale, &zoom) == 0) {
+		return 0;
+	}
+
+	// Decompress
+#if JD_FASTDECODE
+	res = jd_decomp_fb(&jdec, (unsigned short*) fb, dst_width, devid.xoffset, devid.yoffset, scale, zoom);
+#else
+	res = jd_decomp(&jdec, tjpgd_output, scale);
+#endif
+	if (res != JDR_OK) {
+		ESP_LOGE(TAG, "jd_decomp failed with %d", res);
+		return 0;
+	}
+	
+	return 1;
+}
+
+
+/**
+ * Decompress a jpeg image to our frame buffer as a quick preview.  Only the DC coefficient
+ * of each 8x8 block is decoded (1/8 scale, skipping the IDCT) and each pixel is drawn as a
+ * 2x2 block.  This takes a fraction of the time of a full decode at the cost of a blocky
+ * image.  Images that can't be previewed at the same size as render_jpeg_image would draw
+ * them, or any image when built without JD_FASTDECODE, are fully decoded.
+ *   returns 1 for success, 0 for failure
+ */
+int render_jpeg_preview(uint8_t* fb, uint8_t* jpeg, uint32_t jpeg_length, uint16_t dst_width, uint16_t dst_height)
+{
+#if JD_FASTDECODE
+	JDEC jdec;
+	JRESULT res;
+	IODEV devid;
+	uint8_t scale;
+	uint8_t zoom;
+	
+	if (render_prepare(&jdec, &devid, fb, jpeg, jpeg_length, dst_width, dst_height, true, &scale, &zoom) == 0) {
+		return 0;
+	}
+	
+	res = jd_decomp_fb(&jdec, (unsigned short*) fb, dst_width, devid.xoffset, devid.yoffset, scale, zoom);
+	if (res != JDR_OK) {
+		ESP_LOGE(TAG, "jd_decomp failed with %d", res);
+		return 0;
+	}
+	
+	return 1;
+#else
+	return render_jpeg_image(fb, jpeg, jpeg_length, dst_width, dst_height);
+#endif
+}
+
+
+/**
+ * Get the dimensions of a jpeg image without decoding it
+ *   returns 1 for success, 0 for failure
+ */
+int render_jpeg_get_size(uint8_t* jpeg, uint32_t jpeg_length, uint16_t* width, uint16_t* height)
+{
+	JDEC jdec;
+	JRESULT res;
+	IODEV devid;
 	
-	// Prepare to decompress
 	devid.jpic = jpeg;
 	devid.jsize = jpeg_length;
 	devid.joffset = 0;
-	devid.fwidth = dst_width;
-	devid.fbuf = fb;
 	res = jd_prepare(&jdec, tjpgd_input, tjpgd_work, TJPGD_WORK_BUF_LEN, &devid);
 	if (res != JDR_OK) {
 		ESP_LOGE(TAG, "jd_prepare failed with %d", res);
 		return 0;
 	}
 	
-	// Compute scale factor
-	if (src_width / dst_width == 1) scale = 0;
-	else if (src_width / dst_width == 2) scale = 1;
-	else if (src_width / dst_width == 4) scale = 2;
-	else scale = 3;
+	*width = jdec.width;
+	*height = jdec.height;
+	return 1;
+}
 
-	// Decompress
-	res = jd_decomp(&jdec, tjpgd_output, scale);
-	if (res != JDR_OK) {
-		ESP_LOGE(TAG, "jd_decomp failed with %d", res);
-		return 0;
+
+#if defined(RENDER_JPG_BENCHMARK) && JD_FASTDECODE
+/**
+ * Time decoding jpeg into a dst_width x dst_height frame buffer with the original
+ * tjpgd output path and the fast path and compare their output.  The fast path averages
+ * the color components before color conversion when scaling so the images may differ
+ * by a few LSBs.
+ */
+void render_jpeg_benchmark(uint8_t* jpeg, uint32_t jpeg_length, uint16_t dst_width, uint16_t dst_height)
+{
+	const int iterations = 10;
+	int i;
+	int max_diff = 0;
+	int d;
+	int64_t t0;
+	int64_t t_ref;
+	int64_t t_fast;
+	int64_t t_preview;
+	uint16_t p1, p2;
+	uint8_t scale;
+	uint8_t zoom;
+	uint8_t* refP;
+	uint8_t* fastP;
+	JDEC jdec;
+	IODEV devid;
+	
+	refP = heap_caps_malloc(2 * dst_width * dst_height, MALLOC_CAP_SPIRAM);
+	fastP = heap_caps_malloc(2 * dst_width * dst_height, MALLOC_CAP_SPIRAM);
+	if ((refP == NULL) || (fastP == NULL)) {
+		ESP_LOGE(TAG, "Could not allocate benchmark buffers");
+		goto done;
 	}
 	
-	return 1;
+	t0 = esp_timer_get_time();
+	for (i=0; i<iterations; i++) {
+		if ((render_prepare(&jdec, &devid, refP, jpeg, jpeg_length, dst_width, dst_height, false, &scale, &zoom) == 0) ||
+		    (jd_decomp(&jdec, tjpgd_output, scale) != JDR_OK)) {
+			ESP_LOGE(TAG, "Benchmark tjpgd decode failed");
+			goto done;
+		}
+	}
+	t_ref = (esp_timer_get_time() - t0) / iterations;
+	
+	t0 = esp_timer_get_time();
+	for (i=0; i<iterations; i++) {
+		if ((render_prepare(&jdec, &devid, fastP, jpeg, jpeg_length, dst_width, dst_height, false, &scale, &zoom) == 0) ||
+		    (jd_decomp_fb(&jdec, (unsigned short*) fastP, dst_width, devid.xoffset, devid.yoffset, scale, zoom) != JDR_OK)) {
+			ESP_LOGE(TAG, "Benchmark fast decode failed");
+			goto done;
+		}
+	}
+	t_fast = (esp_timer_get_time() - t0) / iterations;
+	
+	// Largest difference in any RGB565 component
+	for (i=0; i<dst_width*dst_height; i++) {
+		p1 = (refP[2*i] << 8) | refP[2*i + 1];
+		p2 = (fastP[2*i] << 8) | fastP[2*i + 1];
+		d = abs((p1 >> 11) - (p2 >> 11));
+		if (d > max_diff) max_diff = d;
+		d = abs(((p1 >> 5) & 0x3F) - ((p2 >> 5) & 0x3F));
+		if (d > max_diff) max_diff = d;
+		d = abs((p1 & 0x1F) - (p2 & 0x1F));
+		if (d > max_diff) max_diff = d;
+	}
+	
+	t0 = esp_timer_get_time();
+	for (i=0; i<iterations; i++) {
+		if (render_jpeg_preview(refP, jpeg, jpeg_length, dst_width, dst_height) == 0) {
+			ESP_LOGE(TAG, "Benchmark preview decode failed");
+			goto done;
+		}
+	}
+	t_preview = (esp_timer_get_time() - t0) / iterations;
+	
+	ESP_LOGI(TAG, "Decode %dx%d scale %d: tjpgd %d uSec, fast %d uSec, max diff %d, preview %d uSec",
+	         jdec.width, jdec.height, scale, (int) t_ref, (int) t_fast, max_diff, (int) t_preview);
+
+done:
+	free(refP);
+	free(fastP);
 }
+#endif
 
 
 //
 // Internal Routines
 //
+
+/**
+ * Prepare the decompressor for jpeg and compute the scale factor, pixel replication and
+ * position of the image in the frame buffer
+ *   returns 1 for success, 0 for failure
+ */
+static int render_prepare(JDEC* jd, IODEV* dev, uint8_t* fb, uint8_t* jpeg, uint32_t jpeg_length, uint16_t dst_width, uint16_t dst_height, bool preview, uint8_t* scale, uint8_t* zoom)
+{
+	uint16_t w, h;
+	JRESULT res;
+	
+	dev->jpic = jpeg;
+	dev->jsize = jpeg_length;
+	dev->joffset = 0;
+	dev->fwidth = dst_width;
+	dev->xoffset = 0;
+	dev->yoffset = 0;
+	dev->fbuf = fb;
+	res = jd_prepare(jd, tjpgd_input, tjpgd_work, TJPGD_WORK_BUF_LEN, dev);
+	if (res != JDR_OK) {
+		ESP_LOGE(TAG, "jd_prepare failed with %d", res);
+		return 0;
+	}
+	
+	// Compute scale factor
+	for (*scale = 0; *scale < 3; (*scale)++) {
+		if (((jd->width >> *scale) <= dst_width) && ((jd->height >> *scale) <= dst_height)) break;
+	}
+	*zoom = 1;
+	
+	// A preview replaces decodes at 1/4 or 1/2 scale with a DC-only decode drawn at 2x when
+	// that is the same size
+	if (preview && (*scale == 2) && (2 * (jd->width >> 3) == (jd->width >> 2)) &&
+	    (2 * (jd->height >> 3) == (jd->height >> 2))) {
+		*scale = 3;
+		*zoom = 2;
+	}
+	w = (jd->width >> *scale) * *zoom;
+	h = (jd->height >> *scale) * *zoom;
+	if ((w > dst_width) || (h > dst_height)) {
+		ESP_LOGE(TAG, "jpeg %dx%d too large", jd->width, jd->height);
+		return 0;
+	}
+	if ((w < dst_width) || (h < dst_height)) {
+		memset(fb, 0, 2 * dst_width * dst_height);
+		dev->xoffset = (dst_width - w) / 2;
+		dev->yoffset = (dst_height - h) / 2;
+	}
+	
+	return 1;
+}
+
  
 /**
  * TJpgDec input function - returns data to the compressor from the jpeg image buffer
@@ -134,6 +330,7 @@ static unsigned int tjpgd_input(JDEC* jd, unsigned char* buff, unsigned int nbyt
 }
 
 
+#if !JD_FASTDECODE || defined(RENDER_JPG_BENCHMARK)
 /**
  * TjpgDec output function - updates the image buffer
  */
@@ -145,7 +342,7 @@ static unsigned int tjpgd_output(JDEC* jd, void* bitmap, JRECT* rect)
 	
 	/* Copy the decompressed RGB rectanglar to the frame buffer (assuming RGB565 cfg) */
 	src = (uint8_t*)bitmap;
-	dst = dev->fbuf + 2 * (rect->top * dev->fwidth + rect->left);  /* Left-top of destination rectangular */
+	dst = dev->fbuf + 2 * ((rect->top + dev->yoffset) * dev->fwidth + rect->left + dev->xoffset);  /* Left-top of destination rectangular */
 	bws = 2 * (rect->right - rect->left + 1);	  /* Width of source rectangular [byte] */
 	bwd = 2 * dev->fwidth;						 /* Width of frame buffer [byte] */
 	for (y = rect->top; y <= rect->bottom; y++) {
@@ -155,3 +352,4 @@ static unsigned int tjpgd_output(JDEC* jd, void* bitmap, JRECT* rect)
 
 	return 1;	/* Continue to decompress */
 }
+#endif
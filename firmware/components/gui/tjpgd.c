@@ -16,13 +16,22 @@
 / Oct 04,'11 R0.01  First release.
 / Feb 19,'12 R0.01a Fixed decompression fails when scan starts with an escape seq.
 / Sep 03,'12 R0.01b Added JD_TBLCLIP option.
+/ firecam: Added JD_FASTDECODE huffman lookup tables and jd_decomp_fb().
 /----------------------------------------------------------------------------*/
 #include "esp_system.h"
+#include "esp_attr.h"
 #include "esp_log.h"
 #include <byteswap.h>
+#include <stdint.h>
+#include <string.h>
 #include "tjpgd.h"
 
 
+#if JD_FASTDECODE
+#define HUFF_LUT_BITS	8	/* Huffman codes up to this length are decoded with one table lookup */
+#endif
+
+
 
 /*-----------------------------------------------*/
 /* Zigzag-order to raster-order conversion table */
@@ -31,7 +40,7 @@
 #define ZIG(n)	Zig[n]
 
 static
-const unsigned char Zig[64] = {	/* Zigzag-order to raster-order conversion table */
+DRAM_ATTR const unsigned char Zig[64] = {	/* Zigzag-order to raster-order conversion table */
 	 0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
 	12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
 	35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
@@ -70,7 +79,7 @@ const unsigned short Ipsf[64] = {	/* See also aa_idct.png */
 #define BYTECLIP(v) Clip8[(unsigned int)(v) & 0x3FF]
 
 static
-const unsigned char Clip8[1024] = {
+DRAM_ATTR const unsigned char Clip8[1024] = {
 	/* 0..255 */
 	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
 	32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63,
@@ -204,6 +213,10 @@ unsigned int create_huffman_tbl (	/* 0:OK, !0:Failed */
 	unsigned int i, j, b, np, cls, num;
 	unsigned char d, *pb, *pd;
 	unsigned short hc, *ph;
+#if JD_FASTDECODE
+	unsigned int k, n;
+	unsigned short *pl;
+#endif
 
 
 	while (ndata) {	/* Process all tables in the segment */
@@ -240,6 +253,22 @@ unsigned int create_huffman_tbl (	/* 0:OK, !0:Failed */
 			if (!cls && d > 11) return JDR_FMT1;
 			*pd++ = d;
 		}
+
+#if JD_FASTDECODE
+		pl = alloc_pool(jd, (1 << HUFF_LUT_BITS) * sizeof (unsigned short));	/* Allocate a memory block for the lookup table */
+		if (!pl) return JDR_MEM1;			/* Err: not enough memory */
+		jd->hufflut[num][cls] = pl;
+		for (i = 0; i < (1 << HUFF_LUT_BITS); i++) pl[i] = 0;	/* 0: code is longer than HUFF_LUT_BITS */
+		pd = jd->huffdata[num][cls];
+		for (j = i = 0; i < HUFF_LUT_BITS; i++) {	/* Fill every entry starting with each short code word */
+			n = HUFF_LUT_BITS - 1 - i;				/* Number of trailing bits not in the code */
+			for (b = pb[i]; b; b--, j++) {
+				for (k = 0; k < (1U << n); k++) {
+					pl[((unsigned int)ph[j] << n) + k] = (unsigned short)(((i + 1) << 8) | pd[j]);	/* Code length and data */
+				}
+			}
+		}
+#endif
 	}
 
 	return JDR_OK;
@@ -788,6 +817,9 @@ JRESULT jd_prepare (
 			jd->huffbits[i][j] = 0;
 			jd->huffcode[i][j] = 0;
 			jd->huffdata[i][j] = 0;
+#if JD_FASTDECODE
+			jd->hufflut[i][j] = 0;
+#endif
 		}
 	}
 	for (i = 0; i < 4; i++) jd->qttbl[i] = 0;
@@ -971,3 +1003,559 @@ JRESULT jd_decomp (
 
 
 
+
+
+
+
+#if JD_FASTDECODE
+/*-----------------------------------------------------------------------*/
+/* Fast decode path                                                      */
+/*-----------------------------------------------------------------------*/
+/* The bit stream is read through a 32-bit buffer, short huffman codes   */
+/* are decoded with one table lookup, the IDCT skips empty columns and   */
+/* rows and the pixels are converted to byte-swapped RGB565 directly in  */
+/* the frame buffer.  Scaling averages the YCbCr components before the   */
+/* color conversion.                                                     */
+
+typedef struct {
+	uint32_t buf;			/* Bit buffer (MSB aligned) */
+	int cnt;				/* Number of valid bits in the buffer */
+	int marker;				/* Marker found in the stream (0: none yet) */
+} JBITS;
+
+
+
+/* Get a byte from the input stream (<0: input error) */
+static inline
+int IRAM_ATTR getbyte_fast (
+	JDEC* jd	/* Pointer to the decompressor object */
+)
+{
+	if (!jd->dctr) {	/* No input data is available, re-fill input buffer */
+		jd->dptr = jd->inbuf;
+		jd->dctr = jd->infunc(jd, jd->dptr, JD_SZBUF);
+		if (!jd->dctr) return 0 - (int)JDR_INP;
+	} else {
+		jd->dptr++;
+	}
+	jd->dctr--;
+
+	return *jd->dptr;
+}
+
+
+
+/* Load the bit buffer with at least 25 bits (0:OK, <0: input error) */
+static inline
+int IRAM_ATTR fill_fast (
+	JDEC* jd,	/* Pointer to the decompressor object */
+	JBITS* bs	/* Bit buffer */
+)
+{
+	int d;
+
+
+	while (bs->cnt <= 24) {
+		d = 0;
+		if (!bs->marker) {
+			d = getbyte_fast(jd);
+			if (d < 0) return d;
+			if (d == 0xFF) {
+				do {
+					d = getbyte_fast(jd);
+					if (d < 0) return d;
+				} while (d == 0xFF);	/* Skip fill bytes */
+				if (d == 0) {
+					d = 0xFF;			/* The flag is a data 0xFF */
+				} else {
+					bs->marker = d;		/* End of the entropy coded segment, feed zeros from here */
+					d = 0;
+				}
+			}
+		}
+		bs->buf |= (uint32_t)d << (24 - bs->cnt);
+		bs->cnt += 8;
+	}
+
+	return 0;
+}
+
+
+
+/* Extract N bits from the bit buffer (>=0: extracted data, <0: error code) */
+static inline
+int IRAM_ATTR bitext_fast (
+	JDEC* jd,			/* Pointer to the decompressor object */
+	JBITS* bs,			/* Bit buffer */
+	unsigned int nbit	/* Number of bits to extract (1 to 15) */
+)
+{
+	int v;
+
+
+	if (bs->cnt < (int)nbit && fill_fast(jd, bs)) return 0 - (int)JDR_INP;
+	v = (int)(bs->buf >> (32 - nbit));
+	bs->buf <<= nbit; bs->cnt -= nbit;
+
+	return v;
+}
+
+
+
+/* Extract a huffman decoded data (>=0: decoded data, <0: error code) */
+static inline
+int IRAM_ATTR huffext_fast (
+	JDEC* jd,			/* Pointer to the decompressor object */
+	JBITS* bs,			/* Bit buffer */
+	unsigned int id,	/* Huffman table ID */
+	unsigned int cls	/* 0:DC, 1:AC */
+)
+{
+	const unsigned char *hb, *hd;
+	const unsigned short *hc;
+	unsigned int e, l, nd, code;
+
+
+	if (bs->cnt < 16 && fill_fast(jd, bs)) return 0 - (int)JDR_INP;
+
+	e = jd->hufflut[id][cls][bs->buf >> (32 - HUFF_LUT_BITS)];
+	if (e) {			/* Short code */
+		l = e >> 8;
+		bs->buf <<= l; bs->cnt -= l;
+		return (int)(e & 0xFF);
+	}
+
+	/* Search the code word tables for a long code */
+	hb = jd->huffbits[id][cls];
+	hc = jd->huffcode[id][cls];
+	hd = jd->huffdata[id][cls];
+	for (l = 1; l <= 16; l++) {
+		code = (unsigned int)(bs->buf >> (32 - l));
+		for (nd = *hb++; nd; nd--) {
+			if (code == *hc++) {
+				bs->buf <<= l; bs->cnt -= l;
+				return *hd;
+			}
+			hd++;
+		}
+	}
+
+	return 0 - (int)JDR_FMT1;	/* Err: code not found (may be collapted data) */
+}
+
+
+
+/* Apply Inverse-DCT in Arai Algorithm skipping empty columns and rows.  The output is   */
+/* identical to block_idct().                                                           */
+static
+void IRAM_ATTR block_idct_fast (
+	long* src,				/* Input block data (de-quantized and pre-scaled for Arai Algorithm) */
+	unsigned char* dst,		/* Pointer to the destination to store the block as byte array */
+	unsigned int cols_nz,	/* Bit mask of columns with any non-zero element */
+	unsigned int cols_ac	/* Bit mask of columns with non-zero elements below row 0 */
+)
+{
+	const long M13 = (long)(1.41421*4096), M2 = (long)(1.08239*4096), M4 = (long)(2.61313*4096), M5 = (long)(1.84776*4096);
+	long v0, v1, v2, v3, v4, v5, v6, v7;
+	long t10, t11, t12, t13;
+	unsigned int i;
+	unsigned char c;
+
+
+	/* Process columns */
+	for (i = 0; i < 8; i++, src++) {
+		if (!(cols_ac & (1 << i))) {
+			if (cols_nz & (1 << i)) {	/* Only the DC element - all outputs are the same */
+				v0 = src[8 * 0];
+				src[8 * 1] = v0; src[8 * 2] = v0; src[8 * 3] = v0;
+				src[8 * 4] = v0; src[8 * 5] = v0; src[8 * 6] = v0; src[8 * 7] = v0;
+			}
+			continue;					/* An empty column stays empty */
+		}
+
+		v0 = src[8 * 0];	/* Get even elements */
+		v1 = src[8 * 2];
+		v2 = src[8 * 4];
+		v3 = src[8 * 6];
+
+		t10 = v0 + v2;		/* Process the even elements */
+		t12 = v0 - v2;
+		t11 = (v1 - v3) * M13 >> 12;
+		v3 += v1;
+		t11 -= v3;
+		v0 = t10 + v3;
+		v3 = t10 - v3;
+		v1 = t11 + t12;
+		v2 = t12 - t11;
+
+		v4 = src[8 * 7];	/* Get odd elements */
+		v5 = src[8 * 1];
+		v6 = src[8 * 5];
+		v7 = src[8 * 3];
+
+		t10 = v5 - v4;		/* Process the odd elements */
+		t11 = v5 + v4;
+		t12 = v6 - v7;
+		v7 += v6;
+		v5 = (t11 - v7) * M13 >> 12;
+		v7 += t11;
+		t13 = (t10 + t12) * M5 >> 12;
+		v4 = t13 - (t10 * M2 >> 12);
+		v6 = t13 - (t12 * M4 >> 12) - v7;
+		v5 -= v6;
+		v4 -= v5;
+
+		src[8 * 0] = v0 + v7;	/* Write-back transformed values */
+		src[8 * 7] = v0 - v7;
+		src[8 * 1] = v1 + v6;
+		src[8 * 6] = v1 - v6;
+		src[8 * 2] = v2 + v5;
+		src[8 * 5] = v2 - v5;
+		src[8 * 3] = v3 + v4;
+		src[8 * 4] = v3 - v4;
+	}
+
+	/* Process rows */
+	src -= 8;
+	if (cols_nz == 0x01) {		/* Only the first column - each row is flat */
+		for (i = 0; i < 8; i++) {
+			c = BYTECLIP((src[0] + (128L << 8)) >> 8);
+			memset(dst, c, 8);
+			dst += 8;
+			src += 8;
+		}
+		return;
+	}
+
+	for (i = 0; i < 8; i++) {
+		v0 = src[0] + (128L << 8);	/* Get even elements (remove DC offset (-128) here) */
+		v1 = src[2];
+		v2 = src[4];
+		v3 = src[6];
+
+		t10 = v0 + v2;				/* Process the even elements */
+		t12 = v0 - v2;
+		t11 = (v1 - v3) * M13 >> 12;
+		v3 += v1;
+		t11 -= v3;
+		v0 = t10 + v3;
+		v3 = t10 - v3;
+		v1 = t11 + t12;
+		v2 = t12 - t11;
+
+		v4 = src[7];				/* Get odd elements */
+		v5 = src[1];
+		v6 = src[5];
+		v7 = src[3];
+
+		t10 = v5 - v4;				/* Process the odd elements */
+		t11 = v5 + v4;
+		t12 = v6 - v7;
+		v7 += v6;
+		v5 = (t11 - v7) * M13 >> 12;
+		v7 += t11;
+		t13 = (t10 + t12) * M5 >> 12;
+		v4 = t13 - (t10 * M2 >> 12);
+		v6 = t13 - (t12 * M4 >> 12) - v7;
+		v5 -= v6;
+		v4 -= v5;
+
+		dst[0] = BYTECLIP((v0 + v7) >> 8);	/* Descale the transformed values 8 bits and output */
+		dst[7] = BYTECLIP((v0 - v7) >> 8);
+		dst[1] = BYTECLIP((v1 + v6) >> 8);
+		dst[6] = BYTECLIP((v1 - v6) >> 8);
+		dst[2] = BYTECLIP((v2 + v5) >> 8);
+		dst[5] = BYTECLIP((v2 - v5) >> 8);
+		dst[3] = BYTECLIP((v3 + v4) >> 8);
+		dst[4] = BYTECLIP((v3 - v4) >> 8);
+		dst += 8;
+
+		src += 8;	/* Next row */
+	}
+}
+
+
+
+/* Load all blocks in the MCU into working buffer */
+static
+JRESULT IRAM_ATTR mcu_load_fast (
+	JDEC* jd,	/* Pointer to the decompressor object */
+	JBITS* bs	/* Bit buffer */
+)
+{
+	long *tmp = (long*)jd->workbuf;	/* Block working buffer for de-quantize and IDCT */
+	unsigned int blk, nby, nbc, i, z, id, cmp, cols_nz, cols_ac;
+	int b, d, e, clr, dc_only;
+	unsigned char *bp;
+	const long *dqf;
+
+
+	nby = jd->msx * jd->msy;	/* Number of Y blocks (1, 2 or 4) */
+	nbc = 2;					/* Number of C blocks (2) */
+	bp = jd->mcubuf;			/* Pointer to the first block */
+	dc_only = JD_USE_SCALE && jd->scale == 3;	/* 1/8 scaling only uses the DC elements */
+
+	for (blk = 0; blk < nby + nbc; blk++) {
+		cmp = (blk < nby) ? 0 : blk - nby + 1;	/* Component number 0:Y, 1:Cb, 2:Cr */
+		id = cmp ? 1 : 0;						/* Huffman table ID of the component */
+
+		/* Extract a DC element from input stream */
+		b = huffext_fast(jd, bs, id, 0);		/* Extract a huffman coded data (bit length) */
+		if (b < 0) return 0 - b;				/* Err: invalid code or input */
+		d = jd->dcv[cmp];						/* DC value of previous block */
+		if (b) {								/* If there is any difference from previous block */
+			e = bitext_fast(jd, bs, b);			/* Extract data bits */
+			if (e < 0) return 0 - e;			/* Err: input */
+			b = 1 << (b - 1);					/* MSB position */
+			if (!(e & b)) e -= (b << 1) - 1;	/* Restore sign if needed */
+			d += e;								/* Get current value */
+			jd->dcv[cmp] = (short)d;			/* Save current DC value for next block */
+		}
+		dqf = jd->qttbl[jd->qtid[cmp]];			/* De-quantizer table ID for this component */
+		tmp[0] = d * dqf[0] >> 8;				/* De-quantize, apply scale factor of Arai algorithm and descale 8 bits */
+
+		/* Extract following 63 AC elements from input stream */
+		cols_nz = 0x01;
+		cols_ac = 0;
+		clr = 0;
+		i = 1;					/* Top of the AC elements */
+		do {
+			b = huffext_fast(jd, bs, id, 1);	/* Extract a huffman coded value (zero runs and bit length) */
+			if (b == 0) break;					/* EOB? */
+			if (b < 0) return 0 - b;			/* Err: invalid code or input error */
+			z = (unsigned int)b >> 4;			/* Number of leading zero elements */
+			if (z) {
+				i += z;							/* Skip zero elements */
+				if (i >= 64) return JDR_FMT1;	/* Too long zero run */
+			}
+			if (b &= 0x0F) {					/* Bit length */
+				d = bitext_fast(jd, bs, b);		/* Extract data bits */
+				if (d < 0) return 0 - d;		/* Err: input device */
+				if (dc_only) continue;			/* Skip the AC element */
+				b = 1 << (b - 1);				/* MSB position */
+				if (!(d & b)) d -= (b << 1) - 1;/* Restore negative value if needed */
+				if (!clr) {
+					memset(&tmp[1], 0, 63 * sizeof (long));	/* Clear rest of elements on the first AC element */
+					clr = 1;
+				}
+				z = ZIG(i);						/* Zigzag-order to raster-order converted index */
+				tmp[z] = d * dqf[z] >> 8;		/* De-quantize, apply scale factor of Arai algorithm and descale 8 bits */
+				cols_nz |= 1 << (z & 7);
+				if (z >= 8) cols_ac |= 1 << (z & 7);
+			}
+		} while (++i < 64);		/* Next AC element */
+
+		if (dc_only) {
+			*bp = (*tmp / 256) + 128;	/* If scale ratio is 1/8, IDCT can be ommited and only DC element is used */
+		} else if (!clr) {
+			memset(bp, BYTECLIP((tmp[0] + (128L << 8)) >> 8), 64);	/* Flat block */
+		} else {
+			block_idct_fast(tmp, bp, cols_nz, cols_ac);	/* Apply IDCT and store the block to the MCU buffer */
+		}
+
+		bp += 64;				/* Next block */
+	}
+
+	return JDR_OK;	/* All blocks have been loaded successfully */
+}
+
+
+
+/* Convert a YCbCr pixel to byte-swapped RGB565 */
+static inline
+unsigned short IRAM_ATTR ycc_to_rgb565 (
+	int yy,		/* Y component */
+	int cb,		/* Cb component (-128 to 127) */
+	int cr		/* Cr component (-128 to 127) */
+)
+{
+	const int CVACC = 1024;
+	unsigned short w;
+
+
+	w  = (BYTECLIP(yy + ((int)(1.402 * CVACC) * cr) / CVACC) & 0xF8) << 8;
+	w |= (BYTECLIP(yy - ((int)(0.344 * CVACC) * cb + (int)(0.714 * CVACC) * cr) / CVACC) & 0xFC) << 3;
+	w |= BYTECLIP(yy + ((int)(1.772 * CVACC) * cb) / CVACC) >> 3;
+
+	return __bswap_16(w);
+}
+
+
+
+/* Output an MCU directly into the frame buffer */
+static
+void IRAM_ATTR mcu_output_fast (
+	JDEC* jd,			/* Pointer to the decompressor object */
+	unsigned short* fb,	/* Frame buffer (top-left of the image) */
+	unsigned int fbw,	/* Frame buffer width (pixels) */
+	unsigned int x,		/* MCU position in the image (left of the MCU) */
+	unsigned int y		/* MCU position in the image (top of the MCU) */
+)
+{
+	unsigned int ix, iy, mx, my, rx, ry, s, w, px, py, sx, sy, hs, vs, cw, ch, cs, z, zx, zy;
+	unsigned int ysum, cbsum, crsum;
+	int cb, cr;
+	const unsigned char *ym, *cm, *p;
+	unsigned short *dp, c;
+
+
+	mx = jd->msx * 8; my = jd->msy * 8;					/* MCU size (pixel) */
+	rx = (x + mx <= jd->width) ? mx : jd->width - x;	/* Output rectangular size (it may be clipped at right/bottom end) */
+	ry = (y + my <= jd->height) ? my : jd->height - y;
+	s = jd->scale;
+	rx >>= s; ry >>= s;
+	if (!rx || !ry) return;								/* Skip this MCU if all pixel is to be rounded off */
+	x >>= s; y >>= s;
+
+	ym = jd->mcubuf;									/* Y blocks */
+	cm = jd->mcubuf + 64 * jd->msx * jd->msy;			/* Cb block, Cr block follows */
+	hs = jd->msx - 1;									/* Chroma subsampling shifts */
+	vs = jd->msy - 1;
+
+	if (s == 3) {		/* 1/8 scaling: one pixel per block from its DC value, replicated zoom times */
+		z = jd->zoom;
+		cb = cm[0] - 128;
+		cr = cm[64] - 128;
+		for (iy = 0; iy < ry; iy++) {
+			for (ix = 0; ix < rx; ix++) {
+				c = ycc_to_rgb565(ym[64 * (iy * jd->msx + ix)], cb, cr);
+				dp = fb + (y + iy) * z * fbw + (x + ix) * z;
+				for (zy = 0; zy < z; zy++) {
+					for (zx = 0; zx < z; zx++) dp[zx] = c;
+					dp += fbw;
+				}
+			}
+		}
+		return;
+	}
+
+	if (s == 0) {		/* 1:1 */
+		for (iy = 0; iy < ry; iy++) {
+			dp = fb + (y + iy) * fbw + x;
+			for (ix = 0; ix < rx; ix++) {
+				p = ym + 64 * ((iy >> 3) * jd->msx + (ix >> 3)) + (iy & 7) * 8 + (ix & 7);
+				cb = cm[(iy >> vs) * 8 + (ix >> hs)] - 128;
+				cr = cm[64 + (iy >> vs) * 8 + (ix >> hs)] - 128;
+				*dp++ = ycc_to_rgb565(*p, cb, cr);
+			}
+		}
+		return;
+	}
+
+	/* 1/2 and 1/4 scaling: average each component over the square covered by a pixel */
+	w = 1 << s;
+	cw = (w >> hs) ? (w >> hs) : 1;						/* Chroma samples covered by a pixel */
+	ch = (w >> vs) ? (w >> vs) : 1;
+	cs = (cw == 4 ? 2 : cw >> 1) + (ch == 4 ? 2 : ch >> 1);	/* log2(cw * ch) */
+	for (iy = 0; iy < ry; iy++) {
+		dp = fb + (y + iy) * fbw + x;
+		for (ix = 0; ix < rx; ix++) {
+			px = ix << s;
+			py = iy << s;
+
+			/* The square is always within one Y block */
+			p = ym + 64 * ((py >> 3) * jd->msx + (px >> 3)) + (py & 7) * 8 + (px & 7);
+			ysum = 0;
+			for (sy = 0; sy < w; sy++) {
+				for (sx = 0; sx < w; sx++) ysum += p[sx];
+				p += 8;
+			}
+
+			p = cm + (py >> vs) * 8 + (px >> hs);
+			cbsum = crsum = 0;
+			for (sy = 0; sy < ch; sy++) {
+				for (sx = 0; sx < cw; sx++) {
+					cbsum += p[sx];
+					crsum += p[64 + sx];
+				}
+				p += 8;
+			}
+
+			*dp++ = ycc_to_rgb565(ysum >> (2 * s), (int)(cbsum >> cs) - 128, (int)(crsum >> cs) - 128);
+		}
+	}
+}
+
+
+
+/* Process restart interval */
+static
+JRESULT restart_fast (
+	JDEC* jd,			/* Pointer to the decompressor object */
+	JBITS* bs,			/* Bit buffer */
+	unsigned short rstn	/* Expected restert sequense number */
+)
+{
+	int d;
+
+
+	/* Discard the padding bits and find the marker */
+	bs->buf = 0; bs->cnt = 0;
+	if (!bs->marker) {
+		d = getbyte_fast(jd);
+		if (d < 0) return JDR_INP;
+		if (d != 0xFF) return JDR_FMT1;
+		do {
+			d = getbyte_fast(jd);
+			if (d < 0) return JDR_INP;
+		} while (d == 0xFF);
+		bs->marker = d;
+	}
+
+	/* Check the marker */
+	if ((bs->marker & 0xF8) != 0xD0 || (bs->marker & 7) != (rstn & 7))
+		return JDR_FMT1;	/* Err: expected RSTn marker is not detected (may be collapted data) */
+	bs->marker = 0;
+
+	/* Reset DC offset */
+	jd->dcv[2] = jd->dcv[1] = jd->dcv[0] = 0;
+
+	return JDR_OK;
+}
+
+
+
+/* Decompress the JPEG picture directly into a byte-swapped RGB565 frame buffer */
+JRESULT jd_decomp_fb (
+	JDEC* jd,				/* Initialized decompression object */
+	unsigned short* fb,		/* Frame buffer */
+	unsigned int fbw,		/* Frame buffer width (pixels) */
+	unsigned int xoff,		/* Position of the scaled image in the frame buffer */
+	unsigned int yoff,
+	unsigned char scale,	/* Output de-scaling factor (0 to 3) */
+	unsigned char zoom		/* Pixel replication for 1/8 scaling (1 or 2), must be 1 for other scales */
+)
+{
+	unsigned int x, y, mx, my;
+	unsigned short rst, rsc;
+	JBITS bs;
+	JRESULT rc;
+
+
+	if (scale > 3 || zoom < 1 || zoom > 2 || (zoom != 1 && scale != 3)) return JDR_PAR;
+	jd->scale = scale;
+	jd->zoom = zoom;
+
+	mx = jd->msx * 8; my = jd->msy * 8;			/* Size of the MCU (pixel) */
+	fb += yoff * fbw + xoff;
+
+	jd->dcv[2] = jd->dcv[1] = jd->dcv[0] = 0;	/* Initialize DC values */
+	rst = rsc = 0;
+	bs.buf = 0; bs.cnt = 0; bs.marker = 0;
+
+	for (y = 0; y < jd->height; y += my) {		/* Vertical loop of MCUs */
+		for (x = 0; x < jd->width; x += mx) {	/* Horizontal loop of MCUs */
+			if (jd->nrst && rst++ == jd->nrst) {	/* Process restart interval if enabled */
+				rc = restart_fast(jd, &bs, rsc++);
+				if (rc != JDR_OK) return rc;
+				rst = 1;
+			}
+			rc = mcu_load_fast(jd, &bs);		/* Load an MCU (decompress huffman coded stream and apply IDCT) */
+			if (rc != JDR_OK) return rc;
+			mcu_output_fast(jd, fb, fbw, x, y);	/* Output the MCU (color space conversion and scaling) */
+		}
+	}
+
+	return JDR_OK;
+}
+#endif
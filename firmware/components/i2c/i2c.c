@@ -2,7 +2,15 @@
  * I2C Module
  *
  * Provides I2C Access routines for other modules/tasks.  Provides a locking mechanism
- * since the underlying ESP IDF routines are not thread safe.
+ * since the underlying ESP IDF routines are not thread safe.  Devices may be given
+ * their own clock rate and the bus is switched to it for each transaction.
+ *
+ * The lock is granted by priority.  Tasks waiting for the bus are queued with an
+ * I2C_PRIO_xxx and, when it is released, the oldest waiter of the highest priority gets
+ * it (instead of the waiter with the highest task priority) so a latency-critical
+ * transaction, like reading the RTC time, never waits behind queued bulk traffic.  Bulk
+ * users keep each locked transaction to I2C_MAX_BULK_BYTES so a critical transaction
+ * waits at most one short transfer.
  *
  * Copyright 2020 Dan Julio
  *
@@ -24,15 +32,58 @@
  */
 #include "system_config.h"
 #include "i2c.h"
+#include "pm_utilities.h"
 #include "driver/i2c.h"
+#include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 
 
+//
+// I2C typedefs
+//
+typedef struct {
+	uint8_t addr7;
+	uint32_t freq_hz;
+} i2c_dev_profile_t;
+
+typedef struct {
+	bool in_use;                 // Held by a task until it has taken its grant
+	bool waiting;                // Not granted the bus yet
+	int prio;
+	uint32_t seq;                // Queue order within a priority
+	TaskHandle_t task;
+	SemaphoreHandle_t grant;
+} i2c_waiter_t;
+
+
+
 //
 // I2C variables
 //
-static SemaphoreHandle_t i2c_mutex;
+static const char* TAG = "i2c";
+
+// Bus lock state
+static TaskHandle_t i2c_owner = NULL;
+static i2c_waiter_t i2c_waiters[I2C_MAX_WAITERS];
+static uint32_t i2c_wait_seq = 0;
+static portMUX_TYPE i2c_lock_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static i2c_config_t i2c_conf;
+
+// Devices with their own clock rate (all others use I2C_MASTER_FREQ_HZ)
+static i2c_dev_profile_t i2c_profiles[I2C_MAX_DEV_PROFILES];
+static int i2c_num_profiles = 0;
+
+
+
+//
+// I2C Forward Declarations for internal functions
+//
+static i2c_waiter_t* i2c_next_waiter();
+static i2c_dev_profile_t* i2c_find_profile(uint8_t addr7);
+static void i2c_select_freq(uint32_t freq_hz);
+static esp_err_t i2c_master_run(uint8_t addr7, i2c_cmd_handle_t cmd);
 
 
 
@@ -46,40 +97,151 @@ static SemaphoreHandle_t i2c_mutex;
 esp_err_t i2c_master_init()
 {
     int i2c_master_port = I2C_MASTER_NUM;
-    i2c_config_t conf;
-    
-    i2c_mutex = xSemaphoreCreateMutex();
-    
-    conf.mode = I2C_MODE_MASTER;
-    conf.sda_io_num = I2C_MASTER_SDA_IO;
-    conf.sda_pullup_en = GPIO_PULLUP_ENABLE;
-    conf.scl_io_num = I2C_MASTER_SCL_IO;
-    conf.scl_pullup_en = GPIO_PULLUP_ENABLE;
-    conf.master.clk_speed = I2C_MASTER_FREQ_HZ;
-    
-    i2c_param_config(i2c_master_port, &conf);
-    
-    return i2c_driver_install(i2c_master_port, conf.mode,
+    int i;
+	
+    for (i=0; i<I2C_MAX_WAITERS; i++) {
+        i2c_waiters[i].in_use = false;
+        i2c_waiters[i].grant = xSemaphoreCreateBinary();
+        if (i2c_waiters[i].grant == NULL) {
+            ESP_LOGE(TAG, "Could not create lock semaphores");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+	
+    i2c_conf.mode = I2C_MODE_MASTER;
+    i2c_conf.sda_io_num = I2C_MASTER_SDA_IO;
+    i2c_conf.sda_pullup_en = GPIO_PULLUP_ENABLE;
+    i2c_conf.scl_io_num = I2C_MASTER_SCL_IO;
+    i2c_conf.scl_pullup_en = GPIO_PULLUP_ENABLE;
+    i2c_conf.master.clk_speed = I2C_MASTER_FREQ_HZ;
+	
+    i2c_param_config(i2c_master_port, &i2c_conf);
+	
+    return i2c_driver_install(i2c_master_port, i2c_conf.mode,
                               I2C_MASTER_RX_BUF_LEN,
                               I2C_MASTER_TX_BUF_LEN, 0);
 }
 
 
 /**
- * i2c master lock
+ * i2c master lock at normal priority
  */
 void i2c_lock()
 {
-	xSemaphoreTake(i2c_mutex, portMAX_DELAY);
+	i2c_lock_prio(I2C_PRIO_NORMAL);
 }
 
 
 /**
- * i2c master unlock
+ * i2c master lock at prio (I2C_PRIO_xxx).  The bus is taken immediately if it is free,
+ * otherwise the calling task is queued until i2c_unlock grants it.
+ */
+void i2c_lock_prio(int prio)
+{
+	TaskHandle_t task = xTaskGetCurrentTaskHandle();
+	i2c_waiter_t* wP = NULL;
+	int i;
+	
+	while (wP == NULL) {
+		portENTER_CRITICAL(&i2c_lock_mux);
+		if (i2c_owner == NULL) {
+			i2c_owner = task;
+			portEXIT_CRITICAL(&i2c_lock_mux);
+			return;
+		}
+		for (i=0; i<I2C_MAX_WAITERS; i++) {
+			if (!i2c_waiters[i].in_use) {
+				wP = &i2c_waiters[i];
+				wP->in_use = true;
+				wP->waiting = true;
+				wP->prio = prio;
+				wP->seq = i2c_wait_seq++;
+				wP->task = task;
+				break;
+			}
+		}
+		portEXIT_CRITICAL(&i2c_lock_mux);
+		
+		if (wP == NULL) {
+			// Every queue entry is in use so wait for one
+			vTaskDelay(1);
+		}
+	}
+	
+	// i2c_unlock makes us the owner before granting the bus
+	(void) xSemaphoreTake(wP->grant, portMAX_DELAY);
+	portENTER_CRITICAL(&i2c_lock_mux);
+	wP->in_use = false;
+	portEXIT_CRITICAL(&i2c_lock_mux);
+}
+
+
+/**
+ * i2c master unlock.  The bus goes to the next waiting task, if any.
  */
 void i2c_unlock()
 {
-	xSemaphoreGive(i2c_mutex);
+	i2c_waiter_t* wP;
+	
+	portENTER_CRITICAL(&i2c_lock_mux);
+	wP = i2c_next_waiter();
+	if (wP != NULL) {
+		wP->waiting = false;
+		i2c_owner = wP->task;
+	} else {
+		i2c_owner = NULL;
+	}
+	portEXIT_CRITICAL(&i2c_lock_mux);
+	
+	if (wP != NULL) {
+		xSemaphoreGive(wP->grant);
+	}
+}
+
+
+/**
+ * Return true if task holds the i2c master lock or is waiting for it (deleting it would
+ * leave the bus to a task that no longer exists)
+ */
+bool i2c_locked_by(TaskHandle_t task)
+{
+	bool locked;
+	int i;
+	
+	portENTER_CRITICAL(&i2c_lock_mux);
+	locked = (i2c_owner == task);
+	for (i=0; i<I2C_MAX_WAITERS; i++) {
+		if (i2c_waiters[i].in_use && (i2c_waiters[i].task == task)) {
+			locked = true;
+		}
+	}
+	portEXIT_CRITICAL(&i2c_lock_mux);
+	
+	return locked;
+}
+
+
+/**
+ * Set the clock rate used for transactions with the device at addr7
+ */
+void i2c_set_device_freq(uint8_t addr7, uint32_t freq_hz)
+{
+	i2c_dev_profile_t* profileP;
+	
+	i2c_lock();
+	profileP = i2c_find_profile(addr7);
+	if (profileP == NULL) {
+		if (i2c_num_profiles < I2C_MAX_DEV_PROFILES) {
+			profileP = &i2c_profiles[i2c_num_profiles++];
+			profileP->addr7 = addr7;
+		} else {
+			ESP_LOGE(TAG, "No room for device 0x%02x clock profile", addr7);
+		}
+	}
+	if (profileP != NULL) {
+		profileP->freq_hz = freq_hz;
+	}
+	i2c_unlock();
 }
 
 
@@ -104,7 +266,7 @@ esp_err_t i2c_master_read_slave(uint8_t addr7, uint8_t *data_rd, size_t size)
     }
     i2c_master_read_byte(cmd, data_rd + size - 1, NACK_VAL);
     i2c_master_stop(cmd);
-    esp_err_t ret = i2c_master_cmd_begin(I2C_MODE_MASTER, cmd, 1000 / portTICK_RATE_MS);
+    esp_err_t ret = i2c_master_run(addr7, cmd);
     i2c_cmd_link_delete(cmd);
     return ret;
 }
@@ -125,7 +287,177 @@ esp_err_t i2c_master_write_slave(uint8_t addr7, uint8_t *data_wr, size_t size)
     i2c_master_write_byte(cmd, (addr7 << 1) | I2C_MASTER_WRITE, ACK_CHECK_EN);
     i2c_master_write(cmd, data_wr, size, ACK_CHECK_EN);
     i2c_master_stop(cmd);
-    esp_err_t ret = i2c_master_cmd_begin(I2C_MODE_MASTER, cmd, 1000 / portTICK_RATE_MS);
+    esp_err_t ret = i2c_master_run(addr7, cmd);
+    i2c_cmd_link_delete(cmd);
+    return ret;
+}
+
+
+
+/**
+ * Read several registers from esp-i2c-slave in one transaction.  Each register's
+ * reg_size bytes are loaded into data_rd in order.  For devices without register
+ * address auto-increment.
+ *
+ * ___________________________________________________________________________________________
+ * | start | slave_addr + wr_bit + ack | reg + ack | start | slave_addr + rd_bit + ack |     |
+ * --------|---------------------------|-----------|-------|---------------------------|     |
+ * | read reg_size-1 bytes + ack | read 1 byte + nack | ...repeated for each reg... | stop |
+ * ------------------------------|--------------------|-----------------------------|------|
+ *
+ */
+esp_err_t i2c_master_read_slave_regs(uint8_t addr7, uint8_t *regs, int num_regs, uint8_t *data_rd, size_t reg_size)
+{
+    int i;
+    
+    if ((num_regs == 0) || (reg_size == 0)) {
+        return ESP_OK;
+    }
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    for (i=0; i<num_regs; i++) {
+        i2c_master_start(cmd);
+        i2c_master_write_byte(cmd, (addr7 << 1) | I2C_MASTER_WRITE, ACK_CHECK_EN);
+        i2c_master_write_byte(cmd, regs[i], ACK_CHECK_EN);
+        i2c_master_start(cmd);
+        i2c_master_write_byte(cmd, (addr7 << 1) | I2C_MASTER_READ, ACK_CHECK_EN);
+        if (reg_size > 1) {
+            i2c_master_read(cmd, data_rd, reg_size - 1, ACK_VAL);
+        }
+        i2c_master_read_byte(cmd, data_rd + reg_size - 1, NACK_VAL);
+        data_rd += reg_size;
+    }
+    i2c_master_stop(cmd);
+    esp_err_t ret = i2c_master_run(addr7, cmd);
     i2c_cmd_link_delete(cmd);
     return ret;
 }
+
+
+/**
+ * Write several 8-bit registers of esp-i2c-slave in one transaction.  reg_vals holds
+ * num_regs register address and value pairs.  Each pair is sent as its own write
+ * following a repeated start so the device sees separate register writes without the
+ * bus being released between them.  For devices without register address auto-increment.
+ *
+ * ___________________________________________________________________________________
+ * | start | slave_addr + wr_bit + ack | reg + ack | value + ack | ...repeated for each |
+ * --------|---------------------------|-----------|-------------|----------------------|
+ * | pair after a start... | stop |
+ * ------------------------|------|
+ *
+ */
+esp_err_t i2c_master_write_slave_regs(uint8_t addr7, const uint8_t *reg_vals, int num_regs)
+{
+    int i;
+    
+    if (num_regs == 0) {
+        return ESP_OK;
+    }
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    for (i=0; i<num_regs; i++) {
+        i2c_master_start(cmd);
+        i2c_master_write_byte(cmd, (addr7 << 1) | I2C_MASTER_WRITE, ACK_CHECK_EN);
+        i2c_master_write_byte(cmd, reg_vals[i*2], ACK_CHECK_EN);
+        i2c_master_write_byte(cmd, reg_vals[i*2 + 1], ACK_CHECK_EN);
+    }
+    i2c_master_stop(cmd);
+    esp_err_t ret = i2c_master_run(addr7, cmd);
+    i2c_cmd_link_delete(cmd);
+    return ret;
+}
+
+
+//
+// I2C internal functions
+//
+
+/**
+ * Return the task that should get the bus next: the oldest waiter of the highest
+ * priority.  Returns NULL if no task is waiting.  Called with i2c_lock_mux held.
+ */
+static i2c_waiter_t* i2c_next_waiter()
+{
+	i2c_waiter_t* bestP = NULL;
+	i2c_waiter_t* wP;
+	int i;
+	
+	for (i=0; i<I2C_MAX_WAITERS; i++) {
+		wP = &i2c_waiters[i];
+		if (!wP->in_use || !wP->waiting) continue;
+		
+		if ((bestP == NULL) || (wP->prio > bestP->prio) ||
+		    ((wP->prio == bestP->prio) && ((int32_t) (wP->seq - bestP->seq) < 0)))
+		{
+			bestP = wP;
+		}
+	}
+	
+	return bestP;
+}
+
+
+/**
+ * Return the clock profile for addr7 or NULL if it uses the default rate
+ */
+static i2c_dev_profile_t* i2c_find_profile(uint8_t addr7)
+{
+	int i;
+	
+	for (i=0; i<i2c_num_profiles; i++) {
+		if (i2c_profiles[i].addr7 == addr7) {
+			return &i2c_profiles[i];
+		}
+	}
+	
+	return NULL;
+}
+
+
+/**
+ * Switch the bus clock if it isn't already running at freq_hz
+ */
+static void i2c_select_freq(uint32_t freq_hz)
+{
+	if (i2c_conf.master.clk_speed != freq_hz) {
+		i2c_conf.master.clk_speed = freq_hz;
+		i2c_param_config(I2C_MASTER_NUM, &i2c_conf);
+	}
+}
+
+
+/**
+ * Execute a command list at addr7's clock rate, retrying if it fails.  A device that
+ * keeps failing at a faster clock is dropped back to the default rate for the final
+ * attempt and from then on.
+ */
+static esp_err_t i2c_master_run(uint8_t addr7, i2c_cmd_handle_t cmd)
+{
+	esp_err_t ret;
+	i2c_dev_profile_t* profileP;
+	int i;
+	
+	// The driver waits for the transaction to complete with the CPU idle so stay out of
+	// light sleep, which stops the controller's clock, until it is done
+	pm_set_level(PM_USER_I2C, PM_LEVEL_AWAKE);
+	
+	profileP = i2c_find_profile(addr7);
+	i2c_select_freq((profileP != NULL) ? profileP->freq_hz : I2C_MASTER_FREQ_HZ);
+	
+	for (i=0; i<=I2C_MASTER_RETRIES; i++) {
+		if ((i == I2C_MASTER_RETRIES) && (profileP != NULL) &&
+		    (profileP->freq_hz > I2C_MASTER_FREQ_HZ))
+		{
+			ESP_LOGW(TAG, "Device 0x%02x failing at %u Hz, using %u Hz", addr7,
+			         profileP->freq_hz, I2C_MASTER_FREQ_HZ);
+			profileP->freq_hz = I2C_MASTER_FREQ_HZ;
+			i2c_select_freq(I2C_MASTER_FREQ_HZ);
+		}
+		
+		ret = i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, 1000 / portTICK_RATE_MS);
+		if (ret == ESP_OK) break;
+	}
+	
+	pm_set_level(PM_USER_I2C, PM_LEVEL_SLEEP);
+	
+	return ret;
+}
@@ -2,7 +2,15 @@
  * I2C Module
  *
  * Provides I2C Access routines for other modules/tasks.  Provides a locking mechanism
- * since the underlying ESP IDF routines are not thread safe.
+ * since the underlying ESP IDF routines are not thread safe.  Devices may be given
+ * their own clock rate and the bus is switched to it for each transaction.
+ *
+ * The lock is granted by priority.  Tasks waiting for the bus are queued with an
+ * I2C_PRIO_xxx and, when it is released, the oldest waiter of the highest priority gets
+ * it (instead of the waiter with the highest task priority) so a latency-critical
+ * transaction, like reading the RTC time, never waits behind queued bulk traffic.  Bulk
+ * users keep each locked transaction to I2C_MAX_BULK_BYTES so a critical transaction
+ * waits at most one short transfer.
  *
  * Copyright 2020 Dan Julio
  *
@@ -25,8 +33,11 @@
 #ifndef I2C_H
 #define I2C_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 //
 // I2C constants
@@ -41,15 +52,39 @@
 #define ACK_VAL 0x0
 #define NACK_VAL 0x1 
 
+// Maximum number of devices with their own clock rate
+#define I2C_MAX_DEV_PROFILES 4
+
+// Additional attempts for a failed transaction.  A device that still fails at a
+// faster clock is dropped back to I2C_MASTER_FREQ_HZ.
+#define I2C_MASTER_RETRIES 2
+
+// Bus lock priorities
+#define I2C_PRIO_BULK      0      /* Persistent storage and sensor configuration */
+#define I2C_PRIO_NORMAL    1
+#define I2C_PRIO_CRITICAL  2      /* RTC time reads */
+
+// Maximum tasks waiting for the bus at once (more wait to be queued)
+#define I2C_MAX_WAITERS    8
+
+// Longest transfer made with one lock by a bulk user (about 3 mSec at 100 kHz).  Longer
+// transfers are split.
+#define I2C_MAX_BULK_BYTES 32
+
 
 //
 // I2C API
 //
 esp_err_t i2c_master_init();
 void i2c_lock();
+void i2c_lock_prio(int prio);
 void i2c_unlock();
+bool i2c_locked_by(TaskHandle_t task);
+void i2c_set_device_freq(uint8_t addr7, uint32_t freq_hz);
 esp_err_t i2c_master_read_slave(uint8_t addr7, uint8_t *data_rd, size_t size);
 esp_err_t i2c_master_write_slave(uint8_t addr7, uint8_t *data_wr, size_t size);
+esp_err_t i2c_master_read_slave_regs(uint8_t addr7, uint8_t *regs, int num_regs, uint8_t *data_rd, size_t reg_size);
+esp_err_t i2c_master_write_slave_regs(uint8_t addr7, const uint8_t *reg_vals, int num_regs);
 
 
 #endif /* I2C_H */
\ No newline at end of file
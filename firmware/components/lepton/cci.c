@@ -24,6 +24,8 @@
 #include "cci.h"
 #include "i2c.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "rom/ets_sys.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include <stdbool.h>
@@ -39,6 +41,17 @@ static bool cci_last_status_error;
 
 
 
+//
+// CCI Forward Declarations for internal functions
+//
+static uint32_t cci_read_status(bool log_err);
+static bool cci_run_cmd(uint16_t cmd, uint16_t* data, int len, bool wait_idle, char* name);
+static uint32_t cci_get_u32(uint16_t cmd, char* name);
+static void cci_set_u32(uint16_t cmd, uint32_t value, char* name);
+static void cci_poll_delay(uint32_t usec);
+
+
+
 //
 // CCI API
 //
@@ -49,11 +62,47 @@ static bool cci_last_status_error;
 int cci_init()
 {
 	esp_err_t ret = ESP_OK;
-  
+	
 	return ret;
 }
 
 
+/**
+ * Wait for the Lepton to finish booting after power-on.  Must be called before other
+ * devices on the I2C bus are accessed.  Returns false if it has not booted by
+ * CCI_BOOT_TIMEOUT_MSEC after the ESP32 started.
+ */
+bool cci_wait_boot()
+{
+	while (1) {
+		if (cci_boot_ready()) {
+			ESP_LOGI(TAG, "Lepton booted after %d mSec", (int) (esp_timer_get_time() / 1000));
+			return true;
+		}
+
+		if (esp_timer_get_time() >= (CCI_BOOT_TIMEOUT_MSEC * 1000)) {
+			ESP_LOGE(TAG, "timeout waiting for boot");
+			return false;
+		}
+
+		cci_poll_delay(CCI_POLL_MAX_USEC);
+	}
+}
+
+
+/**
+ * Check once, without waiting, if the Lepton has finished booting (after power-on or a
+ * reboot).  It doesn't respond on the I2C bus for part of its boot.
+ */
+bool cci_boot_ready()
+{
+	uint32_t status;
+	
+	status = cci_read_status(false);
+	return ((status != CCI_STATUS_COMM_ERR) && ((status & 0x04) == 0x04));
+}
+
+
 /**
  * Write a CCI register.
  */
@@ -66,7 +115,7 @@ int cci_write_register(uint16_t reg, uint16_t value)
 		value >> 8 & 0xff,
 		value & 0xff
 	};
-
+	
 	i2c_lock();
 	if (i2c_master_write_slave(CCI_ADDRESS, write_buf, sizeof(write_buf)) != ESP_OK) {
 		i2c_unlock();
@@ -74,7 +123,7 @@ int cci_write_register(uint16_t reg, uint16_t value)
 		return -1;
 	};
 	i2c_unlock();
-
+	
 	return 1;
 }
 
@@ -87,63 +136,133 @@ int cci_write_register(uint16_t reg, uint16_t value)
 uint16_t cci_read_register(uint16_t reg)
 {
 	uint8_t buf[2] = {0, 0};
-
+	
 	// Write the register address
 	buf[0] = reg >> 8;
 	buf[1] = reg & 0xff;
-  
+	
 	i2c_lock();
 	if (i2c_master_write_slave(CCI_ADDRESS, buf, sizeof(buf)) != ESP_OK) {
 		i2c_unlock();
 		ESP_LOGE(TAG, "failed to write CCI register %02x", reg);
 		return -1;
 	}
-
+	
 	// Read
 	if (i2c_master_read_slave(CCI_ADDRESS, buf, sizeof(buf)) != ESP_OK) {
 		ESP_LOGE(TAG, "failed to read from CCI register %02x (read %d)", reg, cci_last_read_count);
 		cci_last_read_count = 0;
 	}
 	i2c_unlock();
-
+	
 	return buf[0] << 8 | buf[1];
 }
 
 
 /**
- * Wait for busy to be clear in the status register
+ * Write len consecutive CCI registers starting at reg in one I2C transaction.  The
+ * Lepton increments the register address after each word so this is used to load the
+ * data registers in one write instead of one per word.
+ */
+int cci_write_registers(uint16_t reg, const uint16_t* data, int len)
+{
+	uint8_t write_buf[2 + CCI_MAX_BLOCK_WORDS*2];
+	int i;
+	
+	if ((len < 1) || (len > CCI_MAX_BLOCK_WORDS)) {
+		return -1;
+	}
+	
+	write_buf[0] = reg >> 8 & 0xff;
+	write_buf[1] = reg & 0xff;
+	for (i=0; i<len; i++) {
+		write_buf[2 + i*2] = data[i] >> 8 & 0xff;
+		write_buf[3 + i*2] = data[i] & 0xff;
+	}
+	
+	i2c_lock();
+	if (i2c_master_write_slave(CCI_ADDRESS, write_buf, 2 + len*2) != ESP_OK) {
+		i2c_unlock();
+		ESP_LOGE(TAG, "failed to write %d CCI registers at %02x", len, reg);
+		return -1;
+	}
+	i2c_unlock();
+	
+	return 1;
+}
+
+
+/**
+ * Read len consecutive CCI registers starting at reg into data with one register
+ * address write and one read.  Returns false if either fails, in which case data is
+ * zeroed.
+ */
+bool cci_read_registers(uint16_t reg, uint16_t* data, int len)
+{
+	uint8_t buf[CCI_MAX_BLOCK_WORDS*2];
+	int i;
+	
+	if ((len < 1) || (len > CCI_MAX_BLOCK_WORDS)) {
+		return false;
+	}
+	
+	// Write the register address
+	buf[0] = reg >> 8;
+	buf[1] = reg & 0xff;
+	
+	i2c_lock();
+	if (i2c_master_write_slave(CCI_ADDRESS, buf, 2) != ESP_OK) {
+		i2c_unlock();
+		ESP_LOGE(TAG, "failed to write CCI register %02x", reg);
+		for (i=0; i<len; i++) data[i] = 0;
+		return false;
+	}
+	
+	// Read all words, each MSB first
+	if (i2c_master_read_slave(CCI_ADDRESS, buf, len*2) != ESP_OK) {
+		i2c_unlock();
+		ESP_LOGE(TAG, "failed to read %d CCI registers at %02x", len, reg);
+		for (i=0; i<len; i++) data[i] = 0;
+		return false;
+	}
+	i2c_unlock();
+	
+	for (i=0; i<len; i++) {
+		data[i] = buf[i*2] << 8 | buf[i*2 + 1];
+	}
+	
+	return true;
+}
+
+
+/**
+ * Wait for busy to be clear in the status register, backing off between polls
  *   Returns the 16-bit STATUS
- *   Returns 0x00010000 if there is a communication failure
+ *   Returns CCI_STATUS_COMM_ERR if there is a communication failure or timeout
  */
 uint32_t cci_wait_busy_clear()
 {
-	bool err = false;
-	uint8_t buf[2] = {0x00, 0x07};
-
+	int64_t start_usec;
+	uint32_t delay_usec = CCI_POLL_MIN_USEC;
+	uint32_t status;
+	
+	start_usec = esp_timer_get_time();
+	
 	// Wait for booted, not busy
-	while (((buf[1] & 0x07) != 0x06) && !err) {
-		// Write STATUS register address
-		buf[0] = 0x00;
-		buf[1] = 0x02;
+	while (1) {
+		status = cci_read_status(true);
+		if ((status == CCI_STATUS_COMM_ERR) || ((status & 0x07) == 0x06)) {
+			return status;
+		}
 		
-		i2c_lock();
-		if (i2c_master_write_slave(CCI_ADDRESS, buf, sizeof(buf)) != ESP_OK) {
-			ESP_LOGE(TAG, "failed to set STATUS register");
-			err = true;
-		};
-
-		// Read register - low bits in buf[1]
-		if (i2c_master_read_slave(CCI_ADDRESS, buf, sizeof(buf)) != ESP_OK) {
-			ESP_LOGE(TAG, "failed to read STATUS register");
-			err = true;
+		if ((esp_timer_get_time() - start_usec) >= (CCI_BUSY_TIMEOUT_MSEC * 1000)) {
+			ESP_LOGE(TAG, "timeout waiting for busy clear");
+			return CCI_STATUS_COMM_ERR;
 		}
-		i2c_unlock();
-	}
-	
-	if (err) {
-		return 0x00010000;
-	} else {
-		return (buf[0] << 8) | buf[1];
+		
+		cci_poll_delay(delay_usec);
+		delay_usec *= 2;
+		if (delay_usec > CCI_POLL_MAX_USEC) delay_usec = CCI_POLL_MAX_USEC;
 	}
 }
 
@@ -160,7 +279,7 @@ void cci_wait_busy_clear_check(char* cmd)
 	cci_last_status_error = false;
 	
 	t32 = cci_wait_busy_clear();
-	if (t32 == 0x00010000) {
+	if (t32 == CCI_STATUS_COMM_ERR) {
 		ESP_LOGE(TAG, "cmd: %s", cmd);
 		cci_last_status_error = true;
 	} else {
@@ -182,6 +301,64 @@ bool cci_command_success()
 }
 
 
+/**
+ * Start a command without waiting for it to complete.  len words from data (if not
+ * NULL) are loaded into the data registers and len is loaded into the data length
+ * register (if not 0).  Returns false if the Lepton is busy or can't be reached.  The
+ * caller polls for completion with cci_cmd_poll.
+ */
+bool cci_cmd_start(uint16_t cmd, const uint16_t* data, int len)
+{
+	uint32_t status;
+	
+	status = cci_read_status(true);
+	if ((status == CCI_STATUS_COMM_ERR) || ((status & 0x07) != 0x06)) {
+		return false;
+	}
+	
+	if ((data != NULL) && (len != 0)) {
+		if (cci_write_registers(CCI_REG_DATA_0, data, len) < 0) return false;
+	}
+	if (len != 0) {
+		if (cci_write_register(CCI_REG_DATA_LENGTH, len) < 0) return false;
+	}
+	
+	return (cci_write_register(CCI_REG_COMMAND, cmd) > 0);
+}
+
+
+/**
+ * Check a command started by cci_cmd_start with one STATUS read.  Returns CCI_CMD_BUSY
+ * while it is running, CCI_CMD_ERROR if it failed or CCI_CMD_DONE when it is complete,
+ * in which case len result words (if data is not NULL) are loaded into data.
+ */
+int cci_cmd_poll(uint16_t* data, int len)
+{
+	int8_t response;
+	uint32_t status;
+	
+	status = cci_read_status(true);
+	if (status == CCI_STATUS_COMM_ERR) {
+		return CCI_CMD_ERROR;
+	}
+	if ((status & 0x07) != 0x06) {
+		return CCI_CMD_BUSY;
+	}
+	
+	response = (int8_t) ((status & 0x0000FF00) >> 8);
+	if (response < 0) {
+		ESP_LOGE(TAG, "command returned %d", response);
+		return CCI_CMD_ERROR;
+	}
+	
+	if ((data != NULL) && (len != 0)) {
+		if (!cci_read_registers(CCI_REG_DATA_0, data, len)) return CCI_CMD_ERROR;
+	}
+	
+	return CCI_CMD_DONE;
+}
+
+
 /**
  * Ping the camera.
  *   Returns 0 for a successful ping
@@ -198,7 +375,7 @@ uint32_t cci_run_ping()
 	res = cci_wait_busy_clear();
 	
 	lep_res = (res & 0x000FF00) >> 8;  // 8-bit Response Error Code: 0=LEP_OK
-	if (res == 0x00010000) {
+	if (res == CCI_STATUS_COMM_ERR) {
 		return 0x100;
 	} else if (lep_res == 0x00) {
 		return 0;
@@ -226,13 +403,7 @@ void cci_run_ffc()
  */
 uint32_t cci_get_uptime()
 {
-	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_LENGTH, 2);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_SYS_GET_UPTIME);
-	cci_wait_busy_clear_check("CCI_CMD_SYS_GET_UPTIME");
-	uint16_t ls_word = cci_read_register(CCI_REG_DATA_0);
-	uint16_t ms_word = cci_read_register(CCI_REG_DATA_1);
-	return ms_word << 16 | ls_word;
+	return cci_get_u32(CCI_CMD_SYS_GET_UPTIME, "CCI_CMD_SYS_GET_UPTIME");
 }
 
 
@@ -241,13 +412,7 @@ uint32_t cci_get_uptime()
  */
 uint32_t cci_get_aux_temp()
 {
-	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_LENGTH, 2);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_SYS_GET_AUX_TEMP);
-	cci_wait_busy_clear_check("CCI_CMD_SYS_GET_AUX_TEMP");
-	uint16_t ls_word = cci_read_register(CCI_REG_DATA_0);
-	uint16_t ms_word = cci_read_register(CCI_REG_DATA_1);
-	return ms_word << 16 | ls_word;
+	return cci_get_u32(CCI_CMD_SYS_GET_AUX_TEMP, "CCI_CMD_SYS_GET_AUX_TEMP");
 }
 
 
@@ -256,13 +421,45 @@ uint32_t cci_get_aux_temp()
  */
 uint32_t cci_get_fpa_temp()
 {
-	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_LENGTH, 2);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_SYS_GET_FPA_TEMP);
-	cci_wait_busy_clear_check("CCI_CMD_SYS_GET_FPA_TEMP");
-	uint16_t ls_word = cci_read_register(CCI_REG_DATA_0);
-	uint16_t ms_word = cci_read_register(CCI_REG_DATA_1);
-	return ms_word << 16 | ls_word;
+	return cci_get_u32(CCI_CMD_SYS_GET_FPA_TEMP, "CCI_CMD_SYS_GET_FPA_TEMP");
+}
+
+
+/**
+ * Get the FFC status (cci_ffc_status_t).
+ */
+int32_t cci_get_ffc_status()
+{
+	return (int32_t) cci_get_u32(CCI_CMD_SYS_GET_FFC_STATUS, "CCI_CMD_SYS_GET_FFC_STATUS");
+}
+
+
+/**
+ * Get the uptime, temperatures and FFC status back-to-back.  The Lepton is only checked
+ * for idle before the first command since each command's completion wait leaves it idle
+ * for the next, and each result is block read.  Returns false if any command failed
+ * (the snapshot holds what was read).
+ */
+bool cci_get_status_snapshot(cci_status_snapshot_t* snapP)
+{
+	uint16_t data[2];
+	bool success;
+	
+	success = cci_run_cmd(CCI_CMD_SYS_GET_UPTIME, data, 2, true, "CCI_CMD_SYS_GET_UPTIME");
+	snapP->uptime_msec = ((uint32_t) data[1] << 16) | data[0];
+	
+	success &= cci_run_cmd(CCI_CMD_SYS_GET_FPA_TEMP, data, 2, !success, "CCI_CMD_SYS_GET_FPA_TEMP");
+	snapP->fpa_temp_k100 = data[0];
+	
+	success &= cci_run_cmd(CCI_CMD_SYS_GET_AUX_TEMP, data, 2, !success, "CCI_CMD_SYS_GET_AUX_TEMP");
+	snapP->aux_temp_k100 = data[0];
+	
+	success &= cci_run_cmd(CCI_CMD_SYS_GET_FFC_STATUS, data, 2, !success, "CCI_CMD_SYS_GET_FFC_STATUS");
+	snapP->ffc_status = (int32_t) (((uint32_t) data[1] << 16) | data[0]);
+	
+	cci_last_status_error = !success;
+	
+	return success;
 }
 
 
@@ -271,13 +468,7 @@ uint32_t cci_get_fpa_temp()
  */
 void cci_set_telemetry_enable_state(cci_telemetry_enable_state_t state)
 {
-	uint32_t value = state;
-	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_0, value & 0xffff);
-	cci_write_register(CCI_REG_DATA_1, value >> 16 & 0xffff);
-	cci_write_register(CCI_REG_DATA_LENGTH, 2);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_SYS_SET_TELEMETRY_ENABLE_STATE);
-	cci_wait_busy_clear_check("CCI_CMD_SYS_SET_TELEMETRY_ENABLE_STATE");
+	cci_set_u32(CCI_CMD_SYS_SET_TELEMETRY_ENABLE_STATE, (uint32_t) state, "CCI_CMD_SYS_SET_TELEMETRY_ENABLE_STATE");
 }
 
 
@@ -286,13 +477,7 @@ void cci_set_telemetry_enable_state(cci_telemetry_enable_state_t state)
  */
 uint32_t cci_get_telemetry_enable_state()
 {
-	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_LENGTH, 2);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_SYS_GET_TELEMETRY_ENABLE_STATE);
-	cci_wait_busy_clear_check("CCI_CMD_SYS_GET_TELEMETRY_ENABLE_STATE");
-	uint16_t ls_word = cci_read_register(CCI_REG_DATA_0);
-	uint16_t ms_word = cci_read_register(CCI_REG_DATA_1);
-	return ms_word << 16 | ls_word;
+	return cci_get_u32(CCI_CMD_SYS_GET_TELEMETRY_ENABLE_STATE, "CCI_CMD_SYS_GET_TELEMETRY_ENABLE_STATE");
 }
 
 
@@ -301,13 +486,7 @@ uint32_t cci_get_telemetry_enable_state()
  */
 void cci_set_telemetry_location(cci_telemetry_location_t location)
 {
-	uint32_t value = location;
-	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_0, value & 0xffff);
-	cci_write_register(CCI_REG_DATA_1, value >> 16 & 0xffff);
-	cci_write_register(CCI_REG_DATA_LENGTH, 2);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_SYS_SET_TELEMETRY_LOCATION);
-	cci_wait_busy_clear_check("CCI_CMD_SYS_SET_TELEMETRY_LOCATION");
+	cci_set_u32(CCI_CMD_SYS_SET_TELEMETRY_LOCATION, (uint32_t) location, "CCI_CMD_SYS_SET_TELEMETRY_LOCATION");
 }
 
 
@@ -316,37 +495,73 @@ void cci_set_telemetry_location(cci_telemetry_location_t location)
  */
 uint32_t cci_get_telemetry_location()
 {
-	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_LENGTH, 2);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_SYS_GET_TELEMETRY_LOCATION);
-	cci_wait_busy_clear_check("CCI_CMD_SYS_GET_TELEMETRY_LOCATION");
-	uint16_t ls_word = cci_read_register(CCI_REG_DATA_0);
-	uint16_t ms_word = cci_read_register(CCI_REG_DATA_1);
-	return ms_word << 16 | ls_word;
+	return cci_get_u32(CCI_CMD_SYS_GET_TELEMETRY_LOCATION, "CCI_CMD_SYS_GET_TELEMETRY_LOCATION");
 }
 
 
 void cci_set_gain_mode(cc_gain_mode_t mode)
 {
-	uint32_t value = mode;
-	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_0, value & 0xffff);
-	cci_write_register(CCI_REG_DATA_1, value >> 16 & 0xffff);
-	cci_write_register(CCI_REG_DATA_LENGTH, 2);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_SYS_SET_GAIN_MODE);
-	cci_wait_busy_clear_check("CCI_CMD_SYS_SET_GAIN_MODE");
+	cci_set_u32(CCI_CMD_SYS_SET_GAIN_MODE, (uint32_t) mode, "CCI_CMD_SYS_SET_GAIN_MODE");
 }
 
 
 uint32_t cci_get_gain_mode()
 {
+	return cci_get_u32(CCI_CMD_SYS_GET_GAIN_MODE, "CCI_CMD_SYS_GET_GAIN_MODE");
+}
+
+
+/**
+ * Set the FFC shutter mode
+ */
+void cci_set_ffc_shutter_mode(cci_ffc_shutter_mode_obj_t* mode)
+{
+	uint16_t data[16] = {
+		mode->shutterMode & 0xffff,
+		mode->shutterMode >> 16 & 0xffff,
+		mode->tempLockoutState & 0xffff,
+		mode->tempLockoutState >> 16 & 0xffff,
+		mode->videoFreezeDuringFFC & 0xffff,
+		mode->videoFreezeDuringFFC >> 16 & 0xffff,
+		mode->ffcDesired & 0xffff,
+		mode->ffcDesired >> 16 & 0xffff,
+		mode->elapsedTimeSinceLastFfc & 0xffff,
+		mode->elapsedTimeSinceLastFfc >> 16 & 0xffff,
+		mode->desiredFfcPeriod & 0xffff,
+		mode->desiredFfcPeriod >> 16 & 0xffff,
+		mode->explicitCmdToOpen & 0xffff,
+		mode->explicitCmdToOpen >> 16 & 0xffff,
+		mode->desiredFfcTempDelta,
+		mode->imminentDelay
+	};
+	
 	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_LENGTH, 2);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_SYS_GET_GAIN_MODE);
-	cci_wait_busy_clear_check("CCI_CMD_SYS_GET_GAIN_MODE");
-	uint16_t ls_word = cci_read_register(CCI_REG_DATA_0);
-	uint16_t ms_word = cci_read_register(CCI_REG_DATA_1);
-	return ms_word << 16 | ls_word;
+	cci_write_registers(CCI_REG_DATA_0, data, 16);
+	cci_write_register(CCI_REG_DATA_LENGTH, 16);
+	cci_write_register(CCI_REG_COMMAND, CCI_CMD_SYS_SET_FFC_SHUTTER_MODE);
+	cci_wait_busy_clear_check("CCI_CMD_SYS_SET_FFC_SHUTTER_MODE");
+}
+
+
+/**
+ * Get the FFC shutter mode
+ */
+bool cci_get_ffc_shutter_mode(cci_ffc_shutter_mode_obj_t* mode)
+{
+	uint16_t data[16];
+	
+	(void) cci_run_cmd(CCI_CMD_SYS_GET_FFC_SHUTTER_MODE, data, 16, true, "CCI_CMD_SYS_GET_FFC_SHUTTER_MODE");
+	mode->shutterMode = ((uint32_t) data[1] << 16) | data[0];
+	mode->tempLockoutState = ((uint32_t) data[3] << 16) | data[2];
+	mode->videoFreezeDuringFFC = ((uint32_t) data[5] << 16) | data[4];
+	mode->ffcDesired = ((uint32_t) data[7] << 16) | data[6];
+	mode->elapsedTimeSinceLastFfc = ((uint32_t) data[9] << 16) | data[8];
+	mode->desiredFfcPeriod = ((uint32_t) data[11] << 16) | data[10];
+	mode->explicitCmdToOpen = ((uint32_t) data[13] << 16) | data[12];
+	mode->desiredFfcTempDelta = data[14];
+	mode->imminentDelay = data[15];
+	
+	return !cci_last_status_error;
 }
 
 
@@ -355,13 +570,7 @@ uint32_t cci_get_gain_mode()
  */
 void cci_set_radiometry_enable_state(cci_radiometry_enable_state_t state)
 {
-	uint32_t value = state;
-	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_0, value & 0xffff);
-	cci_write_register(CCI_REG_DATA_1, value >> 16 & 0xffff);
-	cci_write_register(CCI_REG_DATA_LENGTH, 2);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_RAD_SET_RADIOMETRY_ENABLE_STATE);
-	cci_wait_busy_clear_check("CCI_CMD_RAD_SET_RADIOMETRY_ENABLE_STATE");
+	cci_set_u32(CCI_CMD_RAD_SET_RADIOMETRY_ENABLE_STATE, (uint32_t) state, "CCI_CMD_RAD_SET_RADIOMETRY_ENABLE_STATE");
 }
 
 
@@ -370,13 +579,7 @@ void cci_set_radiometry_enable_state(cci_radiometry_enable_state_t state)
  */
 uint32_t cci_get_radiometry_enable_state()
 {
-	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_LENGTH, 2);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_RAD_GET_RADIOMETRY_ENABLE_STATE);
-	cci_wait_busy_clear_check("CCI_CMD_RAD_GET_RADIOMETRY_ENABLE_STATE");
-	uint16_t ls_word = cci_read_register(CCI_REG_DATA_0);
-	uint16_t ms_word = cci_read_register(CCI_REG_DATA_1);
-	return ms_word << 16 | ls_word;
+	return cci_get_u32(CCI_CMD_RAD_GET_RADIOMETRY_ENABLE_STATE, "CCI_CMD_RAD_GET_RADIOMETRY_ENABLE_STATE");
 }
 
 
@@ -385,15 +588,19 @@ uint32_t cci_get_radiometry_enable_state()
  */
 void cci_set_radiometry_flux_linear_params(cci_rad_flux_linear_params_t* params)
 {
+	uint16_t data[8] = {
+		params->sceneEmissivity,
+		params->TBkgK,
+		params->tauWindow,
+		params->TWindowK,
+		params->tauAtm,
+		params->TAtmK,
+		params->reflWindow,
+		params->TReflK
+	};
+	
 	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_0, params->sceneEmissivity);
-	cci_write_register(CCI_REG_DATA_1, params->TBkgK);
-	cci_write_register(CCI_REG_DATA_2, params->tauWindow);
-	cci_write_register(CCI_REG_DATA_3, params->TWindowK);
-	cci_write_register(CCI_REG_DATA_4, params->tauAtm);
-	cci_write_register(CCI_REG_DATA_5, params->TAtmK);
-	cci_write_register(CCI_REG_DATA_6, params->reflWindow);
-	cci_write_register(CCI_REG_DATA_7, params->TReflK);
+	cci_write_registers(CCI_REG_DATA_0, data, 8);
 	cci_write_register(CCI_REG_DATA_LENGTH, 8);
 	cci_write_register(CCI_REG_COMMAND, CCI_CMD_RAD_SET_RADIOMETRY_FLUX_LINEAR_PARAMS);
 	cci_wait_busy_clear_check("CCI_CMD_RAD_SET_RADIOMETRY_FLUX_LINEAR_PARAMS");
@@ -405,18 +612,17 @@ void cci_set_radiometry_flux_linear_params(cci_rad_flux_linear_params_t* params)
  */
 bool cci_get_radiometry_flux_linear_params(cci_rad_flux_linear_params_t* params)
 {
-	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_LENGTH, 8);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_RAD_GET_RADIOMETRY_FLUX_LINEAR_PARAMS);
-	cci_wait_busy_clear_check("CCI_CMD_RAD_GET_RADIOMETRY_FLUX_LINEAR_PARAMS");
-	params->sceneEmissivity = cci_read_register(CCI_REG_DATA_0);
-	params->TBkgK = cci_read_register(CCI_REG_DATA_1);
-	params->tauWindow = cci_read_register(CCI_REG_DATA_2);
-	params->TWindowK = cci_read_register(CCI_REG_DATA_3);
-	params->tauAtm = cci_read_register(CCI_REG_DATA_4);
-	params->TAtmK = cci_read_register(CCI_REG_DATA_5);
-	params->reflWindow = cci_read_register(CCI_REG_DATA_6);
-	params->TReflK = cci_read_register(CCI_REG_DATA_7);
+	uint16_t data[8];
+	
+	(void) cci_run_cmd(CCI_CMD_RAD_GET_RADIOMETRY_FLUX_LINEAR_PARAMS, data, 8, true, "CCI_CMD_RAD_GET_RADIOMETRY_FLUX_LINEAR_PARAMS");
+	params->sceneEmissivity = data[0];
+	params->TBkgK = data[1];
+	params->tauWindow = data[2];
+	params->TWindowK = data[3];
+	params->tauAtm = data[4];
+	params->TAtmK = data[5];
+	params->reflWindow = data[6];
+	params->TReflK = data[7];
 	
 	return !cci_last_status_error;
 }
@@ -427,13 +633,7 @@ bool cci_get_radiometry_flux_linear_params(cci_rad_flux_linear_params_t* params)
  */
 void cci_set_radiometry_tlinear_enable_state(cci_radiometry_tlinear_enable_state_t state)
 {
-	uint32_t value = state;
-	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_0, value & 0xffff);
-	cci_write_register(CCI_REG_DATA_1, value >> 16 & 0xffff);
-	cci_write_register(CCI_REG_DATA_LENGTH, 2);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_RAD_SET_RADIOMETRY_TLINEAR_ENABLE_STATE);
-	cci_wait_busy_clear_check("CCI_CMD_RAD_SET_RADIOMETRY_TLINEAR_ENABLE_STATE");
+	cci_set_u32(CCI_CMD_RAD_SET_RADIOMETRY_TLINEAR_ENABLE_STATE, (uint32_t) state, "CCI_CMD_RAD_SET_RADIOMETRY_TLINEAR_ENABLE_STATE");
 }
 
 
@@ -442,13 +642,7 @@ void cci_set_radiometry_tlinear_enable_state(cci_radiometry_tlinear_enable_state
  */
 uint32_t cci_get_radiometry_tlinear_enable_state()
 {
-	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_LENGTH, 2);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_RAD_GET_RADIOMETRY_TLINEAR_ENABLE_STATE);
-	cci_wait_busy_clear_check("CCI_CMD_RAD_GET_RADIOMETRY_TLINEAR_ENABLE_STATE");
-	uint16_t ls_word = cci_read_register(CCI_REG_DATA_0);
-	uint16_t ms_word = cci_read_register(CCI_REG_DATA_1);
-	return ms_word << 16 | ls_word;
+	return cci_get_u32(CCI_CMD_RAD_GET_RADIOMETRY_TLINEAR_ENABLE_STATE, "CCI_CMD_RAD_GET_RADIOMETRY_TLINEAR_ENABLE_STATE");
 }
 
 
@@ -457,13 +651,7 @@ uint32_t cci_get_radiometry_tlinear_enable_state()
  */
 void cci_set_radiometry_tlinear_auto_res(cci_radiometry_tlinear_auto_res_state_t state)
 {
-	uint32_t value = state;
-	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_0, value & 0xffff);
-	cci_write_register(CCI_REG_DATA_1, value >> 16 & 0xffff);
-	cci_write_register(CCI_REG_DATA_LENGTH, 2);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_RAD_SET_RADIOMETRY_TLINEAR_AUTO_RES);
-	cci_wait_busy_clear_check("CCI_CMD_RAD_SET_RADIOMETRY_TLINEAR_AUTO_RES");
+	cci_set_u32(CCI_CMD_RAD_SET_RADIOMETRY_TLINEAR_AUTO_RES, (uint32_t) state, "CCI_CMD_RAD_SET_RADIOMETRY_TLINEAR_AUTO_RES");
 }
 
 
@@ -472,13 +660,7 @@ void cci_set_radiometry_tlinear_auto_res(cci_radiometry_tlinear_auto_res_state_t
  */
 uint32_t cci_get_radiometry_tlinear_auto_res()
 {
-	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_LENGTH, 2);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_RAD_GET_RADIOMETRY_TLINEAR_AUTO_RES);
-	cci_wait_busy_clear_check("CCI_CMD_RAD_GET_RADIOMETRY_TLINEAR_AUTO_RES");
-	uint16_t ls_word = cci_read_register(CCI_REG_DATA_0);
-	uint16_t ms_word = cci_read_register(CCI_REG_DATA_1);
-	return ms_word << 16 | ls_word;
+	return cci_get_u32(CCI_CMD_RAD_GET_RADIOMETRY_TLINEAR_AUTO_RES, "CCI_CMD_RAD_GET_RADIOMETRY_TLINEAR_AUTO_RES");
 }
 
 
@@ -487,11 +669,10 @@ uint32_t cci_get_radiometry_tlinear_auto_res()
  */
 void cci_set_radiometry_spotmeter(uint16_t r1, uint16_t c1, uint16_t r2, uint16_t c2)
 {
+	uint16_t data[4] = {r1, c1, r2, c2};
+	
 	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_0, r1);
-	cci_write_register(CCI_REG_DATA_1, c1);
-	cci_write_register(CCI_REG_DATA_2, r2);
-	cci_write_register(CCI_REG_DATA_3, c2);
+	cci_write_registers(CCI_REG_DATA_0, data, 4);
 	cci_write_register(CCI_REG_DATA_LENGTH, 4);
 	cci_write_register(CCI_REG_COMMAND, CCI_CMD_RAD_SET_RADIOMETRY_SPOT_ROI);
 	cci_wait_busy_clear_check("CCI_CMD_RAD_SET_RADIOMETRY_SPOT_ROI");
@@ -503,14 +684,13 @@ void cci_set_radiometry_spotmeter(uint16_t r1, uint16_t c1, uint16_t r2, uint16_
  */
 bool cci_get_radiometry_spotmeter(uint16_t* r1, uint16_t* c1, uint16_t* r2, uint16_t* c2)
 {
-	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_LENGTH, 4);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_RAD_GET_RADIOMETRY_SPOT_ROI);
-	cci_wait_busy_clear_check("CCI_CMD_RAD_GET_RADIOMETRY_SPOT_ROI");
-	*r1 = cci_read_register(CCI_REG_DATA_0);
-	*c1 = cci_read_register(CCI_REG_DATA_1);
-	*r2 = cci_read_register(CCI_REG_DATA_2);
-	*c2 = cci_read_register(CCI_REG_DATA_3);
+	uint16_t data[4];
+	
+	(void) cci_run_cmd(CCI_CMD_RAD_GET_RADIOMETRY_SPOT_ROI, data, 4, true, "CCI_CMD_RAD_GET_RADIOMETRY_SPOT_ROI");
+	*r1 = data[0];
+	*c1 = data[1];
+	*r2 = data[2];
+	*c2 = data[3];
 	
 	return !cci_last_status_error;
 }
@@ -521,13 +701,7 @@ bool cci_get_radiometry_spotmeter(uint16_t* r1, uint16_t* c1, uint16_t* r2, uint
  */
 uint32_t cci_get_agc_enable_state()
 {
-	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_LENGTH, 2);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_AGC_GET_AGC_ENABLE_STATE);
-	cci_wait_busy_clear_check("CCI_CMD_AGC_GET_AGC_ENABLE_STATE");
-	uint16_t ls_word = cci_read_register(CCI_REG_DATA_0);
-	uint16_t ms_word = cci_read_register(CCI_REG_DATA_1);
-	return ms_word << 16 | ls_word;
+	return cci_get_u32(CCI_CMD_AGC_GET_AGC_ENABLE_STATE, "CCI_CMD_AGC_GET_AGC_ENABLE_STATE");
 }
 
 
@@ -536,13 +710,7 @@ uint32_t cci_get_agc_enable_state()
  */
 void cci_set_agc_enable_state(cci_agc_enable_state_t state)
 {
-	uint32_t value = state;
-	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_0, value & 0xffff);
-	cci_write_register(CCI_REG_DATA_1, value >> 16 & 0xffff);
-	cci_write_register(CCI_REG_DATA_LENGTH, 2);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_AGC_SET_AGC_ENABLE_STATE);
-	cci_wait_busy_clear_check("CCI_CMD_AGC_SET_AGC_ENABLE_STATE");
+	cci_set_u32(CCI_CMD_AGC_SET_AGC_ENABLE_STATE, (uint32_t) state, "CCI_CMD_AGC_SET_AGC_ENABLE_STATE");
 }
 
 
@@ -551,13 +719,7 @@ void cci_set_agc_enable_state(cci_agc_enable_state_t state)
  */
 uint32_t cci_get_agc_calc_enable_state()
 {
-	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_LENGTH, 2);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_AGC_GET_CALC_ENABLE_STATE);
-	cci_wait_busy_clear_check("CCI_CMD_AGC_GET_CALC_ENABLE_STATE");
-	uint16_t ls_word = cci_read_register(CCI_REG_DATA_0);
-	uint16_t ms_word = cci_read_register(CCI_REG_DATA_1);
-	return ms_word << 16 | ls_word;
+	return cci_get_u32(CCI_CMD_AGC_GET_CALC_ENABLE_STATE, "CCI_CMD_AGC_GET_CALC_ENABLE_STATE");
 }
 
 
@@ -566,13 +728,7 @@ uint32_t cci_get_agc_calc_enable_state()
  */
 void cci_set_agc_calc_enable_state(cci_agc_enable_state_t state)
 {
-	uint32_t value = state;
-	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_0, value & 0xffff);
-	cci_write_register(CCI_REG_DATA_1, value >> 16 & 0xffff);
-	cci_write_register(CCI_REG_DATA_LENGTH, 2);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_AGC_SET_CALC_ENABLE_STATE);
-	cci_wait_busy_clear_check("CCI_CMD_AGC_SET_CALC_ENABLE_STATE");
+	cci_set_u32(CCI_CMD_AGC_SET_CALC_ENABLE_STATE, (uint32_t) state, "CCI_CMD_AGC_SET_CALC_ENABLE_STATE");
 }
 
 /**
@@ -588,18 +744,42 @@ void cc_run_oem_reboot()
 }
 
 
+/**
+ * Start the Reboot command without waiting for it.  The caller polls cci_boot_ready
+ * for the Lepton to come back.  Returns false if the command couldn't be sent.
+ */
+bool cci_start_oem_reboot()
+{
+	return (cci_write_register(CCI_REG_COMMAND, CCI_CMD_OEM_RUN_REBOOT) > 0);
+}
+
+
+/**
+ * Get the OEM part number into pn (CCI_PART_NUMBER_LEN + 1 characters, NUL terminated)
+ */
+bool cci_get_part_number(char* pn)
+{
+	uint16_t data[CCI_PART_NUMBER_LEN/2];
+	int i;
+	
+	(void) cci_run_cmd(CCI_CMD_OEM_GET_PART_NUMBER, data, CCI_PART_NUMBER_LEN/2, true, "CCI_CMD_OEM_GET_PART_NUMBER");
+	for (i=0; i<CCI_PART_NUMBER_LEN/2; i++) {
+		// Each word holds two characters, first in the low byte
+		pn[2*i] = data[i] & 0xFF;
+		pn[2*i + 1] = data[i] >> 8;
+	}
+	pn[CCI_PART_NUMBER_LEN] = 0;
+	
+	return !cci_last_status_error;
+}
+
+
 /**
  * Get the GPIO mode.
  */
 uint32_t cci_get_gpio_mode()
 {
-	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_LENGTH, 2);
- 	cci_write_register(CCI_REG_COMMAND, CCI_CMD_OEM_GET_GPIO_MODE);
-	cci_wait_busy_clear_check("CCI_CMD_OEM_GET_GPIO_MODE");
-	uint16_t ls_word = cci_read_register(CCI_REG_DATA_0);
-	uint16_t ms_word = cci_read_register(CCI_REG_DATA_1);
-	return ms_word << 16 | ls_word;
+	return cci_get_u32(CCI_CMD_OEM_GET_GPIO_MODE, "CCI_CMD_OEM_GET_GPIO_MODE");
 }
 
 
@@ -608,11 +788,107 @@ uint32_t cci_get_gpio_mode()
  */
 void cci_set_gpio_mode(cci_gpio_mode_t mode)
 {
-	uint32_t value = mode;
+	cci_set_u32(CCI_CMD_OEM_SET_GPIO_MODE, (uint32_t) mode, "CCI_CMD_OEM_SET_GPIO_MODE");
+}
+
+
+
+//
+// CCI internal functions
+//
+
+/**
+ * Read the STATUS register, logging failures if log_err is set
+ *   Returns the 16-bit STATUS
+ *   Returns CCI_STATUS_COMM_ERR if there is a communication failure
+ */
+static uint32_t cci_read_status(bool log_err)
+{
+	bool err = false;
+	uint8_t buf[2] = {0x00, 0x02};
+	
+	i2c_lock();
+	if (i2c_master_write_slave(CCI_ADDRESS, buf, sizeof(buf)) != ESP_OK) {
+		if (log_err) ESP_LOGE(TAG, "failed to set STATUS register");
+		err = true;
+	}
+	
+	// Read register - low bits in buf[1]
+	if (!err && (i2c_master_read_slave(CCI_ADDRESS, buf, sizeof(buf)) != ESP_OK)) {
+		if (log_err) ESP_LOGE(TAG, "failed to read STATUS register");
+		err = true;
+	}
+	i2c_unlock();
+	
+	return err ? CCI_STATUS_COMM_ERR : (uint32_t) ((buf[0] << 8) | buf[1]);
+}
+
+
+/**
+ * Run a command that returns len words and block read them into data.  The Lepton is
+ * checked for idle first if wait_idle is set.  Sets cci_last_status_error and returns
+ * false if the command failed, in which case data is zeroed.
+ */
+static bool cci_run_cmd(uint16_t cmd, uint16_t* data, int len, bool wait_idle, char* name)
+{
+	int i;
+	
+	if (wait_idle) {
+		cci_wait_busy_clear();
+	}
+	cci_write_register(CCI_REG_DATA_LENGTH, len);
+	cci_write_register(CCI_REG_COMMAND, cmd);
+	cci_wait_busy_clear_check(name);
+	if (cci_last_status_error) {
+		for (i=0; i<len; i++) data[i] = 0;
+		return false;
+	}
+	
+	if (!cci_read_registers(CCI_REG_DATA_0, data, len)) {
+		cci_last_status_error = true;
+		return false;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Run a GET command for a 32-bit attribute (LS word first)
+ */
+static uint32_t cci_get_u32(uint16_t cmd, char* name)
+{
+	uint16_t data[2];
+	
+	(void) cci_run_cmd(cmd, data, 2, true, name);
+	return ((uint32_t) data[1] << 16) | data[0];
+}
+
+
+/**
+ * Run a SET command for a 32-bit attribute
+ */
+static void cci_set_u32(uint16_t cmd, uint32_t value, char* name)
+{
+	uint16_t data[2] = {value & 0xffff, value >> 16 & 0xffff};
+	
 	cci_wait_busy_clear();
-	cci_write_register(CCI_REG_DATA_0, value & 0xffff);
-	cci_write_register(CCI_REG_DATA_1, value >> 16 & 0xffff);
+	cci_write_registers(CCI_REG_DATA_0, data, 2);
 	cci_write_register(CCI_REG_DATA_LENGTH, 2);
-	cci_write_register(CCI_REG_COMMAND, CCI_CMD_OEM_SET_GPIO_MODE);
-	cci_wait_busy_clear_check("CCI_CMD_OEM_SET_GPIO_MODE");
+	cci_write_register(CCI_REG_COMMAND, cmd);
+	cci_wait_busy_clear_check(name);
+}
+
+
+/**
+ * Wait between STATUS polls with the bus released.  Sleep if the interval is at least
+ * a tick so other tasks can run.
+ */
+static void cci_poll_delay(uint32_t usec)
+{
+	if (usec < (portTICK_PERIOD_MS * 1000)) {
+		ets_delay_us(usec);
+	} else {
+		vTaskDelay(usec / (portTICK_PERIOD_MS * 1000));
+	}
 }
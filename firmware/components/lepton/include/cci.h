@@ -37,6 +37,9 @@
 #define CCI_WORD_LENGTH 0x02
 #define CCI_ADDRESS 0x2A
 
+// Maximum words in one block register transfer (the data registers)
+#define CCI_MAX_BLOCK_WORDS 16
+
 // CCI register locations
 #define CCI_REG_STATUS 0x0002
 #define CCI_REG_COMMAND 0x0004
@@ -67,7 +70,10 @@
 #define CCI_CMD_SYS_SET_TELEMETRY_ENABLE_STATE 0x0219
 #define CCI_CMD_SYS_GET_TELEMETRY_LOCATION 0x021C
 #define CCI_CMD_SYS_SET_TELEMETRY_LOCATION 0x021D
+#define CCI_CMD_SYS_GET_FFC_SHUTTER_MODE 0x023C
+#define CCI_CMD_SYS_SET_FFC_SHUTTER_MODE 0x023D
 #define CCI_CMD_SYS_RUN_FFC 0x0242
+#define CCI_CMD_SYS_GET_FFC_STATUS 0x0244
 #define CCI_CMD_SYS_GET_GAIN_MODE 0x0248
 #define CCI_CMD_SYS_SET_GAIN_MODE 0x0249
 
@@ -87,12 +93,37 @@
 #define CCI_CMD_AGC_GET_CALC_ENABLE_STATE 0x0148
 #define CCI_CMD_AGC_SET_CALC_ENABLE_STATE 0x0149
 
+#define CCI_CMD_OEM_GET_PART_NUMBER 0x481C
 #define CCI_CMD_OEM_RUN_REBOOT 0x4842
 
 #define CCI_CMD_OEM_GET_GPIO_MODE 0x4854
 #define CCI_CMD_OEM_SET_GPIO_MODE 0x4855
 
 
+// STATUS polling.  The bus is released between polls and the interval doubles from
+// CCI_POLL_MIN_USEC up to CCI_POLL_MAX_USEC so a long command (e.g. a FFC) doesn't
+// keep other devices off the I2C bus.  Intervals shorter than a tick are spun, longer
+// ones sleep.  A command that is still busy after CCI_BUSY_TIMEOUT_MSEC has failed.
+#define CCI_POLL_MIN_USEC       100
+#define CCI_POLL_MAX_USEC       20000
+#define CCI_BUSY_TIMEOUT_MSEC   5000
+
+// Maximum time from power-on for the Lepton to report it has booted.  It doesn't
+// respond on the I2C bus for part of its boot so failed STATUS reads are retried.
+#define CCI_BOOT_TIMEOUT_MSEC   2000
+
+// Length of the OEM part number (characters, not NUL terminated by the Lepton)
+#define CCI_PART_NUMBER_LEN     32
+
+// cci_wait_busy_clear communication failure result
+#define CCI_STATUS_COMM_ERR     0x00010000
+
+// cci_cmd_poll results
+#define CCI_CMD_BUSY            0
+#define CCI_CMD_DONE            1
+#define CCI_CMD_ERROR           -1
+
+
 //
 // Macros
 //
@@ -121,6 +152,13 @@ typedef enum {
 	LEP_SYS_GAIN_MODE_AUTO
 	} cc_gain_mode_t;
 
+// FFC Shutter Modes for use with CCI_CMD_SYS_SET_FFC_SHUTTER_MODE
+typedef enum {
+	LEP_SYS_FFC_SHUTTER_MODE_MANUAL,
+	LEP_SYS_FFC_SHUTTER_MODE_AUTO,
+	LEP_SYS_FFC_SHUTTER_MODE_EXTERNAL
+} cci_ffc_shutter_mode_t;
+
 // Radiometry Modes for use with CCI_CMD_RAD_SET_RADIOMETRY*
 typedef enum {
 	CCI_RADIOMETRY_DISABLED,
@@ -165,6 +203,36 @@ typedef struct {
 	uint16_t TReflK;
 } cci_rad_flux_linear_params_t;
 
+// FFC Shutter Mode object (16 words)
+typedef struct {
+	uint32_t shutterMode;               // cci_ffc_shutter_mode_t
+	uint32_t tempLockoutState;
+	uint32_t videoFreezeDuringFFC;
+	uint32_t ffcDesired;
+	uint32_t elapsedTimeSinceLastFfc;   // mSec
+	uint32_t desiredFfcPeriod;          // mSec
+	uint32_t explicitCmdToOpen;
+	uint16_t desiredFfcTempDelta;       // K * 100
+	uint16_t imminentDelay;             // Frames
+} cci_ffc_shutter_mode_obj_t;
+
+// FFC Status
+typedef enum {
+	LEP_SYS_FFC_STATUS_WRITE_ERROR = -2,
+	LEP_SYS_FFC_STATUS_ERROR = -1,
+	LEP_SYS_FFC_STATUS_READY = 0,
+	LEP_SYS_FFC_STATUS_BUSY = 1,
+	LEP_SYS_FFC_STATUS_FRAME_AVERAGING = 2
+} cci_ffc_status_t;
+
+// Sensor status read by cci_get_status_snapshot
+typedef struct {
+	uint32_t uptime_msec;
+	uint16_t fpa_temp_k100;
+	uint16_t aux_temp_k100;
+	int32_t ffc_status;                 // cci_ffc_status_t
+} cci_status_snapshot_t;
+
 
 
 //
@@ -173,26 +241,38 @@ typedef struct {
 
 // Setup
 int cci_init();
+bool cci_wait_boot();
+bool cci_boot_ready();
 
 // Primative methods
 int cci_write_register(uint16_t reg, uint16_t value);
 uint16_t cci_read_register(uint16_t reg);
+int cci_write_registers(uint16_t reg, const uint16_t* data, int len);
+bool cci_read_registers(uint16_t reg, uint16_t* data, int len);
 uint32_t cci_wait_busy_clear();
 void cci_wait_busy_clear_check(char* cmd);
 bool cci_command_success();
 
+// Non-blocking commands
+bool cci_cmd_start(uint16_t cmd, const uint16_t* data, int len);
+int cci_cmd_poll(uint16_t* data, int len);
+
 // Module: SYS
 uint32_t cci_run_ping();
 void cci_run_ffc();
 uint32_t cci_get_uptime();
 uint32_t cci_get_aux_temp();
 uint32_t cci_get_fpa_temp();
+int32_t cci_get_ffc_status();
+bool cci_get_status_snapshot(cci_status_snapshot_t* snapP);
 void cci_set_telemetry_enable_state(cci_telemetry_enable_state_t state);
 uint32_t cci_get_telemetry_enable_state();
 void cci_set_telemetry_location(cci_telemetry_location_t location);
 uint32_t cci_get_telemetry_location();
 void cci_set_gain_mode(cc_gain_mode_t mode);
 uint32_t cci_get_gain_mode();
+void cci_set_ffc_shutter_mode(cci_ffc_shutter_mode_obj_t* mode);
+bool cci_get_ffc_shutter_mode(cci_ffc_shutter_mode_obj_t* mode);
 
 // Module: RAD
 void cci_set_radiometry_enable_state(cci_radiometry_enable_state_t state);
@@ -214,6 +294,8 @@ uint32_t cci_get_agc_calc_enable_state();
 
 // Module: OEM
 void cc_run_oem_reboot();
+bool cci_start_oem_reboot();
+bool cci_get_part_number(char* pn);
 uint32_t cci_get_gpio_mode();
 void cci_set_gpio_mode(cci_gpio_mode_t mode);
 
@@ -0,0 +1,72 @@
+/*
+ * Lepton radiometric alarm
+ *
+ * Evaluates the alarm configured in the GUI state against each set of radiometric
+ * statistics and tracks alarm events.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LEPTON_ALARM_H
+#define LEPTON_ALARM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "lepton_stats.h"
+#include "sys_utilities.h"
+
+
+//
+// Lepton Alarm constants
+//
+
+// lepton_alarm_eval results
+#define LEP_ALARM_NO_CHANGE 0
+#define LEP_ALARM_TRIGGER   1
+#define LEP_ALARM_CLEAR     2
+
+// Alarm event causes
+#define LEP_ALARM_CAUSE_THRESH 0
+#define LEP_ALARM_CAUSE_RATE   1
+
+
+
+//
+// Lepton Alarm typedefs
+//
+typedef struct {
+	bool active;                // Set while an event is in progress
+	uint8_t cause;              // LEP_ALARM_CAUSE_xxx of the most recent event
+	uint8_t roi;                // Statistics entry (0 for the frame)
+	uint8_t stat;               // SYS_ALARM_STAT_xxx
+	uint32_t value;             // Statistic value (K * 100) when the event started
+	int32_t rate;               // Statistic change (K * 100 / sec) when the event started
+	int64_t start_usec;         // Frame timestamp when the event started
+	uint32_t count;             // Events since startup
+} lep_alarm_event_t;
+
+
+
+//
+// Lepton Alarm API
+//
+int lepton_alarm_eval(const lep_stats_t* statsP, const gui_state_t* stP);
+void lepton_alarm_get_event(lep_alarm_event_t* eventP);
+const char* lepton_alarm_stat_name(uint8_t stat);
+
+#endif /* LEPTON_ALARM_H */
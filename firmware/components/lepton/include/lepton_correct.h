@@ -0,0 +1,90 @@
+/*
+ * Lepton pixel correction
+ *
+ * Replaces a Lepton module's bad (dead or stuck) pixels with the mean of their good
+ * neighbors and removes its column offsets using a calibration kept in NVS.  The
+ * calibration averages LEP_CORR_CAL_FRAMES frames of a uniform scene taken after a
+ * FFC.  Only the listed pixels and offset columns are touched in each frame.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LEPTON_CORRECT_H
+#define LEPTON_CORRECT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sys_utilities.h"
+#include "vospi.h"
+
+
+//
+// Lepton Correct constants
+//
+
+// Maximum bad pixels.  A calibration finding more fails (the scene wasn't uniform).
+#define LEP_CORR_MAX_BAD        64
+
+// Frames averaged by a calibration
+#define LEP_CORR_CAL_FRAMES     32
+
+// A pixel is bad when it differs from the median of its neighbors by more than
+// LEP_CORR_BAD_K100 (K * 100) in the averaged frame
+#define LEP_CORR_BAD_K100       200
+
+// A column's offset is its mean less the median of the means of the columns around
+// it (LEP_CORR_COL_SPAN on each side) so scene gradients aren't mistaken for offsets.
+// Offsets smaller than LEP_CORR_COL_MIN_K100 are noise and aren't corrected.  A
+// calibration finding one larger than LEP_CORR_COL_MAX_K100 fails.
+#define LEP_CORR_COL_SPAN       2
+#define LEP_CORR_COL_MIN_K100   3
+#define LEP_CORR_COL_MAX_K100   100
+
+// Correction states
+#define LEP_CORR_STATE_OFF      0      /* No calibration */
+#define LEP_CORR_STATE_ON       1
+#define LEP_CORR_STATE_CAL      2      /* Calibrating (frames aren't corrected) */
+
+
+
+//
+// Lepton Correct typedefs
+//
+typedef struct {
+	int state;                   // LEP_CORR_STATE_xxx
+	int bad_pixels;              // Bad pixels being replaced
+	int columns;                 // Columns being offset
+	bool cal_failed;             // The last calibration failed (the previous one is kept)
+} lep_corr_status_t;
+
+
+
+//
+// Lepton Correct API
+//
+void lepton_correct_init();
+void lepton_correct_frame(lep_buffer_t* lepP);
+bool lepton_correct_cal_start();
+void lepton_correct_cal_restart();
+bool lepton_correct_cal_add(const lep_buffer_t* lepP);
+bool lepton_correct_cal_finish(int tlin_scale);
+void lepton_correct_cal_abort();
+bool lepton_correct_clear();
+void lepton_correct_get_status(lep_corr_status_t* statusP);
+
+#endif /* LEPTON_CORRECT_H */
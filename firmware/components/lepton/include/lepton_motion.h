@@ -0,0 +1,59 @@
+/*
+ * Lepton scene change detector
+ *
+ * Compares a block-averaged copy of each Lepton frame against the previous one to
+ * detect when something in the scene has changed.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LEPTON_MOTION_H
+#define LEPTON_MOTION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sys_utilities.h"
+#include "vospi.h"
+
+
+//
+// Lepton Motion constants
+//
+
+// Frames are averaged in LEP_MOTION_BLOCK x LEP_MOTION_BLOCK pixel blocks
+#define LEP_MOTION_BLOCK        8
+#define LEP_MOTION_BLOCKS_X     (LEP_WIDTH / LEP_MOTION_BLOCK)
+#define LEP_MOTION_BLOCKS_Y     (LEP_HEIGHT / LEP_MOTION_BLOCK)
+#define LEP_MOTION_NUM_BLOCKS   (LEP_MOTION_BLOCKS_X * LEP_MOTION_BLOCKS_Y)
+
+// A block has changed when its mean moved more than LEP_MOTION_THRESH (K * 100) relative
+// to the mean change of the whole frame (so a flat-field correction or a slow ambient
+// drift isn't a change).  The scene has changed when at least LEP_MOTION_MIN_BLOCKS
+// blocks have changed.
+#define LEP_MOTION_THRESH       50
+#define LEP_MOTION_MIN_BLOCKS   2
+
+
+
+//
+// Lepton Motion API
+//
+bool lepton_motion_detect(lep_buffer_t* lepP);
+void lepton_motion_reset();
+
+#endif /* LEPTON_MOTION_H */
@@ -0,0 +1,95 @@
+/*
+ * Lepton radiometric statistics
+ *
+ * Computes temperature statistics for the full Lepton frame, up to
+ * SYS_LEP_STATS_MAX_ROI rectangular regions of interest and the GUI's touch meter in
+ * one pass over the frame.  Each region's statistics may be corrected for its
+ * emissivity and reflected temperature.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LEPTON_STATS_H
+#define LEPTON_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sys_utilities.h"
+
+
+//
+// Lepton Stats constants
+//
+
+// Statistics are kept for the full frame followed by each region and then the meter.
+// The meter is only displayed so it isn't counted as a statistics region.
+#define LEP_STATS_FRAME    0
+#define LEP_STATS_NUM      (SYS_LEP_STATS_MAX_ROI + 1)
+#define LEP_STATS_METER    LEP_STATS_NUM
+#define LEP_STATS_ALL_NUM  (LEP_STATS_NUM + 1)
+
+// Reported percentiles
+#define LEP_STATS_PCT_LOW  10
+#define LEP_STATS_PCT_MID  50
+#define LEP_STATS_PCT_HIGH 90
+
+// Percentiles are found from a histogram spanning the frame's minimum to maximum value.
+// They are exact when the span is less than the number of bins.
+#define LEP_STATS_HIST_BINS 256
+
+// Region emissivity corrections are looked up in a table of corrected values at
+// 2^LEP_STATS_CORR_SHIFT K * 100 steps (2.56 K) and linearly interpolated.  The table
+// spans 0 - 1310 K and is extrapolated above that.  Interpolation adds less than 0.1 K
+// error above the reflected temperature for emissivities of 30% or more (the correction
+// itself grows steep as the emissivity falls).
+#define LEP_STATS_CORR_SHIFT   8
+#define LEP_STATS_CORR_ENTRIES 512
+
+
+
+//
+// Lepton Stats typedefs
+//
+typedef struct {
+	bool valid;                 // Set for the frame and enabled regions
+	sys_lep_roi_t roi;          // Region in Lepton pixels
+	uint32_t min;               // Values are in K * 100
+	uint32_t max;
+	uint32_t mean;
+	uint32_t stddev;
+	uint32_t p_low;             // LEP_STATS_PCT_xxx percentiles
+	uint32_t p_mid;
+	uint32_t p_high;
+} lep_roi_stats_t;
+
+typedef struct {
+	int64_t timestamp_usec;     // Timestamp of the frame the statistics are from (0 if none)
+	lep_roi_stats_t stats[LEP_STATS_ALL_NUM];
+} lep_stats_t;
+
+
+
+//
+// Lepton Stats API
+//
+void lepton_stats_compute(lep_buffer_t* lepP, const sys_lep_roi_t* roiP, const uint8_t* emissivityP, const uint16_t* reflP);
+bool lepton_stats_get_latest(lep_stats_t* statsP);
+bool lepton_stats_get_frame(lep_buffer_t* lepP, lep_stats_t* statsP);
+void lepton_stats_set_meter(const sys_lep_roi_t* roiP);
+
+#endif /* LEPTON_STATS_H */
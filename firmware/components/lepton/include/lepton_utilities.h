@@ -26,6 +26,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include "sys_utilities.h"
 
 //
 // Lepton Utilities Constants
@@ -128,19 +129,113 @@
 #define LEP_FFC_STATE_CMPL     0x00000030
 
 
+//
+// Radiometry
+//
+// TLinear pixel values are in K * 100 or, when the resolution telemetry word is 0,
+// K * 10.  Telemetry temperatures are always in K * 100.  Temperatures are converted
+// with integer math in K * 100 and C * 100 units.
+#define LEP_K100_0C            27315
+#define LEP_TLIN_SCALE_HIGH    1       // K * 100 per pixel count at 0.01 K resolution
+#define LEP_TLIN_SCALE_LOW     10      // K * 100 per pixel count at 0.1 K resolution
+
+// Radiometric crop.  Recorded and streamed radiometric data may be limited to a region
+// of the frame (gui_st.lep_crop) to save space.  It is sent as the region's rows, and the
+// region is in the image metadata, while the display, statistics and previews use the
+// whole frame.  Cropped data read back is expanded to a full frame.
+#define LEP_CROP_PIXEL_LEN(c)  ((uint32_t) (c)->w * (c)->h * 2)
+
+
+//
+// Module detection
+//
+// OEM part number prefix of the Lepton 2.5 (80x60).  It is the only Lepton 2.x module
+// supported since FireCAM needs radiometry.  Other modules are treated as a Lepton 3.x.
+#define LEP_PN_LEPTON_2_5      "500-0763"
+
+
+//
+// Configuration check
+//
+// lepton_check_service results
+#define LEP_CHECK_BUSY         0
+#define LEP_CHECK_OK           1
+#define LEP_CHECK_FAIL         -1
+
+// Check step phases
+#define LEP_CHECK_PHASE_GET    0
+#define LEP_CHECK_PHASE_SET    1
+#define LEP_CHECK_PHASE_VERIFY 2
+
+#define LEP_CHECK_NUM_STEPS    8
+
+
+//
+// Stream recovery
+//
+// lep_task calls lepton_recover_stall each time it loses the VoSPI stream.  The first
+// LEP_RECOVER_RESYNCS stalls in a row resynchronize VoSPI.  The following ones reboot the
+// lepton through the CCI or, after LEP_RECOVER_REBOOTS reboots on boards with
+// LEP_RESET_IO, pulse its reset line.  The escalation restarts when a frame arrives.
+#define LEP_RECOVER_RESYNCS    2
+#define LEP_RECOVER_REBOOTS    2
+
+// Wait after a reboot or reset before polling the lepton's boot status (it may still
+// report the old state), the poll period and the maximum wait for it to boot
+#define LEP_RECOVER_HOLD_MSEC  300
+#define LEP_RECOVER_POLL_MSEC  50
+#define LEP_RECOVER_BOOT_MSEC  6000
+
+// Reset pulse (RESET_L low) width
+#define LEP_RECOVER_RESET_USEC 1000
+
+// Recovery stages
+#define LEP_RECOVER_IDLE       0
+#define LEP_RECOVER_RESYNC     1
+#define LEP_RECOVER_REBOOT     2
+#define LEP_RECOVER_RESET      3
+
+
+//
+// Lepton Utilities typedefs
+//
+typedef struct {
+	uint16_t get_cmd;           // CCI command to read the setting (or the ping)
+	uint16_t set_cmd;           // CCI command to restore the setting
+	uint32_t value;             // Expected value
+	bool gain_mode;             // Expected value is the gain mode last set
+	const char* name;
+} lep_check_step_t;
+
+
 //
 // Lepton Utilities API
 //
 bool lepton_init();
-bool lepton_check_reset_state();
+void lepton_check_start();
+bool lepton_check_running();
+int lepton_check_service();
+int lepton_recover_stall();
+bool lepton_recover_booting();
+bool lepton_recover_service();
+void lepton_recover_done();
 void lepton_agc(bool en);
 void lepton_ffc();
-void lepton_gain_mode(uint8_t mode);
+bool lepton_ffc_manual(bool en);
+bool lepton_ffc_due(const lep_telem_t* telP);
+bool lepton_gain_mode(int mode);
+bool lepton_gain_in_use(const lep_telem_t* telP, int mode);
 void lepton_spotmeter(uint16_t r1, uint16_t c1, uint16_t r2, uint16_t c2);
 void lepton_emissivity(uint16_t e);
 
-uint32_t lepton_get_tel_status(uint16_t* tel_buf);
-
-float lepton_kelvin_to_C(uint16_t k, float lep_res);
+void lepton_decode_telem(const uint16_t* tel_buf, lep_telem_t* telP);
+int lepton_get_tlin_scale(const lep_buffer_t* lepP);
+int32_t lepton_k100_to_c100(uint32_t k100);
+void lepton_pixels_to_k100(const uint16_t* src, uint32_t* dst, int n, int scale);
+void lepton_pixels_to_c100(const uint16_t* src, int32_t* dst, int n, int scale);
+bool lepton_get_crop(sys_lep_roi_t* cropP);
+bool lepton_crop_is_full(const sys_lep_roi_t* cropP);
+void lepton_crop_copy(const uint16_t* src, const sys_lep_roi_t* cropP, uint16_t* dst);
+void lepton_crop_expand(uint16_t* buf, const sys_lep_roi_t* cropP);
 
 #endif /* LEPTON_UTILITIES_H */
\ No newline at end of file
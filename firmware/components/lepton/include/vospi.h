@@ -43,11 +43,27 @@
 // than LEP_FRAME_USEC -  maximum ISR latency)
 #define LEP_MAX_FRAME_XFER_WAIT_USEC 9250
 
+// LEP_MAX_DISCARD_BURSTS is the number of bursts containing only discard packets
+// after vsync before vospi_transfer_segment() gives up on the segment
+#define LEP_MAX_DISCARD_BURSTS 4
+
+// LEP_RESYNC_MSEC is the time CS is held de-asserted to force the lepton to
+// resynchronize its VoSPI output (must be > 185 mSec)
+#define LEP_RESYNC_MSEC 200
+
 #define LEP_WIDTH      160
 #define LEP_HEIGHT     120
 #define LEP_NUM_PIXELS (LEP_WIDTH * LEP_HEIGHT)
 #define LEP_PKT_LENGTH 164
 
+// Packet CRC: CRC16-CCITT (x^16 + x^12 + x^5 + 1, initial value 0) over the whole packet
+// with the ID field's 4 high bits and the CRC field zeroed
+#define LEP_CRC_POLY   0x1021
+
+// Number of packets read in each SPI (DMA) transaction
+#define LEP_PKTS_PER_BURST 8
+#define LEP_BURST_LENGTH   (LEP_PKTS_PER_BURST * LEP_PKT_LENGTH)
+
 // Telemetry related
 #define LEP_TEL_PACKETS 3
 #define LEP_TEL_PKT_LEN (LEP_PKT_LENGTH - 4)
@@ -59,11 +75,54 @@
 #define LEP_TEL_WORDS_PER_SEG    (LEP_TEL_PKTS_PER_SEG * LEP_WIDTH / 2)
 #define LEP_NOTEL_WORDS_PER_SEG  (LEP_NOTEL_PKTS_PER_SEG * LEP_WIDTH / 2)
 
+// Lepton 2.x modules send one unsegmented 80x60 frame (63 lines with telemetry at the
+// end) per vsync.  Each line is doubled in both directions into the 160x120 frame so
+// the rest of the system sees the same frame format.  The per-segment statistics are
+// kept for each quarter of the lines.
+#define LEP2_WIDTH               80
+#define LEP2_HEIGHT              60
+#define LEP2_TEL_PKTS_PER_FRAME  63
+#define LEP2_LINES_PER_STAT_SEG  (LEP2_HEIGHT / 4)
+
+// Maximum time to wait for a Lepton 2.x frame after vsync (frames are 37 mSec apart)
+#define LEP2_MAX_FRAME_XFER_WAIT_USEC 30000
+
 /* Lepton frame error return */
 enum LeptonReadError {
-  NONE, DISCARD, SEGMENT_ERROR, ROW_ERROR, SEGMENT_INVALID
+  NONE, DISCARD, SEGMENT_ERROR, ROW_ERROR, SEGMENT_INVALID, CRC_ERROR
 };
 
+/* Read error and frame accounting */
+typedef struct {
+	uint32_t frames;
+	uint32_t discards;
+	uint32_t segment_errors;
+	uint32_t row_errors;
+	uint32_t segment_invalids;
+	uint32_t crc_errors;
+	uint32_t resyncs;
+} vospi_stats_t;
+
+#ifdef INCLUDE_VOSPI_CAPTURE
+// Raw packet capture.  Every burst read from the Lepton is copied, with the time of
+// the vsync that started the segment and the time the burst transfer completed, into
+// a ring in PSRAM for file_task to write to the root directory of the Micro-SD Card.
+// Bursts arriving while the ring is full are dropped (seen as gaps in seq).
+#define VOSPI_CAP_MAGIC        0x50564346   /* "FCVP" */
+#define VOSPI_CAP_RING_LEN     1024
+#define VOSPI_CAP_FILE_NAME    "vospi.bin"
+#define VOSPI_CAP_MAX_FILE_LEN (256 * 1024 * 1024)
+
+/* Capture file record (little-endian) */
+typedef struct {
+	uint32_t magic;
+	uint32_t seq;               // Burst sequence number
+	uint32_t vsync_usec;        // esp_timer time (low 32 bits) vsync was detected
+	uint32_t burst_usec;        // esp_timer time (low 32 bits) the burst was received
+	uint8_t pkt[LEP_PKTS_PER_BURST][LEP_PKT_LENGTH];
+} vospi_cap_record_t;
+#endif
+
 
 
 //
@@ -71,7 +130,21 @@ enum LeptonReadError {
 //
 int vospi_init();
 bool vospi_transfer_segment(uint64_t vsyncDetectedUsec);
-void vospi_get_frame(lep_buffer_t* sys_bufP);
+void vospi_set_frame(lep_buffer_t* bufP);
+lep_buffer_t* vospi_get_frame(lep_buffer_t* bufP);
+void vospi_get_telem(uint16_t* telemP);
+void vospi_resync();
+void vospi_get_stats(vospi_stats_t* stats);
+void vospi_reset_stats();
 void vospi_include_telem(bool en);
+void vospi_include_image(bool en);
+void vospi_include_histogram(bool en);
+void vospi_set_lepton2(bool en);
+bool vospi_is_lepton2();
+#ifdef INCLUDE_VOSPI_CAPTURE
+int vospi_capture_peek(vospi_cap_record_t** recP);
+void vospi_capture_consume(int n);
+uint32_t vospi_capture_get_overruns();
+#endif
 
 #endif /* VOSPI_H */
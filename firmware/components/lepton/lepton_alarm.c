@@ -0,0 +1,208 @@
+/*
+ * Lepton radiometric alarm
+ *
+ * Evaluates the alarm configured in the GUI state against each set of radiometric
+ * statistics and tracks alarm events.  A threshold alarm checks the selected statistic
+ * against the threshold.  A rate alarm checks how fast the statistic changed since the
+ * previous evaluation: rising for ABOVE, falling for BELOW and either way for RATE.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "lepton_alarm.h"
+#include "freertos/FreeRTOS.h"
+
+
+
+//
+// Lepton Alarm variables
+//
+
+// Current event
+static lep_alarm_event_t alarm_event;
+static portMUX_TYPE alarm_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Evaluation state (only accessed by the evaluating task)
+static bool alarm_prev_valid = false;
+static uint8_t alarm_prev_roi;
+static uint8_t alarm_prev_stat;
+static uint32_t alarm_prev_value;
+static int64_t alarm_prev_usec;
+static int64_t alarm_last_true_usec;
+
+static const char* alarm_stat_names[SYS_ALARM_STAT_NUM] = {
+	"Min", "Max", "Mean", "P10", "P50", "P90"
+};
+
+
+
+//
+// Lepton Alarm Forward Declarations for internal functions
+//
+static uint32_t lepton_alarm_stat_value(const lep_roi_stats_t* statP, uint8_t stat);
+static int lepton_alarm_end_event();
+
+
+
+//
+// Lepton Alarm API
+//
+
+/**
+ * Evaluate the alarm in stP against the statistics in statsP.  Returns LEP_ALARM_TRIGGER
+ * when an event starts, LEP_ALARM_CLEAR when one ends and LEP_ALARM_NO_CHANGE otherwise.
+ * Only one task may call this.
+ */
+int lepton_alarm_eval(const lep_stats_t* statsP, const gui_state_t* stP)
+{
+	const lep_roi_stats_t* statP;
+	bool thresh_hit = false;
+	bool rate_hit = false;
+	int32_t rate = 0;
+	int64_t dt;
+	uint32_t value;
+	
+	if ((stP->alarm_mode == SYS_ALARM_OFF) || (stP->alarm_roi >= LEP_STATS_NUM) ||
+	    (stP->alarm_stat >= SYS_ALARM_STAT_NUM))
+	{
+		alarm_prev_valid = false;
+		return lepton_alarm_end_event();
+	}
+	
+	statP = &statsP->stats[stP->alarm_roi];
+	if (!statP->valid) {
+		// Region disabled
+		alarm_prev_valid = false;
+		return lepton_alarm_end_event();
+	}
+	
+	value = lepton_alarm_stat_value(statP, stP->alarm_stat);
+	
+	// Threshold check
+	if (stP->alarm_mode == SYS_ALARM_ABOVE) {
+		thresh_hit = (value > stP->alarm_threshold);
+	} else if (stP->alarm_mode == SYS_ALARM_BELOW) {
+		thresh_hit = (value < stP->alarm_threshold);
+	}
+	
+	// Rate check against the previous evaluation of the same statistic
+	if (alarm_prev_valid && (alarm_prev_roi == stP->alarm_roi) &&
+	    (alarm_prev_stat == stP->alarm_stat) && (statsP->timestamp_usec > alarm_prev_usec))
+	{
+		dt = statsP->timestamp_usec - alarm_prev_usec;
+		rate = (int32_t) (((int64_t) value - (int64_t) alarm_prev_value) * 1000000 / dt);
+		if (stP->alarm_rate != 0) {
+			if (stP->alarm_mode == SYS_ALARM_ABOVE) {
+				rate_hit = (rate > (int32_t) stP->alarm_rate);
+			} else if (stP->alarm_mode == SYS_ALARM_BELOW) {
+				rate_hit = (-rate > (int32_t) stP->alarm_rate);
+			} else {
+				rate_hit = (rate > (int32_t) stP->alarm_rate) || (-rate > (int32_t) stP->alarm_rate);
+			}
+		}
+	}
+	alarm_prev_valid = true;
+	alarm_prev_roi = stP->alarm_roi;
+	alarm_prev_stat = stP->alarm_stat;
+	alarm_prev_value = value;
+	alarm_prev_usec = statsP->timestamp_usec;
+	
+	if (thresh_hit || rate_hit) {
+		alarm_last_true_usec = statsP->timestamp_usec;
+		if (!alarm_event.active) {
+			portENTER_CRITICAL(&alarm_mux);
+			alarm_event.active = true;
+			alarm_event.cause = thresh_hit ? LEP_ALARM_CAUSE_THRESH : LEP_ALARM_CAUSE_RATE;
+			alarm_event.roi = stP->alarm_roi;
+			alarm_event.stat = stP->alarm_stat;
+			alarm_event.value = value;
+			alarm_event.rate = rate;
+			alarm_event.start_usec = statsP->timestamp_usec;
+			alarm_event.count++;
+			portEXIT_CRITICAL(&alarm_mux);
+			return LEP_ALARM_TRIGGER;
+		}
+	} else if (alarm_event.active &&
+	          ((statsP->timestamp_usec - alarm_last_true_usec) >= ((int64_t) stP->alarm_hold * 1000000)))
+	{
+		return lepton_alarm_end_event();
+	}
+	
+	return LEP_ALARM_NO_CHANGE;
+}
+
+
+/**
+ * Get the current (or most recent) event
+ */
+void lepton_alarm_get_event(lep_alarm_event_t* eventP)
+{
+	portENTER_CRITICAL(&alarm_mux);
+	*eventP = alarm_event;
+	portEXIT_CRITICAL(&alarm_mux);
+}
+
+
+/**
+ * Return a display name for a SYS_ALARM_STAT_xxx statistic
+ */
+const char* lepton_alarm_stat_name(uint8_t stat)
+{
+	if (stat >= SYS_ALARM_STAT_NUM) return "";
+	
+	return alarm_stat_names[stat];
+}
+
+
+
+//
+// Lepton Alarm internal functions
+//
+static uint32_t lepton_alarm_stat_value(const lep_roi_stats_t* statP, uint8_t stat)
+{
+	switch (stat) {
+		case SYS_ALARM_STAT_MIN:
+			return statP->min;
+		case SYS_ALARM_STAT_MAX:
+			return statP->max;
+		case SYS_ALARM_STAT_MEAN:
+			return statP->mean;
+		case SYS_ALARM_STAT_P_LOW:
+			return statP->p_low;
+		case SYS_ALARM_STAT_P_MID:
+			return statP->p_mid;
+		default:
+			return statP->p_high;
+	}
+}
+
+
+/**
+ * End any event in progress, returning LEP_ALARM_CLEAR if there was one
+ */
+static int lepton_alarm_end_event()
+{
+	bool was_active;
+	
+	portENTER_CRITICAL(&alarm_mux);
+	was_active = alarm_event.active;
+	alarm_event.active = false;
+	portEXIT_CRITICAL(&alarm_mux);
+	
+	return was_active ? LEP_ALARM_CLEAR : LEP_ALARM_NO_CHANGE;
+}
@@ -0,0 +1,536 @@
+/*
+ * Lepton pixel correction
+ *
+ * Replaces a Lepton module's bad (dead or stuck) pixels with the mean of their good
+ * neighbors and removes its column offsets using a calibration kept in NVS.  The
+ * calibration is turned into a list of bad pixels, with a mask of the neighbors each is
+ * replaced from, and a list of offset columns so each frame only touches the pixels
+ * being corrected.  The frame's minimum, maximum and histogram are kept up to date
+ * from the pixels that change, only rescanning the frame when a corrected pixel was its
+ * minimum or maximum.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "lepton_correct.h"
+#include "lepton_utilities.h"
+#include "ps_nvs.h"
+#include "vospi.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+
+//
+// Lepton Correct constants
+//
+
+// Stored calibration layout version
+#define LEP_CORR_VERSION        1
+
+// Marks a bad pixel in the calibration average
+#define LEP_CORR_CAL_BAD_FLAG   0x80000000
+
+
+
+//
+// Lepton Correct typedefs
+//
+
+// Calibration stored in NVS
+typedef struct {
+	uint16_t version;            // LEP_CORR_VERSION
+	uint16_t num_bad;
+	uint16_t bad[LEP_CORR_MAX_BAD];          // Pixel indices
+	int16_t col_k100[LEP_WIDTH];             // Column offsets (K * 100, 0 for none)
+} lep_corr_cal_t;
+
+
+
+//
+// Lepton Correct variables
+//
+static const char* TAG = "lepton_correct";
+
+// Neighbors a bad pixel may be replaced from.  Mask bits 0-3 are the pixels beside it,
+// which are used if any are good, and bits 4-7 the diagonal pixels.
+static const int8_t corr_nbr_dx[8] = {-1, 1, 0, 0, -1, 1, -1, 1};
+static const int8_t corr_nbr_dy[8] = {0, 0, -1, 1, -1, -1, 1, 1};
+
+// Correction tables
+static bool corr_enable = false;
+static int corr_num_bad;
+static uint16_t corr_bad_idx[LEP_CORR_MAX_BAD];
+static uint8_t corr_bad_nbr[LEP_CORR_MAX_BAD];
+static int corr_num_cols;
+static uint8_t corr_cols[LEP_WIDTH];
+static int16_t corr_col_k100[LEP_WIDTH];
+
+// Extent of the corrected pixels in the current frame
+static bool corr_rescan;
+static uint16_t corr_min;
+static uint16_t corr_max;
+
+// Calibration state
+static lep_corr_cal_t corr_cal;
+static uint32_t* corr_cal_sumP = NULL;       // Pixel sums, then the average (K * 100)
+static int corr_cal_frames;
+static int32_t corr_cal_col_mean[LEP_WIDTH];
+
+// Status for other tasks
+static lep_corr_status_t corr_status;
+static portMUX_TYPE corr_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+
+//
+// Lepton Correct Forward Declarations for internal functions
+//
+static void lepton_correct_use_cal(const lep_corr_cal_t* calP);
+static bool lepton_correct_is_bad(const lep_corr_cal_t* calP, int idx);
+static inline void lepton_correct_pixel(lep_buffer_t* lepP, uint16_t* pP, int32_t v) __attribute__((always_inline));
+static void lepton_correct_find_extent(lep_buffer_t* lepP);
+static int32_t lepton_correct_median(int32_t* v, int n);
+static void lepton_correct_set_state(int state, bool cal_failed);
+
+
+
+//
+// Lepton Correct API
+//
+
+/**
+ * Load the stored calibration.  Only lep_task may call the lepton_correct functions
+ * (other than lepton_correct_get_status).
+ */
+void lepton_correct_init()
+{
+	if (vospi_is_lepton2()) {
+		// Each Lepton 2 pixel is 2x2 pixels in the frame so neighbors can't replace it
+		lepton_correct_set_state(LEP_CORR_STATE_OFF, false);
+		return;
+	}
+	
+	if (ps_nvs_get_blob(PS_NVS_BLOB_LEP_CORR, &corr_cal, sizeof(lep_corr_cal_t)) &&
+	    (corr_cal.version == LEP_CORR_VERSION) && (corr_cal.num_bad <= LEP_CORR_MAX_BAD))
+	{
+		lepton_correct_use_cal(&corr_cal);
+	} else {
+		lepton_correct_set_state(LEP_CORR_STATE_OFF, false);
+	}
+}
+
+
+/**
+ * Correct lepP's pixels (right after vospi_get_frame) with its minimum, maximum and
+ * histogram
+ */
+void lepton_correct_frame(lep_buffer_t* lepP)
+{
+	int i, j, y;
+	int n;
+	int32_t off;
+	int scale;
+	uint16_t* bufP;
+	uint16_t* pP;
+	uint32_t sum;
+	
+	if (!corr_enable) return;
+	
+	corr_rescan = false;
+	corr_min = 0xFFFF;
+	corr_max = 0;
+	bufP = lepP->lep_bufferP;
+	
+	// Columns first so bad pixels are replaced from corrected neighbors
+	scale = lepton_get_tlin_scale(lepP);
+	for (i=0; i<corr_num_cols; i++) {
+		off = corr_col_k100[i] / scale;
+		if (off == 0) continue;
+	
+		pP = bufP + corr_cols[i];
+		for (y=0; y<LEP_HEIGHT; y++) {
+			lepton_correct_pixel(lepP, pP, (int32_t) *pP - off);
+			pP += LEP_WIDTH;
+		}
+	}
+	
+	for (i=0; i<corr_num_bad; i++) {
+		pP = bufP + corr_bad_idx[i];
+		sum = 0;
+		n = 0;
+		for (j=0; j<8; j++) {
+			if (corr_bad_nbr[i] & (1 << j)) {
+				sum += *(pP + corr_nbr_dy[j] * LEP_WIDTH + corr_nbr_dx[j]);
+				n++;
+			}
+		}
+		lepton_correct_pixel(lepP, pP, (int32_t) ((sum + n/2) / n));
+	}
+	
+	// The uncorrected pixels still hold the old extremes unless a corrected pixel was one
+	if (corr_rescan) {
+		lepton_correct_find_extent(lepP);
+	} else {
+		if (corr_min < lepP->lep_min_val) lepP->lep_min_val = corr_min;
+		if (corr_max > lepP->lep_max_val) lepP->lep_max_val = corr_max;
+	}
+}
+
+
+/**
+ * Start a calibration.  Frames aren't corrected until it is done.  The caller runs a
+ * FFC and waits for it to settle before adding frames.
+ */
+bool lepton_correct_cal_start()
+{
+	if (vospi_is_lepton2()) {
+		ESP_LOGE(TAG, "Pixel correction isn't supported for the Lepton 2");
+		return false;
+	}
+	
+	if (corr_cal_sumP == NULL) {
+		corr_cal_sumP = heap_caps_malloc(LEP_NUM_PIXELS * sizeof(uint32_t), MALLOC_CAP_SPIRAM);
+		if (corr_cal_sumP == NULL) {
+			ESP_LOGE(TAG, "Could not allocate calibration buffer");
+			return false;
+		}
+	}
+	
+	lepton_correct_cal_restart();
+	corr_enable = false;
+	lepton_correct_set_state(LEP_CORR_STATE_CAL, false);
+	
+	return true;
+}
+
+
+/**
+ * Discard the frames added so far (for example after a FFC ran during the calibration)
+ */
+void lepton_correct_cal_restart()
+{
+	if (corr_cal_sumP != NULL) {
+		memset(corr_cal_sumP, 0, LEP_NUM_PIXELS * sizeof(uint32_t));
+	}
+	corr_cal_frames = 0;
+}
+
+
+/**
+ * Add a frame to the calibration.  Returns true when it has enough frames.
+ */
+bool lepton_correct_cal_add(const lep_buffer_t* lepP)
+{
+	int i;
+	
+	if (corr_cal_sumP == NULL) return false;
+	
+	for (i=0; i<LEP_NUM_PIXELS; i++) {
+		corr_cal_sumP[i] += lepP->lep_bufferP[i];
+	}
+	
+	return (++corr_cal_frames >= LEP_CORR_CAL_FRAMES);
+}
+
+
+/**
+ * Find the bad pixels and column offsets in the averaged frames (pixel values in
+ * K * 100 / tlin_scale) and store them.  A calibration that fails keeps the previous
+ * one.  Returns true if the calibration succeeded.
+ */
+bool lepton_correct_cal_finish(int tlin_scale)
+{
+	bool success = false;
+	int i, n, x, y, nx, ny;
+	int32_t nbr[8];
+	int32_t p, d;
+	uint32_t sum;
+	
+	if ((corr_cal_sumP == NULL) || (corr_cal_frames == 0)) goto done;
+	
+	// Average
+	for (i=0; i<LEP_NUM_PIXELS; i++) {
+		corr_cal_sumP[i] = ((corr_cal_sumP[i] + corr_cal_frames/2) / corr_cal_frames) * tlin_scale;
+	}
+	
+	// Find the pixels that stand out from their neighbors
+	memset(&corr_cal, 0, sizeof(lep_corr_cal_t));
+	corr_cal.version = LEP_CORR_VERSION;
+	for (y=0; y<LEP_HEIGHT; y++) {
+		for (x=0; x<LEP_WIDTH; x++) {
+			n = 0;
+			for (i=0; i<8; i++) {
+				nx = x + corr_nbr_dx[i];
+				ny = y + corr_nbr_dy[i];
+				if ((nx >= 0) && (nx < LEP_WIDTH) && (ny >= 0) && (ny < LEP_HEIGHT)) {
+					nbr[n++] = (int32_t) corr_cal_sumP[ny*LEP_WIDTH + nx];
+				}
+			}
+			p = (int32_t) corr_cal_sumP[y*LEP_WIDTH + x];
+			if (abs(p - lepton_correct_median(nbr, n)) > LEP_CORR_BAD_K100) {
+				if (corr_cal.num_bad == LEP_CORR_MAX_BAD) {
+					ESP_LOGE(TAG, "Calibration found over %d bad pixels - is the scene uniform?", LEP_CORR_MAX_BAD);
+					goto done;
+				}
+				corr_cal.bad[corr_cal.num_bad++] = y*LEP_WIDTH + x;
+			}
+		}
+	}
+	for (i=0; i<corr_cal.num_bad; i++) {
+		corr_cal_sumP[corr_cal.bad[i]] |= LEP_CORR_CAL_BAD_FLAG;
+	}
+	
+	// Column means of the good pixels
+	for (x=0; x<LEP_WIDTH; x++) {
+		sum = 0;
+		n = 0;
+		for (y=0; y<LEP_HEIGHT; y++) {
+			if ((corr_cal_sumP[y*LEP_WIDTH + x] & LEP_CORR_CAL_BAD_FLAG) == 0) {
+				sum += corr_cal_sumP[y*LEP_WIDTH + x];
+				n++;
+			}
+		}
+		corr_cal_col_mean[x] = (int32_t) ((sum + n/2) / n);
+	}
+	
+	// Column offsets from the columns around each one
+	for (x=0; x<LEP_WIDTH; x++) {
+		n = 0;
+		for (i=x-LEP_CORR_COL_SPAN; i<=x+LEP_CORR_COL_SPAN; i++) {
+			if ((i >= 0) && (i < LEP_WIDTH)) {
+				nbr[n++] = corr_cal_col_mean[i];
+			}
+		}
+		d = corr_cal_col_mean[x] - lepton_correct_median(nbr, n);
+		if (abs(d) > LEP_CORR_COL_MAX_K100) {
+			ESP_LOGE(TAG, "Calibration found column %d offset %d - is the scene uniform?", x, (int) d);
+			goto done;
+		}
+		corr_cal.col_k100[x] = (abs(d) < LEP_CORR_COL_MIN_K100) ? 0 : d;
+	}
+	
+	if (ps_nvs_set_blob(PS_NVS_BLOB_LEP_CORR, &corr_cal, sizeof(lep_corr_cal_t))) {
+		success = true;
+	}
+	
+done:
+	heap_caps_free(corr_cal_sumP);
+	corr_cal_sumP = NULL;
+	
+	if (success) {
+		lepton_correct_use_cal(&corr_cal);
+		ESP_LOGI(TAG, "Calibrated %d bad pixels and %d column offsets", corr_num_bad, corr_num_cols);
+	} else {
+		// Go back to the stored calibration
+		lepton_correct_init();
+		lepton_correct_set_state(corr_enable ? LEP_CORR_STATE_ON : LEP_CORR_STATE_OFF, true);
+	}
+	
+	return success;
+}
+
+
+/**
+ * Stop a calibration, keeping the previous one
+ */
+void lepton_correct_cal_abort()
+{
+	heap_caps_free(corr_cal_sumP);
+	corr_cal_sumP = NULL;
+	
+	lepton_correct_init();
+	lepton_correct_set_state(corr_enable ? LEP_CORR_STATE_ON : LEP_CORR_STATE_OFF, true);
+}
+
+
+/**
+ * Remove the stored calibration and stop correcting frames.  Returns false if it could
+ * not be removed from NVS.
+ */
+bool lepton_correct_clear()
+{
+	corr_enable = false;
+	corr_num_bad = 0;
+	corr_num_cols = 0;
+	lepton_correct_set_state(LEP_CORR_STATE_OFF, false);
+	
+	return ps_nvs_erase_blob(PS_NVS_BLOB_LEP_CORR);
+}
+
+
+/**
+ * Return a copy of the status
+ */
+void lepton_correct_get_status(lep_corr_status_t* statusP)
+{
+	portENTER_CRITICAL(&corr_mux);
+	*statusP = corr_status;
+	portEXIT_CRITICAL(&corr_mux);
+}
+
+
+
+//
+// Lepton Correct internal functions
+//
+
+/**
+ * Build the correction tables from a calibration
+ */
+static void lepton_correct_use_cal(const lep_corr_cal_t* calP)
+{
+	int i, j, x, y, nx, ny;
+	uint8_t mask;
+	
+	corr_num_bad = 0;
+	for (i=0; i<calP->num_bad; i++) {
+		x = calP->bad[i] % LEP_WIDTH;
+		y = calP->bad[i] / LEP_WIDTH;
+		if (y >= LEP_HEIGHT) continue;
+	
+		// Good neighbors beside the pixel, or diagonal to it if there are none
+		mask = 0;
+		for (j=0; j<8; j++) {
+			if ((j == 4) && (mask != 0)) break;
+			nx = x + corr_nbr_dx[j];
+			ny = y + corr_nbr_dy[j];
+			if ((nx >= 0) && (nx < LEP_WIDTH) && (ny >= 0) && (ny < LEP_HEIGHT) &&
+			    !lepton_correct_is_bad(calP, ny*LEP_WIDTH + nx))
+			{
+				mask |= 1 << j;
+			}
+		}
+	
+		if (mask == 0) {
+			ESP_LOGW(TAG, "Bad pixel %d, %d has no good neighbors - not corrected", x, y);
+		} else {
+			corr_bad_idx[corr_num_bad] = calP->bad[i];
+			corr_bad_nbr[corr_num_bad] = mask;
+			corr_num_bad++;
+		}
+	}
+	
+	corr_num_cols = 0;
+	for (x=0; x<LEP_WIDTH; x++) {
+		if (calP->col_k100[x] != 0) {
+			corr_cols[corr_num_cols] = x;
+			corr_col_k100[corr_num_cols] = calP->col_k100[x];
+			corr_num_cols++;
+		}
+	}
+	
+	corr_enable = (corr_num_bad != 0) || (corr_num_cols != 0);
+	lepton_correct_set_state(corr_enable ? LEP_CORR_STATE_ON : LEP_CORR_STATE_OFF, false);
+}
+
+
+/**
+ * Return true if pixel idx is in the calibration's bad pixel list
+ */
+static bool lepton_correct_is_bad(const lep_corr_cal_t* calP, int idx)
+{
+	int i;
+	
+	for (i=0; i<calP->num_bad; i++) {
+		if (calP->bad[i] == idx) return true;
+	}
+	return false;
+}
+
+
+/**
+ * Set a pixel to v (clipped to 16 bits), moving it in the frame's histogram and noting
+ * the extent of the corrected pixels
+ */
+static inline void lepton_correct_pixel(lep_buffer_t* lepP, uint16_t* pP, int32_t v)
+{
+	uint16_t old = *pP;
+	
+	if (v < 0) v = 0;
+	if (v > 0xFFFF) v = 0xFFFF;
+	
+	if ((old == lepP->lep_min_val) || (old == lepP->lep_max_val)) {
+		corr_rescan = true;
+	}
+	if (lepP->hist_valid) {
+		lepP->lep_hist[old >> LEP_HIST_SHIFT]--;
+		lepP->lep_hist[v >> LEP_HIST_SHIFT]++;
+	}
+	if (v < corr_min) corr_min = v;
+	if (v > corr_max) corr_max = v;
+	
+	*pP = (uint16_t) v;
+}
+
+
+/**
+ * Find a frame's minimum and maximum after a pixel holding one was corrected
+ */
+static void lepton_correct_find_extent(lep_buffer_t* lepP)
+{
+	int i;
+	uint16_t min = 0xFFFF;
+	uint16_t max = 0;
+	uint16_t* pP = lepP->lep_bufferP;
+	
+	for (i=0; i<LEP_NUM_PIXELS; i++) {
+		if (*pP < min) min = *pP;
+		if (*pP > max) max = *pP;
+		pP++;
+	}
+	lepP->lep_min_val = min;
+	lepP->lep_max_val = max;
+}
+
+
+/**
+ * Return the median of n (1 - 8) values, sorting them in place
+ */
+static int32_t lepton_correct_median(int32_t* v, int n)
+{
+	int i, j;
+	int32_t t;
+	
+	for (i=1; i<n; i++) {
+		t = v[i];
+		for (j=i; (j > 0) && (v[j-1] > t); j--) {
+			v[j] = v[j-1];
+		}
+		v[j] = t;
+	}
+	
+	return (n & 1) ? v[n/2] : (v[n/2 - 1] + v[n/2]) / 2;
+}
+
+
+/**
+ * Update the status for other tasks
+ */
+static void lepton_correct_set_state(int state, bool cal_failed)
+{
+	portENTER_CRITICAL(&corr_mux);
+	corr_status.state = state;
+	corr_status.bad_pixels = (state == LEP_CORR_STATE_ON) ? corr_num_bad : 0;
+	corr_status.columns = (state == LEP_CORR_STATE_ON) ? corr_num_cols : 0;
+	corr_status.cal_failed = cal_failed;
+	portEXIT_CRITICAL(&corr_mux);
+}
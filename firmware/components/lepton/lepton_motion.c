@@ -0,0 +1,115 @@
+/*
+ * Lepton scene change detector
+ *
+ * Compares a block-averaged copy of each Lepton frame against the previous one to
+ * detect when something in the scene has changed.  Averaging the blocks suppresses
+ * pixel noise and the small reference frame keeps the comparison cheap enough to run
+ * on every frame app_task sees.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "lepton_motion.h"
+#include "lepton_utilities.h"
+#include "vospi.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+
+//
+// Lepton Motion variables
+//
+
+// Block means (K * 100) of the previous frame
+static bool motion_ref_valid = false;
+static int32_t motion_ref[LEP_MOTION_NUM_BLOCKS];
+
+// Block sums and changes of the current frame
+static uint32_t motion_sum[LEP_MOTION_NUM_BLOCKS];
+static int32_t motion_diff[LEP_MOTION_NUM_BLOCKS];
+
+
+
+//
+// Lepton Motion API
+//
+
+/**
+ * Compare the frame in lepP to the previous frame and make it the new reference.
+ * Returns true if the scene changed.  The first frame after a reset never changes.
+ * Only one task may call this.
+ */
+bool lepton_motion_detect(lep_buffer_t* lepP)
+{
+	bool ref_valid;
+	int32_t cur;
+	int32_t mean_d;
+	int32_t scale;
+	int32_t sum_d;
+	int changed;
+	int i, x, y;
+	uint16_t* rowP;
+	uint32_t* sumP;
+	
+	// Sum the blocks in one pass over the frame
+	memset(motion_sum, 0, sizeof(motion_sum));
+	rowP = lepP->lep_bufferP;
+	for (y=0; y<LEP_HEIGHT; y++) {
+		sumP = &motion_sum[(y / LEP_MOTION_BLOCK) * LEP_MOTION_BLOCKS_X];
+		for (x=0; x<LEP_WIDTH; x++) {
+			sumP[x / LEP_MOTION_BLOCK] += rowP[x];
+		}
+		rowP += LEP_WIDTH;
+	}
+	
+	// Block means are compared in K * 100
+	scale = lepton_get_tlin_scale(lepP);
+	
+	// Update the reference with this frame's block means
+	ref_valid = motion_ref_valid;
+	sum_d = 0;
+	for (i=0; i<LEP_MOTION_NUM_BLOCKS; i++) {
+		cur = (int32_t) (motion_sum[i] / (LEP_MOTION_BLOCK * LEP_MOTION_BLOCK)) * scale;
+		motion_diff[i] = cur - motion_ref[i];
+		sum_d += motion_diff[i];
+		motion_ref[i] = cur;
+	}
+	motion_ref_valid = true;
+	if (!ref_valid) return false;
+	
+	// Count the blocks that changed more than the frame as a whole
+	mean_d = sum_d / LEP_MOTION_NUM_BLOCKS;
+	changed = 0;
+	for (i=0; i<LEP_MOTION_NUM_BLOCKS; i++) {
+		if (abs(motion_diff[i] - mean_d) > LEP_MOTION_THRESH) {
+			if (++changed >= LEP_MOTION_MIN_BLOCKS) return true;
+		}
+	}
+	
+	return false;
+}
+
+
+/**
+ * Forget the reference frame (e.g. when starting a recording session)
+ */
+void lepton_motion_reset()
+{
+	motion_ref_valid = false;
+}
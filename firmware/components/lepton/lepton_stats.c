@@ -0,0 +1,380 @@
+/*
+ * Lepton radiometric statistics
+ *
+ * Computes temperature statistics for the full Lepton frame, up to
+ * SYS_LEP_STATS_MAX_ROI rectangular regions of interest and the GUI's touch meter in
+ * one pass over the frame.  Each row is read once while it is in the cache, feeding the
+ * frame and any regions covering it.  The statistics for the most recent frame are kept for other tasks.
+ *
+ * A region with an emissivity below 100% has its values corrected for the emissivity
+ * and the radiation reflected from its surroundings.  The Lepton reports the
+ * temperature of a black body giving the same radiation so, using the Stefan-Boltzmann
+ * approximation for the band, the object's temperature is
+ *
+ *   To = ((Ta^4 - (1 - e) * Tr^4) / e) ^ 1/4
+ *
+ * for apparent temperature Ta and reflected temperature Tr.  The correction is
+ * monotonic so the minimum, maximum and percentiles are corrected from the raw values
+ * and only the mean and standard deviation need each pixel to be corrected.  That is
+ * done with a fixed-point table built for the region when its settings change.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "lepton_stats.h"
+#include "lepton_utilities.h"
+#include "vospi.h"
+#include "freertos/FreeRTOS.h"
+#include <math.h>
+#include <string.h>
+
+
+
+//
+// Lepton Stats typedefs
+//
+
+// Per-region accumulators.  Sums are of the offset from the frame minimum.
+typedef struct {
+	int x1;
+	int x2;                     // Exclusive
+	int y1;
+	int y2;                     // Exclusive
+	uint16_t min;
+	uint16_t max;
+	uint32_t sum;
+	uint64_t sum_sq;
+	const uint32_t* lutP;       // Emissivity correction (NULL for none)
+	uint32_t base;              // Corrected frame minimum the corrected sums are offset from
+} lep_stats_acc_t;
+
+// Region emissivity correction table for the settings it was built with
+typedef struct {
+	uint8_t emissivity;         // Percent (0 when not built)
+	uint16_t refl;              // K * 100
+	uint32_t lut[LEP_STATS_CORR_ENTRIES + 1];
+} lep_stats_corr_t;
+
+
+
+//
+// Lepton Stats variables
+//
+
+// Statistics for the most recent frame
+static lep_stats_t stats_latest;
+static portMUX_TYPE stats_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Meter region for the next frame (w or h 0 when disabled)
+static sys_lep_roi_t stats_meter;
+
+// Working histograms
+static uint16_t stats_hist[LEP_STATS_ALL_NUM][LEP_STATS_HIST_BINS];
+
+// Region emissivity corrections (only used by lepton_stats_compute)
+static lep_stats_corr_t stats_corr[SYS_LEP_STATS_MAX_ROI];
+
+
+
+//
+// Lepton Stats Forward Declarations for internal functions
+//
+static uint32_t lepton_stats_percentile(uint16_t* histP, uint32_t count, int pct, uint16_t min_val, int shift, lep_stats_acc_t* accP);
+static const uint32_t* lepton_stats_get_corr(int roi, uint8_t emissivity, uint16_t refl);
+static inline uint32_t lepton_stats_correct(const uint32_t* lutP, uint32_t k100);
+
+
+
+//
+// Lepton Stats API
+//
+
+/**
+ * Compute the statistics for the frame in lepP and the regions in roiP
+ * (SYS_LEP_STATS_MAX_ROI entries), corrected with the region emissivities in
+ * emissivityP and reflected temperatures in reflP, along with the meter region, and
+ * make them the latest statistics.  Disabled or out-of-bounds regions are skipped.
+ * Only one task may call this.
+ */
+void SYS_HOT_IRAM_ATTR lepton_stats_compute(lep_buffer_t* lepP, const sys_lep_roi_t* roiP, const uint8_t* emissivityP, const uint16_t* reflP)
+{
+	lep_stats_t s;
+	lep_stats_acc_t acc[LEP_STATS_ALL_NUM];
+	lep_stats_acc_t* accP;
+	lep_roi_stats_t* statP;
+	uint16_t* rowP;
+	uint16_t* histP;
+	uint16_t min_val;
+	uint16_t v;
+	uint32_t count;
+	uint32_t scale;
+	uint32_t c;
+	int32_t d;
+	int bin;
+	int shift;
+	int i, n, x, y;
+	double mean, var;
+	
+	memset(&s, 0, sizeof(lep_stats_t));
+	s.timestamp_usec = lepP->timestamp_usec;
+	portENTER_CRITICAL(&stats_mux);
+	s.stats[LEP_STATS_METER].roi = stats_meter;
+	portEXIT_CRITICAL(&stats_mux);
+	
+	// Size the histogram bins to cover the frame's span
+	min_val = lepP->lep_min_val;
+	shift = 0;
+	while (((lepP->lep_max_val - min_val) >> shift) >= LEP_STATS_HIST_BINS) {
+		shift++;
+	}
+	
+	// Statistics are reported in K * 100
+	scale = lepton_get_tlin_scale(lepP);
+	
+	// Set up the frame and enabled regions
+	n = 0;
+	for (i=0; i<LEP_STATS_ALL_NUM; i++) {
+		if (i == LEP_STATS_FRAME) {
+			s.stats[i].roi.x = 0;
+			s.stats[i].roi.y = 0;
+			s.stats[i].roi.w = LEP_WIDTH;
+			s.stats[i].roi.h = LEP_HEIGHT;
+		} else {
+			if (i != LEP_STATS_METER) s.stats[i].roi = roiP[i-1];
+			if ((s.stats[i].roi.w == 0) || (s.stats[i].roi.h == 0) ||
+			    ((s.stats[i].roi.x + s.stats[i].roi.w) > LEP_WIDTH) ||
+			    ((s.stats[i].roi.y + s.stats[i].roi.h) > LEP_HEIGHT))
+			{
+				continue;
+			}
+		}
+		s.stats[i].valid = true;
+		
+		acc[n].x1 = s.stats[i].roi.x;
+		acc[n].x2 = s.stats[i].roi.x + s.stats[i].roi.w;
+		acc[n].y1 = s.stats[i].roi.y;
+		acc[n].y2 = s.stats[i].roi.y + s.stats[i].roi.h;
+		acc[n].min = 0xFFFF;
+		acc[n].max = 0;
+		acc[n].sum = 0;
+		acc[n].sum_sq = 0;
+		acc[n].lutP = NULL;
+		if ((i != LEP_STATS_FRAME) && (i != LEP_STATS_METER) && (emissivityP[i-1] < SYS_LEP_EMISSIVITY_MAX)) {
+			acc[n].lutP = lepton_stats_get_corr(i-1, emissivityP[i-1], reflP[i-1]);
+			acc[n].base = lepton_stats_correct(acc[n].lutP, min_val * scale);
+		}
+		memset(stats_hist[n], 0, LEP_STATS_HIST_BINS * sizeof(uint16_t));
+		n++;
+	}
+	
+	// Single pass over the frame
+	rowP = lepP->lep_bufferP;
+	for (y=0; y<LEP_HEIGHT; y++) {
+		for (i=0; i<n; i++) {
+			accP = &acc[i];
+			if ((y < accP->y1) || (y >= accP->y2)) continue;
+			
+			histP = stats_hist[i];
+			if (accP->lutP == NULL) {
+				for (x=accP->x1; x<accP->x2; x++) {
+					v = rowP[x];
+					if (v < accP->min) accP->min = v;
+					if (v > accP->max) accP->max = v;
+					
+					d = (int32_t) v - min_val;
+					if (d < 0) d = 0;
+					accP->sum += d;
+					accP->sum_sq += (uint64_t) d * d;
+					
+					bin = d >> shift;
+					if (bin >= LEP_STATS_HIST_BINS) bin = LEP_STATS_HIST_BINS - 1;
+					histP[bin]++;
+				}
+			} else {
+				// Sums are of corrected K * 100 values, the histogram is still of raw values
+				for (x=accP->x1; x<accP->x2; x++) {
+					v = rowP[x];
+					if (v < accP->min) accP->min = v;
+					if (v > accP->max) accP->max = v;
+					
+					d = (int32_t) v - min_val;
+					if (d < 0) d = 0;
+					c = lepton_stats_correct(accP->lutP, v * scale);
+					c = (c > accP->base) ? (c - accP->base) : 0;
+					accP->sum += c;
+					accP->sum_sq += (uint64_t) c * c;
+					
+					bin = d >> shift;
+					if (bin >= LEP_STATS_HIST_BINS) bin = LEP_STATS_HIST_BINS - 1;
+					histP[bin]++;
+				}
+			}
+		}
+		rowP += LEP_WIDTH;
+	}
+	
+	// Reduce the accumulators
+	n = 0;
+	for (i=0; i<LEP_STATS_ALL_NUM; i++) {
+		statP = &s.stats[i];
+		if (!statP->valid) continue;
+		
+		accP = &acc[n];
+		count = (accP->x2 - accP->x1) * (accP->y2 - accP->y1);
+		mean = (double) accP->sum / count;
+		var = ((double) accP->sum_sq / count) - (mean * mean);
+		if (var < 0) var = 0;
+		
+		statP->min = accP->min * scale;
+		statP->max = accP->max * scale;
+		statP->p_low = lepton_stats_percentile(stats_hist[n], count, LEP_STATS_PCT_LOW, min_val, shift, accP) * scale;
+		statP->p_mid = lepton_stats_percentile(stats_hist[n], count, LEP_STATS_PCT_MID, min_val, shift, accP) * scale;
+		statP->p_high = lepton_stats_percentile(stats_hist[n], count, LEP_STATS_PCT_HIGH, min_val, shift, accP) * scale;
+		if (accP->lutP == NULL) {
+			statP->mean = (uint32_t) (((min_val + mean) * scale) + 0.5);
+			statP->stddev = (uint32_t) ((sqrt(var) * scale) + 0.5);
+		} else {
+			statP->min = lepton_stats_correct(accP->lutP, statP->min);
+			statP->max = lepton_stats_correct(accP->lutP, statP->max);
+			statP->p_low = lepton_stats_correct(accP->lutP, statP->p_low);
+			statP->p_mid = lepton_stats_correct(accP->lutP, statP->p_mid);
+			statP->p_high = lepton_stats_correct(accP->lutP, statP->p_high);
+			statP->mean = (uint32_t) (accP->base + mean + 0.5);
+			statP->stddev = (uint32_t) (sqrt(var) + 0.5);
+		}
+		n++;
+	}
+	
+	portENTER_CRITICAL(&stats_mux);
+	stats_latest = s;
+	portEXIT_CRITICAL(&stats_mux);
+}
+
+
+/**
+ * Get the latest statistics.  Returns false if none have been computed yet.
+ */
+bool lepton_stats_get_latest(lep_stats_t* statsP)
+{
+	portENTER_CRITICAL(&stats_mux);
+	*statsP = stats_latest;
+	portEXIT_CRITICAL(&stats_mux);
+	
+	return (statsP->timestamp_usec != 0);
+}
+
+
+/**
+ * Get the statistics for the frame in lepP.  Returns false if the latest statistics
+ * are not from that frame.
+ */
+bool lepton_stats_get_frame(lep_buffer_t* lepP, lep_stats_t* statsP)
+{
+	if (!lepton_stats_get_latest(statsP)) return false;
+	
+	return (statsP->timestamp_usec == lepP->timestamp_usec);
+}
+
+
+/**
+ * Set the meter region included in the statistics from the next frame on.  A width or
+ * height of 0 disables the meter.
+ */
+void lepton_stats_set_meter(const sys_lep_roi_t* roiP)
+{
+	portENTER_CRITICAL(&stats_mux);
+	stats_meter = *roiP;
+	portEXIT_CRITICAL(&stats_mux);
+}
+
+
+
+//
+// Lepton Stats internal functions
+//
+
+/**
+ * Return the raw value of the pct percentile (nearest rank) from a histogram of count
+ * values.  The value is the bin center limited to the region's range.
+ */
+static uint32_t lepton_stats_percentile(uint16_t* histP, uint32_t count, int pct, uint16_t min_val, int shift, lep_stats_acc_t* accP)
+{
+	uint32_t rank;
+	uint32_t sum;
+	uint32_t val;
+	int bin;
+	
+	rank = (count * pct + 99) / 100;
+	if (rank == 0) rank = 1;
+	
+	sum = 0;
+	for (bin=0; bin<(LEP_STATS_HIST_BINS-1); bin++) {
+		sum += histP[bin];
+		if (sum >= rank) break;
+	}
+	
+	val = min_val + (bin << shift) + ((1 << shift) >> 1);
+	if (val < accP->min) val = accP->min;
+	if (val > accP->max) val = accP->max;
+	
+	return val;
+}
+
+
+/**
+ * Return the emissivity correction table for a region, rebuilding it if its settings
+ * have changed
+ */
+static const uint32_t* lepton_stats_get_corr(int roi, uint8_t emissivity, uint16_t refl)
+{
+	lep_stats_corr_t* corrP = &stats_corr[roi];
+	double e, w_refl, t, w;
+	int i;
+	
+	if ((corrP->emissivity != emissivity) || (corrP->refl != refl)) {
+		e = emissivity / 100.0;
+		t = refl / 100.0;
+		w_refl = (1.0 - e) * t * t * t * t;
+		for (i=0; i<=LEP_STATS_CORR_ENTRIES; i++) {
+			t = (double) (i << LEP_STATS_CORR_SHIFT) / 100.0;
+			w = ((t * t * t * t) - w_refl) / e;
+			corrP->lut[i] = (w > 0) ? (uint32_t) ((sqrt(sqrt(w)) * 100.0) + 0.5) : 0;
+		}
+		corrP->emissivity = emissivity;
+		corrP->refl = refl;
+	}
+	
+	return corrP->lut;
+}
+
+
+/**
+ * Return the corrected value of a K * 100 value
+ */
+static inline uint32_t lepton_stats_correct(const uint32_t* lutP, uint32_t k100)
+{
+	uint32_t i = k100 >> LEP_STATS_CORR_SHIFT;
+	
+	if (i >= LEP_STATS_CORR_ENTRIES) {
+		// Extrapolate from the last step
+		i = LEP_STATS_CORR_ENTRIES - 1;
+		return lutP[i] + (uint32_t) (((uint64_t) (lutP[i+1] - lutP[i]) * (k100 - (i << LEP_STATS_CORR_SHIFT))) >> LEP_STATS_CORR_SHIFT);
+	}
+	
+	return lutP[i] + (((lutP[i+1] - lutP[i]) * (k100 & ((1 << LEP_STATS_CORR_SHIFT) - 1))) >> LEP_STATS_CORR_SHIFT);
+}
@@ -30,10 +30,14 @@
 #include "i2c.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "rom/ets_sys.h"
 #include "ps_utilities.h"
 #include "sys_utilities.h"
 #include "vospi.h"
 #include "system_config.h"
+#include <string.h>
 
 
 
@@ -42,6 +46,57 @@
 //
 static const char* TAG = "lepton_utilities";
 
+// Configuration check steps.  The lepton is pinged first and then each setting is read
+// and, if it doesn't have the expected value, set and read back.
+static const lep_check_step_t check_steps[] = {
+	{CCI_CMD_SYS_RUN_PING, 0, 0, false, "Ping"},
+	{CCI_CMD_RAD_GET_RADIOMETRY_ENABLE_STATE, CCI_CMD_RAD_SET_RADIOMETRY_ENABLE_STATE,
+	 CCI_RADIOMETRY_ENABLED, false, "Radiometry"},
+	{CCI_CMD_RAD_GET_RADIOMETRY_TLINEAR_ENABLE_STATE, CCI_CMD_RAD_SET_RADIOMETRY_TLINEAR_ENABLE_STATE,
+	 CCI_RADIOMETRY_TLINEAR_ENABLED, false, "Radiometry TLinear"},
+	{CCI_CMD_RAD_GET_RADIOMETRY_TLINEAR_AUTO_RES, CCI_CMD_RAD_SET_RADIOMETRY_TLINEAR_AUTO_RES,
+	 CCI_RADIOMETRY_AUTO_RES_ENABLED, false, "Radiometry Auto Resolution"},
+	{CCI_CMD_AGC_GET_AGC_ENABLE_STATE, CCI_CMD_AGC_SET_AGC_ENABLE_STATE,
+	 CCI_AGC_DISABLED, false, "AGC"},
+	{CCI_CMD_SYS_GET_TELEMETRY_ENABLE_STATE, CCI_CMD_SYS_SET_TELEMETRY_ENABLE_STATE,
+	 CCI_TELEMETRY_ENABLED, false, "Telemetry enable"},
+	{CCI_CMD_SYS_GET_GAIN_MODE, CCI_CMD_SYS_SET_GAIN_MODE, 0, true, "Gain Mode"},
+	{CCI_CMD_OEM_GET_GPIO_MODE, CCI_CMD_OEM_SET_GPIO_MODE,
+	 LEP_OEM_GPIO_MODE_VSYNC, false, "GPIO Mode"}
+};
+
+// Configuration check state
+static int check_step = -1;                 // Index into check_steps, -1 when idle
+static int check_phase;
+static bool check_cmd_running;
+static uint32_t check_value;                // Expected value for the current step
+static uint32_t check_delay_usec;
+static int64_t check_cmd_usec;              // Time the current command was started
+static int64_t check_next_usec;             // Time the current command is next polled
+
+// Gain mode (SYS_GAIN_xxx) the check expects.  It is only changed by lepton_gain_mode
+// so a check never switches the lepton's gain in the middle of a frame.
+static int check_gain_mode;
+
+// Stream recovery state
+static int recover_stage = LEP_RECOVER_IDLE;
+static int recover_resyncs;                 // Resyncs and reboots in the current stall
+static int recover_reboots;
+static bool recover_booting;                // Waiting for the lepton to boot
+static int64_t recover_start_usec;          // Time the stream was lost
+static int64_t recover_boot_usec;           // Time of the reboot or reset
+static int64_t recover_next_usec;           // Time of the next boot status poll
+
+
+
+//
+// Lepton Utilities Forward Declarations for internal functions
+//
+static int lepton_check_end(int res, const char* name);
+static uint32_t lepton_check_gain_mode();
+static cc_gain_mode_t lepton_lep_gain_mode(int mode);
+static void lepton_recover_restart();
+
 
 
 //
@@ -53,7 +108,15 @@ bool lepton_init()
 	cc_gain_mode_t gain_mode;
 	gui_state_t gui_state;
 	uint32_t rsp;
-  
+	char pn[CCI_PART_NUMBER_LEN+1];
+	cci_status_snapshot_t snap;
+	
+#ifdef LEP_RESET_IO
+	// Hold the reset line inactive for stream recovery
+	gpio_set_level(LEP_RESET_IO, 1);
+	gpio_set_direction(LEP_RESET_IO, GPIO_MODE_OUTPUT);
+#endif
+	
   	// Attempt to ping the Lepton to validate communication
   	// If this is successful, we assume further communication will be successful
   	rsp = cci_run_ping();
@@ -62,6 +125,14 @@ bool lepton_init()
   		return false;
 	}
 	
+	// Configure the VoSPI pipeline for the module
+	if (cci_get_part_number(pn)) {
+		ESP_LOGI(TAG, "Lepton Part Number = %s", pn);
+		vospi_set_lepton2(strncmp(pn, LEP_PN_LEPTON_2_5, strlen(LEP_PN_LEPTON_2_5)) == 0);
+	} else {
+		ESP_LOGE(TAG, "Could not read Lepton part number - assuming Lepton 3.x");
+	}
+	
 	// Configure Radiometry for TLinear enabled, auto-resolution
 	cci_set_radiometry_enable_state(CCI_RADIOMETRY_ENABLED);
 	rsp = cci_get_radiometry_enable_state();
@@ -78,7 +149,7 @@ bool lepton_init()
 			return false;
 		}
 	}
-
+	
 	cci_set_radiometry_tlinear_enable_state(CCI_RADIOMETRY_TLINEAR_ENABLED);
 	rsp = cci_get_radiometry_tlinear_enable_state();
 	ESP_LOGI(TAG, "Lepton Radiometry TLinear = %d", rsp);
@@ -116,16 +187,8 @@ bool lepton_init()
 	
 	// Set gain mode from persistent storage
 	ps_get_gui_state(&gui_state);
-	switch (gui_state.gain_mode) {
-		case SYS_GAIN_HIGH:
-			gain_mode = LEP_SYS_GAIN_MODE_HIGH;
-			break;
-		case SYS_GAIN_LOW:
-			gain_mode = LEP_SYS_GAIN_MODE_LOW;
-			break;
-		default:
-			gain_mode = LEP_SYS_GAIN_MODE_AUTO;
-	}
+	check_gain_mode = gui_state.gain_mode;
+	gain_mode = lepton_lep_gain_mode(check_gain_mode);
 	cci_set_gain_mode(gain_mode);
 	rsp = cci_get_gain_mode();
 	ESP_LOGI(TAG, "Lepton Gain Mode = %d", rsp);
@@ -133,7 +196,15 @@ bool lepton_init()
 		ESP_LOGE(TAG, "Lepton communication failed (%d)", rsp);
   		return false;
 	}
-  
+	
+#ifdef LEP_FFC_MANUAL
+	// lep_task schedules FFCs between captures.  The Lepton's automatic FFC is only a
+	// fallback so a failure here isn't fatal.
+	if (!lepton_ffc_manual(true)) {
+		ESP_LOGE(TAG, "Could not set Lepton manual FFC mode");
+	}
+#endif
+	
 	// Finally enable VSYNC on Lepton GPIO3
 	cci_set_gpio_mode(LEP_OEM_GPIO_MODE_VSYNC);
 	rsp = cci_get_gpio_mode();
@@ -143,120 +214,232 @@ bool lepton_init()
   		return false;
 	}
 	
+	if (cci_get_status_snapshot(&snap)) {
+		ESP_LOGI(TAG, "Lepton Uptime = %u mSec, FPA = %d, AUX = %d (K x 100), FFC Status = %d",
+			snap.uptime_msec, snap.fpa_temp_k100, snap.aux_temp_k100, snap.ffc_status);
+	}
+	
 	return true;
 }
 
 
-bool lepton_check_reset_state()
+/**
+ * Start checking that the lepton is still configured correctly (and restoring any
+ * setting that isn't) if a check isn't already running.  The check steps through the
+ * settings one CCI command at a time as lepton_check_service is called.
+ */
+void lepton_check_start()
 {
-	cc_gain_mode_t gain_mode;
-	gui_state_t gui_state;
-	uint32_t rsp;
-  
-  	// Attempt to ping the Lepton to validate communication
-  	// If this is successful, we assume further communication will be successful
-  	rsp = cci_run_ping();
-  	if (rsp != 0) {
-  		ESP_LOGE(TAG, "Lepton ping failed (%d)", rsp);
-  		return false;
+	if (check_step < 0) {
+		check_step = 0;
+		check_phase = LEP_CHECK_PHASE_GET;
+		check_cmd_running = false;
+		check_next_usec = 0;
 	}
+}
+
+
+/**
+ * Return true while a check is running
+ */
+bool lepton_check_running()
+{
+	return (check_step >= 0);
+}
+
+
+/**
+ * Advance a running check.  At most one CCI command is started or polled per call and
+ * the call returns immediately if the current command's next poll isn't due yet.
+ * Returns LEP_CHECK_BUSY while the check is running (or none is running),
+ * LEP_CHECK_OK when it finishes successfully and LEP_CHECK_FAIL if the lepton could
+ * not be reached or a setting could not be restored.
+ */
+int lepton_check_service()
+{
+	const lep_check_step_t* stepP;
+	int64_t now;
+	int res;
+	uint16_t data[2];
+	uint32_t rsp;
 	
-	// Check Radiometry for TLinear enabled, auto-resolution
-	rsp = cci_get_radiometry_enable_state();
-	if (rsp != CCI_RADIOMETRY_ENABLED) {
-		ESP_LOGE(TAG, "Reset Lepton Radiometry");
-		cci_set_radiometry_enable_state(CCI_RADIOMETRY_ENABLED);
-		rsp = cci_get_radiometry_enable_state();
-		if (rsp != CCI_RADIOMETRY_ENABLED) {
-			ESP_LOGE(TAG, "Reset Lepton Radiometry failed");
-			return false;
+	if (check_step < 0) return LEP_CHECK_BUSY;
+	
+	now = esp_timer_get_time();
+	if (now < check_next_usec) return LEP_CHECK_BUSY;
+	
+	stepP = &check_steps[check_step];
+	
+	if (!check_cmd_running) {
+		// Start the command for the current phase
+		if (check_phase == LEP_CHECK_PHASE_SET) {
+			data[0] = check_value & 0xFFFF;
+			data[1] = check_value >> 16;
+			res = cci_cmd_start(stepP->set_cmd, data, 2);
+		} else {
+			if (check_phase == LEP_CHECK_PHASE_GET) {
+				check_value = (stepP->gain_mode) ? lepton_check_gain_mode() : stepP->value;
+			}
+			res = cci_cmd_start(stepP->get_cmd, NULL, (stepP->get_cmd == CCI_CMD_SYS_RUN_PING) ? 0 : 2);
 		}
+		if (!res) {
+			return lepton_check_end(LEP_CHECK_FAIL, stepP->name);
+		}
+		check_cmd_running = true;
+		check_cmd_usec = now;
+		check_delay_usec = CCI_POLL_MIN_USEC;
+		check_next_usec = now + check_delay_usec;
+		return LEP_CHECK_BUSY;
 	}
 	
-	rsp = cci_get_radiometry_tlinear_enable_state();
-	if (rsp != CCI_RADIOMETRY_TLINEAR_ENABLED) {
-		ESP_LOGE(TAG, "Reset Lepton Radiometry TLinear");
-		cci_set_radiometry_tlinear_enable_state(CCI_RADIOMETRY_TLINEAR_ENABLED);
-  		rsp = cci_get_radiometry_tlinear_enable_state();
-  		if (rsp != CCI_RADIOMETRY_TLINEAR_ENABLED) {
-  			ESP_LOGE(TAG, "Reset Lepton Radiometry TLinear failed");
-			return false;
-  		}
+	// Poll the running command, backing off while it is busy
+	res = cci_cmd_poll(data, (check_phase == LEP_CHECK_PHASE_SET) ? 0 : 2);
+	if (res == CCI_CMD_BUSY) {
+		if ((now - check_cmd_usec) >= (CCI_BUSY_TIMEOUT_MSEC * 1000)) {
+			return lepton_check_end(LEP_CHECK_FAIL, stepP->name);
+		}
+		check_delay_usec *= 2;
+		if (check_delay_usec > CCI_POLL_MAX_USEC) check_delay_usec = CCI_POLL_MAX_USEC;
+		check_next_usec = now + check_delay_usec;
+		return LEP_CHECK_BUSY;
+	} else if (res == CCI_CMD_ERROR) {
+		return lepton_check_end(LEP_CHECK_FAIL, stepP->name);
 	}
+	check_cmd_running = false;
+	check_next_usec = 0;
 	
-	rsp = cci_get_radiometry_tlinear_auto_res();
-	if (rsp != CCI_RADIOMETRY_AUTO_RES_ENABLED) {
-		ESP_LOGE(TAG, "Reset Lepton Radiometry Auto Resolution");
-		cci_set_radiometry_tlinear_auto_res(CCI_RADIOMETRY_AUTO_RES_ENABLED);
-		rsp = cci_get_radiometry_tlinear_auto_res();
-		if (rsp != CCI_RADIOMETRY_AUTO_RES_ENABLED) {
-			ESP_LOGE(TAG, "Reset Lepton Radiometry Auto Resolution failed");
-			return false;
+	// Command complete
+	if (stepP->get_cmd == CCI_CMD_SYS_RUN_PING) {
+		// If the ping is successful, we assume further communication will be successful
+		check_phase = LEP_CHECK_PHASE_GET;
+	} else if (check_phase == LEP_CHECK_PHASE_SET) {
+		check_phase = LEP_CHECK_PHASE_VERIFY;
+		return LEP_CHECK_BUSY;
+	} else {
+		rsp = ((uint32_t) data[1] << 16) | data[0];
+		if (rsp != check_value) {
+			if (check_phase == LEP_CHECK_PHASE_VERIFY) {
+				return lepton_check_end(LEP_CHECK_FAIL, stepP->name);
+			}
+			ESP_LOGE(TAG, "Reset Lepton %s", stepP->name);
+			check_phase = LEP_CHECK_PHASE_SET;
+			return LEP_CHECK_BUSY;
 		}
+		check_phase = LEP_CHECK_PHASE_GET;
 	}
 	
-	// Check AGC disabled
-	rsp = cci_get_agc_enable_state();
-	if (rsp != CCI_AGC_DISABLED) {
-		ESP_LOGE(TAG, "Reset Lepton AGC");
-		cci_set_agc_enable_state(CCI_AGC_DISABLED);
-		rsp = cci_get_agc_enable_state();
-		if (rsp != CCI_AGC_DISABLED) {
-			ESP_LOGE(TAG, "Reset Lepton AGC failed");
-			return false;
-		}
+	// Setting is good, move to the next one
+	if (++check_step >= LEP_CHECK_NUM_STEPS) {
+		return lepton_check_end(LEP_CHECK_OK, NULL);
 	}
 	
-	// Check telemetry enabled
-	rsp = cci_get_telemetry_enable_state();
-	if (rsp != CCI_TELEMETRY_ENABLED) {
-		ESP_LOGE(TAG, "Reset Lepton Telemetry enable");
-		cci_set_telemetry_enable_state(CCI_TELEMETRY_ENABLED);
-		if (rsp != CCI_TELEMETRY_ENABLED) {
-			ESP_LOGE(TAG, "Reset Lepton Telemetry enable failed");
-			return false;
-		}
+	return LEP_CHECK_BUSY;
+}
+
+
+/**
+ * Take the next recovery step after lep_task loses the VoSPI stream: resynchronize,
+ * reboot or reset the lepton.  A running configuration check is abandoned for a reboot
+ * or reset (the lepton loses its configuration so lep_task checks it once it has
+ * booted).  Returns the stage used.
+ */
+int lepton_recover_stall()
+{
+	if (recover_stage == LEP_RECOVER_IDLE) {
+		recover_resyncs = 0;
+		recover_reboots = 0;
+		recover_start_usec = esp_timer_get_time();
 	}
 	
-	// Check gain mode matches persistent storage
-	ps_get_gui_state(&gui_state);
-	switch (gui_state.gain_mode) {
-		case SYS_GAIN_HIGH:
-			gain_mode = LEP_SYS_GAIN_MODE_HIGH;
-			break;
-		case SYS_GAIN_LOW:
-			gain_mode = LEP_SYS_GAIN_MODE_LOW;
-			break;
-		default:
-			gain_mode = LEP_SYS_GAIN_MODE_AUTO;
+	if (recover_resyncs < LEP_RECOVER_RESYNCS) {
+		recover_resyncs++;
+		recover_stage = LEP_RECOVER_RESYNC;
+		ESP_LOGI(TAG, "Recover lepton stream: resync");
+		vospi_resync();
+		return recover_stage;
 	}
-	rsp = cci_get_gain_mode();
-	if (rsp != (uint32_t) gain_mode) {
-		ESP_LOGE(TAG, "Reset Lepton Gain Mode");
-		cci_set_gain_mode(gain_mode);
-		rsp = cci_get_gain_mode();
-		if (rsp != (uint32_t) gain_mode) {
-			ESP_LOGE(TAG, "Reset Lepton Gain Mode failed");
-			return false;
-		}
+	
+	// Configuration commands can't complete while the lepton restarts
+	check_step = -1;
+	check_cmd_running = false;
+	
+#ifdef LEP_RESET_IO
+	if (recover_reboots >= LEP_RECOVER_REBOOTS) {
+		recover_reboots = 0;
+		recover_stage = LEP_RECOVER_RESET;
+		ESP_LOGI(TAG, "Recover lepton stream: reset");
+		gpio_set_level(LEP_RESET_IO, 0);
+		ets_delay_us(LEP_RECOVER_RESET_USEC);
+		gpio_set_level(LEP_RESET_IO, 1);
+		lepton_recover_restart();
+		return recover_stage;
 	}
+#endif
 	
-	// Make sure VSYNC is enabled on Lepton GPIO3
-	rsp = cci_get_gpio_mode();
-	if (rsp != LEP_OEM_GPIO_MODE_VSYNC) {
-		ESP_LOGE(TAG, "Reset Lepton GPIO Mode");
-		cci_set_gpio_mode(LEP_OEM_GPIO_MODE_VSYNC);
-		rsp = cci_get_gpio_mode();
-		if (rsp != LEP_OEM_GPIO_MODE_VSYNC) {
-			ESP_LOGE(TAG, "Reset Lepton GPIO Mode failed");
-			return false;
-		}
+	recover_reboots++;
+	recover_stage = LEP_RECOVER_REBOOT;
+	ESP_LOGI(TAG, "Recover lepton stream: reboot");
+	if (!cci_start_oem_reboot()) {
+		ESP_LOGE(TAG, "Could not send lepton reboot");
+	}
+	lepton_recover_restart();
+	return recover_stage;
+}
+
+
+/**
+ * Return true while waiting for the lepton to boot after a recovery reboot or reset.
+ * The CCI and VoSPI stream shouldn't be used until it has.
+ */
+bool lepton_recover_booting()
+{
+	return recover_booting;
+}
+
+
+/**
+ * Poll the lepton's boot status (at most every LEP_RECOVER_POLL_MSEC) while waiting for
+ * it to boot.  Returns true once when the wait ends, when lep_task should resynchronize
+ * VoSPI and restore the lepton configuration.  A lepton that doesn't boot in time is
+ * left to the next stall.
+ */
+bool lepton_recover_service()
+{
+	int64_t now;
+	
+	if (!recover_booting) return false;
+	
+	now = esp_timer_get_time();
+	if (now < recover_next_usec) return false;
+	recover_next_usec = now + (LEP_RECOVER_POLL_MSEC * 1000);
+	
+	if (cci_boot_ready()) {
+		ESP_LOGI(TAG, "Lepton booted after %d mSec", (int) ((now - recover_boot_usec) / 1000));
+	} else if ((now - recover_boot_usec) < (LEP_RECOVER_BOOT_MSEC * 1000)) {
+		return false;
+	} else {
+		ESP_LOGE(TAG, "Lepton did not boot");
 	}
 	
+	recover_booting = false;
 	return true;
 }
 
 
+/**
+ * Note a frame was received, ending any recovery
+ */
+void lepton_recover_done()
+{
+	if (recover_stage != LEP_RECOVER_IDLE) {
+		ESP_LOGI(TAG, "Lepton stream recovered after %d mSec",
+		         (int) ((esp_timer_get_time() - recover_start_usec) / 1000));
+		recover_stage = LEP_RECOVER_IDLE;
+		recover_booting = false;
+	}
+}
+
+
 void lepton_agc(bool en)
 {
 	if (en) {
@@ -276,26 +459,100 @@ void lepton_ffc()
 }
 
 
-void lepton_gain_mode(uint8_t mode)
+/**
+ * Set the lepton's gain mode (SYS_GAIN_xxx) and read it back.  Configuration checks
+ * expect (and restore) this mode once it has been set.  Returns false, leaving the
+ * previous mode expected, if the lepton could not be set.
+ */
+bool lepton_gain_mode(int mode)
 {
 	cc_gain_mode_t gain_mode;
+	uint32_t rsp;
 	
-	switch (mode) {
-		case SYS_GAIN_HIGH:
-			gain_mode = LEP_SYS_GAIN_MODE_HIGH;
-			break;
-		case SYS_GAIN_LOW:
-			gain_mode = LEP_SYS_GAIN_MODE_LOW;
-			break;
-		default:
-			gain_mode = LEP_SYS_GAIN_MODE_AUTO;
-	}
+	gain_mode = lepton_lep_gain_mode(mode);
 	cci_set_gain_mode(gain_mode);
+	rsp = cci_get_gain_mode();
+	if (rsp != (uint32_t) gain_mode) {
+		ESP_LOGE(TAG, "Set Lepton Gain Mode failed (%d)", rsp);
+		return false;
+	}
+	check_gain_mode = mode;
+	
+	return true;
 }
 
 
+/**
+ * Return true if a frame's telemetry shows it was made in gain mode (SYS_GAIN_xxx)
+ */
+bool lepton_gain_in_use(const lep_telem_t* telP, int mode)
+{
+	if (mode == SYS_GAIN_AUTO) {
+		return telP->gain_auto;
+	}
+	
+	return (!telP->gain_auto && (telP->gain_mode == (uint16_t) lepton_lep_gain_mode(mode)));
+}
+
+
+/**
+ * Select manual (en true) or automatic FFC mode.  The other shutter mode settings are
+ * left unchanged.  Returns false if the mode could not be set.
+ */
+bool lepton_ffc_manual(bool en)
+{
+	cci_ffc_shutter_mode_obj_t mode;
+	uint32_t shutter_mode;
+	
+	shutter_mode = en ? LEP_SYS_FFC_SHUTTER_MODE_MANUAL : LEP_SYS_FFC_SHUTTER_MODE_AUTO;
+	
+	if (!cci_get_ffc_shutter_mode(&mode)) return false;
+	if (mode.shutterMode != shutter_mode) {
+		mode.shutterMode = shutter_mode;
+		cci_set_ffc_shutter_mode(&mode);
+		if (!cci_get_ffc_shutter_mode(&mode)) return false;
+	}
+	ESP_LOGI(TAG, "Lepton FFC Mode = %d", mode.shutterMode);
+	
+	return (mode.shutterMode == shutter_mode);
+}
+
+
+/**
+ * Return true if a frame's telemetry shows the lepton needs a FFC: it is asking for
+ * one, its FPA temperature has drifted LEP_FFC_TEMP_DELTA_K100 since the last one or
+ * the last one was LEP_FFC_MAX_INTERVAL_SEC ago.  Returns false while a FFC is
+ * imminent or running.
+ */
+bool lepton_ffc_due(const lep_telem_t* telP)
+{
+	int32_t delta;
+	
+	if ((telP->ffc_state == LEP_FFC_STATE_IMM) || (telP->ffc_state == LEP_FFC_STATE_RUN)) {
+		return false;
+	}
+	if (telP->ffc_desired) return true;
+	
+	delta = (int32_t) telP->fpa_temp_k100 - (int32_t) telP->last_ffc_fpa_k100;
+	if (delta < 0) delta = -delta;
+	if (delta >= LEP_FFC_TEMP_DELTA_K100) return true;
+	
+	return ((telP->uptime_msec - telP->last_ffc_msec) >= (LEP_FFC_MAX_INTERVAL_SEC * 1000));
+}
+
+
+/**
+ * Set the spotmeter.  The coordinates are in the 160x120 frame and scaled down for a
+ * Lepton 2.x.
+ */
 void lepton_spotmeter(uint16_t r1, uint16_t c1, uint16_t r2, uint16_t c2)
 {
+	if (vospi_is_lepton2()) {
+		r1 /= 2;
+		c1 /= 2;
+		r2 /= 2;
+		c2 /= 2;
+	}
 	cci_set_radiometry_spotmeter(r1, c1, r2, c2);
 }
 
@@ -322,16 +579,221 @@ void lepton_emissivity(uint16_t e)
 }
 
 
-uint32_t lepton_get_tel_status(uint16_t* tel_buf)
+/**
+ * Decode the telemetry words in tel_buf into telP.  tel_buf is NULL for a frame without
+ * telemetry, which is given zero values and the default 0.01 K resolution.
+ */
+void lepton_decode_telem(const uint16_t* tel_buf, lep_telem_t* telP)
+{
+	if (tel_buf == NULL) {
+		memset(telP, 0, sizeof(lep_telem_t));
+		telP->tlin_scale = LEP_TLIN_SCALE_HIGH;
+		return;
+	}
+	
+	telP->frame_count = ((uint32_t) tel_buf[LEP_TEL_FC_HIGH] << 16) | tel_buf[LEP_TEL_FC_LOW];
+	telP->uptime_msec = ((uint32_t) tel_buf[LEP_TEL_TC_HIGH] << 16) | tel_buf[LEP_TEL_TC_LOW];
+	telP->status = ((uint32_t) tel_buf[LEP_TEL_STATUS_HIGH] << 16) | tel_buf[LEP_TEL_STATUS_LOW];
+	telP->ffc_state = telP->status & LEP_STATUS_FFC_STATE;
+	telP->ffc_desired = (telP->status & LEP_STATUS_FFC_DESIRED) != 0;
+	telP->last_ffc_msec = ((uint32_t) tel_buf[LEP_TEL_LAST_TC_HIGH] << 16) | tel_buf[LEP_TEL_LAST_TC_LOW];
+	telP->fpa_temp_k100 = tel_buf[LEP_TEL_FPA_T_K100];
+	telP->aux_temp_k100 = tel_buf[LEP_TEL_HSE_T_K100];
+	telP->last_ffc_fpa_k100 = tel_buf[LEP_TEL_LAST_FPA_T];
+	
+	// In auto gain mode the effective mode is the one in use
+	telP->gain_auto = (tel_buf[LEP_TEL_GAIN_MODE] == LEP_SYS_GAIN_MODE_AUTO);
+	telP->gain_mode = telP->gain_auto ? tel_buf[LEP_TEL_EFF_GAIN_MODE] : tel_buf[LEP_TEL_GAIN_MODE];
+	
+	telP->tlin_scale = (tel_buf[LEP_TEL_TLIN_RES] == 0) ? LEP_TLIN_SCALE_LOW : LEP_TLIN_SCALE_HIGH;
+}
+
+
+/**
+ * Return the number of K * 100 units per TLinear pixel count for a frame (the default
+ * 0.01 K resolution is assumed for a frame without telemetry)
+ */
+int lepton_get_tlin_scale(const lep_buffer_t* lepP)
+{
+	return lepP->telem_valid ? lepP->telem.tlin_scale : LEP_TLIN_SCALE_HIGH;
+}
+
+
+/**
+ * Convert a temperature in K * 100 to C * 100
+ */
+int32_t lepton_k100_to_c100(uint32_t k100)
+{
+	return (int32_t) k100 - LEP_K100_0C;
+}
+
+
+/**
+ * Convert n TLinear pixels in src to K * 100 in dst using the scale from
+ * lepton_get_tlin_scale
+ */
+void lepton_pixels_to_k100(const uint16_t* src, uint32_t* dst, int n, int scale)
+{
+	const uint16_t* endP = src + n;
+	
+	if (scale == LEP_TLIN_SCALE_HIGH) {
+		while (src < endP) {
+			*dst++ = *src++;
+		}
+	} else {
+		while (src < endP) {
+			*dst++ = (uint32_t) *src++ * scale;
+		}
+	}
+}
+
+
+/**
+ * Convert n TLinear pixels in src to C * 100 in dst using the scale from
+ * lepton_get_tlin_scale
+ */
+void lepton_pixels_to_c100(const uint16_t* src, int32_t* dst, int n, int scale)
+{
+	const uint16_t* endP = src + n;
+	
+	while (src < endP) {
+		*dst++ = ((int32_t) *src++ * scale) - LEP_K100_0C;
+	}
+}
+
+
+/**
+ * Load cropP with the region of the radiometric data to record and stream.  It is the
+ * whole frame unless a crop is configured.  Returns true if the data is cropped.
+ */
+bool lepton_get_crop(sys_lep_roi_t* cropP)
+{
+	*cropP = gui_st.lep_crop;
+	if ((cropP->w == 0) || (cropP->h == 0) ||
+	    ((cropP->x + cropP->w) > LEP_WIDTH) || ((cropP->y + cropP->h) > LEP_HEIGHT))
+	{
+		cropP->x = 0;
+		cropP->y = 0;
+		cropP->w = LEP_WIDTH;
+		cropP->h = LEP_HEIGHT;
+	}
+	
+	return !lepton_crop_is_full(cropP);
+}
+
+
+/**
+ * Return true if the crop is the whole frame
+ */
+bool lepton_crop_is_full(const sys_lep_roi_t* cropP)
+{
+	return (cropP->w == LEP_WIDTH) && (cropP->h == LEP_HEIGHT);
+}
+
+
+/**
+ * Copy the cropped region of the frame in src into dst row by row
+ */
+void lepton_crop_copy(const uint16_t* src, const sys_lep_roi_t* cropP, uint16_t* dst)
+{
+	const uint16_t* rowP = src + cropP->y * LEP_WIDTH + cropP->x;
+	int i;
+	
+	for (i=0; i<cropP->h; i++) {
+		memcpy(dst, rowP, cropP->w * 2);
+		dst += cropP->w;
+		rowP += LEP_WIDTH;
+	}
+}
+
+
+/**
+ * Expand the cropped region at the start of buf in place into a full frame.  Pixels
+ * outside the region are set to its minimum so they don't change the frame's range.
+ */
+void lepton_crop_expand(uint16_t* buf, const sys_lep_roi_t* cropP)
+{
+	uint16_t* srcP;
+	uint16_t* dstP;
+	uint16_t min_val = 0xFFFF;
+	int i, n;
+	
+	n = cropP->w * cropP->h;
+	for (i=0; i<n; i++) {
+		if (buf[i] < min_val) min_val = buf[i];
+	}
+	
+	// From the last row so rows aren't overwritten before they are moved
+	for (i=cropP->h-1; i>=0; i--) {
+		srcP = buf + i * cropP->w;
+		dstP = buf + (cropP->y + i) * LEP_WIDTH + cropP->x;
+		memmove(dstP, srcP, cropP->w * 2);
+	}
+	
+	for (i=0; i<LEP_HEIGHT; i++) {
+		dstP = buf + i * LEP_WIDTH;
+		for (n=0; n<LEP_WIDTH; n++) {
+			if ((i < cropP->y) || (i >= (cropP->y + cropP->h)) ||
+			    (n < cropP->x) || (n >= (cropP->x + cropP->w)))
+			{
+				dstP[n] = min_val;
+			}
+		}
+	}
+}
+
+
+
+//
+// Lepton Utilities internal functions
+//
+
+/**
+ * Finish the running check, logging the step that failed
+ */
+static int lepton_check_end(int res, const char* name)
 {
-	return (tel_buf[LEP_TEL_STATUS_HIGH] << 16) | tel_buf[LEP_TEL_STATUS_LOW];
+	if (res == LEP_CHECK_FAIL) {
+		ESP_LOGE(TAG, "Lepton check %s failed", name);
+	}
+	check_step = -1;
+	check_cmd_running = false;
+	
+	return res;
 }
 
 
 /**
- * Convert a temperature reading from the lepton (in units of K * 100) to C
+ * Start waiting for the lepton to boot after a reboot or reset
  */
-float lepton_kelvin_to_C(uint16_t k, float lep_res)
+static void lepton_recover_restart()
 {
-	return (((float) k) * lep_res) - 273.15;
+	recover_booting = true;
+	recover_boot_usec = esp_timer_get_time();
+	recover_next_usec = recover_boot_usec + (LEP_RECOVER_HOLD_MSEC * 1000);
+}
+
+
+/**
+ * Return the lepton gain mode the check expects
+ */
+static uint32_t lepton_check_gain_mode()
+{
+	return (uint32_t) lepton_lep_gain_mode(check_gain_mode);
+}
+
+
+/**
+ * Return the lepton gain mode for a SYS_GAIN_xxx mode
+ */
+static cc_gain_mode_t lepton_lep_gain_mode(int mode)
+{
+	switch (mode) {
+		case SYS_GAIN_HIGH:
+			return LEP_SYS_GAIN_MODE_HIGH;
+		case SYS_GAIN_LOW:
+			return LEP_SYS_GAIN_MODE_LOW;
+		default:
+			return LEP_SYS_GAIN_MODE_AUTO;
+	}
 }
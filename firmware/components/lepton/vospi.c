@@ -29,12 +29,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include "esp_system.h"
+#include "esp_attr.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "driver/spi_master.h"
 #include "system_config.h"
+#include "lepton_utilities.h"
 #include "vospi.h"
 
 
@@ -50,21 +52,41 @@ static const char* TAG = "vospi";
 static spi_device_handle_t spi;
 static spi_transaction_t lep_spi_trans;
 
-// Pointer to allocated array to store one Lepton packet (DMA capable)
-static uint8_t* lepPacketP;
+// Pointer to allocated array to store a burst of Lepton packets (DMA capable)
+static uint8_t* lepBurstP;
 
-// Lepton Frame buffer (16-bit values)
-static uint16_t lepBuffer[LEP_NUM_PIXELS];
-
-// Lepton Telemetry buffer (16-bit values)
-static uint16_t lepTelem[LEP_TEL_WORDS];
+// Frame pool buffer currently being filled with lepton image and telemetry data
+static lep_buffer_t* lepFrameP = NULL;
 
 // Processing State
 static int curSegment = 1;
-static int curLinesPerSeg = LEP_NOTEL_PKTS_PER_SEG;
-static int curWordsPerSeg = LEP_NOTEL_WORDS_PER_SEG;
 static bool validSegmentRegion = false;
 static bool includeTelemetry = false;
+static bool includeHistogram = false;
+static bool includeImage = true;
+static bool isLepton2 = false;
+
+// Read error accounting
+static vospi_stats_t vospiStats;
+
+// Packet CRC lookup table (built by vospi_init)
+static DRAM_ATTR uint16_t crcTable[256];
+
+// Per-segment image statistics accumulated as packets arrive
+static uint16_t segMin[4];
+static uint16_t segMax[4];
+static uint16_t segHist[4][LEP_HIST_BINS];
+
+#ifdef INCLUDE_VOSPI_CAPTURE
+// Raw packet capture ring - loaded here, emptied by file_task
+static vospi_cap_record_t* capRingP = NULL;
+static int capHead;                     // Next record to write to the file
+static int capTail;                     // Next record to load
+static int capCount;
+static uint32_t capSeq;
+static uint32_t capOverruns;
+static portMUX_TYPE capMux = portMUX_INITIALIZER_UNLOCKED;
+#endif
 
 
 
@@ -72,9 +94,24 @@ static bool includeTelemetry = false;
 //
 // VoSPI Forward Declarations for internal functions
 //
-static bool transfer_packet(uint8_t* line, uint8_t* seg);
-static void copy_packet_to_lepton_buffer(uint8_t line);
-static void copy_packet_to_telem_buffer(uint8_t line);
+static bool IRAM_ATTR transfer_segment_telem(uint64_t vsyncDetectedUsec);
+static bool IRAM_ATTR transfer_segment_notelem(uint64_t vsyncDetectedUsec);
+static inline bool transfer_segment(uint64_t vsyncDetectedUsec, const bool telem) __attribute__((always_inline));
+static bool IRAM_ATTR transfer_frame_lep2(uint64_t vsyncDetectedUsec);
+static void SYS_HOT_IRAM_ATTR transfer_burst();
+static void note_read_error(enum LeptonReadError err);
+static inline bool parse_packet(uint8_t* pktP, uint8_t* line, uint8_t* seg) __attribute__((always_inline));
+static inline bool packet_crc_valid(const uint8_t* pktP) __attribute__((always_inline));
+static void init_crc_table();
+static inline void copy_packet_to_lepton_buffer(uint8_t* pktP, uint8_t line, const int wordsPerSeg) __attribute__((always_inline));
+static void SYS_HOT_IRAM_ATTR copy_packet_to_telem_buffer(uint8_t* pktP, uint8_t line);
+static inline void copy_lep2_packet_to_lepton_buffer(uint8_t* pktP, uint8_t line) __attribute__((always_inline));
+#ifdef INCLUDE_VOSPI_CAPTURE
+static void capture_burst(uint64_t vsyncDetectedUsec);
+#endif
+
+// Segment parser for the current telemetry mode (set by vospi_include_telem)
+static bool (*transferSegmentFn)(uint64_t vsyncDetectedUsec) = transfer_segment_notelem;
 
 
 
@@ -100,17 +137,27 @@ int vospi_init()
 		.cs_ena_pretrans = 10
 	};
 
+	init_crc_table();
+	
 	if ((ret=spi_bus_add_device(LEP_SPI_HOST, &devcfg, &spi)) != ESP_OK) {
 		ESP_LOGE(TAG, "failed to add lepton spi device");
 	} else {
-		// Allocate DMA capable memory for the lepton packet
-		lepPacketP = (uint8_t*) heap_caps_malloc(LEP_PKT_LENGTH, MALLOC_CAP_DMA);
-		if (lepPacketP != NULL) {
+		// Allocate DMA capable memory for the lepton packet burst
+		lepBurstP = (uint8_t*) heap_caps_malloc(LEP_BURST_LENGTH, MALLOC_CAP_DMA);
+		if (lepBurstP != NULL) {
 			ret = ESP_OK;
 		} else {
-			ESP_LOGE(TAG, "failed to allocate lepton DMA packet buffer");
+			ESP_LOGE(TAG, "failed to allocate lepton DMA burst buffer");
 			ret = ESP_FAIL;
 		}
+		
+#ifdef INCLUDE_VOSPI_CAPTURE
+		// Capture is optional so failing to get the ring isn't fatal
+		capRingP = (vospi_cap_record_t*) heap_caps_malloc(VOSPI_CAP_RING_LEN * sizeof(vospi_cap_record_t), MALLOC_CAP_SPIRAM);
+		if (capRingP == NULL) {
+			ESP_LOGE(TAG, "failed to allocate capture ring - capture disabled");
+		}
+#endif
 	}
 
 	return ret;
@@ -119,29 +166,297 @@ int vospi_init()
 
 /**
  * Attempt to read a complete segment from the Lepton
- *  - Data loaded into lepBuffer
+ *  - Data loaded into the current frame buffer
  *  - Returns true when last successful segment read, false otherwise
+ *
+ * Packets are read in bursts of LEP_PKTS_PER_BURST using one DMA transaction per burst
+ * and then parsed individually.  Reading past the end of a segment only consumes
+ * discard packets.  If nothing but discard packets are seen for LEP_MAX_DISCARD_BURSTS
+ * bursts after vsync we give up early since the lepton is not outputting this segment
+ * (e.g. during a FFC or when we are out of sync).
+ */
+bool SYS_HOT_IRAM_ATTR vospi_transfer_segment(uint64_t vsyncDetectedUsec)
+{
+	return transferSegmentFn(vsyncDetectedUsec);
+}
+
+
+/**
+ * Set the frame pool buffer the pipeline fills.  This must be done before the first
+ * call to vospi_transfer_segment().
+ */
+void vospi_set_frame(lep_buffer_t* bufP)
+{
+	lepFrameP = bufP;
+}
+
+
+/**
+ * Complete the frame just acquired by vospi_transfer_segment() and hand it to the
+ * caller by pointer, switching the pipeline to fill bufP next.  The returned buffer
+ * is owned by the caller.
+ */
+lep_buffer_t* vospi_get_frame(lep_buffer_t* bufP)
+{
+	lep_buffer_t* doneP = lepFrameP;
+	uint16_t min = 0xFFFF;
+	uint16_t max = 0x0000;
+	int i, j;
+
+	// Combine the per-segment image statistics
+	for (i=0; i<4; i++) {
+		if (segMin[i] < min) min = segMin[i];
+		if (segMax[i] > max) max = segMax[i];
+	}
+	doneP->lep_min_val = min;
+	doneP->lep_max_val = max;
+	
+	doneP->hist_valid = includeHistogram;
+	if (includeHistogram) {
+		for (j=0; j<LEP_HIST_BINS; j++) {
+			doneP->lep_hist[j] = segHist[0][j] + segHist[1][j] + segHist[2][j] + segHist[3][j];
+		}
+	}
+	
+	// Decode the telemetry once for every consumer of the frame
+	doneP->telem_valid = includeTelemetry;
+	lepton_decode_telem(includeTelemetry ? doneP->lep_telemP : NULL, &doneP->telem);
+	
+	// Swap in the new buffer
+	lepFrameP = bufP;
+	
+	return doneP;
+}
+
+
+/**
+ * Copy the telemetry from the frame just acquired by vospi_transfer_segment() without
+ * handing off the frame buffer (used when only telemetry is being collected)
+ */
+void vospi_get_telem(uint16_t* telemP)
+{
+	memcpy(telemP, lepFrameP->lep_telemP, LEP_TEL_WORDS*2);
+}
+
+
+/**
+ * Resynchronize with the VoSPI stream by leaving CS de-asserted and the clock idle
+ * for the lepton re-sync period.  The pipeline restarts looking for segment 1.
+ */
+void vospi_resync()
+{
+	vospiStats.resyncs++;
+	curSegment = 1;
+	validSegmentRegion = false;
+	vTaskDelay(pdMS_TO_TICKS(LEP_RESYNC_MSEC));
+}
+
+
+/**
+ * Return a copy of the read error and frame counters
+ */
+void vospi_get_stats(vospi_stats_t* stats)
+{
+	*stats = vospiStats;
+}
+
+
+/**
+ * Clear the read error and frame counters
+ */
+void vospi_reset_stats()
+{
+	memset(&vospiStats, 0, sizeof(vospi_stats_t));
+}
+
+
+/**
+ * Configure the pipeline to include telemetry or not.
+ * This should be done during initialization
+ */
+void vospi_include_telem(bool en)
+{
+	includeTelemetry = en;
+	if (isLepton2) {
+		transferSegmentFn = transfer_frame_lep2;
+	} else {
+		transferSegmentFn = (en) ? transfer_segment_telem : transfer_segment_notelem;
+	}
+}
+
+
+/**
+ * Configure the pipeline to load image data or not.  Telemetry is still collected
+ * when image data is skipped.
+ */
+void vospi_include_image(bool en)
+{
+	includeImage = en;
+}
+
+
+/**
+ * Configure the pipeline to compute a coarse histogram of each frame or not.
+ */
+void vospi_include_histogram(bool en)
+{
+	includeHistogram = en;
+}
+
+
+/**
+ * Configure the pipeline for a Lepton 2.x (one 80x60 frame per vsync) or Lepton 3.x
+ * (four 160x120 frame segments) stream.  This should be done during initialization.
+ */
+void vospi_set_lepton2(bool en)
+{
+	isLepton2 = en;
+	vospi_include_telem(includeTelemetry);
+}
+
+
+/**
+ * Return true when the pipeline is reading a Lepton 2.x stream
+ */
+bool vospi_is_lepton2()
+{
+	return isLepton2;
+}
+
+
+
+#ifdef INCLUDE_VOSPI_CAPTURE
+/**
+ * Point recP to the oldest captured records and return how many are contiguous in the
+ * ring (0 if there are none).  The records stay valid until vospi_capture_consume().
+ */
+int vospi_capture_peek(vospi_cap_record_t** recP)
+{
+	int n;
+	
+	portENTER_CRITICAL(&capMux);
+	n = capCount;
+	if (n > (VOSPI_CAP_RING_LEN - capHead)) n = VOSPI_CAP_RING_LEN - capHead;
+	*recP = &capRingP[capHead];
+	portEXIT_CRITICAL(&capMux);
+	
+	return n;
+}
+
+
+/**
+ * Free the n oldest captured records
+ */
+void vospi_capture_consume(int n)
+{
+	portENTER_CRITICAL(&capMux);
+	if (n > capCount) n = capCount;
+	capHead = (capHead + n) % VOSPI_CAP_RING_LEN;
+	capCount -= n;
+	portEXIT_CRITICAL(&capMux);
+}
+
+
+/**
+ * Return the number of bursts dropped because the ring was full
+ */
+uint32_t vospi_capture_get_overruns()
+{
+	uint32_t n;
+	
+	portENTER_CRITICAL(&capMux);
+	n = capOverruns;
+	portEXIT_CRITICAL(&capMux);
+	
+	return n;
+}
+#endif
+
+
+
+//
+// VoSPI Forward Declarations for internal functions
+//
+
+/**
+ * Segment parsers specialized for each telemetry mode so the per-packet line tests and
+ * buffer index math use constants.  They run from IRAM with the packet parse and copy
+ * inlined.
+ */
+static bool IRAM_ATTR transfer_segment_telem(uint64_t vsyncDetectedUsec)
+{
+	return transfer_segment(vsyncDetectedUsec, true);
+}
+
+
+static bool IRAM_ATTR transfer_segment_notelem(uint64_t vsyncDetectedUsec)
+{
+	return transfer_segment(vsyncDetectedUsec, false);
+}
+
+
+/**
+ * Read a segment (see vospi_transfer_segment) with telemetry at the end of the frame
+ * when telem is set.  Only called with a constant telem.
  */
-bool vospi_transfer_segment(uint64_t vsyncDetectedUsec)
+static inline bool transfer_segment(uint64_t vsyncDetectedUsec, const bool telem)
 {
 	uint8_t line, prevLine;
 	uint8_t segment;
+	uint8_t* pktP;
 	bool done = false;
 	bool beforeValidData = true;
+	bool sawValidPacket;
+	bool sawAnyValidPacket = false;
 	bool success = false;
+	int discardBursts = 0;
+	int i;
+	const int linesPerSeg = (telem) ? LEP_TEL_PKTS_PER_SEG : LEP_NOTEL_PKTS_PER_SEG;
+	const int wordsPerSeg = (telem) ? LEP_TEL_WORDS_PER_SEG : LEP_NOTEL_WORDS_PER_SEG;
 
 	prevLine = 255;
 
 	while (!done) {
-		if (transfer_packet(&line, &segment)) {
+		transfer_burst();
+#ifdef INCLUDE_VOSPI_CAPTURE
+		capture_burst(vsyncDetectedUsec);
+#endif
+		sawValidPacket = false;
+		
+		for (i=0; (i<LEP_PKTS_PER_BURST) && !done; i++) {
+			pktP = lepBurstP + (i * LEP_PKT_LENGTH);
+			
+			if (!parse_packet(pktP, &line, &segment)) {
+				// Discard packet
+				note_read_error(DISCARD);
+				continue;
+			}
+			
+			if (!packet_crc_valid(pktP)) {
+				// Corrupted line (SPI glitch) so drop the frame in progress and start
+				// over with the next segment 1 rather than storing bad data
+				note_read_error(CRC_ERROR);
+				validSegmentRegion = false;
+				curSegment = 1;
+				done = true;
+				continue;
+			}
+			sawValidPacket = true;
+			sawAnyValidPacket = true;
+			
 			// Saw a valid packet
 			if (line == prevLine) {
-			// This is garbage data since line numbers should always increment
-			done = true;
+				// This is garbage data since line numbers should always increment
+				note_read_error(ROW_ERROR);
+				done = true;
 			} else {
 				// Check for termination or completion conditions
 				if (line == 20) {
 					// Check segment
+					if (segment == 0) {
+						// Lepton is flagging this segment as invalid
+						note_read_error(SEGMENT_INVALID);
+					}
 					if (!validSegmentRegion) {
 						// Look for start of valid segment data
 						if (segment == 1) {
@@ -150,6 +465,9 @@ bool vospi_transfer_segment(uint64_t vsyncDetectedUsec)
 						}
 					} else if ((segment < 2) || (segment > 4)) {
 						// Hold/Reset in starting position (always collecting in segment 1 buffer locations)
+						if (segment != 0) {
+							note_read_error(SEGMENT_ERROR);
+						}
 						validSegmentRegion = false;  // In case it was set
 						curSegment = 1;
 					}
@@ -158,14 +476,14 @@ bool vospi_transfer_segment(uint64_t vsyncDetectedUsec)
 				// Copy the data to the lepton frame buffer or telemetry buffer
 				//  - beforeValidData is used to collect data before we know if the current segment (1) is valid
 				//  - then we use validSegmentRegion for remaining data once we know we're seeing valid data
-				if (includeTelemetry && validSegmentRegion && (curSegment == 4) && (line >= 57)) {
-					copy_packet_to_telem_buffer(line - 57);
+				if (telem && validSegmentRegion && (curSegment == 4) && (line >= 57)) {
+					copy_packet_to_telem_buffer(pktP, line - 57);
 				}
-				else if ((beforeValidData || validSegmentRegion) && (line < curLinesPerSeg)) {
-					copy_packet_to_lepton_buffer(line);
+				else if (includeImage && (beforeValidData || validSegmentRegion) && (line < linesPerSeg)) {
+					copy_packet_to_lepton_buffer(pktP, line, wordsPerSeg);
 				}
 	
-				if (line == (curLinesPerSeg-1)) {
+				if (line == (linesPerSeg-1)) {
 					// Saw a complete segment, move to next segment or complete frame aquisition if possible
 					if (validSegmentRegion) {
 						if (curSegment < 4) {
@@ -174,6 +492,7 @@ bool vospi_transfer_segment(uint64_t vsyncDetectedUsec)
 						} else {
 							// Got frame
 							success = true;
+							vospiStats.frames++;
 
 							// Setup to get the next frame
 							curSegment = 1;
@@ -184,9 +503,16 @@ bool vospi_transfer_segment(uint64_t vsyncDetectedUsec)
 				}
 			}
 			prevLine = line;
-		} else if ((esp_timer_get_time() - vsyncDetectedUsec) > LEP_MAX_FRAME_XFER_WAIT_USEC) {
-			// Did not see a valid packet within this segment interval
-      		done = true;
+		}
+		
+		if (!done && !sawValidPacket) {
+			if (!sawAnyValidPacket && (++discardBursts >= LEP_MAX_DISCARD_BURSTS)) {
+				// Lepton isn't outputting this segment so don't waste time waiting for it
+				done = true;
+			} else if ((esp_timer_get_time() - vsyncDetectedUsec) > LEP_MAX_FRAME_XFER_WAIT_USEC) {
+				// Did not see a valid packet within this segment interval
+      			done = true;
+      		}
     	}
 	}
 	
@@ -195,118 +521,341 @@ bool vospi_transfer_segment(uint64_t vsyncDetectedUsec)
 
 
 /**
- * Load the a system buffer from our buffers for another task
+ * Read a Lepton 2.x frame.  The frame is sent as consecutive lines starting at line 0
+ * (discard packets may be interleaved) so any other line number means we are not
+ * synchronized with the frame.  Returns true when a complete frame was read.
  */
-void vospi_get_frame(lep_buffer_t* sys_bufP)
+static bool IRAM_ATTR transfer_frame_lep2(uint64_t vsyncDetectedUsec)
 {
-	uint16_t* sptr = sys_bufP->lep_bufferP;
-	uint16_t* lptr = &lepBuffer[0];
-	uint16_t min = 0xFFFF;
-	uint16_t max = 0x0000;
-	uint16_t t16;
-
-	// Load lepton image data
-	while (lptr < &lepBuffer[LEP_NUM_PIXELS]) {
-		t16 = *lptr++;
-		if (t16 < min) min = t16;
-		if (t16 > max) max = t16;
-		*sptr++ = t16;
-	}
-	sys_bufP->lep_min_val = min;
-	sys_bufP->lep_max_val = max;
+	uint8_t line, prevLine;
+	uint8_t segment;
+	uint8_t* pktP;
+	bool done = false;
+	bool sawValidPacket;
+	bool sawAnyValidPacket = false;
+	bool success = false;
+	int discardBursts = 0;
+	int i;
+	int lines = (includeTelemetry) ? LEP2_TEL_PKTS_PER_FRAME : LEP2_HEIGHT;
 	
-	// Optionally load telemetry
-	sys_bufP->telem_valid = includeTelemetry;
-	if (includeTelemetry) {
-		sptr = sys_bufP->lep_telemP;
-		lptr = &lepTelem[0];
-		while (lptr < &lepTelem[LEP_TEL_WORDS]) {
-			*sptr++ = *lptr++;
+	prevLine = 255;
+	
+	while (!done) {
+		transfer_burst();
+#ifdef INCLUDE_VOSPI_CAPTURE
+		capture_burst(vsyncDetectedUsec);
+#endif
+		sawValidPacket = false;
+		
+		for (i=0; (i<LEP_PKTS_PER_BURST) && !done; i++) {
+			pktP = lepBurstP + (i * LEP_PKT_LENGTH);
+			
+			if (!parse_packet(pktP, &line, &segment)) {
+				note_read_error(DISCARD);
+				continue;
+			}
+			
+			if (!packet_crc_valid(pktP)) {
+				note_read_error(CRC_ERROR);
+				done = true;
+				continue;
+			}
+			sawValidPacket = true;
+			sawAnyValidPacket = true;
+			
+			if ((line != (uint8_t) (prevLine + 1)) || (line >= lines)) {
+				note_read_error(ROW_ERROR);
+				done = true;
+				continue;
+			}
+			
+			if (line >= LEP2_HEIGHT) {
+				copy_packet_to_telem_buffer(pktP, line - LEP2_HEIGHT);
+			} else if (includeImage) {
+				copy_lep2_packet_to_lepton_buffer(pktP, line);
+			}
+			
+			if (line == (lines-1)) {
+				success = true;
+				vospiStats.frames++;
+				done = true;
+			}
+			prevLine = line;
+		}
+		
+		if (!done && !sawValidPacket) {
+			if (!sawAnyValidPacket && (++discardBursts >= LEP_MAX_DISCARD_BURSTS)) {
+				done = true;
+			} else if ((esp_timer_get_time() - vsyncDetectedUsec) > LEP2_MAX_FRAME_XFER_WAIT_USEC) {
+				done = true;
+			}
 		}
 	}
+	
+	return success;
 }
 
 
 /**
- * Configure the pipeline to include telemetry or not.
- * This should be done during initialization
+ * Read a burst of LEP_PKTS_PER_BURST packets from the lepton into lepBurstP
  */
-void vospi_include_telem(bool en)
+static void SYS_HOT_IRAM_ATTR transfer_burst()
 {
-	includeTelemetry = en;
-	curLinesPerSeg = (en) ? LEP_TEL_PKTS_PER_SEG : LEP_NOTEL_PKTS_PER_SEG;
-	curWordsPerSeg = (en) ? LEP_TEL_WORDS_PER_SEG : LEP_NOTEL_WORDS_PER_SEG;
+	esp_err_t ret;
+	
+	// Setup our SPI transaction
+	memset(&lep_spi_trans, 0, sizeof(spi_transaction_t));
+	lep_spi_trans.tx_buffer = NULL;
+	lep_spi_trans.rx_buffer = lepBurstP;
+	lep_spi_trans.rxlength = LEP_BURST_LENGTH*8;
+
+	/************************************************************************************/
+    /* Note: queued transactions cause a panic when a task yields and I can't figure    */
+    /* it out.  Disabling queuing gets rid of the panic at some performance hit.  The   */
+    /* burst reads amortize the per-transaction driver overhead across several packets. */
+    /************************************************************************************/
+	// Get the packets using the interrupt method and DMA engine to free the CPU some
+	ret = spi_device_transmit(spi, &lep_spi_trans);
+	ESP_ERROR_CHECK(ret);
 }
 
 
+#ifdef INCLUDE_VOSPI_CAPTURE
+/**
+ * Copy the burst just read into the capture ring.  The burst is dropped if the ring
+ * is full.  Only this function loads the ring so the tail record can't change while
+ * it is being filled.
+ */
+static void capture_burst(uint64_t vsyncDetectedUsec)
+{
+	vospi_cap_record_t* recP;
+	uint32_t burstUsec;
+	bool full;
+	
+	if (capRingP == NULL) return;
+	
+	burstUsec = (uint32_t) esp_timer_get_time();
+	
+	portENTER_CRITICAL(&capMux);
+	full = (capCount == VOSPI_CAP_RING_LEN);
+	if (full) capOverruns++;
+	portEXIT_CRITICAL(&capMux);
+	
+	if (!full) {
+		recP = &capRingP[capTail];
+		recP->magic = VOSPI_CAP_MAGIC;
+		recP->seq = capSeq;
+		recP->vsync_usec = (uint32_t) vsyncDetectedUsec;
+		recP->burst_usec = burstUsec;
+		memcpy(recP->pkt, lepBurstP, LEP_BURST_LENGTH);
+		
+		portENTER_CRITICAL(&capMux);
+		if (++capTail == VOSPI_CAP_RING_LEN) capTail = 0;
+		capCount++;
+		portEXIT_CRITICAL(&capMux);
+	}
+	capSeq++;
+}
+#endif
 
-//
-// VoSPI Forward Declarations for internal functions
-//
 
 /**
- * Attempt to read one packet from the lepton
+ * Account for a read error
+ */
+static void note_read_error(enum LeptonReadError err)
+{
+	switch (err) {
+		case DISCARD:
+			vospiStats.discards++;
+			break;
+		case SEGMENT_ERROR:
+			vospiStats.segment_errors++;
+			break;
+		case ROW_ERROR:
+			vospiStats.row_errors++;
+			break;
+		case SEGMENT_INVALID:
+			vospiStats.segment_invalids++;
+			break;
+		case CRC_ERROR:
+			vospiStats.crc_errors++;
+			break;
+		default:
+			break;
+	}
+}
+
+
+/**
+ * Parse one packet from a burst
  *  - Return false for discard packets
  *  - Return true otherwise
  *    - line contains the packet line number for all valid packets
  *    - seg contains the packet segment number if the line number is 20
  */
-static bool transfer_packet(uint8_t* line, uint8_t* seg)
+static inline bool parse_packet(uint8_t* pktP, uint8_t* line, uint8_t* seg)
 {
-	bool valid = false;
-	esp_err_t ret;
-
 	// *seg will be set if possible
 	*seg = 0;
+  
+	// Discard packets have 0xF in the ID field
+	if ((*pktP & 0x0F) == 0x0F) {
+		return false;
+	}
+	
+	*line = *(pktP + 1);
 
-	// Setup our SPI transaction
-	memset(&lep_spi_trans, 0, sizeof(spi_transaction_t));
-	lep_spi_trans.tx_buffer = NULL;
-	lep_spi_trans.rx_buffer = lepPacketP;
-	lep_spi_trans.rxlength = LEP_PKT_LENGTH*8;
+	// Get segment when possible
+	if (*line == 20) {
+		*seg = (*pktP >> 4);
+	}
 
-	/************************************************************************************/
-    /* Note: queued transactions cause a panic when a task yields and I can't figure    */
-    /* it out.  Disabling queuing gets rid of the panic at some performance hit.        */
-    /************************************************************************************/
-	// Get a packet using the interrupt method and DMA engine to free the CPU some
-	//ret = spi_device_polling_transmit(spi, &lep_spi_trans);
-	ret = spi_device_transmit(spi, &lep_spi_trans);
-	ESP_ERROR_CHECK(ret);
-  
-	// Repeat as long as the frame is not valid, equals sync
-	if ((*lepPacketP & 0x0F) == 0x0F) {
-		valid = false;
-	} else {
-		*line = *(lepPacketP + 1);
+	return true;
+}
 
-		// Get segment when possible
-		if (*line == 20) {
-			*seg = (*lepPacketP >> 4);
-		}
 
-		valid = true;
+/**
+ * Check a packet's CRC
+ */
+static inline bool packet_crc_valid(const uint8_t* pktP)
+{
+	uint16_t crc;
+	int i;
+	
+	// ID field with the high nibble masked, then the zeroed CRC field
+	crc = crcTable[pktP[0] & 0x0F];
+	crc = (crc << 8) ^ crcTable[(crc >> 8) ^ pktP[1]];
+	crc = (crc << 8) ^ crcTable[crc >> 8];
+	crc = (crc << 8) ^ crcTable[crc >> 8];
+	
+	for (i=4; i<LEP_PKT_LENGTH; i++) {
+		crc = (crc << 8) ^ crcTable[(crc >> 8) ^ pktP[i]];
 	}
+	
+	return (crc == ((pktP[2] << 8) | pktP[3]));
+}
+
 
-	return(valid);
+/**
+ * Build the packet CRC lookup table
+ */
+static void init_crc_table()
+{
+	uint16_t crc;
+	int i, j;
+	
+	for (i=0; i<256; i++) {
+		crc = i << 8;
+		for (j=0; j<8; j++) {
+			crc = (crc & 0x8000) ? ((crc << 1) ^ LEP_CRC_POLY) : (crc << 1);
+		}
+		crcTable[i] = crc;
+	}
 }
 
 
 /**
- * Copy the lepton packet to the raw lepton frame
+ * Copy the lepton packet to the raw lepton frame, byte-swapping the pixels and
+ * updating the current segment's statistics as we go
  *   - line specifies packet line number
+ *   - wordsPerSeg is the constant segment size for the parser's telemetry mode
+ *   - 32-bit accesses are safe since packets start on 4-byte boundaries in the burst
+ *     buffer and each line starts on an even pixel
  */
-static void copy_packet_to_lepton_buffer(uint8_t line)
+static inline void copy_packet_to_lepton_buffer(uint8_t* pktP, uint8_t line, const int wordsPerSeg)
 {
-	uint8_t* lepPopPtr = lepPacketP + 4;
-	uint16_t* acqPushPtr = &lepBuffer[((curSegment-1) * curWordsPerSeg) + (line * (LEP_WIDTH/2))];
-	uint16_t t;
+	uint32_t* lepPopPtr = (uint32_t*) (pktP + 4);
+	uint32_t* acqPushPtr = (uint32_t*) &lepFrameP->lep_bufferP[((curSegment-1) * wordsPerSeg) + (line * (LEP_WIDTH/2))];
+	uint16_t* histP = segHist[curSegment-1];
+	uint16_t min, max;
+	uint16_t p0, p1;
+	uint32_t t;
+	int i;
+	
+	// Restart the segment statistics at the start of each segment
+	if (line == 0) {
+		segMin[curSegment-1] = 0xFFFF;
+		segMax[curSegment-1] = 0x0000;
+		if (includeHistogram) {
+			memset(histP, 0, LEP_HIST_BINS * sizeof(uint16_t));
+		}
+	}
+	min = segMin[curSegment-1];
+	max = segMax[curSegment-1];
 
-	while (lepPopPtr <= (lepPacketP + (LEP_PKT_LENGTH-1))) {
-		t = *lepPopPtr++ << 8;
-		t |= *lepPopPtr++;
+	for (i=0; i<(LEP_WIDTH/4); i++) {
+		// Swap the bytes of both 16-bit pixels at once
+		t = *lepPopPtr++;
+		t = ((t & 0x00FF00FF) << 8) | ((t >> 8) & 0x00FF00FF);
 		*acqPushPtr++ = t;
+		
+		p0 = t & 0xFFFF;
+		p1 = t >> 16;
+		if (p0 < min) min = p0;
+		if (p0 > max) max = p0;
+		if (p1 < min) min = p1;
+		if (p1 > max) max = p1;
+		if (includeHistogram) {
+			histP[p0 >> LEP_HIST_SHIFT]++;
+			histP[p1 >> LEP_HIST_SHIFT]++;
+		}
+	}
+	
+	segMin[curSegment-1] = min;
+	segMax[curSegment-1] = max;
+}
+
+
+/**
+ * Copy a Lepton 2.x packet to two lines of the raw lepton frame, doubling each pixel,
+ * and update the statistics for its quarter of the frame.  Each pixel counts for the
+ * four it becomes in the histogram.
+ */
+static inline void copy_lep2_packet_to_lepton_buffer(uint8_t* pktP, uint8_t line)
+{
+	uint32_t* lepPopPtr = (uint32_t*) (pktP + 4);
+	uint32_t* row1P = (uint32_t*) &lepFrameP->lep_bufferP[2 * line * LEP_WIDTH];
+	uint32_t* row2P = row1P + (LEP_WIDTH/2);
+	int seg = line / LEP2_LINES_PER_STAT_SEG;
+	uint16_t* histP = segHist[seg];
+	uint16_t min, max;
+	uint32_t p0, p1;
+	uint32_t t;
+	int i;
+	
+	if ((line % LEP2_LINES_PER_STAT_SEG) == 0) {
+		segMin[seg] = 0xFFFF;
+		segMax[seg] = 0x0000;
+		if (includeHistogram) {
+			memset(histP, 0, LEP_HIST_BINS * sizeof(uint16_t));
+		}
+	}
+	min = segMin[seg];
+	max = segMax[seg];
+	
+	for (i=0; i<(LEP2_WIDTH/2); i++) {
+		t = *lepPopPtr++;
+		t = ((t & 0x00FF00FF) << 8) | ((t >> 8) & 0x00FF00FF);
+		p0 = t & 0xFFFF;
+		p1 = t >> 16;
+		
+		*row1P++ = p0 | (p0 << 16);
+		*row1P++ = p1 | (p1 << 16);
+		*row2P++ = p0 | (p0 << 16);
+		*row2P++ = p1 | (p1 << 16);
+		
+		if (p0 < min) min = p0;
+		if (p0 > max) max = p0;
+		if (p1 < min) min = p1;
+		if (p1 > max) max = p1;
+		if (includeHistogram) {
+			histP[p0 >> LEP_HIST_SHIFT] += 4;
+			histP[p1 >> LEP_HIST_SHIFT] += 4;
+		}
 	}
+	
+	segMin[seg] = min;
+	segMax[seg] = max;
 }
 
 
@@ -314,19 +863,17 @@ static void copy_packet_to_lepton_buffer(uint8_t line)
  * Copy the lepton packet to the telemetry buffer
  *   - line specifies packet line number (only 0-2 are valid, do not call with line 3)
  */
-static void copy_packet_to_telem_buffer(uint8_t line)
+static void SYS_HOT_IRAM_ATTR copy_packet_to_telem_buffer(uint8_t* pktP, uint8_t line)
 {
-	uint8_t* lepPopPtr = lepPacketP + 4;
-	uint16_t* telPushPtr = &lepTelem[line * (LEP_WIDTH/2)];
-	uint16_t t;
+	uint32_t* lepPopPtr = (uint32_t*) (pktP + 4);
+	uint32_t* telPushPtr = (uint32_t*) &lepFrameP->lep_telemP[line * (LEP_WIDTH/2)];
+	uint32_t t;
+	int i;
 	
 	if (line > 2) return;
 	
-	while (lepPopPtr <= (lepPacketP + (LEP_PKT_LENGTH-1))) {
-		t = *lepPopPtr++ << 8;
-		t |= *lepPopPtr++;
-		*telPushPtr++ = t;
+	for (i=0; i<(LEP_WIDTH/4); i++) {
+		t = *lepPopPtr++;
+		*telPushPtr++ = ((t & 0x00FF00FF) << 8) | ((t >> 8) & 0x00FF00FF);
 	}
 }
-
-
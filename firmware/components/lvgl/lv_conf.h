@@ -67,8 +67,11 @@ typedef int16_t lv_coord_t;
 /* LittelvGL's internal memory manager's settings.
  * The graphical objects and other related data are stored here. */
 
-/* 1: use custom malloc/free, 0: use the built-in `lv_mem_alloc` and `lv_mem_free` */
-#define LV_MEM_CUSTOM      0
+/* 1: use custom malloc/free, 0: use the built-in `lv_mem_alloc` and `lv_mem_free`
+ * FireCAM: the objects and styles are allocated from the PSRAM by gui_mem_utilities in
+ * the gui component instead of from a pool in the internal RAM.  The display buffers
+ * are allocated in internal DMA-capable memory by gui_task. */
+#define LV_MEM_CUSTOM      1
 #if LV_MEM_CUSTOM == 0
 /* Size of the memory used by `lv_mem_alloc` in bytes (>= 2kB)*/
 #  define LV_MEM_SIZE    (32U * 1024U)
@@ -83,9 +86,9 @@ typedef int16_t lv_coord_t;
 /* Automatically defrag. on free. Defrag. means joining the adjacent free cells. */
 #  define LV_MEM_AUTO_DEFRAG  1
 #else       /*LV_MEM_CUSTOM*/
-#  define LV_MEM_CUSTOM_INCLUDE <stdlib.h>   /*Header for the dynamic memory function*/
-#  define LV_MEM_CUSTOM_ALLOC   malloc       /*Wrapper to malloc*/
-#  define LV_MEM_CUSTOM_FREE    free         /*Wrapper to free*/
+#  define LV_MEM_CUSTOM_INCLUDE "gui_mem_utilities.h"   /*Header for the dynamic memory function*/
+#  define LV_MEM_CUSTOM_ALLOC   gui_mem_alloc       /*Wrapper to malloc*/
+#  define LV_MEM_CUSTOM_FREE    gui_mem_free        /*Wrapper to free*/
 #endif     /*LV_MEM_CUSTOM*/
 
 /* Garbage Collector settings
@@ -9,6 +9,7 @@
  *********************/
 #include "disp_spi.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "driver/gpio.h"
 #include "driver/spi_master.h"
 #include <string.h>
@@ -18,11 +19,15 @@
 #include "lvgl/lvgl.h"
 #include "ili9341.h"
 #include "tp_spi.h"
+#include "perf_utilities.h"
 
 /*********************
  *      DEFINES
  *********************/
 
+/* Transactions needed to queue a full lvgl display buffer */
+#define DISP_SPI_QUEUE_LEN ((LVGL_DISP_BUF_SIZE * 2 + DISP_SPI_SLICE_LEN - 1) / DISP_SPI_SLICE_LEN)
+
 /**********************
  *      TYPEDEFS
  **********************/
@@ -31,13 +36,23 @@
  *  STATIC PROTOTYPES
  **********************/
 static void IRAM_ATTR spi_ready (spi_transaction_t *trans);
+static void disp_spi_reclaim(int max_queued);
 
 /**********************
  *  STATIC VARIABLES
  **********************/
 static spi_device_handle_t spi;
-static volatile bool spi_trans_in_progress;
-static volatile bool spi_color_sent;
+
+/* Color transactions must stay valid until the driver is done with them so they are
+   allocated here instead of on the stack.  Used in order as a ring. */
+static spi_transaction_t color_trans[DISP_SPI_QUEUE_LEN];
+static int color_trans_next;
+static int color_trans_queued;     /* Queued but results not yet collected */
+static int64_t color_flush_usec;   /* When the lvgl flush being sent was queued */
+
+/* Internal memory slices that pixels the DMA can't read (e.g. in PSRAM) are copied
+   through by disp_spi_copy_colors.  One is filled while the other is sent. */
+static uint8_t color_stage[DISP_SPI_STAGE_NUM][DISP_SPI_SLICE_LEN] __attribute__((aligned(4)));
 
 /**********************
  *      MACROS
@@ -55,7 +70,7 @@ void disp_spi_init(void)
             .clock_speed_hz=DISP_SPI_FREQ_HZ,
             .mode=0,                               //SPI mode 0
             .spics_io_num=LCD_CSN_IO,              //CS pin
-            .queue_size=1,
+            .queue_size=DISP_SPI_QUEUE_LEN,
             .pre_cb=NULL,
             .post_cb=spi_ready,
             .flags = SPI_DEVICE_HALFDUPLEX
@@ -65,56 +80,98 @@ void disp_spi_init(void)
     ret=spi_bus_add_device(DISP_SPI_HOST, &devcfg, &spi);
     assert(ret==ESP_OK);
 
-    spi_trans_in_progress = false;
+    color_trans_next = 0;
+    color_trans_queued = 0;
 }
 
 void disp_spi_send_data(uint8_t * data, uint16_t length)
 {
     if (length == 0) return;           //no need to send anything
 
-    while (spi_trans_in_progress) {};
+    /* Finish any queued colors so this transaction's result is the one we collect */
+    disp_spi_wait_idle();
 
     spi_transaction_t t = {
         .length = length * 8, // transaction length is in bits
-        .tx_buffer = data
+        .tx_buffer = data,
+        .user = NULL                    //Mark the "lv_flush_ready" NOT needs to be called in "spi_ready"
     };
 
-    spi_trans_in_progress = true;
-    spi_color_sent = false;             //Mark the "lv_flush_ready" NOT needs to be called in "spi_ready"
-    /************************************************************************************/
-    /* Note: queued transactions cause a panic when this task yields and I can't figure */
-    /* it out.  Disabling queuing gets rid of the panic at some performance hit.        */
-    /************************************************************************************/
-    //spi_device_queue_trans(spi, &t, portMAX_DELAY);
     spi_device_transmit(spi, &t);
-
 }
 
+/* Queue the colors in slices and return without waiting for them to be sent.  lvgl
+   renders into its other buffer meanwhile and spi_ready tells lvgl when the last slice
+   is done.  The buffer must not be touched until then. */
 void disp_spi_send_colors(uint8_t * data, uint16_t length)
 {
-    if (length == 0) return;           //no need to send anything
+    spi_transaction_t * t;
+    uint16_t n;
 
-    while (spi_trans_in_progress) {};
+    color_flush_usec = esp_timer_get_time();
 
-    spi_transaction_t t = {
-        .length = length * 8, // transaction length is in bits
-        .tx_buffer = data
-    };
-    
-    spi_trans_in_progress = true;
-    spi_color_sent = true;              //Mark the "lv_flush_ready" needs to be called in "spi_ready"
-    /************************************************************************************/
-    /* Note: queued transactions cause a panic when this task yields and I can't figure */
-    /* it out.  Disabling queuing gets rid of the panic at some performance hit.        */
-    /************************************************************************************/
-    //spi_device_queue_trans(spi, &t, portMAX_DELAY);
-    spi_device_transmit(spi, &t);
+    while (length > 0) {
+        n = (length > DISP_SPI_SLICE_LEN) ? DISP_SPI_SLICE_LEN : length;
+
+        /* Make sure the next transaction in the ring is free */
+        disp_spi_reclaim(DISP_SPI_QUEUE_LEN - 1);
+
+        t = &color_trans[color_trans_next];
+        if (++color_trans_next == DISP_SPI_QUEUE_LEN) color_trans_next = 0;
+        memset(t, 0, sizeof(spi_transaction_t));
+        t->length = n * 8;              // transaction length is in bits
+        t->tx_buffer = data;
+        t->user = (n == length) ? (void *) 1 : NULL;  //Only the last slice calls "lv_flush_ready"
+
+        spi_device_queue_trans(spi, t, portMAX_DELAY);
+        color_trans_queued++;
+
+        data += n;
+        length -= n;
+    }
 }
 
 
-bool disp_spi_is_busy(void)
+/* Send pixels from a buffer anywhere in memory without involving lvgl.  The pixels are
+   copied through the internal staging slices so the caller's buffer may be reused as
+   soon as this returns.  The last slices finish in the background. */
+void disp_spi_copy_colors(const uint8_t * data, uint32_t length)
+{
+    spi_transaction_t * t;
+    uint32_t n;
+    int stage = 0;
+
+    /* Only staged slices can be in flight while the staging buffers are recycled */
+    disp_spi_wait_idle();
+
+    while (length > 0) {
+        n = (length > DISP_SPI_SLICE_LEN) ? DISP_SPI_SLICE_LEN : length;
+
+        /* Wait for the slice last sent from this staging buffer */
+        disp_spi_reclaim(DISP_SPI_STAGE_NUM - 1);
+        memcpy(color_stage[stage], data, n);
+
+        t = &color_trans[color_trans_next];
+        if (++color_trans_next == DISP_SPI_QUEUE_LEN) color_trans_next = 0;
+        memset(t, 0, sizeof(spi_transaction_t));
+        t->length = n * 8;              // transaction length is in bits
+        t->tx_buffer = color_stage[stage];
+        t->user = NULL;                 //Not an lvgl flush
+
+        spi_device_queue_trans(spi, t, portMAX_DELAY);
+        color_trans_queued++;
+        if (++stage == DISP_SPI_STAGE_NUM) stage = 0;
+
+        data += n;
+        length -= n;
+    }
+}
+
+/* Wait for all queued colors to be sent.  Must be called before changing the D/C line
+   or selecting another device on the bus with a GPIO chip select. */
+void disp_spi_wait_idle(void)
 {
-    return spi_trans_in_progress;
+    disp_spi_reclaim(0);
 }
 
 /**********************
@@ -123,8 +180,20 @@ bool disp_spi_is_busy(void)
 
 static void IRAM_ATTR spi_ready (spi_transaction_t *trans)
 {
-    spi_trans_in_progress = false;
-
     lv_disp_t * disp = lv_refr_get_disp_refreshing();
-    if(spi_color_sent) lv_disp_flush_ready(&disp->driver);
+    if(trans->user != NULL) {
+        perf_record_isr(PERF_LCD_FLUSH, esp_timer_get_time() - color_flush_usec);
+        lv_disp_flush_ready(&disp->driver);
+    }
+}
+
+/* Collect the results of completed color transactions until at most max_queued remain */
+static void disp_spi_reclaim(int max_queued)
+{
+    spi_transaction_t * rt;
+
+    while (color_trans_queued > max_queued) {
+        spi_device_get_trans_result(spi, &rt, portMAX_DELAY);
+        color_trans_queued--;
+    }
 }
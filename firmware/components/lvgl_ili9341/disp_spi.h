@@ -26,6 +26,12 @@ extern "C" {
 #define DISP_SPI_FREQ_HZ LCD_SPI_FREQ_HZ
 #define DISP_SPI_CS LCD_CSN_IO
 
+/* Maximum pixel bytes per SPI transaction (about 2 mSec at 16 MHz) */
+#define DISP_SPI_SLICE_LEN 4096
+
+/* Internal memory slices used to send pixels from buffers the DMA can't access */
+#define DISP_SPI_STAGE_NUM 2
+
 
 /**********************
  *      TYPEDEFS
@@ -37,7 +43,8 @@ extern "C" {
 void disp_spi_init(void);
 void disp_spi_send_data(uint8_t * data, uint16_t length);
 void disp_spi_send_colors(uint8_t * data, uint16_t length);
-bool disp_spi_is_busy(void);
+void disp_spi_copy_colors(const uint8_t * data, uint32_t length);
+void disp_spi_wait_idle(void);
 
 /**********************
  *      MACROS
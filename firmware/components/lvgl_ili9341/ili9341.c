@@ -33,6 +33,7 @@ typedef struct {
 /**********************
  *  STATIC PROTOTYPES
  **********************/
+static void ili9341_set_window(const lv_area_t * area);
 static void ili9341_send_cmd(uint8_t cmd);
 static void ili9341_send_data(void * data, uint16_t length);
 static void ili9341_send_color(void * data, uint16_t length);
@@ -105,9 +106,80 @@ void ili9341_init(void)
 
 void ili9341_flush(lv_disp_drv_t * drv, const lv_area_t * area, lv_color_t * color_map)
 {
-	uint8_t data[4];
+	uint8_t* colorP = (uint8_t*) color_map;
+	
+	system_lock_vspi(VSPI_USER_LCD);
+
+	ili9341_set_window(area);
+
+	uint32_t size = lv_area_get_width(area) * lv_area_get_height(area) * 2;
+
+	/*Queue the pixels and return so lvgl can render into its other buffer while they
+	  are sent.  Other devices with hardware chip selects (ArduCAM) can use the bus as
+	  soon as it is unlocked, their transactions are serialized with ours by the SPI
+	  driver.  The touchscreen waits for the pixels to finish before selecting itself.*/
+	ili9341_send_color((void*)colorP, size);
 	
-	system_lock_vspi();
+	system_unlock_vspi();
+}
+
+
+/*Put the display to sleep (blank it) or wake it back up.  The panel memory and
+  interface keep working while it sleeps so lvgl can continue to draw.*/
+void ili9341_sleep(bool en)
+{
+	system_lock_vspi(VSPI_USER_LCD);
+
+	if (en) {
+		ili9341_send_cmd(0x28);		/*Display off*/
+		ili9341_send_cmd(0x10);		/*Sleep in*/
+		disp_spi_wait_idle();
+		system_unlock_vspi();
+	} else {
+		ili9341_send_cmd(0x11);		/*Sleep out*/
+		disp_spi_wait_idle();
+		system_unlock_vspi();
+
+		/*The controller needs 120 mSec after sleep out before it takes a display on*/
+		vTaskDelay(pdMS_TO_TICKS(120));
+
+		system_lock_vspi(VSPI_USER_LCD);
+		ili9341_send_cmd(0x29);		/*Display on*/
+		disp_spi_wait_idle();
+		system_unlock_vspi();
+	}
+}
+
+
+/*Write a block of pixels (lv_color_t format) straight to an area of the display without
+  going through lvgl.  The pixels may be anywhere in memory (e.g. PSRAM) and the buffer
+  may be reused as soon as this returns.  The caller is responsible for making sure lvgl
+  isn't drawing anything else in the area.*/
+void ili9341_write_area(const lv_area_t * area, const uint16_t * pixels)
+{
+	uint32_t size = lv_area_get_width(area) * lv_area_get_height(area) * 2;
+
+	system_lock_vspi(VSPI_USER_LCD);
+
+	ili9341_set_window(area);
+
+	disp_spi_wait_idle();
+	gpio_set_level(ILI9341_DC, 1);	 /*Data mode*/
+	disp_spi_copy_colors((const uint8_t*) pixels, size);
+
+	system_unlock_vspi();
+}
+
+
+
+/**********************
+ *   STATIC FUNCTIONS
+ **********************/
+
+
+static void ili9341_set_window(const lv_area_t * area)
+{
+	uint8_t data[4];
 
 	/*Column addresses*/
 	ili9341_send_cmd(0x2A);
@@ -127,27 +199,11 @@ void ili9341_flush(lv_disp_drv_t * drv, const lv_area_t * area, lv_color_t * col
 
 	/*Memory write*/
 	ili9341_send_cmd(0x2C);
-
-
-	uint32_t size = lv_area_get_width(area) * lv_area_get_height(area);
-
-	ili9341_send_color((void*)color_map, size * 2);
-	
-	system_unlock_vspi();
 }
 
-
-
-/**********************
- *   STATIC FUNCTIONS
- **********************/
-
-
 static void ili9341_send_cmd(uint8_t cmd)
 {
-	while (disp_spi_is_busy()) {
-		taskYIELD();
-	};
+	disp_spi_wait_idle();
 
 	gpio_set_level(ILI9341_DC, 0);	 /*Command mode*/
 	disp_spi_send_data(&cmd, 1);
@@ -155,9 +211,7 @@ static void ili9341_send_cmd(uint8_t cmd)
 
 static void ili9341_send_data(void * data, uint16_t length)
 {
-	while (disp_spi_is_busy()) {
-		taskYIELD();
-	};
+	disp_spi_wait_idle();
 
 	gpio_set_level(ILI9341_DC, 1);	 /*Data mode*/
 	disp_spi_send_data(data, length);
@@ -165,9 +219,7 @@ static void ili9341_send_data(void * data, uint16_t length)
 
 static void ili9341_send_color(void * data, uint16_t length)
 {
-	while (disp_spi_is_busy()) {
-		taskYIELD();
-	};
+	disp_spi_wait_idle();
 
     gpio_set_level(ILI9341_DC, 1);   /*Data mode*/
     disp_spi_send_colors(data, length);
@@ -37,6 +37,8 @@ extern "C" {
 
 void ili9341_init(void);
 void ili9341_flush(lv_disp_drv_t * drv, const lv_area_t * area, lv_color_t * color_map);
+void ili9341_write_area(const lv_area_t * area, const uint16_t * pixels);
+void ili9341_sleep(bool en);
 
 /**********************
  *      MACROS
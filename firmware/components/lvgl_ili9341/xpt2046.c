@@ -10,8 +10,10 @@
 #include "xpt2046.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "driver/gpio.h"
 #include "tp_spi.h"
+#include "disp_spi.h"
 #include "sys_utilities.h"
 #include <stddef.h>
 
@@ -30,6 +32,7 @@
  **********************/
 static void xpt2046_corr(int16_t * x, int16_t * y);
 static void xpt2046_avg(int16_t * x, int16_t * y);
+static void IRAM_ATTR xpt2046_irq_isr(void * arg);
 
 /**********************
  *  STATIC VARIABLES
@@ -40,6 +43,15 @@ int16_t avg_buf_x[XPT2046_AVG];
 int16_t avg_buf_y[XPT2046_AVG];
 uint8_t avg_last;
 
+/*lvgl's touchpad read task is stopped while the screen isn't touched and restarted by
+  the pen interrupt*/
+static lv_task_t * read_task = NULL;
+static volatile bool touch_irq = false;
+static bool touch_active = true;
+
+/*esp_timer time of the pen interrupt starting the latest touch*/
+static volatile int64_t touch_irq_usec = 0;
+
 /**********************
  *      MACROS
  **********************/
@@ -56,6 +68,43 @@ void xpt2046_init(void)
 	ESP_LOGI(TAG, "Touchpad initialization");
 	
     gpio_set_level(XPT2046_CS, 1);
+
+    /*The XPT2046 pulls its pen interrupt low when the screen is touched*/
+    gpio_set_intr_type(XPT2046_IRQ, GPIO_INTR_NEGEDGE);
+    gpio_isr_handler_add(XPT2046_IRQ, xpt2046_irq_isr, NULL);
+}
+
+/**
+ * Start or stop lvgl's touchpad read task based on the pen interrupt so the touchscreen
+ * is only polled while it's being touched.  Call before each lv_task_handler().
+ * @return true when a new touch restarted the read task
+ */
+bool xpt2046_check_irq(void)
+{
+    if(read_task == NULL) return false;
+
+    if(touch_irq) {
+        touch_irq = false;
+        if(read_task->prio == LV_TASK_PRIO_OFF) {
+            lv_task_set_prio(read_task, LV_TASK_PRIO_MID);
+            lv_task_ready(read_task);
+            return true;
+        }
+    } else if(!touch_active && (read_task->prio != LV_TASK_PRIO_OFF)) {
+        /*lvgl has seen the release*/
+        lv_task_set_prio(read_task, LV_TASK_PRIO_OFF);
+    }
+
+    return false;
+}
+
+/**
+ * Get when the latest touch started
+ * @return esp_timer time of its pen interrupt, 0 if the screen hasn't been touched
+ */
+int64_t xpt2046_get_touch_usec(void)
+{
+    return touch_irq_usec;
 }
 
 /**
@@ -73,10 +122,18 @@ bool xpt2046_read(lv_indev_drv_t * drv, lv_indev_data_t * data)
     int16_t x = 0;
     int16_t y = 0;
 
+    /*Remember the read task so xpt2046_check_irq can control it*/
+    read_task = drv->read_task;
+
     uint8_t irq = gpio_get_level(XPT2046_IRQ);
 
+    touch_active = (irq == 0);
     if(irq == 0) {
-    	system_lock_vspi();
+    	system_lock_vspi(VSPI_USER_TS);
+    	
+    	/*The touchscreen's GPIO chip select isn't managed by the SPI driver so wait for any
+    	  queued LCD pixels to be sent before selecting it*/
+    	disp_spi_wait_idle();
     	
         gpio_set_level(XPT2046_CS, 0);
         tp_spi_xchg(CMD_X_READ);         /*Start x read*/
@@ -119,6 +176,13 @@ bool xpt2046_read(lv_indev_drv_t * drv, lv_indev_data_t * data)
 /**********************
  *   STATIC FUNCTIONS
  **********************/
+static void IRAM_ATTR xpt2046_irq_isr(void * arg)
+{
+    /*Later edges from the same touch don't move its start*/
+    if(!touch_irq && !touch_active) touch_irq_usec = esp_timer_get_time();
+    touch_irq = true;
+}
+
 static void xpt2046_corr(int16_t * x, int16_t * y)
 {
 #if XPT2046_XY_SWAP != 0
@@ -47,6 +47,8 @@ extern "C" {
  **********************/
 void xpt2046_init(void);
 bool xpt2046_read(lv_indev_drv_t * drv, lv_indev_data_t * data);
+bool xpt2046_check_irq(void);
+int64_t xpt2046_get_touch_usec(void);
 
 /**********************
  *      MACROS
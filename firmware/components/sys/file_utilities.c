@@ -29,8 +29,10 @@
 #include "esp_vfs_fat.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "system_config.h"
 #include "ff.h"
 #include "vfs_fat_internal.h"
+#include "driver/gpio.h"
 #include "driver/sdmmc_host.h"
 #include "sdmmc_cmd.h"
 #include "driver/sdmmc_defs.h"
@@ -51,11 +53,28 @@
 // Directory and file string lengths (including null)
 //
 // Directory names are "session_YY_MM_DD_HH_MM_SS"
-#define DIR_NAME_LEN    32
+#define DIR_NAME_LEN    SESSION_DIR_NAME_LEN
 // Sub-directory names are "group_XXXX"
 #define SUBDIR_NAME_LEN 16
-// File names are "img_XXXXX.json"
+// File names are "img_XXXXX.json" or "img_XXXXX.fcr"
 #define FILE_NAME_LEN   16
+// Image file path prefix "/sdcard/<session dir>/<sub-directory>/"
+#define PATH_PREFIX_LEN (sizeof(base_path) + DIR_NAME_LEN + SUBDIR_NAME_LEN + 1)
+// Deepest path in a session directory "<session dir>/<sub-directory>/<file>"
+#define DELETE_PATH_LEN (DIR_NAME_LEN + SUBDIR_NAME_LEN + FILE_NAME_LEN + 2)
+
+// Card format.  Cards are formatted with one partition and large allocation units so a
+// recorded image (typically 100 - 160 kB) spans only a few clusters, meaning fewer FAT
+// updates per file, and the data area is aligned to the card's erase block (the SD
+// allocation unit: 4 MB for SDHC cards, up to 16 MB for SDXC cards) so clusters never
+// straddle one.  Cards larger than 32 GB are formatted exFAT when FF_FS_EXFAT is set in
+// the IDF fatfs/src/ffconf.h (otherwise FAT32 with 64 kB clusters).
+#define FMT_FAT_AU_LEN      (64 * 1024)
+#define FMT_EXFAT_AU_LEN    (128 * 1024)
+#define FMT_SDHC_ALIGN_LEN  (4 * 1024 * 1024)
+#define FMT_SDXC_ALIGN_LEN  (16 * 1024 * 1024)
+#define FMT_SDXC_MIN_BYTES  (32ULL * 1024 * 1024 * 1024)
+#define FMT_WORKBUF_LEN     (16 * 1024)
 
 
 
@@ -70,15 +89,34 @@ static sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT(); // No CD,
 static sdmmc_card_t sd_card;
 
 static bool card_present = false;
+static bool card_mounted = false;
+
+
+// SD bus modes tried, fastest first, until the card initializes
+typedef struct {
+	int width;
+	int freq_khz;
+} sd_bus_mode_t;
+
+static const sd_bus_mode_t sd_bus_modes[] = {
+	{SD_BUS_WIDTH, SD_MAX_FREQ_KHZ},
+	{SD_BUS_WIDTH, SDMMC_FREQ_DEFAULT},
+	{1,            SDMMC_FREQ_DEFAULT}
+};
+
+#define SD_NUM_BUS_MODES (sizeof(sd_bus_modes) / sizeof(sd_bus_mode_t))
 
 
 // Options for mounting the filesystem.
 esp_vfs_fat_sdmmc_mount_config_t mount_config = {
     .format_if_mount_failed = false,
-    .max_files = 5,
-    .allocation_unit_size = 16 * 1024
+    .max_files = 7,         // Session files while recording plus an image and index moved from the spool
+    .allocation_unit_size = FMT_FAT_AU_LEN
 };
 
+// Erase block size (sectors) reported to f_mkfs while formatting
+static DWORD fmt_block_sectors;
+
 static FATFS *fat_fs;     // Pointer to the filesystem object
 
 // Static allocations for directory and file names
@@ -86,8 +124,13 @@ static char session_dir_name[DIR_NAME_LEN];
 static char session_subdir_name[SUBDIR_NAME_LEN];
 static char session_file_name[FILE_NAME_LEN];
 
-// Last created sub-directory
-static int cur_sub_directory_num = -1;   
+// Highest created sub-directory (they are created in order)
+static int cur_sub_directory_num = -1;
+
+// Cached path prefix for image files in the sub-directory currently being written
+static char image_path_prefix[PATH_PREFIX_LEN];
+static int image_path_prefix_len;
+static int image_path_sub_directory_num = -1;
 
 
 
@@ -96,10 +139,27 @@ static int cur_sub_directory_num = -1;
 //
 char* file_get_subdir_name(int seq_num);
 bool file_create_subdirectory(char* dir_name, char* subdir_name);
+bool file_negotiate_card_init();
+static DSTATUS file_fmt_disk_init(unsigned char pdrv);
+static DSTATUS file_fmt_disk_status(unsigned char pdrv);
+static DRESULT file_fmt_disk_read(unsigned char pdrv, unsigned char* buff, uint32_t sector, unsigned count);
+static DRESULT file_fmt_disk_write(unsigned char pdrv, const unsigned char* buff, uint32_t sector, unsigned count);
+static DRESULT file_fmt_disk_ioctl(unsigned char pdrv, unsigned char cmd, void* buff);
+static bool file_open_session_append_file(char* dir_name, const char* name, FILE** fp, bool* is_new);
+
+// Disk driver used while formatting.  It is the same as the IDF SDMMC driver but it
+// reports the erase block size so f_mkfs aligns the data area to it.
+static const ff_diskio_impl_t fmt_diskio = {
+	.init = &file_fmt_disk_init,
+	.status = &file_fmt_disk_status,
+	.read = &file_fmt_disk_read,
+	.write = &file_fmt_disk_write,
+	.ioctl = &file_fmt_disk_ioctl
+};
 
 // References to internal SDMMC driver functions used to probe the SD Card for
 // insertion and removal events
-esp_err_t sdmmc_send_cmd_send_scr(sdmmc_card_t* card, sdmmc_scr_t *out_scr);
+esp_err_t sdmmc_send_cmd_send_status(sdmmc_card_t* card, uint32_t* out_status);
 esp_err_t sdmmc_fix_host_flags(sdmmc_card_t* card);
 esp_err_t sdmmc_io_reset(sdmmc_card_t* card);
 esp_err_t sdmmc_send_cmd_go_idle_state(sdmmc_card_t* card);
@@ -118,7 +178,11 @@ esp_err_t sdmmc_init_sd_if_cond(sdmmc_card_t* card);
 bool file_init_sdmmc_driver()
 {
 	esp_err_t ret;
-		
+	
+	// Start with the fastest configured mode
+	host_driver.max_freq_khz = sd_bus_modes[0].freq_khz;
+	slot_config.width = sd_bus_modes[0].width;
+	
 	// Initialize the driver
 	ret = host_driver.init();
 	if (ret != ESP_OK) {
@@ -144,6 +208,12 @@ bool file_init_sdmmc_driver()
 	// Register FATFS with our card (which will point to the driver when initialized)
  	ff_diskio_register_sdmmc(0, &sd_card);
 	
+#ifdef SD_CD_IO
+	// Card-detect switch input (file_task attaches the interrupt handler)
+	gpio_set_direction(SD_CD_IO, GPIO_MODE_INPUT);
+	gpio_set_pull_mode(SD_CD_IO, GPIO_PULLUP_ONLY);
+#endif
+	
 	card_present = false;
 	
 	return true;
@@ -151,30 +221,47 @@ bool file_init_sdmmc_driver()
 
 
 /**
- * Check if the card is present.  If we think it is already been detected then attempt
- * to read the SD Configuration Register from it to verify it is still present.
+ * Check if a card we think is present still responds by reading its status register
+ * (CMD13 has no data phase so it is the cheapest command we can issue).  Does not change
+ * the card present state since the caller decides when a card is really gone.
  */
 bool file_check_card_still_present()
 {
-	esp_err_t ret;;
-	sdmmc_scr_t scr_tmp;
+	esp_err_t ret;
+	uint32_t status;
 
 	// Turn off error logging temporarily because a component in the SDMMC driver will
 	// issue an error message about a timeout if the card is missing and we don't want the
 	// log file cluttered up with those.
 	esp_log_level_set("sdmmc_req", ESP_LOG_NONE);
-	ret = sdmmc_send_cmd_send_scr(&sd_card, &scr_tmp);
+	ret = sdmmc_send_cmd_send_status(&sd_card, &status);
 	esp_log_level_set("sdmmc_req", ESP_LOG_INFO);
-	if (ret != ESP_OK) {
-		card_present = false;
-		return false;
-	}
+	
+	return (ret == ESP_OK);
+}
 
-	card_present = true;
-	return true;
+
+/**
+ * Note that the card has been removed (and release its filesystem if it was mounted)
+ */
+void file_set_card_removed()
+{
+	file_unmount_sdcard();
+	card_present = false;
 }
 
 
+#ifdef SD_CD_IO
+/**
+ * Return true if the card-detect switch indicates a card is inserted
+ */
+bool file_get_card_detect()
+{
+	return (gpio_get_level(SD_CD_IO) == 0);
+}
+#endif
+
+
 /**
  * Getter for card_present variable for use by other tasks.
  *  Note: We aren't protecting this with a mutex since it should be atomically accessed.
@@ -241,7 +328,7 @@ fail:
  */
 bool file_init_card()
 {
-	if (sdmmc_card_init(&host_driver, &sd_card) != ESP_OK) {
+	if (!file_negotiate_card_init()) {
  		return false;
  	}
  	
@@ -254,12 +341,7 @@ bool file_reinit_card()
 {
 	card_present = false;
 	
-	// Reconfigure the SD Slot (necessary before initializing card)
-	if (sdmmc_host_init_slot(host_driver.slot, &slot_config) != ESP_OK) {
-		ESP_LOGE(TAG, "Could not re-initialize SD Slot");
-		return false;
-	}
-	if (sdmmc_card_init(&host_driver, &sd_card) != ESP_OK) {
+	if (!file_negotiate_card_init()) {
 		ESP_LOGE(TAG, "Could not re-initialize SD Card");
 		return false;
 	}
@@ -270,70 +352,126 @@ bool file_reinit_card()
 
 
 /**
- * Attempt to mount the SD Card
+ * Get the bus width and clock the SD card was initialized with.  Returns false if no
+ * card has been initialized.
+ */
+bool file_get_card_mode(int* width, int* freq_khz)
+{
+	if (!card_present || (sd_card.max_freq_khz == 0)) {
+		return false;
+	}
+	
+	*width = 1 << sd_card.log_bus_width;
+	*freq_khz = sd_card.max_freq_khz;
+	return true;
+}
+
+
+/**
+ * Attempt to mount the SD Card.  Does nothing if it is already mounted.
  */
 bool file_mount_sdcard()
 {
 	FRESULT ret;
-	const size_t workbuf_size = 4096;
-	void* workbuf = NULL;
+	
+	if (card_mounted) {
+		return true;
+	}
 	
 	// Attempt to mount the default drive immediately to verify it's still present
 	ret = f_mount(fat_fs, "", 1);
 	if (ret == FR_NO_FILESYSTEM) {
 		// Card mounted but we have to put a filesystem on it
-
-		// Malloc a workbuf
-		workbuf = malloc(workbuf_size);
-		if (workbuf == NULL) {
-			ESP_LOGE(TAG, "Could not allocate work buffer for sd card format");
+		if (!file_format_card()) {
 			card_present = false;
 			return false;
 		}
 		
-		// Partition into one partion
-		DWORD plist[] = {100, 0, 0, 0};
-		ESP_LOGI(TAG, "partitioning card");
-		ret = f_fdisk(0, plist, workbuf);
+		// Attempt to mount the new filesystem
+		ret = f_mount(fat_fs, "", 1);
 		if (ret != FR_OK) {
-			free(workbuf);
-			ESP_LOGE(TAG, "Could not partition sd card");
+			ESP_LOGE(TAG, "Could not mount sd card (%d)", ret);
 			card_present = false;
 			return false;
 		}
-		
-		// Format the partition
-		size_t alloc_unit_size = esp_vfs_fat_get_allocation_unit_size(
-                sd_card.csd.sector_size,
-                mount_config.allocation_unit_size);
-        ESP_LOGI(TAG, "formatting card, allocation unit size=%d", alloc_unit_size);
-        ret = f_mkfs("", FM_ANY, alloc_unit_size, workbuf, workbuf_size);
-        if (ret != FR_OK) {
-        	free(workbuf);
-        	ESP_LOGE(TAG, "Could not format sd card");
-        	card_present = false;
-        	return false;
-        }
-        
-        // Need to set FF_USE_LABEL in ESP IDF components fatfs/src/ffconf.h to use this
-        // Name it
-        //f_setlabel(DEF_SD_CARD_LABEL);
-        
-        free(workbuf);
-        
-        // Attempt to mount the new filesystem
-        ret = f_mount(fat_fs, "", 1);
-        if (ret != FR_OK) {
-        	ESP_LOGE(TAG, "Could not mount sd card (%d)", ret);
-        	card_present = false;
-        	return false;
-        }
 	} else if (ret != FR_OK) {
 		ESP_LOGE(TAG, "Could not mount sd card (%d)", ret);
  		card_present = false;
 		return false;
 	}
 
+	card_mounted = true;
+	return true;
+}
+
+
+/**
+ * Partition and format the card for recording (see FMT_*), erasing everything on it.
+ * The card must be present and unmounted.
+ */
+bool file_format_card()
+{
+	FRESULT ret;
+	DWORD plist[] = {100, 0, 0, 0};
+	void* workbuf;
+	uint64_t card_bytes;
+	BYTE opt;
+	DWORD au_len;
+	
+	if (!card_present || card_mounted) {
+		ESP_LOGE(TAG, "Card must be present and unmounted to format");
+		return false;
+	}
+	
+	workbuf = malloc(FMT_WORKBUF_LEN);
+	if (workbuf == NULL) {
+		ESP_LOGE(TAG, "Could not allocate work buffer for sd card format");
+		return false;
+	}
+	
+	card_bytes = (uint64_t) sd_card.csd.capacity * sd_card.csd.sector_size;
+	if (card_bytes > FMT_SDXC_MIN_BYTES) {
+		fmt_block_sectors = FMT_SDXC_ALIGN_LEN / sd_card.csd.sector_size;
+	} else {
+		fmt_block_sectors = FMT_SDHC_ALIGN_LEN / sd_card.csd.sector_size;
+	}
+#if FF_FS_EXFAT
+	if (card_bytes > FMT_SDXC_MIN_BYTES) {
+		opt = FM_EXFAT;
+		au_len = FMT_EXFAT_AU_LEN;
+	} else
+#endif
+	{
+		// Small cards end up FAT16 (which also allows 64 kB clusters)
+		opt = FM_FAT | FM_FAT32;
+		au_len = FMT_FAT_AU_LEN;
+	}
+	
+	// Partition into one partition
+	ESP_LOGI(TAG, "partitioning card");
+	ret = f_fdisk(0, plist, workbuf);
+	if (ret != FR_OK) {
+		free(workbuf);
+		ESP_LOGE(TAG, "Could not partition sd card (%d)", ret);
+		return false;
+	}
+	
+	// Format the partition
+	ESP_LOGI(TAG, "formatting card %s, allocation unit size=%u, aligned to %u sectors",
+	         (opt == FM_EXFAT) ? "exFAT" : "FAT", au_len, fmt_block_sectors);
+	ff_diskio_register(0, &fmt_diskio);
+	ret = f_mkfs("", opt, au_len, workbuf, FMT_WORKBUF_LEN);
+	ff_diskio_register_sdmmc(0, &sd_card);
+	free(workbuf);
+	if (ret != FR_OK) {
+		ESP_LOGE(TAG, "Could not format sd card (%d)", ret);
+		return false;
+	}
+	
+	// Need to set FF_USE_LABEL in ESP IDF components fatfs/src/ffconf.h to use this
+	// Name it
+	//f_setlabel(DEF_SD_CARD_LABEL);
+	
 	return true;
 }
 
@@ -365,6 +503,7 @@ bool file_create_directory(char* dir_name)
 	
 	// Setup for creating the subdirectories
 	cur_sub_directory_num = -1;
+	image_path_sub_directory_num = -1;
 
 	// Check if the directory already exists
 	ret = f_stat(dir_name, NULL);
@@ -389,49 +528,207 @@ bool file_create_directory(char* dir_name)
 
 
 /**
- * Create an image file name in our local variable and return a pointer to it.
+ * Create an image file name in our local variable and return a pointer to it.  Binary
+ * image records use a different extension from json files.
  */
-char* file_get_session_file_name(uint16_t seq_num)
+char* file_get_session_file_name(uint16_t seq_num, bool binary)
 {
-	sprintf(session_file_name, "img_%05d.json", seq_num);
+	sprintf(session_file_name, binary ? "img_%05d.fcr" : "img_%05d.json", seq_num);
 	
 	return session_file_name;
 }
 
 
+/**
+ * Make sure the subdirectory for the image seq_num and the one after it exist so the
+ * next subdirectory is ready before the first image in it is written.  Designed to be
+ * called when file_task has nothing else to do.  Does nothing (quickly) if they
+ * have already been created.
+ */
+bool file_prepare_subdirectories(char* dir_name, uint16_t seq_num)
+{
+	int file_group_num;
+	
+	file_group_num = seq_num / FILES_PER_SUBDIRECTORY;
+	while (cur_sub_directory_num < (file_group_num + 1)) {
+		if (!file_create_subdirectory(dir_name, file_get_subdir_name(cur_sub_directory_num + 1))) {
+			ESP_LOGE(TAG, "Could not create subdirectory %s", session_subdir_name);
+			return false;
+		}
+		cur_sub_directory_num++;
+	}
+	
+	return true;
+}
+
+
 /**
  * Open a file for writing an image to return a file pointer to it
  */
-bool file_open_image_write_file(char* dir_name, uint16_t seq_num, FILE** fp)
+bool file_open_image_write_file(char* dir_name, uint16_t seq_num, bool binary, FILE** fp)
 {
-	char* subdir_name;
-	char* file_name;
-	char full_name[sizeof(base_path) + DIR_NAME_LEN + SUBDIR_NAME_LEN + FILE_NAME_LEN + 3];
+	char full_name[PATH_PREFIX_LEN + FILE_NAME_LEN];
 	int file_group_num;
-	int dir_name_len;
 	
-	// Make sure the subdirectory exists for this file
+	if (strlen(dir_name) == 0) {
+		ESP_LOGE(TAG, "No directory specified for file open");
+		return false;
+	}
+	
+	// Make sure the subdirectory exists for this file (normally it was created ahead of
+	// time by file_prepare_subdirectories)
 	file_group_num = seq_num / FILES_PER_SUBDIRECTORY;
-	subdir_name = file_get_subdir_name(file_group_num);
-	if (file_group_num != cur_sub_directory_num) {
-		if (file_create_subdirectory(dir_name, subdir_name)) {
+	if (file_group_num > cur_sub_directory_num) {
+		if (file_create_subdirectory(dir_name, file_get_subdir_name(file_group_num))) {
 			cur_sub_directory_num = file_group_num;
 		} else {
-			ESP_LOGE(TAG, "Could not create subdirectory %s", subdir_name);
+			ESP_LOGE(TAG, "Could not create subdirectory %s", session_subdir_name);
 			return false;
 		}
 	}
 	
+	// Build the path prefix once per subdirectory
+	if (file_group_num != image_path_sub_directory_num) {
+		image_path_prefix_len = sprintf(image_path_prefix, "%s/%s/%s/", base_path, dir_name,
+		                                file_get_subdir_name(file_group_num));
+		image_path_sub_directory_num = file_group_num;
+	}
+	
 	// Fill a buffer with the full file name
-	dir_name_len = strlen(dir_name);
-	if (dir_name_len == 0) {
+	memcpy(full_name, image_path_prefix, image_path_prefix_len);
+	sprintf(&full_name[image_path_prefix_len], binary ? "img_%05d.fcr" : "img_%05d.json", seq_num);
+
+	// Attempt to open the file
+	*fp = fopen(full_name, "w");
+	if (*fp == NULL) {
+		ESP_LOGE(TAG, "Could not open %s", full_name);
+		return false;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Open a file for writing an image moved from the flash spool, creating the session
+ * directory and the image's subdirectory if necessary.  The image may belong to an
+ * earlier session so this doesn't use or change the subdirectory state of the session
+ * being recorded.
+ */
+bool file_open_spooled_image_file(char* dir_name, uint16_t seq_num, bool binary, FILE** fp)
+{
+	char full_name[PATH_PREFIX_LEN + FILE_NAME_LEN];
+	char* subdir_name;
+	FRESULT ret;
+	
+	if (strlen(dir_name) == 0) {
+		ESP_LOGE(TAG, "No directory specified for file open");
+		return false;
+	}
+	
+	ret = f_stat(dir_name, NULL);
+	if (ret == FR_NO_FILE) {
+		ret = f_mkdir(dir_name);
+	}
+	if (ret != FR_OK) {
+		ESP_LOGE(TAG, "Could not create directory %s (%d)", dir_name, ret);
+		return false;
+	}
+	
+	subdir_name = file_get_subdir_name(seq_num / FILES_PER_SUBDIRECTORY);
+	if (!file_create_subdirectory(dir_name, subdir_name)) {
+		return false;
+	}
+	
+	sprintf(full_name, binary ? "%s/%s/%s/img_%05d.fcr" : "%s/%s/%s/img_%05d.json", base_path, dir_name,
+	        subdir_name, seq_num);
+	*fp = fopen(full_name, "w");
+	if (*fp == NULL) {
+		ESP_LOGE(TAG, "Could not open %s", full_name);
+		return false;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Open the binary high-rate recording file in the session directory.  A new file is
+ * created if offset is 0.  Otherwise the existing file is opened for writing at offset
+ * (to resume an interrupted session after its last complete record).
+ */
+bool file_open_lep_record_file(char* dir_name, uint32_t offset, FILE** fp)
+{
+	char full_name[sizeof(base_path) + DIR_NAME_LEN + sizeof(LEP_RECORD_FILE_NAME) + 2];
+	
+	if (strlen(dir_name) == 0) {
 		ESP_LOGE(TAG, "No directory specified for file open");
 		return false;
 	}
-	file_name = file_get_session_file_name(seq_num);
-	sprintf(full_name, "%s/%s/%s/%s", base_path, dir_name, subdir_name, file_name);
+	sprintf(full_name, "%s/%s/%s", base_path, dir_name, LEP_RECORD_FILE_NAME);
+	
+	if (offset != 0) {
+		*fp = fopen(full_name, "r+");
+		if (*fp != NULL) {
+			if (fseek(*fp, offset, SEEK_SET) == 0) {
+				return true;
+			}
+			fclose(*fp);
+		}
+		ESP_LOGE(TAG, "Could not reopen %s at %u - starting a new file", full_name, offset);
+	}
+	
+	*fp = fopen(full_name, "w");
+	if (*fp == NULL) {
+		ESP_LOGE(TAG, "Could not open %s", full_name);
+		return false;
+	}
+	
+	return true;
+}
 
-	// Attempt to open the file
+
+/**
+ * Open a session container file in the session directory
+ */
+bool file_open_container_file(char* dir_name, int container_num, FILE** fp)
+{
+	char file_name[CONTAINER_FILE_NAME_LEN];
+	char full_name[sizeof(base_path) + DIR_NAME_LEN + CONTAINER_FILE_NAME_LEN + 2];
+	
+	if (strlen(dir_name) == 0) {
+		ESP_LOGE(TAG, "No directory specified for file open");
+		return false;
+	}
+	sprintf(file_name, CONTAINER_FILE_NAME_FMT, container_num);
+	sprintf(full_name, "%s/%s/%s", base_path, dir_name, file_name);
+	
+	*fp = fopen(full_name, "w");
+	if (*fp == NULL) {
+		ESP_LOGE(TAG, "Could not open %s", full_name);
+		return false;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Create a session AVI file (or, if index is set, its index checkpoint file) in the
+ * session directory
+ */
+bool file_open_avi_file(char* dir_name, uint16_t seq_num, bool index, FILE** fp)
+{
+	char file_name[AVI_FILE_NAME_LEN];
+	char full_name[sizeof(base_path) + DIR_NAME_LEN + AVI_FILE_NAME_LEN + 2];
+	
+	if (strlen(dir_name) == 0) {
+		ESP_LOGE(TAG, "No directory specified for file open");
+		return false;
+	}
+	sprintf(file_name, index ? AVI_INDEX_FILE_NAME_FMT : AVI_FILE_NAME_FMT, seq_num);
+	sprintf(full_name, "%s/%s/%s", base_path, dir_name, file_name);
+	
 	*fp = fopen(full_name, "w");
 	if (*fp == NULL) {
 		ESP_LOGE(TAG, "Could not open %s", full_name);
@@ -442,6 +739,317 @@ bool file_open_image_write_file(char* dir_name, uint16_t seq_num, FILE** fp)
 }
 
 
+/**
+ * Open the session index file in the session directory positioned at its end.  An
+ * existing index (from a resumed session) is continued.  is_new is set if the file was
+ * created.
+ */
+bool file_open_index_file(char* dir_name, FILE** fp, bool* is_new)
+{
+	return file_open_session_append_file(dir_name, INDEX_FILE_NAME, fp, is_new);
+}
+
+
+/**
+ * Open the session thumbnail file in the session directory positioned at its end.  Like
+ * the index an existing file is continued.  is_new is set if the file was created.
+ */
+bool file_open_thumb_file(char* dir_name, FILE** fp, bool* is_new)
+{
+	return file_open_session_append_file(dir_name, THUMB_FILE_NAME, fp, is_new);
+}
+
+
+/**
+ * Open the session telemetry log file in the session directory positioned at its end.
+ * Like the index an existing file is continued.  is_new is set if the file was created.
+ */
+bool file_open_tlog_file(char* dir_name, FILE** fp, bool* is_new)
+{
+	return file_open_session_append_file(dir_name, TLOG_FILE_NAME, fp, is_new);
+}
+
+
+/**
+ * Open the session metadata log file in the session directory positioned at its end.
+ * Like the index an existing file is continued.  is_new is set if the file was created.
+ */
+bool file_open_meta_log_file(char* dir_name, FILE** fp, bool* is_new)
+{
+	return file_open_session_append_file(dir_name, META_LOG_FILE_NAME, fp, is_new);
+}
+
+
+/**
+ * Write the session summary file.  It is written to a temporary file that then replaces
+ * the previous summary so a summary on the card is always complete.
+ */
+bool file_write_summary_file(char* dir_name, const char* bufP, uint32_t len)
+{
+	char full_name[sizeof(base_path) + DIR_NAME_LEN + sizeof(SUMMARY_FILE_NAME) + 2];
+	char tmp_name[DIR_NAME_LEN + sizeof(SUMMARY_TMP_FILE_NAME) + 1];
+	char new_name[DIR_NAME_LEN + sizeof(SUMMARY_FILE_NAME) + 1];
+	FILE* fp;
+	FRESULT ret;
+	bool success;
+	
+	if (strlen(dir_name) == 0) {
+		ESP_LOGE(TAG, "No directory specified for file open");
+		return false;
+	}
+	sprintf(full_name, "%s/%s/%s", base_path, dir_name, SUMMARY_TMP_FILE_NAME);
+	
+	fp = fopen(full_name, "w");
+	if (fp == NULL) {
+		ESP_LOGE(TAG, "Could not open %s", full_name);
+		return false;
+	}
+	success = (fwrite(bufP, 1, len, fp) == len);
+	if (fclose(fp) != 0) success = false;
+	if (!success) {
+		ESP_LOGE(TAG, "Could not write %s", full_name);
+		return false;
+	}
+	
+	// FATFS paths are relative to the card
+	sprintf(tmp_name, "%s/%s", dir_name, SUMMARY_TMP_FILE_NAME);
+	sprintf(new_name, "%s/%s", dir_name, SUMMARY_FILE_NAME);
+	ret = f_unlink(new_name);
+	if ((ret != FR_OK) && (ret != FR_NO_FILE)) {
+		ESP_LOGE(TAG, "Could not delete %s (%d)", new_name, ret);
+		return false;
+	}
+	if ((ret = f_rename(tmp_name, new_name)) != FR_OK) {
+		ESP_LOGE(TAG, "Could not rename %s (%d)", tmp_name, ret);
+		return false;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Open (creating or truncating) a file in the root directory for writing
+ */
+bool file_open_root_write_file(const char* name, FILE** fp)
+{
+	char full_name[sizeof(base_path) + FILE_NAME_LEN + 1];
+	
+	if (strlen(name) >= FILE_NAME_LEN) {
+		ESP_LOGE(TAG, "File name %s too long", name);
+		return false;
+	}
+	sprintf(full_name, "%s/%s", base_path, name);
+	
+	*fp = fopen(full_name, "w");
+	if (*fp == NULL) {
+		ESP_LOGE(TAG, "Could not open %s", full_name);
+		return false;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Open (creating if necessary) a file in the root directory for appending
+ */
+bool file_open_root_append_file(const char* name, FILE** fp)
+{
+	char full_name[sizeof(base_path) + FILE_NAME_LEN + 1];
+	
+	if (strlen(name) >= FILE_NAME_LEN) {
+		ESP_LOGE(TAG, "File name %s too long", name);
+		return false;
+	}
+	sprintf(full_name, "%s/%s", base_path, name);
+	
+	*fp = fopen(full_name, "a");
+	if (*fp == NULL) {
+		ESP_LOGE(TAG, "Could not open %s", full_name);
+		return false;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Rename a file in the root directory, replacing any existing file with the new name
+ */
+bool file_rename_root_file(const char* name, const char* new_name)
+{
+	FRESULT ret;
+	
+	ret = f_unlink(new_name);
+	if ((ret != FR_OK) && (ret != FR_NO_FILE)) {
+		ESP_LOGE(TAG, "Could not delete %s (%d)", new_name, ret);
+		return false;
+	}
+	if ((ret = f_rename(name, new_name)) != FR_OK) {
+		ESP_LOGE(TAG, "Could not rename %s (%d)", name, ret);
+		return false;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Delete a file in the root directory
+ */
+bool file_delete_root_file(const char* name)
+{
+	FRESULT ret;
+	
+	if ((ret = f_unlink(name)) != FR_OK) {
+		ESP_LOGE(TAG, "Could not delete %s (%d)", name, ret);
+		return false;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Allocate space for an open file (opened for writing) out to length bytes.  FATFS
+ * allocates the whole cluster chain at once, from the first free cluster, when a file
+ * is extended by a seek so the space is contiguous unless the card is fragmented.  The
+ * contents of the new space are undefined.  The file position is unchanged.
+ *
+ * Note: f_expand() would guarantee a contiguous allocation but it isn't accessible
+ * through VFS FILE streams (and requires FF_USE_EXPAND in the IDF ffconf.h).
+ */
+bool file_preallocate(FILE* fp, uint32_t length)
+{
+	bool success;
+	long pos;
+	
+	pos = ftell(fp);
+	if (pos < 0) return false;
+	if (length <= (uint32_t) pos) return true;
+	
+	success = (fseek(fp, length - 1, SEEK_SET) == 0) &&
+	          (fputc(0, fp) != EOF) &&
+	          (fflush(fp) == 0);
+	fseek(fp, pos, SEEK_SET);
+	
+	return success;
+}
+
+
+/**
+ * Find the oldest session directory on the card, other than exclude_name (which may be
+ * NULL), and copy its name into name (SESSION_DIR_NAME_LEN bytes).  Session directory
+ * names contain their start time so the oldest has the lowest name.  Returns false if
+ * there isn't one.
+ */
+bool file_find_oldest_session(char* exclude_name, char* name)
+{
+	bool found = false;
+	FF_DIR dir;
+	FILINFO fi;
+	
+	if (f_opendir(&dir, "/") != FR_OK) {
+		ESP_LOGE(TAG, "Could not open the root directory");
+		return false;
+	}
+	
+	while ((f_readdir(&dir, &fi) == FR_OK) && (fi.fname[0] != 0)) {
+		if (((fi.fattrib & AM_DIR) == 0) ||
+		    (strncmp(fi.fname, SESSION_DIR_PREFIX, strlen(SESSION_DIR_PREFIX)) != 0) ||
+		    (strlen(fi.fname) >= SESSION_DIR_NAME_LEN)) {
+			continue;
+		}
+		if ((exclude_name != NULL) && (strcmp(fi.fname, exclude_name) == 0)) {
+			continue;
+		}
+		if (!found || (strcmp(fi.fname, name) < 0)) {
+			strcpy(name, fi.fname);
+			found = true;
+		}
+	}
+	f_closedir(&dir);
+	
+	return found;
+}
+
+
+/**
+ * Delete one file, or one empty directory, from a session directory.  Called repeatedly
+ * to remove the session a piece at a time so it can be done between other file operations.
+ * done is set when the session directory itself has been removed.
+ */
+bool file_delete_session_step(char* dir_name, bool* done)
+{
+	char path[DELETE_PATH_LEN];
+	FF_DIR dir;
+	FILINFO fi;
+	FRESULT ret;
+	int len;
+	
+	*done = false;
+	strncpy(path, dir_name, DIR_NAME_LEN - 1);
+	path[DIR_NAME_LEN - 1] = 0;
+	
+	// Descend to the first entry that isn't a non-empty directory
+	while (1) {
+		if ((ret = f_opendir(&dir, path)) != FR_OK) {
+			ESP_LOGE(TAG, "Could not open directory %s (%d)", path, ret);
+			return false;
+		}
+		ret = f_readdir(&dir, &fi);
+		f_closedir(&dir);
+		if (ret != FR_OK) {
+			ESP_LOGE(TAG, "Could not read directory %s (%d)", path, ret);
+			return false;
+		}
+		
+		if (fi.fname[0] == 0) {
+			// Empty directory
+			break;
+		}
+		
+		len = strlen(path);
+		if ((len + 1 + strlen(fi.fname)) >= DELETE_PATH_LEN) {
+			ESP_LOGE(TAG, "Unexpected file %s in %s", fi.fname, path);
+			return false;
+		}
+		path[len] = '/';
+		strcpy(&path[len + 1], fi.fname);
+		
+		if ((fi.fattrib & AM_DIR) == 0) {
+			// A file
+			break;
+		}
+	}
+	
+	if ((ret = f_unlink(path)) != FR_OK) {
+		ESP_LOGE(TAG, "Could not delete %s (%d)", path, ret);
+		return false;
+	}
+	
+	*done = (strcmp(path, dir_name) == 0);
+	return true;
+}
+
+
+/**
+ * Return the free space on the mounted sd card
+ */
+uint64_t file_get_free_bytes()
+{
+	DWORD free_clusters;
+	FATFS* fs;
+	
+	if (f_getfree("", &free_clusters, &fs) != FR_OK) {
+		return 0;
+	}
+	
+	return (uint64_t) free_clusters * fs->csize * sd_card.csd.sector_size;
+}
+
+
 /**
  * Close a file
  */
@@ -457,7 +1065,19 @@ void file_close_file(FILE* fp)
  */
 void file_unmount_sdcard()
 {
-	f_mount(0, "", 0);
+	if (card_mounted) {
+		f_mount(0, "", 0);
+		card_mounted = false;
+	}
+}
+
+
+/**
+ * Getter for card_mounted variable for use by other tasks.
+ */
+bool file_get_card_mounted()
+{
+	return card_mounted;
 }
 
 
@@ -477,6 +1097,70 @@ char* file_get_subdir_name(int subdir_num)
 }
 
 
+/**
+ * Open a file in the session directory positioned at its end, creating it if necessary.
+ * is_new is set if the file was created.
+ */
+static bool file_open_session_append_file(char* dir_name, const char* name, FILE** fp, bool* is_new)
+{
+	char full_name[sizeof(base_path) + DIR_NAME_LEN + FILE_NAME_LEN + 2];
+	
+	if (strlen(dir_name) == 0) {
+		ESP_LOGE(TAG, "No directory specified for file open");
+		return false;
+	}
+	sprintf(full_name, "%s/%s/%s", base_path, dir_name, name);
+	
+	*fp = fopen(full_name, "r+");
+	if (*fp != NULL) {
+		if (fseek(*fp, 0, SEEK_END) == 0) {
+			*is_new = false;
+			return true;
+		}
+		fclose(*fp);
+	}
+	
+	*fp = fopen(full_name, "w");
+	if (*fp == NULL) {
+		ESP_LOGE(TAG, "Could not open %s", full_name);
+		return false;
+	}
+	
+	*is_new = true;
+	return true;
+}
+
+
+/**
+ * Initialize the card in the fastest bus mode it works in.  sdmmc_card_init only
+ * switches to high-speed mode and the wider bus if the card supports them but a card
+ * (or socket) may still fail at the faster clock so we fall back to slower modes.
+ */
+bool file_negotiate_card_init()
+{
+	int i;
+	
+	for (i=0; i<SD_NUM_BUS_MODES; i++) {
+		host_driver.max_freq_khz = sd_bus_modes[i].freq_khz;
+		slot_config.width = sd_bus_modes[i].width;
+		
+		// Reconfigure the SD Slot (necessary before initializing card)
+		if (sdmmc_host_init_slot(host_driver.slot, &slot_config) != ESP_OK) {
+			ESP_LOGE(TAG, "Could not initialize SD Slot for %d-bit mode", sd_bus_modes[i].width);
+			continue;
+		}
+		
+		if (sdmmc_card_init(&host_driver, &sd_card) == ESP_OK) {
+			ESP_LOGI(TAG, "SD Card using %d-bit bus at %d kHz", 1 << sd_card.log_bus_width,
+			         sd_card.max_freq_khz);
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+
 /**
  * Create a subdirectory
  */
@@ -508,3 +1192,50 @@ bool file_create_subdirectory(char* dir_name, char* subdir_name)
 	}
 	return true;
 }
+
+
+/**
+ * Format disk driver - the card is already initialized
+ */
+static DSTATUS file_fmt_disk_init(unsigned char pdrv)
+{
+	return 0;
+}
+
+
+static DSTATUS file_fmt_disk_status(unsigned char pdrv)
+{
+	return 0;
+}
+
+
+static DRESULT file_fmt_disk_read(unsigned char pdrv, unsigned char* buff, uint32_t sector, unsigned count)
+{
+	return (sdmmc_read_sectors(&sd_card, buff, sector, count) == ESP_OK) ? RES_OK : RES_ERROR;
+}
+
+
+static DRESULT file_fmt_disk_write(unsigned char pdrv, const unsigned char* buff, uint32_t sector, unsigned count)
+{
+	return (sdmmc_write_sectors(&sd_card, buff, sector, count) == ESP_OK) ? RES_OK : RES_ERROR;
+}
+
+
+static DRESULT file_fmt_disk_ioctl(unsigned char pdrv, unsigned char cmd, void* buff)
+{
+	switch (cmd) {
+		case CTRL_SYNC:
+			return RES_OK;
+		case GET_SECTOR_COUNT:
+			*((DWORD*) buff) = sd_card.csd.capacity;
+			return RES_OK;
+		case GET_SECTOR_SIZE:
+			*((WORD*) buff) = sd_card.csd.sector_size;
+			return RES_OK;
+		case GET_BLOCK_SIZE:
+			*((DWORD*) buff) = fmt_block_sectors;
+			return RES_OK;
+	}
+	
+	return RES_ERROR;
+}
@@ -0,0 +1,137 @@
+/*
+ * Fork-join helper to split per-pixel work across both cores
+ *
+ * A kernel over n units (rows, blocks) is split in half.  A helper task pinned to the
+ * other core runs the second half while the caller runs the first half, and the caller
+ * waits for the helper before returning.  The whole kernel runs in the caller when the
+ * helper isn't running or is already busy with another caller's kernel.  Only worth it
+ * for kernels taking much longer than the handoff (tens of uSec).
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "fork_utilities.h"
+#include "system_config.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+
+
+//
+// Fork Utilities variables
+//
+static const char* TAG = "fork_utilities";
+
+static TaskHandle_t fork_task_handle = NULL;
+
+// Held by the caller owning the helper for one kernel
+static SemaphoreHandle_t fork_mutex;
+
+// Given by the helper when its half is done
+static SemaphoreHandle_t fork_done_sem;
+
+// Helper's half of the current kernel
+static fork_kernel_t fork_kernel;
+static void* fork_argP;
+static int fork_start;
+static int fork_end;
+
+
+
+//
+// Fork Utilities Forward Declarations for internal functions
+//
+static void fork_task(void* arg);
+
+
+
+//
+// Fork Utilities API
+//
+
+/**
+ * Start the helper task.  Kernels run on one core if this fails.
+ */
+bool fork_init()
+{
+	fork_mutex = xSemaphoreCreateMutex();
+	fork_done_sem = xSemaphoreCreateBinary();
+	if ((fork_mutex == NULL) || (fork_done_sem == NULL)) {
+		ESP_LOGE(TAG, "Could not create semaphores");
+		return false;
+	}
+	
+	if (xTaskCreatePinnedToCore(&fork_task, "fork_task", FORK_TASK_STACK, NULL,
+	                            FORK_TASK_PRIO, &fork_task_handle, FORK_TASK_CORE) != pdPASS)
+	{
+		ESP_LOGE(TAG, "Could not start helper task");
+		fork_task_handle = NULL;
+		return false;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Run kernel over units [0, n), splitting them with the helper if it is free
+ */
+void fork_run(fork_kernel_t kernel, void* argP, int n)
+{
+	int half = n / 2;
+	
+	if ((fork_task_handle == NULL) || (half == 0) || (xSemaphoreTake(fork_mutex, 0) != pdTRUE)) {
+		kernel(argP, 0, n);
+		return;
+	}
+	
+	fork_kernel = kernel;
+	fork_argP = argP;
+	fork_start = half;
+	fork_end = n;
+	xTaskNotifyGive(fork_task_handle);
+	
+	kernel(argP, 0, half);
+	
+	(void) xSemaphoreTake(fork_done_sem, portMAX_DELAY);
+	xSemaphoreGive(fork_mutex);
+}
+
+
+
+//
+// Fork Utilities internal functions
+//
+
+/**
+ * Helper task - runs the second half of each kernel
+ */
+static void fork_task(void* arg)
+{
+	ESP_LOGI(TAG, "Start task");
+	
+	while (1) {
+		(void) ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	
+		fork_kernel(fork_argP, fork_start, fork_end);
+	
+		xSemaphoreGive(fork_done_sem);
+	}
+}
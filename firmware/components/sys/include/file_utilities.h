@@ -25,6 +25,7 @@
 #ifndef FILE_UTILITIES_H
 #define FILE_UTILITIES_H
 
+#include "system_config.h"
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -36,26 +37,86 @@
 //
 #define DEF_SD_CARD_LABEL "FIRECAM"
 
+// Session directory name length (including null).  Names are
+// "session_YY_MM_DD_HH_MM_SS" so they sort by age.
+#define SESSION_DIR_NAME_LEN 32
+#define SESSION_DIR_PREFIX   "session_"
+
 // Number of image files per subdirectory
 #define FILES_PER_SUBDIRECTORY 100
 
+// High-rate recording file name (one per session directory)
+#define LEP_RECORD_FILE_NAME "lepton.bin"
+
+// Session container file names (a session has more than one if the first fills up)
+#define CONTAINER_FILE_NAME_FMT "images_%03d.fcs"
+#define CONTAINER_FILE_NAME_LEN 16
+
+// Session index file name (one per session directory)
+#define INDEX_FILE_NAME "index.fci"
+
+// Session thumbnail file name (one per session directory)
+#define THUMB_FILE_NAME "thumbs.fct"
+
+// Session telemetry log file name (one per session directory)
+#define TLOG_FILE_NAME "telemetry.fcl"
+
+// Session metadata log file name (one per session directory)
+#define META_LOG_FILE_NAME "metadata.jsonl"
+
+// Session summary file and the temporary file it is written to before replacing the
+// previous one (one per session directory)
+#define SUMMARY_FILE_NAME     "summary.json"
+#define SUMMARY_TMP_FILE_NAME "summary.tmp"
+
+// Session MJPEG AVI file and its index checkpoint file names (numbered with the sequence
+// number of the file's first image)
+#define AVI_FILE_NAME_FMT       "video_%05u.avi"
+#define AVI_INDEX_FILE_NAME_FMT "video_%05u.avx"
+#define AVI_FILE_NAME_LEN       16
+
 
 //
 // File Utilities API
 //
 bool file_init_sdmmc_driver();
 bool file_check_card_still_present();
+void file_set_card_removed();
+#ifdef SD_CD_IO
+bool file_get_card_detect();
+#endif
 bool file_get_card_present();
 bool file_check_card_inserted();
 bool file_init_card();
 bool file_reinit_card();
+bool file_get_card_mode(int* width, int* freq_khz);
 bool file_mount_sdcard();
+bool file_format_card();
 char* file_get_session_directory_name();
 bool file_create_directory(char* dir_name);
-char* file_get_session_file_name(uint16_t seq_num);
-bool file_open_image_write_file(char* dir_name, uint16_t seq_num, FILE** fp);
+char* file_get_session_file_name(uint16_t seq_num, bool binary);
+bool file_prepare_subdirectories(char* dir_name, uint16_t seq_num);
+bool file_open_image_write_file(char* dir_name, uint16_t seq_num, bool binary, FILE** fp);
+bool file_open_spooled_image_file(char* dir_name, uint16_t seq_num, bool binary, FILE** fp);
+bool file_open_lep_record_file(char* dir_name, uint32_t offset, FILE** fp);
+bool file_open_container_file(char* dir_name, int container_num, FILE** fp);
+bool file_open_index_file(char* dir_name, FILE** fp, bool* is_new);
+bool file_open_thumb_file(char* dir_name, FILE** fp, bool* is_new);
+bool file_open_tlog_file(char* dir_name, FILE** fp, bool* is_new);
+bool file_open_meta_log_file(char* dir_name, FILE** fp, bool* is_new);
+bool file_open_avi_file(char* dir_name, uint16_t seq_num, bool index, FILE** fp);
+bool file_write_summary_file(char* dir_name, const char* bufP, uint32_t len);
+bool file_open_root_write_file(const char* name, FILE** fp);
+bool file_open_root_append_file(const char* name, FILE** fp);
+bool file_rename_root_file(const char* name, const char* new_name);
+bool file_delete_root_file(const char* name);
+bool file_preallocate(FILE* fp, uint32_t length);
+bool file_find_oldest_session(char* exclude_name, char* name);
+bool file_delete_session_step(char* dir_name, bool* done);
+uint64_t file_get_free_bytes();
 void file_close_file(FILE* fp);
 void file_unmount_sdcard();
+bool file_get_card_mounted();
 
 
 
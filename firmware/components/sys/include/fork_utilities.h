@@ -0,0 +1,51 @@
+/*
+ * Fork-join helper to split per-pixel work across both cores
+ *
+ * A kernel over n units (rows, blocks) is split in half.  A helper task pinned to the
+ * other core runs the second half while the caller runs the first half, and the caller
+ * waits for the helper before returning.  The whole kernel runs in the caller when the
+ * helper isn't running or is already busy with another caller's kernel.  Only worth it
+ * for kernels taking much longer than the handoff (tens of uSec).
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef FORK_UTILITIES_H
+#define FORK_UTILITIES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+//
+// Fork Utilities typedefs
+//
+
+// Kernel run over units [start, end).  argP is shared by both halves so a kernel must
+// only write the outputs belonging to its own units.
+typedef void (*fork_kernel_t)(void* argP, int start, int end);
+
+
+
+//
+// Fork Utilities API
+//
+bool fork_init();
+void fork_run(fork_kernel_t kernel, void* argP, int n);
+
+#endif /* FORK_UTILITIES_H */
@@ -0,0 +1,116 @@
+/*
+ * Runtime performance counters
+ *
+ * Always-on timing statistics and latency histograms for each stage of the image
+ * pipeline and event counters for the Lepton frame stream.  Recording a time is
+ * cheap enough to do for every operation and may be done from any task or ISR.
+ * Per-task CPU use and stack high-water marks are sampled every few seconds.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PERF_UTILITIES_H
+#define PERF_UTILITIES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_attr.h"
+#include "freertos/FreeRTOS.h"
+
+
+//
+// Perf Utilities constants
+//
+
+// Timed stages
+#define PERF_VOSPI_SEGMENT 0
+#define PERF_CAM_CAPTURE   1
+#define PERF_CAM_READOUT   2
+#define PERF_JSON_BUILD    3
+#define PERF_SD_WRITE      4
+#define PERF_TCP_SEND      5
+#define PERF_JPEG_DECODE   6
+#define PERF_LCD_FLUSH     7
+#define PERF_TOUCH_ACTION  8
+#define PERF_LEP_GAIN      9
+#define PERF_NUM_STAGES    10
+
+// Event counters
+#define PERF_CNT_LEP_VSYNC 0
+#define PERF_CNT_LEP_FRAME 1
+#define PERF_CNT_LEP_DUP_FRAME  2
+#define PERF_CNT_LEP_SKIP_FRAME 3
+#define PERF_CNT_LEP_GAIN_FRAME 4
+#define PERF_NUM_COUNTERS  5
+
+// The Lepton outputs one frame every 12 vsyncs (segment periods)
+#define PERF_LEP_VSYNC_PER_FRAME 12
+
+// Latency histogram.  Bin 0 holds times shorter than (1 << PERF_HIST_SHIFT) uSec and
+// each following bin twice the range of the previous one.  The last bin holds all
+// longer times (about 262 mSec and up).
+#define PERF_HIST_SHIFT    6
+#define PERF_HIST_BINS     14
+
+// Task statistics.  Each task's CPU use is measured over the PERF_TASK_SAMPLE_MSEC
+// period between calls to perf_sample_tasks().
+#define PERF_MAX_TASKS        24
+#define PERF_TASK_SAMPLE_MSEC 5000
+
+
+
+//
+// Perf Utilities typedefs
+//
+typedef struct {
+	uint32_t count;
+	uint32_t last_usec;
+	uint32_t min_usec;
+	uint32_t max_usec;
+	uint64_t total_usec;
+	uint32_t hist[PERF_HIST_BINS];
+} perf_stage_t;
+
+typedef struct {
+	perf_stage_t stage[PERF_NUM_STAGES];
+	uint32_t counter[PERF_NUM_COUNTERS];
+} perf_stats_t;
+
+typedef struct {
+	char name[configMAX_TASK_NAME_LEN];
+	int8_t core;                // Core the task is pinned to, -1 if it can run on either
+	uint8_t cpu;                // Percent of one core used during the last sample period
+	uint16_t priority;
+	uint32_t stack_free;        // Minimum free stack (bytes) since the task started
+} perf_task_t;
+
+
+
+//
+// Perf Utilities API
+//
+void perf_record(int stage, uint32_t usec);
+void IRAM_ATTR perf_record_isr(int stage, uint32_t usec);
+void perf_count(int counter);
+void perf_count_n(int counter, uint32_t n);
+void perf_get(perf_stats_t* statsP);
+const char* perf_stage_name(int stage);
+void perf_sample_tasks();
+int perf_get_tasks(perf_task_t* tasksP);
+
+#endif /* PERF_UTILITIES_H */
@@ -0,0 +1,66 @@
+/*
+ * Power management
+ *
+ * Dynamic frequency scaling and automatic light sleep through the IDF's esp_pm.  The
+ * CPU runs at SYS_PM_MIN_FREQ_MHZ and the system light sleeps (with SYS_PM_LIGHT_SLEEP)
+ * whenever every task is waiting and no user holds a level that prevents it.  Users
+ * raise their level around work with deadlines (VoSPI segments, SPI DMA bursts, WiFi
+ * sends) and while they rely on peripherals or GPIO interrupts that stop during light
+ * sleep.  Requires CONFIG_PM_ENABLE (and CONFIG_FREERTOS_USE_TICKLESS_IDLE for light
+ * sleep) in sdkconfig.  Without it the calls do nothing and the CPU runs at the
+ * sdkconfig default frequency.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PM_UTILITIES_H
+#define PM_UTILITIES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+//
+// PM Utilities constants
+//
+
+// Users.  Each user's level is only changed by one task at a time.
+#define PM_USER_LEP   0
+#define PM_USER_CAM   1
+#define PM_USER_GUI   2
+#define PM_USER_WIFI  3
+#define PM_USER_CMD   4
+#define PM_USER_FILE  5
+#define PM_USER_I2C   6
+#define PM_NUM_USERS  7
+
+// Levels
+#define PM_LEVEL_SLEEP 0     // No requirement: the CPU may slow and the system light sleep
+#define PM_LEVEL_AWAKE 1     // No light sleep: peripherals and GPIO interrupts keep running
+#define PM_LEVEL_FAST  2     // CPU at SYS_PM_MAX_FREQ_MHZ (no light sleep)
+
+
+
+//
+// PM Utilities API
+//
+bool pm_init();
+void pm_set_level(int user, int level);
+int pm_get_level(int user);
+
+#endif /* PM_UTILITIES_H */
@@ -0,0 +1,81 @@
+/*
+ * Single-producer, single-consumer ring of slots
+ *
+ * The ring only manages slot indicies.  The caller owns an array of len slots (typically
+ * descriptors of large PSRAM buffers) so nothing is copied.  The producer fills the slot
+ * it gets from ring_write_slot and publishes it.  The consumer gets the oldest published
+ * slot from ring_read_slot and releases it when done.  Each index is only written by
+ * one side so a RING_BLOCK_ON_FULL ring needs no lock.  A RING_OVERWRITE_OLDEST ring lets
+ * the producer reclaim the oldest published slot (that the consumer isn't reading) so
+ * it takes a short critical section.  The other side is woken by a task notification.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef RING_UTILITIES_H
+#define RING_UTILITIES_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+
+//
+// Ring Utilities constants
+//
+
+// Full ring policies
+#define RING_BLOCK_ON_FULL    0   /* ring_write_slot fails until the consumer releases a slot */
+#define RING_OVERWRITE_OLDEST 1   /* ring_write_slot reclaims the oldest unread slot */
+
+
+
+//
+// Ring Utilities typedefs
+//
+typedef struct {
+	int len;                         // Number of slots
+	int policy;                      // RING_BLOCK_ON_FULL or RING_OVERWRITE_OLDEST
+	volatile int head;               // Next slot to publish (0 - 2*len-1, producer only)
+	volatile int tail;               // Oldest published slot (0 - 2*len-1, consumer only)
+	volatile bool reading;           // Consumer has the tail slot
+	volatile uint32_t overwritten;   // Slots reclaimed before they were read
+	TaskHandle_t producer_task;      // Notified with producer_mask when a slot is released
+	uint32_t producer_mask;
+	TaskHandle_t consumer_task;      // Notified with consumer_mask when a slot is published
+	uint32_t consumer_mask;
+	portMUX_TYPE mux;                // Used by RING_OVERWRITE_OLDEST rings
+} ring_t;
+
+
+
+//
+// Ring Utilities API
+//
+void ring_init(ring_t* r, int len, int policy);
+void ring_set_producer(ring_t* r, TaskHandle_t task, uint32_t mask);
+void ring_set_consumer(ring_t* r, TaskHandle_t task, uint32_t mask);
+int ring_write_slot(ring_t* r, bool* overwroteP);
+void ring_publish(ring_t* r);
+int ring_read_slot(ring_t* r);
+void ring_release(ring_t* r);
+int ring_count(ring_t* r);
+uint32_t ring_overwritten(ring_t* r);
+
+#endif /* RING_UTILITIES_H */
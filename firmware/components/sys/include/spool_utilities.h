@@ -0,0 +1,101 @@
+/*
+ * Internal flash spool for recorded images
+ *
+ * A log of records in the "spool" data partition that file_task writes images to when
+ * they can't be written to the Micro-SD Card and moves to the card, oldest first, once
+ * it is writing again.  The records survive a restart so images spooled before a
+ * session was suspended (or the camera lost power) are moved after it starts again.
+ *
+ * Records are appended from the start of the partition.  Each is a spool_header_t
+ * followed by its data, padded to a 4-byte boundary.  Flash bits can be cleared without
+ * an erase so a record's state moves from SPOOL_STATE_WRITING through SPOOL_STATE_VALID
+ * (completely written) to SPOOL_STATE_DONE (moved or abandoned) by rewriting its state
+ * word in place.  Once every record is done the log starts again at the beginning of
+ * the partition with the next generation number so records left from the previous pass
+ * are ignored.  Each sector is erased just before the log first writes into it (flash
+ * operations stall both cores so this limits each stall to one sector erase or write).
+ * The partition isn't reclaimed until it is empty so it holds as many images as fit
+ * between two times the card catches up.
+ *
+ * Only used by file_task.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef SPOOL_UTILITIES_H
+#define SPOOL_UTILITIES_H
+
+#include "file_utilities.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+
+//
+// Spool Utilities constants
+//
+
+// Partition (see partitions.csv)
+#define SPOOL_PARTITION_LABEL  "spool"
+#define SPOOL_PARTITION_TYPE   0x40
+
+#define SPOOL_MAGIC            0x50534346   /* "FCSP" */
+
+// Record states
+#define SPOOL_STATE_WRITING    0xFFFFFFFF
+#define SPOOL_STATE_VALID      0xFFFF0000
+#define SPOOL_STATE_DONE       0x00000000
+
+// Caller information stored with a record when it is completed
+#define SPOOL_INFO_LEN         32
+
+// Data is written to flash through an internal buffer of this size (the source is
+// usually in PSRAM which can't be read while the flash cache is disabled)
+#define SPOOL_BUF_LEN          4096
+
+
+
+//
+// Spool Utilities typedefs
+//
+typedef struct {
+	uint32_t magic;              // SPOOL_MAGIC
+	uint32_t state;              // SPOOL_STATE_*
+	uint32_t generation;         // Pass through the partition the record was written in
+	uint32_t length;             // Data following the header
+	uint16_t type;               // Caller's record type
+	uint16_t seq_num;            // Caller's sequence number
+	char dir_name[SESSION_DIR_NAME_LEN];  // Session directory the record belongs in
+	uint8_t info[SPOOL_INFO_LEN];         // Caller information (written with the state)
+} __attribute__((packed)) spool_header_t;
+
+
+
+//
+// Spool Utilities API
+//
+bool spool_init();
+int spool_get_count();
+uint32_t spool_get_free_bytes();
+bool spool_start_record(const char* dir_name, uint16_t seq_num, uint16_t type, uint32_t length);
+bool spool_write(const uint8_t* bufP, uint32_t length);
+bool spool_end_record(bool success, const void* infoP, int info_len);
+bool spool_get_next(spool_header_t* hdrP);
+bool spool_read(uint32_t offset, uint8_t* bufP, uint32_t length);
+void spool_release();
+
+#endif /* SPOOL_UTILITIES_H */
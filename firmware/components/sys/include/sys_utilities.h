@@ -28,6 +28,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "system_config.h"
+#include "trace_utilities.h"
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -43,29 +44,226 @@
 #define SYS_GAIN_AUTO 2
 #define SYS_GAIN_DD_STRING "High\nLow\nAuto"
 
+// ArduCAM resolution
+#define SYS_CAM_RES_640x480 0
+#define SYS_CAM_RES_320x240 1
+#define SYS_CAM_RES_160x120 2
+
+// ArduCAM region of interest.  The region is specified in SYS_CAM_ROI_UNIT pixel steps
+// of a 640x480 image and scaled to the current resolution.  A zero width or height
+// selects the full image.
+#define SYS_CAM_ROI_UNIT       8
+#define SYS_CAM_ROI_REF_WIDTH  640
+#define SYS_CAM_ROI_REF_HEIGHT 480
+
+// Lepton display AGC - how the GUI maps lepton values to palette colors
+#define SYS_LEP_AGC_LINEAR  0
+#define SYS_LEP_AGC_CLIP    1
+#define SYS_LEP_AGC_HEQ     2
+#define SYS_LEP_AGC_PLATEAU 3
+#define SYS_LEP_AGC_NUM     4
+
+// Lepton/ArduCAM image fusion - how the GUI combines the ArduCAM image with the Lepton
+// image in the Lepton display area
+#define SYS_FUSION_OFF   0
+#define SYS_FUSION_BLEND 1
+#define SYS_FUSION_EDGE  2
+#define SYS_FUSION_NUM   3
+
+// Image fusion calibration.  The alpha is the Lepton's weight in a blend.  The Lepton
+// image is centered on the ArduCAM display pixel offset from the center of the ArduCAM
+// image and spans the scale percent of the ArduCAM image.
+#define SYS_FUSION_ALPHA_MIN  1
+#define SYS_FUSION_ALPHA_MAX  100
+#define SYS_FUSION_ALPHA_DEF  50
+#define SYS_FUSION_OFFSET_MAX 40
+#define SYS_FUSION_SCALE_MIN  50
+#define SYS_FUSION_SCALE_MAX  200
+#define SYS_FUSION_SCALE_DEF  100
+
+// Image fusion parallax distances in cm (0 for none).  Offsets calibrated at one distance
+// are scaled to the subject distance (parallax is inversely proportional to distance).
+#define SYS_FUSION_DIST_MIN   30
+#define SYS_FUSION_DIST_MAX   10000
+
+// Lepton radiometric statistics regions of interest (in addition to the full frame).
+// Regions are specified in Lepton pixels.  A zero width or height disables a region.
+#define SYS_LEP_STATS_MAX_ROI 2
+
+// Statistics region emissivity (percent) and reflected temperature (K * 100) corrections.
+// A region with an emissivity of 100% is uncorrected.
+#define SYS_LEP_EMISSIVITY_MIN 10
+#define SYS_LEP_EMISSIVITY_MAX 100
+#define SYS_LEP_REFL_DEF_K100  29515
+
+// Radiometric alarm.  An alarm event starts when the selected statistic of the frame or
+// a statistics region exceeds (ABOVE) or falls below (BELOW) the threshold or, with a
+// non-zero rate, changes faster than the rate.  RATE only checks the rate.  The event
+// ends alarm_hold seconds after its condition was last true.
+#define SYS_ALARM_OFF   0
+#define SYS_ALARM_ABOVE 1
+#define SYS_ALARM_BELOW 2
+#define SYS_ALARM_RATE  3
+#define SYS_ALARM_NUM   4
+
+// Alarm statistics (values of a lep_roi_stats_t)
+#define SYS_ALARM_STAT_MIN    0
+#define SYS_ALARM_STAT_MAX    1
+#define SYS_ALARM_STAT_MEAN   2
+#define SYS_ALARM_STAT_P_LOW  3
+#define SYS_ALARM_STAT_P_MID  4
+#define SYS_ALARM_STAT_P_HIGH 5
+#define SYS_ALARM_STAT_NUM    6
+
+// Alarm threshold (K * 100) and rate (K * 100 per second) are stored in unit steps
+#define SYS_ALARM_THRESH_UNIT 10
+#define SYS_ALARM_THRESH_MAX  (65535 * SYS_ALARM_THRESH_UNIT)
+#define SYS_ALARM_RATE_UNIT   10
+#define SYS_ALARM_RATE_MAX    (255 * SYS_ALARM_RATE_UNIT)
+#define SYS_ALARM_HOLD_MIN    1
+#define SYS_ALARM_HOLD_DEF    10
+
+// Isotherm display - Lepton pixels at or above the high threshold (ABOVE), at or below
+// the low threshold (BELOW) or between them (BETWEEN) are displayed in the isotherm color
+// instead of their palette color.  Thresholds are in K * 100.
+#define SYS_ISO_OFF     0
+#define SYS_ISO_ABOVE   1
+#define SYS_ISO_BELOW   2
+#define SYS_ISO_BETWEEN 3
+#define SYS_ISO_NUM     4
+
+#define SYS_ISO_THRESH_MAX 65535
+
+#define SYS_ISO_COLOR_WHITE   0
+#define SYS_ISO_COLOR_BLACK   1
+#define SYS_ISO_COLOR_RED     2
+#define SYS_ISO_COLOR_GREEN   3
+#define SYS_ISO_COLOR_BLUE    4
+#define SYS_ISO_COLOR_MAGENTA 5
+#define SYS_ISO_COLOR_NUM     6
+
+// Touch meter on the main screen Lepton image - the mean of a small spot or the maximum
+// and mean of a box, placed by touching the image
+#define SYS_METER_OFF  0
+#define SYS_METER_SPOT 1
+#define SYS_METER_BOX  2
+#define SYS_METER_NUM  3
+
+// Session telemetry log - samples per second written to a recording session's
+// telemetry log (0 disables it)
+#define SYS_TLOG_MAX_RATE 10
+
+// Lepton coarse histogram (bins cover the full 16-bit pixel range)
+#define LEP_HIST_SHIFT 8
+#define LEP_HIST_BINS  (65536 >> LEP_HIST_SHIFT)
+
+// Image content flags (select what is included in an image file or response)
+#define IMG_CONTENT_CAM   0x01
+#define IMG_CONTENT_LEP   0x02
+#define IMG_CONTENT_TELEM 0x04
+#define IMG_CONTENT_META  0x08
+#define IMG_CONTENT_ALL   (IMG_CONTENT_CAM | IMG_CONTENT_LEP | IMG_CONTENT_TELEM | IMG_CONTENT_META)
+
+// Low-bandwidth 80x60 8-bit Lepton preview (prevcodec.h).  Only streamed to remote
+// clients that ask for it so it isn't part of IMG_CONTENT_ALL.
+#define IMG_CONTENT_PREVIEW 0x10
+
+// VSPI bus users in increasing priority.  A user holding the bus for a long transfer
+// splits it into slices and calls system_yield_vspi() between them so a waiting higher
+// priority user gets the bus within one slice.
+#define VSPI_USER_CAM 0
+#define VSPI_USER_LCD 1
+#define VSPI_USER_TS  2
+#define VSPI_NUM_USERS 3
+
+// Maximum time a yielding user waits for the higher priority user to finish
+#define VSPI_HANDOFF_MAX_MSEC 20
+
+// Frame event streams.  Each carries frame descriptors from one producer (cam_task or
+// lep_task) to app_task in order.  The queues are deep enough to hold every frame that
+// can be in flight so no handoff is lost when app_task falls behind for a moment.
+#define SYS_FRAME_STREAM_CAM  0
+#define SYS_FRAME_STREAM_LEP  1
+#define SYS_FRAME_NUM_STREAMS 2
+#define SYS_FRAME_QUEUE_LEN   4
+
+// Frame event flags
+#define SYS_FRAME_FLAG_FAIL   0x01           /* Producer failed to get the requested frame */
+
+// The ArduCAM is initialized by a short-lived task during system_peripheral_init so its
+// reset delays overlap the rest of the peripheral initialization
+#define SYS_CAM_INIT_STACK        2048
+#define SYS_CAM_INIT_PRIO         2
+#define SYS_CAM_INIT_CORE         1
+#define SYS_CAM_INIT_DONE_MASK    0x00000001
+#define SYS_CAM_INIT_TIMEOUT_MSEC 5000
+
 
 
 //
 // System Utilities typedefs
 //
 typedef struct {
+	int ref_count;
+	int64_t timestamp_usec;          // esp_timer time the capture completed
+	int64_t start_usec;              // esp_timer time the capture was started
+	uint32_t capture_num;            // Producer's count of images read (from 1)
 	uint32_t cam_buffer_len;
 	uint8_t* cam_bufferP;
 } cam_buffer_t;
 
+// Lepton telemetry decoded once per frame (by lepton_decode_telem) so consumers don't
+// index the raw telemetry words
 typedef struct {
+	uint32_t frame_count;            // Lepton frame counter (counts every core frame)
+	uint32_t uptime_msec;            // Lepton uptime when the frame was captured
+	uint32_t status;                 // Status DWORD (LEP_STATUS_*)
+	uint32_t ffc_state;              // LEP_FFC_STATE_*
+	bool ffc_desired;
+	uint32_t last_ffc_msec;          // Uptime at the last FFC
+	uint16_t fpa_temp_k100;
+	uint16_t aux_temp_k100;          // Housing temperature
+	uint16_t last_ffc_fpa_k100;      // FPA temperature at the last FFC
+	uint16_t gain_mode;              // Gain mode in use (the one auto gain chose when set)
+	bool gain_auto;                  // Lepton is in auto gain mode
+	int tlin_scale;                  // K * 100 per pixel count (LEP_TLIN_SCALE_*)
+} lep_telem_t;
+
+typedef struct {
+	int ref_count;                   // Managed by the lepton frame pool functions
+	int64_t timestamp_usec;          // esp_timer time of the vsync completing the frame
 	bool telem_valid;
 	uint16_t lep_min_val;
 	uint16_t lep_max_val;
+	bool hist_valid;
+	uint16_t lep_hist[LEP_HIST_BINS];
 	uint16_t* lep_bufferP;
 	uint16_t* lep_telemP;
+	lep_telem_t telem;               // Decoded from lep_telemP (defaults if !telem_valid)
 } lep_buffer_t;
 
 typedef struct {
+	int ref_count;
 	uint32_t length;
 	char* bufferP;
 } json_image_string_t;
 
+// Frame descriptor passed from a producer to app_task.  The event owns a reference to
+// the buffer that the consumer takes over (or releases).
+typedef struct {
+	uint32_t seq_num;                // Producer's count of posted frames
+	uint32_t flags;                  // SYS_FRAME_FLAG_*
+	int64_t timestamp_usec;          // Capture time (0 for a failure)
+	void* bufP;                      // cam_buffer_t* or lep_buffer_t* (NULL for a failure)
+} sys_frame_event_t;
+
+typedef struct {
+	uint8_t x;
+	uint8_t y;
+	uint8_t w;
+	uint8_t h;
+} sys_lep_roi_t;
+
 typedef struct {
 	bool rec_arducam_enable;
 	bool rec_lepton_enable;
@@ -73,6 +271,42 @@ typedef struct {
 	uint16_t record_interval;
 	int record_interval_index;
 	int palette_index;
+	uint8_t record_format;      // REC_FORMAT_JSON, REC_FORMAT_BINARY, REC_FORMAT_BINARY_Z or REC_FORMAT_AVI
+	bool record_container;      // Append a session's images to one container file
+	bool record_ring;           // Delete the oldest sessions when the card is nearly full
+	bool record_motion;         // Record every second while the scene is changing
+	bool record_sleep;          // Deep sleep between images at long recording intervals
+	bool record_meta_log;       // Log seconds without an image in the session metadata log
+	uint8_t cam_resolution;     // SYS_CAM_RES_xxx
+	uint8_t cam_quality;        // OV2640 JPEG quantization scale (lower is higher quality)
+	uint16_t cam_roi_x;         // Region of interest in a 640x480 image (w or h 0 for full image)
+	uint16_t cam_roi_y;
+	uint16_t cam_roi_w;
+	uint16_t cam_roi_h;
+	uint8_t lep_agc_mode;       // SYS_LEP_AGC_xxx
+	uint8_t fusion_mode;        // SYS_FUSION_xxx
+	uint8_t fusion_alpha;       // Lepton percent in a blend
+	int8_t fusion_offset_x;     // Parallax correction in ArduCAM display pixels
+	int8_t fusion_offset_y;
+	uint8_t fusion_scale;       // Percent of the ArduCAM image spanned by the Lepton image
+	uint16_t fusion_cal_dist;   // Distance in cm the offsets were calibrated at (0 for none)
+	uint16_t fusion_dist;       // Subject distance in cm the offsets are scaled to (0 for none)
+	sys_lep_roi_t stats_roi[SYS_LEP_STATS_MAX_ROI]; // Lepton statistics regions
+	uint8_t stats_emissivity[SYS_LEP_STATS_MAX_ROI];  // Percent
+	uint16_t stats_refl[SYS_LEP_STATS_MAX_ROI];       // Reflected temperature K * 100
+	uint8_t alarm_mode;         // SYS_ALARM_xxx
+	uint8_t alarm_roi;          // 0 for the frame or statistics region 1 - SYS_LEP_STATS_MAX_ROI
+	uint8_t alarm_stat;         // SYS_ALARM_STAT_xxx
+	uint32_t alarm_threshold;   // K * 100
+	uint16_t alarm_rate;        // K * 100 per second (0 to disable)
+	uint8_t alarm_hold;         // Seconds
+	uint8_t iso_mode;           // SYS_ISO_xxx
+	uint8_t iso_color;          // SYS_ISO_COLOR_xxx
+	uint32_t iso_low;           // K * 100
+	uint32_t iso_high;
+	uint8_t meter_mode;         // SYS_METER_xxx
+	sys_lep_roi_t lep_crop;     // Recorded and streamed radiometric region (w or h 0 for full frame)
+	uint8_t tlog_rate;          // Session telemetry log samples per second (0 for none)
 } gui_state_t;
 
 typedef struct {
@@ -99,25 +333,53 @@ extern TaskHandle_t task_handle_cam;
 extern TaskHandle_t task_handle_cmd;
 extern TaskHandle_t task_handle_file;
 extern TaskHandle_t task_handle_gui;
+extern TaskHandle_t task_handle_http;
 extern TaskHandle_t task_handle_lep;
+extern TaskHandle_t task_handle_render;
+extern TaskHandle_t task_handle_xfer;
+extern TaskHandle_t task_handle_log;
+extern TaskHandle_t task_handle_sync;
+extern TaskHandle_t task_handle_ota;
+extern TaskHandle_t task_handle_upload;
+extern TaskHandle_t task_handle_play;
+extern TaskHandle_t task_handle_health;
 #ifdef INCLUDE_SYS_MON
 extern TaskHandle_t task_handle_mon;
 #endif
+#ifdef INCLUDE_SYS_BENCH
+extern TaskHandle_t task_handle_bench;
+#endif
 
 //
 // Global buffer pointers for memory allocated in the external SPIRAM
 //
 
 // Shared memory data structures
-extern cam_buffer_t sys_cam_buffer;   // Loaded by cam_task with jpeg data for other tasks
-extern lep_buffer_t sys_lep_buffer;   // Loaded by lep_task for other tasks
-extern json_image_string_t sys_image_file_buffer;   // Loaded by app_task with image data for file_task
-extern json_image_string_t sys_cmd_response_buffer; // Loaded by app_task with image data for cmd_task
+extern cam_buffer_t* sys_cam_bufferP; // Latest cam_task image, held by app_task for other tasks
+extern cam_buffer_t* sys_cam_gui_bufferP; // Held by app_task for gui_task while it renders
+extern lep_buffer_t* sys_lep_bufferP; // Latest lep_task frame, held by app_task for other tasks
+extern lep_buffer_t* sys_lep_gui_bufferP; // Held by app_task for gui_task while it renders
+extern lep_buffer_t* sys_lep_rec_bufferP; // Published by lep_task for file_task during high-rate recording
+extern lep_buffer_t* sys_lep_udp_bufferP; // Published by lep_task for cmd_task's UDP frame stream
+extern cam_buffer_t* sys_cmd_cam_bufferP; // Held by app_task for cmd_task binary images
+extern cam_buffer_t* sys_http_cam_bufferP; // Held by app_task for http_task's MJPEG stream
+extern lep_buffer_t* sys_cmd_lep_bufferP; // Held by app_task for cmd_task binary images
+extern cam_buffer_t* sys_bench_cam_bufferP; // Held by app_task for bench_task while it runs
+extern lep_buffer_t* sys_bench_lep_bufferP; // Held by app_task for bench_task while it runs
+extern int sys_cmd_seq_num;           // Sequence number of the cmd_task binary image
+extern uint8_t sys_cmd_contents;      // IMG_CONTENT_* items in the cmd_task json image
+extern bool sys_cmd_cached;           // The cmd_task image is app_task's latest, not a new one
+extern int64_t sys_cmd_image_usec;    // Capture time of the cmd_task image
+extern json_image_string_t sys_image_buffer; // Loaded by app_task with image data for file_task and cmd_task
 extern gui_state_t gui_st;            // Shared GUI control variables
 
 // Big buffers
-extern uint16_t* gui_cam_bufferP;    // Loaded by gui_task for its own use
+extern uint16_t* gui_cam_bufferP;    // Displayed by gui_task
+extern uint16_t* gui_cam_render_bufferP; // Loaded by render_task for gui_task
 extern uint16_t* gui_lep_bufferP;    // Loaded by gui_task for its own use
+extern uint32_t* lep_accum_bufferP;  // Loaded by lep_task for its own use
+extern uint8_t* cmd_lep_z_bufferP;   // Loaded by cmd_task for its own use
+extern uint8_t* file_lep_z_bufferP;  // Loaded by file_task for its own use
 
 // Recording intervals
 extern const record_interval_t record_intervals[REC_INT_NUM];
@@ -130,9 +392,24 @@ bool system_esp_io_init();
 bool system_peripheral_init();
 bool system_buffer_init();
 void system_shutoff();
-void system_lock_vspi();
+void system_sleep(uint32_t sec, bool rtc_wake);
+bool system_get_sleep_wake();
+void system_lock_vspi(int user);
 void system_unlock_vspi();
+bool system_yield_vspi();
+bool system_vspi_user_busy(int user);
 int system_get_rec_interval_index(int rec_interval);
+bool system_image_buffer_in_use();
+void system_image_buffer_hold();
+void system_image_buffer_release();
+cam_buffer_t* system_cam_buffer_alloc();
+void system_cam_buffer_hold(cam_buffer_t* bufP);
+void system_cam_buffer_release(cam_buffer_t* bufP);
+lep_buffer_t* system_lep_frame_alloc();
+void system_lep_frame_hold(lep_buffer_t* bufP);
+void system_lep_frame_release(lep_buffer_t* bufP);
+bool system_frame_event_post(int stream, void* bufP, int64_t timestamp_usec, uint32_t flags);
+bool system_frame_event_get(int stream, sys_frame_event_t* evP);
 
 #define system_get_gui_st() (&gui_st)
  
@@ -0,0 +1,90 @@
+/*
+ * Task notification trace
+ *
+ * When INCLUDE_SYS_TRACE is defined every xTaskNotify and xTaskNotifyFromISR call in
+ * a file including this header is recorded, with its source and destination tasks and
+ * value, in a ring buffer.  The ring can be written to a file in the Chrome trace event
+ * format to be viewed as a timeline (chrome://tracing or https://ui.perfetto.dev).
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef TRACE_UTILITIES_H
+#define TRACE_UTILITIES_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "system_config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef INCLUDE_SYS_TRACE
+
+
+//
+// Trace Utilities constants
+//
+
+// Number of notifications kept.  The ring is in internal RAM since it is written
+// from ISRs that may run while the flash cache (and PSRAM) is disabled.
+#define TRACE_RING_LEN    512
+
+// Maximum number of different tasks named in a trace file
+#define TRACE_MAX_TASKS   16
+
+// Trace file name in the root directory of the Micro-SD Card
+#define TRACE_FILE_NAME   "trace.json"
+
+
+
+//
+// Trace Utilities typedefs
+//
+typedef struct {
+	uint32_t ccount;            // Cycle count on the notifying core
+	uint32_t usec;              // esp_timer time (low 32 bits), common to both cores
+	TaskHandle_t src;           // NULL for an ISR
+	TaskHandle_t dst;
+	uint32_t value;
+	uint8_t core;
+} trace_entry_t;
+
+
+
+//
+// Trace Utilities API
+//
+BaseType_t trace_notify(TaskHandle_t dst, uint32_t value, eNotifyAction action);
+BaseType_t IRAM_ATTR trace_notify_from_isr(TaskHandle_t dst, uint32_t value, eNotifyAction action, BaseType_t* wokenP);
+bool trace_write(FILE* fp);
+
+
+
+//
+// Route notifications through the trace
+//
+#undef xTaskNotify
+#define xTaskNotify(dst, value, action) trace_notify((dst), (value), (action))
+#undef xTaskNotifyFromISR
+#define xTaskNotifyFromISR(dst, value, action, wokenP) trace_notify_from_isr((dst), (value), (action), (wokenP))
+
+#endif /* INCLUDE_SYS_TRACE */
+
+#endif /* TRACE_UTILITIES_H */
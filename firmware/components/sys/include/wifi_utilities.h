@@ -38,11 +38,30 @@
 #define WIFI_INFO_FLAG_ENABLED        0x04
 #define WIFI_INFO_FLAG_CONNECTED      0x08
 #define WIFI_INFO_FLAG_CL_STATIC_IP   0x10
+#define WIFI_INFO_FLAG_AP_STA_MODE    0x20
 #define WIFI_INFO_FLAG_CLIENT_MODE    0x80
 
+// WiFi profiles.  The default profile uses the driver defaults, throughput disables
+// modem sleep and allows more receive buffers for heavy streaming and low power uses
+// modem sleep (waking for each DTIM beacon) and a lower transmit power.
+#define WIFI_PROFILE_DEFAULT          0
+#define WIFI_PROFILE_THROUGHPUT       1
+#define WIFI_PROFILE_LOW_POWER        2
+#define WIFI_NUM_PROFILES             3
+
 // Maximum attempts to reconnect to an AP in client mode
 #define WIFI_MAX_RECONNECT_ATTEMPTS   5
 
+// IP TOS values for outgoing traffic.  WMM maps the IP precedence to an access
+// category: EF (DSCP 46) is sent as voice, 0 as best effort and CS1 (DSCP 8) as
+// background.
+#define WIFI_TOS_CONTROL              0xB8
+#define WIFI_TOS_BULK                 0x00
+#define WIFI_TOS_BACKGROUND           0x20
+
+// Time server used in client mode
+#define WIFI_SNTP_SERVER              "pool.ntp.org"
+
 
 
 //
@@ -57,6 +76,7 @@ typedef struct {
 	uint8_t ap_ip_addr[4];
 	uint8_t sta_ip_addr[4];
 	uint8_t cur_ip_addr[4];
+	uint8_t profile;           // WIFI_PROFILE_xxx
 } wifi_info_t;
 
 
@@ -0,0 +1,254 @@
+/*
+ * Runtime performance counters
+ *
+ * Always-on timing statistics and latency histograms for each stage of the image
+ * pipeline and event counters for the Lepton frame stream.  Recording a time is
+ * cheap enough to do for every operation and may be done from any task or ISR.
+ * Per-task CPU use and stack high-water marks are sampled every few seconds.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "perf_utilities.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <string.h>
+
+
+
+//
+// Perf Utilities variables
+//
+
+static perf_stats_t perf_stats;
+static portMUX_TYPE perf_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Task samples alternate between the two arrays so the previous sample is available
+// to compute the run time deltas
+static EXT_RAM_ATTR TaskStatus_t perf_task_samples[2][PERF_MAX_TASKS];
+static int perf_task_sample_cur = 0;
+static int perf_task_sample_count[2];
+static uint32_t perf_task_sample_time[2];
+
+// Task statistics from the last sample (protected by perf_mux)
+static perf_task_t perf_tasks[PERF_MAX_TASKS];
+static int perf_num_tasks = 0;
+
+static const char* perf_stage_names[PERF_NUM_STAGES] = {
+	"VoSPI Segment",
+	"ArduCAM Capture",
+	"ArduCAM Readout",
+	"JSON Build",
+	"SD Write",
+	"TCP Send",
+	"JPEG Decode",
+	"LCD Flush",
+	"Touch Action",
+	"Lepton Gain Change"
+};
+
+
+
+//
+// Perf Utilities Forward Declarations for internal functions
+//
+static void IRAM_ATTR perf_update(perf_stage_t* sP, uint32_t usec);
+
+
+
+//
+// Perf Utilities API
+//
+
+/**
+ * Record the time, in uSec, an operation in stage took
+ */
+void perf_record(int stage, uint32_t usec)
+{
+	if ((stage < 0) || (stage >= PERF_NUM_STAGES)) return;
+	
+	portENTER_CRITICAL(&perf_mux);
+	perf_update(&perf_stats.stage[stage], usec);
+	portEXIT_CRITICAL(&perf_mux);
+}
+
+
+/**
+ * perf_record for use in an ISR
+ */
+void IRAM_ATTR perf_record_isr(int stage, uint32_t usec)
+{
+	if ((stage < 0) || (stage >= PERF_NUM_STAGES)) return;
+	
+	portENTER_CRITICAL_ISR(&perf_mux);
+	perf_update(&perf_stats.stage[stage], usec);
+	portEXIT_CRITICAL_ISR(&perf_mux);
+}
+
+
+/**
+ * Count an event
+ */
+void perf_count(int counter)
+{
+	if ((counter < 0) || (counter >= PERF_NUM_COUNTERS)) return;
+	
+	portENTER_CRITICAL(&perf_mux);
+	perf_stats.counter[counter]++;
+	portEXIT_CRITICAL(&perf_mux);
+}
+
+
+/**
+ * Count n events at once
+ */
+void perf_count_n(int counter, uint32_t n)
+{
+	if ((counter < 0) || (counter >= PERF_NUM_COUNTERS)) return;
+	
+	portENTER_CRITICAL(&perf_mux);
+	perf_stats.counter[counter] += n;
+	portEXIT_CRITICAL(&perf_mux);
+}
+
+
+/**
+ * Get a consistent copy of all the statistics
+ */
+void perf_get(perf_stats_t* statsP)
+{
+	portENTER_CRITICAL(&perf_mux);
+	memcpy(statsP, &perf_stats, sizeof(perf_stats_t));
+	portEXIT_CRITICAL(&perf_mux);
+}
+
+
+/**
+ * Return the display name of a stage
+ */
+const char* perf_stage_name(int stage)
+{
+	if ((stage < 0) || (stage >= PERF_NUM_STAGES)) return "";
+	
+	return perf_stage_names[stage];
+}
+
+
+
+/**
+ * Sample the run time and stack use of all tasks.  Called every PERF_TASK_SAMPLE_MSEC
+ * by adc_task.  Tasks started since the previous sample are charged with all their
+ * run time.
+ */
+void perf_sample_tasks()
+{
+	TaskStatus_t* curP;
+	TaskStatus_t* prevP;
+	perf_task_t* tP;
+	BaseType_t affinity;
+	uint32_t run_time;
+	uint32_t task_time;
+	uint32_t elapsed;
+	int cur, prev;
+	int i, j, n;
+	uint64_t pct;
+	
+	cur = perf_task_sample_cur;
+	prev = 1 - cur;
+	curP = perf_task_samples[cur];
+	prevP = perf_task_samples[prev];
+	
+	// Returns 0 if there are more than PERF_MAX_TASKS tasks
+	n = (int) uxTaskGetSystemState(curP, PERF_MAX_TASKS, &run_time);
+	if (n == 0) return;
+	
+	perf_task_sample_count[cur] = n;
+	perf_task_sample_time[cur] = run_time;
+	perf_task_sample_cur = prev;
+	elapsed = run_time - perf_task_sample_time[prev];
+	
+	portENTER_CRITICAL(&perf_mux);
+	for (i=0; i<n; i++) {
+		tP = &perf_tasks[i];
+		
+		// Find the task's previous sample
+		task_time = curP[i].ulRunTimeCounter;
+		for (j=0; j<perf_task_sample_count[prev]; j++) {
+			if (prevP[j].xHandle == curP[i].xHandle) {
+				task_time -= prevP[j].ulRunTimeCounter;
+				break;
+			}
+		}
+		
+		strncpy(tP->name, curP[i].pcTaskName, configMAX_TASK_NAME_LEN - 1);
+		tP->name[configMAX_TASK_NAME_LEN - 1] = 0;
+		affinity = xTaskGetAffinity(curP[i].xHandle);
+		tP->core = (affinity == tskNO_AFFINITY) ? -1 : (int8_t) affinity;
+		pct = (elapsed == 0) ? 0 : ((uint64_t) task_time * 100) / elapsed;
+		tP->cpu = (pct > 100) ? 100 : (uint8_t) pct;
+		tP->priority = (uint16_t) curP[i].uxCurrentPriority;
+		tP->stack_free = curP[i].usStackHighWaterMark;
+	}
+	perf_num_tasks = n;
+	portEXIT_CRITICAL(&perf_mux);
+}
+
+
+/**
+ * Copy the task statistics from the last sample into tasksP (which must hold
+ * PERF_MAX_TASKS entries) and return the number of tasks.  Returns 0 before the
+ * first sample.
+ */
+int perf_get_tasks(perf_task_t* tasksP)
+{
+	int n;
+	
+	portENTER_CRITICAL(&perf_mux);
+	n = perf_num_tasks;
+	memcpy(tasksP, perf_tasks, n * sizeof(perf_task_t));
+	portEXIT_CRITICAL(&perf_mux);
+	
+	return n;
+}
+
+
+
+//
+// Perf Utilities internal functions
+//
+
+/**
+ * Add a time to a stage's statistics.  Called with perf_mux held.
+ */
+static void IRAM_ATTR perf_update(perf_stage_t* sP, uint32_t usec)
+{
+	uint32_t v;
+	int bin;
+	
+	if ((sP->count == 0) || (usec < sP->min_usec)) sP->min_usec = usec;
+	if (usec > sP->max_usec) sP->max_usec = usec;
+	sP->last_usec = usec;
+	sP->total_usec += usec;
+	sP->count++;
+	
+	// Bin by the position of the highest set bit
+	v = usec >> PERF_HIST_SHIFT;
+	bin = (v == 0) ? 0 : (32 - __builtin_clz(v));
+	if (bin >= PERF_HIST_BINS) bin = PERF_HIST_BINS - 1;
+	sP->hist[bin]++;
+}
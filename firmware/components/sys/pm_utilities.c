@@ -0,0 +1,159 @@
+/*
+ * Power management
+ *
+ * Dynamic frequency scaling and automatic light sleep through the IDF's esp_pm.  The
+ * CPU runs at SYS_PM_MIN_FREQ_MHZ and the system light sleeps (with SYS_PM_LIGHT_SLEEP)
+ * whenever every task is waiting and no user holds a level that prevents it.  Users
+ * raise their level around work with deadlines (VoSPI segments, SPI DMA bursts, WiFi
+ * sends) and while they rely on peripherals or GPIO interrupts that stop during light
+ * sleep.  Requires CONFIG_PM_ENABLE (and CONFIG_FREERTOS_USE_TICKLESS_IDLE for light
+ * sleep) in sdkconfig.  Without it the calls do nothing and the CPU runs at the
+ * sdkconfig default frequency.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "pm_utilities.h"
+#include "system_config.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include <stdio.h>
+#ifdef CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
+
+
+
+//
+// PM Utilities variables
+//
+static const char* TAG = "pm_utilities";
+
+static int pm_levels[PM_NUM_USERS];
+
+#ifdef CONFIG_PM_ENABLE
+static bool pm_initialized = false;
+
+// Each user's locks for PM_LEVEL_AWAKE and PM_LEVEL_FAST
+static esp_pm_lock_handle_t pm_awake_locks[PM_NUM_USERS];
+static esp_pm_lock_handle_t pm_fast_locks[PM_NUM_USERS];
+
+static const char* pm_user_names[PM_NUM_USERS] = {
+	"lep",
+	"cam",
+	"gui",
+	"wifi",
+	"cmd",
+	"file",
+	"i2c"
+};
+#endif
+
+
+
+//
+// PM Utilities API
+//
+
+/**
+ * Create the users' locks and configure esp_pm.  Must be called before the tasks are
+ * started.  Returns false if power management couldn't be configured in which case the
+ * CPU stays at its default frequency.
+ */
+bool pm_init()
+{
+#ifdef CONFIG_PM_ENABLE
+	esp_pm_config_esp32_t pm_config;
+	char name[16];
+	esp_err_t ret;
+	int i;
+	
+	for (i=0; i<PM_NUM_USERS; i++) {
+		sprintf(name, "%s_awake", pm_user_names[i]);
+		if (esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, name, &pm_awake_locks[i]) != ESP_OK) {
+			ESP_LOGE(TAG, "Could not create %s", name);
+			return false;
+		}
+		sprintf(name, "%s_fast", pm_user_names[i]);
+		if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, name, &pm_fast_locks[i]) != ESP_OK) {
+			ESP_LOGE(TAG, "Could not create %s", name);
+			return false;
+		}
+		pm_levels[i] = PM_LEVEL_SLEEP;
+	}
+	pm_initialized = true;
+	
+	pm_config.max_freq_mhz = SYS_PM_MAX_FREQ_MHZ;
+	pm_config.min_freq_mhz = SYS_PM_MIN_FREQ_MHZ;
+#if defined(SYS_PM_LIGHT_SLEEP) && defined(CONFIG_FREERTOS_USE_TICKLESS_IDLE)
+	pm_config.light_sleep_enable = true;
+#else
+	pm_config.light_sleep_enable = false;
+#endif
+	ret = esp_pm_configure(&pm_config);
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "Could not configure power management (%d)", ret);
+		return false;
+	}
+	
+	ESP_LOGI(TAG, "CPU %d - %d MHz, light sleep %s", SYS_PM_MIN_FREQ_MHZ, SYS_PM_MAX_FREQ_MHZ,
+		pm_config.light_sleep_enable ? "on" : "off");
+	return true;
+#else
+	ESP_LOGI(TAG, "Power management not enabled");
+	return false;
+#endif
+}
+
+
+/**
+ * Set a user's level.  The system runs at the highest level any user holds.
+ */
+void pm_set_level(int user, int level)
+{
+	if ((user < 0) || (user >= PM_NUM_USERS) || (level == pm_levels[user])) return;
+	
+#ifdef CONFIG_PM_ENABLE
+	if (!pm_initialized) return;
+	
+	// Take the new lock before releasing the old one so the level doesn't drop between
+	if (level == PM_LEVEL_AWAKE) {
+		esp_pm_lock_acquire(pm_awake_locks[user]);
+	} else if (level == PM_LEVEL_FAST) {
+		esp_pm_lock_acquire(pm_fast_locks[user]);
+	}
+	if (pm_levels[user] == PM_LEVEL_AWAKE) {
+		esp_pm_lock_release(pm_awake_locks[user]);
+	} else if (pm_levels[user] == PM_LEVEL_FAST) {
+		esp_pm_lock_release(pm_fast_locks[user]);
+	}
+#endif
+	
+	pm_levels[user] = level;
+}
+
+
+/**
+ * Return a user's level
+ */
+int pm_get_level(int user)
+{
+	if ((user < 0) || (user >= PM_NUM_USERS)) return PM_LEVEL_SLEEP;
+	
+	return pm_levels[user];
+}
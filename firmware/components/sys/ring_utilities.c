@@ -0,0 +1,241 @@
+/*
+ * Single-producer, single-consumer ring of slots
+ *
+ * The ring only manages slot indicies.  The caller owns an array of len slots (typically
+ * descriptors of large PSRAM buffers) so nothing is copied.  The producer fills the slot
+ * it gets from ring_write_slot and publishes it.  The consumer gets the oldest published
+ * slot from ring_read_slot and releases it when done.  Each index is only written by
+ * one side so a RING_BLOCK_ON_FULL ring needs no lock.  A RING_OVERWRITE_OLDEST ring lets
+ * the producer reclaim the oldest published slot (that the consumer isn't reading) so
+ * it takes a short critical section.  The other side is woken by a task notification.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "ring_utilities.h"
+#include "trace_utilities.h"
+
+
+
+//
+// Ring Utilities Forward Declarations for internal functions
+//
+static inline int ring_next(ring_t* r, int i);
+static inline int ring_used(ring_t* r);
+static inline void ring_lock(ring_t* r);
+static inline void ring_unlock(ring_t* r);
+
+
+
+//
+// Ring Utilities API
+//
+
+/**
+ * Initialize an empty ring of len slots.  No task is notified until one is set.
+ */
+void ring_init(ring_t* r, int len, int policy)
+{
+	r->len = len;
+	r->policy = policy;
+	r->head = 0;
+	r->tail = 0;
+	r->reading = false;
+	r->overwritten = 0;
+	r->producer_task = NULL;
+	r->producer_mask = 0;
+	r->consumer_task = NULL;
+	r->consumer_mask = 0;
+	vPortCPUInitializeMutex(&r->mux);
+}
+
+
+/**
+ * Set the task notified with mask when the consumer releases a slot
+ */
+void ring_set_producer(ring_t* r, TaskHandle_t task, uint32_t mask)
+{
+	r->producer_task = task;
+	r->producer_mask = mask;
+}
+
+
+/**
+ * Set the task notified with mask when the producer publishes a slot
+ */
+void ring_set_consumer(ring_t* r, TaskHandle_t task, uint32_t mask)
+{
+	r->consumer_task = task;
+	r->consumer_mask = mask;
+}
+
+
+/**
+ * Producer: return the index of the slot to fill next or -1 if the ring is full.  The
+ * slot stays the producer's until it is published so this may be called again.  A
+ * RING_OVERWRITE_OLDEST ring reclaims the oldest slot when it is full unless the
+ * consumer is reading it.  overwroteP (which may be NULL) is set when that happens so
+ * the producer can clean up the slot's old contents.
+ */
+int ring_write_slot(ring_t* r, bool* overwroteP)
+{
+	int slot = -1;
+	
+	if (overwroteP != NULL) *overwroteP = false;
+	
+	ring_lock(r);
+	if (ring_used(r) < r->len) {
+		slot = r->head % r->len;
+	} else if ((r->policy == RING_OVERWRITE_OLDEST) && !r->reading) {
+		r->tail = ring_next(r, r->tail);
+		r->overwritten++;
+		if (overwroteP != NULL) *overwroteP = true;
+		slot = r->head % r->len;
+	}
+	ring_unlock(r);
+	
+	return slot;
+}
+
+
+/**
+ * Producer: publish the slot from ring_write_slot to the consumer
+ */
+void ring_publish(ring_t* r)
+{
+	// The slot contents must be visible before the index moves
+	__sync_synchronize();
+	
+	ring_lock(r);
+	r->head = ring_next(r, r->head);
+	ring_unlock(r);
+	
+	if (r->consumer_task != NULL) {
+		xTaskNotify(r->consumer_task, r->consumer_mask, eSetBits);
+	}
+}
+
+
+/**
+ * Consumer: return the index of the oldest published slot or -1 if the ring is empty.
+ * The slot stays the consumer's until it is released so this may be called again.
+ */
+int ring_read_slot(ring_t* r)
+{
+	int slot = -1;
+	
+	ring_lock(r);
+	if (ring_used(r) != 0) {
+		r->reading = true;
+		slot = r->tail % r->len;
+	}
+	ring_unlock(r);
+	
+	// Don't read the slot contents before the index
+	__sync_synchronize();
+	
+	return slot;
+}
+
+
+/**
+ * Consumer: release the slot from ring_read_slot back to the producer
+ */
+void ring_release(ring_t* r)
+{
+	// Finish with the slot contents before the producer can reuse it
+	__sync_synchronize();
+	
+	ring_lock(r);
+	if (r->reading) {
+		r->tail = ring_next(r, r->tail);
+		r->reading = false;
+	}
+	ring_unlock(r);
+	
+	if (r->producer_task != NULL) {
+		xTaskNotify(r->producer_task, r->producer_mask, eSetBits);
+	}
+}
+
+
+/**
+ * Return the number of published slots not yet released
+ */
+int ring_count(ring_t* r)
+{
+	int n;
+	
+	ring_lock(r);
+	n = ring_used(r);
+	ring_unlock(r);
+	
+	return n;
+}
+
+
+/**
+ * Return the number of slots reclaimed before the consumer read them
+ */
+uint32_t ring_overwritten(ring_t* r)
+{
+	return r->overwritten;
+}
+
+
+
+//
+// Ring Utilities internal functions
+//
+
+/**
+ * Advance an index.  Indicies run to 2*len so a full ring can be told from an empty one.
+ */
+static inline int ring_next(ring_t* r, int i)
+{
+	return (++i == 2*r->len) ? 0 : i;
+}
+
+
+/**
+ * Return the number of published slots
+ */
+static inline int ring_used(ring_t* r)
+{
+	int n;
+	
+	n = r->head - r->tail;
+	if (n < 0) n += 2*r->len;
+	
+	return n;
+}
+
+
+/**
+ * Only RING_OVERWRITE_OLDEST rings, where the producer can move the tail, need a lock
+ */
+static inline void ring_lock(ring_t* r)
+{
+	if (r->policy == RING_OVERWRITE_OLDEST) portENTER_CRITICAL(&r->mux);
+}
+
+
+static inline void ring_unlock(ring_t* r)
+{
+	if (r->policy == RING_OVERWRITE_OLDEST) portEXIT_CRITICAL(&r->mux);
+}
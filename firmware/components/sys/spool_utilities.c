@@ -0,0 +1,442 @@
+/*
+ * Internal flash spool for recorded images
+ *
+ * A log of records in the "spool" data partition that file_task writes images to when
+ * they can't be written to the Micro-SD Card and moves to the card, oldest first, once
+ * it is writing again.  The records survive a restart so images spooled before a
+ * session was suspended (or the camera lost power) are moved after it starts again.
+ *
+ * Records are appended from the start of the partition.  Each is a spool_header_t
+ * followed by its data, padded to a 4-byte boundary.  Flash bits can be cleared without
+ * an erase so a record's state moves from SPOOL_STATE_WRITING through SPOOL_STATE_VALID
+ * (completely written) to SPOOL_STATE_DONE (moved or abandoned) by rewriting its state
+ * word in place.  Once every record is done the log starts again at the beginning of
+ * the partition with the next generation number so records left from the previous pass
+ * are ignored.  Each sector is erased just before the log first writes into it (flash
+ * operations stall both cores so this limits each stall to one sector erase or write).
+ * The partition isn't reclaimed until it is empty so it holds as many images as fit
+ * between two times the card catches up.
+ *
+ * Only used by file_task.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "spool_utilities.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+#include <stddef.h>
+#include <string.h>
+
+
+
+//
+// Spool Utilities internal constants
+//
+#define SPOOL_SECTOR_LEN       SPI_FLASH_SEC_SIZE
+
+// Space a record with length bytes of data takes in the log
+#define SPOOL_RECORD_LEN(l)    ((sizeof(spool_header_t) + (l) + 3) & ~3)
+
+// Round a partition offset up to the start of the next sector
+#define SPOOL_SECTOR_END(p)    ((((p) + SPOOL_SECTOR_LEN - 1) / SPOOL_SECTOR_LEN) * SPOOL_SECTOR_LEN)
+
+
+
+//
+// Spool Utilities internal variables
+//
+static const char* TAG = "spool_utilities";
+
+static const esp_partition_t* spool_partP = NULL;
+static uint8_t* spool_bufP;
+
+// Log state
+static uint32_t spool_generation;
+static uint32_t spool_write_pos;         // Where the next record starts
+static uint32_t spool_erased_end;        // End of the sectors erased in this generation
+static uint32_t spool_read_pos;          // Oldest valid record (when spool_count != 0)
+static int spool_count;                  // Valid records
+
+// Record being written
+static bool rec_open = false;
+static bool rec_failed;
+static uint32_t rec_pos;
+static uint32_t rec_length;
+static uint32_t rec_written;
+
+
+
+//
+// Spool Utilities Forward Declarations for internal functions
+//
+static void spool_reset();
+static void spool_find_next(uint32_t pos);
+static bool spool_read_header(uint32_t pos, spool_header_t* hdrP);
+static bool spool_write_state(uint32_t pos, uint32_t state);
+static bool spool_program(uint32_t pos, const void* bufP, uint32_t length);
+
+
+
+//
+// Spool Utilities API
+//
+
+/**
+ * Find the spool partition and the records left in it.  Returns false if the camera's
+ * partition table doesn't have one (it was flashed over the air from an older table).
+ */
+bool spool_init()
+{
+	spool_header_t hdr;
+	uint32_t pos = 0;
+	uint8_t* p;
+	int i;
+	
+	spool_partP = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, SPOOL_PARTITION_TYPE, SPOOL_PARTITION_LABEL);
+	if (spool_partP == NULL) {
+		ESP_LOGW(TAG, "No %s partition - images can't be spooled", SPOOL_PARTITION_LABEL);
+		return false;
+	}
+	
+	spool_bufP = heap_caps_malloc(SPOOL_BUF_LEN, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	if (spool_bufP == NULL) {
+		ESP_LOGE(TAG, "malloc spool buffer failed");
+		spool_partP = NULL;
+		return false;
+	}
+	
+	// Follow the records of the current generation (set by the first record)
+	spool_generation = 0;
+	spool_count = 0;
+	while (spool_read_header(pos, &hdr)) {
+		if ((hdr.magic != SPOOL_MAGIC) ||
+		    ((pos != 0) && (hdr.generation != spool_generation)) ||
+		    (hdr.length > (spool_partP->size - pos - sizeof(spool_header_t))))
+		{
+			break;
+		}
+		spool_generation = hdr.generation;
+	
+		if (hdr.state == SPOOL_STATE_VALID) {
+			if (spool_count++ == 0) {
+				spool_read_pos = pos;
+			}
+		} else if (hdr.state != SPOOL_STATE_DONE) {
+			// The camera restarted while the record was being written
+			(void) spool_write_state(pos, SPOOL_STATE_DONE);
+		}
+		pos += SPOOL_RECORD_LEN(hdr.length);
+	}
+	
+	if (spool_count == 0) {
+		spool_reset();
+	} else {
+		// Anything but erased flash where the log ends (a header that was being written
+		// or a sector left from an earlier generation) is skipped to the next sector
+		if (spool_read_header(pos, &hdr)) {
+			p = (uint8_t*) &hdr;
+			for (i=0; i<sizeof(spool_header_t); i++) {
+				if (p[i] != 0xFF) {
+					pos = SPOOL_SECTOR_END(pos);
+					break;
+				}
+			}
+		}
+		if (pos > spool_partP->size) pos = spool_partP->size;
+		spool_write_pos = pos;
+		spool_erased_end = SPOOL_SECTOR_END(pos);
+	}
+	
+	ESP_LOGI(TAG, "%d spooled records, %u kB free", spool_count, spool_get_free_bytes() / 1024);
+	return true;
+}
+
+
+/**
+ * Return the number of records waiting to be moved
+ */
+int spool_get_count()
+{
+	return spool_count;
+}
+
+
+/**
+ * Return the space left for new records
+ */
+uint32_t spool_get_free_bytes()
+{
+	if (spool_partP == NULL) return 0;
+	
+	return spool_partP->size - spool_write_pos;
+}
+
+
+/**
+ * Start a record of length bytes.  Returns false if there isn't room for it.  The
+ * data is written with spool_write and the record finished with spool_end_record.
+ */
+bool spool_start_record(const char* dir_name, uint16_t seq_num, uint16_t type, uint32_t length)
+{
+	spool_header_t hdr;
+	
+	if ((spool_partP == NULL) || rec_open) return false;
+	if (SPOOL_RECORD_LEN(length) > spool_get_free_bytes()) return false;
+	
+	// The state and info are left erased to be written when the record is complete
+	memset(&hdr, 0xFF, sizeof(spool_header_t));
+	hdr.magic = SPOOL_MAGIC;
+	hdr.generation = spool_generation;
+	hdr.length = length;
+	hdr.type = type;
+	hdr.seq_num = seq_num;
+	memset(hdr.dir_name, 0, SESSION_DIR_NAME_LEN);
+	strncpy(hdr.dir_name, dir_name, SESSION_DIR_NAME_LEN - 1);
+	
+	if (!spool_program(spool_write_pos, &hdr, sizeof(spool_header_t))) {
+		// Leave whatever was written behind
+		spool_write_pos = spool_erased_end;
+		return false;
+	}
+	
+	rec_open = true;
+	rec_failed = false;
+	rec_pos = spool_write_pos;
+	rec_length = length;
+	rec_written = 0;
+	spool_write_pos += SPOOL_RECORD_LEN(length);
+	
+	return true;
+}
+
+
+/**
+ * Append data to the record being written
+ */
+bool spool_write(const uint8_t* bufP, uint32_t length)
+{
+	uint32_t len;
+	
+	if (!rec_open || rec_failed) return false;
+	if ((rec_written + length) > rec_length) {
+		ESP_LOGE(TAG, "Record longer than %u bytes", rec_length);
+		rec_failed = true;
+		return false;
+	}
+	
+	while (length > 0) {
+		len = (length > SPOOL_BUF_LEN) ? SPOOL_BUF_LEN : length;
+		memcpy(spool_bufP, bufP, len);
+		if (!spool_program(rec_pos + sizeof(spool_header_t) + rec_written, spool_bufP, len)) {
+			rec_failed = true;
+			return false;
+		}
+		rec_written += len;
+		bufP += len;
+		length -= len;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Finish the record being written.  A record is only valid if all its data was written
+ * and success is set.  info_len bytes (up to SPOOL_INFO_LEN) of infoP are stored with a
+ * valid record.  Returns true if the record is valid.
+ */
+bool spool_end_record(bool success, const void* infoP, int info_len)
+{
+	if (!rec_open) return false;
+	rec_open = false;
+	
+	success = success && !rec_failed && (rec_written == rec_length);
+	if (success && (info_len > 0)) {
+		if (info_len > SPOOL_INFO_LEN) info_len = SPOOL_INFO_LEN;
+		memcpy(spool_bufP, infoP, info_len);
+		success = spool_program(rec_pos + offsetof(spool_header_t, info), spool_bufP, info_len);
+	}
+	if (success) {
+		success = spool_write_state(rec_pos, SPOOL_STATE_VALID);
+	}
+	
+	if (success) {
+		if (spool_count++ == 0) {
+			spool_read_pos = rec_pos;
+		}
+	} else {
+		(void) spool_write_state(rec_pos, SPOOL_STATE_DONE);
+	}
+	
+	return success;
+}
+
+
+/**
+ * Get the header of the oldest valid record.  Returns false if there isn't one.
+ */
+bool spool_get_next(spool_header_t* hdrP)
+{
+	if (spool_count == 0) return false;
+	
+	return spool_read_header(spool_read_pos, hdrP);
+}
+
+
+/**
+ * Read data from the oldest valid record
+ */
+bool spool_read(uint32_t offset, uint8_t* bufP, uint32_t length)
+{
+	esp_err_t err;
+	
+	if (spool_count == 0) return false;
+	
+	err = esp_partition_read(spool_partP, spool_read_pos + sizeof(spool_header_t) + offset, bufP, length);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "Read at %u failed - %d", spool_read_pos + offset, err);
+		return false;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Mark the oldest valid record done once it has been moved.  The log starts over when
+ * the last one is done.
+ */
+void spool_release()
+{
+	spool_header_t hdr;
+	
+	if (spool_count == 0) return;
+	
+	if (!spool_read_header(spool_read_pos, &hdr)) {
+		// Can't find the following records
+		spool_count = 0;
+	} else {
+		(void) spool_write_state(spool_read_pos, SPOOL_STATE_DONE);
+		if (--spool_count != 0) {
+			spool_find_next(spool_read_pos + SPOOL_RECORD_LEN(hdr.length));
+		}
+	}
+	
+	if ((spool_count == 0) && !rec_open) {
+		spool_reset();
+	}
+}
+
+
+
+//
+// Spool Utilities internal functions
+//
+
+/**
+ * Start a new generation at the beginning of the partition
+ */
+static void spool_reset()
+{
+	if (++spool_generation == 0xFFFFFFFF) {
+		// Looks like erased flash
+		spool_generation = 1;
+	}
+	spool_write_pos = 0;
+	spool_erased_end = 0;
+	spool_count = 0;
+}
+
+
+/**
+ * Find the next valid record at or after pos
+ */
+static void spool_find_next(uint32_t pos)
+{
+	spool_header_t hdr;
+	
+	while (pos < spool_write_pos) {
+		if (!spool_read_header(pos, &hdr)) break;
+		if (hdr.state == SPOOL_STATE_VALID) {
+			spool_read_pos = pos;
+			return;
+		}
+		pos += SPOOL_RECORD_LEN(hdr.length);
+	}
+	
+	ESP_LOGE(TAG, "Lost %d spooled records", spool_count);
+	spool_count = 0;
+}
+
+
+/**
+ * Read the record header at pos
+ */
+static bool spool_read_header(uint32_t pos, spool_header_t* hdrP)
+{
+	if ((pos + sizeof(spool_header_t)) > spool_partP->size) return false;
+	
+	return (esp_partition_read(spool_partP, pos, hdrP, sizeof(spool_header_t)) == ESP_OK);
+}
+
+
+/**
+ * Rewrite the state of the record at pos (only clears bits)
+ */
+static bool spool_write_state(uint32_t pos, uint32_t state)
+{
+	esp_err_t err;
+	
+	err = esp_partition_write(spool_partP, pos + offsetof(spool_header_t, state), &state, sizeof(uint32_t));
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "State write at %u failed - %d", pos, err);
+		return false;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Write to the log at pos, first erasing the sectors it reaches that haven't been erased
+ * in this generation.  bufP must be in internal memory.
+ */
+static bool spool_program(uint32_t pos, const void* bufP, uint32_t length)
+{
+	esp_err_t err;
+	
+	while (spool_erased_end < (pos + length)) {
+		err = esp_partition_erase_range(spool_partP, spool_erased_end, SPOOL_SECTOR_LEN);
+		if (err != ESP_OK) {
+			ESP_LOGE(TAG, "Erase at %u failed - %d", spool_erased_end, err);
+			return false;
+		}
+		spool_erased_end += SPOOL_SECTOR_LEN;
+	}
+	
+	err = esp_partition_write(spool_partP, pos, bufP, length);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "Write at %u failed - %d", pos, err);
+		return false;
+	}
+	
+	return true;
+}
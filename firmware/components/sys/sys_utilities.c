@@ -26,14 +26,21 @@
 #include "esp_log.h"
 #include "esp_heap_caps.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 #include "freertos/semphr.h"
+#include "driver/rtc_io.h"
 #include "driver/spi_master.h"
+#include "esp_sleep.h"
 #include "system_config.h"
 #include "adc_utilities.h"
+#include "cci.h"
+#include "file_task.h"
 #include "file_utilities.h"
 #include "json_utilities.h"
 #include "lepton_utilities.h"
+#include "ps_nvs.h"
 #include "ps_utilities.h"
+#include "schedule_utilities.h"
 #include "sys_utilities.h"
 #include "time_utilities.h"
 #include "wifi_utilities.h"
@@ -43,6 +50,7 @@
 #include "ov2640.h"
 #include "render_jpg.h"
 #include "vospi.h"
+#include "xfer_task.h"
 
 
 
@@ -81,11 +89,67 @@ const record_interval_t record_intervals[REC_INT_NUM] = {
 	{
 		.name = REC_INT_6_NAME,
 		.interval = REC_INT_6_VAL
+	},
+	{
+		.name = REC_INT_7_NAME,
+		.interval = REC_INT_7_VAL
 	}
 };
 
 
 
+//
+// System memory budget
+//
+typedef struct {
+	const char* name;
+	int count;
+	uint32_t len;
+	uint32_t caps;            // MALLOC_CAP_SPIRAM or MALLOC_CAP_DMA (internal)
+} sys_mem_budget_t;
+
+// The big buffers allocated at startup.  Their sizes are set by the largest selectable
+// configuration (resolution, telemetry and record format can change at runtime).  The
+// hot buffers placed in internal RAM when there is room are budgeted in the PSRAM.
+// Buffers for subsystems the feature profile leaves out aren't allocated.
+static const sys_mem_budget_t sys_mem_budget[] = {
+#ifdef INCLUDE_SYS_ARDUCAM
+	{"ArduCAM jpeg pool",        CAM_BUFFER_POOL_LEN, CAM_MAX_JPG_LEN, MALLOC_CAP_SPIRAM},
+#endif
+#ifdef INCLUDE_SYS_GUI
+	{"ArduCAM gui",              2, CAM_IMG_PIXELS*2, MALLOC_CAP_SPIRAM},
+#endif
+	{"Lepton frame pool",        LEP_FRAME_POOL_LEN, LEP_NUM_PIXELS*2 + LEP_TEL_WORDS*2, MALLOC_CAP_SPIRAM},
+	{"Lepton accumulator",       1, LEP_NUM_PIXELS*4, MALLOC_CAP_SPIRAM},
+	{"Lepton compression",       2, LEP_NUM_PIXELS*2, MALLOC_CAP_SPIRAM},
+#ifdef INCLUDE_SYS_GUI
+	{"Lepton gui",               1, LEP_IMG_PIXELS*2, MALLOC_CAP_SPIRAM},
+#endif
+	{"Json response",            1, JSON_MAX_RSP_TEXT_LEN, MALLOC_CAP_SPIRAM},
+	{"Json cached responses",    2, JSON_MAX_RSP_TEXT_LEN, MALLOC_CAP_SPIRAM},
+	{"Json arena",               1, JSON_ARENA_LEN, MALLOC_CAP_SPIRAM},
+	{"Json image text",          1, JSON_MAX_IMAGE_TEXT_LEN, MALLOC_CAP_SPIRAM},
+	{"File queue json",          FILE_QUEUE_LEN, JSON_MAX_IMAGE_TEXT_LEN, MALLOC_CAP_SPIRAM},
+	{"File container index",     1, FILE_CONTAINER_MAX_RECORDS * sizeof(file_container_index_t), MALLOC_CAP_SPIRAM},
+	{"File queue thumbnails",    1, FILE_QUEUE_LEN * sizeof(file_thumb_entry_t), MALLOC_CAP_SPIRAM},
+	{"File telemetry log",       1, FILE_TLOG_BUF_ENTRIES * sizeof(file_tlog_entry_t), MALLOC_CAP_SPIRAM},
+#ifdef INCLUDE_SYS_GUI
+	{"LVGL display",             2, LVGL_DISP_BUF_SIZE*2, MALLOC_CAP_DMA},
+#endif
+	{"Lepton VoSPI burst",       1, LEP_BURST_LENGTH, MALLOC_CAP_DMA},
+#ifdef INCLUDE_SYS_ARDUCAM
+	{"ArduCAM SPI",              CAM_NUM_SPI_BUFS, CAM_MAX_SPI_PKT, MALLOC_CAP_DMA},
+#endif
+	{"File write staging",       1, FILE_WRITE_BUF_LEN, MALLOC_CAP_DMA},
+	{"Session transfer",         1, XFER_BLOCK_LEN, MALLOC_CAP_DMA},
+#ifdef INCLUDE_SYS_GUI
+	{"Playback gui",             2, CAM_IMG_PIXELS*2, MALLOC_CAP_SPIRAM}
+#endif
+};
+
+#define SYS_MEM_BUDGET_LEN (sizeof(sys_mem_budget) / sizeof(sys_mem_budget_t))
+
+
 //
 // Task handle externs for use by tasks to communicate with each other
 //
@@ -95,30 +159,98 @@ TaskHandle_t task_handle_cam;
 TaskHandle_t task_handle_cmd;
 TaskHandle_t task_handle_file;
 TaskHandle_t task_handle_gui;
+TaskHandle_t task_handle_http;
 TaskHandle_t task_handle_lep;
+TaskHandle_t task_handle_render;
+TaskHandle_t task_handle_xfer;
+TaskHandle_t task_handle_log;
+TaskHandle_t task_handle_sync;
+TaskHandle_t task_handle_ota;
+TaskHandle_t task_handle_upload;
+TaskHandle_t task_handle_play;
+TaskHandle_t task_handle_health;
 #ifdef INCLUDE_SYS_MON
 TaskHandle_t task_handle_mon;
 #endif
+#ifdef INCLUDE_SYS_BENCH
+TaskHandle_t task_handle_bench;
+#endif
 
 
 //
-// Global buffer pointers for memory allocated in the external SPIRAM
+// Global buffer pointers for memory allocated in the external SPIRAM (or internal RAM
+// for the hot buffers placed there by system_alloc_hot)
 //
 
 // Shared memory data structures
-cam_buffer_t sys_cam_buffer;   // Loaded by cam_task with jpeg data for other tasks
-lep_buffer_t sys_lep_buffer;   // Loaded by lep_task for other task
-json_image_string_t sys_image_file_buffer;   // Loaded by app_task with image data for file_task
-json_image_string_t sys_cmd_response_buffer; // Loaded by app_task with image data for cmd_task
+cam_buffer_t* sys_cam_bufferP; // Latest cam_task image, held by app_task for other tasks
+cam_buffer_t* sys_cam_gui_bufferP; // Held by app_task for gui_task while it renders
+lep_buffer_t* sys_lep_bufferP; // Latest lep_task frame, held by app_task for other tasks
+lep_buffer_t* sys_lep_gui_bufferP; // Held by app_task for gui_task while it renders
+lep_buffer_t* sys_lep_rec_bufferP; // Published by lep_task for file_task during high-rate recording
+lep_buffer_t* sys_lep_udp_bufferP; // Published by lep_task for cmd_task's UDP frame stream
+cam_buffer_t* sys_cmd_cam_bufferP; // Held by app_task for cmd_task binary images
+cam_buffer_t* sys_http_cam_bufferP; // Held by app_task for http_task's MJPEG stream
+lep_buffer_t* sys_cmd_lep_bufferP; // Held by app_task for cmd_task binary images
+cam_buffer_t* sys_bench_cam_bufferP; // Held by app_task for bench_task while it runs
+lep_buffer_t* sys_bench_lep_bufferP; // Held by app_task for bench_task while it runs
+int sys_cmd_seq_num;           // Sequence number of the cmd_task binary image
+uint8_t sys_cmd_contents;      // IMG_CONTENT_* items in the cmd_task json image
+bool sys_cmd_cached;           // The cmd_task image is app_task's latest, not a new one
+int64_t sys_cmd_image_usec;    // Capture time of the cmd_task image
+json_image_string_t sys_image_buffer; // Loaded by app_task with image data for file_task and cmd_task
 gui_state_t gui_st;            // Shared GUI control variables
 
 // Big buffers
-uint16_t* gui_cam_bufferP;    // Loaded by gui_task for its own use
+uint16_t* gui_cam_bufferP;    // Displayed by gui_task
+uint16_t* gui_cam_render_bufferP; // Loaded by render_task for gui_task
 uint16_t* gui_lep_bufferP;    // Loaded by gui_task for its own use
+uint32_t* lep_accum_bufferP;  // Loaded by lep_task for its own use
+uint8_t* cmd_lep_z_bufferP;   // Loaded by cmd_task for its own use
+uint8_t* file_lep_z_bufferP;  // Loaded by file_task for its own use
 
 // Designed to lock VSPI for multiple uninterruptible SPI transactions by one task
 static SemaphoreHandle_t vspi_mutex;
 
+// VSPI arbitration.  A user yielding the bus to a higher priority user waits on
+// vspi_handoff_sem until the bus is unlocked (giving the mutex alone wouldn't let a
+// lower priority task run).
+static SemaphoreHandle_t vspi_handoff_sem;
+static portMUX_TYPE vspi_mux = portMUX_INITIALIZER_UNLOCKED;
+static int vspi_waiting[VSPI_NUM_USERS];  // Users blocked on vspi_mutex
+static int vspi_owner;
+static int vspi_parked;                   // Users waiting on vspi_handoff_sem
+
+// Pool of reference counted lepton frame buffers handed between tasks by pointer
+static portMUX_TYPE image_buffer_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static cam_buffer_t cam_buffer_pool[CAM_BUFFER_POOL_LEN];
+static portMUX_TYPE cam_buffer_pool_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static lep_buffer_t lep_frame_pool[LEP_FRAME_POOL_LEN];
+static portMUX_TYPE lep_frame_pool_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Frame event queues and the sequence number of the next event posted to each
+static QueueHandle_t frame_event_queue[SYS_FRAME_NUM_STREAMS];
+static uint32_t frame_event_seq[SYS_FRAME_NUM_STREAMS];
+
+#ifdef INCLUDE_SYS_ARDUCAM
+// ArduCAM initialization task result
+static TaskHandle_t sys_init_task_handle;
+static bool sys_cam_init_ok;
+#endif
+
+
+
+//
+// System Utilities Forward Declarations for internal functions
+//
+#ifdef INCLUDE_SYS_ARDUCAM
+static void system_cam_init_task(void* args);
+#endif
+static bool system_check_budget();
+static void* system_alloc_hot(size_t len, const char* name);
+
 
 
 //
@@ -136,6 +268,18 @@ bool system_esp_io_init()
 	gpio_set_direction(PWR_HOLD_IO, GPIO_MODE_OUTPUT);
 	gpio_set_level(PWR_HOLD_IO, 1);
 	
+	// Release the pins latched or used to wake from a duty-cycled recording sleep
+	gpio_hold_dis(PWR_HOLD_IO);
+	gpio_deep_sleep_hold_dis();
+	if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_EXT0) {
+		rtc_gpio_deinit(TS_IRQ_IO);
+	}
+#ifdef RTC_SQW_IO
+	if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_EXT1) {
+		rtc_gpio_deinit(RTC_SQW_IO);
+	}
+#endif
+	
 	// Configure other GPIO pins
 	gpio_set_direction(CAM_CSN_IO, GPIO_MODE_OUTPUT);
 	gpio_set_level(CAM_CSN_IO, 1);
@@ -150,6 +294,12 @@ bool system_esp_io_init()
 	gpio_set_direction(TS_IRQ_IO, GPIO_MODE_INPUT);
 	gpio_set_direction(LEP_VSYNC_IO, GPIO_MODE_INPUT);
 	
+	// Install the GPIO ISR service so tasks can attach per-pin interrupt handlers
+	if (gpio_install_isr_service(0) != ESP_OK) {
+		ESP_LOGE(TAG, "GPIO ISR service installation failed");
+		return false;
+	}
+	
 	// Handle the special case where the DS3232 RTC I2C interface is confused.
 	// Per its data sheet, we manually toggle SCL until SDA is seen high.
 	// Do this before handing the pins over the I2C interface during its initialization.
@@ -160,13 +310,15 @@ bool system_esp_io_init()
 		ESP_LOGE(TAG, "I2C Master initialization failed");
 		return false;
 	}
+	i2c_set_device_freq(CCI_ADDRESS, I2C_LEP_FREQ_HZ);
+	i2c_set_device_freq(RTC_ADDR, I2C_RTC_FREQ_HZ);
 	
 	// Attempt to initialize the HSPI Master (used by the Lepton)
 	spi_bus_config_t hspi_buscfg = {
 		.miso_io_num=HSPI_MISO_IO,
 		.mosi_io_num=-1,
 		.sclk_io_num=HSPI_SCK_IO,
-		.max_transfer_sz=LEP_PKT_LENGTH,
+		.max_transfer_sz=LEP_BURST_LENGTH,
 		.quadwp_io_num=-1,
 		.quadhd_io_num=-1
 	};
@@ -200,22 +352,52 @@ bool system_esp_io_init()
  */
 bool system_peripheral_init()
 {
+	uint32_t notification_value = 0;
+	
 	ESP_LOGI(TAG, "System Peripheral Initialization");
 	
-	// Time and PS init first so other modules can use data from them
+	// Devices not on the I2C bus first, while the Lepton is still booting
+	if (!ps_nvs_init()) {
+		ESP_LOGE(TAG, "NVS persistent storage initialization failed");
+		return false;
+	}
+	
+	if (!file_init_sdmmc_driver()) {
+		ESP_LOGE(TAG, "SD Card driver initialization failed");
+		return false;
+	}
+	
+#ifndef INCLUDE_SYS_REPLAY
+	// The Lepton gets confused by I2C traffic to other peripherals while it boots
+	if (!cci_wait_boot()) {
+		ESP_LOGE(TAG, "Lepton boot failed");
+		return false;
+	}
+	
+#ifdef INCLUDE_SYS_ARDUCAM
+	// Initialize the ArduCAM in parallel with the other peripherals.  The I2C driver
+	// serializes access to the shared bus.
+	sys_init_task_handle = xTaskGetCurrentTaskHandle();
+	if (xTaskCreatePinnedToCore(&system_cam_init_task, "cam_init", SYS_CAM_INIT_STACK, NULL,
+	                            SYS_CAM_INIT_PRIO, NULL, SYS_CAM_INIT_CORE) != pdPASS)
+	{
+		ESP_LOGE(TAG, "Could not start ArduCAM initialization");
+		return false;
+	}
+#endif
+#endif
+	
+	// Time and PS init next so other modules can use data from them
 	time_init();
 	ps_init();
+	sched_init();
 	
 	if (!adc_init()) {
 		ESP_LOGE(TAG, "ADC subsystem initialization failed");
 		return false;
 	}
 	
-	if (ov2640_init() == 0) {
-		ESP_LOGE(TAG, "Arducam ov2640 initialization failed");
-		return false;
-	}
-
+#ifndef INCLUDE_SYS_REPLAY
 	if (!lepton_init()) {
 		ESP_LOGE(TAG, "Lepton initialization failed");
 		return false;
@@ -224,16 +406,24 @@ bool system_peripheral_init()
 		ESP_LOGE(TAG, "Lepton VoSPI initialization failed");
 		return false;
 	}
+#endif
 	
-	if (!file_init_sdmmc_driver()) {
-		ESP_LOGE(TAG, "SD Card driver initialization failed");
+	if (!wifi_init()) {
+		ESP_LOGE(TAG, "WiFi initialization failed");
 		return false;
 	}
 	
-	if (!wifi_init()) {
-		ESP_LOGE(TAG, "WiFi initialization failed");
+#if defined(INCLUDE_SYS_REPLAY) || !defined(INCLUDE_SYS_ARDUCAM)
+	// replay_task stands in for the sensors or the profile has no ArduCAM
+	(void) notification_value;
+#else
+	(void) xTaskNotifyWait(0x00, SYS_CAM_INIT_DONE_MASK, &notification_value,
+	                       pdMS_TO_TICKS(SYS_CAM_INIT_TIMEOUT_MSEC));
+	if (!Notification(notification_value, SYS_CAM_INIT_DONE_MASK) || !sys_cam_init_ok) {
+		ESP_LOGE(TAG, "Arducam ov2640 initialization failed");
 		return false;
 	}
+#endif
 	
 	return true;
 }
@@ -244,20 +434,39 @@ bool system_peripheral_init()
  */
 bool system_buffer_init()
 {
+	int i;
 	uint16_t* ptr;
 	
 	ESP_LOGI(TAG, "Buffer Allocation");
 	
-	// Allocate the ArduCAM jpeg image buffer in the external RAM
-	sys_cam_buffer.cam_bufferP = heap_caps_malloc(CAM_MAX_JPG_LEN, MALLOC_CAP_SPIRAM);
-	if (sys_cam_buffer.cam_bufferP == NULL) {
-		ESP_LOGE(TAG, "malloc ArduCAM shared buffer failed");
+	if (!system_check_budget()) {
 		return false;
 	}
 	
-	// Allocate the buffer used by the gui to display images from the ArduCAM
+	// Allocate the ArduCAM jpeg image pool buffers in the external RAM
+	for (i=0; i<CAM_BUFFER_POOL_LEN; i++) {
+		cam_buffer_pool[i].ref_count = 0;
+		cam_buffer_pool[i].timestamp_usec = 0;
+		cam_buffer_pool[i].capture_num = 0;
+		cam_buffer_pool[i].cam_buffer_len = 0;
+		cam_buffer_pool[i].cam_bufferP = heap_caps_malloc(CAM_MAX_JPG_LEN, MALLOC_CAP_SPIRAM);
+		if (cam_buffer_pool[i].cam_bufferP == NULL) {
+			ESP_LOGE(TAG, "malloc ArduCAM pool buffer %d failed", i);
+			return false;
+		}
+	}
+	sys_cam_bufferP = NULL;
+	sys_cam_gui_bufferP = NULL;
+	sys_cmd_cam_bufferP = NULL;
+	sys_http_cam_bufferP = NULL;
+	sys_bench_cam_bufferP = NULL;
+	
+#ifdef INCLUDE_SYS_GUI
+	// Allocate the buffers used by the gui to display images from the ArduCAM.  render_task
+	// decodes into one while the gui displays the other.
 	gui_cam_bufferP = heap_caps_malloc(CAM_IMG_PIXELS*2, MALLOC_CAP_SPIRAM);
-	if (gui_cam_bufferP == NULL) {
+	gui_cam_render_bufferP = heap_caps_malloc(CAM_IMG_PIXELS*2, MALLOC_CAP_SPIRAM);
+	if ((gui_cam_bufferP == NULL) || (gui_cam_render_bufferP == NULL)) {
 		ESP_LOGE(TAG, "malloc ArduCAM gui buffer failed");
 		return false;
 	}
@@ -267,23 +476,65 @@ bool system_buffer_init()
 	while (ptr < (gui_cam_bufferP + CAM_IMG_PIXELS)) {
 		*ptr++ = 0;
 	}
+#endif
+	
+	// Allocate the lepton frame pool buffers.  The first SYS_LEP_HOT_FRAMES are hot
+	// (system_lep_frame_alloc hands out the lowest free buffer so they are the ones
+	// usually being filled and processed) and the rest are in the external RAM.
+	for (i=0; i<LEP_FRAME_POOL_LEN; i++) {
+		lep_frame_pool[i].ref_count = 0;
+		if (i < SYS_LEP_HOT_FRAMES) {
+			lep_frame_pool[i].lep_bufferP = system_alloc_hot(LEP_NUM_PIXELS*2, "lepton frame");
+		} else {
+			lep_frame_pool[i].lep_bufferP = heap_caps_malloc(LEP_NUM_PIXELS*2, MALLOC_CAP_SPIRAM);
+		}
+		if (lep_frame_pool[i].lep_bufferP == NULL) {
+			ESP_LOGE(TAG, "malloc lepton pool image buffer %d failed", i);
+			return false;
+		}
+		lep_frame_pool[i].lep_telemP = heap_caps_malloc(LEP_TEL_WORDS*2, MALLOC_CAP_SPIRAM);
+		if (lep_frame_pool[i].lep_telemP == NULL) {
+			ESP_LOGE(TAG, "malloc lepton pool telemetry buffer %d failed", i);
+			return false;
+		}
+	}
+	sys_lep_bufferP = NULL;
+	sys_lep_gui_bufferP = NULL;
+	sys_lep_rec_bufferP = NULL;
+	sys_lep_udp_bufferP = NULL;
+	sys_cmd_lep_bufferP = NULL;
+	sys_bench_lep_bufferP = NULL;
 	
-	// Allocate the lepton frame buffer in the external RAM
-	sys_lep_buffer.lep_bufferP = heap_caps_malloc(LEP_NUM_PIXELS*2, MALLOC_CAP_SPIRAM);
-	if (sys_lep_buffer.lep_bufferP == NULL) {
-		ESP_LOGE(TAG, "malloc lepton shared image buffer failed");
+	// Create the frame event queues
+	for (i=0; i<SYS_FRAME_NUM_STREAMS; i++) {
+		frame_event_queue[i] = xQueueCreate(SYS_FRAME_QUEUE_LEN, sizeof(sys_frame_event_t));
+		if (frame_event_queue[i] == NULL) {
+			ESP_LOGE(TAG, "create frame event queue %d failed", i);
+			return false;
+		}
+		frame_event_seq[i] = 0;
+	}
+	
+	// Allocate the lepton frame averaging accumulator in the external RAM
+	lep_accum_bufferP = heap_caps_malloc(LEP_NUM_PIXELS*4, MALLOC_CAP_SPIRAM);
+	if (lep_accum_bufferP == NULL) {
+		ESP_LOGE(TAG, "malloc lepton accumulator buffer failed");
 		return false;
 	}
-		
-	// Allocate the lepton telemetry buffer in the external RAM
-	sys_lep_buffer.lep_telemP = heap_caps_malloc(LEP_TEL_WORDS*2, MALLOC_CAP_SPIRAM);
-	if (sys_lep_buffer.lep_telemP == NULL) {
-		ESP_LOGE(TAG, "malloc lepton shared telemetry buffer failed");
+	
+	// Allocate the compressed radiometric data buffers (compressed data is always
+	// smaller than the raw frame)
+	cmd_lep_z_bufferP = heap_caps_malloc(LEP_NUM_PIXELS*2, MALLOC_CAP_SPIRAM);
+	file_lep_z_bufferP = heap_caps_malloc(LEP_NUM_PIXELS*2, MALLOC_CAP_SPIRAM);
+	if ((cmd_lep_z_bufferP == NULL) || (file_lep_z_bufferP == NULL)) {
+		ESP_LOGE(TAG, "malloc lepton compression buffers failed");
 		return false;
 	}
 	
-	// Allocate the buffer used by the gui to display images from the lepton
-	gui_lep_bufferP = heap_caps_malloc(LEP_IMG_PIXELS*2, MALLOC_CAP_SPIRAM);
+#ifdef INCLUDE_SYS_GUI
+	// Allocate the buffer used by the gui to display images from the lepton.  It is
+	// written pixel by pixel through the palette so it is hot.
+	gui_lep_bufferP = system_alloc_hot(LEP_IMG_PIXELS*2, "lepton gui");
 	if (gui_lep_bufferP == NULL) {
 		ESP_LOGE(TAG, "malloc lepton gui buffer failed");
 		return false;
@@ -299,6 +550,9 @@ bool system_buffer_init()
 		ESP_LOGE(TAG, "initialize jpeg decompressor failed");
 		return false;
 	}
+#else
+	(void) ptr;
+#endif
 	
 	// Allocate the json buffers
 	if (!json_init()) {
@@ -306,15 +560,13 @@ bool system_buffer_init()
 		return false;
 	}
 	
-	// Allocate the shared json image text buffers in the external RAM
-	sys_image_file_buffer.bufferP = heap_caps_malloc(JSON_MAX_IMAGE_TEXT_LEN, MALLOC_CAP_SPIRAM);
-	if (sys_image_file_buffer.bufferP == NULL) {
-		ESP_LOGE(TAG, "malloc shared json image text file buffer failed");
-		return false;
-	}
-	sys_cmd_response_buffer.bufferP = heap_caps_malloc(JSON_MAX_IMAGE_TEXT_LEN, MALLOC_CAP_SPIRAM);
-	if (sys_cmd_response_buffer.bufferP == NULL) {
-		ESP_LOGE(TAG, "malloc shared json image text command buffer failed");
+	// Allocate the shared json image text buffer in the external RAM.  file_task and
+	// cmd_task both read it in place.
+	sys_image_buffer.ref_count = 0;
+	sys_image_buffer.length = 0;
+	sys_image_buffer.bufferP = heap_caps_malloc(JSON_MAX_IMAGE_TEXT_LEN, MALLOC_CAP_SPIRAM);
+	if (sys_image_buffer.bufferP == NULL) {
+		ESP_LOGE(TAG, "malloc shared json image text buffer failed");
 		return false;
 	}
 	
@@ -324,10 +576,20 @@ bool system_buffer_init()
 		ESP_LOGE(TAG, "could not create vspi_mutex");
 		return false;
 	}
+	vspi_handoff_sem = xSemaphoreCreateCounting(VSPI_NUM_USERS, 0);
+	if (vspi_handoff_sem == NULL) {
+		ESP_LOGE(TAG, "could not create vspi_handoff_sem");
+		return false;
+	}
 	
 	// Initialize GUI state (that may be used by other modules) from persistent storage
 	ps_get_gui_state(&gui_st);
 	
+	ESP_LOGI(TAG, "Free internal RAM %d bytes (IRAM %d bytes), PSRAM %d bytes",
+	         heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+	         heap_caps_get_free_size(MALLOC_CAP_EXEC),
+	         heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+	
 	return true;
 }
 
@@ -339,6 +601,9 @@ void system_shutoff()
 {
 	ESP_LOGI(TAG, "shutdown");
 	
+	// Don't lose any cached configuration changes
+	(void) ps_flush();
+	
 	// Delay for final logging
 	vTaskDelay(pdMS_TO_TICKS(10));
 	
@@ -348,20 +613,135 @@ void system_shutoff()
 
 
 /**
- * Lock the VSPI SPI bus
+ * Deep sleep for sec seconds, or until the touchscreen is touched, with power held on
+ * (the cameras, LCD and RTC stay powered).  The system restarts when it wakes.  When
+ * rtc_wake is set the RTC alarm (see time_set_wake_alarm) wakes it instead of the
+ * ESP32's less accurate RTC timer, which is kept as a late backup.
  */
-void system_lock_vspi()
+void system_sleep(uint32_t sec, bool rtc_wake)
 {
+	ESP_LOGI(TAG, "sleep for %u seconds", sec);
+	
+	// Don't lose any cached configuration changes
+	(void) ps_flush();
+	
+	// Keep PWR_HOLD asserted while the digital pads are powered down
+	gpio_hold_en(PWR_HOLD_IO);
+	gpio_deep_sleep_hold_en();
+	
+#ifdef RTC_SQW_IO
+	if (rtc_wake) {
+		esp_sleep_enable_ext1_wakeup(1ULL << RTC_SQW_IO, ESP_EXT1_WAKEUP_ALL_LOW);
+		sec += (sec / SYS_SLEEP_BACKUP_DIV) + SYS_SLEEP_BACKUP_SEC;
+	}
+#else
+	(void) rtc_wake;
+#endif
+	esp_sleep_enable_timer_wakeup((uint64_t) sec * 1000000);
+	esp_sleep_enable_ext0_wakeup(TS_IRQ_IO, 0);
+	
+	// Delay for final logging
+	vTaskDelay(pdMS_TO_TICKS(10));
+	
+	esp_deep_sleep_start();
+}
+
+
+/**
+ * Return true if the system was woken by the timer or RTC alarm from a duty-cycled
+ * recording sleep
+ */
+bool system_get_sleep_wake()
+{
+	esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
+	
+	return ((cause == ESP_SLEEP_WAKEUP_TIMER) || (cause == ESP_SLEEP_WAKEUP_EXT1));
+}
+
+
+/**
+ * Lock the VSPI SPI bus for user (VSPI_USER_*)
+ */
+void system_lock_vspi(int user)
+{
+	portENTER_CRITICAL(&vspi_mux);
+	vspi_waiting[user]++;
+	portEXIT_CRITICAL(&vspi_mux);
+	
 	xSemaphoreTake(vspi_mutex, portMAX_DELAY);
+	
+	portENTER_CRITICAL(&vspi_mux);
+	vspi_waiting[user]--;
+	vspi_owner = user;
+	portEXIT_CRITICAL(&vspi_mux);
 }
 
 
 /**
- * Unlock the VSPI SPI bus
+ * Unlock the VSPI SPI bus and wake any users that yielded it to us
  */
 void system_unlock_vspi()
 {
+	int parked;
+	
+	portENTER_CRITICAL(&vspi_mux);
+	parked = vspi_parked;
+	vspi_parked = 0;
+	portEXIT_CRITICAL(&vspi_mux);
+	
 	xSemaphoreGive(vspi_mutex);
+	while (parked--) {
+		xSemaphoreGive(vspi_handoff_sem);
+	}
+}
+
+
+/**
+ * Called by the VSPI owner between slices of a long transfer.  If a higher priority user
+ * is waiting the bus is handed to it and the call returns, with the bus locked again,
+ * after that user has unlocked it.  Returns true if the bus was yielded.
+ */
+bool system_yield_vspi()
+{
+	bool higher_waiting = false;
+	int i;
+	int owner;
+	
+	portENTER_CRITICAL(&vspi_mux);
+	owner = vspi_owner;
+	for (i=owner+1; i<VSPI_NUM_USERS; i++) {
+		if (vspi_waiting[i] != 0) higher_waiting = true;
+	}
+	if (higher_waiting) {
+		vspi_parked++;
+	}
+	portEXIT_CRITICAL(&vspi_mux);
+	
+	if (!higher_waiting) return false;
+	
+	xSemaphoreGive(vspi_mutex);
+	(void) xSemaphoreTake(vspi_handoff_sem, pdMS_TO_TICKS(VSPI_HANDOFF_MAX_MSEC));
+	system_lock_vspi(owner);
+	
+	return true;
+}
+
+
+/**
+ * Return true if user (VSPI_USER_*) has the VSPI SPI bus locked or is waiting for it
+ */
+bool system_vspi_user_busy(int user)
+{
+	bool locked;
+	bool busy;
+	
+	locked = (xSemaphoreGetMutexHolder(vspi_mutex) != NULL);
+	
+	portENTER_CRITICAL(&vspi_mux);
+	busy = (vspi_waiting[user] != 0) || (locked && (vspi_owner == user));
+	portEXIT_CRITICAL(&vspi_mux);
+	
+	return busy;
 }
 
 
@@ -379,4 +759,266 @@ int system_get_rec_interval_index(int rec_interval)
 	}
 	
 	return -1;
-}
\ No newline at end of file
+}
+
+
+/**
+ * Return true if a task still holds a reference to the shared json image text buffer
+ * and it may not be overwritten
+ */
+bool system_image_buffer_in_use()
+{
+	bool in_use;
+	
+	portENTER_CRITICAL(&image_buffer_mux);
+	in_use = (sys_image_buffer.ref_count != 0);
+	portEXIT_CRITICAL(&image_buffer_mux);
+	
+	return in_use;
+}
+
+
+/**
+ * Add a reference to the shared json image text buffer for a consumer
+ */
+void system_image_buffer_hold()
+{
+	portENTER_CRITICAL(&image_buffer_mux);
+	sys_image_buffer.ref_count++;
+	portEXIT_CRITICAL(&image_buffer_mux);
+}
+
+
+/**
+ * Drop a consumer's reference to the shared json image text buffer
+ */
+void system_image_buffer_release()
+{
+	portENTER_CRITICAL(&image_buffer_mux);
+	if (sys_image_buffer.ref_count > 0) {
+		sys_image_buffer.ref_count--;
+	}
+	portEXIT_CRITICAL(&image_buffer_mux);
+}
+
+
+/**
+ * Allocate an unused ArduCAM jpeg buffer from the pool.  The caller holds the only
+ * reference to it.  Returns NULL if all buffers are in use.
+ */
+cam_buffer_t* system_cam_buffer_alloc()
+{
+	int i;
+	cam_buffer_t* bufP = NULL;
+	
+	portENTER_CRITICAL(&cam_buffer_pool_mux);
+	for (i=0; i<CAM_BUFFER_POOL_LEN; i++) {
+		if (cam_buffer_pool[i].ref_count == 0) {
+			cam_buffer_pool[i].ref_count = 1;
+			bufP = &cam_buffer_pool[i];
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&cam_buffer_pool_mux);
+	
+	return bufP;
+}
+
+
+/**
+ * Add a reference to an ArduCAM jpeg buffer
+ */
+void system_cam_buffer_hold(cam_buffer_t* bufP)
+{
+	if (bufP == NULL) return;
+	
+	portENTER_CRITICAL(&cam_buffer_pool_mux);
+	bufP->ref_count++;
+	portEXIT_CRITICAL(&cam_buffer_pool_mux);
+}
+
+
+/**
+ * Drop a reference to an ArduCAM jpeg buffer, returning it to the pool when unused
+ */
+void system_cam_buffer_release(cam_buffer_t* bufP)
+{
+	if (bufP == NULL) return;
+	
+	portENTER_CRITICAL(&cam_buffer_pool_mux);
+	if (bufP->ref_count > 0) {
+		bufP->ref_count--;
+	}
+	portEXIT_CRITICAL(&cam_buffer_pool_mux);
+}
+
+
+/**
+ * Allocate an unused lepton frame buffer from the pool.  The caller holds the only
+ * reference to it.  Returns NULL if all buffers are in use.
+ */
+lep_buffer_t* system_lep_frame_alloc()
+{
+	int i;
+	lep_buffer_t* bufP = NULL;
+	
+	portENTER_CRITICAL(&lep_frame_pool_mux);
+	for (i=0; i<LEP_FRAME_POOL_LEN; i++) {
+		if (lep_frame_pool[i].ref_count == 0) {
+			lep_frame_pool[i].ref_count = 1;
+			bufP = &lep_frame_pool[i];
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&lep_frame_pool_mux);
+	
+	return bufP;
+}
+
+
+/**
+ * Add a reference to a lepton frame buffer so it isn't reused while being consumed
+ */
+void system_lep_frame_hold(lep_buffer_t* bufP)
+{
+	if (bufP == NULL) return;
+	
+	portENTER_CRITICAL(&lep_frame_pool_mux);
+	bufP->ref_count++;
+	portEXIT_CRITICAL(&lep_frame_pool_mux);
+}
+
+
+/**
+ * Release a reference to a lepton frame buffer.  It returns to the pool when the
+ * last reference is released.
+ */
+void system_lep_frame_release(lep_buffer_t* bufP)
+{
+	if (bufP == NULL) return;
+	
+	portENTER_CRITICAL(&lep_frame_pool_mux);
+	if (bufP->ref_count > 0) {
+		bufP->ref_count--;
+	}
+	portEXIT_CRITICAL(&lep_frame_pool_mux);
+}
+
+
+/**
+ * Post a frame, or a failure to get one, to a frame event stream.  The caller's
+ * reference to bufP is passed to the consumer.  Each stream has one producer.
+ * Returns false, leaving the caller with its reference, if the queue is full.
+ */
+bool system_frame_event_post(int stream, void* bufP, int64_t timestamp_usec, uint32_t flags)
+{
+	sys_frame_event_t ev;
+	
+	ev.seq_num = frame_event_seq[stream];
+	ev.flags = flags;
+	ev.timestamp_usec = timestamp_usec;
+	ev.bufP = bufP;
+	if (xQueueSend(frame_event_queue[stream], &ev, 0) != pdTRUE) {
+		ESP_LOGE(TAG, "Frame event stream %d full", stream);
+		return false;
+	}
+	frame_event_seq[stream]++;
+	
+	return true;
+}
+
+
+/**
+ * Get the oldest event from a frame event stream without waiting.  Returns false if
+ * the stream is empty.
+ */
+bool system_frame_event_get(int stream, sys_frame_event_t* evP)
+{
+	return (xQueueReceive(frame_event_queue[stream], evP, 0) == pdTRUE);
+}
+
+
+
+//
+// System Utilities internal functions
+//
+
+#ifdef INCLUDE_SYS_ARDUCAM
+/**
+ * Initialize the ArduCAM and notify system_peripheral_init when done
+ */
+static void system_cam_init_task(void* args)
+{
+	sys_cam_init_ok = (ov2640_init() != 0);
+	xTaskNotify(sys_init_task_handle, SYS_CAM_INIT_DONE_MASK, eSetBits);
+	vTaskDelete(NULL);
+}
+#endif
+
+
+/**
+ * Log the system memory budget and check it fits in the free memory.  Returns false if
+ * it doesn't.  Called before any of the budgeted buffers have been allocated (some
+ * internal DMA buffers are allocated by drivers earlier and have already been taken
+ * from the free internal RAM).
+ */
+static bool system_check_budget()
+{
+	int i;
+	uint32_t len;
+	uint32_t psram_len = 0;
+	uint32_t dma_len = 0;
+	uint32_t psram_free;
+	
+	ESP_LOGI(TAG, "Memory budget");
+	for (i=0; i<SYS_MEM_BUDGET_LEN; i++) {
+		len = sys_mem_budget[i].count * sys_mem_budget[i].len;
+		ESP_LOGI(TAG, "  %-22s %2d x %6d = %7d bytes (%s)", sys_mem_budget[i].name,
+		         sys_mem_budget[i].count, sys_mem_budget[i].len, len,
+		         (sys_mem_budget[i].caps == MALLOC_CAP_SPIRAM) ? "PSRAM" : "internal");
+		if (sys_mem_budget[i].caps == MALLOC_CAP_SPIRAM) {
+			psram_len += len;
+		} else {
+			dma_len += len;
+		}
+	}
+	
+	psram_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+	ESP_LOGI(TAG, "  PSRAM %d of %d free bytes (%d reserved), internal DMA %d bytes",
+	         psram_len, psram_free, SYS_PSRAM_RESERVE, dma_len);
+	
+	if ((psram_len + SYS_PSRAM_RESERVE) > psram_free) {
+		ESP_LOGE(TAG, "Buffers need %d more bytes of PSRAM than are available - reduce the pool or queue lengths in system_config.h",
+		         (psram_len + SYS_PSRAM_RESERVE) - psram_free);
+		return false;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Allocate a buffer for a small, frequently accessed working set.  It is placed in the
+ * internal RAM, which is much faster than the PSRAM, if that leaves at least
+ * SYS_INT_RAM_RESERVE bytes free for the tasks and WiFi started later.  Otherwise it
+ * goes in the PSRAM.  The placement is logged.
+ */
+static void* system_alloc_hot(size_t len, const char* name)
+{
+	void* p = NULL;
+	
+	if ((heap_caps_get_free_size(MALLOC_CAP_INTERNAL) >= (len + SYS_INT_RAM_RESERVE)) &&
+	    (heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT) >= len))
+	{
+		p = heap_caps_malloc(len, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	}
+	
+	if (p != NULL) {
+		ESP_LOGI(TAG, "  %s buffer (%d bytes) in internal RAM", name, (int) len);
+	} else {
+		p = heap_caps_malloc(len, MALLOC_CAP_SPIRAM);
+		ESP_LOGI(TAG, "  %s buffer (%d bytes) in PSRAM", name, (int) len);
+	}
+	
+	return p;
+}
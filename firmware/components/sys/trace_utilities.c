@@ -0,0 +1,240 @@
+/*
+ * Task notification trace
+ *
+ * When INCLUDE_SYS_TRACE is defined every xTaskNotify and xTaskNotifyFromISR call in
+ * a file including this header is recorded, with its source and destination tasks and
+ * value, in a ring buffer.  The ring can be written to a file in the Chrome trace event
+ * format to be viewed as a timeline (chrome://tracing or https://ui.perfetto.dev).
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "trace_utilities.h"
+
+#ifdef INCLUDE_SYS_TRACE
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "soc/cpu.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+
+//
+// Trace Utilities variables
+//
+static const char* TAG = "trace_utilities";
+
+static trace_entry_t trace_ring[TRACE_RING_LEN];
+static int trace_next;                // Next entry to write
+static bool trace_wrapped;            // Set once the ring has been filled
+static portMUX_TYPE trace_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+
+//
+// Trace Utilities Forward Declarations for internal functions
+//
+static void IRAM_ATTR trace_record(TaskHandle_t src, TaskHandle_t dst, uint32_t value);
+static int trace_task_index(TaskHandle_t* tasks, int* num_tasks, TaskHandle_t t);
+static const char* trace_task_name(TaskHandle_t t);
+
+
+
+//
+// Trace Utilities API
+//
+
+/**
+ * Record and send a notification from a task
+ */
+BaseType_t trace_notify(TaskHandle_t dst, uint32_t value, eNotifyAction action)
+{
+	portENTER_CRITICAL(&trace_mux);
+	trace_record(xTaskGetCurrentTaskHandle(), dst, value);
+	portEXIT_CRITICAL(&trace_mux);
+	
+	return xTaskGenericNotify(dst, value, action, NULL);
+}
+
+
+/**
+ * Record and send a notification from an ISR
+ */
+BaseType_t IRAM_ATTR trace_notify_from_isr(TaskHandle_t dst, uint32_t value, eNotifyAction action, BaseType_t* wokenP)
+{
+	portENTER_CRITICAL_ISR(&trace_mux);
+	trace_record(NULL, dst, value);
+	portEXIT_CRITICAL_ISR(&trace_mux);
+	
+	return xTaskGenericNotifyFromISR(dst, value, action, NULL, wokenP);
+}
+
+
+/**
+ * Write the trace, oldest notification first, to an open file as a Chrome trace
+ * event json object.  Each notification is shown as an instant event on the
+ * sending task's timeline and the receiving task's timeline.  Notifications are
+ * still recorded while the file is written.  Returns false if a write failed.
+ */
+bool trace_write(FILE* fp)
+{
+	trace_entry_t* snapP;
+	trace_entry_t* eP;
+	TaskHandle_t tasks[TRACE_MAX_TASKS];
+	int num_tasks;
+	int count;
+	int first;
+	int i, n;
+	uint32_t first_usec;
+	bool success = true;
+	
+	snapP = heap_caps_malloc(TRACE_RING_LEN * sizeof(trace_entry_t), MALLOC_CAP_SPIRAM);
+	if (snapP == NULL) {
+		ESP_LOGE(TAG, "malloc trace snapshot failed");
+		return false;
+	}
+	
+	// Copy the ring in order
+	portENTER_CRITICAL(&trace_mux);
+	if (trace_wrapped) {
+		count = TRACE_RING_LEN;
+		first = trace_next;
+	} else {
+		count = trace_next;
+		first = 0;
+	}
+	n = TRACE_RING_LEN - first;
+	if (n > count) n = count;
+	memcpy(snapP, &trace_ring[first], n * sizeof(trace_entry_t));
+	memcpy(&snapP[n], trace_ring, (count - n) * sizeof(trace_entry_t));
+	portEXIT_CRITICAL(&trace_mux);
+	
+	// Timeline row 0 is for ISRs
+	tasks[0] = NULL;
+	num_tasks = 1;
+	first_usec = (count > 0) ? snapP[0].usec : 0;
+	
+	if (fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n") < 0) success = false;
+	
+	for (i=0; (i<count) && success; i++) {
+		eP = &snapP[i];
+		
+		// Times are relative to the first notification (the difference of the low 32
+		// bits is correct for traces spanning less than 71 minutes)
+		if (fprintf(fp, "{\"name\":\"> %s 0x%08X\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%u,\"pid\":0,\"tid\":%d,\"args\":{\"core\":%d,\"ccount\":%u}},\n",
+		            trace_task_name(eP->dst), eP->value, eP->usec - first_usec,
+		            trace_task_index(tasks, &num_tasks, eP->src), eP->core, eP->ccount) < 0)
+		{
+			success = false;
+		}
+		if (fprintf(fp, "{\"name\":\"< %s 0x%08X\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%u,\"pid\":0,\"tid\":%d,\"args\":{\"core\":%d,\"ccount\":%u}},\n",
+		            trace_task_name(eP->src), eP->value, eP->usec - first_usec,
+		            trace_task_index(tasks, &num_tasks, eP->dst), eP->core, eP->ccount) < 0)
+		{
+			success = false;
+		}
+	}
+	
+	// Name the timeline rows.  Tasks past TRACE_MAX_TASKS share the last row.
+	for (i=0; (i<num_tasks) && success; i++) {
+		if (fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+		            i, trace_task_name(tasks[i])) < 0)
+		{
+			success = false;
+		}
+	}
+	if (success) {
+		if (fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"other\"}}\n]}\n",
+		            TRACE_MAX_TASKS) < 0)
+		{
+			success = false;
+		}
+	}
+	
+	free(snapP);
+	
+	if (success) {
+		ESP_LOGI(TAG, "Wrote %d notifications", count);
+	} else {
+		ESP_LOGE(TAG, "Trace write failed");
+	}
+	
+	return success;
+}
+
+
+
+//
+// Trace Utilities internal functions
+//
+
+/**
+ * Add a notification to the ring.  Called with trace_mux held.
+ */
+static void IRAM_ATTR trace_record(TaskHandle_t src, TaskHandle_t dst, uint32_t value)
+{
+	trace_entry_t* eP;
+	
+	eP = &trace_ring[trace_next];
+	RSR(CCOUNT, eP->ccount);
+	eP->usec = (uint32_t) esp_timer_get_time();
+	eP->src = src;
+	eP->dst = dst;
+	eP->value = value;
+	eP->core = (uint8_t) xPortGetCoreID();
+	
+	if (++trace_next == TRACE_RING_LEN) {
+		trace_next = 0;
+		trace_wrapped = true;
+	}
+}
+
+
+/**
+ * Return the timeline row for task t, adding it to tasks if it is new
+ */
+static int trace_task_index(TaskHandle_t* tasks, int* num_tasks, TaskHandle_t t)
+{
+	int i;
+	
+	for (i=0; i<*num_tasks; i++) {
+		if (tasks[i] == t) return i;
+	}
+	
+	if (*num_tasks == TRACE_MAX_TASKS) return TRACE_MAX_TASKS;
+	
+	tasks[*num_tasks] = t;
+	return (*num_tasks)++;
+}
+
+
+/**
+ * Return the name of task t.  Tasks are only deleted after fatal errors so the
+ * handles in the trace stay valid.
+ */
+static const char* trace_task_name(TaskHandle_t t)
+{
+	if (t == NULL) return "ISR";
+	
+	return pcTaskGetTaskName(t);
+}
+
+#endif /* INCLUDE_SYS_TRACE */
@@ -7,6 +7,10 @@
  *
  * Note: Currently only 1 station is allowed to connect at a time.
  *
+ * In AP+Client mode the camera stays connected to the site network as a client while
+ * running its own AP so a technician can connect directly.  The ESP32 has one radio so
+ * the AP operates on the channel of the network the client is connected to.
+ *
  * Copyright 2020 Dan Julio
  *
  * This file is part of firecam.
@@ -26,24 +30,49 @@
  *
  */
 #include "wifi_utilities.h"
+#include "ps_nvs.h"
 #include "ps_utilities.h"
+#include "pm_utilities.h"
+#include "sys_utilities.h"
+#include "time_utilities.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "esp_wifi.h"
 #include "esp_event_loop.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
-#include "nvs_flash.h"
+#include "lwip/apps/sntp.h"
 #include <lwip/sockets.h>
 #include <string.h>
 
 
 
+//
+// WiFi Utilities typedefs
+//
+typedef struct {
+	bool set_radio;               // Apply the radio settings below, otherwise driver defaults
+	wifi_ps_type_t ps_type;       // Client modem sleep
+	int8_t max_tx_power;          // 0.25 dBm units
+	wifi_bandwidth_t bandwidth;
+	int dynamic_rx_buf_num;       // Driver receive buffers, 0 for the sdkconfig value
+} wifi_profile_t;
+
+
+
 //
 // Wifi Utilities local variables
 //
 static const char* TAG = "wifi_utilities";
 
+// Profiles (indexed by WIFI_PROFILE_xxx)
+static const wifi_profile_t wifi_profiles[WIFI_NUM_PROFILES] = {
+	{false, WIFI_PS_MIN_MODEM, 0, WIFI_BW_HT20, 0},
+	{true, WIFI_PS_NONE, 80, WIFI_BW_HT40, 64},
+	{true, WIFI_PS_MIN_MODEM, 52, WIFI_BW_HT20, 16}
+};
+static int wifi_init_profile;      // Profile the driver was initialized with
+
 // Wifi information
 static char wifi_ap_ssid_array[PS_SSID_MAX_LEN+1];
 static char wifi_sta_ssid_array[PS_SSID_MAX_LEN+1];
@@ -61,7 +90,11 @@ static wifi_info_t wifi_info = {
 };
 
 static bool sta_connected = false; // Set when we connect to an AP so we can disconnect if we restart
+static bool ap_sta_joined = false; // Set while a station is connected to our AP
 static int sta_retry_num = 0;
+static bool sta_directed = false;  // Client configured to connect to the cached AP
+static bool sta_directed_ok;       // Set once a directed connection has succeeded
+static bool sntp_running = false;
 
 // FreeRTOS event group to signal when we are connected
 static EventGroupHandle_t wifi_event_group;
@@ -72,9 +105,18 @@ static EventGroupHandle_t wifi_event_group;
 // WiFi Utilities Forward Declarations for internal functions
 //
 static bool init_esp_wifi();
-static bool enable_esp_wifi_ap();
-static bool enable_esp_wifi_client();
+static bool enable_esp_wifi();
+static bool config_esp_wifi_ap();
+static bool config_esp_wifi_client();
+static bool set_esp_wifi_client_config(bool directed);
+static void save_ap_cache(const uint8_t* bssid, uint8_t channel);
+static void clear_ap_cache();
+static void update_connected();
+static void apply_esp_wifi_bandwidth(wifi_mode_t mode);
+static void apply_esp_wifi_power(wifi_mode_t mode);
 static esp_err_t sys_event_handler(void *ctx, system_event_t* event);
+static void start_sntp();
+static void stop_sntp();
 
 
 //
@@ -101,20 +143,7 @@ bool wifi_init()
 	// Initialize the TCP/IP stack
 	tcpip_adapter_init();
 	
-	// Initialize NVS
-	ret = nvs_flash_init();
-	if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-		ret = nvs_flash_erase();
-		if (ret != ESP_OK) {
-			ESP_LOGI(TAG, "nvs_flash_erase failed (%d)", ret);
-			return false;
-		}
-		ret = nvs_flash_init();
-	}
-	if (ret != ESP_OK) {
-		ESP_LOGI(TAG, "nvs_flash_init failed (%d)", ret);
-		return false;
-	}
+	// NVS (required by the WiFi driver) was initialized by ps_nvs_init
 	
 	// Get our wifi info
 	ps_get_wifi_info(&wifi_info);
@@ -123,22 +152,13 @@ bool wifi_init()
 	if (init_esp_wifi()) {
 		wifi_info.flags |= WIFI_INFO_FLAG_INITIALIZED;
 		
-		// Configure the WiFi interface if enabled
-		if ((wifi_info.flags & WIFI_INFO_FLAG_STARTUP_ENABLE) != 0) {
-			if ((wifi_info.flags & WIFI_INFO_FLAG_CLIENT_MODE) != 0) {
-				if (enable_esp_wifi_client()) {
-					wifi_info.flags |= WIFI_INFO_FLAG_ENABLED;
-					ESP_LOGI(TAG, "WiFi Station starting");
-				} else {
-					return false;
-				}
+		// Configure the WiFi interface if enabled.  It stays off while briefly awake to
+		// record an image between duty-cycled recording sleeps.
+		if (((wifi_info.flags & WIFI_INFO_FLAG_STARTUP_ENABLE) != 0) && !system_get_sleep_wake()) {
+			if (enable_esp_wifi()) {
+				wifi_info.flags |= WIFI_INFO_FLAG_ENABLED;
 			} else {
-				if (enable_esp_wifi_ap()) {
-					wifi_info.flags |= WIFI_INFO_FLAG_ENABLED;
-					ESP_LOGI(TAG, "WiFi AP %s enabled", wifi_info.ap_ssid);
-				} else {
-					return false;
-				}
+				return false;
 			}
 		}
 	} else {
@@ -155,53 +175,64 @@ bool wifi_init()
  */
 bool wifi_reinit()
 {
+	bool initialized;
+	char prev_sta_ssid[PS_SSID_MAX_LEN+1];
+	
 	// Attempt to disconnect from an AP if we were previously connected
 	if (sta_connected) {
 		ESP_LOGI(TAG, "Attempting to disconnect from AP");
 		esp_wifi_disconnect();
 		sta_connected = false;
 	}
+	stop_sntp();
 	
 	// Shut down the old configuration
 	if ((wifi_info.flags & WIFI_INFO_FLAG_ENABLED) != 0) {
 		ESP_LOGI(TAG, "WiFi stopping");
 		esp_wifi_stop();
+		pm_set_level(PM_USER_WIFI, PM_LEVEL_SLEEP);
 		wifi_info.flags &= ~WIFI_INFO_FLAG_ENABLED;
 	}
 
-	if ((wifi_info.flags & WIFI_INFO_FLAG_INITIALIZED) == 0) {
+	// Update the wifi info because we're called when it's updated
+	initialized = ((wifi_info.flags & WIFI_INFO_FLAG_INITIALIZED) != 0);
+	strcpy(prev_sta_ssid, wifi_info.sta_ssid);
+	ps_get_wifi_info(&wifi_info);
+	
+	// The cached AP belongs to the previous network
+	if (strcmp(prev_sta_ssid, wifi_info.sta_ssid) != 0) {
+		clear_ap_cache();
+	}
+	
+	// The driver sizes its buffers when it is initialized so initialize it again for a
+	// new profile.  This also restores its defaults for settings the profile changed.
+	if (initialized && (wifi_info.profile != wifi_init_profile)) {
+		ESP_LOGI(TAG, "WiFi profile %d", wifi_info.profile);
+		esp_wifi_deinit();
+		initialized = false;
+	}
+	
+	if (!initialized) {
 		// Attempt to initialize the wifi interface again
 		if (!init_esp_wifi()) {
 			return false;
 		}
 	}
-	
-	// Update the wifi info because we're called when it's updated
-	ps_get_wifi_info(&wifi_info);
 	wifi_info.flags |= WIFI_INFO_FLAG_INITIALIZED;   // Add in the fact we're already initialized
 	
+	// Nothing should be connected now
+	ap_sta_joined = false;
+	wifi_info.flags &= ~WIFI_INFO_FLAG_CONNECTED;
+	
 	// Reconfigure the interface if enabled
 	if ((wifi_info.flags & WIFI_INFO_FLAG_STARTUP_ENABLE) != 0) {
-		if ((wifi_info.flags & WIFI_INFO_FLAG_CLIENT_MODE) != 0) {
-			if (enable_esp_wifi_client()) {
-				wifi_info.flags |= WIFI_INFO_FLAG_ENABLED;
-				ESP_LOGI(TAG, "WiFi Station starting");
-			} else {
-				return false;
-			}
+		if (enable_esp_wifi()) {
+			wifi_info.flags |= WIFI_INFO_FLAG_ENABLED;
 		} else {
-			if (enable_esp_wifi_ap()) {
-				wifi_info.flags |= WIFI_INFO_FLAG_ENABLED;
-				ESP_LOGI(TAG, "WiFi AP %s enabled", wifi_info.ap_ssid);
-			} else {
-				return false;
-			}
+			return false;
 		}
 	}
 	
-	// Nothing should be connected now
-	wifi_info.flags &= ~WIFI_INFO_FLAG_CONNECTED;
-	
 	return true;
 }
 
@@ -236,11 +267,16 @@ static bool init_esp_wifi()
 	esp_err_t ret;
 	wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
 	
+	if (wifi_profiles[wifi_info.profile].dynamic_rx_buf_num != 0) {
+		cfg.dynamic_rx_buf_num = wifi_profiles[wifi_info.profile].dynamic_rx_buf_num;
+	}
+	
 	ret = esp_wifi_init(&cfg);
 	if (ret != ESP_OK) {
 		ESP_LOGE(TAG, "Could not allocate wifi resources (%d)", ret);
 		return false;
 	}
+	wifi_init_profile = wifi_info.profile;
 	
 	// We don't need the NVS configuration storage for the WiFi configuration since we
 	// are managing persistent storage ourselves
@@ -255,14 +291,70 @@ static bool init_esp_wifi()
 
 
 /**
- * Enable this device as a Soft AP
+ * Enable this device as a Soft AP, a Client or both (AP+Client mode) depending on the
+ * mode flags
  */
-static bool enable_esp_wifi_ap()
+static bool enable_esp_wifi()
 {
 	esp_err_t ret;
+	wifi_mode_t mode;
 	int i;
 	
-	// Enable the AP
+	if ((wifi_info.flags & WIFI_INFO_FLAG_CLIENT_MODE) == 0) {
+		mode = WIFI_MODE_AP;
+	} else if ((wifi_info.flags & WIFI_INFO_FLAG_AP_STA_MODE) != 0) {
+		mode = WIFI_MODE_APSTA;
+	} else {
+		mode = WIFI_MODE_STA;
+	}
+	
+    ret = esp_wifi_set_mode(mode);
+    if (ret != ESP_OK) {
+    	ESP_LOGE(TAG, "Could not set WiFi mode %d (%d)", mode, ret);
+    	return false;
+    }
+    
+    if ((mode == WIFI_MODE_AP) || (mode == WIFI_MODE_APSTA)) {
+    	if (!config_esp_wifi_ap()) return false;
+    }
+    if ((mode == WIFI_MODE_STA) || (mode == WIFI_MODE_APSTA)) {
+    	if (!config_esp_wifi_client()) return false;
+    }
+    apply_esp_wifi_bandwidth(mode);
+    
+    ret = esp_wifi_start();
+    if (ret != ESP_OK) {
+    	ESP_LOGE(TAG, "Could not start WiFi (%d)", ret);
+    	return false;
+    }
+    
+    // The AP and the client connection must keep answering while WiFi is on
+    pm_set_level(PM_USER_WIFI, PM_LEVEL_AWAKE);
+    apply_esp_wifi_power(mode);
+    
+    // For now, since we are using the default IP address, copy it to the current here.
+    // It is replaced by the client address when the client gets one.
+    if (mode != WIFI_MODE_STA) {
+    	for (i=0; i<4; i++) {
+    		wifi_info.cur_ip_addr[i] = wifi_info.ap_ip_addr[i];
+    	}
+    	ESP_LOGI(TAG, "WiFi AP %s enabled", wifi_info.ap_ssid);
+    }
+    if (mode != WIFI_MODE_AP) {
+    	ESP_LOGI(TAG, "WiFi Station starting");
+    }
+    
+    return true;
+}
+
+
+/**
+ * Configure the Soft AP interface
+ */
+static bool config_esp_wifi_ap()
+{
+	esp_err_t ret;
+	
 	wifi_config_t wifi_config = {
         .ap = {
             .ssid_len = strlen(wifi_info.ap_ssid),
@@ -276,37 +368,20 @@ static bool enable_esp_wifi_ap()
         wifi_config.ap.authmode = WIFI_AUTH_OPEN;
     }
     
-    ret = esp_wifi_set_mode(WIFI_MODE_AP);
-    if (ret != ESP_OK) {
-    	ESP_LOGE(TAG, "Could not set Soft AP mode (%d)", ret);
-    	return false;
-    }
-    
     ret = esp_wifi_set_config(ESP_IF_WIFI_AP, &wifi_config);
     if (ret != ESP_OK) {
     	ESP_LOGE(TAG, "Could not set Soft AP configuration (%d)", ret);
     	return false;
     }
     
-    ret = esp_wifi_start();
-    if (ret != ESP_OK) {
-    	ESP_LOGE(TAG, "Could not start Soft AP (%d)", ret);
-    	return false;
-    }
-    
-    // For now, since we are using the default IP address, copy it to the current here
-    for (i=0; i<4; i++) {
-    	wifi_info.cur_ip_addr[i] = wifi_info.ap_ip_addr[i];
-    }
-    	
     return true;
 }
 
 
 /**
- * Enable this device as a Client
+ * Configure the Client interface
  */
-static bool enable_esp_wifi_client()
+static bool config_esp_wifi_client()
 {
 	esp_err_t ret;
 	tcpip_adapter_ip_info_t ipInfo;
@@ -333,7 +408,22 @@ static bool enable_esp_wifi_client()
     	}
 	}
 	
-	// Enable the Client
+	// Connect directly to the AP we were last connected to, if known, to skip the scan
+	return set_esp_wifi_client_config(true);
+}
+
+
+/**
+ * Set the Client connection configuration.  A directed configuration connects to the
+ * cached AP channel and BSSID (if there is one) without scanning the other channels.
+ * Otherwise all channels are scanned for the SSID and the strongest AP is used.
+ */
+static bool set_esp_wifi_client_config(bool directed)
+{
+	esp_err_t ret;
+	uint32_t bssid_hi, bssid_lo;
+	uint8_t channel;
+	
 	wifi_config_t wifi_config = {
 		.sta = {
 			.scan_method = WIFI_FAST_SCAN,
@@ -350,11 +440,22 @@ static bool enable_esp_wifi_client()
     	strcpy((char*) wifi_config.sta.password, wifi_info.sta_pw);
     }
     
-    ret = esp_wifi_set_mode(WIFI_MODE_STA);
-    if (ret != ESP_OK) {
-    	ESP_LOGE(TAG, "Could not set Station mode (%d)", ret);
-    	return false;
+    channel = directed ? (uint8_t) ps_nvs_get_uint(PS_NVS_WIFI_AP_CHAN) : 0;
+    if (channel != 0) {
+    	bssid_hi = ps_nvs_get_uint(PS_NVS_WIFI_AP_BSSID_HI);
+    	bssid_lo = ps_nvs_get_uint(PS_NVS_WIFI_AP_BSSID_LO);
+    	wifi_config.sta.channel = channel;
+    	wifi_config.sta.bssid_set = 1;
+    	wifi_config.sta.bssid[0] = (bssid_hi >> 8) & 0xFF;
+    	wifi_config.sta.bssid[1] = bssid_hi & 0xFF;
+    	wifi_config.sta.bssid[2] = (bssid_lo >> 24) & 0xFF;
+    	wifi_config.sta.bssid[3] = (bssid_lo >> 16) & 0xFF;
+    	wifi_config.sta.bssid[4] = (bssid_lo >> 8) & 0xFF;
+    	wifi_config.sta.bssid[5] = bssid_lo & 0xFF;
+    	ESP_LOGI(TAG, "Connecting to cached AP "MACSTR" on channel %d", MAC2STR(wifi_config.sta.bssid), channel);
     }
+    sta_directed = (channel != 0);
+    sta_directed_ok = false;
     
     ret = esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config);
     if (ret != ESP_OK) {
@@ -362,16 +463,68 @@ static bool enable_esp_wifi_client()
     	return false;
     }
     
-    ret = esp_wifi_start();
-    if (ret != ESP_OK) {
-    	ESP_LOGE(TAG, "Could not start Station (%d)", ret);
-    	return false;
-    }
-    
     return true;
 }
 
 
+/**
+ * Apply the current profile's bandwidth to the configured interfaces before they are
+ * started (the client connects as soon as it starts).  Failures here and in
+ * apply_esp_wifi_power aren't fatal since the driver defaults still work.
+ */
+static void apply_esp_wifi_bandwidth(wifi_mode_t mode)
+{
+	const wifi_profile_t* profileP = &wifi_profiles[wifi_info.profile];
+	esp_err_t ret;
+	
+	if (!profileP->set_radio) return;
+	
+	if (mode != WIFI_MODE_STA) {
+		ret = esp_wifi_set_bandwidth(ESP_IF_WIFI_AP, profileP->bandwidth);
+		if (ret != ESP_OK) ESP_LOGW(TAG, "Set AP bandwidth returned %d", ret);
+	}
+	if (mode != WIFI_MODE_AP) {
+		ret = esp_wifi_set_bandwidth(ESP_IF_WIFI_STA, profileP->bandwidth);
+		if (ret != ESP_OK) ESP_LOGW(TAG, "Set Station bandwidth returned %d", ret);
+	}
+}
+
+
+/**
+ * Apply the current profile's power settings once the interfaces have started
+ */
+static void apply_esp_wifi_power(wifi_mode_t mode)
+{
+	const wifi_profile_t* profileP = &wifi_profiles[wifi_info.profile];
+	esp_err_t ret;
+	
+	if (!profileP->set_radio) return;
+	
+	// Modem sleep only applies in client mode
+	if (mode == WIFI_MODE_STA) {
+		ret = esp_wifi_set_ps(profileP->ps_type);
+		if (ret != ESP_OK) ESP_LOGW(TAG, "Set power save mode returned %d", ret);
+	}
+	
+	ret = esp_wifi_set_max_tx_power(profileP->max_tx_power);
+	if (ret != ESP_OK) ESP_LOGW(TAG, "Set TX power returned %d", ret);
+}
+
+
+/**
+ * Update the connected flag.  We are connected while a station is using our AP or the
+ * client has an IP address.
+ */
+static void update_connected()
+{
+	if (ap_sta_joined || sta_connected) {
+		wifi_info.flags |= WIFI_INFO_FLAG_CONNECTED;
+	} else {
+		wifi_info.flags &= ~WIFI_INFO_FLAG_CONNECTED;
+	}
+}
+
+
 /**
  * Handle system events that we care about from the WiFi task
  */
@@ -379,14 +532,16 @@ static esp_err_t sys_event_handler(void *ctx, system_event_t* event)
 {
 	switch(event->event_id) {
 		case SYSTEM_EVENT_AP_STACONNECTED:
-			wifi_info.flags |= WIFI_INFO_FLAG_CONNECTED;
+			ap_sta_joined = true;
+			update_connected();
 			ESP_LOGI(TAG, "station:"MACSTR" join, AID=%d",
                  MAC2STR(event->event_info.sta_connected.mac),
                  event->event_info.sta_connected.aid);
 			break;
 		
 		case SYSTEM_EVENT_AP_STADISCONNECTED:
-			wifi_info.flags &= ~WIFI_INFO_FLAG_CONNECTED;
+			ap_sta_joined = false;
+			update_connected();
 			ESP_LOGI(TAG, "station:"MACSTR" leave, AID=%d",
                  MAC2STR(event->event_info.sta_disconnected.mac),
                  event->event_info.sta_disconnected.aid);
@@ -401,21 +556,43 @@ static esp_err_t sys_event_handler(void *ctx, system_event_t* event)
         case SYSTEM_EVENT_STA_STOP:
         	ESP_LOGI(TAG, "Station stopped");
         	break;
+        
+        case SYSTEM_EVENT_STA_CONNECTED:
+        	sta_directed_ok = sta_directed;
+        	save_ap_cache(event->event_info.connected.bssid, event->event_info.connected.channel);
+        	break;
         	
         case SYSTEM_EVENT_STA_GOT_IP:
-        	wifi_info.flags |= WIFI_INFO_FLAG_CONNECTED;
+        	sta_connected = true;
+        	update_connected();
         	uint32_t ip = event->event_info.got_ip.ip_info.ip.addr;
         	ESP_LOGI(TAG, "Connected. Got ip: %s", ip4addr_ntoa(&event->event_info.got_ip.ip_info.ip));
         	wifi_info.cur_ip_addr[3] = ip & 0xFF;
         	wifi_info.cur_ip_addr[2] = (ip >> 8) & 0xFF;
         	wifi_info.cur_ip_addr[1] = (ip >> 16) & 0xFF;
 			wifi_info.cur_ip_addr[0] = (ip >> 24) & 0xFF;
-			sta_connected = true;
         	sta_retry_num = 0;
+        	start_sntp();
         	break;
         	
         case SYSTEM_EVENT_STA_DISCONNECTED:
-        	wifi_info.flags &= ~WIFI_INFO_FLAG_CONNECTED;
+        	sta_connected = false;
+        	update_connected();
+        	stop_sntp();
+        	if ((wifi_info.flags & WIFI_INFO_FLAG_AP_STA_MODE) != 0) {
+        		// Still reachable through our AP
+        		memcpy(wifi_info.cur_ip_addr, wifi_info.ap_ip_addr, 4);
+        	}
+        	if (sta_directed && (event->event_info.disconnected.reason != WIFI_REASON_ASSOC_LEAVE)) {
+        		// Scan for the network on reconnection attempts in case the AP has changed
+        		// and forget the cached AP if we never got to it (our own disconnects when
+        		// restarting don't count)
+        		if (!sta_directed_ok) {
+        			ESP_LOGI(TAG, "Cached AP not found");
+        			clear_ap_cache();
+        		}
+        		(void) set_esp_wifi_client_config(false);
+        	}
         	if (sta_retry_num < WIFI_MAX_RECONNECT_ATTEMPTS) {
                 esp_wifi_connect();
                 sta_retry_num++;
@@ -431,3 +608,59 @@ static esp_err_t sys_event_handler(void *ctx, system_event_t* event)
 	
 	return ESP_OK;
 }
+
+
+/**
+ * Remember the AP we connected to in client mode for a directed connection next time
+ */
+static void save_ap_cache(const uint8_t* bssid, uint8_t channel)
+{
+	uint32_t bssid_hi, bssid_lo;
+	
+	bssid_hi = ((uint32_t) bssid[0] << 8) | bssid[1];
+	bssid_lo = ((uint32_t) bssid[2] << 24) | ((uint32_t) bssid[3] << 16) | ((uint32_t) bssid[4] << 8) | bssid[5];
+	
+	// Avoid NVS writes when reconnecting to the same AP
+	if ((ps_nvs_get_uint(PS_NVS_WIFI_AP_CHAN) != channel) ||
+	    (ps_nvs_get_uint(PS_NVS_WIFI_AP_BSSID_HI) != bssid_hi) ||
+	    (ps_nvs_get_uint(PS_NVS_WIFI_AP_BSSID_LO) != bssid_lo))
+	{
+		(void) ps_nvs_set_uint(PS_NVS_WIFI_AP_BSSID_HI, bssid_hi);
+		(void) ps_nvs_set_uint(PS_NVS_WIFI_AP_BSSID_LO, bssid_lo);
+		(void) ps_nvs_set_uint(PS_NVS_WIFI_AP_CHAN, channel);
+	}
+}
+
+
+static void clear_ap_cache()
+{
+	if (ps_nvs_get_uint(PS_NVS_WIFI_AP_CHAN) != 0) {
+		(void) ps_nvs_set_uint(PS_NVS_WIFI_AP_CHAN, 0);
+	}
+}
+
+
+/**
+ * Start getting the time from WIFI_SNTP_SERVER (client mode only).  lwip syncs
+ * immediately and then periodically.
+ */
+static void start_sntp()
+{
+	if (sntp_running) return;
+	
+	ESP_LOGI(TAG, "Starting SNTP with %s", WIFI_SNTP_SERVER);
+	sntp_setoperatingmode(SNTP_OPMODE_POLL);
+	sntp_setservername(0, (char*) WIFI_SNTP_SERVER);
+	sntp_set_time_sync_notification_cb(time_sntp_sync);
+	sntp_init();
+	sntp_running = true;
+}
+
+
+static void stop_sntp()
+{
+	if (!sntp_running) return;
+	
+	sntp_stop();
+	sntp_running = false;
+}
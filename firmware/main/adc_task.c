@@ -24,12 +24,17 @@
  */
 #include "adc_task.h"
 #include "app_task.h"
+#include "gui_task.h"
 #include "adc_utilities.h"
+#include "metadata_utilities.h"
+#include "perf_utilities.h"
 #include "sys_utilities.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "driver/gpio.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -45,6 +50,30 @@ static const char* TAG = "adc_task";
 // while power button is pressed
 static int poweroff_count;
 
+// Previous power button state to detect a new press (assumed pressed from startup)
+static bool prev_btn_pressed = true;
+
+// When the task statistics are next sampled
+static int64_t perf_sample_usec;
+
+#ifdef ADC_INT_IO
+// Fast samples remaining after an alert
+static int alert_sample_count = ADC_TASK_ALERT_SAMPLES;
+#endif
+
+// Values last loaded into the image metadata snapshot
+static batt_status_t prev_batt_status;
+static float prev_temp;
+
+
+
+//
+// ADC Task Forward Declarations for internal functions
+//
+#ifdef ADC_INT_IO
+static void IRAM_ATTR adc_task_alert_isr(void* arg);
+#endif
+
 
 
 //
@@ -54,21 +83,59 @@ void adc_task()
 {
 	batt_status_t batt_status;
 	bool btn_pressed;
+	float temp;
 	uint32_t notification_value;
+#ifdef ADC_INT_IO
+	uint32_t alert_value;
+	int sample_msec;
+#endif
 
 	ESP_LOGI(TAG, "Start task");
 	
 	poweroff_count = ADC_TASK_PWROFF_PRESS_MSEC / ADC_TASK_SAMPLE_MSEC;
+	perf_sample_usec = esp_timer_get_time() + PERF_TASK_SAMPLE_MSEC * 1000;
+	
+#ifdef ADC_INT_IO
+	// The ADC alerts us to a button press or critical battery
+	gpio_set_direction(ADC_INT_IO, GPIO_MODE_INPUT);
+	gpio_set_intr_type(ADC_INT_IO, GPIO_INTR_NEGEDGE);
+	gpio_isr_handler_add(ADC_INT_IO, adc_task_alert_isr, NULL);
+#endif
 	
 	while (1) {
+#ifdef ADC_INT_IO
+		// This task runs every ADC_TASK_SLOW_SAMPLE_MSEC mSec until an alert and then
+		// every ADC_TASK_SAMPLE_MSEC mSec until the button has been released for a while
+		sample_msec = (alert_sample_count > 0) ? ADC_TASK_SAMPLE_MSEC : ADC_TASK_SLOW_SAMPLE_MSEC;
+		if (xTaskNotifyWait(0x00, 0xFFFFFFFF, &alert_value, pdMS_TO_TICKS(sample_msec))) {
+			if (Notification(alert_value, ADC_NOTIFY_ALERT_MASK)) {
+				alert_sample_count = ADC_TASK_ALERT_SAMPLES;
+			}
+		}
+		if (alert_sample_count > 0) alert_sample_count--;
+#else
 		// This task runs every ADC_TASK_SAMPLE_MSEC mSec
 		vTaskDelay(pdMS_TO_TICKS(ADC_TASK_SAMPLE_MSEC));
+#endif
 		
 		// Update ADC values and get values we're interested in
 		adc_update();
 		adc_get_batt(&batt_status);
+		temp = adc_get_temp();
 		btn_pressed = adc_button_pressed();
 		
+		// Update the image metadata snapshot with changed values
+		if ((batt_status.batt_voltage != prev_batt_status.batt_voltage) ||
+		    (batt_status.charge_state != prev_batt_status.charge_state))
+		{
+			metadata_set_batt(&batt_status);
+			prev_batt_status = batt_status;
+		}
+		if (temp != prev_temp) {
+			metadata_set_lens_temp(temp);
+			prev_temp = temp;
+		}
+		
 		// Determine if we have conditions to send a power-down notification to app_task
 		notification_value = 0;
 		
@@ -77,7 +144,19 @@ void adc_task()
 			notification_value = APP_NOTIFY_SHUTDOWN_MASK;
 		}
 		
+#ifdef INCLUDE_SYS_GUI
+		if (btn_pressed && !prev_btn_pressed) {
+			// Any press wakes the display
+			xTaskNotify(task_handle_gui, GUI_NOTIFY_WAKE_MASK, eSetBits);
+		}
+#endif
+		prev_btn_pressed = btn_pressed;
+		
 		if (btn_pressed) {
+#ifdef ADC_INT_IO
+			// Keep timing the press at the normal rate
+			alert_sample_count = ADC_TASK_ALERT_SAMPLES;
+#endif
 			if (--poweroff_count == 0) {
 				notification_value = APP_NOTIFY_SHUTDOWN_MASK;
 				poweroff_count = ADC_TASK_PWROFF_PRESS_MSEC / ADC_TASK_SAMPLE_MSEC;
@@ -91,5 +170,28 @@ void adc_task()
 			// Notify app_task
 			xTaskNotify(task_handle_app, notification_value, eSetBits);
 		}
+		
+		// Periodically update the task statistics for get_status
+		if (esp_timer_get_time() >= perf_sample_usec) {
+			perf_sample_tasks();
+			perf_sample_usec += PERF_TASK_SAMPLE_MSEC * 1000;
+		}
+	}
+}
+
+
+
+//
+// ADC Task internal functions
+//
+#ifdef ADC_INT_IO
+static void IRAM_ATTR adc_task_alert_isr(void* arg)
+{
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+	
+	xTaskNotifyFromISR(task_handle_adc, ADC_NOTIFY_ALERT_MASK, eSetBits, &xHigherPriorityTaskWoken);
+	if (xHigherPriorityTaskWoken == pdTRUE) {
+		portYIELD_FROM_ISR();
 	}
 }
+#endif
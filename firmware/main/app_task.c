@@ -22,19 +22,30 @@
  *
  */
 #include "app_task.h"
+#include "bench_task.h"
 #include "cam_task.h"
 #include "cmd_task.h"
 #include "file_task.h"
 #include "gui_task.h"
+#include "http_task.h"
 #include "lep_task.h"
+#include "sync_task.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "esp_attr.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "file_utilities.h"
 #include "gui_utilities.h"
 #include "json_utilities.h"
+#include "lepton_alarm.h"
+#include "lepton_motion.h"
+#include "lepton_stats.h"
+#include "metadata_utilities.h"
+#include "perf_utilities.h"
 #include "ps_utilities.h"
+#include "schedule_utilities.h"
 #include "sys_utilities.h"
 #include "time_utilities.h"
 #include "system_config.h"
@@ -49,15 +60,53 @@
 // App Task private constants
 //
 
-#define APP_EVAL_MSEC 50
-
 // Maximum wait period within a one second window to see both images before processing
-// whatever we have.  Should be divisible by APP_EVAL_MSEC.
+// whatever we have.
 #define APP_MAX_WAIT_MSEC 800
 
+// Oldest latest image sent to cmd_task for a request that doesn't need a new image.
+// Older images (e.g. a Lepton frame from before lep_task went into standby) aren't used
+// and the request waits for the next second's images.
+#define APP_CMD_CACHE_MAX_MSEC 2000
+
+// Comment out to request the ArduCAM image at the top of the second instead of arming the
+// capture so the image is ready when the second starts (see cam_task_get_image_lead_msec)
+#ifdef INCLUDE_SYS_ARDUCAM
+#define APP_CAM_PREARM
+#endif
+
+// Comment out to start the ArduCAM capture directly instead of having lep_task start it
+// when it publishes a frame, and use that frame, so each second's pair of images are
+// captured together (see LEP_NOTIFY_SYNC_CAM_MASK)
+#ifdef INCLUDE_SYS_ARDUCAM
+#define APP_CAM_LEP_SYNC
+#endif
+
 // Uncomment to trace image timing
 //#define APP_DEBUG_IMG
 
+// Frame consumers, each with a delivery policy in app_consumer_policy
+#define APP_CONSUMER_GUI  0
+#define APP_CONSUMER_HTTP 1
+#define APP_CONSUMER_FILE 2
+#define APP_CONSUMER_CMD  3
+#define APP_NUM_CONSUMERS 4
+
+// Consumer priorities.  A consumer is decimated further while the load level is above its
+// priority so the lowest priority consumers give up images first.  APP_PRIO_HIGH consumers
+// are never decimated for load.
+#define APP_PRIO_LOW    0
+#define APP_PRIO_NORMAL 1
+#define APP_PRIO_HIGH   2
+
+// Load levels, rated once per period
+#define APP_LOAD_NONE   0
+#define APP_LOAD_LIGHT  1    // The GUI or http_task skipped images during the last period
+#define APP_LOAD_HEAVY  2    // Images for file_task or cmd_task were dropped
+
+// Quiet periods before the load level drops by one
+#define APP_LOAD_DECAY_PERIODS 5
+
 
 enum app_state_t {
 	WAIT_TOS,
@@ -71,6 +120,23 @@ enum app_image_request_state_t {
 	FAILED
 };
 
+// Per-consumer delivery policy.  The image format each consumer gets is set at run time
+// (recording format, cmd_task request) and each format is still only generated once for
+// all consumers of a set of images.
+typedef struct {
+	uint8_t cameras;                   // IMG_CONTENT_CAM and/or IMG_CONTENT_LEP images it is given
+	uint8_t priority;                  // APP_PRIO_*
+	uint8_t decimate;                  // Deliver every Nth image
+	uint8_t load_decimate;             // Additional decimation while loaded above priority
+} app_consumer_policy_t;
+
+// Images kept for alarm recording
+typedef struct {
+	cam_buffer_t* camP;
+	lep_buffer_t* lepP;
+	bool write;                        // Part of an alarm event and should be recorded
+} app_ring_entry_t;
+
 
 
 //
@@ -78,35 +144,158 @@ enum app_image_request_state_t {
 //
 static const char* TAG = "app_task";
 
+static const app_consumer_policy_t app_consumer_policy[APP_NUM_CONSUMERS] = {
+#ifdef INCLUDE_SYS_GUI
+	{IMG_CONTENT_CAM | IMG_CONTENT_LEP, APP_PRIO_NORMAL, 1, 2},  // GUI
+#else
+	{0,                                 APP_PRIO_NORMAL, 1, 2},  // No GUI in this profile
+#endif
+	{IMG_CONTENT_CAM,                   APP_PRIO_LOW,    1, 4},  // http_task MJPEG stream
+	{IMG_CONTENT_CAM | IMG_CONTENT_LEP, APP_PRIO_HIGH,   1, 1},  // file_task recording
+	{IMG_CONTENT_CAM | IMG_CONTENT_LEP, APP_PRIO_HIGH,   1, 1}   // cmd_task image requests
+};
+
 static enum app_state_t app_state = IDLE;
 static time_t app_prev_time;  // Used to detect second intervals
 
 static enum app_image_request_state_t cam_image_request_state = IDLE;
 static enum app_image_request_state_t lep_image_request_state = IDLE;
+#ifdef INCLUDE_SYS_ARDUCAM
+static bool cam_armed = false;         // ArduCAM image requested ahead of the next second
+#endif
+static bool app_lep_standby = false;   // lep_task isn't reading frames between recorded images
+static int64_t cam_received_usec;      // When the requested images arrived
+static int64_t lep_received_usec;
+
+// Image pipeline accounting - counted here and published once per period for other tasks
+static app_frame_stats_t app_frame_stats;
+static app_frame_stats_t app_frame_stats_pub;
+static portMUX_TYPE app_frame_stats_mux = portMUX_INITIALIZER_UNLOCKED;
 
 static bool cam_gui_update_pending = false;
 static bool lep_gui_update_pending = false;
+static bool cam_http_update_pending = false;
+
+// Consumer decimation counts for each camera ([0] = ArduCAM, [1] = Lepton) and load rating
+static uint8_t app_consumer_cnt[APP_NUM_CONSUMERS][2];
+static int app_load_level = APP_LOAD_NONE;
+static int app_load_quiet_cnt = 0;
+static uint32_t app_http_skipped = 0;  // Images not streamed because http_task was still busy
+static uint32_t app_load_prev_skipped = 0;
+static uint32_t app_load_prev_lost = 0;
 
 static bool sdcard_present = false;    // Can't start recording unless a card is present
+static bool app_rec_restart_pending = false; // Restart recording when the card is found
 static bool app_recording = false;
-static bool file_image_send_pending = false;
 static bool app_rec_arducam_en;
 static bool app_rec_lepton_en;
 static uint16_t app_rec_seq_num = 0;
 static uint16_t app_rec_interval;      // Seconds between images when recording
 static uint16_t app_rec_interval_cnt;  // Counts interval up to app_rec_interval to trigger picture
+static uint8_t app_rec_format;         // REC_FORMAT_JSON, REC_FORMAT_BINARY, REC_FORMAT_BINARY_Z or REC_FORMAT_AVI
+static bool app_rec_meta_log;          // Seconds without images go to the session metadata log
+static bool app_rec_alarm_en;          // Only record alarm events
+static bool app_rec_motion_en;         // Record every second while the scene is changing
+static bool app_rec_sleep_en;          // Deep sleep between images at long intervals
+static int64_t app_motion_end_usec = 0; // When motion recording ends
+
+// Recording schedule.  The interval, camera enables and sleep above come from the active
+// schedule window or, outside all windows, the configured settings.
+static int app_sched_window = -1;      // Active window, -1 for none
+static uint32_t app_sched_version;     // Schedule table version it was found in
+
+// Duty-cycled recording.  The time the next image is due is kept in the ESP32 RTC memory
+// through the deep sleep (the session itself is resumed from its journal in the DS3232).
+RTC_DATA_ATTR static time_t app_sleep_img_time;
+static bool app_sleep_cycle_done = false; // Set if a sleep wake can't resume recording
+
+// Alarm recording pre-trigger ring.  While recording with an alarm enabled each second's
+// images go here instead of being recorded.  Images from the start of an alarm event
+// (including the pre-trigger images) are marked to be written and recorded from the
+// oldest as file_task has room for them.
+static bool app_alarm_active = false;
+static int app_ring_head = 0;
+static int app_ring_count = 0;
+static app_ring_entry_t app_ring[APP_ALARM_PRE_IMAGES];
+
+#ifdef INCLUDE_SYS_ARDUCAM
+// ArduCAM images taken from cam_task's pre-trigger ring when an alarm triggered.  They
+// are recorded in time order with the alarm ring's images.  cam_task's ring is only
+// enabled again once they have all been recorded so the two never hold more than
+// CAM_RING_LEN buffers.
+static bool app_cam_ring_en = false;
+static int app_cam_pre_head = 0;
+static int app_cam_pre_count = 0;
+static cam_buffer_t* app_cam_pre[CAM_RING_LEN];
+#endif
 
 static bool cmd_requesting_image = false;
+static bool cmd_req_json;              // cmd_task wants a json image
+static bool cmd_req_binary;            // cmd_task wants the raw image buffers
+static bool cmd_req_cached;            // cmd_task can use the latest images
+static uint8_t cmd_req_contents;       // IMG_CONTENT_* items for the json image
 static bool cmd_image_send_pending = false;
+static bool cmd_image_held_json;       // cmd_task is using sys_image_buffer
+static bool cmd_image_held_binary;     // cmd_task is using sys_cmd_*_bufferP
+
+// Request parameters from cmd_task (loaded by app_task_request_cmd_image)
+static bool cmd_next_req_json;
+static bool cmd_next_req_binary;
+static uint8_t cmd_next_req_contents;
+static bool cmd_next_req_cached;
+
+#ifdef INCLUDE_SYS_BENCH
+static bool app_bench_requested = false; // bench_task is waiting for a set of images
+#endif
+
+// Images captured during a previous second waiting to be processed.  app_task holds
+// references to them so the cameras can capture the next images in the meantime.
+static bool app_proc_pending = false;
+static bool app_proc_cached = false;   // The latest images queued only for cmd_task
+static cam_buffer_t* app_cam_procP = NULL;
+static lep_buffer_t* app_lep_procP = NULL;
 
 
 //
 // App Task Forward Declarations for internal functions
 //
-static void app_task_handle_notifications();
+static void app_task_handle_notifications(uint32_t notification_value);
+static void app_task_handle_cam_event(const sys_frame_event_t* evP);
+static void app_task_handle_lep_event(const sys_frame_event_t* evP);
+static void app_task_eval_alarm();
+static void app_task_eval_motion();
+static TickType_t app_task_ticks_to_next_event(int64_t tos_usec);
+static void app_task_arm_cam();
+#ifdef APP_CAM_PREARM
+static int app_task_get_cam_lead_msec();
+#endif
+#ifdef INCLUDE_SYS_ARDUCAM
+static void app_task_request_cam();
+#endif
+static void app_task_eval_lep_standby();
+static void app_task_eval_schedule(bool force);
+static void app_task_record_touch_latency();
 static void app_task_start_recording(bool from_gui);
 static void app_task_stop_recording(bool en_restart);
-static void app_process_images(bool valid_cam, bool valid_lep);
+static void app_task_end_recording(bool suspend);
+static bool app_task_sleep_enabled();
+static void app_task_eval_sleep();
+static void app_task_update_frame_stats(int64_t tos_usec, bool valid_cam, bool valid_lep);
+static void app_task_update_load();
+static bool app_task_consumer_wants(int consumer, uint8_t camera);
+static void app_task_queue_images(bool valid_cam, bool valid_lep);
+static void app_task_queue_cached_images();
+static void app_task_process_pending();
+static void app_task_release_pending();
+static void app_task_push_ring(bool valid_cam, bool valid_lep);
+static void app_task_process_ring();
+static void app_task_release_ring();
+#ifdef INCLUDE_SYS_ARDUCAM
+static int64_t app_task_ring_entry_usec(app_ring_entry_t* entryP);
+static void app_task_update_cam_ring();
+#endif
+static void app_process_images(cam_buffer_t* camP, lep_buffer_t* lepP, bool rec_en, bool cmd_en);
+static void app_task_update_lep_mode();
 
 
 //
@@ -115,55 +304,83 @@ static void app_process_images(bool valid_cam, bool valid_lep);
 
 void app_task()
 {
-	int msec_count = 0;
+	int64_t tos_usec = 0;
+	uint32_t notification_value;
 	
 	ESP_LOGI(TAG, "Start task");
 	
 	// Let other tasks start running first
 	vTaskDelay(pdMS_TO_TICKS(100));
 	
+	// Get notified at the top of each second
+	if (!time_start_tick(task_handle_app, APP_NOTIFY_TOS_MASK)) {
+		ESP_LOGE(TAG, "Could not start the second tick");
+	}
+	
 	// Get initial recording values
-	app_rec_arducam_en = gui_st.rec_arducam_enable;
-	app_rec_lepton_en = gui_st.rec_lepton_enable;
-	app_rec_interval = gui_st.record_interval;
+	app_task_eval_schedule(true);
 	app_rec_interval_cnt = 0;
+	app_rec_format = gui_st.record_format;
+	app_rec_meta_log = gui_st.record_meta_log;
+	app_rec_alarm_en = (gui_st.alarm_mode != SYS_ALARM_OFF);
+	app_rec_motion_en = gui_st.record_motion;
 	
-	// If we were recording when we last powered down (e.g. crashed and rebooted) then
-	// notify ourselves to start recording again immediately.
+	// If we were recording when we last powered down (e.g. crashed and rebooted or slept
+	// between duty-cycled images) then start recording again as soon as file_task has
+	// found the card.
 	if (ps_get_rec_enable()) {
 		ESP_LOGI(TAG, "Restarting recording on powerup");
-		xTaskNotify(task_handle_app, APP_NOTIFY_START_RECORD_MASK, eSetBits);
+		app_rec_restart_pending = true;
 	}
 	
 	// app_task distributes activities over a one second interval in order to spread 
-	// time-consuming activities out over time.  It evaluates on APP_EVAL_MSEC intervals.
+	// time-consuming activities out over time.  It blocks waiting for notifications from
+	// other tasks with a timeout set by the next scheduled event (top of second or end
+	// of the image wait period).  The top of second is also notified by a timer aligned
+	// to the system time so it is seen without waiting for the next tick.
 	// While recording it prioritizes getting a file written every second, even if there
 	// is not an image from one of the cameras (e.g. the lepton is performing a FFC and
 	// has stalled its VoSPI pipeline).  Because of this image files may contain 2, 1 or
 	// 0 images but they always have some metadata.
 	//
-	//   1. At the beginning of each second it requests the cameras get an image
-	//      a. It will not request an image if the GUI is still displaying previous
-	//         images since it shares the image buffer with the GUI.  The GUI should
-	//         normally never fail to process previous images before the start of a new
-	//         second.
-	//   2. Up to APP_MAX_WAIT_MSEC mSec it checks to see if has received both images.
-	//      If it has:
-	//      a. It generates a json text file with metadata and available images.
-	//      b. It writes the file if it is recording and a file operation is not already
-	//         pending.
+	//   1. At the beginning of each second it requests the cameras get an image.  The
+	//      ArduCAM image is requested just before the second (APP_CAM_PREARM) so it is
+	//      ready at the top of the second.  lep_task starts its capture with the Lepton
+	//      frame it then hands us (APP_CAM_LEP_SYNC) so the images are time-aligned.  The GUI renders from its own reference to the
+	//      previous images so a slow display update never stalls capture (it just skips
+	//      displaying an image).
+	//   2. As soon as it has received both images, or at APP_MAX_WAIT_MSEC mSec with
+	//      whatever images it has received, it takes references to them and queues them
+	//      for processing.  The cameras are then free to capture the next images.
+	//   3. It processes queued images as soon as their consumers are ready:
+	//      a. It generates a json text file with metadata and available images if
+	//         recording json files or there is a pending image request.
+	//      b. It writes the file if it is recording (binary image records are written
+	//         by file_task directly from the image buffers).  If file_task is still writing the
+	//         previous file the images wait, while the next capture proceeds, until
+	//         it is done.
 	//      c. It initiates an image response using the file data through the cmd_task if
 	//         there is a pending request for one.
-	//   3. At APP_MAX_WAIT_MSEC mSec it generates a json text file with metadata and any
-	//      image it has received and writes the file if recording if possible and initiates
-	//      an image response if one is pending.
+	//      If a new set of images is queued before the previous set could be processed
+	//      the older set is dropped.
 	//   4. It initiates image updates in the GUI as they are received from the camera
 	//      tasks.
 	//   5. It handles other notifications as they are received.
+//
+// When recording with an alarm enabled images are only recorded during alarm events.
+// Each second's images are kept in a short ring instead of being queued and the images
+// from the start of an event, including those from the seconds before it was triggered,
+// are recorded.  When recording with record_motion set images are recorded every second,
+// instead of every recording interval, while the scene is changing.  When recording with
+// record_sleep set at long intervals the system deep sleeps after each image is written
+// and resumes the session when it wakes for the next one.
 	//
 	while (1) {
-		// Look for notifications to act on
-		app_task_handle_notifications();
+		// Wait for notifications to act on or our next scheduled event
+		notification_value = 0;
+		if (xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, app_task_ticks_to_next_event(tos_usec))) {
+			app_task_handle_notifications(notification_value);
+		}
 		
 		switch (app_state) {
 			case WAIT_TOS:
@@ -172,21 +389,28 @@ void app_task()
 #ifdef APP_DEBUG_IMG
 					ESP_LOGI(TAG, "TOS");
 #endif
-					msec_count = 0;
+					tos_usec = esp_timer_get_time();
 					app_state = WAIT_IMAGE;
+					
+					// Switch recording parameters when the active schedule window changes
+					app_task_eval_schedule(false);
 	
-					if (!cam_gui_update_pending) {
-						// Request cam_task update the shared buffer with a new image when available
-						xTaskNotify(task_handle_cam, CAM_NOTIFY_GET_FRAME_MASK, eSetBits);
+#ifdef INCLUDE_SYS_ARDUCAM
+					// Request cam_task update the shared buffer with a new image when available
+					// unless the image was already requested ahead of time (and didn't fail)
+					if (!cam_armed || (cam_image_request_state == FAILED)) {
+						app_task_request_cam();
 						cam_image_request_state = REQUESTED;
 #ifdef APP_DEBUG_IMG
 						ESP_LOGI(TAG, "  Req Cam");
 #endif
-					} else {
-						cam_image_request_state = IDLE;
 					}
-					if (!lep_gui_update_pending) {
-						// Request lep_task update the shared buffer with a new image when available
+					cam_armed = false;
+#endif
+					// Request lep_task update the shared buffer with a new image when available
+					// unless it is in standby until shortly before the next recorded image
+					app_task_eval_lep_standby();
+					if (!app_lep_standby) {
 						xTaskNotify(task_handle_lep, LEP_NOTIFY_GET_FRAME_MASK, eSetBits);
 						lep_image_request_state = REQUESTED;
 #ifdef APP_DEBUG_IMG
@@ -195,37 +419,46 @@ void app_task()
 					} else {
 						lep_image_request_state = IDLE;
 					}
+				} else {
+					app_task_arm_cam();
 				}
 				break;
 			
 			case WAIT_IMAGE:
-				if ((cam_image_request_state == RECEIVED) && (lep_image_request_state == RECEIVED)) {
-				    // Handle demand for the images as soon as possible, prioritizing recording
-					if ((!file_image_send_pending && app_recording) ||
-						(!app_recording && !cmd_image_send_pending && cmd_requesting_image)) {
-
-						app_process_images(true, true);
-#ifdef APP_DEBUG_IMG
-						ESP_LOGI(TAG, "Process image early");
-#endif
-					}
+				if (((cam_image_request_state == RECEIVED) || (cam_image_request_state == IDLE)) &&
+				    ((lep_image_request_state == RECEIVED) || (lep_image_request_state == IDLE)))
+				{
+					// Normal case: hand off both images as soon as they arrive (the ArduCAM
+					// image is never requested in profiles without it)
+					app_task_update_frame_stats(tos_usec, (cam_image_request_state == RECEIVED), true);
+					app_task_queue_images((cam_image_request_state == RECEIVED), true);
 					app_state = WAIT_TOS;
-				} else if (msec_count >= APP_MAX_WAIT_MSEC) {
+				} else if ((esp_timer_get_time() - tos_usec) >= (APP_MAX_WAIT_MSEC * 1000)) {
 					// At the end of the period, handle whatever we have
-					if (app_recording || cmd_requesting_image) {
-						app_process_images((cam_image_request_state == RECEIVED),
-						                   (lep_image_request_state == RECEIVED));
+					app_task_update_frame_stats(tos_usec, (cam_image_request_state == RECEIVED),
+					                            (lep_image_request_state == RECEIVED));
+					app_task_queue_images((cam_image_request_state == RECEIVED),
+					                      (lep_image_request_state == RECEIVED));
 #ifdef APP_DEBUG_IMG
-						ESP_LOGI(TAG, "Process image: cam = %d, lep = %d", cam_image_request_state == RECEIVED, lep_image_request_state == RECEIVED);
+					ESP_LOGI(TAG, "Late images: cam = %d, lep = %d", cam_image_request_state == RECEIVED, lep_image_request_state == RECEIVED);
 #endif
-					}
 					app_state = WAIT_TOS;
 				}
 				break;
 		}
-	
-		vTaskDelay(pdMS_TO_TICKS(APP_EVAL_MSEC));
-		msec_count += APP_EVAL_MSEC;
+		
+		// Process queued images if their consumers have become ready
+		app_task_process_pending();
+		app_task_process_ring();
+#ifdef INCLUDE_SYS_ARDUCAM
+		app_task_update_cam_ring();
+#endif
+		
+		// Write settled configuration changes to persistent storage
+		ps_flush_check();
+		
+		// Keep the system time locked to the RTC
+		time_discipline();
 	}
 }
 
@@ -239,6 +472,42 @@ bool app_task_get_recording()
 }
 
 
+/**
+ * Return true while awake from a duty-cycled recording sleep to record the next image
+ */
+bool app_task_get_sleep_cycle()
+{
+	return system_get_sleep_wake() && ps_get_rec_enable() && !app_sleep_cycle_done;
+}
+
+
+/**
+ * Called by cmd_task to request the next processed image for its clients.  It may ask
+ * for a json image with the IMG_CONTENT_* items in json_contents, the raw image buffers
+ * or both.  When cached is set the latest images are processed immediately instead of
+ * waiting for the next second's images.
+ */
+void app_task_request_cmd_image(bool json, bool binary, uint8_t json_contents, bool cached)
+{
+	cmd_next_req_json = json;
+	cmd_next_req_binary = binary;
+	cmd_next_req_contents = json_contents;
+	cmd_next_req_cached = cached;
+	xTaskNotify(task_handle_app, APP_NOTIFY_CMD_REQ_MASK, eSetBits);
+}
+
+
+/**
+ * Get the image pipeline accounting as of the last image period
+ */
+void app_task_get_frame_stats(app_frame_stats_t* statsP)
+{
+	portENTER_CRITICAL(&app_frame_stats_mux);
+	*statsP = app_frame_stats_pub;
+	portEXIT_CRITICAL(&app_frame_stats_mux);
+}
+
+
 
 //
 // App Task internal functions
@@ -247,183 +516,578 @@ bool app_task_get_recording()
 /**
  * Process notifications from other tasks
  */
-static void app_task_handle_notifications()
+static void app_task_handle_notifications(uint32_t notification_value)
 {
-	uint32_t notification_value;
+	int32_t sec;
+	time_t now;
+	sys_frame_event_t ev;
 	
-	notification_value = 0;
-	if (xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, 0)) {
-		//
-		// SHUTDOWN
-		//
-		if (Notification(notification_value, APP_NOTIFY_SHUTDOWN_MASK)) {
-			// Stop recording if it is in process
-			if (app_recording) {
-				app_task_stop_recording(false);
-			}
-			
-			// Notify the gui_task to display the shutdown screen.  Wait a short bit
-			// to give it a chance to be displayed and then shut off our power. This will
-			// turn off the LCD backlight.  Note that the user may still be holding the
-			// power button and keeping us alive so just spin in a loop after that waiting
-			// for power to go away.
-			xTaskNotify(task_handle_gui, GUI_NOTIFY_SHUTDOWN_MASK, eSetBits);
-			vTaskDelay(pdMS_TO_TICKS(1500));
-			system_shutoff();
-			while (1) {
-				vTaskDelay(pdMS_TO_TICKS(1000));
-			}
-		}
-		
-		//
-		// ARDUCAM
-		//
-		if (Notification(notification_value, APP_NOTIFY_CAM_FRAME_MASK)) {
-			// cam_task has updated the shared buffer with a new image
-			cam_image_request_state = RECEIVED;
-			if (!cam_gui_update_pending) {
-				// Notify the GUI to update
-				xTaskNotify(task_handle_gui, GUI_NOTIFY_CAM_FRAME_MASK, eSetBits);
-				cam_gui_update_pending = true;
-#ifdef APP_DEBUG_IMG
-				ESP_LOGI(TAG, "Got cam image");
-#endif
-			}
-		}
+	//
+	// SHUTDOWN
+	//
+	if (Notification(notification_value, APP_NOTIFY_SHUTDOWN_MASK)) {
+		app_task_record_touch_latency();
 		
-		if (Notification(notification_value, APP_NOTIFY_CAM_FAIL_MASK)) {
-			// cam_task failed to get an image and update the shared buffer
-			cam_image_request_state = FAILED;
-		}
-			
-		if (Notification(notification_value, APP_NOTIFY_GUI_CAM_DONE_MASK)) {
-			// GUI has consumed the shared buffer
-			cam_gui_update_pending = false;
+		// Stop recording if it is in process
+		if (app_recording) {
+			app_task_stop_recording(false);
 		}
 		
-		//
-		// LEPTON
-		//	
-		if (Notification(notification_value, APP_NOTIFY_LEP_FRAME_MASK)) {
-			// lep_task has updated the shared buffer with a new image
-			lep_image_request_state = RECEIVED;
-			if (!lep_gui_update_pending) {
-				// Notify the GUI to update
-				xTaskNotify(task_handle_gui, GUI_NOTIFY_LEP_FRAME_MASK, eSetBits);
-				lep_gui_update_pending = true;
-#ifdef APP_DEBUG_IMG
-				ESP_LOGI(TAG, "Got lep image");
+		// Notify the gui_task to display the shutdown screen.  Wait a short bit
+		// to give it a chance to be displayed and then shut off our power. This will
+		// turn off the LCD backlight.  Note that the user may still be holding the
+		// power button and keeping us alive so just spin in a loop after that waiting
+		// for power to go away.
+#ifdef INCLUDE_SYS_GUI
+		xTaskNotify(task_handle_gui, GUI_NOTIFY_SHUTDOWN_MASK, eSetBits);
 #endif
-			}
+		vTaskDelay(pdMS_TO_TICKS(1500));
+		system_shutoff();
+		while (1) {
+			vTaskDelay(pdMS_TO_TICKS(1000));
 		}
-		
-		if (Notification(notification_value, APP_NOTIFY_LEP_FAIL_MASK)) {
-			// lep_task failed to get an image and update the shared buffer
-			lep_image_request_state = FAILED;
+	}
+	
+	//
+	// RESTART
+	//
+	if (Notification(notification_value, APP_NOTIFY_RESTART_MASK)) {
+		// Restart into a new firmware image.  A recording session is suspended so it
+		// resumes after the restart.
+		ESP_LOGI(TAG, "Restarting into new firmware");
+		if (app_recording) {
+			app_task_end_recording(true);
 		}
 		
-		if (Notification(notification_value, APP_NOTIFY_GUI_LEP_DONE_MASK)) {
-			// GUI has consumed the shared buffer
-			lep_gui_update_pending = false;
+		// Give file_task time to suspend the session
+		vTaskDelay(pdMS_TO_TICKS(500));
+		(void) ps_flush();
+		esp_restart();
+	}
+	
+	//
+	// ARDUCAM
+	//
+	if (Notification(notification_value, APP_NOTIFY_CAM_FRAME_MASK)) {
+		// Handle every image (or failure) cam_task has handed us, in order
+		while (system_frame_event_get(SYS_FRAME_STREAM_CAM, &ev)) {
+			app_task_handle_cam_event(&ev);
 		}
-		
-		//
-		// RECORD BUTTON CONTROL
-		//
-		if (Notification(notification_value, APP_NOTIFY_RECORD_BTN_MASK)) {
-			// Set recording state
-			if (app_recording) {
-				app_task_stop_recording(false);
-			} else {
-				app_task_start_recording(true);
-			}
+	}
+	
+	if (Notification(notification_value, APP_NOTIFY_GUI_CAM_DONE_MASK)) {
+		// GUI has consumed its buffer
+		system_cam_buffer_release(sys_cam_gui_bufferP);
+		sys_cam_gui_bufferP = NULL;
+		cam_gui_update_pending = false;
+	}
+	
+	if (Notification(notification_value, APP_NOTIFY_HTTP_DONE_MASK)) {
+		// http_task has sent its image to all its viewers
+		system_cam_buffer_release(sys_http_cam_bufferP);
+		sys_http_cam_bufferP = NULL;
+		cam_http_update_pending = false;
+	}
+	
+	//
+	// LEPTON
+	//	
+	if (Notification(notification_value, APP_NOTIFY_LEP_FRAME_MASK)) {
+		// Handle every frame (or failure) lep_task has handed us, in order
+		while (system_frame_event_get(SYS_FRAME_STREAM_LEP, &ev)) {
+			app_task_handle_lep_event(&ev);
 		}
+	}
+	
+	if (Notification(notification_value, APP_NOTIFY_GUI_LEP_DONE_MASK)) {
+		// GUI has consumed its buffer
+		system_lep_frame_release(sys_lep_gui_bufferP);
+		sys_lep_gui_bufferP = NULL;
+		lep_gui_update_pending = false;
+	}
+	
+	//
+	// RECORD BUTTON CONTROL
+	//
+	if (Notification(notification_value, APP_NOTIFY_RECORD_BTN_MASK)) {
+		app_task_record_touch_latency();
 		
-		//
-		// RECORDING PARAMETERS
-		//
-		if (Notification(notification_value, APP_NOTIFY_RECORD_PARM_UPD_MASK)) {
-			app_rec_arducam_en = gui_st.rec_arducam_enable;
-			app_rec_lepton_en = gui_st.rec_lepton_enable;
-			app_rec_interval = gui_st.record_interval;
+		// Set recording state
+		if (app_recording) {
+			app_task_stop_recording(false);
+		} else {
+			app_task_start_recording(true);
 		}
-		
-		//
-		// FILE OPERATIONS
-		//
-		if (Notification(notification_value, APP_NOTIFY_SDCARD_PRESENT_MASK)) {
-			sdcard_present = true;
+	}
+	
+	//
+	// RECORDING PARAMETERS
+	//
+	if (Notification(notification_value, APP_NOTIFY_RECORD_PARM_UPD_MASK)) {
+		app_task_eval_schedule(true);
+		app_rec_format = gui_st.record_format;
+		app_rec_meta_log = gui_st.record_meta_log;
+		if (app_rec_alarm_en && (gui_st.alarm_mode == SYS_ALARM_OFF)) {
+			app_task_release_ring();
 		}
-		
-		if (Notification(notification_value, APP_NOTIFY_SDCARD_MISSING_MASK)) {
-			sdcard_present = false;
+		app_rec_alarm_en = (gui_st.alarm_mode != SYS_ALARM_OFF);
+		app_rec_motion_en = gui_st.record_motion;
+		lepton_motion_reset();
+		app_task_update_lep_mode();
+	}
+	
+	//
+	// FILE OPERATIONS
+	//
+	if (Notification(notification_value, APP_NOTIFY_SDCARD_PRESENT_MASK)) {
+		sdcard_present = true;
+		if (app_rec_restart_pending) {
+			app_rec_restart_pending = false;
+			app_task_start_recording(false);
 		}
-		
-		if (Notification(notification_value, APP_NOTIFY_RECORD_START_MASK)) {
-			// file_task has initiated recording
-			app_recording = true;
-			app_rec_seq_num = 1;
-			app_rec_interval_cnt = 0;
-			ps_set_rec_enable(true);
-			xTaskNotify(task_handle_gui, GUI_NOTIFY_LED_ON_MASK, eSetBits);
+	}
+	
+	if (Notification(notification_value, APP_NOTIFY_SDCARD_MISSING_MASK)) {
+		sdcard_present = false;
+		if (app_rec_restart_pending) {
+			// Stay awake if we woke from a duty-cycled sleep to resume the session
+			app_rec_restart_pending = false;
+			app_sleep_cycle_done = true;
 		}
+	}
+	
+	if (Notification(notification_value, APP_NOTIFY_RECORD_START_MASK)) {
+		// file_task has initiated recording
+		app_recording = true;
+		app_rec_seq_num = 1;
+		app_rec_interval_cnt = 0;
+		app_motion_end_usec = 0;
+		lepton_motion_reset();
+		ps_set_rec_enable(true);
+		app_task_update_lep_mode();
+#ifdef INCLUDE_SYS_GUI
+		xTaskNotify(task_handle_gui, GUI_NOTIFY_LED_ON_MASK, eSetBits);
+#endif
 		
-		if (Notification(notification_value, APP_NOTIFY_RECORD_NOSTART_MASK)) {
-			// Not currently implemented
+		if (app_task_get_sleep_cycle() && app_task_sleep_enabled()) {
+			// Record the image we woke for when it is due
+			time(&now);
+			sec = (int32_t) (app_sleep_img_time - now);
+			if (sec < 0) sec = 0;
+			if (sec < app_rec_interval) {
+				app_rec_interval_cnt = app_rec_interval - 1 - sec;
+			}
+		} else if ((sync_task_get_mode() != SYNC_MODE_OFF) && (app_rec_interval > 1)) {
+			// Synchronized cameras record on the same seconds (multiples of the interval)
+			time(&now);
+			app_rec_interval_cnt = (uint16_t) (now % app_rec_interval);
 		}
-		
-		if (Notification(notification_value, APP_NOTIFY_RECORD_FAIL_MASK)) {
-			app_task_stop_recording(true);
+	}
+	
+	if (Notification(notification_value, APP_NOTIFY_RECORD_NOSTART_MASK)) {
+		// Not currently implemented
+	}
+	
+	if (Notification(notification_value, APP_NOTIFY_RECORD_FAIL_MASK)) {
+		// file_task has had repeated write failures (single failed images are dropped)
+		app_task_stop_recording(true);
+	}
+	
+	if (Notification(notification_value, APP_NOTIFY_RECORD_IMG_DONE_MASK)) {
+		// file_task has written a queued image.  Bump the count if we're recording (we
+		// may get image done notifications after recording is ended for the last queued
+		// images and we don't want to increment any counters then)
+		if (app_recording) {
+#ifdef INCLUDE_SYS_GUI
+			xTaskNotify(task_handle_gui, GUI_NOTIFY_INC_REC_MASK, eSetBits);
+#endif
+			app_task_eval_sleep();
 		}
-		
-		if (Notification(notification_value, APP_NOTIFY_RECORD_IMG_DONE_MASK)) {
-			// file_task has consumed the image buffer
-			file_image_send_pending = false;
-			
-			// Bump the count if we're recording (we will get a final image done
-			// notification after recording is ended for the last image and we don't
-			// want to increment any counters then)
-			if (app_recording) {
-				app_rec_seq_num++;
-				xTaskNotify(task_handle_gui, GUI_NOTIFY_INC_REC_MASK, eSetBits);
+	}
+	
+	//
+	// COMMAND CONTROL
+	//
+	if (Notification(notification_value, APP_NOTIFY_START_RECORD_MASK)) {
+		// Start recording command
+		app_task_start_recording(false);
+	}
+	
+	if (Notification(notification_value, APP_NOTIFY_STOP_RECORD_MASK)) {
+		// Stop recording command
+		app_task_stop_recording(false);
+	}
+	
+	if (Notification(notification_value, APP_NOTIFY_CMD_REQ_MASK)) {
+		// cmd_task is requesting an image
+		cmd_req_json = cmd_next_req_json;
+		cmd_req_binary = cmd_next_req_binary;
+		cmd_req_contents = cmd_next_req_contents;
+		cmd_req_cached = cmd_next_req_cached;
+		cmd_requesting_image = cmd_req_json || cmd_req_binary;
+	}
+	
+	if (Notification(notification_value, APP_NOTIFY_CMD_DONE_MASK)) {
+		// cmd_task is done using the image it requested
+		if (cmd_image_send_pending) {
+			if (cmd_image_held_binary) {
+				system_cam_buffer_release(sys_cmd_cam_bufferP);
+				sys_cmd_cam_bufferP = NULL;
+				system_lep_frame_release(sys_cmd_lep_bufferP);
+				sys_cmd_lep_bufferP = NULL;
 			}
+			if (cmd_image_held_json) {
+				system_image_buffer_release();
+			}
+			cmd_image_send_pending = false;
 		}
-		
-		//
-		// COMMAND CONTROL
-		//
-		if (Notification(notification_value, APP_NOTIFY_START_RECORD_MASK)) {
-			// Start recording command
-			app_task_start_recording(false);
+	}
+	
+	if (Notification(notification_value, APP_NOTIFY_CMD_REQ_MASK) && cmd_requesting_image && cmd_req_cached) {
+		// Answer with the latest images now (after any previous image was released)
+		app_task_queue_cached_images();
+	}
+	
+#ifdef INCLUDE_SYS_BENCH
+	//
+	// BENCHMARK
+	//
+	if (Notification(notification_value, APP_NOTIFY_START_BENCH_MASK)) {
+		// bench_task starts with the next set of images
+		app_bench_requested = true;
+	}
+#endif
+	
+	//
+	// WIFI CONFIGURATION
+	//
+	if (Notification(notification_value, APP_NOTIFY_NEW_WIFI_MASK)) {
+		// Reconfigure WiFi
+		if (!wifi_reinit()) {
+			ESP_LOGE(TAG, "Could not restart WiFi with the new configuration");
+#ifdef INCLUDE_SYS_GUI
+			// Let the user know
+			gui_preset_message_box_string("Could not restart WiFi with the new configuration");
+			xTaskNotify(task_handle_gui, GUI_NOTIFY_MESSAGEBOX_MASK, eSetBits);
+#endif
 		}
+		metadata_set_camera(wifi_get_info()->ap_ssid);				
+	}
+}
+
+
+/**
+ * Handle an event from cam_task.  A new image becomes the current image, taking over
+ * the event's reference, and is passed to the GUI and http_task as their policies allow.
+ */
+static void app_task_handle_cam_event(const sys_frame_event_t* evP)
+{
+	if ((evP->flags & SYS_FRAME_FLAG_FAIL) != 0) {
+		// cam_task failed to get an image
+		cam_image_request_state = FAILED;
+		return;
+	}
+	
+	system_cam_buffer_release(sys_cam_bufferP);
+	sys_cam_bufferP = (cam_buffer_t*) evP->bufP;
+	cam_image_request_state = RECEIVED;
+	cam_received_usec = esp_timer_get_time();
+	
+	if (cam_gui_update_pending) {
+		app_frame_stats.gui_skipped++;
+	} else if (app_task_consumer_wants(APP_CONSUMER_GUI, IMG_CONTENT_CAM)) {
+		// Give the GUI its own reference to the image so cam_task can keep capturing
+		// while it renders
+		system_cam_buffer_hold(sys_cam_bufferP);
+		sys_cam_gui_bufferP = sys_cam_bufferP;
 		
-		if (Notification(notification_value, APP_NOTIFY_STOP_RECORD_MASK)) {
-			// Stop recording command
-			app_task_stop_recording(false);
-		}
+		// Notify the GUI to update
+		xTaskNotify(task_handle_gui, GUI_NOTIFY_CAM_FRAME_MASK, eSetBits);
+		cam_gui_update_pending = true;
+#ifdef APP_DEBUG_IMG
+		ESP_LOGI(TAG, "Got cam image %u", evP->seq_num);
+#endif
+	}
+	
+	if (!http_task_has_clients()) return;
+	
+	if (cam_http_update_pending) {
+		app_http_skipped++;
+	} else if (app_task_consumer_wants(APP_CONSUMER_HTTP, IMG_CONTENT_CAM)) {
+		// Give http_task its own reference for the MJPEG stream
+		system_cam_buffer_hold(sys_cam_bufferP);
+		sys_http_cam_bufferP = sys_cam_bufferP;
+		xTaskNotify(task_handle_http, HTTP_NOTIFY_CAM_FRAME_MASK, eSetBits);
+		cam_http_update_pending = true;
+	}
+}
+
+
+/**
+ * Handle an event from lep_task.  A new frame becomes the current frame, taking over
+ * the event's reference, and is evaluated and passed to the GUI as its policy allows.
+ */
+static void app_task_handle_lep_event(const sys_frame_event_t* evP)
+{
+	if ((evP->flags & SYS_FRAME_FLAG_FAIL) != 0) {
+		// lep_task failed to get a frame
+		lep_image_request_state = FAILED;
+		return;
+	}
+	
+	system_lep_frame_release(sys_lep_bufferP);
+	sys_lep_bufferP = (lep_buffer_t*) evP->bufP;
+	lep_image_request_state = RECEIVED;
+	lep_received_usec = esp_timer_get_time();
+	
+	// Update the radiometric statistics before anyone uses the frame's metadata
+	lepton_stats_compute(sys_lep_bufferP, gui_st.stats_roi, gui_st.stats_emissivity, gui_st.stats_refl);
+	app_task_eval_alarm();
+	app_task_eval_motion();
+	
+	if (lep_gui_update_pending) {
+		app_frame_stats.gui_skipped++;
+	} else if (app_task_consumer_wants(APP_CONSUMER_GUI, IMG_CONTENT_LEP)) {
+		// Give the GUI its own reference to the frame so lep_task can keep publishing
+		// while it renders
+		system_lep_frame_hold(sys_lep_bufferP);
+		sys_lep_gui_bufferP = sys_lep_bufferP;
 		
-		if (Notification(notification_value, APP_NOTIFY_CMD_REQ_MASK)) {
-			// cmd_task is requesting an image
-			cmd_requesting_image = true;
-		}
+		// Notify the GUI to update
+		xTaskNotify(task_handle_gui, GUI_NOTIFY_LEP_FRAME_MASK, eSetBits);
+		lep_gui_update_pending = true;
+#ifdef APP_DEBUG_IMG
+		ESP_LOGI(TAG, "Got lep image %u", evP->seq_num);
+#endif
+	}
+}
+
+
+/**
+ * Evaluate the alarm against the statistics for the latest Lepton frame.  Clients are
+ * notified when an event starts or ends and, while recording, the images in the ring
+ * from the seconds before the event are marked to be written along with the ArduCAM
+ * images in cam_task's pre-trigger ring.
+ */
+static void app_task_eval_alarm()
+{
+	lep_stats_t stats;
+	int i;
+	
+	if (!lepton_stats_get_latest(&stats)) return;
+	
+	switch (lepton_alarm_eval(&stats, &gui_st)) {
+		case LEP_ALARM_TRIGGER:
+			ESP_LOGI(TAG, "Alarm triggered");
+			app_alarm_active = true;
+			for (i=0; i<app_ring_count; i++) {
+				app_ring[(app_ring_head + i) % APP_ALARM_PRE_IMAGES].write = true;
+			}
+#ifdef INCLUDE_SYS_ARDUCAM
+			if (app_cam_ring_en) {
+				app_cam_pre_count = cam_task_take_ring(app_cam_pre, CAM_RING_LEN);
+				app_cam_pre_head = 0;
+				app_task_update_cam_ring();
+			}
+#endif
+			cmd_task_notify(CMD_NOTIFY_ALARM_MASK);
+			break;
 		
-		if (Notification(notification_value, APP_NOTIFY_CMD_DONE_MASK)) {
-			// cmd_task is done using the image it requested
-			cmd_image_send_pending = false;
+		case LEP_ALARM_CLEAR:
+			ESP_LOGI(TAG, "Alarm cleared");
+			app_alarm_active = false;
+			cmd_task_notify(CMD_NOTIFY_ALARM_MASK);
+			break;
+	}
+}
+
+
+/**
+ * Look for a change in the scene of the latest Lepton frame when it would shorten the
+ * recording interval.  Images are recorded every second until APP_MOTION_HOLD_SEC after
+ * the last change.
+ */
+static void app_task_eval_motion()
+{
+	if (!app_recording || !app_rec_motion_en || app_rec_alarm_en || (app_rec_interval <= 1)) return;
+	
+	if (lepton_motion_detect(sys_lep_bufferP)) {
+		if (esp_timer_get_time() >= app_motion_end_usec) {
+			ESP_LOGI(TAG, "Scene changing");
 		}
-		
-		//
-		// WIFI CONFIGURATION
-		//
-		if (Notification(notification_value, APP_NOTIFY_NEW_WIFI_MASK)) {
-			// Reconfigure WiFi
-			if (!wifi_reinit()) {
-				// Let the user know we couldn't start recording
-				gui_preset_message_box_string("Could not restart WiFi with the new configuration");
-				xTaskNotify(task_handle_gui, GUI_NOTIFY_MESSAGEBOX_MASK, eSetBits);
-			}				
+		app_motion_end_usec = esp_timer_get_time() + ((int64_t) APP_MOTION_HOLD_SEC * 1000000);
+	}
+}
+
+
+/**
+ * Compute the number of ticks to block until our next scheduled event
+ */
+static TickType_t app_task_ticks_to_next_event(int64_t tos_usec)
+{
+	int msec;
+	int time_msec;
+	
+	if (app_state == WAIT_TOS) {
+		// Wake when the ArduCAM image should be requested and, as a backstop to the top of
+		// second notification, just after the second changes
+		msec = time_msec_to_next_second() + 1;
+#ifdef APP_CAM_PREARM
+		if (!cam_armed) {
+			msec -= app_task_get_cam_lead_msec() + 1;
+			if (msec < 0) msec = 0;
+		}
+#endif
+	} else {
+		// Wake at the end of the image wait period
+		msec = APP_MAX_WAIT_MSEC - (int) ((esp_timer_get_time() - tos_usec) / 1000);
+		if (msec < 0) msec = 0;
+	}
+	
+	// Wake when time_discipline is checking the RTC
+	time_msec = time_discipline_msec();
+	if ((time_msec >= 0) && (time_msec < msec)) msec = time_msec;
+	
+	// Round up so we don't wake before the event
+	return (TickType_t) ((msec + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS);
+}
+
+
+/**
+ * Request the ArduCAM image for the next second early enough that it is ready at the
+ * top of the second
+ */
+static void app_task_arm_cam()
+{
+#ifdef APP_CAM_PREARM
+	if (!cam_armed && (time_msec_to_next_second() <= app_task_get_cam_lead_msec())) {
+		app_task_request_cam();
+		cam_image_request_state = REQUESTED;
+		cam_armed = true;
+#ifdef APP_DEBUG_IMG
+		ESP_LOGI(TAG, "  Arm Cam");
+#endif
+	}
+#endif
+}
+
+
+#ifdef APP_CAM_PREARM
+/**
+ * Return how long before the top of the second the ArduCAM image should be requested
+ */
+static int app_task_get_cam_lead_msec()
+{
+	int lead_msec = cam_task_get_image_lead_msec();
+	
+#ifdef APP_CAM_LEP_SYNC
+	// Allow for the wait for the Lepton frame the capture starts with
+	if (!app_lep_standby) {
+		lead_msec += LEP_TASK_SYNC_LEAD_MSEC;
+	}
+#endif
+	
+	return lead_msec;
+}
+#endif
+
+
+#ifdef INCLUDE_SYS_ARDUCAM
+/**
+ * Start an ArduCAM capture, synchronized with the next Lepton frame when lep_task is
+ * streaming
+ */
+static void app_task_request_cam()
+{
+#ifdef APP_CAM_LEP_SYNC
+	if (!app_lep_standby) {
+		xTaskNotify(task_handle_lep, LEP_NOTIFY_SYNC_CAM_MASK, eSetBits);
+		return;
+	}
+#endif
+	
+	xTaskNotify(task_handle_cam, CAM_NOTIFY_GET_FRAME_MASK, eSetBits);
+}
+#endif
+
+
+/**
+ * Record the time from the touch that sent an action from the GUI to us acting on it
+ */
+static void app_task_record_touch_latency()
+{
+	int64_t touch_usec = gui_task_take_action_usec();
+	
+	if (touch_usec != 0) {
+		perf_record(PERF_TOUCH_ACTION, (uint32_t) (esp_timer_get_time() - touch_usec));
+	}
+}
+
+
+/**
+ * Put lep_task in standby between sparse recorded images while nobody else needs Lepton
+ * frames and take it out LEP_STANDBY_LEAD_SEC seconds before the next image is due.
+ * Called at the top of each second.  This second's images are recorded when
+ * app_rec_interval_cnt has reached app_rec_interval - 1.
+ */
+static void app_task_eval_lep_standby()
+{
+	bool en;
+	
+	en = app_recording && !app_rec_alarm_en && !app_rec_motion_en &&
+	     (app_rec_interval >= LEP_STANDBY_MIN_REC_INTERVAL) && gui_task_get_headless() &&
+	     !cmd_requesting_image &&
+	     (!app_rec_lepton_en || ((app_rec_interval - 1 - app_rec_interval_cnt) > LEP_STANDBY_LEAD_SEC));
+	
+	if (en != app_lep_standby) {
+		app_lep_standby = en;
+		xTaskNotify(task_handle_lep, en ? LEP_NOTIFY_STANDBY_ON_MASK : LEP_NOTIFY_STANDBY_OFF_MASK, eSetBits);
+	}
+}
+
+
+/**
+ * Load the recording interval, camera enables and sleep from the active schedule window,
+ * or the configured settings outside all windows.  Called at the top of each second and,
+ * with force set, when the settings change.  While recording, the first image after a
+ * window change is recorded right away.
+ */
+static void app_task_eval_schedule(bool force)
+{
+	sched_window_t w;
+	time_t now;
+	uint32_t version;
+	int window;
+	
+	time(&now);
+	version = sched_get_version();
+	window = sched_active_window(now, &w);
+	if (!force && (window == app_sched_window) && (version == app_sched_version)) return;
+	
+	if (window >= 0) {
+		app_rec_arducam_en = ((w.flags & SCHED_FLAG_ARDUCAM) != 0);
+		app_rec_lepton_en = ((w.flags & SCHED_FLAG_LEPTON) != 0);
+		app_rec_interval = w.record_interval;
+		app_rec_sleep_en = ((w.flags & SCHED_FLAG_SLEEP) != 0);
+	} else {
+		app_rec_arducam_en = gui_st.rec_arducam_enable;
+		app_rec_lepton_en = gui_st.rec_lepton_enable;
+		app_rec_interval = gui_st.record_interval;
+		app_rec_sleep_en = gui_st.record_sleep;
+	}
+	
+	if (window != app_sched_window) {
+		ESP_LOGI(TAG, "Schedule window %d", window);
+		if (app_recording) {
+			app_rec_interval_cnt = (app_rec_interval > 0) ? (app_rec_interval - 1) : 0;
 		}
 	}
+	app_sched_window = window;
+	app_sched_version = version;
+	
+	if (!force) {
+		app_task_update_lep_mode();
+	}
 }
 
 
@@ -435,11 +1099,15 @@ static void app_task_start_recording(bool from_gui)
 			// Request file_task start a recording session
 			xTaskNotify(task_handle_file, FILE_NOTIFY_START_RECORDING_MASK, eSetBits);
 		} else {
+#ifdef INCLUDE_SYS_GUI
 			if (from_gui) {
 				// Let the user know we couldn't start recording
 				gui_preset_message_box_string("Please insert a SD Card");
 				xTaskNotify(task_handle_gui, GUI_NOTIFY_MESSAGEBOX_MASK, eSetBits);
 			}
+#else
+			(void) from_gui;
+#endif
 		}
 	}
 }
@@ -448,13 +1116,7 @@ static void app_task_start_recording(bool from_gui)
 static void app_task_stop_recording(bool en_restart)
 {
 	if (app_recording) {
-		app_recording = false;
-		app_rec_seq_num = 0;
-		app_rec_interval_cnt = 0;
-	
-		xTaskNotify(task_handle_file, FILE_NOTIFY_STOP_RECORDING_MASK, eSetBits);
-		xTaskNotify(task_handle_gui, GUI_NOTIFY_LED_OFF_MASK, eSetBits);
-		xTaskNotify(task_handle_gui, GUI_NOTIFY_CLR_REC_MASK, eSetBits);
+		app_task_end_recording(en_restart);
 		
 		if (!en_restart) {
 			// Normal recording stop
@@ -463,65 +1125,594 @@ static void app_task_stop_recording(bool en_restart)
 			// Something went wrong so we reboot hoping we'll be able to start recording
 			// again successfully
 			ESP_LOGE(TAG, "Recording session failed - rebooting system");
-			app_task_stop_recording(true);
-			vTaskDelay(pdMS_TO_TICKS(10));
+			
+			// Give file_task time to suspend the session before restarting
+			vTaskDelay(pdMS_TO_TICKS(500));
+			(void) ps_flush();
 			esp_restart();
 		}
 	}
 }
 
 
-static void app_process_images(bool valid_cam, bool valid_lep)
+/**
+ * End the recording session.  A suspended session is resumed by file_task when
+ * recording restarts after a reboot or duty-cycled sleep.
+ */
+static void app_task_end_recording(bool suspend)
+{
+	app_recording = false;
+	app_rec_seq_num = 0;
+	app_rec_interval_cnt = 0;
+	app_task_update_lep_mode();
+	app_task_release_pending();
+	app_task_release_ring();
+	
+	xTaskNotify(task_handle_file, suspend ? FILE_NOTIFY_SUSPEND_REC_MASK : FILE_NOTIFY_STOP_RECORDING_MASK, eSetBits);
+#ifdef INCLUDE_SYS_GUI
+	xTaskNotify(task_handle_gui, GUI_NOTIFY_LED_OFF_MASK, eSetBits);
+	xTaskNotify(task_handle_gui, GUI_NOTIFY_CLR_REC_MASK, eSetBits);
+#endif
+}
+
+
+/**
+ * Return true if the recording parameters call for sleeping between images
+ */
+static bool app_task_sleep_enabled()
+{
+	return app_recording && app_rec_sleep_en && !app_rec_alarm_en && !app_rec_motion_en &&
+	       (app_rec_interval >= APP_SLEEP_MIN_REC_INTERVAL);
+}
+
+
+/**
+ * Deep sleep until shortly before the next image is due, or the active schedule window
+ * changes, if nobody is using the camera.  Called after an image has been written.
+ */
+static void app_task_eval_sleep()
+{
+	bool rtc_wake;
+	int32_t sec;
+	time_t change;
+	time_t now;
+	
+	if (!app_task_sleep_enabled()) return;
+	
+	if (!gui_task_get_headless() || http_task_has_clients() || cmd_requesting_image ||
+	    cmd_image_send_pending)
+	{
+		return;
+	}
+	
+	// Wake for the start of a new window as if its first image was due then
+	time(&now);
+	change = sched_next_change(now);
+	if ((change != 0) && (change < app_sleep_img_time)) {
+		app_sleep_img_time = change;
+	}
+	sec = (int32_t) (app_sleep_img_time - now) - APP_SLEEP_WAKE_LEAD_SEC;
+	if (sec <= 0) return;
+	
+	ESP_LOGI(TAG, "Sleep until the next image");
+	app_task_end_recording(true);
+#ifdef INCLUDE_SYS_ARDUCAM
+	xTaskNotify(task_handle_cam, CAM_NOTIFY_SLEEP_MASK, eSetBits);
+#endif
+	
+	// Give file_task time to suspend the session and cam_task to power down the sensor
+	vTaskDelay(pdMS_TO_TICKS(500));
+	rtc_wake = time_set_wake_alarm(now + sec);
+	system_sleep((uint32_t) sec, rtc_wake);
+}
+
+
+/**
+ * Account for this period's images at their hand off and publish the updated counts.
+ * A pre-armed ArduCAM image may arrive before the period starts.
+ */
+static void app_task_update_frame_stats(int64_t tos_usec, bool valid_cam, bool valid_lep)
+{
+	int64_t skew_usec;
+	
+	app_frame_stats.requested++;
+	if (valid_cam) {
+		app_frame_stats.cam_received++;
+		app_frame_stats.cam_msec = (cam_received_usec < tos_usec) ? 0 : (uint16_t) ((cam_received_usec - tos_usec) / 1000);
+	} else {
+		// Periods without a request (no ArduCAM in the profile) aren't late
+		if (cam_image_request_state != IDLE) app_frame_stats.cam_late++;
+		app_frame_stats.cam_msec = APP_FRAME_LATE;
+	}
+	if (valid_lep) {
+		app_frame_stats.lep_received++;
+		app_frame_stats.lep_msec = (lep_received_usec < tos_usec) ? 0 : (uint16_t) ((lep_received_usec - tos_usec) / 1000);
+	} else {
+		// Periods without a request (lep_task in standby) aren't late
+		if (lep_image_request_state != IDLE) app_frame_stats.lep_late++;
+		app_frame_stats.lep_msec = APP_FRAME_LATE;
+	}
+	if (valid_cam && valid_lep && (lep_image_request_state == RECEIVED)) {
+		skew_usec = sys_cam_bufferP->start_usec - sys_lep_bufferP->timestamp_usec;
+		if (skew_usec < 0) skew_usec = -skew_usec;
+		app_frame_stats.pair_msec = (skew_usec >= (APP_FRAME_LATE * 1000LL)) ? (APP_FRAME_LATE - 1) : (uint16_t) (skew_usec / 1000);
+	} else {
+		app_frame_stats.pair_msec = APP_FRAME_LATE;
+	}
+	
+	app_task_update_load();
+	
+	portENTER_CRITICAL(&app_frame_stats_mux);
+	app_frame_stats_pub = app_frame_stats;
+	portEXIT_CRITICAL(&app_frame_stats_mux);
+}
+
+
+/**
+ * Rate the load from the images skipped and dropped during the last period.  The level
+ * rises immediately and drops by one after APP_LOAD_DECAY_PERIODS quiet periods.
+ */
+static void app_task_update_load()
+{
+	uint32_t skipped = app_frame_stats.gui_skipped + app_http_skipped;
+	uint32_t lost = app_frame_stats.file_skipped + app_frame_stats.dropped;
+	int level = APP_LOAD_NONE;
+	
+	if (lost != app_load_prev_lost) {
+		level = APP_LOAD_HEAVY;
+	} else if (skipped != app_load_prev_skipped) {
+		level = APP_LOAD_LIGHT;
+	}
+	app_load_prev_skipped = skipped;
+	app_load_prev_lost = lost;
+	
+	if (level >= app_load_level) {
+		if (level > app_load_level) {
+			ESP_LOGI(TAG, "Load level %d", level);
+		}
+		app_load_level = level;
+		app_load_quiet_cnt = 0;
+	} else if (++app_load_quiet_cnt >= APP_LOAD_DECAY_PERIODS) {
+		app_load_level--;
+		app_load_quiet_cnt = 0;
+		ESP_LOGI(TAG, "Load level %d", app_load_level);
+	}
+}
+
+
+/**
+ * Apply a consumer's policy to a new image from camera (IMG_CONTENT_CAM or IMG_CONTENT_LEP)
+ * and return true if the consumer should be given it.  Decimated images are counted.
+ */
+static bool app_task_consumer_wants(int consumer, uint8_t camera)
+{
+	const app_consumer_policy_t* p = &app_consumer_policy[consumer];
+	uint8_t* cntP = &app_consumer_cnt[consumer][(camera == IMG_CONTENT_CAM) ? 0 : 1];
+	int n;
+	
+	if ((p->cameras & camera) == 0) return false;
+	
+	n = p->decimate;
+	if (app_load_level > p->priority) n *= p->load_decimate;
+	
+	if (++(*cntP) < n) {
+		app_frame_stats.decimated++;
+		return false;
+	}
+	*cntP = 0;
+	
+	return true;
+}
+
+
+/**
+ * Take references to this second's images and queue them for processing if anyone
+ * needs them
+ */
+static void app_task_queue_images(bool valid_cam, bool valid_lep)
+{
+#ifdef INCLUDE_SYS_BENCH
+	// Give this second's images to a requested benchmark run
+	if (app_bench_requested) {
+		if (valid_cam) {
+			system_cam_buffer_hold(sys_cam_bufferP);
+			sys_bench_cam_bufferP = sys_cam_bufferP;
+		}
+		if (valid_lep) {
+			system_lep_frame_hold(sys_lep_bufferP);
+			sys_bench_lep_bufferP = sys_lep_bufferP;
+		}
+		app_bench_requested = false;
+		xTaskNotify(task_handle_bench, BENCH_NOTIFY_START_MASK, eSetBits);
+	}
+#endif
+	
+	if (app_recording && app_rec_alarm_en) {
+		app_task_push_ring(valid_cam, valid_lep);
+	}
+	
+	if (!cmd_requesting_image && (!app_recording || app_rec_alarm_en)) return;
+	
+	if (app_proc_pending) {
+		// Consumers didn't keep up - drop the older images (latest images queued for
+		// cmd_task are simply replaced by the new ones)
+		if (!app_proc_cached) {
+			app_frame_stats.dropped++;
+		}
+		app_task_release_pending();
+#ifdef APP_DEBUG_IMG
+		ESP_LOGI(TAG, "Drop queued images");
+#endif
+	}
+	
+	if (valid_cam) {
+		system_cam_buffer_hold(sys_cam_bufferP);
+		app_cam_procP = sys_cam_bufferP;
+	}
+	if (valid_lep) {
+		system_lep_frame_hold(sys_lep_bufferP);
+		app_lep_procP = sys_lep_bufferP;
+	}
+	app_proc_pending = true;
+}
+
+
+/**
+ * Queue the latest images, those not older than APP_CMD_CACHE_MAX_MSEC, for cmd_task
+ * only.  Nothing is queued if images are already waiting to be processed (they'll answer
+ * the request) or cmd_task is still sending the last image.
+ */
+static void app_task_queue_cached_images()
+{
+	int64_t t = esp_timer_get_time() - (APP_CMD_CACHE_MAX_MSEC * 1000);
+	bool valid_cam;
+	bool valid_lep;
+	
+	if (app_proc_pending || cmd_image_send_pending) return;
+	
+	valid_cam = (sys_cam_bufferP != NULL) && (sys_cam_bufferP->timestamp_usec >= t);
+	valid_lep = (sys_lep_bufferP != NULL) && (sys_lep_bufferP->timestamp_usec >= t);
+	if (!valid_cam && !valid_lep) return;
+	
+	if (valid_cam) {
+		system_cam_buffer_hold(sys_cam_bufferP);
+		app_cam_procP = sys_cam_bufferP;
+	}
+	if (valid_lep) {
+		system_lep_frame_hold(sys_lep_bufferP);
+		app_lep_procP = sys_lep_bufferP;
+	}
+	app_proc_pending = true;
+	app_proc_cached = true;
+}
+
+
+/**
+ * Process queued images when their consumers are ready.  We wait for cmd_task to finish
+ * with the shared image buffer before overwriting it (file_task has its own queue).
+ */
+static void app_task_process_pending()
+{
+	if (!app_proc_pending) return;
+	
+	if (!cmd_requesting_image && (!app_recording || app_rec_alarm_en)) {
+		// No longer needed
+		app_task_release_pending();
+		return;
+	}
+	
+	if (system_image_buffer_in_use()) return;
+	
+#ifdef APP_DEBUG_IMG
+	ESP_LOGI(TAG, "Process images: cam = %d, lep = %d", app_cam_procP != NULL, app_lep_procP != NULL);
+#endif
+	app_process_images(app_cam_procP, app_lep_procP, !app_rec_alarm_en && !app_proc_cached, true);
+	app_task_release_pending();
+}
+
+
+/**
+ * Drop our references to queued images
+ */
+static void app_task_release_pending()
+{
+	system_cam_buffer_release(app_cam_procP);
+	app_cam_procP = NULL;
+	system_lep_frame_release(app_lep_procP);
+	app_lep_procP = NULL;
+	app_proc_pending = false;
+	app_proc_cached = false;
+}
+
+
+/**
+ * Add this second's images to the alarm ring, dropping the oldest images if it is full.
+ * Images are marked to be written while an alarm event is active.
+ */
+static void app_task_push_ring(bool valid_cam, bool valid_lep)
+{
+	app_ring_entry_t* entryP;
+	
+	if (app_ring_count == APP_ALARM_PRE_IMAGES) {
+		entryP = &app_ring[app_ring_head];
+		if (entryP->write) {
+			// file_task has fallen too far behind so this image is dropped
+			file_task_drop_image();
+			app_frame_stats.file_skipped++;
+#ifdef APP_DEBUG_IMG
+			ESP_LOGI(TAG, "Drop alarm image");
+#endif
+		}
+		system_cam_buffer_release(entryP->camP);
+		system_lep_frame_release(entryP->lepP);
+		app_ring_head = (app_ring_head + 1) % APP_ALARM_PRE_IMAGES;
+		app_ring_count--;
+	}
+	
+	entryP = &app_ring[(app_ring_head + app_ring_count) % APP_ALARM_PRE_IMAGES];
+	entryP->camP = NULL;
+	entryP->lepP = NULL;
+	if (valid_cam) {
+		system_cam_buffer_hold(sys_cam_bufferP);
+		entryP->camP = sys_cam_bufferP;
+	}
+	if (valid_lep) {
+		system_lep_frame_hold(sys_lep_bufferP);
+		entryP->lepP = sys_lep_bufferP;
+	}
+	entryP->write = app_alarm_active;
+	app_ring_count++;
+}
+
+
+/**
+ * Record the oldest alarm image marked to be written when file_task has room for it.
+ * Only the oldest image needs to be checked since images are marked from the oldest.
+ * Images taken from cam_task's pre-trigger ring are recorded before ring images
+ * captured after them.
+ */
+static void app_task_process_ring()
+{
+	app_ring_entry_t* entryP = NULL;
+	
+	if ((app_ring_count != 0) && app_ring[app_ring_head].write) {
+		entryP = &app_ring[app_ring_head];
+	}
+#ifdef INCLUDE_SYS_ARDUCAM
+	if ((entryP == NULL) && (app_cam_pre_head == app_cam_pre_count)) return;
+#else
+	if (entryP == NULL) return;
+#endif
+	if (file_task_queue_full() || system_image_buffer_in_use()) return;
+	
+#ifdef INCLUDE_SYS_ARDUCAM
+	if ((app_cam_pre_head != app_cam_pre_count) &&
+	    ((entryP == NULL) || (app_task_ring_entry_usec(entryP) > app_cam_pre[app_cam_pre_head]->timestamp_usec)))
+	{
+		app_process_images(app_cam_pre[app_cam_pre_head], NULL, true, false);
+		system_cam_buffer_release(app_cam_pre[app_cam_pre_head]);
+		app_cam_pre[app_cam_pre_head++] = NULL;
+		return;
+	}
+#endif
+	
+	app_process_images(entryP->camP, entryP->lepP, true, false);
+	
+	// Written images aren't kept as pre-trigger images for a following event
+	system_cam_buffer_release(entryP->camP);
+	system_lep_frame_release(entryP->lepP);
+	app_ring_head = (app_ring_head + 1) % APP_ALARM_PRE_IMAGES;
+	app_ring_count--;
+}
+
+
+/**
+ * Drop our references to the images in the alarm ring and those taken from cam_task's
+ * pre-trigger ring
+ */
+static void app_task_release_ring()
 {
+	app_ring_entry_t* entryP;
+	
+	while (app_ring_count > 0) {
+		entryP = &app_ring[app_ring_head];
+		system_cam_buffer_release(entryP->camP);
+		system_lep_frame_release(entryP->lepP);
+		app_ring_head = (app_ring_head + 1) % APP_ALARM_PRE_IMAGES;
+		app_ring_count--;
+	}
+	
+#ifdef INCLUDE_SYS_ARDUCAM
+	while (app_cam_pre_head != app_cam_pre_count) {
+		system_cam_buffer_release(app_cam_pre[app_cam_pre_head]);
+		app_cam_pre[app_cam_pre_head++] = NULL;
+	}
+#endif
+}
+
+
+#ifdef INCLUDE_SYS_ARDUCAM
+/**
+ * Return the capture time of an alarm ring entry's images (0 for an entry without
+ * images so it is recorded first)
+ */
+static int64_t app_task_ring_entry_usec(app_ring_entry_t* entryP)
+{
+	if (entryP->camP != NULL) return entryP->camP->timestamp_usec;
+	if (entryP->lepP != NULL) return entryP->lepP->timestamp_usec;
+	return 0;
+}
+
+
+/**
+ * Enable cam_task's pre-trigger ring while recording alarm events with the ArduCAM
+ * enabled, outside of an event and once the images taken from it have been recorded
+ */
+static void app_task_update_cam_ring()
+{
+	bool en;
+	
+	en = app_recording && app_rec_alarm_en && app_rec_arducam_en && !app_alarm_active &&
+	     (app_cam_pre_head == app_cam_pre_count);
+	if (en != app_cam_ring_en) {
+		cam_task_set_ring(en);
+		app_cam_ring_en = en;
+	}
+}
+#endif
+
+
+/**
+ * Process a set of images for the consumers enabled by rec_en (file_task, if recording)
+ * and cmd_en (cmd_task, if it is requesting an image)
+ */
+static void app_process_images(cam_buffer_t* camP, lep_buffer_t* lepP, bool rec_en, bool cmd_en)
+{
+	bool fast_rec;
 	bool process_cam;
 	bool process_lep;
-	char* image_json_text;
-	uint32_t image_json_len;
+	bool send_file = false;
+	bool send_meta;
+	bool send_cmd;
+	bool image_valid = false;
+	uint8_t cameras;
+	uint8_t json_contents;
+	uint32_t cmd_notify_mask = 0;
 	
-	// Determine what images to process
-	process_cam = valid_cam && (!app_recording || (app_recording && app_rec_arducam_en));
-	process_lep = valid_lep && (!app_recording || (app_recording && app_rec_lepton_en));
+	// When recording at the Lepton frame rate the lepton images go to the binary record
+	// file directly from lep_task so the once-per-second image file only holds the
+	// ArduCAM image (if enabled) and metadata.
+	fast_rec = app_recording && !app_rec_alarm_en && (app_rec_interval == REC_INT_FAST_VAL);
 	
-	// Get the image json text string
-	image_json_text = json_get_image_file_string(app_rec_seq_num, process_cam, process_lep,
-	                                             &image_json_len);
+	// Determine what images to process.  Only images from cameras in the enabled consumers'
+	// policies are used.
+	cameras = (rec_en ? app_consumer_policy[APP_CONSUMER_FILE].cameras : 0) |
+	          (cmd_en ? app_consumer_policy[APP_CONSUMER_CMD].cameras : 0);
+	process_cam = (camP != NULL) && ((cameras & IMG_CONTENT_CAM) != 0) &&
+	              (!app_recording || (app_recording && app_rec_arducam_en));
+	process_lep = (lepP != NULL) && ((cameras & IMG_CONTENT_LEP) != 0) && !fast_rec &&
+	              (!app_recording || (app_recording && app_rec_lepton_en));
+	if (!process_cam) camP = NULL;
+	if (!process_lep) lepP = NULL;
 	
-	// Send it to file_task for writing if we are recording and a send not already pending
-	if (app_recording) {
-		if (++app_rec_interval_cnt >= app_rec_interval) {
-			if (!file_image_send_pending && app_recording) {
-				// Record image
-				app_rec_interval_cnt = 0;
-				if (image_json_len < JSON_MAX_IMAGE_TEXT_LEN) {
-					// Copy the image to the shared buffer for file_task
-					memcpy(sys_image_file_buffer.bufferP, image_json_text, image_json_len);
-					sys_image_file_buffer.length = image_json_len;
-			
-					// Notify file_task
-					xTaskNotify(task_handle_file, FILE_NOTIFY_NEW_IMAGE_MASK, eSetBits);
-					file_image_send_pending = true;
-				} else {
-					ESP_LOGE(TAG, "image_json_text (%d bytes) too large for sys_image_file_buffer", image_json_len);
-				}
+	// Determine who gets the images.  Alarm events and a changing scene are recorded every
+	// second.
+	if (app_recording && rec_en && !(fast_rec && !app_rec_arducam_en)) {
+		if (app_rec_alarm_en || (esp_timer_get_time() < app_motion_end_usec) ||
+		    (++app_rec_interval_cnt >= app_rec_interval))
+		{
+			app_rec_interval_cnt = 0;
+			if (app_task_sleep_enabled()) {
+				app_sleep_img_time = app_prev_time + app_rec_interval;
+			}
+			if (!file_task_queue_full()) {
+				send_file = true;
+			} else {
+				// file_task has fallen too far behind so this image is dropped
+				file_task_drop_image();
+				app_frame_stats.file_skipped++;
+#ifdef APP_DEBUG_IMG
+				ESP_LOGI(TAG, "Drop image - file queue full");
+#endif
 			}
 		}
 	}
+	send_cmd = cmd_en && !cmd_image_send_pending && cmd_requesting_image;
 	
-	// Send it to cmd_task if there's a request and a send not already pending
-	if (!cmd_image_send_pending && cmd_requesting_image) {
-		if (image_json_len < JSON_MAX_IMAGE_TEXT_LEN-2) {
-			// Copy the image to the shared buffer for cmd_task, adding delimitors
-			sys_cmd_response_buffer.bufferP[0] = CMD_JSON_STRING_START;
-			memcpy(&sys_cmd_response_buffer.bufferP[1], image_json_text, image_json_len);
-			sys_cmd_response_buffer.bufferP[image_json_len+1] = CMD_JSON_STRING_STOP;
-			sys_cmd_response_buffer.length = image_json_len + 2;
-			
-			// Notify cmd_task
-			xTaskNotify(task_handle_cmd, CMD_NOTIFY_IMAGE_MASK, eSetBits);
-			cmd_image_send_pending = true;
+	// A recorded second without images only adds a line to the session metadata log
+	// when that is enabled
+	send_meta = send_file && app_rec_meta_log && (camP == NULL) && (lepP == NULL);
+	
+	// Generate the image json text string directly into the shared buffer if anyone
+	// needs it (our caller has made sure no other task is still using it).  cmd_task
+	// gets the complete file contents if we are also writing a json file.
+	if ((send_file && !send_meta && (app_rec_format == REC_FORMAT_JSON)) || (send_cmd && cmd_req_json)) {
+		json_contents = (send_file && !send_meta && (app_rec_format == REC_FORMAT_JSON)) ? IMG_CONTENT_ALL : cmd_req_contents;
+		image_valid = json_get_image_file_string(app_rec_seq_num, camP, lepP, json_contents, &sys_image_buffer);
+		if (!image_valid) {
+			ESP_LOGE(TAG, "Could not generate image json text");
+		}
+	}
+	
+	// Queue the image for file_task to write.  Each consumer holds a reference to the
+	// buffers it uses until it is done with them (the file queue holds references to
+	// binary image buffers and copies json images).
+	if (send_file) {
+		if (send_meta) {
+			// file_task builds the line itself (it doesn't need the shared buffer)
+			if (file_task_queue_meta_record(app_rec_seq_num)) {
+				app_rec_seq_num++;
+			}
+		} else if (app_rec_format != REC_FORMAT_JSON) {
+			// file_task writes the record directly from the image buffers
+			if (file_task_queue_bin_image(camP, lepP, (app_rec_format >= REC_FORMAT_BINARY_Z))) {
+				app_rec_seq_num++;
+			}
+		} else if (image_valid) {
+			if (file_task_queue_json_image(&sys_image_buffer, camP, lepP)) {
+				app_rec_seq_num++;
+			}
+		}
+	}
+	
+	// Hand it to cmd_task if there's a request and a send not already pending
+	if (send_cmd) {
+		cmd_image_held_binary = cmd_req_binary;
+		if (cmd_req_binary) {
+			// cmd_task builds binary images for its clients directly from the image buffers
+			system_cam_buffer_hold(camP);
+			sys_cmd_cam_bufferP = camP;
+			system_lep_frame_hold(lepP);
+			sys_cmd_lep_bufferP = lepP;
+			sys_cmd_seq_num = app_rec_seq_num;
+			cmd_notify_mask |= CMD_NOTIFY_BIN_IMAGE_MASK;
+		}
+		
+		// cmd_task images only come from app_task_process_pending's queued images
+		sys_cmd_cached = app_proc_cached;
+		if ((camP != NULL) && ((lepP == NULL) || (camP->timestamp_usec < lepP->timestamp_usec))) {
+			sys_cmd_image_usec = camP->timestamp_usec;
+		} else if (lepP != NULL) {
+			sys_cmd_image_usec = lepP->timestamp_usec;
 		} else {
-			ESP_LOGE(TAG, "image_json_text (%d bytes) too large for sys_cmd_response_buffer", image_json_len);
+			sys_cmd_image_usec = esp_timer_get_time();
+		}
+		
+		cmd_image_held_json = cmd_req_json && image_valid;
+		if (cmd_image_held_json) {
+			// cmd_task adds the delimitors when it sends the image
+			system_image_buffer_hold();
+			sys_cmd_contents = json_contents;
+			cmd_notify_mask |= CMD_NOTIFY_IMAGE_MASK;
+		}
+		
+		if (cmd_notify_mask != 0) {
+			cmd_image_send_pending = true;
+			cmd_task_notify(cmd_notify_mask);
+			app_frame_stats.cmd_sent++;
 		}
 		cmd_requesting_image = false;
 	}
 }
+
+
+/**
+ * Configure lep_task for the current recording parameters.  Enable lepton frame averaging
+ * when recording at long intervals since we have plenty of frames to average between
+ * recorded images.  Have lep_task send every frame to file_task when recording at the
+ * Lepton's frame rate.  Neither is used when recording alarm events.
+ */
+static void app_task_update_lep_mode()
+{
+	if (app_recording && !app_rec_alarm_en && (app_rec_interval >= LEP_AVG_MIN_REC_INTERVAL)) {
+		xTaskNotify(task_handle_lep, LEP_NOTIFY_AVG_ON_MASK, eSetBits);
+	} else {
+		xTaskNotify(task_handle_lep, LEP_NOTIFY_AVG_OFF_MASK, eSetBits);
+	}
+	
+	if (app_recording && app_rec_lepton_en && !app_rec_alarm_en && (app_rec_interval == REC_INT_FAST_VAL)) {
+		xTaskNotify(task_handle_lep, LEP_NOTIFY_REC_ON_MASK, eSetBits);
+	} else {
+		xTaskNotify(task_handle_lep, LEP_NOTIFY_REC_OFF_MASK, eSetBits);
+	}
+}
@@ -0,0 +1,524 @@
+/*
+ * Bench Task
+ *
+ * Time the pipeline components on the camera hardware for the run_benchmark command.
+ * Components owned by other tasks are timed in their task's context.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "bench_task.h"
+
+#ifdef INCLUDE_SYS_BENCH
+
+#include "app_task.h"
+#include "cmd_task.h"
+#include "file_task.h"
+#include "gui_task.h"
+#include "lep_task.h"
+#include "render_task.h"
+#include "base64_fast.h"
+#include "file_utilities.h"
+#include "gui_screen_main.h"
+#include "json_utilities.h"
+#include "render_jpg.h"
+#include "sys_utilities.h"
+#include "vospi.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+
+//
+// Bench Task variables
+//
+static const char* TAG = "bench_task";
+
+static bench_result_t bench_results[BENCH_NUM_ITEMS];
+static portMUX_TYPE bench_mux = portMUX_INITIALIZER_UNLOCKED;
+static bool bench_running = false;
+
+// Where the requesting client wants the TCP send data (port 0 to skip it)
+static uint32_t bench_tcp_addr;
+static uint16_t bench_tcp_port;
+
+// Scratch buffers in the external RAM
+static uint8_t* bench_bufP;
+static json_image_string_t bench_json;
+
+static const char* bench_item_names[BENCH_NUM_ITEMS] = {
+	"Base64 Telemetry",
+	"Base64 Radiometric",
+	"Base64 JPEG",
+	"JSON Image",
+	"JPEG Decode 1:1",
+	"JPEG Decode 1:2",
+	"JPEG Decode 1:4",
+	"JPEG Decode 1:8",
+	"Lepton Image",
+	"VoSPI Get Frame",
+	"SD Write 4K",
+	"SD Write 16K",
+	"SD Write 32K",
+	"SD Write 64K",
+	"TCP Send"
+};
+
+static const uint32_t bench_sd_block_len[] = {4096, 16384, 32768, 65536};
+
+
+
+//
+// Bench Task Forward Declarations for internal functions
+//
+static void bench_run();
+static void bench_run_step(TaskHandle_t task, uint32_t mask, const char* name);
+static void bench_run_base64();
+static void bench_run_json_image();
+static void bench_run_tcp();
+static void bench_set_result(int item, uint32_t bytes, int64_t usec);
+static void bench_log_results();
+
+
+
+//
+// Bench Task API
+//
+void bench_task()
+{
+	uint32_t notification_value;
+	uint32_t* ptr;
+	
+	ESP_LOGI(TAG, "Start task");
+	
+	// Allocate our scratch buffers in the external SPI SRAM
+	bench_bufP = heap_caps_malloc(BENCH_BUF_LEN, MALLOC_CAP_SPIRAM);
+	bench_json.bufferP = heap_caps_malloc(JSON_MAX_IMAGE_TEXT_LEN, MALLOC_CAP_SPIRAM);
+	if ((bench_bufP == NULL) || (bench_json.bufferP == NULL)) {
+		ESP_LOGE(TAG, "Could not allocate buffers - bailing");
+		vTaskDelete(NULL);
+	}
+	
+	// Incompressible data so no part of the path can take a shortcut
+	for (ptr = (uint32_t*) bench_bufP; ptr < (uint32_t*) (bench_bufP + BENCH_BUF_LEN); ptr++) {
+		*ptr = esp_random();
+	}
+	
+#ifdef BENCH_AT_BOOT
+	// Let the system start up
+	vTaskDelay(pdMS_TO_TICKS(BENCH_BOOT_DELAY_MSEC));
+	(void) bench_task_request(0, 0);
+#endif
+	
+	while (1) {
+		// app_task starts us once it holds a set of images for us
+		xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, portMAX_DELAY);
+		
+		if (Notification(notification_value, BENCH_NOTIFY_START_MASK)) {
+			bench_run();
+		}
+	}
+}
+
+
+/**
+ * Request a benchmark run.  The data for the TCP send benchmark is sent to tcp_addr
+ * (network byte order) at tcp_port if tcp_port is not 0.  Returns false if a run is
+ * already in progress.
+ */
+bool bench_task_request(uint32_t tcp_addr, uint16_t tcp_port)
+{
+	bool started = false;
+	
+	portENTER_CRITICAL(&bench_mux);
+	if (!bench_running) {
+		bench_running = true;
+		bench_tcp_addr = tcp_addr;
+		bench_tcp_port = tcp_port;
+		started = true;
+	}
+	portEXIT_CRITICAL(&bench_mux);
+	
+	if (started) {
+		xTaskNotify(task_handle_app, APP_NOTIFY_START_BENCH_MASK, eSetBits);
+	} else {
+		ESP_LOGE(TAG, "Benchmark already running");
+	}
+	
+	return started;
+}
+
+
+/**
+ * Get a copy of the results of the last run
+ */
+void bench_task_get_results(bench_result_t* resultsP)
+{
+	portENTER_CRITICAL(&bench_mux);
+	memcpy(resultsP, bench_results, sizeof(bench_results));
+	portEXIT_CRITICAL(&bench_mux);
+}
+
+
+/**
+ * Return the display name of an item
+ */
+const char* bench_task_item_name(int item)
+{
+	if ((item < 0) || (item >= BENCH_NUM_ITEMS)) return "";
+	
+	return bench_item_names[item];
+}
+
+
+#ifdef INCLUDE_SYS_GUI
+/**
+ * Time decoding the benchmark jpeg at each tjpgd scale.  Called by render_task, which
+ * owns the decoder.
+ */
+void bench_task_run_render()
+{
+	cam_buffer_t* camP = sys_bench_cam_bufferP;
+	uint16_t w, h;
+	uint16_t dst_w, dst_h;
+	uint8_t* fbP;
+	int64_t start_usec;
+	int i, s;
+	bool success;
+	
+	if ((camP != NULL) && render_jpeg_get_size(camP->cam_bufferP, camP->cam_buffer_len, &w, &h)) {
+		for (s=0; s<4; s++) {
+			// render_jpeg_image uses the scale that exactly fits the image
+			dst_w = w >> s;
+			dst_h = h >> s;
+			fbP = heap_caps_malloc(2 * dst_w * dst_h, MALLOC_CAP_SPIRAM);
+			if (fbP == NULL) {
+				ESP_LOGE(TAG, "Could not allocate %dx%d render buffer", dst_w, dst_h);
+				continue;
+			}
+			
+			success = true;
+			start_usec = esp_timer_get_time();
+			for (i=0; (i<BENCH_ITERATIONS) && success; i++) {
+				success = (render_jpeg_image(fbP, camP->cam_bufferP, camP->cam_buffer_len, dst_w, dst_h) == 1);
+			}
+			if (success) {
+				bench_set_result(BENCH_JPEG_SCALE_1 + s, camP->cam_buffer_len,
+				                 (esp_timer_get_time() - start_usec) / BENCH_ITERATIONS);
+			}
+			
+			free(fbP);
+		}
+	}
+	
+	xTaskNotify(task_handle_bench, BENCH_NOTIFY_DONE_MASK, eSetBits);
+}
+
+
+/**
+ * Time converting the benchmark lepton frame to the display image.  Called by gui_task,
+ * which owns LVGL.  The time doesn't include LVGL redrawing the image.
+ */
+void bench_task_run_lep_image()
+{
+	int64_t start_usec;
+	int i;
+	
+	if (sys_bench_lep_bufferP != NULL) {
+		start_usec = esp_timer_get_time();
+		for (i=0; i<BENCH_ITERATIONS; i++) {
+			gui_screen_main_update_lep_image(sys_bench_lep_bufferP);
+		}
+		bench_set_result(BENCH_LEP_IMAGE, LEP_NUM_PIXELS*2, (esp_timer_get_time() - start_usec) / BENCH_ITERATIONS);
+	}
+	
+	xTaskNotify(task_handle_bench, BENCH_NOTIFY_DONE_MASK, eSetBits);
+}
+#endif
+
+
+/**
+ * Time handing a completed frame off from vospi.  Called by lep_task, between segments,
+ * since it owns vospi.  A spare frame is swapped in and out so vospi ends up with the
+ * buffer it is filling.
+ */
+void bench_task_run_vospi()
+{
+	lep_buffer_t* bufP;
+	int64_t start_usec;
+	int i;
+	
+	bufP = system_lep_frame_alloc();
+	if (bufP != NULL) {
+		start_usec = esp_timer_get_time();
+		for (i=0; i<BENCH_VOSPI_ITERATIONS; i++) {
+			bufP = vospi_get_frame(bufP);
+		}
+		bench_set_result(BENCH_VOSPI_FRAME, 0, (esp_timer_get_time() - start_usec) / BENCH_VOSPI_ITERATIONS);
+		system_lep_frame_release(bufP);
+	} else {
+		ESP_LOGE(TAG, "No free frame buffer for vospi");
+	}
+	
+	xTaskNotify(task_handle_bench, BENCH_NOTIFY_DONE_MASK, eSetBits);
+}
+
+
+/**
+ * Time writing a file sequentially in each block size, including syncing it to the
+ * card.  Called by file_task, which owns the card, with card_ready set if it has
+ * mounted the card for us.
+ */
+void bench_task_run_sd(bool card_ready)
+{
+	FILE* fp;
+	int64_t start_usec;
+	uint32_t len;
+	uint32_t n;
+	int i;
+	bool success;
+	
+	if (card_ready) {
+		for (i=0; i<sizeof(bench_sd_block_len)/sizeof(uint32_t); i++) {
+			len = bench_sd_block_len[i];
+			if (!file_open_root_write_file(BENCH_SD_FILE_NAME, &fp)) break;
+	
+			success = true;
+			start_usec = esp_timer_get_time();
+			for (n=0; (n<BENCH_SD_FILE_LEN) && success; n+=len) {
+				success = (fwrite(bench_bufP, 1, len, fp) == len);
+			}
+			fsync(fileno(fp));
+			if (success) {
+				bench_set_result(BENCH_SD_4K + i, BENCH_SD_FILE_LEN, esp_timer_get_time() - start_usec);
+			} else {
+				ESP_LOGE(TAG, "SD write failed");
+			}
+	
+			file_close_file(fp);
+			if (!success) break;
+		}
+		(void) file_delete_root_file(BENCH_SD_FILE_NAME);
+	}
+	
+	xTaskNotify(task_handle_bench, BENCH_NOTIFY_DONE_MASK, eSetBits);
+}
+
+
+
+//
+// Bench Task internal functions
+//
+
+/**
+ * Run all the benchmarks using the images app_task is holding for us
+ */
+static void bench_run()
+{
+	int64_t start_usec;
+	
+	ESP_LOGI(TAG, "Start benchmarks");
+	start_usec = esp_timer_get_time();
+	
+	portENTER_CRITICAL(&bench_mux);
+	memset(bench_results, 0, sizeof(bench_results));
+	portEXIT_CRITICAL(&bench_mux);
+	
+	bench_run_base64();
+	bench_run_json_image();
+#ifdef INCLUDE_SYS_GUI
+	bench_run_step(task_handle_render, RENDER_NOTIFY_BENCH_MASK, "render_task");
+	bench_run_step(task_handle_gui, GUI_NOTIFY_BENCH_MASK, "gui_task");
+#endif
+	bench_run_step(task_handle_lep, LEP_NOTIFY_BENCH_MASK, "lep_task");
+	bench_run_step(task_handle_file, FILE_NOTIFY_BENCH_MASK, "file_task");
+	bench_run_tcp();
+	
+	// Done with the images
+	system_cam_buffer_release(sys_bench_cam_bufferP);
+	sys_bench_cam_bufferP = NULL;
+	system_lep_frame_release(sys_bench_lep_bufferP);
+	sys_bench_lep_bufferP = NULL;
+	
+	ESP_LOGI(TAG, "Benchmarks done in %d mSec", (int) ((esp_timer_get_time() - start_usec) / 1000));
+	bench_log_results();
+	
+	portENTER_CRITICAL(&bench_mux);
+	bench_running = false;
+	portEXIT_CRITICAL(&bench_mux);
+	
+	// Let cmd_task send the results to the clients that asked for them
+	cmd_task_notify(CMD_NOTIFY_BENCH_MASK);
+}
+
+
+/**
+ * Have another task run its items and wait for it to finish
+ */
+static void bench_run_step(TaskHandle_t task, uint32_t mask, const char* name)
+{
+	uint32_t notification_value = 0;
+	
+	xTaskNotify(task, mask, eSetBits);
+	
+	if (!xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, pdMS_TO_TICKS(BENCH_STEP_TIMEOUT_MSEC)) ||
+	    !Notification(notification_value, BENCH_NOTIFY_DONE_MASK))
+	{
+		ESP_LOGE(TAG, "%s did not finish its benchmarks", name);
+	}
+}
+
+
+/**
+ * Time base64 encoding the size of each image in a json image
+ */
+static void bench_run_base64()
+{
+	const int items[] = {BENCH_B64_TELEM, BENCH_B64_LEP, BENCH_B64_JPEG};
+	uint32_t lens[3];
+	int64_t start_usec;
+	int i, j;
+	
+	lens[0] = LEP_TEL_WORDS*2;
+	lens[1] = LEP_NUM_PIXELS*2;
+	lens[2] = (sys_bench_cam_bufferP != NULL) ? sys_bench_cam_bufferP->cam_buffer_len : BENCH_BUF_LEN;
+	
+	for (i=0; i<3; i++) {
+		start_usec = esp_timer_get_time();
+		for (j=0; j<BENCH_ITERATIONS; j++) {
+			(void) base64_fast_encode(bench_bufP, lens[i], bench_json.bufferP);
+		}
+		bench_set_result(items[i], lens[i], (esp_timer_get_time() - start_usec) / BENCH_ITERATIONS);
+	}
+}
+
+
+/**
+ * Time building a json image with all the contents from the images we are holding
+ */
+static void bench_run_json_image()
+{
+	int64_t start_usec;
+	int i;
+	bool success = true;
+	
+	start_usec = esp_timer_get_time();
+	for (i=0; (i<BENCH_ITERATIONS) && success; i++) {
+		success = json_get_image_file_string(0, sys_bench_cam_bufferP, sys_bench_lep_bufferP,
+		                                     IMG_CONTENT_ALL, &bench_json);
+	}
+	if (success) {
+		bench_set_result(BENCH_JSON_IMAGE, bench_json.length, (esp_timer_get_time() - start_usec) / BENCH_ITERATIONS);
+	}
+}
+
+
+/**
+ * Time sending data to the requesting client
+ */
+static void bench_run_tcp()
+{
+	struct sockaddr_in dest_addr;
+	struct timeval tv;
+	int64_t start_usec;
+	uint32_t sent = 0;
+	int len;
+	int ret;
+	int sock;
+	
+	if (bench_tcp_port == 0) return;
+	
+	sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+	if (sock < 0) {
+		ESP_LOGE(TAG, "Unable to create TCP socket: errno %d", errno);
+		return;
+	}
+	
+	tv.tv_sec = BENCH_STEP_TIMEOUT_MSEC / 1000;
+	tv.tv_usec = 0;
+	(void) setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	
+	dest_addr.sin_family = AF_INET;
+	dest_addr.sin_addr.s_addr = bench_tcp_addr;
+	dest_addr.sin_port = htons(bench_tcp_port);
+	if (connect(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) != 0) {
+		ESP_LOGE(TAG, "Could not connect to port %d: errno %d", bench_tcp_port, errno);
+		close(sock);
+		return;
+	}
+	
+	start_usec = esp_timer_get_time();
+	while (sent < BENCH_TCP_LEN) {
+		len = BENCH_TCP_LEN - sent;
+		if (len > CMD_TX_CHUNK_LEN) len = CMD_TX_CHUNK_LEN;
+	
+		ret = send(sock, bench_bufP, len, 0);
+		if (ret <= 0) {
+			ESP_LOGE(TAG, "TCP send failed: errno %d", errno);
+			break;
+		}
+		sent += ret;
+	}
+	if (sent == BENCH_TCP_LEN) {
+		bench_set_result(BENCH_TCP_SEND, sent, esp_timer_get_time() - start_usec);
+	}
+	
+	shutdown(sock, 0);
+	close(sock);
+}
+
+
+static void bench_set_result(int item, uint32_t bytes, int64_t usec)
+{
+	portENTER_CRITICAL(&bench_mux);
+	bench_results[item].valid = true;
+	bench_results[item].bytes = bytes;
+	bench_results[item].usec = (uint32_t) usec;
+	portEXIT_CRITICAL(&bench_mux);
+}
+
+
+static void bench_log_results()
+{
+	int i;
+	
+	for (i=0; i<BENCH_NUM_ITEMS; i++) {
+		if (!bench_results[i].valid) {
+			ESP_LOGI(TAG, "  %s: not run", bench_item_names[i]);
+		} else if ((bench_results[i].bytes == 0) || (bench_results[i].usec == 0)) {
+			ESP_LOGI(TAG, "  %s: %u uSec", bench_item_names[i], bench_results[i].usec);
+		} else {
+			// bytes/uSec = MB/sec
+			ESP_LOGI(TAG, "  %s: %u bytes in %u uSec (%1.2f MB/s)", bench_item_names[i],
+			         bench_results[i].bytes, bench_results[i].usec,
+			         (float) bench_results[i].bytes / (float) bench_results[i].usec);
+		}
+	}
+}
+
+#endif /* INCLUDE_SYS_BENCH */
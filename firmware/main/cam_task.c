@@ -6,9 +6,10 @@
  * interface.
  *
  * Note: The ArduCAM shares its SPI bus with other peripherals.  Activity on the SPI
- * bus directed at other devices while we are offloading an image seems to confuse the
+ * bus directed at other devices in the middle of an image offload seems to confuse the
  * ArduCAM so although the ESP32 IDF SPI driver provides access control, we lock the SPI
- * bus during the entire image offload process.
+ * bus during the image offload process.  The offload yields the bus to the LCD and
+ * touchscreen only between complete FIFO bursts (see CAM_YIELD_BETWEEN_BURSTS).
  *
  * Copyright 2020 Dan Julio
  *
@@ -31,12 +32,18 @@
 #include <stdint.h>
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "rom/ets_sys.h"
 #include "driver/gpio.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "app_task.h"
 #include "cam_task.h"
+#include "health_task.h"
 #include "ov2640.h"
+#include "perf_utilities.h"
+#include "pm_utilities.h"
+#include "ps_utilities.h"
 #include "sys_utilities.h"
 #include "system_config.h"
 
@@ -46,6 +53,59 @@
 
 static const char* TAG = "cam_task";
 
+static const int cam_spi_freqs[] = CAM_SPI_TUNE_FREQS;
+#define CAM_NUM_SPI_FREQS (sizeof(cam_spi_freqs) / sizeof(cam_spi_freqs[0]))
+
+static int cam_spi_freq;                 // Current clock
+static int cam_fail_count;               // Consecutive failed images
+static uint32_t cam_capture_num = 0;     // Images read (including pre-trigger ring images)
+
+// Set once the task has started (it is recreated by health_task if it stalls)
+static bool cam_started = false;
+
+// Buffer being captured into, kept here so it can be released if we are recreated
+static cam_buffer_t* cam_newP = NULL;
+
+// Current image configuration
+static uint8_t cam_resolution;
+static uint8_t cam_quality;              // Configured quality
+static uint8_t cam_adapt_quality;        // Quality in use
+static uint16_t cam_roi[4];              // x, y, w, h in a 640x480 image
+static uint16_t cam_jpeg_width;
+
+// Capture time prediction and statistics
+static int32_t cam_capture_avg_usec = CAM_CAPTURE_INIT_MSEC * 1000;
+static int32_t cam_readout_avg_usec = 0;
+static uint32_t cam_total_polls = 0;
+static cam_capture_stats_t cam_stats;
+static portMUX_TYPE cam_stats_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Jpeg length budget from cmd_task (0 for none), protected by cam_stats_mux
+static uint32_t cam_jpeg_budget = 0;
+
+// Pre-trigger ring (oldest at cam_ring_head)
+static bool cam_ring_en = false;
+static int cam_ring_head = 0;
+static int cam_ring_count = 0;
+static cam_buffer_t* cam_ring[CAM_RING_LEN];
+static portMUX_TYPE cam_ring_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+
+//
+// CAM Task Forward Declarations for internal functions
+//
+static bool image_config_changed(const gui_state_t* stP);
+static void set_image_config(const gui_state_t* stP);
+static void adapt_jpeg_quality(uint32_t jpeg_len);
+static void capture_ring_image();
+static bool capture_image(cam_buffer_t* bufP, bool idle_only);
+static bool wait_capture_done();
+static bool wait_vspi_idle();
+static void tune_spi_freq();
+static bool try_spi_freq(int freq_hz, int num_captures);
+static void step_down_spi_freq();
+
 
 
 //
@@ -57,45 +117,582 @@ static const char* TAG = "cam_task";
  */
 void cam_task()
 {
-	int wait_count;
 	uint32_t notification_value;
+	bool ring_en;
 	
 	ESP_LOGI(TAG, "Start task");
 	
+	if (cam_started) {
+		// Recreated after a stall.  Drop the image we were capturing and take the sensor
+		// out of low power mode in case we stalled while it slept.  It is reconfigured
+		// from scratch.
+		system_cam_buffer_release(cam_newP);
+		cam_newP = NULL;
+		ov2640_lowPower(false);
+		cam_jpeg_width = 0;
+	}
+	cam_started = true;
+	
 	// Configure the camera
-	ov2640_setJPEGSize(CAM_SIZE_SPEC);
 	ov2640_set_Light_Mode(Sunny);
+	set_image_config(&gui_st);
+	
+	// Find the fastest reliable SPI clock
+	tune_spi_freq();
 	
 	while (1) {
-		// Block waiting for a request for a frame
-		xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, portMAX_DELAY);
-
-		// Take a picture;
-		ov2640_capture();
+		health_task_beat(HEALTH_TASK_CAM);
 		
-		// Wait for the image to be captured
-		wait_count = CAM_MAX_JPEG_WAIT_TIME_MSEC / CAM_JPEG_TASK_WAIT_MSEC;
-		while (!ov2640_getBit(ARDUCHIP_TRIG, CAP_DONE_MASK) && (wait_count-- > 0)) {
-			vTaskDelay(pdMS_TO_TICKS(CAM_JPEG_TASK_WAIT_MSEC));
+		portENTER_CRITICAL(&cam_ring_mux);
+		ring_en = cam_ring_en;
+		portEXIT_CRITICAL(&cam_ring_mux);
+		
+		// Block waiting for a request for a frame, filling the pre-trigger ring while
+		// there isn't one
+		if (!xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, ring_en ? 0 : pdMS_TO_TICKS(HEALTH_BEAT_MSEC))) {
+			if (ring_en) {
+				capture_ring_image();
+			}
+			continue;
 		}
-		if (wait_count == 0) {
-			ESP_LOGE(TAG, "jpeg image not captured in time");
+		
+		// Put the sensor in low power mode when the system is about to deep sleep between
+		// recorded images.  It is reinitialized when the system wakes.
+		if (Notification(notification_value, CAM_NOTIFY_SLEEP_MASK)) {
+			ov2640_lowPower(true);
+			continue;
+		}
+		
+		// Pick up image changes made through the GUI or command interface
+		if (image_config_changed(&gui_st)) {
+			set_image_config(&gui_st);
 		}
-			
-		// Get the jpeg image into the shared buffer
-		// Lock the SPI bus so no other task can interrupt us offloading the image
-		system_lock_vspi();
-		ov2640_transferJpeg(sys_cam_buffer.cam_bufferP, &sys_cam_buffer.cam_buffer_len);
-		system_unlock_vspi();
 		
-		if (sys_cam_buffer.cam_buffer_len == 0) {
+		// Get a buffer that no other task is using to capture into
+		cam_newP = system_cam_buffer_alloc();
+		if (cam_newP == NULL) {
+			ESP_LOGE(TAG, "No free jpeg buffer");
+			(void) system_frame_event_post(SYS_FRAME_STREAM_CAM, NULL, 0, SYS_FRAME_FLAG_FAIL);
+			xTaskNotify(task_handle_app, APP_NOTIFY_CAM_FRAME_MASK, eSetBits);
+			continue;
+		}
+
+		if (!capture_image(cam_newP, false)) {
 			ESP_LOGE(TAG, "Could not get jpeg image");
-			// Let app_task know we failed to update the buffer
-			xTaskNotify(task_handle_app, APP_NOTIFY_CAM_FAIL_MASK, eSetBits);
+			system_cam_buffer_release(cam_newP);
+			cam_newP = NULL;
+			// Let app_task know we failed to get an image
+			(void) system_frame_event_post(SYS_FRAME_STREAM_CAM, NULL, 0, SYS_FRAME_FLAG_FAIL);
+			xTaskNotify(task_handle_app, APP_NOTIFY_CAM_FRAME_MASK, eSetBits);
+			
+			if (++cam_fail_count >= CAM_SPI_MAX_FAILS) {
+				cam_fail_count = 0;
+				step_down_spi_freq();
+			}
 		} else {
-			// Let app_task know we've updated the buffer
+			cam_fail_count = 0;
+			adapt_jpeg_quality(cam_newP->cam_buffer_len);
+			
+			// Hand the new image, and our reference to it, to app_task
+			if (!system_frame_event_post(SYS_FRAME_STREAM_CAM, cam_newP, cam_newP->timestamp_usec, 0)) {
+				system_cam_buffer_release(cam_newP);
+			}
 			xTaskNotify(task_handle_app, APP_NOTIFY_CAM_FRAME_MASK, eSetBits);
-			//ESP_LOGI(TAG, "image size = %d", sys_cam_buffer.cam_buffer_len);
+			//ESP_LOGI(TAG, "image size = %d", cam_newP->cam_buffer_len);
+			cam_newP = NULL;
+		}
+	}
+}
+
+
+
+/**
+ * Return how long before it is needed an image should be requested
+ */
+int cam_task_get_image_lead_msec()
+{
+	int lead_msec;
+	bool ring_en;
+	
+	portENTER_CRITICAL(&cam_ring_mux);
+	ring_en = cam_ring_en;
+	portEXIT_CRITICAL(&cam_ring_mux);
+	
+	portENTER_CRITICAL(&cam_stats_mux);
+	lead_msec = cam_stats.avg_msec + cam_stats.avg_readout_msec + CAM_ARM_MARGIN_MSEC;
+	if (ring_en) {
+		// The request may wait for a ring image being captured
+		lead_msec += cam_stats.avg_msec + cam_stats.avg_readout_msec;
+	}
+	portEXIT_CRITICAL(&cam_stats_mux);
+	
+	if (lead_msec > CAM_ARM_MAX_LEAD_MSEC) lead_msec = CAM_ARM_MAX_LEAD_MSEC;
+	return lead_msec;
+}
+
+
+/**
+ * Set the longest jpeg image the network clients can keep up with, or 0 for no limit
+ */
+void cam_task_set_jpeg_budget(uint32_t len)
+{
+	portENTER_CRITICAL(&cam_stats_mux);
+	cam_jpeg_budget = len;
+	portEXIT_CRITICAL(&cam_stats_mux);
+}
+
+
+/**
+ * Enable or disable the pre-trigger ring.  Disabling it drops the images it holds.
+ */
+void cam_task_set_ring(bool en)
+{
+	cam_buffer_t* bufP;
+	
+	portENTER_CRITICAL(&cam_ring_mux);
+	cam_ring_en = en;
+	portEXIT_CRITICAL(&cam_ring_mux);
+	
+	if (!en) {
+		while (cam_task_take_ring(&bufP, 1) != 0) {
+			system_cam_buffer_release(bufP);
 		}
 	}
-}
\ No newline at end of file
+}
+
+
+/**
+ * Move up to max_len of the oldest images in the pre-trigger ring, and the ring's
+ * references to them, into bufPP.  Returns the number of images moved.
+ */
+int cam_task_take_ring(cam_buffer_t** bufPP, int max_len)
+{
+	int n = 0;
+	
+	portENTER_CRITICAL(&cam_ring_mux);
+	while ((cam_ring_count > 0) && (n < max_len)) {
+		bufPP[n++] = cam_ring[cam_ring_head];
+		cam_ring_head = (cam_ring_head + 1) % CAM_RING_LEN;
+		cam_ring_count--;
+	}
+	portEXIT_CRITICAL(&cam_ring_mux);
+	
+	return n;
+}
+
+
+/**
+ * Return a copy of the capture time statistics
+ */
+void cam_task_get_capture_stats(cam_capture_stats_t* statsP)
+{
+	portENTER_CRITICAL(&cam_stats_mux);
+	*statsP = cam_stats;
+	portEXIT_CRITICAL(&cam_stats_mux);
+}
+
+
+
+//
+// CAM Task internal functions
+//
+
+/**
+ * Return true if the image settings in stP differ from the current configuration
+ */
+static bool image_config_changed(const gui_state_t* stP)
+{
+	return ((stP->cam_resolution != cam_resolution) || (stP->cam_quality != cam_quality) ||
+	        (stP->cam_roi_x != cam_roi[0]) || (stP->cam_roi_y != cam_roi[1]) ||
+	        (stP->cam_roi_w != cam_roi[2]) || (stP->cam_roi_h != cam_roi[3]));
+}
+
+
+/**
+ * Configure the image size, region of interest and jpeg quality.  A size change
+ * invalidates the capture time prediction so it restarts from the initial value.
+ */
+static void set_image_config(const gui_state_t* stP)
+{
+	int div;
+	int width;
+	uint8_t size;
+	
+	switch (stP->cam_resolution) {
+		case SYS_CAM_RES_320x240:
+			size = OV2640_320x240;
+			div = 2;
+			break;
+		case SYS_CAM_RES_160x120:
+			size = OV2640_160x120;
+			div = 4;
+			break;
+		default:
+			size = OV2640_640x480;
+			div = 1;
+	}
+	
+	if ((stP->cam_resolution != cam_resolution) || (cam_jpeg_width == 0)) {
+		ov2640_setJPEGSize(size);
+	}
+	
+	// The region is specified in a 640x480 image
+	width = ov2640_setWindow(size, stP->cam_roi_x / div, stP->cam_roi_y / div,
+	                         stP->cam_roi_w / div, stP->cam_roi_h / div);
+	if (width == 0) {
+		ESP_LOGE(TAG, "Illegal region of interest - using full image");
+		width = ov2640_setWindow(size, 0, 0, 0, 0);
+	}
+	
+	if ((stP->cam_resolution != cam_resolution) || (width != cam_jpeg_width) ||
+	    (stP->cam_roi_x != cam_roi[0]) || (stP->cam_roi_y != cam_roi[1]))
+	{
+		cam_capture_avg_usec = CAM_CAPTURE_INIT_MSEC * 1000;
+		cam_readout_avg_usec = 0;
+		
+		// Let the sensor output a few frames at the new size
+		vTaskDelay(pdMS_TO_TICKS(CAM_RECONFIG_SETTLE_MSEC));
+	}
+	
+	ov2640_setJPEGQuality(stP->cam_quality);
+	
+	cam_resolution = stP->cam_resolution;
+	cam_quality = stP->cam_quality;
+	cam_adapt_quality = stP->cam_quality;
+	cam_roi[0] = stP->cam_roi_x;
+	cam_roi[1] = stP->cam_roi_y;
+	cam_roi[2] = stP->cam_roi_w;
+	cam_roi[3] = stP->cam_roi_h;
+	cam_jpeg_width = width;
+	
+	portENTER_CRITICAL(&cam_stats_mux);
+	cam_stats.quality = cam_adapt_quality;
+	portEXIT_CRITICAL(&cam_stats_mux);
+	
+	ESP_LOGI(TAG, "Image width %d, quality %d", cam_jpeg_width, cam_quality);
+}
+
+
+/**
+ * Step the jpeg quality used for the next image toward the network budget, or back to
+ * the configured quality while recording or without a budget.  The quality is coarsened
+ * while images are too long and refined again once they are comfortably short.
+ */
+static void adapt_jpeg_quality(uint32_t jpeg_len)
+{
+	int q = cam_adapt_quality;
+	uint32_t budget;
+	
+	portENTER_CRITICAL(&cam_stats_mux);
+	budget = cam_jpeg_budget;
+	portEXIT_CRITICAL(&cam_stats_mux);
+	
+	if ((budget == 0) || app_task_get_recording()) {
+		q = cam_quality;
+	} else if (jpeg_len > budget) {
+		q += CAM_ADAPT_QS_STEP;
+		if (q > OV2640_QS_MAX) q = OV2640_QS_MAX;
+	} else if (jpeg_len < (budget * CAM_ADAPT_LOW_PCT / 100)) {
+		q -= CAM_ADAPT_QS_STEP;
+		if (q < cam_quality) q = cam_quality;
+	}
+	
+	if (q != cam_adapt_quality) {
+		ov2640_setJPEGQuality((uint8_t) q);
+		cam_adapt_quality = (uint8_t) q;
+		
+		portENTER_CRITICAL(&cam_stats_mux);
+		cam_stats.quality = q;
+		portEXIT_CRITICAL(&cam_stats_mux);
+	}
+}
+
+
+/**
+ * Capture an image into the pre-trigger ring, dropping its oldest image if it is full.
+ * Failed ring images don't count toward stepping down the SPI clock since they are
+ * also dropped when the bus isn't idle.
+ */
+static void capture_ring_image()
+{
+	cam_buffer_t* oldP = NULL;
+	
+	if (image_config_changed(&gui_st)) {
+		set_image_config(&gui_st);
+	}
+	
+	cam_newP = system_cam_buffer_alloc();
+	if (cam_newP == NULL) {
+		// Don't take buffers needed for requested images
+		vTaskDelay(pdMS_TO_TICKS(CAM_RING_IDLE_WAIT_MSEC));
+		return;
+	}
+	
+	if (!capture_image(cam_newP, true)) {
+		system_cam_buffer_release(cam_newP);
+		cam_newP = NULL;
+		return;
+	}
+	
+	portENTER_CRITICAL(&cam_ring_mux);
+	if (cam_ring_en) {
+		if (cam_ring_count == CAM_RING_LEN) {
+			oldP = cam_ring[cam_ring_head];
+			cam_ring_head = (cam_ring_head + 1) % CAM_RING_LEN;
+			cam_ring_count--;
+		}
+		cam_ring[(cam_ring_head + cam_ring_count) % CAM_RING_LEN] = cam_newP;
+		cam_ring_count++;
+	} else {
+		// Disabled while we were capturing
+		oldP = cam_newP;
+	}
+	portEXIT_CRITICAL(&cam_ring_mux);
+	
+	system_cam_buffer_release(oldP);
+	cam_newP = NULL;
+}
+
+
+/**
+ * Take a picture and read it into bufP.  The offload waits for the VSPI bus to be idle
+ * when idle_only is set.  Returns false if a complete jpeg image wasn't read.
+ */
+static bool capture_image(cam_buffer_t* bufP, bool idle_only)
+{
+	int64_t start_usec;
+	int32_t readout_usec;
+	
+	// Take a picture.  Light sleep would add its wake time to the capture polls.
+	pm_set_level(PM_USER_CAM, PM_LEVEL_AWAKE);
+	bufP->start_usec = esp_timer_get_time();
+	ov2640_capture();
+	
+	// Wait for the image to be captured
+	if (!wait_capture_done()) {
+		ESP_LOGE(TAG, "jpeg image not captured in time");
+		bufP->cam_buffer_len = 0;
+		pm_set_level(PM_USER_CAM, PM_LEVEL_SLEEP);
+		return false;
+	}
+	bufP->timestamp_usec = esp_timer_get_time();
+	
+	if (idle_only && !wait_vspi_idle()) {
+		bufP->cam_buffer_len = 0;
+		pm_set_level(PM_USER_CAM, PM_LEVEL_SLEEP);
+		return false;
+	}
+	
+	// Get the jpeg image into our buffer
+	// Lock the SPI bus so no other task can interrupt us offloading the image
+	start_usec = esp_timer_get_time();
+	system_lock_vspi(VSPI_USER_CAM);
+	pm_set_level(PM_USER_CAM, PM_LEVEL_FAST);
+	ov2640_transferJpeg(bufP->cam_bufferP, &bufP->cam_buffer_len);
+	pm_set_level(PM_USER_CAM, PM_LEVEL_SLEEP);
+	system_unlock_vspi();
+	
+	if (bufP->cam_buffer_len != 0) {
+		bufP->capture_num = ++cam_capture_num;
+		readout_usec = (int32_t) (esp_timer_get_time() - start_usec);
+		perf_record(PERF_CAM_READOUT, readout_usec);
+		if (cam_readout_avg_usec == 0) {
+			cam_readout_avg_usec = readout_usec;
+		} else {
+			cam_readout_avg_usec += (readout_usec - cam_readout_avg_usec) / CAM_CAPTURE_AVG_WEIGHT;
+		}
+		portENTER_CRITICAL(&cam_stats_mux);
+		cam_stats.avg_readout_msec = cam_readout_avg_usec / 1000;
+		portEXIT_CRITICAL(&cam_stats_mux);
+	}
+	
+	return (bufP->cam_buffer_len != 0);
+}
+
+
+/**
+ * Wait for the capture started by ov2640_capture to complete and update the capture time
+ * prediction and statistics.  Returns false if it timed out.
+ */
+static bool wait_capture_done()
+{
+	bool done = false;
+	int polls = 0;
+	int32_t sleep_msec;
+	int64_t start_usec;
+	int64_t elapsed_usec;
+	uint32_t capture_msec;
+	
+	start_usec = esp_timer_get_time();
+	
+	// Sleep through most of the expected capture time
+	sleep_msec = (cam_capture_avg_usec / 1000) - CAM_CAPTURE_EARLY_MSEC;
+	if (sleep_msec >= portTICK_PERIOD_MS) {
+		vTaskDelay(sleep_msec / portTICK_PERIOD_MS);
+	}
+	
+	while (1) {
+		polls++;
+		if (ov2640_getBit(ARDUCHIP_TRIG, CAP_DONE_MASK)) {
+			done = true;
+			break;
+		}
+		
+		elapsed_usec = esp_timer_get_time() - start_usec;
+		if (elapsed_usec >= (CAM_MAX_JPEG_WAIT_TIME_MSEC * 1000)) {
+			break;
+		}
+		if (elapsed_usec < (cam_capture_avg_usec + (CAM_CAPTURE_SPIN_MSEC * 1000))) {
+			ets_delay_us(CAM_CAPTURE_POLL_USEC);
+		} else {
+			vTaskDelay(pdMS_TO_TICKS(CAM_JPEG_TASK_WAIT_MSEC));
+		}
+	}
+	
+	elapsed_usec = esp_timer_get_time() - start_usec;
+	capture_msec = (uint32_t) (elapsed_usec / 1000);
+	if (done) {
+		cam_capture_avg_usec += ((int32_t) elapsed_usec - cam_capture_avg_usec) / CAM_CAPTURE_AVG_WEIGHT;
+		perf_record(PERF_CAM_CAPTURE, elapsed_usec);
+	}
+	
+	portENTER_CRITICAL(&cam_stats_mux);
+	if (done) {
+		cam_stats.captures++;
+		cam_total_polls += polls;
+		cam_stats.avg_msec = cam_capture_avg_usec / 1000;
+		cam_stats.avg_polls = (float) cam_total_polls / (float) cam_stats.captures;
+		if (capture_msec > cam_stats.max_msec) cam_stats.max_msec = capture_msec;
+	} else {
+		cam_stats.timeouts++;
+	}
+	portEXIT_CRITICAL(&cam_stats_mux);
+	
+	return done;
+}
+
+
+/**
+ * Wait for neither the LCD nor the touchscreen to have or be waiting for the VSPI bus.
+ * Returns false if it didn't become idle within CAM_RING_IDLE_WAIT_MSEC.
+ */
+static bool wait_vspi_idle()
+{
+	int64_t start_usec = esp_timer_get_time();
+	
+	while (system_vspi_user_busy(VSPI_USER_LCD) || system_vspi_user_busy(VSPI_USER_TS)) {
+		if ((esp_timer_get_time() - start_usec) >= (CAM_RING_IDLE_WAIT_MSEC * 1000)) {
+			return false;
+		}
+		vTaskDelay(pdMS_TO_TICKS(CAM_JPEG_TASK_WAIT_MSEC));
+	}
+	
+	return true;
+}
+
+
+/**
+ * Select the SPI clock.  A previously calibrated clock is used if it still works,
+ * otherwise each of the faster clocks is tried.  The result is stored so the full
+ * calibration only happens once.
+ */
+static void tune_spi_freq()
+{
+	int i;
+	int stored_freq;
+	
+	cam_fail_count = 0;
+	cam_spi_freq = CAM_SPI_FREQ_HZ;
+	
+	stored_freq = ps_get_cam_spi_freq();
+	if (stored_freq > CAM_SPI_FREQ_HZ) {
+		if (try_spi_freq(stored_freq, 1)) {
+			cam_spi_freq = stored_freq;
+			ESP_LOGI(TAG, "SPI clock %d MHz", cam_spi_freq / 1000000);
+			return;
+		}
+	} else if (stored_freq == CAM_SPI_FREQ_HZ) {
+		// A previous calibration found nothing faster works
+		ESP_LOGI(TAG, "SPI clock %d MHz", cam_spi_freq / 1000000);
+		return;
+	}
+	
+	for (i=0; i<CAM_NUM_SPI_FREQS; i++) {
+		if (try_spi_freq(cam_spi_freqs[i], CAM_SPI_TUNE_CAPTURES)) {
+			cam_spi_freq = cam_spi_freqs[i];
+			break;
+		}
+	}
+	
+	if (cam_spi_freq == CAM_SPI_FREQ_HZ) {
+		system_lock_vspi(VSPI_USER_CAM);
+		(void) ov2640_setSpiFreq(CAM_SPI_FREQ_HZ);
+		system_unlock_vspi();
+	}
+	
+	ps_set_cam_spi_freq(cam_spi_freq);
+	ESP_LOGI(TAG, "Calibrated SPI clock %d MHz", cam_spi_freq / 1000000);
+}
+
+
+/**
+ * Switch to freq_hz and check that the test register works and num_captures jpeg
+ * images are read intact.  The camera is left at freq_hz.
+ */
+static bool try_spi_freq(int freq_hz, int num_captures)
+{
+	bool success;
+	cam_buffer_t* bufP;
+	
+	system_lock_vspi(VSPI_USER_CAM);
+	success = (ov2640_setSpiFreq(freq_hz) != 0) && (ov2640_testSpi() != 0);
+	system_unlock_vspi();
+	if (!success) {
+		ESP_LOGI(TAG, "SPI clock %d MHz failed register test", freq_hz / 1000000);
+		return false;
+	}
+	
+	bufP = system_cam_buffer_alloc();
+	if (bufP == NULL) {
+		// Can't check images so trust the register test
+		return true;
+	}
+	
+	// transferJpeg only returns an image found between SOI and EOI markers
+	while (success && (num_captures-- > 0)) {
+		success = capture_image(bufP, false);
+	}
+	system_cam_buffer_release(bufP);
+	
+	if (!success) {
+		ESP_LOGI(TAG, "SPI clock %d MHz failed image test", freq_hz / 1000000);
+	}
+	return success;
+}
+
+
+/**
+ * Drop to the next slower SPI clock after repeated image failures and remember it
+ */
+static void step_down_spi_freq()
+{
+	int i;
+	int new_freq = CAM_SPI_FREQ_HZ;
+	
+	if (cam_spi_freq <= CAM_SPI_FREQ_HZ) return;
+	
+	for (i=0; i<CAM_NUM_SPI_FREQS; i++) {
+		if (cam_spi_freqs[i] < cam_spi_freq) {
+			new_freq = cam_spi_freqs[i];
+			break;
+		}
+	}
+	
+	system_lock_vspi(VSPI_USER_CAM);
+	if (ov2640_setSpiFreq(new_freq) != 0) {
+		cam_spi_freq = new_freq;
+		ps_set_cam_spi_freq(cam_spi_freq);
+		ESP_LOGW(TAG, "Reduced SPI clock to %d MHz", cam_spi_freq / 1000000);
+	}
+	system_unlock_vspi();
+}
@@ -22,52 +22,247 @@
  *
  */
 #include "app_task.h"
+#include "bench_task.h"
+#include "cam_task.h"
 #include "cmd_task.h"
+#include "file_task.h"
+#include "health_task.h"
+#include "base64_fast.h"
+#include "binrec_utilities.h"
 #include "json_utilities.h"
+#include "lep_task.h"
+#include "ota_task.h"
+#include "perf_utilities.h"
+#include "pm_utilities.h"
+#include "prevcodec.h"
+#include "radcodec.h"
+#include "sync_task.h"
+#include "upload_task.h"
 #include "lepton_utilities.h"
+#include "vospi.h"
 #include "ps_utilities.h"
+#include "schedule_utilities.h"
 #include "sys_utilities.h"
 #include "time_utilities.h"
 #include "wifi_utilities.h"
+#include "xfer_task.h"
 #include "system_config.h"
 #include "esp_system.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "lwip/err.h"
 #include "lwip/sockets.h"
 #include "lwip/sys.h"
+#include <fcntl.h>
+#include <string.h>
 #include <lwip/netdb.h>
 
+//
+// CMD Task internal constants
+//
+
+// Longest tag prefix added to a json response or image: <0x02>{"tag":65535,"age":4294967295,
+#define CMD_TAG_PREFIX_LEN 32
+
+// Client copy of the rest of an image (a json image is always longer than a binary one)
+#define CMD_LAG_BUF_LEN    (CMD_TAG_PREFIX_LEN + JSON_MAX_IMAGE_TEXT_LEN + 1)
+
+
+
 //
 // CMD Task variables
 //
 static const char* TAG = "cmd_task";
 
-// Command processor
-static bool response_expected;
-static bool response_available;
-static bool response_was_image;
-static char* response_buffer;
-static uint32_t response_length;
+// Piece of an image being sent
+typedef struct {
+	const char* bufP;
+	uint32_t length;
+} cmd_tx_seg_t;
+
+// Per-client state
+typedef struct {
+	int sock;                            // -1 when the slot is unused
+	int image_format;                    // CMD_IMG_FMT_*
+	int image_requests;                  // get_image requests waiting for an image
+	uint16_t image_tags[CMD_MAX_IMAGE_REQUESTS];  // Their tags, oldest first
+	bool image_fresh[CMD_MAX_IMAGE_REQUESTS];     // Set for requests that can't use a cached image
+	bool bench_requested;                // Waiting for run_benchmark results
+	uint16_t bench_tag;
+	bool list_requested;                 // Waiting for a list_sessions list
+	uint16_t list_tag;
+	bool streaming;
+	int stream_period;                   // Images between streamed images
+	int stream_cnt;
+	int stream_contents;                 // IMG_CONTENT_* items in streamed images
+	
+	// Receive state.  Commands are collected, without delimiters, as they arrive and
+	// are parsed in place.
+	char rx_cmd_buffer[JSON_MAX_CMD_TEXT_LEN+1];
+	int rx_cmd_len;                      // -1 when not in a command
+	bool rx_cmd_overflow;                // Command too long, discarded at its end
+	
+	// Transmit state.  Command responses are copied so they can be queued behind an
+	// image.  Images are sent in place from the buffers app_task is holding for us.
+	char rsp_buffer[JSON_MAX_RSP_TEXT_LEN];
+	uint32_t rsp_length;
+	uint32_t rsp_offset;
+	
+	// Streamed response state.  A streamed response is written into stream_buffer a
+	// chunk at a time as the previous chunk is sent.  It follows the first stream_at
+	// bytes of rsp_buffer and responses queued after it wait until it is finished.
+	json_stream_t stream;
+	char stream_buffer[CMD_STREAM_CHUNK_LEN];
+	uint32_t stream_length;
+	uint32_t stream_offset;
+	uint32_t stream_at;
+	bool img_active;                     // Sending img_seg
+	cmd_tx_seg_t img_seg[CMD_TX_MAX_SEGS];
+	int img_seg_count;
+	int img_seg_index;
+	uint32_t img_seg_offset;
+	uint8_t bin_header_buffer[BINREC_MAX_HEADER_LEN];
+	char img_tag_buffer[CMD_TAG_PREFIX_LEN];  // Start of a json get_image response
+	int64_t tx_progress_usec;            // Last time we were able to send to the client
+	int tx_tos;                          // IP TOS currently set on the socket
+	
+	// Slow client state.  A client that takes too long to send the held image finishes
+	// it from lag_buffer (allocated in PSRAM on first use) and misses the images that
+	// arrive until it is done.
+	uint8_t* lag_bufferP;
+	bool lag_alloc_failed;               // Don't try to allocate lag_buffer again
+	bool img_detached;                   // img_seg is a copy in lag_buffer
+	bool img_missed;                     // An image arrived while sending the copy
+	
+	// Throughput measurement for the adaptive jpeg quality
+	uint32_t img_len;                    // Length of the image being sent
+	uint32_t img_jpeg_len;               // Length of its jpeg as sent (0 if none)
+	bool img_jpeg_base64;                // Its jpeg is Base-64 encoded
+	int64_t img_start_usec;              // When it was queued
+	int64_t img_done_usec;               // When the last image finished
+	uint32_t tx_rate;                    // Average bytes/sec, 0 until measured
+	uint32_t jpeg_budget;                // Longest jpeg it can keep up with (0 for any)
+	
+	// Firmware update state.  The image following an ota_update command is received
+	// straight into ota_task's buffers, or discarded if the update was refused or failed.
+	bool ota_active;                     // Waiting for the result of our update
+	bool ota_discard;                    // Discarding the rest of the image
+	uint32_t ota_remaining;              // Image bytes still to arrive
+	uint8_t* ota_bufP;                   // ota_task buffer being filled (NULL if none)
+	uint32_t ota_fill;
+	uint16_t ota_tag;
+} cmd_client_t;
+
+// Only touched at network rates so kept in PSRAM
+static EXT_RAM_ATTR cmd_client_t clients[CMD_MAX_CLIENTS];
+
+// Image request state
+static bool image_request_outstanding;   // Waiting for app_task to deliver an image
+static bool image_held;                  // app_task is holding an image for our clients
+static bool image_held_json;             // The held image has a json form
+static bool image_held_binary;           // The held image has a binary form
+static int64_t image_held_usec;          // When it was delivered
+static int64_t image_request_usec;       // When the outstanding request was made
 
-// Main receive buffer for incoming packets
-static char rx_circular_buffer[CMD_MAX_TCP_RX_BUFFER_LEN];
-static int rx_circular_push_index;
-static int rx_circular_pop_index;
+// Jpeg budget last given to cam_task
+static uint32_t jpeg_budget;
 
-// json command string buffer
-static char json_cmd_string[JSON_MAX_CMD_TEXT_LEN];
+// Radiometric crop of the held image (captured with it so every client gets the same region)
+static sys_lep_roi_t lep_crop;
+static bool lep_cropped;
+
+// Compressed radiometric data for the held image, built on first use
+static bool lep_z_valid;
+static uint32_t lep_z_len;               // 0 if the frame didn't compress
+
+// Uncompressed cropped radiometric data for the held image, built on first use
+static bool crop_valid;
+static EXT_RAM_ATTR uint16_t crop_buffer[LEP_NUM_PIXELS];
+
+// Preview of the held image for binary clients, built on first use
+static bool preview_valid;
+static uint32_t preview_len;
+static EXT_RAM_ATTR uint8_t preview_buffer[PREVCODEC_MAX_LEN];
+
+// Loopback sockets used to wake us from select() when another task notifies us
+static int wake_rx_sock = -1;
+static int wake_tx_sock = -1;
+static struct sockaddr_in wake_addr;
+
+// Status beacon and discovery socket
+static int beacon_sock = -1;
+#ifdef CMD_BEACON_SEC
+static int64_t beacon_usec;              // When the last beacon was broadcast
+#endif
+
+// UDP frame stream
+static bool udp_streaming;
+static int udp_sock = -1;
+static struct sockaddr_in udp_dest_addr;
+static uint32_t udp_frame_num;
+static EXT_RAM_ATTR uint8_t udp_tx_buffer[sizeof(cmd_udp_header_t) + CMD_UDP_PAYLOAD_LEN];
+
+// Set once the task has started (it is recreated by health_task if it stalls) and the
+// listening socket it opened
+static bool cmd_started = false;
+static int cmd_listen_sock = -1;
+
+// json image delimitors
+static const char json_image_start = CMD_JSON_STRING_START;
+static const char json_image_stop = CMD_JSON_STRING_STOP;
 
 
 //
 // CMD Task Forward Declarations for internal functions
 //
-static void init_command_processor();
-static void process_rx_data(char* data, int len);
-static void process_rx_packet();
+static void cmd_restart_cleanup();
+static void cmd_create_wake_sockets();
+static void cmd_drain_wake_socket();
+static void cmd_accept_client(int listen_sock);
+static void cmd_close_client(cmd_client_t* c);
+static void init_client(cmd_client_t* c, int sock);
+static void cmd_receive(cmd_client_t* c, char* rx_buffer, int rx_len);
+static void process_rx_data(cmd_client_t* c, char* data, int len);
+static void process_rx_packet(cmd_client_t* c);
 static void cmd_task_handle_notifications();
-static int in_buffer(char c);
+static void cmd_update_image_request();
+static void cmd_send_images(bool json_valid, bool binary_valid);
+static void cmd_send_image(cmd_client_t* c, bool json_valid, bool binary_valid);
+static bool cmd_client_wants_image(cmd_client_t* c, uint8_t* contents, uint16_t* tag, bool* request);
+static void cmd_queue_response(cmd_client_t* c, char* buf, uint32_t length, uint16_t tag);
+static void cmd_queue_stream(cmd_client_t* c, int type, uint16_t tag);
+static void cmd_queue_json_image(cmd_client_t* c, uint16_t tag, bool request);
+static void cmd_queue_binary_image(cmd_client_t* c, uint8_t contents, uint16_t tag);
+static uint32_t cmd_get_lep_z_len();
+static uint16_t* cmd_get_crop_buffer();
+static uint32_t cmd_get_preview_len();
+static bool cmd_tx_pending(cmd_client_t* c);
+static bool cmd_stream_active(cmd_client_t* c);
+static void cmd_service_tx(cmd_client_t* c);
+static void cmd_check_tx_timeout(cmd_client_t* c);
+static void cmd_check_image_lag();
+static void cmd_detach_image(cmd_client_t* c);
+static void cmd_check_image_done();
+static void cmd_start_image(cmd_client_t* c, uint32_t jpeg_len, bool base64);
+static void cmd_update_tx_rate(cmd_client_t* c);
+#ifdef CMD_ADAPT_JPEG
+static void cmd_update_jpeg_budget();
+#endif
+static void cmd_check_beacon_socket();
+static void cmd_handle_beacon_request();
+static void cmd_send_beacon(struct sockaddr_in* toP);
+static void cmd_udp_stream_on(uint8_t* ip_addr, uint16_t port);
+static void cmd_udp_stream_off();
+static void cmd_send_udp_frame();
+static void cmd_ota_start(cmd_client_t* c, cJSON* cmd_args, uint16_t tag);
+static bool cmd_ota_rx_ready(cmd_client_t* c);
+static int cmd_ota_rx_data(cmd_client_t* c, char* data, int len);
+static void cmd_ota_advance(cmd_client_t* c, uint32_t len);
+static void cmd_ota_end(cmd_client_t* c, ota_status_t* statusP);
 
 
 
@@ -78,41 +273,48 @@ void cmd_task()
 {
 	char rx_buffer[128];
     char addr_str[16];
-    int byte_offset;
-    int count;
+    fd_set read_fds;
+    fd_set write_fds;
+    bool tx_busy;
     int err;
     int flag;
-    int len;
+    int i;
     int listen_sock;
-    int sock;
+    int max_fd;
     struct sockaddr_in destAddr;
-    struct sockaddr_in sourceAddr;
-    uint32_t addrLen;
-    
+    struct timeval tv;
+	
 	ESP_LOGI(TAG, "Start task");
 	
-	// Loop to setup socket, wait for connection, handle connection.  Terminates
-	// when client disconnects
+	if (cmd_started) {
+		cmd_restart_cleanup();
+	}
+	cmd_started = true;
+	
+	// Setup a listening socket and then serve up to CMD_MAX_CLIENTS connections at
+	// once.  Each client has its own receive buffer and image settings.  Images from
+	// app_task are sent to every client waiting for one.
 	
 	// Wait until WiFi is connected
 	if (!wifi_is_connected()) {
 		vTaskDelay(pdMS_TO_TICKS(500));
 	}
-
+	
 	// Config IPV4
     destAddr.sin_addr.s_addr = htonl(INADDR_ANY);
     destAddr.sin_family = AF_INET;
     destAddr.sin_port = htons(CMD_PORT);
     inet_ntoa_r(destAddr.sin_addr, addr_str, sizeof(addr_str) - 1);
-        
-    // socket - bind - listen - accept
+	
+    // socket - bind - listen
     listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
     if (listen_sock < 0) {
         ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
         goto error;
     }
+    cmd_listen_sock = listen_sock;
     ESP_LOGI(TAG, "Socket created");
-
+	
 	flag = 1;
   	setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
     err = bind(listen_sock, (struct sockaddr *)&destAddr, sizeof(destAddr));
@@ -121,335 +323,1781 @@ void cmd_task()
          goto error;
     }
     ESP_LOGI(TAG, "Socket bound");
-    
+	
+    err = listen(listen_sock, CMD_MAX_CLIENTS);
+    if (err != 0) {
+    	ESP_LOGE(TAG, "Error occured during listen: errno %d", errno);
+    	goto error;
+    }
+    ESP_LOGI(TAG, "Socket listening");
+	
+    for (i=0; i<CMD_MAX_CLIENTS; i++) {
+    	clients[i].sock = -1;
+    	clients[i].lag_bufferP = NULL;
+    }
+    cmd_create_wake_sockets();
+    image_request_outstanding = false;
+    image_held = false;
+    jpeg_budget = 0;
+	
 	while (1) {
-		init_command_processor();
+		health_task_beat(HEALTH_TASK_CMD);
+		
+		// Wait for a new connection, data from any client or room to send more data to
+		// clients with data queued
+		FD_ZERO(&read_fds);
+		FD_ZERO(&write_fds);
+		FD_SET(listen_sock, &read_fds);
+		max_fd = listen_sock;
+		tx_busy = false;
+		if (wake_rx_sock >= 0) {
+			FD_SET(wake_rx_sock, &read_fds);
+			if (wake_rx_sock > max_fd) max_fd = wake_rx_sock;
+		}
+		if (beacon_sock >= 0) {
+			FD_SET(beacon_sock, &read_fds);
+			if (beacon_sock > max_fd) max_fd = beacon_sock;
+		}
+		for (i=0; i<CMD_MAX_CLIENTS; i++) {
+			if (clients[i].sock >= 0) {
+				// A client sending an image waits while all the update buffers are full
+				if (cmd_ota_rx_ready(&clients[i])) {
+					FD_SET(clients[i].sock, &read_fds);
+				}
+				if (cmd_tx_pending(&clients[i])) {
+					FD_SET(clients[i].sock, &write_fds);
+					tx_busy = true;
+				}
+				if (clients[i].sock > max_fd) max_fd = clients[i].sock;
+			}
+		}
+		// Run at full speed while sending so images go out in bursts
+		pm_set_level(PM_USER_CMD, tx_busy ? PM_LEVEL_FAST : PM_LEVEL_SLEEP);
+		
+		tv.tv_sec = 0;
+		tv.tv_usec = CMD_POLL_MSEC * 1000;
+		err = select(max_fd + 1, &read_fds, &write_fds, NULL, &tv);
+		if (err < 0) {
+			ESP_LOGE(TAG, "select failed: errno %d", errno);
+			break;
+		}
+		
+		if (err > 0) {
+			if (FD_ISSET(listen_sock, &read_fds)) {
+				cmd_accept_client(listen_sock);
+			}
+			
+			if ((wake_rx_sock >= 0) && FD_ISSET(wake_rx_sock, &read_fds)) {
+				cmd_drain_wake_socket();
+			}
+			
+			if ((beacon_sock >= 0) && FD_ISSET(beacon_sock, &read_fds)) {
+				cmd_handle_beacon_request();
+			}
 			
-        err = listen(listen_sock, 1);
-        if (err != 0) {
-            ESP_LOGE(TAG, "Error occured during listen: errno %d", errno);
-            break;
-        }
-        ESP_LOGI(TAG, "Socket listening");
-		
-        addrLen = sizeof(sourceAddr);
-        sock = accept(listen_sock, (struct sockaddr *)&sourceAddr, &addrLen);
-        if (sock < 0) {
-            ESP_LOGE(TAG, "Unable to accept connection: errno %d", errno);
-            break;
-        }
-        ESP_LOGI(TAG, "Socket accepted");
-		
-        // Handle communication with client
-        while (1) {
-        	len = recv(sock, rx_buffer, sizeof(rx_buffer) - 1, 0);
-            // Error occured during receiving
-            if (len < 0) {
-                ESP_LOGE(TAG, "recv failed: errno %d", errno);
-                break;
-            }
-            // Connection closed
-            else if (len == 0) {
-                ESP_LOGI(TAG, "Connection closed");
-                break;
-            }
-            // Data received
-            else {
-            	// Initiates handling of commands if one is found
-            	process_rx_data(rx_buffer, len);
-            	
-            	// Wait if we're expecting to send back a response in case another
-            	// task has to come up with it (e.g. an image).  Commands that we
-            	// handle always have an immediate response ready
-            	while (response_expected) {
-            		if (response_available) {
-            			// Write our response to the socket
-            			byte_offset = 0;
-						while (byte_offset < response_length) {
-							len = response_length - byte_offset;
-							if (len > CMD_MAX_TX_PKT_LEN) len = CMD_MAX_TX_PKT_LEN;
-							err = send(sock, &response_buffer[byte_offset], len, 0);
-							                 
-							if (err < 0) {
-								ESP_LOGE(TAG, "Error in socket send: errno %d", errno);
-								break;
-							}
-							byte_offset += err;
-						}
-						
-						if (response_was_image) {
-							// Notify app_task we're done with the shared buffer
-							xTaskNotify(task_handle_app, APP_NOTIFY_CMD_DONE_MASK, eSetBits);
-						}
-						response_expected = false;
-            		} else {
-            			// Look for notifications for a while indicating a response
-            			count = CMD_RESPONSE_WAIT_COUNT_INIT;
-            			while (count-- > 0) {
-            				vTaskDelay(pdMS_TO_TICKS(CMD_RESPONSE_WAIT_TASK_SLEEP_MSEC));
-            				
-            				cmd_task_handle_notifications();
-            				if (response_available) {
-            					count = 0;
-            				}
-            			}
-            			
-            			// Bail if we didn't see a response in time
-            			if (!response_available) {
-            				ESP_LOGW(TAG, "Didn't get response in time - dropping command");
-            				response_expected = false;
-            				if (response_was_image) {
-								xTaskNotify(task_handle_app, APP_NOTIFY_CMD_DONE_MASK, eSetBits);
-							}
-            			}
-            		}
-            	}
-            }
-        }
-        
-        // Close this session
-        if (sock != -1) {
-            ESP_LOGI(TAG, "Shutting down socket and restarting...");
-            shutdown(sock, 0);
-            close(sock);
-        }
+			for (i=0; i<CMD_MAX_CLIENTS; i++) {
+				if ((clients[i].sock >= 0) && FD_ISSET(clients[i].sock, &read_fds)) {
+					cmd_receive(&clients[i], rx_buffer, sizeof(rx_buffer) - 1);
+				}
+				
+				// Send the next chunk of queued data.  Clients are serviced in turn
+				// so a large image to one doesn't hold up responses to the others.
+				if ((clients[i].sock >= 0) && FD_ISSET(clients[i].sock, &write_fds)) {
+					cmd_service_tx(&clients[i]);
+				}
+			}
+		}
+		
+		for (i=0; i<CMD_MAX_CLIENTS; i++) {
+			cmd_check_tx_timeout(&clients[i]);
+		}
+		cmd_check_image_lag();
+#ifdef CMD_ADAPT_JPEG
+		cmd_update_jpeg_budget();
+#endif
+		cmd_check_beacon_socket();
+		
+		// Send images from app_task and request more if clients need them
+		cmd_task_handle_notifications();
+		cmd_update_image_request();
 	}
-
+	
 error:
 	ESP_LOGI(TAG, "Something went seriously wrong with our networking handling - bailing");
+	health_task_stop(HEALTH_TASK_CMD);
 	vTaskDelete(NULL);
 }
 
 
+/**
+ * Called by other tasks to notify cmd_task.  We are woken immediately from waiting for
+ * socket activity to handle the notification.
+ */
+void cmd_task_notify(uint32_t mask)
+{
+	char c = 0;
+	
+	xTaskNotify(task_handle_cmd, mask, eSetBits);
+	if (wake_tx_sock >= 0) {
+		(void) sendto(wake_tx_sock, &c, 1, 0, (struct sockaddr *)&wake_addr, sizeof(wake_addr));
+	}
+}
+
+
+/**
+ * Called by health_task when we have stalled to shut down the client connections in
+ * case we are stuck servicing one of them.  Returns false if there were none.
+ */
+bool cmd_task_recover()
+{
+	bool found = false;
+	int i;
+	int sock;
+	
+	for (i=0; i<CMD_MAX_CLIENTS; i++) {
+		sock = clients[i].sock;
+		if (sock >= 0) {
+			shutdown(sock, SHUT_RDWR);
+			found = true;
+		}
+	}
+	
+	return found;
+}
+
+
 
 //
 // CMD Task internal functions
 //
 
+/**
+ * Close everything a stalled instance of the task had open, releasing the image and
+ * streamed frame it was holding, before starting again
+ */
+static void cmd_restart_cleanup()
+{
+	int i;
+	int sock;
+	
+	if (cmd_listen_sock >= 0) {
+		close(cmd_listen_sock);
+		cmd_listen_sock = -1;
+	}
+	
+	for (i=0; i<CMD_MAX_CLIENTS; i++) {
+		cmd_close_client(&clients[i]);
+	}
+	
+	// Other tasks stop using the wake socket before it is closed
+	sock = wake_tx_sock;
+	wake_tx_sock = -1;
+	if (sock >= 0) close(sock);
+	if (wake_rx_sock >= 0) {
+		close(wake_rx_sock);
+		wake_rx_sock = -1;
+	}
+	
+	if (beacon_sock >= 0) {
+		close(beacon_sock);
+		beacon_sock = -1;
+	}
+	
+	if (udp_streaming) {
+		cmd_udp_stream_off();
+	}
+	if (sys_lep_udp_bufferP != NULL) {
+		xTaskNotify(task_handle_lep, LEP_NOTIFY_UDP_DONE_MASK, eSetBits);
+	}
+}
+
+
+/**
+ * Setup the loopback sockets used by cmd_task_notify.  If this fails notifications
+ * are only seen every CMD_POLL_MSEC.
+ */
+static void cmd_create_wake_sockets()
+{
+	int sock;
+	
+	wake_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	wake_addr.sin_family = AF_INET;
+	wake_addr.sin_port = htons(CMD_WAKE_PORT);
+	
+	sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+	if (sock < 0) {
+		ESP_LOGE(TAG, "Unable to create wake socket: errno %d", errno);
+		return;
+	}
+	if (bind(sock, (struct sockaddr *)&wake_addr, sizeof(wake_addr)) != 0) {
+		ESP_LOGE(TAG, "Wake socket unable to bind: errno %d", errno);
+		close(sock);
+		return;
+	}
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+	
+	// Other tasks send on their own socket so they never share one with us
+	wake_tx_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+	if (wake_tx_sock < 0) {
+		ESP_LOGE(TAG, "Unable to create wake send socket: errno %d", errno);
+		close(sock);
+		return;
+	}
+	fcntl(wake_tx_sock, F_SETFL, fcntl(wake_tx_sock, F_GETFL, 0) | O_NONBLOCK);
+	wake_rx_sock = sock;
+}
+
 
 /**
- * Initialize variables associated with receiving and processing commands
+ * Discard the wake packets (the notifications themselves carry the information)
  */
-static void init_command_processor()
+static void cmd_drain_wake_socket()
 {
-	response_expected = false;
-	response_available = false;
-	response_was_image = false;
-	response_length = 0;
+	char buf[8];
 	
-	rx_circular_push_index = 0;
-	rx_circular_pop_index = 0;
+	while (recv(wake_rx_sock, buf, sizeof(buf), 0) > 0) {}
 }
 
 
 /**
- * Push received data into our circular buffer and see if we can find a complete json
- * string to process.
+ * Accept a new connection into a free client slot, turning it away if there isn't one
  */
-static void process_rx_data(char* data, int len)
+static void cmd_accept_client(int listen_sock)
 {
-	int begin, end, i;
+	int i;
+	int sock;
+	int flag;
+	struct sockaddr_in sourceAddr;
+	uint32_t addrLen;
 	
-	// Push the received data into the circular buffer
-	while (len-- > 0) {
-		rx_circular_buffer[rx_circular_push_index] = *data++;
-		if (++rx_circular_push_index >= CMD_MAX_TCP_RX_BUFFER_LEN) rx_circular_push_index = 0;
+	addrLen = sizeof(sourceAddr);
+	sock = accept(listen_sock, (struct sockaddr *)&sourceAddr, &addrLen);
+	if (sock < 0) {
+		ESP_LOGE(TAG, "Unable to accept connection: errno %d", errno);
+		return;
 	}
 	
-	// See if we can find an entire json string
-	end = in_buffer(CMD_JSON_STRING_STOP);
-	if (end >= 0) {
-		// Found end of packet, look for beginning
-		begin = in_buffer(CMD_JSON_STRING_START);
-		if (begin >= 0) {
-			// Found packet - copy it, without delimiters to json_cmd_string
-			//
-			// Skip past start
-			while (rx_circular_pop_index != begin) {
-				if (++rx_circular_pop_index >= CMD_MAX_TCP_RX_BUFFER_LEN) rx_circular_pop_index = 0;
-			}
-			
-			// Copy up to end
-			i = 0;
-			while ((rx_circular_pop_index != end) && (i < CMD_MAX_TCP_RX_BUFFER_LEN)) {
-				if (i < JSON_MAX_CMD_TEXT_LEN) {
-					json_cmd_string[i] = rx_circular_buffer[rx_circular_pop_index];
-				}
-				i++;
-				if (++rx_circular_pop_index >= CMD_MAX_TCP_RX_BUFFER_LEN) rx_circular_pop_index = 0;
-			}
-			json_cmd_string[i] = 0;               // Make sure this is a null-terminated string
+	for (i=0; i<CMD_MAX_CLIENTS; i++) {
+		if (clients[i].sock < 0) {
+			// Sends never block (we queue data and send it as the socket has room).
+			// Disable Nagle so the tail end of an image or a short response goes
+			// out immediately.
+			fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+			flag = 1;
+			setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
 			
-			// Skip past end
-			if (++rx_circular_pop_index >= CMD_MAX_TCP_RX_BUFFER_LEN) rx_circular_pop_index = 0;
-			
-			if (i < JSON_MAX_CMD_TEXT_LEN+1) {
-				// Process json command string
-				process_rx_packet();
+			init_client(&clients[i], sock);
+			ESP_LOGI(TAG, "Socket accepted for client %d", i);
+			return;
+		}
+	}
+	
+	ESP_LOGW(TAG, "Too many clients - refusing connection");
+	shutdown(sock, 0);
+	close(sock);
+}
+
+
+/**
+ * Close a client's connection and free its slot
+ */
+static void cmd_close_client(cmd_client_t* c)
+{
+	if (c->sock >= 0) {
+		ESP_LOGI(TAG, "Shutting down client socket");
+		shutdown(c->sock, 0);
+		close(c->sock);
+		c->sock = -1;
+	}
+	c->image_requests = 0;
+	c->bench_requested = false;
+	c->list_requested = false;
+	c->streaming = false;
+	c->rsp_length = 0;
+	c->stream.type = JSON_STREAM_NONE;
+	c->stream_length = 0;
+	c->stream_offset = 0;
+	c->img_active = false;
+	c->img_detached = false;
+	c->img_missed = false;
+	if (c->ota_active) {
+		// Abort an update we didn't finish sending
+		c->ota_active = false;
+		ota_task_release();
+	}
+	c->ota_remaining = 0;
+	c->ota_bufP = NULL;
+	if (c->lag_bufferP != NULL) {
+		heap_caps_free(c->lag_bufferP);
+		c->lag_bufferP = NULL;
+	}
+	
+	// This may have been the last client using the image
+	cmd_check_image_done();
+}
+
+
+/**
+ * Initialize variables associated with receiving and processing commands for a new
+ * client
+ */
+static void init_client(cmd_client_t* c, int sock)
+{
+	c->sock = sock;
+	
+	// Each connection starts with json images and no stream
+	c->image_format = CMD_IMG_FMT_JSON;
+	c->image_requests = 0;
+	c->bench_requested = false;
+	c->list_requested = false;
+	c->streaming = false;
+	
+	c->rx_cmd_len = -1;
+	
+	c->rsp_length = 0;
+	c->rsp_offset = 0;
+	c->stream.type = JSON_STREAM_NONE;
+	c->stream_length = 0;
+	c->stream_offset = 0;
+	c->stream_at = 0;
+	c->img_active = false;
+	c->tx_tos = WIFI_TOS_BULK;
+	
+	c->lag_alloc_failed = false;
+	c->img_detached = false;
+	c->img_missed = false;
+	
+	c->tx_rate = 0;
+	c->jpeg_budget = 0;
+	
+	c->ota_active = false;
+	c->ota_remaining = 0;
+	c->ota_bufP = NULL;
+}
+
+
+/**
+ * Receive data from a client.  Image data for an update is received straight into the
+ * update buffer.
+ */
+static void cmd_receive(cmd_client_t* c, char* rx_buffer, int rx_len)
+{
+	bool to_ota;
+	char* bufP;
+	int len;
+	
+	to_ota = (c->ota_remaining > 0) && !c->ota_discard && (c->ota_bufP != NULL);
+	if (to_ota) {
+		bufP = (char*) c->ota_bufP + c->ota_fill;
+		len = OTA_BUFFER_LEN - c->ota_fill;
+		if (len > c->ota_remaining) len = c->ota_remaining;
+	} else {
+		bufP = rx_buffer;
+		len = rx_len;
+	}
+	
+	len = recv(c->sock, bufP, len, 0);
+	if (len < 0) {
+		ESP_LOGE(TAG, "recv failed: errno %d", errno);
+		cmd_close_client(c);
+	} else if (len == 0) {
+		ESP_LOGI(TAG, "Connection closed");
+		cmd_close_client(c);
+	} else if (to_ota) {
+		cmd_ota_advance(c, len);
+	} else {
+		// Initiates handling of commands if one is found
+		process_rx_data(c, rx_buffer, len);
+	}
+}
+
+
+/**
+ * Collect received data into the client's command buffer, processing each complete
+ * json string as its end delimiter arrives.  Data outside of delimiters is ignored.
+ * Data following an ota_update command is part of the image.
+ */
+static void process_rx_data(cmd_client_t* c, char* data, int len)
+{
+	char ch;
+	int n;
+	
+	while (len > 0) {
+		if (c->ota_remaining > 0) {
+			n = cmd_ota_rx_data(c, data, len);
+			data += n;
+			len -= n;
+			continue;
+		}
+		
+		len--;
+		ch = *data++;
+		if (ch == CMD_JSON_STRING_START) {
+			// Start a new command, discarding any unterminated one
+			c->rx_cmd_len = 0;
+			c->rx_cmd_overflow = false;
+		} else if (c->rx_cmd_len < 0) {
+			// Skip data outside of a command
+			continue;
+		} else if (ch == CMD_JSON_STRING_STOP) {
+			if (c->rx_cmd_overflow) {
+				ESP_LOGE(TAG, "Command too long - discarded");
+			} else {
+				c->rx_cmd_buffer[c->rx_cmd_len] = 0;
+				process_rx_packet(c);
 			}
+			c->rx_cmd_len = -1;
+		} else if (c->rx_cmd_len < JSON_MAX_CMD_TEXT_LEN) {
+			c->rx_cmd_buffer[c->rx_cmd_len++] = ch;
 		} else {
-			// Unexpected end without start - skip it
-			while (rx_circular_pop_index != end) {
-				if (++rx_circular_pop_index >= CMD_MAX_TCP_RX_BUFFER_LEN) rx_circular_pop_index = 0;
-			}
+			c->rx_cmd_overflow = true;
 		}
 	}
 }
 
 
-static void process_rx_packet()
+static void process_rx_packet(cmd_client_t* c)
 {
 	char ap_ssid[PS_SSID_MAX_LEN+1];
 	char sta_ssid[PS_SSID_MAX_LEN+1];
 	char ap_pw[PS_PW_MAX_LEN+1];
 	char sta_pw[PS_PW_MAX_LEN+1];
+	char* response_buffer;
 	cJSON* json_obj;
+	uint8_t udp_ip_addr[4];
+	uint16_t udp_port;
+	struct sockaddr_in peer_addr;
+	socklen_t peer_addr_len;
+#ifdef INCLUDE_SYS_BENCH
+	uint16_t bench_port;
+#endif
+	xfer_request_t xfer_req;
+	sched_window_t sched_w;
 	cJSON* cmd_args;
 	gui_state_t new_gui_st;
+	bool has_args;
+	bool update_lepton;
+	bool clear;
 	int cmd;
+	int sync_mode;
+	int sched_n;
+	uint16_t tag;
 	tmElements_t te;
+	uint32_t response_length;
 	wifi_info_t new_wifi_info;
 	
-	response_expected = false; // Will be set true if necessary
-	response_available = false;
-		
-	// Create a json object to parse
-	json_obj = json_get_cmd_object(json_cmd_string);
-	if (json_obj != NULL) {
-		if (json_parse_cmd(json_obj, &cmd, &cmd_args)) {
-			switch (cmd) {
-				case CMD_GET_STATUS:
-					response_buffer = json_get_status(&response_length);
-					ESP_LOGI(TAG, "cmd " CMD_GET_STATUS_S);
-					if (response_length != 0) {
-						response_expected = true;
-						response_available = true;
-						response_was_image = false;
-					}
-					break;
-					
-				case CMD_GET_IMAGE:
-					ESP_LOGI(TAG, "cmd " CMD_GET_IMAGE_S);
-					response_buffer = sys_cmd_response_buffer.bufferP;
-					response_expected = true;
-					response_available = false;
-					xTaskNotify(task_handle_app, APP_NOTIFY_CMD_REQ_MASK, eSetBits);
-					break;
-					
-				case CMD_SET_TIME:					
-					ESP_LOGI(TAG, "cmd " CMD_SET_TIME_S);
-					if (json_parse_set_time(cmd_args, &te)) {
-						time_set(te);
-					}
-					break;
-				
-				case CMD_GET_WIFI:
-					response_buffer = json_get_wifi(&response_length);
-					ESP_LOGI(TAG, "cmd " CMD_GET_WIFI_S);
-					if (response_length != 0) {
-						response_expected = true;
-						response_available = true;
-						response_was_image = false;
-					}
-					break;
-					
-				case CMD_SET_WIFI:
-					new_wifi_info.ap_ssid = ap_ssid;
-					new_wifi_info.sta_ssid = sta_ssid;
-					new_wifi_info.ap_pw = ap_pw;
-					new_wifi_info.sta_pw = sta_pw;
-					ESP_LOGI(TAG, "cmd " CMD_SET_WIFI_S);
-					if (json_parse_set_wifi(cmd_args, &new_wifi_info)) {
-						ps_set_wifi_info(&new_wifi_info);
-						xTaskNotify(task_handle_app, APP_NOTIFY_NEW_WIFI_MASK, eSetBits);
-					}
-					break;
-				
-				case CMD_GET_CONFIG:
-					response_buffer = json_get_config(&response_length);
-					ESP_LOGI(TAG, "cmd " CMD_GET_CONFIG_S);
-					if (response_length != 0) {
-						response_expected = true;
-						response_available = true;
-						response_was_image = false;
-					}
-					break;
-					
-				case CMD_SET_CONFIG:
-					ESP_LOGI(TAG, "cmd " CMD_SET_CONFIG_S);
-					if (json_parse_set_config(cmd_args, &new_gui_st)) {
-						// Look for changed items that require updating other modules
-						if (new_gui_st.gain_mode != gui_st.gain_mode) {
-							lepton_gain_mode(new_gui_st.gain_mode);
-						}
-						gui_st = new_gui_st;
-						ps_set_gui_state(&gui_st);
-						xTaskNotify(task_handle_app, APP_NOTIFY_RECORD_PARM_UPD_MASK, eSetBits);
-					}
-					break;
-				
-				case CMD_RECORD_ON:
-					ESP_LOGI(TAG, "cmd " CMD_RECORD_ON_S);
-					xTaskNotify(task_handle_app, APP_NOTIFY_START_RECORD_MASK, eSetBits);
-					break;
-				
-				case CMD_RECORD_OFF:
-					ESP_LOGI(TAG, "cmd " CMD_RECORD_OFF_S);
-					xTaskNotify(task_handle_app, APP_NOTIFY_STOP_RECORD_MASK, eSetBits);
-					break;
-					
-				case CMD_POWEROFF:
-					ESP_LOGI(TAG, "cmd " CMD_POWEROFF_S);
-					xTaskNotify(task_handle_app, APP_NOTIFY_SHUTDOWN_MASK, eSetBits);
-					break;
-				
-				default:
-					ESP_LOGE(TAG, "Unknown command in json string: %s", json_cmd_string);
-			}
-		} else {
-			ESP_LOGE(TAG, "Unknown type of json string: %s", json_cmd_string);
+	// Commands without arguments are recognized in place.  Only commands with arguments
+	// are parsed into a json object.
+	json_obj = NULL;
+	cmd_args = NULL;
+	if (!json_scan_cmd(c->rx_cmd_buffer, &cmd, &tag, &has_args)) {
+		ESP_LOGE(TAG, "Unknown type of json string: %s", c->rx_cmd_buffer);
+		return;
+	}
+	if (has_args) {
+		json_obj = json_get_cmd_object(c->rx_cmd_buffer);
+		if (json_obj == NULL) {
+			ESP_LOGE(TAG, "Couldn't convert json string: %s", c->rx_cmd_buffer);
+			return;
 		}
+		if (!json_parse_cmd(json_obj, &cmd, &tag, &cmd_args)) {
+			ESP_LOGE(TAG, "Unknown type of json string: %s", c->rx_cmd_buffer);
+			json_free_cmd(json_obj);
+			return;
+		}
+	}
+	
+	switch (cmd) {
+		case CMD_GET_STATUS:
+			response_buffer = json_get_status(&response_length);
+			ESP_LOGI(TAG, "cmd " CMD_GET_STATUS_S);
+			cmd_queue_response(c, response_buffer, response_length, tag);
+			break;
 		
-		json_free_cmd(json_obj);
-	} else {
-		ESP_LOGE(TAG, "Couldn't convert json string: %s", json_cmd_string);
+		case CMD_GET_PERF:
+			ESP_LOGI(TAG, "cmd " CMD_GET_PERF_S);
+			cmd_queue_stream(c, JSON_STREAM_PERF, tag);
+			break;
+		
+		case CMD_GET_IMAGE:
+			// Each request is answered, in order, with app_task's latest images or, for
+			// a fresh request, one of the next images we get from app_task
+			ESP_LOGI(TAG, "cmd " CMD_GET_IMAGE_S);
+			if (c->image_requests < CMD_MAX_IMAGE_REQUESTS) {
+				json_parse_get_image(cmd_args, &c->image_fresh[c->image_requests]);
+				c->image_tags[c->image_requests++] = tag;
+			} else {
+				ESP_LOGW(TAG, "Too many get_image requests - dropping request");
+			}
+			break;
+		
+		case CMD_SET_IMG_FMT:
+			ESP_LOGI(TAG, "cmd " CMD_SET_IMG_FMT_S);
+			(void) json_parse_set_image_format(cmd_args, &c->image_format);
+			break;
+		
+		case CMD_STREAM_ON:
+			ESP_LOGI(TAG, "cmd " CMD_STREAM_ON_S);
+			json_parse_stream_on(cmd_args, &c->stream_period, &c->stream_contents);
+			c->stream_cnt = 0;
+			c->streaming = true;
+			break;
+		
+		case CMD_STREAM_OFF:
+			ESP_LOGI(TAG, "cmd " CMD_STREAM_OFF_S);
+			c->streaming = false;
+			break;
+		
+		case CMD_UDP_ON:
+			ESP_LOGI(TAG, "cmd " CMD_UDP_ON_S);
+			if (json_parse_udp_stream_on(cmd_args, udp_ip_addr, &udp_port)) {
+				cmd_udp_stream_on(udp_ip_addr, udp_port);
+			}
+			break;
+		
+		case CMD_UDP_OFF:
+			ESP_LOGI(TAG, "cmd " CMD_UDP_OFF_S);
+			cmd_udp_stream_off();
+			break;
+		
+		case CMD_SET_TIME:					
+			ESP_LOGI(TAG, "cmd " CMD_SET_TIME_S);
+			if (json_parse_set_time(cmd_args, &te)) {
+				time_set(te);
+			}
+			break;
+		
+		case CMD_GET_WIFI:
+			response_buffer = json_get_wifi(&response_length);
+			ESP_LOGI(TAG, "cmd " CMD_GET_WIFI_S);
+			cmd_queue_response(c, response_buffer, response_length, tag);
+			break;
+		
+		case CMD_SET_WIFI:
+			new_wifi_info.ap_ssid = ap_ssid;
+			new_wifi_info.sta_ssid = sta_ssid;
+			new_wifi_info.ap_pw = ap_pw;
+			new_wifi_info.sta_pw = sta_pw;
+			ESP_LOGI(TAG, "cmd " CMD_SET_WIFI_S);
+			if (json_parse_set_wifi(cmd_args, &new_wifi_info)) {
+				ps_set_wifi_info(&new_wifi_info);
+				xTaskNotify(task_handle_app, APP_NOTIFY_NEW_WIFI_MASK, eSetBits);
+			}
+			break;
+		
+		case CMD_GET_CONFIG:
+			response_buffer = json_get_config(&response_length);
+			ESP_LOGI(TAG, "cmd " CMD_GET_CONFIG_S);
+			cmd_queue_response(c, response_buffer, response_length, tag);
+			break;
+		case CMD_SET_CONFIG:
+			ESP_LOGI(TAG, "cmd " CMD_SET_CONFIG_S);
+			if (json_parse_set_config(cmd_args, &new_gui_st)) {
+				// Look for changed items that require updating other modules
+				update_lepton = (new_gui_st.gain_mode != gui_st.gain_mode);
+				gui_st = new_gui_st;
+				ps_set_gui_state(&gui_st);
+				if (update_lepton) {
+					// lep_task applies the new gain mode from persistent storage between frames
+					xTaskNotify(task_handle_lep, LEP_NOTIFY_GAIN_MASK, eSetBits);
+				}
+				xTaskNotify(task_handle_app, APP_NOTIFY_RECORD_PARM_UPD_MASK, eSetBits);
+			}
+			break;
+		
+		case CMD_SET_FUSION_CAL:
+			ESP_LOGI(TAG, "cmd " CMD_SET_FUSION_CAL_S);
+			if (json_parse_set_fusion_cal(cmd_args, &new_gui_st)) {
+				// The GUI rebuilds its remap tables when it sees the new calibration
+				gui_st = new_gui_st;
+				ps_set_gui_state(&gui_st);
+			}
+			break;
+		
+		case CMD_CAL_LEPTON:
+			ESP_LOGI(TAG, "cmd " CMD_CAL_LEPTON_S);
+			json_parse_calibrate_lepton(cmd_args, &clear);
+			xTaskNotify(task_handle_lep, clear ? LEP_NOTIFY_CORR_CLEAR_MASK : LEP_NOTIFY_CORR_CAL_MASK, eSetBits);
+			break;
+		
+		case CMD_RECORD_ON:
+			ESP_LOGI(TAG, "cmd " CMD_RECORD_ON_S);
+			xTaskNotify(task_handle_app, APP_NOTIFY_START_RECORD_MASK, eSetBits);
+			break;
+		
+		case CMD_RECORD_OFF:
+			ESP_LOGI(TAG, "cmd " CMD_RECORD_OFF_S);
+			xTaskNotify(task_handle_app, APP_NOTIFY_STOP_RECORD_MASK, eSetBits);
+			break;
+		
+		case CMD_DUMP_TRACE:
+			ESP_LOGI(TAG, "cmd " CMD_DUMP_TRACE_S);
+#ifdef INCLUDE_SYS_TRACE
+			xTaskNotify(task_handle_file, FILE_NOTIFY_DUMP_TRACE_MASK, eSetBits);
+#else
+			ESP_LOGE(TAG, "Notification trace not included in this build");
+#endif
+			break;
+		
+		case CMD_RUN_BENCH:
+			ESP_LOGI(TAG, "cmd " CMD_RUN_BENCH_S);
+#ifdef INCLUDE_SYS_BENCH
+			// The TCP send benchmark connects back to the client's tcp_port
+			json_parse_run_benchmark(cmd_args, &bench_port);
+			peer_addr_len = sizeof(peer_addr);
+			if (getpeername(c->sock, (struct sockaddr *)&peer_addr, &peer_addr_len) != 0) {
+				bench_port = 0;
+			}
+			(void) bench_task_request(peer_addr.sin_addr.s_addr, bench_port);
+			c->bench_requested = true;
+			c->bench_tag = tag;
+#else
+			ESP_LOGE(TAG, "Benchmarks not included in this build");
+#endif
+			break;
+		
+		case CMD_LIST_SESSIONS:
+			ESP_LOGI(TAG, "cmd " CMD_LIST_SESSIONS_S);
+			(void) xfer_task_request_list();
+			c->list_requested = true;
+			c->list_tag = tag;
+			break;
+		
+		case CMD_GET_FILE:
+		case CMD_GET_SESSION:
+			ESP_LOGI(TAG, "cmd %s", (cmd == CMD_GET_FILE) ? CMD_GET_FILE_S : CMD_GET_SESSION_S);
+			// xfer_task connects back to the client's tcp_port to send the data
+			if (json_parse_get_file(cmd_args, cmd == CMD_GET_SESSION, &xfer_req)) {
+				peer_addr_len = sizeof(peer_addr);
+				if (getpeername(c->sock, (struct sockaddr *)&peer_addr, &peer_addr_len) == 0) {
+					xfer_req.tcp_addr = peer_addr.sin_addr.s_addr;
+					(void) xfer_task_request_send(&xfer_req);
+				}
+			} else {
+				ESP_LOGE(TAG, "Illegal transfer request");
+			}
+			break;
+		
+		case CMD_PREP_CARD:
+			ESP_LOGI(TAG, "cmd " CMD_PREP_CARD_S);
+			xTaskNotify(task_handle_file, FILE_NOTIFY_PREP_CARD_MASK, eSetBits);
+			break;
+		
+		case CMD_SET_SYNC:
+			ESP_LOGI(TAG, "cmd " CMD_SET_SYNC_S);
+			if (json_parse_set_sync(cmd_args, &sync_mode)) {
+				sync_task_set_mode(sync_mode);
+			}
+			break;
+		
+		case CMD_SET_UPLOAD:
+			ESP_LOGI(TAG, "cmd " CMD_SET_UPLOAD_S);
+			if (json_parse_set_upload(cmd_args, udp_ip_addr, &udp_port)) {
+				upload_task_set_server(udp_ip_addr, udp_port);
+			}
+			break;
+		
+		case CMD_GET_SCHED:
+			response_buffer = json_get_schedule(&response_length);
+			ESP_LOGI(TAG, "cmd " CMD_GET_SCHED_S);
+			cmd_queue_response(c, response_buffer, response_length, tag);
+			break;
+		
+		case CMD_SET_SCHED:
+			ESP_LOGI(TAG, "cmd " CMD_SET_SCHED_S);
+			// app_task switches to the new window values at the top of the next second
+			if (json_parse_set_schedule(cmd_args, &sched_n, &sched_w)) {
+				(void) sched_set_window(sched_n, &sched_w);
+			}
+			break;
+		
+		case CMD_OTA_UPDATE:
+			ESP_LOGI(TAG, "cmd " CMD_OTA_UPDATE_S);
+			cmd_ota_start(c, cmd_args, tag);
+			break;
+		
+		case CMD_POWEROFF:
+			ESP_LOGI(TAG, "cmd " CMD_POWEROFF_S);
+			xTaskNotify(task_handle_app, APP_NOTIFY_SHUTDOWN_MASK, eSetBits);
+			break;
+		
+		default:
+			ESP_LOGE(TAG, "Unknown command in json string: %s", c->rx_cmd_buffer);
 	}
+	
+	json_free_cmd(json_obj);
 }
 
 
+
+
 /**
- * Process notifications from other tasks
+ * Process notifications from app_task that an image is ready for our clients or an
+ * alarm event started or ended, from lep_task that a frame is ready for the UDP stream
+ * from bench_task that a benchmark run is done, from xfer_task that a session list
+ * is ready and from ota_task that an update buffer is free or the update is done
  */
 static void cmd_task_handle_notifications()
 {
+	bool binary_valid;
+	bool json_valid;
+	char* response_buffer;
+	int i;
+	ota_status_t ota_status;
 	uint32_t notification_value;
+	uint32_t response_length;
 	
 	notification_value = 0;
 	if (xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, 0)) {
-		if (Notification(notification_value, CMD_NOTIFY_IMAGE_MASK)) {
-			response_available = true;
-			response_length = sys_cmd_response_buffer.length;
-			response_was_image = true;
+		json_valid = Notification(notification_value, CMD_NOTIFY_IMAGE_MASK);
+		binary_valid = Notification(notification_value, CMD_NOTIFY_BIN_IMAGE_MASK);
+		if (Notification(notification_value, CMD_NOTIFY_LEP_FRAME_MASK)) {
+			cmd_send_udp_frame();
+			xTaskNotify(task_handle_lep, LEP_NOTIFY_UDP_DONE_MASK, eSetBits);
+		}
+		
+		if (Notification(notification_value, CMD_NOTIFY_ALARM_MASK)) {
+			// Tell every client about the alarm event
+			response_buffer = json_get_alarm(&response_length);
+			if (response_buffer != NULL) {
+				for (i=0; i<CMD_MAX_CLIENTS; i++) {
+					if (clients[i].sock >= 0) {
+						cmd_queue_response(&clients[i], response_buffer, response_length, 0);
+					}
+				}
+			}
+		}
+		
+#ifdef INCLUDE_SYS_BENCH
+		if (Notification(notification_value, CMD_NOTIFY_BENCH_MASK)) {
+			// Send the results to the clients that asked for them
+			response_buffer = json_get_benchmark(&response_length);
+			for (i=0; i<CMD_MAX_CLIENTS; i++) {
+				if ((clients[i].sock >= 0) && clients[i].bench_requested) {
+					if (response_buffer != NULL) {
+						cmd_queue_response(&clients[i], response_buffer, response_length, clients[i].bench_tag);
+					}
+					clients[i].bench_requested = false;
+				}
+			}
+		}
+#endif
+		
+		if (Notification(notification_value, CMD_NOTIFY_XFER_MASK)) {
+			// Send the session list to the clients that asked for it
+			for (i=0; i<CMD_MAX_CLIENTS; i++) {
+				if ((clients[i].sock >= 0) && clients[i].list_requested) {
+					cmd_queue_stream(&clients[i], JSON_STREAM_SESSIONS, clients[i].list_tag);
+					clients[i].list_requested = false;
+				}
+			}
+		}
+		
+		if (Notification(notification_value, CMD_NOTIFY_OTA_MASK)) {
+			// Send the result to the client whose update is done.  Freed buffers are
+			// picked up when its socket is next selected.
+			ota_task_get_status(&ota_status);
+			if (ota_status.state != OTA_STATE_ACTIVE) {
+				for (i=0; i<CMD_MAX_CLIENTS; i++) {
+					if ((clients[i].sock >= 0) && clients[i].ota_active) {
+						cmd_ota_end(&clients[i], &ota_status);
+					}
+				}
+			}
+		}
+		
+		if (json_valid || binary_valid) {
+			image_held = true;
+			image_held_json = json_valid;
+			image_held_binary = binary_valid;
+			image_held_usec = esp_timer_get_time();
+			lep_cropped = lepton_get_crop(&lep_crop);
+			lep_z_valid = false;
+			crop_valid = false;
+			preview_valid = false;
+			image_request_outstanding = false;
+			cmd_send_images(json_valid, binary_valid);
+			
+			// Release it now if no-one wanted it
+			cmd_check_image_done();
 		}
 	}
 }
 
 
 /**
- * Look for c in the rx_circular_buffer and return its location if found, -1 otherwise
+ * Ask app_task for the next image, in the formats our clients need, if any of them
+ * are waiting for one.  Requests that don't get an image in time are dropped.
  */
-static int in_buffer(char c)
+static void cmd_update_image_request()
 {
+	bool binary = false;
+	bool cached = false;
+	bool json = false;
 	int i;
+	uint8_t json_contents = 0;
 	
-	i = rx_circular_pop_index;
-	while (i != rx_circular_push_index) {
-		if (c == rx_circular_buffer[i]) {
-			return i;
-		} else {
-			if (i++ >= CMD_MAX_TCP_RX_BUFFER_LEN) i = 0;
+	// Wait until our clients are done sending the image we have (app_task can't give us
+	// a new one until then)
+	if (image_held) return;
+	
+	if (image_request_outstanding) {
+		if ((esp_timer_get_time() - image_request_usec) < (CMD_RESPONSE_MAX_WAIT_MSEC * 1000)) {
+			return;
+		}
+		
+		ESP_LOGW(TAG, "Didn't get image in time - dropping request");
+		image_request_outstanding = false;
+		for (i=0; i<CMD_MAX_CLIENTS; i++) {
+			clients[i].image_requests = 0;
 		}
 	}
 	
-	return -1;
+	for (i=0; i<CMD_MAX_CLIENTS; i++) {
+		if ((clients[i].sock >= 0) && ((clients[i].image_requests > 0) || clients[i].streaming)) {
+			if (clients[i].image_format != CMD_IMG_FMT_JSON) {
+				binary = true;
+			} else {
+				json = true;
+				json_contents |= (clients[i].image_requests > 0) ? IMG_CONTENT_ALL : clients[i].stream_contents;
+			}
+			
+			// A request that can be answered now lets app_task send its latest images
+			if ((clients[i].image_requests > 0) && !clients[i].image_fresh[0]) {
+				cached = true;
+			}
+		}
+	}
+	
+	if (json || binary) {
+		app_task_request_cmd_image(json, binary, json_contents, cached);
+		image_request_outstanding = true;
+		image_request_usec = esp_timer_get_time();
+	}
+}
+
+
+/**
+ * Queue the image app_task is holding for us to every client that wants it.  Clients
+ * still sending their copy of an older image skip it.
+ */
+static void cmd_send_images(bool json_valid, bool binary_valid)
+{
+	int i;
+	
+	for (i=0; i<CMD_MAX_CLIENTS; i++) {
+		if (clients[i].sock < 0) continue;
+		
+		if (clients[i].img_active) {
+			clients[i].img_missed = true;
+		} else {
+			cmd_send_image(&clients[i], json_valid, binary_valid);
+		}
+	}
+}
+
+
+/**
+ * Queue the held image to one client if it wants it
+ */
+static void cmd_send_image(cmd_client_t* c, bool json_valid, bool binary_valid)
+{
+	bool request;
+	uint8_t contents;
+	uint16_t tag;
+	
+	if (c->image_format != CMD_IMG_FMT_JSON) {
+		if (binary_valid && cmd_client_wants_image(c, &contents, &tag, &request)) {
+			cmd_queue_binary_image(c, contents, tag);
+		}
+	} else {
+		if (json_valid && cmd_client_wants_image(c, &contents, &tag, &request)) {
+			cmd_queue_json_image(c, tag, request);
+		}
+	}
+}
+
+
+/**
+ * Determine if a client should get the current image, the IMG_CONTENT_* items it
+ * should contain and its tag.  get_image responses always contain everything so a
+ * json image built for streaming clients with fewer items doesn't satisfy a request.
+ * The image answers the oldest request.  Streamed images are untagged.  A cached image
+ * (app_task's latest images sent without waiting for the next second) doesn't answer a
+ * fresh request and isn't streamed.  request is set for an answer to a request.
+ */
+static bool cmd_client_wants_image(cmd_client_t* c, uint8_t* contents, uint16_t* tag, bool* request)
+{
+	bool stream_due = false;
+	int i;
+	
+	if (sys_cmd_cached) {
+		if ((c->image_requests == 0) || c->image_fresh[0]) return false;
+	} else if (c->streaming) {
+		if (++c->stream_cnt >= c->stream_period) {
+			c->stream_cnt = 0;
+			stream_due = true;
+		}
+	}
+	
+	if (c->image_requests > 0) {
+		if ((c->image_format != CMD_IMG_FMT_JSON) || ((sys_cmd_contents & IMG_CONTENT_ALL) == IMG_CONTENT_ALL)) {
+			*tag = c->image_tags[0];
+			for (i=1; i<c->image_requests; i++) {
+				c->image_tags[i-1] = c->image_tags[i];
+				c->image_fresh[i-1] = c->image_fresh[i];
+			}
+			c->image_requests--;
+			*contents = IMG_CONTENT_ALL;
+			*request = true;
+			return true;
+		}
+	}
+	
+	if (stream_due) {
+		*tag = 0;
+		*contents = c->stream_contents;
+		*request = false;
+		return true;
+	}
+	
+	return false;
+}
+
+
+/**
+ * Queue a command response to a client.  The response is copied since the json
+ * response buffers are reused for the next command.  A non-zero tag is added as the
+ * first item of the response object.
+ */
+static void cmd_queue_response(cmd_client_t* c, char* buf, uint32_t length, uint16_t tag)
+{
+	char prefix[CMD_TAG_PREFIX_LEN];
+	int prefix_len;
+	
+	if (length == 0) return;
+	
+	// Responses start with the delimitor and '{'
+	if (tag != 0) {
+		prefix_len = sprintf(prefix, "%c{\"tag\":%u,", CMD_JSON_STRING_START, tag);
+		buf += 2;
+		length -= 2;
+	} else {
+		prefix_len = 0;
+	}
+	
+	// Discard any response that has already been sent
+	if (c->rsp_offset == c->rsp_length) {
+		c->rsp_length = 0;
+		c->rsp_offset = 0;
+		c->stream_at = 0;
+	}
+	
+	if ((c->rsp_length + prefix_len + length) > JSON_MAX_RSP_TEXT_LEN) {
+		ESP_LOGW(TAG, "Client response buffer full - dropping response");
+		return;
+	}
+	
+	memcpy(&c->rsp_buffer[c->rsp_length], prefix, prefix_len);
+	memcpy(&c->rsp_buffer[c->rsp_length + prefix_len], buf, length);
+	if (!cmd_tx_pending(c)) {
+		c->tx_progress_usec = esp_timer_get_time();
+	}
+	c->rsp_length += prefix_len + length;
+}
+
+
+/**
+ * Queue a streamed response to a client.  It is sent after the responses already
+ * queued and is generated as it is sent so it isn't limited by the response buffer.
+ * A client can only have one streamed response at a time.
+ */
+static void cmd_queue_stream(cmd_client_t* c, int type, uint16_t tag)
+{
+	if (cmd_stream_active(c)) {
+		ESP_LOGW(TAG, "Client already has a streamed response - dropping response");
+		return;
+	}
+	
+	// Discard any response that has already been sent
+	if (c->rsp_offset == c->rsp_length) {
+		c->rsp_length = 0;
+		c->rsp_offset = 0;
+	}
+	
+	if (!cmd_tx_pending(c)) {
+		c->tx_progress_usec = esp_timer_get_time();
+	}
+	json_stream_start(&c->stream, type, tag);
+	c->stream_length = 0;
+	c->stream_offset = 0;
+	c->stream_at = c->rsp_length;
+}
+
+
+/**
+ * Queue the json image in the shared image buffer to a client.  Images are sent in
+ * place so we add their delimitors, and the tag if there is one, here.  They also start
+ * with the age of the image in mSec when its object has items to follow it (get_image
+ * responses, request set, always do).
+ */
+static void cmd_queue_json_image(cmd_client_t* c, uint16_t tag, bool request)
+{
+	uint32_t age;
+	int n;
+	
+	if ((tag != 0) || request || (sys_image_buffer.length > 2)) {
+		n = sprintf(c->img_tag_buffer, "%c{", CMD_JSON_STRING_START);
+		if (tag != 0) {
+			n += sprintf(&c->img_tag_buffer[n], "\"tag\":%u,", tag);
+		}
+		age = (uint32_t) ((esp_timer_get_time() - sys_cmd_image_usec) / 1000);
+		n += sprintf(&c->img_tag_buffer[n], "\"age\":%u,", age);
+		c->img_seg[0].bufP = c->img_tag_buffer;
+		c->img_seg[0].length = n;
+		c->img_seg[1].bufP = sys_image_buffer.bufferP + 1;     // Skip its '{'
+		c->img_seg[1].length = sys_image_buffer.length - 1;
+	} else {
+		c->img_seg[0].bufP = &json_image_start;
+		c->img_seg[0].length = 1;
+		c->img_seg[1].bufP = sys_image_buffer.bufferP;
+		c->img_seg[1].length = sys_image_buffer.length;
+	}
+	c->img_seg[2].bufP = &json_image_stop;
+	c->img_seg[2].length = 1;
+	c->img_seg_count = 3;
+	if ((sys_cmd_cam_bufferP != NULL) && ((sys_cmd_contents & IMG_CONTENT_CAM) != 0)) {
+		cmd_start_image(c, BASE64_ENC_LEN(sys_cmd_cam_bufferP->cam_buffer_len), true);
+	} else {
+		cmd_start_image(c, 0, true);
+	}
+}
+
+
+/**
+ * Queue the image app_task is holding for us to a client as a binary image record with
+ * the IMG_CONTENT_* items in contents.  The header contains the lengths of everything
+ * that follows it so the client can read the complete image without scanning for a
+ * delimitor.  It also holds the tag and the metadata ends with the age of the image.
+ */
+static void cmd_queue_binary_image(cmd_client_t* c, uint8_t contents, uint16_t tag)
+{
+	binrec_header_t* hdrP = (binrec_header_t*) c->bin_header_buffer;
+	int n = 0;
+	uint32_t z_len = 0;
+	
+	if ((sys_cmd_lep_bufferP != NULL) && ((contents & IMG_CONTENT_PREVIEW) != 0)) {
+		z_len = cmd_get_preview_len();
+	} else if ((c->image_format == CMD_IMG_FMT_BINARY_Z) && (sys_cmd_lep_bufferP != NULL) &&
+	           ((contents & IMG_CONTENT_LEP) != 0)) {
+		z_len = cmd_get_lep_z_len();
+	}
+	
+	c->img_seg[n].bufP = (char*) c->bin_header_buffer;
+	c->img_seg[n].length = binrec_build_header(c->bin_header_buffer, sys_cmd_seq_num, sys_cmd_cam_bufferP, sys_cmd_lep_bufferP, contents, z_len,
+	                                           &lep_crop);
+	c->img_seg[n++].length = binrec_add_age(c->bin_header_buffer, (uint32_t) ((esp_timer_get_time() - sys_cmd_image_usec) / 1000));
+	hdrP->tag = tag;
+	
+	// Followed by the payloads the header says are present
+	if (hdrP->jpeg_len != 0) {
+		c->img_seg[n].bufP = (char*) sys_cmd_cam_bufferP->cam_bufferP;
+		c->img_seg[n++].length = hdrP->jpeg_len;
+	}
+	if (hdrP->lep_len != 0) {
+		if (hdrP->lep_codec == BINREC_LEP_CODEC_RADZ) {
+			c->img_seg[n].bufP = (char*) cmd_lep_z_bufferP;
+		} else if (hdrP->lep_codec == BINREC_LEP_CODEC_PREVIEW) {
+			c->img_seg[n].bufP = (char*) preview_buffer;
+		} else if (lep_cropped) {
+			c->img_seg[n].bufP = (char*) cmd_get_crop_buffer();
+		} else {
+			c->img_seg[n].bufP = (char*) sys_cmd_lep_bufferP->lep_bufferP;
+		}
+		c->img_seg[n++].length = hdrP->lep_len;
+	}
+	if (hdrP->telem_len != 0) {
+		c->img_seg[n].bufP = (char*) sys_cmd_lep_bufferP->lep_telemP;
+		c->img_seg[n++].length = hdrP->telem_len;
+	}
+	c->img_seg_count = n;
+	cmd_start_image(c, hdrP->jpeg_len, false);
+}
+
+
+/**
+ * Compress the held radiometric image (its crop) the first time a client asks for it
+ * so every client streaming compressed images shares one copy.  Returns the compressed
+ * length or 0 if it should be sent raw.
+ */
+static uint32_t cmd_get_lep_z_len()
+{
+	if (!lep_z_valid) {
+		lep_z_len = radcodec_encode_region(sys_cmd_lep_bufferP->lep_bufferP + lep_crop.y*LEP_WIDTH + lep_crop.x,
+		                                   LEP_WIDTH, lep_crop.w, lep_crop.h,
+		                                   cmd_lep_z_bufferP, LEP_CROP_PIXEL_LEN(&lep_crop) - 1);
+		lep_z_valid = true;
+	}
+	
+	return lep_z_len;
+}
+
+
+/**
+ * Copy the crop of the held radiometric image the first time a client asks for it raw
+ */
+static uint16_t* cmd_get_crop_buffer()
+{
+	if (!crop_valid) {
+		lepton_crop_copy(sys_cmd_lep_bufferP->lep_bufferP, &lep_crop, crop_buffer);
+		crop_valid = true;
+	}
+	
+	return crop_buffer;
+}
+
+
+/**
+ * Build the preview of the held radiometric image the first time a client asks for it
+ * and return its length
+ */
+static uint32_t cmd_get_preview_len()
+{
+	if (!preview_valid) {
+		preview_len = prevcodec_encode(sys_cmd_lep_bufferP, preview_buffer);
+		preview_valid = true;
+	}
+	
+	return preview_len;
+}
+
+
+/**
+ * Return true if a client has queued data to send
+ */
+static bool cmd_tx_pending(cmd_client_t* c)
+{
+	return (c->img_active || (c->rsp_offset < c->rsp_length) || cmd_stream_active(c));
+}
+
+
+/**
+ * Return true if a client's streamed response hasn't been completely sent
+ */
+static bool cmd_stream_active(cmd_client_t* c)
+{
+	return ((c->stream.type != JSON_STREAM_NONE) || (c->stream_offset < c->stream_length));
+}
+
+
+/**
+ * Send as much of a client's queued data as fits, up to CMD_TX_CHUNK_LEN bytes.
+ * Responses are sent between images, never in the middle of one.  A streamed response
+ * is sent, a chunk at a time, once the responses queued before it have been sent and
+ * holds off the responses and images queued after it until it is finished.
+ */
+static void cmd_service_tx(cmd_client_t* c)
+{
+	bool between_images;
+	bool send_rsp;
+	bool send_stream;
+	const char* bufP;
+	int err;
+	int tos;
+	uint32_t len;
+	uint32_t rsp_end;
+	int64_t start_usec;
+	
+	between_images = !c->img_active ||
+	                 (!c->img_detached && (c->img_seg_index == 0) && (c->img_seg_offset == 0));
+	rsp_end = cmd_stream_active(c) ? c->stream_at : c->rsp_length;
+	send_rsp = (c->rsp_offset < rsp_end) && between_images;
+	
+	send_stream = false;
+	if (!send_rsp && between_images && cmd_stream_active(c)) {
+		if (c->stream_offset == c->stream_length) {
+			c->stream_length = json_stream_fill(&c->stream, c->stream_buffer, CMD_STREAM_CHUNK_LEN);
+			c->stream_offset = 0;
+		}
+		send_stream = (c->stream_offset < c->stream_length);
+	}
+	
+	if (send_rsp) {
+		bufP = &c->rsp_buffer[c->rsp_offset];
+		len = rsp_end - c->rsp_offset;
+	} else if (send_stream) {
+		bufP = &c->stream_buffer[c->stream_offset];
+		len = c->stream_length - c->stream_offset;
+	} else if (c->img_active) {
+		bufP = &c->img_seg[c->img_seg_index].bufP[c->img_seg_offset];
+		len = c->img_seg[c->img_seg_index].length - c->img_seg_offset;
+	} else {
+		return;
+	}
+	if (len > CMD_TX_CHUNK_LEN) len = CMD_TX_CHUNK_LEN;
+	
+	// Mark responses for a higher WMM access category than images so they aren't
+	// queued behind image data from other connections
+	tos = (send_rsp || send_stream) ? WIFI_TOS_CONTROL : WIFI_TOS_BULK;
+	if (tos != c->tx_tos) {
+		setsockopt(c->sock, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+		c->tx_tos = tos;
+	}
+	
+	start_usec = esp_timer_get_time();
+	err = send(c->sock, bufP, len, 0);
+	if (err < 0) {
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+			ESP_LOGE(TAG, "Error in socket send: errno %d", errno);
+			cmd_close_client(c);
+		}
+		return;
+	}
+	c->tx_progress_usec = esp_timer_get_time();
+	perf_record(PERF_TCP_SEND, c->tx_progress_usec - start_usec);
+	
+	if (send_rsp) {
+		c->rsp_offset += err;
+		if (c->rsp_offset == c->rsp_length) {
+			c->rsp_length = 0;
+			c->rsp_offset = 0;
+			c->stream_at = 0;
+		}
+	} else if (send_stream) {
+		c->stream_offset += err;
+	} else {
+		c->img_seg_offset += err;
+		while ((c->img_seg_index < c->img_seg_count) &&
+		       (c->img_seg_offset >= c->img_seg[c->img_seg_index].length)) {
+			c->img_seg_offset = 0;
+			c->img_seg_index++;
+		}
+		if (c->img_seg_index == c->img_seg_count) {
+			c->img_active = false;
+			cmd_update_tx_rate(c);
+			if (c->img_detached) {
+				// Catch up with the newest image if we skipped any while sending the copy
+				c->img_detached = false;
+				if (c->img_missed && image_held) {
+					cmd_send_image(c, image_held_json, image_held_binary);
+				}
+				c->img_missed = false;
+			} else {
+				cmd_check_image_done();
+			}
+		}
+	}
+}
+
+
+/**
+ * Disconnect a client that hasn't been able to accept any data for too long so it
+ * can't hold up images to the others
+ */
+static void cmd_check_tx_timeout(cmd_client_t* c)
+{
+	if ((c->sock >= 0) && cmd_tx_pending(c)) {
+		if ((esp_timer_get_time() - c->tx_progress_usec) > (CMD_SEND_TIMEOUT_MSEC * 1000)) {
+			ESP_LOGW(TAG, "Client not accepting data - disconnecting");
+			cmd_close_client(c);
+		}
+	}
+}
+
+
+/**
+ * Give clients still sending the held image after CMD_IMAGE_LAG_MSEC their own copy of
+ * the rest of it so a slow client doesn't stop app_task delivering newer images.  A
+ * client we can't allocate a copy for keeps holding the image.
+ */
+static void cmd_check_image_lag()
+{
+	int i;
+	
+	if (!image_held) return;
+	if ((esp_timer_get_time() - image_held_usec) < (CMD_IMAGE_LAG_MSEC * 1000)) return;
+	
+	for (i=0; i<CMD_MAX_CLIENTS; i++) {
+		if ((clients[i].sock >= 0) && clients[i].img_active && !clients[i].img_detached) {
+			cmd_detach_image(&clients[i]);
+		}
+	}
+	
+	cmd_check_image_done();
+}
+
+
+/**
+ * Copy the unsent part of a client's image into its lag buffer and send it from there
+ */
+static void cmd_detach_image(cmd_client_t* c)
+{
+	int i;
+	uint32_t len = 0;
+	uint32_t n;
+	uint32_t offset;
+	
+	if (c->lag_bufferP == NULL) {
+		if (c->lag_alloc_failed) return;
+		
+		c->lag_bufferP = heap_caps_malloc(CMD_LAG_BUF_LEN, MALLOC_CAP_SPIRAM);
+		if (c->lag_bufferP == NULL) {
+			ESP_LOGE(TAG, "malloc lag buffer failed - slow client will hold images");
+			c->lag_alloc_failed = true;
+			return;
+		}
+	}
+	
+	offset = c->img_seg_offset;
+	for (i=c->img_seg_index; i<c->img_seg_count; i++) {
+		n = c->img_seg[i].length - offset;
+		if ((len + n) > CMD_LAG_BUF_LEN) return;
+		memcpy(&c->lag_bufferP[len], &c->img_seg[i].bufP[offset], n);
+		len += n;
+		offset = 0;
+	}
+	
+	c->img_seg[0].bufP = (char*) c->lag_bufferP;
+	c->img_seg[0].length = len;
+	c->img_seg_count = 1;
+	c->img_seg_index = 0;
+	c->img_seg_offset = 0;
+	c->img_detached = true;
+}
+
+
+/**
+ * Notify app_task we're done with the image it is holding for us once no client is
+ * still sending it (clients sending their own copy don't count)
+ */
+static void cmd_check_image_done()
+{
+	int i;
+	
+	if (!image_held) return;
+	
+	for (i=0; i<CMD_MAX_CLIENTS; i++) {
+		if ((clients[i].sock >= 0) && clients[i].img_active && !clients[i].img_detached) return;
+	}
+	
+	xTaskNotify(task_handle_app, APP_NOTIFY_CMD_DONE_MASK, eSetBits);
+	image_held = false;
+}
+
+
+/**
+ * Start sending the image whose segments have been loaded into img_seg.  jpeg_len is
+ * the length of the jpeg in it as sent (Base-64 encoded if base64 is set).
+ */
+static void cmd_start_image(cmd_client_t* c, uint32_t jpeg_len, bool base64)
+{
+	int i;
+	
+	c->img_len = 0;
+	for (i=0; i<c->img_seg_count; i++) {
+		c->img_len += c->img_seg[i].length;
+	}
+	c->img_jpeg_len = jpeg_len;
+	c->img_jpeg_base64 = base64;
+	c->img_start_usec = esp_timer_get_time();
+	
+	c->img_seg_index = 0;
+	c->img_seg_offset = 0;
+	if (!cmd_tx_pending(c)) {
+		c->tx_progress_usec = c->img_start_usec;
+	}
+	c->img_active = true;
+}
+
+
+/**
+ * Update a client's throughput when it finishes an image and work out the longest jpeg
+ * that would let it send its images in CMD_ADAPT_TARGET_PCT percent of their period
+ */
+static void cmd_update_tx_rate(cmd_client_t* c)
+{
+	int64_t budget;
+	int64_t period_msec;
+	int64_t usec;
+	uint32_t rate;
+	
+	c->img_done_usec = esp_timer_get_time();
+	usec = c->img_done_usec - c->img_start_usec;
+	if (usec <= 0) return;
+	
+	rate = (uint32_t) ((int64_t) c->img_len * 1000000 / usec);
+	if (c->tx_rate == 0) {
+		c->tx_rate = rate;
+	} else {
+		c->tx_rate = (uint32_t) ((int32_t) c->tx_rate + ((int32_t) rate - (int32_t) c->tx_rate) / CMD_ADAPT_AVG_WEIGHT);
+	}
+	
+	if (c->img_jpeg_len == 0) {
+		c->jpeg_budget = 0;
+		return;
+	}
+	
+	// Whatever the time sending the rest of the image leaves for the jpeg (at least one
+	// byte so the quality is as coarse as possible when there's no room)
+	period_msec = ((c->streaming && (c->image_requests == 0)) ? c->stream_period : 1) * 1000;
+	budget = (int64_t) c->tx_rate * period_msec * CMD_ADAPT_TARGET_PCT / 100000;
+	budget -= c->img_len - c->img_jpeg_len;
+	if (c->img_jpeg_base64) {
+		budget = budget * 3 / 4;
+	}
+	if (budget < 1) budget = 1;
+	if (budget > CAM_MAX_JPG_LEN) budget = CAM_MAX_JPG_LEN;
+	c->jpeg_budget = (uint32_t) budget;
+}
+
+
+#ifdef CMD_ADAPT_JPEG
+/**
+ * Give cam_task the jpeg budget of the slowest client that is still receiving images
+ */
+static void cmd_update_jpeg_budget()
+{
+	int i;
+	int64_t t;
+	uint32_t budget = 0;
+	
+	t = esp_timer_get_time();
+	for (i=0; i<CMD_MAX_CLIENTS; i++) {
+		if ((clients[i].sock >= 0) && (clients[i].tx_rate != 0) && (clients[i].jpeg_budget != 0) &&
+		    ((t - clients[i].img_done_usec) < (CMD_ADAPT_STALE_MSEC * 1000)))
+		{
+			if ((budget == 0) || (clients[i].jpeg_budget < budget)) {
+				budget = clients[i].jpeg_budget;
+			}
+		}
+	}
+	
+	if (budget != jpeg_budget) {
+		cam_task_set_jpeg_budget(budget);
+		jpeg_budget = budget;
+	}
+}
+#endif
+
+
+/**
+ * Create the CMD_BEACON_PORT socket once WiFi is up (closing it if WiFi goes away) and
+ * broadcast the status beacon every CMD_BEACON_SEC
+ */
+static void cmd_check_beacon_socket()
+{
+	int flag = 1;
+	struct sockaddr_in addr;
+	
+	if (!wifi_is_connected()) {
+		if (beacon_sock >= 0) {
+			close(beacon_sock);
+			beacon_sock = -1;
+		}
+		return;
+	}
+	
+	if (beacon_sock < 0) {
+		beacon_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (beacon_sock < 0) return;
+		
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(CMD_BEACON_PORT);
+		setsockopt(beacon_sock, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+		setsockopt(beacon_sock, SOL_SOCKET, SO_BROADCAST, &flag, sizeof(flag));
+		if (bind(beacon_sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+			ESP_LOGE(TAG, "Beacon socket unable to bind: errno %d", errno);
+			close(beacon_sock);
+			beacon_sock = -1;
+			return;
+		}
+		fcntl(beacon_sock, F_SETFL, fcntl(beacon_sock, F_GETFL, 0) | O_NONBLOCK);
+	}
+	
+#ifdef CMD_BEACON_SEC
+	if ((esp_timer_get_time() - beacon_usec) >= ((int64_t) CMD_BEACON_SEC * 1000000)) {
+		beacon_usec = esp_timer_get_time();
+		addr.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(CMD_BEACON_PORT);
+		cmd_send_beacon(&addr);
+	}
+#endif
+}
+
+
+/**
+ * Answer get_status command datagrams on the beacon socket with the status beacon.
+ * Anything else (including other cameras' beacons) is ignored.
+ */
+static void cmd_handle_beacon_request()
+{
+	char buf[JSON_MAX_CMD_TEXT_LEN+1];
+	char* cP;
+	struct sockaddr_in from;
+	socklen_t from_len;
+	bool has_args;
+	int cmd;
+	int len;
+	uint16_t tag;
+	
+	while (1) {
+		from_len = sizeof(from);
+		len = recvfrom(beacon_sock, buf, JSON_MAX_CMD_TEXT_LEN, 0, (struct sockaddr *)&from, &from_len);
+		if (len <= 0) break;
+		
+		// The command may be sent with or without the delimitors
+		buf[len] = 0;
+		if (buf[len-1] == CMD_JSON_STRING_STOP) buf[len-1] = 0;
+		cP = (buf[0] == CMD_JSON_STRING_START) ? &buf[1] : buf;
+		
+		cmd = CMD_UNKNOWN;
+		if (json_scan_cmd(cP, &cmd, &tag, &has_args) && !has_args && (cmd == CMD_GET_STATUS)) {
+			cmd_send_beacon(&from);
+		}
+	}
+}
+
+
+static void cmd_send_beacon(struct sockaddr_in* toP)
+{
+	char* bufP;
+	uint32_t len;
+	
+	bufP = json_get_beacon(&len);
+	if ((bufP == NULL) || (len == 0)) return;
+	
+	(void) sendto(beacon_sock, bufP, len, 0, (struct sockaddr *)toP, sizeof(struct sockaddr_in));
+}
+
+
+/**
+ * Start sending every Lepton frame to a unicast or multicast address.  The stream is
+ * shared by all viewers and keeps running until stopped by any client.
+ */
+static void cmd_udp_stream_on(uint8_t* ip_addr, uint16_t port)
+{
+	uint8_t ttl = CMD_UDP_MULTICAST_TTL;
+	
+	if (udp_sock < 0) {
+		udp_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+		if (udp_sock < 0) {
+			ESP_LOGE(TAG, "Unable to create UDP stream socket: errno %d", errno);
+			return;
+		}
+		fcntl(udp_sock, F_SETFL, fcntl(udp_sock, F_GETFL, 0) | O_NONBLOCK);
+	}
+	
+	// ip_addr is stored most-significant byte last (as in wifi_info_t)
+	udp_dest_addr.sin_family = AF_INET;
+	udp_dest_addr.sin_port = htons(port);
+	udp_dest_addr.sin_addr.s_addr = htonl(((uint32_t) ip_addr[3] << 24) | ((uint32_t) ip_addr[2] << 16) |
+	                                      ((uint32_t) ip_addr[1] << 8) | ip_addr[0]);
+	if ((ip_addr[3] >= 224) && (ip_addr[3] <= 239)) {
+		setsockopt(udp_sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+	}
+	
+	udp_frame_num = 0;
+	udp_streaming = true;
+	xTaskNotify(task_handle_lep, LEP_NOTIFY_UDP_ON_MASK, eSetBits);
+}
+
+
+/**
+ * Stop the UDP frame stream
+ */
+static void cmd_udp_stream_off()
+{
+	udp_streaming = false;
+	xTaskNotify(task_handle_lep, LEP_NOTIFY_UDP_OFF_MASK, eSetBits);
+}
+
+
+/**
+ * Send the frame lep_task published for us as a sequence of datagrams.  If the network
+ * can't take a datagram the rest of the frame is dropped.
+ */
+static void cmd_send_udp_frame()
+{
+	cmd_udp_header_t* hdrP = (cmd_udp_header_t*) udp_tx_buffer;
+	uint8_t* payloadP = &udp_tx_buffer[sizeof(cmd_udp_header_t)];
+	uint16_t i;
+	uint32_t len;
+	uint32_t offset;
+	const uint32_t pixel_len = LEP_NUM_PIXELS*2;
+	const uint32_t total_len = LEP_NUM_PIXELS*2 + LEP_TEL_WORDS*2;
+	
+	if (!udp_streaming || (sys_lep_udp_bufferP == NULL)) return;
+	
+	hdrP->magic = CMD_UDP_MAGIC;
+	hdrP->frame_num = udp_frame_num++;
+	hdrP->chunk_count = (total_len + CMD_UDP_PAYLOAD_LEN - 1) / CMD_UDP_PAYLOAD_LEN;
+	hdrP->total_len = total_len;
+	
+	offset = 0;
+	for (i=0; i<hdrP->chunk_count; i++) {
+		len = total_len - offset;
+		if (len > CMD_UDP_PAYLOAD_LEN) len = CMD_UDP_PAYLOAD_LEN;
+		
+		// The payload may span the end of the pixels and start of the telemetry
+		if (offset >= pixel_len) {
+			memcpy(payloadP, (uint8_t*) sys_lep_udp_bufferP->lep_telemP + (offset - pixel_len), len);
+		} else if ((offset + len) <= pixel_len) {
+			memcpy(payloadP, (uint8_t*) sys_lep_udp_bufferP->lep_bufferP + offset, len);
+		} else {
+			memcpy(payloadP, (uint8_t*) sys_lep_udp_bufferP->lep_bufferP + offset, pixel_len - offset);
+			memcpy(payloadP + (pixel_len - offset), sys_lep_udp_bufferP->lep_telemP, len - (pixel_len - offset));
+		}
+		
+		hdrP->chunk_index = i;
+		hdrP->offset = offset;
+		if (sendto(udp_sock, udp_tx_buffer, sizeof(cmd_udp_header_t) + len, 0,
+		           (struct sockaddr *)&udp_dest_addr, sizeof(udp_dest_addr)) < 0) {
+			return;
+		}
+		offset += len;
+	}
+}
+
+
+/**
+ * Start the update requested by an ota_update command.  The image follows the command
+ * so it is discarded if the update can't be started.
+ */
+static void cmd_ota_start(cmd_client_t* c, cJSON* cmd_args, uint16_t tag)
+{
+	bool restart;
+	bool valid;
+	char* response_buffer;
+	ota_status_t status;
+	uint8_t sha256[32];
+	uint32_t length;
+	uint32_t response_length;
+	
+	valid = json_parse_ota_update(cmd_args, &length, sha256, &restart);
+	
+	c->ota_tag = tag;
+	c->ota_remaining = length;
+	c->ota_fill = 0;
+	c->ota_bufP = NULL;
+	c->ota_discard = true;
+	
+	if (!valid) {
+		ESP_LOGE(TAG, "Illegal ota_update command");
+		memset(&status, 0, sizeof(ota_status_t));
+		status.state = OTA_STATE_FAILED;
+		status.length = length;
+		status.result = "Illegal command";
+	} else if (ota_task_start(length, sha256, restart, &status)) {
+		c->ota_active = true;
+		c->ota_discard = false;
+		c->ota_bufP = ota_task_get_buffer();
+		return;
+	}
+	
+	response_buffer = json_get_ota(&status, &response_length);
+	if (response_buffer != NULL) {
+		cmd_queue_response(c, response_buffer, response_length, tag);
+	}
+}
+
+
+/**
+ * Returns false while a client is sending an image and all the update buffers are
+ * waiting to be written so we stop reading from it
+ */
+static bool cmd_ota_rx_ready(cmd_client_t* c)
+{
+	ota_status_t status;
+	
+	if ((c->ota_remaining == 0) || c->ota_discard || (c->ota_bufP != NULL)) {
+		return true;
+	}
+	
+	c->ota_bufP = ota_task_get_buffer();
+	if (c->ota_bufP != NULL) {
+		return true;
+	}
+	
+	// The rest of the image is discarded if the update failed
+	ota_task_get_status(&status);
+	if (status.state != OTA_STATE_ACTIVE) {
+		c->ota_discard = true;
+		return true;
+	}
+	
+	return false;
+}
+
+
+/**
+ * Handle image data received along with commands.  Returns the number of bytes used.
+ */
+static int cmd_ota_rx_data(cmd_client_t* c, char* data, int len)
+{
+	ota_status_t status;
+	uint32_t n;
+	
+	n = ((uint32_t) len < c->ota_remaining) ? (uint32_t) len : c->ota_remaining;
+	
+	if (!c->ota_discard && (c->ota_bufP == NULL)) {
+		c->ota_bufP = ota_task_get_buffer();
+		if (c->ota_bufP == NULL) {
+			// No room for it so give up on the update
+			ota_task_get_status(&status);
+			status.result = "Aborted";
+			cmd_ota_end(c, &status);
+		}
+	}
+	
+	if (c->ota_discard) {
+		c->ota_remaining -= n;
+		return n;
+	}
+	
+	if (n > (OTA_BUFFER_LEN - c->ota_fill)) n = OTA_BUFFER_LEN - c->ota_fill;
+	memcpy(c->ota_bufP + c->ota_fill, data, n);
+	cmd_ota_advance(c, n);
+	
+	return n;
+}
+
+
+/**
+ * Account for len bytes of image data added to the update buffer, handing it to
+ * ota_task when it is full or holds the end of the image
+ */
+static void cmd_ota_advance(cmd_client_t* c, uint32_t len)
+{
+	c->ota_fill += len;
+	c->ota_remaining -= len;
+	
+	if ((c->ota_fill == OTA_BUFFER_LEN) || (c->ota_remaining == 0)) {
+		ota_task_put_buffer(c->ota_fill);
+		c->ota_fill = 0;
+		c->ota_bufP = (c->ota_remaining > 0) ? ota_task_get_buffer() : NULL;
+	}
+}
+
+
+/**
+ * Send a client the result of its update and release the update.  Any image data
+ * still to come is discarded.
+ */
+static void cmd_ota_end(cmd_client_t* c, ota_status_t* statusP)
+{
+	char* response_buffer;
+	uint32_t response_length;
+	
+	response_buffer = json_get_ota(statusP, &response_length);
+	if (response_buffer != NULL) {
+		cmd_queue_response(c, response_buffer, response_length, c->ota_tag);
+	}
+	
+	c->ota_active = false;
+	c->ota_discard = true;
+	c->ota_bufP = NULL;
+	c->ota_fill = 0;
+	ota_task_release();
 }
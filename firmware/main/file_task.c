@@ -25,13 +25,42 @@
  */
 #include "file_task.h"
 #include "app_task.h"
+#include "bench_task.h"
+#include "health_task.h"
+#include "lep_task.h"
+#include "log_task.h"
+#include "adc_utilities.h"
 #include "file_utilities.h"
+#include "gui_task.h"
+#include "gui_utilities.h"
+#include "avi_utilities.h"
+#include "binrec_utilities.h"
+#include "json_utilities.h"
+#include "perf_utilities.h"
+#include "pm_utilities.h"
+#include "ring_utilities.h"
+#include "ps_utilities.h"
+#include "system_config.h"
+#include "radcodec.h"
+#include "spool_utilities.h"
+#include "summary_utilities.h"
 #include "sys_utilities.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "vospi.h"
+#include "lepton_alarm.h"
+#include "lepton_stats.h"
+#include "lepton_utilities.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include "freertos/task.h"
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 
 
 //
@@ -39,6 +68,34 @@
 //
 #define FILE_EVAL_MSEC 50
 
+// Period between syncs of the VoSPI capture file
+#define FILE_CAP_SYNC_MSEC 1000
+
+// Estimated image sizes used until a container has a few images to average
+#define FILE_EST_JSON_IMAGE_LEN JSON_MAX_IMAGE_TEXT_LEN
+#define FILE_EST_FCR_IMAGE_LEN  (BINREC_MAX_HEADER_LEN + CAM_MAX_JPG_LEN + LEP_NUM_PIXELS*2 + LEP_TEL_WORDS*2)
+
+// High-rate record length (for the card speed test)
+#define FILE_LEP_RECORD_LEN     (sizeof(lep_record_header_t) + LEP_NUM_PIXELS*2 + LEP_TEL_WORDS*2)
+
+
+
+//
+// File Task private typedefs
+//
+typedef struct {
+	bool binary;
+	bool meta;                   // Metadata log line in json_bufP (no images)
+	bool compress;               // Compress the radiometric data in a binary image
+	cam_buffer_t* camP;          // Binary image buffers (file_task holds the references)
+	lep_buffer_t* lepP;
+	uint32_t json_len;
+	char* json_bufP;             // Json image text (allocated at task start)
+	file_index_entry_t idx;      // Session index entry (completed when the image is written)
+	summary_sample_t sample;     // Session summary values
+	file_thumb_entry_t* thumbP;  // Session thumbnail pixels (NULL if thumbnails are disabled)
+} file_queue_entry_t;
+
 
 
 //
@@ -46,20 +103,218 @@
 //
 static const char* TAG = "file_task";
 
-// Counter used to probe card for presence 
-static int card_check_count = FILE_CARD_CHECK_PERIOD_MSEC / FILE_EVAL_MSEC;
+// Tick of the last probe for card presence
+static TickType_t card_check_tick;
+
+#ifdef SD_CD_IO
+// Card-detect switch debounce state
+static bool cd_settling = false;
+static TickType_t cd_change_tick;
+static bool cd_init_failed = false;      // Don't retry a card that wouldn't initialize until it's reinserted
+#else
+static int card_probe_fails = 0;         // Consecutive failed checks of a present card
+#endif
 static bool recording;
 static char* rec_dir_name;
 static uint16_t rec_seq_num = 0;
 
+// Recording journal for the current session (rec_dir_name points to its session_dir)
+static ps_rec_journal_t rec_journal;
+
+// High-rate recording file (opened on the first record in a session)
+static FILE* lep_rec_fp = NULL;
+static uint32_t lep_rec_seq_num;
+static uint32_t lep_rec_resume_offset;   // Where to continue the file when resuming a session
+static int lep_rec_unsynced;             // Records written since the last sync
+
+// Session container file (opened on the first image in a session when enabled)
+static bool rec_container;
+static FILE* cont_fp = NULL;
+static int cont_num;
+static uint32_t cont_data_end;           // Offset just past the last complete record
+static uint32_t cont_count;
+static int cont_unsynced;                // Records written since the last sync
+static uint32_t cont_alloc_end;          // Space allocated for the container
+static uint32_t cont_est_image_len;      // Expected image length for this session
+static int cont_images_per_extent;
+static file_container_index_t* cont_indexP;
+
+// Session AVI file (opened on the first image with a jpeg when enabled)
+static bool rec_avi;
+static FILE* avi_fp = NULL;
+static FILE* avi_idx_fp = NULL;          // Index checkpoint file
+static uint16_t avi_file_num;            // Sequence number of the file's first image
+static avi_info_t avi_info;
+static uint32_t avi_usec_per_frame;
+static uint32_t avi_checkpoint_frames;   // Frames as of the last checkpoint
+static avi_index_entry_t* avi_indexP;
+static uint8_t avi_hdr_buf[AVI_HEADER_LEN];
+
+// Write-behind image queue - loaded by app_task, emptied by file_task
+static file_queue_entry_t file_queue[FILE_QUEUE_LEN];
+static int file_queue_len;               // Entries with an allocated json buffer
+static ring_t file_queue_ring;           // Slots in file_queue (always full until initialized)
+static portMUX_TYPE file_queue_mux = portMUX_INITIALIZER_UNLOCKED;
+static file_rec_stats_t rec_stats;
+static int rec_write_fails;              // Consecutive write failures
+
+// Flash spool state (see FILE_SPOOL_RETRY_MSEC)
+static bool spool_enabled = false;
+static bool spool_card_failed = false;   // Images go to the spool until a move to the card works
+static bool spool_moving = false;        // Moved an image on the last pass
+static bool img_spooling = false;        // The image being written goes to the spool
+static TickType_t spool_retry_tick;
+
+// Ring recording state
+static bool rec_ring;
+static bool ring_evicting = false;       // Deleting sessions to get back above FILE_RING_HIGH_FREE_MB
+static bool ring_oldest_valid = false;
+static char ring_oldest[SESSION_DIR_NAME_LEN];
+static uint32_t ring_free_mb;            // As of the last check
+static TickType_t ring_check_tick;
+
+// Session index file (opened on the first image in a session)
+static FILE* index_fp = NULL;
+static int index_unsynced;
+
+// Session thumbnail file (opened on the first thumbnail in a session)
+static file_thumb_entry_t* thumb_entriesP;
+static FILE* thumb_fp = NULL;
+static int thumb_unsynced;
+static int thumb_countdown;              // Lepton images to write before the next thumbnail
+
+// Session telemetry log (opened on the first sample in a session)
+static file_tlog_entry_t* tlog_bufP;
+static FILE* tlog_fp = NULL;
+static bool tlog_failed;                 // The file couldn't be opened this session
+static int tlog_count;                   // Entries waiting in tlog_bufP
+static uint32_t tlog_seq_num;
+static TickType_t tlog_sample_tick;      // When the next sample is due
+static TickType_t tlog_flush_tick;       // When the buffer was last written
+static lep_stats_t tlog_stats;           // Sampling scratch (kept off the task stack)
+static perf_stats_t tlog_perf;
+
+// Session metadata log (opened on the first line in a session)
+static FILE* meta_fp = NULL;
+static long meta_end;                    // Offset just past the last complete line
+static int meta_unsynced;
+
+// Session summary json text (allocated at task start)
+static char* summary_textP;
+static TickType_t summary_write_tick;
+
+// Write staging buffer (see FILE_WRITE_BUF_LEN)
+static uint8_t* stage_bufP;
+static FILE* stage_fp = NULL;            // File the staged data belongs to
+static uint32_t stage_len;               // Bytes staged
+static uint32_t stage_limit;             // Bytes to stage before writing
+
+// Write throughput for the current (or last) recording session
+static uint64_t wr_bytes;
+static int64_t wr_usec;
+static volatile float wr_rate;           // MB/sec
+
+// Speed test result for the card in the camera
+static file_card_speed_t card_speed;
+static portMUX_TYPE card_speed_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Free space on the card as of the last check while it was mounted
+static volatile uint32_t card_free_mb = 0;
+static TickType_t card_free_tick;
+
+#ifdef LOG_TO_FILE
+// Tick of the last log file update
+static TickType_t log_write_tick;
+#endif
+
+#ifdef INCLUDE_VOSPI_CAPTURE
+// Raw VoSPI packet capture file
+static FILE* cap_fp = NULL;
+static bool cap_done = false;            // File full or failed
+static uint32_t cap_len;
+static uint32_t cap_reported_overruns;
+static TickType_t cap_sync_tick;
+#endif
+
 
 //
 // File Task Forward Declarations for internal functions
 //
-static void handle_notifications();
+static void handle_notifications(uint32_t notification_value);
 static void update_card_present_info();
+static void mount_idle_card();
+static void prepare_card();
+static void test_card_speed();
+static void check_rec_profile(file_card_speed_t* speedP);
+static bool profile_sustainable(file_card_speed_t* speedP, uint8_t format, uint16_t interval);
+#ifdef SD_CD_IO
+static void IRAM_ATTR card_detect_isr(void* arg);
+#endif
 static bool setup_recording_session();
-static bool write_image_file();
+static void end_recording_session(bool suspend);
+static void update_journal();
+static void update_ring();
+static void update_free_space(bool now);
+static bool write_queued_image();
+static bool write_queued_entry(file_queue_entry_t* entryP, bool spool);
+static int get_queue_count();
+static void note_write_result(bool success);
+static bool migrate_spool();
+static bool write_spooled_index_entry(char* dir_name, file_index_entry_t* idxP);
+static void update_spool_pending();
+static bool write_image_file(file_queue_entry_t* entryP);
+static bool write_binary_image_file(file_queue_entry_t* entryP);
+static bool write_image_data(FILE* fp, uint8_t* bufP, uint32_t length);
+static bool open_image_output(uint16_t type, uint32_t length, FILE** fp);
+static bool close_image_output(FILE* fp, uint16_t type, uint32_t length, bool success, file_index_entry_t* idxP);
+static bool open_container();
+static bool write_container_header(uint32_t index_offset);
+static void sync_container();
+static void close_container();
+static void extend_container();
+static bool write_avi_frame(cam_buffer_t* camP, file_index_entry_t* idxP);
+static bool open_avi_file(cam_buffer_t* camP);
+static bool write_avi_header();
+static void checkpoint_avi_file();
+static void close_avi_file();
+static void init_index_entry(file_index_entry_t* idxP, cam_buffer_t* camP, lep_buffer_t* lepP);
+static void init_index_header(file_index_header_t* hdrP);
+static bool write_index_entry(file_index_entry_t* idxP);
+static void close_index_file();
+static void init_thumb_entry(file_thumb_entry_t* thumbP, lep_buffer_t* lepP);
+static void write_thumb(file_queue_entry_t* entryP, bool spooled);
+static bool write_thumb_entry(file_thumb_entry_t* thumbP);
+static void close_thumb_file();
+static void update_tlog();
+static TickType_t tlog_wait_ticks(TickType_t max_ticks);
+static bool open_tlog_file();
+static void init_tlog_entry(file_tlog_entry_t* eP);
+static void flush_tlog();
+static void close_tlog_file();
+static bool write_meta_record(file_queue_entry_t* entryP);
+static bool open_meta_file();
+static void sync_meta_file();
+static void close_meta_file();
+static void write_summary(bool now, bool complete);
+static bool write_lep_record();
+static void sync_lep_record_file();
+static void close_lep_record_file();
+static bool write_buffer(FILE* fp, uint8_t* bufP, uint32_t length);
+static bool flush_buffer();
+static void discard_buffer();
+static bool write_direct(FILE* fp, uint8_t* bufP, uint32_t length);
+#ifdef INCLUDE_SYS_TRACE
+static void dump_trace();
+#endif
+#ifdef INCLUDE_SYS_BENCH
+static void run_benchmark();
+#endif
+#ifdef LOG_TO_FILE
+static void write_log_file();
+#endif
+#ifdef INCLUDE_VOSPI_CAPTURE
+static void write_vospi_capture();
+#endif
 
 
 //
@@ -67,8 +322,75 @@ static bool write_image_file();
 //
 void file_task()
 {
+	int i;
+	
 	ESP_LOGI(TAG, "Start task");
 	
+	// Allocate the image queue json buffers
+	file_queue_len = 0;
+	for (i=0; i<FILE_QUEUE_LEN; i++) {
+		file_queue[i].json_bufP = heap_caps_malloc(JSON_MAX_IMAGE_TEXT_LEN, MALLOC_CAP_SPIRAM);
+		if (file_queue[i].json_bufP == NULL) {
+			ESP_LOGE(TAG, "malloc image queue buffer %d failed", i);
+			break;
+		}
+		file_queue[i].camP = NULL;
+		file_queue[i].lepP = NULL;
+		file_queue_len++;
+	}
+	ring_init(&file_queue_ring, file_queue_len, RING_BLOCK_ON_FULL);
+	ring_set_consumer(&file_queue_ring, xTaskGetCurrentTaskHandle(), FILE_NOTIFY_NEW_IMAGE_MASK);
+	
+	// Allocate the container index
+	cont_indexP = heap_caps_malloc(FILE_CONTAINER_MAX_RECORDS * sizeof(file_container_index_t), MALLOC_CAP_SPIRAM);
+	if (cont_indexP == NULL) {
+		ESP_LOGE(TAG, "malloc container index failed - container recording disabled");
+	}
+	
+	// Allocate the image queue thumbnails
+	thumb_entriesP = heap_caps_malloc(FILE_QUEUE_LEN * sizeof(file_thumb_entry_t), MALLOC_CAP_SPIRAM);
+	if (thumb_entriesP == NULL) {
+		ESP_LOGE(TAG, "malloc thumbnails failed - session thumbnails disabled");
+	}
+	for (i=0; i<FILE_QUEUE_LEN; i++) {
+		file_queue[i].thumbP = (thumb_entriesP == NULL) ? NULL : &thumb_entriesP[i];
+	}
+	
+	// Allocate the session telemetry log buffer
+	tlog_bufP = heap_caps_malloc(FILE_TLOG_BUF_ENTRIES * sizeof(file_tlog_entry_t), MALLOC_CAP_SPIRAM);
+	if (tlog_bufP == NULL) {
+		ESP_LOGE(TAG, "malloc telemetry log buffer failed - session telemetry logs disabled");
+	}
+	
+	// Allocate the AVI index
+	avi_indexP = heap_caps_malloc(FILE_AVI_MAX_FRAMES * sizeof(avi_index_entry_t), MALLOC_CAP_SPIRAM);
+	if (avi_indexP == NULL) {
+		ESP_LOGE(TAG, "malloc AVI index failed - AVI recording disabled");
+	}
+	
+	// Allocate the session summary text
+	summary_textP = heap_caps_malloc(SUMMARY_MAX_TEXT_LEN, MALLOC_CAP_SPIRAM);
+	if (summary_textP == NULL) {
+		ESP_LOGE(TAG, "malloc summary text failed - session summaries disabled");
+	}
+	
+	// Allocate the write staging buffer in internal memory the SD driver can DMA from
+	stage_bufP = heap_caps_malloc(FILE_WRITE_BUF_LEN, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+	if (stage_bufP == NULL) {
+		ESP_LOGE(TAG, "malloc write staging buffer failed - using unstaged writes");
+	}
+	
+	// Images are moved from the flash spool through the staging buffer
+	if (stage_bufP != NULL) {
+		spool_enabled = spool_init();
+		update_spool_pending();
+	}
+	
+	// A journal left from a session that wasn't going to be restarted is stale
+	if (!ps_get_rec_enable()) {
+		ps_clear_rec_journal();
+	}
+	
 	// Try to initialize a SD Card to see if one is there.
 	if (file_init_card()) {
 		ESP_LOGI(TAG, "SD Card found");
@@ -76,22 +398,240 @@ void file_task()
 		// Notify app_task
 		xTaskNotify(task_handle_app, APP_NOTIFY_SDCARD_PRESENT_MASK, eSetBits);
 		
-		// Mount it briefly to force a format if necessary, then unmount it.
-		if (file_mount_sdcard()) {
-			file_unmount_sdcard();
-		}
+		mount_idle_card();
 	} else {
 		xTaskNotify(task_handle_app, APP_NOTIFY_SDCARD_MISSING_MASK, eSetBits);
 		ESP_LOGI(TAG, "No SD Card found");
 	}
 	
-	// Loop handling notifications and file operation requests
+#ifdef SD_CD_IO
+	// Start handling card-detect switch interrupts
+	gpio_set_intr_type(SD_CD_IO, GPIO_INTR_ANYEDGE);
+	gpio_isr_handler_add(SD_CD_IO, card_detect_isr, NULL);
+#endif
+	
+	// Loop handling notifications and file operation requests.  We block waiting for
+	// requests so high-rate recording records are written as soon as they are available.
+	// Queued images are written one per pass so high-rate records aren't held up behind
+	// a backlog of images.  Spooled images are moved when there is nothing else to do.
+	card_check_tick = xTaskGetTickCount();
 	while (1) {
-		handle_notifications();
+		uint32_t notification_value = 0;
+		TickType_t wait_ticks;
+		BaseType_t notified;
+		
+		health_task_beat(HEALTH_TASK_FILE);
+		
+		// The SD driver waits for transfers with the CPU idle so stay out of light sleep,
+		// which stops the SDMMC clock, except while waiting here
+		wait_ticks = ((get_queue_count() != 0) || spool_moving) ? 0 : tlog_wait_ticks(pdMS_TO_TICKS(FILE_EVAL_MSEC));
+		if (wait_ticks != 0) {
+			pm_set_level(PM_USER_FILE, PM_LEVEL_SLEEP);
+		}
+		notified = xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, wait_ticks);
+		pm_set_level(PM_USER_FILE, PM_LEVEL_AWAKE);
+		if (notified) {
+			handle_notifications(notification_value);
+		}
+		if (recording) {
+			update_tlog();
+		}
+		if (!write_queued_image()) {
+			// Nothing to write so get the next image subdirectory ready ahead of time
+			// and make room on the card
+			if (recording && !rec_container) {
+				(void) file_prepare_subdirectories(rec_dir_name, rec_seq_num);
+			}
+			if (recording && rec_ring) {
+				update_ring();
+			}
+			if (recording) {
+				write_summary(false, false);
+			}
+			update_free_space(false);
+#ifdef LOG_TO_FILE
+			write_log_file();
+#endif
+			spool_moving = migrate_spool();
+		}
 		update_card_present_info();
+#ifdef INCLUDE_VOSPI_CAPTURE
+		write_vospi_capture();
+#endif
+	}
+}
+
+
+/**
+ * Return true if there's no room in the image queue for another image
+ */
+bool file_task_queue_full()
+{
+	return (ring_write_slot(&file_queue_ring, NULL) < 0);
+}
+
+
+/**
+ * Copy a json image into the image queue for writing.  camP and lepP are the images (if
+ * any) in the json image, used only for its index entry.  Returns false (and counts the
+ * image as dropped) if the queue is full.
+ */
+bool file_task_queue_json_image(json_image_string_t* imgP, cam_buffer_t* camP, lep_buffer_t* lepP)
+{
+	int slot;
+	file_queue_entry_t* entryP;
+	
+	slot = ring_write_slot(&file_queue_ring, NULL);
+	if ((slot < 0) || (imgP->length > JSON_MAX_IMAGE_TEXT_LEN)) {
+		file_task_drop_image();
+		return false;
+	}
+	
+	// Only app_task loads entries so the slot is ours until it is published
+	entryP = &file_queue[slot];
+	entryP->binary = false;
+	entryP->meta = false;
+	entryP->compress = false;
+	entryP->camP = NULL;
+	entryP->lepP = NULL;
+	memcpy(entryP->json_bufP, imgP->bufferP, imgP->length);
+	entryP->json_len = imgP->length;
+	init_index_entry(&entryP->idx, camP, lepP);
+	summary_get_sample(camP, lepP, &entryP->sample);
+	init_thumb_entry(entryP->thumbP, lepP);
+	
+	portENTER_CRITICAL(&file_queue_mux);
+	if (++rec_stats.queued > rec_stats.max_queued) rec_stats.max_queued = rec_stats.queued;
+	portEXIT_CRITICAL(&file_queue_mux);
+	
+	// Wakes file_task with FILE_NOTIFY_NEW_IMAGE_MASK
+	ring_publish(&file_queue_ring);
+	return true;
+}
+
+
+/**
+ * Queue a binary image for writing directly from the image buffers.  The queue holds
+ * its own references to the buffers until the image is written.  Returns false (and
+ * counts the image as dropped) if the queue is full.
+ */
+bool file_task_queue_bin_image(cam_buffer_t* camP, lep_buffer_t* lepP, bool compress)
+{
+	int slot;
+	file_queue_entry_t* entryP;
+	
+	slot = ring_write_slot(&file_queue_ring, NULL);
+	if (slot < 0) {
+		file_task_drop_image();
+		return false;
+	}
+	
+	entryP = &file_queue[slot];
+	entryP->binary = true;
+	entryP->meta = false;
+	entryP->compress = compress;
+	system_cam_buffer_hold(camP);
+	entryP->camP = camP;
+	system_lep_frame_hold(lepP);
+	entryP->lepP = lepP;
+	entryP->json_len = 0;
+	init_index_entry(&entryP->idx, camP, lepP);
+	summary_get_sample(camP, lepP, &entryP->sample);
+	init_thumb_entry(entryP->thumbP, lepP);
+	
+	portENTER_CRITICAL(&file_queue_mux);
+	if (++rec_stats.queued > rec_stats.max_queued) rec_stats.max_queued = rec_stats.queued;
+	portEXIT_CRITICAL(&file_queue_mux);
+	
+	// Wakes file_task with FILE_NOTIFY_NEW_IMAGE_MASK
+	ring_publish(&file_queue_ring);
+	return true;
+}
+
+
+/**
+ * Queue a line for the session metadata log holding the metadata of a recorded second
+ * without images.  The line is built now so its time and status are those of the
+ * second.  Returns false (and counts the image as dropped) if the queue is full or the
+ * line couldn't be built.
+ */
+bool file_task_queue_meta_record(int seq_num)
+{
+	int slot;
+	file_queue_entry_t* entryP;
+	
+	slot = ring_write_slot(&file_queue_ring, NULL);
+	if (slot < 0) {
+		file_task_drop_image();
+		return false;
+	}
 	
-		vTaskDelay(pdMS_TO_TICKS(FILE_EVAL_MSEC));
+	entryP = &file_queue[slot];
+	entryP->json_len = json_get_image_meta_line(seq_num, NULL, NULL, entryP->json_bufP, JSON_MAX_IMAGE_TEXT_LEN);
+	if (entryP->json_len == 0) {
+		file_task_drop_image();
+		return false;
 	}
+	entryP->binary = false;
+	entryP->meta = true;
+	entryP->compress = false;
+	entryP->camP = NULL;
+	entryP->lepP = NULL;
+	init_index_entry(&entryP->idx, NULL, NULL);
+	summary_get_sample(NULL, NULL, &entryP->sample);
+	init_thumb_entry(entryP->thumbP, NULL);
+	
+	portENTER_CRITICAL(&file_queue_mux);
+	if (++rec_stats.queued > rec_stats.max_queued) rec_stats.max_queued = rec_stats.queued;
+	portEXIT_CRITICAL(&file_queue_mux);
+	
+	// Wakes file_task with FILE_NOTIFY_NEW_IMAGE_MASK
+	ring_publish(&file_queue_ring);
+	return true;
+}
+
+
+/**
+ * Count an image app_task couldn't queue
+ */
+void file_task_drop_image()
+{
+	portENTER_CRITICAL(&file_queue_mux);
+	rec_stats.dropped++;
+	portEXIT_CRITICAL(&file_queue_mux);
+}
+
+
+/**
+ * Get the recording queue statistics for the current (or last) recording session
+ */
+void file_task_get_rec_stats(file_rec_stats_t* statsP)
+{
+	portENTER_CRITICAL(&file_queue_mux);
+	*statsP = rec_stats;
+	portEXIT_CRITICAL(&file_queue_mux);
+}
+
+
+/**
+ * Get the speed test result for the card in the camera (valid is clear if there isn't
+ * a tested card)
+ */
+void file_task_get_card_speed(file_card_speed_t* speedP)
+{
+	portENTER_CRITICAL(&card_speed_mux);
+	*speedP = card_speed;
+	portEXIT_CRITICAL(&card_speed_mux);
+}
+
+
+/**
+ * Get the free space, in MB, on the card as of the last time it was checked while the
+ * card was mounted (0 if it hasn't been)
+ */
+uint32_t file_task_get_free_mb()
+{
+	return card_free_mb;
 }
 
 
@@ -103,50 +643,340 @@ void file_task()
 /**
  * Process notifications from other tasks
  */
-static void handle_notifications()
+static void handle_notifications(uint32_t notification_value)
 {
-	uint32_t notification_value;
+	if (Notification(notification_value, FILE_NOTIFY_START_RECORDING_MASK)) {
+		if (setup_recording_session()) {
+			xTaskNotify(task_handle_app, APP_NOTIFY_RECORD_START_MASK, eSetBits);
+		} else {
+			xTaskNotify(task_handle_app, APP_NOTIFY_RECORD_NOSTART_MASK, eSetBits);
+		}
+	}
 	
-	notification_value = 0;
-	if (xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, 0)) {
+	// FILE_NOTIFY_NEW_IMAGE_MASK just wakes us to write the queued images
 	
-		if (Notification(notification_value, FILE_NOTIFY_START_RECORDING_MASK)) {
-			if (setup_recording_session()) {
-				xTaskNotify(task_handle_app, APP_NOTIFY_RECORD_START_MASK, eSetBits);
-			} else {
-				xTaskNotify(task_handle_app, APP_NOTIFY_RECORD_NOSTART_MASK, eSetBits);
+	if (Notification(notification_value, FILE_NOTIFY_NEW_LEP_RECORD_MASK)) {
+		// Return the frame to lep_task whether or not the write succeeds
+		note_write_result(write_lep_record());
+		xTaskNotify(task_handle_lep, LEP_NOTIFY_REC_DONE_MASK, eSetBits);
+	}
+	
+	if (Notification(notification_value, FILE_NOTIFY_STOP_RECORDING_MASK)) {
+		end_recording_session(false);
+	}
+	
+	if (Notification(notification_value, FILE_NOTIFY_SUSPEND_REC_MASK)) {
+		end_recording_session(true);
+	}
+	
+#ifdef SD_CD_IO
+	if (Notification(notification_value, FILE_NOTIFY_CARD_DETECT_MASK)) {
+		// Restart the debounce period on each switch transition
+		cd_settling = true;
+		cd_change_tick = xTaskGetTickCount();
+	}
+#endif
+
+	if (Notification(notification_value, FILE_NOTIFY_PREP_CARD_MASK)) {
+		prepare_card();
+	}
+	
+#ifdef INCLUDE_SYS_TRACE
+	if (Notification(notification_value, FILE_NOTIFY_DUMP_TRACE_MASK)) {
+		dump_trace();
+	}
+#endif
+
+#ifdef INCLUDE_SYS_BENCH
+	if (Notification(notification_value, FILE_NOTIFY_BENCH_MASK)) {
+		run_benchmark();
+	}
+#endif
+}
+
+
+/**
+ * Write the oldest queued image and return its buffers.  Returns true if there was an
+ * image in the queue.  Images queued after a session ended are dropped.  An image that
+ * can't be written to the card is written to the flash spool instead.
+ */
+static bool write_queued_image()
+{
+	int slot;
+	bool success = false;
+	bool spooled = false;
+	file_queue_entry_t* entryP;
+	
+	slot = ring_read_slot(&file_queue_ring);
+	if (slot < 0) return false;
+	
+	// Only file_task unloads entries so the slot is ours until it is released
+	entryP = &file_queue[slot];
+	if (recording) {
+		if (!spool_card_failed) {
+			success = write_queued_entry(entryP, false);
+			if (!success && spool_enabled) {
+				ESP_LOGW(TAG, "Spooling images until the SD Card is writing again");
+				spool_card_failed = true;
+				spool_retry_tick = xTaskGetTickCount();
 			}
 		}
+		if (!success && spool_card_failed) {
+			spooled = write_queued_entry(entryP, true);
+			success = spooled;
+			if (spooled) {
+				portENTER_CRITICAL(&file_queue_mux);
+				rec_stats.spooled++;
+				portEXIT_CRITICAL(&file_queue_mux);
+				update_spool_pending();
+			}
+		}
+		summary_add_image(&entryP->sample, rec_seq_num, success, spooled);
+		rec_seq_num++;
 		
-		if (Notification(notification_value, FILE_NOTIFY_NEW_IMAGE_MASK)) {
-			if (write_image_file()) {
-				xTaskNotify(task_handle_app, APP_NOTIFY_RECORD_IMG_DONE_MASK, eSetBits);
-			} else {
-				xTaskNotify(task_handle_app, APP_NOTIFY_RECORD_FAIL_MASK, eSetBits);
-			}		  
+		note_write_result(success);
+		if (success) {
+			// A spooled image's index entry is written when it is moved to the card.  Metadata
+			// log lines aren't indexed.
+			if (!spooled && !entryP->meta && !write_index_entry(&entryP->idx)) {
+				ESP_LOGE(TAG, "Could not write index entry for image %u", entryP->idx.seq_num);
+			}
+			write_thumb(entryP, spooled);
+			xTaskNotify(task_handle_app, APP_NOTIFY_RECORD_IMG_DONE_MASK, eSetBits);
+		}
+		
+		// Images in a container are only safe once it has been synced
+		if (!rec_container || (cont_unsynced == 0)) {
+			update_journal();
 		}
+	}
+	
+	system_cam_buffer_release(entryP->camP);
+	entryP->camP = NULL;
+	system_lep_frame_release(entryP->lepP);
+	entryP->lepP = NULL;
+	
+	portENTER_CRITICAL(&file_queue_mux);
+	rec_stats.queued--;
+	portEXIT_CRITICAL(&file_queue_mux);
+	ring_release(&file_queue_ring);
+	
+	return true;
+}
+
+
+/**
+ * Write a queued image to the card or, if spool is set, to the flash spool.  The jpeg
+ * stays in a spooled image in AVI mode.
+ */
+static bool write_queued_entry(file_queue_entry_t* entryP, bool spool)
+{
+	bool success;
+	
+	img_spooling = spool;
+	if (spool) {
+		entryP->idx.flags &= ~FILE_INDEX_FLAG_AVI;
+	}
+	if (entryP->meta && !spool) {
+		success = write_meta_record(entryP);
+	} else if (entryP->binary) {
+		success = write_binary_image_file(entryP);
+	} else {
+		success = write_image_file(entryP);
+	}
+	img_spooling = false;
+	
+	return success;
+}
+
+
+/**
+ * Return the number of images waiting in the queue
+ */
+static int get_queue_count()
+{
+	int n;
+	
+	portENTER_CRITICAL(&file_queue_mux);
+	n = rec_stats.queued;
+	portEXIT_CRITICAL(&file_queue_mux);
+	
+	return n;
+}
+
+
+/**
+ * Track write failures.  A failed image or record is dropped and counted.  We only give
+ * up on the session (and let app_task try to recover) when writes keep failing.
+ */
+static void note_write_result(bool success)
+{
+	if (success) {
+		rec_write_fails = 0;
+	} else {
+		portENTER_CRITICAL(&file_queue_mux);
+		rec_stats.write_errors++;
+		portEXIT_CRITICAL(&file_queue_mux);
 		
-		if (Notification(notification_value, FILE_NOTIFY_STOP_RECORDING_MASK)) {
-			recording = false;
-			rec_seq_num = 0;
-			file_unmount_sdcard();
-			ESP_LOGI(TAG, "End recording session");
+		if (++rec_write_fails == FILE_MAX_WRITE_FAILS) {
+			ESP_LOGE(TAG, "%d consecutive write failures", rec_write_fails);
+			xTaskNotify(task_handle_app, APP_NOTIFY_RECORD_FAIL_MASK, eSetBits);
+		}
+	}
+}
+
+
+/**
+ * Move the oldest image in the flash spool to its session directory on the card.  Called
+ * when there's nothing else to write.  Returns true if an image was moved.  While the
+ * card is failing this is only tried every FILE_SPOOL_RETRY_MSEC and the first image
+ * moved sends images back to the card.
+ */
+static bool migrate_spool()
+{
+	spool_header_t hdr;
+	file_index_entry_t idx;
+	FILE* fp;
+	uint32_t offset;
+	uint32_t len;
+	bool success;
+	
+	if (!spool_enabled || (spool_get_count() == 0) || !file_get_card_mounted()) return false;
+	if (spool_card_failed &&
+	    ((xTaskGetTickCount() - spool_retry_tick) < pdMS_TO_TICKS(FILE_SPOOL_RETRY_MSEC)))
+	{
+		return false;
+	}
+	if (!spool_get_next(&hdr)) return false;
+	hdr.dir_name[SESSION_DIR_NAME_LEN-1] = 0;
+	
+	// The image is copied through the staging buffer so nothing can be left in it
+	success = flush_buffer();
+	if (success) {
+		success = file_open_spooled_image_file(hdr.dir_name, hdr.seq_num, (hdr.type == FILE_CONTAINER_TYPE_FCR), &fp);
+	}
+	if (success) {
+		for (offset=0; success && (offset < hdr.length); offset += len) {
+			len = hdr.length - offset;
+			if (len > FILE_WRITE_BUF_LEN) len = FILE_WRITE_BUF_LEN;
+			success = spool_read(offset, stage_bufP, len) && write_direct(fp, stage_bufP, len);
 		}
+		success = success && (fflush(fp) == 0) && (fsync(fileno(fp)) == 0);
+		file_close_file(fp);
+	}
+	
+	if (!success) {
+		spool_card_failed = true;
+		spool_retry_tick = xTaskGetTickCount();
+		return false;
+	}
+	
+	memcpy(&idx, hdr.info, sizeof(file_index_entry_t));
+	if (!write_spooled_index_entry(hdr.dir_name, &idx)) {
+		ESP_LOGE(TAG, "Could not write index entry for spooled image %u", hdr.seq_num);
+	}
+	spool_release();
+	update_spool_pending();
+	
+	if (spool_card_failed) {
+		ESP_LOGI(TAG, "SD Card writing again - %d images left in the spool", spool_get_count());
+		spool_card_failed = false;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Append a spooled image's entry to its session's index.  The entry goes through the
+ * open index when the image belongs to the session being recorded.
+ */
+static bool write_spooled_index_entry(char* dir_name, file_index_entry_t* idxP)
+{
+	bool is_new;
+	bool success = true;
+	file_index_header_t hdr;
+	FILE* fp;
+	
+	if (recording && (strcmp(dir_name, rec_dir_name) == 0)) {
+		return write_index_entry(idxP);
+	}
+	
+	if (!file_open_index_file(dir_name, &fp, &is_new)) {
+		return false;
+	}
+	if (is_new) {
+		init_index_header(&hdr);
+		success = write_direct(fp, (uint8_t*) &hdr, sizeof(hdr));
 	}
+	success = success && write_direct(fp, (uint8_t*) idxP, sizeof(file_index_entry_t));
+	file_close_file(fp);
+	
+	return success;
+}
+
+
+/**
+ * Make the number of images waiting in the flash spool available in the recording stats
+ */
+static void update_spool_pending()
+{
+	int n;
+	
+	n = spool_enabled ? spool_get_count() : 0;
+	portENTER_CRITICAL(&file_queue_mux);
+	rec_stats.spool_pending = n;
+	portEXIT_CRITICAL(&file_queue_mux);
 }
 
 
 /**
  * Handle card insertion/removal detection.  Initialize the a new card.  Update the
  * card present status available from file_utilities and notify the app_task of changes.
+ * Uses the card-detect switch if there is one, otherwise periodically probes the card.
  */
 static void update_card_present_info()
 {
-	if (--card_check_count == 0) {
+#ifdef SD_CD_IO
+	bool inserted;
+	
+	// Wait for the switch to settle after it changes
+	if (cd_settling) {
+		if ((xTaskGetTickCount() - cd_change_tick) < pdMS_TO_TICKS(FILE_CD_DEBOUNCE_MSEC)) {
+			return;
+		}
+		cd_settling = false;
+		cd_init_failed = false;
+	}
+	
+	if (recording) return;
+	
+	inserted = file_get_card_detect();
+	if (inserted && !file_get_card_present() && !cd_init_failed) {
+		if (file_reinit_card()) {
+			xTaskNotify(task_handle_app, APP_NOTIFY_SDCARD_PRESENT_MASK, eSetBits);
+			ESP_LOGI(TAG, "SD Card detected inserted");
+			mount_idle_card();
+		} else {
+			cd_init_failed = true;
+		}
+	} else if (!inserted && file_get_card_present()) {
+		file_set_card_removed();
+		card_speed.valid = false;
+		xTaskNotify(task_handle_app, APP_NOTIFY_SDCARD_MISSING_MASK, eSetBits);
+		ESP_LOGI(TAG, "SD Card detected removed");
+	}
+#else
+	if ((xTaskGetTickCount() - card_check_tick) >= pdMS_TO_TICKS(FILE_CARD_CHECK_PERIOD_MSEC)) {
 		if (!recording) {
 			if (file_get_card_present()) {
 				// Make sure it's still there
-				if (!file_check_card_still_present()) {
+				if (file_check_card_still_present()) {
+					card_probe_fails = 0;
+				} else if (++card_probe_fails >= FILE_CARD_MISSING_PROBES) {
+					card_probe_fails = 0;
+					file_set_card_removed();
+					card_speed.valid = false;
 					xTaskNotify(task_handle_app, APP_NOTIFY_SDCARD_MISSING_MASK, eSetBits);
 					ESP_LOGI(TAG, "SD Card detected removed");
 				}
@@ -157,83 +987,1890 @@ static void update_card_present_info()
 					if (file_reinit_card()) {
 						xTaskNotify(task_handle_app, APP_NOTIFY_SDCARD_PRESENT_MASK, eSetBits);
 						ESP_LOGI(TAG, "SD Card detected inserted");
+						mount_idle_card();
 					}
 				}
 			}
 		}
 		
-		card_check_count = FILE_CARD_CHECK_PERIOD_MSEC / FILE_EVAL_MSEC;
+		card_check_tick = xTaskGetTickCount();
 	}
+#endif
 }
 
 
 /**
- * Setup a recording session - initialize (if necessary), mount the sd card and create
- * the session directory.
+ * Mount a newly found card to format it if necessary and test its speed.  It is left
+ * mounted in persistent mount mode, or if app_task is going to resume an interrupted
+ * recording session, and the free space is read now, while we're idle, so FATFS has it
+ * cached for recording.
  */
-static bool setup_recording_session()
+static void mount_idle_card()
 {
-	if (file_get_card_present()) {
-		if (file_mount_sdcard()) {
-			rec_dir_name = file_get_session_directory_name();
-			if (file_create_directory(rec_dir_name)) {
-				recording = true;
-				rec_seq_num = 1;
-				ESP_LOGI(TAG, "Start recording session: %s", rec_dir_name);
-				return true;
-			} else {
-				ESP_LOGE(TAG, "Could not create session directory");
-			}
-		} else {
-			ESP_LOGE(TAG, "Could not mount the SD Card");
-		}
-	} else {
-		ESP_LOGE(TAG, "Attempted to start recording when SD Card not present - internal logic error");
+	bool resuming;
+	bool keep_mounted;
+	
+	if (!file_mount_sdcard()) return;
+	
+	// Don't hold up or second-guess a session that is about to resume
+	resuming = ps_get_rec_enable() && ps_get_rec_journal(&rec_journal);
+	if (!resuming) {
+		test_card_speed();
 	}
 	
-	return false;
-}
-
+#ifdef FILE_KEEP_MOUNTED
+	keep_mounted = true;
+#else
+	keep_mounted = resuming;
+#endif
+	
+	update_free_space(true);
+	if (keep_mounted) {
+		ESP_LOGI(TAG, "SD Card mounted with %u MB free", card_free_mb);
+	} else {
+		file_unmount_sdcard();
+	}
+}
+
+
+/**
+ * Reformat the card for recording in response to the prepare_card command.  Not
+ * allowed while recording or while a session is waiting to be resumed.
+ */
+static void prepare_card()
+{
+	if (recording || (ps_get_rec_enable() && ps_get_rec_journal(&rec_journal))) {
+		ESP_LOGE(TAG, "Can't prepare the SD Card during a recording session");
+		return;
+	}
+	if (!file_get_card_present()) {
+		ESP_LOGE(TAG, "No SD Card to prepare");
+		return;
+	}
+	
+	file_unmount_sdcard();
+	if (file_format_card()) {
+		ESP_LOGI(TAG, "SD Card prepared");
+	}
+	mount_idle_card();
+}
+
 
 /**
- * Create and write out an image file from the shared image buffer
+ * Time writing a test file to the mounted card, check the recording profile against the
+ * result and make it available through file_task_get_card_speed (see FILE_SPEED_TEST_LEN)
  */
-static bool write_image_file()
+static void test_card_speed()
 {
-	bool err = false;
-	char* image_json_text;
+	file_card_speed_t speed;
 	FILE* fp;
-	int write_ret;
-	int len;
-	uint32_t image_json_len;
-	uint32_t byte_offset;
+	int64_t start_usec;
+	uint32_t usec;
+	uint32_t offset;
+	uint32_t n;
+	int i;
+	bool success;
+	
+	memset(&speed, 0, sizeof(file_card_speed_t));
+	portENTER_CRITICAL(&card_speed_mux);
+	card_speed = speed;
+	portEXIT_CRITICAL(&card_speed_mux);
+	
+	if ((stage_bufP == NULL) || (file_get_free_bytes() < (2 * FILE_SPEED_TEST_LEN))) {
+		ESP_LOGW(TAG, "Skipping SD Card speed test");
+		return;
+	}
+	if (!file_open_root_write_file(FILE_SPEED_TEST_FILE_NAME, &fp)) return;
+	
+	// Sequential writes including the final sync
+	success = true;
+	start_usec = esp_timer_get_time();
+	for (n=0; (n<FILE_SPEED_TEST_LEN) && success; n+=FILE_WRITE_BUF_LEN) {
+		success = (fwrite(stage_bufP, 1, FILE_WRITE_BUF_LEN, fp) == FILE_WRITE_BUF_LEN);
+	}
+	success = success && (fflush(fp) == 0) && (fsync(fileno(fp)) == 0);
+	usec = (uint32_t) (esp_timer_get_time() - start_usec);
+	if (usec != 0) {
+		speed.seq_rate = (float) FILE_SPEED_TEST_LEN / (float) usec;   // bytes/uSec = MB/sec
+	}
+	
+	// Synced writes scattered through the file
+	for (i=0; (i<FILE_SPEED_TEST_RAND_WRITES) && success; i++) {
+		offset = (esp_random() % (FILE_SPEED_TEST_LEN / FILE_SPEED_TEST_RAND_LEN)) * FILE_SPEED_TEST_RAND_LEN;
+		start_usec = esp_timer_get_time();
+		success = (fseek(fp, offset, SEEK_SET) == 0) &&
+		          (fwrite(stage_bufP, 1, FILE_SPEED_TEST_RAND_LEN, fp) == FILE_SPEED_TEST_RAND_LEN) &&
+		          (fflush(fp) == 0) &&
+		          (fsync(fileno(fp)) == 0);
+		usec = (uint32_t) (esp_timer_get_time() - start_usec);
+		speed.rand_avg_usec += usec;
+		if (usec > speed.rand_max_usec) speed.rand_max_usec = usec;
+	}
+	
+	file_close_file(fp);
+	(void) file_delete_root_file(FILE_SPEED_TEST_FILE_NAME);
+	
+	if (!success) {
+		ESP_LOGE(TAG, "SD Card speed test write failed");
+		return;
+	}
+	speed.rand_avg_usec /= FILE_SPEED_TEST_RAND_WRITES;
+	speed.valid = true;
+	ESP_LOGI(TAG, "SD Card writes %1.2f MB/sec sequential, %u uSec (max %u uSec) synced random",
+	         speed.seq_rate, speed.rand_avg_usec, speed.rand_max_usec);
+	
+	check_rec_profile(&speed);
+	
+	portENTER_CRITICAL(&card_speed_mux);
+	card_speed = speed;
+	portEXIT_CRITICAL(&card_speed_mux);
+}
+
+
+/**
+ * Warn when the card can't sustain the recording profile and, with
+ * FILE_SPEED_AUTO_PROFILE, switch to the closest profile it can sustain: a binary format
+ * instead of json at the same interval, otherwise the next longer interval that works
+ * with the configured format (or a binary one).
+ */
+static void check_rec_profile(file_card_speed_t* speedP)
+{
+	uint8_t format = gui_st.record_format;
+	uint16_t interval = gui_st.record_interval;
+#ifdef FILE_SPEED_AUTO_PROFILE
+	uint8_t new_format = format;
+	int new_index = -1;
+	int i;
+#endif
 	
-	image_json_text = sys_image_file_buffer.bufferP;
-	image_json_len = sys_image_file_buffer.length;
+	speedP->sustainable = profile_sustainable(speedP, format, interval);
+	if (speedP->sustainable) return;
 	
-	if (file_open_image_write_file(rec_dir_name, rec_seq_num, &fp)) {
-		byte_offset = 0;
-		while (byte_offset < image_json_len) {
-			// Determine maximum bytes to write
-			len = image_json_len - byte_offset;
-			if (len > MAX_FILE_WRITE_LEN) len = MAX_FILE_WRITE_LEN;
-			
-			write_ret = fwrite(&image_json_text[byte_offset], 1, len, fp);
-			if (write_ret < 0) {
-				ESP_LOGE(TAG, "Error in file write - %d", write_ret);
-				err = true;
-				break;
+	ESP_LOGW(TAG, "SD Card is too slow to record format %d every %d sec", format, interval);
+	
+#ifdef FILE_SPEED_AUTO_PROFILE
+	if ((format == REC_FORMAT_JSON) && profile_sustainable(speedP, REC_FORMAT_BINARY_Z, interval)) {
+		new_format = REC_FORMAT_BINARY_Z;
+		new_index = gui_st.record_interval_index;
+	} else {
+		for (i=0; i<REC_INT_NUM; i++) {
+			if ((record_intervals[i].interval <= interval) ||
+			    ((new_index >= 0) && (record_intervals[i].interval >= record_intervals[new_index].interval)))
+			{
+				continue;
+			}
+			if (profile_sustainable(speedP, format, record_intervals[i].interval)) {
+				new_format = format;
+				new_index = i;
+			} else if ((format == REC_FORMAT_JSON) &&
+			           profile_sustainable(speedP, REC_FORMAT_BINARY_Z, record_intervals[i].interval))
+			{
+				new_format = REC_FORMAT_BINARY_Z;
+				new_index = i;
 			}
-			byte_offset += write_ret;
 		}
+	}
 	
-		file_close_file(fp);
-		rec_seq_num++;
+	if (new_index >= 0) {
+		gui_st.record_format = new_format;
+		gui_st.record_interval_index = new_index;
+		gui_st.record_interval = record_intervals[new_index].interval;
+		ps_set_gui_state(&gui_st);
+		xTaskNotify(task_handle_app, APP_NOTIFY_RECORD_PARM_UPD_MASK, eSetBits);
+		speedP->profile_changed = true;
+		
+		ESP_LOGW(TAG, "Recording changed to format %d every %d sec", new_format, gui_st.record_interval);
+#ifdef INCLUDE_SYS_GUI
+		gui_preset_message_box_string("The SD Card is too slow for the recording settings.  They have been changed to ones it can keep up with.");
+		xTaskNotify(task_handle_gui, GUI_NOTIFY_MESSAGEBOX_MASK, eSetBits);
+#endif
+		return;
+	}
+#endif
+	
+#ifdef INCLUDE_SYS_GUI
+	gui_preset_message_box_string("The SD Card is too slow for the recording settings.  Images will be dropped.");
+	xTaskNotify(task_handle_gui, GUI_NOTIFY_MESSAGEBOX_MASK, eSetBits);
+#endif
+}
+
+
+/**
+ * Return true if the tested card can keep up with recording format at interval
+ */
+static bool profile_sustainable(file_card_speed_t* speedP, uint8_t format, uint16_t interval)
+{
+	uint64_t image_usec;
+	uint64_t sec_usec;
+	
+	if (speedP->seq_rate <= 0) return false;
+	
+	// Time to write one image
+	image_usec = (uint64_t) ((float) ((format == REC_FORMAT_JSON) ? FILE_EST_JSON_IMAGE_LEN : FILE_EST_FCR_IMAGE_LEN) /
+	                         speedP->seq_rate);
+	image_usec += FILE_SPEED_IMAGE_SYNCS * speedP->rand_avg_usec;
+	
+	if (interval == REC_INT_FAST_VAL) {
+		// The high-rate records and an image every second
+		sec_usec = image_usec;
+		sec_usec += (uint64_t) ((float) (FILE_SPEED_LEP_RECS_PER_SEC * FILE_LEP_RECORD_LEN) / speedP->seq_rate);
+		interval = 1;
+	} else {
+		sec_usec = image_usec / interval;
+	}
+	
+	return ((sec_usec * FILE_SPEED_MARGIN) <= 1000000) &&
+	       (speedP->rand_max_usec <= ((uint64_t) FILE_QUEUE_LEN * interval * 1000000));
+}
+
+
+#ifdef SD_CD_IO
+/**
+ * Card-detect switch interrupt handler - wake file_task to debounce the change
+ */
+static void IRAM_ATTR card_detect_isr(void* arg)
+{
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+	
+	xTaskNotifyFromISR(task_handle_file, FILE_NOTIFY_CARD_DETECT_MASK, eSetBits, &xHigherPriorityTaskWoken);
+	if (xHigherPriorityTaskWoken == pdTRUE) {
+		portYIELD_FROM_ISR();
+	}
+}
+#endif
+
+
+/**
+ * Setup a recording session - initialize (if necessary), mount the sd card and create
+ * the session directory.
+ */
+static bool setup_recording_session()
+{
+	bool resume;
+	
+	if (file_get_card_present()) {
+		if (file_mount_sdcard()) {
+			// A valid journal means the last session was interrupted so we resume it
+			resume = ps_get_rec_journal(&rec_journal);
+			if (!resume) {
+				strncpy(rec_journal.session_dir, file_get_session_directory_name(), PS_JRNL_DIR_LEN);
+				rec_journal.session_dir[PS_JRNL_DIR_LEN] = 0;
+				rec_journal.image_seq_num = 1;
+				rec_journal.container_num = 0;
+				rec_journal.lep_seq_num = 1;
+				rec_journal.lep_offset = 0;
+			}
+			rec_dir_name = rec_journal.session_dir;
+			if (file_create_directory(rec_dir_name)) {
+				recording = true;
+				rec_seq_num = rec_journal.image_seq_num;
+				lep_rec_seq_num = rec_journal.lep_seq_num;
+				lep_rec_resume_offset = rec_journal.lep_offset;
+				lep_rec_unsynced = 0;
+				thumb_countdown = 0;
+				tlog_failed = false;
+				tlog_count = 0;
+				tlog_sample_tick = xTaskGetTickCount();
+				tlog_flush_tick = tlog_sample_tick;
+				meta_unsynced = 0;
+				wr_bytes = 0;
+				wr_usec = 0;
+				wr_rate = 0;
+				rec_write_fails = 0;
+				portENTER_CRITICAL(&file_queue_mux);
+				rec_stats.max_queued = rec_stats.queued;
+				rec_stats.dropped = 0;
+				rec_stats.write_errors = 0;
+				rec_stats.spooled = 0;
+				portEXIT_CRITICAL(&file_queue_mux);
+				spool_card_failed = false;
+				rec_container = gui_st.record_container && (cont_indexP != NULL);
+				rec_ring = gui_st.record_ring;
+				rec_avi = (gui_st.record_format == REC_FORMAT_AVI) && (avi_indexP != NULL);
+				avi_usec_per_frame = 1000000 * ((gui_st.record_interval > 1) ? gui_st.record_interval : 1);
+				ring_evicting = false;
+				ring_oldest_valid = false;
+				ring_check_tick = xTaskGetTickCount() - pdMS_TO_TICKS(FILE_RING_CHECK_MSEC);
+				cont_num = rec_journal.container_num;
+				cont_est_image_len = (gui_st.record_format == REC_FORMAT_JSON) ? FILE_EST_JSON_IMAGE_LEN :
+				                                                                  FILE_EST_FCR_IMAGE_LEN;
+				// Images are recorded at most once per second (the Lepton rate goes to
+				// the high-rate recording file)
+				cont_images_per_extent = FILE_PREALLOC_SEC / ((gui_st.record_interval > 1) ? gui_st.record_interval : 1);
+				if (cont_images_per_extent == 0) cont_images_per_extent = 1;
+				ps_set_rec_journal(&rec_journal, false);
+				summary_start(rec_dir_name, resume, gui_st.rec_arducam_enable, gui_st.rec_lepton_enable);
+				summary_write_tick = xTaskGetTickCount();
+				ESP_LOGI(TAG, "%s recording session: %s", resume ? "Resume" : "Start", rec_dir_name);
+				return true;
+			} else {
+				ESP_LOGE(TAG, "Could not create session directory");
+			}
+		} else {
+			ESP_LOGE(TAG, "Could not mount the SD Card");
+		}
+	} else {
+		ESP_LOGE(TAG, "Attempted to start recording when SD Card not present - internal logic error");
+	}
+	
+	return false;
+}
+
+
+/**
+ * Close the session's files and unmount the card.  The journal is cleared when a session
+ * is stopped.  A suspended session (app_task is restarting after repeated write
+ * failures) keeps it, without writing the remaining queued images, so the session is
+ * resumed after the restart.
+ */
+static void end_recording_session(bool suspend)
+{
+	if (suspend) {
+		sync_lep_record_file();
+	} else {
+		// Finish writing the images queued before recording stopped
+		while (write_queued_image()) {}
+	}
+	write_summary(true, !suspend);
+	close_lep_record_file();
+	close_container();
+	close_avi_file();
+	close_index_file();
+	close_thumb_file();
+	close_tlog_file();
+	close_meta_file();
+	recording = false;
+	
+	if (suspend) {
+		// Drop any remaining queued images
+		while (write_queued_image()) {}
+		update_journal();
+	} else {
+		ps_clear_rec_journal();
+	}
+	
+	rec_seq_num = 0;
+#ifndef FILE_KEEP_MOUNTED
+	file_unmount_sdcard();
+#endif
+	ESP_LOGI(TAG, "%s recording session: %u kB written at %1.2f MB/sec", suspend ? "Suspend" : "End",
+	         (uint32_t) (wr_bytes / 1024), wr_rate);
+	ESP_LOGI(TAG, "  Max queued images: %d, dropped: %u, write errors: %u", rec_stats.max_queued,
+	         rec_stats.dropped, rec_stats.write_errors);
+}
+
+
+/**
+ * Update card_free_mb if the card is mounted and it has been FILE_FREE_CHECK_MSEC since
+ * the last check (or now is set).  FATFS keeps the free cluster count so this doesn't
+ * read the FAT.
+ */
+static void update_free_space(bool now)
+{
+	if (!file_get_card_mounted()) return;
+	
+	if (now || ((xTaskGetTickCount() - card_free_tick) >= pdMS_TO_TICKS(FILE_FREE_CHECK_MSEC))) {
+		card_free_tick = xTaskGetTickCount();
+		card_free_mb = (uint32_t) (file_get_free_bytes() / (1024*1024));
+	}
+}
+
+
+/**
+ * Ring recording housekeeping - called when there's nothing to write.  Checks the free
+ * space periodically and, while it is low, deletes a piece of the oldest session each
+ * call.  The oldest session is found once and remembered until it has been deleted.
+ */
+static void update_ring()
+{
+	bool done;
+	
+	if ((xTaskGetTickCount() - ring_check_tick) >= pdMS_TO_TICKS(FILE_RING_CHECK_MSEC)) {
+		ring_check_tick = xTaskGetTickCount();
+		ring_free_mb = (uint32_t) (file_get_free_bytes() / (1024*1024));
+		if (!ring_evicting && (ring_free_mb < FILE_RING_LOW_FREE_MB)) {
+			ESP_LOGI(TAG, "%u MB free - deleting old sessions", ring_free_mb);
+			ring_evicting = true;
+		} else if (ring_evicting && (ring_free_mb >= FILE_RING_HIGH_FREE_MB)) {
+			ESP_LOGI(TAG, "%u MB free", ring_free_mb);
+			ring_evicting = false;
+		}
+	}
+	
+	if (!ring_evicting) return;
+	
+	if (!ring_oldest_valid) {
+		if (!file_find_oldest_session(rec_dir_name, ring_oldest)) {
+			ESP_LOGW(TAG, "No old sessions left to delete");
+			ring_evicting = false;
+			return;
+		}
+		ring_oldest_valid = true;
+		ESP_LOGI(TAG, "Deleting %s", ring_oldest);
+	}
+	
+	if (!file_delete_session_step(ring_oldest, &done)) {
+		// Give up until the next free space check
+		ring_evicting = false;
+		ring_oldest_valid = false;
+		return;
+	}
+	
+	if (done) {
+		ring_oldest_valid = false;
+		
+		// Check if we've freed enough right away
+		ring_check_tick = xTaskGetTickCount() - pdMS_TO_TICKS(FILE_RING_CHECK_MSEC);
+	}
+}
+
+
+/**
+ * Update the journal with the next image number and container.  A session resumed
+ * after a crash starts a new container since the open one may have unsynced data past
+ * its last sync.
+ */
+static void update_journal()
+{
+	rec_journal.image_seq_num = rec_seq_num;
+	rec_journal.container_num = (cont_fp != NULL) ? cont_num + 1 : cont_num;
+	ps_set_rec_journal(&rec_journal, true);
+}
+
+
+/**
+ * Create and write out an image file from a queued json image
+ */
+static bool write_image_file(file_queue_entry_t* entryP)
+{
+	bool success;
+	FILE* fp;
+	
+	if (open_image_output(FILE_CONTAINER_TYPE_JSON, entryP->json_len, &fp)) {
+		success = write_image_data(fp, (uint8_t*) entryP->json_bufP, entryP->json_len);
+		success = close_image_output(fp, FILE_CONTAINER_TYPE_JSON, entryP->json_len, success, &entryP->idx);
+	} else {
+		ESP_LOGE(TAG, "Could not open file for writing");
+		success = false;
+	}
+	
+	return success;
+}
+
+
+/**
+ * Create and write out a binary image record file directly from the image buffers
+ * held by a queue entry.  Only the configured crop of the radiometric image is written.
+ */
+static bool write_binary_image_file(file_queue_entry_t* entryP)
+{
+	cam_buffer_t* camP = entryP->camP;
+	lep_buffer_t* lepP = entryP->lepP;
+	sys_lep_roi_t crop;
+	bool cropped;
+	bool success;
+	FILE* fp;
+	static uint8_t hdr_buf[BINREC_MAX_HEADER_LEN];
+	binrec_header_t* hdrP = (binrec_header_t*) hdr_buf;
+	uint32_t hdr_len;
+	uint32_t rec_len;
+	uint32_t z_len = 0;
+	uint8_t contents = IMG_CONTENT_ALL;
+	
+	// The jpeg goes to the AVI file in AVI mode (it stays in the record if it couldn't
+	// be written there)
+	if (rec_avi && (camP != NULL) && !img_spooling) {
+		if (write_avi_frame(camP, &entryP->idx)) {
+			contents &= ~IMG_CONTENT_CAM;
+		}
+	}
+	
+	cropped = lepton_get_crop(&crop);
+	if (entryP->compress && (lepP != NULL)) {
+		z_len = radcodec_encode_region(lepP->lep_bufferP + crop.y*LEP_WIDTH + crop.x, LEP_WIDTH, crop.w, crop.h,
+		                               file_lep_z_bufferP, LEP_CROP_PIXEL_LEN(&crop) - 1);
+	}
+	if (cropped && (lepP != NULL) && (z_len == 0)) {
+		// Uncompressed cropped data is gathered in the compression buffer
+		lepton_crop_copy(lepP->lep_bufferP, &crop, (uint16_t*) file_lep_z_bufferP);
+	}
+	hdr_len = binrec_build_header(hdr_buf, rec_seq_num, camP, lepP, contents, z_len, &crop);
+	rec_len = hdr_len + hdrP->jpeg_len + hdrP->lep_len + hdrP->telem_len;
+	
+	if (open_image_output(FILE_CONTAINER_TYPE_FCR, rec_len, &fp)) {
+		success = write_image_data(fp, hdr_buf, hdr_len);
+		if (success && (hdrP->jpeg_len != 0)) {
+			success = write_image_data(fp, camP->cam_bufferP, camP->cam_buffer_len);
+		}
+		if (success && (lepP != NULL)) {
+			if (z_len != 0) {
+				success = write_image_data(fp, file_lep_z_bufferP, z_len);
+			} else if (cropped) {
+				success = write_image_data(fp, file_lep_z_bufferP, LEP_CROP_PIXEL_LEN(&crop));
+			} else {
+				success = write_image_data(fp, (uint8_t*) lepP->lep_bufferP, LEP_NUM_PIXELS*2);
+			}
+			if (success) {
+				success = write_image_data(fp, (uint8_t*) lepP->lep_telemP, LEP_TEL_WORDS*2);
+			}
+		}
+		success = close_image_output(fp, FILE_CONTAINER_TYPE_FCR, rec_len, success, &entryP->idx);
 	} else {
 		ESP_LOGE(TAG, "Could not open file for writing");
-		err = true;
+		success = false;
+	}
+	
+	return success;
+}
+
+
+/**
+ * Write image data to the output from open_image_output
+ */
+static bool write_image_data(FILE* fp, uint8_t* bufP, uint32_t length)
+{
+	if (img_spooling) {
+		return spool_write(bufP, length);
+	}
+	
+	return write_buffer(fp, bufP, length);
+}
+
+
+/**
+ * Get a file to write an image of length bytes to.  This is a new image file or, in
+ * container mode, the session container positioned after a new entry header.  A
+ * spooled image is a new spool record (and fp is set to NULL).
+ */
+static bool open_image_output(uint16_t type, uint32_t length, FILE** fp)
+{
+	file_container_entry_t entry;
+	
+	if (img_spooling) {
+		*fp = NULL;
+		return spool_start_record(rec_dir_name, rec_seq_num, type, length);
+	}
+	
+	if (!rec_container) {
+		return file_open_image_write_file(rec_dir_name, rec_seq_num, (type == FILE_CONTAINER_TYPE_FCR), fp);
+	}
+	
+	if (cont_fp == NULL) {
+		if (!open_container()) {
+			return false;
+		}
+	}
+	
+	entry.magic = FILE_CONTAINER_ENTRY_MAGIC;
+	entry.type = type;
+	entry.reserved = 0;
+	entry.seq_num = rec_seq_num;
+	entry.length = length;
+	if (!write_buffer(cont_fp, (uint8_t*) &entry, sizeof(entry))) {
+		discard_buffer();
+		fseek(cont_fp, cont_data_end, SEEK_SET);
+		return false;
+	}
+	
+	*fp = cont_fp;
+	return true;
+}
+
+
+/**
+ * Finish writing an image.  Image files are closed.  Container records are added to
+ * the index if they were completely written or overwritten by the next record if not.
+ * Spool records are completed with their index entry.  Returns success.
+ */
+static bool close_image_output(FILE* fp, uint16_t type, uint32_t length, bool success, file_index_entry_t* idxP)
+{
+	if (success) {
+		success = flush_buffer();
+	} else {
+		discard_buffer();
+	}
+	
+	idxP->seq_num = rec_seq_num;
+	idxP->type = type;
+	idxP->length = length;
+	
+	if (img_spooling) {
+		// It will be moved to an image file
+		idxP->container_num = FILE_INDEX_NO_CONTAINER;
+		idxP->offset = 0;
+		return spool_end_record(success, idxP, sizeof(file_index_entry_t));
+	}
+	
+	if (!rec_container) {
+		file_close_file(fp);
+		idxP->container_num = FILE_INDEX_NO_CONTAINER;
+		idxP->offset = 0;
+		return success;
+	}
+	
+	if (!success) {
+		fseek(cont_fp, cont_data_end, SEEK_SET);
+		return false;
+	}
+	
+	idxP->container_num = cont_num;
+	idxP->offset = cont_data_end;
+	
+	cont_indexP[cont_count].offset = cont_data_end;
+	cont_indexP[cont_count].length = length;
+	cont_indexP[cont_count].seq_num = rec_seq_num;
+	cont_indexP[cont_count].type = type;
+	cont_indexP[cont_count].reserved = 0;
+	cont_count++;
+	cont_data_end += sizeof(file_container_entry_t) + length;
+	
+	if (cont_count == FILE_CONTAINER_MAX_RECORDS) {
+		// Images continue in the next container
+		close_container();
+	} else {
+		if ((cont_data_end + cont_est_image_len + sizeof(file_container_entry_t)) > cont_alloc_end) {
+			extend_container();
+		}
+		if (++cont_unsynced >= FILE_CONTAINER_SYNC_RECORDS) {
+			sync_container();
+		}
+	}
+	
+	return true;
+}
+
+
+/**
+ * Create the next container in the session directory and allocate its first extent
+ */
+static bool open_container()
+{
+	if (!file_open_container_file(rec_dir_name, cont_num, &cont_fp)) {
+		cont_fp = NULL;
+		return false;
+	}
+	
+	cont_data_end = sizeof(file_container_header_t);
+	cont_alloc_end = 0;
+	cont_count = 0;
+	cont_unsynced = 0;
+	extend_container();
+	if (!write_container_header(0)) {
+		file_close_file(cont_fp);
+		cont_fp = NULL;
+		return false;
+	}
+	
+	ESP_LOGI(TAG, "Start container %d", cont_num);
+	return true;
+}
+
+
+/**
+ * Write the container header and leave the file positioned at the end of the data
+ */
+static bool write_container_header(uint32_t index_offset)
+{
+	file_container_header_t hdr;
+	bool success;
+	
+	hdr.magic = FILE_CONTAINER_MAGIC;
+	hdr.version = FILE_CONTAINER_VERSION;
+	hdr.header_len = sizeof(file_container_header_t);
+	hdr.record_count = cont_count;
+	hdr.data_end = cont_data_end;
+	hdr.index_offset = index_offset;
+	hdr.reserved = 0;
+	
+	success = (fseek(cont_fp, 0, SEEK_SET) == 0);
+	if (success) {
+		success = write_direct(cont_fp, (uint8_t*) &hdr, sizeof(hdr));
+	}
+	fseek(cont_fp, cont_data_end, SEEK_SET);
+	
+	return success;
+}
+
+
+/**
+ * Commit the container data and header to the card
+ */
+static void sync_container()
+{
+	if (!write_container_header(0)) {
+		ESP_LOGE(TAG, "Could not update container header");
+	}
+	fflush(cont_fp);
+	fsync(fileno(cont_fp));
+	cont_unsynced = 0;
+}
+
+
+/**
+ * Allocate the next extent of the container sized for about FILE_PREALLOC_SEC seconds
+ * of images.  Once the container has a few images their average size is used instead
+ * of the estimate.
+ */
+static void extend_container()
+{
+	int images;
+	uint64_t free_bytes;
+	uint64_t len;
+	
+	if (cont_count >= FILE_CONTAINER_SYNC_RECORDS) {
+		cont_est_image_len = (cont_data_end - sizeof(file_container_header_t)) / cont_count;
 	}
 	
-	return !err;
+	images = FILE_CONTAINER_MAX_RECORDS - cont_count;
+	if (images > cont_images_per_extent) images = cont_images_per_extent;
+	len = (uint64_t) images * (cont_est_image_len + sizeof(file_container_entry_t)) +
+	      FILE_CONTAINER_MAX_RECORDS * sizeof(file_container_index_t);
+	if (len < FILE_PREALLOC_MIN_LEN) len = FILE_PREALLOC_MIN_LEN;
+	if (len > FILE_PREALLOC_MAX_LEN) len = FILE_PREALLOC_MAX_LEN;
+	
+	// Leave room on the card for the other session files
+	free_bytes = file_get_free_bytes();
+	if (len > (free_bytes / 2)) len = free_bytes / 2;
+	if (len == 0) return;
+	
+	if (file_preallocate(cont_fp, cont_data_end + (uint32_t) len)) {
+		cont_alloc_end = cont_data_end + (uint32_t) len;
+		ESP_LOGI(TAG, "Container %d allocated to %u bytes", cont_num, cont_alloc_end);
+	} else {
+		// Not fatal, the file will just grow as it is written
+		ESP_LOGW(TAG, "Could not preallocate container");
+		cont_alloc_end = cont_data_end + (uint32_t) len;
+	}
 }
 
+
+/**
+ * Append the index to the open container and close it
+ */
+static void close_container()
+{
+	if (cont_fp == NULL) return;
+	
+	if (write_buffer(cont_fp, (uint8_t*) cont_indexP, cont_count * sizeof(file_container_index_t)) &&
+	    flush_buffer()) {
+		if (!write_container_header(cont_data_end)) {
+			ESP_LOGE(TAG, "Could not update container header");
+		}
+	} else {
+		ESP_LOGE(TAG, "Could not write container index");
+	}
+	file_close_file(cont_fp);
+	cont_fp = NULL;
+	
+	ESP_LOGI(TAG, "Wrote %d images to container %d", cont_count, cont_num);
+	cont_num++;
+}
+
+
+/**
+ * Append an image's jpeg to the session AVI file as the next frame, starting a new file
+ * if necessary, and note where it is in the image's index entry
+ */
+static bool write_avi_frame(cam_buffer_t* camP, file_index_entry_t* idxP)
+{
+	uint8_t chunk_hdr[AVI_CHUNK_HDR_LEN];
+	uint8_t pad = 0;
+	uint32_t len = camP->cam_buffer_len;
+	uint32_t chunk_len = AVI_CHUNK_HDR_LEN + len + (len & 1);
+	
+	if ((avi_fp != NULL) &&
+	    ((avi_info.frames == FILE_AVI_MAX_FRAMES) ||
+	     ((AVI_HEADER_LEN + avi_info.movi_len + chunk_len) > FILE_AVI_MAX_LEN)))
+	{
+		close_avi_file();
+	}
+	
+	if (avi_fp == NULL) {
+		if (!open_avi_file(camP)) {
+			return false;
+		}
+	}
+	
+	// Chunks are padded to an even length
+	avi_build_chunk_header(chunk_hdr, "00dc", len);
+	if (!write_buffer(avi_fp, chunk_hdr, AVI_CHUNK_HDR_LEN) ||
+	    !write_buffer(avi_fp, camP->cam_bufferP, len) ||
+	    (((len & 1) != 0) && !write_buffer(avi_fp, &pad, 1)) ||
+	    !flush_buffer())
+	{
+		// The next frame overwrites this one
+		discard_buffer();
+		fseek(avi_fp, AVI_HEADER_LEN + avi_info.movi_len, SEEK_SET);
+		return false;
+	}
+	
+	avi_build_index_entry(&avi_indexP[avi_info.frames], avi_info.movi_len, len);
+	idxP->flags |= FILE_INDEX_FLAG_AVI;
+	idxP->avi_file = avi_file_num;
+	idxP->avi_frame = (uint16_t) avi_info.frames;
+	avi_info.frames++;
+	avi_info.movi_len += chunk_len;
+	if (len > avi_info.max_frame_len) avi_info.max_frame_len = len;
+	
+	if ((avi_info.frames - avi_checkpoint_frames) >= FILE_AVI_SYNC_FRAMES) {
+		checkpoint_avi_file();
+	}
+	
+	return true;
+}
+
+
+/**
+ * Create the next AVI file, and its index checkpoint file, in the session directory.  The
+ * frame size comes from the first jpeg.
+ */
+static bool open_avi_file(cam_buffer_t* camP)
+{
+	if (!file_open_avi_file(rec_dir_name, rec_seq_num, false, &avi_fp)) {
+		avi_fp = NULL;
+		return false;
+	}
+	
+	// Not fatal, the file just can't be repaired after a crash
+	if (!file_open_avi_file(rec_dir_name, rec_seq_num, true, &avi_idx_fp)) {
+		avi_idx_fp = NULL;
+	}
+	
+	memset(&avi_info, 0, sizeof(avi_info_t));
+	if (!avi_get_jpeg_size(camP->cam_bufferP, camP->cam_buffer_len, &avi_info.width, &avi_info.height)) {
+		ESP_LOGW(TAG, "Could not get AVI frame size");
+		avi_info.width = FILE_AVI_DEF_WIDTH;
+		avi_info.height = FILE_AVI_DEF_HEIGHT;
+	}
+	avi_info.usec_per_frame = avi_usec_per_frame;
+	avi_file_num = rec_seq_num;
+	avi_checkpoint_frames = 0;
+	
+	if (!write_avi_header()) {
+		close_avi_file();
+		return false;
+	}
+	
+	ESP_LOGI(TAG, "Start AVI file " AVI_FILE_NAME_FMT " (%dx%d)", avi_file_num, avi_info.width, avi_info.height);
+	return true;
+}
+
+
+/**
+ * Write the AVI header and leave the file positioned at the end of the data
+ */
+static bool write_avi_header()
+{
+	bool success;
+	uint32_t end;
+	
+	avi_build_header(avi_hdr_buf, &avi_info);
+	
+	end = AVI_HEADER_LEN + avi_info.movi_len;
+	if (avi_info.index_len != 0) {
+		end += AVI_CHUNK_HDR_LEN + avi_info.index_len;
+	}
+	
+	success = (fseek(avi_fp, 0, SEEK_SET) == 0);
+	if (success) {
+		success = write_direct(avi_fp, avi_hdr_buf, AVI_HEADER_LEN);
+	}
+	fseek(avi_fp, end, SEEK_SET);
+	
+	return success;
+}
+
+
+/**
+ * Commit the AVI frames, header and the index entries since the last checkpoint to the
+ * card
+ */
+static void checkpoint_avi_file()
+{
+	uint32_t n = avi_info.frames - avi_checkpoint_frames;
+	
+	if ((avi_idx_fp != NULL) && (n != 0)) {
+		if (write_buffer(avi_idx_fp, (uint8_t*) &avi_indexP[avi_checkpoint_frames], n * sizeof(avi_index_entry_t)) &&
+		    flush_buffer())
+		{
+			fflush(avi_idx_fp);
+			fsync(fileno(avi_idx_fp));
+		} else {
+			// Give up on the checkpoint file rather than leave a gap in it
+			ESP_LOGE(TAG, "Could not write AVI index checkpoint");
+			discard_buffer();
+			file_close_file(avi_idx_fp);
+			avi_idx_fp = NULL;
+		}
+	}
+	
+	if (!write_avi_header()) {
+		ESP_LOGE(TAG, "Could not update AVI header");
+	}
+	fflush(avi_fp);
+	fsync(fileno(avi_fp));
+	avi_checkpoint_frames = avi_info.frames;
+}
+
+
+/**
+ * Append the index to the open AVI file and close it
+ */
+static void close_avi_file()
+{
+	uint8_t chunk_hdr[AVI_CHUNK_HDR_LEN];
+	uint32_t len;
+	
+	if (avi_fp == NULL) return;
+	
+	if (avi_info.frames != 0) {
+		len = avi_info.frames * sizeof(avi_index_entry_t);
+		avi_build_chunk_header(chunk_hdr, "idx1", len);
+		if (write_buffer(avi_fp, chunk_hdr, AVI_CHUNK_HDR_LEN) &&
+		    write_buffer(avi_fp, (uint8_t*) avi_indexP, len) &&
+		    flush_buffer())
+		{
+			avi_info.index_len = len;
+		} else {
+			ESP_LOGE(TAG, "Could not write AVI index");
+			discard_buffer();
+		}
+		if (!write_avi_header()) {
+			ESP_LOGE(TAG, "Could not update AVI header");
+		}
+	}
+	file_close_file(avi_fp);
+	avi_fp = NULL;
+	
+	// The checkpoint file is only needed if the AVI file wasn't closed
+	if (avi_idx_fp != NULL) {
+		file_close_file(avi_idx_fp);
+		avi_idx_fp = NULL;
+	}
+	
+	ESP_LOGI(TAG, "Wrote %u frames to AVI file " AVI_FILE_NAME_FMT, avi_info.frames, avi_file_num);
+}
+
+
+/**
+ * Load the parts of an image's index entry known when it is queued
+ */
+static void init_index_entry(file_index_entry_t* idxP, cam_buffer_t* camP, lep_buffer_t* lepP)
+{
+	memset(idxP, 0, sizeof(file_index_entry_t));
+	idxP->epoch_sec = (uint32_t) time(NULL);
+	
+	if (camP != NULL) {
+		idxP->flags |= FILE_INDEX_FLAG_CAM;
+	}
+	if (lepP != NULL) {
+		idxP->flags |= FILE_INDEX_FLAG_LEP;
+		idxP->lep_min_val = lepP->lep_min_val;
+		idxP->lep_max_val = lepP->lep_max_val;
+		if (lepP->telem_valid) {
+			idxP->flags |= FILE_INDEX_FLAG_TELEM;
+			idxP->fpa_temp_c100 = (int16_t) lepton_k100_to_c100(lepP->telem.fpa_temp_k100);
+		}
+	}
+}
+
+
+/**
+ * Rewrite the session summary if it has changed and it has been FILE_SUMMARY_WRITE_MSEC
+ * since the last write (or now is set).  complete is set when the session ends.  The
+ * summary isn't written while images are going to the spool.
+ */
+static void write_summary(bool now, bool complete)
+{
+	uint32_t len;
+	
+	if ((summary_textP == NULL) || spool_card_failed) return;
+	if (!now && ((xTaskGetTickCount() - summary_write_tick) < pdMS_TO_TICKS(FILE_SUMMARY_WRITE_MSEC))) return;
+	summary_write_tick = xTaskGetTickCount();
+	
+	summary_update(rec_stats.dropped, complete);
+	if (!summary_get_changed()) return;
+	
+	len = json_get_summary_string(summary_get(), summary_textP, SUMMARY_MAX_TEXT_LEN);
+	if ((len == 0) || !file_write_summary_file(rec_dir_name, summary_textP, len)) {
+		ESP_LOGE(TAG, "Could not write session summary");
+	}
+}
+
+
+/**
+ * Load the header for a new session index
+ */
+static void init_index_header(file_index_header_t* hdrP)
+{
+	hdrP->magic = FILE_INDEX_MAGIC;
+	hdrP->version = FILE_INDEX_VERSION;
+	hdrP->entry_len = sizeof(file_index_entry_t);
+	hdrP->reserved[0] = 0;
+	hdrP->reserved[1] = 0;
+}
+
+
+/**
+ * Append an image's entry to the session index, opening it on the first image.  The
+ * index is synced to the card every FILE_INDEX_SYNC_RECORDS entries.
+ */
+static bool write_index_entry(file_index_entry_t* idxP)
+{
+	bool is_new;
+	file_index_header_t hdr;
+	
+	if (index_fp == NULL) {
+		if (!file_open_index_file(rec_dir_name, &index_fp, &is_new)) {
+			index_fp = NULL;
+			return false;
+		}
+		index_unsynced = 0;
+		
+		if (is_new) {
+			init_index_header(&hdr);
+			if (!write_buffer(index_fp, (uint8_t*) &hdr, sizeof(hdr))) {
+				discard_buffer();
+				return false;
+			}
+		}
+	}
+	
+	if (!write_buffer(index_fp, (uint8_t*) idxP, sizeof(file_index_entry_t)) || !flush_buffer()) {
+		discard_buffer();
+		return false;
+	}
+	
+	if (++index_unsynced >= FILE_INDEX_SYNC_RECORDS) {
+		fflush(index_fp);
+		fsync(fileno(index_fp));
+		index_unsynced = 0;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Close the session index if one was opened during this session
+ */
+static void close_index_file()
+{
+	if (index_fp != NULL) {
+		file_close_file(index_fp);
+		index_fp = NULL;
+	}
+}
+
+
+/**
+ * Load a queued image's thumbnail pixels from its Lepton image.  Called by app_task as
+ * the image is queued since a json image's Lepton buffer isn't held by the queue.  Each
+ * pixel is the mean of a block of Lepton pixels scaled between the frame's minimum and
+ * maximum.
+ */
+static void init_thumb_entry(file_thumb_entry_t* thumbP, lep_buffer_t* lepP)
+{
+	int x, y, i, j;
+	uint32_t sum, range;
+	uint16_t* rowP;
+	uint8_t* dstP;
+	
+	if ((thumbP == NULL) || (lepP == NULL)) return;
+	
+	thumbP->lep_min_val = lepP->lep_min_val;
+	thumbP->lep_max_val = lepP->lep_max_val;
+	thumbP->tlin_scale = (uint16_t) lepton_get_tlin_scale(lepP);
+	thumbP->reserved = 0;
+	range = (lepP->lep_max_val > lepP->lep_min_val) ? (lepP->lep_max_val - lepP->lep_min_val) : 1;
+	
+	dstP = thumbP->pixels;
+	for (y=0; y<FILE_THUMB_HEIGHT; y++) {
+		for (x=0; x<FILE_THUMB_WIDTH; x++) {
+			sum = 0;
+			for (j=0; j<FILE_THUMB_DECIMATE; j++) {
+				rowP = lepP->lep_bufferP + (y*FILE_THUMB_DECIMATE + j)*LEP_WIDTH + x*FILE_THUMB_DECIMATE;
+				for (i=0; i<FILE_THUMB_DECIMATE; i++) {
+					sum += *rowP++;
+				}
+			}
+			sum /= (FILE_THUMB_DECIMATE * FILE_THUMB_DECIMATE);
+			sum = (sum > lepP->lep_min_val) ? (sum - lepP->lep_min_val) : 0;
+			*dstP++ = (sum >= range) ? 255 : (uint8_t) ((sum * 255) / range);
+		}
+	}
+}
+
+
+/**
+ * Write the thumbnail of an image that was just written when it's the first or
+ * FILE_THUMB_INTERVAL'th Lepton image since the last one.  A spooled image's thumbnail
+ * is skipped and the next image written to the card gets one instead.
+ */
+static void write_thumb(file_queue_entry_t* entryP, bool spooled)
+{
+	if ((entryP->thumbP == NULL) || ((entryP->idx.flags & FILE_INDEX_FLAG_LEP) == 0)) return;
+	
+	if (thumb_countdown != 0) {
+		thumb_countdown--;
+	} else if (!spooled) {
+		entryP->thumbP->seq_num = entryP->idx.seq_num;
+		entryP->thumbP->epoch_sec = entryP->idx.epoch_sec;
+		if (!write_thumb_entry(entryP->thumbP)) {
+			ESP_LOGE(TAG, "Could not write thumbnail for image %u", entryP->idx.seq_num);
+		}
+		thumb_countdown = FILE_THUMB_INTERVAL - 1;
+	}
+}
+
+
+/**
+ * Append a thumbnail to the session's thumbnail file, opening it on the first one.  The
+ * file is synced to the card every FILE_THUMB_SYNC_RECORDS thumbnails.
+ */
+static bool write_thumb_entry(file_thumb_entry_t* thumbP)
+{
+	bool is_new;
+	file_thumb_header_t hdr;
+	
+	if (thumb_fp == NULL) {
+		if (!file_open_thumb_file(rec_dir_name, &thumb_fp, &is_new)) {
+			thumb_fp = NULL;
+			return false;
+		}
+		thumb_unsynced = 0;
+		
+		if (is_new) {
+			hdr.magic = FILE_THUMB_MAGIC;
+			hdr.version = FILE_THUMB_VERSION;
+			hdr.entry_len = sizeof(file_thumb_entry_t);
+			hdr.width = FILE_THUMB_WIDTH;
+			hdr.height = FILE_THUMB_HEIGHT;
+			hdr.interval = FILE_THUMB_INTERVAL;
+			hdr.reserved = 0;
+			if (!write_buffer(thumb_fp, (uint8_t*) &hdr, sizeof(hdr))) {
+				discard_buffer();
+				return false;
+			}
+		}
+	}
+	
+	if (!write_buffer(thumb_fp, (uint8_t*) thumbP, sizeof(file_thumb_entry_t)) || !flush_buffer()) {
+		discard_buffer();
+		return false;
+	}
+	
+	if (++thumb_unsynced >= FILE_THUMB_SYNC_RECORDS) {
+		fflush(thumb_fp);
+		fsync(fileno(thumb_fp));
+		thumb_unsynced = 0;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Close the session thumbnail file if one was opened during this session
+ */
+static void close_thumb_file()
+{
+	if (thumb_fp != NULL) {
+		file_close_file(thumb_fp);
+		thumb_fp = NULL;
+	}
+}
+
+
+/**
+ * Take a telemetry log sample when one is due and write the buffered samples when the
+ * buffer is full or hasn't been written for FILE_TLOG_FLUSH_MSEC
+ */
+static void update_tlog()
+{
+	TickType_t cur_tick = xTaskGetTickCount();
+	TickType_t period;
+	uint8_t rate = gui_st.tlog_rate;
+	
+	if ((tlog_bufP == NULL) || tlog_failed) return;
+	
+	if ((rate == 0) || (rate > SYS_TLOG_MAX_RATE)) {
+		// Samples start as soon as the log is enabled
+		tlog_sample_tick = cur_tick;
+	} else if ((int32_t) (cur_tick - tlog_sample_tick) >= 0) {
+		if ((tlog_fp == NULL) && !open_tlog_file()) {
+			tlog_failed = true;
+			return;
+		}
+		init_tlog_entry(&tlog_bufP[tlog_count++]);
+		
+		// Skip samples missed during a long card operation instead of bunching them
+		period = pdMS_TO_TICKS(1000 / rate);
+		tlog_sample_tick += period;
+		if ((int32_t) (cur_tick - tlog_sample_tick) >= 0) {
+			tlog_sample_tick = cur_tick + period;
+		}
+	}
+	
+	if ((tlog_count == FILE_TLOG_BUF_ENTRIES) ||
+	    ((tlog_count != 0) && ((cur_tick - tlog_flush_tick) >= pdMS_TO_TICKS(FILE_TLOG_FLUSH_MSEC))))
+	{
+		flush_tlog();
+	}
+}
+
+
+/**
+ * Limit file_task's wait for notifications so the next telemetry log sample is taken
+ * on time
+ */
+static TickType_t tlog_wait_ticks(TickType_t max_ticks)
+{
+	int32_t ticks;
+	
+	if (!recording || (tlog_bufP == NULL) || tlog_failed || (gui_st.tlog_rate == 0)) {
+		return max_ticks;
+	}
+	
+	ticks = (int32_t) (tlog_sample_tick - xTaskGetTickCount());
+	if (ticks <= 0) return 0;
+	
+	return ((TickType_t) ticks < max_ticks) ? (TickType_t) ticks : max_ticks;
+}
+
+
+/**
+ * Open the session's telemetry log, writing the header for a new file.  An existing
+ * file (from a resumed session) is continued after its last complete entry.
+ */
+static bool open_tlog_file()
+{
+	bool is_new;
+	long pos;
+	uint32_t n = 0;
+	file_tlog_header_t hdr;
+	
+	if (!file_open_tlog_file(rec_dir_name, &tlog_fp, &is_new)) {
+		tlog_fp = NULL;
+		return false;
+	}
+	
+	pos = ftell(tlog_fp);
+	if (!is_new && (pos >= (long) sizeof(hdr))) {
+		n = (pos - sizeof(hdr)) / sizeof(file_tlog_entry_t);
+		if (fseek(tlog_fp, sizeof(hdr) + n * sizeof(file_tlog_entry_t), SEEK_SET) != 0) {
+			ESP_LOGE(TAG, "Could not continue %s", TLOG_FILE_NAME);
+			close_tlog_file();
+			return false;
+		}
+	} else {
+		// New, or created but interrupted before the header was written
+		hdr.magic = FILE_TLOG_MAGIC;
+		hdr.version = FILE_TLOG_VERSION;
+		hdr.entry_len = sizeof(file_tlog_entry_t);
+		hdr.num_stats = FILE_TLOG_STATS;
+		memset(hdr.reserved, 0, sizeof(hdr.reserved));
+		if ((fseek(tlog_fp, 0, SEEK_SET) != 0) ||
+		    !write_buffer(tlog_fp, (uint8_t*) &hdr, sizeof(hdr)) || !flush_buffer())
+		{
+			discard_buffer();
+			ESP_LOGE(TAG, "Could not write %s header", TLOG_FILE_NAME);
+			close_tlog_file();
+			return false;
+		}
+	}
+	tlog_seq_num = n + 1;
+	
+	ESP_LOGI(TAG, "Start telemetry log at sample %u", tlog_seq_num);
+	return true;
+}
+
+
+/**
+ * Sample the camera's environment into a telemetry log entry
+ */
+static void init_tlog_entry(file_tlog_entry_t* eP)
+{
+	struct timeval tv;
+	lep_task_sample_t lep;
+	batt_status_t batt;
+	lep_alarm_event_t alarm;
+	int64_t cur_usec = esp_timer_get_time();
+	uint32_t k100;
+	int i;
+	
+	memset(eP, 0, sizeof(file_tlog_entry_t));
+	
+	gettimeofday(&tv, NULL);
+	eP->seq_num = tlog_seq_num++;
+	eP->epoch_sec = (uint32_t) tv.tv_sec;
+	eP->epoch_msec = (uint16_t) (tv.tv_usec / 1000);
+	
+	lep_task_get_sample(&lep);
+	if ((lep.timestamp_usec != 0) && ((cur_usec - lep.timestamp_usec) <= FILE_TLOG_MAX_LEP_AGE_USEC)) {
+		if (lep.telem_valid) {
+			eP->flags |= FILE_TLOG_FLAG_LEP;
+			eP->fpa_temp_c100 = (int16_t) lepton_k100_to_c100(lep.fpa_temp_k100);
+			eP->aux_temp_c100 = (int16_t) lepton_k100_to_c100(lep.aux_temp_k100);
+		}
+		if (lep.frame_valid) {
+			eP->flags |= FILE_TLOG_FLAG_FRAME;
+			lepton_pixels_to_k100(&lep.min_val, &k100, 1, lep.tlin_scale);
+			eP->lep_min_c100 = (int16_t) lepton_k100_to_c100(k100);
+			lepton_pixels_to_k100(&lep.max_val, &k100, 1, lep.tlin_scale);
+			eP->lep_max_c100 = (int16_t) lepton_k100_to_c100(k100);
+		}
+	}
+	
+	eP->lens_temp_c100 = (int16_t) (adc_get_temp() * 100.0f);
+	adc_get_batt(&batt);
+	eP->batt_mv = (uint16_t) (batt.batt_voltage * 1000.0f);
+	eP->batt_state = (uint8_t) batt.batt_state;
+	eP->charge_state = (uint8_t) batt.charge_state;
+	
+	if (lepton_stats_get_latest(&tlog_stats) &&
+	    ((cur_usec - tlog_stats.timestamp_usec) <= FILE_TLOG_MAX_STATS_AGE_USEC))
+	{
+		for (i=0; i<FILE_TLOG_STATS; i++) {
+			if (tlog_stats.stats[i].valid) {
+				eP->stats_valid |= 1 << i;
+				eP->stats[i][0] = (int16_t) lepton_k100_to_c100(tlog_stats.stats[i].min);
+				eP->stats[i][1] = (int16_t) lepton_k100_to_c100(tlog_stats.stats[i].max);
+				eP->stats[i][2] = (int16_t) lepton_k100_to_c100(tlog_stats.stats[i].mean);
+			}
+		}
+	}
+	
+	lepton_alarm_get_event(&alarm);
+	if (alarm.active) eP->flags |= FILE_TLOG_FLAG_ALARM;
+	eP->alarm_cause = alarm.cause;
+	eP->alarm_count = alarm.count;
+	
+	perf_get(&tlog_perf);
+	eP->lep_vsyncs = tlog_perf.counter[PERF_CNT_LEP_VSYNC];
+	eP->lep_frames = tlog_perf.counter[PERF_CNT_LEP_FRAME];
+	eP->lep_dup_frames = tlog_perf.counter[PERF_CNT_LEP_DUP_FRAME];
+	eP->lep_skip_frames = tlog_perf.counter[PERF_CNT_LEP_SKIP_FRAME];
+	eP->queued = (uint16_t) get_queue_count();
+}
+
+
+/**
+ * Append the buffered telemetry log samples to the file and sync it.  Samples that
+ * can't be written are dropped.
+ */
+static void flush_tlog()
+{
+	tlog_flush_tick = xTaskGetTickCount();
+	if ((tlog_fp == NULL) || (tlog_count == 0)) return;
+	
+	if (!write_buffer(tlog_fp, (uint8_t*) tlog_bufP, tlog_count * sizeof(file_tlog_entry_t)) ||
+	    !flush_buffer())
+	{
+		discard_buffer();
+		ESP_LOGE(TAG, "Could not write %d telemetry log samples", tlog_count);
+	} else {
+		fflush(tlog_fp);
+		fsync(fileno(tlog_fp));
+	}
+	tlog_count = 0;
+}
+
+
+/**
+ * Write the remaining samples and close the session telemetry log if one was opened
+ * during this session
+ */
+static void close_tlog_file()
+{
+	if (tlog_fp != NULL) {
+		flush_tlog();
+		file_close_file(tlog_fp);
+		tlog_fp = NULL;
+	}
+	tlog_count = 0;
+}
+
+
+/**
+ * Append a line to the session metadata log, opening it for the first line.  A line
+ * that isn't completely written is overwritten by the next one.
+ */
+static bool write_meta_record(file_queue_entry_t* entryP)
+{
+	if ((meta_fp == NULL) && !open_meta_file()) {
+		return false;
+	}
+	
+	if (!write_buffer(meta_fp, (uint8_t*) entryP->json_bufP, entryP->json_len) || !flush_buffer()) {
+		discard_buffer();
+		fseek(meta_fp, meta_end, SEEK_SET);
+		ESP_LOGE(TAG, "Could not write %s line for image %u", META_LOG_FILE_NAME, rec_seq_num);
+		return false;
+	}
+	meta_end += entryP->json_len;
+	
+	if (++meta_unsynced >= FILE_META_SYNC_RECORDS) {
+		sync_meta_file();
+	}
+	
+	return true;
+}
+
+
+/**
+ * Open the session's metadata log.  An existing file (from a resumed session) is
+ * continued, first ending its last line if it was cut short.
+ */
+static bool open_meta_file()
+{
+	bool is_new;
+	char c;
+	
+	if (!file_open_meta_log_file(rec_dir_name, &meta_fp, &is_new)) {
+		meta_fp = NULL;
+		return false;
+	}
+	
+	meta_end = ftell(meta_fp);
+	if (!is_new && (meta_end > 0)) {
+		if ((fseek(meta_fp, meta_end - 1, SEEK_SET) != 0) || (fread(&c, 1, 1, meta_fp) != 1) ||
+		    (fseek(meta_fp, meta_end, SEEK_SET) != 0))
+		{
+			ESP_LOGE(TAG, "Could not continue %s", META_LOG_FILE_NAME);
+			close_meta_file();
+			return false;
+		}
+		if (c != '\n') {
+			c = '\n';
+			if (!write_buffer(meta_fp, (uint8_t*) &c, 1) || !flush_buffer()) {
+				discard_buffer();
+				ESP_LOGE(TAG, "Could not continue %s", META_LOG_FILE_NAME);
+				close_meta_file();
+				return false;
+			}
+			meta_end++;
+		}
+	}
+	meta_unsynced = 0;
+	
+	return true;
+}
+
+
+/**
+ * Push the session metadata log's lines to the card
+ */
+static void sync_meta_file()
+{
+	if (meta_fp != NULL) {
+		fflush(meta_fp);
+		fsync(fileno(meta_fp));
+		meta_unsynced = 0;
+	}
+}
+
+
+/**
+ * Close the session metadata log if one was opened during this session
+ */
+static void close_meta_file()
+{
+	if (meta_fp != NULL) {
+		file_close_file(meta_fp);
+		meta_fp = NULL;
+	}
+}
+
+
+/**
+ * Append the frame in sys_lep_rec_bufferP to the session's high-rate recording file
+ */
+static bool write_lep_record()
+{
+	lep_record_header_t hdr;
+	lep_buffer_t* bufP = sys_lep_rec_bufferP;
+	
+	if (!recording || (bufP == NULL)) {
+		// Record arrived after the session ended - quietly drop it
+		return true;
+	}
+	
+	if (lep_rec_fp == NULL) {
+		if (!file_open_lep_record_file(rec_dir_name, lep_rec_resume_offset, &lep_rec_fp)) {
+			return false;
+		}
+		ESP_LOGI(TAG, "Start high-rate recording to %s at record %u", LEP_RECORD_FILE_NAME, lep_rec_seq_num);
+	}
+	
+	hdr.magic = LEP_REC_MAGIC;
+	hdr.version = LEP_REC_VERSION;
+	hdr.flags = bufP->telem_valid ? LEP_REC_FLAG_TELEM : 0;
+	hdr.seq_num = lep_rec_seq_num++;
+	hdr.epoch_sec = (uint32_t) time(NULL);
+	hdr.timestamp_usec = bufP->timestamp_usec;
+	hdr.width = LEP_WIDTH;
+	hdr.height = LEP_HEIGHT;
+	hdr.min_val = bufP->lep_min_val;
+	hdr.max_val = bufP->lep_max_val;
+	
+	if (!write_buffer(lep_rec_fp, (uint8_t*) &hdr, sizeof(hdr)) ||
+	    !write_buffer(lep_rec_fp, (uint8_t*) bufP->lep_bufferP, LEP_NUM_PIXELS * sizeof(uint16_t))) {
+		discard_buffer();
+		return false;
+	}
+	if (bufP->telem_valid) {
+		if (!write_buffer(lep_rec_fp, (uint8_t*) bufP->lep_telemP, LEP_TEL_WORDS * sizeof(uint16_t))) {
+			discard_buffer();
+			return false;
+		}
+	}
+	
+	if (!flush_buffer()) {
+		return false;
+	}
+	
+	if (++lep_rec_unsynced >= FILE_LEP_SYNC_RECORDS) {
+		sync_lep_record_file();
+	}
+	
+	return true;
+}
+
+
+/**
+ * Commit the high-rate recording file to the card and note how much of it is safe in
+ * the journal
+ */
+static void sync_lep_record_file()
+{
+	long pos;
+	
+	if (lep_rec_fp == NULL) return;
+	
+	fflush(lep_rec_fp);
+	fsync(fileno(lep_rec_fp));
+	lep_rec_unsynced = 0;
+	
+	pos = ftell(lep_rec_fp);
+	if (pos > 0) {
+		rec_journal.lep_seq_num = lep_rec_seq_num;
+		rec_journal.lep_offset = (uint32_t) pos;
+		ps_set_rec_journal(&rec_journal, true);
+	}
+}
+
+
+/**
+ * Close the high-rate recording file if one was opened during this session
+ */
+static void close_lep_record_file()
+{
+	if (lep_rec_fp != NULL) {
+		ESP_LOGI(TAG, "Wrote %d high-rate records", lep_rec_seq_num - 1);
+		file_close_file(lep_rec_fp);
+		lep_rec_fp = NULL;
+	}
+}
+
+
+/**
+ * Write a buffer to an open file through the staging buffer.  Data is written to the
+ * file as each FILE_WRITE_BUF_LEN block fills.  The caller must call flush_buffer when
+ * it has finished writing a record and before seeking or closing the file.
+ */
+static bool write_buffer(FILE* fp, uint8_t* bufP, uint32_t length)
+{
+	long pos;
+	uint32_t len;
+	
+	if (stage_bufP == NULL) {
+		return write_direct(fp, bufP, length);
+	}
+	
+	if (fp != stage_fp) {
+		// Start staging for this file.  The first block ends on a FILE_WRITE_BUF_LEN
+		// boundary in the file so all the following blocks are aligned.
+		if (!flush_buffer()) return false;
+		pos = ftell(fp);
+		stage_fp = fp;
+		stage_len = 0;
+		stage_limit = FILE_WRITE_BUF_LEN - ((pos > 0) ? (pos % FILE_WRITE_BUF_LEN) : 0);
+	}
+	
+	while (length > 0) {
+		len = stage_limit - stage_len;
+		if (len > length) len = length;
+		memcpy(&stage_bufP[stage_len], bufP, len);
+		stage_len += len;
+		bufP += len;
+		length -= len;
+		
+		if (stage_len == stage_limit) {
+			if (!write_direct(stage_fp, stage_bufP, stage_len)) {
+				discard_buffer();
+				return false;
+			}
+			stage_len = 0;
+			stage_limit = FILE_WRITE_BUF_LEN;
+		}
+	}
+	
+	return true;
+}
+
+
+/**
+ * Write any staged data to its file
+ */
+static bool flush_buffer()
+{
+	bool success = true;
+	
+	if ((stage_fp != NULL) && (stage_len != 0)) {
+		success = write_direct(stage_fp, stage_bufP, stage_len);
+	}
+	stage_fp = NULL;
+	stage_len = 0;
+	
+	return success;
+}
+
+
+/**
+ * Throw away any staged data after a write failure
+ */
+static void discard_buffer()
+{
+	stage_fp = NULL;
+	stage_len = 0;
+}
+
+
+/**
+ * Return the average write throughput (MB/sec) of the current or last recording session
+ */
+float file_task_get_write_rate()
+{
+	return wr_rate;
+}
+
+
+/**
+ * Write a buffer to an open file in chunks no larger than MAX_FILE_WRITE_LEN (staged
+ * blocks are written in one call) and track the write throughput
+ */
+static bool write_direct(FILE* fp, uint8_t* bufP, uint32_t length)
+{
+	int write_ret;
+	int len;
+	int max_len;
+	int64_t start_usec;
+	int64_t elapsed_usec;
+	uint32_t byte_offset = 0;
+	
+	max_len = (bufP == stage_bufP) ? FILE_WRITE_BUF_LEN : MAX_FILE_WRITE_LEN;
+	start_usec = esp_timer_get_time();
+	while (byte_offset < length) {
+		// Determine maximum bytes to write
+		len = length - byte_offset;
+		if (len > max_len) len = max_len;
+		
+		write_ret = fwrite(&bufP[byte_offset], 1, len, fp);
+		if (write_ret <= 0) {
+			ESP_LOGE(TAG, "Error in file write - %d", write_ret);
+			return false;
+		}
+		byte_offset += write_ret;
+	}
+	
+	elapsed_usec = esp_timer_get_time() - start_usec;
+	perf_record(PERF_SD_WRITE, elapsed_usec);
+	wr_bytes += length;
+	wr_usec += elapsed_usec;
+	if (wr_usec > 0) {
+		wr_rate = (float) wr_bytes / (float) wr_usec;     // bytes/uSec = MB/sec
+	}
+	
+	return true;
+}
+
+
+#ifdef INCLUDE_SYS_TRACE
+/**
+ * Write the notification trace to the root directory of the card, mounting it for the
+ * write if it isn't already mounted
+ */
+static void dump_trace()
+{
+	bool was_mounted;
+	FILE* fp;
+	
+	if (!file_get_card_present()) {
+		ESP_LOGE(TAG, "No card for the notification trace");
+		return;
+	}
+	
+	was_mounted = file_get_card_mounted();
+	if (!was_mounted && !file_mount_sdcard()) return;
+	
+	if (file_open_root_write_file(TRACE_FILE_NAME, &fp)) {
+		(void) trace_write(fp);
+		file_close_file(fp);
+	}
+	
+	if (!was_mounted) {
+		file_unmount_sdcard();
+	}
+}
+#endif
+
+
+#ifdef INCLUDE_SYS_BENCH
+/**
+ * Run the SD Card benchmark, mounting the card for it if it isn't already mounted.  The
+ * benchmark is skipped while recording.
+ */
+static void run_benchmark()
+{
+	bool was_mounted;
+	
+	if (recording || !file_get_card_present()) {
+		ESP_LOGE(TAG, "Card not available for the benchmark");
+		bench_task_run_sd(false);
+		return;
+	}
+	
+	was_mounted = file_get_card_mounted();
+	if (!was_mounted && !file_mount_sdcard()) {
+		bench_task_run_sd(false);
+		return;
+	}
+	
+	bench_task_run_sd(true);
+	
+	if (!was_mounted) {
+		file_unmount_sdcard();
+	}
+}
+#endif
+
+
+#ifdef LOG_TO_FILE
+/**
+ * Append the new log data to LOG_FILE_NAME every LOG_FILE_WRITE_MSEC while the card is
+ * mounted, starting a new file when it reaches LOG_FILE_MAX_LEN.  The log written while
+ * the card wasn't mounted is kept in the log ring as long as there is room.
+ */
+static void write_log_file()
+{
+	FILE* fp;
+	char* bufP;
+	uint32_t len;
+	uint32_t lost;
+	uint32_t pos;
+	
+	if ((xTaskGetTickCount() - log_write_tick) < pdMS_TO_TICKS(LOG_FILE_WRITE_MSEC)) return;
+	log_write_tick = xTaskGetTickCount();
+	
+	if (!file_get_card_mounted()) return;
+	if (log_task_peek(LOG_SINK_FILE, &bufP, &pos) == 0) return;
+	
+	if (!file_open_root_append_file(LOG_FILE_NAME, &fp)) return;
+	if ((fseek(fp, 0, SEEK_END) == 0) && (ftell(fp) >= LOG_FILE_MAX_LEN)) {
+		file_close_file(fp);
+		(void) file_rename_root_file(LOG_FILE_NAME, LOG_OLD_FILE_NAME);
+		if (!file_open_root_append_file(LOG_FILE_NAME, &fp)) return;
+	}
+	
+	lost = log_task_get_lost(LOG_SINK_FILE);
+	if (lost != 0) {
+		fprintf(fp, "--- %u log bytes lost ---\n", lost);
+	}
+	while ((len = log_task_peek(LOG_SINK_FILE, &bufP, &pos)) != 0) {
+		if (fwrite(bufP, 1, len, fp) != len) break;
+		log_task_consume(LOG_SINK_FILE, pos, len);
+	}
+	
+	file_close_file(fp);
+}
+#endif
+
+
+#ifdef INCLUDE_VOSPI_CAPTURE
+/**
+ * Write captured VoSPI bursts to the capture file.  The file is created when a card is
+ * first available (and left mounted) and written until it reaches VOSPI_CAP_MAX_FILE_LEN
+ * or a write fails.  Each call empties the capture ring so the loop's FILE_EVAL_MSEC
+ * period sets the ring length needed.
+ */
+static void write_vospi_capture()
+{
+	vospi_cap_record_t* recP;
+	uint32_t overruns;
+	int n;
+	
+	if (cap_done) return;
+	
+	if (cap_fp == NULL) {
+		if (!file_get_card_present()) {
+			// Discard captured data until there is somewhere to put it
+			while ((n = vospi_capture_peek(&recP)) != 0) {
+				vospi_capture_consume(n);
+			}
+			return;
+		}
+		if (!file_get_card_mounted() && !file_mount_sdcard()) {
+			cap_done = true;
+			return;
+		}
+		if (!file_open_root_write_file(VOSPI_CAP_FILE_NAME, &cap_fp)) {
+			cap_done = true;
+			return;
+		}
+		cap_len = 0;
+		cap_sync_tick = xTaskGetTickCount();
+		ESP_LOGI(TAG, "Capturing VoSPI packets to %s", VOSPI_CAP_FILE_NAME);
+	}
+	
+	// Write the ring, at most MAX_FILE_WRITE_LEN bytes at a time
+	while ((n = vospi_capture_peek(&recP)) != 0) {
+		if (n > (MAX_FILE_WRITE_LEN / sizeof(vospi_cap_record_t))) {
+			n = MAX_FILE_WRITE_LEN / sizeof(vospi_cap_record_t);
+		}
+		
+		if (!file_get_card_present() ||
+		    (fwrite(recP, sizeof(vospi_cap_record_t), n, cap_fp) != (size_t) n))
+		{
+			ESP_LOGE(TAG, "VoSPI capture write failed after %u bytes", cap_len);
+			file_close_file(cap_fp);
+			cap_fp = NULL;
+			cap_done = true;
+			return;
+		}
+		vospi_capture_consume(n);
+		
+		cap_len += n * sizeof(vospi_cap_record_t);
+		if (cap_len >= VOSPI_CAP_MAX_FILE_LEN) {
+			ESP_LOGI(TAG, "VoSPI capture file full");
+			file_close_file(cap_fp);
+			cap_fp = NULL;
+			cap_done = true;
+			return;
+		}
+	}
+	
+	// Periodically make the file readable up to here in case power is lost
+	if ((xTaskGetTickCount() - cap_sync_tick) >= pdMS_TO_TICKS(FILE_CAP_SYNC_MSEC)) {
+		fflush(cap_fp);
+		fsync(fileno(cap_fp));
+		cap_sync_tick = xTaskGetTickCount();
+	}
+	
+	overruns = vospi_capture_get_overruns();
+	if (overruns != cap_reported_overruns) {
+		ESP_LOGW(TAG, "VoSPI capture dropped %u bursts", overruns - cap_reported_overruns);
+		cap_reported_overruns = overruns;
+	}
+}
+#endif
@@ -24,12 +24,20 @@
  *
  */
 #include "gui_task.h"
+
+#ifdef INCLUDE_SYS_GUI
+
 #include "app_task.h"
+#include "bench_task.h"
+#include "health_task.h"
+#include "http_task.h"
+#include "render_task.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "esp_freertos_hooks.h"
+#include "esp_heap_caps.h"
 #include "system_config.h"
 #include "lvgl/lvgl.h"
 #include "disp_spi.h"
@@ -37,12 +45,15 @@
 #include "tp_spi.h"
 #include "xpt2046.h"
 #include "gui_utilities.h"
+#include "pm_utilities.h"
 #include "sys_utilities.h"
 #include "gui_screen_main.h"
 #include "gui_screen_network.h"
+#include "gui_screen_playback.h"
 #include "gui_screen_settings.h"
 #include "gui_screen_time.h"
 #include "gui_screen_poweroff.h"
+#include "gui_screen_thermal.h"
 #include "gui_screen_wifi.h"
 
 //
@@ -62,9 +73,11 @@
 
 static const char* TAG = "gui_task";
 
-// Dual display update buffers to allow DMA/SPI transfer of one while the other is updated
-static lv_color_t lvgl_disp_buf1[LVGL_DISP_BUF_SIZE];
-static lv_color_t lvgl_disp_buf2[LVGL_DISP_BUF_SIZE];
+// Dual display update buffers to allow DMA/SPI transfer of one while the other is updated.
+// disp_spi sends them without copying so they are allocated from DMA capable memory at
+// startup instead of taking up static internal RAM.
+static lv_color_t* lvgl_disp_buf1;
+static lv_color_t* lvgl_disp_buf2;
 static lv_disp_buf_t lvgl_disp_buf;
 
 // Display driver
@@ -73,21 +86,48 @@ static lv_disp_drv_t lvgl_disp_drv;
 // Touchscreen driver
 static lv_indev_drv_t lvgl_indev_drv;
 
-// Screen object array and current screen index
+// Screen object array (NULL until a screen is first displayed) and current screen index
 static lv_obj_t* gui_screens[GUI_NUM_SCREENS];
 static int gui_cur_screen_index;
 
 // LVGL sub-task array
 static lv_task_t* lvgl_tasks[LVGL_ST_NUM];
 
+// Screen constructors (in GUI_SCREEN_xxx order)
+static lv_obj_t* (* const gui_screen_create[GUI_NUM_SCREENS])() = {
+	gui_screen_main_create,
+	gui_screen_settings_create,
+	gui_screen_time_create,
+	gui_screen_wifi_create,
+	gui_screen_network_create,
+	gui_screen_poweroff_create,
+	gui_screen_thermal_create,
+	gui_screen_playback_create
+};
+
+// Set while render_task is decoding an ArduCAM image into the back buffer
+static bool cam_render_busy = false;
+
+// Set while headless (LCD asleep and images not rendered)
+static bool gui_headless = false;
+
+// Notifications received by the task loop for the event handler sub-task
+static uint32_t gui_notifications = 0;
+
+// Touch time of the last action sent to app_task (0 when it has been taken)
+static int64_t gui_action_touch_usec = 0;
+static portMUX_TYPE gui_action_mux = portMUX_INITIALIZER_UNLOCKED;
+
 
 //
 // GUI Task internal function forward declarations
 //
-static void gui_lvgl_init();
+static bool gui_lvgl_init();
 static void gui_screen_init();
 static void gui_add_subtasks();
 static void gui_task_event_handler_task(lv_task_t * task);
+static void gui_eval_headless();
+static void gui_set_headless(bool en);
 static void IRAM_ATTR lv_tick_callback();
 
 
@@ -104,20 +144,50 @@ static void IRAM_ATTR lv_tick_callback();
  */
 void gui_task()
 {
+	uint32_t notification_value;
+	
 	ESP_LOGI(TAG, "Start task");
 
 	// Initialize
-	gui_lvgl_init();
+	if (!gui_lvgl_init()) {
+		ESP_LOGE(TAG, "Could not allocate display buffers - bailing");
+		vTaskDelete(NULL);
+	}
 	gui_screen_init();
 	gui_add_subtasks();
 	
 	// Set the initially displayed screen
 	gui_set_screen(GUI_SCREEN_MAIN);
 	
+	// The backlight, touchscreen and LCD refreshes need the system awake until headless
+	pm_set_level(PM_USER_GUI, PM_LEVEL_AWAKE);
+	
+	// Stay dark while briefly awake to record an image between duty-cycled recording sleeps
+	if (app_task_get_sleep_cycle()) {
+		gui_set_headless(true);
+	}
+	
 	while (1) {
-		// This task runs every LVGL_EVAL_MSEC mSec
-		vTaskDelay(pdMS_TO_TICKS(LVGL_EVAL_MSEC));
+		health_task_beat(HEALTH_TASK_GUI);
+		
+		// This task runs every LVGL_EVAL_MSEC mSec (LVGL_HEADLESS_EVAL_MSEC while headless)
+		// and as soon as another task notifies it, running the event handler sub-task
+		// right away so events don't wait for its period
+		if (xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value,
+		                    pdMS_TO_TICKS(gui_headless ? LVGL_HEADLESS_EVAL_MSEC : LVGL_EVAL_MSEC)))
+		{
+			gui_notifications |= notification_value;
+			lv_task_ready(lvgl_tasks[LVGL_ST_EVENT]);
+		}
+		
+		// Only let LittleVGL poll the touchscreen while it is being touched
+		if (xpt2046_check_irq() && gui_headless) {
+			// Wake without letting the touch act on whatever is under it
+			lv_indev_wait_release(lv_indev_get_next(NULL));
+			gui_set_headless(false);
+		}
 		lv_task_handler();
+		gui_eval_headless();
 	}
 }
 
@@ -127,7 +197,15 @@ void gui_task()
  */
 void gui_set_screen(int n)
 {
+#ifdef GUI_FREE_SCREENS
+	int i;
+#endif
+	
 	if (n < GUI_NUM_SCREENS) {
+		// Screens other than the main screen are constructed when they are first displayed
+		if (gui_screens[n] == NULL) {
+			gui_screens[n] = gui_screen_create[n]();
+		}
 		gui_cur_screen_index = n;
 		
 		gui_screen_main_set_active(n == GUI_SCREEN_MAIN);
@@ -136,12 +214,84 @@ void gui_set_screen(int n)
 		gui_screen_wifi_set_active(n == GUI_SCREEN_WIFI);
 		gui_screen_network_set_active(n == GUI_SCREEN_NETWORK);
 		gui_screen_poweroff_set_active(n == GUI_SCREEN_POWEROFF);
+		gui_screen_thermal_set_active(n == GUI_SCREEN_THERMAL);
+		gui_screen_playback_set_active(n == GUI_SCREEN_PLAYBACK);
 		
 		lv_scr_load(gui_screens[n]);
+		
+#ifdef GUI_FREE_SCREENS
+		// Free the settings screens when returning to the main screen.  They are deleted
+		// after the current LVGL event since we may be in one of their callbacks.  A
+		// message box deletes itself so screens are kept while one is displayed.
+		if ((n == GUI_SCREEN_MAIN) && !gui_message_box_displayed()) {
+			for (i=0; i<GUI_NUM_SCREENS; i++) {
+				if ((i != GUI_SCREEN_MAIN) && (i != GUI_SCREEN_POWEROFF) && (gui_screens[i] != NULL)) {
+					lv_obj_del_async(gui_screens[i]);
+					gui_screens[i] = NULL;
+				}
+			}
+		}
+#endif
 	}
 }
 
 
+/**
+ * Return LittleVGL's free display buffer and its length in pixels for drawing directly
+ * to the LCD (with ili9341_write_area, which copies the pixels so the buffer may be
+ * refilled as soon as it returns).  Only valid in the LittleVGL context between
+ * refreshes: LittleVGL waits for the previous flush from this buffer before flushing
+ * the other one.
+ */
+uint16_t* gui_get_draw_buffer(uint32_t* lenP)
+{
+	*lenP = LVGL_DISP_BUF_SIZE;
+	return (uint16_t*) lv_disp_get_buf(NULL)->buf_act;
+}
+
+
+/**
+ * Return true while the LCD is asleep
+ */
+bool gui_task_get_headless()
+{
+	return gui_headless;
+}
+
+
+/**
+ * Send app_task a critical action (APP_NOTIFY_xxx) from a touch control, yielding so
+ * it can act on it before this pass through Little VGL finishes.  The time of the touch
+ * is kept for app_task's touch to action measurement.
+ */
+void gui_task_send_action(uint32_t mask)
+{
+	portENTER_CRITICAL(&gui_action_mux);
+	gui_action_touch_usec = xpt2046_get_touch_usec();
+	portEXIT_CRITICAL(&gui_action_mux);
+	
+	xTaskNotify(task_handle_app, mask, eSetBits);
+	taskYIELD();
+}
+
+
+/**
+ * Return the touch time of the last action sent to app_task, or 0 if it was already
+ * taken (or the action didn't come from a touch)
+ */
+int64_t gui_task_take_action_usec()
+{
+	int64_t usec;
+	
+	portENTER_CRITICAL(&gui_action_mux);
+	usec = gui_action_touch_usec;
+	gui_action_touch_usec = 0;
+	portEXIT_CRITICAL(&gui_action_mux);
+	
+	return usec;
+}
+
+
 
 //
 // GUI Task Internal functions
@@ -149,10 +299,17 @@ void gui_set_screen(int n)
 
 /**
  * Initialize the LittleVGL system including initializing the LCD display and
- * Touchscreen controller.
+ * Touchscreen controller.  Returns false if the display buffers could not be allocated.
  */
-static void gui_lvgl_init()
+static bool gui_lvgl_init()
 {
+	// Get the display buffers
+	lvgl_disp_buf1 = heap_caps_malloc(LVGL_DISP_BUF_SIZE * sizeof(lv_color_t), MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+	lvgl_disp_buf2 = heap_caps_malloc(LVGL_DISP_BUF_SIZE * sizeof(lv_color_t), MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+	if ((lvgl_disp_buf1 == NULL) || (lvgl_disp_buf2 == NULL)) {
+		return false;
+	}
+	
 	// Initialize lvgl and its hardware
 	lv_init();
 	disp_spi_init();
@@ -175,21 +332,23 @@ static void gui_lvgl_init()
     
     // Hook LittleVGL's timebase to its CPU system tick so it can keep track of time
     esp_register_freertos_tick_hook(lv_tick_callback);
+    
+    return true;
 }
 
 
 /**
- * Initialize the screen objects and their control callbacks
+ * Initialize the main screen.  The other screens are created by gui_set_screen when
+ * they are needed.
  */
 static void gui_screen_init()
 {
-	// Initialize the screens
+	int i;
+	
+	for (i=0; i<GUI_NUM_SCREENS; i++) {
+		gui_screens[i] = NULL;
+	}
 	gui_screens[GUI_SCREEN_MAIN] = gui_screen_main_create();
-	gui_screens[GUI_SCREEN_SETTINGS] = gui_screen_settings_create();
-	gui_screens[GUI_SCREEN_TIME] = gui_screen_time_create();
-	gui_screens[GUI_SCREEN_WIFI] = gui_screen_wifi_create();
-	gui_screens[GUI_SCREEN_NETWORK] = gui_screen_network_create();
-	gui_screens[GUI_SCREEN_POWEROFF] = gui_screen_poweroff_create();
 }
 
 
@@ -218,29 +377,77 @@ static void gui_add_subtasks()
 static void gui_task_event_handler_task(lv_task_t * task)
 {
 	uint32_t notification_value;
+	uint32_t len;
+	uint8_t* jpgP;
 	static uint16_t image_num;     // Image number displayed on the main screen, managed here
 	
-	// Look for incoming notifications (clear them upon reading)
-	if (xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, 0)) {
+	// Handle the notifications the task loop received (clearing them)
+	notification_value = gui_notifications;
+	gui_notifications = 0;
+	if (notification_value != 0) {
 	
 		if (Notification(notification_value, GUI_NOTIFY_SHUTDOWN_MASK)) {
 			gui_set_screen(GUI_SCREEN_POWEROFF);
 		}
 		
+		// Handled before a new frame so the back buffer is free before it is reused
+		if (Notification(notification_value, GUI_NOTIFY_CAM_RENDERED_MASK)) {
+			// Display the newly decoded image
+			gui_screen_main_update_cam_image();
+			cam_render_busy = false;
+		}
+		
+		if (Notification(notification_value, GUI_NOTIFY_CAM_RENDER_FAIL_MASK)) {
+			cam_render_busy = false;
+		}
+		
+		// Draw (or just release, if the screen has been left) the decoded playback frame
+		if (Notification(notification_value, GUI_NOTIFY_PLAY_RENDERED_MASK)) {
+			gui_screen_playback_frame_done(true);
+		}
+		
+		if (Notification(notification_value, GUI_NOTIFY_PLAY_RENDER_FAIL_MASK)) {
+			gui_screen_playback_frame_done(false);
+		}
+		
+		if (Notification(notification_value, GUI_NOTIFY_WAKE_MASK)) {
+			lv_disp_trig_activity(NULL);
+			if (gui_headless) {
+				gui_set_headless(false);
+			}
+		}
+		
 		if (Notification(notification_value, GUI_NOTIFY_CAM_FRAME_MASK)) {
-			if (gui_cur_screen_index == GUI_SCREEN_MAIN) {
-				// Trigger the main screen to draw the image from the buffer to the display
-				gui_screen_main_update_cam_image();
+			if ((gui_cur_screen_index == GUI_SCREEN_MAIN) && !cam_render_busy && !gui_headless) {
+				// Have render_task decode the image from the buffer.  It lets the app
+				// task know when it's done with the buffer.
+				cam_render_busy = true;
+				xTaskNotify(task_handle_render, RENDER_NOTIFY_CAM_FRAME_MASK, eSetBits);
+			} else {
+				// Let the app task know we're done with the buffer
+				xTaskNotify(task_handle_app, APP_NOTIFY_GUI_CAM_DONE_MASK, eSetBits);
 			}
-			// Let the app task know we're done with the buffer
-			xTaskNotify(task_handle_app, APP_NOTIFY_GUI_CAM_DONE_MASK, eSetBits);
 		}
 		
 		if (Notification(notification_value, GUI_NOTIFY_LEP_FRAME_MASK)) {
-			if (gui_cur_screen_index == GUI_SCREEN_MAIN) {
+			if ((gui_cur_screen_index == GUI_SCREEN_MAIN) && !gui_headless) {
 				// Trigger the main screen to draw the image from the buffer to the display
-				gui_screen_main_update_lep_image();
+				gui_screen_main_update_lep_image(sys_lep_gui_bufferP);
+			} else if ((gui_cur_screen_index == GUI_SCREEN_THERMAL) && !gui_headless) {
+				// Draw the image upscaled to fill the display
+				gui_screen_main_update_lep_full(sys_lep_gui_bufferP);
 			}
+			
+			// Encode the palette-rendered image if anyone is viewing it through http_task
+			// (reusing the main screen's image when it was just drawn)
+			jpgP = http_task_get_thermal_buffer();
+			if (jpgP != NULL) {
+				len = gui_screen_main_encode_lep_jpg(sys_lep_gui_bufferP,
+					(gui_cur_screen_index == GUI_SCREEN_MAIN) && !gui_headless,
+					jpgP, HTTP_THERMAL_JPG_LEN);
+				http_task_set_thermal_image(len);
+			}
+			
 			// Let the app task know we're done with the buffer
 			xTaskNotify(task_handle_app, APP_NOTIFY_GUI_LEP_DONE_MASK, eSetBits);
 		}
@@ -265,7 +472,55 @@ static void gui_task_event_handler_task(lv_task_t * task)
 		
 		if (Notification(notification_value, GUI_NOTIFY_MESSAGEBOX_MASK)) {
 			gui_preset_message_box(gui_screens[gui_cur_screen_index]);
-		}	
+		}
+		
+#ifdef INCLUDE_SYS_BENCH
+		if (Notification(notification_value, GUI_NOTIFY_BENCH_MASK)) {
+			bench_task_run_lep_image();
+		}
+#endif
+	}
+	
+	// Start the next playback frame when it is due
+	if ((gui_cur_screen_index == GUI_SCREEN_PLAYBACK) && !gui_headless) {
+		gui_screen_playback_update();
+	}
+}
+
+
+/**
+ * Go headless while recording with no touch activity for GUI_HEADLESS_MSEC and wake
+ * when recording stops (a recording resuming after a duty-cycled sleep hasn't started
+ * yet when we start headless)
+ */
+static void gui_eval_headless()
+{
+#if GUI_HEADLESS_MSEC != 0
+	if (!gui_headless) {
+		if (app_task_get_recording() && (lv_disp_get_inactive_time(NULL) >= GUI_HEADLESS_MSEC)) {
+			gui_set_headless(true);
+		}
+	} else if (!app_task_get_recording() && !app_task_get_sleep_cycle()) {
+		gui_set_headless(false);
+	}
+#endif
+}
+
+
+/**
+ * Enter or leave headless operation.  The LCD sleeps and images aren't rendered while
+ * headless, giving the recording tasks more CPU time.  LittleVGL continues to draw the
+ * rest of the screen into the LCD's memory so it is current when the LCD wakes.
+ */
+static void gui_set_headless(bool en)
+{
+	ESP_LOGI(TAG, "%s headless", en ? "Enter" : "Leave");
+	gui_headless = en;
+	ili9341_sleep(en);
+	pm_set_level(PM_USER_GUI, en ? PM_LEVEL_SLEEP : PM_LEVEL_AWAKE);
+	if (!en) {
+		// Restart the idle timeout
+		lv_disp_trig_activity(NULL);
 	}
 }
 
@@ -278,3 +533,5 @@ static void IRAM_ATTR lv_tick_callback()
 {
 	lv_tick_inc(portTICK_RATE_MS);
 }
+
+#endif /* INCLUDE_SYS_GUI */
@@ -0,0 +1,365 @@
+/*
+ * Health Task
+ *
+ * Watches the heartbeats of the sensor, file, command and GUI tasks and recovers a task
+ * that stops beating, escalating from re-initializing its peripheral to recreating it
+ * and only then restarting the system.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "health_task.h"
+#include "cam_task.h"
+#include "cmd_task.h"
+#include "lep_task.h"
+#include "i2c.h"
+#include "ps_nvs.h"
+#include "ps_utilities.h"
+#include "sys_utilities.h"
+#include "system_config.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <stdint.h>
+
+
+
+//
+// Health Task constants
+//
+
+// Time other tasks are given to finish notifying a task being recreated, through the
+// handle they already read, before it is deleted
+#define HEALTH_SWAP_MSEC           10
+
+
+
+//
+// Health Task typedefs
+//
+typedef struct {
+	const char* name;
+	void (*entry)();             // Task function, NULL if it can't be recreated
+	TaskHandle_t* handleP;
+	uint32_t stack;
+	UBaseType_t prio;
+	BaseType_t core;
+	int vspi_user;               // VSPI_USER_xxx it locks the bus as, -1 for none
+	uint32_t stall_msec;
+	bool (*recover)();           // Re-initializes its peripheral, NULL for none
+} health_task_def_t;
+
+
+
+//
+// Health Task private variables
+//
+static const char* TAG = "health_task";
+
+// Watched tasks (indexed by HEALTH_TASK_xxx).  gui_task can't be recreated because
+// LittleVGL's state (including its lv_task_handler re-entry guard) would be left as
+// the deleted task had it.  file_task can't be because it owns the card's open files
+// and session state.
+static const health_task_def_t health_tasks[HEALTH_NUM_TASKS] = {
+	{"lep_task", lep_task, &task_handle_lep, LEP_TASK_STACK, LEP_TASK_PRIO, LEP_TASK_CORE,
+	 -1, HEALTH_LEP_STALL_MSEC, lep_task_recover},
+	{"cam_task", cam_task, &task_handle_cam, CAM_TASK_STACK, CAM_TASK_PRIO, CAM_TASK_CORE,
+	 VSPI_USER_CAM, HEALTH_CAM_STALL_MSEC, NULL},
+	{"file_task", NULL, &task_handle_file, FILE_TASK_STACK, FILE_TASK_PRIO, FILE_TASK_CORE,
+	 -1, HEALTH_FILE_STALL_MSEC, NULL},
+	{"cmd_task", cmd_task, &task_handle_cmd, CMD_TASK_STACK, CMD_TASK_PRIO, CMD_TASK_CORE,
+	 -1, HEALTH_CMD_STALL_MSEC, cmd_task_recover},
+	{"gui_task", NULL, &task_handle_gui, GUI_TASK_STACK, GUI_TASK_PRIO, GUI_TASK_CORE,
+	 -1, HEALTH_GUI_STALL_MSEC, NULL}
+};
+
+// Heartbeats (written by the watched tasks)
+static volatile bool health_beaten[HEALTH_NUM_TASKS];
+static volatile TickType_t health_beat_tick[HEALTH_NUM_TASKS];
+
+// Escalation state
+static TickType_t health_stage_tick[HEALTH_NUM_TASKS];   // When the current stage started
+
+// Recreated tasks wait for this before running so they don't start until the stalled
+// task they replace has been deleted
+static SemaphoreHandle_t health_start_sem;
+
+// Statistics for other tasks
+static health_stats_t health_stats;
+static portMUX_TYPE health_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+
+//
+// Health Task Forward Declarations for internal functions
+//
+static void health_eval(int task, TickType_t cur_tick);
+static void health_escalate(int task, int state, TickType_t cur_tick);
+static void health_set_state(int task, int state);
+static bool health_locks_held(int task);
+static bool health_restart(int task);
+static void health_restart_entry(void* arg);
+static void health_reboot(int task);
+
+
+
+//
+// Health Task API
+//
+void health_task()
+{
+	TickType_t cur_tick;
+	int i;
+	
+	ESP_LOGI(TAG, "Start task");
+	
+	health_start_sem = xSemaphoreCreateBinary();
+	if (health_start_sem == NULL) {
+		ESP_LOGE(TAG, "Could not create semaphore - tasks won't be recreated");
+	}
+	health_stats.reboots = ps_nvs_get_uint(PS_NVS_HEALTH_REBOOTS);
+	
+	while (1) {
+		vTaskDelay(pdMS_TO_TICKS(HEALTH_EVAL_MSEC));
+	
+		cur_tick = xTaskGetTickCount();
+		for (i=0; i<HEALTH_NUM_TASKS; i++) {
+			if (health_beaten[i]) {
+				health_eval(i, cur_tick);
+			}
+		}
+	}
+}
+
+
+/**
+ * Called by a watched task (HEALTH_TASK_xxx) each time through its loop
+ */
+void health_task_beat(int task)
+{
+	health_beat_tick[task] = xTaskGetTickCount();
+	health_beaten[task] = true;
+}
+
+
+/**
+ * Called by a watched task that is ending to stop watching it
+ */
+void health_task_stop(int task)
+{
+	health_beaten[task] = false;
+	health_set_state(task, HEALTH_STATE_IDLE);
+}
+
+
+/**
+ * Return a copy of the statistics
+ */
+void health_task_get_stats(health_stats_t* statsP)
+{
+	portENTER_CRITICAL(&health_mux);
+	*statsP = health_stats;
+	portEXIT_CRITICAL(&health_mux);
+}
+
+
+/**
+ * Return the name of a watched task
+ */
+const char* health_task_name(int task)
+{
+	return health_tasks[task].name;
+}
+
+
+
+//
+// Health Task internal functions
+//
+
+/**
+ * Check a task that has started beating.  A beat after the current stage started
+ * returns it to the OK state.
+ */
+static void health_eval(int task, TickType_t cur_tick)
+{
+	const health_task_def_t* dP = &health_tasks[task];
+	TickType_t beat_tick = health_beat_tick[task];
+	int state = health_stats.tasks[task].state;
+	
+	if (state == HEALTH_STATE_IDLE) {
+		health_set_state(task, HEALTH_STATE_OK);
+		state = HEALTH_STATE_OK;
+	}
+	
+	if (state == HEALTH_STATE_OK) {
+		if ((cur_tick - beat_tick) > pdMS_TO_TICKS(dP->stall_msec)) {
+			ESP_LOGE(TAG, "%s stalled for %u mSec", dP->name, (cur_tick - beat_tick) * portTICK_PERIOD_MS);
+			portENTER_CRITICAL(&health_mux);
+			health_stats.tasks[task].stalls++;
+			portEXIT_CRITICAL(&health_mux);
+			health_escalate(task, HEALTH_STATE_OK, cur_tick);
+		}
+		return;
+	}
+	
+	if ((int32_t) (beat_tick - health_stage_tick[task]) > 0) {
+		ESP_LOGI(TAG, "%s recovered", dP->name);
+		health_set_state(task, HEALTH_STATE_OK);
+	} else if ((cur_tick - health_stage_tick[task]) >
+	           pdMS_TO_TICKS((state == HEALTH_STATE_RECOVER) ? HEALTH_RECOVER_WAIT_MSEC : HEALTH_RESTART_WAIT_MSEC))
+	{
+		health_escalate(task, state, cur_tick);
+	}
+}
+
+
+/**
+ * Run the first recovery stage after state the task supports, restarting the system
+ * if none is left
+ */
+static void health_escalate(int task, int state, TickType_t cur_tick)
+{
+	const health_task_def_t* dP = &health_tasks[task];
+	
+	if ((state < HEALTH_STATE_RECOVER) && (dP->recover != NULL)) {
+		ESP_LOGI(TAG, "Re-initialize %s peripheral", dP->name);
+		if (dP->recover()) {
+			portENTER_CRITICAL(&health_mux);
+			health_stats.tasks[task].recovers++;
+			portEXIT_CRITICAL(&health_mux);
+			health_stage_tick[task] = cur_tick;
+			health_set_state(task, HEALTH_STATE_RECOVER);
+			return;
+		}
+	}
+	
+	if ((state < HEALTH_STATE_RESTART) && (dP->entry != NULL)) {
+		if (health_locks_held(task)) {
+			ESP_LOGE(TAG, "%s holds a shared lock - can't recreate it", dP->name);
+		} else if (health_restart(task)) {
+			portENTER_CRITICAL(&health_mux);
+			health_stats.tasks[task].restarts++;
+			portEXIT_CRITICAL(&health_mux);
+			health_stage_tick[task] = xTaskGetTickCount();
+			health_set_state(task, HEALTH_STATE_RESTART);
+			return;
+		}
+	}
+	
+	health_reboot(task);
+}
+
+
+/**
+ * Set a task's state for other tasks
+ */
+static void health_set_state(int task, int state)
+{
+	portENTER_CRITICAL(&health_mux);
+	health_stats.tasks[task].state = state;
+	portEXIT_CRITICAL(&health_mux);
+}
+
+
+/**
+ * Return true if a task holds a lock other tasks share.  Deleting it would leave the
+ * lock held forever.
+ */
+static bool health_locks_held(int task)
+{
+	const health_task_def_t* dP = &health_tasks[task];
+	
+	if (i2c_locked_by(*dP->handleP) || ps_nvs_locked_by(*dP->handleP)) {
+		return true;
+	}
+	if ((dP->vspi_user >= 0) && system_vspi_user_busy(dP->vspi_user)) {
+		return true;
+	}
+	
+	return false;
+}
+
+
+/**
+ * Replace a stalled task with a new one.  The handle is switched to the new task before
+ * the old one is deleted so other tasks never notify a deleted task.  Notifications
+ * sent in between wait for the new task.
+ */
+static bool health_restart(int task)
+{
+	const health_task_def_t* dP = &health_tasks[task];
+	TaskHandle_t old_handle = *dP->handleP;
+	TaskHandle_t new_handle;
+	
+	if (health_start_sem == NULL) return false;
+	
+	ESP_LOGI(TAG, "Recreate %s", dP->name);
+	if (xTaskCreatePinnedToCore(&health_restart_entry, dP->name, dP->stack, (void*) (intptr_t) task,
+	                            dP->prio, &new_handle, dP->core) != pdPASS)
+	{
+		ESP_LOGE(TAG, "Could not create %s", dP->name);
+		return false;
+	}
+	
+	*dP->handleP = new_handle;
+	vTaskDelay(pdMS_TO_TICKS(HEALTH_SWAP_MSEC));
+	vTaskDelete(old_handle);
+	xSemaphoreGive(health_start_sem);
+	
+	return true;
+}
+
+
+/**
+ * Recreated task entry.  Waits for the task it replaces to be deleted.
+ */
+static void health_restart_entry(void* arg)
+{
+	int task = (int) (intptr_t) arg;
+	
+	(void) xSemaphoreTake(health_start_sem, portMAX_DELAY);
+	health_tasks[task].entry();
+	vTaskDelete(NULL);
+}
+
+
+/**
+ * Restart the system, counting it in persistent storage.  Cached settings are only
+ * saved if the stalled task isn't holding the locks that needs.
+ */
+static void health_reboot(int task)
+{
+	TaskHandle_t handle = *health_tasks[task].handleP;
+	
+	ESP_LOGE(TAG, "Could not recover %s - restarting", health_tasks[task].name);
+	
+	if (!ps_nvs_locked_by(handle)) {
+		(void) ps_nvs_set_uint(PS_NVS_HEALTH_REBOOTS, health_stats.reboots + 1);
+		if (!i2c_locked_by(handle)) {
+			(void) ps_flush();
+		}
+	}
+	
+	// Delay for final logging
+	vTaskDelay(pdMS_TO_TICKS(10));
+	
+	esp_restart();
+}
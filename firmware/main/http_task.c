@@ -0,0 +1,655 @@
+/*
+ * HTTP Task
+ *
+ * Serve the ArduCAM jpeg images to web browsers and NVRs.  A GET of HTTP_URI_STREAM
+ * returns a multipart/x-mixed-replace MJPEG stream of every image the camera captures.
+ * A GET of HTTP_URI_SNAPSHOT returns the next image.  Images are sent directly from
+ * the jpeg buffer cam_task captured into (held for us by app_task) so there is no
+ * encoding or copying.  HTTP_URI_THERMAL_STREAM and HTTP_URI_THERMAL_SNAPSHOT do the
+ * same with the palette-rendered Lepton image, which gui_task encodes into our thermal
+ * buffer only while someone is viewing it.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "app_task.h"
+#include "http_task.h"
+#include "ps_utilities.h"
+#include "sys_utilities.h"
+#include "wifi_utilities.h"
+#include "system_config.h"
+#include "esp_system.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/err.h"
+#include "lwip/sockets.h"
+#include "lwip/sys.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+
+
+//
+// HTTP Task variables
+//
+static const char* TAG = "http_task";
+
+// Client states
+#define HTTP_ST_REQUEST  0
+#define HTTP_ST_STREAM   1
+#define HTTP_ST_SNAPSHOT 2
+#define HTTP_ST_CLOSING  3
+
+// Thermal buffer states
+#define HTTP_THERMAL_FREE    0
+#define HTTP_THERMAL_FILLING 1           // gui_task is encoding an image into it
+#define HTTP_THERMAL_HELD    2           // Being sent to clients
+
+// Maximum pieces of a response being sent (header, jpeg, trailer)
+#define HTTP_TX_MAX_SEGS 3
+
+// Piece of a response being sent
+typedef struct {
+	const char* bufP;
+	uint32_t length;
+} http_tx_seg_t;
+
+// Per-client state
+typedef struct {
+	int sock;                            // -1 when the slot is unused
+	int state;
+	char req_buffer[HTTP_MAX_REQ_LEN];
+	int req_length;
+	bool thermal;                        // Viewing the Lepton images instead of the ArduCAM
+
+	// Transmit state.  Images are sent in place from the buffer app_task is holding.
+	char hdr_buffer[256];
+	bool tx_active;
+	bool tx_image;                       // The response includes the held image
+	bool tx_thermal;                     // The response includes the thermal image
+	http_tx_seg_t tx_seg[HTTP_TX_MAX_SEGS];
+	int tx_seg_count;
+	int tx_seg_index;
+	uint32_t tx_seg_offset;
+	int64_t tx_progress_usec;            // Last time we were able to send to the client
+} http_client_t;
+
+// Only touched at network rates so kept in PSRAM
+static EXT_RAM_ATTR http_client_t clients[HTTP_MAX_CLIENTS];
+
+// Number of ArduCAM (read by app_task) and thermal (read by gui_task) clients connected
+static volatile int num_clients;
+static volatile int num_thermal_clients;
+
+// app_task is holding sys_http_cam_bufferP for us
+static bool image_held;
+
+// Thermal jpeg image shared with gui_task
+static EXT_RAM_ATTR uint8_t thermal_buffer[HTTP_THERMAL_JPG_LEN];
+static uint32_t thermal_len;
+static int thermal_state = HTTP_THERMAL_FREE;
+static portMUX_TYPE thermal_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Fixed responses
+static const char* http_stream_rsp = "HTTP/1.1 200 OK\r\n" \
+                                     "Content-Type: multipart/x-mixed-replace; boundary=" HTTP_BOUNDARY "\r\n" \
+                                     "Cache-Control: no-cache\r\n" \
+                                     "Connection: close\r\n\r\n";
+static const char* http_not_found_rsp = "HTTP/1.1 404 Not Found\r\n" \
+                                        "Content-Type: text/plain\r\n" \
+                                        "Content-Length: 10\r\n" \
+                                        "Connection: close\r\n\r\n" \
+                                        "Not Found\n";
+static const char* http_part_end = "\r\n";
+
+
+//
+// HTTP Task Forward Declarations for internal functions
+//
+static void http_accept_client(int listen_sock);
+static void http_close_client(http_client_t* c);
+static void http_process_rx_data(http_client_t* c, char* data, int len);
+static void http_process_request(http_client_t* c);
+static void http_task_handle_notifications();
+static void http_set_thermal(http_client_t* c);
+static void http_queue_text(http_client_t* c, const char* s);
+static void http_queue_image(http_client_t* c, const uint8_t* bufP, uint32_t len, bool thermal);
+static void http_service_tx(http_client_t* c);
+static void http_check_tx_timeout(http_client_t* c);
+static void http_check_image_done();
+static void http_check_thermal_done();
+
+
+
+//
+// HTTP Task API
+//
+void http_task()
+{
+	char rx_buffer[128];
+    fd_set read_fds;
+    fd_set write_fds;
+    int err;
+    int flag;
+    int i;
+    int len;
+    int listen_sock;
+    int max_fd;
+    struct sockaddr_in destAddr;
+    struct timeval tv;
+
+	ESP_LOGI(TAG, "Start task");
+
+	// Wait until WiFi is connected
+	while (!wifi_is_connected()) {
+		vTaskDelay(pdMS_TO_TICKS(500));
+	}
+
+	// Config IPV4
+    destAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    destAddr.sin_family = AF_INET;
+    destAddr.sin_port = htons(HTTP_PORT);
+
+    // socket - bind - listen
+    listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (listen_sock < 0) {
+        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+        goto error;
+    }
+
+	flag = 1;
+  	setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    err = bind(listen_sock, (struct sockaddr *)&destAddr, sizeof(destAddr));
+    if (err != 0) {
+        ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
+        goto error;
+    }
+
+    err = listen(listen_sock, HTTP_MAX_CLIENTS);
+    if (err != 0) {
+    	ESP_LOGE(TAG, "Error occured during listen: errno %d", errno);
+    	goto error;
+    }
+    ESP_LOGI(TAG, "Listening on port %d", HTTP_PORT);
+
+    for (i=0; i<HTTP_MAX_CLIENTS; i++) {
+    	clients[i].sock = -1;
+    }
+    num_clients = 0;
+    image_held = false;
+
+	while (1) {
+		// Wait for a new connection, data from any client or room to send more data to
+		// clients with data queued
+		FD_ZERO(&read_fds);
+		FD_ZERO(&write_fds);
+		FD_SET(listen_sock, &read_fds);
+		max_fd = listen_sock;
+		for (i=0; i<HTTP_MAX_CLIENTS; i++) {
+			if (clients[i].sock >= 0) {
+				FD_SET(clients[i].sock, &read_fds);
+				if (clients[i].tx_active) {
+					FD_SET(clients[i].sock, &write_fds);
+				}
+				if (clients[i].sock > max_fd) max_fd = clients[i].sock;
+			}
+		}
+		tv.tv_sec = 0;
+		tv.tv_usec = HTTP_POLL_MSEC * 1000;
+		err = select(max_fd + 1, &read_fds, &write_fds, NULL, &tv);
+		if (err < 0) {
+			ESP_LOGE(TAG, "select failed: errno %d", errno);
+			break;
+		}
+
+		if (err > 0) {
+			if (FD_ISSET(listen_sock, &read_fds)) {
+				http_accept_client(listen_sock);
+			}
+
+			for (i=0; i<HTTP_MAX_CLIENTS; i++) {
+				if ((clients[i].sock >= 0) && FD_ISSET(clients[i].sock, &read_fds)) {
+					len = recv(clients[i].sock, rx_buffer, sizeof(rx_buffer), 0);
+					if (len <= 0) {
+						// Error or the client closed its connection
+						http_close_client(&clients[i]);
+					} else {
+						http_process_rx_data(&clients[i], rx_buffer, len);
+					}
+				}
+
+				if ((clients[i].sock >= 0) && FD_ISSET(clients[i].sock, &write_fds)) {
+					http_service_tx(&clients[i]);
+				}
+			}
+		}
+
+		for (i=0; i<HTTP_MAX_CLIENTS; i++) {
+			http_check_tx_timeout(&clients[i]);
+		}
+
+		http_task_handle_notifications();
+	}
+
+error:
+	ESP_LOGE(TAG, "Something went seriously wrong with our socket handling - restarting");
+	// Delay for message to be sent
+	vTaskDelay(pdMS_TO_TICKS(500));
+	(void) ps_flush();
+	esp_restart();
+}
+
+
+/**
+ * Return true if anyone is connected so app_task only holds images for us when they
+ * will be used
+ */
+bool http_task_has_clients()
+{
+	return (num_clients > 0);
+}
+
+
+/**
+ * Get the thermal buffer for gui_task to encode the current Lepton image into.  Returns
+ * NULL if nobody is viewing the thermal images or the previous one is still being sent.
+ * A buffer returned must be passed back with http_task_set_thermal_image.
+ */
+uint8_t* http_task_get_thermal_buffer()
+{
+	uint8_t* bufP = NULL;
+
+	portENTER_CRITICAL(&thermal_mux);
+	if ((num_thermal_clients > 0) && (thermal_state == HTTP_THERMAL_FREE)) {
+		thermal_state = HTTP_THERMAL_FILLING;
+		bufP = thermal_buffer;
+	}
+	portEXIT_CRITICAL(&thermal_mux);
+
+	return bufP;
+}
+
+
+/**
+ * Hand us the len byte jpeg image gui_task encoded into the thermal buffer (0 if it
+ * couldn't be encoded)
+ */
+void http_task_set_thermal_image(uint32_t len)
+{
+	portENTER_CRITICAL(&thermal_mux);
+	thermal_len = len;
+	thermal_state = (len == 0) ? HTTP_THERMAL_FREE : HTTP_THERMAL_HELD;
+	portEXIT_CRITICAL(&thermal_mux);
+
+	if (len != 0) {
+		xTaskNotify(task_handle_http, HTTP_NOTIFY_LEP_FRAME_MASK, eSetBits);
+	}
+}
+
+
+
+//
+// HTTP Task internal functions
+//
+
+/**
+ * Accept a new connection into a free client slot
+ */
+static void http_accept_client(int listen_sock)
+{
+	int i;
+	int sock;
+	int flag;
+	struct sockaddr_in sourceAddr;
+	uint32_t addrLen;
+
+	addrLen = sizeof(sourceAddr);
+	sock = accept(listen_sock, (struct sockaddr *)&sourceAddr, &addrLen);
+	if (sock < 0) {
+		ESP_LOGE(TAG, "Unable to accept connection: errno %d", errno);
+		return;
+	}
+
+	for (i=0; i<HTTP_MAX_CLIENTS; i++) {
+		if (clients[i].sock < 0) {
+			fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+			flag = 1;
+			setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+			clients[i].sock = sock;
+			clients[i].state = HTTP_ST_REQUEST;
+			clients[i].req_length = 0;
+			clients[i].tx_active = false;
+			clients[i].thermal = false;
+			clients[i].tx_image = false;
+			clients[i].tx_thermal = false;
+			num_clients++;
+			return;
+		}
+	}
+
+	ESP_LOGW(TAG, "Too many viewers - refusing connection");
+	shutdown(sock, 0);
+	close(sock);
+}
+
+
+/**
+ * Close a client's connection and free its slot
+ */
+static void http_close_client(http_client_t* c)
+{
+	bool was_image;
+	bool was_thermal;
+
+	if (c->sock < 0) return;
+
+	shutdown(c->sock, 0);
+	close(c->sock);
+	c->sock = -1;
+	if (c->thermal) {
+		num_thermal_clients--;
+	} else {
+		num_clients--;
+	}
+
+	was_image = c->tx_active && c->tx_image;
+	was_thermal = c->tx_active && c->tx_thermal;
+	c->tx_active = false;
+	c->tx_image = false;
+	c->tx_thermal = false;
+	if (was_image) {
+		http_check_image_done();
+	}
+	if (was_thermal) {
+		http_check_thermal_done();
+	}
+}
+
+
+/**
+ * Buffer the request header until we have all of it
+ */
+static void http_process_rx_data(http_client_t* c, char* data, int len)
+{
+	if (c->state != HTTP_ST_REQUEST) {
+		// Ignore anything sent after the request
+		return;
+	}
+
+	if ((c->req_length + len) >= HTTP_MAX_REQ_LEN) {
+		// Just look at what fits, we only need the request line
+		len = HTTP_MAX_REQ_LEN - 1 - c->req_length;
+	}
+	memcpy(&c->req_buffer[c->req_length], data, len);
+	c->req_length += len;
+	c->req_buffer[c->req_length] = 0;
+
+	if ((strstr(c->req_buffer, "\r\n\r\n") != NULL) || (c->req_length == (HTTP_MAX_REQ_LEN - 1))) {
+		http_process_request(c);
+	}
+}
+
+
+/**
+ * Look at the request line and start the response
+ */
+static void http_process_request(http_client_t* c)
+{
+	char* uriP;
+	char* endP;
+
+	// Request line: <method> <uri> HTTP/1.x
+	uriP = NULL;
+	if (strncmp(c->req_buffer, "GET ", 4) == 0) {
+		uriP = &c->req_buffer[4];
+		endP = strpbrk(uriP, " ?\r\n");
+		if (endP != NULL) *endP = 0;
+	}
+
+	if ((uriP != NULL) && ((strcmp(uriP, HTTP_URI_STREAM) == 0) || (strcmp(uriP, "/") == 0))) {
+		ESP_LOGI(TAG, "Start stream");
+		c->state = HTTP_ST_STREAM;
+		http_queue_text(c, http_stream_rsp);
+	} else if ((uriP != NULL) && (strcmp(uriP, HTTP_URI_SNAPSHOT) == 0)) {
+		// Wait for the next image
+		c->state = HTTP_ST_SNAPSHOT;
+	} else if ((uriP != NULL) && (strcmp(uriP, HTTP_URI_THERMAL_STREAM) == 0)) {
+		ESP_LOGI(TAG, "Start thermal stream");
+		http_set_thermal(c);
+		c->state = HTTP_ST_STREAM;
+		http_queue_text(c, http_stream_rsp);
+	} else if ((uriP != NULL) && (strcmp(uriP, HTTP_URI_THERMAL_SNAPSHOT) == 0)) {
+		http_set_thermal(c);
+		c->state = HTTP_ST_SNAPSHOT;
+	} else {
+		c->state = HTTP_ST_CLOSING;
+		http_queue_text(c, http_not_found_rsp);
+	}
+}
+
+
+/**
+ * Move a client from the ArduCAM images to the thermal images
+ */
+static void http_set_thermal(http_client_t* c)
+{
+	c->thermal = true;
+	num_clients--;
+	num_thermal_clients++;
+}
+
+
+/**
+ * Handle a new image from app_task or gui_task
+ */
+static void http_task_handle_notifications()
+{
+	int i;
+	uint32_t notification_value;
+
+	notification_value = 0;
+	if (xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, 0)) {
+		if (Notification(notification_value, HTTP_NOTIFY_CAM_FRAME_MASK)) {
+			image_held = true;
+
+			// Clients still sending the previous image skip this one
+			for (i=0; i<HTTP_MAX_CLIENTS; i++) {
+				if ((clients[i].sock >= 0) && !clients[i].tx_active && !clients[i].thermal &&
+				    ((clients[i].state == HTTP_ST_STREAM) || (clients[i].state == HTTP_ST_SNAPSHOT))) {
+
+					http_queue_image(&clients[i], sys_http_cam_bufferP->cam_bufferP,
+					                 sys_http_cam_bufferP->cam_buffer_len, false);
+				}
+			}
+
+			// Release it now if no-one wanted it
+			http_check_image_done();
+		}
+
+		if (Notification(notification_value, HTTP_NOTIFY_LEP_FRAME_MASK)) {
+			for (i=0; i<HTTP_MAX_CLIENTS; i++) {
+				if ((clients[i].sock >= 0) && !clients[i].tx_active && clients[i].thermal &&
+				    ((clients[i].state == HTTP_ST_STREAM) || (clients[i].state == HTTP_ST_SNAPSHOT))) {
+
+					http_queue_image(&clients[i], thermal_buffer, thermal_len, true);
+				}
+			}
+
+			http_check_thermal_done();
+		}
+	}
+}
+
+
+/**
+ * Queue a fixed text response
+ */
+static void http_queue_text(http_client_t* c, const char* s)
+{
+	c->tx_seg[0].bufP = s;
+	c->tx_seg[0].length = strlen(s);
+	c->tx_seg_count = 1;
+	c->tx_seg_index = 0;
+	c->tx_seg_offset = 0;
+	c->tx_image = false;
+	c->tx_thermal = false;
+	c->tx_active = true;
+	c->tx_progress_usec = esp_timer_get_time();
+}
+
+
+/**
+ * Queue the held jpeg image (ArduCAM or thermal) as the next part of a stream or a
+ * snapshot response
+ */
+static void http_queue_image(http_client_t* c, const uint8_t* bufP, uint32_t jpeg_len, bool thermal)
+{
+	if (c->state == HTTP_ST_STREAM) {
+		sprintf(c->hdr_buffer, "--" HTTP_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n",
+			jpeg_len);
+	} else {
+		sprintf(c->hdr_buffer, "HTTP/1.1 200 OK\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\n" \
+			"Cache-Control: no-cache\r\nConnection: close\r\n\r\n", jpeg_len);
+		c->state = HTTP_ST_CLOSING;
+	}
+
+	c->tx_seg[0].bufP = c->hdr_buffer;
+	c->tx_seg[0].length = strlen(c->hdr_buffer);
+	c->tx_seg[1].bufP = (const char*) bufP;
+	c->tx_seg[1].length = jpeg_len;
+	c->tx_seg[2].bufP = http_part_end;
+	c->tx_seg[2].length = strlen(http_part_end);
+	c->tx_seg_count = (c->state == HTTP_ST_STREAM) ? 3 : 2;
+	c->tx_seg_index = 0;
+	c->tx_seg_offset = 0;
+	c->tx_image = !thermal;
+	c->tx_thermal = thermal;
+	c->tx_active = true;
+	c->tx_progress_usec = esp_timer_get_time();
+}
+
+
+/**
+ * Send as much of the queued response as the socket will take
+ */
+static void http_service_tx(http_client_t* c)
+{
+	bool was_image;
+	bool was_thermal;
+	const char* bufP;
+	int err;
+	uint32_t len;
+
+	if (!c->tx_active) return;
+
+	bufP = &c->tx_seg[c->tx_seg_index].bufP[c->tx_seg_offset];
+	len = c->tx_seg[c->tx_seg_index].length - c->tx_seg_offset;
+	if (len > HTTP_TX_CHUNK_LEN) len = HTTP_TX_CHUNK_LEN;
+
+	err = send(c->sock, bufP, len, 0);
+	if (err < 0) {
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+			http_close_client(c);
+		}
+		return;
+	}
+	c->tx_progress_usec = esp_timer_get_time();
+
+	c->tx_seg_offset += err;
+	while ((c->tx_seg_index < c->tx_seg_count) &&
+	       (c->tx_seg_offset >= c->tx_seg[c->tx_seg_index].length)) {
+		c->tx_seg_offset = 0;
+		c->tx_seg_index++;
+	}
+	if (c->tx_seg_index == c->tx_seg_count) {
+		was_image = c->tx_image;
+		was_thermal = c->tx_thermal;
+		c->tx_active = false;
+		c->tx_image = false;
+		c->tx_thermal = false;
+		if (c->state == HTTP_ST_CLOSING) {
+			http_close_client(c);
+		}
+		if (was_image) {
+			http_check_image_done();
+		}
+		if (was_thermal) {
+			http_check_thermal_done();
+		}
+	}
+}
+
+
+/**
+ * Disconnect a client that hasn't been able to accept any data for too long
+ */
+static void http_check_tx_timeout(http_client_t* c)
+{
+	if ((c->sock >= 0) && c->tx_active) {
+		if ((esp_timer_get_time() - c->tx_progress_usec) > (HTTP_SEND_TIMEOUT_MSEC * 1000)) {
+			ESP_LOGW(TAG, "Viewer not accepting data - disconnecting");
+			http_close_client(c);
+		}
+	}
+}
+
+
+/**
+ * Notify app_task we're done with the image it is holding for us once no client is
+ * still sending it
+ */
+static void http_check_image_done()
+{
+	int i;
+
+	if (!image_held) return;
+
+	for (i=0; i<HTTP_MAX_CLIENTS; i++) {
+		if ((clients[i].sock >= 0) && clients[i].tx_active && clients[i].tx_image) {
+			return;
+		}
+	}
+
+	image_held = false;
+	xTaskNotify(task_handle_app, APP_NOTIFY_HTTP_DONE_MASK, eSetBits);
+}
+
+
+/**
+ * Free the thermal buffer for gui_task once no client is still sending it
+ */
+static void http_check_thermal_done()
+{
+	int i;
+
+	if (thermal_state != HTTP_THERMAL_HELD) return;
+
+	for (i=0; i<HTTP_MAX_CLIENTS; i++) {
+		if ((clients[i].sock >= 0) && clients[i].tx_active && clients[i].tx_thermal) {
+			return;
+		}
+	}
+
+	portENTER_CRITICAL(&thermal_mux);
+	thermal_state = HTTP_THERMAL_FREE;
+	portEXIT_CRITICAL(&thermal_mux);
+}
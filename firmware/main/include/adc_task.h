@@ -34,6 +34,15 @@
 // chip to sample all inputs.
 #define ADC_TASK_SAMPLE_MSEC 75
 
+// Update interval while the ADC's limit alerts (ADC_INT_IO) watch the power button and
+// battery, and the number of ADC_TASK_SAMPLE_MSEC samples taken after an alert (more are
+// taken while the button is held)
+#define ADC_TASK_SLOW_SAMPLE_MSEC 1000
+#define ADC_TASK_ALERT_SAMPLES    4
+
+// ADC Task notifications
+#define ADC_NOTIFY_ALERT_MASK 0x00000001
+
 // Power-button long-press detection period - rounded to a multiple of the sample period
 #define ADC_TASK_PWROFF_PRESS_MSEC 1500
 
@@ -33,7 +33,8 @@
 // App Task constants
 //
 
-// App Task notifications
+// App Task notifications.  CAM_FRAME and LEP_FRAME mean there are new events in the
+// SYS_FRAME_STREAM_CAM and SYS_FRAME_STREAM_LEP frame event streams.
 #define APP_NOTIFY_SHUTDOWN_MASK        0x00000001
 #define APP_NOTIFY_NEW_WIFI_MASK        0x00000002
 #define APP_NOTIFY_SDCARD_PRESENT_MASK  0x00000004
@@ -47,13 +48,44 @@
 #define APP_NOTIFY_RECORD_FAIL_MASK     0x00000400
 #define APP_NOTIFY_RECORD_IMG_DONE_MASK 0x00000800
 #define APP_NOTIFY_CAM_FRAME_MASK       0x00001000
-#define APP_NOTIFY_CAM_FAIL_MASK        0x00002000
 #define APP_NOTIFY_LEP_FRAME_MASK       0x00004000
-#define APP_NOTIFY_LEP_FAIL_MASK        0x00008000
 #define APP_NOTIFY_GUI_CAM_DONE_MASK    0x00010000
 #define APP_NOTIFY_GUI_LEP_DONE_MASK    0x00020000
 #define APP_NOTIFY_CMD_REQ_MASK         0x00040000
 #define APP_NOTIFY_CMD_DONE_MASK        0x00080000
+#define APP_NOTIFY_HTTP_DONE_MASK       0x00100000
+#define APP_NOTIFY_TOS_MASK             0x00200000
+#define APP_NOTIFY_START_BENCH_MASK     0x00400000
+#define APP_NOTIFY_RESTART_MASK         0x00800000
+
+// Frame stats arrival time for an image that wasn't received in its period
+#define APP_FRAME_LATE                  0xFFFF
+
+
+
+//
+// App Task typedefs
+//
+
+// Image pipeline accounting since startup.  Each one second period both cameras are
+// asked for an image and the period's images are handed off for processing when both
+// have arrived or at APP_MAX_WAIT_MSEC.  The arrival times are for the last period.
+typedef struct {
+	uint32_t requested;         // Periods (each requests both images)
+	uint32_t cam_received;      // Images received within their period
+	uint32_t lep_received;
+	uint32_t cam_late;          // Periods handed off without the image
+	uint32_t lep_late;
+	uint32_t gui_skipped;       // Images not displayed because the GUI was still busy
+	uint32_t file_skipped;      // Images not recorded because file_task was behind
+	uint32_t dropped;           // Periods not processed because cmd_task was behind
+	uint32_t cmd_sent;          // Images handed to cmd_task
+	uint32_t decimated;         // Images not given to a consumer by its rate or load policy
+	uint16_t cam_msec;          // Arrival after the start of the last period or APP_FRAME_LATE
+	uint16_t lep_msec;
+	uint16_t pair_msec;         // Time between the last period's ArduCAM capture start and
+	                            // Lepton frame or APP_FRAME_LATE if either is missing
+} app_frame_stats_t;
 
 
 
@@ -62,5 +94,8 @@
 //
 void app_task();
 bool app_task_get_recording();
+bool app_task_get_sleep_cycle();
+void app_task_request_cmd_image(bool json, bool binary, uint8_t json_contents, bool cached);
+void app_task_get_frame_stats(app_frame_stats_t* statsP);
  
 #endif /* APP_TASK_H */
\ No newline at end of file
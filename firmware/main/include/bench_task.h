@@ -0,0 +1,116 @@
+/*
+ * Bench Task
+ *
+ * Time the pipeline components on the camera hardware for the run_benchmark command.
+ * Components owned by other tasks are timed in their task's context.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef BENCH_TASK_H
+#define BENCH_TASK_H
+
+#include "system_config.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef INCLUDE_SYS_BENCH
+
+
+//
+// Bench Task Constants
+//
+
+// Bench Task notifications
+#define BENCH_NOTIFY_START_MASK 0x00000001
+#define BENCH_NOTIFY_DONE_MASK  0x00000002
+
+// Times are averaged over this many runs of each item
+#define BENCH_ITERATIONS        10
+
+// vospi_get_frame is only a few uSec so it is run more times, but still quickly enough
+// to finish between segments (must be even to leave vospi with its original buffer)
+#define BENCH_VOSPI_ITERATIONS  100
+
+// Scratch data buffer (pseudo-random data for base64, SD and TCP)
+#define BENCH_BUF_LEN           CAM_MAX_JPG_LEN
+
+// SD Card sequential write test file (in the root directory, deleted afterwards)
+#define BENCH_SD_FILE_NAME      "bench.dat"
+#define BENCH_SD_FILE_LEN       (1024 * 1024)
+
+// Data sent to the requesting client's tcp_port
+#define BENCH_TCP_LEN           (1024 * 1024)
+
+// Maximum time for another task to run its items
+#define BENCH_STEP_TIMEOUT_MSEC 10000
+
+// Delay before running the benchmarks with BENCH_AT_BOOT.  The system should be up and
+// the cameras delivering images.
+#define BENCH_BOOT_DELAY_MSEC   15000
+
+// Benchmark items
+#define BENCH_B64_TELEM         0
+#define BENCH_B64_LEP           1
+#define BENCH_B64_JPEG          2
+#define BENCH_JSON_IMAGE        3
+#define BENCH_JPEG_SCALE_1      4
+#define BENCH_JPEG_SCALE_2      5
+#define BENCH_JPEG_SCALE_4      6
+#define BENCH_JPEG_SCALE_8      7
+#define BENCH_LEP_IMAGE         8
+#define BENCH_VOSPI_FRAME       9
+#define BENCH_SD_4K             10
+#define BENCH_SD_16K            11
+#define BENCH_SD_32K            12
+#define BENCH_SD_64K            13
+#define BENCH_TCP_SEND          14
+#define BENCH_NUM_ITEMS         15
+
+
+
+//
+// Bench Task typedefs
+//
+typedef struct {
+	bool valid;                 // Item was run
+	uint32_t bytes;             // Bytes processed by one run
+	uint32_t usec;              // Average time for one run
+} bench_result_t;
+
+
+
+//
+// Bench Task API
+//
+void bench_task();
+bool bench_task_request(uint32_t tcp_addr, uint16_t tcp_port);
+void bench_task_get_results(bench_result_t* resultsP);
+const char* bench_task_item_name(int item);
+
+// Called by the tasks owning the items
+#ifdef INCLUDE_SYS_GUI
+void bench_task_run_render();
+void bench_task_run_lep_image();
+#endif
+void bench_task_run_vospi();
+void bench_task_run_sd(bool card_ready);
+
+#endif /* INCLUDE_SYS_BENCH */
+
+#endif /* BENCH_TASK_H */
@@ -31,7 +31,9 @@
 #ifndef CAM_TASK_H
 #define CAM_TASK_H
 
+#include <stdbool.h>
 #include <stdint.h>
+#include "sys_utilities.h"
 
 
 
@@ -45,8 +47,73 @@
 // CAM Max wait time for ArduCAM to complete a jpeg snapshot
 #define CAM_MAX_JPEG_WAIT_TIME_MSEC 300
 
+// Capture done detection.  Each check of the capture done flag is a VSPI transaction so
+// cam_task sleeps through most of the capture time predicted from recent captures,
+// waking CAM_CAPTURE_EARLY_MSEC early, and then checks every CAM_CAPTURE_POLL_USEC for up
+// to CAM_CAPTURE_SPIN_MSEC past the prediction before falling back to checking every
+// CAM_JPEG_TASK_WAIT_MSEC.  The prediction is a running average (weight
+// 1/CAM_CAPTURE_AVG_WEIGHT for the newest capture) starting at CAM_CAPTURE_INIT_MSEC.
+#define CAM_CAPTURE_INIT_MSEC       100
+#define CAM_CAPTURE_EARLY_MSEC      15
+#define CAM_CAPTURE_POLL_USEC       1000
+#define CAM_CAPTURE_SPIN_MSEC       15
+#define CAM_CAPTURE_AVG_WEIGHT      8
+
+// Pre-armed capture.  app_task requests the image cam_task_get_image_lead_msec() before
+// the top of the second so it is ready when the second starts.  The lead is the average
+// capture and offload time plus CAM_ARM_MARGIN_MSEC (limited to CAM_ARM_MAX_LEAD_MSEC).
+#define CAM_ARM_MARGIN_MSEC         20
+#define CAM_ARM_MAX_LEAD_MSEC       400
+
+// ArduCAM SPI clock calibration.  The camera starts at CAM_SPI_FREQ_HZ and cam_task
+// looks for the fastest clock in CAM_SPI_TUNE_FREQS (fastest first) that passes the
+// ArduChip test register patterns and then reads CAM_SPI_TUNE_CAPTURES complete jpeg
+// images.  The result is kept in persistent storage and only rechecked with one image at
+// startup.  The clock steps down to the next slower one after CAM_SPI_MAX_FAILS
+// consecutive failed images.
+#define CAM_SPI_TUNE_FREQS          {16000000, 10000000, 8000000}
+#define CAM_SPI_TUNE_CAPTURES       3
+#define CAM_SPI_MAX_FAILS           3
+
+// Delay after changing the image resolution before the next capture
+#define CAM_RECONFIG_SETTLE_MSEC    100
+
+// Network adaptive jpeg quality.  cmd_task sets a jpeg length budget from the throughput
+// its slowest client achieves.  While the camera isn't recording the quantization scale
+// steps up by CAM_ADAPT_QS_STEP after each image longer than the budget (to at most
+// OV2640_QS_MAX) and back down toward the configured quality after each image shorter
+// than CAM_ADAPT_LOW_PCT percent of it.  Recorded images always use the configured
+// quality.
+#define CAM_ADAPT_QS_STEP           4
+#define CAM_ADAPT_LOW_PCT           70
+
+// Pre-trigger jpeg ring.  While app_task has it enabled (recording alarm events with the
+// ArduCAM enabled) cam_task captures continuously at its maximum rate between requested
+// images and keeps the CAM_RING_LEN most recent in pool buffers.  A ring image's offload
+// only starts once neither the LCD nor the touchscreen has or is waiting for the VSPI
+// bus, checking every CAM_JPEG_TASK_WAIT_MSEC for up to CAM_RING_IDLE_WAIT_MSEC before the
+// image is dropped, so the ring only uses idle bus time.  app_task takes the ring's images
+// when an alarm triggers and records them with the event.
+#define CAM_RING_IDLE_WAIT_MSEC     200
+
 // CAM Task notifications
 #define CAM_NOTIFY_GET_FRAME_MASK 0x00000001
+#define CAM_NOTIFY_SLEEP_MASK     0x00000002
+
+
+
+//
+// CAM Task typedefs
+//
+typedef struct {
+	uint32_t captures;           // Completed captures
+	uint32_t timeouts;           // Captures that didn't complete in CAM_MAX_JPEG_WAIT_TIME_MSEC
+	uint32_t avg_msec;           // Running average capture time
+	uint32_t max_msec;           // Longest capture time
+	uint32_t avg_readout_msec;   // Running average jpeg offload time
+	float avg_polls;             // Average capture done checks per capture
+	uint32_t quality;            // Current jpeg quantization scale
+} cam_capture_stats_t;
 
 
 
@@ -54,5 +121,10 @@
 // CAM Task API
 //
 void cam_task();
+void cam_task_get_capture_stats(cam_capture_stats_t* statsP);
+int cam_task_get_image_lead_msec();
+void cam_task_set_jpeg_budget(uint32_t len);
+void cam_task_set_ring(bool en);
+int cam_task_take_ring(cam_buffer_t** bufPP, int max_len);
 
 #endif /* CAM_TASK_H */
\ No newline at end of file
@@ -24,6 +24,7 @@
 #ifndef CMD_TASK_H
 #define CMD_TASK_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 
@@ -43,8 +44,27 @@
 #define CMD_RECORD_ON  7
 #define CMD_RECORD_OFF 8
 #define CMD_POWEROFF   9
-#define CMD_UNKNOWN    10
-#define CMD_NUM        10
+#define CMD_SET_IMG_FMT 10
+#define CMD_STREAM_ON  11
+#define CMD_STREAM_OFF 12
+#define CMD_UDP_ON     13
+#define CMD_UDP_OFF    14
+#define CMD_GET_PERF   15
+#define CMD_DUMP_TRACE 16
+#define CMD_RUN_BENCH  17
+#define CMD_LIST_SESSIONS 18
+#define CMD_GET_FILE   19
+#define CMD_GET_SESSION 20
+#define CMD_PREP_CARD  21
+#define CMD_SET_SYNC   22
+#define CMD_OTA_UPDATE 23
+#define CMD_SET_UPLOAD 24
+#define CMD_SET_FUSION_CAL 25
+#define CMD_CAL_LEPTON 26
+#define CMD_GET_SCHED  27
+#define CMD_SET_SCHED  28
+#define CMD_UNKNOWN    29
+#define CMD_NUM        29
 
 // Command strings
 #define CMD_GET_STATUS_S "get_status"
@@ -57,27 +77,133 @@
 #define CMD_RECORD_ON_S  "record_on"
 #define CMD_RECORD_OFF_S "record_off"
 #define CMD_POWEROFF_S   "poweroff"
+#define CMD_SET_IMG_FMT_S "set_image_format"
+#define CMD_STREAM_ON_S  "stream_on"
+#define CMD_STREAM_OFF_S "stream_off"
+#define CMD_UDP_ON_S     "udp_stream_on"
+#define CMD_UDP_OFF_S    "udp_stream_off"
+#define CMD_GET_PERF_S   "get_perf"
+#define CMD_DUMP_TRACE_S "dump_trace"
+#define CMD_RUN_BENCH_S  "run_benchmark"
+#define CMD_LIST_SESSIONS_S "list_sessions"
+#define CMD_GET_FILE_S   "get_file"
+#define CMD_GET_SESSION_S "get_session"
+#define CMD_PREP_CARD_S  "prepare_card"
+#define CMD_SET_SYNC_S   "set_sync"
+#define CMD_OTA_UPDATE_S "ota_update"
+#define CMD_SET_UPLOAD_S "set_upload"
+#define CMD_SET_FUSION_CAL_S "set_fusion_cal"
+#define CMD_CAL_LEPTON_S "calibrate_lepton"
+#define CMD_GET_SCHED_S  "get_schedule"
+#define CMD_SET_SCHED_S  "set_schedule"
 
+// get_image response formats (selected per connection by set_image_format)
+#define CMD_IMG_FMT_JSON   0
+#define CMD_IMG_FMT_BINARY 1
+#define CMD_IMG_FMT_BINARY_Z 2   /* Binary with compressed radiometric data */
 
-// Maximum wait period for the system to come up with a response to send back
+
+// Maximum number of simultaneous client connections
+#define CMD_MAX_CLIENTS                   4
+
+// Commands may include a "tag" (1 - CMD_MAX_TAG) that is returned in their responses
+#define CMD_MAX_TAG                       65535
+
+// Maximum get_image requests a client may have waiting for images
+#define CMD_MAX_IMAGE_REQUESTS            4
+
+// Maximum wait period for the system to come up with an image to send back
 #define CMD_RESPONSE_MAX_WAIT_MSEC        1500
-#define CMD_RESPONSE_WAIT_TASK_SLEEP_MSEC 100
-#define CMD_RESPONSE_WAIT_COUNT_INIT      (CMD_RESPONSE_MAX_WAIT_MSEC / CMD_RESPONSE_WAIT_TASK_SLEEP_MSEC)
+
+// Socket select timeout used for housekeeping (request and send timeouts).  Notifications
+// from other tasks wake cmd_task immediately through a loopback socket.
+#define CMD_POLL_MSEC                     100
+
+// Loopback UDP port used to wake cmd_task from select() when it is notified
+#define CMD_WAKE_PORT                     5002
+
+// Status beacon.  A compact status datagram is broadcast to CMD_BEACON_PORT every
+// CMD_BEACON_SEC seconds and sent back to anyone who sends a get_status command
+// datagram to that port, so a monitor can find every camera with one broadcast and
+// follow them without a TCP connection.  Undefine CMD_BEACON_SEC to only answer
+// requests.
+#define CMD_BEACON_SEC                    10
+
+// Clients that can't accept any data for this long are disconnected
+#define CMD_SEND_TIMEOUT_MSEC             1000
+
+// Maximum pieces of an image being sent (binary header, jpeg, radiometric, telemetry)
+#define CMD_TX_MAX_SEGS                   4
+
+// A client still sending an image this long after app_task gave it to us is sent the
+// rest from its own copy so the image can be released and newer images delivered to
+// the other clients.  Images that arrive while a client is sending its copy are skipped
+// for it and it is sent the newest one when it is done.
+#define CMD_IMAGE_LAG_MSEC                250
+
+// Network adaptive jpeg quality.  Each client's throughput is the running average
+// (weight 1/CMD_ADAPT_AVG_WEIGHT for the newest image) of its image lengths over the time
+// taken to send them.  The jpeg budget given to cam_task leaves the slowest client
+// CMD_ADAPT_TARGET_PCT percent of its image period to send each image.  Clients that
+// haven't finished an image for CMD_ADAPT_STALE_MSEC aren't counted.  Undefine
+// CMD_ADAPT_JPEG to always send images with the configured quality.
+#define CMD_ADAPT_JPEG
+#define CMD_ADAPT_AVG_WEIGHT              4
+#define CMD_ADAPT_TARGET_PCT              75
+#define CMD_ADAPT_STALE_MSEC              5000
 
 // Delimiters used to wrap json strings sent over the network
 #define CMD_JSON_STRING_START 0x02
 #define CMD_JSON_STRING_STOP  0x03
 
-// Maximum send packet size
-#define CMD_MAX_TX_PKT_LEN    1024
+// Maximum bytes handed to the socket at once.  This matches the socket send buffer
+// (CONFIG_TCP_SND_BUF_DEFAULT) and is a multiple of the TCP MSS (CONFIG_TCP_MSS) so
+// lwip can always send full-sized segments.
+#define CMD_TCP_MSS           1436
+#define CMD_TX_CHUNK_LEN      (CMD_TCP_MSS * 8)
+
+// Streamed responses (get_perf, list_sessions) are written one TCP segment at a time
+// as the socket accepts them
+#define CMD_STREAM_CHUNK_LEN  CMD_TCP_MSS
 
 // App Task notifications
-#define CMD_NOTIFY_IMAGE_MASK 0x00000001
+#define CMD_NOTIFY_IMAGE_MASK     0x00000001
+#define CMD_NOTIFY_BIN_IMAGE_MASK 0x00000002
+#define CMD_NOTIFY_LEP_FRAME_MASK 0x00000004
+#define CMD_NOTIFY_ALARM_MASK     0x00000008
+#define CMD_NOTIFY_BENCH_MASK     0x00000010
+#define CMD_NOTIFY_XFER_MASK      0x00000020
+#define CMD_NOTIFY_OTA_MASK       0x00000040
+
+
+//
+// CMD Task typedefs
+//
+
+// UDP frame stream datagram header (little-endian).  Each Lepton frame is sent as the
+// 16-bit radiometric pixels followed by the 16-bit telemetry words, split across
+// chunk_count datagrams of up to CMD_UDP_PAYLOAD_LEN bytes.
+#define CMD_UDP_MAGIC       0x46554346   /* "FCUF" */
+#define CMD_UDP_PAYLOAD_LEN 1400
+
+// Multicast datagrams are limited to the local network by default
+#define CMD_UDP_MULTICAST_TTL 1
+
+typedef struct {
+	uint32_t magic;
+	uint32_t frame_num;        // Incremented for each frame sent
+	uint16_t chunk_index;
+	uint16_t chunk_count;
+	uint32_t offset;           // Offset of this payload in the frame
+	uint32_t total_len;        // Length of the complete frame
+} __attribute__((packed)) cmd_udp_header_t;
 
 
 //
 // CMD Task API
 //
 void cmd_task();
+void cmd_task_notify(uint32_t mask);
+bool cmd_task_recover();
 
 #endif /* CMD_TASK_H */
\ No newline at end of file
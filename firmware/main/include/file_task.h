@@ -26,7 +26,10 @@
 #ifndef FILE_TASK_H
 #define FILE_TASK_H
 
+#include "sys_utilities.h"
+#include "vospi.h"
 #include <stdint.h>
+#include <stdbool.h>
 
 
 //
@@ -37,20 +40,398 @@
 #define FILE_NOTIFY_START_RECORDING_MASK 0x00000001
 #define FILE_NOTIFY_STOP_RECORDING_MASK  0x00000002
 #define FILE_NOTIFY_NEW_IMAGE_MASK       0x00000004
+#define FILE_NOTIFY_NEW_LEP_RECORD_MASK  0x00000008
+#define FILE_NOTIFY_SUSPEND_REC_MASK     0x00000010
+#define FILE_NOTIFY_CARD_DETECT_MASK     0x00000020
+#define FILE_NOTIFY_DUMP_TRACE_MASK      0x00000040
+#define FILE_NOTIFY_BENCH_MASK           0x00000080
+#define FILE_NOTIFY_PREP_CARD_MASK       0x00000100
+
+// Write-behind image queue.  app_task queues recorded images for file_task so SD Card
+// latency spikes (card housekeeping can stall writes for hundreds of mSec) don't hold
+// up image processing.  Binary images are queued as references to the pool buffers and
+// json images are copied into a queue buffer.  New images are dropped while the queue
+// is full.
+#define FILE_QUEUE_LEN                   4
+
+// Consecutive write failures before file_task gives up on a recording session.  Single
+// failed images are dropped and counted.
+#define FILE_MAX_WRITE_FAILS             3
 
 // Maximum file write size - maximum bytes to write through the system call so that
-// we don't put too large a pressure on the stack or heap
+// we don't put too large a pressure on the stack or heap (used if the write staging
+// buffer can't be allocated)
 #define MAX_FILE_WRITE_LEN               4096
 
-// Period between checks for card present state.
+// Write staging buffer size.  Data in the PSRAM isn't DMA capable so the SD driver
+// would copy it through a bounce buffer one 512-byte sector at a time.  Instead writes
+// are collected in an internal DMA-capable buffer and handed to FATFS in blocks of this
+// size aligned to the same boundary in the file so they go to the card as multi-sector
+// transfers.  It divides the FAT allocation unit the camera formats cards with.
+#define FILE_WRITE_BUF_LEN               (16 * 1024)
+
+// Internal flash spool (see spool_utilities.h).  When an image can't be written to the
+// card it is written to the spool partition instead and so are the images after it
+// until the card is writing again.  Spooled images are moved to their session directory
+// on the card, oldest first, whenever there is nothing else to write (as image files,
+// also for container sessions, each with its entry appended to the session index).
+// While the card is failing a move is tried every FILE_SPOOL_RETRY_MSEC and the first
+// that works sends images back to the card.  A spooled image isn't a write error so a
+// card stall or a card knocked loose doesn't end the session unless the spool fills.
+// High-rate records aren't spooled.
+#define FILE_SPOOL_RETRY_MSEC            2000
+
+// Period between checks for card present state when there is no card-detect switch
+// (SD_CD_IO).  A present card is checked with a status command and must fail
+// FILE_CARD_MISSING_PROBES checks in a row to be considered removed.  A full card
+// initialization is only attempted after a basic probe finds a card.
 #define FILE_CARD_CHECK_PERIOD_MSEC      2000
+#define FILE_CARD_MISSING_PROBES         2
+
+// Time the card-detect switch must be stable before acting on a change
+#define FILE_CD_DEBOUNCE_MSEC            250
+
+// Undefine to unmount the card between recording sessions.  Keeping it mounted means
+// FATFS keeps the free cluster count it read (or computed, which can take seconds on a
+// large card) when the card was mounted, so a recording session starts immediately.
+#define FILE_KEEP_MOUNTED
+
+// Card speed test.  A newly found card (unless a session is waiting to be resumed) is
+// timed writing a FILE_SPEED_TEST_LEN byte file sequentially in FILE_WRITE_BUF_LEN blocks,
+// the way recording writes, and then rewriting FILE_SPEED_TEST_RAND_WRITES blocks of
+// FILE_SPEED_TEST_RAND_LEN bytes at random offsets in it, each synced like an index or
+// container sync.  The recording profile (format and interval) is sustainable if the
+// estimated time to write a second's worth of recording is less than 1/FILE_SPEED_MARGIN
+// of a second and the longest random write is shorter than the FILE_QUEUE_LEN images of
+// queue can cover.  Each image is estimated to need FILE_SPEED_IMAGE_SYNCS synced writes
+// (directory, FAT and index updates) and recording at the Lepton rate writes about
+// FILE_SPEED_LEP_RECS_PER_SEC high-rate records a second.  The camera warns when the
+// configured profile isn't sustainable.  Undefine FILE_SPEED_AUTO_PROFILE to only warn
+// instead of also switching to the closest profile the card can sustain (a binary format
+// instead of json, then longer intervals).
+#define FILE_SPEED_TEST_FILE_NAME        "speed.tmp"
+#define FILE_SPEED_TEST_LEN              (1024 * 1024)
+#define FILE_SPEED_TEST_RAND_LEN         4096
+#define FILE_SPEED_TEST_RAND_WRITES      16
+#define FILE_SPEED_MARGIN                2
+#define FILE_SPEED_IMAGE_SYNCS           3
+#define FILE_SPEED_LEP_RECS_PER_SEC      9
+#define FILE_SPEED_AUTO_PROFILE
+
+// High-rate recording file record.  Each record in the session's binary file consists
+// of a lep_record_header_t, the raw Lepton pixels (LEP_NUM_PIXELS little-endian 16-bit
+// words) and, if LEP_REC_FLAG_TELEM is set, the telemetry (LEP_TEL_WORDS 16-bit words).
+#define LEP_REC_MAGIC                    0x524C4346
+#define LEP_REC_VERSION                  1
+
+#define LEP_REC_FLAG_TELEM               0x0001
+
+// Session container file.  When record_container is set all images in a recording
+// session are appended to one file instead of one file per image.  The file starts
+// with a file_container_header_t and each image is a file_container_entry_t followed by
+// the image (json text or binary image record).  An index of file_container_index_t
+// is appended when the container is closed.  The header is rewritten each time the file
+// is synced so a container from a session that ended in a crash can be read up to the
+// last sync by following the entries.
+#define FILE_CONTAINER_MAGIC             0x43534346   /* "FCSC" */
+#define FILE_CONTAINER_VERSION           1
+#define FILE_CONTAINER_ENTRY_MAGIC       0x45534346   /* "FCSE" */
+
+#define FILE_CONTAINER_TYPE_JSON         1
+#define FILE_CONTAINER_TYPE_FCR          2
+
+// Records per container (limits the in-memory index).  A new container is started in
+// the session directory when one is full.
+#define FILE_CONTAINER_MAX_RECORDS       4096
+
+// Container space is allocated ahead of the images in large contiguous extents so the
+// file doesn't fragment (and writes don't slow down) over long sessions.  Each extent
+// holds about FILE_PREALLOC_SEC seconds of images at the session's recording interval
+// and image size, limited to what is left on the card.
+#define FILE_PREALLOC_SEC                3600
+#define FILE_PREALLOC_MIN_LEN            (4 * 1024 * 1024)
+#define FILE_PREALLOC_MAX_LEN            (256 * 1024 * 1024)
+
+// Records written between syncs of the container data and header to the card
+#define FILE_CONTAINER_SYNC_RECORDS      10
+
+// MJPEG AVI recording.  When record_format is REC_FORMAT_AVI the ArduCAM jpeg of each
+// image is appended as a frame to the session's AVI file (see avi_utilities.h) and the
+// rest of the image is recorded as a compressed binary image record without the jpeg
+// (as an image file or in the container).  The AVI index is kept in memory and appended
+// when the file is closed.  Every FILE_AVI_SYNC_FRAMES frames the header is rewritten
+// with the current counts and the index entries since the last checkpoint are appended
+// to the file's index checkpoint file, then both are synced, so the file from a session
+// that ended in a crash can be played (or its index rebuilt) up to the last checkpoint.
+// A new AVI file is started when one holds FILE_AVI_MAX_FRAMES frames or would grow past
+// FILE_AVI_MAX_LEN bytes (AVI 1.0 files are limited to 32-bit offsets and older players
+// to 1 GB).
+#define FILE_AVI_MAX_FRAMES              16384
+#define FILE_AVI_MAX_LEN                 (1024 * 1024 * 1024)
+#define FILE_AVI_SYNC_FRAMES             10
+
+// AVI frame size used if it can't be read from the first jpeg
+#define FILE_AVI_DEF_WIDTH               640
+#define FILE_AVI_DEF_HEIGHT              480
+
+// Session index file.  file_task appends a file_index_entry_t to the session's
+// INDEX_FILE_NAME for each image it writes so host tools can find images by time or
+// temperature without reading them.  The file starts with a file_index_header_t.  Image
+// files are found from their sequence number and type (see file_get_subdir_name and
+// file_get_session_file_name) and container images from their container number and
+// entry offset.
+#define FILE_INDEX_MAGIC                 0x49534346   /* "FCSI" */
+#define FILE_INDEX_VERSION               1
+
+#define FILE_INDEX_NO_CONTAINER          0xFFFF
+
+#define FILE_INDEX_FLAG_CAM              0x0001
+#define FILE_INDEX_FLAG_LEP              0x0002
+#define FILE_INDEX_FLAG_TELEM            0x0004
+#define FILE_INDEX_FLAG_AVI              0x0008
+
+// Index entries written between syncs of the index file to the card
+#define FILE_INDEX_SYNC_RECORDS          10
+
+// Session thumbnail file.  file_task appends a file_thumb_entry_t holding a decimated
+// 8-bit copy of the Lepton image to the session's THUMB_FILE_NAME for the first and then
+// every FILE_THUMB_INTERVAL'th Lepton image it writes so a session can be previewed
+// without opening its images.  Pixels are the mean of a FILE_THUMB_DECIMATE square block
+// scaled between the frame's minimum and maximum values.  The file starts with a
+// file_thumb_header_t.  Images written to the flash spool don't get a thumbnail.
+#define FILE_THUMB_MAGIC                 0x54534346   /* "FCST" */
+#define FILE_THUMB_VERSION               1
+
+#define FILE_THUMB_DECIMATE              4
+#define FILE_THUMB_WIDTH                 (LEP_WIDTH / FILE_THUMB_DECIMATE)
+#define FILE_THUMB_HEIGHT                (LEP_HEIGHT / FILE_THUMB_DECIMATE)
+#define FILE_THUMB_PIXELS                (FILE_THUMB_WIDTH * FILE_THUMB_HEIGHT)
+
+#define FILE_THUMB_INTERVAL              30
+
+// Thumbnails written between syncs of the thumbnail file to the card
+#define FILE_THUMB_SYNC_RECORDS          4
+
+// Session telemetry log.  While recording with a telemetry log rate (tlog_rate in
+// gui_state_t) file_task samples the camera's environment that many times a second,
+// independent of the recording interval, and appends a file_tlog_entry_t for each
+// sample to the session's TLOG_FILE_NAME.  Entries are collected in a buffer of
+// FILE_TLOG_BUF_ENTRIES and appended to the file, then synced, when it fills, every
+// FILE_TLOG_FLUSH_MSEC and when the session ends so the log costs a few large writes.
+// The Lepton values come from its latest frame (updated at the Lepton rate) and are
+// left out when it is older than FILE_TLOG_MAX_LEP_AGE_USEC.  The region statistics
+// come from the latest frame app_task processed (about once a second) and are left
+// out when it is older than FILE_TLOG_MAX_STATS_AGE_USEC.  The file starts with a
+// file_tlog_header_t and is continued by a resumed session.
+#define FILE_TLOG_MAGIC                  0x4C534346   /* "FCSL" */
+#define FILE_TLOG_VERSION                1
+
+#define FILE_TLOG_STATS                  (1 + SYS_LEP_STATS_MAX_ROI)
+
+#define FILE_TLOG_FLAG_LEP               0x0001
+#define FILE_TLOG_FLAG_FRAME             0x0002
+#define FILE_TLOG_FLAG_ALARM             0x0004
+
+#define FILE_TLOG_BUF_ENTRIES            112
+#define FILE_TLOG_FLUSH_MSEC             60000
+
+#define FILE_TLOG_MAX_LEP_AGE_USEC       1000000
+#define FILE_TLOG_MAX_STATS_AGE_USEC     2000000
+
+// Session metadata log.  When record_meta_log is set a recorded second without an image
+// from either camera (for example while one fails and the other is disabled or also
+// missing its image) isn't written as an image file holding only metadata.  Its
+// metadata is appended instead as one line of compact json text to the session's
+// META_LOG_FILE_NAME so a sensor outage doesn't cost a file create and directory update
+// (or a container record) every second.  Lines aren't listed in the session index.  The
+// log is synced every FILE_META_SYNC_RECORDS lines and when the session ends.  It is
+// continued by a resumed session, after ending a line cut short by a power failure.  A
+// line that can't be written while images are going to the flash spool is spooled as a
+// json image file.
+#define FILE_META_SYNC_RECORDS           10
+
+// Ring recording.  When record_ring is set file_task deletes the oldest session
+// directories, other than the one being recorded, while a session's free space is below
+// FILE_RING_LOW_FREE_MB until it is above FILE_RING_HIGH_FREE_MB so recording can continue
+// indefinitely.  Free space is checked every FILE_RING_CHECK_MSEC (FATFS keeps the free
+// cluster count so this doesn't read the FAT) and sessions are deleted one file at a time
+// when there are no images waiting to be written.  The low threshold leaves room for a
+// full container extent.
+#define FILE_RING_LOW_FREE_MB            512
+#define FILE_RING_HIGH_FREE_MB           1024
+#define FILE_RING_CHECK_MSEC             5000
+
+// The free space on a mounted card is checked for file_task_get_free_mb every
+// FILE_FREE_CHECK_MSEC while there is nothing to write
+#define FILE_FREE_CHECK_MSEC             10000
+
+// The session summary is rewritten every FILE_SUMMARY_WRITE_MSEC, when it has changed
+// and there is nothing to write, and when the session ends
+#define FILE_SUMMARY_WRITE_MSEC          60000
+
+// Recording journal.  file_task records the session directory and how far each file
+// has been safely written in the RTC SRAM (see ps_rec_journal_t) as it records.  If the
+// camera restarts without the session being stopped (crash, power failure or a
+// suspended session after repeated write failures) the next session resumes in the same
+// directory: image numbering continues, a new container is started and the high-rate
+// file continues after its last synced record.  The journal is updated after each image
+// file, each container sync and each sync of the high-rate file.
+//
+// High-rate records written between syncs of the high-rate file (about 10 seconds of
+// frames)
+#define FILE_LEP_SYNC_RECORDS            90
+
+
+
+//
+// File Task typedefs
+//
+typedef struct {
+	uint32_t magic;              // LEP_REC_MAGIC ("FCLR")
+	uint16_t version;            // LEP_REC_VERSION
+	uint16_t flags;
+	uint32_t seq_num;            // Record number in this session, starting at 1
+	uint32_t epoch_sec;          // Wall-clock time the record was written
+	int64_t timestamp_usec;      // esp_timer time of the frame's vsync
+	uint16_t width;
+	uint16_t height;
+	uint16_t min_val;
+	uint16_t max_val;
+} __attribute__((packed)) lep_record_header_t;
+
+typedef struct {
+	uint32_t magic;              // FILE_CONTAINER_MAGIC
+	uint16_t version;            // FILE_CONTAINER_VERSION
+	uint16_t header_len;         // sizeof(file_container_header_t)
+	uint32_t record_count;       // Records in the container (as of the last sync)
+	uint32_t data_end;           // Offset of the end of the last record (as of the last sync)
+	uint32_t index_offset;       // Offset of the index or 0 if the container wasn't closed
+	uint32_t reserved;
+} __attribute__((packed)) file_container_header_t;
+
+typedef struct {
+	uint32_t magic;              // FILE_CONTAINER_ENTRY_MAGIC
+	uint16_t type;               // FILE_CONTAINER_TYPE_*
+	uint16_t reserved;
+	uint32_t seq_num;            // Image sequence number (as used in image file names)
+	uint32_t length;             // Image length following this entry header
+} __attribute__((packed)) file_container_entry_t;
+
+typedef struct {
+	uint32_t offset;             // Offset of the record's file_container_entry_t
+	uint32_t length;             // Image length
+	uint32_t seq_num;
+	uint16_t type;
+	uint16_t reserved;
+} __attribute__((packed)) file_container_index_t;
+
+typedef struct {
+	uint32_t magic;              // FILE_INDEX_MAGIC
+	uint16_t version;            // FILE_INDEX_VERSION
+	uint16_t entry_len;          // sizeof(file_index_entry_t)
+	uint32_t reserved[2];
+} __attribute__((packed)) file_index_header_t;
+
+typedef struct {
+	uint32_t seq_num;            // Image sequence number
+	uint32_t epoch_sec;          // Wall-clock time the image was captured
+	uint16_t type;               // FILE_CONTAINER_TYPE_*
+	uint16_t container_num;      // FILE_INDEX_NO_CONTAINER for an image file
+	uint32_t offset;             // Offset of the image's file_container_entry_t in the container
+	uint32_t length;             // Image length
+	uint16_t flags;              // FILE_INDEX_FLAG_*
+	uint16_t lep_min_val;        // Lepton frame minimum and maximum raw values (FLAG_LEP)
+	uint16_t lep_max_val;
+	int16_t fpa_temp_c100;       // Lepton FPA temperature in C * 100 (FLAG_TELEM)
+	uint16_t avi_file;           // Sequence number naming the AVI file holding the jpeg (FLAG_AVI)
+	uint16_t avi_frame;          // Frame in that file (FLAG_AVI)
+} __attribute__((packed)) file_index_entry_t;
+
+typedef struct {
+	uint32_t magic;              // FILE_THUMB_MAGIC
+	uint16_t version;            // FILE_THUMB_VERSION
+	uint16_t entry_len;          // sizeof(file_thumb_entry_t)
+	uint8_t width;               // FILE_THUMB_WIDTH
+	uint8_t height;              // FILE_THUMB_HEIGHT
+	uint16_t interval;           // FILE_THUMB_INTERVAL
+	uint32_t reserved;
+} __attribute__((packed)) file_thumb_header_t;
+
+typedef struct {
+	uint32_t seq_num;            // Image sequence number
+	uint32_t epoch_sec;          // Wall-clock time the image was captured
+	uint16_t lep_min_val;        // Raw values of pixel values 0 and 255
+	uint16_t lep_max_val;
+	uint16_t tlin_scale;         // K * 100 per raw count (LEP_TLIN_SCALE_*)
+	uint16_t reserved;
+	uint8_t pixels[FILE_THUMB_PIXELS];
+} __attribute__((packed)) file_thumb_entry_t;
+
+typedef struct {
+	uint32_t magic;              // FILE_TLOG_MAGIC
+	uint16_t version;            // FILE_TLOG_VERSION
+	uint16_t entry_len;          // sizeof(file_tlog_entry_t)
+	uint8_t num_stats;           // FILE_TLOG_STATS
+	uint8_t reserved[7];
+} __attribute__((packed)) file_tlog_header_t;
+
+typedef struct {
+	uint32_t seq_num;            // Sample number in this session, starting at 1
+	uint32_t epoch_sec;          // Wall-clock time of the sample
+	uint16_t epoch_msec;
+	uint16_t flags;              // FILE_TLOG_FLAG_*
+	int16_t fpa_temp_c100;       // Lepton FPA temperature in C * 100 (FLAG_LEP)
+	int16_t aux_temp_c100;       // Lepton housing temperature in C * 100 (FLAG_LEP)
+	int16_t lep_min_c100;        // Latest Lepton frame minimum and maximum in C * 100 (FLAG_FRAME)
+	int16_t lep_max_c100;
+	int16_t lens_temp_c100;      // Lens temperature sensor in C * 100
+	uint16_t batt_mv;            // Battery voltage
+	uint8_t batt_state;          // BATT_STATE_t
+	uint8_t charge_state;        // CHARGE_STATE_t
+	uint8_t stats_valid;         // Bit n set when stats[n] is valid
+	uint8_t alarm_cause;         // LEP_ALARM_CAUSE_xxx of the most recent alarm event
+	int16_t stats[FILE_TLOG_STATS][3];   // Min, max and mean in C * 100 of the frame and each region
+	uint32_t alarm_count;        // Alarm events since startup
+	uint32_t lep_vsyncs;         // Lepton event counters since startup (PERF_CNT_LEP_xxx)
+	uint32_t lep_frames;
+	uint32_t lep_dup_frames;
+	uint32_t lep_skip_frames;
+	uint16_t queued;             // Images waiting to be written
+	uint16_t reserved;
+} __attribute__((packed)) file_tlog_entry_t;
+
+typedef struct {
+	int queued;                  // Images waiting to be written
+	int max_queued;              // Most images waiting at once this session
+	uint32_t dropped;            // Images dropped this session because the queue was full
+	uint32_t write_errors;       // Images or high-rate records that failed to write this session
+	uint32_t spooled;            // Images written to the flash spool this session
+	int spool_pending;           // Images in the flash spool waiting to be moved to the card
+} file_rec_stats_t;
 
+typedef struct {
+	bool valid;                  // Set when the card in the camera has been tested
+	float seq_rate;              // Sequential write throughput (MB/sec)
+	uint32_t rand_avg_usec;      // Average and longest synced random write
+	uint32_t rand_max_usec;
+	bool sustainable;            // The recording profile was sustainable when tested
+	bool profile_changed;        // The recording profile was changed to one that is
+} file_card_speed_t;
 
 
 //
 // File Task API
 //
 void file_task();
+bool file_task_queue_full();
+bool file_task_queue_json_image(json_image_string_t* imgP, cam_buffer_t* camP, lep_buffer_t* lepP);
+bool file_task_queue_bin_image(cam_buffer_t* camP, lep_buffer_t* lepP, bool compress);
+bool file_task_queue_meta_record(int seq_num);
+void file_task_drop_image();
+void file_task_get_rec_stats(file_rec_stats_t* statsP);
+float file_task_get_write_rate();
+void file_task_get_card_speed(file_card_speed_t* speedP);
+uint32_t file_task_get_free_mb();
 
 
 #endif /* FILE_TASK_H */
\ No newline at end of file
@@ -26,6 +26,7 @@
 #ifndef GUI_TASK_H
 #define GUI_TASK_H
 
+#include "system_config.h"
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -41,7 +42,9 @@
 #define GUI_SCREEN_WIFI     3
 #define GUI_SCREEN_NETWORK  4
 #define GUI_SCREEN_POWEROFF 5
-#define GUI_NUM_SCREENS     6
+#define GUI_SCREEN_THERMAL  6
+#define GUI_SCREEN_PLAYBACK 7
+#define GUI_NUM_SCREENS     8
 
 // GUI Task notifications
 #define GUI_NOTIFY_SHUTDOWN_MASK   0x00000001
@@ -51,7 +54,13 @@
 #define GUI_NOTIFY_LED_OFF_MASK    0x00000020
 #define GUI_NOTIFY_INC_REC_MASK    0x00000040
 #define GUI_NOTIFY_CLR_REC_MASK    0x00000080
+#define GUI_NOTIFY_CAM_RENDERED_MASK    0x00000100
+#define GUI_NOTIFY_CAM_RENDER_FAIL_MASK 0x00000200
+#define GUI_NOTIFY_WAKE_MASK       0x00000400
 #define GUI_NOTIFY_MESSAGEBOX_MASK 0x00001000
+#define GUI_NOTIFY_BENCH_MASK      0x00002000
+#define GUI_NOTIFY_PLAY_RENDERED_MASK    0x00004000
+#define GUI_NOTIFY_PLAY_RENDER_FAIL_MASK 0x00008000
 
 
 //
@@ -59,6 +68,17 @@
 //
 void gui_task();
 void gui_set_screen(int n);
+uint16_t* gui_get_draw_buffer(uint32_t* lenP);
+#ifdef INCLUDE_SYS_GUI
+bool gui_task_get_headless();
+void gui_task_send_action(uint32_t mask);
+int64_t gui_task_take_action_usec();
+#else
+// Feature profiles without the GUI always operate as if headless and never send touch
+// actions
+#define gui_task_get_headless() true
+#define gui_task_take_action_usec() 0
+#endif
  
 
 #endif /* GUI_TASK_H */
\ No newline at end of file
@@ -0,0 +1,108 @@
+/*
+ * Health Task
+ *
+ * Watches the heartbeats of the sensor, file, command and GUI tasks and recovers a task
+ * that stops beating without restarting the whole system.  Each watched task beats at
+ * least every HEALTH_BEAT_MSEC while its loop is running.  A task that hasn't beaten for
+ * its stall timeout is escalated one stage at a time, waiting for it to beat again
+ * between stages:
+ *   1. Re-initialize the task's peripheral (for tasks blocked waiting on it).
+ *   2. Delete and recreate the task (if it isn't holding a shared lock).
+ *   3. Restart the system.
+ * Stages a task doesn't support are skipped.  A task is only watched once it has beaten
+ * so tasks that haven't started (or never run, like the sensor tasks while replaying)
+ * aren't escalated.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef HEALTH_TASK_H
+#define HEALTH_TASK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Health Task Constants
+//
+
+// Watched tasks
+#define HEALTH_TASK_LEP            0
+#define HEALTH_TASK_CAM            1
+#define HEALTH_TASK_FILE           2
+#define HEALTH_TASK_CMD            3
+#define HEALTH_TASK_GUI            4
+#define HEALTH_NUM_TASKS           5
+
+// Evaluation period
+#define HEALTH_EVAL_MSEC           1000
+
+// Longest a watched task may wait for work without beating.  Tasks that block waiting
+// for a notification wait at most this long.
+#define HEALTH_BEAT_MSEC           1000
+
+// Stall timeouts.  file_task's is long since a card operation (creating a session's
+// index or a card speed test) can legitimately take many seconds.
+#define HEALTH_LEP_STALL_MSEC      10000
+#define HEALTH_CAM_STALL_MSEC      10000
+#define HEALTH_FILE_STALL_MSEC     120000
+#define HEALTH_CMD_STALL_MSEC      10000
+#define HEALTH_GUI_STALL_MSEC      10000
+
+// Time for a task to beat again after its peripheral is re-initialized or it is
+// recreated before escalating further
+#define HEALTH_RECOVER_WAIT_MSEC   5000
+#define HEALTH_RESTART_WAIT_MSEC   15000
+
+// Task states
+#define HEALTH_STATE_IDLE          0      /* Not beaten yet */
+#define HEALTH_STATE_OK            1
+#define HEALTH_STATE_RECOVER       2      /* Peripheral re-initialized */
+#define HEALTH_STATE_RESTART       3      /* Task recreated */
+
+
+
+//
+// Health Task typedefs
+//
+typedef struct {
+	int state;                   // HEALTH_STATE_xxx
+	uint32_t stalls;             // Times the task stopped beating
+	uint32_t recovers;           // Peripheral re-initializations
+	uint32_t restarts;           // Task recreations
+} health_task_stats_t;
+
+typedef struct {
+	health_task_stats_t tasks[HEALTH_NUM_TASKS];
+	uint32_t reboots;            // System restarts by the monitor (kept in persistent storage)
+} health_stats_t;
+
+
+
+//
+// Health Task API
+//
+void health_task();
+void health_task_beat(int task);
+void health_task_stop(int task);
+void health_task_get_stats(health_stats_t* statsP);
+const char* health_task_name(int task);
+
+#endif /* HEALTH_TASK_H */
@@ -0,0 +1,79 @@
+/*
+ * HTTP Task
+ *
+ * Serve the ArduCAM jpeg images to web browsers and NVRs as a MJPEG stream.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef HTTP_TASK_H
+#define HTTP_TASK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// HTTP Task Constants
+//
+
+// Maximum number of simultaneous viewers
+#define HTTP_MAX_CLIENTS          2
+
+// Maximum length of a request header we will buffer (we only look at the request line)
+#define HTTP_MAX_REQ_LEN          512
+
+// Socket select timeout.  Also the maximum latency between app_task handing us an image
+// and us starting to send it.
+#define HTTP_POLL_MSEC            50
+
+// Clients that can't accept any data for this long are disconnected
+#define HTTP_SEND_TIMEOUT_MSEC    2000
+
+// Maximum bytes handed to the socket at once
+#define HTTP_TX_CHUNK_LEN         (1436 * 4)
+
+// Multipart boundary between images in the MJPEG stream
+#define HTTP_BOUNDARY             "firecamframe"
+
+// URIs
+#define HTTP_URI_STREAM           "/stream"
+#define HTTP_URI_SNAPSHOT         "/jpg"
+#define HTTP_URI_THERMAL_STREAM   "/thermal"
+#define HTTP_URI_THERMAL_SNAPSHOT "/thermal.jpg"
+
+// Buffer gui_task encodes the palette-rendered Lepton image into for the thermal URIs
+// (the 160x120 images are usually only a few kB)
+#define HTTP_THERMAL_JPG_LEN      (20 * 1024)
+
+// HTTP Task notifications
+#define HTTP_NOTIFY_CAM_FRAME_MASK 0x00000001
+#define HTTP_NOTIFY_LEP_FRAME_MASK 0x00000002
+
+
+
+//
+// HTTP Task API
+//
+void http_task();
+bool http_task_has_clients();
+uint8_t* http_task_get_thermal_buffer();
+void http_task_set_thermal_image(uint32_t len);
+
+#endif /* HTTP_TASK_H */
@@ -27,6 +27,7 @@
 #ifndef LEP_TASK_H
 #define LEP_TASK_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 
@@ -36,7 +37,52 @@
 //
 
 // LEP Task notifications
-#define LEP_NOTIFY_GET_FRAME_MASK 0x00000001
+#define LEP_NOTIFY_GET_FRAME_MASK  0x00000001
+#define LEP_NOTIFY_VSYNC_MASK      0x00000002
+#define LEP_NOTIFY_TELEM_ONLY_MASK 0x00000004
+#define LEP_NOTIFY_FULL_FRAME_MASK 0x00000008
+#define LEP_NOTIFY_AVG_ON_MASK     0x00000010
+#define LEP_NOTIFY_AVG_OFF_MASK    0x00000020
+#define LEP_NOTIFY_REC_ON_MASK     0x00000040
+#define LEP_NOTIFY_REC_OFF_MASK    0x00000080
+#define LEP_NOTIFY_REC_DONE_MASK   0x00000100
+#define LEP_NOTIFY_UDP_ON_MASK     0x00000200
+#define LEP_NOTIFY_UDP_OFF_MASK    0x00000400
+#define LEP_NOTIFY_UDP_DONE_MASK   0x00000800
+#define LEP_NOTIFY_CHECK_MASK      0x00001000
+#define LEP_NOTIFY_BENCH_MASK      0x00002000
+#define LEP_NOTIFY_STANDBY_ON_MASK 0x00004000
+#define LEP_NOTIFY_STANDBY_OFF_MASK 0x00008000
+#define LEP_NOTIFY_SYNC_CAM_MASK   0x00010000
+#define LEP_NOTIFY_CORR_CAL_MASK   0x00020000
+#define LEP_NOTIFY_CORR_CLEAR_MASK 0x00040000
+#define LEP_NOTIFY_GAIN_MASK       0x00080000
+
+// Synchronized ArduCAM capture.  LEP_NOTIFY_SYNC_CAM_MASK asks lep_task to start the
+// ArduCAM capture as soon as it publishes its next frame and to use that frame for the
+// next frame request so the pair is captured together.  A synchronized capture is
+// requested LEP_TASK_SYNC_LEAD_MSEC (a frame period) earlier than a direct one to allow
+// for the wait for the frame.
+#define LEP_TASK_SYNC_LEAD_MSEC    115
+
+
+
+//
+// LEP Task typedefs
+//
+
+// Values from the most recent frame (also in telemetry-only mode) for tasks sampling
+// the Lepton faster than frames are requested
+typedef struct {
+	int64_t timestamp_usec;      // esp_timer time of the frame's vsync (0 before the first frame)
+	bool telem_valid;            // The temperatures are valid
+	bool frame_valid;            // The frame values are valid (not in telemetry-only mode)
+	uint16_t fpa_temp_k100;
+	uint16_t aux_temp_k100;      // Housing temperature
+	uint16_t min_val;            // Raw frame minimum and maximum
+	uint16_t max_val;
+	int tlin_scale;              // K * 100 per raw count (LEP_TLIN_SCALE_*)
+} lep_task_sample_t;
 
 
 
@@ -44,5 +90,8 @@
 // LEP Task API
 //
 void lep_task();
+uint32_t lep_task_get_telem_sample(uint16_t* buf);
+void lep_task_get_sample(lep_task_sample_t* sampleP);
+bool lep_task_recover();
 
 #endif /* LEP_TASK_H */
\ No newline at end of file
@@ -0,0 +1,80 @@
+/*
+ * Log Task
+ *
+ * Replaces the blocking UART output of the ESP_LOGx calls with a ring in the PSRAM so a
+ * task that logs never waits on the 115200 baud console.  Lines are formatted by the
+ * calling task into the ring and drained at low priority to the console and a client
+ * connected to LOG_PORT.  file_task appends them to a log file on the Micro-SD Card.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOG_TASK_H
+#define LOG_TASK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+//
+// Log Task Constants
+//
+
+// Log Task notifications
+#define LOG_NOTIFY_DATA_MASK   0x00000001
+
+// Log ring length (a power of 2).  Each sink reads the ring at its own pace.  A sink
+// that falls more than LOG_RING_LEN bytes behind skips ahead to the next complete line
+// and is sent a note of how much it missed.  Logging never waits for a sink.
+#define LOG_RING_LEN           (32 * 1024)
+
+// Longest formatted line (longer lines are truncated).  Lines are formatted on the
+// logging task's stack.
+#define LOG_MAX_LINE_LEN       160
+
+// Period the log task checks for a new TCP log client while there is nothing to send
+#define LOG_EVAL_MSEC          100
+
+// Log sinks
+#define LOG_SINK_CONSOLE       0
+#define LOG_SINK_TCP           1
+#define LOG_SINK_FILE          2
+#define LOG_SINK_NUM           3
+
+// Undefine to stop file_task appending the log to LOG_FILE_NAME while the card is
+// mounted.  The file is checked every LOG_FILE_WRITE_MSEC.  When it reaches
+// LOG_FILE_MAX_LEN it is renamed to LOG_OLD_FILE_NAME (replacing the previous one) and a
+// new file is started.
+#define LOG_TO_FILE
+#define LOG_FILE_NAME          "firecam.log"
+#define LOG_OLD_FILE_NAME      "firecam.old"
+#define LOG_FILE_MAX_LEN       (4 * 1024 * 1024)
+#define LOG_FILE_WRITE_MSEC    5000
+
+
+
+//
+// Log Task API
+//
+bool log_task_init();
+void log_task();
+uint32_t log_task_peek(int sink, char** bufP, uint32_t* posP);
+void log_task_consume(int sink, uint32_t pos, uint32_t len);
+uint32_t log_task_get_lost(int sink);
+
+#endif /* LOG_TASK_H */
@@ -0,0 +1,99 @@
+/*
+ * OTA Task
+ *
+ * Writes a firmware image arriving on a command connection into the inactive OTA
+ * partition.  cmd_task receives the image straight into one of a small set of buffers
+ * while ota_task writes the others to flash so the network and flash work overlap and
+ * the image is never held in memory.  The image's SHA-256 is checked against the one
+ * given with the command before it is made the boot image.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef OTA_TASK_H
+#define OTA_TASK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// OTA Task Constants
+//
+
+// Image buffers.  cmd_task fills one OTA_BUFFER_LEN buffer while ota_task writes the
+// others.  It stops reading the connection while every buffer is waiting to be written
+// so TCP holds the sender back.  Buffers are allocated from internal memory only while
+// an update is running (the flash can be written from them while its cache is disabled).
+#define OTA_BUFFER_LEN          4096
+#define OTA_NUM_BUFFERS         2
+
+// Flash erase pacing.  esp_ota_begin is only asked to erase the first sector and each
+// following sector is erased just before it is written instead of erasing the whole
+// image up front.  Flash operations stall both cores so this limits each stall to one
+// sector erase or write.  ota_task waits OTA_SECTOR_GAP_MSEC between sectors so the
+// capture and recording tasks catch up.
+#define OTA_SECTOR_GAP_MSEC     10
+
+// An update fails if no image data arrives for this long
+#define OTA_TIMEOUT_MSEC        10000
+
+// Task evaluation period while an update is running
+#define OTA_EVAL_MSEC           500
+
+// Delay before a requested restart so the result reaches the client
+#define OTA_RESTART_DELAY_MSEC  1000
+
+// Update states
+#define OTA_STATE_IDLE          0
+#define OTA_STATE_ACTIVE        1
+#define OTA_STATE_DONE          2
+#define OTA_STATE_FAILED        3
+
+// OTA Task notifications
+#define OTA_NOTIFY_START_MASK   0x00000001
+#define OTA_NOTIFY_DATA_MASK    0x00000002
+#define OTA_NOTIFY_ABORT_MASK   0x00000004
+
+
+
+//
+// OTA Task typedefs
+//
+typedef struct {
+	int state;                   // OTA_STATE_xxx
+	uint32_t length;             // Image length
+	uint32_t written;            // Bytes written to flash
+	const char* partition;       // Label of the partition being written (NULL if none)
+	const char* result;          // "OK" or why the update failed (NULL while active)
+} ota_status_t;
+
+
+
+//
+// OTA Task API
+//
+void ota_task();
+bool ota_task_start(uint32_t length, const uint8_t* sha256, bool restart, ota_status_t* statusP);
+uint8_t* ota_task_get_buffer();
+void ota_task_put_buffer(uint32_t len);
+void ota_task_release();
+void ota_task_get_status(ota_status_t* statusP);
+
+#endif /* OTA_TASK_H */
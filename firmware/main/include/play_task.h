@@ -0,0 +1,111 @@
+/*
+ * Play Task
+ *
+ * Reads the images of a recording session back from the Micro-SD Card for the playback
+ * screen.  Images are read in session index order from the current position into
+ * PLAY_NUM_FRAMES read-ahead buffers and decoded as far as the radiometric pixels (the
+ * jpeg image is left for render_task to decode).  The GUI takes one frame at a time and
+ * releases it once it has been drawn.  Runs alongside file_task (FATFS serializes their
+ * accesses) and waits while file_task has recorded images queued so playback never
+ * slows a recording.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PLAY_TASK_H
+#define PLAY_TASK_H
+
+#include "file_utilities.h"
+#include "json_utilities.h"
+#include "sys_utilities.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+
+//
+// Play Task Constants
+//
+
+// Play Task notifications
+#define PLAY_NOTIFY_OPEN_MASK  0x00000001
+#define PLAY_NOTIFY_SEEK_MASK  0x00000002
+#define PLAY_NOTIFY_CLOSE_MASK 0x00000004
+#define PLAY_NOTIFY_FREE_MASK  0x00000008
+
+// Read-ahead frames.  Each buffer holds a whole image file (json images are the
+// largest) so PLAY_NUM_FRAMES * PLAY_FRAME_BUF_LEN bytes of PSRAM are used.  They are
+// only allocated while a session is open (the PSRAM budget can't hold them as well as
+// the recording buffers).
+#define PLAY_NUM_FRAMES        3
+#define PLAY_FRAME_BUF_LEN     (JSON_MAX_IMAGE_TEXT_LEN + 1)
+
+// Display period while playing (5 frames/sec)
+#define PLAY_FRAME_MSEC        200
+
+// Check period while file_task has recorded images waiting to be written
+#define PLAY_REC_WAIT_MSEC     50
+
+// Maximum card path (session directory, subdirectory and file name)
+#define PLAY_MAX_PATH_LEN      96
+
+// Playback states
+#define PLAY_STATE_CLOSED      0
+#define PLAY_STATE_OPENING     1
+#define PLAY_STATE_OPEN        2
+#define PLAY_STATE_EMPTY       3      /* No card, no sessions or no indexed images */
+
+// play_task_open session selection
+#define PLAY_OPEN_NEWEST       0
+#define PLAY_OPEN_OLDER        -1
+#define PLAY_OPEN_NEWER        1
+
+
+
+//
+// Play Task typedefs
+//
+typedef struct {
+	int state;                   // PLAY_STATE_*
+	char session[SESSION_DIR_NAME_LEN];
+	uint32_t count;              // Indexed images when the session was opened
+} play_info_t;
+
+typedef struct {
+	uint32_t pos;                // Position in the session index
+	uint32_t epoch_sec;          // Capture time
+	bool has_lep;
+	lep_buffer_t lep;            // Radiometric image (own pixel and telemetry buffers)
+	uint8_t* jpegP;              // Jpeg image in bufP (jpeg_len 0 for none)
+	uint32_t jpeg_len;
+	uint8_t* bufP;               // Image file contents
+} play_frame_t;
+
+
+
+//
+// Play Task API
+//
+void play_task();
+void play_task_open(int dir);
+void play_task_seek(uint32_t pos);
+void play_task_close();
+void play_task_get_info(play_info_t* infoP);
+play_frame_t* play_task_get_frame();
+void play_task_release_frame(play_frame_t* frameP);
+
+#endif /* PLAY_TASK_H */
@@ -0,0 +1,41 @@
+/*
+ * Render Task
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef RENDER_TASK_H
+#define RENDER_TASK_H
+
+
+//
+// Render Task Constants
+//
+
+// Render Task notifications
+#define RENDER_NOTIFY_CAM_FRAME_MASK 0x00000001
+#define RENDER_NOTIFY_BENCH_MASK     0x00000002
+#define RENDER_NOTIFY_PLAY_FRAME_MASK 0x00000004
+
+
+//
+// Render Task API
+//
+void render_task();
+ 
+#endif /* RENDER_TASK_H */
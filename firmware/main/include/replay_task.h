@@ -0,0 +1,84 @@
+/*
+ * Replay Task
+ *
+ * Sensor-free frame sources that stand in for lep_task and cam_task so the rest of the
+ * image pipeline (json building, file writing, networking and the GUI) can be run and
+ * timed without the Lepton or ArduCAM.  The replay tasks answer the same notifications
+ * and hand frames to app_task, file_task and cmd_task through the same shared buffer
+ * and frame event interface, so no other task knows they aren't talking to the sensors.
+ *
+ * Frames come from the image files of a recording session on the Micro-SD Card
+ * (binary image records or json files) or, without one, from a synthetic generator.
+ * A new Lepton frame is produced every REPLAY_LEP_FRAME_MSEC.  The ArduCAM source
+ * answers each request with the jpeg image of the latest frame.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef REPLAY_TASK_H
+#define REPLAY_TASK_H
+
+#include "system_config.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef INCLUDE_SYS_REPLAY
+
+
+//
+// Replay Task Constants
+//
+
+// Lepton frame period.  The default matches the Lepton's 8.8 Hz.  Shorter periods
+// produce frames faster than the sensor can for high-rate recording and the UDP frame
+// stream (app_task still takes one set of images per second).
+#define REPLAY_LEP_FRAME_MSEC     114
+
+// Emulated ArduCAM capture and readout time before each jpeg image is delivered
+#define REPLAY_CAM_CAPTURE_MSEC   120
+
+// Session replayed from the Micro-SD Card.  Empty to replay the oldest session on the
+// card.  Its image files are replayed in order, starting again at the first at the end.
+// Sessions recorded to container files can't be replayed.  The synthetic generator is
+// used if the session has no image files or no card is mounted within
+// REPLAY_CARD_WAIT_MSEC.
+#define REPLAY_SESSION            ""
+#define REPLAY_CARD_WAIT_MSEC     10000
+
+// Define to always use the synthetic generator
+//#define REPLAY_SYNTHETIC_ONLY
+
+// Synthetic frames: a scene at REPLAY_SYN_BASE_K100 with a REPLAY_SYN_SPOT_K100 hotter
+// spot circling the frame once every REPLAY_SYN_ORBIT_FRAMES frames and a
+// REPLAY_SYN_JPEG_WIDTH x REPLAY_SYN_JPEG_HEIGHT test pattern jpeg image
+#define REPLAY_SYN_BASE_K100      29315
+#define REPLAY_SYN_SPOT_K100      6000
+#define REPLAY_SYN_SPOT_RADIUS    12
+#define REPLAY_SYN_ORBIT_FRAMES   88
+#define REPLAY_SYN_JPEG_WIDTH     320
+#define REPLAY_SYN_JPEG_HEIGHT    240
+
+//
+// Replay Task API
+//
+void replay_lep_task();
+void replay_cam_task();
+
+#endif /* INCLUDE_SYS_REPLAY */
+
+#endif /* REPLAY_TASK_H */
@@ -0,0 +1,116 @@
+/*
+ * Sync Task
+ *
+ * Keeps the system time of several cameras on one network together so their once per
+ * second captures happen at the same instant and their images carry the same time.
+ * A master broadcasts a timestamped beacon to SYNC_PORT every second.  Each slave
+ * answers the beacon with a delay request, measures its offset from the master's time
+ * and the network delay from the master's response and corrects its system time to the
+ * master's.  app_task's capture pipeline runs from the top of each second of the system
+ * time so it follows.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef SYNC_TASK_H
+#define SYNC_TASK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Sync Task Constants
+//
+
+// Sync modes (kept in persistent storage)
+#define SYNC_MODE_OFF              0
+#define SYNC_MODE_MASTER           1
+#define SYNC_MODE_SLAVE            2
+
+// Master beacon period
+#define SYNC_BEACON_MSEC           1000
+
+// Socket receive timeout.  The task waits in the socket so packets are timestamped as
+// soon as they arrive and checks for notifications and beacons to send in between.
+#define SYNC_RX_TIMEOUT_MSEC       100
+
+// Period the task checks for the network and a mode change while it isn't syncing
+#define SYNC_EVAL_MSEC             500
+
+// Slave delay filter.  A measurement is only used if its round trip is within
+// SYNC_DELAY_MARGIN_USEC of the shortest of the last SYNC_DELAY_SAMPLES.  Longer round
+// trips were queued somewhere in the network and their offsets are skewed.
+#define SYNC_DELAY_SAMPLES         8
+#define SYNC_DELAY_MARGIN_USEC     2000
+
+// A slave is locked while its last used measurement was within SYNC_LOCK_MAX_ERR_USEC
+// and no more than SYNC_LOCK_TIMEOUT_SEC ago
+#define SYNC_LOCK_MAX_ERR_USEC     2000
+#define SYNC_LOCK_TIMEOUT_SEC      5
+
+// Sync packet
+#define SYNC_MAGIC                 0x59534346   /* "FCSY" */
+#define SYNC_TYPE_BEACON           0
+#define SYNC_TYPE_DELAY_REQ        1
+#define SYNC_TYPE_DELAY_RSP        2
+
+// Sync Task notifications
+#define SYNC_NOTIFY_MODE_MASK      0x00000001
+
+
+
+//
+// Sync Task typedefs
+//
+
+// Packet times are the sender's system time in uSec since 1970
+//   Beacon:    t1 = master send time
+//   Delay req: t1 = slave send time
+//   Delay rsp: t1 = the request's t1, t2 = master receive time, t3 = master send time
+typedef struct __attribute__((packed)) {
+	uint32_t magic;
+	uint8_t type;
+	uint8_t rsvd;
+	uint16_t seq;
+	int64_t t1;
+	int64_t t2;
+	int64_t t3;
+} sync_packet_t;
+
+typedef struct {
+	int mode;                    // SYNC_MODE_xxx
+	bool locked;                 // Slave is following its master
+	int32_t offset_usec;         // Last used slave offset (positive when ahead of the master)
+	int32_t delay_usec;          // Last used one-way network delay
+	uint32_t beacons;            // Beacons sent (master) or received (slave)
+	uint32_t rejected;           // Slave measurements discarded by the delay filter
+} sync_status_t;
+
+
+
+//
+// Sync Task API
+//
+void sync_task();
+int sync_task_get_mode();
+void sync_task_set_mode(int mode);
+void sync_task_get_status(sync_status_t* statusP);
+
+#endif /* SYNC_TASK_H */
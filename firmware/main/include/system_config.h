@@ -29,6 +29,44 @@
 #include "ov2640.h"
 
 
+// ======================================================================================
+// Feature profile
+//
+
+// Select one profile for the deployment.  The tasks of the subsystems a profile leaves
+// out aren't started and their buffers aren't allocated so the memory, CPU time and
+// boot time go to the rest of the image pipeline.  Without the GUI LittleVGL and the
+// display drivers aren't linked either.
+//   SYS_PROFILE_FULL      Everything
+//   SYS_PROFILE_HEADLESS  No local user interface (gui_task and LittleVGL, render_task
+//                         and play_task) for loggers and streamers without a display.
+//                         The camera always operates as if headless.  The web Lepton
+//                         stream (rendered by gui_task) isn't available.
+//   SYS_PROFILE_THERMAL   SYS_PROFILE_HEADLESS without the ArduCAM (cam_task and its
+//                         jpeg pool) for Lepton-only cameras such as battery powered
+//                         duty-cycled loggers.  Recording is always Lepton only.
+// The command interface, WiFi and the Micro-SD Card are part of every profile since
+// they are how a camera without a display is configured and where its images go (a
+// camera without a card just doesn't record).
+#define SYS_PROFILE_FULL
+//#define SYS_PROFILE_HEADLESS
+//#define SYS_PROFILE_THERMAL
+
+#if defined(SYS_PROFILE_FULL)
+#define SYS_PROFILE_NAME "full"
+#define INCLUDE_SYS_GUI
+#define INCLUDE_SYS_ARDUCAM
+#elif defined(SYS_PROFILE_HEADLESS)
+#define SYS_PROFILE_NAME "headless"
+#define INCLUDE_SYS_ARDUCAM
+#elif defined(SYS_PROFILE_THERMAL)
+#define SYS_PROFILE_NAME "thermal"
+#else
+#error "Select a feature profile"
+#endif
+
+
+
 // ======================================================================================
 // System debug
 //
@@ -36,12 +74,35 @@
 // Undefine to include the system monitoring task (included only for debugging/tuning)
 //#define INCLUDE_SYS_MON
 
+// Undefine to record task notifications for the dump_trace command (debugging only)
+//#define INCLUDE_SYS_TRACE
+
+// Undefine to include the benchmark task for the run_benchmark command (tuning only) and
+// also undefine BENCH_AT_BOOT to run the benchmarks once shortly after power-up
+//#define INCLUDE_SYS_BENCH
+//#define BENCH_AT_BOOT
+
+// Undefine to replace lep_task and cam_task with replay_task, which feeds recorded or
+// synthetic frames through the image pipeline without the sensors (see replay_task.h
+// for its options)
+//#define INCLUDE_SYS_REPLAY
+
+// Undefine to capture every raw VoSPI packet to the Micro-SD Card (debugging only)
+//#define INCLUDE_VOSPI_CAPTURE
+
 
 
 // ======================================================================================
 // System hardware definitions
 //
 
+// The pin map, SPI hosts and the image kernels (VoSPI packet byte swap and min/max,
+// palette mapping, base64, tjpgd) are written for the classic ESP32 on the v3.3 IDF.
+// A port to another chip needs its own pin map and host assignments here first.
+#if defined(CONFIG_IDF_TARGET_ESP32S2) || defined(CONFIG_IDF_TARGET_ESP32S3)
+#error "FireCAM only supports the ESP32"
+#endif
+
 //
 // IO Pins
 //   Lepton uses HSPI (no MOSI)
@@ -69,8 +130,31 @@
 //
 
 // I2C
+//   The Lepton CCI and DS3232 RTC run fast and everything else at the default rate
 #define I2C_MASTER_NUM     1
 #define I2C_MASTER_FREQ_HZ 100000
+#define I2C_LEP_FREQ_HZ    400000
+#define I2C_RTC_FREQ_HZ    400000
+
+// Define RTC_SQW_IO as the GPIO connected to the DS3232 INT/SQW output on boards that
+// wire it (the output is open-drain and needs an external pull-up).  Its 1 Hz square
+// wave is then used to keep the system time's sub-second part locked to the RTC.
+// Otherwise the system time is only aligned to the RTC at startup.  It must be an RTC
+// GPIO (the input-only GPIOs 34-39 are) since the RTC alarm also wakes the system from
+// duty-cycled recording sleeps through it.
+//#define RTC_SQW_IO         38
+
+// Define LEP_RESET_IO as the GPIO connected to the Lepton's RESET_L input on boards that
+// wire it.  A stalled Lepton is then reset when CCI reboots don't restart its stream.
+// The FireCAM board has no Lepton reset or power control.
+//#define LEP_RESET_IO       0
+
+// Define ADC_INT_IO as the GPIO connected to the ADC128D818 INT output on boards that
+// wire it (the output is open-drain and needs an external pull-up).  The ADC then raises
+// an interrupt when the power button is pressed or the battery falls to its critical
+// voltage and adc_task only samples slowly until it does.  Otherwise adc_task polls the
+// ADC every ADC_TASK_SAMPLE_MSEC.
+//#define ADC_INT_IO         0
 
 // SPI
 #define LEP_SPI_HOST    HSPI_HOST
@@ -80,10 +164,165 @@
 #define HSPI_DMA_NUM    1
 #define VSPI_DMA_NUM    2
 #define LEP_SPI_FREQ_HZ 16000000
-#define LCD_SPI_FREQ_HZ 16000000
 #define CAM_SPI_FREQ_HZ  4000000
 #define TS_SPI_FREQ_HZ   2000000
 
+// LCD SPI clock.  The LCD is write-only (half-duplex) so it isn't held to the 26.7 MHz
+// limit for reading through the GPIO matrix and the ILI9341 accepts writes up to 40 MHz.
+// SPI clocks are 80 MHz divided by an integer (40, 26.7, 20, 16 MHz...).  Define
+// LCD_SPI_FAST on boards with short, clean display wiring to run the LCD at 40 MHz for
+// shorter VSPI transfers.  The ESP32 has no third SPI host for the LCD (HSPI is dedicated
+// to the Lepton) so it always shares VSPI with the ArduCAM and touchscreen.
+//#define LCD_SPI_FAST
+#ifdef LCD_SPI_FAST
+#define LCD_SPI_FREQ_HZ 40000000
+#else
+#define LCD_SPI_FREQ_HZ 16000000
+#endif
+
+// SD Card (SDMMC slot 1 with D0-D3 wired).  The card is initialized with the fastest
+// bus speed and width it and the board support.  Set SD_BUS_WIDTH to 1 for boards with
+// only D0 wired and SD_MAX_FREQ_KHZ to 20000 to disable high-speed mode.
+#define SD_BUS_WIDTH     4
+#define SD_MAX_FREQ_KHZ  40000
+
+// Define SD_CD_IO as the GPIO connected to the socket's card-detect switch (low when a
+// card is inserted) on boards that wire it.  Card insertion and removal are then
+// detected by interrupt instead of periodically probing the card with SD commands.
+//#define SD_CD_IO         0
+
+// Power management (needs CONFIG_PM_ENABLE in sdkconfig).  The CPU frequency scales
+// between SYS_PM_MIN_FREQ_MHZ when idle and SYS_PM_MAX_FREQ_MHZ while a task holds
+// PM_LEVEL_FAST.  The minimum is kept at 80 MHz so the APB clock, and with it the SPI,
+// I2C and LEDC clock rates, doesn't change.  Undefine SYS_PM_LIGHT_SLEEP to disable
+// automatic light sleep (it also needs CONFIG_FREERTOS_USE_TICKLESS_IDLE).  The system
+// only light sleeps while the Lepton is in standby, the LCD is headless, WiFi is off
+// and no card, camera or I2C operation is in progress, for example between images
+// when recording at long intervals.
+#define SYS_PM_MAX_FREQ_MHZ 240
+#define SYS_PM_MIN_FREQ_MHZ 80
+#define SYS_PM_LIGHT_SLEEP
+
+
+// ======================================================================================
+// Task configuration
+//
+
+// Undefine to use the realtime capture profile.  It runs lep_task by itself at high
+// priority on the APP core (1), away from the WiFi stack on the PRO core (0), with all
+// other tasks sharing the PRO core.  The default profile runs lep_task and cmd_task on
+// the PRO core with the WiFi stack and the remaining tasks on the APP core.  In both
+// profiles the fork_utilities helper (fork_task) runs on the core opposite gui_task and
+// below lep_task so split kernels only use time lep_task doesn't need, and health_task
+// runs above every task it watches on either core so a task spinning on one core can't
+// hold it off.
+//#define SYS_TASK_PROFILE_REALTIME
+
+//
+// Task table: stack size (bytes), priority, core
+//
+#define ADC_TASK_STACK   2048
+#define CAM_TASK_STACK   2048
+#define CMD_TASK_STACK   3072
+#define FILE_TASK_STACK  3072
+#define GUI_TASK_STACK   3072
+#define HTTP_TASK_STACK  3072
+#define LEP_TASK_STACK   2048
+#define RENDER_TASK_STACK 3072
+#define APP_TASK_STACK   3072
+#define MON_TASK_STACK   2048
+#define BENCH_TASK_STACK 3072
+#define REPLAY_TASK_STACK 3072
+#define FORK_TASK_STACK  2048
+#define XFER_TASK_STACK  3072
+#define LOG_TASK_STACK   2560
+#define SYNC_TASK_STACK  2560
+#define OTA_TASK_STACK   3072
+#define UPLOAD_TASK_STACK 3072
+#define PLAY_TASK_STACK  3072
+#define HEALTH_TASK_STACK 2560
+
+#ifdef SYS_TASK_PROFILE_REALTIME
+#define ADC_TASK_PRIO    1
+#define ADC_TASK_CORE    0
+#define CAM_TASK_PRIO    2
+#define CAM_TASK_CORE    0
+#define CMD_TASK_PRIO    1
+#define CMD_TASK_CORE    0
+#define FILE_TASK_PRIO   1
+#define FILE_TASK_CORE   0
+#define GUI_TASK_PRIO    1
+#define GUI_TASK_CORE    0
+#define HTTP_TASK_PRIO   1
+#define HTTP_TASK_CORE   0
+#define LEP_TASK_PRIO    10
+#define LEP_TASK_CORE    1
+#define RENDER_TASK_PRIO 1
+#define RENDER_TASK_CORE 0
+#define APP_TASK_PRIO    1
+#define APP_TASK_CORE    0
+#define MON_TASK_PRIO    1
+#define MON_TASK_CORE    0
+#define BENCH_TASK_PRIO  1
+#define BENCH_TASK_CORE  0
+#define FORK_TASK_PRIO   1
+#define FORK_TASK_CORE   1
+#define XFER_TASK_PRIO   1
+#define XFER_TASK_CORE   0
+#define LOG_TASK_PRIO    1
+#define LOG_TASK_CORE    0
+#define SYNC_TASK_PRIO   2
+#define SYNC_TASK_CORE   0
+#define OTA_TASK_PRIO    1
+#define OTA_TASK_CORE    0
+#define UPLOAD_TASK_PRIO 1
+#define UPLOAD_TASK_CORE 0
+#define PLAY_TASK_PRIO   1
+#define PLAY_TASK_CORE   0
+#define HEALTH_TASK_PRIO 12
+#define HEALTH_TASK_CORE tskNO_AFFINITY
+#else
+#define ADC_TASK_PRIO    1
+#define ADC_TASK_CORE    1
+#define CAM_TASK_PRIO    2
+#define CAM_TASK_CORE    1
+#define CMD_TASK_PRIO    1
+#define CMD_TASK_CORE    0
+#define FILE_TASK_PRIO   1
+#define FILE_TASK_CORE   1
+#define GUI_TASK_PRIO    1
+#define GUI_TASK_CORE    1
+#define HTTP_TASK_PRIO   1
+#define HTTP_TASK_CORE   0
+#define LEP_TASK_PRIO    2
+#define LEP_TASK_CORE    0
+#define RENDER_TASK_PRIO 1
+#define RENDER_TASK_CORE 1
+#define APP_TASK_PRIO    1
+#define APP_TASK_CORE    1
+#define MON_TASK_PRIO    1
+#define MON_TASK_CORE    1
+#define BENCH_TASK_PRIO  1
+#define BENCH_TASK_CORE  1
+#define FORK_TASK_PRIO   1
+#define FORK_TASK_CORE   0
+#define XFER_TASK_PRIO   1
+#define XFER_TASK_CORE   0
+#define LOG_TASK_PRIO    1
+#define LOG_TASK_CORE    1
+#define SYNC_TASK_PRIO   2
+#define SYNC_TASK_CORE   0
+#define OTA_TASK_PRIO    1
+#define OTA_TASK_CORE    0
+#define UPLOAD_TASK_PRIO 1
+#define UPLOAD_TASK_CORE 0
+#define PLAY_TASK_PRIO   1
+#define PLAY_TASK_CORE   0
+#define HEALTH_TASK_PRIO 12
+#define HEALTH_TASK_CORE tskNO_AFFINITY
+#endif
+
+
 
 // ======================================================================================
 // System configuration
@@ -103,58 +342,185 @@
 // Little VGL evaluation rate (mSec)
 #define LVGL_EVAL_MSEC      10
 
+// Screens other than the main screen are created when they are first displayed.
+// Undefine GUI_FREE_SCREENS to keep them once created instead of deleting the settings
+// screens (settings, time, wifi and network) to free their Little VGL memory each time the
+// main screen is displayed again.
+#define GUI_FREE_SCREENS
 
-// ArduCAM image resolution
-//  Undefine for 640x480 resolution, otherwise 320x240
-//  Note: CAM_RES_HIGH also sets the jpeg decoder scale factor in render_jpg.c
-#define CAM_RES_HIGH
-
-#ifdef CAM_RES_HIGH
-#define CAM_SIZE_SPEC       OV2640_640x480
-#define CAM_JPEG_WIDTH      640
-#else
-#define CAM_SIZE_SPEC       OV2640_320x240
-#define CAM_JPEG_WIDTH      320
-#endif
+// Headless operation.  While recording without any touch activity for GUI_HEADLESS_MSEC
+// the LCD is put to sleep, images are no longer rendered and Little VGL is evaluated
+// every LVGL_HEADLESS_EVAL_MSEC.  A touch or power button press wakes the display.  Set
+// GUI_HEADLESS_MSEC to 0 to disable.
+#define GUI_HEADLESS_MSEC        (5 * 60 * 1000)
+#define LVGL_HEADLESS_EVAL_MSEC  100
 
 
-// ArduCAM max jpg image size (based on CAM_SIZE_SPEC)
-#ifdef CAM_RES_HIGH
+// ArduCAM max jpg image size (sized for the largest selectable resolution, 640x480)
 #define CAM_MAX_JPG_LEN     65536
+
+// Motion recording.  While recording with record_motion set images are recorded every
+// second, instead of every recording interval, until APP_MOTION_HOLD_SEC seconds after
+// the last Lepton frame in which the scene changed.
+#define APP_MOTION_HOLD_SEC  30
+
+// Duty-cycled recording.  While recording with record_sleep set at an interval of at
+// least APP_SLEEP_MIN_REC_INTERVAL seconds, the display headless and no image clients,
+// the ESP32 deep sleeps with power held on after writing each image and wakes (WiFi
+// off, display dark) APP_SLEEP_WAKE_LEAD_SEC seconds before the next image is due so
+// the cameras have settled.  A touch wakes it for normal operation.
+#define APP_SLEEP_MIN_REC_INTERVAL 300
+#define APP_SLEEP_WAKE_LEAD_SEC    10
+
+// Duty-cycled sleeps on boards with RTC_SQW_IO are woken by the DS3232 alarm.  The
+// ESP32's RTC timer (its slow clock can be off by several percent) is set to wake it
+// SYS_SLEEP_BACKUP_SEC seconds plus 1/SYS_SLEEP_BACKUP_DIV of the sleep late in case
+// the alarm is missed.
+#define SYS_SLEEP_BACKUP_DIV       16
+#define SYS_SLEEP_BACKUP_SEC       30
+
+// Alarm recording.  While recording with an alarm enabled app_task keeps references to
+// the most recent APP_ALARM_PRE_IMAGES images so an alarm event's recording starts with
+// the seconds before it was triggered.
+#define APP_ALARM_PRE_IMAGES 5
+
+// Alarm recording visible pre-trigger ring.  While recording alarm events cam_task also
+// captures ArduCAM images continuously between the once-per-second images and keeps the
+// most recent CAM_RING_LEN so an event's recording includes the visible images from just
+// before it was triggered (see cam_task.h).
+#define CAM_RING_LEN 8
+
+// Number of ArduCAM jpeg buffers in the shared pool.  One is being filled by cam_task,
+// one is app_task's current image, one may be held by app_task waiting to be processed,
+// up to four (FILE_QUEUE_LEN) may be held by file_task's queue of binary records to
+// write, one may be held by cmd_task sending a binary image, one may be held by
+// http_task sending the MJPEG stream, one may be held by gui_task while it renders so
+// capture never waits on the display or processing, APP_ALARM_PRE_IMAGES may be held
+// by app_task's alarm pre-trigger ring and CAM_RING_LEN may be held by cam_task's
+// pre-trigger ring or app_task recording the images taken from it.  Profiles without
+// the GUI don't need its buffer and profiles without the ArduCAM have no pool.
+#if !defined(INCLUDE_SYS_ARDUCAM)
+#define CAM_BUFFER_POOL_LEN 0
+#elif defined(INCLUDE_SYS_GUI)
+#define CAM_BUFFER_POOL_LEN (10 + APP_ALARM_PRE_IMAGES + CAM_RING_LEN)
 #else
-#define CAM_MAX_JPG_LEN     32768
+#define CAM_BUFFER_POOL_LEN (9 + APP_ALARM_PRE_IMAGES + CAM_RING_LEN)
 #endif
 
 // Lepton default gain mode
 #define LEP_DEF_GAIN_MODE  LEP_SYS_GAIN_MODE_HIGH
 
-// Combined image (ArduCAM + Lepton + Metadata) json object text size
-// Based on the following items:
-//   1. Base64 encoded ArduCAM maximum image size: CAM_MAX_JPG_LEN*4 / 3
-//   2. Base64 encoded Lepton image size: (160x120x2)*4 / 3
-//   3. Metadata text size: 2048
-//   4. Json object overhead (child names, formatting characters, NLs): 256
-// Manually calculate this and round to 4-byte boundary
-#ifdef CAM_RES_HIGH
-#define JSON_MAX_IMAGE_TEXT_LEN (1024 * 160)
+// Number of lepton frame buffers in the shared pool.  One is being filled by vospi,
+// one holds the latest streamed frame, one may be held by lep_task as the frame a
+// synchronized ArduCAM capture was started with, one is app_task's current frame, one
+// may be held by app_task waiting to be processed, one may be held by gui_task while it
+// renders, up to four (FILE_QUEUE_LEN) may be held by file_task's queue of binary
+// records, one may be held by cmd_task for a binary image, one may be held by file_task
+// for high-rate recording, one may be held by cmd_task for the UDP frame stream,
+// APP_ALARM_PRE_IMAGES may be held by app_task's alarm pre-trigger ring and the
+// remainder allow consumers to hold frames longer.  Profiles without the GUI don't need
+// its frame.
+#ifdef INCLUDE_SYS_GUI
+#define LEP_FRAME_POOL_LEN (14 + APP_ALARM_PRE_IMAGES)
+#else
+#define LEP_FRAME_POOL_LEN (13 + APP_ALARM_PRE_IMAGES)
+#endif
+
+// Buffer placement.  Bulk buffers are in the PSRAM.  The small buffers walked pixel by
+// pixel (the lepton gui buffer and the first SYS_LEP_HOT_FRAMES lepton pool frames)
+// are placed in the internal RAM while at least SYS_INT_RAM_RESERVE bytes remain free
+// for task stacks, WiFi and lwip.  The active palette is always copied to internal RAM.
+#define SYS_LEP_HOT_FRAMES  2
+#define SYS_INT_RAM_RESERVE (128 * 1024)
+
+// Code placement.  Code in flash runs through the cache the PSRAM also uses so the
+// per-packet and per-pixel kernels of the image pipeline stall on cache misses while the
+// PSRAM is busy.  With SYS_HOT_IRAM defined the kernels not already in IRAM (the VoSPI
+// burst read, telemetry copy and segment dispatch, the Lepton statistics and the GUI
+// palette mapping and scaling) are placed there too.  Undefine it to leave them in flash
+// if the build's IRAM headroom report (see the Makefile) shows IRAM running out.
+#define SYS_HOT_IRAM
+#ifdef SYS_HOT_IRAM
+#define SYS_HOT_IRAM_ATTR IRAM_ATTR
 #else
-#define JSON_MAX_IMAGE_TEXT_LEN (1024 * 128)
+#define SYS_HOT_IRAM_ATTR
 #endif
 
-// Max command response json object text size
-#define JSON_MAX_RSP_TEXT_LEN   1024
+// Lepton frame averaging for long-interval recordings.  When recording with an interval
+// of at least LEP_AVG_MIN_REC_INTERVAL seconds the lepton image is the mean of
+// LEP_AVG_NUM_FRAMES consecutive frames.  Define LEP_AVG_OUTPUT_MAX to store the
+// per-pixel maximum of the frames instead of the mean.
+#define LEP_AVG_MIN_REC_INTERVAL 300
+#define LEP_AVG_NUM_FRAMES       8
+//#define LEP_AVG_OUTPUT_MAX
+
+// Lepton standby between sparse captures.  When recording with an interval of at least
+// LEP_STANDBY_MIN_REC_INTERVAL seconds while the display is headless lep_task stops
+// reading the VoSPI stream between recorded images.  app_task resumes it
+// LEP_STANDBY_LEAD_SEC seconds before an image is due and lep_task resynchronizes and,
+// with LEP_STANDBY_FFC defined, runs a FFC so the recorded frame is fresh.  The Lepton
+// itself keeps running since its CCI power down can only be left by power cycling it.
+#define LEP_STANDBY_MIN_REC_INTERVAL 60
+#define LEP_STANDBY_LEAD_SEC         5
+#define LEP_STANDBY_FFC
+
+// Lepton FFC scheduling.  With LEP_FFC_MANUAL defined the Lepton's automatic FFC is
+// disabled and lep_task runs a FFC right after delivering a frame to app_task (or,
+// when no frames are being requested, at any time) once the telemetry shows one is
+// needed.  The VoSPI stream freezes during a FFC so this keeps them away from captures.
+#define LEP_FFC_MANUAL
+#define LEP_FFC_MAX_INTERVAL_SEC     180
+#define LEP_FFC_TEMP_DELTA_K100      150
+
+// Combined image (ArduCAM + Lepton + Metadata) json object text size limits.  The
+// buffer size, JSON_MAX_IMAGE_TEXT_LEN in json_utilities.h, is derived from these and
+// the image sizes.
+#define JSON_MAX_METADATA_LEN   2560
+#define JSON_IMAGE_OVERHEAD_LEN 256
+
+// Free memory left after the buffers in the system memory budget are allocated for
+// the remaining (smaller) allocations.  Startup fails if the budget doesn't fit.
+#define SYS_PSRAM_RESERVE       (256 * 1024)
+
+// Max command response json object text size (get_status with its task list and health
+// counters is the largest).  get_perf and list_sessions responses are streamed so they
+// aren't limited by it.
+#define JSON_MAX_RSP_TEXT_LEN   5120
+
+// get_status responses are re-rendered at most this often.  Polls in between are sent the
+// previous response.
+#define JSON_STATUS_HOLD_MSEC   500
 
 // Maximum incoming command json string length (large enough for longest command)
 #define JSON_MAX_CMD_TEXT_LEN   256
 
-// Maximum TCP/IP Socket receiver buffer
-//  This should be large enough for the maximum number of command received at a time
-//  (probably 2 is ok)
-#define CMD_MAX_TCP_RX_BUFFER_LEN 1024
+// cJSON allocation arena size.  Large enough for a parsed command and the largest
+// response objects (get_config, get_perf) at the same time.  Allocations that don't fit come from
+// the heap.
+#define JSON_ARENA_LEN          (1024 * 32)
 
 // TCP/IP listening port
 #define CMD_PORT 5001
 
+// HTTP (MJPEG) listening port
+#define HTTP_PORT 80
+
+// TCP log listening port (see log_task.h)
+#define LOG_PORT 5003
+
+// UDP status beacon and discovery port (see cmd_task.h)
+#define CMD_BEACON_PORT 5005
+
+// UDP multi-camera sync beacon port (see sync_task.h)
+#define SYNC_PORT 5004
+
+
+// Recording file formats
+#define REC_FORMAT_JSON   0
+#define REC_FORMAT_BINARY 1
+#define REC_FORMAT_BINARY_Z 2   /* Binary with compressed radiometric data */
+#define REC_FORMAT_AVI    3   /* ArduCAM jpegs in an MJPEG AVI file, the rest as REC_FORMAT_BINARY_Z */
+
 
 // Recording Intervals and names
 #define REC_INT_0_VAL  1
@@ -171,7 +537,14 @@
 #define REC_INT_5_NAME "30 Minutes"
 #define REC_INT_6_VAL  3600
 #define REC_INT_6_NAME "1 Hour"
-#define REC_INT_NUM    7
+#define REC_INT_7_VAL  REC_INT_FAST_VAL
+#define REC_INT_7_NAME "Lepton Rate"
+#define REC_INT_NUM    8
+
+// Special recording interval value for high-rate recording.  Each lepton frame is
+// recorded to a binary file in the session directory and the once-per-second json
+// files only contain metadata and (optionally) the ArduCAM image.
+#define REC_INT_FAST_VAL 0
 
 
 
@@ -0,0 +1,108 @@
+/*
+ * Upload Task
+ *
+ * Pushes completed recording sessions on the Micro-SD Card to a HTTP server when the
+ * camera is connected to a network in client mode so recordings from sites with
+ * intermittent connectivity are collected without removing the card.  Each file is
+ * sent with HTTP PUT requests of up to UPLOAD_REQUEST_LEN bytes over one persistent
+ * connection and the progress through a session is kept in a marker file in its
+ * directory so an interrupted upload resumes where it left off.  Runs at low priority
+ * and, while recording, is throttled and waits for file_task's queue to empty so it
+ * never holds up the recording.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef UPLOAD_TASK_H
+#define UPLOAD_TASK_H
+
+#include "file_utilities.h"
+#include "xfer_task.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Upload Task Constants
+//
+
+// Upload Task notifications
+#define UPLOAD_NOTIFY_CONFIG_MASK 0x00000001
+
+// Period the task looks for sessions to upload while it is idle and after a failure
+#define UPLOAD_CHECK_MSEC         30000
+#define UPLOAD_RETRY_MSEC         60000
+
+// Most file data sent in one PUT request.  Larger files are sent as several requests
+// with a Content-Range header and the marker file is updated after each.
+#define UPLOAD_REQUEST_LEN        (1024 * 1024)
+
+// Files are read in blocks of UPLOAD_BLOCK_LEN bytes into a DMA-capable buffer
+// (allocated while a session is being uploaded) as xfer_task does
+#define UPLOAD_BLOCK_LEN          8192
+
+// Upload rate limit while recording (kB/sec).  There is no limit otherwise.
+#define UPLOAD_REC_KBPS           256
+
+// Wait before checking again while file_task has images queued during a recording
+#define UPLOAD_QUEUE_WAIT_MSEC    100
+
+// A server that doesn't accept data or respond for this long fails the upload
+#define UPLOAD_TIMEOUT_MSEC       10000
+
+// Longest HTTP request or response header
+#define UPLOAD_MAX_HDR_LEN        512
+
+// Marker file kept in each session directory
+#define UPLOAD_FILE_NAME          "upload.fcu"
+#define UPLOAD_MAGIC              0x50554346   /* "FCUP" */
+
+
+
+//
+// Upload Task typedefs
+//
+
+// Marker file contents
+typedef struct {
+	uint32_t magic;              // UPLOAD_MAGIC
+	uint32_t done;               // Set when every file in the session has been uploaded
+	uint32_t offset;             // Offset of the next data to send from file
+	char file[XFER_MAX_PATH_LEN]; // Path relative to the session (empty before the first file)
+} __attribute__((packed)) upload_marker_t;
+
+typedef struct {
+	bool enabled;                // A server is configured
+	bool active;                 // Uploading session
+	char session[SESSION_DIR_NAME_LEN];  // Session being or last uploaded (empty if none)
+	uint32_t sessions;           // Sessions uploaded since the camera started
+	uint32_t kbytes;             // kB uploaded since the camera started
+	uint32_t failures;           // Failed uploads since the camera started
+} upload_status_t;
+
+
+
+//
+// Upload Task API
+//
+void upload_task();
+void upload_task_set_server(const uint8_t* ip_addr, uint16_t port);
+void upload_task_get_status(upload_status_t* statusP);
+
+#endif /* UPLOAD_TASK_H */
@@ -0,0 +1,105 @@
+/*
+ * Xfer Task
+ *
+ * Lists the recording sessions on the Micro-SD Card and streams a file or a whole
+ * session to a client over TCP for the list_sessions, get_file and get_session commands
+ * so recordings can be collected without removing the card.  Runs alongside file_task
+ * (FATFS serializes their accesses) so recording continues during a transfer.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef XFER_TASK_H
+#define XFER_TASK_H
+
+#include "file_utilities.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+
+//
+// Xfer Task Constants
+//
+
+// Xfer Task notifications
+#define XFER_NOTIFY_LIST_MASK  0x00000001
+#define XFER_NOTIFY_SEND_MASK  0x00000002
+
+// Maximum sessions reported by list_sessions (oldest first, the rest are only counted)
+#define XFER_MAX_SESSIONS      32
+
+// Files are read in blocks of XFER_BLOCK_LEN bytes at block-aligned file offsets (a
+// resumed file starts with a short block) into a DMA-capable buffer so FATFS reads whole
+// sectors from the card directly into it and the block is sent to the socket in place
+#define XFER_BLOCK_LEN         8192
+
+// Maximum card path (session directory, subdirectory and file name)
+#define XFER_MAX_PATH_LEN      96
+
+// A client that can't accept data for this long ends the transfer
+#define XFER_SEND_TIMEOUT_MSEC 5000
+
+// Stream format.  Each file is sent as a xfer_file_header_t, its name_len byte path
+// relative to the session directory (no null) and its data from offset to length.  The
+// transfer ends with a header with name_len 0.  A transfer that failed simply ends (the
+// client resumes with the file and offset it got to).
+#define XFER_MAGIC             0x46584346   /* "FCXF" */
+
+
+
+//
+// Xfer Task typedefs
+//
+typedef struct {
+	uint32_t magic;              // XFER_MAGIC
+	uint32_t length;             // File length when it was opened
+	uint32_t offset;             // File offset of the data that follows
+	uint16_t name_len;           // Length of the path that follows (0 ends the transfer)
+	uint16_t reserved;
+} __attribute__((packed)) xfer_file_header_t;
+
+// Session information from its directory and index file
+typedef struct {
+	char name[SESSION_DIR_NAME_LEN];
+	uint32_t images;             // Index entries
+	uint32_t start_sec;          // Capture times of the first and last indexed images
+	uint32_t end_sec;
+} xfer_session_t;
+
+// File or session transfer request
+typedef struct {
+	uint32_t tcp_addr;           // Client address (network byte order) and port to connect to
+	uint16_t tcp_port;
+	bool whole_session;          // Send every file in the session starting with file
+	char session[SESSION_DIR_NAME_LEN];
+	char file[XFER_MAX_PATH_LEN]; // Path relative to the session (may be empty for a session)
+	uint32_t offset;             // Offset into file to start at
+} xfer_request_t;
+
+
+
+//
+// Xfer Task API
+//
+void xfer_task();
+bool xfer_task_request_list();
+bool xfer_task_request_send(xfer_request_t* reqP);
+int xfer_task_get_session_count(int* total);
+bool xfer_task_get_session(int i, xfer_session_t* sP);
+
+#endif /* XFER_TASK_H */
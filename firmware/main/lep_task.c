@@ -1,7 +1,7 @@
 /*
  * Lepton Task
  *
- * Contains functions to initialize the Lepton and then sampling images from it,
+ * Contains functions to initialize the Lepton and then stream images from it,
  * making those available to other tasks through a shared buffer and event
  * interface.  This task should be run on the "PRO" core (0) while other application
  * tasks run on the "APP" core (1).
@@ -25,17 +25,29 @@
  *
  */
 #include <stdbool.h>
+#include <string.h>
 #include "esp_system.h"
 #include "esp_log.h"
 #include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "rom/ets_sys.h"
 #include "driver/gpio.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "app_task.h"
+#include "bench_task.h"
+#include "cam_task.h"
+#include "cmd_task.h"
+#include "file_task.h"
+#include "health_task.h"
 #include "lep_task.h"
 #include "cci.h"
 #include "vospi.h"
+#include "lepton_correct.h"
 #include "lepton_utilities.h"
+#include "perf_utilities.h"
+#include "pm_utilities.h"
+#include "ps_utilities.h"
 #include "sys_utilities.h"
 #include "system_config.h"
 
@@ -44,6 +56,65 @@
 // LEP Task constants
 //
 
+// Number of consecutive segment periods without a complete frame before we declare the
+// VoSPI stream lost.  We should see a valid frame every 12 vsync interrupts (one frame
+// period) but give the lepton extra frame periods to start correctly streaming data.
+#define LEP_TASK_MAX_VSYNC_FAIL     36
+
+// Number of consecutive segment periods without a complete frame, while seeing row or
+// segment errors, before we resynchronize early.  Errors (as opposed to just discard
+// packets) mean we are misaligned with the VoSPI stream rather than the lepton being busy.
+#define LEP_TASK_SYNC_ERR_FAIL      12
+
+// Maximum time to wait for a vsync before counting a missed segment period (a frame
+// period for a Lepton 2.x)
+#define LEP_TASK_VSYNC_TIMEOUT_MSEC 20
+#define LEP_TASK_LEP2_TIMEOUT_MSEC  50
+
+// Maximum age of the latest streamed frame that can be used to satisfy a request
+#define LEP_TASK_MAX_FRAME_AGE_USEC 250000
+
+// A synchronized ArduCAM capture is started without a frame if none is published within
+// two frame periods (e.g. during a FFC).  The frame it was started with is only used for
+// a request within LEP_TASK_SYNC_MAX_AGE_USEC.
+#define LEP_TASK_SYNC_MAX_WAIT_USEC (2 * 12 * LEP_FRAME_USEC)
+#define LEP_TASK_SYNC_MAX_AGE_USEC  1000000
+
+// Period between routine lepton configuration checks.  Checks also run when the
+// lepton appears to have reset or we lose the VoSPI stream.
+#define LEP_TASK_CHECK_PERIOD_USEC  60000000
+
+// Loop period in standby, while there are no vsyncs to wait for, so configuration
+// checks still run
+#define LEP_TASK_STANDBY_EVAL_MSEC  1000
+
+// Time without a frame request after which a FFC that is due can run at any time
+#define LEP_TASK_FFC_IDLE_USEC      2000000
+
+// Time after a FFC during which telemetry from frames started before it is ignored
+#define LEP_TASK_FFC_HOLDOFF_USEC   5000000
+
+// Pixel correction calibration.  Frames are averaged starting LEP_TASK_CAL_SETTLE_USEC
+// after the FFC it runs.  It is abandoned if the FFC hasn't run after
+// LEP_TASK_CAL_FFC_USEC.
+#define LEP_TASK_CAL_SETTLE_USEC    2000000
+#define LEP_TASK_CAL_FFC_USEC       10000000
+
+// Gain mode changes are applied between frames.  The frames after the change that were
+// made before the lepton switched (their telemetry still shows the previous mode) are
+// dropped, as is at least the first one in case it was already on its way out of the
+// lepton, for up to LEP_TASK_GAIN_SETTLE_USEC.  A change waiting longer than
+// LEP_TASK_GAIN_WAIT_USEC for the end of a frame (the stream is lost) is applied anyway.
+#define LEP_TASK_GAIN_MIN_FRAMES    1
+#define LEP_TASK_GAIN_SETTLE_USEC   2000000
+#define LEP_TASK_GAIN_WAIT_USEC     500000
+
+// Pixel correction calibration states
+#define LEP_CAL_IDLE                0
+#define LEP_CAL_FFC                 1
+#define LEP_CAL_SETTLE              2
+#define LEP_CAL_ACCUM               3
+
 
 
 //
@@ -51,9 +122,124 @@
 //
 static const char* TAG = "lep_task";
 
+// Set once the task has started (it is recreated by health_task if it stalls)
+static bool lep_started = false;
+
 // Lepton Vsync Interrupt handling
 static volatile int64_t vsyncDetectedUsec;
 
+// Streaming frame state (buffers from the shared frame pool)
+static lep_buffer_t* lep_latest_frameP;     // Most recent complete frame, NULL if none
+static int64_t lep_latest_frame_usec;
+
+// Set when app_task has requested a frame we haven't been able to deliver yet
+static bool lep_frame_requested;
+
+// Synchronized ArduCAM capture state
+static bool lep_sync_pending;               // Start the capture with the next frame
+static int64_t lep_sync_request_usec;
+static lep_buffer_t* lep_sync_frameP;       // Frame the last capture was started with
+
+// Consecutive segment periods without a complete frame
+static uint32_t lep_vsync_fail_count;
+
+// Lepton frame counter of the previous frame in the stream and the counter step between
+// output frames (the counter advances for every core frame, including the ones the
+// lepton doesn't output, so the smallest step seen is one output frame)
+static bool lep_fc_valid;
+static uint32_t lep_fc_last;
+static uint32_t lep_fc_step;
+
+// VoSPI error counters at the start of a run of failed segment periods
+static vospi_stats_t lep_fail_start_stats;
+
+// Frame averaging state
+static bool lep_avg_enable;
+static int lep_avg_count;
+
+// High-rate recording state
+static bool lep_rec_enable;
+static bool lep_rec_pending;                // Set while file_task holds sys_lep_rec_bufferP
+static uint32_t lep_rec_drop_count;
+
+// UDP frame stream state
+static bool lep_udp_enable;
+static bool lep_udp_pending;                // Set while cmd_task holds sys_lep_udp_bufferP
+
+// Lepton configuration check state
+static bool lep_check_needed;               // Set to run a check as soon as possible
+static int64_t lep_check_usec;              // Time of the last successful check
+static uint32_t lep_uptime_msec;            // Lepton uptime from the last telemetry
+
+// Standby state (VoSPI stream not read between sparse captures)
+static bool lep_standby;
+
+// FFC scheduling state
+static bool lep_ffc_pending;                // FFC to run as soon as the CCI is free
+static bool lep_ffc_due;                    // Telemetry shows a FFC is needed
+static bool lep_ffc_mode_needed;            // Manual FFC mode to restore after a reset
+static int64_t lep_deliver_usec;            // Time a frame was last delivered to app_task
+static int64_t lep_ffc_usec;                // Time of the last FFC we ran
+
+// Pixel correction calibration state
+static int lep_cal_state;
+static int64_t lep_cal_usec;                // Time the calibration started
+static int64_t lep_cal_ffc_usec;            // Time of the last FFC we ran it has seen
+static int64_t lep_cal_settle_usec;         // Time of the FFC it is waiting to settle after
+static uint32_t lep_cal_ffc_msec;           // Lepton's last FFC time when averaging started
+
+// Gain mode change state
+static bool lep_frame_boundary;             // The last segment read completed a frame
+static bool lep_gain_pending;               // Change to apply at the next frame boundary
+static int lep_gain_mode;                   // Mode being changed to (SYS_GAIN_xxx)
+static int64_t lep_gain_request_usec;       // Time the change was requested
+static bool lep_gain_settling;              // Dropping frames made before the change
+static int lep_gain_frames;                 // Frames dropped since it was applied
+static int64_t lep_gain_usec;               // Time it was applied
+
+// Telemetry-only mode state
+static bool lep_telem_only;
+static uint16_t lep_telem_sample[LEP_TEL_WORDS];
+static uint32_t lep_telem_sample_seq;
+static portMUX_TYPE lep_telem_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Latest frame values (also protected by lep_telem_mux)
+static lep_task_sample_t lep_sample;
+
+
+
+//
+// LEP Task Forward Declarations for internal functions
+//
+static void IRAM_ATTR lep_vsync_isr(void* arg);
+static void lep_task_handle_frame_request();
+static void lep_task_handle_sync_request();
+static void lep_task_check_sync();
+static void lep_task_start_cam(bool with_frame);
+static void lep_task_service_check();
+static void lep_task_check_uptime(bool telem_valid, const lep_telem_t* telP);
+static bool lep_task_check_frame_count(const lep_telem_t* telP);
+static void lep_task_set_telem_only(bool en);
+static void lep_task_set_averaging(bool en);
+static void lep_task_set_recording(bool en);
+static void lep_task_set_standby(bool en);
+static void lep_task_eval_ffc(const lep_telem_t* telP);
+static void lep_task_start_cal();
+static void lep_task_cal_frame(lep_buffer_t* frameP);
+static void lep_task_request_gain();
+static void lep_task_apply_gain();
+static bool lep_task_gain_settled(bool telem_valid, const lep_telem_t* telP);
+static void lep_task_update_sample(int64_t vsync_usec, const lep_telem_t* telP, const lep_buffer_t* frameP);
+static void lep_task_record_frame();
+static void lep_task_udp_frame();
+static void lep_task_accumulate_frame(lep_buffer_t* frameP);
+static void lep_task_finish_average(lep_buffer_t* outP, lep_buffer_t* lastP);
+static void lep_task_process_segment();
+static void lep_task_note_segment_fail();
+static bool lep_task_latest_frame_valid();
+static void lep_task_deliver_frame(lep_buffer_t* frameP);
+static void lep_task_frame_failed();
+
 
 
 //
@@ -61,60 +247,1067 @@ static volatile int64_t vsyncDetectedUsec;
 //
 
 /**
- * This task drives the Lepton camera interface.
+ * This task drives the Lepton camera interface.  It streams continuously from the
+ * lepton, staying synchronized with the VoSPI output, and has vospi assemble each
+ * frame directly in a buffer from the shared frame pool.  Requests from app_task are
+ * satisfied by publishing the most recent frame by pointer.
  */
 void lep_task()
 {
-	bool done;
 	uint32_t notification_value;
-	uint32_t vsync_count;
+	int vsync_timeout_msec;
 	
 	ESP_LOGI(TAG, "Start task");
-  
+	
+	if (!lep_started) {
+		lep_latest_frameP = NULL;
+		lep_frame_requested = false;
+		lep_sync_pending = false;
+		lep_sync_frameP = NULL;
+		lep_vsync_fail_count = 0;
+		lep_fc_valid = false;
+		lep_fc_step = 0;
+		lep_telem_only = false;
+		lep_telem_sample_seq = 0;
+		lep_avg_enable = false;
+		lep_avg_count = 0;
+		lep_rec_enable = false;
+		lep_rec_pending = false;
+		lep_udp_enable = false;
+		lep_udp_pending = false;
+		lep_standby = false;
+		lep_ffc_pending = false;
+		lep_ffc_due = false;
+		lep_ffc_mode_needed = false;
+		lep_deliver_usec = 0;
+		lep_ffc_usec = 0;
+		lep_check_needed = false;
+		lep_check_usec = esp_timer_get_time();  // lepton_init just configured the lepton
+		lep_uptime_msec = 0;
+		lep_cal_state = LEP_CAL_IDLE;
+		lep_frame_boundary = false;
+		lep_gain_pending = false;
+		lep_gain_settling = false;
+		lepton_correct_init();
+		
+		// Give vospi its first buffer to fill
+		vospi_set_frame(system_lep_frame_alloc());
+		lep_started = true;
+	} else {
+		// Recreated after a stall.  The modes other tasks have set and the frames they
+		// hold are kept (vospi also keeps the buffer it was filling).  Our own frames
+		// are dropped and we resynchronize with the stream and recheck the lepton's
+		// configuration.
+		gpio_isr_handler_remove(LEP_VSYNC_IO);
+		system_lep_frame_release(lep_latest_frameP);
+		lep_latest_frameP = NULL;
+		system_lep_frame_release(lep_sync_frameP);
+		lep_sync_frameP = NULL;
+		lep_vsync_fail_count = 0;
+		lep_fc_valid = false;
+		lep_avg_count = 0;
+		lep_check_needed = true;
+		vospi_resync();
+	}
+	
+	// Stay out of light sleep while streaming so vsync interrupts are seen
+	pm_set_level(PM_USER_LEP, lep_standby ? PM_LEVEL_SLEEP : PM_LEVEL_AWAKE);
+	
+	// Start handling vsync interrupts from the lepton
+	gpio_set_intr_type(LEP_VSYNC_IO, GPIO_INTR_POSEDGE);
+	gpio_isr_handler_add(LEP_VSYNC_IO, lep_vsync_isr, NULL);
+	
+	vsync_timeout_msec = vospi_is_lepton2() ? LEP_TASK_LEP2_TIMEOUT_MSEC : LEP_TASK_VSYNC_TIMEOUT_MSEC;
+	
 	while (1) {
-		// Block waiting for a notification that the app_task wants an image
-		xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, portMAX_DELAY);
-		
-		done = false;
-		vsync_count = 0;
-		
-		if (!lepton_check_reset_state()) {
-			xTaskNotify(task_handle_app, APP_NOTIFY_LEP_FAIL_MASK, eSetBits);
-			done = true;
-		}
-		
-		while (!done) {
-			// Then spin waiting for vsync to be asserted
-			while (gpio_get_level(LEP_VSYNC_IO) == 0) {
-				vTaskDelay(pdMS_TO_TICKS(9));
-			};
-			vsyncDetectedUsec = esp_timer_get_time();
-			
-			// Attempt to process a segment
-			if (vospi_transfer_segment(vsyncDetectedUsec)) {				
-				// Copy the frame to the shared buffer
-				vospi_get_frame(&sys_lep_buffer);
-				
-				// Let app_task know we've updated the buffer
-				xTaskNotify(task_handle_app, APP_NOTIFY_LEP_FRAME_MASK, eSetBits);		
-				done = true;
-			} else {
-				// We should see a valid frame every 12 vsync interrupts (one frame period).
-				// However, since we're resynchronizing with the VoSPI stream and our task
-				// may be interrupted by other tasks, we give the lepton extra frame periods
-				// to start correctly streaming data.  We may still fail when the lepton runs
-				// a FFC since that takes a long time.
-				if (++vsync_count == 36) {
-					// Let app_task know we failed to update the buffer
-					ESP_LOGE(TAG, "Could not get lepton image");
-					xTaskNotify(task_handle_app, APP_NOTIFY_LEP_FAIL_MASK, eSetBits);
-					done = true;
-					
-					// Reset the VoSPI pipeline
-					vTaskDelay(pdMS_TO_TICKS(200));
+		health_task_beat(HEALTH_TASK_LEP);
+		
+		// Block waiting for vsync (or a request from app_task)
+		notification_value = 0;
+		if (xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value,
+		                    pdMS_TO_TICKS(lep_standby ? LEP_TASK_STANDBY_EVAL_MSEC : vsync_timeout_msec)))
+		{
+			// Service vsync first since reading the segment is time critical
+			if (Notification(notification_value, LEP_NOTIFY_VSYNC_MASK) && !lep_standby) {
+				lep_task_process_segment();
+			}
+			
+			if (Notification(notification_value, LEP_NOTIFY_TELEM_ONLY_MASK)) {
+				lep_task_set_telem_only(true);
+			}
+			
+			if (Notification(notification_value, LEP_NOTIFY_FULL_FRAME_MASK)) {
+				lep_task_set_telem_only(false);
+			}
+			
+			if (Notification(notification_value, LEP_NOTIFY_AVG_ON_MASK)) {
+				lep_task_set_averaging(true);
+			}
+			
+			if (Notification(notification_value, LEP_NOTIFY_AVG_OFF_MASK)) {
+				lep_task_set_averaging(false);
+			}
+			
+			if (Notification(notification_value, LEP_NOTIFY_REC_ON_MASK)) {
+				lep_task_set_recording(true);
+			}
+			
+			if (Notification(notification_value, LEP_NOTIFY_REC_OFF_MASK)) {
+				lep_task_set_recording(false);
+			}
+			
+			if (Notification(notification_value, LEP_NOTIFY_REC_DONE_MASK)) {
+				// file_task is done with the recorded frame
+				system_lep_frame_release(sys_lep_rec_bufferP);
+				sys_lep_rec_bufferP = NULL;
+				lep_rec_pending = false;
+			}
+			
+			if (Notification(notification_value, LEP_NOTIFY_UDP_ON_MASK)) {
+				lep_task_set_standby(false);
+				lep_udp_enable = true;
+			}
+			
+			if (Notification(notification_value, LEP_NOTIFY_UDP_OFF_MASK)) {
+				lep_udp_enable = false;
+			}
+			
+			if (Notification(notification_value, LEP_NOTIFY_UDP_DONE_MASK)) {
+				// cmd_task is done sending the streamed frame
+				system_lep_frame_release(sys_lep_udp_bufferP);
+				sys_lep_udp_bufferP = NULL;
+				lep_udp_pending = false;
+			}
+			
+			if (Notification(notification_value, LEP_NOTIFY_STANDBY_ON_MASK)) {
+				lep_task_set_standby(true);
+			}
+			
+			if (Notification(notification_value, LEP_NOTIFY_STANDBY_OFF_MASK)) {
+				lep_task_set_standby(false);
+			}
+			
+			// Before a frame request so the request waits for the synchronized frame
+			if (Notification(notification_value, LEP_NOTIFY_SYNC_CAM_MASK)) {
+				lep_task_handle_sync_request();
+			}
+			
+			if (Notification(notification_value, LEP_NOTIFY_GET_FRAME_MASK)) {
+				lep_task_handle_frame_request();
+			}
+			
+			if (Notification(notification_value, LEP_NOTIFY_CHECK_MASK)) {
+				// Settings changed, push them to the lepton
+				lep_check_needed = true;
+			}
+			
+			if (Notification(notification_value, LEP_NOTIFY_GAIN_MASK)) {
+				lep_task_request_gain();
+			}
+			
+			if (Notification(notification_value, LEP_NOTIFY_CORR_CAL_MASK)) {
+				lep_task_start_cal();
+			}
+			
+			if (Notification(notification_value, LEP_NOTIFY_CORR_CLEAR_MASK)) {
+				if (lep_cal_state != LEP_CAL_IDLE) {
+					lep_cal_state = LEP_CAL_IDLE;
+					lepton_correct_cal_abort();
 				}
+				(void) lepton_correct_clear();
+				ESP_LOGI(TAG, "Pixel correction cleared");
+			}
+			
+#ifdef INCLUDE_SYS_BENCH
+			if (Notification(notification_value, LEP_NOTIFY_BENCH_MASK)) {
+				bench_task_run_vospi();
+			}
+#endif
+		} else if (!lep_standby) {
+			// No vsync from the lepton
+			lep_task_note_segment_fail();
+		}
+		
+		// Don't hold up a synchronized ArduCAM capture for long without frames
+		lep_task_check_sync();
+		
+		// Restart the stream once the lepton has booted after a recovery reboot or reset.
+		// It has lost its configuration (including the VSYNC output).
+		if (lepton_recover_service()) {
+			vospi_resync();
+			lep_vsync_fail_count = 0;
+			lep_fc_valid = false;
+			lep_check_needed = true;
+			lep_ffc_mode_needed = true;
+		}
+		
+		// Advance any configuration check between segments
+		lep_task_service_check();
+		
+		// Apply a gain mode change between frames once the CCI is free
+		if (lep_gain_pending && !lepton_check_running() && !lepton_recover_booting()) {
+			if (lep_frame_boundary || lep_standby ||
+			    ((esp_timer_get_time() - lep_gain_request_usec) >= LEP_TASK_GAIN_WAIT_USEC))
+			{
+				lep_task_apply_gain();
+			}
+		}
+		
+		// Run a FFC scheduled between captures (or for a stream resumed from standby)
+		// once the CCI is free
+		if (lep_ffc_pending && !lepton_check_running() && !lepton_recover_booting()) {
+			lep_ffc_pending = false;
+			lep_ffc_due = false;
+			lepton_ffc();
+			lep_ffc_usec = esp_timer_get_time();
+		}
+	}
+}
+
+
+/**
+ * Copy the most recent telemetry sample captured in telemetry-only mode into buf
+ * (LEP_TEL_WORDS long).  Returns the sample's sequence number (incremented each frame)
+ * or 0 if no sample has been captured.
+ */
+uint32_t lep_task_get_telem_sample(uint16_t* buf)
+{
+	uint32_t seq;
+	
+	portENTER_CRITICAL(&lep_telem_mux);
+	memcpy(buf, lep_telem_sample, LEP_TEL_WORDS*2);
+	seq = lep_telem_sample_seq;
+	portEXIT_CRITICAL(&lep_telem_mux);
+	
+	return seq;
+}
+
+
+/**
+ * Copy the values from the most recent frame into sampleP
+ */
+void lep_task_get_sample(lep_task_sample_t* sampleP)
+{
+	portENTER_CRITICAL(&lep_telem_mux);
+	*sampleP = lep_sample;
+	portEXIT_CRITICAL(&lep_telem_mux);
+}
+
+
+/**
+ * Called by health_task when we have stalled to reset the lepton in case we are blocked
+ * waiting on it.  We resynchronize and then reconfigure it as we would after it reset
+ * itself.  Returns false on boards without LEP_RESET_IO.
+ */
+bool lep_task_recover()
+{
+#ifdef LEP_RESET_IO
+	gpio_set_level(LEP_RESET_IO, 0);
+	ets_delay_us(LEP_RECOVER_RESET_USEC);
+	gpio_set_level(LEP_RESET_IO, 1);
+	lep_check_needed = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+
+//
+// LEP Task internal functions
+//
+
+/**
+ * Lepton VSYNC interrupt handler - record the time and wake lep_task to read the
+ * segment
+ */
+static void IRAM_ATTR lep_vsync_isr(void* arg)
+{
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+	
+	vsyncDetectedUsec = esp_timer_get_time();
+	xTaskNotifyFromISR(task_handle_lep, LEP_NOTIFY_VSYNC_MASK, eSetBits, &xHigherPriorityTaskWoken);
+	if (xHigherPriorityTaskWoken == pdTRUE) {
+		portYIELD_FROM_ISR();
+	}
+}
+
+
+/**
+ * Handle a request from app_task for a frame
+ */
+static void lep_task_handle_frame_request()
+{
+	// Hand app_task the frame the ArduCAM capture was started with if there is one, or
+	// the next frame if that capture is still waiting for it.  Otherwise hand it the
+	// latest frame immediately if it is recent enough or deliver the next frame we get.
+	// No images are available in telemetry-only mode or standby.
+	if (lep_telem_only || lep_standby) {
+		lep_task_frame_failed();
+	} else if (lep_sync_pending) {
+		lep_frame_requested = true;
+	} else if ((lep_sync_frameP != NULL) &&
+	           ((esp_timer_get_time() - lep_sync_frameP->timestamp_usec) <= LEP_TASK_SYNC_MAX_AGE_USEC))
+	{
+		lep_task_deliver_frame(lep_sync_frameP);
+	} else if (lep_task_latest_frame_valid()) {
+		lep_task_deliver_frame(lep_latest_frameP);
+	} else {
+		lep_frame_requested = true;
+	}
+	
+	// The synchronized frame is only used once
+	system_lep_frame_release(lep_sync_frameP);
+	lep_sync_frameP = NULL;
+}
+
+
+/**
+ * Handle a request from app_task to start the ArduCAM capture with the next frame.  It
+ * is started immediately when there are no frames.
+ */
+static void lep_task_handle_sync_request()
+{
+	if (lep_telem_only || lep_standby) {
+		lep_task_start_cam(false);
+	} else {
+		lep_sync_pending = true;
+		lep_sync_request_usec = esp_timer_get_time();
+	}
+}
+
+
+/**
+ * Start a synchronized ArduCAM capture that has waited too long for a frame
+ */
+static void lep_task_check_sync()
+{
+	if (lep_sync_pending &&
+	    ((esp_timer_get_time() - lep_sync_request_usec) > LEP_TASK_SYNC_MAX_WAIT_USEC))
+	{
+		lep_task_start_cam(false);
+	}
+}
+
+
+/**
+ * Start the ArduCAM capture, with the frame just published if with_frame is set
+ */
+static void lep_task_start_cam(bool with_frame)
+{
+	xTaskNotify(task_handle_cam, CAM_NOTIFY_GET_FRAME_MASK, eSetBits);
+	lep_sync_pending = false;
+	
+	system_lep_frame_release(lep_sync_frameP);
+	lep_sync_frameP = NULL;
+	if (with_frame) {
+		system_lep_frame_hold(lep_latest_frameP);
+		lep_sync_frameP = lep_latest_frameP;
+	}
+}
+
+
+/**
+ * Start a configuration check when one is needed or the routine check is due and
+ * advance a running check.  The lepton configuration is otherwise assumed unchanged.
+ * A failure is reported to app_task if it is still waiting for a frame and the check
+ * is retried.
+ */
+static void lep_task_service_check()
+{
+	int res;
+	int64_t now;
+	
+	// The lepton can't be configured until it has booted
+	if (lepton_recover_booting()) return;
+	
+	if (!lepton_check_running()) {
+		now = esp_timer_get_time();
+		if (!lep_check_needed && ((now - lep_check_usec) < LEP_TASK_CHECK_PERIOD_USEC)) {
+			return;
+		}
+		lep_check_needed = false;
+		lepton_check_start();
+	}
+	
+	res = lepton_check_service();
+	if (res == LEP_CHECK_OK) {
+		lep_check_usec = esp_timer_get_time();
+#ifdef LEP_FFC_MANUAL
+		if (lep_ffc_mode_needed) {
+			lep_ffc_mode_needed = false;
+			(void) lepton_ffc_manual(true);
+		}
+#endif
+	} else if (res == LEP_CHECK_FAIL) {
+		lep_check_needed = true;
+		if (lep_frame_requested) {
+			lep_task_frame_failed();
+			lep_frame_requested = false;
+		}
+	}
+}
+
+
+/**
+ * Look for signs the lepton has reset in a frame's telemetry: telemetry missing or
+ * its uptime counter going backwards.  Either means it has lost our configuration.
+ */
+static void lep_task_check_uptime(bool telem_valid, const lep_telem_t* telP)
+{
+	if (!telem_valid) {
+		lep_check_needed = true;
+		lep_ffc_mode_needed = true;
+		return;
+	}
+	
+	if (telP->uptime_msec < lep_uptime_msec) {
+		ESP_LOGI(TAG, "Lepton uptime went backwards");
+		lep_check_needed = true;
+		lep_ffc_mode_needed = true;
+		lep_fc_valid = false;
+	}
+	lep_uptime_msec = telP->uptime_msec;
+}
+
+
+/**
+ * Check a frame's Lepton frame counter against the previous frame in the stream.
+ * Returns false if it is the previous frame again.  Frames the counter shows were
+ * missed are counted.
+ */
+static bool lep_task_check_frame_count(const lep_telem_t* telP)
+{
+	uint32_t delta;
+	
+	if (lep_fc_valid && (telP->frame_count >= lep_fc_last)) {
+		delta = telP->frame_count - lep_fc_last;
+		if (delta == 0) {
+			perf_count(PERF_CNT_LEP_DUP_FRAME);
+			return false;
+		}
+		
+		if ((lep_fc_step == 0) || (delta < lep_fc_step)) {
+			lep_fc_step = delta;
+		}
+		if (delta >= (2 * lep_fc_step)) {
+			perf_count_n(PERF_CNT_LEP_SKIP_FRAME, (delta / lep_fc_step) - 1);
+		}
+	}
+	lep_fc_last = telP->frame_count;
+	lep_fc_valid = true;
+	
+	return true;
+}
+
+
+/**
+ * Enter or leave telemetry-only mode.  In telemetry-only mode vospi skips the image
+ * data and only the telemetry rows (which include the spotmeter results) are captured
+ * each frame.
+ */
+static void lep_task_set_telem_only(bool en)
+{
+	if (en != lep_telem_only) {
+		ESP_LOGI(TAG, "Telemetry-only mode %s", en ? "on" : "off");
+		lep_telem_only = en;
+		lep_fc_valid = false;
+		vospi_include_image(!en);
+		
+		// Any previous frame is no longer current
+		system_lep_frame_release(lep_latest_frameP);
+		lep_latest_frameP = NULL;
+	}
+}
+
+
+/**
+ * Enable or disable the frame averaging stage.  The accumulator restarts either way.
+ */
+static void lep_task_set_averaging(bool en)
+{
+	if (en != lep_avg_enable) {
+		ESP_LOGI(TAG, "Frame averaging %s", en ? "on" : "off");
+		lep_avg_enable = en;
+		lep_avg_count = 0;
+	}
+}
+
+
+/**
+ * Enable or disable sending every frame to file_task for high-rate recording
+ */
+static void lep_task_set_recording(bool en)
+{
+	if (en != lep_rec_enable) {
+		if (!en && (lep_rec_drop_count != 0)) {
+			ESP_LOGI(TAG, "High-rate recording dropped %d frames", lep_rec_drop_count);
+		}
+		lep_rec_enable = en;
+		lep_rec_drop_count = 0;
+	}
+}
+
+
+/**
+ * Enter or leave standby.  In standby the vsync interrupt is off and the VoSPI stream
+ * isn't read.  Leaving standby resynchronizes with the stream, which the lepton has
+ * kept sending, and optionally runs a FFC.  Frame requests fail while in standby.
+ */
+static void lep_task_set_standby(bool en)
+{
+	if (en == lep_standby) return;
+	
+	// Every frame is needed while recording at the Lepton rate, streaming frames or
+	// calibrating
+	if (en && (lep_rec_enable || lep_udp_enable || (lep_cal_state != LEP_CAL_IDLE))) return;
+	
+	ESP_LOGI(TAG, "Standby %s", en ? "on" : "off");
+	lep_standby = en;
+	if (en) {
+		gpio_intr_disable(LEP_VSYNC_IO);
+		pm_set_level(PM_USER_LEP, PM_LEVEL_SLEEP);
+		
+		// Any previous frame is no longer current
+		if (lep_sync_pending) {
+			lep_task_start_cam(false);
+		}
+		system_lep_frame_release(lep_sync_frameP);
+		lep_sync_frameP = NULL;
+		system_lep_frame_release(lep_latest_frameP);
+		lep_latest_frameP = NULL;
+		lep_avg_count = 0;
+		if (lep_frame_requested) {
+			lep_task_frame_failed();
+			lep_frame_requested = false;
+		}
+	} else {
+		vospi_resync();
+		lep_vsync_fail_count = 0;
+		lep_fc_valid = false;
+		pm_set_level(PM_USER_LEP, PM_LEVEL_AWAKE);
+		gpio_intr_enable(LEP_VSYNC_IO);
+#ifdef LEP_STANDBY_FFC
+		lep_ffc_pending = true;
+#endif
+	}
+}
+
+
+/**
+ * Start a pixel correction calibration: run a FFC, wait for it to settle and average
+ * frames of the (uniform) scene
+ */
+static void lep_task_start_cal()
+{
+	if (lep_cal_state != LEP_CAL_IDLE) return;
+	
+	if (lep_telem_only) {
+		ESP_LOGE(TAG, "Can't calibrate pixel correction in telemetry-only mode");
+		return;
+	}
+	
+	if (lepton_correct_cal_start()) {
+		ESP_LOGI(TAG, "Start pixel correction calibration");
+		lep_task_set_standby(false);
+		lep_cal_state = LEP_CAL_FFC;
+		lep_cal_usec = esp_timer_get_time();
+		lep_ffc_pending = true;
+	}
+}
+
+
+/**
+ * Advance the pixel correction calibration with a new raw frame.  Averaging restarts if
+ * another FFC runs (ours or one the lepton runs itself) so all the frames are from one
+ * flat field.
+ */
+static void lep_task_cal_frame(lep_buffer_t* frameP)
+{
+	int64_t now = esp_timer_get_time();
+	
+	switch (lep_cal_state) {
+		case LEP_CAL_FFC:
+			if (lep_ffc_usec > lep_cal_usec) {
+				lep_cal_settle_usec = lep_ffc_usec;
+				lep_cal_state = LEP_CAL_SETTLE;
+			} else if ((now - lep_cal_usec) > LEP_TASK_CAL_FFC_USEC) {
+				ESP_LOGE(TAG, "Pixel correction calibration FFC didn't run");
+				lep_cal_state = LEP_CAL_IDLE;
+				lepton_correct_cal_abort();
+			}
+			break;
+		
+		case LEP_CAL_SETTLE:
+			if (lep_ffc_usec > lep_cal_settle_usec) {
+				lep_cal_settle_usec = lep_ffc_usec;
+			}
+			if ((now - lep_cal_settle_usec) >= LEP_TASK_CAL_SETTLE_USEC) {
+				lep_cal_ffc_usec = lep_ffc_usec;
+				lep_cal_ffc_msec = frameP->telem.last_ffc_msec;
+				lepton_correct_cal_restart();
+				lep_cal_state = LEP_CAL_ACCUM;
+			}
+			break;
+		
+		case LEP_CAL_ACCUM:
+			if ((lep_ffc_usec != lep_cal_ffc_usec) ||
+			    (frameP->telem_valid && (frameP->telem.last_ffc_msec != lep_cal_ffc_msec)))
+			{
+				ESP_LOGI(TAG, "FFC during pixel correction calibration - restarting");
+				lep_cal_settle_usec = now;
+				lep_cal_state = LEP_CAL_SETTLE;
+			} else if (lepton_correct_cal_add(frameP)) {
+				lep_cal_state = LEP_CAL_IDLE;
+				(void) lepton_correct_cal_finish(lepton_get_tlin_scale(frameP));
+			}
+			break;
+	}
+}
+
+
+/**
+ * Queue a change to the gain mode in persistent storage.  It is applied at the next
+ * frame boundary so a frame is never read while the lepton switches.  A later request
+ * replaces one that hasn't been applied yet.
+ */
+static void lep_task_request_gain()
+{
+	gui_state_t gui_state;
+	
+	ps_get_gui_state(&gui_state);
+	lep_gain_mode = gui_state.gain_mode;
+	if (!lep_gain_pending) {
+		lep_gain_pending = true;
+		lep_gain_request_usec = esp_timer_get_time();
+	}
+}
+
+
+/**
+ * Set the lepton to the queued gain mode and start dropping the frames made before it
+ * switched.  A change that fails is retried after the configuration check it starts.
+ */
+static void lep_task_apply_gain()
+{
+	if (!lepton_gain_mode(lep_gain_mode)) {
+		lep_check_needed = true;
+		return;
+	}
+	
+	lep_gain_pending = false;
+	lep_gain_usec = esp_timer_get_time();
+	lep_gain_frames = 0;
+	lep_gain_settling = !lep_standby;
+	ESP_LOGI(TAG, "Gain mode %d set after %d mSec", lep_gain_mode,
+	         (int) ((lep_gain_usec - lep_gain_request_usec) / 1000));
+}
+
+
+/**
+ * Return false for a frame that should be dropped because it was made before a gain
+ * mode change.  The first frame whose telemetry shows the new mode, after at least
+ * LEP_TASK_GAIN_MIN_FRAMES have been dropped, ends the change and its handover time
+ * (from setting the lepton to the frame's vsync) is recorded.
+ */
+static bool lep_task_gain_settled(bool telem_valid, const lep_telem_t* telP)
+{
+	int64_t now;
+	
+	if (!lep_gain_settling) return true;
+	
+	now = esp_timer_get_time();
+	if ((lep_gain_frames >= LEP_TASK_GAIN_MIN_FRAMES) && telem_valid &&
+	    lepton_gain_in_use(telP, lep_gain_mode))
+	{
+		lep_gain_settling = false;
+		perf_record(PERF_LEP_GAIN, (uint32_t) (vsyncDetectedUsec - lep_gain_usec));
+		ESP_LOGI(TAG, "Gain mode %d in use after %d frames", lep_gain_mode, lep_gain_frames);
+		return true;
+	}
+	
+	if ((now - lep_gain_usec) >= LEP_TASK_GAIN_SETTLE_USEC) {
+		lep_gain_settling = false;
+		ESP_LOGE(TAG, "Gain mode %d not seen in telemetry after %d frames", lep_gain_mode, lep_gain_frames);
+		return true;
+	}
+	
+	lep_gain_frames++;
+	perf_count(PERF_CNT_LEP_GAIN_FRAME);
+	return false;
+}
+
+
+/**
+ * Note from a frame's telemetry (NULL if it has none) when a FFC is needed with manual
+ * FFC mode.  A FFC that is due runs after the next frame is delivered to app_task or,
+ * if app_task isn't requesting frames, now.
+ */
+static void lep_task_eval_ffc(const lep_telem_t* telP)
+{
+#ifdef LEP_FFC_MANUAL
+	int64_t now = esp_timer_get_time();
+	
+	if ((telP != NULL) && ((now - lep_ffc_usec) >= LEP_TASK_FFC_HOLDOFF_USEC) &&
+	    lepton_ffc_due(telP))
+	{
+		lep_ffc_due = true;
+	}
+	
+	if (lep_ffc_due && !lep_frame_requested &&
+	    ((now - lep_deliver_usec) >= LEP_TASK_FFC_IDLE_USEC))
+	{
+		lep_ffc_pending = true;
+	}
+#endif
+}
+
+
+/**
+ * Read a segment from the lepton following a vsync, loading complete frames into
+ * the frame pool
+ */
+static void lep_task_process_segment()
+{
+	lep_buffer_t* newP;
+	lep_buffer_t* doneP;
+	lep_buffer_t* outP;
+	lep_telem_t tel;
+	int64_t start_usec;
+	bool frame_done;
+	
+	// The segment must be read before the lepton starts the next one
+	pm_set_level(PM_USER_LEP, PM_LEVEL_FAST);
+	start_usec = esp_timer_get_time();
+	frame_done = vospi_transfer_segment(vsyncDetectedUsec);
+	perf_record(PERF_VOSPI_SEGMENT, esp_timer_get_time() - start_usec);
+	pm_set_level(PM_USER_LEP, PM_LEVEL_AWAKE);
+	perf_count(PERF_CNT_LEP_VSYNC);
+	lep_frame_boundary = frame_done;
+	
+	if (frame_done) {
+		lep_vsync_fail_count = 0;
+		lepton_recover_done();
+		perf_count(PERF_CNT_LEP_FRAME);
+		
+		if (lep_telem_only) {
+			// Just publish the telemetry, vospi keeps its frame buffer
+			portENTER_CRITICAL(&lep_telem_mux);
+			vospi_get_telem(lep_telem_sample);
+			if (++lep_telem_sample_seq == 0) lep_telem_sample_seq = 1;
+			portEXIT_CRITICAL(&lep_telem_mux);
+			lepton_decode_telem(lep_telem_sample, &tel);
+			lep_task_check_uptime(true, &tel);
+			lep_task_eval_ffc(&tel);
+			if (lep_task_gain_settled(true, &tel)) {
+				lep_task_update_sample(vsyncDetectedUsec, &tel, NULL);
 			}
+			return;
+		}
+		
+		// Swap the completed frame out of vospi for a free buffer.  If consumers are
+		// still holding every buffer then the new frame is dropped and vospi reuses
+		// its buffer.
+		newP = system_lep_frame_alloc();
+		if (newP == NULL) {
+			ESP_LOGE(TAG, "No free frame buffer - dropping frame");
+			return;
+		}
+		doneP = vospi_get_frame(newP);
+		lep_task_check_uptime(doneP->telem_valid, &doneP->telem);
+		lep_task_eval_ffc(doneP->telem_valid ? &doneP->telem : NULL);
+		
+		// Calibrate with the raw frames or correct them for every consumer
+		if (lep_cal_state != LEP_CAL_IDLE) {
+			lep_task_cal_frame(doneP);
+		} else {
+			lepton_correct_frame(doneP);
+		}
+		
+		// Drop a frame we already have (the stream repeated it) or one made before a
+		// gain mode change
+		if (doneP->telem_valid && !lep_task_check_frame_count(&doneP->telem)) {
+			system_lep_frame_release(doneP);
+			return;
 		}
+		if (!lep_task_gain_settled(doneP->telem_valid, &doneP->telem)) {
+			system_lep_frame_release(doneP);
+			return;
+		}
+		lep_task_update_sample(vsyncDetectedUsec, doneP->telem_valid ? &doneP->telem : NULL, doneP);
+		
+		if (lep_avg_enable) {
+			// Accumulate the frame and only publish the result when we have enough
+			lep_task_accumulate_frame(doneP);
+			if (lep_avg_count < LEP_AVG_NUM_FRAMES) {
+				system_lep_frame_release(doneP);
+				return;
+			}
+			
+			outP = system_lep_frame_alloc();
+			if (outP == NULL) {
+				ESP_LOGE(TAG, "No free frame buffer - dropping averaged frame");
+				system_lep_frame_release(doneP);
+				return;
+			}
+			lep_task_finish_average(outP, doneP);
+			system_lep_frame_release(doneP);
+			doneP = outP;
+		}
+		
+		system_lep_frame_release(lep_latest_frameP);
+		lep_latest_frameP = doneP;
+		lep_latest_frame_usec = vsyncDetectedUsec;
+		doneP->timestamp_usec = vsyncDetectedUsec;
+		
+		// Start a synchronized ArduCAM capture first as it is waiting for this frame
+		// (keeping the frame for the next request unless it's delivered now)
+		if (lep_sync_pending) {
+			lep_task_start_cam(!lep_frame_requested);
+		}
+		
+		// Hand the frame to file_task if we are recording every frame
+		if (lep_rec_enable) {
+			lep_task_record_frame();
+		}
+		
+		// Hand the frame to cmd_task if it is streaming frames over UDP
+		if (lep_udp_enable) {
+			lep_task_udp_frame();
+		}
+		
+		// Satisfy any outstanding request with the new frame
+		if (lep_frame_requested) {
+			lep_task_deliver_frame(lep_latest_frameP);
+		}
+	} else {
+		lep_task_note_segment_fail();
 	}
 }
 
+
+/**
+ * Account for a segment period that did not complete a frame, resynchronizing with
+ * the VoSPI stream if it looks like we've lost it and recovering the lepton if that
+ * doesn't bring the stream back
+ */
+static void lep_task_note_segment_fail()
+{
+	vospi_stats_t cur_stats;
+	
+	if (lepton_recover_booting()) {
+		// No stream until the lepton has rebooted
+		lep_vsync_fail_count = 0;
+		if (lep_frame_requested) {
+			lep_task_frame_failed();
+			lep_frame_requested = false;
+		}
+		return;
+	}
+	
+	if (++lep_vsync_fail_count == 1) {
+		vospi_get_stats(&lep_fail_start_stats);
+	}
+	
+	if (lep_vsync_fail_count == LEP_TASK_SYNC_ERR_FAIL) {
+		vospi_get_stats(&cur_stats);
+		if ((cur_stats.row_errors != lep_fail_start_stats.row_errors) ||
+		    (cur_stats.segment_errors != lep_fail_start_stats.segment_errors)) {
+		    // Misaligned with the stream so resynchronize now
+		    ESP_LOGI(TAG, "Resync lepton VoSPI stream");
+		    lep_vsync_fail_count = 0;
+		    vospi_resync();
+		    return;
+		}
+	}
+	
+	if (lep_vsync_fail_count == LEP_TASK_MAX_VSYNC_FAIL) {
+		// We have lost the VoSPI stream (for example the lepton is running a FFC)
+		ESP_LOGE(TAG, "Lost lepton VoSPI stream");
+		lep_vsync_fail_count = 0;
+		lep_check_needed = true;
+		
+		// Let app_task know we failed to get a frame if it is waiting
+		if (lep_frame_requested) {
+			lep_task_frame_failed();
+			lep_frame_requested = false;
+		}
+		
+		// Resynchronize, escalating to rebooting the lepton if the stream stays lost
+		(void) lepton_recover_stall();
+	}
+}
+
+
+/**
+ * Return true if the latest frame is recent enough to deliver
+ */
+static bool lep_task_latest_frame_valid()
+{
+	int64_t max_age;
+	
+	if (lep_latest_frameP == NULL) {
+		return false;
+	}
+	
+	// Averaged frames are only produced every LEP_AVG_NUM_FRAMES frame periods
+	max_age = LEP_TASK_MAX_FRAME_AGE_USEC;
+	if (lep_avg_enable) {
+		max_age += LEP_AVG_NUM_FRAMES * LEP_FRAME_USEC * 12;
+	}
+	
+	return ((esp_timer_get_time() - lep_latest_frame_usec) <= max_age);
+}
+
+
+/**
+ * Hand frameP (the latest or synchronized frame), with its own reference, to app_task
+ * and let it know.
+ */
+static void lep_task_deliver_frame(lep_buffer_t* frameP)
+{
+	system_lep_frame_hold(frameP);
+	if (!system_frame_event_post(SYS_FRAME_STREAM_LEP, frameP, frameP->timestamp_usec, 0)) {
+		system_lep_frame_release(frameP);
+	}
+	xTaskNotify(task_handle_app, APP_NOTIFY_LEP_FRAME_MASK, eSetBits);
+	lep_frame_requested = false;
+	lep_deliver_usec = esp_timer_get_time();
+	
+	// The capture is done so this is the time for a FFC that is due
+	if (lep_ffc_due) lep_ffc_pending = true;
+}
+
+
+/**
+ * Let app_task know we couldn't get the frame it asked for
+ */
+static void lep_task_frame_failed()
+{
+	(void) system_frame_event_post(SYS_FRAME_STREAM_LEP, NULL, 0, SYS_FRAME_FLAG_FAIL);
+	xTaskNotify(task_handle_app, APP_NOTIFY_LEP_FRAME_MASK, eSetBits);
+}
+
+
+/**
+ * Update the latest frame values from a new frame's telemetry (NULL if it has none) and
+ * frame (NULL in telemetry-only mode)
+ */
+static void lep_task_update_sample(int64_t vsync_usec, const lep_telem_t* telP, const lep_buffer_t* frameP)
+{
+	portENTER_CRITICAL(&lep_telem_mux);
+	lep_sample.timestamp_usec = vsync_usec;
+	lep_sample.telem_valid = (telP != NULL);
+	if (telP != NULL) {
+		lep_sample.fpa_temp_k100 = telP->fpa_temp_k100;
+		lep_sample.aux_temp_k100 = telP->aux_temp_k100;
+		lep_sample.tlin_scale = telP->tlin_scale;
+	}
+	lep_sample.frame_valid = (frameP != NULL);
+	if (frameP != NULL) {
+		lep_sample.min_val = frameP->lep_min_val;
+		lep_sample.max_val = frameP->lep_max_val;
+		if (telP == NULL) lep_sample.tlin_scale = frameP->telem.tlin_scale;
+	}
+	portEXIT_CRITICAL(&lep_telem_mux);
+}
+
+
+/**
+ * Publish the latest frame to file_task for high-rate recording if it is ready for one,
+ * otherwise drop the frame from the recording
+ */
+static void lep_task_record_frame()
+{
+	if (lep_rec_pending) {
+		lep_rec_drop_count++;
+		return;
+	}
+	
+	system_lep_frame_hold(lep_latest_frameP);
+	sys_lep_rec_bufferP = lep_latest_frameP;
+	lep_rec_pending = true;
+	xTaskNotify(task_handle_file, FILE_NOTIFY_NEW_LEP_RECORD_MASK, eSetBits);
+}
+
+
+/**
+ * Publish the latest frame to cmd_task for the UDP frame stream if it is ready for one.
+ * Frames are simply skipped if it is still sending the previous one.
+ */
+static void lep_task_udp_frame()
+{
+	if (lep_udp_pending) return;
+	
+	system_lep_frame_hold(lep_latest_frameP);
+	sys_lep_udp_bufferP = lep_latest_frameP;
+	lep_udp_pending = true;
+	cmd_task_notify(CMD_NOTIFY_LEP_FRAME_MASK);
+}
+
+
+/**
+ * Add a frame to the accumulator, starting a new accumulation if necessary
+ */
+static void lep_task_accumulate_frame(lep_buffer_t* frameP)
+{
+	uint32_t* aptr = lep_accum_bufferP;
+	uint16_t* fptr = frameP->lep_bufferP;
+	
+	if (lep_avg_count >= LEP_AVG_NUM_FRAMES) {
+		lep_avg_count = 0;
+	}
+	
+	if (lep_avg_count == 0) {
+		while (aptr < (lep_accum_bufferP + LEP_NUM_PIXELS)) {
+			*aptr++ = (uint32_t) *fptr++;
+		}
+	} else {
+		while (aptr < (lep_accum_bufferP + LEP_NUM_PIXELS)) {
+#ifdef LEP_AVG_OUTPUT_MAX
+			if (*fptr > *aptr) *aptr = *fptr;
+			aptr++;
+			fptr++;
+#else
+			*aptr++ += (uint32_t) *fptr++;
+#endif
+		}
+	}
+	
+	lep_avg_count++;
+}
+
+
+/**
+ * Load outP with the result of the accumulation.  Telemetry is taken from the last
+ * frame accumulated.
+ */
+static void lep_task_finish_average(lep_buffer_t* outP, lep_buffer_t* lastP)
+{
+	uint32_t* aptr = lep_accum_bufferP;
+	uint16_t* optr = outP->lep_bufferP;
+	uint16_t min = 0xFFFF;
+	uint16_t max = 0x0000;
+	uint16_t t16;
+	
+	while (aptr < (lep_accum_bufferP + LEP_NUM_PIXELS)) {
+#ifdef LEP_AVG_OUTPUT_MAX
+		t16 = (uint16_t) *aptr++;
+#else
+		t16 = (uint16_t) ((*aptr++ + (LEP_AVG_NUM_FRAMES/2)) / LEP_AVG_NUM_FRAMES);
+#endif
+		if (t16 < min) min = t16;
+		if (t16 > max) max = t16;
+		*optr++ = t16;
+	}
+	outP->lep_min_val = min;
+	outP->lep_max_val = max;
+	outP->hist_valid = false;
+	
+	outP->telem_valid = lastP->telem_valid;
+	outP->telem = lastP->telem;
+	if (lastP->telem_valid) {
+		memcpy(outP->lep_telemP, lastP->lep_telemP, LEP_TEL_WORDS*2);
+	}
+}
@@ -0,0 +1,372 @@
+/*
+ * Log Task
+ *
+ * Replaces the blocking UART output of the ESP_LOGx calls with a ring in the PSRAM so a
+ * task that logs never waits on the 115200 baud console.  Lines are formatted by the
+ * calling task into the ring and drained at low priority to the console and a client
+ * connected to LOG_PORT.  file_task appends them to a log file on the Micro-SD Card.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "log_task.h"
+#include "sys_utilities.h"
+#include "system_config.h"
+#include "wifi_utilities.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+
+//
+// Log Task private constants
+//
+#define LOG_RING_MASK (LOG_RING_LEN - 1)
+
+
+
+//
+// Log Task private variables
+//
+static const char* TAG = "log_task";
+
+// Ring and the positions (bytes written since startup) of the writer and each sink
+static char* log_ringP = NULL;
+static uint32_t log_wr;
+static uint32_t log_rd[LOG_SINK_NUM];
+static uint32_t log_lost[LOG_SINK_NUM];  // Bytes skipped since the sink last checked
+static portMUX_TYPE log_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// TCP log client
+static int log_listen_sock = -1;
+static int log_client_sock = -1;
+
+
+
+//
+// Log Task Forward Declarations for internal functions
+//
+static int log_vprintf(const char* fmt, va_list args);
+static void log_put(const char* bufP, uint32_t len);
+static void log_drain_console();
+static void log_check_client();
+static void log_drain_tcp();
+static void log_close_client();
+
+
+
+//
+// Log Task API
+//
+
+/**
+ * Allocate the ring and redirect the ESP_LOGx output to it.  Called first thing at
+ * startup so the boot log also reaches the log task's sinks.  Logging stays on the
+ * console if the ring can't be allocated.
+ */
+bool log_task_init()
+{
+	int i;
+	
+	log_ringP = heap_caps_malloc(LOG_RING_LEN, MALLOC_CAP_SPIRAM);
+	if (log_ringP == NULL) {
+		ESP_LOGE(TAG, "malloc log ring failed - logging directly to the console");
+		return false;
+	}
+	
+	log_wr = 0;
+	for (i=0; i<LOG_SINK_NUM; i++) {
+		log_rd[i] = 0;
+		log_lost[i] = 0;
+	}
+	
+	(void) esp_log_set_vprintf(log_vprintf);
+	
+	return true;
+}
+
+
+void log_task()
+{
+	uint32_t notification_value;
+	
+	ESP_LOGI(TAG, "Start task");
+	
+	// Loop sending new log data to the console and TCP client.  New data is signalled
+	// by every line written to the ring and we also wake periodically to look for a
+	// new TCP client.
+	while (1) {
+		notification_value = 0;
+		(void) xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, pdMS_TO_TICKS(LOG_EVAL_MSEC));
+	
+		if (log_ringP != NULL) {
+			log_drain_console();
+			log_check_client();
+			log_drain_tcp();
+		}
+	}
+}
+
+
+/**
+ * Get the next contiguous run of log data for sink.  Returns its length (0 if there
+ * isn't any) and sets *bufP to the data and *posP to its position for log_task_consume.
+ */
+uint32_t log_task_peek(int sink, char** bufP, uint32_t* posP)
+{
+	uint32_t len;
+	uint32_t pos;
+	
+	if (log_ringP == NULL) return 0;
+	
+	portENTER_CRITICAL(&log_mux);
+	pos = log_rd[sink];
+	len = log_wr - pos;
+	portEXIT_CRITICAL(&log_mux);
+	
+	if (len > (LOG_RING_LEN - (pos & LOG_RING_MASK))) {
+		len = LOG_RING_LEN - (pos & LOG_RING_MASK);
+	}
+	*bufP = &log_ringP[pos & LOG_RING_MASK];
+	*posP = pos;
+	
+	return len;
+}
+
+
+/**
+ * Mark len bytes from pos (from log_task_peek) as sent to sink.  Ignored if the sink
+ * was skipped ahead while it was sending them.
+ */
+void log_task_consume(int sink, uint32_t pos, uint32_t len)
+{
+	portENTER_CRITICAL(&log_mux);
+	if (log_rd[sink] == pos) {
+		log_rd[sink] += len;
+	}
+	portEXIT_CRITICAL(&log_mux);
+}
+
+
+/**
+ * Return the number of bytes sink missed since the last call
+ */
+uint32_t log_task_get_lost(int sink)
+{
+	uint32_t lost;
+	
+	portENTER_CRITICAL(&log_mux);
+	lost = log_lost[sink];
+	log_lost[sink] = 0;
+	portEXIT_CRITICAL(&log_mux);
+	
+	return lost;
+}
+
+
+
+//
+// Log Task internal functions
+//
+
+/**
+ * esp_log vprintf replacement - format a line into the ring and wake the log task
+ */
+static int log_vprintf(const char* fmt, va_list args)
+{
+	char buf[LOG_MAX_LINE_LEN];
+	int len;
+	
+	len = vsnprintf(buf, LOG_MAX_LINE_LEN, fmt, args);
+	if (len <= 0) return len;
+	if (len >= LOG_MAX_LINE_LEN) {
+		// Truncated - keep the line ending
+		len = LOG_MAX_LINE_LEN - 1;
+		buf[len-1] = '\n';
+	}
+	
+	log_put(buf, len);
+	
+	if (task_handle_log != NULL) {
+		xTaskNotify(task_handle_log, LOG_NOTIFY_DATA_MASK, eSetBits);
+	}
+	
+	return len;
+}
+
+
+/**
+ * Copy a line into the ring, skipping any sink that it overruns ahead to the next
+ * complete line
+ */
+static void log_put(const char* bufP, uint32_t len)
+{
+	uint32_t n;
+	uint32_t pos;
+	uint32_t rd;
+	uint32_t limit;
+	int i;
+	
+	portENTER_CRITICAL(&log_mux);
+	
+	pos = log_wr & LOG_RING_MASK;
+	n = LOG_RING_LEN - pos;
+	if (n > len) n = len;
+	memcpy(&log_ringP[pos], bufP, n);
+	if (n < len) {
+		memcpy(log_ringP, &bufP[n], len - n);
+	}
+	log_wr += len;
+	
+	for (i=0; i<LOG_SINK_NUM; i++) {
+		if ((log_wr - log_rd[i]) > LOG_RING_LEN) {
+			rd = log_wr - LOG_RING_LEN;
+			limit = rd + LOG_MAX_LINE_LEN;
+			while ((rd != log_wr) && (rd != limit)) {
+				if (log_ringP[(rd++) & LOG_RING_MASK] == '\n') break;
+			}
+			log_lost[i] += rd - log_rd[i];
+			log_rd[i] = rd;
+		}
+	}
+	
+	portEXIT_CRITICAL(&log_mux);
+}
+
+
+/**
+ * Write the new log data to the console
+ */
+static void log_drain_console()
+{
+	char* bufP;
+	uint32_t len;
+	uint32_t lost;
+	uint32_t pos;
+	
+	lost = log_task_get_lost(LOG_SINK_CONSOLE);
+	if (lost != 0) {
+		printf("--- %u log bytes lost ---\n", lost);
+	}
+	
+	while ((len = log_task_peek(LOG_SINK_CONSOLE, &bufP, &pos)) != 0) {
+		(void) fwrite(bufP, 1, len, stdout);
+		log_task_consume(LOG_SINK_CONSOLE, pos, len);
+	}
+	fflush(stdout);
+}
+
+
+/**
+ * Create the LOG_PORT listening socket once WiFi is up and accept a client.  A new
+ * client replaces the current one.  It is sent the log from the oldest line still in
+ * the ring.
+ */
+static void log_check_client()
+{
+	int flag = 1;
+	int sock;
+	struct sockaddr_in addr;
+	
+	if (log_listen_sock < 0) {
+		if (!wifi_is_connected()) return;
+	
+		log_listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+		if (log_listen_sock < 0) return;
+	
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(LOG_PORT);
+		setsockopt(log_listen_sock, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+		if ((bind(log_listen_sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+		    (listen(log_listen_sock, 1) != 0))
+		{
+			ESP_LOGE(TAG, "Unable to listen on the log port: errno %d", errno);
+			close(log_listen_sock);
+			log_listen_sock = -1;
+			return;
+		}
+		fcntl(log_listen_sock, F_SETFL, fcntl(log_listen_sock, F_GETFL, 0) | O_NONBLOCK);
+	}
+	
+	sock = accept(log_listen_sock, NULL, NULL);
+	if (sock >= 0) {
+		log_close_client();
+		fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+		log_client_sock = sock;
+		(void) log_task_get_lost(LOG_SINK_TCP);
+		ESP_LOGI(TAG, "Log client connected");
+	} else if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+		// The network went away - start over when it's back
+		log_close_client();
+		close(log_listen_sock);
+		log_listen_sock = -1;
+	}
+}
+
+
+/**
+ * Send the new log data to the TCP client as fast as it will take it
+ */
+static void log_drain_tcp()
+{
+	char* bufP;
+	char note[40];
+	int ret;
+	uint32_t len;
+	uint32_t lost;
+	uint32_t pos;
+	
+	if (log_client_sock < 0) return;
+	
+	lost = log_task_get_lost(LOG_SINK_TCP);
+	if (lost != 0) {
+		sprintf(note, "--- %u log bytes lost ---\n", lost);
+		(void) send(log_client_sock, note, strlen(note), 0);
+	}
+	
+	while ((len = log_task_peek(LOG_SINK_TCP, &bufP, &pos)) != 0) {
+		ret = send(log_client_sock, bufP, len, 0);
+		if (ret > 0) {
+			log_task_consume(LOG_SINK_TCP, pos, ret);
+		} else {
+			if ((ret == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+				log_close_client();
+			}
+			break;
+		}
+	}
+}
+
+
+static void log_close_client()
+{
+	if (log_client_sock >= 0) {
+		shutdown(log_client_sock, 0);
+		close(log_client_sock);
+		log_client_sock = -1;
+	}
+}
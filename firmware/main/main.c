@@ -26,8 +26,11 @@
  *   4. Soft-power pushbutton control, battery voltage detection and automatic low-battery
  *      shutdown.
  *   5. Time/Date and parameter storage in an externally battery-backed RTC.
- *   6. Operational and error logging to USB Serial interface.
+ *   6. Operational and error logging to USB Serial interface, a TCP log port and the
+ *      Micro-SD Card without blocking the logging task.
  *   7. Auto-restart on camera crash and automatic restart of recording.
+ *   8. Heartbeat monitoring of the main tasks, recovering a stalled task without
+ *      restarting the system where possible.
  *
  * Copyright 2020 Dan Julio
  *
@@ -52,12 +55,26 @@
 #include "esp_log.h"
 #include "adc_task.h"
 #include "app_task.h"
+#include "bench_task.h"
 #include "cam_task.h"
 #include "cmd_task.h"
 #include "file_task.h"
 #include "gui_task.h"
+#include "health_task.h"
+#include "http_task.h"
 #include "lep_task.h"
+#include "log_task.h"
 #include "mon_task.h"
+#include "ota_task.h"
+#include "render_task.h"
+#include "replay_task.h"
+#include "sync_task.h"
+#include "upload_task.h"
+#include "xfer_task.h"
+#include "play_task.h"
+#include "fork_utilities.h"
+#include "metadata_utilities.h"
+#include "pm_utilities.h"
 #include "system_config.h"
 #include "sys_utilities.h"
 
@@ -67,6 +84,9 @@ static const char* TAG = "main";
 
 void app_main(void)
 {
+    // Send the log through the log task's ring from here on
+    (void) log_task_init();
+    
     ESP_LOGI(TAG, "FireCAM startup");
     
     // Initialize the ESP32 IO pins, set PWR_EN to keep us powered up and initialize
@@ -76,32 +96,76 @@ void app_main(void)
     	system_shutoff();
     }
     
-    // After the IO has been set, holding power on, delay for > 950 mSec to allow
-    // the both the ArduCAM and Lepton to finish booting so the ArduCAM is accessible
-    // and the Lepton doesn't get confused by I2C traffic to other peripherals.
-    vTaskDelay(pdMS_TO_TICKS(1000));
-    
-    // Initialize the camera's peripheral devices: RTC, ADC, Arducam, Lepton
+    // Initialize the camera's peripheral devices: RTC, ADC, Arducam, Lepton.  This waits
+    // for the Lepton to finish booting before using the I2C bus and for the ArduCAM to
+    // become accessible.
     if (!system_peripheral_init()) {
     	ESP_LOGE(TAG, "FireCAM Peripheral init failed - shutting off");
     	system_shutoff();
     }
     
+    // Load the image metadata snapshot that adc_task and app_task keep up to date
+    metadata_init();
+    
     // Pre-allocate big buffers
     if (!system_buffer_init()) {
     	ESP_LOGE(TAG, "FireCAM memory allocate failed - shutting off");
     	system_shutoff();
     }
     
+    // Start the helper that splits the per-pixel kernels across both cores.  They just
+    // run on one core without it.
+    if (!fork_init()) {
+    	ESP_LOGE(TAG, "FireCAM fork helper start failed - single core kernels");
+    }
+    
+    // Start frequency scaling and light sleep.  Each task holds the level it needs.
+    (void) pm_init();
+    
     // Initialized: Start tasks
-    xTaskCreatePinnedToCore(&adc_task,  "adc_task",  2048, NULL, 1, &task_handle_adc,  1);
-    xTaskCreatePinnedToCore(&cam_task,  "cam_task",  2048, NULL, 2, &task_handle_cam,  1);
-    xTaskCreatePinnedToCore(&cmd_task,  "cmd_task",  3072, NULL, 1, &task_handle_cmd,  0);
-    xTaskCreatePinnedToCore(&file_task, "file_task", 3072, NULL, 1, &task_handle_file, 1);
-    xTaskCreatePinnedToCore(&gui_task,  "gui_task",  3072, NULL, 1, &task_handle_gui,  1);
-    xTaskCreatePinnedToCore(&lep_task,  "lep_task",  2048, NULL, 2, &task_handle_lep,  0);
-    xTaskCreatePinnedToCore(&app_task,  "app_task",  3072, NULL, 1, &task_handle_app,  1);
+    //   Stack sizes, priorities and core assignments come from the task table in
+    //   system_config.h.  Tasks for subsystems the feature profile leaves out aren't
+    //   started and their handles stay NULL.
+    ESP_LOGI(TAG, "Feature profile: %s", SYS_PROFILE_NAME);
+#ifdef SYS_TASK_PROFILE_REALTIME
+    ESP_LOGI(TAG, "Realtime capture task profile");
+#endif
+    xTaskCreatePinnedToCore(&adc_task,  "adc_task",  ADC_TASK_STACK,  NULL, ADC_TASK_PRIO,  &task_handle_adc,  ADC_TASK_CORE);
+#ifdef INCLUDE_SYS_REPLAY
+    // The replay sources run in place of the sensor tasks with their handles
+#ifdef INCLUDE_SYS_ARDUCAM
+    xTaskCreatePinnedToCore(&replay_cam_task, "replay_cam", REPLAY_TASK_STACK, NULL, CAM_TASK_PRIO, &task_handle_cam, CAM_TASK_CORE);
+#endif
+    xTaskCreatePinnedToCore(&replay_lep_task, "replay_lep", REPLAY_TASK_STACK, NULL, LEP_TASK_PRIO, &task_handle_lep, LEP_TASK_CORE);
+#elif defined(INCLUDE_SYS_ARDUCAM)
+    xTaskCreatePinnedToCore(&cam_task,  "cam_task",  CAM_TASK_STACK,  NULL, CAM_TASK_PRIO,  &task_handle_cam,  CAM_TASK_CORE);
+#endif
+    xTaskCreatePinnedToCore(&cmd_task,  "cmd_task",  CMD_TASK_STACK,  NULL, CMD_TASK_PRIO,  &task_handle_cmd,  CMD_TASK_CORE);
+    xTaskCreatePinnedToCore(&file_task, "file_task", FILE_TASK_STACK, NULL, FILE_TASK_PRIO, &task_handle_file, FILE_TASK_CORE);
+#ifdef INCLUDE_SYS_GUI
+    xTaskCreatePinnedToCore(&gui_task,  "gui_task",  GUI_TASK_STACK,  NULL, GUI_TASK_PRIO,  &task_handle_gui,  GUI_TASK_CORE);
+#endif
+    xTaskCreatePinnedToCore(&http_task, "http_task", HTTP_TASK_STACK, NULL, HTTP_TASK_PRIO, &task_handle_http, HTTP_TASK_CORE);
+#ifndef INCLUDE_SYS_REPLAY
+    xTaskCreatePinnedToCore(&lep_task,  "lep_task",  LEP_TASK_STACK,  NULL, LEP_TASK_PRIO,  &task_handle_lep,  LEP_TASK_CORE);
+#endif
+#ifdef INCLUDE_SYS_GUI
+    xTaskCreatePinnedToCore(&render_task, "render_task", RENDER_TASK_STACK, NULL, RENDER_TASK_PRIO, &task_handle_render, RENDER_TASK_CORE);
+#endif
+    xTaskCreatePinnedToCore(&app_task,  "app_task",  APP_TASK_STACK,  NULL, APP_TASK_PRIO,  &task_handle_app,  APP_TASK_CORE);
+    xTaskCreatePinnedToCore(&xfer_task, "xfer_task", XFER_TASK_STACK, NULL, XFER_TASK_PRIO, &task_handle_xfer, XFER_TASK_CORE);
+    xTaskCreatePinnedToCore(&log_task,  "log_task",  LOG_TASK_STACK,  NULL, LOG_TASK_PRIO,  &task_handle_log,  LOG_TASK_CORE);
+    xTaskCreatePinnedToCore(&sync_task, "sync_task", SYNC_TASK_STACK, NULL, SYNC_TASK_PRIO, &task_handle_sync, SYNC_TASK_CORE);
+    xTaskCreatePinnedToCore(&ota_task,  "ota_task",  OTA_TASK_STACK,  NULL, OTA_TASK_PRIO,  &task_handle_ota,  OTA_TASK_CORE);
+    xTaskCreatePinnedToCore(&upload_task, "upload_task", UPLOAD_TASK_STACK, NULL, UPLOAD_TASK_PRIO, &task_handle_upload, UPLOAD_TASK_CORE);
+#ifdef INCLUDE_SYS_GUI
+    xTaskCreatePinnedToCore(&play_task, "play_task", PLAY_TASK_STACK, NULL, PLAY_TASK_PRIO, &task_handle_play, PLAY_TASK_CORE);
+#endif
+    xTaskCreatePinnedToCore(&health_task, "health_task", HEALTH_TASK_STACK, NULL, HEALTH_TASK_PRIO, &task_handle_health, HEALTH_TASK_CORE);
 #ifdef INCLUDE_SYS_MON
-	xTaskCreatePinnedToCore(&mon_task,  "mon_task",  2048, NULL, 1, &task_handle_mon,  1);
+	xTaskCreatePinnedToCore(&mon_task,  "mon_task",  MON_TASK_STACK,  NULL, MON_TASK_PRIO,  &task_handle_mon,  MON_TASK_CORE);
+#endif
+#ifdef INCLUDE_SYS_BENCH
+	xTaskCreatePinnedToCore(&bench_task, "bench_task", BENCH_TASK_STACK, NULL, BENCH_TASK_PRIO, &task_handle_bench, BENCH_TASK_CORE);
 #endif
 }
@@ -0,0 +1,462 @@
+/*
+ * OTA Task
+ *
+ * Writes a firmware image arriving on a command connection into the inactive OTA
+ * partition.  cmd_task receives the image straight into one of a small set of buffers
+ * while ota_task writes the others to flash so the network and flash work overlap and
+ * the image is never held in memory.  The image's SHA-256 is checked against the one
+ * given with the command before it is made the boot image.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "ota_task.h"
+#include "app_task.h"
+#include "cmd_task.h"
+#include "sys_utilities.h"
+#include "system_config.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mbedtls/sha256.h"
+#include <string.h>
+
+
+
+//
+// OTA Task private variables
+//
+static const char* TAG = "ota_task";
+
+// Update being written (owned by the task once started)
+static const esp_partition_t* ota_partP;
+static esp_ota_handle_t ota_handle;
+static bool ota_open;                       // ota_handle is valid
+static mbedtls_sha256_context ota_sha_ctx;
+static uint8_t ota_sha256[32];              // Expected hash
+static bool ota_restart;                    // Restart into the new image when done
+
+// Image buffers.  Buffers ota_write_index onward (ota_full_count of them) are waiting
+// to be written.  The one after them is handed to cmd_task to fill.
+static uint8_t* ota_bufs[OTA_NUM_BUFFERS];
+static uint32_t ota_buf_len[OTA_NUM_BUFFERS];
+static int ota_write_index;
+static int ota_full_count;
+static bool ota_cmd_holding;                // cmd_task is filling a buffer
+static bool ota_cmd_released;               // cmd_task is done with the buffers
+static int64_t ota_data_usec;               // Last time image data arrived or was written
+
+// Status for other tasks
+static ota_status_t ota_status = {OTA_STATE_IDLE, 0, 0, NULL, NULL};
+static portMUX_TYPE ota_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+
+//
+// OTA Task Forward Declarations for internal functions
+//
+static void ota_begin();
+static bool ota_write_next();
+static void ota_finish();
+static void ota_fail(const char* reason);
+static esp_err_t ota_close();
+static void ota_set_result(int state, const char* result);
+static void ota_free_buffers_if_done();
+
+
+
+//
+// OTA Task API
+//
+void ota_task()
+{
+	uint32_t notification_value;
+	
+	ESP_LOGI(TAG, "Start task");
+	
+	while (1) {
+		notification_value = 0;
+		(void) xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, pdMS_TO_TICKS(OTA_EVAL_MSEC));
+	
+		if (Notification(notification_value, OTA_NOTIFY_START_MASK)) {
+			ota_begin();
+		}
+	
+		if (Notification(notification_value, OTA_NOTIFY_ABORT_MASK) && (ota_status.state == OTA_STATE_ACTIVE)) {
+			ota_fail("Aborted");
+		}
+	
+		// Write the buffers cmd_task has filled, pausing between sectors
+		while (ota_write_next()) {
+			vTaskDelay(pdMS_TO_TICKS(OTA_SECTOR_GAP_MSEC));
+		}
+	
+		if ((ota_status.state == OTA_STATE_ACTIVE) &&
+		    ((esp_timer_get_time() - ota_data_usec) > (OTA_TIMEOUT_MSEC * 1000)))
+		{
+			ota_fail("Timeout");
+		}
+	}
+}
+
+
+/**
+ * Called by cmd_task to start an update of a length byte image with the given SHA-256.
+ * Returns false, with why in statusP, if it can't be started.  Otherwise statusP holds
+ * the new update's status and cmd_task follows with the image using
+ * ota_task_get_buffer and ota_task_put_buffer.  It must call ota_task_release when it
+ * is done with the update.
+ */
+bool ota_task_start(uint32_t length, const uint8_t* sha256, bool restart, ota_status_t* statusP)
+{
+	const esp_partition_t* partP;
+	bool busy;
+	int i;
+	
+	memset(statusP, 0, sizeof(ota_status_t));
+	statusP->state = OTA_STATE_FAILED;
+	statusP->length = length;
+	
+	// Only one update at a time
+	portENTER_CRITICAL(&ota_mux);
+	busy = (ota_status.state == OTA_STATE_ACTIVE) || (ota_bufs[0] != NULL);
+	portEXIT_CRITICAL(&ota_mux);
+	if (busy) {
+		statusP->result = "Busy";
+		return false;
+	}
+	
+	partP = esp_ota_get_next_update_partition(NULL);
+	if (partP == NULL) {
+		ESP_LOGE(TAG, "No OTA partition");
+		statusP->result = "No OTA partition";
+		return false;
+	}
+	statusP->partition = partP->label;
+	if ((length == 0) || (length > partP->size)) {
+		ESP_LOGE(TAG, "Illegal image length %u", length);
+		statusP->result = "Illegal length";
+		return false;
+	}
+	
+	// Flash is written from internal memory
+	for (i=0; i<OTA_NUM_BUFFERS; i++) {
+		ota_bufs[i] = heap_caps_malloc(OTA_BUFFER_LEN, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+		if (ota_bufs[i] == NULL) {
+			ESP_LOGE(TAG, "malloc OTA buffer failed");
+			while (i-- > 0) {
+				heap_caps_free(ota_bufs[i]);
+				ota_bufs[i] = NULL;
+			}
+			statusP->result = "No memory";
+			return false;
+		}
+	}
+	
+	ota_partP = partP;
+	memcpy(ota_sha256, sha256, sizeof(ota_sha256));
+	ota_restart = restart;
+	
+	portENTER_CRITICAL(&ota_mux);
+	ota_write_index = 0;
+	ota_full_count = 0;
+	ota_cmd_holding = false;
+	ota_cmd_released = false;
+	ota_data_usec = esp_timer_get_time();
+	ota_status.state = OTA_STATE_ACTIVE;
+	ota_status.length = length;
+	ota_status.written = 0;
+	ota_status.partition = partP->label;
+	ota_status.result = NULL;
+	*statusP = ota_status;
+	portEXIT_CRITICAL(&ota_mux);
+	
+	ESP_LOGI(TAG, "Start %u byte update of %s", length, partP->label);
+	xTaskNotify(task_handle_ota, OTA_NOTIFY_START_MASK, eSetBits);
+	
+	return true;
+}
+
+
+/**
+ * Called by cmd_task to get an empty OTA_BUFFER_LEN buffer for the next part of the
+ * image.  Returns NULL if none is free or the update is no longer running.  cmd_task
+ * is notified with CMD_NOTIFY_OTA_MASK when a buffer is freed.
+ */
+uint8_t* ota_task_get_buffer()
+{
+	uint8_t* bufP = NULL;
+	
+	portENTER_CRITICAL(&ota_mux);
+	if ((ota_status.state == OTA_STATE_ACTIVE) && !ota_cmd_holding && (ota_full_count < OTA_NUM_BUFFERS)) {
+		bufP = ota_bufs[(ota_write_index + ota_full_count) % OTA_NUM_BUFFERS];
+		ota_cmd_holding = true;
+	}
+	portEXIT_CRITICAL(&ota_mux);
+	
+	return bufP;
+}
+
+
+/**
+ * Called by cmd_task to hand back the buffer from ota_task_get_buffer holding len bytes
+ * of the image.  Every buffer but the image's last must be full.
+ */
+void ota_task_put_buffer(uint32_t len)
+{
+	portENTER_CRITICAL(&ota_mux);
+	if ((ota_status.state == OTA_STATE_ACTIVE) && ota_cmd_holding) {
+		ota_buf_len[(ota_write_index + ota_full_count) % OTA_NUM_BUFFERS] = len;
+		ota_full_count++;
+		ota_data_usec = esp_timer_get_time();
+	}
+	ota_cmd_holding = false;
+	portEXIT_CRITICAL(&ota_mux);
+	
+	xTaskNotify(task_handle_ota, OTA_NOTIFY_DATA_MASK, eSetBits);
+}
+
+
+/**
+ * Called by cmd_task when it is done with an update it started (it has its result or
+ * the client went away).  An unfinished update is aborted.  The buffers are freed once
+ * ota_task is done with them too.
+ */
+void ota_task_release()
+{
+	bool active;
+	
+	portENTER_CRITICAL(&ota_mux);
+	ota_cmd_released = true;
+	ota_cmd_holding = false;
+	active = (ota_status.state == OTA_STATE_ACTIVE);
+	portEXIT_CRITICAL(&ota_mux);
+	
+	if (active) {
+		xTaskNotify(task_handle_ota, OTA_NOTIFY_ABORT_MASK, eSetBits);
+	} else {
+		ota_free_buffers_if_done();
+	}
+}
+
+
+void ota_task_get_status(ota_status_t* statusP)
+{
+	portENTER_CRITICAL(&ota_mux);
+	*statusP = ota_status;
+	portEXIT_CRITICAL(&ota_mux);
+}
+
+
+
+//
+// OTA Task internal functions
+//
+
+/**
+ * Open the update.  esp_ota_begin is told the image is one byte long so it only erases
+ * the first sector.  ota_write_next erases the rest one sector at a time.
+ */
+static void ota_begin()
+{
+	esp_err_t err;
+	
+	if (ota_status.state != OTA_STATE_ACTIVE) return;
+	
+	err = esp_ota_begin(ota_partP, 1, &ota_handle);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "esp_ota_begin failed - %d", err);
+		ota_fail("Begin failed");
+		return;
+	}
+	ota_open = true;
+	
+	mbedtls_sha256_init(&ota_sha_ctx);
+	(void) mbedtls_sha256_starts_ret(&ota_sha_ctx, 0);
+}
+
+
+/**
+ * Write the next filled buffer to flash.  Returns true if one was written.
+ */
+static bool ota_write_next()
+{
+	esp_err_t err;
+	uint8_t* bufP;
+	uint32_t len;
+	uint32_t offset;
+	bool done;
+	
+	if (!ota_open) return false;
+	
+	portENTER_CRITICAL(&ota_mux);
+	if ((ota_status.state != OTA_STATE_ACTIVE) || (ota_full_count == 0)) {
+		portEXIT_CRITICAL(&ota_mux);
+		return false;
+	}
+	bufP = ota_bufs[ota_write_index];
+	len = ota_buf_len[ota_write_index];
+	offset = ota_status.written;
+	portEXIT_CRITICAL(&ota_mux);
+	
+	// Each buffer is one sector (the first was erased by esp_ota_begin)
+	if (offset != 0) {
+		err = esp_partition_erase_range(ota_partP, offset, OTA_BUFFER_LEN);
+		if (err != ESP_OK) {
+			ESP_LOGE(TAG, "Erase at %u failed - %d", offset, err);
+			ota_fail("Erase failed");
+			return false;
+		}
+	}
+	
+	err = esp_ota_write(ota_handle, bufP, len);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "esp_ota_write at %u failed - %d", offset, err);
+		ota_fail((err == ESP_ERR_OTA_VALIDATE_FAILED) ? "Not a firmware image" : "Write failed");
+		return false;
+	}
+	(void) mbedtls_sha256_update_ret(&ota_sha_ctx, bufP, len);
+	
+	portENTER_CRITICAL(&ota_mux);
+	ota_status.written += len;
+	ota_full_count--;
+	ota_write_index = (ota_write_index + 1) % OTA_NUM_BUFFERS;
+	ota_data_usec = esp_timer_get_time();
+	done = (ota_status.written >= ota_status.length);
+	portEXIT_CRITICAL(&ota_mux);
+	
+	if (done) {
+		ota_finish();
+	} else {
+		// cmd_task may be waiting for a buffer
+		cmd_task_notify(CMD_NOTIFY_OTA_MASK);
+	}
+	
+	return true;
+}
+
+
+/**
+ * Check the complete image and make it the boot image
+ */
+static void ota_finish()
+{
+	esp_err_t err;
+	uint8_t sha256[32];
+	
+	(void) mbedtls_sha256_finish_ret(&ota_sha_ctx, sha256);
+	
+	// esp_ota_end validates the image
+	err = ota_close();
+	if (memcmp(sha256, ota_sha256, sizeof(sha256)) != 0) {
+		ESP_LOGE(TAG, "SHA-256 mismatch");
+		ota_set_result(OTA_STATE_FAILED, "SHA-256 mismatch");
+		return;
+	}
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "esp_ota_end failed - %d", err);
+		ota_set_result(OTA_STATE_FAILED, "Invalid image");
+		return;
+	}
+	
+	err = esp_ota_set_boot_partition(ota_partP);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "esp_ota_set_boot_partition failed - %d", err);
+		ota_set_result(OTA_STATE_FAILED, "Set boot partition failed");
+		return;
+	}
+	
+	ESP_LOGI(TAG, "Update of %s done", ota_partP->label);
+	ota_set_result(OTA_STATE_DONE, "OK");
+	
+	if (ota_restart) {
+		// Give cmd_task time to send the result
+		vTaskDelay(pdMS_TO_TICKS(OTA_RESTART_DELAY_MSEC));
+		xTaskNotify(task_handle_app, APP_NOTIFY_RESTART_MASK, eSetBits);
+	}
+}
+
+
+static void ota_fail(const char* reason)
+{
+	ESP_LOGE(TAG, "Update failed: %s", reason);
+	(void) ota_close();
+	ota_set_result(OTA_STATE_FAILED, reason);
+}
+
+
+/**
+ * End the update if it is open, returning esp_ota_end's result
+ */
+static esp_err_t ota_close()
+{
+	esp_err_t err = ESP_OK;
+	
+	if (ota_open) {
+		ota_open = false;
+		mbedtls_sha256_free(&ota_sha_ctx);
+		err = esp_ota_end(ota_handle);
+	}
+	
+	return err;
+}
+
+
+/**
+ * Finish the update with result and let cmd_task know
+ */
+static void ota_set_result(int state, const char* result)
+{
+	portENTER_CRITICAL(&ota_mux);
+	ota_status.state = state;
+	ota_status.result = result;
+	ota_full_count = 0;
+	portEXIT_CRITICAL(&ota_mux);
+	
+	ota_free_buffers_if_done();
+	cmd_task_notify(CMD_NOTIFY_OTA_MASK);
+}
+
+
+/**
+ * Free the buffers once the update is over and cmd_task has released them
+ */
+static void ota_free_buffers_if_done()
+{
+	uint8_t* bufs[OTA_NUM_BUFFERS];
+	bool done;
+	int i;
+	
+	portENTER_CRITICAL(&ota_mux);
+	done = ota_cmd_released && (ota_status.state != OTA_STATE_ACTIVE);
+	for (i=0; i<OTA_NUM_BUFFERS; i++) {
+		bufs[i] = done ? ota_bufs[i] : NULL;
+		if (done) ota_bufs[i] = NULL;
+	}
+	portEXIT_CRITICAL(&ota_mux);
+	
+	for (i=0; i<OTA_NUM_BUFFERS; i++) {
+		if (bufs[i] != NULL) {
+			heap_caps_free(bufs[i]);
+		}
+	}
+}
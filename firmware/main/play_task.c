@@ -0,0 +1,640 @@
+/*
+ * Play Task
+ *
+ * Reads the images of a recording session back from the Micro-SD Card for the playback
+ * screen.  Images are read in session index order from the current position into
+ * PLAY_NUM_FRAMES read-ahead buffers and decoded as far as the radiometric pixels (the
+ * jpeg image is left for render_task to decode).  The GUI takes one frame at a time and
+ * releases it once it has been drawn.  Runs alongside file_task (FATFS serializes their
+ * accesses) and waits while file_task has recorded images queued so playback never
+ * slows a recording.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "play_task.h"
+#include "system_config.h"
+
+#ifdef INCLUDE_SYS_GUI
+
+#include "app_task.h"
+#include "file_task.h"
+#include "binrec_utilities.h"
+#include "file_utilities.h"
+#include "json_utilities.h"
+#include "lepton_utilities.h"
+#include "sys_utilities.h"
+#include "vospi.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "ff.h"
+#include <stdio.h>
+#include <string.h>
+
+
+
+//
+// Play Task constants
+//
+
+// Read-ahead frame buffer states
+#define PLAY_SLOT_FREE         0
+#define PLAY_SLOT_READY        1
+#define PLAY_SLOT_HELD         2
+
+
+
+//
+// Play Task variables
+//
+static const char* TAG = "play_task";
+
+// Read-ahead frames.  A frame is only handed out if it was read for the current
+// generation, which each open and seek advances so frames read for an old position are
+// dropped.
+static play_frame_t play_frames[PLAY_NUM_FRAMES];
+static int play_slot_state[PLAY_NUM_FRAMES];
+static uint32_t play_slot_gen[PLAY_NUM_FRAMES];
+static bool play_frames_allocated = false;
+
+// Shared state (with the GUI)
+static play_info_t play_info = {PLAY_STATE_CLOSED, "", 0};
+static uint32_t play_gen = 0;
+static uint32_t play_seek_pos;
+static int play_open_dir;
+static portMUX_TYPE play_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Reading state
+static uint32_t play_read_gen;
+static uint32_t play_read_pos;              // Next index position to read
+static uint16_t play_entry_len;             // Session index entry length
+
+// FATFS objects (with their sector buffers and long names) are kept off the stack
+static FIL play_fil;
+static FILINFO play_fi;
+
+
+
+//
+// Play Task Forward Declarations for internal functions
+//
+static bool play_alloc_frames();
+static void play_free_frames();
+static void play_open_session(int dir);
+static bool play_find_session(int dir, char* name);
+static uint32_t play_read_index_count(const char* name);
+static int play_get_free_slot();
+static void play_read_next(int slot);
+static bool play_read_frame(play_frame_t* frameP, uint32_t pos);
+static bool play_read_entry(uint32_t pos, file_index_entry_t* entryP);
+static bool play_read_image(const file_index_entry_t* entryP, uint8_t* bufP, uint32_t* lenP);
+static void play_wait_recording();
+static void play_drop_ready();
+
+
+
+//
+// Play Task API
+//
+void play_task()
+{
+	uint32_t notification_value;
+	TickType_t wait;
+	int slot;
+	
+	ESP_LOGI(TAG, "Start task");
+	
+	while (1) {
+		// Keep reading while there are images left and a free buffer to read them into
+		slot = (play_info.state == PLAY_STATE_OPEN) && (play_read_pos < play_info.count) ?
+		       play_get_free_slot() : -1;
+		wait = (slot < 0) ? portMAX_DELAY : 0;
+	
+		if (xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, wait)) {
+			if (Notification(notification_value, PLAY_NOTIFY_CLOSE_MASK)) {
+				portENTER_CRITICAL(&play_mux);
+				play_info.state = PLAY_STATE_CLOSED;
+				portEXIT_CRITICAL(&play_mux);
+			}
+	
+			if (Notification(notification_value, PLAY_NOTIFY_OPEN_MASK)) {
+				play_open_session(play_open_dir);
+			}
+	
+			// Free the buffers once closed and the GUI has released its frame
+			if (play_info.state == PLAY_STATE_CLOSED) {
+				play_free_frames();
+			}
+	
+			if (Notification(notification_value, PLAY_NOTIFY_SEEK_MASK)) {
+				portENTER_CRITICAL(&play_mux);
+				play_read_gen = play_gen;
+				play_read_pos = play_seek_pos;
+				portEXIT_CRITICAL(&play_mux);
+			}
+	
+			// A released buffer (PLAY_NOTIFY_FREE_MASK) is found by play_get_free_slot or freed
+			continue;
+		}
+	
+		play_wait_recording();
+		play_read_next(slot);
+	}
+}
+
+
+/**
+ * Open the newest session or the session older or newer than the current one
+ * (PLAY_OPEN_*).  The current session stays open if there isn't one.
+ */
+void play_task_open(int dir)
+{
+	portENTER_CRITICAL(&play_mux);
+	play_open_dir = dir;
+	play_gen++;
+	play_drop_ready();
+	if (play_info.state != PLAY_STATE_OPEN) {
+		play_info.state = PLAY_STATE_OPENING;
+	}
+	portEXIT_CRITICAL(&play_mux);
+	
+	xTaskNotify(task_handle_play, PLAY_NOTIFY_OPEN_MASK, eSetBits);
+}
+
+
+/**
+ * Continue playback from index position pos.  Frames already read for other positions
+ * are dropped.
+ */
+void play_task_seek(uint32_t pos)
+{
+	portENTER_CRITICAL(&play_mux);
+	play_seek_pos = pos;
+	play_gen++;
+	play_drop_ready();
+	portEXIT_CRITICAL(&play_mux);
+	
+	xTaskNotify(task_handle_play, PLAY_NOTIFY_SEEK_MASK, eSetBits);
+}
+
+
+/**
+ * Stop reading ahead
+ */
+void play_task_close()
+{
+	portENTER_CRITICAL(&play_mux);
+	play_gen++;
+	play_drop_ready();
+	portEXIT_CRITICAL(&play_mux);
+	
+	xTaskNotify(task_handle_play, PLAY_NOTIFY_CLOSE_MASK, eSetBits);
+}
+
+
+/**
+ * Get the playback state and open session
+ */
+void play_task_get_info(play_info_t* infoP)
+{
+	portENTER_CRITICAL(&play_mux);
+	*infoP = play_info;
+	portEXIT_CRITICAL(&play_mux);
+}
+
+
+/**
+ * Take the next frame (the one read for the lowest index position since the last open
+ * or seek).  Returns NULL if it hasn't been read yet.  The frame must be released with
+ * play_task_release_frame.
+ */
+play_frame_t* play_task_get_frame()
+{
+	int i;
+	int slot = -1;
+	
+	portENTER_CRITICAL(&play_mux);
+	for (i=0; i<PLAY_NUM_FRAMES; i++) {
+		if ((play_slot_state[i] == PLAY_SLOT_READY) && (play_slot_gen[i] == play_gen) &&
+		    ((slot < 0) || (play_frames[i].pos < play_frames[slot].pos)))
+		{
+			slot = i;
+		}
+	}
+	if (slot >= 0) {
+		play_slot_state[slot] = PLAY_SLOT_HELD;
+	}
+	portEXIT_CRITICAL(&play_mux);
+	
+	return (slot < 0) ? NULL : &play_frames[slot];
+}
+
+
+/**
+ * Release a frame taken with play_task_get_frame so its buffer can be reused
+ */
+void play_task_release_frame(play_frame_t* frameP)
+{
+	int slot = frameP - play_frames;
+	
+	if ((slot < 0) || (slot >= PLAY_NUM_FRAMES)) return;
+	
+	portENTER_CRITICAL(&play_mux);
+	play_slot_state[slot] = PLAY_SLOT_FREE;
+	portEXIT_CRITICAL(&play_mux);
+	
+	xTaskNotify(task_handle_play, PLAY_NOTIFY_FREE_MASK, eSetBits);
+}
+
+
+
+//
+// Play Task internal functions
+//
+
+/**
+ * Allocate the read-ahead frame buffers in PSRAM if they aren't already.  Returns false
+ * (with none allocated) if there isn't room.
+ */
+static bool play_alloc_frames()
+{
+	play_frame_t* fP;
+	int i;
+	
+	if (play_frames_allocated) return true;
+	
+	for (i=0; i<PLAY_NUM_FRAMES; i++) {
+		fP = &play_frames[i];
+		memset(fP, 0, sizeof(play_frame_t));
+		fP->bufP = heap_caps_malloc(PLAY_FRAME_BUF_LEN, MALLOC_CAP_SPIRAM);
+		fP->lep.lep_bufferP = heap_caps_malloc(LEP_NUM_PIXELS*2, MALLOC_CAP_SPIRAM);
+		fP->lep.lep_telemP = heap_caps_malloc(LEP_TEL_WORDS*2, MALLOC_CAP_SPIRAM);
+		play_slot_state[i] = PLAY_SLOT_FREE;
+	}
+	play_frames_allocated = true;
+	
+	for (i=0; i<PLAY_NUM_FRAMES; i++) {
+		fP = &play_frames[i];
+		if ((fP->bufP == NULL) || (fP->lep.lep_bufferP == NULL) || (fP->lep.lep_telemP == NULL)) {
+			play_free_frames();
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+
+/**
+ * Free the read-ahead frame buffers unless the GUI still holds a frame (none are read
+ * or handed out once closed)
+ */
+static void play_free_frames()
+{
+	play_frame_t* fP;
+	bool held = false;
+	int i;
+	
+	if (!play_frames_allocated) return;
+	
+	portENTER_CRITICAL(&play_mux);
+	for (i=0; i<PLAY_NUM_FRAMES; i++) {
+		if (play_slot_state[i] == PLAY_SLOT_HELD) held = true;
+	}
+	portEXIT_CRITICAL(&play_mux);
+	if (held) return;
+	
+	for (i=0; i<PLAY_NUM_FRAMES; i++) {
+		fP = &play_frames[i];
+		heap_caps_free(fP->bufP);
+		heap_caps_free(fP->lep.lep_bufferP);
+		heap_caps_free(fP->lep.lep_telemP);
+		fP->bufP = NULL;
+		fP->lep.lep_bufferP = NULL;
+		fP->lep.lep_telemP = NULL;
+	}
+	play_frames_allocated = false;
+}
+
+
+/**
+ * Find and open a session, reading from its first image
+ */
+static void play_open_session(int dir)
+{
+	char name[SESSION_DIR_NAME_LEN];
+	uint32_t count;
+	
+	portENTER_CRITICAL(&play_mux);
+	strcpy(name, play_info.session);
+	portEXIT_CRITICAL(&play_mux);
+	
+	if (!play_alloc_frames()) {
+		ESP_LOGE(TAG, "Could not allocate frame buffers");
+		portENTER_CRITICAL(&play_mux);
+		play_info.state = PLAY_STATE_EMPTY;
+		play_info.count = 0;
+		portEXIT_CRITICAL(&play_mux);
+		return;
+	}
+	
+	if (!play_find_session(dir, name)) {
+		if (play_info.state == PLAY_STATE_OPEN) {
+			// Keep the current session, starting it again
+			count = play_read_index_count(name);
+		} else {
+			name[0] = 0;
+			count = 0;
+		}
+	} else {
+		count = play_read_index_count(name);
+	}
+	
+	portENTER_CRITICAL(&play_mux);
+	strcpy(play_info.session, name);
+	play_info.count = count;
+	play_info.state = (count != 0) ? PLAY_STATE_OPEN : PLAY_STATE_EMPTY;
+	play_read_gen = play_gen;
+	play_read_pos = 0;
+	portEXIT_CRITICAL(&play_mux);
+	
+	ESP_LOGI(TAG, "Open %s: %u images", (name[0] != 0) ? name : "(none)", count);
+}
+
+
+/**
+ * Find the newest session directory or the newest older (oldest newer) than name.
+ * Returns false if there isn't one.  Session names sort in age order.
+ */
+static bool play_find_session(int dir, char* name)
+{
+	FF_DIR dir_obj;
+	char found[SESSION_DIR_NAME_LEN];
+	
+	found[0] = 0;
+	if (!file_get_card_mounted() || (f_opendir(&dir_obj, "/") != FR_OK)) {
+		return false;
+	}
+	
+	while ((f_readdir(&dir_obj, &play_fi) == FR_OK) && (play_fi.fname[0] != 0)) {
+		if (((play_fi.fattrib & AM_DIR) == 0) ||
+		    (strncmp(play_fi.fname, SESSION_DIR_PREFIX, strlen(SESSION_DIR_PREFIX)) != 0) ||
+		    (strlen(play_fi.fname) >= SESSION_DIR_NAME_LEN))
+		{
+			continue;
+		}
+	
+		if ((dir == PLAY_OPEN_OLDER) && (name[0] != 0)) {
+			if ((strcmp(play_fi.fname, name) < 0) &&
+			    ((found[0] == 0) || (strcmp(play_fi.fname, found) > 0)))
+			{
+				strcpy(found, play_fi.fname);
+			}
+		} else if ((dir == PLAY_OPEN_NEWER) && (name[0] != 0)) {
+			if ((strcmp(play_fi.fname, name) > 0) &&
+			    ((found[0] == 0) || (strcmp(play_fi.fname, found) < 0)))
+			{
+				strcpy(found, play_fi.fname);
+			}
+		} else if ((found[0] == 0) || (strcmp(play_fi.fname, found) > 0)) {
+			strcpy(found, play_fi.fname);
+		}
+	}
+	f_closedir(&dir_obj);
+	
+	if (found[0] == 0) return false;
+	
+	strcpy(name, found);
+	return true;
+}
+
+
+/**
+ * Return the number of entries in a session's index file (0 if it doesn't have a valid
+ * one).  Sets the entry length used to read them.
+ */
+static uint32_t play_read_index_count(const char* name)
+{
+	char path[PLAY_MAX_PATH_LEN];
+	file_index_header_t hdr;
+	uint32_t n = 0;
+	UINT br;
+	
+	if (!file_get_card_mounted()) return 0;
+	
+	snprintf(path, PLAY_MAX_PATH_LEN, "/%s/%s", name, INDEX_FILE_NAME);
+	if (f_open(&play_fil, path, FA_READ) != FR_OK) return 0;
+	
+	if ((f_read(&play_fil, &hdr, sizeof(hdr), &br) == FR_OK) && (br == sizeof(hdr)) &&
+	    (hdr.magic == FILE_INDEX_MAGIC) && (hdr.entry_len >= sizeof(file_index_entry_t)))
+	{
+		play_entry_len = hdr.entry_len;
+		n = (f_size(&play_fil) - sizeof(hdr)) / hdr.entry_len;
+	}
+	
+	f_close(&play_fil);
+	return n;
+}
+
+
+/**
+ * Return a free read-ahead buffer or -1 if they are all in use
+ */
+static int play_get_free_slot()
+{
+	int i;
+	int slot = -1;
+	
+	portENTER_CRITICAL(&play_mux);
+	for (i=0; i<PLAY_NUM_FRAMES; i++) {
+		if (play_slot_state[i] == PLAY_SLOT_FREE) {
+			slot = i;
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&play_mux);
+	
+	return slot;
+}
+
+
+/**
+ * Read the image at the read position into a free buffer.  An image that can't be read
+ * is skipped.  The frame is dropped if an open or seek happened while it was read.
+ */
+static void play_read_next(int slot)
+{
+	play_frame_t* frameP = &play_frames[slot];
+	uint32_t pos = play_read_pos++;
+	bool success;
+	
+	success = play_read_frame(frameP, pos);
+	if (!success) {
+		ESP_LOGE(TAG, "Could not read image %u of %s", pos, play_info.session);
+	}
+	
+	portENTER_CRITICAL(&play_mux);
+	if (success && (play_read_gen == play_gen)) {
+		play_slot_state[slot] = PLAY_SLOT_READY;
+		play_slot_gen[slot] = play_read_gen;
+	}
+	portEXIT_CRITICAL(&play_mux);
+}
+
+
+/**
+ * Load frameP with the image at index position pos
+ */
+static bool play_read_frame(play_frame_t* frameP, uint32_t pos)
+{
+	file_index_entry_t entry;
+	lep_buffer_t* lepP = &frameP->lep;
+	uint16_t* p;
+	uint16_t min = 0xFFFF;
+	uint16_t max = 0x0000;
+	uint32_t len;
+	bool success;
+	
+	if (!play_read_entry(pos, &entry) || !play_read_image(&entry, frameP->bufP, &len)) {
+		return false;
+	}
+	
+	if (entry.type == FILE_CONTAINER_TYPE_FCR) {
+		success = binrec_parse_record(frameP->bufP, len, lepP, &frameP->has_lep,
+		                              &frameP->jpegP, &frameP->jpeg_len);
+	} else {
+		success = json_parse_image_string((char*) frameP->bufP, len, lepP, &frameP->has_lep,
+		                                  &frameP->jpegP, &frameP->jpeg_len);
+	}
+	if (!success) return false;
+	
+	frameP->pos = pos;
+	frameP->epoch_sec = entry.epoch_sec;
+	
+	if (frameP->has_lep) {
+		p = lepP->lep_bufferP;
+		while (p < (lepP->lep_bufferP + LEP_NUM_PIXELS)) {
+			if (*p < min) min = *p;
+			if (*p > max) max = *p;
+			p++;
+		}
+		lepP->lep_min_val = min;
+		lepP->lep_max_val = max;
+		lepP->hist_valid = false;
+		lepton_decode_telem(lepP->telem_valid ? lepP->lep_telemP : NULL, &lepP->telem);
+	}
+	
+	return true;
+}
+
+
+/**
+ * Read the session index entry at pos
+ */
+static bool play_read_entry(uint32_t pos, file_index_entry_t* entryP)
+{
+	char path[PLAY_MAX_PATH_LEN];
+	bool success;
+	UINT br;
+	
+	if (!file_get_card_mounted()) return false;
+	
+	snprintf(path, PLAY_MAX_PATH_LEN, "/%s/%s", play_info.session, INDEX_FILE_NAME);
+	if (f_open(&play_fil, path, FA_READ) != FR_OK) return false;
+	
+	success = (f_lseek(&play_fil, sizeof(file_index_header_t) + pos * play_entry_len) == FR_OK) &&
+	          (f_read(&play_fil, entryP, sizeof(file_index_entry_t), &br) == FR_OK) &&
+	          (br == sizeof(file_index_entry_t));
+	
+	f_close(&play_fil);
+	return success;
+}
+
+
+/**
+ * Read an indexed image, from its image file or its container file, into bufP (which
+ * leaves room for a terminating null)
+ */
+static bool play_read_image(const file_index_entry_t* entryP, uint8_t* bufP, uint32_t* lenP)
+{
+	char path[PLAY_MAX_PATH_LEN];
+	char name[CONTAINER_FILE_NAME_LEN];
+	file_container_entry_t ce;
+	bool success;
+	UINT br;
+	
+	if (entryP->container_num == FILE_INDEX_NO_CONTAINER) {
+		snprintf(path, PLAY_MAX_PATH_LEN, "/%s/group_%04d/img_%05d.%s", play_info.session,
+		         (int) (entryP->seq_num / FILES_PER_SUBDIRECTORY), (int) entryP->seq_num,
+		         (entryP->type == FILE_CONTAINER_TYPE_FCR) ? "fcr" : "json");
+		if (f_open(&play_fil, path, FA_READ) != FR_OK) return false;
+	
+		success = (f_read(&play_fil, bufP, PLAY_FRAME_BUF_LEN - 1, &br) == FR_OK);
+		*lenP = br;
+	} else {
+		sprintf(name, CONTAINER_FILE_NAME_FMT, entryP->container_num);
+		snprintf(path, PLAY_MAX_PATH_LEN, "/%s/%s", play_info.session, name);
+		if (f_open(&play_fil, path, FA_READ) != FR_OK) return false;
+	
+		success = (f_lseek(&play_fil, entryP->offset) == FR_OK) &&
+		          (f_read(&play_fil, &ce, sizeof(ce), &br) == FR_OK) && (br == sizeof(ce)) &&
+		          (ce.magic == FILE_CONTAINER_ENTRY_MAGIC) && (ce.length < PLAY_FRAME_BUF_LEN) &&
+		          (f_read(&play_fil, bufP, ce.length, &br) == FR_OK) && (br == ce.length);
+		*lenP = ce.length;
+	}
+	
+	f_close(&play_fil);
+	return success;
+}
+
+
+/**
+ * Hold off while file_task has recorded images waiting to be written
+ */
+static void play_wait_recording()
+{
+	file_rec_stats_t rec_stats;
+	
+	if (!app_task_get_recording()) return;
+	
+	file_task_get_rec_stats(&rec_stats);
+	while ((rec_stats.queued != 0) && app_task_get_recording()) {
+		vTaskDelay(pdMS_TO_TICKS(PLAY_REC_WAIT_MSEC));
+		file_task_get_rec_stats(&rec_stats);
+	}
+}
+
+
+/**
+ * Free the frames read but not yet taken by the GUI (called with play_mux held)
+ */
+static void play_drop_ready()
+{
+	int i;
+	
+	for (i=0; i<PLAY_NUM_FRAMES; i++) {
+		if (play_slot_state[i] == PLAY_SLOT_READY) {
+			play_slot_state[i] = PLAY_SLOT_FREE;
+		}
+	}
+}
+
+#endif /* INCLUDE_SYS_GUI */
@@ -0,0 +1,103 @@
+/*
+ * Render Task
+ *
+ * Decode the ArduCAM jpeg images for the GUI.  Decoding an image takes long enough to
+ * make the touchscreen and display feel sluggish if it is done by gui_task in the
+ * LittleVGL context so gui_task hands each image to us.  We decode it into the GUI's
+ * back buffer and tell gui_task when it is ready.  gui_task then swaps the back buffer
+ * with the displayed buffer and redraws the image.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "render_task.h"
+#include "system_config.h"
+
+#ifdef INCLUDE_SYS_GUI
+
+#include "app_task.h"
+#include "bench_task.h"
+#include "gui_task.h"
+#include "gui_screen_main.h"
+#include "gui_screen_playback.h"
+#include "perf_utilities.h"
+#include "sys_utilities.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Render Task variables
+//
+
+static const char* TAG = "render_task";
+
+
+
+//
+// Render Task API
+//
+void render_task()
+{
+	uint32_t notification_value;
+	int64_t start_usec;
+	
+	ESP_LOGI(TAG, "Start task");
+	
+	while (1) {
+		// Wait for gui_task to hand us an image
+		xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, portMAX_DELAY);
+		
+		if (Notification(notification_value, RENDER_NOTIFY_CAM_FRAME_MASK)) {
+			// Let gui_task know the result before app_task can send it another image
+			start_usec = esp_timer_get_time();
+			if (gui_screen_main_render_cam_image(gui_cam_render_bufferP)) {
+				perf_record(PERF_JPEG_DECODE, esp_timer_get_time() - start_usec);
+				xTaskNotify(task_handle_gui, GUI_NOTIFY_CAM_RENDERED_MASK, eSetBits);
+			} else {
+				xTaskNotify(task_handle_gui, GUI_NOTIFY_CAM_RENDER_FAIL_MASK, eSetBits);
+			}
+			
+			// Let the app task know we're done with the jpeg buffer
+			xTaskNotify(task_handle_app, APP_NOTIFY_GUI_CAM_DONE_MASK, eSetBits);
+		}
+		
+		if (Notification(notification_value, RENDER_NOTIFY_PLAY_FRAME_MASK)) {
+			// Decode the playback screen's current frame
+			if (gui_screen_playback_render_cam_image()) {
+				xTaskNotify(task_handle_gui, GUI_NOTIFY_PLAY_RENDERED_MASK, eSetBits);
+			} else {
+				xTaskNotify(task_handle_gui, GUI_NOTIFY_PLAY_RENDER_FAIL_MASK, eSetBits);
+			}
+		}
+		
+#ifdef INCLUDE_SYS_BENCH
+		if (Notification(notification_value, RENDER_NOTIFY_BENCH_MASK)) {
+			bench_task_run_render();
+		}
+#endif
+	}
+}
+
+#endif /* INCLUDE_SYS_GUI */
@@ -0,0 +1,713 @@
+/*
+ * Replay Task
+ *
+ * Sensor-free stand-ins for lep_task and cam_task.  replay_lep_task produces a Lepton
+ * frame every REPLAY_LEP_FRAME_MSEC from a recording session on the Micro-SD Card, or
+ * from a synthetic generator, and handles the lep_task notifications that apply to a
+ * frame source.  It also keeps the jpeg image of the latest frame, which
+ * replay_cam_task hands to app_task for each ArduCAM request.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "replay_task.h"
+
+#ifdef INCLUDE_SYS_REPLAY
+
+#include "app_task.h"
+#include "cam_task.h"
+#include "cmd_task.h"
+#include "file_task.h"
+#include "lep_task.h"
+#include "binrec_utilities.h"
+#include "file_utilities.h"
+#include "jpgenc.h"
+#include "json_utilities.h"
+#include "lepton_utilities.h"
+#include "sys_utilities.h"
+#include "vospi.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "ff.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+
+//
+// Replay Task constants
+//
+
+// Maximum age of the latest frame that can be used to satisfy a request
+#define REPLAY_MAX_FRAME_AGE_USEC (REPLAY_LEP_FRAME_MSEC * 1000 + 250000)
+
+// The frame a synchronized ArduCAM capture was started with is only used for a request
+// within REPLAY_SYNC_MAX_AGE_USEC
+#define REPLAY_SYNC_MAX_AGE_USEC  1000000
+
+// Image file path length: "/<session>/group_NNNN/img_NNNNN.json"
+#define REPLAY_MAX_PATH_LEN       (SESSION_DIR_NAME_LEN + 32)
+
+// Card mount poll period while waiting for file_task to mount the card
+#define REPLAY_MOUNT_POLL_MSEC    100
+
+
+
+//
+// Replay Task variables
+//
+static const char* TAG = "replay_task";
+
+// Frame source
+static bool rpl_synthetic;
+static char rpl_session_name[SESSION_DIR_NAME_LEN];
+static int rpl_seq_num;                     // Next image file to replay
+static uint32_t rpl_frame_count;            // Frames produced
+static FIL rpl_fil;
+static char* rpl_file_bufP;                 // Image file contents (external RAM)
+static uint16_t rpl_syn_telem[LEP_TEL_WORDS];
+
+// Jpeg image of the latest frame (external RAM), handed to replay_cam_task.  The mutex
+// is created by replay_lep_task before the first image is loaded.
+static uint8_t* rpl_jpeg_bufP;
+static uint32_t rpl_jpeg_len;
+static SemaphoreHandle_t rpl_jpeg_mutex = NULL;
+static uint32_t rpl_cam_capture_num = 0;    // Jpeg images produced
+
+// Streaming frame state (buffers from the shared frame pool)
+static lep_buffer_t* rpl_latest_frameP;
+static int64_t rpl_latest_frame_usec;
+static bool rpl_frame_requested;
+
+// Synchronized ArduCAM capture state
+static bool rpl_sync_pending;
+static lep_buffer_t* rpl_sync_frameP;
+
+// High-rate recording state
+static bool rpl_rec_enable;
+static bool rpl_rec_pending;                // Set while file_task holds sys_lep_rec_bufferP
+static uint32_t rpl_rec_drop_count;
+
+// UDP frame stream state
+static bool rpl_udp_enable;
+static bool rpl_udp_pending;                // Set while cmd_task holds sys_lep_udp_bufferP
+
+
+
+//
+// Replay Task Forward Declarations for internal functions
+//
+static bool replay_init_source();
+static bool replay_find_session();
+static void replay_init_synthetic();
+static void replay_produce_frame();
+static void replay_no_frame();
+static bool replay_load_file(lep_buffer_t* bufP);
+static bool replay_open_file(int seq_num, bool* binary);
+static void replay_load_synthetic(lep_buffer_t* bufP);
+static void replay_set_jpeg(const uint8_t* jpegP, uint32_t len);
+static bool replay_get_jpeg(cam_buffer_t* bufP);
+static void replay_handle_frame_request();
+static void replay_start_cam(bool with_frame);
+static void replay_deliver_frame(lep_buffer_t* frameP);
+static void replay_frame_failed();
+static void replay_record_frame();
+static void replay_udp_frame();
+
+
+
+//
+// Replay Task API
+//
+
+/**
+ * Lepton replay task.  Produces frames at the replay rate and hands them to app_task,
+ * file_task and cmd_task exactly as lep_task does.  Telemetry-only mode, averaging,
+ * standby, configuration checks and FFCs have no meaning for a replayed frame and
+ * their notifications are ignored.
+ */
+void replay_lep_task()
+{
+	uint32_t notification_value;
+	int64_t now;
+	int64_t next_frame_usec;
+	int wait_msec;
+	
+	ESP_LOGI(TAG, "Start Lepton replay");
+	
+	rpl_latest_frameP = NULL;
+	rpl_frame_requested = false;
+	rpl_sync_pending = false;
+	rpl_sync_frameP = NULL;
+	rpl_rec_enable = false;
+	rpl_rec_pending = false;
+	rpl_rec_drop_count = 0;
+	rpl_udp_enable = false;
+	rpl_udp_pending = false;
+	rpl_frame_count = 0;
+	rpl_jpeg_len = 0;
+	
+	if (!replay_init_source()) {
+		ESP_LOGE(TAG, "Could not allocate replay buffers");
+		vTaskDelete(NULL);
+	}
+	
+	next_frame_usec = esp_timer_get_time();
+	
+	while (1) {
+		// Wait for the next frame time (or a request)
+		now = esp_timer_get_time();
+		wait_msec = (next_frame_usec > now) ? (int) ((next_frame_usec - now + 999) / 1000) : 0;
+	
+		notification_value = 0;
+		if (xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, pdMS_TO_TICKS(wait_msec))) {
+			if (Notification(notification_value, LEP_NOTIFY_REC_ON_MASK)) {
+				rpl_rec_enable = true;
+				rpl_rec_drop_count = 0;
+			}
+	
+			if (Notification(notification_value, LEP_NOTIFY_REC_OFF_MASK)) {
+				if (rpl_rec_enable && (rpl_rec_drop_count != 0)) {
+					ESP_LOGI(TAG, "High-rate recording dropped %d frames", rpl_rec_drop_count);
+				}
+				rpl_rec_enable = false;
+			}
+	
+			if (Notification(notification_value, LEP_NOTIFY_REC_DONE_MASK)) {
+				system_lep_frame_release(sys_lep_rec_bufferP);
+				sys_lep_rec_bufferP = NULL;
+				rpl_rec_pending = false;
+			}
+	
+			if (Notification(notification_value, LEP_NOTIFY_UDP_ON_MASK)) {
+				rpl_udp_enable = true;
+			}
+	
+			if (Notification(notification_value, LEP_NOTIFY_UDP_OFF_MASK)) {
+				rpl_udp_enable = false;
+			}
+	
+			if (Notification(notification_value, LEP_NOTIFY_UDP_DONE_MASK)) {
+				system_lep_frame_release(sys_lep_udp_bufferP);
+				sys_lep_udp_bufferP = NULL;
+				rpl_udp_pending = false;
+			}
+	
+			// Before a frame request so the request waits for the synchronized frame
+			if (Notification(notification_value, LEP_NOTIFY_SYNC_CAM_MASK)) {
+				rpl_sync_pending = true;
+			}
+	
+			if (Notification(notification_value, LEP_NOTIFY_GET_FRAME_MASK)) {
+				replay_handle_frame_request();
+			}
+		}
+	
+		now = esp_timer_get_time();
+		if (now >= next_frame_usec) {
+			replay_produce_frame();
+	
+			// Don't try to catch up when the source can't keep up with the frame rate
+			next_frame_usec += REPLAY_LEP_FRAME_MSEC * 1000;
+			if (next_frame_usec < now) {
+				next_frame_usec = now + REPLAY_LEP_FRAME_MSEC * 1000;
+			}
+		}
+	}
+}
+
+
+/**
+ * ArduCAM replay task.  Answers each capture request with a copy of the jpeg image
+ * of the latest replayed frame after the emulated capture time.  Sleep requests are
+ * ignored.
+ */
+void replay_cam_task()
+{
+	cam_buffer_t* bufP;
+	uint32_t notification_value;
+	
+	ESP_LOGI(TAG, "Start ArduCAM replay");
+	
+	while (1) {
+		notification_value = 0;
+		xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, portMAX_DELAY);
+	
+		if (Notification(notification_value, CAM_NOTIFY_GET_FRAME_MASK)) {
+			bufP = system_cam_buffer_alloc();
+			if (bufP == NULL) {
+				ESP_LOGE(TAG, "No free ArduCAM buffer");
+				(void) system_frame_event_post(SYS_FRAME_STREAM_CAM, NULL, 0, SYS_FRAME_FLAG_FAIL);
+			} else {
+				bufP->start_usec = esp_timer_get_time();
+				vTaskDelay(pdMS_TO_TICKS(REPLAY_CAM_CAPTURE_MSEC));
+				bufP->timestamp_usec = esp_timer_get_time();
+				bufP->capture_num = ++rpl_cam_capture_num;
+	
+				if (!replay_get_jpeg(bufP)) {
+					system_cam_buffer_release(bufP);
+					(void) system_frame_event_post(SYS_FRAME_STREAM_CAM, NULL, 0, SYS_FRAME_FLAG_FAIL);
+				} else if (!system_frame_event_post(SYS_FRAME_STREAM_CAM, bufP, bufP->timestamp_usec, 0)) {
+					system_cam_buffer_release(bufP);
+				}
+			}
+			xTaskNotify(task_handle_app, APP_NOTIFY_CAM_FRAME_MASK, eSetBits);
+		}
+	}
+}
+
+
+
+//
+// Replay Task internal functions
+//
+
+/**
+ * Allocate the replay buffers and select the frame source.  Returns false if the
+ * buffers couldn't be allocated.
+ */
+static bool replay_init_source()
+{
+	rpl_jpeg_bufP = heap_caps_malloc(CAM_MAX_JPG_LEN, MALLOC_CAP_SPIRAM);
+	rpl_file_bufP = heap_caps_malloc(JSON_MAX_IMAGE_TEXT_LEN + 1, MALLOC_CAP_SPIRAM);
+	if ((rpl_jpeg_bufP == NULL) || (rpl_file_bufP == NULL)) {
+		return false;
+	}
+	rpl_jpeg_mutex = xSemaphoreCreateMutex();
+	if (rpl_jpeg_mutex == NULL) {
+		return false;
+	}
+	
+#ifdef REPLAY_SYNTHETIC_ONLY
+	rpl_synthetic = true;
+#else
+	rpl_synthetic = !replay_find_session();
+#endif
+	if (rpl_synthetic) {
+		ESP_LOGI(TAG, "Replaying synthetic frames");
+		replay_init_synthetic();
+	} else {
+		ESP_LOGI(TAG, "Replaying session %s", rpl_session_name);
+	}
+	
+	return true;
+}
+
+
+/**
+ * Wait for file_task to mount the card and find the session to replay.  Returns false
+ * if there is no card or the session doesn't start with an image file.
+ */
+static bool replay_find_session()
+{
+	bool binary;
+	int wait_msec = 0;
+	
+	while (!file_get_card_mounted()) {
+		if (wait_msec >= REPLAY_CARD_WAIT_MSEC) {
+			ESP_LOGI(TAG, "No Micro-SD Card");
+			return false;
+		}
+		vTaskDelay(pdMS_TO_TICKS(REPLAY_MOUNT_POLL_MSEC));
+		wait_msec += REPLAY_MOUNT_POLL_MSEC;
+	}
+	
+	if (strlen(REPLAY_SESSION) != 0) {
+		strncpy(rpl_session_name, REPLAY_SESSION, SESSION_DIR_NAME_LEN - 1);
+		rpl_session_name[SESSION_DIR_NAME_LEN - 1] = 0;
+	} else if (!file_find_oldest_session(NULL, rpl_session_name)) {
+		ESP_LOGI(TAG, "No session to replay");
+		return false;
+	}
+	
+	if (!replay_open_file(0, &binary)) {
+		ESP_LOGI(TAG, "Session %s has no image files", rpl_session_name);
+		return false;
+	}
+	f_close(&rpl_fil);
+	rpl_seq_num = 0;
+	
+	return true;
+}
+
+
+/**
+ * Set up the synthetic source: fixed telemetry and a jpeg test pattern (a color
+ * gradient).  The jpeg is encoded once.
+ */
+static void replay_init_synthetic()
+{
+	uint16_t* imgP;
+	uint16_t* p;
+	uint32_t len;
+	int x, y;
+	
+	memset(rpl_syn_telem, 0, sizeof(rpl_syn_telem));
+	rpl_syn_telem[LEP_TEL_FPA_T_K100] = REPLAY_SYN_BASE_K100;
+	rpl_syn_telem[LEP_TEL_TLIN_ENABLE] = 1;
+	rpl_syn_telem[LEP_TEL_TLIN_RES] = 1;      // 0.01 K
+	
+	imgP = heap_caps_malloc(REPLAY_SYN_JPEG_WIDTH * REPLAY_SYN_JPEG_HEIGHT * 2, MALLOC_CAP_SPIRAM);
+	if (imgP == NULL) {
+		ESP_LOGE(TAG, "Could not allocate the test pattern");
+		return;
+	}
+	
+	p = imgP;
+	for (y=0; y<REPLAY_SYN_JPEG_HEIGHT; y++) {
+		for (x=0; x<REPLAY_SYN_JPEG_WIDTH; x++) {
+			*p++ = (uint16_t) (((x * 32 / REPLAY_SYN_JPEG_WIDTH) << 11) |
+			                   ((y * 64 / REPLAY_SYN_JPEG_HEIGHT) << 5) |
+			                   (31 - (x * 32 / REPLAY_SYN_JPEG_WIDTH)));
+		}
+	}
+	
+	len = jpgenc_encode_rgb565(imgP, REPLAY_SYN_JPEG_WIDTH, REPLAY_SYN_JPEG_HEIGHT, false,
+	                           rpl_jpeg_bufP, CAM_MAX_JPG_LEN);
+	heap_caps_free(imgP);
+	
+	if (len == 0) {
+		ESP_LOGE(TAG, "Could not encode the test pattern");
+	}
+	xSemaphoreTake(rpl_jpeg_mutex, portMAX_DELAY);
+	rpl_jpeg_len = len;
+	xSemaphoreGive(rpl_jpeg_mutex);
+}
+
+
+/**
+ * Load a new frame from the source and publish it as the latest frame, handing it to
+ * the consumers waiting for it
+ */
+static void replay_produce_frame()
+{
+	lep_buffer_t* bufP;
+	uint16_t* p;
+	uint16_t min = 0xFFFF;
+	uint16_t max = 0x0000;
+	
+	bufP = system_lep_frame_alloc();
+	if (bufP == NULL) {
+		ESP_LOGE(TAG, "No free frame buffer - dropping frame");
+		replay_no_frame();
+		return;
+	}
+	
+	if (!rpl_synthetic) {
+		if (!replay_load_file(bufP)) {
+			system_lep_frame_release(bufP);
+			replay_no_frame();
+			return;
+		}
+	}
+	if (rpl_synthetic) {
+		replay_load_synthetic(bufP);
+	}
+	rpl_frame_count++;
+	
+	p = bufP->lep_bufferP;
+	while (p < (bufP->lep_bufferP + LEP_NUM_PIXELS)) {
+		if (*p < min) min = *p;
+		if (*p > max) max = *p;
+		p++;
+	}
+	bufP->lep_min_val = min;
+	bufP->lep_max_val = max;
+	bufP->hist_valid = false;
+	lepton_decode_telem(bufP->telem_valid ? bufP->lep_telemP : NULL, &bufP->telem);
+	bufP->timestamp_usec = esp_timer_get_time();
+	
+	system_lep_frame_release(rpl_latest_frameP);
+	rpl_latest_frameP = bufP;
+	rpl_latest_frame_usec = bufP->timestamp_usec;
+	
+	if (rpl_sync_pending) {
+		replay_start_cam(!rpl_frame_requested);
+	}
+	
+	if (rpl_rec_enable) {
+		replay_record_frame();
+	}
+	
+	if (rpl_udp_enable) {
+		replay_udp_frame();
+	}
+	
+	if (rpl_frame_requested) {
+		replay_deliver_frame(rpl_latest_frameP);
+	}
+}
+
+
+/**
+ * Don't leave app_task waiting for a frame period without a frame
+ */
+static void replay_no_frame()
+{
+	if (rpl_sync_pending) {
+		replay_start_cam(false);
+	}
+	
+	if (rpl_frame_requested) {
+		replay_frame_failed();
+		rpl_frame_requested = false;
+	}
+}
+
+
+/**
+ * Load the next image file from the session into bufP, starting again at the first
+ * after the last.  Switches to the synthetic source if the session's first image file
+ * can no longer be opened (e.g. it was deleted).  Returns false if no frame was loaded.
+ */
+static bool replay_load_file(lep_buffer_t* bufP)
+{
+	bool binary;
+	bool has_lep;
+	bool success;
+	uint8_t* jpegP;
+	uint32_t jpeg_len;
+	UINT len;
+	
+	if (!file_get_card_mounted() || !replay_open_file(rpl_seq_num, &binary)) {
+		if ((rpl_seq_num == 0) || !file_get_card_mounted() || !replay_open_file(0, &binary)) {
+			ESP_LOGE(TAG, "Lost session %s - replaying synthetic frames", rpl_session_name);
+			rpl_synthetic = true;
+			replay_init_synthetic();
+			return false;
+		}
+		rpl_seq_num = 0;
+	}
+	
+	success = (f_read(&rpl_fil, rpl_file_bufP, JSON_MAX_IMAGE_TEXT_LEN, &len) == FR_OK);
+	f_close(&rpl_fil);
+	
+	if (success) {
+		if (binary) {
+			success = binrec_parse_record((uint8_t*) rpl_file_bufP, len, bufP, &has_lep, &jpegP, &jpeg_len);
+		} else {
+			success = json_parse_image_string(rpl_file_bufP, len, bufP, &has_lep, &jpegP, &jpeg_len);
+		}
+		success = success && has_lep;
+		if (success && (jpeg_len != 0)) {
+			replay_set_jpeg(jpegP, jpeg_len);
+		}
+	}
+	if (!success) {
+		ESP_LOGE(TAG, "Could not replay image %d", rpl_seq_num);
+	}
+	rpl_seq_num++;
+	
+	return success;
+}
+
+
+/**
+ * Open the binary or json image file for seq_num in the session
+ */
+static bool replay_open_file(int seq_num, bool* binary)
+{
+	char path[REPLAY_MAX_PATH_LEN];
+	int i;
+	
+	for (i=0; i<2; i++) {
+		*binary = (i == 0);
+		snprintf(path, REPLAY_MAX_PATH_LEN, "/%s/group_%04d/img_%05d.%s", rpl_session_name,
+		         seq_num / FILES_PER_SUBDIRECTORY, seq_num, *binary ? "fcr" : "json");
+		if (f_open(&rpl_fil, path, FA_READ) == FR_OK) {
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+
+/**
+ * Load bufP with the next synthetic frame: a gradient with a hot spot circling the
+ * frame.  The telemetry frame counter and uptime advance with each frame.
+ */
+static void replay_load_synthetic(lep_buffer_t* bufP)
+{
+	uint16_t* p = bufP->lep_bufferP;
+	uint32_t msec;
+	float a;
+	int cx, cy;
+	int dx, dy, d2;
+	int x, y;
+	int r2 = REPLAY_SYN_SPOT_RADIUS * REPLAY_SYN_SPOT_RADIUS;
+	int32_t t;
+	
+	a = 2.0f * (float) M_PI * (float) (rpl_frame_count % REPLAY_SYN_ORBIT_FRAMES) / REPLAY_SYN_ORBIT_FRAMES;
+	cx = LEP_WIDTH/2 + (int) ((LEP_WIDTH/3) * cosf(a));
+	cy = LEP_HEIGHT/2 + (int) ((LEP_HEIGHT/3) * sinf(a));
+	
+	for (y=0; y<LEP_HEIGHT; y++) {
+		for (x=0; x<LEP_WIDTH; x++) {
+			t = REPLAY_SYN_BASE_K100 + (x * 4) + (y * 2);
+			dx = x - cx;
+			dy = y - cy;
+			d2 = dx*dx + dy*dy;
+			if (d2 < r2) {
+				t += REPLAY_SYN_SPOT_K100 * (r2 - d2) / r2;
+			}
+			*p++ = (uint16_t) t;
+		}
+	}
+	
+	msec = (uint32_t) (esp_timer_get_time() / 1000);
+	rpl_syn_telem[LEP_TEL_TC_LOW] = msec & 0xFFFF;
+	rpl_syn_telem[LEP_TEL_TC_HIGH] = msec >> 16;
+	rpl_syn_telem[LEP_TEL_FC_LOW] = rpl_frame_count & 0xFFFF;
+	rpl_syn_telem[LEP_TEL_FC_HIGH] = rpl_frame_count >> 16;
+	memcpy(bufP->lep_telemP, rpl_syn_telem, LEP_TEL_WORDS*2);
+	bufP->telem_valid = true;
+}
+
+
+/**
+ * Make jpegP the jpeg image of the latest frame
+ */
+static void replay_set_jpeg(const uint8_t* jpegP, uint32_t len)
+{
+	xSemaphoreTake(rpl_jpeg_mutex, portMAX_DELAY);
+	memcpy(rpl_jpeg_bufP, jpegP, len);
+	rpl_jpeg_len = len;
+	xSemaphoreGive(rpl_jpeg_mutex);
+}
+
+
+/**
+ * Copy the jpeg image of the latest frame into bufP.  Returns false if there isn't one
+ * yet.
+ */
+static bool replay_get_jpeg(cam_buffer_t* bufP)
+{
+	if (rpl_jpeg_mutex == NULL) return false;
+	
+	xSemaphoreTake(rpl_jpeg_mutex, portMAX_DELAY);
+	memcpy(bufP->cam_bufferP, rpl_jpeg_bufP, rpl_jpeg_len);
+	bufP->cam_buffer_len = rpl_jpeg_len;
+	xSemaphoreGive(rpl_jpeg_mutex);
+	
+	return (bufP->cam_buffer_len != 0);
+}
+
+
+/**
+ * Handle a request from app_task for a frame the same way lep_task does
+ */
+static void replay_handle_frame_request()
+{
+	if (rpl_sync_pending) {
+		rpl_frame_requested = true;
+	} else if ((rpl_sync_frameP != NULL) &&
+	           ((esp_timer_get_time() - rpl_sync_frameP->timestamp_usec) <= REPLAY_SYNC_MAX_AGE_USEC))
+	{
+		replay_deliver_frame(rpl_sync_frameP);
+	} else if ((rpl_latest_frameP != NULL) &&
+	           ((esp_timer_get_time() - rpl_latest_frame_usec) <= REPLAY_MAX_FRAME_AGE_USEC))
+	{
+		replay_deliver_frame(rpl_latest_frameP);
+	} else {
+		rpl_frame_requested = true;
+	}
+	
+	// The synchronized frame is only used once
+	system_lep_frame_release(rpl_sync_frameP);
+	rpl_sync_frameP = NULL;
+}
+
+
+/**
+ * Start the ArduCAM capture, with the frame just published if with_frame is set
+ */
+static void replay_start_cam(bool with_frame)
+{
+	xTaskNotify(task_handle_cam, CAM_NOTIFY_GET_FRAME_MASK, eSetBits);
+	rpl_sync_pending = false;
+	
+	system_lep_frame_release(rpl_sync_frameP);
+	rpl_sync_frameP = NULL;
+	if (with_frame) {
+		system_lep_frame_hold(rpl_latest_frameP);
+		rpl_sync_frameP = rpl_latest_frameP;
+	}
+}
+
+
+/**
+ * Hand frameP, with its own reference, to app_task and let it know
+ */
+static void replay_deliver_frame(lep_buffer_t* frameP)
+{
+	system_lep_frame_hold(frameP);
+	if (!system_frame_event_post(SYS_FRAME_STREAM_LEP, frameP, frameP->timestamp_usec, 0)) {
+		system_lep_frame_release(frameP);
+	}
+	xTaskNotify(task_handle_app, APP_NOTIFY_LEP_FRAME_MASK, eSetBits);
+	rpl_frame_requested = false;
+}
+
+
+/**
+ * Let app_task know we couldn't get the frame it asked for
+ */
+static void replay_frame_failed()
+{
+	(void) system_frame_event_post(SYS_FRAME_STREAM_LEP, NULL, 0, SYS_FRAME_FLAG_FAIL);
+	xTaskNotify(task_handle_app, APP_NOTIFY_LEP_FRAME_MASK, eSetBits);
+}
+
+
+/**
+ * Publish the latest frame to file_task for high-rate recording if it is ready for one
+ */
+static void replay_record_frame()
+{
+	if (rpl_rec_pending) {
+		rpl_rec_drop_count++;
+		return;
+	}
+	
+	system_lep_frame_hold(rpl_latest_frameP);
+	sys_lep_rec_bufferP = rpl_latest_frameP;
+	rpl_rec_pending = true;
+	xTaskNotify(task_handle_file, FILE_NOTIFY_NEW_LEP_RECORD_MASK, eSetBits);
+}
+
+
+/**
+ * Publish the latest frame to cmd_task for the UDP frame stream if it is ready for one
+ */
+static void replay_udp_frame()
+{
+	if (rpl_udp_pending) return;
+	
+	system_lep_frame_hold(rpl_latest_frameP);
+	sys_lep_udp_bufferP = rpl_latest_frameP;
+	rpl_udp_pending = true;
+	cmd_task_notify(CMD_NOTIFY_LEP_FRAME_MASK);
+}
+
+#endif /* INCLUDE_SYS_REPLAY */
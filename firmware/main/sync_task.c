@@ -0,0 +1,427 @@
+/*
+ * Sync Task
+ *
+ * Keeps the system time of several cameras on one network together so their once per
+ * second captures happen at the same instant and their images carry the same time.
+ * A master broadcasts a timestamped beacon to SYNC_PORT every second.  Each slave
+ * answers the beacon with a delay request, measures its offset from the master's time
+ * and the network delay from the master's response and corrects its system time to the
+ * master's.  app_task's capture pipeline runs from the top of each second of the system
+ * time so it follows.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "sync_task.h"
+#include "ps_nvs.h"
+#include "sys_utilities.h"
+#include "system_config.h"
+#include "time_utilities.h"
+#include "wifi_utilities.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+
+
+//
+// Sync Task private variables
+//
+static const char* TAG = "sync_task";
+
+// Current mode and socket (owned by the task)
+static int sync_mode = SYNC_MODE_OFF;
+static int sync_sock = -1;
+
+// Master state
+static uint16_t sync_seq;
+static int64_t sync_beacon_usec;            // esp_timer time of the last beacon
+
+// Slave state
+static bool sync_req_pending;               // Waiting for the response to sync_req_seq
+static uint16_t sync_req_seq;
+static int32_t sync_rounds[SYNC_DELAY_SAMPLES];  // Recent round trip times
+static int sync_round_count;
+static int sync_round_index;
+static int64_t sync_lock_usec;              // esp_timer time of the last used measurement
+
+// Status for other tasks
+static sync_status_t sync_status;
+static portMUX_TYPE sync_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+
+//
+// Sync Task Forward Declarations for internal functions
+//
+static void sync_update_mode();
+static void sync_check_socket();
+static void sync_close_socket();
+static void sync_receive();
+static void sync_send_beacon();
+static void sync_send_delay_req(struct sockaddr_in* masterP);
+static void sync_answer_delay_req(sync_packet_t* reqP, struct sockaddr_in* slaveP, int64_t rx_usec);
+static void sync_eval_response(sync_packet_t* rspP, int64_t rx_usec);
+static void sync_check_lock();
+static void sync_send(sync_packet_t* pktP, struct sockaddr_in* toP);
+static int64_t sync_get_time_usec();
+
+
+
+//
+// Sync Task API
+//
+void sync_task()
+{
+	uint32_t notification_value;
+	
+	ESP_LOGI(TAG, "Start task");
+	
+	sync_update_mode();
+	
+	// Loop waiting in the socket for sync packets while we are syncing, otherwise just
+	// waiting for the network or a mode change
+	while (1) {
+		notification_value = 0;
+		if (sync_sock < 0) {
+			(void) xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, pdMS_TO_TICKS(SYNC_EVAL_MSEC));
+		} else {
+			sync_receive();
+			(void) xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, 0);
+		}
+	
+		if (Notification(notification_value, SYNC_NOTIFY_MODE_MASK)) {
+			sync_update_mode();
+		}
+	
+		sync_check_socket();
+	
+		if ((sync_mode == SYNC_MODE_MASTER) && (sync_sock >= 0) &&
+		    ((esp_timer_get_time() - sync_beacon_usec) >= (SYNC_BEACON_MSEC * 1000)))
+		{
+			sync_send_beacon();
+		}
+	
+		sync_check_lock();
+	}
+}
+
+
+/**
+ * Return the SYNC_MODE_xxx set in persistent storage
+ */
+int sync_task_get_mode()
+{
+	return (int) ps_nvs_get_uint(PS_NVS_SYNC_MODE);
+}
+
+
+/**
+ * Store a new SYNC_MODE_xxx and have the task start using it
+ */
+void sync_task_set_mode(int mode)
+{
+	if ((mode < SYNC_MODE_OFF) || (mode > SYNC_MODE_SLAVE)) {
+		ESP_LOGE(TAG, "Illegal sync mode %d", mode);
+		return;
+	}
+	
+	(void) ps_nvs_set_uint(PS_NVS_SYNC_MODE, (uint32_t) mode);
+	xTaskNotify(task_handle_sync, SYNC_NOTIFY_MODE_MASK, eSetBits);
+}
+
+
+void sync_task_get_status(sync_status_t* statusP)
+{
+	portENTER_CRITICAL(&sync_mux);
+	*statusP = sync_status;
+	portEXIT_CRITICAL(&sync_mux);
+}
+
+
+
+//
+// Sync Task internal functions
+//
+
+/**
+ * Load the mode from persistent storage and start over with it
+ */
+static void sync_update_mode()
+{
+	sync_mode = sync_task_get_mode();
+	sync_close_socket();
+	
+	sync_beacon_usec = 0;
+	sync_req_pending = false;
+	sync_round_count = 0;
+	sync_round_index = 0;
+	
+	portENTER_CRITICAL(&sync_mux);
+	memset(&sync_status, 0, sizeof(sync_status_t));
+	sync_status.mode = sync_mode;
+	portEXIT_CRITICAL(&sync_mux);
+	
+	ESP_LOGI(TAG, "Sync mode %d", sync_mode);
+}
+
+
+/**
+ * Open the SYNC_PORT socket when we are syncing and the network is up and close it when
+ * we aren't
+ */
+static void sync_check_socket()
+{
+	int flag = 1;
+	struct sockaddr_in addr;
+	struct timeval tv;
+	
+	if ((sync_mode == SYNC_MODE_OFF) || !wifi_is_connected()) {
+		sync_close_socket();
+		return;
+	}
+	
+	if (sync_sock >= 0) return;
+	
+	sync_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (sync_sock < 0) return;
+	
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(SYNC_PORT);
+	setsockopt(sync_sock, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+	setsockopt(sync_sock, SOL_SOCKET, SO_BROADCAST, &flag, sizeof(flag));
+	tv.tv_sec = 0;
+	tv.tv_usec = SYNC_RX_TIMEOUT_MSEC * 1000;
+	setsockopt(sync_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	if (bind(sync_sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		ESP_LOGE(TAG, "Unable to bind the sync port: errno %d", errno);
+		close(sync_sock);
+		sync_sock = -1;
+	}
+}
+
+
+static void sync_close_socket()
+{
+	if (sync_sock >= 0) {
+		close(sync_sock);
+		sync_sock = -1;
+	}
+	sync_req_pending = false;
+}
+
+
+/**
+ * Wait up to SYNC_RX_TIMEOUT_MSEC for a packet and handle it
+ */
+static void sync_receive()
+{
+	sync_packet_t pkt;
+	struct sockaddr_in from;
+	socklen_t from_len;
+	int64_t rx_usec;
+	int len;
+	
+	from_len = sizeof(from);
+	len = recvfrom(sync_sock, &pkt, sizeof(pkt), 0, (struct sockaddr *)&from, &from_len);
+	rx_usec = sync_get_time_usec();
+	if (len < 0) {
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+			// The network went away - start over when it's back
+			sync_close_socket();
+		}
+		return;
+	}
+	if ((len != sizeof(sync_packet_t)) || (pkt.magic != SYNC_MAGIC)) return;
+	
+	switch (pkt.type) {
+		case SYNC_TYPE_BEACON:
+			if (sync_mode == SYNC_MODE_SLAVE) {
+				portENTER_CRITICAL(&sync_mux);
+				sync_status.beacons++;
+				portEXIT_CRITICAL(&sync_mux);
+				sync_send_delay_req(&from);
+			}
+			break;
+	
+		case SYNC_TYPE_DELAY_REQ:
+			if (sync_mode == SYNC_MODE_MASTER) {
+				sync_answer_delay_req(&pkt, &from, rx_usec);
+			}
+			break;
+	
+		case SYNC_TYPE_DELAY_RSP:
+			if ((sync_mode == SYNC_MODE_SLAVE) && sync_req_pending && (pkt.seq == sync_req_seq)) {
+				sync_req_pending = false;
+				sync_eval_response(&pkt, rx_usec);
+			}
+			break;
+	}
+}
+
+
+static void sync_send_beacon()
+{
+	struct sockaddr_in to;
+	sync_packet_t pkt;
+	
+	to.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+	to.sin_family = AF_INET;
+	to.sin_port = htons(SYNC_PORT);
+	
+	memset(&pkt, 0, sizeof(sync_packet_t));
+	pkt.type = SYNC_TYPE_BEACON;
+	pkt.seq = ++sync_seq;
+	sync_beacon_usec = esp_timer_get_time();
+	pkt.t1 = sync_get_time_usec();
+	sync_send(&pkt, &to);
+	
+	portENTER_CRITICAL(&sync_mux);
+	sync_status.beacons++;
+	portEXIT_CRITICAL(&sync_mux);
+}
+
+
+/**
+ * Start a delay measurement with the master whose beacon came from masterP.  A request
+ * that is never answered is replaced by the one for the next beacon.
+ */
+static void sync_send_delay_req(struct sockaddr_in* masterP)
+{
+	struct sockaddr_in to;
+	sync_packet_t pkt;
+	
+	to.sin_addr.s_addr = masterP->sin_addr.s_addr;
+	to.sin_family = AF_INET;
+	to.sin_port = htons(SYNC_PORT);
+	
+	memset(&pkt, 0, sizeof(sync_packet_t));
+	pkt.type = SYNC_TYPE_DELAY_REQ;
+	pkt.seq = ++sync_req_seq;
+	sync_req_pending = true;
+	pkt.t1 = sync_get_time_usec();
+	sync_send(&pkt, &to);
+}
+
+
+static void sync_answer_delay_req(sync_packet_t* reqP, struct sockaddr_in* slaveP, int64_t rx_usec)
+{
+	sync_packet_t pkt;
+	
+	memset(&pkt, 0, sizeof(sync_packet_t));
+	pkt.type = SYNC_TYPE_DELAY_RSP;
+	pkt.seq = reqP->seq;
+	pkt.t1 = reqP->t1;
+	pkt.t2 = rx_usec;
+	pkt.t3 = sync_get_time_usec();
+	sync_send(&pkt, slaveP);
+}
+
+
+/**
+ * Compute the offset and delay from a completed exchange (t4 is our receive time) and
+ * correct the system time if the exchange passes the delay filter
+ */
+static void sync_eval_response(sync_packet_t* rspP, int64_t rx_usec)
+{
+	int32_t round_usec;
+	int32_t min_usec;
+	int64_t offset_usec;
+	int i;
+	
+	// Round trip less the master's turnaround and our offset from the master
+	round_usec = (int32_t) ((rx_usec - rspP->t1) - (rspP->t3 - rspP->t2));
+	offset_usec = ((rspP->t1 - rspP->t2) + (rx_usec - rspP->t3)) / 2;
+	if (round_usec < 0) return;
+	
+	sync_rounds[sync_round_index] = round_usec;
+	if (++sync_round_index == SYNC_DELAY_SAMPLES) sync_round_index = 0;
+	if (sync_round_count < SYNC_DELAY_SAMPLES) sync_round_count++;
+	
+	min_usec = round_usec;
+	for (i=0; i<sync_round_count; i++) {
+		if (sync_rounds[i] < min_usec) min_usec = sync_rounds[i];
+	}
+	
+	if (round_usec > (min_usec + SYNC_DELAY_MARGIN_USEC)) {
+		portENTER_CRITICAL(&sync_mux);
+		sync_status.rejected++;
+		portEXIT_CRITICAL(&sync_mux);
+		return;
+	}
+	
+	time_sync_adjust(offset_usec);
+	sync_lock_usec = esp_timer_get_time();
+	
+	if ((offset_usec > TIME_MAX_SLEW_USEC) || (offset_usec < -TIME_MAX_SLEW_USEC)) {
+		ESP_LOGI(TAG, "Stepped %d mSec to the master", (int) (offset_usec / 1000));
+	}
+	
+	portENTER_CRITICAL(&sync_mux);
+	sync_status.locked = (abs((int) offset_usec) <= SYNC_LOCK_MAX_ERR_USEC);
+	sync_status.offset_usec = (int32_t) offset_usec;
+	sync_status.delay_usec = round_usec / 2;
+	portEXIT_CRITICAL(&sync_mux);
+}
+
+
+/**
+ * A slave loses lock when its master stops answering
+ */
+static void sync_check_lock()
+{
+	if (sync_mode != SYNC_MODE_SLAVE) return;
+	
+	if ((esp_timer_get_time() - sync_lock_usec) > ((int64_t) SYNC_LOCK_TIMEOUT_SEC * 1000000)) {
+		portENTER_CRITICAL(&sync_mux);
+		sync_status.locked = false;
+		portEXIT_CRITICAL(&sync_mux);
+	}
+}
+
+
+static void sync_send(sync_packet_t* pktP, struct sockaddr_in* toP)
+{
+	pktP->magic = SYNC_MAGIC;
+	if (sendto(sync_sock, pktP, sizeof(sync_packet_t), 0, (struct sockaddr *)toP, sizeof(struct sockaddr_in)) < 0) {
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != ENOMEM)) {
+			sync_close_socket();
+		}
+	}
+}
+
+
+/**
+ * Return the system time in uSec since 1970
+ */
+static int64_t sync_get_time_usec()
+{
+	struct timeval tv;
+	
+	gettimeofday(&tv, NULL);
+	return ((int64_t) tv.tv_sec * 1000000) + tv.tv_usec;
+}
@@ -0,0 +1,687 @@
+/*
+ * Upload Task
+ *
+ * Pushes completed recording sessions on the Micro-SD Card to a HTTP server when the
+ * camera is connected to a network in client mode so recordings from sites with
+ * intermittent connectivity are collected without removing the card.  Each file is
+ * sent with HTTP PUT requests of up to UPLOAD_REQUEST_LEN bytes over one persistent
+ * connection and the progress through a session is kept in a marker file in its
+ * directory so an interrupted upload resumes where it left off.  Runs at low priority
+ * and, while recording, is throttled and waits for file_task's queue to empty so it
+ * never holds up the recording.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "upload_task.h"
+#include "app_task.h"
+#include "file_task.h"
+#include "file_utilities.h"
+#include "ps_nvs.h"
+#include "ps_utilities.h"
+#include "sys_utilities.h"
+#include "system_config.h"
+#include "wifi_utilities.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include "ff.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+
+//
+// Upload Task variables
+//
+static const char* TAG = "upload_task";
+
+// Server connection
+static int upload_sock = -1;
+static uint32_t upload_addr;           // Server address (host byte order) and port
+static uint16_t upload_port;
+static char upload_host[24];           // "a.b.c.d:port" for the Host header
+static char upload_camera[PS_SSID_MAX_LEN+1];  // Camera name used in upload paths
+
+// Session being uploaded
+static char upload_session_name[SESSION_DIR_NAME_LEN];
+static upload_marker_t upload_marker;
+static bool upload_started;            // Reached the marker's file
+static uint64_t upload_sent;           // Bytes sent since the camera started
+
+// Block buffer in internal DMA-capable RAM (allocated while uploading a session)
+static uint8_t* upload_bufP;
+
+// FATFS objects (with their sector buffers and long names) are kept off the stack
+static FIL upload_fil;
+static FIL upload_marker_fil;
+static FILINFO upload_fi[2];           // One for each directory level in a session
+
+// Status for other tasks
+static upload_status_t upload_status;
+static portMUX_TYPE upload_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+
+//
+// Upload Task Forward Declarations for internal functions
+//
+static bool upload_ready();
+static bool upload_find_session(char* name);
+static bool upload_session_done(const char* name);
+static bool upload_session();
+static bool upload_dir(const char* rel_dir, int depth);
+static bool upload_file(const char* rel_path, uint32_t offset);
+static bool upload_put(const char* rel_path, uint32_t offset, uint32_t n, uint32_t length);
+static bool upload_read_response();
+static void upload_throttle(uint32_t len);
+static bool upload_read_marker(const char* name, upload_marker_t* mP);
+static bool upload_write_marker();
+static bool upload_connect();
+static void upload_disconnect();
+static bool upload_send_all(const uint8_t* bufP, int len);
+static void upload_set_camera_name();
+
+
+
+//
+// Upload Task API
+//
+void upload_task()
+{
+	uint32_t notification_value;
+	TickType_t wait;
+	
+	ESP_LOGI(TAG, "Start task");
+	
+	// Upload the completed sessions, oldest first, whenever we can reach the server.  A
+	// new server configuration is checked immediately.
+	wait = pdMS_TO_TICKS(UPLOAD_CHECK_MSEC);
+	while (1) {
+		notification_value = 0;
+		(void) xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, wait);
+	
+		wait = pdMS_TO_TICKS(UPLOAD_CHECK_MSEC);
+		while (upload_ready() && upload_find_session(upload_session_name)) {
+			if (!upload_session()) {
+				wait = pdMS_TO_TICKS(UPLOAD_RETRY_MSEC);
+				break;
+			}
+		}
+		upload_disconnect();
+	}
+}
+
+
+/**
+ * Set the server to upload to (ip_addr is stored most-significant byte last as in
+ * wifi_info_t).  A port of 0 disables uploads.  Kept in persistent storage.
+ */
+void upload_task_set_server(const uint8_t* ip_addr, uint16_t port)
+{
+	uint32_t addr;
+	
+	addr = ((uint32_t) ip_addr[3] << 24) | ((uint32_t) ip_addr[2] << 16) |
+	       ((uint32_t) ip_addr[1] << 8) | ip_addr[0];
+	(void) ps_nvs_set_uint(PS_NVS_UPLOAD_ADDR, addr);
+	(void) ps_nvs_set_uint(PS_NVS_UPLOAD_PORT, (uint32_t) port);
+	
+	xTaskNotify(task_handle_upload, UPLOAD_NOTIFY_CONFIG_MASK, eSetBits);
+}
+
+
+void upload_task_get_status(upload_status_t* statusP)
+{
+	portENTER_CRITICAL(&upload_mux);
+	*statusP = upload_status;
+	statusP->kbytes = (uint32_t) (upload_sent / 1024);
+	portEXIT_CRITICAL(&upload_mux);
+	
+	statusP->enabled = (ps_nvs_get_uint(PS_NVS_UPLOAD_PORT) != 0);
+}
+
+
+
+//
+// Upload Task internal functions
+//
+
+/**
+ * Returns true when a server is configured and we can reach it (client mode with a
+ * connection) and there is a card to upload from
+ */
+static bool upload_ready()
+{
+	const wifi_info_t* wifi_infoP = wifi_get_info();
+	
+	upload_addr = ps_nvs_get_uint(PS_NVS_UPLOAD_ADDR);
+	upload_port = (uint16_t) ps_nvs_get_uint(PS_NVS_UPLOAD_PORT);
+	
+	return (upload_port != 0) && (upload_addr != 0) &&
+	       ((wifi_infoP->flags & WIFI_INFO_FLAG_CLIENT_MODE) != 0) && wifi_is_connected() &&
+	       file_get_card_mounted();
+}
+
+
+/**
+ * Find the oldest session directory that hasn't been uploaded.  The session being
+ * recorded (or waiting to be resumed) isn't complete so it is skipped.
+ */
+static bool upload_find_session(char* name)
+{
+	FF_DIR dir;
+	FILINFO* fiP = &upload_fi[0];
+	ps_rec_journal_t jrnl;
+	bool has_jrnl;
+	bool found = false;
+	
+	has_jrnl = ps_get_rec_journal(&jrnl);
+	
+	if (f_opendir(&dir, "/") != FR_OK) {
+		ESP_LOGE(TAG, "Could not read the card's root directory");
+		return false;
+	}
+	
+	while ((f_readdir(&dir, fiP) == FR_OK) && (fiP->fname[0] != 0)) {
+		if (((fiP->fattrib & AM_DIR) == 0) ||
+		    (strncmp(fiP->fname, SESSION_DIR_PREFIX, strlen(SESSION_DIR_PREFIX)) != 0) ||
+		    (strlen(fiP->fname) >= SESSION_DIR_NAME_LEN) ||
+		    (has_jrnl && (strcmp(fiP->fname, jrnl.session_dir) == 0)))
+		{
+			continue;
+		}
+	
+		if ((!found || (strcmp(fiP->fname, name) < 0)) && !upload_session_done(fiP->fname)) {
+			strcpy(name, fiP->fname);
+			found = true;
+		}
+	}
+	f_closedir(&dir);
+	
+	return found;
+}
+
+
+/**
+ * Returns true if a session's marker says it has been uploaded
+ */
+static bool upload_session_done(const char* name)
+{
+	upload_marker_t m;
+	
+	return upload_read_marker(name, &m) && (m.done != 0);
+}
+
+
+/**
+ * Upload the files in upload_session_name, resuming from its marker.  Returns false
+ * if the upload failed.
+ */
+static bool upload_session()
+{
+	bool success;
+	
+	if (!upload_read_marker(upload_session_name, &upload_marker)) {
+		memset(&upload_marker, 0, sizeof(upload_marker_t));
+		upload_marker.magic = UPLOAD_MAGIC;
+	}
+	
+	if (upload_bufP == NULL) {
+		upload_bufP = heap_caps_malloc(UPLOAD_BLOCK_LEN, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+		if (upload_bufP == NULL) {
+			ESP_LOGE(TAG, "Could not allocate buffer");
+			return false;
+		}
+	}
+	
+	portENTER_CRITICAL(&upload_mux);
+	upload_status.active = true;
+	strcpy(upload_status.session, upload_session_name);
+	portEXIT_CRITICAL(&upload_mux);
+	
+	upload_set_camera_name();
+	if (upload_marker.file[0] == 0) {
+		ESP_LOGI(TAG, "Upload %s", upload_session_name);
+	} else {
+		ESP_LOGI(TAG, "Resume upload of %s at %s", upload_session_name, upload_marker.file);
+	}
+	
+	upload_started = (upload_marker.file[0] == 0);
+	success = upload_dir("", 0);
+	if (success && !upload_started) {
+		// The file we got to is gone so the session is sent again from the start
+		ESP_LOGE(TAG, "Could not find %s", upload_marker.file);
+		memset(&upload_marker, 0, sizeof(upload_marker_t));
+		upload_marker.magic = UPLOAD_MAGIC;
+		(void) upload_write_marker();
+		success = false;
+	}
+	
+	if (success) {
+		upload_marker.done = 1;
+		success = upload_write_marker();
+	}
+	
+	ESP_LOGI(TAG, "Upload %s %s", upload_session_name, success ? "done" : "failed");
+	
+	portENTER_CRITICAL(&upload_mux);
+	upload_status.active = false;
+	if (success) {
+		upload_status.sessions++;
+	} else {
+		upload_status.failures++;
+	}
+	portEXIT_CRITICAL(&upload_mux);
+	
+	heap_caps_free(upload_bufP);
+	upload_bufP = NULL;
+	
+	return success;
+}
+
+
+/**
+ * Upload the files in a session directory (depth 0) and its subdirectories (depth 1)
+ * in directory order, skipping files before the marker's file
+ */
+static bool upload_dir(const char* rel_dir, int depth)
+{
+	char path[XFER_MAX_PATH_LEN];
+	char rel_path[XFER_MAX_PATH_LEN];
+	FF_DIR dir;
+	FILINFO* fiP = &upload_fi[depth];
+	bool success = true;
+	uint32_t offset;
+	
+	if (depth == 0) {
+		snprintf(path, XFER_MAX_PATH_LEN, "/%s", upload_session_name);
+	} else {
+		snprintf(path, XFER_MAX_PATH_LEN, "/%s/%s", upload_session_name, rel_dir);
+	}
+	if (f_opendir(&dir, path) != FR_OK) {
+		ESP_LOGE(TAG, "Could not open %s", path);
+		return false;
+	}
+	
+	while (success && (f_readdir(&dir, fiP) == FR_OK) && (fiP->fname[0] != 0)) {
+		if (depth == 0) {
+			if (strcmp(fiP->fname, UPLOAD_FILE_NAME) == 0) continue;
+			snprintf(rel_path, XFER_MAX_PATH_LEN, "%s", fiP->fname);
+		} else {
+			snprintf(rel_path, XFER_MAX_PATH_LEN, "%s/%s", rel_dir, fiP->fname);
+		}
+	
+		if ((fiP->fattrib & AM_DIR) != 0) {
+			if (depth == 0) {
+				success = upload_dir(rel_path, 1);
+			}
+			continue;
+		}
+	
+		offset = 0;
+		if (!upload_started) {
+			if (strcmp(rel_path, upload_marker.file) != 0) continue;
+			upload_started = true;
+			offset = upload_marker.offset;
+		}
+		success = upload_file(rel_path, offset);
+	}
+	f_closedir(&dir);
+	
+	return success;
+}
+
+
+/**
+ * Upload one file (path relative to the session directory) from offset in requests of
+ * up to UPLOAD_REQUEST_LEN bytes, recording the progress in the marker after each
+ */
+static bool upload_file(const char* rel_path, uint32_t offset)
+{
+	char path[XFER_MAX_PATH_LEN];
+	bool success = true;
+	uint32_t length;
+	uint32_t n;
+	
+	snprintf(path, XFER_MAX_PATH_LEN, "/%s/%s", upload_session_name, rel_path);
+	if (f_open(&upload_fil, path, FA_READ) != FR_OK) {
+		ESP_LOGE(TAG, "Could not open %s", path);
+		return false;
+	}
+	
+	length = f_size(&upload_fil);
+	if (offset > length) offset = length;
+	if ((offset == length) && (length != 0)) {
+		// Finished before we were interrupted
+		f_close(&upload_fil);
+		return true;
+	}
+	if (f_lseek(&upload_fil, offset) != FR_OK) {
+		ESP_LOGE(TAG, "Could not seek to %u in %s", offset, path);
+		f_close(&upload_fil);
+		return false;
+	}
+	
+	// An empty file is sent as one empty request
+	do {
+		n = length - offset;
+		if (n > UPLOAD_REQUEST_LEN) n = UPLOAD_REQUEST_LEN;
+	
+		success = upload_put(rel_path, offset, n, length);
+		if (success) {
+			offset += n;
+			strcpy(upload_marker.file, rel_path);
+			upload_marker.offset = offset;
+			success = upload_write_marker();
+		}
+	} while (success && (offset < length));
+	
+	f_close(&upload_fil);
+	
+	return success;
+}
+
+
+/**
+ * Send n bytes of the open file from offset in one PUT request and wait for the
+ * server's response.  A request that doesn't hold the whole file has a Content-Range
+ * header.
+ */
+static bool upload_put(const char* rel_path, uint32_t offset, uint32_t n, uint32_t length)
+{
+	char hdr[UPLOAD_MAX_HDR_LEN];
+	bool success;
+	int hdr_len;
+	uint32_t end;
+	UINT len;
+	UINT br;
+	
+	// Stop when the server is disabled or can't be reached anymore
+	if (!upload_ready() || !upload_connect()) return false;
+	
+	hdr_len = snprintf(hdr, UPLOAD_MAX_HDR_LEN, "PUT /%s/%s/%s HTTP/1.1\r\nHost: %s\r\n" \
+	                   "Content-Type: application/octet-stream\r\nContent-Length: %u\r\n",
+	                   upload_camera, upload_session_name, rel_path, upload_host, n);
+	if ((n != 0) && (n != length)) {
+		hdr_len += snprintf(&hdr[hdr_len], UPLOAD_MAX_HDR_LEN - hdr_len, "Content-Range: bytes %u-%u/%u\r\n",
+		                    offset, offset + n - 1, length);
+	}
+	hdr_len += snprintf(&hdr[hdr_len], UPLOAD_MAX_HDR_LEN - hdr_len, "\r\n");
+	success = upload_send_all((uint8_t*) hdr, hdr_len);
+	
+	// Blocks start at block-aligned offsets so the card is read in whole clusters
+	end = offset + n;
+	while (success && (offset < end)) {
+		len = UPLOAD_BLOCK_LEN - (offset % UPLOAD_BLOCK_LEN);
+		if (len > (end - offset)) len = end - offset;
+	
+		if ((f_read(&upload_fil, upload_bufP, len, &br) != FR_OK) || (br != len)) {
+			ESP_LOGE(TAG, "Read %s failed at %u", rel_path, offset);
+			success = false;
+		} else {
+			success = upload_send_all(upload_bufP, len);
+			offset += len;
+			upload_throttle(len);
+		}
+	}
+	
+	if (success) {
+		success = upload_read_response();
+	}
+	
+	if (!success) {
+		// The connection is out of step with our requests
+		upload_disconnect();
+	}
+	
+	return success;
+}
+
+
+/**
+ * Read the server's response to a request, discarding its body.  Returns true if it
+ * was successful (2xx).
+ */
+static bool upload_read_response()
+{
+	char rsp[UPLOAD_MAX_HDR_LEN + 1];
+	char* endP;
+	char* p;
+	bool close_after;
+	int len = 0;
+	int ret;
+	int status;
+	uint32_t body_len;
+	uint32_t content_len = 0;
+	
+	// Read to the end of the header
+	do {
+		if (len == UPLOAD_MAX_HDR_LEN) {
+			ESP_LOGE(TAG, "Response header too long");
+			return false;
+		}
+		ret = recv(upload_sock, &rsp[len], UPLOAD_MAX_HDR_LEN - len, 0);
+		if (ret <= 0) {
+			ESP_LOGE(TAG, "No response: errno %d", errno);
+			return false;
+		}
+		len += ret;
+		rsp[len] = 0;
+	} while ((endP = strstr(rsp, "\r\n\r\n")) == NULL);
+	
+	body_len = len - ((endP + 4) - rsp);
+	*endP = 0;
+	for (p = rsp; *p != 0; p++) {
+		*p = tolower((int) *p);
+	}
+	
+	if (sscanf(rsp, "http/%*d.%*d %d", &status) != 1) {
+		ESP_LOGE(TAG, "Bad response");
+		return false;
+	}
+	if ((p = strstr(rsp, "\r\ncontent-length:")) != NULL) {
+		content_len = strtoul(p + strlen("\r\ncontent-length:"), NULL, 10);
+	}
+	
+	// We can't find the end of a chunked body so the connection is closed after it
+	close_after = (strstr(rsp, "\r\nconnection: close") != NULL) ||
+	              (strstr(rsp, "\r\ntransfer-encoding:") != NULL);
+	
+	while (!close_after && (body_len < content_len)) {
+		ret = recv(upload_sock, rsp, UPLOAD_MAX_HDR_LEN, 0);
+		if (ret <= 0) {
+			close_after = true;
+		} else {
+			body_len += ret;
+		}
+	}
+	
+	if (close_after) {
+		upload_disconnect();
+	}
+	
+	if ((status < 200) || (status > 299)) {
+		ESP_LOGE(TAG, "Server returned %d", status);
+		return false;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Keep the upload from competing with a recording: limit its rate and wait while
+ * file_task has images queued
+ */
+static void upload_throttle(uint32_t len)
+{
+	file_rec_stats_t rec_stats;
+	
+	if (!app_task_get_recording()) return;
+	
+	vTaskDelay(pdMS_TO_TICKS((len * 1000) / (UPLOAD_REC_KBPS * 1024)));
+	
+	file_task_get_rec_stats(&rec_stats);
+	while ((rec_stats.queued != 0) && app_task_get_recording()) {
+		vTaskDelay(pdMS_TO_TICKS(UPLOAD_QUEUE_WAIT_MSEC));
+		file_task_get_rec_stats(&rec_stats);
+	}
+}
+
+
+static bool upload_read_marker(const char* name, upload_marker_t* mP)
+{
+	char path[XFER_MAX_PATH_LEN];
+	bool success;
+	UINT br;
+	
+	snprintf(path, XFER_MAX_PATH_LEN, "/%s/%s", name, UPLOAD_FILE_NAME);
+	if (f_open(&upload_marker_fil, path, FA_READ) != FR_OK) return false;
+	
+	success = (f_read(&upload_marker_fil, mP, sizeof(upload_marker_t), &br) == FR_OK) &&
+	          (br == sizeof(upload_marker_t)) && (mP->magic == UPLOAD_MAGIC);
+	mP->file[XFER_MAX_PATH_LEN-1] = 0;
+	
+	f_close(&upload_marker_fil);
+	
+	return success;
+}
+
+
+static bool upload_write_marker()
+{
+	char path[XFER_MAX_PATH_LEN];
+	bool success;
+	UINT bw;
+	
+	snprintf(path, XFER_MAX_PATH_LEN, "/%s/%s", upload_session_name, UPLOAD_FILE_NAME);
+	if (f_open(&upload_marker_fil, path, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+		ESP_LOGE(TAG, "Could not create %s", path);
+		return false;
+	}
+	
+	success = (f_write(&upload_marker_fil, &upload_marker, sizeof(upload_marker_t), &bw) == FR_OK) &&
+	          (bw == sizeof(upload_marker_t));
+	
+	if ((f_close(&upload_marker_fil) != FR_OK) || !success) {
+		ESP_LOGE(TAG, "Could not write %s", path);
+		return false;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Connect to the server if we aren't already.  Traffic is marked as background so the
+ * access point sends images and commands to clients ahead of it.
+ */
+static bool upload_connect()
+{
+	struct sockaddr_in dest_addr;
+	struct timeval tv;
+	int tos = WIFI_TOS_BACKGROUND;
+	
+	if (upload_sock >= 0) return true;
+	
+	upload_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+	if (upload_sock < 0) {
+		ESP_LOGE(TAG, "Unable to create TCP socket: errno %d", errno);
+		return false;
+	}
+	
+	tv.tv_sec = UPLOAD_TIMEOUT_MSEC / 1000;
+	tv.tv_usec = 0;
+	(void) setsockopt(upload_sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	(void) setsockopt(upload_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	(void) setsockopt(upload_sock, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+	
+	dest_addr.sin_family = AF_INET;
+	dest_addr.sin_addr.s_addr = htonl(upload_addr);
+	dest_addr.sin_port = htons(upload_port);
+	if (connect(upload_sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) != 0) {
+		ESP_LOGE(TAG, "Could not connect to port %d: errno %d", upload_port, errno);
+		upload_disconnect();
+		return false;
+	}
+	
+	snprintf(upload_host, sizeof(upload_host), "%d.%d.%d.%d:%u", (upload_addr >> 24) & 0xFF,
+	         (upload_addr >> 16) & 0xFF, (upload_addr >> 8) & 0xFF, upload_addr & 0xFF, upload_port);
+	
+	return true;
+}
+
+
+static void upload_disconnect()
+{
+	if (upload_sock >= 0) {
+		shutdown(upload_sock, 0);
+		close(upload_sock);
+		upload_sock = -1;
+	}
+}
+
+
+/**
+ * Send a buffer, waiting for the socket as necessary
+ */
+static bool upload_send_all(const uint8_t* bufP, int len)
+{
+	int ret;
+	
+	while (len > 0) {
+		ret = send(upload_sock, bufP, len, 0);
+		if (ret <= 0) {
+			ESP_LOGE(TAG, "TCP send failed: errno %d", errno);
+			return false;
+		}
+		bufP += ret;
+		len -= ret;
+	
+		portENTER_CRITICAL(&upload_mux);
+		upload_sent += ret;
+		portEXIT_CRITICAL(&upload_mux);
+	}
+	
+	return true;
+}
+
+
+/**
+ * Upload paths start with the camera name so several cameras can share a server.
+ * Characters that would need escaping in a URL are replaced.
+ */
+static void upload_set_camera_name()
+{
+	char* p;
+	
+	strncpy(upload_camera, wifi_get_info()->ap_ssid, PS_SSID_MAX_LEN);
+	upload_camera[PS_SSID_MAX_LEN] = 0;
+	for (p = upload_camera; *p != 0; p++) {
+		if (!isalnum((int) *p) && (*p != '-') && (*p != '_') && (*p != '.')) {
+			*p = '_';
+		}
+	}
+}
@@ -0,0 +1,483 @@
+/*
+ * Xfer Task
+ *
+ * Lists the recording sessions on the Micro-SD Card and streams a file or a whole
+ * session to a client over TCP for the list_sessions, get_file and get_session commands
+ * so recordings can be collected without removing the card.  Runs alongside file_task
+ * (FATFS serializes their accesses) so recording continues during a transfer.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "xfer_task.h"
+#include "cmd_task.h"
+#include "file_task.h"
+#include "file_utilities.h"
+#include "sys_utilities.h"
+#include "system_config.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include "ff.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+
+
+//
+// Xfer Task variables
+//
+static const char* TAG = "xfer_task";
+
+// Last session list, read by cmd_task
+static xfer_session_t xfer_sessions[XFER_MAX_SESSIONS];
+static int xfer_session_count = 0;
+static int xfer_session_total = 0;
+static portMUX_TYPE xfer_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Session list being built
+static xfer_session_t xfer_scan[XFER_MAX_SESSIONS];
+
+// Current transfer
+static bool xfer_busy = false;
+static xfer_request_t xfer_req;
+static bool xfer_started;              // Reached the request's first file
+static uint32_t xfer_sent;             // Bytes sent this transfer
+
+// Block buffer in internal DMA-capable RAM
+static uint8_t* xfer_bufP;
+
+// FATFS objects (with their sector buffers and long names) are kept off the stack
+static FIL xfer_fil;
+static FILINFO xfer_fi[2];             // One for each directory level in a session
+
+
+
+//
+// Xfer Task Forward Declarations for internal functions
+//
+static void xfer_build_list();
+static void xfer_read_index(xfer_session_t* sP);
+static void xfer_send();
+static bool xfer_send_dir(int sock, const char* rel_dir, int depth);
+static bool xfer_send_file(int sock, const char* rel_path, uint32_t offset);
+static bool xfer_send_all(int sock, const uint8_t* bufP, int len);
+
+
+
+//
+// Xfer Task API
+//
+void xfer_task()
+{
+	uint32_t notification_value;
+	
+	ESP_LOGI(TAG, "Start task");
+	
+	xfer_bufP = heap_caps_malloc(XFER_BLOCK_LEN, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+	if (xfer_bufP == NULL) {
+		ESP_LOGE(TAG, "Could not allocate buffer - bailing");
+		vTaskDelete(NULL);
+	}
+	
+	while (1) {
+		xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, portMAX_DELAY);
+	
+		if (Notification(notification_value, XFER_NOTIFY_SEND_MASK)) {
+			xfer_send();
+	
+			portENTER_CRITICAL(&xfer_mux);
+			xfer_busy = false;
+			portEXIT_CRITICAL(&xfer_mux);
+		}
+	
+		// A list requested during a transfer is built after it
+		if (Notification(notification_value, XFER_NOTIFY_LIST_MASK)) {
+			xfer_build_list();
+			xTaskNotify(task_handle_cmd, CMD_NOTIFY_XFER_MASK, eSetBits);
+		}
+	}
+}
+
+
+/**
+ * Request a new session list.  cmd_task is notified when it is ready.
+ */
+bool xfer_task_request_list()
+{
+	xTaskNotify(task_handle_xfer, XFER_NOTIFY_LIST_MASK, eSetBits);
+	
+	return true;
+}
+
+
+/**
+ * Request a file or session transfer.  Returns false if a transfer is already in
+ * progress.
+ */
+bool xfer_task_request_send(xfer_request_t* reqP)
+{
+	bool started = false;
+	
+	portENTER_CRITICAL(&xfer_mux);
+	if (!xfer_busy) {
+		xfer_busy = true;
+		xfer_req = *reqP;
+		started = true;
+	}
+	portEXIT_CRITICAL(&xfer_mux);
+	
+	if (started) {
+		xTaskNotify(task_handle_xfer, XFER_NOTIFY_SEND_MASK, eSetBits);
+	} else {
+		ESP_LOGE(TAG, "Transfer already in progress");
+	}
+	
+	return started;
+}
+
+
+/**
+ * Return the number of sessions in the last list and load total with the number of
+ * sessions found on the card
+ */
+int xfer_task_get_session_count(int* total)
+{
+	int n;
+	
+	portENTER_CRITICAL(&xfer_mux);
+	n = xfer_session_count;
+	*total = xfer_session_total;
+	portEXIT_CRITICAL(&xfer_mux);
+	
+	return n;
+}
+
+
+/**
+ * Get a copy of entry i in the last list
+ */
+bool xfer_task_get_session(int i, xfer_session_t* sP)
+{
+	bool valid = false;
+	
+	portENTER_CRITICAL(&xfer_mux);
+	if ((i >= 0) && (i < xfer_session_count)) {
+		*sP = xfer_sessions[i];
+		valid = true;
+	}
+	portEXIT_CRITICAL(&xfer_mux);
+	
+	return valid;
+}
+
+
+
+//
+// Xfer Task internal functions
+//
+
+/**
+ * Find the session directories and read their indexes.  The newest XFER_MAX_SESSIONS
+ * are kept, in name (age) order.
+ */
+static void xfer_build_list()
+{
+	FF_DIR dir;
+	FILINFO* fiP = &xfer_fi[0];
+	int count = 0;
+	int total = 0;
+	int i;
+	
+	if (file_get_card_mounted() && (f_opendir(&dir, "/") == FR_OK)) {
+		while ((f_readdir(&dir, fiP) == FR_OK) && (fiP->fname[0] != 0)) {
+			if (((fiP->fattrib & AM_DIR) == 0) ||
+			    (strncmp(fiP->fname, SESSION_DIR_PREFIX, strlen(SESSION_DIR_PREFIX)) != 0) ||
+			    (strlen(fiP->fname) >= SESSION_DIR_NAME_LEN))
+			{
+				continue;
+			}
+			total++;
+	
+			// Insert in order, dropping the oldest when the list is full
+			if (count == XFER_MAX_SESSIONS) {
+				if (strcmp(fiP->fname, xfer_scan[0].name) < 0) continue;
+				memmove(&xfer_scan[0], &xfer_scan[1], (count - 1) * sizeof(xfer_session_t));
+				count--;
+			}
+			for (i=count; (i > 0) && (strcmp(fiP->fname, xfer_scan[i-1].name) < 0); i--) {
+				xfer_scan[i] = xfer_scan[i-1];
+			}
+			strcpy(xfer_scan[i].name, fiP->fname);
+			count++;
+		}
+		f_closedir(&dir);
+	} else {
+		ESP_LOGE(TAG, "Could not read the card's root directory");
+	}
+	
+	for (i=0; i<count; i++) {
+		xfer_read_index(&xfer_scan[i]);
+	}
+	
+	portENTER_CRITICAL(&xfer_mux);
+	memcpy(xfer_sessions, xfer_scan, count * sizeof(xfer_session_t));
+	xfer_session_count = count;
+	xfer_session_total = total;
+	portEXIT_CRITICAL(&xfer_mux);
+}
+
+
+/**
+ * Get the image count and time span of a session from its index file (left zero if it
+ * doesn't have a valid one)
+ */
+static void xfer_read_index(xfer_session_t* sP)
+{
+	char path[XFER_MAX_PATH_LEN];
+	file_index_header_t hdr;
+	file_index_entry_t entry;
+	UINT br;
+	uint32_t n;
+	
+	sP->images = 0;
+	sP->start_sec = 0;
+	sP->end_sec = 0;
+	
+	snprintf(path, XFER_MAX_PATH_LEN, "/%s/%s", sP->name, INDEX_FILE_NAME);
+	if (f_open(&xfer_fil, path, FA_READ) != FR_OK) return;
+	
+	if ((f_read(&xfer_fil, &hdr, sizeof(hdr), &br) == FR_OK) && (br == sizeof(hdr)) &&
+	    (hdr.magic == FILE_INDEX_MAGIC) && (hdr.entry_len >= sizeof(file_index_entry_t)))
+	{
+		n = (f_size(&xfer_fil) - sizeof(hdr)) / hdr.entry_len;
+		if ((n != 0) &&
+		    (f_read(&xfer_fil, &entry, sizeof(entry), &br) == FR_OK) && (br == sizeof(entry)))
+		{
+			sP->start_sec = entry.epoch_sec;
+			if ((f_lseek(&xfer_fil, sizeof(hdr) + (n - 1) * hdr.entry_len) == FR_OK) &&
+			    (f_read(&xfer_fil, &entry, sizeof(entry), &br) == FR_OK) && (br == sizeof(entry)))
+			{
+				sP->images = n;
+				sP->end_sec = entry.epoch_sec;
+			}
+		}
+	}
+	
+	f_close(&xfer_fil);
+}
+
+
+/**
+ * Connect to the requesting client and send the requested file or session
+ */
+static void xfer_send()
+{
+	struct sockaddr_in dest_addr;
+	struct timeval tv;
+	xfer_file_header_t hdr;
+	int64_t start_usec;
+	bool success;
+	int sock;
+	
+	if (!file_get_card_mounted()) {
+		ESP_LOGE(TAG, "No card for transfer");
+		return;
+	}
+	
+	sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+	if (sock < 0) {
+		ESP_LOGE(TAG, "Unable to create TCP socket: errno %d", errno);
+		return;
+	}
+	
+	tv.tv_sec = XFER_SEND_TIMEOUT_MSEC / 1000;
+	tv.tv_usec = 0;
+	(void) setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	
+	dest_addr.sin_family = AF_INET;
+	dest_addr.sin_addr.s_addr = xfer_req.tcp_addr;
+	dest_addr.sin_port = htons(xfer_req.tcp_port);
+	if (connect(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) != 0) {
+		ESP_LOGE(TAG, "Could not connect to port %d: errno %d", xfer_req.tcp_port, errno);
+		close(sock);
+		return;
+	}
+	
+	ESP_LOGI(TAG, "Sending %s %s %s", xfer_req.whole_session ? "session" : "file",
+	         xfer_req.session, xfer_req.file);
+	start_usec = esp_timer_get_time();
+	xfer_sent = 0;
+	if (xfer_req.whole_session) {
+		xfer_started = (xfer_req.file[0] == 0);
+		success = xfer_send_dir(sock, "", 0);
+		if (success && !xfer_started) {
+			ESP_LOGE(TAG, "Could not find %s", xfer_req.file);
+			success = false;
+		}
+	} else {
+		xfer_started = true;
+		success = xfer_send_file(sock, xfer_req.file, xfer_req.offset);
+	}
+	
+	if (success) {
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.magic = XFER_MAGIC;
+		success = xfer_send_all(sock, (uint8_t*) &hdr, sizeof(hdr));
+	}
+	
+	ESP_LOGI(TAG, "Transfer %s: %u bytes in %u mSec", success ? "done" : "failed", xfer_sent,
+	         (uint32_t) ((esp_timer_get_time() - start_usec) / 1000));
+	
+	shutdown(sock, 0);
+	close(sock);
+}
+
+
+/**
+ * Send the files in a session directory (depth 0) and its subdirectories (depth 1) in
+ * directory order, skipping files before the request's first file
+ */
+static bool xfer_send_dir(int sock, const char* rel_dir, int depth)
+{
+	char path[XFER_MAX_PATH_LEN];
+	char rel_path[XFER_MAX_PATH_LEN];
+	FF_DIR dir;
+	FILINFO* fiP = &xfer_fi[depth];
+	bool success = true;
+	uint32_t offset;
+	
+	if (depth == 0) {
+		snprintf(path, XFER_MAX_PATH_LEN, "/%s", xfer_req.session);
+	} else {
+		snprintf(path, XFER_MAX_PATH_LEN, "/%s/%s", xfer_req.session, rel_dir);
+	}
+	if (f_opendir(&dir, path) != FR_OK) {
+		ESP_LOGE(TAG, "Could not open %s", path);
+		return false;
+	}
+	
+	while (success && (f_readdir(&dir, fiP) == FR_OK) && (fiP->fname[0] != 0)) {
+		if (depth == 0) {
+			snprintf(rel_path, XFER_MAX_PATH_LEN, "%s", fiP->fname);
+		} else {
+			snprintf(rel_path, XFER_MAX_PATH_LEN, "%s/%s", rel_dir, fiP->fname);
+		}
+	
+		if ((fiP->fattrib & AM_DIR) != 0) {
+			if (depth == 0) {
+				success = xfer_send_dir(sock, rel_path, 1);
+			}
+			continue;
+		}
+	
+		offset = 0;
+		if (!xfer_started) {
+			if (strcmp(rel_path, xfer_req.file) != 0) continue;
+			xfer_started = true;
+			offset = xfer_req.offset;
+		}
+		success = xfer_send_file(sock, rel_path, offset);
+	}
+	f_closedir(&dir);
+	
+	return success;
+}
+
+
+/**
+ * Send one file (path relative to the session directory) from offset
+ */
+static bool xfer_send_file(int sock, const char* rel_path, uint32_t offset)
+{
+	char path[XFER_MAX_PATH_LEN];
+	uint8_t hdr_buf[sizeof(xfer_file_header_t) + XFER_MAX_PATH_LEN];
+	xfer_file_header_t* hdrP = (xfer_file_header_t*) hdr_buf;
+	bool success = true;
+	uint32_t length;
+	UINT len;
+	UINT br;
+	
+	snprintf(path, XFER_MAX_PATH_LEN, "/%s/%s", xfer_req.session, rel_path);
+	if (f_open(&xfer_fil, path, FA_READ) != FR_OK) {
+		ESP_LOGE(TAG, "Could not open %s", path);
+		return false;
+	}
+	
+	length = f_size(&xfer_fil);
+	if (offset > length) offset = length;
+	if (f_lseek(&xfer_fil, offset) != FR_OK) {
+		ESP_LOGE(TAG, "Could not seek to %u in %s", offset, path);
+		f_close(&xfer_fil);
+		return false;
+	}
+	
+	hdrP->magic = XFER_MAGIC;
+	hdrP->length = length;
+	hdrP->offset = offset;
+	hdrP->name_len = strlen(rel_path);
+	hdrP->reserved = 0;
+	memcpy(&hdr_buf[sizeof(xfer_file_header_t)], rel_path, hdrP->name_len);
+	success = xfer_send_all(sock, hdr_buf, sizeof(xfer_file_header_t) + hdrP->name_len);
+	
+	// Blocks start at block-aligned offsets so the card is read in whole clusters
+	while (success && (offset < length)) {
+		len = XFER_BLOCK_LEN - (offset % XFER_BLOCK_LEN);
+		if (len > (length - offset)) len = length - offset;
+	
+		if ((f_read(&xfer_fil, xfer_bufP, len, &br) != FR_OK) || (br != len)) {
+			ESP_LOGE(TAG, "Read %s failed at %u", path, offset);
+			success = false;
+		} else {
+			success = xfer_send_all(sock, xfer_bufP, len);
+			offset += len;
+		}
+	}
+	
+	f_close(&xfer_fil);
+	
+	return success;
+}
+
+
+/**
+ * Send a buffer, waiting for the socket as necessary
+ */
+static bool xfer_send_all(int sock, const uint8_t* bufP, int len)
+{
+	int ret;
+	
+	while (len > 0) {
+		ret = send(sock, bufP, len, 0);
+		if (ret <= 0) {
+			ESP_LOGE(TAG, "TCP send failed: errno %d", errno);
+			return false;
+		}
+		bufP += ret;
+		len -= ret;
+		xfer_sent += ret;
+	}
+	
+	return true;
+}
@@ -0,0 +1,552 @@
+/*
+ * Load generator and latency benchmark for the firecam command interface
+ *
+ *   fc_bench [-t seconds] [-p pollers] [-i poll msec] [-s streamers] [-f format]
+ *            [-w writers] [-W write msec] <camera ip>
+ *
+ * Opens a mix of command connections to one camera for a fixed time: pollers send
+ * get_status as soon as the previous response arrives (or every -i mSec), streamers
+ * stream images once per second in the -f image format and writers rewrite a
+ * display-only setting with set_config followed by get_config every -W mSec.  Then it
+ * reports the round-trip latency percentiles of each kind of command, the image
+ * throughput and the images the streamers missed next to the counters from the
+ * camera's get_perf command, sampled at the start and end of the run over one more
+ * control connection.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#define _GNU_SOURCE
+#include "fc_client.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+//
+// FCB Constants
+//
+
+// Client roles
+#define FCB_ROLE_CONTROL      0
+#define FCB_ROLE_POLLER       1
+#define FCB_ROLE_STREAMER     2
+#define FCB_ROLE_WRITER       3
+#define FCB_NUM_ROLES         4
+
+#define FCB_MAX_CLIENTS       64
+
+// Streamed image period (seconds) and contents
+#define FCB_STREAM_PERIOD     1
+#define FCB_STREAM_CONTENTS   (FCC_STREAM_JPEG | FCC_STREAM_RADIOM | FCC_STREAM_TELEM | FCC_STREAM_METADATA)
+
+// Tags (a request's tag is never 0 so it can't be confused with a streamed image)
+#define FCB_TAG_PERF          1
+#define FCB_TAG_CONFIG        2
+#define FCB_TAG_FIRST         16
+
+// Time to wait for the connections and final get_perf response (mSec)
+#define FCB_CONNECT_MSEC      5000
+#define FCB_FINISH_MSEC       5000
+
+// Setting the writers rewrite with its current value (it only affects the LCD)
+#define FCB_WRITE_KEY         "fusion_alpha"
+
+// get_perf stages reported
+static const char* fcb_perf_stages[] = {"TCP Send", "JSON Build", "ArduCAM Capture", "SD Write"};
+#define FCB_NUM_PERF_STAGES   (sizeof(fcb_perf_stages) / sizeof(fcb_perf_stages[0]))
+
+static const char* fcb_role_names[FCB_NUM_ROLES] = {"control", "get_status", "stream", "set_config"};
+
+
+//
+// FCB typedefs
+//
+
+// Round-trip latency samples (uSec)
+typedef struct {
+	double* samples;
+	int count;
+	int size;
+} fcb_lat_t;
+
+typedef struct {
+	int valid;
+	double uptime;
+	double count[FCB_NUM_PERF_STAGES];
+	double avg[FCB_NUM_PERF_STAGES];
+	double max[FCB_NUM_PERF_STAGES];
+} fcb_perf_t;
+
+typedef struct {
+	fcc_conn_t* conn;
+	int role;                      // FCB_ROLE_*
+	int connected;
+	int closed;
+	int error;
+	uint16_t tag;                  // Outstanding request's tag (0 if none)
+	uint16_t next_tag;
+	double sent_usec;              // When the outstanding request was sent
+	double next_usec;              // When the next request is due
+	int write_value;               // Writer's value for FCB_WRITE_KEY (-1 until read)
+	uint32_t images;
+	uint64_t image_bytes;
+	double first_image_usec;
+	double last_image_usec;
+	uint32_t late_responses;       // Responses that didn't match the outstanding request
+} fcb_client_t;
+
+
+//
+// FCB variables
+//
+static fcb_client_t clients[FCB_MAX_CLIENTS];
+static int num_clients;
+
+static fcb_lat_t latency[FCB_NUM_ROLES];
+
+static fcb_perf_t perf_start;
+static fcb_perf_t perf_end;
+
+static int poll_msec = 0;
+static int write_msec = 1000;
+static int stream_format = FCC_IMG_FMT_BINARY;
+static int running = 1;
+
+
+//
+// FCB internal functions
+//
+static double fcb_now_usec()
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec * 1000000.0 + (double) ts.tv_nsec / 1000.0;
+}
+
+
+static void fcb_add_latency(int role, double usec)
+{
+	fcb_lat_t* lP = &latency[role];
+	double* newP;
+	
+	if (lP->count == lP->size) {
+		lP->size = (lP->size == 0) ? 4096 : lP->size * 2;
+		newP = (double*) realloc(lP->samples, lP->size * sizeof(double));
+		if (newP == NULL) return;
+		lP->samples = newP;
+	}
+	lP->samples[lP->count++] = usec;
+}
+
+
+static int fcb_compare_double(const void* a, const void* b)
+{
+	double da = *(const double*) a;
+	double db = *(const double*) b;
+	
+	return (da < db) ? -1 : ((da > db) ? 1 : 0);
+}
+
+
+// Return the p percentile of a sorted set of samples (nearest rank)
+static double fcb_percentile(const fcb_lat_t* lP, int p)
+{
+	int i;
+	
+	if (lP->count == 0) return 0;
+	i = (int) (((int64_t) p * lP->count + 99) / 100) - 1;
+	if (i < 0) i = 0;
+	if (i >= lP->count) i = lP->count - 1;
+	return lP->samples[i];
+}
+
+
+// Find the number following key in json text, starting at the object item section if it
+// isn't NULL.  Returns 0 or -1 if it isn't found.
+static int fcb_json_find_number(const char* json, uint32_t len, const char* section, const char* key, double* valP)
+{
+	char pattern[64];
+	const char* endP = json + len;
+	const char* p = json;
+	char* numEndP;
+	char num[32];
+	int n;
+	
+	if (section != NULL) {
+		snprintf(pattern, sizeof(pattern), "\"%s\"", section);
+		p = (const char*) memmem(p, endP - p, pattern, strlen(pattern));
+		if (p == NULL) return -1;
+	}
+	snprintf(pattern, sizeof(pattern), "\"%s\"", key);
+	p = (const char*) memmem(p, endP - p, pattern, strlen(pattern));
+	if (p == NULL) return -1;
+	p += strlen(pattern);
+	while ((p < endP) && ((*p == ' ') || (*p == ':'))) p++;
+	
+	// Copy the number so strtod can't run past the end of the frame
+	for (n=0; (n < (int) sizeof(num) - 1) && ((p + n) < endP) && (strchr("+-.0123456789eE", p[n]) != NULL); n++) {
+		num[n] = p[n];
+	}
+	num[n] = 0;
+	*valP = strtod(num, &numEndP);
+	return (numEndP == num) ? -1 : 0;
+}
+
+
+static void fcb_parse_perf(const fcc_frame_t* frame, fcb_perf_t* perfP)
+{
+	const char* json = (const char*) frame->data;
+	unsigned int i;
+	
+	memset(perfP, 0, sizeof(fcb_perf_t));
+	if (fcb_json_find_number(json, frame->len, NULL, "Uptime", &perfP->uptime) != 0) return;
+	for (i=0; i<FCB_NUM_PERF_STAGES; i++) {
+		(void) fcb_json_find_number(json, frame->len, fcb_perf_stages[i], "Count", &perfP->count[i]);
+		(void) fcb_json_find_number(json, frame->len, fcb_perf_stages[i], "Avg", &perfP->avg[i]);
+		(void) fcb_json_find_number(json, frame->len, fcb_perf_stages[i], "Max", &perfP->max[i]);
+	}
+	perfP->valid = 1;
+}
+
+
+static void fcb_send_request(fcb_client_t* cP, double now)
+{
+	char cmd[FCC_MAX_CMD_LEN];
+	
+	cP->tag = cP->next_tag++;
+	if (cP->next_tag < FCB_TAG_FIRST) cP->next_tag = FCB_TAG_FIRST;
+	
+	cP->sent_usec = now;
+	if (cP->role == FCB_ROLE_POLLER) {
+		(void) fcc_send_simple(cP->conn, "get_status", cP->tag);
+	} else {
+		// set_config has no response so it is timed through the get_config after it
+		// (commands are processed in order)
+		snprintf(cmd, sizeof(cmd), "{\"cmd\":\"set_config\",\"args\":{\"%s\":%d}}", FCB_WRITE_KEY, cP->write_value);
+		(void) fcc_send_cmd(cP->conn, cmd);
+		(void) fcc_send_simple(cP->conn, "get_config", cP->tag);
+	}
+}
+
+
+static void fcb_handle_frame(fcb_client_t* cP, const fcc_frame_t* frame)
+{
+	double now = fcb_now_usec();
+	double v;
+	
+	switch (cP->role) {
+		case FCB_ROLE_CONTROL:
+			if ((frame->type == FCC_FRAME_JSON) && (frame->tag == FCB_TAG_PERF)) {
+				fcb_parse_perf(frame, running ? &perf_start : &perf_end);
+			}
+			break;
+	
+		case FCB_ROLE_STREAMER:
+			if (frame->tag != 0) break;
+			if (cP->images++ == 0) {
+				cP->first_image_usec = now;
+			}
+			cP->image_bytes += frame->len;
+			cP->last_image_usec = now;
+			break;
+	
+		case FCB_ROLE_POLLER:
+		case FCB_ROLE_WRITER:
+			if (frame->type != FCC_FRAME_JSON) break;
+			if (frame->tag == FCB_TAG_CONFIG) {
+				// The writer's starting value
+				if (fcb_json_find_number((const char*) frame->data, frame->len, NULL, FCB_WRITE_KEY, &v) == 0) {
+					cP->write_value = (int) v;
+					cP->next_usec = now;
+				}
+				break;
+			}
+			if ((cP->tag == 0) || (frame->tag != cP->tag)) {
+				cP->late_responses++;
+				break;
+			}
+			if (running) {
+				fcb_add_latency(cP->role, now - cP->sent_usec);
+			}
+			cP->tag = 0;
+			cP->next_usec = cP->sent_usec + ((cP->role == FCB_ROLE_POLLER) ? poll_msec : write_msec) * 1000.0;
+			break;
+	}
+}
+
+
+static void fcb_callback(fcc_conn_t* conn, const fcc_event_t* ev, void* user)
+{
+	fcb_client_t* cP = (fcb_client_t*) user;
+	
+	(void) conn;
+	switch (ev->type) {
+		case FCC_EV_CONNECTED:
+			cP->connected = 1;
+			break;
+	
+		case FCC_EV_FRAME:
+			fcb_handle_frame(cP, &ev->frame);
+			break;
+	
+		case FCC_EV_CLOSED:
+			cP->closed = 1;
+			cP->error = ev->error;
+			cP->conn = NULL;
+			break;
+	}
+}
+
+
+// Start a client's load once its connection is up
+static void fcb_start_client(fcb_client_t* cP, double now)
+{
+	switch (cP->role) {
+		case FCB_ROLE_CONTROL:
+			(void) fcc_send_simple(cP->conn, "get_perf", FCB_TAG_PERF);
+			break;
+	
+		case FCB_ROLE_POLLER:
+			cP->next_usec = now;
+			break;
+	
+		case FCB_ROLE_STREAMER:
+			(void) fcc_set_image_format(cP->conn, stream_format, 0);
+			(void) fcc_stream_on(cP->conn, FCB_STREAM_PERIOD, FCB_STREAM_CONTENTS, 0);
+			break;
+	
+		case FCB_ROLE_WRITER:
+			// Requests start when the current value arrives
+			cP->next_usec = 0;
+			(void) fcc_send_simple(cP->conn, "get_config", FCB_TAG_CONFIG);
+			break;
+	}
+}
+
+
+static void fcb_print_latency(int role)
+{
+	fcb_lat_t* lP = &latency[role];
+	
+	if (lP->count == 0) {
+		printf("  %-12s no responses\n", fcb_role_names[role]);
+		return;
+	}
+	qsort(lP->samples, lP->count, sizeof(double), fcb_compare_double);
+	printf("  %-12s %7d  p50 %8.2f  p90 %8.2f  p99 %8.2f  max %8.2f mSec\n", fcb_role_names[role], lP->count,
+	       fcb_percentile(lP, 50) / 1000.0, fcb_percentile(lP, 90) / 1000.0, fcb_percentile(lP, 99) / 1000.0,
+	       lP->samples[lP->count - 1] / 1000.0);
+}
+
+
+static void fcb_report(double run_sec)
+{
+	fcb_client_t* cP;
+	double span;
+	double total_bytes = 0;
+	uint32_t total_images = 0;
+	uint32_t expected;
+	uint32_t total_expected = 0;
+	uint32_t late = 0;
+	double n, avg;
+	unsigned int j;
+	int closed = 0;
+	int i;
+	
+	printf("\nRun time %.1f sec\n", run_sec);
+	
+	printf("\nRound-trip latency (requests, percentiles)\n");
+	fcb_print_latency(FCB_ROLE_POLLER);
+	fcb_print_latency(FCB_ROLE_WRITER);
+	
+	// A streamer gets one image per period, less any the camera skipped for it
+	printf("\nStreams\n");
+	for (i=0; i<num_clients; i++) {
+		cP = &clients[i];
+		if (cP->role != FCB_ROLE_STREAMER) continue;
+		if (cP->images == 0) {
+			printf("  stream %d: no images\n", i);
+			continue;
+		}
+		span = (cP->last_image_usec - cP->first_image_usec) / 1000000.0;
+		expected = (uint32_t) (span / FCB_STREAM_PERIOD + 0.5) + 1;
+		if (expected < cP->images) expected = cP->images;
+		printf("  stream %d: %u images, %.2f images/sec, %.1f kB/sec, %u missed (%.1f%%)\n", i, cP->images,
+		       (span > 0) ? (cP->images - 1) / span : 0, (span > 0) ? cP->image_bytes / span / 1000.0 : 0,
+		       expected - cP->images, 100.0 * (expected - cP->images) / expected);
+		total_images += cP->images;
+		total_expected += expected;
+		total_bytes += cP->image_bytes;
+	}
+	if (total_expected != 0) {
+		printf("  total: %u images, %.1f kB/sec, %.1f%% missed\n", total_images, total_bytes / run_sec / 1000.0,
+		       100.0 * (total_expected - total_images) / total_expected);
+	}
+	
+	for (i=0; i<num_clients; i++) {
+		if (clients[i].closed) closed++;
+		late += clients[i].late_responses;
+	}
+	printf("\nConnections closed early: %d, unmatched responses: %u\n", closed, late);
+	
+	// The camera's stage counters for the run are the difference of the two samples
+	printf("\nCamera get_perf during the run\n");
+	if (!perf_start.valid || !perf_end.valid) {
+		printf("  not available\n");
+		return;
+	}
+	for (j=0; j<FCB_NUM_PERF_STAGES; j++) {
+		n = perf_end.count[j] - perf_start.count[j];
+		avg = (n > 0) ? (perf_end.count[j] * perf_end.avg[j] - perf_start.count[j] * perf_start.avg[j]) / n : 0;
+		printf("  %-16s %8.0f  avg %8.0f uSec  (max since start %8.0f uSec)\n", fcb_perf_stages[j], n, avg,
+		       perf_end.max[j]);
+	}
+}
+
+
+static int fcb_add_client(fcc_loop_t* loop, const char* ip, int role)
+{
+	fcb_client_t* cP;
+	
+	if (num_clients == FCB_MAX_CLIENTS) return -1;
+	cP = &clients[num_clients];
+	memset(cP, 0, sizeof(fcb_client_t));
+	cP->role = role;
+	cP->next_tag = FCB_TAG_FIRST;
+	cP->write_value = -1;
+	cP->conn = fcc_connect(loop, ip, FCC_CMD_PORT, fcb_callback, cP);
+	if (cP->conn == NULL) return -1;
+	num_clients++;
+	return 0;
+}
+
+
+static void fcb_usage()
+{
+	fprintf(stderr, "usage: fc_bench [-t seconds] [-p pollers] [-i poll msec] [-s streamers] [-f format]\n");
+	fprintf(stderr, "                [-w writers] [-W write msec] <camera ip>\n");
+}
+
+
+int main(int argc, char** argv)
+{
+	fcc_loop_t* loop;
+	fcb_client_t* cP;
+	double start, now, end;
+	int run_sec = 30;
+	int pollers = 1;
+	int streamers = 1;
+	int writers = 1;
+	int all_up;
+	int i, c;
+	
+	while ((c = getopt(argc, argv, "t:p:i:s:f:w:W:")) != -1) {
+		switch (c) {
+			case 't': run_sec = atoi(optarg); break;
+			case 'p': pollers = atoi(optarg); break;
+			case 'i': poll_msec = atoi(optarg); break;
+			case 's': streamers = atoi(optarg); break;
+			case 'f': stream_format = atoi(optarg); break;
+			case 'w': writers = atoi(optarg); break;
+			case 'W': write_msec = atoi(optarg); break;
+			default:  fcb_usage(); return 1;
+		}
+	}
+	if ((argc - optind) != 1) {
+		fcb_usage();
+		return 1;
+	}
+	
+	loop = fcc_loop_create();
+	if (loop == NULL) return 1;
+	
+	if ((fcb_add_client(loop, argv[optind], FCB_ROLE_CONTROL) != 0)) {
+		fprintf(stderr, "Could not connect to %s\n", argv[optind]);
+		return 1;
+	}
+	for (i=0; i<pollers; i++) (void) fcb_add_client(loop, argv[optind], FCB_ROLE_POLLER);
+	for (i=0; i<streamers; i++) (void) fcb_add_client(loop, argv[optind], FCB_ROLE_STREAMER);
+	for (i=0; i<writers; i++) (void) fcb_add_client(loop, argv[optind], FCB_ROLE_WRITER);
+	
+	// Wait for the connections before starting the clock
+	start = fcb_now_usec();
+	do {
+		(void) fcc_loop_run_once(loop, 10);
+		all_up = 1;
+		for (i=0; i<num_clients; i++) {
+			if (!clients[i].connected && !clients[i].closed) all_up = 0;
+		}
+	} while (!all_up && ((fcb_now_usec() - start) < FCB_CONNECT_MSEC * 1000.0));
+	if (!clients[0].connected || clients[0].closed) {
+		fprintf(stderr, "Could not connect to %s\n", argv[optind]);
+		return 1;
+	}
+	for (i=0; i<num_clients; i++) {
+		if (!clients[i].connected || clients[i].closed) {
+			fprintf(stderr, "%s client %d did not connect (the camera accepts a limited number of connections)\n",
+			        fcb_role_names[clients[i].role], i);
+		}
+	}
+	
+	printf("Load: %d get_status (%d mSec), %d stream (format %d), %d set_config (%d mSec) for %d sec\n",
+	       pollers, poll_msec, streamers, stream_format, writers, write_msec, run_sec);
+	
+	start = fcb_now_usec();
+	for (i=0; i<num_clients; i++) {
+		if (clients[i].connected && !clients[i].closed) fcb_start_client(&clients[i], start);
+	}
+	
+	end = start + run_sec * 1000000.0;
+	while ((now = fcb_now_usec()) < end) {
+		if (fcc_loop_run_once(loop, 5) < 0) break;
+	
+		now = fcb_now_usec();
+		for (i=0; i<num_clients; i++) {
+			cP = &clients[i];
+			if ((cP->conn == NULL) || !cP->connected || (cP->tag != 0)) continue;
+			if ((cP->role == FCB_ROLE_POLLER) || ((cP->role == FCB_ROLE_WRITER) && (cP->write_value >= 0))) {
+				if (now >= cP->next_usec) fcb_send_request(cP, now);
+			}
+		}
+	}
+	running = 0;
+	
+	// Stop the load and take the final sample
+	for (i=0; i<num_clients; i++) {
+		cP = &clients[i];
+		if (cP->conn == NULL) continue;
+		if (cP->role == FCB_ROLE_CONTROL) {
+			(void) fcc_send_simple(cP->conn, "get_perf", FCB_TAG_PERF);
+		} else {
+			fcc_close(cP->conn);
+			cP->conn = NULL;
+		}
+	}
+	while (!perf_end.valid && (clients[0].conn != NULL) && ((fcb_now_usec() - now) < FCB_FINISH_MSEC * 1000.0)) {
+		if (fcc_loop_run_once(loop, 10) < 0) break;
+	}
+	
+	fcb_report((now - start) / 1000000.0);
+	fcc_loop_destroy(loop);
+	
+	return 0;
+}
@@ -0,0 +1,801 @@
+/*
+ * Host client library for the firecam command interface
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "fc_client.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#if defined(__linux__)
+#define FCC_USE_EPOLL
+#include <sys/epoll.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__DragonFly__)
+#define FCC_USE_KQUEUE
+#include <sys/event.h>
+#include <sys/time.h>
+#else
+#include <poll.h>
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define FCC_SEND_FLAGS       MSG_NOSIGNAL
+#else
+#define FCC_SEND_FLAGS       0
+#endif
+
+
+//
+// FCC internal constants
+//
+
+// Receive buffer growth (a buffer grows to hold the largest frame it has received)
+#define FCC_RX_CHUNK         (64 * 1024)
+
+// Events handled per wait
+#define FCC_MAX_EVENTS       64
+
+// Connection states
+#define FCC_ST_CONNECTING    0
+#define FCC_ST_OPEN          1
+#define FCC_ST_CLOSING       2
+
+
+//
+// FCC internal typedefs
+//
+struct fcc_conn {
+	fcc_loop_t* loop;
+	fcc_conn_t* next;
+	int fd;
+	int state;                     // FCC_ST_*
+	int want_write;                // Write readiness is being waited for
+	char addr[INET_ADDRSTRLEN];
+	fcc_callback_t cb;
+	void* user;
+	
+	// Received data not yet delivered (a partial frame at the start)
+	uint8_t* rxP;
+	uint32_t rx_len;
+	uint32_t rx_size;
+	uint32_t rx_need;              // Length of the partial binary image (0 if unknown)
+	
+	// Framed commands waiting to be sent
+	uint8_t* txP;
+	uint32_t tx_len;
+	uint32_t tx_size;
+};
+
+struct fcc_loop {
+	int fd;                        // epoll or kqueue descriptor
+	fcc_conn_t* conns;
+	int count;                     // Connections that aren't closing
+#if !defined(FCC_USE_EPOLL) && !defined(FCC_USE_KQUEUE)
+	struct pollfd* pfdP;
+	fcc_conn_t** pconnP;
+	int psize;
+#endif
+};
+
+
+//
+// FCC internal variables
+//
+
+// Base-64 character values (-1 for characters that aren't in the alphabet)
+static const int8_t fcc_b64_table[256] = {
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+	52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+	-1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+	15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+	-1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+
+//
+// FCC internal functions
+//
+static uint16_t fcc_get16(const uint8_t* p)
+{
+	return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+
+static uint32_t fcc_get32(const uint8_t* p)
+{
+	return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+
+static int fcc_is_space(uint8_t c)
+{
+	return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n');
+}
+
+
+// Get the tag of a json response (its first item when there is one)
+static uint16_t fcc_json_tag(const uint8_t* p, uint32_t len)
+{
+	const uint8_t* endP = p + len;
+	uint32_t tag = 0;
+	
+	while ((p < endP) && fcc_is_space(*p)) p++;
+	if ((p == endP) || (*p++ != '{')) return 0;
+	while ((p < endP) && fcc_is_space(*p)) p++;
+	if (((endP - p) < 5) || (memcmp(p, "\"tag\"", 5) != 0)) return 0;
+	p += 5;
+	while ((p < endP) && fcc_is_space(*p)) p++;
+	if ((p == endP) || (*p++ != ':')) return 0;
+	while ((p < endP) && fcc_is_space(*p)) p++;
+	while ((p < endP) && (*p >= '0') && (*p <= '9') && (tag <= 0xFFFF)) {
+		tag = tag * 10 + (*p++ - '0');
+	}
+	
+	return (tag <= 0xFFFF) ? (uint16_t) tag : 0;
+}
+
+
+// Make room for n more bytes in a buffer
+static int fcc_reserve(uint8_t** bufP, uint32_t* sizeP, uint32_t used, uint32_t n)
+{
+	uint32_t size;
+	uint8_t* newP;
+	
+	if ((*sizeP - used) >= n) return 0;
+	
+	size = (*sizeP != 0) ? *sizeP : FCC_RX_CHUNK;
+	while ((size - used) < n) size *= 2;
+	newP = (uint8_t*) realloc(*bufP, size);
+	if (newP == NULL) return -1;
+	*bufP = newP;
+	*sizeP = size;
+	
+	return 0;
+}
+
+
+// Set whether the loop waits for the connection to be writable
+static void fcc_set_write_interest(fcc_conn_t* conn, int enable)
+{
+#ifdef FCC_USE_EPOLL
+	struct epoll_event ev;
+#endif
+#ifdef FCC_USE_KQUEUE
+	struct kevent ev;
+#endif
+	
+	if (conn->want_write == enable) return;
+	conn->want_write = enable;
+	
+#ifdef FCC_USE_EPOLL
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | (enable ? EPOLLOUT : 0);
+	ev.data.ptr = conn;
+	(void) epoll_ctl(conn->loop->fd, EPOLL_CTL_MOD, conn->fd, &ev);
+#endif
+#ifdef FCC_USE_KQUEUE
+	EV_SET(&ev, conn->fd, EVFILT_WRITE, enable ? EV_ENABLE : EV_DISABLE, 0, 0, conn);
+	(void) kevent(conn->loop->fd, &ev, 1, NULL, 0, NULL);
+#endif
+}
+
+
+// Close a connection that failed or was closed by the camera and tell its owner
+static int fcc_fail(fcc_conn_t* conn, int error)
+{
+	fcc_event_t ev;
+	
+	if (conn->state == FCC_ST_CLOSING) return 0;
+	
+	fcc_close(conn);
+	memset(&ev, 0, sizeof(ev));
+	ev.type = FCC_EV_CLOSED;
+	ev.error = error;
+	conn->cb(conn, &ev, conn->user);
+	
+	return 1;
+}
+
+
+// Send as much of the queued data as the socket will take.  Returns the callbacks made.
+static int fcc_flush(fcc_conn_t* conn)
+{
+	ssize_t n;
+	uint32_t sent = 0;
+	
+	while (sent < conn->tx_len) {
+		n = send(conn->fd, conn->txP + sent, conn->tx_len - sent, FCC_SEND_FLAGS);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+			return fcc_fail(conn, errno);
+		}
+		sent += (uint32_t) n;
+	}
+	
+	if (sent != 0) {
+		memmove(conn->txP, conn->txP + sent, conn->tx_len - sent);
+		conn->tx_len -= sent;
+	}
+	fcc_set_write_interest(conn, (conn->tx_len != 0));
+	
+	return 0;
+}
+
+
+// Receive data and deliver every complete frame straight from the receive buffer.
+// Returns the callbacks made.
+static int fcc_receive(fcc_conn_t* conn)
+{
+	fcc_event_t ev;
+	ssize_t n;
+	uint32_t want;
+	uint32_t off = 0;
+	uint32_t need = 0;
+	int calls = 0;
+	int r = 0;
+	
+	// Room for the rest of a partial binary image so it is received in place
+	want = FCC_RX_CHUNK;
+	if (conn->rx_need > (conn->rx_len + want)) {
+		want = conn->rx_need - conn->rx_len;
+	}
+	if (fcc_reserve(&conn->rxP, &conn->rx_size, conn->rx_len, want) < 0) {
+		return fcc_fail(conn, ENOMEM);
+	}
+	
+	n = recv(conn->fd, conn->rxP + conn->rx_len, conn->rx_size - conn->rx_len, 0);
+	if (n == 0) {
+		return fcc_fail(conn, 0);
+	}
+	if (n < 0) {
+		if ((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK)) return 0;
+		return fcc_fail(conn, errno);
+	}
+	conn->rx_len += (uint32_t) n;
+	
+	memset(&ev, 0, sizeof(ev));
+	ev.type = FCC_EV_FRAME;
+	while (off < conn->rx_len) {
+		r = fcc_parse_frame(conn->rxP + off, conn->rx_len - off, &ev.frame, &need);
+		if (r <= 0) break;
+		off += (uint32_t) r;
+		if (ev.frame.type != 0) {
+			conn->cb(conn, &ev, conn->user);
+			calls++;
+			if (conn->state == FCC_ST_CLOSING) return calls;
+		}
+	}
+	if ((r < 0) || ((conn->rx_len - off) > FCC_MAX_FRAME_LEN)) {
+		return calls + fcc_fail(conn, EPROTO);
+	}
+	
+	// Keep the partial frame at the start of the buffer
+	if (off != 0) {
+		memmove(conn->rxP, conn->rxP + off, conn->rx_len - off);
+		conn->rx_len -= off;
+	}
+	conn->rx_need = need;
+	
+	return calls;
+}
+
+
+// Handle readiness of a connection.  Returns the callbacks made.
+static int fcc_handle_io(fcc_conn_t* conn, int readable, int writable)
+{
+	fcc_event_t ev;
+	int calls = 0;
+	int err;
+	socklen_t err_len = sizeof(err);
+	
+	if (conn->state == FCC_ST_CLOSING) return 0;
+	
+	if (conn->state == FCC_ST_CONNECTING) {
+		if (!readable && !writable) return 0;
+		if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0) {
+			err = errno;
+		}
+		if (err != 0) {
+			return fcc_fail(conn, err);
+		}
+		
+		conn->state = FCC_ST_OPEN;
+		memset(&ev, 0, sizeof(ev));
+		ev.type = FCC_EV_CONNECTED;
+		conn->cb(conn, &ev, conn->user);
+		calls++;
+		if (conn->state != FCC_ST_OPEN) return calls;
+		
+		// Send the commands queued while connecting
+		writable = 1;
+	}
+	
+	if (writable) {
+		calls += fcc_flush(conn);
+		if (conn->state != FCC_ST_OPEN) return calls;
+	}
+	
+	if (readable) {
+		calls += fcc_receive(conn);
+	}
+	
+	return calls;
+}
+
+
+// Free the connections closed since the last pass
+static void fcc_reap(fcc_loop_t* loop)
+{
+	fcc_conn_t** connPP = &loop->conns;
+	fcc_conn_t* conn;
+	
+	while (*connPP != NULL) {
+		conn = *connPP;
+		if (conn->state == FCC_ST_CLOSING) {
+			*connPP = conn->next;
+			free(conn->rxP);
+			free(conn->txP);
+			free(conn);
+		} else {
+			connPP = &conn->next;
+		}
+	}
+}
+
+
+//
+// FCC API
+//
+fcc_loop_t* fcc_loop_create()
+{
+	fcc_loop_t* loop;
+	
+	loop = (fcc_loop_t*) calloc(1, sizeof(fcc_loop_t));
+	if (loop == NULL) return NULL;
+	
+#if defined(FCC_USE_EPOLL)
+	loop->fd = epoll_create1(EPOLL_CLOEXEC);
+#elif defined(FCC_USE_KQUEUE)
+	loop->fd = kqueue();
+#else
+	loop->fd = 0;
+#endif
+	if (loop->fd < 0) {
+		free(loop);
+		return NULL;
+	}
+	
+	return loop;
+}
+
+
+void fcc_loop_destroy(fcc_loop_t* loop)
+{
+	fcc_conn_t* conn;
+	
+	for (conn = loop->conns; conn != NULL; conn = conn->next) {
+		fcc_close(conn);
+	}
+	fcc_reap(loop);
+	
+#if defined(FCC_USE_EPOLL) || defined(FCC_USE_KQUEUE)
+	close(loop->fd);
+#else
+	free(loop->pfdP);
+	free(loop->pconnP);
+#endif
+	free(loop);
+}
+
+
+int fcc_loop_run_once(fcc_loop_t* loop, int timeout_msec)
+{
+	int calls = 0;
+	int n;
+	int i;
+#if defined(FCC_USE_EPOLL)
+	struct epoll_event evs[FCC_MAX_EVENTS];
+	
+	n = epoll_wait(loop->fd, evs, FCC_MAX_EVENTS, timeout_msec);
+	if ((n < 0) && (errno != EINTR)) return -1;
+	for (i=0; i<n; i++) {
+		calls += fcc_handle_io((fcc_conn_t*) evs[i].data.ptr,
+		                       (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0,
+		                       (evs[i].events & EPOLLOUT) != 0);
+	}
+#elif defined(FCC_USE_KQUEUE)
+	struct kevent evs[FCC_MAX_EVENTS];
+	struct timespec ts;
+	
+	ts.tv_sec = timeout_msec / 1000;
+	ts.tv_nsec = (timeout_msec % 1000) * 1000000L;
+	n = kevent(loop->fd, NULL, 0, evs, FCC_MAX_EVENTS, (timeout_msec < 0) ? NULL : &ts);
+	if ((n < 0) && (errno != EINTR)) return -1;
+	for (i=0; i<n; i++) {
+		calls += fcc_handle_io((fcc_conn_t*) evs[i].udata,
+		                       (evs[i].filter == EVFILT_READ) || ((evs[i].flags & EV_ERROR) != 0),
+		                       evs[i].filter == EVFILT_WRITE);
+	}
+#else
+	fcc_conn_t* conn;
+	
+	if (loop->psize < loop->count) {
+		free(loop->pfdP);
+		free(loop->pconnP);
+		loop->pfdP = (struct pollfd*) malloc(loop->count * sizeof(struct pollfd));
+		loop->pconnP = (fcc_conn_t**) malloc(loop->count * sizeof(fcc_conn_t*));
+		loop->psize = ((loop->pfdP != NULL) && (loop->pconnP != NULL)) ? loop->count : 0;
+		if (loop->psize == 0) return -1;
+	}
+	n = 0;
+	for (conn = loop->conns; conn != NULL; conn = conn->next) {
+		if (conn->state == FCC_ST_CLOSING) continue;
+		loop->pfdP[n].fd = conn->fd;
+		loop->pfdP[n].events = POLLIN | (conn->want_write ? POLLOUT : 0);
+		loop->pfdP[n].revents = 0;
+		loop->pconnP[n++] = conn;
+	}
+	n = poll(loop->pfdP, n, timeout_msec);
+	if ((n < 0) && (errno != EINTR)) return -1;
+	for (i=0; (n > 0) && (i<loop->psize); i++) {
+		if (loop->pfdP[i].revents == 0) continue;
+		n--;
+		calls += fcc_handle_io(loop->pconnP[i],
+		                       (loop->pfdP[i].revents & (POLLIN | POLLHUP | POLLERR)) != 0,
+		                       (loop->pfdP[i].revents & POLLOUT) != 0);
+	}
+#endif
+	
+	fcc_reap(loop);
+	return calls;
+}
+
+
+int fcc_loop_count(fcc_loop_t* loop)
+{
+	return loop->count;
+}
+
+
+fcc_conn_t* fcc_connect(fcc_loop_t* loop, const char* ip_addr, uint16_t port, fcc_callback_t cb, void* user)
+{
+	fcc_conn_t* conn;
+	struct sockaddr_in sa;
+	int one = 1;
+	int fd;
+#ifdef FCC_USE_EPOLL
+	struct epoll_event ev;
+#endif
+#ifdef FCC_USE_KQUEUE
+	struct kevent ev[2];
+#endif
+	
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	if (inet_pton(AF_INET, ip_addr, &sa.sin_addr) != 1) return NULL;
+	
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return NULL;
+	(void) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	(void) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+	(void) setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+	
+	if ((connect(fd, (struct sockaddr*) &sa, sizeof(sa)) < 0) && (errno != EINPROGRESS)) {
+		close(fd);
+		return NULL;
+	}
+	
+	conn = (fcc_conn_t*) calloc(1, sizeof(fcc_conn_t));
+	if (conn == NULL) {
+		close(fd);
+		return NULL;
+	}
+	conn->loop = loop;
+	conn->fd = fd;
+	conn->state = FCC_ST_CONNECTING;
+	conn->want_write = 1;
+	conn->cb = cb;
+	conn->user = user;
+	strncpy(conn->addr, ip_addr, sizeof(conn->addr) - 1);
+	
+	// The connection is up (or failed) when the socket becomes writable
+#if defined(FCC_USE_EPOLL)
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLOUT;
+	ev.data.ptr = conn;
+	if (epoll_ctl(loop->fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		close(fd);
+		free(conn);
+		return NULL;
+	}
+#elif defined(FCC_USE_KQUEUE)
+	EV_SET(&ev[0], fd, EVFILT_READ, EV_ADD, 0, 0, conn);
+	EV_SET(&ev[1], fd, EVFILT_WRITE, EV_ADD, 0, 0, conn);
+	if (kevent(loop->fd, ev, 2, NULL, 0, NULL) < 0) {
+		close(fd);
+		free(conn);
+		return NULL;
+	}
+#endif
+	
+	conn->next = loop->conns;
+	loop->conns = conn;
+	loop->count++;
+	
+	return conn;
+}
+
+
+void fcc_close(fcc_conn_t* conn)
+{
+	if (conn->state == FCC_ST_CLOSING) return;
+	
+	// Closing the socket also removes it from the epoll or kqueue set.  The connection
+	// is freed at the end of the loop pass.
+	close(conn->fd);
+	conn->fd = -1;
+	conn->state = FCC_ST_CLOSING;
+	conn->loop->count--;
+}
+
+
+void* fcc_get_user(fcc_conn_t* conn)
+{
+	return conn->user;
+}
+
+
+const char* fcc_get_addr(fcc_conn_t* conn)
+{
+	return conn->addr;
+}
+
+
+int fcc_send_cmd(fcc_conn_t* conn, const char* json)
+{
+	uint32_t len;
+	ssize_t n;
+	
+	len = (uint32_t) strlen(json);
+	if ((len > FCC_MAX_CMD_LEN) || (conn->state == FCC_ST_CLOSING)) return -1;
+	if (fcc_reserve(&conn->txP, &conn->tx_size, conn->tx_len, len + 2) < 0) return -1;
+	
+	conn->txP[conn->tx_len] = FCC_STX;
+	memcpy(conn->txP + conn->tx_len + 1, json, len);
+	conn->txP[conn->tx_len + 1 + len] = FCC_ETX;
+	conn->tx_len += len + 2;
+	
+	// Send it now if nothing is waiting ahead of it.  Errors show up in the loop.
+	if ((conn->state == FCC_ST_OPEN) && (conn->tx_len == (len + 2))) {
+		n = send(conn->fd, conn->txP, conn->tx_len, FCC_SEND_FLAGS);
+		if (n > 0) {
+			memmove(conn->txP, conn->txP + n, conn->tx_len - n);
+			conn->tx_len -= (uint32_t) n;
+		}
+	}
+	if (conn->state == FCC_ST_OPEN) {
+		fcc_set_write_interest(conn, (conn->tx_len != 0));
+	}
+	
+	return 0;
+}
+
+
+int fcc_send_simple(fcc_conn_t* conn, const char* cmd, uint16_t tag)
+{
+	char buf[FCC_MAX_CMD_LEN + 1];
+	
+	if (tag != 0) {
+		snprintf(buf, sizeof(buf), "{\"cmd\":\"%s\",\"tag\":%u}", cmd, tag);
+	} else {
+		snprintf(buf, sizeof(buf), "{\"cmd\":\"%s\"}", cmd);
+	}
+	return fcc_send_cmd(conn, buf);
+}
+
+
+int fcc_set_image_format(fcc_conn_t* conn, int format, uint16_t tag)
+{
+	char buf[FCC_MAX_CMD_LEN + 1];
+	
+	snprintf(buf, sizeof(buf), "{\"cmd\":\"set_image_format\",\"tag\":%u,\"args\":{\"format\":%d}}", tag, format);
+	return fcc_send_cmd(conn, buf);
+}
+
+
+int fcc_stream_on(fcc_conn_t* conn, int period, int contents, uint16_t tag)
+{
+	char buf[FCC_MAX_CMD_LEN + 1];
+	
+	snprintf(buf, sizeof(buf), "{\"cmd\":\"stream_on\",\"tag\":%u,\"args\":{\"period\":%d,\"contents\":%d}}",
+	         tag, period, contents);
+	return fcc_send_cmd(conn, buf);
+}
+
+
+int fcc_stream_off(fcc_conn_t* conn, uint16_t tag)
+{
+	return fcc_send_simple(conn, "stream_off", tag);
+}
+
+
+int fcc_parse_frame(const uint8_t* buf, uint32_t len, fcc_frame_t* frame, uint32_t* needP)
+{
+	const uint8_t* endP;
+	uint64_t total;
+	uint32_t i;
+	
+	memset(frame, 0, sizeof(fcc_frame_t));
+	if (needP != NULL) *needP = 0;
+	if (len == 0) return 0;
+	
+	if (buf[0] == FCC_STX) {
+		endP = (const uint8_t*) memchr(buf + 1, FCC_ETX, len - 1);
+		if (endP == NULL) return 0;
+		frame->type = FCC_FRAME_JSON;
+		frame->data = buf + 1;
+		frame->len = (uint32_t) (endP - buf) - 1;
+		frame->tag = fcc_json_tag(frame->data, frame->len);
+		return (int) (endP - buf) + 1;
+	}
+	
+	if (buf[0] == (FCC_FCR_MAGIC & 0xFF)) {
+		if ((len >= 4) && (fcc_get32(buf) != FCC_FCR_MAGIC)) return -1;
+		if (len < FCC_FCR_HEADER_LEN) {
+			if (needP != NULL) *needP = FCC_FCR_HEADER_LEN;
+			return 0;
+		}
+		if (fcc_get16(buf + 6) < FCC_FCR_HEADER_LEN) return -1;
+		total = (uint64_t) fcc_get16(buf + 6) + fcc_get32(buf + 12) + fcc_get32(buf + 16) + fcc_get32(buf + 20);
+		if (total > FCC_MAX_FRAME_LEN) return -1;
+		if (len < total) {
+			if (needP != NULL) *needP = (uint32_t) total;
+			return 0;
+		}
+		frame->type = FCC_FRAME_BINARY;
+		frame->data = buf;
+		frame->len = (uint32_t) total;
+		frame->tag = fcc_get16(buf + 26);
+		return (int) total;
+	}
+	
+	// Skip anything else up to the next frame
+	for (i=1; (i<len) && (buf[i] != FCC_STX) && (buf[i] != (FCC_FCR_MAGIC & 0xFF)); i++) {}
+	return (int) i;
+}
+
+
+int fcc_json_find_string(const char* json, uint32_t len, const char* key, const char** valP, uint32_t* val_lenP)
+{
+	const char* p = json;
+	const char* endP = json + len;
+	const char* startP;
+	uint32_t key_len = (uint32_t) strlen(key);
+	
+	while ((p = (const char*) memchr(p, '"', endP - p)) != NULL) {
+		p++;
+		if ((((uint32_t) (endP - p)) <= key_len) || (memcmp(p, key, key_len) != 0) || (p[key_len] != '"')) {
+			continue;
+		}
+		
+		// It's a key if a colon follows
+		p += key_len + 1;
+		while ((p < endP) && fcc_is_space(*p)) p++;
+		if ((p == endP) || (*p != ':')) continue;
+		p++;
+		while ((p < endP) && fcc_is_space(*p)) p++;
+		if ((p == endP) || (*p != '"')) return -1;
+		startP = ++p;
+		while ((p < endP) && (*p != '"')) {
+			p += (*p == '\\') ? 2 : 1;
+		}
+		if (p >= endP) return -1;
+		*valP = startP;
+		*val_lenP = (uint32_t) (p - startP);
+		return 0;
+	}
+	
+	return -1;
+}
+
+
+int fcc_base64_decode(const char* src, uint32_t src_len, uint8_t* dst, uint32_t dst_size)
+{
+	const uint8_t* s = (const uint8_t*) src;
+	uint32_t i;
+	uint32_t o = 0;
+	uint32_t rem;
+	int32_t a, b, c, d;
+	uint32_t v;
+	
+	if ((src_len != 0) && (src[src_len-1] == '=')) src_len--;
+	if ((src_len != 0) && (src[src_len-1] == '=')) src_len--;
+	rem = src_len % 4;
+	if (rem == 1) return -1;
+	if (((src_len / 4) * 3 + ((rem != 0) ? rem - 1 : 0)) > dst_size) return -1;
+	
+	// An invalid character makes the OR of the values negative
+	for (i=0; (i + 4) <= src_len; i += 4) {
+		a = fcc_b64_table[s[i]];
+		b = fcc_b64_table[s[i+1]];
+		c = fcc_b64_table[s[i+2]];
+		d = fcc_b64_table[s[i+3]];
+		if ((a | b | c | d) < 0) return -1;
+		v = ((uint32_t) a << 18) | ((uint32_t) b << 12) | ((uint32_t) c << 6) | (uint32_t) d;
+		dst[o++] = (uint8_t) (v >> 16);
+		dst[o++] = (uint8_t) (v >> 8);
+		dst[o++] = (uint8_t) v;
+	}
+	
+	if (rem != 0) {
+		a = fcc_b64_table[s[i]];
+		b = fcc_b64_table[s[i+1]];
+		c = (rem == 3) ? fcc_b64_table[s[i+2]] : 0;
+		if ((a | b | c) < 0) return -1;
+		v = ((uint32_t) a << 18) | ((uint32_t) b << 12) | ((uint32_t) c << 6);
+		dst[o++] = (uint8_t) (v >> 16);
+		if (rem == 3) dst[o++] = (uint8_t) (v >> 8);
+	}
+	
+	return (int) o;
+}
+
+
+uint32_t fcc_base64_decoded_len(uint32_t src_len)
+{
+	return ((src_len + 3) / 4) * 3;
+}
+
+
+void fcc_le16_to_host(const uint8_t* src, uint16_t* dst, int n)
+{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+	memcpy(dst, src, n * sizeof(uint16_t));
+#else
+	int i;
+	
+	for (i=0; i<n; i++) {
+		dst[i] = fcc_get16(src + 2*i);
+	}
+#endif
+}
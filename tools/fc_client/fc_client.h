@@ -0,0 +1,164 @@
+/*
+ * Host client library for the firecam command interface
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef FC_CLIENT_H
+#define FC_CLIENT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+//
+// FCC Constants (must match firmware/main/include/cmd_task.h)
+//
+#define FCC_CMD_PORT         5001
+
+#define FCC_STX              0x02
+#define FCC_ETX              0x03
+
+// Longest json command the camera accepts (without the delimiters)
+#define FCC_MAX_CMD_LEN      256
+
+// Image formats for fcc_set_image_format
+#define FCC_IMG_FMT_JSON     0
+#define FCC_IMG_FMT_BINARY   1
+#define FCC_IMG_FMT_BINARY_Z 2
+
+// Contents bits for fcc_stream_on
+#define FCC_STREAM_JPEG      0x01
+#define FCC_STREAM_RADIOM    0x02
+#define FCC_STREAM_TELEM     0x04
+#define FCC_STREAM_METADATA  0x08
+#define FCC_STREAM_PREVIEW   0x10
+
+// Binary image responses (see fcr_reader.h).  They are sent without delimiters and
+// start with the fixed header holding the header and payload lengths.
+#define FCC_FCR_MAGIC        0x52494346   /* "FCIR" */
+#define FCC_FCR_HEADER_LEN   28
+
+// Largest response accepted.  A connection sending a larger frame is closed.
+#define FCC_MAX_FRAME_LEN    (4 * 1024 * 1024)
+
+// Frame types
+#define FCC_FRAME_JSON       1            /* json text without the delimiters */
+#define FCC_FRAME_BINARY     2            /* Complete binary image record */
+
+// Event types
+#define FCC_EV_CONNECTED     1
+#define FCC_EV_FRAME         2
+#define FCC_EV_CLOSED        3
+
+
+//
+// FCC typedefs
+//
+typedef struct fcc_loop fcc_loop_t;
+typedef struct fcc_conn fcc_conn_t;
+
+typedef struct {
+	int type;                      // FCC_FRAME_*
+	const uint8_t* data;           // Points into the connection's receive buffer
+	uint32_t len;
+	uint16_t tag;                  // Command tag (0 if the response has none)
+} fcc_frame_t;
+
+typedef struct {
+	int type;                      // FCC_EV_*
+	fcc_frame_t frame;             // FCC_EV_FRAME (only valid during the callback)
+	int error;                     // FCC_EV_CLOSED: errno or 0 if the camera closed the connection
+} fcc_event_t;
+
+typedef void (*fcc_callback_t)(fcc_conn_t* conn, const fcc_event_t* ev, void* user);
+
+
+//
+// FCC API
+//
+
+// Create and destroy an event loop.  Destroying a loop closes its connections without
+// calling their callbacks.  The loop uses epoll on Linux, kqueue on macOS and the BSDs
+// and poll elsewhere.  It isn't thread-safe: call everything for a loop from one thread.
+fcc_loop_t* fcc_loop_create();
+void fcc_loop_destroy(fcc_loop_t* loop);
+
+// Wait up to timeout_msec (-1 forever) for activity on the loop's connections and call
+// their callbacks.  Returns the number of callbacks made or -1 on an error.
+int fcc_loop_run_once(fcc_loop_t* loop, int timeout_msec);
+
+// Return the number of connections in the loop
+int fcc_loop_count(fcc_loop_t* loop);
+
+// Start connecting to a camera at a dotted-quad IPv4 address.  cb is called with
+// FCC_EV_CONNECTED when the connection is up, FCC_EV_FRAME for each response and
+// FCC_EV_CLOSED when it fails or closes.  The connection is freed after the
+// FCC_EV_CLOSED callback returns.  Commands may be sent before it is up.  Returns NULL
+// if the connection couldn't be started.
+fcc_conn_t* fcc_connect(fcc_loop_t* loop, const char* ip_addr, uint16_t port, fcc_callback_t cb, void* user);
+
+// Close a connection (FCC_EV_CLOSED is not called).  Safe to call from its callback.
+void fcc_close(fcc_conn_t* conn);
+
+void* fcc_get_user(fcc_conn_t* conn);
+const char* fcc_get_addr(fcc_conn_t* conn);
+
+// Send a json command (without delimiters).  It is queued if the socket can't take it
+// all now.  Returns 0 or -1 if the command is too long or the connection is closing.
+int fcc_send_cmd(fcc_conn_t* conn, const char* json);
+
+// Send {"cmd":"<cmd>","tag":<tag>} (the tag is left out when it is 0)
+int fcc_send_simple(fcc_conn_t* conn, const char* cmd, uint16_t tag);
+
+// Streaming.  Images are delivered as FCC_EV_FRAME events in the connection's format.
+int fcc_set_image_format(fcc_conn_t* conn, int format, uint16_t tag);
+int fcc_stream_on(fcc_conn_t* conn, int period, int contents, uint16_t tag);
+int fcc_stream_off(fcc_conn_t* conn, uint16_t tag);
+
+// Find the next frame in buf without copying it.  Returns the bytes consumed (frame is
+// loaded if a frame was found, frame->type is 0 if only filler bytes were skipped), 0 if
+// more data is needed or -1 if the data isn't a valid response.  When 0 is returned for
+// a partial binary image *needP is set to its full length so the caller can make room
+// for it (0 if unknown).
+int fcc_parse_frame(const uint8_t* buf, uint32_t len, fcc_frame_t* frame, uint32_t* needP);
+
+// Find the string value of key in json text.  valP points into the text (the value
+// isn't unescaped: the values of interest are Base-64 or plain ASCII).  Returns 0 or -1
+// if the key isn't found.
+int fcc_json_find_string(const char* json, uint32_t len, const char* key, const char** valP, uint32_t* val_lenP);
+
+// Decode src_len bytes of Base-64 into dst (dst_size bytes).  Returns the decoded
+// length or -1 if the input is invalid or too long.  dst may be the same buffer as src
+// to decode in place.
+int fcc_base64_decode(const char* src, uint32_t src_len, uint8_t* dst, uint32_t dst_size);
+
+// Return the size dst needs to be for fcc_base64_decode of src_len bytes
+uint32_t fcc_base64_decoded_len(uint32_t src_len);
+
+// Copy n little-endian 16-bit words (radiometric and telemetry data) to host order
+void fcc_le16_to_host(const uint8_t* src, uint16_t* dst, int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FC_CLIENT_H */
@@ -0,0 +1,964 @@
+/*
+ * Host converter and indexer for firecam recording sessions
+ *
+ *   fc_session export [-j threads] [-x] <session dir> <output dir>
+ *   fc_session pack [-d] <session dir>
+ *   fc_session unpack [-d] <session dir>
+ *
+ * export decodes every image in a session, in parallel, into column files: a table of
+ * per-frame statistics (frames.csv), the radiometric frames in K * 100 (radiometric.u16)
+ * and the telemetry (telemetry.u16) with one fixed-size slot per image in sequence order,
+ * and, with -x, each jpeg.  pack moves the session's image files into session container
+ * files and unpack moves container images back to image files, both updating the session
+ * index.  -d deletes the files that were moved.
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#define _FILE_OFFSET_BITS 64
+#define _XOPEN_SOURCE 700
+#include "fcr_reader.h"
+#include "fc_client.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+
+//
+// FCS Constants (must match firmware/main/include/file_task.h and
+// firmware/components/sys/include/file_utilities.h)
+//
+#define FCS_CONTAINER_MAGIC       0x43534346   /* "FCSC" */
+#define FCS_CONTAINER_VERSION     1
+#define FCS_CONTAINER_HEADER_LEN  24
+#define FCS_ENTRY_MAGIC           0x45534346   /* "FCSE" */
+#define FCS_ENTRY_LEN             16
+#define FCS_CONT_INDEX_LEN        16
+#define FCS_CONTAINER_MAX_RECORDS 4096
+#define FCS_CONTAINER_NAME_FMT    "images_%03d.fcs"
+
+#define FCS_INDEX_NAME            "index.fci"
+#define FCS_INDEX_MAGIC           0x49534346   /* "FCSI" */
+#define FCS_INDEX_VERSION         1
+#define FCS_INDEX_HEADER_LEN      16
+#define FCS_INDEX_ENTRY_LEN       32
+#define FCS_NO_CONTAINER          0xFFFF
+
+#define FCS_TYPE_JSON             1
+#define FCS_TYPE_FCR              2
+
+#define FCS_FILES_PER_SUBDIR      100
+
+// Lepton frame
+#define FCS_LEP_WIDTH             160
+#define FCS_LEP_HEIGHT            120
+#define FCS_LEP_PIXELS            (FCS_LEP_WIDTH * FCS_LEP_HEIGHT)
+#define FCS_TEL_WORDS             240
+
+#define FCS_MAX_THREADS           64
+#define FCS_MAX_PATH              1024
+
+
+//
+// FCS typedefs
+//
+
+// An image in the session (index entry fields plus the rest of the entry unchanged)
+typedef struct {
+	uint32_t seq_num;
+	uint16_t type;
+	uint16_t container_num;
+	uint32_t offset;               // Offset of the container entry header
+	uint32_t length;
+	uint32_t order;                // Order found (a later index entry replaces an earlier one)
+	uint8_t entry[FCS_INDEX_ENTRY_LEN];   // On-card index entry (zero if there was no index)
+} fcs_image_t;
+
+// Per-frame result of decoding an image
+typedef struct {
+	int ok;
+	int has_lep;
+	uint32_t jpeg_len;
+	int32_t min_c100;
+	int32_t max_c100;
+	int32_t mean_c100;
+	int32_t stddev_c100;
+	char time[FCR_MAX_STRING_LEN+1];
+	char date[FCR_MAX_STRING_LEN+1];
+} fcs_frame_t;
+
+typedef struct {
+	const char* session;
+	const char* out_dir;
+	fcs_image_t* images;
+	fcs_frame_t* frames;
+	int count;
+	int next;                      // Next image for a worker
+	int extract_jpeg;
+	int lep_fd;
+	int tel_fd;
+	pthread_mutex_t mutex;
+} fcs_export_t;
+
+
+//
+// FCS internal functions
+//
+static uint16_t fcs_get16(const uint8_t* p)
+{
+	return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+
+static uint32_t fcs_get32(const uint8_t* p)
+{
+	return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+
+static void fcs_put16(uint8_t* p, uint16_t v)
+{
+	p[0] = (uint8_t) v;
+	p[1] = (uint8_t) (v >> 8);
+}
+
+
+static void fcs_put32(uint8_t* p, uint32_t v)
+{
+	p[0] = (uint8_t) v;
+	p[1] = (uint8_t) (v >> 8);
+	p[2] = (uint8_t) (v >> 16);
+	p[3] = (uint8_t) (v >> 24);
+}
+
+
+static void fcs_image_file_path(char* path, const char* session, uint32_t seq_num, uint16_t type)
+{
+	snprintf(path, FCS_MAX_PATH, "%s/group_%04u/img_%05u.%s", session, seq_num / FCS_FILES_PER_SUBDIR,
+	         seq_num, (type == FCS_TYPE_FCR) ? "fcr" : "json");
+}
+
+
+static void fcs_container_path(char* path, const char* session, int container_num)
+{
+	char name[32];
+	
+	snprintf(name, sizeof(name), FCS_CONTAINER_NAME_FMT, container_num);
+	snprintf(path, FCS_MAX_PATH, "%s/%s", session, name);
+}
+
+
+static int fcs_add_image(fcs_image_t** imagesP, int* countP, int* sizeP, const fcs_image_t* imgP)
+{
+	fcs_image_t* newP;
+	
+	if (*countP == *sizeP) {
+		*sizeP = (*sizeP == 0) ? 1024 : *sizeP * 2;
+		newP = (fcs_image_t*) realloc(*imagesP, *sizeP * sizeof(fcs_image_t));
+		if (newP == NULL) return -1;
+		*imagesP = newP;
+	}
+	(*imagesP)[*countP] = *imgP;
+	(*imagesP)[*countP].order = (uint32_t) *countP;
+	(*countP)++;
+	return 0;
+}
+
+
+static int fcs_compare_images(const void* a, const void* b)
+{
+	const fcs_image_t* ia = (const fcs_image_t*) a;
+	const fcs_image_t* ib = (const fcs_image_t*) b;
+	
+	if (ia->seq_num != ib->seq_num) return (ia->seq_num < ib->seq_num) ? -1 : 1;
+	if (ia->order != ib->order) return (ia->order < ib->order) ? -1 : 1;
+	return 0;
+}
+
+
+// Load the images listed in the session index.  Returns the count or -1 if there
+// isn't a valid index.
+static int fcs_load_index(const char* session, fcs_image_t** imagesP)
+{
+	char path[FCS_MAX_PATH];
+	uint8_t hdr[FCS_INDEX_HEADER_LEN];
+	fcs_image_t img;
+	int count = 0;
+	int size = 0;
+	FILE* fp;
+	
+	snprintf(path, sizeof(path), "%s/%s", session, FCS_INDEX_NAME);
+	fp = fopen(path, "rb");
+	if (fp == NULL) return -1;
+	if ((fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr)) || (fcs_get32(hdr) != FCS_INDEX_MAGIC) ||
+	    (fcs_get16(hdr + 6) != FCS_INDEX_ENTRY_LEN))
+	{
+		fclose(fp);
+		return -1;
+	}
+	
+	memset(&img, 0, sizeof(img));
+	while (fread(img.entry, 1, FCS_INDEX_ENTRY_LEN, fp) == FCS_INDEX_ENTRY_LEN) {
+		img.seq_num = fcs_get32(img.entry);
+		img.type = fcs_get16(img.entry + 8);
+		img.container_num = fcs_get16(img.entry + 10);
+		img.offset = fcs_get32(img.entry + 12);
+		img.length = fcs_get32(img.entry + 16);
+		if (fcs_add_image(imagesP, &count, &size, &img) < 0) break;
+	}
+	fclose(fp);
+	
+	return count;
+}
+
+
+// Add the images in a container, from its index or, if it wasn't closed, by following
+// its entries
+static void fcs_scan_container(const char* session, int container_num, fcs_image_t** imagesP, int* countP, int* sizeP)
+{
+	char path[FCS_MAX_PATH];
+	uint8_t hdr[FCS_CONTAINER_HEADER_LEN];
+	uint8_t e[FCS_ENTRY_LEN];
+	fcs_image_t img;
+	uint32_t n, i;
+	uint32_t data_end;
+	uint32_t index_offset;
+	uint64_t pos;
+	FILE* fp;
+	
+	fcs_container_path(path, session, container_num);
+	fp = fopen(path, "rb");
+	if (fp == NULL) return;
+	if ((fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr)) || (fcs_get32(hdr) != FCS_CONTAINER_MAGIC)) {
+		fclose(fp);
+		return;
+	}
+	n = fcs_get32(hdr + 8);
+	data_end = fcs_get32(hdr + 12);
+	index_offset = fcs_get32(hdr + 16);
+	
+	memset(&img, 0, sizeof(img));
+	img.container_num = (uint16_t) container_num;
+	if ((index_offset != 0) && (fseeko(fp, index_offset, SEEK_SET) == 0)) {
+		for (i=0; (i<n) && (fread(e, 1, FCS_CONT_INDEX_LEN, fp) == FCS_CONT_INDEX_LEN); i++) {
+			img.offset = fcs_get32(e);
+			img.length = fcs_get32(e + 4);
+			img.seq_num = fcs_get32(e + 8);
+			img.type = fcs_get16(e + 12);
+			(void) fcs_add_image(imagesP, countP, sizeP, &img);
+		}
+	} else {
+		pos = FCS_CONTAINER_HEADER_LEN;
+		while (((pos + FCS_ENTRY_LEN) <= data_end) && (fseeko(fp, pos, SEEK_SET) == 0) &&
+		       (fread(e, 1, FCS_ENTRY_LEN, fp) == FCS_ENTRY_LEN) && (fcs_get32(e) == FCS_ENTRY_MAGIC))
+		{
+			img.offset = (uint32_t) pos;
+			img.type = fcs_get16(e + 4);
+			img.seq_num = fcs_get32(e + 8);
+			img.length = fcs_get32(e + 12);
+			(void) fcs_add_image(imagesP, countP, sizeP, &img);
+			pos += FCS_ENTRY_LEN + img.length;
+		}
+	}
+	fclose(fp);
+}
+
+
+// Find the session's images by walking its directories when there is no index
+static int fcs_scan_session(const char* session, fcs_image_t** imagesP)
+{
+	char path[FCS_MAX_PATH];
+	struct dirent* dp;
+	struct dirent* fp;
+	struct stat st;
+	fcs_image_t img;
+	DIR* dir;
+	DIR* subdir;
+	unsigned int num;
+	char ext[8];
+	int count = 0;
+	int size = 0;
+	
+	dir = opendir(session);
+	if (dir == NULL) return -1;
+	
+	memset(&img, 0, sizeof(img));
+	while ((dp = readdir(dir)) != NULL) {
+		if (sscanf(dp->d_name, "images_%u.fcs", &num) == 1) {
+			fcs_scan_container(session, (int) num, imagesP, &count, &size);
+			continue;
+		}
+		if (strncmp(dp->d_name, "group_", 6) != 0) continue;
+	
+		snprintf(path, sizeof(path), "%s/%s", session, dp->d_name);
+		subdir = opendir(path);
+		if (subdir == NULL) continue;
+		while ((fp = readdir(subdir)) != NULL) {
+			if (sscanf(fp->d_name, "img_%u.%7s", &num, ext) != 2) continue;
+			img.seq_num = num;
+			img.type = (strcmp(ext, "fcr") == 0) ? FCS_TYPE_FCR : FCS_TYPE_JSON;
+			img.container_num = FCS_NO_CONTAINER;
+			img.offset = 0;
+			fcs_image_file_path(path, session, num, img.type);
+			if (stat(path, &st) != 0) continue;
+			img.length = (uint32_t) st.st_size;
+			(void) fcs_add_image(imagesP, &count, &size, &img);
+		}
+		closedir(subdir);
+	}
+	closedir(dir);
+	
+	return count;
+}
+
+
+// Get the session's images in sequence order, from the index when there is one.  A
+// resumed session may repeat index entries for the last images written before it was
+// interrupted so only the last entry for each image is kept.
+static int fcs_get_images(const char* session, fcs_image_t** imagesP, int* from_indexP)
+{
+	int count;
+	int i, n;
+	
+	*imagesP = NULL;
+	count = fcs_load_index(session, imagesP);
+	*from_indexP = (count >= 0);
+	if (count < 0) {
+		count = fcs_scan_session(session, imagesP);
+	}
+	if (count > 0) {
+		qsort(*imagesP, count, sizeof(fcs_image_t), fcs_compare_images);
+		n = 0;
+		for (i=0; i<count; i++) {
+			if ((i < (count - 1)) && ((*imagesP)[i+1].seq_num == (*imagesP)[i].seq_num)) continue;
+			(*imagesP)[n++] = (*imagesP)[i];
+		}
+		count = n;
+	}
+	
+	return count;
+}
+
+
+// Read an image into *bufP (grown as necessary).  Returns 0 or -1.
+static int fcs_read_image(const char* session, const fcs_image_t* imgP, uint8_t** bufP, uint32_t* sizeP)
+{
+	char path[FCS_MAX_PATH];
+	uint8_t e[FCS_ENTRY_LEN];
+	uint8_t* newP;
+	off_t pos;
+	int fd;
+	int ret = -1;
+	
+	if (imgP->length > *sizeP) {
+		newP = (uint8_t*) realloc(*bufP, imgP->length);
+		if (newP == NULL) return -1;
+		*bufP = newP;
+		*sizeP = imgP->length;
+	}
+	
+	if (imgP->container_num == FCS_NO_CONTAINER) {
+		fcs_image_file_path(path, session, imgP->seq_num, imgP->type);
+		pos = 0;
+	} else {
+		fcs_container_path(path, session, imgP->container_num);
+		pos = (off_t) imgP->offset + FCS_ENTRY_LEN;
+	}
+	
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return -1;
+	if (imgP->container_num != FCS_NO_CONTAINER) {
+		if ((pread(fd, e, FCS_ENTRY_LEN, imgP->offset) != FCS_ENTRY_LEN) || (fcs_get32(e) != FCS_ENTRY_MAGIC) ||
+		    (fcs_get32(e + 8) != imgP->seq_num))
+		{
+			close(fd);
+			return -1;
+		}
+	}
+	if (pread(fd, *bufP, imgP->length, pos) == (ssize_t) imgP->length) {
+		ret = 0;
+	}
+	close(fd);
+	
+	return ret;
+}
+
+
+// Decode a json image's radiometric data, telemetry and (if jpegP isn't NULL) jpeg
+static int fcs_decode_json(uint8_t* buf, uint32_t len, uint16_t* pixels, uint16_t* telem, int* has_telemP,
+                           uint8_t** jpegP, fcs_frame_t* frameP)
+{
+	uint8_t lep_bytes[FCS_LEP_PIXELS * 2];
+	uint8_t tel_bytes[FCS_TEL_WORDS * 2];
+	const char* valP;
+	uint32_t val_len;
+	int n;
+	int x = 0, y = 0, w = FCS_LEP_WIDTH, h = FCS_LEP_HEIGHT;
+	
+	if (fcc_json_find_string((const char*) buf, len, "Time", &valP, &val_len) == 0) {
+		snprintf(frameP->time, sizeof(frameP->time), "%.*s", (int) val_len, valP);
+	}
+	if (fcc_json_find_string((const char*) buf, len, "Date", &valP, &val_len) == 0) {
+		snprintf(frameP->date, sizeof(frameP->date), "%.*s", (int) val_len, valP);
+	}
+	
+	if (fcc_json_find_string((const char*) buf, len, "jpeg", &valP, &val_len) == 0) {
+		if (jpegP != NULL) {
+			// Decoded in place in the image buffer
+			n = fcc_base64_decode(valP, val_len, (uint8_t*) valP, val_len);
+			if (n > 0) {
+				*jpegP = (uint8_t*) valP;
+				frameP->jpeg_len = (uint32_t) n;
+			}
+		} else {
+			frameP->jpeg_len = (val_len / 4) * 3;
+			if ((val_len >= 4) && (valP[val_len-1] == '=')) frameP->jpeg_len--;
+			if ((val_len >= 4) && (valP[val_len-2] == '=')) frameP->jpeg_len--;
+		}
+	}
+	
+	*has_telemP = 0;
+	if ((fcc_json_find_string((const char*) buf, len, "telemetry", &valP, &val_len) == 0) &&
+	    (fcc_base64_decode(valP, val_len, tel_bytes, sizeof(tel_bytes)) == sizeof(tel_bytes)))
+	{
+		fcc_le16_to_host(tel_bytes, telem, FCS_TEL_WORDS);
+		*has_telemP = 1;
+	}
+	
+	// Radiometric data may be limited to a region of the frame
+	if ((fcc_json_find_string((const char*) buf, len, "crop", &valP, &val_len) == 0) &&
+	    ((sscanf(valP, "%d,%d,%d,%d", &x, &y, &w, &h) != 4) || (x < 0) || (y < 0) || (w <= 0) || (h <= 0) ||
+	     (x + w > FCS_LEP_WIDTH) || (y + h > FCS_LEP_HEIGHT)))
+	{
+		return 0;
+	}
+	if ((fcc_json_find_string((const char*) buf, len, "radiometric", &valP, &val_len) == 0) &&
+	    (fcc_base64_decode(valP, val_len, lep_bytes, sizeof(lep_bytes)) == w * h * 2))
+	{
+		fcc_le16_to_host(lep_bytes, pixels, w * h);
+		fcr_expand_crop(pixels, FCS_LEP_WIDTH, FCS_LEP_HEIGHT, x, y, w, h);
+		frameP->has_lep = 1;
+	}
+	
+	return 0;
+}
+
+
+// Decode a binary image record
+static int fcs_decode_fcr(uint8_t* buf, uint32_t len, uint16_t* pixels, uint16_t* telem, int* has_telemP,
+                          uint8_t** jpegP, fcs_frame_t* frameP)
+{
+	fcr_record_t rec;
+	
+	if (fcr_parse(buf, len, &rec) != 0) return -1;
+	
+	snprintf(frameP->time, sizeof(frameP->time), "%s", rec.time);
+	snprintf(frameP->date, sizeof(frameP->date), "%s", rec.date);
+	frameP->jpeg_len = rec.jpeg_len;
+	if (jpegP != NULL) {
+		*jpegP = (uint8_t*) rec.jpegP;
+	}
+	
+	*has_telemP = 0;
+	if (rec.telem_len == FCS_TEL_WORDS * 2) {
+		fcc_le16_to_host((const uint8_t*) rec.telemP, telem, FCS_TEL_WORDS);
+		*has_telemP = 1;
+	}
+	if ((rec.lep_len != 0) && (fcr_get_lep(&rec, pixels, FCS_LEP_WIDTH, FCS_LEP_HEIGHT) == 0)) {
+		frameP->has_lep = 1;
+	}
+	
+	return 0;
+}
+
+
+// Decode one image, write its slots in the column files and get its statistics
+static void fcs_export_image(fcs_export_t* exP, int i, uint8_t** bufP, uint32_t* sizeP)
+{
+	const fcs_image_t* imgP = &exP->images[i];
+	fcs_frame_t* frameP = &exP->frames[i];
+	uint16_t pixels[FCS_LEP_PIXELS];
+	uint16_t telem[FCS_TEL_WORDS];
+	uint8_t out[FCS_LEP_PIXELS * 2];
+	uint8_t* jpegP = NULL;
+	char path[FCS_MAX_PATH];
+	int has_telem;
+	int scale;
+	int ret;
+	int j;
+	int32_t c100;
+	int64_t sum = 0;
+	double sq = 0;
+	double mean;
+	FILE* fp;
+	
+	memset(frameP, 0, sizeof(fcs_frame_t));
+	if (fcs_read_image(exP->session, imgP, bufP, sizeP) != 0) return;
+	
+	if (imgP->type == FCS_TYPE_FCR) {
+		ret = fcs_decode_fcr(*bufP, imgP->length, pixels, telem, &has_telem, exP->extract_jpeg ? &jpegP : NULL, frameP);
+	} else {
+		ret = fcs_decode_json(*bufP, imgP->length, pixels, telem, &has_telem, exP->extract_jpeg ? &jpegP : NULL, frameP);
+	}
+	if (ret != 0) return;
+	frameP->ok = 1;
+	
+	if (has_telem) {
+		for (j=0; j<FCS_TEL_WORDS; j++) {
+			fcs_put16(&out[j*2], telem[j]);
+		}
+		(void) pwrite(exP->tel_fd, out, FCS_TEL_WORDS * 2, (off_t) i * FCS_TEL_WORDS * 2);
+	}
+	
+	if (frameP->has_lep) {
+		// Same rule as fcr_get_tlin_scale (telem is already in host order)
+		scale = (has_telem && (telem[FCR_TEL_TLIN_RES] == 0)) ? 10 : 1;
+	
+		// Frames are stored in K * 100 whatever the Lepton resolution
+		frameP->min_c100 = 0x7FFFFFFF;
+		frameP->max_c100 = -0x7FFFFFFF;
+		for (j=0; j<FCS_LEP_PIXELS; j++) {
+			fcs_put16(&out[j*2], (uint16_t) (pixels[j] * scale));
+			c100 = (int32_t) pixels[j] * scale - FCR_K100_0C;
+			if (c100 < frameP->min_c100) frameP->min_c100 = c100;
+			if (c100 > frameP->max_c100) frameP->max_c100 = c100;
+			sum += c100;
+		}
+		mean = (double) sum / FCS_LEP_PIXELS;
+		for (j=0; j<FCS_LEP_PIXELS; j++) {
+			c100 = (int32_t) pixels[j] * scale - FCR_K100_0C;
+			sq += (c100 - mean) * (c100 - mean);
+		}
+		frameP->mean_c100 = (int32_t) lround(mean);
+		frameP->stddev_c100 = (int32_t) lround(sqrt(sq / FCS_LEP_PIXELS));
+		(void) pwrite(exP->lep_fd, out, FCS_LEP_PIXELS * 2, (off_t) i * FCS_LEP_PIXELS * 2);
+	}
+	
+	if ((jpegP != NULL) && (frameP->jpeg_len != 0)) {
+		snprintf(path, sizeof(path), "%s/jpeg/img_%05u.jpg", exP->out_dir, imgP->seq_num);
+		fp = fopen(path, "wb");
+		if (fp != NULL) {
+			fwrite(jpegP, 1, frameP->jpeg_len, fp);
+			fclose(fp);
+		}
+	}
+}
+
+
+static void* fcs_export_worker(void* arg)
+{
+	fcs_export_t* exP = (fcs_export_t*) arg;
+	uint8_t* bufP = NULL;
+	uint32_t size = 0;
+	int i;
+	
+	while (1) {
+		pthread_mutex_lock(&exP->mutex);
+		i = exP->next++;
+		pthread_mutex_unlock(&exP->mutex);
+		if (i >= exP->count) break;
+	
+		fcs_export_image(exP, i, &bufP, &size);
+	}
+	free(bufP);
+	
+	return NULL;
+}
+
+
+static int fcs_export(const char* session, const char* out_dir, int threads, int extract_jpeg)
+{
+	fcs_export_t ex;
+	pthread_t tids[FCS_MAX_THREADS];
+	char path[FCS_MAX_PATH];
+	int from_index;
+	int failed = 0;
+	int i;
+	FILE* fp;
+	
+	memset(&ex, 0, sizeof(ex));
+	ex.session = session;
+	ex.out_dir = out_dir;
+	ex.extract_jpeg = extract_jpeg;
+	ex.count = fcs_get_images(session, &ex.images, &from_index);
+	if (ex.count <= 0) {
+		fprintf(stderr, "No images found in %s\n", session);
+		return -1;
+	}
+	printf("%d images (%s)\n", ex.count, from_index ? "from the index" : "from the session directories");
+	
+	ex.frames = (fcs_frame_t*) calloc(ex.count, sizeof(fcs_frame_t));
+	if (ex.frames == NULL) return -1;
+	
+	(void) mkdir(out_dir, 0777);
+	if (extract_jpeg) {
+		snprintf(path, sizeof(path), "%s/jpeg", out_dir);
+		(void) mkdir(path, 0777);
+	}
+	snprintf(path, sizeof(path), "%s/radiometric.u16", out_dir);
+	ex.lep_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	snprintf(path, sizeof(path), "%s/telemetry.u16", out_dir);
+	ex.tel_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if ((ex.lep_fd < 0) || (ex.tel_fd < 0)) {
+		fprintf(stderr, "Could not create the output files in %s\n", out_dir);
+		return -1;
+	}
+	
+	// Every image has a slot (frames without data are left zero)
+	if ((ftruncate(ex.lep_fd, (off_t) ex.count * FCS_LEP_PIXELS * 2) != 0) ||
+	    (ftruncate(ex.tel_fd, (off_t) ex.count * FCS_TEL_WORDS * 2) != 0))
+	{
+		fprintf(stderr, "Could not size the output files\n");
+		return -1;
+	}
+	
+	pthread_mutex_init(&ex.mutex, NULL);
+	if (threads > FCS_MAX_THREADS) threads = FCS_MAX_THREADS;
+	for (i=0; i<threads; i++) {
+		if (pthread_create(&tids[i], NULL, fcs_export_worker, &ex) != 0) break;
+	}
+	threads = i;
+	if (threads == 0) {
+		fcs_export_worker(&ex);
+	}
+	for (i=0; i<threads; i++) {
+		pthread_join(tids[i], NULL);
+	}
+	pthread_mutex_destroy(&ex.mutex);
+	close(ex.lep_fd);
+	close(ex.tel_fd);
+	
+	snprintf(path, sizeof(path), "%s/frames.csv", out_dir);
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		fprintf(stderr, "Could not create %s\n", path);
+		return -1;
+	}
+	fprintf(fp, "slot,seq_num,epoch_sec,time,date,type,ok,jpeg_len,has_lep,min_c100,max_c100,mean_c100,stddev_c100\n");
+	for (i=0; i<ex.count; i++) {
+		fprintf(fp, "%d,%u,%u,%s,%s,%s,%d,%u,%d,%d,%d,%d,%d\n", i, ex.images[i].seq_num,
+		        fcs_get32(ex.images[i].entry + 4), ex.frames[i].time, ex.frames[i].date,
+		        (ex.images[i].type == FCS_TYPE_FCR) ? "fcr" : "json", ex.frames[i].ok, ex.frames[i].jpeg_len,
+		        ex.frames[i].has_lep, ex.frames[i].min_c100, ex.frames[i].max_c100, ex.frames[i].mean_c100,
+		        ex.frames[i].stddev_c100);
+		if (!ex.frames[i].ok) failed++;
+	}
+	fclose(fp);
+	
+	printf("%d images exported to %s (%d could not be read)\n", ex.count - failed, out_dir, failed);
+	free(ex.images);
+	free(ex.frames);
+	return 0;
+}
+
+
+// Write the session index for images (replacing the index atomically)
+static int fcs_write_index(const char* session, fcs_image_t* images, int count)
+{
+	char path[FCS_MAX_PATH];
+	char tmp_path[FCS_MAX_PATH];
+	uint8_t hdr[FCS_INDEX_HEADER_LEN];
+	uint8_t* e;
+	int i;
+	FILE* fp;
+	
+	snprintf(path, sizeof(path), "%s/%s", session, FCS_INDEX_NAME);
+	snprintf(tmp_path, sizeof(tmp_path), "%s/%s.tmp", session, FCS_INDEX_NAME);
+	fp = fopen(tmp_path, "wb");
+	if (fp == NULL) return -1;
+	
+	memset(hdr, 0, sizeof(hdr));
+	fcs_put32(hdr, FCS_INDEX_MAGIC);
+	fcs_put16(hdr + 4, FCS_INDEX_VERSION);
+	fcs_put16(hdr + 6, FCS_INDEX_ENTRY_LEN);
+	fwrite(hdr, 1, sizeof(hdr), fp);
+	
+	for (i=0; i<count; i++) {
+		e = images[i].entry;
+		fcs_put32(e, images[i].seq_num);
+		fcs_put16(e + 8, images[i].type);
+		fcs_put16(e + 10, images[i].container_num);
+		fcs_put32(e + 12, images[i].offset);
+		fcs_put32(e + 16, images[i].length);
+		fwrite(e, 1, FCS_INDEX_ENTRY_LEN, fp);
+	}
+	
+	if ((fflush(fp) != 0) || ferror(fp)) {
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	
+	return rename(tmp_path, path);
+}
+
+
+// Move the session's image files into new containers after any it already has
+static int fcs_pack(const char* session, int delete_files)
+{
+	char path[FCS_MAX_PATH];
+	uint8_t hdr[FCS_CONTAINER_HEADER_LEN];
+	uint8_t e[FCS_ENTRY_LEN];
+	uint8_t* bufP = NULL;
+	uint8_t* cidxP;
+	uint32_t size = 0;
+	uint32_t pos = 0;
+	uint32_t n = 0;
+	fcs_image_t* images;
+	int from_index;
+	int count;
+	int cont_num = 0;
+	int first_cont_num;
+	struct stat st;
+	int packed = 0;
+	int i;
+	FILE* fp = NULL;
+	
+	count = fcs_get_images(session, &images, &from_index);
+	if (count <= 0) {
+		fprintf(stderr, "No images found in %s\n", session);
+		return -1;
+	}
+	for (i=0; i<count; i++) {
+		if ((images[i].container_num != FCS_NO_CONTAINER) && (images[i].container_num >= cont_num)) {
+			cont_num = images[i].container_num + 1;
+		}
+	}
+	fcs_container_path(path, session, cont_num);
+	while (stat(path, &st) == 0) {
+		fcs_container_path(path, session, ++cont_num);
+	}
+	first_cont_num = cont_num;
+	cidxP = (uint8_t*) malloc(FCS_CONTAINER_MAX_RECORDS * FCS_CONT_INDEX_LEN);
+	if (cidxP == NULL) return -1;
+	
+	for (i=0; i<=count; i++) {
+		// Close a full container or the last one
+		if ((fp != NULL) && ((i == count) || (n == FCS_CONTAINER_MAX_RECORDS))) {
+			fwrite(cidxP, FCS_CONT_INDEX_LEN, n, fp);
+			memset(hdr, 0, sizeof(hdr));
+			fcs_put32(hdr, FCS_CONTAINER_MAGIC);
+			fcs_put16(hdr + 4, FCS_CONTAINER_VERSION);
+			fcs_put16(hdr + 6, FCS_CONTAINER_HEADER_LEN);
+			fcs_put32(hdr + 8, n);
+			fcs_put32(hdr + 12, pos);
+			fcs_put32(hdr + 16, pos);
+			fseeko(fp, 0, SEEK_SET);
+			fwrite(hdr, 1, sizeof(hdr), fp);
+			if (fclose(fp) != 0) {
+				fprintf(stderr, "Could not write container %d\n", cont_num);
+				return -1;
+			}
+			fp = NULL;
+			cont_num++;
+		}
+		if (i == count) break;
+		if (images[i].container_num != FCS_NO_CONTAINER) continue;
+	
+		if (fcs_read_image(session, &images[i], &bufP, &size) != 0) {
+			fprintf(stderr, "Could not read image %u - left as a file\n", images[i].seq_num);
+			continue;
+		}
+	
+		if (fp == NULL) {
+			fcs_container_path(path, session, cont_num);
+			fp = fopen(path, "wb");
+			if (fp == NULL) {
+				fprintf(stderr, "Could not create %s\n", path);
+				return -1;
+			}
+			memset(hdr, 0, sizeof(hdr));
+			fwrite(hdr, 1, sizeof(hdr), fp);
+			pos = FCS_CONTAINER_HEADER_LEN;
+			n = 0;
+		}
+	
+		fcs_put32(e, FCS_ENTRY_MAGIC);
+		fcs_put16(e + 4, images[i].type);
+		fcs_put16(e + 6, 0);
+		fcs_put32(e + 8, images[i].seq_num);
+		fcs_put32(e + 12, images[i].length);
+		fwrite(e, 1, FCS_ENTRY_LEN, fp);
+		fwrite(bufP, 1, images[i].length, fp);
+	
+		fcs_put32(cidxP + n * FCS_CONT_INDEX_LEN, pos);
+		fcs_put32(cidxP + n * FCS_CONT_INDEX_LEN + 4, images[i].length);
+		fcs_put32(cidxP + n * FCS_CONT_INDEX_LEN + 8, images[i].seq_num);
+		fcs_put16(cidxP + n * FCS_CONT_INDEX_LEN + 12, images[i].type);
+		fcs_put16(cidxP + n * FCS_CONT_INDEX_LEN + 14, 0);
+		n++;
+	
+		images[i].container_num = (uint16_t) cont_num;
+		images[i].offset = pos;
+		pos += FCS_ENTRY_LEN + images[i].length;
+		packed++;
+	}
+	free(bufP);
+	free(cidxP);
+	
+	// The files are only deleted once the new index points at the containers
+	if (fcs_write_index(session, images, count) != 0) {
+		fprintf(stderr, "Could not write the session index\n");
+		return -1;
+	}
+	if (delete_files) {
+		for (i=0; i<count; i++) {
+			if ((images[i].container_num != FCS_NO_CONTAINER) && (images[i].container_num >= first_cont_num)) {
+				fcs_image_file_path(path, session, images[i].seq_num, images[i].type);
+				(void) unlink(path);
+			}
+		}
+	}
+	
+	printf("%d images packed\n", packed);
+	free(images);
+	return 0;
+}
+
+
+// Move the session's container images to image files
+static int fcs_unpack(const char* session, int delete_files)
+{
+	char path[FCS_MAX_PATH];
+	uint8_t* bufP = NULL;
+	uint8_t used[FCS_NO_CONTAINER + 1];
+	uint32_t size = 0;
+	fcs_image_t* images;
+	int from_index;
+	int count;
+	int unpacked = 0;
+	int failed = 0;
+	int i;
+	FILE* fp;
+	
+	count = fcs_get_images(session, &images, &from_index);
+	if (count <= 0) {
+		fprintf(stderr, "No images found in %s\n", session);
+		return -1;
+	}
+	
+	memset(used, 0, sizeof(used));
+	for (i=0; i<count; i++) {
+		if (images[i].container_num == FCS_NO_CONTAINER) continue;
+	
+		if (fcs_read_image(session, &images[i], &bufP, &size) != 0) {
+			fprintf(stderr, "Could not read image %u from container %u\n", images[i].seq_num, images[i].container_num);
+			used[images[i].container_num] = 2;
+			failed++;
+			continue;
+		}
+		if (used[images[i].container_num] == 0) {
+			used[images[i].container_num] = 1;
+		}
+	
+		snprintf(path, sizeof(path), "%s/group_%04u", session, images[i].seq_num / FCS_FILES_PER_SUBDIR);
+		(void) mkdir(path, 0777);
+		fcs_image_file_path(path, session, images[i].seq_num, images[i].type);
+		fp = fopen(path, "wb");
+		if ((fp == NULL) || (fwrite(bufP, 1, images[i].length, fp) != images[i].length)) {
+			fprintf(stderr, "Could not write %s\n", path);
+			if (fp != NULL) fclose(fp);
+			used[images[i].container_num] = 2;
+			failed++;
+			continue;
+		}
+		fclose(fp);
+	
+		images[i].container_num = FCS_NO_CONTAINER;
+		images[i].offset = 0;
+		unpacked++;
+	}
+	free(bufP);
+	
+	if (fcs_write_index(session, images, count) != 0) {
+		fprintf(stderr, "Could not write the session index\n");
+		return -1;
+	}
+	
+	// A container is only deleted if every image in it was moved
+	if (delete_files) {
+		for (i=0; i<FCS_NO_CONTAINER; i++) {
+			if (used[i] == 1) {
+				fcs_container_path(path, session, i);
+				(void) unlink(path);
+			}
+		}
+	}
+	
+	printf("%d images unpacked (%d failed)\n", unpacked, failed);
+	free(images);
+	return 0;
+}
+
+
+static void fcs_usage()
+{
+	fprintf(stderr, "usage: fc_session export [-j threads] [-x] <session dir> <output dir>\n");
+	fprintf(stderr, "       fc_session pack [-d] <session dir>\n");
+	fprintf(stderr, "       fc_session unpack [-d] <session dir>\n");
+}
+
+
+int main(int argc, char** argv)
+{
+	const char* cmd;
+	int threads;
+	int extract_jpeg = 0;
+	int delete_files = 0;
+	int c;
+	
+	if (argc < 3) {
+		fcs_usage();
+		return 1;
+	}
+	cmd = argv[1];
+	argc--;
+	argv++;
+	
+	threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1) threads = 1;
+	while ((c = getopt(argc, argv, "j:xd")) != -1) {
+		switch (c) {
+			case 'j': threads = atoi(optarg); break;
+			case 'x': extract_jpeg = 1; break;
+			case 'd': delete_files = 1; break;
+			default:  fcs_usage(); return 1;
+		}
+	}
+	
+	if ((strcmp(cmd, "export") == 0) && ((argc - optind) == 2)) {
+		return (fcs_export(argv[optind], argv[optind+1], threads, extract_jpeg) == 0) ? 0 : 1;
+	}
+	if ((strcmp(cmd, "pack") == 0) && ((argc - optind) == 1)) {
+		return (fcs_pack(argv[optind], delete_files) == 0) ? 0 : 1;
+	}
+	if ((strcmp(cmd, "unpack") == 0) && ((argc - optind) == 1)) {
+		return (fcs_unpack(argv[optind], delete_files) == 0) ? 0 : 1;
+	}
+	
+	fcs_usage();
+	return 1;
+}
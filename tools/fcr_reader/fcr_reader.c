@@ -0,0 +1,347 @@
+/*
+ * Host reader for firecam binary image record (.fcr) files
+ *
+ * A record is a fixed little-endian header, type-length-value metadata items and
+ * then the jpeg, radiometric and telemetry payloads in that order.  The radiometric
+ * payload may be compressed (see firmware/components/cmd/include/radcodec.h).
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "fcr_reader.h"
+#include <string.h>
+
+
+//
+// FCR internal functions
+//
+static uint16_t fcr_get16(const uint8_t* p)
+{
+	return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+
+static uint32_t fcr_get32(const uint8_t* p)
+{
+	return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+
+static int64_t fcr_get64(const uint8_t* p)
+{
+	return (int64_t) ((uint64_t) fcr_get32(p) | ((uint64_t) fcr_get32(p + 4) << 32));
+}
+
+
+static float fcr_get_float(const uint8_t* p, uint8_t len)
+{
+	uint32_t u;
+	float f;
+	
+	if (len != sizeof(float)) return 0;
+	u = fcr_get32(p);
+	memcpy(&f, &u, sizeof(float));
+	return f;
+}
+
+
+static void fcr_get_string(char* dst, const uint8_t* p, uint8_t len)
+{
+	if (len > FCR_MAX_STRING_LEN) len = FCR_MAX_STRING_LEN;
+	memcpy(dst, p, len);
+	dst[len] = 0;
+}
+
+
+static void fcr_get_stats(fcr_record_t* rec, const uint8_t* p, uint8_t len)
+{
+	fcr_stats_t* s;
+	
+	if ((len != 33) || (p[0] >= FCR_MAX_STATS)) return;
+	s = &rec->stats[p[0]];
+	s->valid = 1;
+	s->x = p[1];
+	s->y = p[2];
+	s->w = p[3];
+	s->h = p[4];
+	s->min = fcr_get32(p + 5);
+	s->max = fcr_get32(p + 9);
+	s->mean = fcr_get32(p + 13);
+	s->stddev = fcr_get32(p + 17);
+	s->p10 = fcr_get32(p + 21);
+	s->p50 = fcr_get32(p + 25);
+	s->p90 = fcr_get32(p + 29);
+}
+
+
+static void fcr_get_frame_stats(fcr_record_t* rec, const uint8_t* p, uint8_t len)
+{
+	fcr_frame_stats_t* f = &rec->frames;
+	
+	if (len != 40) return;
+	f->valid = 1;
+	f->requested = fcr_get32(p);
+	f->cam_received = fcr_get32(p + 4);
+	f->lep_received = fcr_get32(p + 8);
+	f->cam_late = fcr_get32(p + 12);
+	f->lep_late = fcr_get32(p + 16);
+	f->gui_skipped = fcr_get32(p + 20);
+	f->file_skipped = fcr_get32(p + 24);
+	f->dropped = fcr_get32(p + 28);
+	f->cmd_sent = fcr_get32(p + 32);
+	f->cam_msec = fcr_get16(p + 36);
+	f->lep_msec = fcr_get16(p + 38);
+}
+
+
+
+//
+// FCR API
+//
+int fcr_parse(const uint8_t* buf, uint32_t len, fcr_record_t* rec)
+{
+	uint32_t fixed_len;
+	uint32_t header_len;
+	uint16_t version;
+	uint32_t i;
+	uint8_t t, l;
+	const uint8_t* p;
+	
+	memset(rec, 0, sizeof(fcr_record_t));
+	
+	// Fixed header
+	if (len < FCR_V1_HEADER_LEN) return -1;
+	if (fcr_get32(buf) != FCR_MAGIC) return -1;
+	version = fcr_get16(buf + 4);
+	if ((version < 1) || (version > FCR_VERSION)) return -1;
+	fixed_len = (version == 1) ? FCR_V1_HEADER_LEN : FCR_FIXED_HEADER_LEN;
+	if (len < fixed_len) return -1;
+	header_len = fcr_get16(buf + 6);
+	rec->seq_num = fcr_get32(buf + 8);
+	rec->jpeg_len = fcr_get32(buf + 12);
+	rec->lep_len = fcr_get32(buf + 16);
+	rec->telem_len = fcr_get32(buf + 20);
+	rec->lep_codec = (version == 1) ? FCR_LEP_CODEC_RAW : fcr_get16(buf + 24);
+	if ((header_len < fixed_len) || (header_len > len)) return -1;
+	if ((uint64_t) header_len + rec->jpeg_len + rec->lep_len + rec->telem_len > len) return -1;
+	
+	// Metadata
+	i = fixed_len;
+	while (i + 2 <= header_len) {
+		t = buf[i];
+		l = buf[i+1];
+		p = buf + i + 2;
+		if (i + 2 + l > header_len) return -1;
+		switch (t) {
+			case FCR_MD_CAMERA:     fcr_get_string(rec->camera, p, l); break;
+			case FCR_MD_VERSION:    fcr_get_string(rec->version, p, l); break;
+			case FCR_MD_TIME:       fcr_get_string(rec->time, p, l); break;
+			case FCR_MD_DATE:       fcr_get_string(rec->date, p, l); break;
+			case FCR_MD_BATTERY:    rec->battery = fcr_get_float(p, l); break;
+			case FCR_MD_CHARGE:     fcr_get_string(rec->charge, p, l); break;
+			case FCR_MD_FPA_TEMP:   rec->fpa_temp = fcr_get_float(p, l); rec->has_lep = 1; break;
+			case FCR_MD_AUX_TEMP:   rec->aux_temp = fcr_get_float(p, l); break;
+			case FCR_MD_LENS_TEMP:  rec->lens_temp = fcr_get_float(p, l); break;
+			case FCR_MD_GAIN_MODE:  fcr_get_string(rec->gain_mode, p, l); break;
+			case FCR_MD_RESOLUTION: fcr_get_string(rec->resolution, p, l); break;
+			case FCR_MD_STATS:      fcr_get_stats(rec, p, l); break;
+			case FCR_MD_CAM_TIME:   fcr_get_string(rec->cam_time, p, l); break;
+			case FCR_MD_LEP_TIME:   fcr_get_string(rec->lep_time, p, l); break;
+			case FCR_MD_FRAME_STATS: fcr_get_frame_stats(rec, p, l); break;
+			case FCR_MD_CAM_SEQ:
+				if (l == 16) {
+					rec->has_cam_seq = 1;
+					rec->cam_capture = fcr_get32(p);
+					rec->cam_usec = fcr_get64(p + 4);
+					rec->cam_age_msec = fcr_get32(p + 12);
+				}
+				break;
+			case FCR_MD_LEP_SEQ:
+				if (l == 16) {
+					rec->has_lep_seq = 1;
+					rec->lep_frame_count = fcr_get32(p);
+					rec->lep_usec = fcr_get64(p + 4);
+					rec->lep_age_msec = fcr_get32(p + 12);
+				}
+				break;
+			case FCR_MD_CROP:
+				if (l == 4) {
+					rec->has_crop = 1;
+					rec->crop_x = p[0];
+					rec->crop_y = p[1];
+					rec->crop_w = p[2];
+					rec->crop_h = p[3];
+				}
+				break;
+		}
+		i += 2 + l;
+	}
+	
+	// Payloads
+	p = buf + header_len;
+	if (rec->jpeg_len != 0) rec->jpegP = p;
+	p += rec->jpeg_len;
+	if (rec->lep_len != 0) rec->lepP = (const uint16_t*) p;
+	p += rec->lep_len;
+	if (rec->telem_len != 0) rec->telemP = (const uint16_t*) p;
+	
+	return 0;
+}
+
+
+static int fcr_decode_lep(const fcr_record_t* rec, uint16_t* dst, int width, int height)
+{
+	const uint8_t* p;
+	const uint8_t* endP;
+	uint16_t* rowP;
+	uint16_t* prevP;
+	uint32_t n, num;
+	int run;
+	int32_t a, b, c, pred;
+	uint16_t zz;
+	uint16_t r;
+	int w;
+	
+	num = (uint32_t) width * height;
+	if (rec->lepP == NULL) return -1;
+	p = (const uint8_t*) rec->lepP;
+	
+	if (rec->lep_codec == FCR_LEP_CODEC_RAW) {
+		if (rec->lep_len != num * 2) return -1;
+		for (n=0; n<num; n++) {
+			dst[n] = fcr_get16(p + n*2);
+		}
+		return 0;
+	}
+	
+	if (rec->lep_codec != FCR_LEP_CODEC_RADZ) return -1;
+	
+	// Reverse of radcodec_encode
+	endP = p + rec->lep_len;
+	run = 0;
+	for (n=0; n<num; n++) {
+		if (run > 0) {
+			zz = 0;
+			run--;
+		} else {
+			if (p >= endP) return -1;
+			if (*p < 0x80) {
+				zz = *p++;
+			} else if (*p < 0xC0) {
+				if (p + 2 > endP) return -1;
+				zz = (uint16_t) (((p[0] & 0x3F) << 8) | p[1]);
+				p += 2;
+			} else if (*p < 0xE0) {
+				run = *p++ & 0x1F;
+				zz = 0;
+			} else {
+				if ((*p != 0xE0) || (p + 3 > endP)) return -1;
+				zz = fcr_get16(p + 1);
+				p += 3;
+			}
+		}
+		
+		// Predict from the already decoded neighbors
+		w = n % width;
+		rowP = &dst[n - w];
+		prevP = (n < (uint32_t) width) ? NULL : rowP - width;
+		if (prevP == NULL) {
+			pred = (w == 0) ? 0 : rowP[w-1];
+		} else if (w == 0) {
+			pred = prevP[0];
+		} else {
+			a = rowP[w-1];
+			b = prevP[w];
+			c = prevP[w-1];
+			if (c >= ((a > b) ? a : b)) {
+				pred = (a < b) ? a : b;
+			} else if (c <= ((a < b) ? a : b)) {
+				pred = (a > b) ? a : b;
+			} else {
+				pred = a + b - c;
+			}
+		}
+		
+		r = (uint16_t) ((zz >> 1) ^ (uint16_t) -(int16_t) (zz & 1));
+		dst[n] = (uint16_t) (pred + r);
+	}
+	
+	return (run == 0) && (p == endP) ? 0 : -1;
+}
+
+
+int fcr_get_lep(const fcr_record_t* rec, uint16_t* dst, int width, int height)
+{
+	if (!rec->has_crop) {
+		return fcr_decode_lep(rec, dst, width, height);
+	}
+	
+	if ((rec->crop_w == 0) || (rec->crop_h == 0) ||
+	    (rec->crop_x + rec->crop_w > width) || (rec->crop_y + rec->crop_h > height))
+	{
+		return -1;
+	}
+	if (fcr_decode_lep(rec, dst, rec->crop_w, rec->crop_h) != 0) return -1;
+	fcr_expand_crop(dst, width, height, rec->crop_x, rec->crop_y, rec->crop_w, rec->crop_h);
+	return 0;
+}
+
+
+void fcr_expand_crop(uint16_t* buf, int width, int height, int x, int y, int w, int h)
+{
+	uint16_t min_val = 0xFFFF;
+	int i, j;
+	
+	for (i=0; i<w*h; i++) {
+		if (buf[i] < min_val) min_val = buf[i];
+	}
+	
+	// From the last row so rows aren't overwritten before they are moved
+	for (i=h-1; i>=0; i--) {
+		memmove(buf + (y + i) * width + x, buf + i * w, w * 2);
+	}
+	
+	for (i=0; i<height; i++) {
+		for (j=0; j<width; j++) {
+			if ((i < y) || (i >= y + h) || (j < x) || (j >= x + w)) {
+				buf[i * width + j] = min_val;
+			}
+		}
+	}
+}
+
+
+int fcr_get_tlin_scale(const fcr_record_t* rec)
+{
+	const uint8_t* p;
+	
+	if ((rec->telemP == NULL) || (rec->telem_len < (FCR_TEL_TLIN_RES + 1) * 2)) return 1;
+	
+	p = (const uint8_t*) rec->telemP;
+	return (fcr_get16(p + FCR_TEL_TLIN_RES * 2) == 0) ? 10 : 1;
+}
+
+
+void fcr_pixels_to_c100(const uint16_t* src, int32_t* dst, int n, int scale)
+{
+	int i;
+	
+	for (i=0; i<n; i++) {
+		dst[i] = ((int32_t) src[i] * scale) - FCR_K100_0C;
+	}
+}
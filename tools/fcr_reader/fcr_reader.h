@@ -0,0 +1,170 @@
+/*
+ * Host reader for firecam binary image record (.fcr) files
+ *
+ * Copyright 2020 Dan Julio
+ *
+ * This file is part of firecam.
+ *
+ * firecam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * firecam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with firecam.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef FCR_READER_H
+#define FCR_READER_H
+
+#include <stdint.h>
+
+
+//
+// FCR Constants (must match firmware/components/cmd/include/binrec_utilities.h)
+//
+#define FCR_MAGIC            0x52494346   /* "FCIR" */
+#define FCR_VERSION          2
+#define FCR_V1_HEADER_LEN    24
+#define FCR_FIXED_HEADER_LEN 28
+
+#define FCR_LEP_CODEC_RAW    0
+#define FCR_LEP_CODEC_RADZ   1
+
+#define FCR_MD_CAMERA        0x01
+#define FCR_MD_VERSION       0x02
+#define FCR_MD_TIME          0x03
+#define FCR_MD_DATE          0x04
+#define FCR_MD_BATTERY       0x05
+#define FCR_MD_CHARGE        0x06
+#define FCR_MD_FPA_TEMP      0x07
+#define FCR_MD_AUX_TEMP      0x08
+#define FCR_MD_LENS_TEMP     0x09
+#define FCR_MD_GAIN_MODE     0x0A
+#define FCR_MD_RESOLUTION    0x0B
+#define FCR_MD_STATS         0x0C
+#define FCR_MD_CAM_TIME      0x0D
+#define FCR_MD_LEP_TIME      0x0E
+#define FCR_MD_FRAME_STATS   0x0F
+#define FCR_MD_AGE           0x10
+#define FCR_MD_CROP          0x11
+#define FCR_MD_CAM_SEQ       0x12
+#define FCR_MD_LEP_SEQ       0x13
+
+#define FCR_NO_FRAME_COUNT   0xFFFFFFFF   /* Lepton frame counter of a frame without telemetry */
+
+#define FCR_MAX_STATS        3            /* Frame plus regions of interest */
+
+#define FCR_MAX_STRING_LEN   64
+
+#define FCR_FRAME_LATE       0xFFFF       /* Arrival time of an image not received */
+
+// Radiometry (must match firmware/components/lepton/include/lepton_utilities.h).
+// Pixels are in K * 100 or, when telemetry word FCR_TEL_TLIN_RES is 0, K * 10.
+#define FCR_TEL_TLIN_RES     209
+#define FCR_K100_0C          27315
+
+
+//
+// FCR typedefs
+//
+typedef struct {
+	int valid;
+	uint8_t x, y, w, h;            // Region in Lepton pixels (entry 0 is the full frame)
+	uint32_t min;                  // Values are in K * 100
+	uint32_t max;
+	uint32_t mean;
+	uint32_t stddev;
+	uint32_t p10;
+	uint32_t p50;
+	uint32_t p90;
+} fcr_stats_t;
+
+typedef struct {
+	int valid;
+	uint32_t requested;            // One second image periods since the camera started
+	uint32_t cam_received;         // Images received within their period
+	uint32_t lep_received;
+	uint32_t cam_late;             // Periods without the image
+	uint32_t lep_late;
+	uint32_t gui_skipped;          // Images not displayed
+	uint32_t file_skipped;         // Images not recorded because the card was behind
+	uint32_t dropped;              // Periods not processed
+	uint32_t cmd_sent;             // Images sent to remote clients
+	uint16_t cam_msec;             // Arrival in the last period (mSec) or FCR_FRAME_LATE
+	uint16_t lep_msec;
+} fcr_frame_stats_t;
+
+typedef struct {
+	uint32_t seq_num;
+	
+	// Metadata (strings are empty and has_lep is 0 if not present)
+	char camera[FCR_MAX_STRING_LEN+1];
+	char version[FCR_MAX_STRING_LEN+1];
+	char time[FCR_MAX_STRING_LEN+1];
+	char date[FCR_MAX_STRING_LEN+1];
+	float battery;
+	char charge[FCR_MAX_STRING_LEN+1];
+	char cam_time[FCR_MAX_STRING_LEN+1];   // Capture times "H:MM:SS.mmm"
+	char lep_time[FCR_MAX_STRING_LEN+1];
+	int has_lep;
+	float fpa_temp;
+	float aux_temp;
+	float lens_temp;
+	char gain_mode[FCR_MAX_STRING_LEN+1];
+	char resolution[FCR_MAX_STRING_LEN+1];
+	fcr_stats_t stats[FCR_MAX_STATS];
+	fcr_frame_stats_t frames;      // Image pipeline accounting (valid is 0 in older files)
+	int has_crop;                  // Radiometric data is only the crop_w x crop_h region
+	uint8_t crop_x, crop_y, crop_w, crop_h;
+	int has_cam_seq;               // Image sequence and timing (0 in older files)
+	uint32_t cam_capture;          // ArduCAM image number since the camera started
+	int64_t cam_usec;              // Capture time in uSec since the camera started
+	uint32_t cam_age_msec;         // Capture to encode time
+	int has_lep_seq;
+	uint32_t lep_frame_count;      // Lepton telemetry frame counter or FCR_NO_FRAME_COUNT
+	int64_t lep_usec;
+	uint32_t lep_age_msec;
+	
+	// Payloads point into the caller's file buffer (NULL with a zero length if absent)
+	const uint8_t* jpegP;
+	uint32_t jpeg_len;
+	const uint16_t* lepP;          // Radiometric data encoded as lep_codec
+	uint32_t lep_len;              // Bytes
+	int lep_codec;                 // FCR_LEP_CODEC_*
+	const uint16_t* telemP;        // Little-endian 16-bit telemetry words
+	uint32_t telem_len;            // Bytes
+} fcr_record_t;
+
+
+//
+// FCR API
+//
+
+// Parse a complete file loaded into buf.  Returns 0 on success, -1 if the file is
+// not a valid record.  Unknown metadata types are skipped.
+int fcr_parse(const uint8_t* buf, uint32_t len, fcr_record_t* rec);
+
+// Load dst with the width x height radiometric pixels of a parsed record, decompressing
+// them if necessary.  A cropped record's region is expanded with fcr_expand_crop.
+// Returns 0 on success, -1 if the data is missing or corrupt.
+int fcr_get_lep(const fcr_record_t* rec, uint16_t* dst, int width, int height);
+
+// Expand the w x h region at the start of buf in place into a width x height frame with
+// the region at x, y.  Pixels outside the region are set to its minimum.
+void fcr_expand_crop(uint16_t* buf, int width, int height, int x, int y, int w, int h);
+
+// Return the K * 100 units per radiometric pixel count of a parsed record (1 for
+// 0.01 K resolution or 10 for 0.1 K resolution, 1 if there is no telemetry).
+int fcr_get_tlin_scale(const fcr_record_t* rec);
+
+// Convert n radiometric pixels from fcr_get_lep to C * 100 using the scale from
+// fcr_get_tlin_scale.
+void fcr_pixels_to_c100(const uint16_t* src, int32_t* dst, int n, int scale);
+
+#endif /* FCR_READER_H */